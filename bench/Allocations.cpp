@@ -0,0 +1,51 @@
+#include <stdlib.h>  // for malloc, free
+#include <atomic>    // for atomic, memory_order_relaxed
+#include <new>       // for bad_alloc, nothrow_t
+
+#include "Bench.h"  // for allocations
+
+// Counts every operator new of the process, bell's and civetweb's C++ side.
+// malloc() from C code isn't seen
+static std::atomic<uint64_t> allocationCount = 0;
+
+uint64_t bell::bench::allocations() {
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size > 0 ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
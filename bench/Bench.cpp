@@ -0,0 +1,89 @@
+#include "Bench.h"
+
+#include <stdio.h>  // for printf
+#include <chrono>   // for steady_clock, nanoseconds
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"    // for esp_cpu_get_cycle_count
+#include "esp_timer.h"  // for esp_timer_get_time
+#endif
+
+using namespace bell::bench;
+
+static uint64_t nowNs() {
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time() * 1000;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+static uint32_t nowCycles() {
+#ifdef ESP_PLATFORM
+  return esp_cpu_get_cycle_count();
+#else
+  return 0;
+#endif
+}
+
+Result bell::bench::measure(const std::string& name, int channels,
+                            const std::function<uint64_t()>& run,
+                            uint32_t minMs) {
+  Result result;
+  result.name = name;
+  result.channels = channels;
+
+  // Caches, lazy allocations and branch predictors
+  run();
+
+  uint64_t deadline = nowNs() + (uint64_t)minMs * 1000000;
+  uint64_t start = nowNs();
+  uint64_t end = start;
+  while (end < deadline) {
+    // The counter wraps every few seconds, a single run never takes that long
+    uint32_t cyclesBefore = nowCycles();
+    result.frames += run();
+    result.cycles += (uint32_t)(nowCycles() - cyclesBefore);
+    result.runs++;
+    end = nowNs();
+  }
+  result.ns = end - start;
+  return result;
+}
+
+void bell::bench::report(const Result& result) {
+  if (result.runs == 0) {
+    return;
+  }
+  if (result.frames == 0) {
+    printf("%-36s %12.0f ns/op", result.name.c_str(),
+           (double)result.ns / result.runs);
+    if (result.cycles > 0) {
+      printf(" %12.0f cycles/op", (double)result.cycles / result.runs);
+    }
+    printf("\n");
+    return;
+  }
+
+  double samplesPerSecond =
+      (double)result.frames * result.channels * 1e9 / result.ns;
+  printf("%-36s %10.2f Msamples/s %8.2f ns/frame", result.name.c_str(),
+         samplesPerSecond / 1e6, (double)result.ns / result.frames);
+  if (result.cycles > 0) {
+    printf(" %8.1f cycles/frame", (double)result.cycles / result.frames);
+  }
+  printf("\n");
+}
+
+size_t bell::bench::runAll(const std::vector<Vector>& vectors,
+                           const std::vector<Golden>& golden) {
+  runBufferBenchmarks();
+  runDSPBenchmarks();
+  size_t failures = runCodecBenchmarks(vectors, golden);
+#ifdef BELL_BENCH_HTTP
+  runHTTPBenchmarks();
+#endif
+  return failures;
+}
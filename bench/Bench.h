@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint64_t, uint8_t, uint32_t
+#include <functional>  // for function
+#include <string>      // for string
+#include <vector>      // for vector
+
+namespace bell::bench {
+// Encoded input of the container and decode benchmarks, held in memory so
+// that storage and network don't show up in the numbers
+struct Vector {
+  std::string name;
+  const uint8_t* data;
+  size_t size;
+};
+
+// Expected FNV-1a of a vector's decoded PCM, the codecs' output as it is
+struct Golden {
+  std::string name;
+  uint64_t pcmHash;
+};
+
+struct Result {
+  std::string name;
+  // Audio frames handled, 0 for benchmarks timing whole operations
+  uint64_t frames = 0;
+  int channels = 2;
+  uint64_t runs = 0;
+  uint64_t ns = 0;
+  // CPU cycles, ESP32 only
+  uint64_t cycles = 0;
+};
+
+/**
+ * Calls run once untimed, then again until minMs passed
+ * @param run returns the audio frames it handled
+ */
+Result measure(const std::string& name, int channels,
+               const std::function<uint64_t()>& run, uint32_t minMs = 500);
+
+// One line per benchmark, samples per second and ns per frame
+void report(const Result& result);
+
+void runBufferBenchmarks();
+void runDSPBenchmarks();
+/**
+ * Decode speed per vector, and a check of each decoded PCM against golden
+ * @returns vectors that decoded differently, or not at all, from golden
+ */
+size_t runCodecBenchmarks(const std::vector<Vector>& vectors,
+                          const std::vector<Golden>& golden);
+// BellHTTPServer under concurrent keep-alive clients, host only
+void runHTTPBenchmarks();
+
+// Operator new calls of the whole process so far
+uint64_t allocations();
+
+// Built into bell-bench from BELL_BENCH_VECTORS and BELL_BENCH_GOLDEN
+std::vector<Vector> embeddedVectors();
+std::vector<Golden> embeddedGolden();
+
+// Every benchmark, always in the same order, returns the codec failures
+size_t runAll(const std::vector<Vector>& vectors,
+              const std::vector<Golden>& golden);
+}  // namespace bell::bench
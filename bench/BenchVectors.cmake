@@ -0,0 +1,36 @@
+# Shared by the host bell-bench and the ESP-IDF app in esp/
+set(BELL_BENCH_VECTORS "" CACHE STRING "Encoded files embedded into bell-bench, ; separated")
+# Lines of "<vector name> <hash>", the FNV-1a of each vector's decoded PCM as
+# bell-bench prints it. A vector decoding to anything else fails the run
+set(BELL_BENCH_GOLDEN "" CACHE FILEPATH "Expected hashes of the decoded vectors")
+
+set(BELL_BENCH_DIR "${CMAKE_CURRENT_LIST_DIR}")
+
+# Embeds the vectors as arrays, so that every run decodes the same bytes.
+# Writes the generated source to OUTPUT
+function(bell_bench_vectors OUTPUT)
+    set(VECTORS_DATA "")
+    set(VECTORS_LIST "")
+    set(VECTOR_INDEX 0)
+    foreach(VECTOR ${BELL_BENCH_VECTORS})
+        file(READ "${VECTOR}" VECTOR_HEX HEX)
+        string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," VECTOR_BYTES "${VECTOR_HEX}")
+        get_filename_component(VECTOR_NAME "${VECTOR}" NAME)
+        string(APPEND VECTORS_DATA "static const uint8_t vector${VECTOR_INDEX}[] = {${VECTOR_BYTES}};\n")
+        string(APPEND VECTORS_LIST "      {\"${VECTOR_NAME}\", vector${VECTOR_INDEX}, sizeof(vector${VECTOR_INDEX})},\n")
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${VECTOR}")
+        math(EXPR VECTOR_INDEX "${VECTOR_INDEX} + 1")
+    endforeach()
+
+    set(GOLDEN_LIST "")
+    if(BELL_BENCH_GOLDEN)
+        file(STRINGS "${BELL_BENCH_GOLDEN}" GOLDEN_LINES REGEX "^[^#]")
+        foreach(LINE ${GOLDEN_LINES})
+            if(LINE MATCHES "^([^ \t]+)[ \t]+([0-9a-fA-F]+)")
+                string(APPEND GOLDEN_LIST "      {\"${CMAKE_MATCH_1}\", 0x${CMAKE_MATCH_2}ull},\n")
+            endif()
+        endforeach()
+        set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${BELL_BENCH_GOLDEN}")
+    endif()
+    configure_file("${BELL_BENCH_DIR}/BenchVectors.cpp.in" "${OUTPUT}" @ONLY)
+endfunction()
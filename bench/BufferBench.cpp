@@ -0,0 +1,88 @@
+#include <string.h>  // for memcpy
+#include <memory>    // for make_shared
+#include <vector>    // for vector
+
+#include "Bench.h"               // for measure, report
+#include "CentralAudioBuffer.h"  // for CentralAudioBuffer
+#include "CircularBuffer.h"      // for CircularBuffer
+
+using namespace bell::bench;
+
+// 16-bit stereo, as decoded by most codecs
+static const size_t FRAME_SIZE = 4;
+static const size_t BLOCK_SIZE = 4096;
+static const size_t BLOCKS = 8;
+
+static void circularBuffer(const char* name, bell::CircularBuffer::Mode mode) {
+  bell::CircularBuffer buffer(BLOCK_SIZE * BLOCKS, mode);
+  std::vector<uint8_t> in(BLOCK_SIZE, 0x55), out(BLOCK_SIZE);
+
+  // Fills the buffer, then drains it, so every write sees it partly full
+  report(measure(name, 2, [&]() {
+    for (size_t i = 0; i < BLOCKS; i++) {
+      buffer.write(in.data(), in.size());
+    }
+    for (size_t i = 0; i < BLOCKS; i++) {
+      buffer.read(out.data(), out.size());
+    }
+    return BLOCK_SIZE * BLOCKS / FRAME_SIZE;
+  }));
+}
+
+static void circularBufferZeroCopy() {
+  bell::CircularBuffer buffer(BLOCK_SIZE * BLOCKS,
+                              bell::CircularBuffer::Mode::SPSC);
+  std::vector<uint8_t> in(BLOCK_SIZE, 0x55);
+
+  report(measure("circular_buffer/spsc_zero_copy", 2, [&]() {
+    for (size_t i = 0; i < BLOCKS; i++) {
+      uint8_t* slot = buffer.writeReserve(BLOCK_SIZE);
+      memcpy(slot, in.data(), BLOCK_SIZE);
+      buffer.writeCommit(BLOCK_SIZE);
+    }
+    uint32_t sum = 0;
+    for (size_t i = 0; i < BLOCKS; i++) {
+      sum += buffer.readPeek(BLOCK_SIZE)[0];
+      buffer.readRelease(BLOCK_SIZE);
+    }
+    return sum > 0 ? BLOCK_SIZE * BLOCKS / FRAME_SIZE : 0;
+  }));
+}
+
+static void centralAudioBuffer() {
+  auto buffer = std::make_shared<bell::CentralAudioBuffer>(BLOCKS);
+  std::vector<uint8_t> in(bell::CentralAudioBuffer::PCM_CHUNK_SIZE, 0x55);
+  size_t chunks = BLOCKS - 1;
+
+  report(measure("central_audio_buffer/write_read", 2, [&]() {
+    for (size_t i = 0; i < chunks; i++) {
+      buffer->writePCM(in.data(), in.size(), 1);
+    }
+    uint64_t frames = 0;
+    while (auto chunk = buffer->readChunk()) {
+      frames += chunk->pcmSize / FRAME_SIZE;
+    }
+    return frames;
+  }));
+
+  // What a sink using peekChunk() does, without the copy of readChunk()
+  report(measure("central_audio_buffer/write_peek", 2, [&]() {
+    for (size_t i = 0; i < chunks; i++) {
+      buffer->writePCM(in.data(), in.size(), 1);
+    }
+    uint64_t frames = 0;
+    while (auto chunk = buffer->peekChunk()) {
+      frames += chunk->pcmSize / FRAME_SIZE;
+      buffer->releaseChunk();
+    }
+    return frames;
+  }));
+}
+
+void bell::bench::runBufferBenchmarks() {
+  circularBuffer("circular_buffer/locked",
+                 bell::CircularBuffer::Mode::LOCKED);
+  circularBuffer("circular_buffer/spsc", bell::CircularBuffer::Mode::SPSC);
+  circularBufferZeroCopy();
+  centralAudioBuffer();
+}
@@ -0,0 +1,170 @@
+#include <inttypes.h>  // for PRIx64
+#include <stdio.h>     // for printf
+#include <string.h>    // for memcpy
+#include <algorithm>   // for min, find_if
+#include <memory>      // for shared_ptr, unique_ptr
+#include <vector>      // for vector
+
+#include "AudioCodecs.h"      // for AudioCodecs
+#include "AudioContainer.h"   // for AudioContainer
+#include "AudioContainers.h"  // for guessAudioContainer
+#include "BaseCodec.h"        // for BaseCodec
+#include "Bench.h"            // for Vector, Golden, measure, report
+#include "ByteStream.h"       // for ByteStream
+#include "CodecType.h"        // for AudioCodec
+#include "StreamInfo.h"       // for pcmBytesPerSample
+
+using namespace bell::bench;
+
+namespace {
+// Reads a Vector, every run starts over from a fresh stream
+class MemoryStream : public bell::ByteStream {
+ public:
+  MemoryStream(const Vector& vector) : vector(vector) {}
+
+  size_t read(uint8_t* buf, size_t nbytes) override {
+    nbytes = std::min(nbytes, vector.size - offset);
+    memcpy(buf, vector.data + offset, nbytes);
+    offset += nbytes;
+    return nbytes;
+  }
+
+  size_t skip(size_t nbytes) override {
+    nbytes = std::min(nbytes, vector.size - offset);
+    offset += nbytes;
+    return nbytes;
+  }
+
+  size_t position() override { return offset; }
+  size_t size() override { return vector.size; }
+  void close() override {}
+
+  bool seek(size_t offset) override {
+    if (offset > vector.size) {
+      return false;
+    }
+    this->offset = offset;
+    return true;
+  }
+
+ private:
+  const Vector& vector;
+  size_t offset = 0;
+};
+}  // namespace
+
+static void containerParsing(const Vector& vector) {
+  report(measure("container/" + vector.name, 2, [&]() {
+    MemoryStream stream(vector);
+    auto container = bell::AudioContainers::guessAudioContainer(stream);
+    if (container) {
+      container->parseSetupData();
+    }
+    // Whole opens, not frames
+    return (uint64_t)0;
+  }));
+}
+
+static const char* codecName(bell::AudioCodec codec) {
+  switch (codec) {
+    case bell::AudioCodec::AAC:
+      return "aac";
+    case bell::AudioCodec::MP3:
+      return "mp3";
+    case bell::AudioCodec::VORBIS:
+      return "vorbis";
+    case bell::AudioCodec::OPUS:
+      return "opus";
+    case bell::AudioCodec::FLAC:
+      return "flac";
+    case bell::AudioCodec::ALAC:
+      return "alac";
+    default:
+      return "unknown";
+  }
+}
+
+// FNV-1a over the PCM bytes, the same on every platform
+static constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+static uint64_t fnv1a(uint64_t hash, const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/**
+ * Decodes the whole vector, with a codec per stream as a player does
+ * @param hash when set, hashes the PCM on the way, outside of timed runs
+ */
+static uint64_t decodeAll(const Vector& vector, std::vector<uint8_t>& pcm,
+                          int& channels, uint64_t* hash = nullptr,
+                          bell::AudioCodec* type = nullptr) {
+  MemoryStream stream(vector);
+  auto container = bell::AudioContainers::guessAudioContainer(stream);
+  auto codec =
+      container ? bell::AudioCodecs::createCodec(container.get()) : nullptr;
+  if (!codec) {
+    return 0;
+  }
+  uint64_t bytes = 0;
+  while (uint32_t decoded =
+             codec->decode(container.get(), pcm.data(), pcm.size())) {
+    bytes += decoded;
+    if (hash) {
+      *hash = fnv1a(*hash, pcm.data(), decoded);
+    }
+  }
+  channels = codec->channelCount;
+  if (type) {
+    *type = container->getCodec();
+  }
+  return bytes / (channels * bell::pcmBytesPerSample(codec->getPcmFormat()));
+}
+
+// Returns false when the output isn't the golden one
+static bool decode(const Vector& vector, const std::vector<Golden>& golden) {
+  auto expected =
+      std::find_if(golden.begin(), golden.end(), [&](const Golden& entry) {
+        return entry.name == vector.name;
+      });
+  std::vector<uint8_t> pcm(16384);
+  int channels = 2;
+  uint64_t hash = FNV_OFFSET;
+  bell::AudioCodec codec = bell::AudioCodec::UNKNOWN;
+  if (decodeAll(vector, pcm, channels, &hash, &codec) == 0) {
+    printf("%-36s cannot be decoded\n", ("decode/" + vector.name).c_str());
+    return expected == golden.end();
+  }
+
+  // Per codec, so a platform's numbers read as a table
+  std::string name = std::string("decode/") + codecName(codec) + "/" +
+                     vector.name;
+  report(measure(
+      name, channels, [&]() { return decodeAll(vector, pcm, channels); },
+      2000));
+
+  if (expected == golden.end()) {
+    printf("%-36s pcm %016" PRIx64 ", no golden hash\n", name.c_str(), hash);
+    return true;
+  }
+  if (expected->pcmHash != hash) {
+    printf("%-36s pcm %016" PRIx64 " MISMATCH, expected %016" PRIx64 "\n",
+           name.c_str(), hash, expected->pcmHash);
+    return false;
+  }
+  printf("%-36s pcm %016" PRIx64 " ok\n", name.c_str(), hash);
+  return true;
+}
+
+size_t bell::bench::runCodecBenchmarks(const std::vector<Vector>& vectors,
+                                       const std::vector<Golden>& golden) {
+  for (auto& vector : vectors) {
+    containerParsing(vector);
+  }
+  size_t failures = 0;
+  for (auto& vector : vectors) {
+    failures += decode(vector, golden) ? 0 : 1;
+  }
+  return failures;
+}
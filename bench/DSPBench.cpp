@@ -0,0 +1,110 @@
+#include <string.h>  // for memcpy
+#include <cmath>     // for sin, M_PI
+#include <map>       // for map
+#include <memory>    // for make_shared, shared_ptr
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioPipeline.h"  // for AudioPipeline
+#include "Bench.h"          // for measure, report
+#include "BellDSP.h"        // for BellDSP
+#include "Biquad.h"         // for Biquad
+#include "Compressor.h"     // for Compressor
+#include "Gain.h"           // for Gain
+#include "Resampler.h"      // for Resampler
+#include "StreamInfo.h"     // for PcmFormat, pcmBytesPerSample
+
+using namespace bell::bench;
+
+static const uint32_t SAMPLE_RATE = 44100;
+static const size_t FRAMES = 1024;
+
+// A 1 kHz tone at -6 dBFS, 16-bit stereo. Other formats take it as raw
+// samples, which is just as representative
+static std::vector<int16_t> makeTone() {
+  std::vector<int16_t> tone(FRAMES * 2);
+  for (size_t i = 0; i < FRAMES; i++) {
+    tone[i * 2] = tone[i * 2 + 1] =
+        (int16_t)(16383 * sin(2 * M_PI * 1000 * i / SAMPLE_RATE));
+  }
+  return tone;
+}
+
+static std::shared_ptr<bell::Biquad> makeBiquad(bell::Biquad::Type type,
+                                                int channel, float freq,
+                                                float q, float gain) {
+  auto biquad = std::make_shared<bell::Biquad>();
+  biquad->channel = channel;
+  biquad->sampleRateChanged(SAMPLE_RATE);
+  std::map<std::string, float> config = {
+      {"freq", freq}, {"q", q}, {"gain", gain}};
+  biquad->configure(type, config);
+  return biquad;
+}
+
+static void pipeline(const std::string& name,
+                     std::shared_ptr<bell::AudioPipeline> pipeline,
+                     bell::PcmFormat format = bell::PcmFormat::INT16) {
+  std::vector<int16_t> tone = makeTone();
+  std::vector<uint8_t> work(tone.size() * sizeof(int16_t) * 4);
+  size_t bytes = tone.size() * sizeof(int16_t);
+  uint64_t frames = bytes / (2 * pcmBytesPerSample(format));
+
+  bell::BellDSP dsp(nullptr);
+  dsp.applyPipeline(pipeline);
+  pipeline->sampleRateChanged(SAMPLE_RATE);
+
+  report(measure("dsp/" + name, 2, [&]() {
+    // Every run starts from the same input, a resampler grows it
+    memcpy(work.data(), tone.data(), bytes);
+    dsp.process(work.data(), bytes, work.size(), 2, SAMPLE_RATE, format);
+    return frames;
+  }));
+}
+
+void bell::bench::runDSPBenchmarks() {
+  // Only the format conversion, in Q1.31
+  pipeline("passthrough", std::make_shared<AudioPipeline>());
+
+  auto gain = std::make_shared<AudioPipeline>();
+  auto gainTransform = std::make_shared<Gain>();
+  gainTransform->configure({0, 1}, -6.0f);
+  gain->addTransform(gainTransform);
+  pipeline("gain", gain);
+
+  // A typical room correction, five peaking bands per channel
+  auto eq = std::make_shared<AudioPipeline>();
+  const float bands[] = {60, 250, 1000, 4000, 12000};
+  for (int channel = 0; channel < 2; channel++) {
+    for (float freq : bands) {
+      eq->addTransform(makeBiquad(Biquad::Type::Peaking, channel, freq,
+                                  0.707f, 3.0f));
+    }
+  }
+  pipeline("eq_5_band", eq);
+
+  // Linkwitz-Riley 4th order crossover, the low side of a 2-way speaker
+  auto crossover = std::make_shared<AudioPipeline>();
+  for (int channel = 0; channel < 2; channel++) {
+    for (int i = 0; i < 2; i++) {
+      crossover->addTransform(
+          makeBiquad(Biquad::Type::Lowpass, channel, 2000, 0.707f, 0));
+    }
+  }
+  pipeline("crossover_lr4", crossover);
+
+  auto compressor = std::make_shared<AudioPipeline>();
+  auto compressorTransform = std::make_shared<Compressor>();
+  compressorTransform->configure({0, 1}, 5, 100, -20, 4, 0);
+  compressor->addTransform(compressorTransform);
+  pipeline("compressor", compressor);
+
+  auto resampler = std::make_shared<AudioPipeline>();
+  auto resamplerTransform = std::make_shared<Resampler>();
+  resamplerTransform->configure(48000);
+  resampler->addTransform(resamplerTransform);
+  pipeline("resample_44k1_48k", resampler);
+
+  // The same EQ from 24-bit input
+  pipeline("eq_5_band_int24", eq, PcmFormat::INT24_IN_32);
+}
@@ -0,0 +1,356 @@
+#include <stdio.h>    // for printf
+#include <stdlib.h>   // for strtoul
+#include <string.h>   // for memcmp, memcpy
+#include <algorithm>  // for sort
+#include <atomic>     // for atomic
+#include <memory>     // for unique_ptr
+#include <string>     // for string, to_string
+#include <thread>     // for thread, yield
+#include <vector>     // for vector
+
+#include "Bench.h"           // for measure, report, allocations
+#include "BellClock.h"       // for nowNs
+#include "BellHTTPServer.h"  // for BellHTTPServer
+#include "TCPSocket.h"       // for TCPSocket
+#include "civetweb.h"        // for mg_connect_websocket_client, mg_read
+#include "picohttpparser.h"  // for phr_parse_response, phr_header
+
+using namespace bell::bench;
+
+// Pollers and UIs keeping their connection, and the events pushed to UIs
+static const int CLIENTS = 8;
+static const int WS_CLIENTS = 4;
+static const uint32_t LOAD_MS = 2000;
+// Latencies kept per client, more than a run takes
+static const size_t MAX_SAMPLES = 1 << 20;
+
+static const char* STATUS_JSON =
+    "{\"state\":\"playing\",\"volume\":42,\"track\":{\"title\":\"Title\","
+    "\"artist\":\"Artist\",\"album\":\"Album\",\"duration\":215000},"
+    "\"position\":61234,\"shuffle\":false,\"repeat\":\"off\"}";
+
+// An application's routes, the benchmarked ones among them
+static const char* ROUTES[] = {"/api/status",
+                               "/api/volume",
+                               "/api/players",
+                               "/api/players/:id",
+                               "/api/players/:id/queue/:index",
+                               "/api/settings",
+                               "/api/settings/:key",
+                               "/api/library/albums/:id",
+                               "/api/library/artists/:id",
+                               "/api/search",
+                               "/ui/*"};
+
+namespace {
+// One request at a time on a keep-alive connection
+class Client {
+ public:
+  bool open(uint16_t port) {
+    try {
+      socket.open("127.0.0.1", port);
+    } catch (const std::exception&) {
+      return false;
+    }
+    return true;
+  }
+
+  // @returns false unless a whole 200 response came back
+  bool exchange(const std::string& request) {
+    if (socket.write((uint8_t*)request.data(), request.size()) !=
+        request.size()) {
+      return false;
+    }
+    size_t length = 0, expected = 0;
+    while (expected == 0 || length < expected) {
+      long len = (long)socket.read(buffer + length, sizeof(buffer) - length);
+      if (len <= 0) {
+        return false;
+      }
+      length += len;
+      if (expected == 0) {
+        int headerSize = parseHead(length);
+        if (headerSize == -2 && length < sizeof(buffer)) {
+          continue;
+        }
+        if (headerSize < 0 || status != 200) {
+          return false;
+        }
+        expected = headerSize + bodySize;
+      }
+    }
+    return true;
+  }
+
+ private:
+  bell::TCPSocket socket;
+  uint8_t buffer[16384];
+  int status = 0;
+  size_t bodySize = 0;
+
+  int parseHead(size_t length) {
+    int minorVersion;
+    const char* message;
+    size_t messageLength;
+    phr_header headers[16];
+    size_t headerCount = 16;
+    int parsed = phr_parse_response((const char*)buffer, length,
+                                    &minorVersion, &status, &message,
+                                    &messageLength, headers, &headerCount, 0);
+    bodySize = 0;
+    for (size_t i = 0; parsed > 0 && i < headerCount; i++) {
+      // Never folded nor lowercased by BellHTTPServer, the value ends at \r
+      if (headers[i].name_len == 14 &&
+          memcmp(headers[i].name, "Content-Length", 14) == 0) {
+        bodySize = strtoul(headers[i].value, nullptr, 10);
+      }
+    }
+    return parsed;
+  }
+};
+
+// Frames a WebSocket client received, each stamped with its send time
+struct Receiver {
+  std::atomic<uint64_t> received = 0;
+  std::vector<uint32_t> latenciesNs;
+};
+}  // namespace
+
+static int onFrame(struct mg_connection* conn, int bits, char* data,
+                   size_t len, void* userData) {
+  auto receiver = (Receiver*)userData;
+  if ((bits & 0xf) == MG_WEBSOCKET_OPCODE_BINARY && len == sizeof(int64_t)) {
+    int64_t sentNs;
+    memcpy(&sentNs, data, sizeof(sentNs));
+    if (receiver->latenciesNs.size() < MAX_SAMPLES) {
+      receiver->latenciesNs.push_back(bell::clock::nowNs() - sentNs);
+    }
+    receiver->received++;
+  }
+  return 1;
+}
+
+// Every client's latencies, sorted
+static std::vector<uint32_t> merge(std::vector<std::vector<uint32_t>>& all) {
+  std::vector<uint32_t> merged;
+  for (auto& latencies : all) {
+    merged.insert(merged.end(), latencies.begin(), latencies.end());
+  }
+  std::sort(merged.begin(), merged.end());
+  return merged;
+}
+
+static void reportLoad(const char* name, const char* unit, uint64_t count,
+                       uint64_t ns, const std::vector<uint32_t>& latencies,
+                       uint64_t allocs, uint64_t failures) {
+  if (latencies.empty()) {
+    printf("%-36s failed\n", name);
+    return;
+  }
+  printf("%-36s %10.0f %s/s p50 %7.1f us p99 %7.1f us %6.1f allocs/%s",
+         name, count * 1e9 / ns, unit,
+         latencies[latencies.size() / 2] / 1000.0,
+         latencies[latencies.size() * 99 / 100] / 1000.0,
+         (double)allocs / count, unit);
+  if (failures > 0) {
+    printf(" %llu failed", (unsigned long long)failures);
+  }
+  printf("\n");
+}
+
+/**
+ * CLIENTS connections sending request back to back. Allocations are the
+ * whole process', server and client: the client doesn't allocate once
+ * connected, so that's the server's count plus the connections' setup
+ */
+static void load(const char* name, uint16_t port,
+                 const std::string& request) {
+  std::vector<std::vector<uint32_t>> latencies(CLIENTS);
+  std::vector<std::unique_ptr<Client>> clients;
+  for (auto& samples : latencies) {
+    samples.reserve(MAX_SAMPLES);
+    clients.push_back(std::make_unique<Client>());
+  }
+  std::atomic<uint64_t> requests = 0, failures = 0;
+
+  uint64_t allocsBefore = allocations();
+  int64_t start = bell::clock::nowNs();
+  int64_t deadline = start + (int64_t)LOAD_MS * 1000000;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < CLIENTS; i++) {
+    threads.emplace_back([&, i]() {
+      Client& client = *clients[i];
+      if (!client.open(port)) {
+        failures++;
+        return;
+      }
+      for (int64_t now = bell::clock::nowNs(); now < deadline;) {
+        if (!client.exchange(request)) {
+          failures++;
+          return;
+        }
+        int64_t end = bell::clock::nowNs();
+        if (latencies[i].size() < MAX_SAMPLES) {
+          latencies[i].push_back(end - now);
+        }
+        requests++;
+        now = end;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  uint64_t ns = bell::clock::nowNs() - start;
+  uint64_t allocs = allocations() - allocsBefore;
+  reportLoad(name, "req", requests, ns, merge(latencies), allocs, failures);
+}
+
+/**
+ * broadcastWS() of stamped frames to WS_CLIENTS, each sent once the last
+ * one reached every client. Rates count frames sent, not delivered
+ */
+static void websocket(bell::BellHTTPServer& server, uint16_t port,
+                      std::atomic<int>& ready) {
+  std::vector<std::unique_ptr<Receiver>> receivers;
+  std::vector<struct mg_connection*> connections;
+  char error[256];
+  for (int i = 0; i < WS_CLIENTS; i++) {
+    receivers.push_back(std::make_unique<Receiver>());
+    receivers.back()->latenciesNs.reserve(MAX_SAMPLES);
+    auto conn = mg_connect_websocket_client(
+        "127.0.0.1", port, 0, error, sizeof(error), "/ws/events", nullptr,
+        onFrame, nullptr, receivers.back().get());
+    if (conn == nullptr) {
+      printf("%-36s failed: %s\n", "http/ws_broadcast", error);
+      break;
+    }
+    connections.push_back(conn);
+  }
+
+  int64_t readyDeadline = bell::clock::nowNs() + 1000000000;
+  while (ready < (int)connections.size() &&
+         bell::clock::nowNs() < readyDeadline) {
+    std::this_thread::yield();
+  }
+
+  uint64_t allocsBefore = allocations();
+  uint64_t sent = 0, lost = 0;
+  int64_t start = bell::clock::nowNs();
+  int64_t deadline = start + (int64_t)LOAD_MS * 1000000;
+  while (connections.size() == WS_CLIENTS &&
+         bell::clock::nowNs() < deadline) {
+    int64_t now = bell::clock::nowNs();
+    server.broadcastWS("/ws/events", (const uint8_t*)&now, sizeof(now),
+                       MG_WEBSOCKET_OPCODE_BINARY);
+    sent++;
+    for (auto& receiver : receivers) {
+      while (receiver->received < sent &&
+             bell::clock::nowNs() - now < 1000000000) {
+        std::this_thread::yield();
+      }
+      if (receiver->received < sent) {
+        lost++;
+      }
+    }
+    if (lost > 0) {
+      break;
+    }
+  }
+  uint64_t ns = bell::clock::nowNs() - start;
+  uint64_t allocs = allocations() - allocsBefore;
+
+  for (auto conn : connections) {
+    mg_close_connection(conn);
+  }
+  std::vector<std::vector<uint32_t>> latencies;
+  for (auto& receiver : receivers) {
+    latencies.push_back(std::move(receiver->latenciesNs));
+  }
+  if (sent > 0) {
+    std::vector<uint32_t> merged = merge(latencies);
+    reportLoad("http/ws_broadcast", "msg", sent, ns, merged, allocs, lost);
+  }
+}
+
+static void router() {
+  bell::BellHTTPServer::Router router;
+  bell::BellHTTPServer::HTTPHandler handler = [](struct mg_connection*) {
+    return nullptr;
+  };
+  for (const char* route : ROUTES) {
+    router.insert(route, handler);
+  }
+
+  auto match = [&](const char* name, const char* route) {
+    bell::BellHTTPServer::Router::Match result;
+    report(measure(name, 0, [&]() {
+      router.match(route, result);
+      return 0;
+    }));
+  };
+  match("http/router_literal", "/api/status");
+  match("http/router_params", "/api/players/kitchen/queue/12");
+  match("http/router_catch_all", "/ui/assets/app.js");
+  match("http/router_miss", "/api/unknown/path");
+}
+
+void bell::bench::runHTTPBenchmarks() {
+  router();
+
+  // A worker for every connection, keep-alive ones hold theirs
+  std::atomic<int> ready = 0;
+  BellHTTPServer::Config config;
+  config.numThreads = CLIENTS + WS_CLIENTS + 2;
+  config.keepAlive = true;
+  BellHTTPServer server(0, config);
+  BellHTTPServer* serverPtr = &server;
+
+  // Read-only, the same handler both ways
+  BellHTTPServer::HTTPHandler status = [serverPtr](struct mg_connection*) {
+    return serverPtr->makeJsonResponse(STATUS_JSON);
+  };
+  server.registerGet("/api/status", status,
+                     BellHTTPServer::Concurrency::PARALLEL);
+  server.registerGet("/api/status_serialized", status);
+  server.registerGet(
+      "/api/players/:id",
+      [serverPtr](struct mg_connection* conn) {
+        std::string id(BellHTTPServer::extractParam(conn, "id"));
+        return serverPtr->makeJsonResponse("{\"id\":\"" + id + "\"}");
+      },
+      BellHTTPServer::Concurrency::PARALLEL);
+  server.registerPost("/api/volume", [serverPtr](struct mg_connection* conn) {
+    char body[256];
+    while (mg_read(conn, body, sizeof(body)) > 0) {
+    }
+    return serverPtr->makeJsonResponse("{\"ok\":true}");
+  });
+  server.registerWS(
+      "/ws/events", [](struct mg_connection*, char*, size_t) {},
+      [&ready](struct mg_connection*, BellHTTPServer::WSState state) {
+        if (state == BellHTTPServer::WSState::READY) {
+          ready++;
+        }
+      });
+
+  auto ports = server.getListeningPorts();
+  if (ports.empty()) {
+    printf("%-36s failed: no port\n", "http/server");
+    return;
+  }
+  uint16_t port = ports[0];
+
+  load("http/get_json", port,
+       "GET /api/status HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  load("http/get_json_serialized", port,
+       "GET /api/status_serialized HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  load("http/get_params", port,
+       "GET /api/players/kitchen HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  load("http/post_json", port,
+       "POST /api/volume HTTP/1.1\r\nHost: localhost\r\n"
+       "Content-Type: application/json\r\nContent-Length: 13\r\n\r\n"
+       "{\"volume\":42}");
+  websocket(server, port, ready);
+  server.close();
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>   // for fprintf, printf, stderr
+#include <fstream>   // for ifstream
+#include <iterator>  // for istreambuf_iterator
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "Bench.h"           // for runAll, embeddedVectors, embeddedGolden
+#include "BellLogger.h"      // for setDefaultLogger, bellGlobalLogger
+#include "DecoderGlobals.h"  // for createDecoders
+
+static void setup() {
+  bell::setDefaultLogger();
+  // Containers log every open
+  bell::bellGlobalLogger->setLevel(BELL_LOG_LEVEL_ERROR);
+  bell::createDecoders();
+}
+
+#ifdef ESP_PLATFORM
+extern "C" void app_main() {
+  setup();
+  size_t failures = bell::bench::runAll(bell::bench::embeddedVectors(),
+                                        bell::bench::embeddedGolden());
+  printf("%zu golden mismatches\n", failures);
+}
+#else
+// Files given on the command line are benchmarked after the embedded ones,
+// and checked against BELL_BENCH_GOLDEN by name too. Fails on a mismatch
+int main(int argc, char** argv) {
+  setup();
+  auto vectors = bell::bench::embeddedVectors();
+  std::vector<std::vector<uint8_t>> files(argc);
+  for (int i = 1; i < argc; i++) {
+    std::ifstream file(argv[i], std::ios::binary);
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", argv[i]);
+      return 1;
+    }
+    files[i].assign(std::istreambuf_iterator<char>(file), {});
+    std::string name = argv[i];
+    name = name.substr(name.find_last_of("/\\") + 1);
+    vectors.push_back({name, files[i].data(), files[i].size()});
+  }
+
+  size_t failures = bell::bench::runAll(vectors, bell::bench::embeddedGolden());
+  if (failures > 0) {
+    fprintf(stderr, "%zu vectors don't decode to their golden hash\n",
+            failures);
+    return 1;
+  }
+  return 0;
+}
+#endif
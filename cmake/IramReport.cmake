@@ -0,0 +1,47 @@
+# Prints the IRAM and DRAM that BELL_HOT / BELL_HOT_DATA placed, per object
+# and in total, from the section headers of an archive
+#
+#   cmake -DOBJDUMP=<objdump> -DARCHIVE=<libbell.a> -P IramReport.cmake
+
+if(NOT OBJDUMP OR NOT ARCHIVE)
+    message(FATAL_ERROR "Usage: cmake -DOBJDUMP=<objdump> -DARCHIVE=<archive> -P IramReport.cmake")
+endif()
+
+execute_process(COMMAND ${OBJDUMP} -h ${ARCHIVE}
+                OUTPUT_VARIABLE HEADERS
+                RESULT_VARIABLE RESULT)
+if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "Cannot read the sections of ${ARCHIVE}")
+endif()
+
+set(IRAM_TOTAL 0)
+set(DRAM_TOTAL 0)
+set(OBJECT "")
+string(REPLACE "\n" ";" LINES "${HEADERS}")
+
+macro(flush_object)
+    if(OBJECT AND (OBJECT_IRAM OR OBJECT_DRAM))
+        message(STATUS "${OBJECT}: IRAM ${OBJECT_IRAM} B, DRAM ${OBJECT_DRAM} B")
+    endif()
+endmacro()
+
+foreach(LINE IN LISTS LINES)
+    if(LINE MATCHES "^([^ ]+):[ \t]+file format")
+        flush_object()
+        set(OBJECT "${CMAKE_MATCH_1}")
+        set(OBJECT_IRAM 0)
+        set(OBJECT_DRAM 0)
+    elseif(LINE MATCHES "^[ \t]*[0-9]+[ \t]+\\.(iram1|dram1)[^ \t]*[ \t]+([0-9a-fA-F]+)")
+        math(EXPR SIZE "0x${CMAKE_MATCH_2}")
+        if(CMAKE_MATCH_1 STREQUAL "iram1")
+            math(EXPR OBJECT_IRAM "${OBJECT_IRAM} + ${SIZE}")
+            math(EXPR IRAM_TOTAL "${IRAM_TOTAL} + ${SIZE}")
+        else()
+            math(EXPR OBJECT_DRAM "${OBJECT_DRAM} + ${SIZE}")
+            math(EXPR DRAM_TOTAL "${DRAM_TOTAL} + ${SIZE}")
+        endif()
+    endif()
+endforeach()
+flush_object()
+
+message(STATUS "Hot path total: IRAM ${IRAM_TOTAL} B, DRAM ${DRAM_TOTAL} B")
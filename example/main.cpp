@@ -37,14 +37,18 @@ class AudioPlayer : bell::Task {
 
   void runTask() override {
     while (true) {
-      if (audioBuffer->hasAtLeast(64) || isPaused) {
+      if (audioBuffer->waitForChunks(64, 100) || isPaused) {
         auto chunk = audioBuffer->readChunk();
 
         if (chunk != nullptr && chunk->pcmSize > 0) {
-          // this->dsp->process(chunk->pcmData, chunk->pcmSize, 2, 44100,
-          //                    bell::BitWidth::BW_16);
-
-          this->audioSink->feedPCMFrames(chunk->pcmData, chunk->pcmSize);
+          // Without a pipeline the chunk goes out untouched, in its own
+          // format
+          size_t size =
+              this->dsp->process(chunk->pcmData, chunk->pcmSize,
+                                 chunk->pcmSize, chunk->channels,
+                                 chunk->sampleRate, chunk->format);
+
+          this->audioSink->feedPCMFrames(chunk->pcmData, size);
         }
       }
     }
@@ -61,25 +65,40 @@ int main() {
   auto url = "http://193.222.135.71/378";
   // std::ifstream file("aactest.aac", std::ios::binary);
 
-  auto req = bell::HTTPClient::get(url);
-  auto container = AudioContainers::guessAudioContainer(req->stream());
-  auto codec = AudioCodecs::getCodec(container.get());
+  auto req = bell::HTTPClient::get(
+      url, {bell::HTTPClient::IcyHeader::metadata()});
+  if (auto* icy = req->getIcyStream()) {
+    icy->setMetadataCallback([](const bell::IcyStream::Metadata& metadata) {
+      std::cout << "Now playing: " << metadata.title << std::endl;
+    });
+  }
+  auto container = AudioContainers::guessAudioContainer(req->byteStream());
+  auto codec = AudioCodecs::createCodec(container.get());
 
-  uint32_t dataLen;
   while (true) {
-    uint8_t* data = codec->decode(container.get(), dataLen);
-
-    if (!data) {
-      std::cout << "data invalid" << std::endl;
+    // Decode straight into the next free slot of the buffer
+    auto* chunk = audioBuffer->reserveChunk();
+    if (chunk == nullptr) {
+      audioBuffer->waitForSpace(1, 100);
       continue;
     }
 
-    size_t toWrite = dataLen;
-    while (toWrite > 0) {
-      toWrite -= audioBuffer->writePCM(data + dataLen - toWrite, toWrite, 0);
+    uint32_t bytes = codec->decode(container.get(), chunk->pcmData,
+                                   audioBuffer->getChunkSize());
+    if (bytes == 0) {
+      std::cout << "data invalid" << std::endl;
+      continue;
     }
 
-    // std::cout << dataLen << std::endl;
+    chunk->trackHash = 0;
+    chunk->sampleRate = codec->sampleRate;
+    chunk->channels = codec->channelCount;
+    chunk->bitWidth = 16;
+    chunk->format = bell::PcmFormat::INT16;
+    chunk->sec = 0;
+    chunk->usec = 0;
+    chunk->pcmSize = bytes;
+    audioBuffer->commitChunk();
   }
 
   // return 0;
@@ -101,6 +101,8 @@
 #define	IntensityProcMPEG2	STATNAME(IntensityProcMPEG2)
 #define PolyphaseMono		STATNAME(PolyphaseMono)
 #define PolyphaseStereo		STATNAME(PolyphaseStereo)
+#define PolyphaseMonoRef	STATNAME(PolyphaseMonoRef)
+#define PolyphaseStereoRef	STATNAME(PolyphaseStereoRef)
 #define FDCT32				STATNAME(FDCT32)
 
 #define	ISFMpeg1			STATNAME(ISFMpeg1)
@@ -293,6 +295,15 @@ extern "C" {
 #endif
 void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase);
 void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase);
+
+/* polysimd.c, built with BELL_CODEC_MP3_SIMD on SSE2 and NEON targets
+ * the C versions in polyphase.c are then kept as the bit-exact reference
+ */
+#if defined(BELL_CODEC_MP3_SIMD) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define MP3_SIMD_POLYPHASE
+void PolyphaseMonoRef(short *pcm, int *vbuf, const int *coefBase);
+void PolyphaseStereoRef(short *pcm, int *vbuf, const int *coefBase);
+#endif
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,295 @@
+/* ***** BEGIN LICENSE BLOCK ***** 
+ * Version: RCSL 1.0/RPSL 1.0 
+ *  
+ * Portions Copyright (c) 1995-2002 RealNetworks, Inc. All Rights Reserved. 
+ *      
+ * The contents of this file, and the files included with this file, are 
+ * subject to the current version of the RealNetworks Public Source License 
+ * Version 1.0 (the "RPSL") available at 
+ * http://www.helixcommunity.org/content/rpsl unless you have licensed 
+ * the file under the RealNetworks Community Source License Version 1.0 
+ * (the "RCSL") available at http://www.helixcommunity.org/content/rcsl, 
+ * in which case the RCSL will apply. You may also obtain the license terms 
+ * directly from RealNetworks.  You may not use this file except in 
+ * compliance with the RPSL or, if you have a valid RCSL with RealNetworks 
+ * applicable to this file, the RCSL.  Please see the applicable RPSL or 
+ * RCSL for the rights, obligations and limitations governing use of the 
+ * contents of the file.  
+ *  
+ * This file is part of the Helix DNA Technology. RealNetworks is the 
+ * developer of the Original Code and owns the copyrights in the portions 
+ * it created. 
+ *  
+ * This file, and the files included with this file, is distributed and made 
+ * available on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER 
+ * EXPRESS OR IMPLIED, AND REALNETWORKS HEREBY DISCLAIMS ALL SUCH WARRANTIES, 
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY, FITNESS 
+ * FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT. 
+ * 
+ * Technology Compatibility Kit Test Suite(s) Location: 
+ *    http://www.helixcommunity.org/content/tck 
+ * 
+ * Contributor(s): 
+ *  
+ * ***** END LICENSE BLOCK ***** */ 
+
+/**************************************************************************************
+ * Fixed-point MP3 decoder
+ *
+ * polysimd.c - polyphase synthesis filter with SSE2 or NEON multiply-accumulates
+ *
+ * Same arithmetic as polyphase.c: 32x32 -> 64-bit products summed modulo 2^64,
+ *   so the output is bit-exact with PolyphaseMonoRef() and PolyphaseStereoRef()
+ * Only built with BELL_CODEC_MP3_SIMD, see MP3_SIMD_POLYPHASE in coder.h
+ **************************************************************************************/
+
+#include "coder.h"
+#include "assembly.h"
+
+#ifdef MP3_SIMD_POLYPHASE
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#else
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#endif
+
+/* see polyphase.c */
+#define DEF_NFRACBITS	(DQ_FRACBITS_OUT - 2 - 2 - 15)
+#define CSHIFT	12
+
+static __inline short ClipToShort(int x, int fracBits)
+{
+	int sign;
+
+	/* assumes you've already rounded (x += (1 << (fracBits-1))) */
+	x >>= fracBits;
+
+	/* Ken's trick: clips to [-32768, 32767] */
+	sign = x >> 31;
+	if (sign != (x >> 15))
+		x = sign ^ ((1 << 15) - 1);
+
+	return (short)x;
+}
+
+#if defined(__ARM_NEON)
+
+static __inline int32x4_t Reverse(int32x4_t v)
+{
+	v = vrev64q_s32(v);
+	return vcombine_s32(vget_high_s32(v), vget_low_s32(v));
+}
+
+static __inline int64x2_t MAdd(int64x2_t sum, int32x4_t x, int32x4_t y)
+{
+	sum = vmlal_s32(sum, vget_low_s32(x), vget_low_s32(y));
+	return vmlal_s32(sum, vget_high_s32(x), vget_high_s32(y));
+}
+
+static __inline int64x2_t MSub(int64x2_t sum, int32x4_t x, int32x4_t y)
+{
+	sum = vmlsl_s32(sum, vget_low_s32(x), vget_low_s32(y));
+	return vmlsl_s32(sum, vget_high_s32(x), vget_high_s32(y));
+}
+
+static __inline Word64 Sum(int64x2_t sum)
+{
+	return (Word64)vgetq_lane_s64(sum, 0) + (Word64)vgetq_lane_s64(sum, 1);
+}
+
+/* MC2M() of polyphase.c for x = 0..7: coef holds 8 (c1, c2) pairs
+ *   sum1 = vb[x]*c1 - vb[23-x]*c2, sum2 = vb[x]*c2 + vb[23-x]*c1
+ */
+static __inline void Conv2(const int *vb, const int *coef, Word64 *sum1, Word64 *sum2)
+{
+	int32x4x2_t c;
+	int32x4_t vLo, vHi;
+	int64x2_t s1, s2;
+	int x;
+
+	s1 = s2 = vdupq_n_s64(0);
+	for (x = 0; x < 8; x += 4) {
+		c = vld2q_s32(coef + 2*x);
+		vLo = vld1q_s32(vb + x);
+		vHi = Reverse(vld1q_s32(vb + 20 - x));
+		s1 = MAdd(s1, vLo, c.val[0]);	s1 = MSub(s1, vHi, c.val[1]);
+		s2 = MAdd(s2, vLo, c.val[1]);	s2 = MAdd(s2, vHi, c.val[0]);
+	}
+	*sum1 = Sum(s1);
+	*sum2 = Sum(s2);
+}
+
+/* MC1M() of polyphase.c for x = 0..7: sum = vb[x]*coef[x] */
+static __inline Word64 Conv1(const int *vb, const int *coef)
+{
+	int64x2_t s;
+
+	s = MAdd(vdupq_n_s64(0), vld1q_s32(vb), vld1q_s32(coef));
+	s = MAdd(s, vld1q_s32(vb + 4), vld1q_s32(coef + 4));
+	return Sum(s);
+}
+
+#else	/* SSE2 */
+
+/* signed 32x32 -> 64-bit products of lanes 0 and 2 */
+static __inline __m128i MulEven(__m128i x, __m128i y)
+{
+#ifdef __SSE4_1__
+	return _mm_mul_epi32(x, y);
+#else
+	/* unsigned product, corrected for the signs modulo 2^64:
+	 *   x*y = ux*uy - 2^32 * ((x < 0 ? y : 0) + (y < 0 ? x : 0))
+	 */
+	__m128i fix = _mm_add_epi32(_mm_and_si128(_mm_srai_epi32(x, 31), y),
+								_mm_and_si128(_mm_srai_epi32(y, 31), x));
+	return _mm_sub_epi64(_mm_mul_epu32(x, y), _mm_slli_epi64(fix, 32));
+#endif
+}
+
+static __inline Word64 Sum(__m128i sum)
+{
+	Word64 lanes[2];
+
+	_mm_storeu_si128((__m128i *)lanes, sum);
+	return lanes[0] + lanes[1];
+}
+
+/* see the NEON version, two x per step
+ *   c = (c1, c2) of x and x+1, vLo/vHi lanes 0 and 2 = vb[x], vb[x+1] / vb[23-x], vb[22-x]
+ */
+static __inline void Conv2(const int *vb, const int *coef, Word64 *sum1, Word64 *sum2)
+{
+	__m128i c1, c2, lo, hi, vLo, vHi, s1, s2;
+	int x;
+
+	s1 = s2 = _mm_setzero_si128();
+	for (x = 0; x < 8; x += 4) {
+		lo = _mm_loadu_si128((const __m128i *)(vb + x));
+		hi = _mm_loadu_si128((const __m128i *)(vb + 20 - x));
+
+		c1 = _mm_loadu_si128((const __m128i *)(coef + 2*x));
+		c2 = _mm_srli_epi64(c1, 32);
+		vLo = _mm_unpacklo_epi32(lo, lo);
+		vHi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 2, 3, 3));
+		s1 = _mm_add_epi64(s1, MulEven(vLo, c1));	s1 = _mm_sub_epi64(s1, MulEven(vHi, c2));
+		s2 = _mm_add_epi64(s2, MulEven(vLo, c2));	s2 = _mm_add_epi64(s2, MulEven(vHi, c1));
+
+		c1 = _mm_loadu_si128((const __m128i *)(coef + 2*x + 4));
+		c2 = _mm_srli_epi64(c1, 32);
+		vLo = _mm_unpackhi_epi32(lo, lo);
+		vHi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(0, 0, 1, 1));
+		s1 = _mm_add_epi64(s1, MulEven(vLo, c1));	s1 = _mm_sub_epi64(s1, MulEven(vHi, c2));
+		s2 = _mm_add_epi64(s2, MulEven(vLo, c2));	s2 = _mm_add_epi64(s2, MulEven(vHi, c1));
+	}
+	*sum1 = Sum(s1);
+	*sum2 = Sum(s2);
+}
+
+static __inline Word64 Conv1(const int *vb, const int *coef)
+{
+	__m128i v, c, s;
+	int x;
+
+	s = _mm_setzero_si128();
+	for (x = 0; x < 8; x += 4) {
+		v = _mm_loadu_si128((const __m128i *)(vb + x));
+		c = _mm_loadu_si128((const __m128i *)(coef + x));
+		s = _mm_add_epi64(s, MulEven(v, c));
+		s = _mm_add_epi64(s, MulEven(_mm_srli_epi64(v, 32), _mm_srli_epi64(c, 32)));
+	}
+	return Sum(s);
+}
+
+#endif
+
+#define OUT(sum)	ClipToShort((int)SAR64(rndVal + (sum), (32-CSHIFT)), DEF_NFRACBITS)
+
+/**************************************************************************************
+ * Function:    PolyphaseMono
+ *
+ * Description: same as PolyphaseMonoRef() in polyphase.c, eight taps per multiply-
+ *                accumulate step
+ **************************************************************************************/
+void PolyphaseMono(short *pcm, int *vbuf, const int *coefBase)
+{
+	int i;
+	const int *coef;
+	int *vb1;
+	Word64 sum1L, sum2L, rndVal;
+
+	rndVal = (Word64)( 1 << (DEF_NFRACBITS - 1 + (32 - CSHIFT)) );
+
+	/* special case, output sample 0 */
+	Conv2(vbuf, coefBase, &sum1L, &sum2L);
+	*(pcm + 0) = OUT(sum1L);
+
+	/* special case, output sample 16 */
+	*(pcm + 16) = OUT(Conv1(vbuf + 64*16, coefBase + 256));
+
+	/* main convolution loop: sum1L = samples 1, 2, 3, ... 15   sum2L = samples 31, 30, ... 17 */
+	coef = coefBase + 16;
+	vb1 = vbuf + 64;
+	pcm++;
+
+	for (i = 15; i > 0; i--) {
+		Conv2(vb1, coef, &sum1L, &sum2L);
+		coef += 16;
+		vb1 += 64;
+		*(pcm)       = OUT(sum1L);
+		*(pcm + 2*i) = OUT(sum2L);
+		pcm++;
+	}
+}
+
+/**************************************************************************************
+ * Function:    PolyphaseStereo
+ *
+ * Description: same as PolyphaseStereoRef() in polyphase.c, eight taps per multiply-
+ *                accumulate step
+ *
+ * Notes:       interleaves PCM samples LRLRLR...
+ **************************************************************************************/
+void PolyphaseStereo(short *pcm, int *vbuf, const int *coefBase)
+{
+	int i;
+	const int *coef;
+	int *vb1;
+	Word64 sum1L, sum2L, sum1R, sum2R, rndVal;
+
+	rndVal = (Word64)( 1 << (DEF_NFRACBITS - 1 + (32 - CSHIFT)) );
+
+	/* special case, output sample 0 */
+	Conv2(vbuf, coefBase, &sum1L, &sum2L);
+	Conv2(vbuf + 32, coefBase, &sum1R, &sum2R);
+	*(pcm + 0) = OUT(sum1L);
+	*(pcm + 1) = OUT(sum1R);
+
+	/* special case, output sample 16 */
+	coef = coefBase + 256;
+	vb1 = vbuf + 64*16;
+	*(pcm + 2*16 + 0) = OUT(Conv1(vb1, coef));
+	*(pcm + 2*16 + 1) = OUT(Conv1(vb1 + 32, coef));
+
+	/* main convolution loop: sum1L = samples 1, 2, 3, ... 15   sum2L = samples 31, 30, ... 17 */
+	coef = coefBase + 16;
+	vb1 = vbuf + 64;
+	pcm += 2;
+
+	for (i = 15; i > 0; i--) {
+		Conv2(vb1, coef, &sum1L, &sum2L);
+		Conv2(vb1 + 32, coef, &sum1R, &sum2R);
+		coef += 16;
+		vb1 += 64;
+		*(pcm + 0)         = OUT(sum1L);
+		*(pcm + 1)         = OUT(sum1R);
+		*(pcm + 2*2*i + 0) = OUT(sum2L);
+		*(pcm + 2*2*i + 1) = OUT(sum2R);
+		pcm += 2;
+	}
+}
+
+#endif	/* MP3_SIMD_POLYPHASE */
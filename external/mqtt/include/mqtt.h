@@ -1084,6 +1084,22 @@ struct mqtt_queued_message* mqtt_mq_find(struct mqtt_message_queue *mq, enum MQT
 
 /* CLIENT */
 
+/**
+ * @brief Sends and receives in place of \ref mqtt_pal_sendall and
+ *        \ref mqtt_pal_recvall, e.g. through a TLS connection layered on
+ *        \c socketfd.
+ * @ingroup details
+ *
+ * @note Both return what the pal functions do: the bytes moved, 0 when the
+ *       socket would block, or a negative \ref MQTTErrors.
+ */
+struct mqtt_transport {
+    ssize_t (*send)(void* state, const void* buf, size_t len);
+    ssize_t (*recv)(void* state, void* buf, size_t bufsz);
+    /** @brief Passed to send and recv. */
+    void* state;
+};
+
 /**
  * @brief An MQTT client. 
  * @ingroup details
@@ -1153,6 +1169,16 @@ struct mqtt_client {
      */
     double typical_response_time;
 
+    /**
+     * @brief The session present flag of the last CONNACK, -1 until it arrives.
+     */
+    int session_present;
+
+    /**
+     * @brief Replaces the pal's socket calls when set, NULL after \ref mqtt_init.
+     */
+    const struct mqtt_transport* transport;
+
     /**
      * @brief The callback that is called whenever a publish is received from the broker.
      * 
@@ -1552,6 +1578,24 @@ enum MQTTErrors mqtt_subscribe(struct mqtt_client *client,
                                const char* topic_name,
                                int max_qos_level);
 
+/**
+ * @brief Subscribe to several topics with a single SUBSCRIBE packet.
+ * @ingroup api
+ * 
+ * @pre mqtt_connect must have been called.
+ * 
+ * @param[in,out] client The MQTT client.
+ * @param[in] topic_names The names of the topics to subscribe to.
+ * @param[in] max_qos_levels The maximum QOS level of each topic.
+ * @param[in] count The number of topics, less than \c MQTT_SUBSCRIBE_REQUEST_MAX_NUM_TOPICS.
+ * 
+ * @returns \c MQTT_OK upon success, an \ref MQTTErrors otherwise. 
+ */
+enum MQTTErrors mqtt_subscribe_many(struct mqtt_client *client,
+                                    const char* const* topic_names,
+                                    const int* max_qos_levels,
+                                    size_t count);
+
 /**
  * @brief Unsubscribe from a topic.
  * @ingroup api
@@ -130,6 +130,8 @@ enum MQTTErrors mqtt_init(struct mqtt_client *client,
     client->number_of_timeouts = 0;
     client->number_of_keep_alives = 0;
     client->typical_response_time = -1.0;
+    client->session_present = -1;
+    client->transport = NULL;
     client->publish_response_callback = publish_response_callback;
     client->pid_lfsr = 0;
     client->send_offset = 0;
@@ -163,6 +165,8 @@ void mqtt_init_reconnect(struct mqtt_client *client,
     client->number_of_timeouts = 0;
     client->number_of_keep_alives = 0;
     client->typical_response_time = -1.0;
+    client->session_present = -1;
+    client->transport = NULL;
     client->publish_response_callback = publish_response_callback;
     client->send_offset = 0;
 
@@ -177,6 +181,7 @@ void mqtt_reinit(struct mqtt_client* client,
                  uint8_t *recvbuf, size_t recvbufsz)
 {
     client->error = MQTT_ERROR_CONNECT_NOT_CALLED;
+    client->session_present = -1;
     client->socketfd = socketfd;
 
     mqtt_mq_init(&client->mq, sendbuf, sendbufsz);
@@ -407,6 +412,51 @@ enum MQTTErrors mqtt_subscribe(struct mqtt_client *client,
     return MQTT_OK;
 }
 
+enum MQTTErrors mqtt_subscribe_many(struct mqtt_client *client,
+                                    const char* const* topic_names,
+                                    const int* max_qos_levels,
+                                    size_t count)
+{
+    ssize_t rv;
+    uint16_t packet_id;
+    struct mqtt_queued_message *msg;
+    const char* topic[MQTT_SUBSCRIBE_REQUEST_MAX_NUM_TOPICS] = {NULL};
+    int max_qos[MQTT_SUBSCRIBE_REQUEST_MAX_NUM_TOPICS] = {0};
+    size_t i;
+
+    if (count == 0 || count >= MQTT_SUBSCRIBE_REQUEST_MAX_NUM_TOPICS) {
+        return MQTT_ERROR_SUBSCRIBE_TOO_MANY_TOPICS;
+    }
+    for(i = 0; i < count; ++i) {
+        topic[i] = topic_names[i];
+        max_qos[i] = max_qos_levels[i];
+    }
+
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    packet_id = __mqtt_next_pid(client);
+
+    /* try to pack the message, the list ends at the first NULL topic */
+    MQTT_CLIENT_TRY_PACK(
+        rv, msg, client, 
+        mqtt_pack_subscribe_request(
+            client->mq.curr, client->mq.curr_sz,
+            packet_id,
+            topic[0], max_qos[0], topic[1], max_qos[1],
+            topic[2], max_qos[2], topic[3], max_qos[3],
+            topic[4], max_qos[4], topic[5], max_qos[5],
+            topic[6], max_qos[6],
+            (const char*)NULL
+        ), 
+        1
+    );
+    /* save the control type and packet id of the message */
+    msg->control_type = MQTT_CONTROL_SUBSCRIBE;
+    msg->packet_id = packet_id;
+
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+    return MQTT_OK;
+}
+
 enum MQTTErrors mqtt_unsubscribe(struct mqtt_client *client,
                          const char* topic_name)
 {
@@ -546,7 +596,9 @@ ssize_t __mqtt_send(struct mqtt_client *client)
 
         /* we're sending the message */
         {
-          ssize_t tmp = mqtt_pal_sendall(client->socketfd, msg->start + client->send_offset, msg->size - client->send_offset, 0);
+          ssize_t tmp = client->transport != NULL
+              ? client->transport->send(client->transport->state, msg->start + client->send_offset, msg->size - client->send_offset)
+              : mqtt_pal_sendall(client->socketfd, msg->start + client->send_offset, msg->size - client->send_offset, 0);
           if (tmp < 0) {
             client->error = tmp;
             MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
@@ -649,7 +701,9 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
         ssize_t rv, consumed;
         struct mqtt_queued_message *msg = NULL;
 
-        rv = mqtt_pal_recvall(client->socketfd, client->recv_buffer.curr, client->recv_buffer.curr_sz, 0);
+        rv = client->transport != NULL
+            ? client->transport->recv(client->transport->state, client->recv_buffer.curr, client->recv_buffer.curr_sz)
+            : mqtt_pal_recvall(client->socketfd, client->recv_buffer.curr, client->recv_buffer.curr_sz, 0);
         if (rv < 0) {
             /* an error occurred */
             client->error = rv;
@@ -733,6 +787,7 @@ ssize_t __mqtt_recv(struct mqtt_client *client)
                     }
                     break;
                 }
+                client->session_present = response.decoded.connack.session_present_flag & 1;
                 break;
             case MQTT_CONTROL_PUBLISH:
                 /* stage response, none if qos==0, PUBACK if qos==1, PUBREC if qos==2 */
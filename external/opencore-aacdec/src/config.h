@@ -1,5 +1,7 @@
-/* SBR decoding */
+/* SBR decoding, left out of AAC-LC only builds */
+#ifndef AAC_LC_ONLY
 #define AAC_PLUS 1
+#endif
 
 /* Define to 1 if you have the <curl/curl.h> header file. */
 #define HAVE_CURL_CURL_H 1
@@ -38,13 +40,17 @@
 #define HAVE_UNISTD_H 1
 
 /* High-Quality SBR */
+#ifndef AAC_LC_ONLY
 #define HQ_SBR 1
+#endif
 
 /* Define to 1 if your C compiler doesn't accept -c and -o together. */
 /* #undef NO_MINUS_C_MINUS_O */
 
 /* Parametric-Stereo decoding */
+#ifndef AAC_LC_ONLY
 #define PARAMETRICSTEREO 1
+#endif
 
 /* GCC ARM v4 */
 /* #undef PV_ARM_GCC_V4 */
@@ -1,37 +1,49 @@
 #include "AACDecoder.h"
 
 #include <assert.h>
-#include <stdlib.h>  // for free, malloc
 #include <string.h>
+#include "AudioContainer.h"
 #include "e_tmp4audioobjecttype.h"
 #include "pvmp4audiodecoder_api.h"
 
-namespace bell {
-class AudioContainer;
-}  // namespace bell
-
 using namespace bell;
 
-AACDecoder::AACDecoder() {
-  aacDecoder =
-      (tPVMP4AudioDecoderExternal*)malloc(sizeof(tPVMP4AudioDecoderExternal));
+#ifdef AAC_LC_ONLY
+// A stereo frame of 1024 samples
+#define AAC_OUTPUT_SAMPLES 2048
+#else
+// Twice that with SBR, which decodes into pOutputBuffer_plus
+#define AAC_OUTPUT_SAMPLES 4096
+#endif
 
-  int32_t pMemRequirement = PVMP4AudioDecoderGetMemRequirements();
-  pMem = malloc(pMemRequirement);
-  memset(aacDecoder, 0, sizeof(tPVMP4AudioDecoderExternal));
-  memset(pMem, 0, pMemRequirement);
+AACDecoder::AACDecoder() {
+  // The library state is large, reuse it across streams
+  decoderMemory = CodecBufferPool::acquire(sizeof(tPVMP4AudioDecoderExternal));
+  libraryMemory =
+      CodecBufferPool::acquire(PVMP4AudioDecoderGetMemRequirements());
+  aacDecoder = CodecBufferPool::get<tPVMP4AudioDecoderExternal>(decoderMemory);
+  pMem = libraryMemory.get();
 
   // Initialize the decoder buffers
-  outputBuffer.resize(4096);
-
-  aacDecoder->pOutputBuffer_plus = &outputBuffer[2048];
-  aacDecoder->pOutputBuffer = &outputBuffer[0];
+  outputMemory = CodecBufferPool::acquire(AAC_OUTPUT_SAMPLES * sizeof(int16_t));
+  outputBuffer = CodecBufferPool::get<int16_t>(outputMemory);
+
+  aacDecoder->pOutputBuffer = outputBuffer;
+#ifdef AAC_LC_ONLY
+  aacDecoder->pOutputBuffer_plus = nullptr;
+#else
+  aacDecoder->pOutputBuffer_plus = outputBuffer + 2048;
+#endif
   aacDecoder->inputBufferMaxLength = PVMP4AUDIODECODER_INBUFSIZE;
 
   // Settings
   aacDecoder->desiredChannels = 2;
   aacDecoder->outputFormat = OUTPUTFORMAT_16PCM_INTERLEAVED;
+#ifdef AAC_LC_ONLY
+  aacDecoder->aacPlusEnabled = FALSE;
+#else
   aacDecoder->aacPlusEnabled = TRUE;
+#endif
 
   // State
   aacDecoder->inputBufferCurrentLength = 0;
@@ -43,10 +55,7 @@ AACDecoder::AACDecoder() {
   assert(PVMP4AudioDecoderInitLibrary(aacDecoder, pMem) == MP4AUDEC_SUCCESS);
 }
 
-AACDecoder::~AACDecoder() {
-  free(pMem);
-  free(aacDecoder);
-}
+AACDecoder::~AACDecoder() {}
 
 int AACDecoder::getDecodedStreamType() {
   switch (aacDecoder->extendedAudioObjectType) {
@@ -74,6 +83,33 @@ bool AACDecoder::setup(AudioContainer* container) {
   PVMP4AudioDecoderResetBuffer(pMem);
   assert(PVMP4AudioDecoderInitLibrary(aacDecoder, pMem) == MP4AUDEC_SUCCESS);
   firstFrame = true;
+
+  // Raw MP4 samples carry no ADTS header, configure from the
+  // AudioSpecificConfig instead
+  uint32_t configLen = 0;
+  uint8_t* config = container->getSetupData(configLen, AudioCodec::AAC);
+  if (config == nullptr) {
+    return true;
+  }
+
+  aacDecoder->pInputBuffer = config;
+  aacDecoder->inputBufferCurrentLength = configLen;
+  aacDecoder->inputBufferMaxLength = configLen;
+  aacDecoder->inputBufferUsedLength = 0;
+  aacDecoder->remainderBits = 0;
+  if (PVMP4AudioDecoderConfig(aacDecoder, pMem) != MP4AUDEC_SUCCESS) {
+    return false;
+  }
+
+  // Output is always upmixed / downmixed to desiredChannels
+  sampleRate = static_cast<uint32_t>(container->sampleRate);
+#ifdef AAC_LC_ONLY
+  // The container may announce the SBR rate, only the core is decoded
+  if (aacDecoder->samplingRate > 0) {
+    sampleRate = aacDecoder->samplingRate;
+  }
+#endif
+  channelCount = aacDecoder->desiredChannels;
   return true;
 }
 
@@ -108,5 +144,5 @@ uint8_t* AACDecoder::decode(uint8_t* inData, uint32_t& inLen,
   }
 
   outLen *= aacDecoder->desiredChannels;
-  return (uint8_t*)&outputBuffer[0];
+  return (uint8_t*)outputBuffer;
 }
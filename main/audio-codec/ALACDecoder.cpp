@@ -0,0 +1,125 @@
+#include "ALACDecoder.h"
+
+#include "AudioContainer.h"          // for AudioContainer
+#include "CodecType.h"               // for AudioCodec, AudioCodec::ALAC
+#include "SampleFormat.h"            // for convert, S24_3, S24_4
+#include "codec/ALACAudioTypes.h"    // for ALACSpecificConfig, ALAC_noErr
+#include "codec/ALACBitUtilities.h"  // for BitBuffer, BitBufferInit
+#include "codec/ALACDecoder.h"       // for ALACDecoder
+
+using namespace bell;
+
+// Apple's decoder is a global ALACDecoder as well, hence the bell:: below
+bell::ALACDecoder::ALACDecoder() {}
+
+bell::ALACDecoder::~ALACDecoder() {}
+
+bool bell::ALACDecoder::init(uint8_t* cookie, uint32_t cookieLen) {
+  // Init() allocates without freeing, start from a fresh instance
+  alac = std::make_unique<::ALACDecoder>();
+  lastErrno = alac->Init(cookie, cookieLen);
+  if (lastErrno != ALAC_noErr || alac->mConfig.frameLength == 0 ||
+      alac->mConfig.numChannels == 0 ||
+      alac->mConfig.numChannels > kALACMaxChannels) {
+    alac.reset();
+    return false;
+  }
+
+  frameLength = alac->mConfig.frameLength;
+  streamBitDepth = alac->mConfig.bitDepth;
+  sampleRate = alac->mConfig.sampleRate;
+  channelCount = alac->mConfig.numChannels;
+  bitDepth = streamBitDepth == 16 ? 16 : streamBitDepth == 32 ? 32 : 24;
+
+  // Only grows, frame lengths rarely change within a session
+  uint32_t size = maxFrameSize();
+  if (size > pcmBufferSize) {
+    pcmBuffer = CodecBufferPool::acquire(size);
+    pcmBufferSize = size;
+  }
+  return true;
+}
+
+bool bell::ALACDecoder::setup(uint32_t sampleRate, uint8_t channelCount,
+                              uint8_t bitDepth) {
+  // ALACSpecificConfig with the encoder defaults, big endian
+  uint8_t cookie[24] = {0};
+  uint32_t frameLength = kALACDefaultFramesPerPacket;
+  cookie[0] = frameLength >> 24;
+  cookie[1] = frameLength >> 16;
+  cookie[2] = frameLength >> 8;
+  cookie[3] = frameLength;
+  cookie[5] = bitDepth;
+  cookie[6] = 40;  // pb
+  cookie[7] = 10;  // mb
+  cookie[8] = 14;  // kb
+  cookie[9] = channelCount;
+  cookie[11] = 255;  // maxRun
+  cookie[20] = sampleRate >> 24;
+  cookie[21] = sampleRate >> 16;
+  cookie[22] = sampleRate >> 8;
+  cookie[23] = sampleRate;
+  return init(cookie, sizeof(cookie));
+}
+
+bool bell::ALACDecoder::setup(AudioContainer* container) {
+  uint32_t cookieLen;
+  uint8_t* cookie = container->getSetupData(cookieLen, AudioCodec::ALAC);
+  if (!cookie || cookieLen < sizeof(ALACSpecificConfig)) {
+    return false;
+  }
+  return init(cookie, cookieLen);
+}
+
+uint32_t bell::ALACDecoder::maxFrameSize() {
+  return frameLength * channelCount * (streamBitDepth == 16 ? 2 : 4);
+}
+
+uint8_t* bell::ALACDecoder::decode(uint8_t* inData, uint32_t& inLen,
+                                   uint32_t& outLen) {
+  uint8_t* out = CodecBufferPool::get<uint8_t>(pcmBuffer);
+  if (!decodeInto(inData, inLen, out, outLen)) {
+    return nullptr;
+  }
+  return out;
+}
+
+bool bell::ALACDecoder::decodeInto(uint8_t* inData, uint32_t& inLen,
+                                   uint8_t* out, uint32_t& outLen) {
+  outLen = 0;
+  if (!inData || inLen == 0 || !alac) {
+    return false;
+  }
+
+  uint32_t samples = channelCount * frameLength;
+  // 20 and 24-bit output is packed, have it land in the tail of out so it can
+  // be widened in place
+  uint8_t* packed = out;
+  bool widen = streamBitDepth == 20 || streamBitDepth == 24;
+  if (widen) {
+    packed = out + samples;
+  }
+
+  BitBuffer bits;
+  BitBufferInit(&bits, inData, inLen);
+  uint32_t frames = 0;
+  lastErrno = alac->Decode(&bits, packed, frameLength, channelCount, &frames);
+
+  // A packet is always decoded whole
+  inLen = 0;
+  if (lastErrno != ALAC_noErr) {
+    return false;
+  }
+
+  samples = frames * channelCount;
+  if (widen) {
+    // Sample i is read from packed before out[i] overwrites it. 20-bit
+    // samples are already left-aligned in their 24 bits
+    bell::dsp::convert<bell::dsp::S24_3, bell::dsp::S24_4>(packed, out,
+                                                           samples);
+    outLen = samples * sizeof(int32_t);
+  } else {
+    outLen = samples * (streamBitDepth / 8);
+  }
+  return true;
+}
@@ -1,6 +1,7 @@
 #include "AudioCodecs.h"
 
 #include <map>          // for map, operator!=, map<>::iterator, map<>:...
+#include <mutex>        // for mutex, scoped_lock
 #include <type_traits>  // for remove_extent_t
 
 #include "AudioContainer.h"  // for AudioContainer
@@ -13,67 +14,125 @@ using namespace bell;
 
 #ifdef BELL_CODEC_AAC
 #include "AACDecoder.h"  // for AACDecoder
-
-static std::shared_ptr<AACDecoder> codecAac;
 #endif
 
 #ifdef BELL_CODEC_MP3
 #include "MP3Decoder.h"  // for MP3Decoder
-
-static std::shared_ptr<MP3Decoder> codecMp3;
 #endif
 
 #ifdef BELL_CODEC_VORBIS
 #include "VorbisDecoder.h"  // for VorbisDecoder
+#endif
+
+#ifdef BELL_CODEC_ALAC
+#include "ALACDecoder.h"  // for ALACDecoder
+#endif
 
-static std::shared_ptr<VorbisDecoder> codecVorbis;
+#ifdef BELL_CODEC_FLAC
+#include "FLACDecoder.h"  // for FLACDecoder
 #endif
 
 #ifdef BELL_CODEC_OPUS
 #include "OPUSDecoder.h"  // for OPUSDecoder
-
-static std::shared_ptr<OPUSDecoder> codecOpus;
 #endif
 
-std::map<AudioCodec, std::shared_ptr<BaseCodec>> customCodecs;
+static std::mutex codecsMutex;
+static std::map<AudioCodec, std::shared_ptr<BaseCodec>> sharedCodecs;
+static std::map<AudioCodec, std::shared_ptr<BaseCodec>> customCodecs;
+static std::map<AudioCodec, AudioCodecs::CodecFactory> customFactories;
+static std::map<AudioCodec, std::shared_ptr<BaseCodec>> preparedCodecs;
+
+static std::shared_ptr<BaseCodec> newCodec(AudioCodec type) {
+  {
+    std::scoped_lock lock(codecsMutex);
+    if (customCodecs.find(type) != customCodecs.end())
+      return customCodecs[type];
+    if (customFactories.find(type) != customFactories.end())
+      return customFactories[type]();
+  }
 
-std::shared_ptr<BaseCodec> AudioCodecs::getCodec(AudioCodec type) {
-  if (customCodecs.find(type) != customCodecs.end())
-    return customCodecs[type];
   switch (type) {
 #ifdef BELL_CODEC_AAC
     case AudioCodec::AAC:
-      if (codecAac)
-        return codecAac;
-      codecAac = std::make_shared<AACDecoder>();
-      return codecAac;
+      return std::make_shared<AACDecoder>();
 #endif
 #ifdef BELL_CODEC_MP3
     case AudioCodec::MP3:
-      if (codecMp3)
-        return codecMp3;
-      codecMp3 = std::make_shared<MP3Decoder>();
-      return codecMp3;
+      return std::make_shared<MP3Decoder>();
 #endif
 #ifdef BELL_CODEC_VORBIS
     case AudioCodec::VORBIS:
-      if (codecVorbis)
-        return codecVorbis;
-      codecVorbis = std::make_shared<VorbisDecoder>();
-      return codecVorbis;
+      return std::make_shared<VorbisDecoder>();
+#endif
+#ifdef BELL_CODEC_ALAC
+    case AudioCodec::ALAC:
+      return std::make_shared<bell::ALACDecoder>();
+#endif
+#ifdef BELL_CODEC_FLAC
+    case AudioCodec::FLAC:
+      return std::make_shared<FLACDecoder>();
 #endif
 #ifdef BELL_CODEC_OPUS
     case AudioCodec::OPUS:
-      if (codecOpus)
-        return codecOpus;
-      codecOpus = std::make_shared<OPUSDecoder>();
-      return codecOpus;
+      return std::make_shared<OPUSDecoder>();
 #endif
     default:
       return nullptr;
   }
 }
 
+std::shared_ptr<BaseCodec> AudioCodecs::createCodec(AudioCodec type) {
+  {
+    std::scoped_lock lock(codecsMutex);
+    auto prepared = preparedCodecs.find(type);
+    if (prepared != preparedCodecs.end()) {
+      auto codec = prepared->second;
+      preparedCodecs.erase(prepared);
+      return codec;
+    }
+  }
+  return newCodec(type);
+}
+
+void AudioCodecs::prepareCodec(AudioCodec type) {
+  {
+    std::scoped_lock lock(codecsMutex);
+    if (preparedCodecs.find(type) != preparedCodecs.end())
+      return;
+  }
+
+  auto codec = newCodec(type);
+  if (codec == nullptr)
+    return;
+
+  std::scoped_lock lock(codecsMutex);
+  preparedCodecs.try_emplace(type, codec);
+}
+
+std::shared_ptr<BaseCodec> AudioCodecs::createCodec(AudioContainer* container) {
+  auto codec = createCodec(container->getCodec());
+  if (codec != nullptr) {
+    codec->setup(container);
+  }
+  return codec;
+}
+
+std::shared_ptr<BaseCodec> AudioCodecs::getCodec(AudioCodec type) {
+  {
+    std::scoped_lock lock(codecsMutex);
+    auto shared = sharedCodecs.find(type);
+    if (shared != sharedCodecs.end())
+      return shared->second;
+  }
+
+  auto codec = newCodec(type);
+  if (codec == nullptr)
+    return nullptr;
+
+  std::scoped_lock lock(codecsMutex);
+  return sharedCodecs.try_emplace(type, codec).first->second;
+}
+
 std::shared_ptr<BaseCodec> AudioCodecs::getCodec(AudioContainer* container) {
   auto codec = getCodec(container->getCodec());
   if (codec != nullptr) {
@@ -81,7 +140,19 @@ std::shared_ptr<BaseCodec> AudioCodecs::getCodec(AudioContainer* container) {
   }
   return codec;
 }
+
 void AudioCodecs::addCodec(AudioCodec type,
                            const std::shared_ptr<BaseCodec>& codec) {
+  std::scoped_lock lock(codecsMutex);
   customCodecs[type] = codec;
+  sharedCodecs.erase(type);
+  preparedCodecs.erase(type);
+}
+
+void AudioCodecs::addCodecFactory(AudioCodec type,
+                                  const CodecFactory& factory) {
+  std::scoped_lock lock(codecsMutex);
+  customFactories[type] = factory;
+  sharedCodecs.erase(type);
+  preparedCodecs.erase(type);
 }
@@ -1,6 +1,12 @@
 #include "BaseCodec.h"
 
-#include "AudioContainer.h"  // for AudioContainer
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+
+#include "AudioContainer.h"    // for AudioContainer
+#include "BellMetrics.h"       // for BELL_METRIC_SCOPE
+#include "BellTrace.h"         // for BELL_TRACE_SCOPE
+#include "SampleConversion.h"  // for deinterleave
 
 using namespace bell;
 
@@ -9,19 +15,126 @@ bool BaseCodec::setup(AudioContainer* container) {
 }
 
 uint8_t* BaseCodec::decode(AudioContainer* container, uint32_t& outLen) {
+  pendingLen = 0;
+  return decodeSample(container, nullptr, 0, outLen);
+}
+
+uint32_t BaseCodec::decode(AudioContainer* container, uint8_t* out,
+                           uint32_t capacity, uint32_t maxFrames) {
+  uint32_t written = std::min(pendingLen, capacity);
+  memcpy(out, pendingData, written);
+  pendingData += written;
+  pendingLen -= written;
+
+  for (uint32_t frame = 0; frame < maxFrames && written < capacity; frame++) {
+    uint32_t outLen = 0;
+    uint8_t* result =
+        decodeSample(container, out + written, capacity - written, outLen);
+    if (result == nullptr) {
+      break;
+    }
+
+    // Decoded in place, nothing to copy
+    if (result == out + written) {
+      written += outLen;
+      continue;
+    }
+
+    uint32_t toCopy = std::min(outLen, capacity - written);
+    memcpy(out + written, result, toCopy);
+    written += toCopy;
+
+    // Codec buffer stays valid until the next decode
+    pendingData = result + toCopy;
+    pendingLen = outLen - toCopy;
+  }
+
+  return written;
+}
+
+uint32_t BaseCodec::decodePlanar(AudioContainer* container,
+                                 void* const* planes, uint32_t capacity) {
+  if (outputFormat == OutputFormat::INTERLEAVED) {
+    return 0;
+  }
+
+  uint32_t nativeFrames = maxFrameSamples();
+  if (pendingLen == 0 && isNativeOutput(outputFormat) && nativeFrames > 0 &&
+      capacity >= nativeFrames) {
+    uint8_t* data = readSample(container);
+    if (data == nullptr) {
+      return 0;
+    }
+    BELL_METRIC_SCOPE("codec.decode");
+    BELL_TRACE_SCOPE("codec.decode");
+    uint32_t frames = 0;
+    if (!decodePlanarInto(data, availableBytes, outputFormat, planes,
+                          frames)) {
+      frames = 0;
+    }
+    container->consumeBytes(lastSampleLen - availableBytes);
+    return frames;
+  }
+
+  // Converted from the interleaved output, skipping frames without samples
+  while (pendingLen == 0) {
+    uint32_t outLen = 0;
+    pendingData = decodeSample(container, nullptr, 0, outLen);
+    if (pendingData == nullptr) {
+      return 0;
+    }
+    pendingLen = outLen;
+  }
+
+  PcmFormat format = getPcmFormat();
+  uint32_t frameBytes = pcmBytesPerSample(format) * channelCount;
+  uint32_t frames = std::min(pendingLen / frameBytes, capacity);
+  if (outputFormat == OutputFormat::PLANAR_FLOAT) {
+    dsp::deinterleave(pendingData, format, (float* const*)planes, channelCount,
+                      frames);
+  } else {
+    dsp::deinterleave(pendingData, format, (int32_t* const*)planes,
+                      channelCount, frames);
+  }
+  pendingData += frames * frameBytes;
+  pendingLen -= frames * frameBytes;
+  if (pendingLen < frameBytes) {
+    // A partial frame can't be converted, drop it
+    pendingLen = 0;
+  }
+  return frames;
+}
+
+uint8_t* BaseCodec::readSample(AudioContainer* container) {
   auto* data = container->readSample(lastSampleLen);
-  if (data == nullptr) {
-    outLen = 0;
+  if (data == nullptr || lastSampleLen == 0) {
     return nullptr;
   }
+  availableBytes = lastSampleLen;
+  if (container->takeDataLoss()) {
+    onDataLost();
+  }
+  return (uint8_t*)data;
+}
 
-  if (lastSampleLen == 0) {
+uint8_t* BaseCodec::decodeSample(AudioContainer* container, uint8_t* out,
+                                 uint32_t outCapacity, uint32_t& outLen) {
+  uint8_t* data = readSample(container);
+  if (data == nullptr) {
     outLen = 0;
     return nullptr;
   }
 
-  availableBytes = lastSampleLen;
-  auto* result = decode((uint8_t*)data, availableBytes, outLen);
+  // Per codec frame, container reads excluded
+  BELL_METRIC_SCOPE("codec.decode");
+  BELL_TRACE_SCOPE("codec.decode");
+  uint8_t* result;
+  uint32_t frameSize = maxFrameSize();
+  if (frameSize > 0 && outCapacity >= frameSize) {
+    result = decodeInto(data, availableBytes, out, outLen) ? out : nullptr;
+  } else {
+    result = decode(data, availableBytes, outLen);
+  }
   container->consumeBytes(lastSampleLen - availableBytes);
 
   return result;
@@ -0,0 +1,81 @@
+#include "CodecBufferPool.h"
+
+#include <string.h>  // for memset
+#include <new>       // for bad_alloc
+
+#include "BellAllocator.h"  // for Allocator
+#include "BellMetrics.h"    // for MemoryAccount
+
+using namespace bell;
+
+static void* allocateDefault(size_t size) {
+  return bell::Allocator::allocate(size);
+}
+
+#ifdef ESP_PLATFORM
+static void* allocateExternal(size_t size) {
+  return bell::Allocator::allocate(size, bell::Allocator::PSRAM);
+}
+
+const CodecBufferPool::Allocator CodecBufferPool::EXTERNAL_RAM = {
+    allocateExternal, bell::Allocator::release};
+#endif
+
+CodecBufferPool::Allocator CodecBufferPool::allocator = {
+    allocateDefault, bell::Allocator::release};
+std::mutex CodecBufferPool::poolMutex;
+std::multimap<size_t, void*> CodecBufferPool::idleBuffers;
+
+// Buffers in use and idle ones, guarded by poolMutex
+static size_t heldBytes = 0;
+static MemoryAccount memory("codec");
+
+void CodecBufferPool::Release::operator()(void* buffer) const {
+  if (buffer == nullptr) {
+    return;
+  }
+
+  std::scoped_lock lock(poolMutex);
+  idleBuffers.emplace(size, buffer);
+}
+
+CodecBufferPool::Buffer CodecBufferPool::acquire(size_t size) {
+  void* buffer = nullptr;
+  {
+    std::scoped_lock lock(poolMutex);
+    auto idle = idleBuffers.find(size);
+    if (idle != idleBuffers.end()) {
+      buffer = idle->second;
+      idleBuffers.erase(idle);
+    }
+  }
+
+  if (buffer == nullptr) {
+    buffer = allocator.allocate(size);
+    if (buffer == nullptr) {
+      throw std::bad_alloc();
+    }
+    std::scoped_lock lock(poolMutex);
+    heldBytes += size;
+    memory.resize(heldBytes);
+  }
+
+  memset(buffer, 0, size);
+  return Buffer(buffer, Release{size});
+}
+
+void CodecBufferPool::trim() {
+  std::scoped_lock lock(poolMutex);
+  for (auto& [size, buffer] : idleBuffers) {
+    allocator.release(buffer);
+    heldBytes -= size;
+  }
+  idleBuffers.clear();
+  memory.resize(heldBytes);
+}
+
+void CodecBufferPool::setAllocator(const Allocator& newAllocator) {
+  trim();
+  std::scoped_lock lock(poolMutex);
+  allocator = newAllocator;
+}
@@ -0,0 +1,544 @@
+#include "FLACDecoder.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+
+#include "AudioContainer.h"  // for AudioContainer
+#include "CodecType.h"       // for AudioCodec, AudioCodec::FLAC
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace bell;
+
+namespace bell {
+/**
+ * MSB-first reader over one frame. Reads past the end return zeroes and mark
+ * the reader as exhausted.
+ */
+class FLACBitReader {
+ public:
+  FLACBitReader(const uint8_t* data, size_t len)
+      : data(data), pos(data), end(data + len) {}
+
+  // Reads up to 32 bits
+  uint32_t read(uint32_t bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    refill();
+    uint32_t value = cache >> (64 - bits);
+    cache <<= bits;
+    cached -= bits;
+    return value;
+  }
+
+  int32_t readSigned(uint32_t bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    return (int32_t)(read(bits) << (32 - bits)) >> (32 - bits);
+  }
+
+  // Counts zero bits up to the next one, which is consumed as well
+  uint32_t readUnary() {
+    uint32_t zeros = 0;
+    while (true) {
+      refill();
+      // Bits past the cached ones are always zero
+      if (cache != 0) {
+        uint32_t leading = __builtin_clzll(cache);
+        cache <<= leading;
+        cache <<= 1;
+        cached -= leading + 1;
+        return zeros + leading;
+      }
+      zeros += cached;
+      cached = 0;
+      if (exhausted()) {
+        return zeros;
+      }
+    }
+  }
+
+  void alignToByte() {
+    uint32_t skip = cached & 7;
+    cache <<= skip;
+    cached -= skip;
+  }
+
+  // Bytes read so far, the reader has to be byte aligned
+  size_t bytePosition() const { return (pos - data) + padding - cached / 8; }
+
+  bool exhausted() const {
+    return padding > 0 && (size_t)padding * 8 > cached;
+  }
+
+ private:
+  const uint8_t* data;
+  const uint8_t* pos;
+  const uint8_t* end;
+  uint64_t cache = 0;
+  uint32_t cached = 0;
+  // Zero bytes fed in past the end
+  uint32_t padding = 0;
+
+  void refill() {
+    while (cached <= 56) {
+      uint64_t byte = 0;
+      if (pos < end) {
+        byte = *pos++;
+      } else {
+        padding++;
+      }
+      cache |= byte << (56 - cached);
+      cached += 8;
+    }
+  }
+};
+}  // namespace bell
+
+// Fixed predictors of order 0 - 4, samples before order are the warm-up
+template <typename Acc>
+static void restoreFixed(int32_t* x, uint32_t count, uint32_t order) {
+  switch (order) {
+    case 1:
+      for (uint32_t i = 1; i < count; i++) {
+        x[i] += x[i - 1];
+      }
+      break;
+    case 2:
+      for (uint32_t i = 2; i < count; i++) {
+        x[i] += (Acc)2 * x[i - 1] - x[i - 2];
+      }
+      break;
+    case 3:
+      for (uint32_t i = 3; i < count; i++) {
+        x[i] += (Acc)3 * (x[i - 1] - x[i - 2]) + x[i - 3];
+      }
+      break;
+    case 4:
+      for (uint32_t i = 4; i < count; i++) {
+        x[i] += (Acc)4 * (x[i - 1] + x[i - 3]) - (Acc)6 * x[i - 2] - x[i - 4];
+      }
+      break;
+  }
+}
+
+// Predictions that may not fit 32 bits
+static void restoreLpcWide(int32_t* x, uint32_t count, const int32_t* coefs,
+                           uint32_t order, int shift) {
+  for (uint32_t i = order; i < count; i++) {
+    int64_t sum = 0;
+    for (uint32_t j = 0; j < order; j++) {
+      sum += (int64_t)coefs[j] * x[i - 1 - j];
+    }
+    x[i] += (int32_t)(sum >> shift);
+  }
+}
+
+/**
+ * LPC restoration with 32-bit sums. The recursion runs across samples, so the
+ * vector units work along the coefficients of one prediction instead: they are
+ * reversed and front-padded to a multiple of 4 so that a prediction is the dot
+ * product of two contiguous arrays.
+ */
+static void restoreLpc(int32_t* x, uint32_t count, const int32_t* coefs,
+                       uint32_t order, int shift) {
+  uint32_t padded = (order + 3) & ~3u;
+  alignas(16) int32_t reversed[32] = {0};
+  for (uint32_t j = 0; j < order; j++) {
+    reversed[padded - 1 - j] = coefs[j];
+  }
+
+  // Samples whose padded window would reach before the block
+  uint32_t i = order;
+  for (; i < std::min(padded, count); i++) {
+    int32_t sum = 0;
+    for (uint32_t j = 0; j < order; j++) {
+      sum += coefs[j] * x[i - 1 - j];
+    }
+    x[i] += sum >> shift;
+  }
+
+#if defined(__SSE4_1__)
+  for (; i < count; i++) {
+    const int32_t* window = x + i - padded;
+    __m128i acc = _mm_setzero_si128();
+    for (uint32_t k = 0; k < padded; k += 4) {
+      acc = _mm_add_epi32(
+          acc, _mm_mullo_epi32(_mm_loadu_si128((const __m128i*)(window + k)),
+                               _mm_load_si128((const __m128i*)(reversed + k))));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    x[i] += _mm_cvtsi128_si32(acc) >> shift;
+  }
+#elif defined(__ARM_NEON)
+  for (; i < count; i++) {
+    const int32_t* window = x + i - padded;
+    int32x4_t acc = vdupq_n_s32(0);
+    for (uint32_t k = 0; k < padded; k += 4) {
+      acc = vmlaq_s32(acc, vld1q_s32(window + k), vld1q_s32(reversed + k));
+    }
+#if defined(__aarch64__)
+    int32_t sum = vaddvq_s32(acc);
+#else
+    int32x2_t half = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    int32_t sum = vget_lane_s32(vpadd_s32(half, half), 0);
+#endif
+    x[i] += sum >> shift;
+  }
+#else
+  for (; i < count; i++) {
+    const int32_t* window = x + i - padded;
+    int32_t sum = 0;
+    for (uint32_t k = 0; k < padded; k++) {
+      sum += reversed[k] * window[k];
+    }
+    x[i] += sum >> shift;
+  }
+#endif
+}
+
+FLACDecoder::FLACDecoder() {}
+
+FLACDecoder::~FLACDecoder() {}
+
+bool FLACDecoder::configure(const flac::StreamInfo& info) {
+  if (info.channels == 0 || info.channels > MAX_CHANNELS ||
+      info.bitsPerSample > 32 || info.maxBlockSize == 0) {
+    return false;
+  }
+  this->info = info;
+
+  sampleRate = info.sampleRate;
+  channelCount = info.channels;
+  bitDepth = info.bitsPerSample <= 16 ? 16 : info.bitsPerSample <= 24 ? 24 : 32;
+
+  // Buffers only grow, the pool keeps them around for the next stream
+  if (info.maxBlockSize > blockCapacity) {
+    blockCapacity = info.maxBlockSize;
+    channelBuffer = CodecBufferPool::acquire(blockCapacity * MAX_CHANNELS *
+                                             sizeof(int32_t));
+    pcmBuffer = CodecBufferPool::acquire(blockCapacity * MAX_CHANNELS *
+                                         sizeof(int32_t));
+    for (uint32_t ch = 0; ch < MAX_CHANNELS; ch++) {
+      channelData[ch] =
+          CodecBufferPool::get<int32_t>(channelBuffer) + ch * blockCapacity;
+    }
+  }
+  return true;
+}
+
+bool FLACDecoder::setup(uint32_t sampleRate, uint8_t channelCount,
+                        uint8_t bitDepth) {
+  flac::StreamInfo manual = {};
+  manual.minBlockSize = 16;
+  manual.maxBlockSize = flac::SUBSET_MAX_BLOCK_SIZE;
+  manual.sampleRate = sampleRate;
+  manual.channels = channelCount;
+  manual.bitsPerSample = bitDepth;
+  return configure(manual);
+}
+
+bool FLACDecoder::setup(AudioContainer* container) {
+  uint32_t len;
+  uint8_t* data = container->getSetupData(len, AudioCodec::FLAC);
+  flac::StreamInfo streamInfo;
+  if (!data || !flac::parseStreamInfo(data, len, streamInfo)) {
+    return false;
+  }
+  return configure(streamInfo);
+}
+
+uint32_t FLACDecoder::maxFrameSize() {
+  return blockCapacity * info.channels * (bitDepth == 16 ? 2 : 4);
+}
+
+uint8_t* FLACDecoder::decode(uint8_t* inData, uint32_t& inLen,
+                             uint32_t& outLen) {
+  uint8_t* out = CodecBufferPool::get<uint8_t>(pcmBuffer);
+  if (!decodeInto(inData, inLen, out, outLen)) {
+    return nullptr;
+  }
+  return out;
+}
+
+bool FLACDecoder::decodeInto(uint8_t* inData, uint32_t& inLen, uint8_t* out,
+                             uint32_t& outLen) {
+  outLen = 0;
+  if (!decodeBlock(inData, inLen)) {
+    return false;
+  }
+  interleave(out, outLen);
+  return true;
+}
+
+bool FLACDecoder::decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                                   OutputFormat outputFormat,
+                                   void* const* planes, uint32_t& frames) {
+  frames = 0;
+  if (!decodeBlock(inData, inLen)) {
+    return false;
+  }
+
+  uint32_t count = frame.blockSize;
+  channelCount = frame.channels;
+  for (uint32_t ch = 0; ch < frame.channels; ch++) {
+    const int32_t* in = channelData[ch];
+    if (outputFormat == OutputFormat::PLANAR_FLOAT) {
+      float* out = ((float* const*)planes)[ch];
+      float scale = 1.0f / (float)(1u << (frame.bitsPerSample - 1));
+      for (uint32_t i = 0; i < count; i++) {
+        out[i] = in[i] * scale;
+      }
+    } else {
+      int32_t* out = ((int32_t* const*)planes)[ch];
+      int shift = 32 - std::min<int>(frame.bitsPerSample, 32);
+      for (uint32_t i = 0; i < count; i++) {
+        out[i] = (int32_t)((uint32_t)in[i] << shift);
+      }
+    }
+  }
+  frames = count;
+  return true;
+}
+
+bool FLACDecoder::decodeBlock(uint8_t* inData, uint32_t& inLen) {
+  if (!inData || inLen == 0 || blockCapacity == 0) {
+    return false;
+  }
+
+  uint32_t frameLen = 0;
+  if (!decodeFrame(inData, inLen, frameLen)) {
+    // Most likely a false sync, have the container search again from the
+    // next byte
+    inLen -= 1;
+    return false;
+  }
+
+  inLen -= frameLen;
+  sampleRate = frame.sampleRate;
+  return true;
+}
+
+bool FLACDecoder::decodeFrame(const uint8_t* inData, uint32_t inLen,
+                              uint32_t& frameLen) {
+  if (!flac::parseFrameHeader(inData, inLen, info, frame) ||
+      frame.blockSize > blockCapacity || frame.channels > info.channels ||
+      frame.bitsPerSample != info.bitsPerSample) {
+    lastErrno = -1;
+    return false;
+  }
+
+  FLACBitReader bits(inData + frame.size, inLen - frame.size);
+  for (uint32_t ch = 0; ch < frame.channels; ch++) {
+    // Side channels carry one extra bit
+    uint32_t bps = frame.bitsPerSample;
+    if ((frame.channelAssignment == 8 && ch == 1) ||
+        (frame.channelAssignment == 9 && ch == 0) ||
+        (frame.channelAssignment == 10 && ch == 1)) {
+      bps++;
+    }
+    if (bps > 32 || !decodeSubframe(bits, channelData[ch], bps)) {
+      lastErrno = -2;
+      return false;
+    }
+  }
+
+  bits.alignToByte();
+  size_t crcPos = frame.size + bits.bytePosition();
+  uint16_t crc = bits.read(16);
+  if (bits.exhausted() || flac::crc16(inData, crcPos) != crc) {
+    lastErrno = -3;
+    return false;
+  }
+  frameLen = crcPos + 2;
+
+  // Stereo decorrelation
+  int32_t* left = channelData[0];
+  int32_t* right = channelData[1];
+  uint32_t count = frame.blockSize;
+  switch (frame.channelAssignment) {
+    case 8:
+      for (uint32_t i = 0; i < count; i++) {
+        right[i] = left[i] - right[i];
+      }
+      break;
+    case 9:
+      for (uint32_t i = 0; i < count; i++) {
+        left[i] += right[i];
+      }
+      break;
+    case 10:
+      for (uint32_t i = 0; i < count; i++) {
+        int32_t side = right[i];
+        int32_t mid = (int32_t)((uint32_t)left[i] << 1) | (side & 1);
+        left[i] = (mid + side) >> 1;
+        right[i] = (mid - side) >> 1;
+      }
+      break;
+  }
+  return true;
+}
+
+bool FLACDecoder::decodeSubframe(FLACBitReader& bits, int32_t* out,
+                                 uint32_t bps) {
+  uint32_t count = frame.blockSize;
+  if (bits.read(1) != 0) {
+    return false;
+  }
+  uint32_t type = bits.read(6);
+
+  uint32_t wasted = 0;
+  if (bits.read(1)) {
+    wasted = bits.readUnary() + 1;
+    if (wasted >= bps) {
+      return false;
+    }
+    bps -= wasted;
+  }
+
+  if (type == 0) {
+    // CONSTANT
+    std::fill(out, out + count, bits.readSigned(bps));
+  } else if (type == 1) {
+    // VERBATIM
+    for (uint32_t i = 0; i < count; i++) {
+      out[i] = bits.readSigned(bps);
+    }
+  } else if (type >= 8 && type <= 12) {
+    // FIXED
+    uint32_t order = type - 8;
+    if (order > count) {
+      return false;
+    }
+    for (uint32_t i = 0; i < order; i++) {
+      out[i] = bits.readSigned(bps);
+    }
+    if (!decodeResidual(bits, out, order)) {
+      return false;
+    }
+    if (bps + wasted <= 24) {
+      restoreFixed<int32_t>(out, count, order);
+    } else {
+      restoreFixed<int64_t>(out, count, order);
+    }
+  } else if (type >= 32) {
+    // LPC
+    uint32_t order = type - 31;
+    if (order > count) {
+      return false;
+    }
+    for (uint32_t i = 0; i < order; i++) {
+      out[i] = bits.readSigned(bps);
+    }
+
+    uint32_t precision = bits.read(4) + 1;
+    int shift = bits.readSigned(5);
+    if (precision == 16 || shift < 0) {
+      return false;
+    }
+    int32_t coefs[MAX_LPC_ORDER];
+    uint32_t magnitude = 0;
+    for (uint32_t i = 0; i < order; i++) {
+      coefs[i] = bits.readSigned(precision);
+    }
+    while ((1u << magnitude) < order) {
+      magnitude++;
+    }
+
+    if (!decodeResidual(bits, out, order)) {
+      return false;
+    }
+    // Sample, coefficient and sum of order products have to fit 32 bits
+    if (bps + precision + magnitude <= 32) {
+      restoreLpc(out, count, coefs, order, shift);
+    } else {
+      restoreLpcWide(out, count, coefs, order, shift);
+    }
+  } else {
+    return false;
+  }
+
+  if (wasted > 0) {
+    for (uint32_t i = 0; i < count; i++) {
+      out[i] = (int32_t)((uint32_t)out[i] << wasted);
+    }
+  }
+  return !bits.exhausted();
+}
+
+bool FLACDecoder::decodeResidual(FLACBitReader& bits, int32_t* out,
+                                 uint32_t order) {
+  uint32_t method = bits.read(2);
+  if (method > 1) {
+    return false;
+  }
+  uint32_t paramBits = method == 0 ? 4 : 5;
+  uint32_t escape = method == 0 ? 15 : 31;
+
+  uint32_t partitionOrder = bits.read(4);
+  uint32_t partitionSize = frame.blockSize >> partitionOrder;
+  if ((partitionSize << partitionOrder) != frame.blockSize ||
+      partitionSize < order) {
+    return false;
+  }
+
+  int32_t* residual = out + order;
+  for (uint32_t p = 0; p < (1u << partitionOrder); p++) {
+    uint32_t count = p == 0 ? partitionSize - order : partitionSize;
+    uint32_t param = bits.read(paramBits);
+    if (param == escape) {
+      uint32_t rawBits = bits.read(5);
+      for (uint32_t i = 0; i < count; i++) {
+        residual[i] = bits.readSigned(rawBits);
+      }
+    } else {
+      // Rice codes, unary quotient through a count of leading zeros
+      for (uint32_t i = 0; i < count; i++) {
+        uint32_t value = (bits.readUnary() << param) | bits.read(param);
+        residual[i] = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+      }
+    }
+    residual += count;
+    if (bits.exhausted()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FLACDecoder::interleave(uint8_t* out, uint32_t& outLen) {
+  uint32_t count = frame.blockSize;
+  uint32_t channels = frame.channels;
+  channelCount = channels;
+
+  if (bitDepth == 16) {
+    int16_t* pcm = (int16_t*)out;
+    int shift = 16 - std::min<int>(frame.bitsPerSample, 16);
+    for (uint32_t ch = 0; ch < channels; ch++) {
+      const int32_t* in = channelData[ch];
+      for (uint32_t i = 0; i < count; i++) {
+        pcm[i * channels + ch] = (int16_t)((uint32_t)in[i] << shift);
+      }
+    }
+    outLen = count * channels * sizeof(int16_t);
+    return;
+  }
+
+  // INT24_IN_32 and INT32 are left-justified
+  int32_t* pcm = (int32_t*)out;
+  int shift = 32 - std::min<int>(frame.bitsPerSample, 32);
+  for (uint32_t ch = 0; ch < channels; ch++) {
+    const int32_t* in = channelData[ch];
+    for (uint32_t i = 0; i < count; i++) {
+      pcm[i * channels + ch] = (int32_t)((uint32_t)in[i] << shift);
+    }
+  }
+  outLen = count * channels * sizeof(int32_t);
+}
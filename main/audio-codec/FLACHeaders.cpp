@@ -0,0 +1,183 @@
+#include "FLACHeaders.h"
+
+#include <array>  // for array
+
+using namespace bell;
+
+// Sample rates of header codes 1 - 11, code 0 defers to STREAMINFO
+static const uint32_t SAMPLE_RATES[12] = {0,     88200, 176400, 192000,
+                                          8000,  16000, 22050,  24000,
+                                          32000, 44100, 48000,  96000};
+
+// Sample sizes of header codes, 0 defers to STREAMINFO and 3 is reserved
+static const uint8_t SAMPLE_SIZES[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+
+static uint32_t readBE(const uint8_t* data, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+bool flac::parseStreamInfo(const uint8_t* data, size_t len,
+                           StreamInfo& info) {
+  if (len < STREAMINFO_SIZE) {
+    return false;
+  }
+
+  info.minBlockSize = readBE(data, 2);
+  info.maxBlockSize = readBE(data + 2, 2);
+  info.minFrameSize = readBE(data + 4, 3);
+  info.maxFrameSize = readBE(data + 7, 3);
+  info.sampleRate = readBE(data + 10, 3) >> 4;
+  info.channels = ((data[12] >> 1) & 0x07) + 1;
+  info.bitsPerSample = (((data[12] & 0x01) << 4) | (data[13] >> 4)) + 1;
+  info.totalSamples = (uint64_t)(data[13] & 0x0F) << 32 | readBE(data + 14, 4);
+
+  return info.minBlockSize >= 16 && info.maxBlockSize >= info.minBlockSize &&
+         info.sampleRate > 0 && info.bitsPerSample >= 4;
+}
+
+bool flac::parseFrameHeader(const uint8_t* data, size_t len,
+                            const StreamInfo& info, FrameHeader& header) {
+  if (len < 6 || data[0] != 0xFF || (data[1] & 0xFE) != 0xF8) {
+    return false;
+  }
+
+  bool variableBlockSize = data[1] & 0x01;
+  uint8_t blockSizeCode = data[2] >> 4;
+  uint8_t sampleRateCode = data[2] & 0x0F;
+  uint8_t channelCode = data[3] >> 4;
+  uint8_t sampleSizeCode = (data[3] >> 1) & 0x07;
+  if (blockSizeCode == 0 || sampleRateCode == 15 || channelCode > 10 ||
+      sampleSizeCode == 3 || (data[3] & 0x01)) {
+    return false;
+  }
+
+  // Frame or sample number, UTF-8 style coded on up to 7 bytes
+  size_t pos = 4;
+  uint8_t lead = data[pos++];
+  uint64_t number;
+  int extraBytes;
+  if (!(lead & 0x80)) {
+    number = lead;
+    extraBytes = 0;
+  } else if (lead == 0xFE) {
+    number = 0;
+    extraBytes = 6;
+  } else {
+    extraBytes = 1;
+    while (extraBytes < 6 && (lead & (0x40 >> extraBytes))) {
+      extraBytes++;
+    }
+    if (!(lead & 0x40) || extraBytes == 6) {
+      return false;
+    }
+    number = lead & (0x3F >> extraBytes);
+  }
+  // Room for the number, a frame at the end of the stream may be shorter
+  // than the largest header
+  if (pos + extraBytes > len) {
+    return false;
+  }
+  for (int i = 0; i < extraBytes; i++) {
+    uint8_t byte = data[pos++];
+    if ((byte & 0xC0) != 0x80) {
+      return false;
+    }
+    number = (number << 6) | (byte & 0x3F);
+  }
+
+  // Block size and sample rate bytes past the number, then the CRC
+  size_t optional = (blockSizeCode == 6 ? 1 : blockSizeCode == 7 ? 2 : 0) +
+                    (sampleRateCode == 12 ? 1 : sampleRateCode > 12 ? 2 : 0);
+  if (pos + optional >= len) {
+    return false;
+  }
+
+  if (blockSizeCode == 1) {
+    header.blockSize = 192;
+  } else if (blockSizeCode <= 5) {
+    header.blockSize = 576 << (blockSizeCode - 2);
+  } else if (blockSizeCode == 6) {
+    header.blockSize = data[pos++] + 1;
+  } else if (blockSizeCode == 7) {
+    header.blockSize = readBE(data + pos, 2) + 1;
+    pos += 2;
+  } else {
+    header.blockSize = 256 << (blockSizeCode - 8);
+  }
+
+  if (sampleRateCode == 0) {
+    header.sampleRate = info.sampleRate;
+  } else if (sampleRateCode < 12) {
+    header.sampleRate = SAMPLE_RATES[sampleRateCode];
+  } else if (sampleRateCode == 12) {
+    header.sampleRate = data[pos++] * 1000;
+  } else {
+    header.sampleRate = readBE(data + pos, 2) * (sampleRateCode == 14 ? 10 : 1);
+    pos += 2;
+  }
+
+  header.bitsPerSample =
+      sampleSizeCode == 0 ? info.bitsPerSample : SAMPLE_SIZES[sampleSizeCode];
+  header.channelAssignment = channelCode;
+  header.channels = channelCode < 8 ? channelCode + 1 : 2;
+
+  if (pos >= len || crc8(data, pos) != data[pos]) {
+    return false;
+  }
+  header.size = pos + 1;
+
+  if (variableBlockSize) {
+    header.firstSample = number;
+  } else {
+    // Fixed block size streams count frames, all but the last are full
+    uint32_t blockSize = info.minBlockSize == info.maxBlockSize
+                             ? info.maxBlockSize
+                             : header.blockSize;
+    header.firstSample = number * blockSize;
+  }
+  return header.sampleRate > 0 && header.bitsPerSample > 0;
+}
+
+uint8_t flac::crc8(const uint8_t* data, size_t len) {
+  static const auto table = [] {
+    std::array<uint8_t, 256> crcTable;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint8_t r = i;
+      for (int bit = 0; bit < 8; bit++) {
+        r = (r & 0x80) ? (r << 1) ^ 0x07 : r << 1;
+      }
+      crcTable[i] = r;
+    }
+    return crcTable;
+  }();
+
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc = table[crc ^ data[i]];
+  }
+  return crc;
+}
+
+uint16_t flac::crc16(const uint8_t* data, size_t len) {
+  static const auto table = [] {
+    std::array<uint16_t, 256> crcTable;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint16_t r = i << 8;
+      for (int bit = 0; bit < 8; bit++) {
+        r = (r & 0x8000) ? (r << 1) ^ 0x8005 : r << 1;
+      }
+      crcTable[i] = r;
+    }
+    return crcTable;
+  }();
+
+  uint16_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc = (crc << 8) ^ table[(crc >> 8) ^ data[i]];
+  }
+  return crc;
+}
@@ -1,6 +1,5 @@
 #include "MP3Decoder.h"
 
-#include <stdlib.h>  // for free, malloc
 #include <cstdio>
 
 namespace bell {
@@ -11,13 +10,13 @@ using namespace bell;
 
 MP3Decoder::MP3Decoder() {
   mp3 = MP3InitDecoder();
-  pcmData =
-      (int16_t*)malloc(MAX_NSAMP * MAX_NGRAN * MAX_NCHAN * sizeof(int16_t));
+  pcmBuffer = CodecBufferPool::acquire(MAX_NSAMP * MAX_NGRAN * MAX_NCHAN *
+                                       sizeof(int16_t));
+  pcmData = CodecBufferPool::get<int16_t>(pcmBuffer);
 }
 
 MP3Decoder::~MP3Decoder() {
   MP3FreeDecoder(mp3);
-  free(pcmData);
 }
 
 bool MP3Decoder::setup(uint32_t sampleRate, uint8_t channelCount,
@@ -29,20 +28,38 @@ bool MP3Decoder::setup(AudioContainer* container) {
   return true;
 }
 
+uint32_t MP3Decoder::maxFrameSize() {
+  return MAX_NSAMP * MAX_NGRAN * MAX_NCHAN * sizeof(int16_t);
+}
+
 uint8_t* MP3Decoder::decode(uint8_t* inData, uint32_t& inLen,
                             uint32_t& outLen) {
-  if (!inData || inLen == 0)
+  if (!decodeInto(inData, inLen, (uint8_t*)pcmData, outLen)) {
     return nullptr;
+  }
+  return (uint8_t*)pcmData;
+}
+
+bool MP3Decoder::decodeInto(uint8_t* inData, uint32_t& inLen, uint8_t* out,
+                            uint32_t& outLen) {
+  if (!inData || inLen == 0)
+    return false;
+  uint32_t frameLen = inLen;
   int status = MP3Decode(mp3, static_cast<unsigned char**>(&inData),
                          reinterpret_cast<int*>(&inLen),
-                         static_cast<short*>(this->pcmData),
+                         reinterpret_cast<short*>(out),
                          /* useSize */ 0);
   MP3GetLastFrameInfo(mp3, &frame);
   if (status != ERR_MP3_NONE) {
     lastErrno = status;
-    inLen -= 2;
+    // Frames lacking reservoir data are consumed. A broken frame only loses
+    // its first byte here, the container's resync drops the rest of it and
+    // nothing of the next frame
+    if (inLen == frameLen) {
+      inLen--;
+    }
     outLen = 0;
-    return nullptr;
+    return false;
   }
   if (sampleRate != frame.samprate) {
     this->sampleRate = frame.samprate;
@@ -52,5 +69,5 @@ uint8_t* MP3Decoder::decode(uint8_t* inData, uint32_t& inLen,
     this->channelCount = frame.nChans;
   }
   outLen = frame.outputSamps * sizeof(int16_t);
-  return (uint8_t*)pcmData;
+  return true;
 }
@@ -1,9 +1,13 @@
 #include "OPUSDecoder.h"
 
-#include <stdlib.h>  // for free, malloc
+#include <string.h>     // for memcmp
+#include <algorithm>    // for min, max
+#include <type_traits>  // for is_same_v
 
-#include "CodecType.h"  // for bell
-#include "opus.h"       // for opus_decoder_destroy, opus_decode, opus_decod...
+#include "AudioContainer.h"    // for AudioContainer
+#include "CodecType.h"         // for AudioCodec, AudioCodec::OPUS
+#include "SampleConversion.h"  // for deinterleave
+#include "opus.h"              // for opus_decoder_destroy, opus_decode, op...
 
 using namespace bell;
 
@@ -19,13 +23,14 @@ struct OpusDecoder {
 
 OPUSDecoder::OPUSDecoder() {
   opus = nullptr;
-  pcmData = (int16_t*)malloc(MAX_FRAME_SIZE * MAX_CHANNELS * sizeof(int16_t));
+  pcmBuffer =
+      CodecBufferPool::acquire(MAX_FRAME_SIZE * MAX_CHANNELS * sizeof(int16_t));
+  pcmData = CodecBufferPool::get<int16_t>(pcmBuffer);
 }
 
 OPUSDecoder::~OPUSDecoder() {
   if (opus)
     opus_decoder_destroy(opus);
-  free(pcmData);
 }
 
 bool OPUSDecoder::setup(uint32_t sampleRate, uint8_t channelCount,
@@ -33,17 +38,132 @@ bool OPUSDecoder::setup(uint32_t sampleRate, uint8_t channelCount,
   if (opus)
     opus_decoder_destroy(opus);
   opus = opus_decoder_create((int32_t)sampleRate, channelCount, &lastErrno);
+  this->sampleRate = sampleRate;
+  this->channelCount = channelCount;
   return !lastErrno;
 }
 
+bool OPUSDecoder::setup(AudioContainer* container) {
+  uint32_t headLen;
+  uint8_t* head = container->getSetupData(headLen, AudioCodec::OPUS);
+  if (!head || headLen < 19 || memcmp(head, "OpusHead", 8) != 0)
+    return false;
+
+  headerPreSkip = head[10] | (head[11] << 8);
+  preSkip = headerPreSkip;
+  sampleRate = 48000;
+  channelCount = std::min<uint8_t>(head[9], MAX_CHANNELS);
+  return setup(sampleRate, channelCount, 16);
+}
+
 uint8_t* OPUSDecoder::decode(uint8_t* inData, uint32_t& inLen,
                              uint32_t& outLen) {
   if (!inData)
     return nullptr;
-  outLen =
-      opus_decode(opus, static_cast<unsigned char*>(inData),
-                  static_cast<int32_t>(inLen), pcmData, MAX_FRAME_SIZE, false);
-  outLen *= opus->channels * sizeof(int16_t);
+  if (!opus)
+    return nullptr;
+  int samples = decodePacket(inData, inLen, pcmData);
+  inLen = 0;
+  if (samples < 0) {
+    lastErrno = samples;
+    return nullptr;
+  }
+
+  // Encoder delay at the start of the stream
+  uint32_t skip = std::min<uint32_t>(preSkip, samples);
+  preSkip -= skip;
+  outLen = (samples - skip) * opus->channels * sizeof(int16_t);
+  return (uint8_t*)(pcmData + skip * opus->channels);
+}
+
+uint32_t OPUSDecoder::maxFrameSamples() {
+  return MAX_FRAME_SIZE;
+}
+
+bool OPUSDecoder::isNativeOutput(OutputFormat format) {
+  return format != OutputFormat::PLANAR_Q31;
+}
+
+bool OPUSDecoder::setOutputFormat(OutputFormat format) {
+  if (format == OutputFormat::PLANAR_FLOAT && !floatBuffer) {
+    floatBuffer =
+        CodecBufferPool::acquire(MAX_FRAME_SIZE * MAX_CHANNELS * sizeof(float));
+  }
+  return BaseCodec::setOutputFormat(format);
+}
+
+bool OPUSDecoder::decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                                   OutputFormat outputFormat,
+                                   void* const* planes, uint32_t& frames) {
+  frames = 0;
+  if (!inData || !opus || outputFormat != OutputFormat::PLANAR_FLOAT ||
+      !floatBuffer) {
+    return false;
+  }
+  float* pcm = CodecBufferPool::get<float>(floatBuffer);
+  int samples = decodePacket(inData, inLen, pcm);
   inLen = 0;
+  if (samples < 0) {
+    lastErrno = samples;
+    return false;
+  }
+
+  uint32_t skip = std::min<uint32_t>(preSkip, samples);
+  preSkip -= skip;
+  frames = samples - skip;
+  // Opus only decodes interleaved, this is a plain copy per channel
+  dsp::deinterleave((uint8_t*)(pcm + skip * opus->channels),
+                    PcmFormat::FLOAT32, (float* const*)planes, opus->channels,
+                    frames);
+  return true;
+}
+
+template <typename T>
+int OPUSDecoder::decodePacket(uint8_t* inData, uint32_t inLen, T* pcm) {
+  auto decode = [this, inData, inLen](T* out, int frames, bool fec) {
+    if constexpr (std::is_same_v<T, float>) {
+      return opus_decode_float(opus, static_cast<unsigned char*>(inData),
+                               static_cast<int32_t>(inLen), out, frames, fec);
+    } else {
+      return opus_decode(opus, static_cast<unsigned char*>(inData),
+                         static_cast<int32_t>(inLen), out, frames, fec);
+    }
+  };
+
+  int recovered = 0;
+  if (lossPending) {
+    lossPending = false;
+    // The FEC data of a packet describes the one before it, at the same
+    // duration
+    int lost = opus_packet_get_nb_samples(static_cast<unsigned char*>(inData),
+                                          static_cast<int32_t>(inLen),
+                                          (int32_t)sampleRate);
+    if (lost > 0 && 2 * lost <= MAX_FRAME_SIZE) {
+      recovered = std::max(decode(pcm, lost, true), 0);
+    }
+  }
+
+  int samples = decode(pcm + recovered * opus->channels,
+                       MAX_FRAME_SIZE - recovered, false);
+  return samples < 0 ? samples : recovered + samples;
+}
+
+uint8_t* OPUSDecoder::conceal(uint32_t maxFrames, uint32_t& outLen) {
+  outLen = 0;
+  if (!opus) {
+    return nullptr;
+  }
+
+  uint32_t step = sampleRate / 400;
+  uint32_t frames = std::min<uint32_t>(maxFrames, MAX_FRAME_SIZE) / step * step;
+  if (frames == 0) {
+    return nullptr;
+  }
+  int samples = opus_decode(opus, NULL, 0, pcmData, frames, false);
+  if (samples < 0) {
+    lastErrno = samples;
+    return nullptr;
+  }
+  outLen = samples * opus->channels * sizeof(int16_t);
   return (uint8_t*)pcmData;
 }
@@ -0,0 +1,217 @@
+#include "ParallelFileDecoder.h"
+
+#include <string.h>   // for memcmp
+#include <algorithm>  // for min, max
+#include <deque>      // for deque
+#include <future>     // for future
+#include <memory>     // for shared_ptr
+
+#include "ADTSContainer.h"  // for ADTSContainer
+#include "AudioCodecs.h"    // for AudioCodecs
+#include "BaseCodec.h"      // for BaseCodec
+#include "MP3Container.h"   // for MP3Container
+
+using namespace bell;
+
+ParallelFileDecoder::ParallelFileDecoder(AudioCodec codec, Executor& executor,
+                                         const Config& config)
+    : codec(codec), executor(executor), config(config) {}
+
+bool ParallelFileDecoder::decode(std::span<const uint8_t> data,
+                                 const PCMCallback& onPCM) {
+  this->data = data;
+  sampleRate = 0;
+  channelCount = 0;
+  stopping = false;
+  if (AudioCodecs::createCodec(codec) == nullptr || !scanFrames()) {
+    frames.clear();
+    return false;
+  }
+
+  size_t segmentFrames = std::max<uint32_t>(config.segmentFrames, 1);
+  size_t ahead = config.segmentsAhead;
+  if (ahead == 0) {
+    ahead = std::max<size_t>(executor.workerCount(), 1) * 2;
+  }
+
+  // Segments in flight, in order
+  std::deque<std::future<Segment>> queued;
+  size_t nextStart = 0;
+  auto queueSegments = [&]() {
+    while (queued.size() < ahead && nextStart < frames.size()) {
+      size_t start = nextStart;
+      size_t end = std::min(start + segmentFrames, frames.size());
+      queued.push_back(executor.submit(
+          Executor::Lane::BACKGROUND,
+          [this, start, end]() { return decodeSegment(start, end); }));
+      nextStart = end;
+    }
+  };
+
+  bool completed = true;
+  queueSegments();
+  while (!queued.empty()) {
+    Segment segment = queued.front().get();
+    queued.pop_front();
+    if (!completed) {
+      // Only waiting for the jobs still using frames
+      continue;
+    }
+
+    if (!segment.pcm.empty()) {
+      if (channelCount == 0) {
+        sampleRate = segment.sampleRate;
+        channelCount = segment.channelCount;
+      }
+      completed = onPCM(segment.pcm.data(),
+                        segment.pcm.size() / segment.channelCount);
+    }
+    if (completed) {
+      queueSegments();
+    } else {
+      stopping = true;
+    }
+  }
+
+  frames.clear();
+  return completed;
+}
+
+bool ParallelFileDecoder::scanFrames() {
+  frames.clear();
+  headerSampleRate = 0;
+  switch (codec) {
+    case AudioCodec::MP3:
+      return scanMP3();
+    case AudioCodec::AAC:
+      return scanADTS();
+    default:
+      return false;
+  }
+}
+
+// Offset of the first byte after an ID3v2 tag at the start of data
+static size_t skipTag(std::span<const uint8_t> data) {
+  const uint8_t* tag = data.data();
+  if (data.size() < 10 || memcmp(tag, "ID3", 3) != 0) {
+    return 0;
+  }
+  size_t size = 10 + ((tag[6] & 0x7F) << 21 | (tag[7] & 0x7F) << 14 |
+                      (tag[8] & 0x7F) << 7 | (tag[9] & 0x7F));
+  if (tag[5] & 0x10) {
+    // Footer present
+    size += 10;
+  }
+  return std::min(size, data.size());
+}
+
+bool ParallelFileDecoder::scanMP3() {
+  const uint8_t* bytes = data.data();
+  size_t size = data.size();
+  MP3Container::FrameHeader header, next;
+
+  for (size_t pos = skipTag(data); pos + 4 <= size;) {
+    // Free format frames have no size in the header
+    if (!MP3Container::parseFrameHeader(bytes + pos, header) ||
+        header.bitrate == 0 || header.size > size - pos) {
+      pos++;
+      continue;
+    }
+
+    // A lone header may be a chance match in frame data, the next one has
+    // to follow. An ID3v1 tag or less than a header may end the file
+    size_t nextPos = pos + header.size;
+    if (nextPos + 4 <= size &&
+        !MP3Container::parseFrameHeader(bytes + nextPos, next) &&
+        memcmp(bytes + nextPos, "TAG", 3) != 0) {
+      pos++;
+      continue;
+    }
+
+    if (headerSampleRate == 0) {
+      headerSampleRate = header.sampleRate;
+      if (MP3Container::isInfoFrame(bytes + pos, header.size, header)) {
+        // Info frames carry no audio
+        pos = nextPos;
+        continue;
+      }
+    }
+    frames.push_back({pos, header.size, header.samples});
+    pos = nextPos;
+  }
+  return !frames.empty();
+}
+
+bool ParallelFileDecoder::scanADTS() {
+  const uint8_t* bytes = data.data();
+  size_t size = data.size();
+
+  for (size_t pos = skipTag(data); pos < size;) {
+    uint32_t length = ADTSContainer::frameLength(bytes + pos, size - pos);
+    if (length == 0 || length > size - pos) {
+      pos++;
+      continue;
+    }
+
+    // Same as above, the sync word alone is too weak
+    size_t nextPos = pos + length;
+    if (nextPos < size &&
+        ADTSContainer::frameLength(bytes + nextPos, size - nextPos) == 0 &&
+        (size - nextPos < 3 || memcmp(bytes + nextPos, "TAG", 3) != 0)) {
+      pos++;
+      continue;
+    }
+
+    if (headerSampleRate == 0) {
+      headerSampleRate = ADTSContainer::headerSampleRate(bytes + pos);
+    }
+    frames.push_back({pos, length, ADTSContainer::frameSamples(bytes + pos)});
+    pos = nextPos;
+  }
+  return !frames.empty() && headerSampleRate > 0;
+}
+
+ParallelFileDecoder::Segment ParallelFileDecoder::decodeSegment(size_t start,
+                                                                size_t end) {
+  Segment segment;
+  // The reservoir is counted ahead of the warm-up frames, which then
+  // decode completely and rebuild the overlap
+  size_t warmup = start - std::min<size_t>(start, config.warmupFrames);
+  size_t first = warmup;
+  while (first > 0 &&
+         frames[warmup].offset - frames[first].offset < config.warmupBytes) {
+    first--;
+  }
+
+  // A fresh decoder per segment starts from the same state as a whole file
+  auto decoder = AudioCodecs::createCodec(codec);
+  if (decoder == nullptr) {
+    return segment;
+  }
+  decoder->setup(headerSampleRate, 2, 16);
+
+  for (size_t i = first; i < end && !stopping; i++) {
+    const Frame& frame = frames[i];
+    uint32_t inLen = frame.size;
+    uint32_t outLen = 0;
+    uint8_t* pcm = decoder->decode(
+        const_cast<uint8_t*>(data.data()) + frame.offset, inLen, outLen);
+    // Frames that fail decode to nothing, as they would in order
+    if (pcm == nullptr || outLen == 0 || i < start) {
+      continue;
+    }
+
+    size_t samples = outLen / sizeof(int16_t);
+    if (segment.channelCount == 0) {
+      segment.channelCount = std::max<uint8_t>(decoder->channelCount, 1);
+      // SBR doubles the samples, and the rate, of the header
+      size_t produced = samples / segment.channelCount;
+      segment.sampleRate =
+          (uint64_t)headerSampleRate * produced / frame.samples;
+      segment.pcm.reserve(samples * (end - i));
+    }
+    segment.pcm.insert(segment.pcm.end(), (int16_t*)pcm,
+                       (int16_t*)pcm + samples);
+  }
+  return segment;
+}
@@ -1,16 +1,19 @@
 #include "VorbisDecoder.h"
 
-#include <stdlib.h>  // for free, malloc
+#include <string.h>  // for memcpy
+#include <vector>    // for vector
 
-#include "CodecType.h"     // for bell
+#include "AudioContainer.h"  // for AudioContainer
+#include "CodecType.h"       // for AudioCodec, AudioCodec::VORBIS
+#ifdef BELL_VORBIS_FLOAT
+#include "SampleConversion.h"  // for interleaveInt16
+#else
 #include "config_types.h"  // for ogg_int16_t
-
-namespace bell {
-class AudioContainer;
-}  // namespace bell
+#endif
 
 using namespace bell;
 
+#ifndef BELL_VORBIS_FLOAT
 extern "C" {
 extern vorbis_dsp_state* vorbis_dsp_create(vorbis_info* vi);
 extern void vorbis_dsp_destroy(vorbis_dsp_state* v);
@@ -23,9 +26,7 @@ extern int vorbis_dsp_pcmout(vorbis_dsp_state* v, ogg_int16_t* pcm,
                              int samples);
 extern int vorbis_dsp_read(vorbis_dsp_state* v, int samples);
 }
-
-#define VORBIS_BUF_SAMPLES 1024
-#define VORBIS_BUF_CHANNELS 2
+#endif
 
 VorbisDecoder::VorbisDecoder() {
   vi = new vorbis_info;
@@ -33,6 +34,7 @@ VorbisDecoder::VorbisDecoder() {
   vc = new vorbis_comment;
   vorbis_comment_init(vc);
 
+#ifndef BELL_VORBIS_FLOAT
   op.packet = new ogg_reference;
   op.packet->buffer = new ogg_buffer;
   op.packet->buffer->refcount = 0;
@@ -40,66 +42,106 @@ VorbisDecoder::VorbisDecoder() {
   op.packet->buffer->ptr.next = nullptr;
   op.packet->begin = 0;
   op.packet->next = nullptr;
+#endif
   op.granulepos = -1;
   op.packetno = 10;
-
-  pcmData = (int16_t*)malloc(VORBIS_BUF_SAMPLES * VORBIS_BUF_CHANNELS *
-                             sizeof(uint16_t));
 }
 
 VorbisDecoder::~VorbisDecoder() {
-  vorbis_info_clear(vi);
-  vorbis_comment_clear(vc);
+#ifdef BELL_VORBIS_FLOAT
+  if (dspReady) {
+    vorbis_block_clear(&vb);
+    vorbis_dsp_clear(&vd);
+  }
+#else
   if (vd)
     vorbis_dsp_destroy(vd);
   vd = nullptr;
-  free(pcmData);
+#endif
+  vorbis_info_clear(vi);
+  vorbis_comment_clear(vc);
 }
 
 bool VorbisDecoder::setup(AudioContainer* container) {
-  /*
   uint32_t setupLen;
   uint8_t* setup = container->getSetupData(setupLen, AudioCodec::VORBIS);
   if (!setup)
     return false;
+#ifdef BELL_VORBIS_FLOAT
+  // libvorbis rejects a second set of headers, start from a clean state
+  if (dspReady) {
+    vorbis_block_clear(&vb);
+    vorbis_dsp_clear(&vd);
+    dspReady = false;
+  }
+  vorbis_info_clear(vi);
+  vorbis_info_init(vi);
+  vorbis_comment_clear(vc);
+  vorbis_comment_init(vc);
+#endif
   op.b_o_s = true;                    // mark this page as beginning of stream
   uint32_t bytesLeft = setupLen - 1;  // minus header count length (8 bit)
   std::vector<uint32_t> headers(setup[0]);
+  uint8_t* sizeByte = (uint8_t*)setup + 1;
   for (uint8_t i = 0; i < setup[0]; i++) {
-    uint8_t* sizeByte = (uint8_t*)setup + 1 + i;
     headers[i] = 0;
     while (*sizeByte == 255) {
       headers[i] += *(sizeByte++);
       bytesLeft--;
     }
-    headers[i] += *sizeByte;
+    headers[i] += *(sizeByte++);
     bytesLeft--;
   }
   // parse all headers from the setup data
   for (const auto& headerSize : headers) {
     setPacket(setup + setupLen - bytesLeft, headerSize);
     bytesLeft -= headerSize;
+#ifdef BELL_VORBIS_FLOAT
+    lastErrno = vorbis_synthesis_headerin(vi, vc, &op);
+#else
     lastErrno = vorbis_dsp_headerin(vi, vc, &op);
+#endif
     if (lastErrno < 0) {
       bytesLeft = 0;
       break;
     }
   }
-  // parse last header, not present in header table (seems to happen for MP4 containers)
+  // parse last header, not present in header table (Xiph lacing)
   if (bytesLeft) {
     setPacket(setup + setupLen - bytesLeft, bytesLeft);
+#ifdef BELL_VORBIS_FLOAT
+    lastErrno = vorbis_synthesis_headerin(vi, vc, &op);
+#else
     lastErrno = vorbis_dsp_headerin(vi, vc, &op);
+#endif
   }
   // disable BOS to allow reading audio data
   op.b_o_s = false;
+  if (lastErrno < 0)
+    return false;
   // set up the codec
+#ifdef BELL_VORBIS_FLOAT
+  if (vorbis_synthesis_init(&vd, vi) != 0)
+    return false;
+  vorbis_block_init(&vd, &vb);
+  dspReady = true;
+#else
   if (vd)
     vorbis_dsp_restart(vd);
   else
     vd = vorbis_dsp_create(vi);
+#endif
+  sampleRate = vi->rate;
+  channelCount = vi->channels;
+
+  // A long block overlaps half of itself with its neighbours, a packet
+  // never yields more, so pcmout() empties in one call
+  blockSamples = vorbis_info_blocksize(vi, 1) / 2;
+  pcmBuffer = nullptr;
+  pcmBuffer = CodecBufferPool::acquire(blockSamples * vi->channels *
+                                       sizeof(int16_t));
+  pcmData = CodecBufferPool::get<int16_t>(pcmBuffer);
   return !lastErrno;
-  */
-  return false;
 }
 
 bool VorbisDecoder::setup(uint32_t sampleRate, uint8_t channelCount,
@@ -108,31 +150,96 @@ bool VorbisDecoder::setup(uint32_t sampleRate, uint8_t channelCount,
   return false;
 }
 
-uint8_t* VorbisDecoder::decode(uint8_t* inData, uint32_t& inLen,
-                               uint32_t& outLen) {
-  if (!inData || !vi)
-    return nullptr;
+bool VorbisDecoder::synthesize(uint8_t* inData, uint32_t inLen) {
   setPacket(inData, inLen);
   // sources:
   //  - vorbisfile.c:556
   //  - vorbisfile.c:1557
+#ifdef BELL_VORBIS_FLOAT
+  if (!dspReady)
+    return false;
+  lastErrno = vorbis_synthesis(&vb, &op);
+  if (lastErrno == 0)
+    lastErrno = vorbis_synthesis_blockin(&vd, &vb);
+#else
+  if (!vd)
+    return false;
   lastErrno = vorbis_dsp_synthesis(vd, &op, 1);
-  if (lastErrno < 0)
+#endif
+  return lastErrno >= 0;
+}
+
+uint8_t* VorbisDecoder::decode(uint8_t* inData, uint32_t& inLen,
+                               uint32_t& outLen) {
+  if (!inData || !vi)
     return nullptr;
-  int samples = vorbis_dsp_pcmout(vd, pcmData, VORBIS_BUF_SAMPLES);
-  outLen = samples;
-  if (samples) {
-    if (samples > 0) {
-      vorbis_dsp_read(vd, samples);
-      outLen = samples * 2 * vi->channels;
-    }
-  }
+  bool decoded = synthesize(inData, inLen);
   inLen = 0;
+  if (!decoded)
+    return nullptr;
+#ifdef BELL_VORBIS_FLOAT
+  float** pcm;
+  int samples = vorbis_synthesis_pcmout(&vd, &pcm);
+  if (samples > 0) {
+    dsp::interleaveInt16(pcm, pcmData, vi->channels, samples);
+    vorbis_synthesis_read(&vd, samples);
+  }
+#else
+  int samples = vorbis_dsp_pcmout(vd, pcmData, blockSamples);
+  if (samples > 0)
+    vorbis_dsp_read(vd, samples);
+#endif
+  outLen = samples > 0 ? samples * sizeof(int16_t) * vi->channels : 0;
   return (uint8_t*)pcmData;
 }
 
-void VorbisDecoder::setPacket(uint8_t* inData, uint32_t inLen) const {
+uint32_t VorbisDecoder::maxFrameSamples() {
+  return blockSamples;
+}
+
+bool VorbisDecoder::isNativeOutput(OutputFormat format) {
+#ifdef BELL_VORBIS_FLOAT
+  if (format == OutputFormat::PLANAR_FLOAT)
+    return true;
+#endif
+  return BaseCodec::isNativeOutput(format);
+}
+
+bool VorbisDecoder::decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                                     OutputFormat outputFormat,
+                                     void* const* planes, uint32_t& frames) {
+  frames = 0;
+#ifdef BELL_VORBIS_FLOAT
+  if (!inData || outputFormat != OutputFormat::PLANAR_FLOAT)
+    return false;
+  bool decoded = synthesize(inData, inLen);
+  inLen = 0;
+  if (!decoded)
+    return false;
+  float** pcm;
+  int samples = vorbis_synthesis_pcmout(&vd, &pcm);
+  if (samples > 0) {
+    // libvorbis is planar already, one copy per channel
+    for (int i = 0; i < vi->channels; i++) {
+      memcpy(planes[i], pcm[i], samples * sizeof(float));
+    }
+    vorbis_synthesis_read(&vd, samples);
+    frames = samples;
+  }
+  return true;
+#else
+  // Tremor renders straight to int16, decodePlanar() converts decode()
+  return false;
+#endif
+}
+
+void VorbisDecoder::setPacket(uint8_t* inData, uint32_t inLen) {
+#ifdef BELL_VORBIS_FLOAT
+  op.packet = static_cast<unsigned char*>(inData);
+  op.bytes = static_cast<long>(inLen);
+#else
   op.packet->buffer->data = static_cast<unsigned char*>(inData);
   op.packet->buffer->size = static_cast<long>(inLen);
   op.packet->length = static_cast<long>(inLen);
+#endif
 }
@@ -1,19 +1,27 @@
 #pragma once
 
 #include <stdint.h>  // for uint8_t, uint32_t, int16_t
-#include <vector>
 
 #include "BaseCodec.h"              // for BaseCodec
+#include "CodecBufferPool.h"        // for CodecBufferPool
 #include "pvmp4audiodecoder_api.h"  // for tPVMP4AudioDecoderExternal
 
 namespace bell {
 class AudioContainer;
 
+/**
+ * AAC decoder on opencore-aacdec. Built with BELL_CODEC_AAC_PLUS off
+ * (AAC_LC_ONLY), the library leaves out the SBR and PS tools, which halves
+ * its state, and HE-AAC streams play their AAC-LC core at half the rate.
+ * All buffers come from CodecBufferPool, see CodecBufferPool::setAllocator().
+ */
 class AACDecoder : public BaseCodec {
  private:
+  CodecBufferPool::Buffer decoderMemory;
+  CodecBufferPool::Buffer libraryMemory;
+  CodecBufferPool::Buffer outputMemory;
   tPVMP4AudioDecoderExternal* aacDecoder;
-  std::vector<uint8_t> inputBuffer;
-  std::vector<int16_t> outputBuffer;
+  int16_t* outputBuffer;
   void* pMem;
   bool firstFrame = true;
 
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>  // for uint8_t, uint32_t
+#include <memory>    // for unique_ptr
+
+#include "BaseCodec.h"        // for BaseCodec
+#include "CodecBufferPool.h"  // for CodecBufferPool
+
+// Apple's decoder, it shares its name with the wrapper below
+class ALACDecoder;
+
+namespace bell {
+class AudioContainer;
+
+/**
+ * Apple Lossless decoder. 16-bit streams come out as INT16, 20 and 24-bit
+ * streams as INT24_IN_32 and 32-bit streams as INT32, see bitDepth.
+ */
+class ALACDecoder : public BaseCodec {
+ private:
+  std::unique_ptr<::ALACDecoder> alac;
+  CodecBufferPool::Buffer pcmBuffer;
+  uint32_t pcmBufferSize = 0;
+  uint32_t frameLength = 0;
+  uint8_t streamBitDepth = 16;
+
+  bool init(uint8_t* cookie, uint32_t cookieLen);
+
+ protected:
+  uint32_t maxFrameSize() override;
+  bool decodeInto(uint8_t* inData, uint32_t& inLen, uint8_t* out,
+                  uint32_t& outLen) override;
+
+ public:
+  ALACDecoder();
+  ~ALACDecoder();
+
+  // Builds a default ALACSpecificConfig, as used by streams without a cookie
+  bool setup(uint32_t sampleRate, uint8_t channelCount,
+             uint8_t bitDepth) override;
+
+  // Configures from the container's ALACSpecificConfig
+  bool setup(AudioContainer* container) override;
+  uint8_t* decode(uint8_t* inData, uint32_t& inLen, uint32_t& outLen) override;
+};
+}  // namespace bell
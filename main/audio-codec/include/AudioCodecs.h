@@ -1,6 +1,7 @@
 #pragma once
 
-#include <memory>  // for shared_ptr
+#include <functional>  // for function
+#include <memory>      // for shared_ptr
 
 #include "AudioContainer.h"  // for AudioContainer
 #include "BaseCodec.h"       // for BaseCodec
@@ -9,9 +10,34 @@
 namespace bell {
 class AudioCodecs {
  public:
+  typedef std::function<std::shared_ptr<BaseCodec>()> CodecFactory;
+
+  /**
+   * Creates a new decoder instance, owned by the caller. Every stream should
+   * use its own, work buffers are pooled by CodecBufferPool.
+   */
+  static std::shared_ptr<BaseCodec> createCodec(AudioCodec type);
+  static std::shared_ptr<BaseCodec> createCodec(AudioContainer* container);
+
+  /**
+   * Creates a decoder for the next track ahead of time, so the track switch
+   * doesn't wait for its allocations. The next createCodec() of that type
+   * hands it out.
+   */
+  static void prepareCodec(AudioCodec type);
+
+  /**
+   * Returns a process-wide decoder shared by every caller. Only safe with a
+   * single stream at a time, prefer createCodec.
+   */
   static std::shared_ptr<BaseCodec> getCodec(AudioCodec type);
   static std::shared_ptr<BaseCodec> getCodec(AudioContainer* container);
+
+  // Registers a shared instance, returned by both getCodec and createCodec
   static void addCodec(AudioCodec type,
                        const std::shared_ptr<BaseCodec>& codec);
+
+  // Registers a factory for type, used by createCodec and getCodec
+  static void addCodecFactory(AudioCodec type, const CodecFactory& factory);
 };
 }  // namespace bell
@@ -2,18 +2,104 @@
 
 #include <stdint.h>  // for uint32_t, uint8_t
 
+#include "StreamInfo.h"  // for PcmFormat, BitWidth, pcmFormatFor
+
 namespace bell {
 class AudioContainer;
 
 class BaseCodec {
+ public:
+  // Layout of the PCM returned by decodePlanar()
+  enum class OutputFormat : uint8_t {
+    // Interleaved, in getPcmFormat(), as returned by decode()
+    INTERLEAVED,
+    // Normalized float, one plane per channel
+    PLANAR_FLOAT,
+    // Q1.31, one plane per channel
+    PLANAR_Q31,
+  };
+
  private:
   uint32_t lastSampleLen, availableBytes;
+  OutputFormat outputFormat = OutputFormat::INTERLEAVED;
+
+  // Part of the last frame that didn't fit into the batch output buffer
+  uint8_t* pendingData = nullptr;
+  uint32_t pendingLen = 0;
+
+  // Next sample of the container, nullptr at its end
+  uint8_t* readSample(AudioContainer* container);
+  // Reads and decodes a single sample, into out if the codec supports it
+  uint8_t* decodeSample(AudioContainer* container, uint8_t* out,
+                        uint32_t outCapacity, uint32_t& outLen);
+
+ protected:
+  /**
+	 * Worst case size of a single decoded frame, in bytes. Codecs returning
+	 * non-zero implement decodeInto().
+	 */
+  virtual uint32_t maxFrameSize() { return 0; }
+
+  /**
+	 * Same as decode(), but writes the PCM to out, which holds at least
+	 * maxFrameSize() bytes.
+	 * @return false on failure
+	 */
+  virtual bool decodeInto(uint8_t* inData, uint32_t& inLen, uint8_t* out,
+                          uint32_t& outLen) {
+    return false;
+  }
+
+  /**
+	 * Same as decodeInto(), for codecs producing outputFormat natively, see
+	 * isNativeOutput(). Each plane holds at least maxFrameSamples() samples.
+	 * @param [out] frames samples written to each plane
+	 * @return false on failure
+	 */
+  virtual bool decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                                OutputFormat outputFormat,
+                                void* const* planes, uint32_t& frames) {
+    return false;
+  }
 
  public:
   uint32_t sampleRate = 44100;
   uint8_t channelCount = 2;
   uint8_t bitDepth = 16;
 
+  /**
+	 * Layout of the decoded PCM, for CentralAudioBuffer::writePCM().
+	 */
+  PcmFormat getPcmFormat() const {
+    return pcmFormatFor(static_cast<BitWidth>(bitDepth));
+  }
+
+  /**
+	 * Most samples per channel a single frame decodes to, 0 if unknown.
+	 * Planes of decodePlanar() at least this large take the native path.
+	 */
+  virtual uint32_t maxFrameSamples() { return 0; }
+
+  /**
+	 * Whether the codec produces format without converting its output, e.g.
+	 * float from a float decoder. Other formats are converted from the
+	 * interleaved PCM, the same pass BellDSP would do.
+	 */
+  virtual bool isNativeOutput(OutputFormat format) {
+    return format == OutputFormat::INTERLEAVED;
+  }
+
+  /**
+	 * Layout of decodePlanar(), decode() stays interleaved. Planar output
+	 * feeds BellDSP::process() without another conversion.
+	 * @return false if format isn't available
+	 */
+  virtual bool setOutputFormat(OutputFormat format) {
+    outputFormat = format;
+    return true;
+  }
+  OutputFormat getOutputFormat() const { return outputFormat; }
+
   /**
 	 * Setup the codec (sample rate, channel count, etc) using the specified container.
 	 */
@@ -41,6 +127,74 @@ class BaseCodec {
 	 * @return pointer to decoded raw PCM audio data, allocated inside the codec object; nullptr on failure
 	 */
   uint8_t* decode(AudioContainer* container, uint32_t& outLen);
+  /**
+	 * Decode up to maxFrames samples from the container into a caller supplied
+	 * buffer, e.g. a CentralAudioBuffer slot. Frames are decoded straight into
+	 * out when the codec supports it, and copied otherwise. Output of a frame
+	 * that doesn't fit is kept and returned first by the next call, so don't
+	 * mix this with the single frame decode() within a stream.
+	 *
+	 * @param [in] container media container to read the samples from
+	 * @param [out] out destination of the PCM data
+	 * @param [in] capacity size of out, in bytes
+	 * @param [in] maxFrames maximum amount of samples to decode
+	 * @return amount of PCM bytes written to out, 0 at the end of the stream
+	 */
+  uint32_t decode(AudioContainer* container, uint8_t* out, uint32_t capacity,
+                  uint32_t maxFrames = UINT32_MAX);
+  /**
+	 * Decode the next sample from the container into planes, in
+	 * getOutputFormat(), which has to be planar. Like the batch decode(),
+	 * output beyond capacity is kept for the next call.
+	 *
+	 * @param [in] container media container to read the samples from
+	 * @param [out] planes channelCount planes, float or int32_t
+	 * @param [in] capacity samples each plane holds
+	 * @return samples written to each plane, 0 at the end of the stream
+	 */
+  uint32_t decodePlanar(AudioContainer* container, void* const* planes,
+                        uint32_t capacity);
+  /**
+	 * Drops the output the batch decodes kept from the last frame, and
+	 * treats the next sample as following lost data. Call after seeking the
+	 * container, so nothing from before the seek comes out.
+	 *
+	 * @param [in] toStart the container went back to its first sample
+	 */
+  void flush(bool toStart = false) {
+    pendingLen = 0;
+    onSeek(toStart);
+    onDataLost();
+  }
+  /**
+	 * The container was seeked, see flush(). Codecs dropping an encoder delay
+	 * drop it again from the start only.
+	 */
+  virtual void onSeek(bool toStart) {}
+  /**
+	 * Tells the codec that the next sample follows lost data. Samples read
+	 * from a container do this on their own, see
+	 * AudioContainer::takeDataLoss(). Codecs with in-band redundancy rebuild
+	 * the gap from the sample when decoding it.
+	 */
+  virtual void onDataLost() {}
+
+  /**
+	 * Synthesizes audio continuing the last decoded frame, to bridge data
+	 * that is late (packet loss concealment). A producer whose source stalls
+	 * while the buffer runs low writes this instead of letting the sink
+	 * underrun, see CentralAudioBuffer::writeConcealment(). Call it between
+	 * decodes, the next sample picks up where it ends.
+	 *
+	 * @param [in] maxFrames most samples per channel to synthesize
+	 * @param [out] outLen size of output PCM data, in bytes
+	 * @return pointer to PCM in the decode() layout, valid until the next
+	 * call; nullptr if the codec can't conceal
+	 */
+  virtual uint8_t* conceal(uint32_t maxFrames, uint32_t& outLen) {
+    outLen = 0;
+    return nullptr;
+  }
   /**
 	 * Last error that occurred, this is a codec-specific value.
 	 * This may be set by a codec upon decoding failure.
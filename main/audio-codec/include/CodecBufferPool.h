@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <map>       // for multimap
+#include <memory>    // for unique_ptr
+#include <mutex>     // for mutex
+
+namespace bell {
+/**
+ * Process-wide pool of codec work buffers. Codec instances are created per
+ * stream, the pool keeps their large allocations (decoder state, PCM output)
+ * around so that opening a new stream doesn't hit the heap again and doesn't
+ * fragment it on small targets.
+ */
+class CodecBufferPool {
+ public:
+  // Where new buffers come from, bell::Allocator's Policy by default
+  struct Allocator {
+    void* (*allocate)(size_t size);
+    void (*release)(void* buffer);
+  };
+#ifdef ESP_PLATFORM
+  // PSRAM when the board has some, internal RAM otherwise
+  static const Allocator EXTERNAL_RAM;
+#endif
+
+  // Returns the buffer to the pool instead of freeing it
+  struct Release {
+    size_t size = 0;
+    void operator()(void* buffer) const;
+  };
+
+  typedef std::unique_ptr<void, Release> Buffer;
+
+  /**
+   * Hands out a zeroed buffer of exactly size bytes, reusing an idle one if
+   * possible.
+   * @throws std::bad_alloc when the allocation fails
+   */
+  static Buffer acquire(size_t size);
+
+  template <typename T>
+  static T* get(const Buffer& buffer) {
+    return static_cast<T*>(buffer.get());
+  }
+
+  // Frees all idle buffers, e.g. when playback stops
+  static void trim();
+
+  /**
+   * Replaces the allocator of new buffers, e.g. with EXTERNAL_RAM so that
+   * several decoders (crossfade, prefetch) fit next to the network stack.
+   * Idle buffers are freed, call it before creating any codec.
+   */
+  static void setAllocator(const Allocator& allocator);
+
+ private:
+  static Allocator allocator;
+  static std::mutex poolMutex;
+  static std::multimap<size_t, void*> idleBuffers;
+};
+}  // namespace bell
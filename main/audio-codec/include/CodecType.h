@@ -8,6 +8,10 @@ enum class AudioCodec {
   VORBIS = 3,
   OPUS = 4,
   FLAC = 5,
+  ALAC = 6,
+  // Not decoded, passed through to S/PDIF receivers
+  AC3 = 7,
+  EAC3 = 8,
 };
 
 }
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>  // for uint8_t, uint32_t, int32_t
+
+#include "BaseCodec.h"        // for BaseCodec
+#include "CodecBufferPool.h"  // for CodecBufferPool
+#include "FLACHeaders.h"      // for StreamInfo, FrameHeader
+
+namespace bell {
+class AudioContainer;
+class FLACBitReader;
+
+/**
+ * Native FLAC decoder. Up to 16-bit streams come out as INT16, 17 to 24-bit
+ * streams as INT24_IN_32 and 32-bit streams as INT32, see getPcmFormat().
+ * readSample() of the container has to start at a frame header, the decoder
+ * reports the exact frame length through inLen. Frames are decoded planar,
+ * planar output formats skip the interleaving.
+ */
+class FLACDecoder : public BaseCodec {
+ private:
+  static constexpr uint32_t MAX_CHANNELS = 8;
+  static constexpr uint32_t MAX_LPC_ORDER = 32;
+
+  flac::StreamInfo info = {};
+  flac::FrameHeader frame = {};
+
+  // Decoded samples, one block per channel
+  CodecBufferPool::Buffer channelBuffer;
+  int32_t* channelData[MAX_CHANNELS] = {nullptr};
+  uint32_t blockCapacity = 0;
+
+  CodecBufferPool::Buffer pcmBuffer;
+
+  bool configure(const flac::StreamInfo& info);
+  bool decodeFrame(const uint8_t* inData, uint32_t inLen, uint32_t& frameLen);
+  // decodeFrame() of the sample, updates inLen and sampleRate
+  bool decodeBlock(uint8_t* inData, uint32_t& inLen);
+  bool decodeSubframe(FLACBitReader& bits, int32_t* out, uint32_t bps);
+  bool decodeResidual(FLACBitReader& bits, int32_t* out, uint32_t order);
+  void interleave(uint8_t* out, uint32_t& outLen);
+
+ protected:
+  uint32_t maxFrameSize() override;
+  bool decodeInto(uint8_t* inData, uint32_t& inLen, uint8_t* out,
+                  uint32_t& outLen) override;
+  bool decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                        OutputFormat outputFormat, void* const* planes,
+                        uint32_t& frames) override;
+
+ public:
+  FLACDecoder();
+  ~FLACDecoder();
+
+  // Blocks are limited to the streamable subset without STREAMINFO
+  bool setup(uint32_t sampleRate, uint8_t channelCount,
+             uint8_t bitDepth) override;
+
+  // Configures from the container's STREAMINFO
+  bool setup(AudioContainer* container) override;
+  uint8_t* decode(uint8_t* inData, uint32_t& inLen, uint32_t& outLen) override;
+
+  uint32_t maxFrameSamples() override { return blockCapacity; }
+  bool isNativeOutput(OutputFormat format) override { return true; }
+};
+}  // namespace bell
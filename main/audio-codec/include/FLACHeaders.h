@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t, uint64_t, uint16_t
+
+namespace bell {
+namespace flac {
+static constexpr size_t STREAMINFO_SIZE = 34;
+
+// Largest block size allowed by the streamable subset, used without STREAMINFO
+static constexpr uint32_t SUBSET_MAX_BLOCK_SIZE = 4608;
+
+struct StreamInfo {
+  uint32_t minBlockSize;
+  uint32_t maxBlockSize;
+  // 0 when unknown
+  uint32_t minFrameSize;
+  uint32_t maxFrameSize;
+  uint32_t sampleRate;
+  uint8_t channels;
+  uint8_t bitsPerSample;
+  // 0 when unknown
+  uint64_t totalSamples;
+};
+
+struct FrameHeader {
+  uint32_t blockSize;
+  uint32_t sampleRate;
+  uint8_t channels;
+  // 0-7 independent channels, 8 left / side, 9 side / right, 10 mid / side
+  uint8_t channelAssignment;
+  uint8_t bitsPerSample;
+  uint64_t firstSample;
+  // Header length, including its CRC-8
+  size_t size;
+};
+
+/**
+ * Parses the body of a STREAMINFO metadata block
+ * @return false if it's too short or invalid
+ */
+bool parseStreamInfo(const uint8_t* data, size_t len, StreamInfo& info);
+
+/**
+ * Parses and validates a frame header, CRC-8 included. Fields the header
+ * leaves to STREAMINFO are taken from info.
+ * @return false if data doesn't start with a valid frame header
+ */
+bool parseFrameHeader(const uint8_t* data, size_t len, const StreamInfo& info,
+                      FrameHeader& header);
+
+// CRC-8, polynomial 0x07, protects frame headers
+uint8_t crc8(const uint8_t* data, size_t len);
+
+// CRC-16, polynomial 0x8005, protects whole frames
+uint16_t crc16(const uint8_t* data, size_t len);
+}  // namespace flac
+}  // namespace bell
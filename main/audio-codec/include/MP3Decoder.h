@@ -2,8 +2,9 @@
 
 #include <stdint.h>  // for uint8_t, uint32_t, int16_t
 
-#include "BaseCodec.h"  // for BaseCodec
-#include "mp3dec.h"     // for HMP3Decoder, MP3FrameInfo
+#include "BaseCodec.h"        // for BaseCodec
+#include "CodecBufferPool.h"  // for CodecBufferPool
+#include "mp3dec.h"           // for HMP3Decoder, MP3FrameInfo
 
 namespace bell {
 class AudioContainer;
@@ -11,9 +12,15 @@ class AudioContainer;
 class MP3Decoder : public BaseCodec {
  private:
   HMP3Decoder mp3;
+  CodecBufferPool::Buffer pcmBuffer;
   int16_t* pcmData;
   MP3FrameInfo frame = {};
 
+ protected:
+  uint32_t maxFrameSize() override;
+  bool decodeInto(uint8_t* inData, uint32_t& inLen, uint8_t* out,
+                  uint32_t& outLen) override;
+
  public:
   MP3Decoder();
   ~MP3Decoder();
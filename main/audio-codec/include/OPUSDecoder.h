@@ -2,21 +2,58 @@
 
 #include <stdint.h>  // for uint8_t, uint32_t, int16_t
 
-#include "BaseCodec.h"  // for BaseCodec
+#include "BaseCodec.h"        // for BaseCodec
+#include "CodecBufferPool.h"  // for CodecBufferPool
 
 struct OpusDecoder;
 
 namespace bell {
+class AudioContainer;
+
 class OPUSDecoder : public BaseCodec {
  private:
   OpusDecoder* opus;
+  // Samples still to drop from the start of the stream, of the OpusHead's
+  uint32_t preSkip = 0;
+  uint32_t headerPreSkip = 0;
+  CodecBufferPool::Buffer pcmBuffer;
   int16_t* pcmData;
+  // Interleaved float output, acquired with PLANAR_FLOAT only
+  CodecBufferPool::Buffer floatBuffer;
+  // The next packet follows a lost one
+  bool lossPending = false;
+
+  // opus_decode() or opus_decode_float() of a packet into pcm, preceded by
+  // the lost packet rebuilt from its FEC data if lossPending
+  template <typename T>
+  int decodePacket(uint8_t* inData, uint32_t inLen, T* pcm);
+
+ protected:
+  bool decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                        OutputFormat outputFormat, void* const* planes,
+                        uint32_t& frames) override;
 
  public:
   OPUSDecoder();
   ~OPUSDecoder();
   bool setup(uint32_t sampleRate, uint8_t channelCount,
              uint8_t bitDepth) override;
+  // Reads channels and pre-skip from the container's OpusHead
+  bool setup(AudioContainer* container) override;
   uint8_t* decode(uint8_t* inData, uint32_t& inLen, uint32_t& outLen) override;
+
+  uint32_t maxFrameSamples() override;
+  // Float comes from opus_decode_float(), without an int16 round trip
+  bool isNativeOutput(OutputFormat format) override;
+  bool setOutputFormat(OutputFormat format) override;
+
+  // The next packet's in-band FEC, or PLC where it has none, fills the gap
+  void onDataLost() override { lossPending = true; }
+  // Past the start nothing is skipped, even if the seek came early
+  void onSeek(bool toStart) override {
+    preSkip = toStart ? headerPreSkip : 0;
+  }
+  // Opus PLC, in steps of 2.5 ms
+  uint8_t* conceal(uint32_t maxFrames, uint32_t& outLen) override;
 };
 }  // namespace bell
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint32_t, uint8_t, int16_t
+#include <atomic>      // for atomic
+#include <functional>  // for function
+#include <span>        // for span
+#include <vector>      // for vector
+
+#include "CodecType.h"  // for AudioCodec
+#include "Executor.h"   // for Executor
+
+namespace bell {
+/**
+ * Decodes a whole MP3 or ADTS file on several cores, for offline work such
+ * as loudness analysis. The file is split at frame boundaries into segments
+ * that are decoded as jobs of an Executor, each with a decoder of its own.
+ *
+ * Frames aren't fully independent: MP3 frames take part of their data from
+ * the bit reservoir in the frames before them, and both codecs overlap each
+ * frame with the previous one. A worker therefore starts decoding a few
+ * frames ahead of its segment and drops their output. With the default
+ * warm-up the stitched PCM is the same, sample for sample, as a decoder
+ * fed every frame in order. HE-AAC carries SBR state over more frames,
+ * raise warmupFrames for it; the length of the output stays exact.
+ *
+ * Codecs come from AudioCodecs::createCodec(), which must not hand out a
+ * shared instance.
+ */
+class ParallelFileDecoder {
+ public:
+  struct Config {
+    // Frames per segment, about 13 s of 44.1 kHz MP3
+    uint32_t segmentFrames = 500;
+    // Frames decoded and dropped before each segment, so that the overlap
+    // and the decoder state are rebuilt
+    uint32_t warmupFrames = 2;
+    // Bytes of frames ahead of the warm-up frames, to refill the MP3 bit
+    // reservoir, which reaches up to 511 bytes back
+    size_t warmupBytes = 1024;
+    // Segments queued ahead of the one delivered, bounds the memory used.
+    // 0 keeps two per executor worker
+    size_t segmentsAhead = 0;
+  };
+
+  /**
+   * Receives the PCM in order, on the thread calling decode()
+   * @param pcm interleaved int16 samples, frames * getChannelCount()
+   * @returns false to stop decoding
+   */
+  typedef std::function<bool(const int16_t* pcm, size_t frames)> PCMCallback;
+
+  // codec is AudioCodec::MP3 or AudioCodec::AAC, for ADTS streams
+  ParallelFileDecoder(AudioCodec codec)
+      : ParallelFileDecoder(codec, Executor::instance(), Config()) {}
+  // executor runs the segments, e.g. one with a worker per core
+  ParallelFileDecoder(AudioCodec codec, Executor& executor,
+                      const Config& config);
+
+  /**
+   * Decodes data, a complete file, e.g. FileStream::mapped(). An ID3v2 tag
+   * and a Xing / Info frame are skipped. Free format MP3 isn't supported.
+   * Blocks until the end, it mustn't run as a job of the same executor.
+   * @returns false if no frames were found, the codec isn't available or
+   * onPCM stopped the decoding
+   */
+  bool decode(std::span<const uint8_t> data, const PCMCallback& onPCM);
+
+  // Output format, known from the first call to onPCM on
+  uint32_t getSampleRate() const { return sampleRate; }
+  uint8_t getChannelCount() const { return channelCount; }
+
+ private:
+  struct Frame {
+    size_t offset;
+    uint32_t size;
+    // Per channel, at headerSampleRate
+    uint32_t samples;
+  };
+
+  struct Segment {
+    std::vector<int16_t> pcm;
+    uint32_t sampleRate = 0;
+    uint8_t channelCount = 0;
+  };
+
+  AudioCodec codec;
+  Executor& executor;
+  Config config;
+  uint32_t sampleRate = 0;
+  uint8_t channelCount = 0;
+
+  // Valid during decode()
+  std::span<const uint8_t> data;
+  std::vector<Frame> frames;
+  // Sample rate of the first frame's header, the core rate of SBR streams
+  uint32_t headerSampleRate = 0;
+  // Set when onPCM stops the decoding, queued segments return early
+  std::atomic<bool> stopping = false;
+
+  bool scanFrames();
+  bool scanMP3();
+  bool scanADTS();
+  // Decodes frames [start, end), warm-up frames before it included
+  Segment decodeSegment(size_t start, size_t end);
+};
+}  // namespace bell
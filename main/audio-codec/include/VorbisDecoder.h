@@ -2,20 +2,45 @@
 
 #include <stdint.h>  // for uint8_t, uint32_t, int16_t
 
-#include "BaseCodec.h"     // for BaseCodec
-#include "ivorbiscodec.h"  // for vorbis_comment, vorbis_dsp_state, vorbis_info
+#include "BaseCodec.h"        // for BaseCodec
+#include "CodecBufferPool.h"  // for CodecBufferPool
+#ifdef BELL_VORBIS_FLOAT
+#include <vorbis/codec.h>  // for vorbis_dsp_state, vorbis_block, vorbis_...
+#else
+#include "ivorbiscodec.h"  // for vorbis_comment, vorbis_dsp_state, vorb...
 #include "ogg.h"           // for ogg_packet
+#endif
 
 namespace bell {
 class AudioContainer;
 
+/**
+ * Vorbis decoder on Tremor's integer decoder, or on libvorbis with
+ * BELL_VORBIS_FLOAT, which then has to come from BELL_EXTERNAL_VORBIS. The
+ * float build hands its synthesis output to decodePlanar() as is.
+ */
 class VorbisDecoder : public BaseCodec {
  private:
   vorbis_info* vi = nullptr;
   vorbis_comment* vc = nullptr;
+#ifdef BELL_VORBIS_FLOAT
+  vorbis_dsp_state vd = {};
+  vorbis_block vb = {};
+  bool dspReady = false;
+#else
   vorbis_dsp_state* vd = nullptr;
+#endif
   ogg_packet op = {};
-  int16_t* pcmData;
+  // Interleaved int16 output of decode(), sized in setup() for a long block
+  CodecBufferPool::Buffer pcmBuffer;
+  int16_t* pcmData = nullptr;
+  // Most samples per channel a packet decodes to, half the long block
+  uint32_t blockSamples = 0;
+
+ protected:
+  bool decodePlanarInto(uint8_t* inData, uint32_t& inLen,
+                        OutputFormat outputFormat, void* const* planes,
+                        uint32_t& frames) override;
 
  public:
   VorbisDecoder();
@@ -25,7 +50,13 @@ class VorbisDecoder : public BaseCodec {
   uint8_t* decode(uint8_t* inData, uint32_t& inLen, uint32_t& outLen) override;
   bool setup(AudioContainer* container) override;
 
+  uint32_t maxFrameSamples() override;
+  // Float with BELL_VORBIS_FLOAT, straight from the synthesis buffers
+  bool isNativeOutput(OutputFormat format) override;
+
  private:
-  void setPacket(uint8_t* inData, uint32_t inLen) const;
+  void setPacket(uint8_t* inData, uint32_t inLen);
+  // Synthesizes a packet, false if it decodes to nothing
+  bool synthesize(uint8_t* inData, uint32_t inLen);
 };
 }  // namespace bell
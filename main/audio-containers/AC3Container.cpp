@@ -0,0 +1,212 @@
+#include "AC3Container.h"
+
+#include <algorithm>  // for min
+
+#include "FrameSync.h"   // for findFrame
+#include "StreamInfo.h"  // for BitWidth, SampleRate
+
+using namespace bell;
+
+// Nominal bitrates of frmsizecod / 2, in kbps
+static const uint32_t AC3_BITRATES[] = {32,  40,  48,  56,  64,  80,  96,
+                                        112, 128, 160, 192, 224, 256, 320,
+                                        384, 448, 512, 576, 640};
+static const uint32_t AC3_SAMPLE_RATES[] = {48000, 44100, 32000};
+// Half rates, E-AC-3 fscod2
+static const uint32_t EAC3_REDUCED_RATES[] = {24000, 22050, 16000};
+static const uint32_t EAC3_BLOCKS[] = {1, 2, 3, 6};
+// Full bandwidth channels of acmod
+static const int ACMOD_CHANNELS[] = {2, 1, 2, 3, 3, 4, 4, 5};
+
+AC3Container::AC3Container(std::istream& istr, const std::byte* headingBytes,
+                           size_t headingLen)
+    : bell::AudioContainer(istr) {
+  writeHeading(headingBytes, headingLen);
+}
+
+AC3Container::AC3Container(bell::ByteStream& byteStream,
+                           const std::byte* headingBytes, size_t headingLen)
+    : bell::AudioContainer(byteStream) {
+  writeHeading(headingBytes, headingLen);
+}
+
+void AC3Container::writeHeading(const std::byte* headingBytes,
+                                size_t headingLen) {
+  if (headingBytes != nullptr) {
+    buffer.write(headingBytes, headingLen);
+  }
+}
+
+bool AC3Container::parseFrameHeader(const uint8_t* data, size_t available,
+                                    FrameHeader& header) {
+  if (available < HEADER_LEN || data[0] != 0x0B || data[1] != 0x77) {
+    return false;
+  }
+
+  uint8_t bsid = data[5] >> 3;
+  uint8_t fscod = data[4] >> 6;
+  int acmod;
+  bool lfeon;
+  if (bsid <= 8) {
+    uint8_t frmsizecod = data[4] & 0x3F;
+    if (fscod == 3 || frmsizecod >= 38) {
+      return false;
+    }
+    uint32_t kbps = AC3_BITRATES[frmsizecod >> 1];
+    // 16 bit words per frame of 1536 samples, 44.1 kHz rounds down and
+    // odd codes take one more
+    uint32_t words = fscod == 0   ? kbps * 2
+                     : fscod == 1 ? kbps * 1536000 / 705600 + (frmsizecod & 1)
+                                  : kbps * 3;
+    header.size = words * 2;
+    header.sampleRate = AC3_SAMPLE_RATES[fscod];
+    header.samples = 1536;
+    header.enhanced = false;
+    header.independent = true;
+    header.substream = 0;
+    header.bsmod = data[5] & 0x07;
+
+    // lfeon follows the mix levels present for acmod
+    acmod = data[6] >> 5;
+    int bit = 3;
+    bit += (acmod & 1) && acmod != 1 ? 2 : 0;
+    bit += acmod & 4 ? 2 : 0;
+    bit += acmod == 2 ? 2 : 0;
+    lfeon = (data[6 + bit / 8] >> (7 - bit % 8)) & 1;
+  } else if (bsid >= 11 && bsid <= 16) {
+    uint8_t strmtyp = data[2] >> 6;
+    if (strmtyp == 3) {
+      return false;
+    }
+    header.size = ((((uint32_t)data[2] & 0x07) << 8 | data[3]) + 1) * 2;
+    uint8_t numblkscod = (data[4] >> 4) & 0x03;
+    if (fscod == 3) {
+      // numblkscod is fscod2 then, with 6 blocks
+      if (numblkscod == 3) {
+        return false;
+      }
+      header.sampleRate = EAC3_REDUCED_RATES[numblkscod];
+      header.samples = 6 * 256;
+    } else {
+      header.sampleRate = AC3_SAMPLE_RATES[fscod];
+      header.samples = EAC3_BLOCKS[numblkscod] * 256;
+    }
+    header.enhanced = true;
+    header.independent = strmtyp != 1;
+    header.substream = (data[2] >> 3) & 0x07;
+    header.bsmod = 0;
+    acmod = (data[4] >> 1) & 0x07;
+    lfeon = data[4] & 1;
+  } else {
+    return false;
+  }
+
+  header.channels = ACMOD_CHANNELS[acmod] + (lfeon ? 1 : 0);
+  return header.size >= HEADER_LEN;
+}
+
+size_t AC3Container::frameLength(const uint8_t* data, size_t available) {
+  FrameHeader header;
+  return parseFrameHeader(data, available, header) ? header.size : 0;
+}
+
+bool AC3Container::fillBuffer() {
+  // Reads as much as fits, a chunk ends at the ring wrap point
+  while (buffer.size() < MAX_FRAME_SIZE * 2) {
+    size_t spanLen;
+    std::byte* span = buffer.writeSpan(spanLen);
+    size_t bytesRead = spanLen > 0 ? readBytes(span, spanLen) : 0;
+    if (bytesRead == 0) {
+      break;
+    }
+    buffer.commit(bytesRead);
+  }
+  return buffer.size() >= HEADER_LEN;
+}
+
+bool AC3Container::resync() {
+  size_t validBytes;
+  uint8_t* data = (uint8_t*)buffer.readSpan(validBytes);
+
+  // fillBuffer() stops short only at the end of the source
+  size_t offset;
+  bool found = framesync::findFrame(data, validBytes, HEADER_LEN,
+                                    MAX_FRAME_SIZE, frameLength,
+                                    buffer.size() < MAX_FRAME_SIZE * 2,
+                                    offset, 0x0B);
+  countResync(offset, found);
+  consume(offset);
+  return found;
+}
+
+void AC3Container::consume(size_t len) {
+  len = std::min(len, buffer.size());
+  buffer.consume(len);
+  streamOffset += len;
+}
+
+void AC3Container::consumeBytes(uint32_t len) {
+  consume(len);
+}
+
+std::byte* AC3Container::readSample(uint32_t& len) {
+  len = 0;
+  if (!fillBuffer()) {
+    return nullptr;
+  }
+
+  size_t available;
+  uint8_t* data = (uint8_t*)buffer.readSpan(available);
+  FrameHeader header;
+  if (!parseFrameHeader(data, available, header) ||
+      header.size > available) {
+    if (!resync()) {
+      return nullptr;
+    }
+    data = (uint8_t*)buffer.readSpan(available);
+    if (!parseFrameHeader(data, available, header) ||
+        header.size > available) {
+      return nullptr;
+    }
+  }
+
+  // readSample() hands out the same frame until it's consumed
+  if (streamOffset >= nextFrame) {
+    nextFrame = streamOffset + header.size;
+    frameSampleRate = header.sampleRate;
+    // Dependent substreams and others carry the same samples
+    if (header.independent && header.substream == 0) {
+      samplesPlayed += header.samples;
+    }
+  }
+
+  len = header.size;
+  return (std::byte*)data;
+}
+
+uint32_t AC3Container::getPositionMs() {
+  if (frameSampleRate == 0) {
+    return 0;
+  }
+  return samplesPlayed * 1000 / frameSampleRate;
+}
+
+void AC3Container::parseSetupData() {
+  channels = 2;
+  sampleRate = bell::SampleRate::SR_48000;
+  bitWidth = bell::BitWidth::BW_16;
+
+  size_t available;
+  if (!fillBuffer()) {
+    return;
+  }
+  uint8_t* data = (uint8_t*)buffer.readSpan(available);
+  FrameHeader header;
+  if (parseFrameHeader(data, available, header) ||
+      (resync() && parseFrameHeader((uint8_t*)buffer.readSpan(available),
+                                    available, header))) {
+    enhanced = header.enhanced;
+    channels = header.channels;
+    sampleRate = static_cast<bell::SampleRate>(header.sampleRate);
+  }
+}
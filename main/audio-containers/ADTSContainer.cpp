@@ -1,8 +1,9 @@
 #include "ADTSContainer.h"
 
-#include <cstring>  // for memmove
+#include <algorithm>  // for min, max
 #include <iostream>
 
+#include "FrameSync.h"   // for findFrame
 #include "StreamInfo.h"  // for BitWidth, BitWidth::BW_16, SampleRate, Sampl...
 // #include "aacdec.h"      // for AACFindSyncWord
 
@@ -19,107 +20,209 @@ using namespace bell;
 #define AAC_ADTS_SYNC_VERIFY(buf) \
   ((buf[0] == 0xff) && ((buf[1] & 0xf6) == 0xf0))
 
+// Sampling frequency index of the ADTS header
+static const uint32_t ADTS_SAMPLE_RATES[] = {96000, 88200, 64000, 48000,
+                                             44100, 32000, 24000, 22050,
+                                             16000, 12000, 11025, 8000, 7350};
+
 // AAC ADTS Frame size value stores in 13 bits started at the 31th bit from header
 #define AAC_ADTS_FRAME_GETSIZE(buf) \
   ((buf[3] & 0x03) << 11 | buf[4] << 3 | buf[5] >> 5)
 
-ADTSContainer::ADTSContainer(std::istream& istr, const std::byte* headingBytes)
+ADTSContainer::ADTSContainer(std::istream& istr, const std::byte* headingBytes,
+                             size_t headingLen)
     : bell::AudioContainer(istr) {
+  writeHeading(headingBytes, headingLen);
+}
+
+ADTSContainer::ADTSContainer(bell::ByteStream& byteStream,
+                             const std::byte* headingBytes, size_t headingLen)
+    : bell::AudioContainer(byteStream) {
+  writeHeading(headingBytes, headingLen);
+}
+
+void ADTSContainer::writeHeading(const std::byte* headingBytes,
+                                 size_t headingLen) {
   if (headingBytes != nullptr) {
-    memcpy(buffer.data(), headingBytes, 7);
-    bytesInBuffer = 7;
+    buffer.write(headingBytes, headingLen);
   }
 }
 
 bool ADTSContainer::fillBuffer() {
-  if (this->bytesInBuffer < AAC_MAX_FRAME_SIZE * 2) {
-    this->istr.read((char*)buffer.data() + bytesInBuffer,
-                    buffer.size() - bytesInBuffer);
-    this->bytesInBuffer += istr.gcount();
+  // Reads as much as fits, a chunk ends at the ring wrap point
+  while (buffer.size() < AAC_MAX_FRAME_SIZE * 2) {
+    size_t spanLen;
+    std::byte* span = buffer.writeSpan(spanLen);
+    size_t bytesRead = spanLen > 0 ? readBytes(span, spanLen) : 0;
+    if (bytesRead == 0) {
+      break;
+    }
+    buffer.commit(bytesRead);
   }
-  return this->bytesInBuffer >= AAC_MAX_FRAME_SIZE;
+  return buffer.size() >= AAC_MAX_FRAME_SIZE;
+}
+
+// Frames shorter than their own header are chance syncs
+static size_t adtsFrameLength(const uint8_t* header, size_t available) {
+  uint32_t length = ADTSContainer::frameLength(header, available);
+  return length >= 7 ? length : 0;
 }
 
 bool ADTSContainer::resyncADTS() {
-  int resyncOffset = 0;
-  bool resyncValid = false;
-
-  size_t validBytes = bytesInBuffer - dataOffset;
-
-  while (!resyncValid && resyncOffset < validBytes) {
-    uint8_t* buf = (uint8_t*)this->buffer.data() + dataOffset + resyncOffset;
-    if (AAC_ADTS_SYNC_VERIFY(buf)) {
-      // Read frame size, and check if a consecutive frame is available
-      uint32_t frameSize = AAC_ADTS_FRAME_GETSIZE(buf);
-
-      if (frameSize + resyncOffset > validBytes) {
-        // Not enough data, discard this frame
-        resyncOffset++;
-        continue;
-      }
-
-      buf =
-          (uint8_t*)this->buffer.data() + dataOffset + resyncOffset + frameSize;
-
-      if (AAC_ADTS_SYNC_VERIFY(buf)) {
-        buf += AAC_ADTS_FRAME_GETSIZE(buf);
-        if (AAC_ADTS_SYNC_VERIFY(buf)) {
-          protectionAbsent = (buf[1] & 1);
-
-          // Found 3 consecutive frames, resynced
-          resyncValid = true;
-        }
-      }
-    } else {
-      resyncOffset++;
-    }
+  size_t validBytes;
+  uint8_t* data = (uint8_t*)buffer.readSpan(validBytes);
+
+  // fillBuffer() stops short only at the end of the source
+  size_t offset;
+  bool found = framesync::findFrame(
+      data, validBytes, AAC_ADTS_FRAME_HEADER_LEN, AAC_MAX_FRAME_SIZE,
+      adtsFrameLength, buffer.size() < AAC_MAX_FRAME_SIZE * 2, offset);
+  countResync(offset, found);
+  consume(offset);
+  if (found) {
+    data = (uint8_t*)buffer.readSpan(validBytes);
+    protectionAbsent = (data[1] & 1);
   }
+  return found;
+}
 
-  dataOffset += resyncOffset;
-  return resyncValid;
+void ADTSContainer::consume(size_t len) {
+  len = std::min(len, buffer.size());
+  buffer.consume(len);
+  streamOffset += len;
 }
 
 void ADTSContainer::consumeBytes(uint32_t len) {
-  dataOffset += len;
+  consume(len);
 }
 
 std::byte* ADTSContainer::readSample(uint32_t& len) {
-  // Align data if previous read was offseted
-  if (dataOffset > 0 && bytesInBuffer > 0) {
-    size_t toConsume = std::min(dataOffset, bytesInBuffer);
-    memmove(buffer.data(), buffer.data() + toConsume,
-            buffer.size() - toConsume);
-
-    dataOffset -= toConsume;
-    bytesInBuffer -= toConsume;
-  }
-
   if (!this->fillBuffer()) {
     len = 0;
     return nullptr;
   }
 
-  uint8_t* buf = (uint8_t*)buffer.data() + dataOffset;
+  size_t available;
+  uint8_t* buf = (uint8_t*)buffer.readSpan(available);
 
   if (!AAC_ADTS_SYNC_VERIFY(buf)) {
     if (!resyncADTS()) {
       len = 0;
       return nullptr;
     }
+    buf = (uint8_t*)buffer.readSpan(available);
   } else {
     protectionAbsent = (buf[1] & 1);
   }
 
   len = AAC_ADTS_FRAME_GETSIZE(buf);
 
-  if (len > bytesInBuffer - dataOffset) {
+  if (len > available) {
     if (!resyncADTS()) {
       len = 0;
       return nullptr;
     }
+    buf = (uint8_t*)buffer.readSpan(available);
+    len = AAC_ADTS_FRAME_GETSIZE(buf);
+  }
+
+  countFrame(buf, len);
+  return (std::byte*)buf;
+}
+
+void ADTSContainer::countFrame(const uint8_t* frame, uint32_t len) {
+  // readSample() hands out the same frame until the codec consumes it
+  if (streamOffset < nextFrame || len == 0) {
+    return;
   }
+  nextFrame = streamOffset + len;
 
-  return buffer.data() + dataOffset;
+  uint32_t rate = headerSampleRate(frame);
+  if (rate == 0) {
+    return;
+  }
+  if (frameSampleRate == 0) {
+    frameSampleRate = rate;
+  }
+
+  if (!rateBaseSet) {
+    rateBaseOffset = streamOffset;
+    rateBaseSamples = samplesPlayed;
+    rateBaseSet = true;
+  }
+
+  if (positionExact) {
+    frameIndex.addFrame(streamOffset, getPositionMs());
+  }
+  samplesPlayed += frameSamples(frame);
+}
+
+uint32_t ADTSContainer::frameLength(const uint8_t* header, size_t available) {
+  if (available < AAC_ADTS_FRAME_HEADER_LEN || !AAC_ADTS_SYNC_VERIFY(header)) {
+    return 0;
+  }
+  return AAC_ADTS_FRAME_GETSIZE(header);
+}
+
+uint32_t ADTSContainer::frameSamples(const uint8_t* header) {
+  // 1024 samples per raw data block
+  return ((header[6] & 0x03) + 1) * 1024;
+}
+
+uint32_t ADTSContainer::headerSampleRate(const uint8_t* header) {
+  uint32_t rateIndex = (header[2] >> 2) & 0x0F;
+  if (rateIndex >= sizeof(ADTS_SAMPLE_RATES) / sizeof(ADTS_SAMPLE_RATES[0])) {
+    return 0;
+  }
+  return ADTS_SAMPLE_RATES[rateIndex];
+}
+
+uint32_t ADTSContainer::getPositionMs() {
+  if (frameSampleRate == 0) {
+    return 0;
+  }
+  return samplesPlayed * 1000 / frameSampleRate;
+}
+
+bool ADTSContainer::seekToTime(uint32_t timeMs) {
+  FrameIndex::Entry entry;
+  size_t offset;
+  uint32_t landedMs = timeMs;
+  bool exact = frameIndex.lookup(timeMs, entry);
+
+  if (exact) {
+    offset = entry.offset;
+    landedMs = entry.timeMs;
+  } else {
+    // Average bytes per sample over everything counted so far
+    uint64_t samples = samplesPlayed - rateBaseSamples;
+    if (!rateBaseSet || samples == 0 || nextFrame <= rateBaseOffset) {
+      return false;
+    }
+
+    int64_t deltaSamples =
+        (int64_t)timeMs * frameSampleRate / 1000 - (int64_t)rateBaseSamples;
+    int64_t target = (int64_t)rateBaseOffset +
+                     deltaSamples * (int64_t)(nextFrame - rateBaseOffset) /
+                         (int64_t)samples;
+    offset = std::max<int64_t>(target, 0);
+  }
+
+  if (!seekSource(offset)) {
+    return false;
+  }
+
+  // Landing mid-frame is fine, readSample() resyncs
+  buffer.clear();
+  streamOffset = offset;
+  nextFrame = offset;
+  samplesPlayed = (uint64_t)landedMs * frameSampleRate / 1000;
+  // The index must only learn frames whose time is known for sure
+  positionExact = exact;
+  if (!exact) {
+    rateBaseSet = false;
+  }
+  return true;
 }
 
 void ADTSContainer::parseSetupData() {
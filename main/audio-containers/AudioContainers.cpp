@@ -1,12 +1,19 @@
 #include "AudioContainers.h"
 
-#include <string.h>      // for memcmp
-#include <cstddef>       // for byte
+#include <string.h>   // for memcmp
+#include <algorithm>  // for min, max
+#include <cstddef>    // for byte
+#include <vector>     // for vector
+
 #include "BellLogger.h"  // for BellLogger
 
+#include "AC3Container.h"   // for AC3Container
 #include "ADTSContainer.h"  // for AACContainer
 #include "CodecType.h"      // for bell
+#include "FLACContainer.h"  // for FLACContainer
 #include "MP3Container.h"   // for MP3Container
+#include "MP4Container.h"   // for MP4Container
+#include "OggContainer.h"   // for OggContainer
 
 namespace bell {
 class AudioContainer;
@@ -14,26 +21,208 @@ class AudioContainer;
 
 using namespace bell;
 
-std::unique_ptr<bell::AudioContainer> AudioContainers::guessAudioContainer(
-    std::istream& istr) {
-  std::byte tmp[14];
-  istr.read((char*)tmp, sizeof(tmp));
-
-  if (memcmp(tmp, "\xFF\xF1", 2) == 0 || memcmp(tmp, "\xFF\xF9", 2) == 0) {
-    // AAC found
-    BELL_LOG(info, "AudioContainers",
-             "Mime guesser found AAC in ADTS format, creating ADTSContainer");
-    return std::make_unique<bell::ADTSContainer>(istr, tmp);
-  } else if (memcmp(tmp, "\xFF\xFB", 2) == 0 ||
-             memcmp(tmp, "\x49\x44\x33", 3) == 0) {
-    // MP3 Found
-    BELL_LOG(info, "AudioContainers",
-             "Mime guesser found MP3 format, creating MP3Container");
-
-    return std::make_unique<bell::MP3Container>(istr, tmp);
-  }
-
-  BELL_LOG(error, "AudioContainers",
-           "Mime guesser found no supported format [%X, %X]", tmp[0], tmp[1]);
+// Frames chained before ADTS or MP3 is believed, a lone sync is too weak
+#define PROBE_FRAME_RUN 3
+// Same for AC-3, whose larger frames rarely fit three in a probe
+#define PROBE_AC3_FRAME_RUN 2
+
+enum class ProbedFormat { NONE, ADTS, MP3, MP4, OGG, FLAC, AC3 };
+
+// Size of the ID3v2 tag at the start of data, 0 if there is none
+static size_t id3Size(const uint8_t* data, size_t len) {
+  if (len < 10 || memcmp(data, "ID3", 3) != 0) {
+    return 0;
+  }
+  size_t size = 10 + ((data[6] & 0x7F) << 21 | (data[7] & 0x7F) << 14 |
+                      (data[8] & 0x7F) << 7 | (data[9] & 0x7F));
+  if (data[5] & 0x10) {
+    // Footer present
+    size += 10;
+  }
+  return size;
+}
+
+/**
+ * Length of the run of whole frames starting at data, counted up to
+ * PROBE_FRAME_RUN. When data holds the whole source, a run reaching its end
+ * counts in full, short files may hold fewer frames than that.
+ */
+template <typename FrameLength>
+static size_t frameRun(const uint8_t* data, size_t len, bool complete,
+                       FrameLength frameLength) {
+  size_t frames = 0;
+  for (size_t pos = 0; frames < PROBE_FRAME_RUN; frames++) {
+    if (pos >= len) {
+      return complete && frames > 0 ? PROBE_FRAME_RUN : frames;
+    }
+    size_t size = frameLength(data + pos, len - pos);
+    if (size == 0 || (size > len - pos && !complete)) {
+      break;
+    }
+    pos += size;
+  }
+  return frames;
+}
+
+static size_t adtsFrameLength(const uint8_t* data, size_t len) {
+  uint32_t size = ADTSContainer::frameLength(data, len);
+  // Shorter than a header can't be followed
+  return size >= 7 ? size : 0;
+}
+
+static size_t mp3FrameLength(const uint8_t* data, size_t len) {
+  MP3Container::FrameHeader header;
+  if (len < 4 || !MP3Container::parseFrameHeader(data, header) ||
+      header.bitrate == 0) {
+    return 0;
+  }
+  return header.size;
+}
+
+/**
+ * Scores data, the probe with any ID3v2 tag still at its start
+ * @param complete whether the source ended within data
+ */
+static ProbedFormat probeFormat(const uint8_t* data, size_t len,
+                                bool complete) {
+  size_t tagSize = id3Size(data, len);
+  if (tagSize >= len) {
+    // Audio past the probe, ID3v2 is the MP3 tag format
+    return tagSize > 0 ? ProbedFormat::MP3 : ProbedFormat::NONE;
+  }
+  data += tagSize;
+  len -= tagSize;
+
+  if (len >= 4 && memcmp(data, "OggS", 4) == 0) {
+    return ProbedFormat::OGG;
+  } else if (len >= 4 && memcmp(data, "fLaC", 4) == 0) {
+    return ProbedFormat::FLAC;
+  } else if (len >= 8 && (memcmp(data + 4, "ftyp", 4) == 0 ||
+                          memcmp(data + 4, "styp", 4) == 0)) {
+    return ProbedFormat::MP4;
+  }
+
+  // The first full run of frames wins, the containers skip what's before
+  for (size_t pos = 0; pos + 4 <= len; pos++) {
+    if (data[pos] == 0x0B &&
+        frameRun(data + pos, len - pos, complete, AC3Container::frameLength) >=
+            PROBE_AC3_FRAME_RUN) {
+      return ProbedFormat::AC3;
+    }
+    if (data[pos] != 0xFF) {
+      continue;
+    }
+    if (frameRun(data + pos, len - pos, complete, adtsFrameLength) >=
+        PROBE_FRAME_RUN) {
+      return ProbedFormat::ADTS;
+    }
+    if (frameRun(data + pos, len - pos, complete, mp3FrameLength) >=
+        PROBE_FRAME_RUN) {
+      return ProbedFormat::MP3;
+    }
+  }
+
+  // Frames too large for the probe, a valid header up front will do
+  if (adtsFrameLength(data, len) > 0) {
+    return ProbedFormat::ADTS;
+  } else if (mp3FrameLength(data, len) > 0 || tagSize > 0) {
+    return ProbedFormat::MP3;
+  }
+  return ProbedFormat::NONE;
+}
+
+template <typename Source>
+static std::unique_ptr<bell::AudioContainer> createContainer(
+    ProbedFormat format, Source& source, const std::byte* heading,
+    size_t len) {
+  switch (format) {
+    case ProbedFormat::ADTS:
+      BELL_LOG(info, "AudioContainers",
+               "Mime guesser found AAC in ADTS format, creating ADTSContainer");
+      return std::make_unique<bell::ADTSContainer>(source, heading, len);
+    case ProbedFormat::MP3:
+      BELL_LOG(info, "AudioContainers",
+               "Mime guesser found MP3 format, creating MP3Container");
+      return std::make_unique<bell::MP3Container>(source, heading, len);
+    case ProbedFormat::MP4:
+      // The codec is only known once moov is read
+      BELL_LOG(info, "AudioContainers",
+               "Mime guesser found MP4 format, creating MP4Container");
+      return std::make_unique<bell::MP4Container>(source, heading, len);
+    case ProbedFormat::OGG:
+      // The codec is only known once the first packet is read
+      BELL_LOG(info, "AudioContainers",
+               "Mime guesser found Ogg format, creating OggContainer");
+      return std::make_unique<bell::OggContainer>(source, heading, len);
+    case ProbedFormat::FLAC:
+      BELL_LOG(info, "AudioContainers",
+               "Mime guesser found FLAC format, creating FLACContainer");
+      return std::make_unique<bell::FLACContainer>(source, heading, len);
+    case ProbedFormat::AC3:
+      BELL_LOG(info, "AudioContainers",
+               "Mime guesser found AC-3 format, creating AC3Container");
+      return std::make_unique<bell::AC3Container>(source, heading, len);
+    default:
+      break;
+  }
+
+  if (len < 2) {
+    BELL_LOG(error, "AudioContainers", "Mime guesser got no data");
+  } else {
+    BELL_LOG(error, "AudioContainers",
+             "Mime guesser found no supported format [%X, %X]", heading[0],
+             heading[1]);
+  }
   return nullptr;
 }
+
+/**
+ * Probes source through read, which fills up to len bytes and returns how
+ * many it got. The probe grows past an ID3v2 tag that fits MAX_PROBE_SIZE.
+ */
+template <typename Source, typename Read>
+static std::unique_ptr<bell::AudioContainer> guess(Source& source,
+                                                   size_t probeSize,
+                                                   Read read) {
+  probeSize = std::min(std::max<size_t>(probeSize, 16),
+                       AudioContainers::MAX_PROBE_SIZE);
+  std::vector<std::byte> heading(probeSize);
+  size_t len = read((uint8_t*)heading.data(), probeSize);
+
+  size_t tagSize = id3Size((uint8_t*)heading.data(), len);
+  size_t wanted =
+      std::min(tagSize + probeSize, AudioContainers::MAX_PROBE_SIZE);
+  if (len == probeSize && wanted > len) {
+    heading.resize(wanted);
+    len += read((uint8_t*)heading.data() + len, wanted - len);
+  }
+
+  // Less than asked for, the source ended
+  bool complete = len < heading.size();
+  auto format = probeFormat((uint8_t*)heading.data(), len, complete);
+  return createContainer(format, source, heading.data(), len);
+}
+
+std::unique_ptr<bell::AudioContainer> AudioContainers::guessAudioContainer(
+    std::istream& istr, size_t probeSize) {
+  return guess(istr, probeSize, [&istr](uint8_t* dst, size_t len) {
+    istr.read((char*)dst, len);
+    return (size_t)istr.gcount();
+  });
+}
+
+std::unique_ptr<bell::AudioContainer> AudioContainers::guessAudioContainer(
+    bell::ByteStream& byteStream, size_t probeSize) {
+  return guess(byteStream, probeSize, [&byteStream](uint8_t* dst, size_t len) {
+    // Sockets may hand out less than asked for
+    size_t done = 0;
+    while (done < len) {
+      size_t bytesRead = byteStream.read(dst + done, len - done);
+      if (bytesRead == 0) {
+        break;
+      }
+      done += bytesRead;
+    }
+    return done;
+  });
+}
@@ -0,0 +1,379 @@
+#include "FLACContainer.h"
+
+#include <string.h>   // for memcmp, memcpy
+#include <algorithm>  // for min, max
+
+#include "BellLogger.h"     // for BELL_LOG
+#include "StreamInfo.h"     // for BitWidth, SampleRate
+#include "VorbisComment.h"  // for parseReplayGain
+
+using namespace bell;
+
+// Metadata block types
+#define FLAC_STREAMINFO 0
+#define FLAC_SEEKTABLE 3
+#define FLAC_VORBIS_COMMENT 4
+
+static uint64_t readBE(const uint8_t* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+FLACContainer::FLACContainer(std::istream& istr, const std::byte* headingBytes,
+                             size_t headingLen)
+    : bell::AudioContainer(istr) {
+  writeHeading(headingBytes, headingLen);
+}
+
+FLACContainer::FLACContainer(bell::ByteStream& byteStream,
+                             const std::byte* headingBytes, size_t headingLen)
+    : bell::AudioContainer(byteStream) {
+  writeHeading(headingBytes, headingLen);
+}
+
+void FLACContainer::writeHeading(const std::byte* headingBytes,
+                                 size_t headingLen) {
+  if (headingBytes != nullptr) {
+    buffer.write(headingBytes, headingLen);
+  }
+}
+
+size_t FLACContainer::fillBuffer() {
+  while (buffer.freeSpace() > 0) {
+    size_t spanLen;
+    std::byte* span = buffer.writeSpan(spanLen);
+    size_t bytesRead = readBytes(span, spanLen);
+    if (bytesRead == 0) {
+      break;
+    }
+    buffer.commit(bytesRead);
+  }
+  return buffer.size();
+}
+
+void FLACContainer::consume(size_t len) {
+  len = std::min(len, buffer.size());
+  buffer.consume(len);
+  streamOffset += len;
+}
+
+bool FLACContainer::skip(size_t len) {
+  if (len > buffer.size() + SEEK_DISTANCE &&
+      seekSource(streamOffset + len)) {
+    buffer.clear();
+    streamOffset += len;
+    return true;
+  }
+
+  while (len > 0) {
+    if (buffer.size() == 0 && fillBuffer() == 0) {
+      return false;
+    }
+    size_t toSkip = std::min(len, buffer.size());
+    consume(toSkip);
+    len -= toSkip;
+  }
+  return true;
+}
+
+bool FLACContainer::getReplayGain(ReplayGainInfo& info) {
+  if (!metadataParsed) {
+    parseMetadata();
+  }
+  if (!replayGain.hasTrack && !replayGain.hasAlbum) {
+    return false;
+  }
+  info = replayGain;
+  return true;
+}
+
+bool FLACContainer::readMetadata(uint8_t* dst, size_t len) {
+  while (len > 0) {
+    if (buffer.size() == 0 && fillBuffer() == 0) {
+      return false;
+    }
+    size_t available;
+    std::byte* data = buffer.readSpan(available);
+    available = std::min(available, len);
+    memcpy(dst, data, available);
+    consume(available);
+    dst += available;
+    len -= available;
+  }
+  return true;
+}
+
+bool FLACContainer::parseMetadata() {
+  metadataParsed = true;
+
+  uint8_t marker[4];
+  if (!readMetadata(marker, sizeof(marker)) ||
+      memcmp(marker, "fLaC", 4) != 0) {
+    BELL_LOG(error, "FLACContainer", "Missing fLaC marker");
+    return false;
+  }
+
+  bool last = false;
+  while (!last) {
+    uint8_t header[4];
+    if (!readMetadata(header, sizeof(header))) {
+      return false;
+    }
+    last = header[0] & 0x80;
+    uint8_t type = header[0] & 0x7F;
+    size_t len = readBE(header + 1, 3);
+
+    if (type == FLAC_STREAMINFO && len >= flac::STREAMINFO_SIZE) {
+      if (!readMetadata(streamInfoData, flac::STREAMINFO_SIZE)) {
+        return false;
+      }
+      len -= flac::STREAMINFO_SIZE;
+      hasStreamInfo = flac::parseStreamInfo(
+          streamInfoData, flac::STREAMINFO_SIZE, info);
+    } else if (type == FLAC_SEEKTABLE) {
+      for (; len >= 18; len -= 18) {
+        uint8_t point[18];
+        if (!readMetadata(point, sizeof(point))) {
+          return false;
+        }
+        uint64_t sample = readBE(point, 8);
+        // Placeholder points hold all ones
+        if (sample != UINT64_MAX) {
+          seekTable.push_back({sample, readBE(point + 8, 8)});
+        }
+      }
+    } else if (type == FLAC_VORBIS_COMMENT && len <= SEEK_DISTANCE) {
+      std::vector<uint8_t> comment(len);
+      if (!readMetadata(comment.data(), len)) {
+        return false;
+      }
+      len = 0;
+      vorbis::parseReplayGain(comment.data(), comment.size(), replayGain);
+    }
+
+    if (!skip(len)) {
+      return false;
+    }
+  }
+
+  if (!hasStreamInfo) {
+    BELL_LOG(error, "FLACContainer", "Missing or invalid STREAMINFO");
+    return false;
+  }
+
+  audioStart = streamOffset;
+  nextFrame = streamOffset;
+  channels = info.channels;
+  sampleRate = static_cast<bell::SampleRate>(info.sampleRate);
+  bitWidth = info.bitsPerSample <= 16   ? bell::BitWidth::BW_16
+             : info.bitsPerSample <= 24 ? bell::BitWidth::BW_24
+                                        : bell::BitWidth::BW_32;
+  resizeBuffer();
+  return true;
+}
+
+void FLACContainer::resizeBuffer() {
+  // Worst case is a verbatim frame, plus the header and footer
+  size_t window = info.maxFrameSize > 0
+                      ? info.maxFrameSize + 32
+                      : (size_t)info.maxBlockSize * info.channels *
+                                ((info.bitsPerSample + 7) / 8) +
+                            1024;
+  window = std::min(std::max(window, DEFAULT_FRAME_WINDOW), MAX_FRAME_WINDOW);
+  if (window <= frameWindow) {
+    return;
+  }
+
+  // Carry over what has been read already
+  MirroredRing resized(window * 2, window);
+  while (buffer.size() > 0) {
+    size_t available;
+    std::byte* data = buffer.readSpan(available);
+    resized.write(data, available);
+    buffer.consume(available);
+  }
+  buffer = std::move(resized);
+  frameWindow = window;
+}
+
+bool FLACContainer::findFrame(const uint8_t* data, size_t available,
+                              size_t from, size_t& offset,
+                              flac::FrameHeader& header) {
+  for (size_t i = from; i + 1 < available; i++) {
+    if (data[i] != 0xFF || (data[i + 1] & 0xFE) != 0xF8) {
+      continue;
+    }
+    // The stream parameters don't change, which weeds out false syncs
+    if (flac::parseFrameHeader(data + i, available - i, info, header) &&
+        header.bitsPerSample == info.bitsPerSample &&
+        header.channels == info.channels) {
+      offset = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::byte* FLACContainer::readSample(uint32_t& len) {
+  len = 0;
+  if (!metadataParsed && !parseMetadata()) {
+    return nullptr;
+  }
+  if (!hasStreamInfo) {
+    return nullptr;
+  }
+
+  while (true) {
+    fillBuffer();
+    size_t available;
+    uint8_t* data = (uint8_t*)buffer.readSpan(available);
+    size_t offset;
+    if (findFrame(data, available, 0, offset, frame)) {
+      consume(offset);
+      break;
+    }
+
+    // Keep a possible partial header at the end. The ring is only this
+    // empty at the end of the stream, where nothing more can complete it
+    if (available <= 16) {
+      return nullptr;
+    }
+    consume(available - 16);
+  }
+
+  size_t available;
+  std::byte* data = buffer.readSpan(available);
+
+  if (streamOffset >= nextFrame) {
+    nextFrame = streamOffset + frame.size;
+    frameIndex.addFrame(streamOffset, (uint64_t)frame.firstSample * 1000 /
+                                          info.sampleRate);
+  }
+  hasFrame = true;
+  frameConsumed = false;
+
+  len = available;
+  return data;
+}
+
+void FLACContainer::consumeBytes(uint32_t len) {
+  // A failed decode only skips the sync byte
+  frameConsumed = len > 1;
+  consume(len);
+}
+
+void FLACContainer::parseSetupData() {
+  if (!metadataParsed) {
+    parseMetadata();
+  }
+}
+
+uint8_t* FLACContainer::getSetupData(uint32_t& len, AudioCodec codec) {
+  parseSetupData();
+  if (codec != AudioCodec::FLAC || !hasStreamInfo) {
+    len = 0;
+    return nullptr;
+  }
+
+  len = flac::STREAMINFO_SIZE;
+  return streamInfoData;
+}
+
+uint32_t FLACContainer::getPositionMs() {
+  if (!hasFrame || info.sampleRate == 0) {
+    return 0;
+  }
+  uint64_t sample = frame.firstSample + (frameConsumed ? frame.blockSize : 0);
+  return sample * 1000 / info.sampleRate;
+}
+
+bool FLACContainer::skipToSample(uint64_t target) {
+  while (true) {
+    fillBuffer();
+    size_t available;
+    uint8_t* data = (uint8_t*)buffer.readSpan(available);
+    size_t offset;
+    flac::FrameHeader header;
+    if (!findFrame(data, available, 0, offset, header)) {
+      if (available <= 16) {
+        return false;
+      }
+      consume(available - 16);
+      continue;
+    }
+    consume(offset);
+    data = (uint8_t*)buffer.readSpan(available);
+
+    if (header.firstSample + header.blockSize > target) {
+      return true;
+    }
+
+    // The next frame has to continue this one, or the sync was a false one
+    size_t next = header.size;
+    flac::FrameHeader nextHeader;
+    bool found;
+    while ((found = findFrame(data, available, next, next, nextHeader)) &&
+           nextHeader.firstSample != header.firstSample + header.blockSize) {
+      next++;
+    }
+    if (!found) {
+      // The ring holds a whole frame, so this is the end of the stream
+      return false;
+    }
+    consume(next);
+  }
+}
+
+bool FLACContainer::seekToTime(uint32_t timeMs) {
+  parseSetupData();
+  if (!hasStreamInfo) {
+    return false;
+  }
+
+  uint64_t target = (uint64_t)timeMs * info.sampleRate / 1000;
+
+  // Closest known frame start before the target
+  size_t offset = audioStart;
+  for (auto& point : seekTable) {
+    if (point.sample > target) {
+      break;
+    }
+    offset = audioStart + point.offset;
+  }
+
+  FrameIndex::Entry entry;
+  if (frameIndex.lookup(timeMs, entry) && entry.offset > offset) {
+    offset = entry.offset;
+  } else if (seekTable.empty() && hasFrame && streamOffset > audioStart &&
+             frame.firstSample > 0 && target > frame.firstSample) {
+    // Average bytes per sample so far, backed off so skipToSample() walks
+    // forward to the frame
+    uint64_t estimate = (uint64_t)(streamOffset - audioStart) * target /
+                        frame.firstSample * 9 / 10;
+    offset = std::max(offset, audioStart + (size_t)estimate);
+  }
+
+  if (!seekSource(offset)) {
+    return false;
+  }
+  buffer.clear();
+  streamOffset = offset;
+  nextFrame = offset;
+
+  if (!skipToSample(target)) {
+    return false;
+  }
+
+  // Position of the frame about to be returned
+  size_t available;
+  uint8_t* data = (uint8_t*)buffer.readSpan(available);
+  size_t frameOffset;
+  if (findFrame(data, available, 0, frameOffset, frame)) {
+    hasFrame = true;
+    frameConsumed = false;
+  }
+  return true;
+}
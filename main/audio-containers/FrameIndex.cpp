@@ -0,0 +1,54 @@
+#include "FrameIndex.h"
+
+#include <algorithm>  // for upper_bound
+
+using namespace bell;
+
+FrameIndex::FrameIndex(uint32_t intervalMs, size_t maxEntries)
+    : baseIntervalMs(intervalMs),
+      intervalMs(intervalMs),
+      maxEntries(maxEntries) {}
+
+void FrameIndex::addFrame(size_t offset, uint32_t timeMs) {
+  if (hasFrames && timeMs < lastFrameMs) {
+    return;
+  }
+  lastFrameMs = timeMs;
+  hasFrames = true;
+
+  if (!entries.empty() && timeMs < entries.back().timeMs + intervalMs) {
+    return;
+  }
+
+  if (entries.size() >= maxEntries) {
+    // Keep every other entry, and space new ones out accordingly
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size(); i += 2) {
+      entries[kept++] = entries[i];
+    }
+    entries.resize(kept);
+    intervalMs *= 2;
+  }
+
+  entries.push_back({timeMs, (uint32_t)offset});
+}
+
+bool FrameIndex::lookup(uint32_t timeMs, Entry& entry) const {
+  if (entries.empty() || timeMs > lastFrameMs ||
+      timeMs < entries.front().timeMs) {
+    return false;
+  }
+
+  auto next = std::upper_bound(
+      entries.begin(), entries.end(), timeMs,
+      [](uint32_t time, const Entry& e) { return time < e.timeMs; });
+  entry = *(next - 1);
+  return true;
+}
+
+void FrameIndex::clear() {
+  entries.clear();
+  intervalMs = baseIntervalMs;
+  lastFrameMs = 0;
+  hasFrames = false;
+}
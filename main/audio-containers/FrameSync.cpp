@@ -0,0 +1,54 @@
+#include "FrameSync.h"
+
+#include <string.h>  // for memchr
+
+using namespace bell;
+
+bool framesync::findFrame(const uint8_t* data, size_t len, size_t headerLen,
+                          size_t maxFrameSize, FrameLength frameLength,
+                          bool end, size_t& offset, uint8_t syncByte) {
+  for (size_t pos = 0; pos + headerLen <= len; pos++) {
+    auto sync = (const uint8_t*)memchr(data + pos, syncByte, len - pos);
+    if (sync == nullptr) {
+      break;
+    }
+    pos = sync - data;
+    if (pos + headerLen > len) {
+      // Partial header, kept for the next call
+      offset = pos;
+      return false;
+    }
+
+    size_t size = frameLength(data + pos, len - pos);
+    if (size == UNKNOWN_SIZE) {
+      offset = pos;
+      return true;
+    }
+    if (size == 0 || size > maxFrameSize) {
+      continue;
+    }
+
+    // Bounded look-ahead of a single header
+    size_t next = pos + size;
+    if (next + headerLen > len) {
+      if (!end) {
+        // Confirmed once more data came in
+        offset = pos;
+        return false;
+      }
+      if (next <= len) {
+        offset = pos;
+        return true;
+      }
+      // Truncated
+      continue;
+    }
+    if (frameLength(data + next, len - next) > 0) {
+      offset = pos;
+      return true;
+    }
+  }
+
+  offset = len > headerLen ? len - (headerLen - 1) : 0;
+  return false;
+}
@@ -1,63 +1,407 @@
 #include "MP3Container.h"
 
-#include <cstring>  // for memmove
+#include <algorithm>  // for min, clamp
+#include <cstring>    // for memcmp
 
+#include "FrameSync.h"   // for findFrame, UNKNOWN_SIZE
 #include "StreamInfo.h"  // for BitWidth, BitWidth::BW_16, SampleRate, Sampl...
-#include "mp3dec.h"      // for MP3FindSyncWord
 
 using namespace bell;
 
-MP3Container::MP3Container(std::istream& istr, const std::byte* headingBytes)
+// kbps, [MPEG-1 / MPEG-2 and 2.5][layer - 1][bitrate index]
+static const uint16_t BITRATES[2][3][15] = {
+    {{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+     {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+     {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}},
+    {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}}};
+
+// MPEG-1 rates, halved for MPEG-2 and quartered for MPEG-2.5
+static const uint32_t SAMPLE_RATES[3] = {44100, 48000, 32000};
+
+bool MP3Container::parseFrameHeader(const uint8_t* buf, FrameHeader& header) {
+  if (buf[0] != 0xFF || (buf[1] & 0xE0) != 0xE0) {
+    return false;
+  }
+
+  // 0: MPEG-2.5, 1: reserved, 2: MPEG-2, 3: MPEG-1
+  int version = (buf[1] >> 3) & 0x03;
+  int layer = 4 - ((buf[1] >> 1) & 0x03);
+  int bitrateIndex = buf[2] >> 4;
+  int rateIndex = (buf[2] >> 2) & 0x03;
+  if (version == 1 || layer == 4 || bitrateIndex == 15 || rateIndex == 3) {
+    return false;
+  }
+
+  header.isMpeg1 = version == 3;
+  header.isMono = (buf[3] >> 6) == 3;
+  header.sampleRate =
+      SAMPLE_RATES[rateIndex] >> (header.isMpeg1 ? 0 : (version == 2 ? 1 : 2));
+  header.bitrate =
+      BITRATES[header.isMpeg1 ? 0 : 1][layer - 1][bitrateIndex] * 1000;
+
+  uint32_t padding = (buf[2] >> 1) & 0x01;
+  if (layer == 1) {
+    header.samples = 384;
+    header.size = (12 * header.bitrate / header.sampleRate + padding) * 4;
+  } else {
+    header.samples = (layer == 3 && !header.isMpeg1) ? 576 : 1152;
+    header.size =
+        header.samples / 8 * header.bitrate / header.sampleRate + padding;
+  }
+  return true;
+}
+
+static size_t mp3FrameLength(const uint8_t* data, size_t available) {
+  MP3Container::FrameHeader header;
+  if (available < 4 || !MP3Container::parseFrameHeader(data, header)) {
+    return 0;
+  }
+  // Free format frames have no size in the header
+  return header.bitrate > 0 ? header.size : framesync::UNKNOWN_SIZE;
+}
+
+// Xing / Info (LAME) header sits right after the side information
+static size_t xingPosition(bool isMono, bool isMpeg1) {
+  return 4 + (isMpeg1 ? (isMono ? 17 : 32) : (isMono ? 9 : 17));
+}
+
+bool MP3Container::isInfoFrame(const uint8_t* frame, size_t available,
+                               const FrameHeader& header) {
+  size_t xingPos = xingPosition(header.isMono, header.isMpeg1);
+  if (available >= xingPos + 4 && (memcmp(frame + xingPos, "Xing", 4) == 0 ||
+                                   memcmp(frame + xingPos, "Info", 4) == 0)) {
+    return true;
+  }
+  // VBRI (Fraunhofer) header, always 32 bytes after the frame header
+  return available >= 4 + 32 + 4 && memcmp(frame + 4 + 32, "VBRI", 4) == 0;
+}
+
+static uint32_t readBE(const uint8_t* data, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+MP3Container::MP3Container(std::istream& istr, const std::byte* headingBytes,
+                           size_t headingLen)
     : bell::AudioContainer(istr) {
+  writeHeading(headingBytes, headingLen);
+}
+
+MP3Container::MP3Container(bell::ByteStream& byteStream,
+                           const std::byte* headingBytes, size_t headingLen)
+    : bell::AudioContainer(byteStream) {
+  writeHeading(headingBytes, headingLen);
+}
+
+void MP3Container::writeHeading(const std::byte* headingBytes,
+                                size_t headingLen) {
   if (headingBytes != nullptr) {
-    memcpy(buffer.data(), headingBytes, 7);
-    bytesInBuffer = 7;
+    buffer.write(headingBytes, headingLen);
   }
 }
 
 bool MP3Container::fillBuffer() {
-  if (this->bytesInBuffer < MP3_MAX_FRAME_SIZE * 2) {
-    this->istr.read((char*)buffer.data() + bytesInBuffer,
-                    buffer.size() - bytesInBuffer);
-    this->bytesInBuffer += istr.gcount();
+  // Reads as much as fits, a chunk ends at the ring wrap point
+  while (buffer.size() < MP3_MAX_FRAME_SIZE * 2) {
+    size_t spanLen;
+    std::byte* span = buffer.writeSpan(spanLen);
+    size_t bytesRead = spanLen > 0 ? readBytes(span, spanLen) : 0;
+    if (bytesRead == 0) {
+      break;
+    }
+    buffer.commit(bytesRead);
   }
-  return this->bytesInBuffer >= MP3_MAX_FRAME_SIZE * 2;
+  return buffer.size() >= MP3_MAX_FRAME_SIZE * 2;
+}
+
+void MP3Container::consume(size_t len) {
+  len = std::min(len, buffer.size());
+  buffer.consume(len);
+  streamOffset += len;
 }
 
 void MP3Container::consumeBytes(uint32_t len) {
-  dataOffset += len;
+  consume(len);
 }
 
-std::byte* MP3Container::readSample(uint32_t& len) {
-  // Align data if previous read was offseted
-  if (dataOffset > 0 && bytesInBuffer > 0) {
-    size_t toConsume = std::min(dataOffset, bytesInBuffer);
-    memmove(buffer.data(), buffer.data() + toConsume,
-            buffer.size() - toConsume);
+bool MP3Container::skipTag() {
+  size_t available;
+  uint8_t* data = (uint8_t*)buffer.readSpan(available);
 
-    dataOffset -= toConsume;
-    bytesInBuffer -= toConsume;
+  // ID3v2 tags can hold cover art, frames of it would fool the sync search
+  if (streamOffset == 0 && available >= 10 && memcmp(data, "ID3", 3) == 0) {
+    tagBytesLeft = 10 + ((data[6] & 0x7F) << 21 | (data[7] & 0x7F) << 14 |
+                         (data[8] & 0x7F) << 7 | (data[9] & 0x7F));
+    if (data[5] & 0x10) {
+      // Footer present
+      tagBytesLeft += 10;
+    }
   }
 
-  if (!this->fillBuffer()) {
+  while (tagBytesLeft > 0) {
+    if (buffer.size() == 0) {
+      fillBuffer();
+      if (buffer.size() == 0) {
+        return false;
+      }
+    }
+
+    size_t toSkip = std::min(tagBytesLeft, buffer.size());
+    consume(toSkip);
+    tagBytesLeft -= toSkip;
+  }
+  return true;
+}
+
+std::byte* MP3Container::readSample(uint32_t& len) {
+  if (!this->fillBuffer() || !skipTag() || !this->fillBuffer()) {
     len = 0;
     return nullptr;
   }
 
-  int startOffset =
-      MP3FindSyncWord((uint8_t*)this->buffer.data(), bytesInBuffer);
+  size_t available;
+  std::byte* data = buffer.readSpan(available);
 
-  if (startOffset < 0) {
-    // Discard word
-    dataOffset = MP3_MAX_FRAME_SIZE;
-    return nullptr;
+  // The frame handed out again, or the one right after it, is trusted
+  bool inSync = (streamOffset == nextFrame && !seekEstimated) ||
+                streamOffset == frameStart;
+  if (!inSync || mp3FrameLength((uint8_t*)data, available) == 0) {
+    size_t offset;
+    bool found = framesync::findFrame(
+        (uint8_t*)data, available, 4, MP3_MAX_FRAME_SIZE, mp3FrameLength,
+        buffer.size() < MP3_MAX_FRAME_SIZE * 2, offset);
+    countResync(offset, found);
+    consume(offset);
+    if (!found) {
+      len = 0;
+      return nullptr;
+    }
+    data = buffer.readSpan(available);
+  }
+  frameStart = streamOffset;
+  seekEstimated = false;
+  len = available;
+
+  if (!countFrame((uint8_t*)data, available)) {
+    // The encoder delay doesn't include the Info frame, so it can't be
+    // decoded into a frame of silence
+    consume(nextFrame - streamOffset);
+    return readSample(len);
+  }
+  return data;
+}
+
+bool MP3Container::countFrame(const uint8_t* frame, size_t available) {
+  // readSample() hands out the same frame until the codec consumes it
+  if (streamOffset < nextFrame) {
+    return true;
+  }
+
+  FrameHeader header;
+  if (available < 4 || !parseFrameHeader(frame, header)) {
+    return true;
+  }
+  // Free format frames have no size in the header
+  nextFrame = streamOffset + std::max<uint32_t>(header.size, 1);
+
+  if (streamOffset == infoFrameOffset) {
+    return false;
   }
 
-  dataOffset += startOffset;
+  if (!firstFrameParsed) {
+    firstFrameParsed = true;
+    audioStart = streamOffset;
+    frameSampleRate = header.sampleRate;
+    samplesPerFrame = header.samples;
+    bitrate = header.bitrate;
+
+    if (parseSeekHeaders(frame, available, header.isMono, header.isMpeg1)) {
+      // Info frames carry no audio
+      infoFrameOffset = streamOffset;
+      return false;
+    }
+  }
 
-  len = bytesInBuffer - dataOffset;
+  if (positionExact) {
+    frameIndex.addFrame(streamOffset, getPositionMs());
+  }
+  samplesPlayed += header.samples;
+  return true;
+}
+
+bool MP3Container::parseSeekHeaders(const uint8_t* frame, size_t available,
+                                    bool isMono, bool isMpeg1) {
+  size_t xingPos = xingPosition(isMono, isMpeg1);
+  if (available >= xingPos + 8 && (memcmp(frame + xingPos, "Xing", 4) == 0 ||
+                                   memcmp(frame + xingPos, "Info", 4) == 0)) {
+    uint32_t flags = readBE(frame + xingPos + 4, 4);
+    // Offsets of the optional fields follow from the flags alone, whether
+    // or not the fields before them fit in what was read
+    size_t framesPos = xingPos + 8;
+    size_t bytesPos = framesPos + (flags & 0x01 ? 4 : 0);
+    size_t tocPos = bytesPos + (flags & 0x02 ? 4 : 0);
+    size_t qualityPos = tocPos + (flags & 0x04 ? 100 : 0);
+    size_t lamePos = qualityPos + (flags & 0x08 ? 4 : 0);
+
+    if ((flags & 0x01) && framesPos + 4 <= available) {
+      totalFrames = readBE(frame + framesPos, 4);
+    }
+    if ((flags & 0x02) && bytesPos + 4 <= available) {
+      totalBytes = readBE(frame + bytesPos, 4);
+    }
+    if ((flags & 0x04) && tocPos + 100 <= available) {
+      xingToc.assign(frame + tocPos, frame + tocPos + 100);
+    }
+
+    // LAME extension, the encoder version is followed by 12 bytes of
+    // settings and then 12 bits each of encoder delay and padding
+    const uint8_t* field = frame + lamePos;
+    if (lamePos + 24 <= available && (memcmp(field, "LAME", 4) == 0 ||
+                                      memcmp(field, "Lavc", 4) == 0 ||
+                                      memcmp(field, "Lavf", 4) == 0)) {
+      uint32_t delayPadding = readBE(field + 21, 3);
+      encoderDelay = delayPadding >> 12;
+      encoderPadding = delayPadding & 0xFFF;
+      hasLameTag = true;
+      parseLameGain(field);
+    }
+    return true;
+  }
+
+  // VBRI (Fraunhofer) header, always 32 bytes after the frame header
+  const uint8_t* vbri = frame + 4 + 32;
+  if (available >= 4 + 32 + 26 && memcmp(vbri, "VBRI", 4) == 0) {
+    totalBytes = readBE(vbri + 10, 4);
+    totalFrames = readBE(vbri + 14, 4);
+    uint32_t entries = readBE(vbri + 18, 2);
+    uint32_t scale = readBE(vbri + 20, 2);
+    uint32_t entrySize = readBE(vbri + 22, 2);
+    vbriFramesPerEntry = readBE(vbri + 24, 2);
+
+    const uint8_t* entry = vbri + 26;
+    if (entrySize >= 1 && entrySize <= 4 &&
+        entry + entries * entrySize <= frame + available) {
+      // Entries are segment lengths, keep them as offsets
+      uint32_t offset = 0;
+      vbriOffsets.reserve(entries + 1);
+      vbriOffsets.push_back(0);
+      for (uint32_t i = 0; i < entries; i++, entry += entrySize) {
+        offset += readBE(entry, entrySize) * scale;
+        vbriOffsets.push_back(offset);
+      }
+    }
+    return true;
+  }
+
+  return false;
+}
+
+void MP3Container::parseLameGain(const uint8_t* lame) {
+  // Peak as fixed point with 23 fractional bits, then the radio (track) and
+  // audiophile (album) gains: 3 bits name, 3 bits originator, a sign bit and
+  // 9 bits in 0.1 dB
+  float peak = readBE(lame + 11, 4) / (float)(1 << 23);
+  for (size_t i = 0; i < 2; i++) {
+    uint32_t field = readBE(lame + 15 + i * 2, 2);
+    uint32_t name = field >> 13;
+    float gain = (field & 0x1FF) / 10.0f * (field & 0x200 ? -1 : 1);
+    if (name == 1) {
+      replayGain.hasTrack = true;
+      replayGain.trackGain = gain;
+      replayGain.trackPeak = peak;
+    } else if (name == 2) {
+      replayGain.hasAlbum = true;
+      replayGain.albumGain = gain;
+    }
+  }
+}
+
+bool MP3Container::getReplayGain(ReplayGainInfo& info) {
+  if (!replayGain.hasTrack && !replayGain.hasAlbum) {
+    return false;
+  }
+  info = replayGain;
+  return true;
+}
+
+bool MP3Container::getGaplessInfo(GaplessInfo& info) {
+  if (!hasLameTag) {
+    return false;
+  }
+
+  // The synthesis filterbank delays the output by another 529 samples, which
+  // also eats that much of the padding
+  info.delay = encoderDelay + DECODER_DELAY;
+  info.padding =
+      encoderPadding > DECODER_DELAY ? encoderPadding - DECODER_DELAY : 0;
+  uint64_t encoded = (uint64_t)totalFrames * samplesPerFrame;
+  info.totalFrames = encoded > encoderDelay + encoderPadding
+                         ? encoded - encoderDelay - encoderPadding
+                         : 0;
+  return true;
+}
+
+uint32_t MP3Container::getPositionMs() {
+  if (frameSampleRate == 0) {
+    return 0;
+  }
+  return samplesPlayed * 1000 / frameSampleRate;
+}
+
+bool MP3Container::seekToTime(uint32_t timeMs) {
+  FrameIndex::Entry entry;
+  size_t offset;
+  uint32_t landedMs = timeMs;
+  bool exact = frameIndex.lookup(timeMs, entry);
+
+  if (exact) {
+    offset = entry.offset;
+    landedMs = entry.timeMs;
+  } else if (!firstFrameParsed || frameSampleRate == 0) {
+    return false;
+  } else if (xingToc.size() == 100 && totalFrames > 0 && totalBytes > 0) {
+    float durationMs =
+        (float)totalFrames * samplesPerFrame * 1000 / frameSampleRate;
+    float percent = std::clamp(timeMs * 100.0f / durationMs, 0.0f, 99.99f);
+    size_t i = (size_t)percent;
+    float from = xingToc[i];
+    float to = i < 99 ? xingToc[i + 1] : 256.0f;
+    float position = from + (to - from) * (percent - i);
+    offset = audioStart + (size_t)(position / 256.0f * totalBytes);
+  } else if (!vbriOffsets.empty() && vbriFramesPerEntry > 0) {
+    uint64_t frame =
+        (uint64_t)timeMs * frameSampleRate / 1000 / samplesPerFrame;
+    size_t i = std::min<size_t>(frame / vbriFramesPerEntry,
+                                vbriOffsets.size() - 1);
+    offset = audioStart + vbriOffsets[i];
+    landedMs = (uint64_t)i * vbriFramesPerEntry * samplesPerFrame * 1000 /
+               frameSampleRate;
+  } else if (bitrate > 0) {
+    offset = audioStart + (uint64_t)timeMs * bitrate / 8000;
+  } else {
+    return false;
+  }
+
+  if (!seekSource(offset)) {
+    return false;
+  }
 
-  return this->buffer.data() + dataOffset;
+  buffer.clear();
+  streamOffset = offset;
+  nextFrame = offset;
+  frameStart = SIZE_MAX;
+  // Estimated offsets land anywhere in a frame
+  seekEstimated = !exact;
+  tagBytesLeft = 0;
+  samplesPlayed = (uint64_t)landedMs * frameSampleRate / 1000;
+  // The index must only learn frames whose time is known for sure
+  positionExact = exact;
+  return true;
 }
 
 void MP3Container::parseSetupData() {
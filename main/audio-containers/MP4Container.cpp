@@ -0,0 +1,838 @@
+#include "MP4Container.h"
+
+#include <stdlib.h>   // for strtoull
+#include <string.h>   // for memcpy, memcmp
+#include <algorithm>  // for min, max
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "StreamInfo.h"  // for BitWidth, SampleRate
+
+using namespace bell;
+
+static constexpr uint32_t fourcc(const char* type) {
+  return (uint32_t)type[0] << 24 | (uint32_t)type[1] << 16 |
+         (uint32_t)type[2] << 8 | (uint32_t)type[3];
+}
+
+static uint32_t readBE32(const uint8_t* data) {
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+         (uint32_t)data[2] << 8 | data[3];
+}
+
+MP4Container::MP4Container(std::istream& istr, const std::byte* headingBytes,
+                           size_t headingLen)
+    : bell::AudioContainer(istr) {
+  init(headingBytes, headingLen);
+}
+
+MP4Container::MP4Container(bell::ByteStream& byteStream,
+                           const std::byte* headingBytes, size_t headingLen)
+    : bell::AudioContainer(byteStream) {
+  init(headingBytes, headingLen);
+}
+
+void MP4Container::init(const std::byte* headingBytes, size_t headingLen) {
+  if (headingBytes == nullptr) {
+    headingLen = 0;
+  }
+  readBuffer.resize(std::max(READ_BUFFER_SIZE, headingLen));
+  memcpy(readBuffer.data(), headingBytes, headingLen);
+  readLen = headingLen;
+
+  channels = 2;
+  sampleRate = bell::SampleRate::SR_44100;
+  bitWidth = bell::BitWidth::BW_16;
+}
+
+size_t MP4Container::readFully(uint8_t* dst, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    if (readPos == readLen) {
+      readPos = 0;
+      readLen = 0;
+
+      // Sample data is large, it bypasses the buffer
+      if (len - done >= READ_BUFFER_SIZE) {
+        size_t bytesRead = readBytes((std::byte*)dst + done, len - done);
+        if (bytesRead == 0) {
+          break;
+        }
+        done += bytesRead;
+        continue;
+      }
+
+      readLen = readBytes((std::byte*)readBuffer.data(), READ_BUFFER_SIZE);
+      if (readLen == 0) {
+        break;
+      }
+    }
+
+    size_t toCopy = std::min(len - done, readLen - readPos);
+    memcpy(dst + done, readBuffer.data() + readPos, toCopy);
+    readPos += toCopy;
+    done += toCopy;
+  }
+
+  streamOffset += done;
+  return done;
+}
+
+bool MP4Container::moveTo(uint64_t offset) {
+  if (offset >= streamOffset && offset - streamOffset <= readLen - readPos) {
+    readPos += offset - streamOffset;
+    streamOffset = offset;
+    return true;
+  }
+
+  if (offset < streamOffset || offset - streamOffset > SEEK_DISTANCE) {
+    // Ranged fetch, only the needed part is downloaded
+    if (seekSource(offset)) {
+      readPos = 0;
+      readLen = 0;
+      streamOffset = offset;
+      return true;
+    }
+    if (offset < streamOffset) {
+      return false;
+    }
+  }
+
+  uint8_t scratch[256];
+  while (streamOffset < offset) {
+    size_t toSkip = std::min<uint64_t>(sizeof(scratch), offset - streamOffset);
+    if (readFully(scratch, toSkip) < toSkip) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MP4Container::readBox(Box& box) {
+  box.start = streamOffset;
+  uint8_t header[8];
+  if (readFully(header, sizeof(header)) < sizeof(header)) {
+    return false;
+  }
+
+  uint64_t size = readBE32(header);
+  box.type = readBE32(header + 4);
+  if (size == 1) {
+    size = readU64();
+  }
+
+  if (size == 0) {
+    // Runs to the end of the file
+    box.end = UINT64_MAX;
+  } else {
+    box.end = box.start + size;
+  }
+  return box.end >= streamOffset;
+}
+
+uint8_t MP4Container::readU8() {
+  uint8_t value = 0;
+  readFully(&value, 1);
+  return value;
+}
+
+uint16_t MP4Container::readU16() {
+  uint8_t data[2] = {0};
+  readFully(data, 2);
+  return data[0] << 8 | data[1];
+}
+
+uint32_t MP4Container::readU32() {
+  uint8_t data[4] = {0};
+  readFully(data, 4);
+  return readBE32(data);
+}
+
+uint64_t MP4Container::readU64() {
+  uint64_t high = readU32();
+  return high << 32 | readU32();
+}
+
+bool MP4Container::parseHeaders() {
+  headersParsed = true;
+
+  Box box;
+  while (readBox(box)) {
+    if (box.type == fourcc("moov")) {
+      parseMoov(box);
+      moveTo(box.end);
+      moovParsed = true;
+      if (trackId == 0) {
+        BELL_LOG(error, "MP4Container", "No supported audio track");
+        return false;
+      }
+      if (!fragmented) {
+        // Samples can sit anywhere, readSample() moves to them
+        trackReady = true;
+        return true;
+      }
+    } else if (box.type == fourcc("sidx") && fragments.empty()) {
+      parseSidx(box);
+      moveTo(box.end);
+    } else if (box.type == fourcc("moof") && moovParsed) {
+      parseMoof(box);
+      moveTo(box.end);
+    } else if (box.type == fourcc("mdat") && !moovParsed) {
+      // moov comes last, fetch it from behind the media data
+      if (box.end == UINT64_MAX || !seekSource(box.end)) {
+        BELL_LOG(error, "MP4Container",
+                 "moov after mdat needs a seekable source");
+        return false;
+      }
+      readPos = 0;
+      readLen = 0;
+      streamOffset = box.end;
+    } else if (box.type == fourcc("mdat") && table.sampleCount() > 0) {
+      // Samples of the preceding moof
+      nextBoxOffset = box.end;
+      trackReady = true;
+      return true;
+    } else if (!moveTo(box.end)) {
+      break;
+    }
+  }
+
+  BELL_LOG(error, "MP4Container", "No playable samples found");
+  return false;
+}
+
+void MP4Container::parseMoov(const Box& moov) {
+  Box box;
+  while (streamOffset < moov.end && readBox(box)) {
+    if (box.type == fourcc("mvhd")) {
+      uint8_t version = readU8();
+      moveTo(streamOffset + 3 + (version == 1 ? 16 : 8));
+      movieTimescale = readU32();
+    } else if (box.type == fourcc("trak") && trackId == 0) {
+      parseTrak(box);
+    } else if (box.type == fourcc("udta")) {
+      parseUdta(box);
+    } else if (box.type == fourcc("mvex")) {
+      fragmented = true;
+      Box trex;
+      while (streamOffset < box.end && readBox(trex)) {
+        if (trex.type == fourcc("trex")) {
+          readU32();  // version, flags
+          uint32_t id = readU32();
+          readU32();  // sample description index
+          uint32_t duration = readU32();
+          uint32_t size = readU32();
+          if (id == trackId) {
+            defaultDuration = duration;
+            defaultSize = size;
+          }
+        }
+        moveTo(trex.end);
+      }
+    }
+    moveTo(box.end);
+  }
+}
+
+bool MP4Container::parseTrak(const Box& trak) {
+  uint32_t id = 0;
+  uint32_t scale = 0;
+  int64_t mediaTime = -1;
+  uint64_t segmentDuration = 0;
+  bool isSound = false;
+  bool hasSamples = false;
+
+  table.clear();
+  codec = AudioCodec::UNKNOWN;
+
+  // trak / mdia / minf / stbl, with the headers on the way
+  std::vector<Box> parents = {trak};
+  Box box;
+  while (!parents.empty()) {
+    if (streamOffset >= parents.back().end || !readBox(box)) {
+      moveTo(parents.back().end);
+      parents.pop_back();
+      continue;
+    }
+
+    uint32_t type = box.type;
+    if (type == fourcc("mdia") || type == fourcc("minf") ||
+        type == fourcc("edts")) {
+      parents.push_back(box);
+      continue;
+    }
+
+    if (type == fourcc("tkhd")) {
+      uint8_t version = readU8();
+      moveTo(streamOffset + 3 + (version == 1 ? 16 : 8));
+      id = readU32();
+    } else if (type == fourcc("mdhd")) {
+      uint8_t version = readU8();
+      moveTo(streamOffset + 3 + (version == 1 ? 16 : 8));
+      scale = readU32();
+    } else if (type == fourcc("hdlr")) {
+      readU32();  // version, flags
+      readU32();  // pre_defined
+      isSound = readU32() == fourcc("soun");
+    } else if (type == fourcc("elst")) {
+      uint8_t version = readU8();
+      moveTo(streamOffset + 3);
+      uint32_t entries = readU32();
+      // Leading empty edits only shift the presentation
+      for (uint32_t i = 0; i < entries && streamOffset < box.end; i++) {
+        uint64_t duration = version == 1 ? readU64() : readU32();
+        int64_t time = version == 1 ? (int64_t)readU64() : (int32_t)readU32();
+        readU32();  // media rate
+        if (time >= 0) {
+          mediaTime = time;
+          segmentDuration = duration;
+          break;
+        }
+      }
+    } else if (type == fourcc("stbl") && isSound) {
+      hasSamples = parseStbl(box);
+    }
+    moveTo(box.end);
+  }
+
+  if (!isSound || !hasSamples || codec == AudioCodec::UNKNOWN) {
+    table.clear();
+    codec = AudioCodec::UNKNOWN;
+    setupData.clear();
+    return false;
+  }
+
+  trackId = id;
+  timescale = scale;
+  editMediaTime = mediaTime;
+  editDuration = segmentDuration;
+  return true;
+}
+
+void MP4Container::parseUdta(const Box& udta) {
+  // udta / meta / ilst / ---- holds iTunes' gapless info
+  std::vector<Box> parents = {udta};
+  bool isSmpb = false;
+  Box box;
+  while (!parents.empty()) {
+    if (streamOffset >= parents.back().end || !readBox(box)) {
+      moveTo(parents.back().end);
+      parents.pop_back();
+      continue;
+    }
+
+    uint32_t type = box.type;
+    if (type == fourcc("meta")) {
+      readU32();  // version, flags
+      parents.push_back(box);
+      continue;
+    }
+    if (type == fourcc("ilst") || type == fourcc("----")) {
+      isSmpb = false;
+      parents.push_back(box);
+      continue;
+    }
+
+    if (type == fourcc("name") && box.end - streamOffset == 12) {
+      char name[12];
+      readFully((uint8_t*)name, sizeof(name));
+      isSmpb = memcmp(name + 4, "iTunSMPB", 8) == 0;
+    } else if (type == fourcc("data") && isSmpb &&
+               box.end - streamOffset > 8 && box.end - streamOffset < 256) {
+      readU32();  // type
+      readU32();  // locale
+      std::string text(box.end - streamOffset, '\0');
+      readFully((uint8_t*)text.data(), text.size());
+      parseSmpb(text);
+    }
+    moveTo(box.end);
+  }
+}
+
+void MP4Container::parseSmpb(const std::string& text) {
+  // " 00000000 00000840 000001CA 00000000000D3A76 ...", hex fields of a
+  // reserved word, delay, padding and the track length
+  uint64_t fields[4] = {0};
+  const char* pos = text.c_str();
+  for (int i = 0; i < 4; i++) {
+    char* next = nullptr;
+    fields[i] = strtoull(pos, &next, 16);
+    if (next == pos) {
+      return;
+    }
+    pos = next;
+  }
+
+  smpbDelay = fields[1];
+  smpbPadding = fields[2];
+  smpbTotal = fields[3];
+  hasSmpb = true;
+}
+
+bool MP4Container::parseStbl(const Box& stbl) {
+  Box box;
+  while (streamOffset < stbl.end && readBox(box)) {
+    uint32_t type = box.type;
+    if (type == fourcc("stsd")) {
+      if (!parseStsd(box)) {
+        // Not a codec we play, don't bother with its tables
+        return false;
+      }
+    } else if (type == fourcc("stsz")) {
+      readU32();  // version, flags
+      uint32_t size = readU32();
+      uint32_t count = readU32();
+      if (size > 0) {
+        table.setConstantSize(size, count);
+      } else {
+        for (uint32_t i = 0; i < count && streamOffset < box.end; i++) {
+          table.addSize(readU32());
+        }
+      }
+    } else if (type == fourcc("stz2")) {
+      readU32();  // version, flags
+      uint8_t fieldSize = readU32() & 0xFF;
+      uint32_t count = readU32();
+      for (uint32_t i = 0; i < count && streamOffset < box.end; i++) {
+        if (fieldSize == 16) {
+          table.addSize(readU16());
+        } else if (fieldSize == 8) {
+          table.addSize(readU8());
+        } else {
+          uint8_t pair = readU8();
+          table.addSize(pair >> 4);
+          if (++i < count) {
+            table.addSize(pair & 0x0F);
+          }
+        }
+      }
+    } else if (type == fourcc("stts")) {
+      readU32();  // version, flags
+      uint32_t entries = readU32();
+      for (uint32_t i = 0; i < entries && streamOffset < box.end; i++) {
+        uint32_t count = readU32();
+        table.addDurations(count, readU32());
+      }
+    } else if (type == fourcc("stsc")) {
+      readU32();  // version, flags
+      uint32_t entries = readU32();
+      for (uint32_t i = 0; i < entries && streamOffset < box.end; i++) {
+        uint32_t firstChunk = readU32();
+        uint32_t samplesPerChunk = readU32();
+        readU32();  // sample description index
+        table.addChunkRun(std::max<uint32_t>(firstChunk, 1) - 1,
+                          samplesPerChunk);
+      }
+    } else if (type == fourcc("stco") || type == fourcc("co64")) {
+      readU32();  // version, flags
+      uint32_t entries = readU32();
+      bool wide = type == fourcc("co64");
+      for (uint32_t i = 0; i < entries && streamOffset < box.end; i++) {
+        table.addChunkOffset(wide ? readU64() : readU32());
+      }
+    }
+    moveTo(box.end);
+  }
+
+  return codec != AudioCodec::UNKNOWN;
+}
+
+bool MP4Container::parseStsd(const Box& stsd) {
+  readU32();  // version, flags
+  uint32_t entries = readU32();
+  Box entry;
+  if (entries == 0 || !readBox(entry)) {
+    return false;
+  }
+
+  if (entry.type != fourcc("mp4a") && entry.type != fourcc("alac")) {
+    moveTo(stsd.end);
+    return false;
+  }
+
+  // AudioSampleEntry
+  moveTo(streamOffset + 8);
+  uint16_t version = readU16();
+  moveTo(streamOffset + 6);
+  uint16_t channelCount = readU16();
+  uint16_t sampleSize = readU16();
+  moveTo(streamOffset + 4);
+  uint32_t rate = readU32() >> 16;
+  if (version == 1) {
+    moveTo(streamOffset + 16);
+  } else if (version == 2) {
+    moveTo(streamOffset + 36);
+  }
+
+  channels = channelCount;
+  sampleRate = static_cast<bell::SampleRate>(rate);
+  bitWidth = sampleSize > 16 ? bell::BitWidth::BW_24 : bell::BitWidth::BW_16;
+
+  parseSampleEntryChildren(entry);
+  moveTo(stsd.end);
+  return codec != AudioCodec::UNKNOWN;
+}
+
+void MP4Container::parseSampleEntryChildren(const Box& parent) {
+  Box box;
+  while (streamOffset < parent.end && readBox(box)) {
+    if (box.type == fourcc("esds")) {
+      parseEsds(box);
+    } else if (box.type == fourcc("wave")) {
+      // QuickTime wraps the esds
+      parseSampleEntryChildren(box);
+    } else if (box.type == fourcc("alac") && box.end - streamOffset >= 28) {
+      readU32();  // version, flags
+      setupData.resize(24);
+      readFully(setupData.data(), setupData.size());
+
+      // ALACSpecificConfig
+      bitWidth = setupData[5] > 16 ? bell::BitWidth::BW_24
+                                   : bell::BitWidth::BW_16;
+      channels = setupData[9];
+      sampleRate = static_cast<bell::SampleRate>(readBE32(&setupData[20]));
+      codec = AudioCodec::ALAC;
+    }
+    moveTo(box.end);
+  }
+}
+
+bool MP4Container::parseEsds(const Box& esds) {
+  readU32();  // version, flags
+
+  auto readDescriptor = [this](uint32_t& len) {
+    uint8_t tag = readU8();
+    len = 0;
+    for (int i = 0; i < 4; i++) {
+      uint8_t byte = readU8();
+      len = (len << 7) | (byte & 0x7F);
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    return tag;
+  };
+
+  uint32_t len;
+  if (readDescriptor(len) != 0x03) {
+    return false;
+  }
+  readU16();  // ES_ID
+  uint8_t flags = readU8();
+  if (flags & 0x80) {
+    readU16();
+  }
+  if (flags & 0x40) {
+    moveTo(streamOffset + readU8());
+  }
+  if (flags & 0x20) {
+    readU16();
+  }
+
+  if (readDescriptor(len) != 0x04) {
+    return false;
+  }
+  // MPEG-4 audio, or one of the MPEG-2 AAC profiles
+  uint8_t objectType = readU8();
+  moveTo(streamOffset + 12);
+  if (objectType != 0x40 && (objectType < 0x66 || objectType > 0x68)) {
+    return false;
+  }
+
+  // AudioSpecificConfig
+  if (readDescriptor(len) != 0x05 || len == 0 || len > 64) {
+    return false;
+  }
+  setupData.resize(len);
+  readFully(setupData.data(), len);
+  codec = AudioCodec::AAC;
+  return true;
+}
+
+void MP4Container::parseSidx(const Box& sidx) {
+  uint8_t version = readU8();
+  moveTo(streamOffset + 3);
+  readU32();  // reference ID
+  fragmentsTimescale = readU32();
+  uint64_t firstOffset;
+  if (version == 0) {
+    fragmentsTime = readU32();
+    firstOffset = readU32();
+  } else {
+    fragmentsTime = readU64();
+    firstOffset = readU64();
+  }
+  readU16();  // reserved
+  uint16_t count = readU16();
+
+  fragmentsStart = sidx.end + firstOffset;
+  fragments.reserve(count);
+  for (uint16_t i = 0; i < count && streamOffset < sidx.end; i++) {
+    uint32_t size = readU32() & 0x7FFFFFFF;
+    uint32_t duration = readU32();
+    readU32();  // SAP
+    fragments.push_back({size, duration});
+  }
+}
+
+void MP4Container::parseMoof(const Box& moof) {
+  // Fragments without tfdt follow the previous one
+  uint64_t nextBase = baseTime + table.duration();
+  bool hasTfdt = false;
+  table.clear();
+
+  uint64_t nextDataOffset = 0;
+  Box box;
+  while (streamOffset < moof.end && readBox(box)) {
+    if (box.type == fourcc("traf")) {
+      uint64_t previous = baseTime;
+      baseTime = UINT64_MAX;
+      parseTraf(box, moof.start, nextDataOffset);
+      if (baseTime == UINT64_MAX) {
+        baseTime = previous;
+      } else {
+        hasTfdt = true;
+      }
+    }
+    moveTo(box.end);
+  }
+
+  if (!hasTfdt) {
+    baseTime = nextBase;
+  }
+}
+
+void MP4Container::parseTraf(const Box& traf, uint64_t moofStart,
+                             uint64_t& nextDataOffset) {
+  uint32_t duration = defaultDuration;
+  uint32_t size = defaultSize;
+  uint64_t base = moofStart;
+  bool isTrack = false;
+
+  Box box;
+  while (streamOffset < traf.end && readBox(box)) {
+    if (box.type == fourcc("tfhd")) {
+      uint32_t flags = readU32() & 0xFFFFFF;
+      isTrack = readU32() == trackId;
+      if (flags & 0x01) {
+        base = readU64();
+      }
+      if (flags & 0x02) {
+        readU32();  // sample description index
+      }
+      if (flags & 0x08) {
+        duration = readU32();
+      }
+      if (flags & 0x10) {
+        size = readU32();
+      }
+    } else if (box.type == fourcc("tfdt") && isTrack) {
+      uint8_t version = readU8();
+      moveTo(streamOffset + 3);
+      baseTime = version == 1 ? readU64() : readU32();
+    } else if (box.type == fourcc("trun") && isTrack) {
+      uint32_t flags = readU32() & 0xFFFFFF;
+      uint32_t count = readU32();
+      uint64_t offset = nextDataOffset > 0 ? nextDataOffset : base;
+      if (flags & 0x01) {
+        offset = base + (int32_t)readU32();
+      }
+      if (flags & 0x04) {
+        readU32();  // first sample flags
+      }
+
+      table.addChunkRun(table.chunkCount(), count);
+      table.addChunkOffset(offset);
+      for (uint32_t i = 0; i < count && streamOffset < box.end; i++) {
+        uint32_t sampleDuration = (flags & 0x100) ? readU32() : duration;
+        uint32_t sampleSize = (flags & 0x200) ? readU32() : size;
+        if (flags & 0x400) {
+          readU32();  // sample flags
+        }
+        if (flags & 0x800) {
+          readU32();  // composition time offset
+        }
+        table.addSize(sampleSize);
+        table.addDurations(1, sampleDuration);
+        offset += sampleSize;
+      }
+      nextDataOffset = offset;
+    }
+    moveTo(box.end);
+  }
+}
+
+bool MP4Container::nextFragment() {
+  if (!moveTo(nextBoxOffset)) {
+    return false;
+  }
+
+  Box box;
+  while (readBox(box)) {
+    if (box.type == fourcc("moof")) {
+      parseMoof(box);
+    } else if (box.type == fourcc("mdat") && table.sampleCount() > 0) {
+      nextBoxOffset = box.end;
+      return true;
+    }
+    if (!moveTo(box.end)) {
+      break;
+    }
+  }
+  return false;
+}
+
+void MP4Container::parseSetupData() {
+  if (!headersParsed) {
+    parseHeaders();
+  }
+}
+
+AudioCodec MP4Container::getCodec() {
+  if (!headersParsed) {
+    parseHeaders();
+  }
+  return codec;
+}
+
+uint8_t* MP4Container::getSetupData(uint32_t& len, AudioCodec codec) {
+  if (codec != getCodec() || setupData.empty()) {
+    len = 0;
+    return nullptr;
+  }
+
+  len = setupData.size();
+  return setupData.data();
+}
+
+std::byte* MP4Container::readSample(uint32_t& len) {
+  len = 0;
+  if (!headersParsed) {
+    parseHeaders();
+  }
+  if (!trackReady) {
+    return nullptr;
+  }
+
+  while (!samplePending) {
+    if (table.next(sample)) {
+      samplePending = true;
+      sampleLoaded = false;
+    } else if (!fragmented || !nextFragment()) {
+      return nullptr;
+    }
+  }
+
+  if (!sampleLoaded) {
+    if (sample.size > MAX_SAMPLE_SIZE) {
+      // A corrupt stsz would otherwise have us allocate whatever it says
+      BELL_LOG(error, "MP4Container", "Sample of %u bytes, giving up",
+               (unsigned)sample.size);
+      samplePending = false;
+      return nullptr;
+    }
+    if (!moveTo(sample.offset)) {
+      return nullptr;
+    }
+    sampleBuffer.resize(sample.size);
+    if (readFully(sampleBuffer.data(), sample.size) < sample.size) {
+      return nullptr;
+    }
+    sampleLoaded = true;
+  }
+
+  len = sample.size;
+  return (std::byte*)sampleBuffer.data();
+}
+
+void MP4Container::consumeBytes(uint32_t len) {
+  // Samples can't be split, a codec failing on one moves on to the next
+  samplePending = false;
+}
+
+bool MP4Container::getGaplessInfo(GaplessInfo& info) {
+  if (!headersParsed) {
+    parseHeaders();
+  }
+
+  uint32_t rate = static_cast<uint32_t>(sampleRate);
+  // An edit list that skips nothing defers to iTunSMPB, if both are present
+  bool useEdit = editMediaTime > 0 || (editMediaTime == 0 && !hasSmpb);
+  if (useEdit && timescale > 0) {
+    info.delay = editMediaTime * rate / timescale;
+    info.padding = 0;
+    info.totalFrames =
+        movieTimescale > 0 ? editDuration * rate / movieTimescale : 0;
+    return true;
+  }
+
+  if (hasSmpb) {
+    info.delay = smpbDelay;
+    info.padding = smpbPadding;
+    info.totalFrames = smpbTotal;
+    return true;
+  }
+  return false;
+}
+
+uint32_t MP4Container::getPositionMs() {
+  if (timescale == 0) {
+    return 0;
+  }
+  uint64_t time = samplePending ? sample.time : table.currentTime();
+  return (baseTime + time) * 1000 / timescale;
+}
+
+bool MP4Container::seekToTime(uint32_t timeMs) {
+  if (!trackReady || timescale == 0) {
+    return false;
+  }
+
+  uint64_t target = (uint64_t)timeMs * timescale / 1000;
+  if (!fragmented) {
+    if (!table.seekToTime(target)) {
+      return false;
+    }
+    samplePending = false;
+    return true;
+  }
+
+  // Within the current fragment
+  if (target >= baseTime && target < baseTime + table.duration()) {
+    table.seekToTime(target - baseTime);
+    samplePending = false;
+    return true;
+  }
+
+  if (fragments.empty() || fragmentsTimescale == 0) {
+    return false;
+  }
+
+  uint64_t fragmentTarget = (uint64_t)timeMs * fragmentsTimescale / 1000;
+  uint64_t offset = fragmentsStart;
+  uint64_t time = fragmentsTime;
+  size_t i = 0;
+  for (; i < fragments.size(); i++) {
+    if (fragmentTarget < time + fragments[i].duration) {
+      break;
+    }
+    offset += fragments[i].size;
+    time += fragments[i].duration;
+  }
+  if (i == fragments.size()) {
+    return false;
+  }
+
+  // tfdt of the fragment overrides this, if present
+  baseTime = time * timescale / fragmentsTimescale;
+  table.clear();
+  samplePending = false;
+  nextBoxOffset = offset;
+  if (!nextFragment()) {
+    return false;
+  }
+
+  if (target > baseTime) {
+    table.seekToTime(target - baseTime);
+  }
+  return true;
+}
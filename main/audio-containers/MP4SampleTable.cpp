@@ -0,0 +1,229 @@
+#include "MP4SampleTable.h"
+
+using namespace bell;
+
+void MP4SampleTable::clear() {
+  count = 0;
+  constantSize = 0;
+  lastSize = 0;
+  sizeDeltas.clear();
+  checkpoints.clear();
+  durations.clear();
+  chunkRuns.clear();
+  chunkOffsets.clear();
+  cursor = Cursor();
+}
+
+void MP4SampleTable::setConstantSize(uint32_t size, uint32_t count) {
+  constantSize = size;
+  this->count = count;
+  cursor.size = size;
+}
+
+void MP4SampleTable::addSize(uint32_t size) {
+  if (count % CHECKPOINT_INTERVAL == 0) {
+    checkpoints.push_back({(uint32_t)sizeDeltas.size(), size});
+  } else {
+    int32_t delta = (int32_t)(size - lastSize);
+    uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    while (zigzag >= 0x80) {
+      sizeDeltas.push_back((zigzag & 0x7F) | 0x80);
+      zigzag >>= 7;
+    }
+    sizeDeltas.push_back(zigzag);
+  }
+
+  if (count == 0) {
+    cursor.size = size;
+  }
+  lastSize = size;
+  count++;
+}
+
+void MP4SampleTable::addDurations(uint32_t count, uint32_t delta) {
+  if (count == 0) {
+    return;
+  }
+  if (!durations.empty() && durations.back().value == delta) {
+    durations.back().count += count;
+  } else {
+    durations.push_back({count, delta});
+  }
+}
+
+void MP4SampleTable::addChunkRun(uint32_t firstChunk,
+                                 uint32_t samplesPerChunk) {
+  if (!chunkRuns.empty() && chunkRuns.back().count == samplesPerChunk) {
+    return;
+  }
+  chunkRuns.push_back({samplesPerChunk, firstChunk});
+}
+
+void MP4SampleTable::addChunkOffset(uint64_t offset) {
+  chunkOffsets.push_back(offset);
+}
+
+uint64_t MP4SampleTable::duration() const {
+  uint64_t total = 0;
+  for (auto& run : durations) {
+    total += (uint64_t)run.count * run.value;
+  }
+  return total;
+}
+
+uint32_t MP4SampleTable::samplesPerChunk(uint32_t run) const {
+  return run < chunkRuns.size() ? chunkRuns[run].count : 0;
+}
+
+uint32_t MP4SampleTable::runEnd(uint32_t run) const {
+  return run + 1 < chunkRuns.size() ? chunkRuns[run + 1].value
+                                    : chunkOffsets.size();
+}
+
+void MP4SampleTable::loadSize(uint32_t sample) {
+  cursor.sample = sample;
+  if (constantSize > 0) {
+    cursor.size = constantSize;
+    return;
+  }
+
+  // Walk forward from the closest checkpoint
+  auto& checkpoint = checkpoints[sample / CHECKPOINT_INTERVAL];
+  cursor.size = checkpoint.size;
+  cursor.bytePos = checkpoint.bytePos;
+  for (uint32_t i = sample - sample % CHECKPOINT_INTERVAL; i < sample; i++) {
+    cursor.sample = i;
+    advanceSize();
+  }
+  cursor.sample = sample;
+}
+
+void MP4SampleTable::advanceSize() {
+  uint32_t nextSample = cursor.sample + 1;
+  if (constantSize > 0 || nextSample >= count) {
+    return;
+  }
+
+  if (nextSample % CHECKPOINT_INTERVAL == 0) {
+    auto& checkpoint = checkpoints[nextSample / CHECKPOINT_INTERVAL];
+    cursor.size = checkpoint.size;
+    cursor.bytePos = checkpoint.bytePos;
+    return;
+  }
+
+  uint32_t zigzag = 0;
+  for (int shift = 0; cursor.bytePos < sizeDeltas.size(); shift += 7) {
+    uint8_t byte = sizeDeltas[cursor.bytePos++];
+    zigzag |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+  cursor.size += delta;
+}
+
+bool MP4SampleTable::next(Sample& sample) {
+  if (cursor.sample >= count || cursor.chunk >= chunkOffsets.size()) {
+    return false;
+  }
+
+  sample.offset = chunkOffsets[cursor.chunk] + cursor.offsetInChunk;
+  sample.size = cursor.size;
+  sample.time = cursor.time;
+  sample.duration =
+      cursor.durationRun < durations.size()
+          ? durations[cursor.durationRun].value
+          : 0;
+
+  // Duration
+  cursor.time += sample.duration;
+  if (cursor.durationRun < durations.size() &&
+      ++cursor.inDurationRun >= durations[cursor.durationRun].count) {
+    cursor.durationRun++;
+    cursor.inDurationRun = 0;
+  }
+
+  // Chunk
+  cursor.offsetInChunk += sample.size;
+  if (++cursor.inChunk >= samplesPerChunk(cursor.chunkRun)) {
+    cursor.chunk++;
+    cursor.inChunk = 0;
+    cursor.offsetInChunk = 0;
+    if (cursor.chunk >= runEnd(cursor.chunkRun)) {
+      cursor.chunkRun++;
+    }
+  }
+
+  // Size
+  advanceSize();
+  cursor.sample++;
+  return true;
+}
+
+bool MP4SampleTable::seekToSample(uint32_t index) {
+  if (index >= count) {
+    return false;
+  }
+
+  Cursor target;
+
+  // Chunk holding the sample
+  uint32_t firstSample = 0;
+  for (uint32_t run = 0; run < chunkRuns.size(); run++) {
+    uint32_t perChunk = samplesPerChunk(run);
+    uint32_t chunks = runEnd(run) - chunkRuns[run].value;
+    if (perChunk > 0 && index < firstSample + chunks * perChunk) {
+      target.chunkRun = run;
+      target.chunk = chunkRuns[run].value + (index - firstSample) / perChunk;
+      target.inChunk = (index - firstSample) % perChunk;
+      break;
+    }
+    firstSample += chunks * perChunk;
+    if (run + 1 == chunkRuns.size()) {
+      return false;
+    }
+  }
+
+  // Sizes of the samples before it in its chunk
+  cursor = target;
+  loadSize(index - target.inChunk);
+  for (uint32_t i = 0; i < target.inChunk; i++) {
+    cursor.offsetInChunk += cursor.size;
+    advanceSize();
+    cursor.sample++;
+  }
+
+  // Start time
+  uint32_t remaining = index;
+  for (uint32_t run = 0; run < durations.size(); run++) {
+    if (remaining < durations[run].count) {
+      cursor.durationRun = run;
+      cursor.inDurationRun = remaining;
+      cursor.time += (uint64_t)remaining * durations[run].value;
+      remaining = 0;
+      break;
+    }
+    cursor.time += (uint64_t)durations[run].count * durations[run].value;
+    remaining -= durations[run].count;
+  }
+  if (remaining > 0) {
+    cursor.durationRun = durations.size();
+  }
+  return true;
+}
+
+bool MP4SampleTable::seekToTime(uint64_t time) {
+  uint64_t runStart = 0;
+  uint32_t index = 0;
+  for (auto& run : durations) {
+    uint64_t runLength = (uint64_t)run.count * run.value;
+    if (time < runStart + runLength) {
+      index += run.value > 0 ? (time - runStart) / run.value : 0;
+      return seekToSample(index);
+    }
+    runStart += runLength;
+    index += run.count;
+  }
+  return false;
+}
@@ -0,0 +1,472 @@
+#include "OggContainer.h"
+
+#include <string.h>   // for memcmp
+#include <algorithm>  // for min, max
+#include <array>      // for array
+
+#include "BellLogger.h"     // for BELL_LOG
+#include "StreamInfo.h"     // for BitWidth, BitWidth::BW_16, SampleRate
+#include "VorbisComment.h"  // for parseReplayGain
+
+using namespace bell;
+
+// Pages are skipped while resyncing for at most this many bytes
+#define OGG_MAX_RESYNC (256 * 1024)
+
+static uint64_t readLE(const uint8_t* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = bytes; i > 0; i--) {
+    value = (value << 8) | data[i - 1];
+  }
+  return value;
+}
+
+// CRC-32 with polynomial 0x04c11db7, unreflected, as used by Ogg
+static uint32_t pageCrc(const uint8_t* data, size_t len) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> crcTable;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int bit = 0; bit < 8; bit++) {
+        r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+      }
+      crcTable[i] = r;
+    }
+    return crcTable;
+  }();
+
+  uint32_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    // Checksum field counts as zero
+    uint8_t byte = (i >= 22 && i < 26) ? 0 : data[i];
+    crc = (crc << 8) ^ table[((crc >> 24) ^ byte) & 0xFF];
+  }
+  return crc;
+}
+
+OggContainer::OggContainer(std::istream& istr, const std::byte* headingBytes,
+                           size_t headingLen)
+    : bell::AudioContainer(istr) {
+  init(headingBytes, headingLen);
+}
+
+OggContainer::OggContainer(bell::ByteStream& byteStream,
+                           const std::byte* headingBytes, size_t headingLen)
+    : bell::AudioContainer(byteStream) {
+  init(headingBytes, headingLen);
+}
+
+void OggContainer::init(const std::byte* headingBytes, size_t headingLen) {
+  if (headingBytes != nullptr) {
+    heading.assign(headingBytes, headingBytes + headingLen);
+  }
+  channels = 2;
+  sampleRate = bell::SampleRate::SR_48000;
+  bitWidth = bell::BitWidth::BW_16;
+}
+
+size_t OggContainer::readFully(uint8_t* dst, size_t len) {
+  size_t done = std::min(len, heading.size() - headingPos);
+  if (done > 0) {
+    memcpy(dst, heading.data() + headingPos, done);
+    headingPos += done;
+  }
+
+  while (done < len) {
+    size_t bytesRead = readBytes((std::byte*)dst + done, len - done);
+    if (bytesRead == 0) {
+      break;
+    }
+    done += bytesRead;
+  }
+
+  streamOffset += done;
+  return done;
+}
+
+bool OggContainer::resync() {
+  uint8_t window[4] = {0};
+  uint8_t byte;
+  for (size_t scanned = 0; scanned < OGG_MAX_RESYNC; scanned++) {
+    if (readFully(&byte, 1) != 1) {
+      return false;
+    }
+
+    memmove(window, window + 1, 3);
+    window[3] = byte;
+    if (memcmp(window, "OggS", 4) == 0) {
+      // Hand the capture pattern back to the next page read
+      heading.erase(heading.begin(), heading.begin() + headingPos);
+      heading.insert(heading.begin(), (std::byte*)window,
+                     (std::byte*)window + 4);
+      headingPos = 0;
+      streamOffset -= 4;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool OggContainer::rescan() {
+  // What was taken for a page may hide the next one, past its first byte
+  heading.erase(heading.begin(), heading.begin() + headingPos);
+  heading.insert(heading.begin(), (std::byte*)page.data() + 1,
+                 (std::byte*)page.data() + page.size());
+  headingPos = 0;
+  streamOffset -= page.size() - 1;
+  return resync();
+}
+
+bool OggContainer::readPage() {
+  while (true) {
+    size_t pageStart = streamOffset;
+    page.resize(HEADER_SIZE);
+    if (readFully(page.data(), HEADER_SIZE) < HEADER_SIZE) {
+      return false;
+    }
+
+    if (memcmp(page.data(), "OggS", 4) != 0 || page[4] != 0) {
+      // Lost sync, or landed mid-page after a seek
+      if (!rescan()) {
+        return false;
+      }
+      continue;
+    }
+
+    uint8_t segments = page[26];
+    page.resize(HEADER_SIZE + segments);
+    if (readFully(page.data() + HEADER_SIZE, segments) < segments) {
+      return false;
+    }
+
+    size_t bodyLen = 0;
+    for (size_t i = 0; i < segments; i++) {
+      bodyLen += page[HEADER_SIZE + i];
+    }
+    page.resize(HEADER_SIZE + segments + bodyLen);
+    if (readFully(page.data() + HEADER_SIZE + segments, bodyLen) < bodyLen) {
+      return false;
+    }
+
+    if (pageCrc(page.data(), page.size()) != readLE(page.data() + 22, 4)) {
+      BELL_LOG(error, "OggContainer", "Dropping corrupted page");
+      gapPending = headersParsed;
+      if (!rescan()) {
+        return false;
+      }
+      continue;
+    }
+
+    uint32_t pageSerial = readLE(page.data() + 14, 4);
+    if (!serialSet) {
+      serial = pageSerial;
+      serialSet = true;
+    } else if (pageSerial != serial) {
+      continue;
+    }
+
+    int64_t sequence = readLE(page.data() + 18, 4);
+    if (nextSequence >= 0 && sequence != nextSequence && headersParsed) {
+      gapPending = true;
+    }
+    nextSequence = sequence + 1;
+
+    uint8_t flags = page[5];
+    if (continuing && !(flags & 0x01)) {
+      // The rest of the packet got lost
+      packetBuffer.clear();
+      continuing = false;
+      gapPending = true;
+    }
+    dropContinued = (flags & 0x01) && !continuing;
+
+    if (pageGranule >= 0) {
+      startGranule = pageGranule;
+    }
+    pageGranule = (int64_t)readLE(page.data() + 6, 8);
+    if ((flags & 0x04) && pageGranule >= 0) {
+      // Last page, its granule cuts the padding of the final packet
+      endGranule = pageGranule;
+    }
+
+    segmentCount = segments;
+    segmentIndex = 0;
+    bodyPos = HEADER_SIZE + segments;
+
+    if (!positionExact) {
+      // First page after an estimated seek, only where it ends is known
+      if (pageGranule >= 0) {
+        positionExact = true;
+      }
+      segmentIndex = segmentCount;
+      packetBuffer.clear();
+      continuing = false;
+      dropContinued = false;
+      continue;
+    }
+
+    if (headersParsed && startGranule > 0) {
+      pageIndex.addFrame(pageStart, granuleToMs(startGranule));
+    }
+    return true;
+  }
+}
+
+bool OggContainer::nextPacket() {
+  if (!continuing) {
+    packetBuffer.clear();
+  }
+
+  while (true) {
+    if (segmentIndex >= segmentCount) {
+      if (!readPage()) {
+        return false;
+      }
+      continue;
+    }
+
+    size_t start = bodyPos;
+    size_t len = 0;
+    bool complete = false;
+    while (segmentIndex < segmentCount) {
+      uint8_t lace = page[HEADER_SIZE + segmentIndex++];
+      len += lace;
+      if (lace < 255) {
+        complete = true;
+        break;
+      }
+    }
+    bodyPos += len;
+    uint8_t* data = page.data() + start;
+
+    if (dropContinued) {
+      // Tail of a packet whose start was never seen
+      dropContinued = !complete;
+      continue;
+    }
+
+    if (!complete) {
+      packetBuffer.insert(packetBuffer.end(), data, data + len);
+      continuing = true;
+      continue;
+    }
+
+    if (continuing) {
+      packetBuffer.insert(packetBuffer.end(), data, data + len);
+      continuing = false;
+      packet = packetBuffer.data();
+      packetLen = packetBuffer.size();
+    } else {
+      // Common case, the packet is used straight from the page
+      packet = data;
+      packetLen = len;
+    }
+
+    if (packetLen > 0) {
+      return true;
+    }
+    packetBuffer.clear();
+  }
+}
+
+bool OggContainer::parseHeaders() {
+  headersParsed = true;
+  if (!nextPacket()) {
+    return false;
+  }
+
+  if (packetLen >= 19 && memcmp(packet, "OpusHead", 8) == 0) {
+    codec = AudioCodec::OPUS;
+    channels = packet[9];
+    preSkip = readLE(packet + 10, 2);
+    // Opus always decodes at 48 kHz
+    granuleRate = 48000;
+    setupData.assign(packet, packet + packetLen);
+
+    // Output gain of the header, which the decoder doesn't apply
+    float headerGain = (int16_t)readLE(packet + 16, 2) / 256.0f;
+
+    // OpusTags, its R128 gains are relative to the header gain
+    if (!nextPacket()) {
+      return false;
+    }
+    if (packetLen >= 8 && memcmp(packet, "OpusTags", 8) == 0 &&
+        vorbis::parseReplayGain(packet + 8, packetLen - 8, replayGain)) {
+      replayGain.trackGain += headerGain;
+      replayGain.albumGain += headerGain;
+    }
+  } else if (packetLen >= 30 && memcmp(packet, "\x01vorbis", 7) == 0) {
+    codec = AudioCodec::VORBIS;
+    channels = packet[11];
+    granuleRate = readLE(packet + 12, 4);
+
+    // Identification, comment and setup headers
+    std::vector<uint8_t> headers[3];
+    headers[0].assign(packet, packet + packetLen);
+    for (size_t i = 1; i < 3; i++) {
+      if (!nextPacket()) {
+        return false;
+      }
+      headers[i].assign(packet, packet + packetLen);
+    }
+    if (headers[1].size() >= 7 && headers[1][0] == 0x03) {
+      vorbis::parseReplayGain(headers[1].data() + 7, headers[1].size() - 7,
+                              replayGain);
+    }
+
+    // Xiph lacing, sizes of all but the last header up front
+    setupData = {2};
+    for (size_t i = 0; i < 2; i++) {
+      size_t size = headers[i].size();
+      for (; size >= 255; size -= 255) {
+        setupData.push_back(255);
+      }
+      setupData.push_back(size);
+    }
+    for (auto& header : headers) {
+      setupData.insert(setupData.end(), header.begin(), header.end());
+    }
+  } else {
+    BELL_LOG(error, "OggContainer", "Unsupported Ogg stream");
+    return false;
+  }
+
+  packet = nullptr;
+  audioStart = streamOffset;
+  sampleRate = static_cast<bell::SampleRate>(granuleRate);
+  bitWidth = bell::BitWidth::BW_16;
+  return true;
+}
+
+void OggContainer::parseSetupData() {
+  if (!headersParsed) {
+    parseHeaders();
+  }
+}
+
+AudioCodec OggContainer::getCodec() {
+  if (!headersParsed) {
+    parseHeaders();
+  }
+  return codec;
+}
+
+uint8_t* OggContainer::getSetupData(uint32_t& len, AudioCodec codec) {
+  if (codec != getCodec() || setupData.empty()) {
+    len = 0;
+    return nullptr;
+  }
+
+  len = setupData.size();
+  return setupData.data();
+}
+
+std::byte* OggContainer::readSample(uint32_t& len) {
+  if (!headersParsed && !parseHeaders()) {
+    len = 0;
+    return nullptr;
+  }
+
+  if (packet == nullptr) {
+    if (!nextPacket()) {
+      len = 0;
+      return nullptr;
+    }
+    // Pages read for this packet showed a gap
+    gapReported |= gapPending;
+    gapPending = false;
+  }
+
+  len = packetLen;
+  return (std::byte*)packet;
+}
+
+bool OggContainer::takeDataLoss() {
+  bool lost = gapReported;
+  gapReported = false;
+  return lost;
+}
+
+void OggContainer::consumeBytes(uint32_t len) {
+  // Packets can't be split, a codec failing on one moves on to the next
+  packet = nullptr;
+}
+
+uint32_t OggContainer::granuleToMs(int64_t granule) {
+  if (granuleRate == 0) {
+    return 0;
+  }
+  return std::max<int64_t>(granule - preSkip, 0) * 1000 / granuleRate;
+}
+
+bool OggContainer::getGaplessInfo(GaplessInfo& info) {
+  if (endGranule <= (int64_t)preSkip) {
+    return false;
+  }
+
+  // The Opus decoder drops the pre-skip itself
+  info.delay = 0;
+  info.padding = 0;
+  info.totalFrames = endGranule - preSkip;
+  return true;
+}
+
+bool OggContainer::getReplayGain(ReplayGainInfo& info) {
+  if (!replayGain.hasTrack && !replayGain.hasAlbum) {
+    return false;
+  }
+  info = replayGain;
+  return true;
+}
+
+uint32_t OggContainer::getPositionMs() {
+  return granuleToMs(startGranule);
+}
+
+bool OggContainer::seekToTime(uint32_t timeMs) {
+  if (!headersParsed || granuleRate == 0) {
+    return false;
+  }
+
+  FrameIndex::Entry entry;
+  size_t offset;
+  bool exact = pageIndex.lookup(timeMs, entry);
+  if (exact) {
+    offset = entry.offset;
+  } else {
+    // Interpolate with the bitrate seen so far
+    if (pageGranule <= 0 || streamOffset <= audioStart) {
+      return false;
+    }
+    uint64_t target = (uint64_t)timeMs * granuleRate / 1000 + preSkip;
+    offset = audioStart + target * (streamOffset - audioStart) / pageGranule;
+  }
+
+  if (!seekSource(offset)) {
+    return false;
+  }
+
+  heading.clear();
+  headingPos = 0;
+  streamOffset = offset;
+  segmentIndex = 0;
+  segmentCount = 0;
+  packet = nullptr;
+  packetBuffer.clear();
+  continuing = false;
+  dropContinued = false;
+  // Pages are expected to jump here
+  nextSequence = -1;
+  gapPending = false;
+  gapReported = false;
+
+  if (exact) {
+    // Start of the indexed page, where the previous page ended
+    pageGranule = (int64_t)entry.timeMs * granuleRate / 1000 + preSkip;
+    startGranule = pageGranule;
+  } else {
+    pageGranule = -1;
+  }
+  positionExact = exact;
+  return true;
+}
@@ -0,0 +1,79 @@
+#include "VorbisComment.h"
+
+#include <ctype.h>   // for toupper
+#include <stdlib.h>  // for strtof, strtol
+#include <string.h>  // for strlen
+#include <string>    // for string
+
+using namespace bell;
+
+// R128 gains are relative to -23 LUFS, ReplayGain 2.0 to -18 LUFS
+#define R128_TO_REPLAYGAIN 5.0f
+
+static uint32_t readLE32(const uint8_t* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Whether field is key=..., field names are case insensitive
+static bool isField(const std::string& field, const char* key) {
+  size_t keyLen = strlen(key);
+  if (field.size() <= keyLen || field[keyLen] != '=') {
+    return false;
+  }
+  for (size_t i = 0; i < keyLen; i++) {
+    if (toupper((unsigned char)field[i]) != key[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool vorbis::parseReplayGain(const uint8_t* data, size_t len,
+                             ReplayGainInfo& info) {
+  if (len < 8) {
+    return false;
+  }
+  // Vendor string, then the field count
+  size_t pos = 4 + (size_t)readLE32(data);
+  if (pos + 4 > len) {
+    return false;
+  }
+  uint32_t count = readLE32(data + pos);
+  pos += 4;
+
+  bool found = false;
+  bool hasR128Track = false, hasR128Album = false;
+  for (uint32_t i = 0; i < count && pos + 4 <= len; i++) {
+    size_t fieldLen = readLE32(data + pos);
+    pos += 4;
+    if (fieldLen > len - pos) {
+      break;
+    }
+    std::string field((const char*)data + pos, fieldLen);
+    pos += fieldLen;
+
+    size_t separator = field.find('=');
+    if (separator == std::string::npos) {
+      continue;
+    }
+    const char* value = field.c_str() + separator + 1;
+    if (isField(field, "REPLAYGAIN_TRACK_GAIN") && !hasR128Track) {
+      info.trackGain = strtof(value, nullptr);
+      info.hasTrack = found = true;
+    } else if (isField(field, "REPLAYGAIN_ALBUM_GAIN") && !hasR128Album) {
+      info.albumGain = strtof(value, nullptr);
+      info.hasAlbum = found = true;
+    } else if (isField(field, "REPLAYGAIN_TRACK_PEAK")) {
+      info.trackPeak = strtof(value, nullptr);
+    } else if (isField(field, "REPLAYGAIN_ALBUM_PEAK")) {
+      info.albumPeak = strtof(value, nullptr);
+    } else if (isField(field, "R128_TRACK_GAIN")) {
+      info.trackGain = strtol(value, nullptr, 10) / 256.0f + R128_TO_REPLAYGAIN;
+      info.hasTrack = hasR128Track = found = true;
+    } else if (isField(field, "R128_ALBUM_GAIN")) {
+      info.albumGain = strtol(value, nullptr, 10) / 256.0f + R128_TO_REPLAYGAIN;
+      info.hasAlbum = hasR128Album = found = true;
+    }
+  }
+  return found;
+}
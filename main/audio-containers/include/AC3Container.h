@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t, uint64_t
+#include <cstddef>   // for byte
+#include <istream>   // for istream
+
+#include "AudioContainer.h"  // for AudioContainer
+#include "ByteStream.h"      // for ByteStream
+#include "CodecType.h"       // for AudioCodec
+#include "MirroredRing.h"    // for MirroredRing
+
+namespace bell {
+/**
+ * Raw AC-3 and E-AC-3 elementary streams (.ac3, .eac3), as consecutive sync
+ * frames. Nothing here decodes them: the frames are meant for an
+ * IEC61937Packer, to be played by an S/PDIF receiver.
+ */
+class AC3Container : public AudioContainer {
+ public:
+  struct FrameHeader {
+    // Bytes of the frame, header included
+    uint32_t size;
+    uint32_t sampleRate;
+    // Samples per channel, 256 per audio block
+    uint32_t samples;
+    // E-AC-3, bsid 11 to 16
+    bool enhanced;
+    // Independent substream, dependent ones extend the frame before them
+    bool independent;
+    uint8_t substream;
+    // Bitstream mode, carried by IEC 61937 bursts of AC-3
+    uint8_t bsmod;
+    // Full bandwidth channels plus LFE
+    int channels;
+  };
+
+  ~AC3Container(){};
+  AC3Container(std::istream& istr, const std::byte* headingBytes = nullptr,
+               size_t headingLen = 0);
+  AC3Container(bell::ByteStream& byteStream,
+               const std::byte* headingBytes = nullptr, size_t headingLen = 0);
+
+  std::byte* readSample(uint32_t& len) override;
+  void parseSetupData() override;
+  void consumeBytes(uint32_t len) override;
+
+  // Known once parseSetupData() found a first frame
+  bell::AudioCodec getCodec() override {
+    return enhanced ? bell::AudioCodec::EAC3 : bell::AudioCodec::AC3;
+  }
+
+  uint32_t getPositionMs() override;
+
+  /**
+   * Parses the sync frame header at data, sync word included
+   * @returns false if data holds no valid header
+   */
+  static bool parseFrameHeader(const uint8_t* data, size_t available,
+                               FrameHeader& header);
+  // Size of the frame at data, 0 if it holds no valid header
+  static size_t frameLength(const uint8_t* data, size_t available);
+
+  // Bytes parseFrameHeader() looks at
+  static constexpr size_t HEADER_LEN = 8;
+
+ private:
+  // 1920 words at 32 kHz and 640 kbps, 2048 for E-AC-3
+  static constexpr auto MAX_FRAME_SIZE = 4096;
+  static constexpr auto BUFFER_SIZE = 1024 * 16;
+
+  // Frames are read in place, the mirror covers two of them
+  MirroredRing buffer = MirroredRing(BUFFER_SIZE, MAX_FRAME_SIZE * 2);
+
+  bool enhanced = false;
+  // Source offset of the first byte in buffer
+  size_t streamOffset = 0;
+  // Frames before this offset have been counted already
+  size_t nextFrame = 0;
+  uint64_t samplesPlayed = 0;
+  uint32_t frameSampleRate = 0;
+
+  void writeHeading(const std::byte* headingBytes, size_t headingLen);
+  bool fillBuffer();
+  bool resync();
+  void consume(size_t len);
+};
+}  // namespace bell
@@ -3,16 +3,21 @@
 #include <stdint.h>  // for uint32_t
 #include <cstddef>   // for byte, size_t
 #include <istream>   // for istream
-#include <vector>    // for vector
 
 #include "AudioContainer.h"  // for AudioContainer
+#include "ByteStream.h"      // for ByteStream
 #include "CodecType.h"       // for AudioCodec, AudioCodec::AAC
+#include "FrameIndex.h"      // for FrameIndex
+#include "MirroredRing.h"    // for MirroredRing
 
 namespace bell {
 class ADTSContainer : public AudioContainer {
  public:
   ~ADTSContainer(){};
-  ADTSContainer(std::istream& istr, const std::byte* headingBytes = nullptr);
+  ADTSContainer(std::istream& istr, const std::byte* headingBytes = nullptr,
+                size_t headingLen = 7);
+  ADTSContainer(bell::ByteStream& byteStream,
+                const std::byte* headingBytes = nullptr, size_t headingLen = 7);
 
   std::byte* readSample(uint32_t& len) override;
   bool resyncADTS();
@@ -21,16 +26,51 @@ class ADTSContainer : public AudioContainer {
 
   bell::AudioCodec getCodec() override { return bell::AudioCodec::AAC; }
 
+  /**
+   * Seeks through the index of already played frames, or estimates the offset
+   * from the average bitrate so far. ADTS has no seek table.
+   */
+  bool seekToTime(uint32_t timeMs) override;
+  uint32_t getPositionMs() override;
+
+  /**
+   * Size of the frame starting at header, ADTS header included
+   * @returns 0 if header isn't a valid ADTS header
+   */
+  static uint32_t frameLength(const uint8_t* header, size_t available);
+  // Samples per channel of the frame, at the core sample rate
+  static uint32_t frameSamples(const uint8_t* header);
+  // Core sample rate of the frame, 0 if reserved
+  static uint32_t headerSampleRate(const uint8_t* header);
+
  private:
   static constexpr auto AAC_MAX_FRAME_SIZE = 2100;
   static constexpr auto BUFFER_SIZE = 1024 * 10;
 
-  std::vector<std::byte> buffer = std::vector<std::byte>(BUFFER_SIZE);
+  // Frames are read in place, the mirror covers two of them
+  MirroredRing buffer = MirroredRing(BUFFER_SIZE, AAC_MAX_FRAME_SIZE * 2);
 
-  size_t bytesInBuffer = 0;
-  size_t dataOffset = 0;
   bool protectionAbsent = false;
 
+  FrameIndex frameIndex;
+
+  // Source offset of the first byte in buffer
+  size_t streamOffset = 0;
+  // Frames before this offset have been counted already
+  size_t nextFrame = 0;
+  // Offset and time of the first frame counted since the last estimated seek,
+  // the base of bitrate estimates
+  size_t rateBaseOffset = 0;
+  uint64_t rateBaseSamples = 0;
+  bool rateBaseSet = false;
+  uint64_t samplesPlayed = 0;
+  uint32_t frameSampleRate = 0;
+  // False after a seek that could only estimate the landing time
+  bool positionExact = true;
+
+  void writeHeading(const std::byte* headingBytes, size_t headingLen);
   bool fillBuffer();
+  void consume(size_t len);
+  void countFrame(const uint8_t* frame, uint32_t len);
 };
 }  // namespace bell
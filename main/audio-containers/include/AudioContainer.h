@@ -1,26 +1,170 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <istream>
+#include "ByteStream.h"
 #include "CodecType.h"
 #include "StreamInfo.h"
 
 namespace bell {
+/**
+ * Encoder delay and padding of a track, in frames at the decoder's output
+ * rate. Decoders that strip them on their own (Opus pre-skip) are accounted
+ * for already.
+ */
+struct GaplessInfo {
+  // Frames to drop from the start of the decoded output
+  uint32_t delay = 0;
+  // Frames the encoder appended at the end, informative only
+  uint32_t padding = 0;
+  // Frames left after the delay, 0 when unknown
+  uint64_t totalFrames = 0;
+};
+
+/**
+ * Damage a container stepped over while looking for frames
+ */
+struct CorruptionStats {
+  // Times the frame sync was lost and found again
+  uint32_t resyncs = 0;
+  // Bytes dropped while resyncing, junk before the first frame included
+  uint64_t bytesSkipped = 0;
+};
+
+/**
+ * ReplayGain tags of a track, gains in dB relative to the ReplayGain 2.0
+ * reference of -18 LUFS. Peaks are linear, 1.0 at full scale, 0 when unknown.
+ */
+struct ReplayGainInfo {
+  bool hasTrack = false;
+  float trackGain = 0;
+  float trackPeak = 0;
+  bool hasAlbum = false;
+  float albumGain = 0;
+  float albumPeak = 0;
+};
+
+/**
+ * Base of all containers. Data is pulled either from a bell::ByteStream,
+ * which lets sockets and BufferedStream fill the container buffer with large
+ * reads, or from a std::istream for compatibility.
+ */
 class AudioContainer {
  protected:
-  std::istream& istr;
+  std::istream* istr = nullptr;
+  bell::ByteStream* byteStream = nullptr;
+
+  CorruptionStats corruption;
+  bool syncLost = false;
+
+  /**
+   * Accounts for a resync
+   * @param skipped bytes dropped by it
+   * @param found whether a frame follows them, or more have to go first
+   */
+  void countResync(size_t skipped, bool found) {
+    if (skipped > 0 && !syncLost) {
+      syncLost = true;
+      corruption.resyncs++;
+    }
+    corruption.bytesSkipped += skipped;
+    if (found) {
+      syncLost = false;
+    }
+  }
+
+  /**
+   * Reads up to len bytes from the source
+   * @return amount of bytes read, 0 once the source is exhausted
+   */
+  size_t readBytes(std::byte* dst, size_t len) {
+    if (byteStream != nullptr) {
+      return byteStream->read((uint8_t*)dst, len);
+    }
+
+    istr->read((char*)dst, len);
+    return istr->gcount();
+  }
+
+  // Repositions the source at an absolute byte offset
+  bool seekSource(size_t offset) {
+    if (byteStream != nullptr) {
+      return byteStream->seek(offset);
+    }
+
+    istr->clear();
+    istr->seekg(offset);
+    if (istr->fail()) {
+      // Not seekable, keep the stream readable
+      istr->clear();
+      return false;
+    }
+    return true;
+  }
 
  public:
   bell::SampleRate sampleRate;
   bell::BitWidth bitWidth;
   int channels;
 
-  AudioContainer(std::istream& istr) : istr(istr) {}
+  AudioContainer(std::istream& istr) : istr(&istr) {}
+  AudioContainer(bell::ByteStream& byteStream) : byteStream(&byteStream) {}
+  virtual ~AudioContainer() = default;
 
   virtual std::byte* readSample(uint32_t& len) = 0;
   virtual void consumeBytes(uint32_t len) = 0;
   virtual void parseSetupData() = 0;
   virtual bell::AudioCodec getCodec() = 0;
+
+  /**
+   * Codec setup data found in the container, e.g. Vorbis headers
+   * @param [out] len size of the returned data
+   * @param codec codec asking for the data
+   * @returns nullptr if the container has none for codec
+   */
+  virtual uint8_t* getSetupData(uint32_t& len, AudioCodec codec) {
+    len = 0;
+    return nullptr;
+  }
+
+  /**
+   * Moves playback to the frame at, or shortly before, timeMs. Needs a source
+   * that can seek, e.g. a BufferedStream opened with a StreamReader.
+   * @returns whether the position changed
+   */
+  virtual bool seekToTime(uint32_t timeMs) { return false; }
+
+  // Playback time of the next frame handed out by readSample()
+  virtual uint32_t getPositionMs() { return 0; }
+
+  /**
+   * Whether data went missing right before the sample last returned by
+   * readSample(), e.g. a corrupted or skipped page. Codecs with loss
+   * concealment rebuild the gap, see BaseCodec::onDataLost().
+   * @returns true once per gap
+   */
+  virtual bool takeDataLoss() { return false; }
+
+  /**
+   * Delay and padding to trim for gapless playback, see
+   * CentralAudioBuffer::setTrackTrim(). Some containers only learn the track
+   * length close to its end, so it's worth asking again while decoding.
+   * @param [out] info trimming found in the stream
+   * @returns false if the stream carries none
+   */
+  virtual bool getGaplessInfo(GaplessInfo& info) { return false; }
+
+  /**
+   * Loudness normalization tags, see LoudnessNormalizer::setTagGain(). Found
+   * in the stream headers, known once readSample() returned a first frame.
+   * @param [out] info gains found in the stream
+   * @returns false if the stream carries none
+   */
+  virtual bool getReplayGain(ReplayGainInfo& info) { return false; }
+
+  // Resyncs so far, counted by the containers that search for frame syncs
+  const CorruptionStats& getCorruptionStats() const { return corruption; }
 };
 }  // namespace bell
@@ -1,12 +1,32 @@
 #pragma once
 
+#include <stddef.h>  // for size_t
 #include <iostream>  // for istream
 #include <memory>    // for unique_ptr
 
+#include "ByteStream.h"  // for ByteStream
+
 namespace bell {
 class AudioContainer;
 }  // namespace bell
 
 namespace bell::AudioContainers {
-std::unique_ptr<bell::AudioContainer> guessAudioContainer(std::istream& istr);
+// Bytes probed past an ID3v2 tag by default
+static constexpr size_t DEFAULT_PROBE_SIZE = 4096;
+// Most bytes probed, every container buffers that much as its heading
+static constexpr size_t MAX_PROBE_SIZE = 8192;
+
+/**
+ * Detects the format from the first probeSize bytes, after skipping an
+ * ID3v2 tag by its size as long as the probe stays within MAX_PROBE_SIZE.
+ * Ogg, FLAC and MP4 are told by their magic, ADTS, MP3 and AC-3 by a run of
+ * consecutive frame headers, so junk before the first frame and chance
+ * syncs don't fool it. The probed bytes are handed to the container, none
+ * are read twice.
+ * @returns nullptr if no format scored
+ */
+std::unique_ptr<bell::AudioContainer> guessAudioContainer(
+    std::istream& istr, size_t probeSize = DEFAULT_PROBE_SIZE);
+std::unique_ptr<bell::AudioContainer> guessAudioContainer(
+    bell::ByteStream& byteStream, size_t probeSize = DEFAULT_PROBE_SIZE);
 }  // namespace bell::AudioContainers
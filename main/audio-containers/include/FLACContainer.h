@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>  // for uint32_t, uint8_t, uint64_t
+#include <cstddef>   // for byte, size_t
+#include <istream>   // for istream
+#include <vector>    // for vector
+
+#include "AudioContainer.h"  // for AudioContainer
+#include "ByteStream.h"      // for ByteStream
+#include "CodecType.h"       // for AudioCodec, AudioCodec::FLAC
+#include "FLACHeaders.h"     // for StreamInfo, FrameHeader
+#include "FrameIndex.h"      // for FrameIndex
+#include "MirroredRing.h"    // for MirroredRing
+
+namespace bell {
+/**
+ * Native FLAC stream reader. Frames carry no length, so readSample() returns
+ * everything buffered from the next valid frame header on, and the codec
+ * consumes exactly one frame. The ring is sized from STREAMINFO to always hold
+ * a whole frame.
+ */
+class FLACContainer : public AudioContainer {
+ public:
+  ~FLACContainer(){};
+  FLACContainer(std::istream& istr, const std::byte* headingBytes = nullptr,
+                size_t headingLen = 0);
+  FLACContainer(bell::ByteStream& byteStream,
+                const std::byte* headingBytes = nullptr, size_t headingLen = 0);
+
+  std::byte* readSample(uint32_t& len) override;
+  void parseSetupData() override;
+  void consumeBytes(uint32_t len) override;
+
+  bell::AudioCodec getCodec() override { return bell::AudioCodec::FLAC; }
+
+  /**
+   * The STREAMINFO block, without its metadata header
+   */
+  uint8_t* getSetupData(uint32_t& len, AudioCodec codec) override;
+
+  /**
+   * Seeks to the closest SEEKTABLE point or already played frame before
+   * timeMs, or to an offset estimated from the bitrate so far, and then skips
+   * whole frames up to the one holding timeMs. Frame headers carry their
+   * sample number, so the position is exact after any seek.
+   */
+  bool seekToTime(uint32_t timeMs) override;
+  uint32_t getPositionMs() override;
+
+  // From the VORBIS_COMMENT block, reads the metadata first if needed
+  bool getReplayGain(ReplayGainInfo& info) override;
+
+ private:
+  // Used until STREAMINFO tells the largest frame
+  static constexpr size_t DEFAULT_FRAME_WINDOW = 16 * 1024;
+  static constexpr size_t MAX_FRAME_WINDOW = 1024 * 1024;
+  // Metadata larger than this (cover art) is skipped with a seek, if possible
+  static constexpr size_t SEEK_DISTANCE = 64 * 1024;
+
+  struct SeekPoint {
+    uint64_t sample;
+    uint64_t offset;
+  };
+
+  size_t frameWindow = DEFAULT_FRAME_WINDOW;
+  MirroredRing buffer =
+      MirroredRing(DEFAULT_FRAME_WINDOW * 2, DEFAULT_FRAME_WINDOW);
+
+  bool metadataParsed = false;
+  bool hasStreamInfo = false;
+  uint8_t streamInfoData[flac::STREAMINFO_SIZE] = {0};
+  flac::StreamInfo info = {};
+  std::vector<SeekPoint> seekTable;
+  ReplayGainInfo replayGain;
+  FrameIndex frameIndex;
+
+  // Source offset of the first byte in buffer
+  size_t streamOffset = 0;
+  size_t audioStart = 0;
+  // Frames before this offset have been indexed already
+  size_t nextFrame = 0;
+
+  // Frame last returned by readSample()
+  flac::FrameHeader frame = {};
+  bool frameConsumed = true;
+  bool hasFrame = false;
+
+  void writeHeading(const std::byte* headingBytes, size_t headingLen);
+  size_t fillBuffer();
+  void consume(size_t len);
+  bool skip(size_t len);
+  bool readMetadata(uint8_t* dst, size_t len);
+  bool parseMetadata();
+  void resizeBuffer();
+
+  // Looks for a frame header at or after from in data
+  bool findFrame(const uint8_t* data, size_t available, size_t from,
+                 size_t& offset, flac::FrameHeader& header);
+  bool skipToSample(uint64_t target);
+};
+}  // namespace bell
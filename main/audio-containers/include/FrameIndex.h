@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <vector>    // for vector
+
+namespace bell {
+/**
+ * Sparse map of playback time to frame offsets, built while a stream plays so
+ * that seeking back into the played part lands exactly on a frame. Entries are
+ * thinned out once the index is full, bounding its memory on long streams.
+ */
+class FrameIndex {
+ public:
+  struct Entry {
+    uint32_t timeMs;
+    uint32_t offset;
+  };
+
+  /**
+   * @param intervalMs minimum time between two entries
+   * @param maxEntries entries kept before the interval is doubled
+   */
+  FrameIndex(uint32_t intervalMs = 500, size_t maxEntries = 1024);
+
+  /**
+   * Records a frame, frames have to come in stream order
+   * @param offset byte offset of the frame in the source
+   * @param timeMs playback time at the start of the frame
+   */
+  void addFrame(size_t offset, uint32_t timeMs);
+
+  /**
+   * Finds the last entry at or before timeMs, within the indexed range
+   * @returns false if timeMs lies past the last indexed frame
+   */
+  bool lookup(uint32_t timeMs, Entry& entry) const;
+
+  void clear();
+
+ private:
+  uint32_t baseIntervalMs, intervalMs;
+  size_t maxEntries;
+  std::vector<Entry> entries;
+
+  // Last frame seen, bounds the range lookup() can answer
+  uint32_t lastFrameMs = 0;
+  bool hasFrames = false;
+};
+}  // namespace bell
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, SIZE_MAX
+
+namespace bell {
+namespace framesync {
+// Returned by a FrameLength for a valid header without a size, such as free
+// format MP3, which is then taken without a look-ahead
+static constexpr size_t UNKNOWN_SIZE = SIZE_MAX;
+
+/**
+ * Validates the header at data, sync word included
+ * @returns size of the frame, 0 if data holds no valid header
+ */
+typedef size_t (*FrameLength)(const uint8_t* data, size_t available);
+
+/**
+ * Finds the first frame of data confirmed by a valid header right after it.
+ * Candidates are located with memchr() on the byte starting every sync
+ * word, 0xFF for MPEG audio, and each costs at most two header checks, so a
+ * resync is linear in the bytes skipped with a small constant.
+ * @param maxFrameSize larger frames are taken for chance syncs, data should
+ * hold twice as much unless the stream ends
+ * @param end whether the source has no more data after len, a last frame
+ * is then taken without a header after it
+ * @param [out] offset start of the frame, or how many bytes can be dropped
+ * when there is none: up to a candidate that needs more data to confirm,
+ * or all but a trailing partial header
+ * @returns whether a frame was found
+ */
+bool findFrame(const uint8_t* data, size_t len, size_t headerLen,
+               size_t maxFrameSize, FrameLength frameLength, bool end,
+               size_t& offset, uint8_t syncByte = 0xFF);
+}  // namespace framesync
+}  // namespace bell
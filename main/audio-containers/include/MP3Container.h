@@ -1,18 +1,33 @@
 #pragma once
 
-#include <stdint.h>  // for uint32_t
+#include <stdint.h>  // for uint32_t, SIZE_MAX
 #include <cstddef>   // for byte, size_t
 #include <istream>   // for istream
 #include <vector>    // for vector
 
 #include "AudioContainer.h"  // for AudioContainer
+#include "ByteStream.h"      // for ByteStream
 #include "CodecType.h"       // for AudioCodec, AudioCodec::MP3
+#include "FrameIndex.h"      // for FrameIndex
+#include "MirroredRing.h"    // for MirroredRing
 
 namespace bell {
 class MP3Container : public AudioContainer {
  public:
+  struct FrameHeader {
+    uint32_t sampleRate;
+    uint32_t samples;
+    uint32_t size;
+    uint32_t bitrate;
+    bool isMpeg1;
+    bool isMono;
+  };
+
   ~MP3Container(){};
-  MP3Container(std::istream& istr, const std::byte* headingBytes = nullptr);
+  MP3Container(std::istream& istr, const std::byte* headingBytes = nullptr,
+               size_t headingLen = 7);
+  MP3Container(bell::ByteStream& byteStream,
+               const std::byte* headingBytes = nullptr, size_t headingLen = 7);
 
   std::byte* readSample(uint32_t& len) override;
   void parseSetupData() override;
@@ -20,16 +35,89 @@ class MP3Container : public AudioContainer {
 
   bell::AudioCodec getCodec() override { return bell::AudioCodec::MP3; }
 
+  /**
+   * Seeks through, in order of preference, the index of already played
+   * frames, the Xing / Info TOC, the VBRI table or the CBR bitrate.
+   */
+  bool seekToTime(uint32_t timeMs) override;
+  uint32_t getPositionMs() override;
+
+  // Taken from the LAME extension of the Info header
+  bool getGaplessInfo(GaplessInfo& info) override;
+
+  /**
+   * Also from the LAME extension. ID3v2 tags are skipped, their
+   * REPLAYGAIN_* frames aren't read.
+   */
+  bool getReplayGain(ReplayGainInfo& info) override;
+
+  /**
+   * Parses the 4 byte header at buf. Free format frames come with a
+   * bitrate of 0, their size is unknown.
+   * @returns false if buf doesn't start with a valid header
+   */
+  static bool parseFrameHeader(const uint8_t* buf, FrameHeader& header);
+  // Whether frame holds a Xing / Info / VBRI header instead of audio
+  static bool isInfoFrame(const uint8_t* frame, size_t available,
+                          const FrameHeader& header);
+
  private:
   static constexpr auto MP3_MAX_FRAME_SIZE = 2100;
+  static constexpr uint32_t DECODER_DELAY = 529;
   static constexpr auto BUFFER_SIZE = 1024 * 10;
 
-  std::vector<std::byte> buffer = std::vector<std::byte>(BUFFER_SIZE);
+  // Frames are read in place, the mirror covers two of them
+  MirroredRing buffer = MirroredRing(BUFFER_SIZE, MP3_MAX_FRAME_SIZE * 2);
+
+  FrameIndex frameIndex;
+
+  // Source offset of the first byte in buffer
+  size_t streamOffset = 0;
+  // Frames before this offset have been counted already
+  size_t nextFrame = 0;
+  // Offset of the frame last handed out
+  size_t frameStart = SIZE_MAX;
+  // The next frame has to be confirmed by the one after it
+  bool seekEstimated = false;
+  // Source offset of the first frame, after any ID3v2 tag
+  size_t audioStart = 0;
+  size_t tagBytesLeft = 0;
+  uint64_t samplesPlayed = 0;
+  // False after a seek that could only estimate the landing time
+  bool positionExact = true;
+
+  // Taken from the first frame
+  bool firstFrameParsed = false;
+  uint32_t frameSampleRate = 0;
+  uint32_t samplesPerFrame = 0;
+  uint32_t bitrate = 0;
+
+  // Xing / Info header
+  uint32_t totalFrames = 0;
+  uint32_t totalBytes = 0;
+  std::vector<uint8_t> xingToc;
+  // Skipped instead of being decoded
+  size_t infoFrameOffset = SIZE_MAX;
+
+  // LAME extension
+  bool hasLameTag = false;
+  uint32_t encoderDelay = 0;
+  uint32_t encoderPadding = 0;
+  ReplayGainInfo replayGain;
 
-  size_t bytesInBuffer = 0;
-  size_t dataOffset = 0;
-  size_t toConsume = 0;
+  // VBRI header, offsets relative to audioStart
+  std::vector<uint32_t> vbriOffsets;
+  uint32_t vbriFramesPerEntry = 0;
 
+  void writeHeading(const std::byte* headingBytes, size_t headingLen);
   bool fillBuffer();
+  void consume(size_t len);
+  bool skipTag();
+  // Returns false for the Info frame
+  bool countFrame(const uint8_t* frame, size_t available);
+  bool parseSeekHeaders(const uint8_t* frame, size_t available, bool isMono,
+                        bool isMpeg1);
+  // lame points at the encoder version of the LAME extension
+  void parseLameGain(const uint8_t* lame);
 };
 }  // namespace bell
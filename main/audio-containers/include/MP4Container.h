@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>  // for uint32_t, uint64_t, uint8_t, int64_t
+#include <cstddef>   // for byte, size_t
+#include <istream>   // for istream
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioContainer.h"  // for AudioContainer
+#include "ByteStream.h"      // for ByteStream
+#include "CodecType.h"       // for AudioCodec
+#include "MP4SampleTable.h"  // for MP4SampleTable
+
+namespace bell {
+/**
+ * Streaming MP4 / fragmented MP4 (ISO-BMFF) demuxer for AAC and ALAC. Boxes
+ * are parsed as they stream by, sample tables go straight into a compact
+ * MP4SampleTable without buffering moov. With a seekable source, gaps in
+ * mdat are skipped with a ranged fetch instead of being read through, and a
+ * moov placed after mdat is fetched from the end.
+ */
+class MP4Container : public AudioContainer {
+ public:
+  ~MP4Container(){};
+  MP4Container(std::istream& istr, const std::byte* headingBytes = nullptr,
+               size_t headingLen = 0);
+  MP4Container(bell::ByteStream& byteStream,
+               const std::byte* headingBytes = nullptr, size_t headingLen = 0);
+
+  // Returns one sample, consumed as a whole by consumeBytes()
+  std::byte* readSample(uint32_t& len) override;
+  void parseSetupData() override;
+  void consumeBytes(uint32_t len) override;
+
+  // Parses up to the first playable track if needed
+  bell::AudioCodec getCodec() override;
+
+  /**
+   * AAC: the AudioSpecificConfig. ALAC: the ALACSpecificConfig cookie.
+   */
+  uint8_t* getSetupData(uint32_t& len, AudioCodec codec) override;
+
+  /**
+   * Seeks within the sample table, or across fragments listed by a sidx box
+   */
+  bool seekToTime(uint32_t timeMs) override;
+  uint32_t getPositionMs() override;
+
+  /**
+   * From the track's edit list, or else the iTunSMPB tag iTunes writes
+   */
+  bool getGaplessInfo(GaplessInfo& info) override;
+
+ private:
+  // Gaps larger than this are skipped with a seek, if the source can
+  static constexpr uint64_t SEEK_DISTANCE = 64 * 1024;
+  static constexpr size_t READ_BUFFER_SIZE = 4096;
+  // Well above an 8 channel, 32-bit ALAC frame of 4096 samples
+  static constexpr uint32_t MAX_SAMPLE_SIZE = 256 * 1024;
+
+  struct Box {
+    uint64_t start;
+    uint64_t end;
+    uint32_t type;
+  };
+
+  struct FragmentRef {
+    uint32_t size;
+    uint32_t duration;
+  };
+
+  AudioCodec codec = AudioCodec::UNKNOWN;
+  bool headersParsed = false;
+  bool trackReady = false;
+  std::vector<uint8_t> setupData;
+
+  // Small reads of box fields are served from here, it starts out holding the
+  // bytes read while probing the format
+  std::vector<uint8_t> readBuffer;
+  size_t readPos = 0;
+  size_t readLen = 0;
+  // Source offset of the next byte readFully() returns
+  uint64_t streamOffset = 0;
+
+  // Selected track
+  uint32_t trackId = 0;
+  uint32_t timescale = 0;
+  bool moovParsed = false;
+  bool fragmented = false;
+
+  // Edit list of the track, media time -1 when there is none
+  uint32_t movieTimescale = 0;
+  int64_t editMediaTime = -1;
+  uint64_t editDuration = 0;
+
+  // iTunSMPB
+  bool hasSmpb = false;
+  uint32_t smpbDelay = 0;
+  uint32_t smpbPadding = 0;
+  uint64_t smpbTotal = 0;
+
+  // trex defaults
+  uint32_t defaultDuration = 0;
+  uint32_t defaultSize = 0;
+
+  MP4SampleTable table;
+  // Decode time of the first sample of table
+  uint64_t baseTime = 0;
+  // Where the next top-level box starts, fragmented files only
+  uint64_t nextBoxOffset = 0;
+
+  // sidx, fragment sizes and durations
+  std::vector<FragmentRef> fragments;
+  uint64_t fragmentsStart = 0;
+  uint64_t fragmentsTime = 0;
+  uint32_t fragmentsTimescale = 0;
+
+  MP4SampleTable::Sample sample = {};
+  bool samplePending = false;
+  bool sampleLoaded = false;
+  std::vector<uint8_t> sampleBuffer;
+
+  void init(const std::byte* headingBytes, size_t headingLen);
+
+  // Stream access
+  size_t readFully(uint8_t* dst, size_t len);
+  bool moveTo(uint64_t offset);
+  bool readBox(Box& box);
+  uint8_t readU8();
+  uint16_t readU16();
+  uint32_t readU32();
+  uint64_t readU64();
+
+  // Box parsers, each stops at the end of its box
+  bool parseHeaders();
+  bool nextFragment();
+  void parseMoov(const Box& moov);
+  bool parseTrak(const Box& trak);
+  bool parseStbl(const Box& stbl);
+  bool parseStsd(const Box& stsd);
+  void parseSampleEntryChildren(const Box& parent);
+  bool parseEsds(const Box& esds);
+  void parseUdta(const Box& udta);
+  void parseSmpb(const std::string& text);
+  void parseMoof(const Box& moof);
+  void parseTraf(const Box& traf, uint64_t moofStart,
+                 uint64_t& nextDataOffset);
+  void parseSidx(const Box& sidx);
+};
+}  // namespace bell
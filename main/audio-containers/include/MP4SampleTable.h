@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t, uint8_t
+#include <vector>    // for vector
+
+namespace bell {
+/**
+ * Compact ISO-BMFF sample table, as read from stsz / stts / stsc / stco or
+ * from the truns of a movie fragment. Sample sizes are stored as zig-zag
+ * varint deltas with an absolute checkpoint every CHECKPOINT_INTERVAL
+ * samples, which takes one or two bytes per sample. Durations and chunk
+ * layouts are kept as runs. A cursor walks the samples in order.
+ */
+class MP4SampleTable {
+ public:
+  struct Sample {
+    uint64_t offset;
+    uint32_t size;
+    uint64_t time;
+    uint32_t duration;
+  };
+
+  void clear();
+
+  // stsz with a fixed sample size
+  void setConstantSize(uint32_t size, uint32_t count);
+  void addSize(uint32_t size);
+
+  // stts entry, runs of equal durations are merged
+  void addDurations(uint32_t count, uint32_t delta);
+
+  /**
+   * stsc entry
+   * @param firstChunk zero based index of the first chunk of the run
+   * @param samplesPerChunk samples in every chunk of the run
+   */
+  void addChunkRun(uint32_t firstChunk, uint32_t samplesPerChunk);
+  void addChunkOffset(uint64_t offset);
+
+  uint32_t sampleCount() const { return count; }
+  uint32_t chunkCount() const { return chunkOffsets.size(); }
+
+  // Time after the last sample, in timescale units
+  uint64_t duration() const;
+
+  /**
+   * Reads the sample under the cursor and moves on to the next one
+   * @returns false past the last sample
+   */
+  bool next(Sample& sample);
+
+  // Positions the cursor on a sample
+  bool seekToSample(uint32_t index);
+
+  // Positions the cursor on the sample playing at time
+  bool seekToTime(uint64_t time);
+
+  // Start time of the sample under the cursor
+  uint64_t currentTime() const { return cursor.time; }
+
+ private:
+  static constexpr uint32_t CHECKPOINT_INTERVAL = 256;
+
+  struct Checkpoint {
+    uint32_t bytePos;
+    uint32_t size;
+  };
+
+  struct Run {
+    uint32_t count;
+    uint32_t value;
+  };
+
+  uint32_t count = 0;
+  uint32_t constantSize = 0;
+  uint32_t lastSize = 0;
+  std::vector<uint8_t> sizeDeltas;
+  std::vector<Checkpoint> checkpoints;
+
+  std::vector<Run> durations;
+
+  // value is the first chunk of the run
+  std::vector<Run> chunkRuns;
+  std::vector<uint64_t> chunkOffsets;
+
+  struct Cursor {
+    uint32_t sample = 0;
+    uint32_t size = 0;
+    uint32_t bytePos = 0;
+
+    uint32_t durationRun = 0;
+    uint32_t inDurationRun = 0;
+    uint64_t time = 0;
+
+    uint32_t chunkRun = 0;
+    uint32_t chunk = 0;
+    uint32_t inChunk = 0;
+    uint64_t offsetInChunk = 0;
+  } cursor;
+
+  uint32_t samplesPerChunk(uint32_t run) const;
+  uint32_t runEnd(uint32_t run) const;
+  void loadSize(uint32_t sample);
+  void advanceSize();
+};
+}  // namespace bell
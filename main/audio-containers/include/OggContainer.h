@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>  // for uint32_t, uint8_t, int64_t
+#include <cstddef>   // for byte, size_t
+#include <istream>   // for istream
+#include <vector>    // for vector
+
+#include "AudioContainer.h"  // for AudioContainer
+#include "ByteStream.h"      // for ByteStream
+#include "CodecType.h"       // for AudioCodec
+#include "FrameIndex.h"      // for FrameIndex
+
+namespace bell {
+/**
+ * Streaming Ogg demuxer for Vorbis and Opus. Pages are read whole, and
+ * readSample() returns one packet at a time, pointing into the page unless
+ * the packet spans pages and has to be reassembled. Only the first logical
+ * stream is played, pages of other streams are skipped.
+ */
+class OggContainer : public AudioContainer {
+ public:
+  ~OggContainer(){};
+  OggContainer(std::istream& istr, const std::byte* headingBytes = nullptr,
+               size_t headingLen = 0);
+  OggContainer(bell::ByteStream& byteStream,
+               const std::byte* headingBytes = nullptr, size_t headingLen = 0);
+
+  /**
+   * Returns the next audio packet. Packets are consumed as a whole by
+   * consumeBytes(), whatever length the codec reports.
+   */
+  std::byte* readSample(uint32_t& len) override;
+  void parseSetupData() override;
+  void consumeBytes(uint32_t len) override;
+
+  // Reads the header packets first if needed
+  bell::AudioCodec getCodec() override;
+
+  /**
+   * Vorbis: the three header packets, Xiph laced. Opus: the OpusHead packet.
+   */
+  uint8_t* getSetupData(uint32_t& len, AudioCodec codec) override;
+
+  /**
+   * Granule position at the end of the last page read, -1 when unknown
+   */
+  int64_t getGranulePosition() { return pageGranule; }
+
+  bool seekToTime(uint32_t timeMs) override;
+  uint32_t getPositionMs() override;
+
+  /**
+   * Track length from the granule of the last page, known once that page
+   * was read
+   */
+  bool getGaplessInfo(GaplessInfo& info) override;
+
+  // Vorbis comments or OpusTags, Opus gains include the header output gain
+  bool getReplayGain(ReplayGainInfo& info) override;
+
+  // Set by dropped pages and gaps in the page sequence numbers
+  bool takeDataLoss() override;
+
+ private:
+  static constexpr size_t HEADER_SIZE = 27;
+
+  AudioCodec codec = AudioCodec::UNKNOWN;
+  bool headersParsed = false;
+
+  // Sample rate of granule positions, 48 kHz for Opus
+  uint32_t granuleRate = 0;
+  uint32_t preSkip = 0;
+  std::vector<uint8_t> setupData;
+  ReplayGainInfo replayGain;
+
+  // Data read ahead while probing the format
+  std::vector<std::byte> heading;
+  size_t headingPos = 0;
+
+  uint32_t serial = 0;
+  bool serialSet = false;
+
+  // Sequence number the next page should carry, -1 after a seek
+  int64_t nextSequence = -1;
+  // A gap precedes the next packet / the packet last returned
+  bool gapPending = false;
+  bool gapReported = false;
+
+  // Current page
+  std::vector<uint8_t> page;
+  uint8_t segmentCount = 0;
+  size_t segmentIndex = 0;
+  size_t bodyPos = 0;
+  int64_t pageGranule = -1;
+  // Granule at the start of the current page
+  int64_t startGranule = 0;
+  // Granule of the end of stream page, -1 until it was seen
+  int64_t endGranule = -1;
+
+  // Packet spanning pages
+  std::vector<uint8_t> packetBuffer;
+  bool continuing = false;
+  bool dropContinued = false;
+
+  uint8_t* packet = nullptr;
+  uint32_t packetLen = 0;
+
+  FrameIndex pageIndex;
+  size_t streamOffset = 0;
+  size_t audioStart = 0;
+  // False until a page with a known granule was read after a seek
+  bool positionExact = true;
+
+  void init(const std::byte* headingBytes, size_t headingLen);
+  size_t readFully(uint8_t* dst, size_t len);
+  bool readPage();
+  bool nextPacket();
+  bool parseHeaders();
+  bool resync();
+  // Resyncs from one byte past the start of a page that didn't parse
+  bool rescan();
+  uint32_t granuleToMs(int64_t granule);
+};
+}  // namespace bell
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t
+
+#include "AudioContainer.h"  // for ReplayGainInfo
+
+namespace bell {
+namespace vorbis {
+/**
+ * Reads the loudness fields of a Vorbis comment block, the body of a Vorbis
+ * comment header or OpusTags packet after its magic, or of a FLAC
+ * VORBIS_COMMENT block. REPLAYGAIN_TRACK / ALBUM_GAIN and _PEAK are taken
+ * as is, Opus R128_TRACK / ALBUM_GAIN (Q7.8 dB relative to -23 LUFS) are
+ * moved to the -18 LUFS reference and win over the former.
+ * @param [out] info left untouched for fields the block doesn't carry
+ * @returns false if the block holds no gain
+ */
+bool parseReplayGain(const uint8_t* data, size_t len, ReplayGainInfo& info);
+}  // namespace vorbis
+}  // namespace bell
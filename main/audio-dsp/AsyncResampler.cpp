@@ -0,0 +1,111 @@
+#include "AsyncResampler.h"
+
+#include <algorithm>  // for copy, fill, min, clamp
+#include <cmath>      // for sin, sqrt, ceil
+
+#include "PolyphaseResampler.h"  // for dot, besselI0
+
+using namespace bell;
+
+dsp::AsyncResampler::AsyncResampler(size_t channels, size_t maxInputFrames)
+    : channels(channels), maxInputFrames(maxInputFrames) {
+  designFilter();
+  history.assign(channels * (TAPS + maxInputFrames), 0.0f);
+  reset();
+}
+
+void dsp::AsyncResampler::designFilter() {
+  // Passband to 0.9 of Nyquist, the ratio never gets far enough from 1 to
+  // need more room for the transition band
+  const double beta = 8.0, cutoff = 0.45;
+  const double center = TAPS / 2 - 1;
+  double norm = besselI0(beta);
+
+  filter.assign((PHASES + 1) * TAPS, 0.0f);
+  for (size_t p = 0; p <= PHASES; p++) {
+    // Output sits p / PHASES of a frame after the center tap
+    double delay = (double)p / PHASES;
+    double sum = 0;
+    float* kernel = filter.data() + p * TAPS;
+    for (size_t t = 0; t < TAPS; t++) {
+      double x = t - center - delay;
+      double sinc = x == 0 ? 2.0 * cutoff
+                           : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+      double w = x / (TAPS / 2);
+      double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - w * w)));
+      kernel[t] = (float)(sinc * window / norm);
+      sum += kernel[t];
+    }
+
+    // Unity gain at DC for every phase, or interpolating them ripples
+    for (size_t t = 0; t < TAPS; t++) {
+      kernel[t] = (float)(kernel[t] / sum);
+    }
+  }
+}
+
+void dsp::AsyncResampler::setRatio(double ratio) {
+  ratio = std::clamp(ratio, 1.0 - MAX_DEVIATION, 1.0 + MAX_DEVIATION);
+  stepOffset = (int32_t)std::lround((ratio - 1.0) * 4294967296.0);
+}
+
+double dsp::AsyncResampler::getRatio() const {
+  return 1.0 + stepOffset / 4294967296.0;
+}
+
+size_t dsp::AsyncResampler::maxOutputFrames() const {
+  return (size_t)std::ceil((TAPS + maxInputFrames) / (1.0 - MAX_DEVIATION)) +
+         1;
+}
+
+void dsp::AsyncResampler::reset() {
+  std::fill(history.begin(), history.end(), 0.0f);
+
+  // Start primed with silence, so output starts right away
+  historyFrames = TAPS - 1;
+  fraction = 0;
+}
+
+size_t dsp::AsyncResampler::process(const float* const* in, size_t frames,
+                                    float* const* out,
+                                    size_t activeChannels) {
+  frames = std::min(frames, maxInputFrames);
+  activeChannels = std::min(activeChannels, channels);
+  size_t stride = TAPS + maxInputFrames;
+  size_t available = historyFrames + frames;
+  int64_t step = ((int64_t)1 << 32) + stepOffset.load();
+
+  for (size_t ch = 0; ch < activeChannels; ch++) {
+    std::copy(in[ch], in[ch] + frames,
+              history.begin() + ch * stride + historyFrames);
+  }
+
+  size_t position = 0;
+  size_t produced = 0;
+  while (position + TAPS <= available) {
+    // Top bits pick the kernels, the rest interpolates between them
+    uint32_t phase = fraction >> 25;
+    float blend = (fraction & 0x1ffffff) * (1.0f / (1 << 25));
+    const float* kernel = filter.data() + phase * TAPS;
+    for (size_t ch = 0; ch < activeChannels; ch++) {
+      const float* samples = history.data() + ch * stride + position;
+      float a = dot(samples, kernel, TAPS);
+      float b = dot(samples, kernel + TAPS, TAPS);
+      out[ch][produced] = a + (b - a) * blend;
+    }
+    produced++;
+
+    int64_t next = fraction + step;
+    position += next >> 32;
+    fraction = (uint32_t)next;
+  }
+
+  // Carry the samples still needed by upcoming outputs
+  historyFrames = available - position;
+  for (size_t ch = 0; ch < activeChannels; ch++) {
+    float* plane = history.data() + ch * stride;
+    std::copy(plane + position, plane + available, plane);
+  }
+
+  return produced;
+}
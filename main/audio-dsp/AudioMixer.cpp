@@ -1,44 +1,158 @@
 #include "AudioMixer.h"
 
-#include <mutex>  // for scoped_lock
+#include <algorithm>  // for min, copy
+#include <stdexcept>  // for runtime_error, invalid_argument
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 using namespace bell;
 
+/**
+ * out[d] = sum(gains[d * from + s] * in[s]) for every output channel.
+ * FROM and TO fix the layout at compile time so that the channel loops
+ * unroll, 0 falls back to the runtime from / to.
+ */
+template <size_t FROM, size_t TO>
+static void mixMatrix(const float* const* in, float* const* out,
+                      const float* gains, size_t from, size_t to,
+                      size_t frames) {
+  if constexpr (FROM != 0) {
+    from = FROM;
+  }
+  if constexpr (TO != 0) {
+    to = TO;
+  }
+
+  for (size_t d = 0; d < to; d++) {
+    const float* row = gains + d * from;
+    float* output = out[d];
+    size_t i = 0;
+
+#if defined(__SSE__)
+    for (; i + 4 <= frames; i += 4) {
+      __m128 acc = _mm_setzero_ps();
+      for (size_t s = 0; s < from; s++) {
+        acc = _mm_add_ps(
+            acc, _mm_mul_ps(_mm_set1_ps(row[s]), _mm_loadu_ps(in[s] + i)));
+      }
+      _mm_storeu_ps(output + i, acc);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= frames; i += 4) {
+      float32x4_t acc = vdupq_n_f32(0.0f);
+      for (size_t s = 0; s < from; s++) {
+        acc = vmlaq_n_f32(acc, vld1q_f32(in[s] + i), row[s]);
+      }
+      vst1q_f32(output + i, acc);
+    }
+#endif
+
+    for (; i < frames; i++) {
+      float acc = 0.0f;
+      for (size_t s = 0; s < from; s++) {
+        acc += row[s] * in[s][i];
+      }
+      output[i] = acc;
+    }
+  }
+}
+
 AudioMixer::AudioMixer() {}
 
-std::unique_ptr<StreamInfo> AudioMixer::process(
-    std::unique_ptr<StreamInfo> info) {
-  std::scoped_lock lock(this->accessMutex);
-  if (info->numChannels != from) {
-    throw std::runtime_error(
-        "AudioMixer: Input channel count does not match configuration");
+void AudioMixer::configure(int from, int to, const std::vector<float>& gains) {
+  if (from <= 0 || to <= 0 || gains.size() != (size_t)(from * to)) {
+    throw std::invalid_argument("Mixer matrix size invalid");
   }
-  info->numChannels = to;
+
+  this->from = from;
+  this->to = to;
+  auto mix = std::make_shared<ActiveMix>();
+  mix->from = from;
+  mix->to = to;
+  mix->gains = gains;
+  mix->scratch.assign(to * MIX_BLOCK, 0.0f);
+  mix->inputPlanes.resize(from);
+  for (int d = 0; d < to; d++) {
+    mix->outputPlanes.push_back(mix->scratch.data() + d * MIX_BLOCK);
+  }
+  activeMix.publish(mix);
+}
+
+void AudioMixer::publishConfig() {
+  std::vector<float> gains(to * from, 0.0f);
+  std::vector<bool> mapped(to, false);
 
   for (auto& singleConf : mixerConfig) {
-    if (singleConf.source.size() == 1) {
-      if (singleConf.source[0] == singleConf.destination) {
-        continue;
-      }
-      // Copy channel
-      for (int i = 0; i < info->numSamples; i++) {
-        info->data[singleConf.destination][i] =
-            info->data[singleConf.source[0]][i];
+    if (singleConf.destination < 0 || singleConf.destination >= to) {
+      throw std::invalid_argument("Mixer destination out of range");
+    }
+
+    mapped[singleConf.destination] = true;
+    for (auto& source : singleConf.source) {
+      if (source < 0 || source >= from) {
+        throw std::invalid_argument("Mixer source out of range");
       }
+      gains[singleConf.destination * from + source] +=
+          1.0f / (float)singleConf.source.size();
+    }
+  }
+
+  for (int d = 0; d < std::min(from, to); d++) {
+    if (!mapped[d]) {
+      gains[d * from + d] = 1.0f;
+    }
+  }
+
+  configure(from, to, gains);
+}
+
+int AudioMixer::getOutputChannels(int inputChannels) {
+  auto mix = activeMix.read();
+  return mix ? mix->to : inputChannels;
+}
+
+void AudioMixer::process(StreamInfo& info) {
+  auto mix = activeMix.read();
+  if (!mix) {
+    return;
+  }
+
+  if (info.numChannels != mix->from) {
+    throw std::runtime_error(
+        "AudioMixer: Input channel count does not match configuration");
+  }
+
+  size_t from = mix->from;
+  size_t to = mix->to;
+  const float* gains = mix->gains.data();
+  const float** input = mix->inputPlanes.data();
+  float** scratch = mix->outputPlanes.data();
+  for (size_t offset = 0; offset < info.numSamples; offset += MIX_BLOCK) {
+    size_t frames = std::min(MIX_BLOCK, info.numSamples - offset);
+
+    for (size_t s = 0; s < from; s++) {
+      input[s] = info.data[s] + offset;
+    }
+
+    if (from == 2 && to == 1) {
+      mixMatrix<2, 1>(input, scratch, gains, from, to, frames);
+    } else if (from == 2 && to == 2) {
+      mixMatrix<2, 2>(input, scratch, gains, from, to, frames);
+    } else if (from == 2 && to == 4) {
+      mixMatrix<2, 4>(input, scratch, gains, from, to, frames);
     } else {
-      // Mix channels
-      float sample = 0.0f;
-      for (int i = 0; i < info->numSamples; i++) {
-        sample = 0.0;
-        for (auto& source : singleConf.source) {
-          sample += info->data[source][i];
-        }
-
-        info->data[singleConf.destination][i] =
-            sample / (float)singleConf.source.size();
-      }
+      mixMatrix<0, 0>(input, scratch, gains, from, to, frames);
+    }
+
+    // Every output is computed from the untouched inputs before writing
+    for (size_t d = 0; d < to; d++) {
+      std::copy(scratch[d], scratch[d] + frames, info.data[d] + offset);
     }
   }
 
-  return info;
-}
\ No newline at end of file
+  info.numChannels = mix->to;
+}
@@ -1,22 +1,301 @@
 #include "AudioPipeline.h"
 
-#include <type_traits>  // for remove_extent_t
-#include <utility>      // for move
+#include <algorithm>    // for copy, max, min, stable_sort
+#include <map>          // for map
+#include <numeric>      // for iota
+#include <type_traits>  // for is_same_v
+#include <utility>      // for move, pair, swap
 
-#include "AudioTransform.h"   // for AudioTransform
-#include "BellLogger.h"       // for AbstractLogger, BELL_LOG
-#include "TransformConfig.h"  // for TransformConfig
+#include "AudioTransform.h"    // for AudioTransform
+#include "BellLogger.h"        // for AbstractLogger, BELL_LOG
+#include "BellMetrics.h"       // for Metrics, MetricTimer
+#include "BellTask.h"          // for Task
+#include "BellTrace.h"         // for BELL_TRACE_SCOPE
+#include "Denormals.h"         // for DenormalGuard
+#include "TransformConfig.h"   // for TransformConfig
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
 
 using namespace bell;
 
+/**
+ * Runs lane 1 of a stage while the audio thread runs lane 0. The two
+ * semaphores are the whole barrier, each has a single waiter.
+ */
+class AudioPipeline::Worker : public bell::Task {
+ public:
+  Worker(int core) : bell::Task("dsp_worker", 4096 * 2, 10, core, false) {
+    this->scheduling.policy = Policy::AUDIO;
+  }
+  ~Worker() { stopTask(); }
+
+  // Starts lane on data, finish() waits for it
+  void start(const Lane& lane, StreamInfo& data) {
+    this->lane = &lane;
+    this->data = &data;
+    this->fixedData = nullptr;
+    startSem.give();
+  }
+  void start(const Lane& lane, FixedStreamInfo& data) {
+    this->lane = &lane;
+    this->data = nullptr;
+    this->fixedData = &data;
+    startSem.give();
+  }
+  void finish() { doneSem.wait(); }
+
+ private:
+  bell::WrappedSemaphore startSem = bell::WrappedSemaphore(1);
+  bell::WrappedSemaphore doneSem = bell::WrappedSemaphore(1);
+  const Lane* lane = nullptr;
+  StreamInfo* data = nullptr;
+  FixedStreamInfo* fixedData = nullptr;
+
+  void runTask() override;
+  void onStopRequested() override { startSem.give(); }
+};
+
+// Runs process, timed into the transform's histogram if it has one
+template <typename Process>
+static void timed(AudioTransform& transform, Process&& process) {
+#ifdef BELL_METRICS
+  if (transform.processTime) {
+    MetricTimer timer(*transform.processTime);
+    process();
+    return;
+  }
+#endif
+  process();
+}
+
+/**
+ * Feeds a transform blocks of quantum samples. Samples are collected in one
+ * block while the previous, processed one is played out, so the output
+ * trails the input by exactly one quantum.
+ */
+class AudioPipeline::Quantizer {
+ public:
+  Quantizer(size_t quantum) : quantum(quantum) {}
+
+  size_t getQuantum() const { return quantum; }
+
+  void process(AudioTransform& transform, StreamInfo& data) {
+    if (data.numChannels != channels) {
+      resize(data.numChannels);
+    }
+
+    for (size_t done = 0; done < data.numSamples;) {
+      size_t chunk = std::min(data.numSamples - done, quantum - fill);
+      for (int channel = 0; channel < channels; channel++) {
+        float* samples = data.data[channel] + done;
+        std::copy(samples, samples + chunk, blocks[0][channel] + fill);
+        std::copy(blocks[1][channel] + fill, blocks[1][channel] + fill + chunk,
+                  samples);
+      }
+      fill += chunk;
+      done += chunk;
+
+      if (fill == quantum) {
+        StreamInfo block = data;
+        block.data = blocks[0].data();
+        block.numSamples = quantum;
+        timed(transform, [&]() { transform.process(block); });
+        // The processed block is played out while the next one fills
+        std::swap(blocks[0], blocks[1]);
+        fill = 0;
+      }
+    }
+  }
+
+ private:
+  size_t quantum;
+  int channels = 0;
+  // Samples of the block being collected
+  size_t fill = 0;
+
+  std::vector<float> storage;
+  // [0] collects input, [1] holds the output being played, per channel
+  std::vector<float*> blocks[2];
+
+  // Restarts from silence for a new channel count
+  void resize(int channels) {
+    this->channels = channels;
+    fill = 0;
+    storage.assign(2 * channels * quantum, 0.0f);
+    for (int i = 0; i < 2; i++) {
+      blocks[i].resize(channels);
+      for (int channel = 0; channel < channels; channel++) {
+        blocks[i][channel] =
+            storage.data() + (i * channels + channel) * quantum;
+      }
+    }
+  }
+};
+
+void AudioPipeline::Worker::runTask() {
+  // Set once, the task only ever runs transforms
+  dsp::DenormalGuard denormals;
+  while (true) {
+    startSem.wait();
+    if (isStopRequested()) {
+      return;
+    }
+    for (auto& transform : *lane) {
+      if (data) {
+        timed(*transform, [&]() { transform->process(*data); });
+      } else {
+        timed(*transform, [&]() { transform->processFixed(*fixedData); });
+      }
+    }
+    doneSem.give();
+  }
+}
+
 AudioPipeline::AudioPipeline(){
     // this->headroomGainTransform = std::make_shared<Gain>(Channels::LEFT_RIGHT);
     // this->transforms.push_back(this->headroomGainTransform);
 };
 
 void AudioPipeline::addTransform(std::shared_ptr<AudioTransform> transform) {
+  std::scoped_lock lock(this->accessMutex);
+#ifdef BELL_METRICS
+  // Transforms of the same type share one histogram
+  transform->processTime = &Metrics::histogram("dsp." + transform->filterType);
+#endif
   transforms.push_back(transform);
   recalculateHeadroom();
+  if (transform->config) {
+    transform->precomputeVolumeSteps();
+  }
+
+  publishPlan();
+}
+
+void AudioPipeline::enableParallelProcessing(int core) {
+  std::scoped_lock lock(this->accessMutex);
+  if (worker) {
+    return;
+  }
+  auto newWorker = std::make_shared<Worker>(core);
+  if (!newWorker->startTask()) {
+    BELL_LOG(error, "AudioPipeline", "Couldn't start the DSP worker");
+    return;
+  }
+  worker = newWorker;
+  publishPlan();
+}
+
+size_t AudioPipeline::getLatency() {
+  auto plan = activePlan.current();
+  size_t latency = 0;
+  if (plan) {
+    for (auto& stage : plan->stages) {
+      latency += stage.quantizer ? stage.quantizer->getQuantum() : 0;
+    }
+  }
+  return latency;
+}
+
+void AudioPipeline::disableParallelProcessing() {
+  std::scoped_lock lock(this->accessMutex);
+  worker = nullptr;
+  // The previous plan, and with it the worker, is released once process()
+  // left it
+  publishPlan();
+}
+
+std::shared_ptr<AudioPipeline::Plan> AudioPipeline::makePlan() {
+  auto plan = std::make_shared<Plan>();
+  plan->worker = worker;
+
+  // Transforms since the last one reading every channel
+  std::vector<std::pair<std::shared_ptr<AudioTransform>, std::vector<int>>>
+      pending;
+  auto flush = [&]() {
+    if (pending.empty()) {
+      return;
+    }
+    Stage stage;
+    if (!worker) {
+      for (auto& [transform, channels] : pending) {
+        stage.lanes[0].push_back(transform);
+      }
+      plan->stages.push_back(std::move(stage));
+      pending.clear();
+      return;
+    }
+
+    // Union-find over transforms, joined when they share a channel
+    std::vector<size_t> parent(pending.size());
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&](size_t i) {
+      while (parent[i] != i) {
+        i = parent[i] = parent[parent[i]];
+      }
+      return i;
+    };
+    std::map<int, size_t> channelOwner;
+    for (size_t i = 0; i < pending.size(); i++) {
+      for (int channel : pending[i].second) {
+        auto owner = channelOwner.find(channel);
+        if (owner == channelOwner.end()) {
+          channelOwner[channel] = i;
+        } else {
+          parent[root(i)] = root(owner->second);
+        }
+      }
+    }
+
+    // Largest groups first, each onto the lane with fewer transforms
+    std::map<size_t, std::vector<size_t>> groups;
+    for (size_t i = 0; i < pending.size(); i++) {
+      groups[root(i)].push_back(i);
+    }
+    std::vector<std::vector<size_t>*> bySize;
+    for (auto& group : groups) {
+      bySize.push_back(&group.second);
+    }
+    std::stable_sort(bySize.begin(), bySize.end(),
+                     [](auto* a, auto* b) { return a->size() > b->size(); });
+    for (auto* group : bySize) {
+      auto& lane =
+          stage.lanes[stage.lanes[1].size() < stage.lanes[0].size() ? 1 : 0];
+      // Within a group, and so within a lane, the order is kept
+      for (size_t i : *group) {
+        lane.push_back(pending[i].first);
+      }
+    }
+    plan->stages.push_back(std::move(stage));
+    pending.clear();
+  };
+
+  for (auto& transform : transforms) {
+    plan->keepsFormat = plan->keepsFormat && transform->keepsFormat();
+    size_t quantum = transform->getQuantum();
+    if (quantum > 0) {
+      auto& quantizer = quantizers[transform.get()];
+      if (!quantizer || quantizer->getQuantum() != quantum) {
+        quantizer = std::make_shared<Quantizer>(quantum);
+      }
+      flush();
+      Stage stage;
+      stage.lanes[0].push_back(transform);
+      stage.quantizer = quantizer;
+      plan->stages.push_back(std::move(stage));
+      continue;
+    }
+
+    auto channels = transform->getChannels();
+    if (channels.empty()) {
+      flush();
+      Stage stage;
+      stage.lanes[0].push_back(transform);
+      plan->stages.push_back(std::move(stage));
+    } else {
+      pending.emplace_back(transform, std::move(channels));
+    }
+  }
+  flush();
+  return plan;
 }
 
 void AudioPipeline::recalculateHeadroom() {
@@ -36,18 +315,161 @@ void AudioPipeline::volumeUpdated(int volume) {
   BELL_LOG(debug, "AudioPipeline", "Requested");
   std::scoped_lock lock(this->accessMutex);
   for (auto transform : transforms) {
+    if (transform->followsVolume()) {
+      transform->applyVolumeStep(volume);
+      continue;
+    }
+    // Transforms set up in code, like VolumeControl's gain, have no config
+    if (!transform->config) {
+      continue;
+    }
     transform->config->currentVolume = volume;
-    transform->reconfigure();
+    if (!transform->config->dependsOnVolume()) {
+      continue;
+    }
+
+    // Cached transforms only swap a table entry, others recompute
+    if (!transform->applyVolumeStep(volume)) {
+      transform->reconfigure();
+    }
   }
-  BELL_LOG(debug, "AudioPipeline", "Volume applied, DSP reconfigured");
+  // A reconfigured transform may work on other channels or another quantum
+  publishPlan();
+  BELL_LOG(debug, "AudioPipeline", "Volume applied");
 }
 
-std::unique_ptr<StreamInfo> AudioPipeline::process(
-    std::unique_ptr<StreamInfo> data) {
+void AudioPipeline::sampleRateChanged(uint32_t sampleRate) {
   std::scoped_lock lock(this->accessMutex);
-  for (auto& transform : transforms) {
-    data = transform->process(std::move(data));
+  for (auto transform : transforms) {
+    transform->sampleRateChanged(sampleRate);
+    sampleRate = transform->getOutputRate(sampleRate);
   }
+  publishPlan();
+}
+
+void AudioPipeline::precomputeVolumeSteps() {
+  std::scoped_lock lock(this->accessMutex);
+  for (auto transform : transforms) {
+    if (transform->config) {
+      transform->precomputeVolumeSteps();
+    }
+  }
+  publishPlan();
+}
+
+template <typename Info>
+void AudioPipeline::runPlan(Info& data) {
+  auto plan = activePlan.read();
+  if (!plan) {
+    return;
+  }
+  BELL_TRACE_SCOPE("dsp.process");
+  // Filters decaying through silence otherwise hit the slow denormal path,
+  // restored on return as the caller's thread may rely on IEEE behaviour
+  dsp::DenormalGuard denormals;
+
+  auto run = [](const Lane& lane, Info& data) {
+    for (auto& transform : lane) {
+      timed(*transform, [&]() {
+        if constexpr (std::is_same_v<Info, StreamInfo>) {
+          transform->process(data);
+        } else {
+          transform->processFixed(data);
+        }
+      });
+    }
+  };
+
+  for (auto& stage : plan->stages) {
+    if constexpr (std::is_same_v<Info, StreamInfo>) {
+      if (stage.quantizer) {
+        stage.quantizer->process(*stage.lanes[0][0], data);
+        continue;
+      }
+    }
+    if (stage.lanes[1].empty()) {
+      run(stage.lanes[0], data);
+      continue;
+    }
 
-  return data;
-}
\ No newline at end of file
+    // Per-channel transforms leave the rest of data alone, the worker gets
+    // a copy so neither side sees the other write to it
+    Info workerData = data;
+    plan->worker->start(stage.lanes[1], workerData);
+    run(stage.lanes[0], data);
+    plan->worker->finish();
+  }
+}
+
+void AudioPipeline::process(StreamInfo& data) {
+  runPlan(data);
+}
+
+bool AudioPipeline::isIdentity() {
+  auto plan = activePlan.read();
+  if (!plan) {
+    return true;
+  }
+
+  for (auto& stage : plan->stages) {
+    // Quantized transforms delay the stream
+    if (stage.quantizer) {
+      return false;
+    }
+    for (auto& lane : stage.lanes) {
+      for (auto& transform : lane) {
+        if (!transform->isIdentity()) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+int AudioPipeline::getMaxChannels(int inputChannels) {
+  auto plan = activePlan.read();
+  int channels = inputChannels;
+  if (!plan) {
+    return channels;
+  }
+
+  // Transforms that change the count have a stage of their own, lane order
+  // only matters within a channel
+  for (auto& stage : plan->stages) {
+    for (auto& lane : stage.lanes) {
+      for (auto& transform : lane) {
+        channels = transform->getOutputChannels(channels);
+        inputChannels = std::max(inputChannels, channels);
+      }
+    }
+  }
+  return inputChannels;
+}
+
+bool AudioPipeline::keepsFormat() {
+  auto plan = activePlan.read();
+  return !plan || plan->keepsFormat;
+}
+
+bool AudioPipeline::supportsFixedPoint() {
+  auto plan = activePlan.read();
+  if (!plan) {
+    return true;
+  }
+
+  for (auto& stage : plan->stages) {
+    for (auto& lane : stage.lanes) {
+      for (auto& transform : lane) {
+        if (!transform->supportsFixedPoint()) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void AudioPipeline::processFixed(FixedStreamInfo& data) {
+  runPlan(data);
+}
@@ -1,10 +1,15 @@
 #include "BellDSP.h"
 
+#include <algorithm>    // for min
+#include <cstring>      // for memmove, memcpy
 #include <type_traits>  // for remove_extent_t
 #include <utility>      // for move
 
 #include "AudioPipeline.h"       // for CentralAudioBuffer
+#include "BellHotPath.h"         // for BELL_HOT
+#include "BellMetrics.h"         // for BELL_METRIC_COUNT, BELL_METRIC_GAUGE
 #include "CentralAudioBuffer.h"  // for CentralAudioBuffer
+#include "SampleConversion.h"    // for deinterleave, isSilent
 
 using namespace bell;
 
@@ -32,88 +37,455 @@ void BellDSP::FadeEffect::apply(float* audioData, size_t samples,
   }
 }
 
-BellDSP::BellDSP(std::shared_ptr<CentralAudioBuffer> buffer) {
+BellDSP::BellDSP(std::shared_ptr<CentralAudioBuffer> buffer)
+    : BellDSP(buffer, EngineConfig()){};
+
+BellDSP::BellDSP(std::shared_ptr<CentralAudioBuffer> buffer,
+                 EngineConfig engineConfig)
+    : loadMonitor(engineConfig.loadMonitor) {
   this->buffer = buffer;
+  this->engineConfig = engineConfig;
+  publishEngine(nullptr);
 };
 
+BellDSP::~BellDSP() {
+  delete pendingInstantEffect.exchange(nullptr);
+}
+
+void BellDSP::publishEngine(std::shared_ptr<AudioPipeline> pipeline) {
+  // Allocated here, on the caller's thread, and swapped in atomically
+  auto newEngine = std::make_shared<Engine>();
+  newEngine->config = engineConfig;
+  newEngine->pipeline = pipeline;
+
+  size_t planeSize = engineConfig.maxBlockFrames;
+  newEngine->planarData.assign(planeSize * engineConfig.maxChannels, 0.0f);
+  newEngine->channelData.resize(engineConfig.maxChannels);
+  for (size_t ch = 0; ch < engineConfig.maxChannels; ch++) {
+    newEngine->channelData[ch] = newEngine->planarData.data() + ch * planeSize;
+  }
+
+  if (engineConfig.fixedPoint) {
+    newEngine->fixedPlanarData.assign(planeSize * engineConfig.maxChannels, 0);
+    for (size_t ch = 0; ch < engineConfig.maxChannels; ch++) {
+      newEngine->fixedChannelData.push_back(
+          newEngine->fixedPlanarData.data() + ch * planeSize);
+    }
+  }
+
+  newEngine->requantizer.configure(engineConfig.dither,
+                                   engineConfig.maxChannels);
+  newEngine->carry.data.resize(planeSize * engineConfig.maxChannels *
+                               sizeof(int32_t));
+  newEngine->memory.resize(
+      newEngine->planarData.size() * sizeof(float) +
+      newEngine->fixedPlanarData.size() * sizeof(int32_t) +
+      newEngine->carry.data.size());
+
+  engine.publish(newEngine);
+}
+
 void BellDSP::applyPipeline(std::shared_ptr<AudioPipeline> pipeline) {
   std::scoped_lock lock(accessMutex);
-  activePipeline = pipeline;
+  publishEngine(pipeline);
+}
+
+void BellDSP::applyPipeline(std::shared_ptr<AudioPipeline> pipeline,
+                            EngineConfig engineConfig) {
+  std::scoped_lock lock(accessMutex);
+  this->engineConfig = engineConfig;
+  publishEngine(pipeline);
+}
+
+void BellDSP::setTap(TapPoint point, const Tap& tap) {
+  std::scoped_lock lock(accessMutex);
+  auto current = taps.current();
+  auto next = current != nullptr ? std::make_shared<Taps>(*current)
+                                 : std::make_shared<Taps>();
+  (point == TapPoint::PRE_DSP ? next->pre : next->post) = tap;
+  taps.publish(next->pre || next->post ? next : nullptr);
 }
 
 void BellDSP::queryInstantEffect(std::unique_ptr<AudioEffect> instantEffect) {
-  this->instantEffect = std::move(instantEffect);
-  samplesSinceInstantQueued = 0;
+  // Drop an effect that the audio thread didn't pick up yet
+  delete pendingInstantEffect.exchange(instantEffect.release());
 }
 
 size_t BellDSP::process(uint8_t* data, size_t bytes, int channels,
                         uint32_t sampleRate, BitWidth bitWidth) {
-  if (bytes > 1024 * 2 * channels) {
+  return process(data, bytes, bytes, channels, sampleRate,
+                 pcmFormatFor(bitWidth));
+}
+
+size_t BellDSP::process(uint8_t* data, size_t bytes, size_t capacity,
+                        int channels, uint32_t sampleRate, BitWidth bitWidth) {
+  return process(data, bytes, capacity, channels, sampleRate,
+                 pcmFormatFor(bitWidth));
+}
+
+size_t BELL_HOT BellDSP::process(uint8_t* data, size_t bytes, size_t capacity,
+                                 int channels, uint32_t sampleRate,
+                                 PcmFormat format) {
+  auto activeEngine = engine.read();
+  if (!activeEngine || !fitsPlanes(*activeEngine, channels)) {
     return 0;
   }
 
-  // Create a StreamInfo object to pass to the pipeline
-  auto streamInfo = std::make_unique<StreamInfo>();
-  streamInfo->numChannels = channels;
-  streamInfo->sampleRate = static_cast<bell::SampleRate>(sampleRate);
-  streamInfo->bitwidth = bitWidth;
-  streamInfo->numSamples = bytes / channels / 2;
+  takeInstantEffect();
+  auto activeTaps = taps.read();
 
-  std::scoped_lock lock(accessMutex);
+  uint64_t started = loadMonitor.begin();
+  size_t sampleSize = pcmBytesPerSample(format);
+  size_t capacitySamples = capacity / sampleSize;
+  size_t maxBlockFrames = activeEngine->config.maxBlockFrames;
+  Carry& carry = activeEngine->carry;
 
-  int16_t* data16Bit = (int16_t*)data;
+  size_t frames = bytes / channels / sampleSize;
+  if (activeTaps && activeTaps->pre) {
+    activeTaps->pre(data, frames * channels * sampleSize, channels,
+                    sampleRate, format);
+  }
+  if (carry.bytes > 0 && (carry.channels != channels ||
+                          carry.sampleRate != sampleRate ||
+                          carry.format != format)) {
+    // Left over from another stream
+    carry.bytes = 0;
+  }
+  if (carry.bytes == 0 &&
+      canBypass(*activeEngine, data, frames * channels * sampleSize, frames,
+                sampleRate)) {
+    if (activeTaps && activeTaps->post) {
+      activeTaps->post(data, frames * channels * sampleSize, channels,
+                       sampleRate, format);
+    }
+    loadMonitor.end(started, frames, sampleRate);
+    return frames * channels * sampleSize;
+  }
 
-  int length16 = bytes / 4;
+  // Positions in samples of in, output is packed at the start of data.
+  // Blocks larger than the work buffers are processed in several passes
+  uint8_t* in = data;
+  size_t end = frames * channels;
+  if (carry.bytes > 0) {
+    // Input the previous call had no room for goes first
+    carry.stash(data, end * sampleSize);
+    in = carry.data.data();
+    end = carry.bytes / sampleSize;
+  }
+  size_t readPos = 0;
+  size_t writePos = 0;
+  int outChannels = channels;
+  while (readPos < end) {
+    // Only as much input as there's room for the output of, at the rate
+    // the last block came out, the first one goes by the input's.
+    // Resamplers may round up by a frame
+    uint64_t room = (capacitySamples - writePos) / channels;
+    if (outputRate != 0 && outputRate != sampleRate) {
+      room = room * sampleRate / outputRate;
+      room = room > 0 ? room - 1 : 0;
+    }
+    size_t blockFrames = std::min(
+        {maxBlockFrames, (end - readPos) / channels, (size_t)room});
+    if (blockFrames == 0) {
+      break;
+    }
+    processBlock(*activeEngine, in + readPos * sampleSize, blockFrames,
+                 channels, sampleRate, format);
+    readPos += blockFrames * channels;
+    outputRate = (uint32_t)streamInfo.sampleRate;
 
-  for (size_t i = 0; i < length16; i++) {
-    dataLeft[i] = (data16Bit[i * 2] / (float)MAX_INT16);  // Normalize left
-    dataRight[i] =
-        (data16Bit[i * 2 + 1] / (float)MAX_INT16);  // Normalize right
+    outChannels = std::min(streamInfo.numChannels, channels);
+    if (outChannels <= 0) {
+      continue;
+    }
+    size_t outFrames = std::min(streamInfo.numSamples,
+                                (capacitySamples - writePos) / outChannels);
+    size_t outEnd = writePos + outFrames * outChannels;
+
+    // A resampling pipeline can produce more than it consumed, the unread
+    // input moves out of the way first
+    if (in == data && outEnd > readPos && readPos < end) {
+      carry.bytes = 0;
+      carry.stash(data + readPos * sampleSize, (end - readPos) * sampleSize);
+      in = carry.data.data();
+      end -= readPos;
+      readPos = 0;
+    }
+
+    writeBlock(*activeEngine, data + writePos * sampleSize, outFrames,
+               outChannels, format);
+    writePos = outEnd;
   }
-  float* sampleData[] = {&dataLeft[0], &dataRight[0]};
-  streamInfo->data = sampleData;
 
-  if (activePipeline) {
-    streamInfo = activePipeline->process(std::move(streamInfo));
+  // Input there was no room for is run on the next call, up to a call's
+  // worth so that a caller short of capacity doesn't grow it for ever
+  size_t unread = std::min((end - readPos) * sampleSize,
+                           frames * channels * sampleSize);
+  if (unread > 0 && in == carry.data.data()) {
+    std::memmove(carry.data.data(), in + readPos * sampleSize, unread);
+    carry.bytes = unread;
+  } else {
+    carry.bytes = 0;
+    carry.stash(in + readPos * sampleSize, unread);
   }
+  carry.channels = channels;
+  carry.sampleRate = sampleRate;
+  carry.format = format;
 
-  if (this->instantEffect != nullptr) {
-    this->instantEffect->apply(dataLeft.data(), length16,
-                               samplesSinceInstantQueued);
+  if (activeTaps && activeTaps->post && outChannels > 0) {
+    activeTaps->post(data, writePos * sampleSize, outChannels,
+                     (uint32_t)streamInfo.sampleRate, format);
+  }
 
-    if (streamInfo->numSamples > 1) {
-      this->instantEffect->apply(dataRight.data(), length16,
-                                 samplesSinceInstantQueued);
+  // The budget is the input's duration, whatever the pipeline made of it
+  loadMonitor.end(started, frames, sampleRate);
+  return writePos * sampleSize;
+}
+
+size_t BellDSP::process(const float* const* planes, size_t frames,
+                        int channels, uint32_t sampleRate, uint8_t* out,
+                        size_t capacity, PcmFormat format) {
+  return processPlanar(planes, frames, channels, sampleRate, out, capacity,
+                       format);
+}
+
+size_t BellDSP::process(const int32_t* const* planes, size_t frames,
+                        int channels, uint32_t sampleRate, uint8_t* out,
+                        size_t capacity, PcmFormat format) {
+  return processPlanar(planes, frames, channels, sampleRate, out, capacity,
+                       format);
+}
+
+template <typename T>
+size_t BELL_HOT BellDSP::processPlanar(const T* const* planes, size_t frames,
+                                       int channels, uint32_t sampleRate,
+                                       uint8_t* out, size_t capacity,
+                                       PcmFormat format) {
+  auto activeEngine = engine.read();
+  if (!activeEngine || !fitsPlanes(*activeEngine, channels)) {
+    return 0;
+  }
+
+  takeInstantEffect();
+  auto activeTaps = taps.read();
+
+  uint64_t started = loadMonitor.begin();
+  size_t sampleSize = pcmBytesPerSample(format);
+  size_t capacitySamples = capacity / sampleSize;
+  size_t maxBlockFrames = activeEngine->config.maxBlockFrames;
+  // Planes are always converted to the output format
+  reportPassthrough(false, frames);
+
+  // Input and output don't share a buffer, so there's nothing to move
+  size_t writePos = 0;
+  int outChannels = channels;
+  for (size_t offset = 0; offset < frames;) {
+    size_t blockFrames = std::min(maxBlockFrames, frames - offset);
+    loadBlock(*activeEngine, planes, offset, blockFrames, channels, format);
+    runBlock(*activeEngine, blockFrames, channels, sampleRate, format);
+    offset += blockFrames;
+
+    outChannels = std::min(streamInfo.numChannels, channels);
+    if (outChannels <= 0) {
+      continue;
+    }
+    size_t outFrames = std::min(streamInfo.numSamples,
+                                (capacitySamples - writePos) / outChannels);
+    writeBlock(*activeEngine, out + writePos * sampleSize, outFrames,
+               outChannels, format);
+    writePos += outFrames * outChannels;
+  }
+
+  if (activeTaps && activeTaps->post && outChannels > 0) {
+    activeTaps->post(out, writePos * sampleSize, outChannels,
+                     (uint32_t)streamInfo.sampleRate, format);
+  }
+
+  loadMonitor.end(started, frames, sampleRate);
+  return writePos * sampleSize;
+}
+
+void BellDSP::Carry::stash(const uint8_t* input, size_t length) {
+  if (bytes + length > data.size()) {
+    data.resize(bytes + length);
+  }
+  std::memcpy(data.data() + bytes, input, length);
+  bytes += length;
+}
+
+bool BellDSP::fitsPlanes(Engine& engine, int channels) {
+  if (channels <= 0 || (size_t)channels > engine.config.maxChannels) {
+    return false;
+  }
+  // An upmix writes planes past the input's, the block is dropped rather
+  // than run past the work buffers
+  return !engine.pipeline ||
+         (size_t)engine.pipeline->getMaxChannels(channels) <=
+             engine.config.maxChannels;
+}
+
+void BellDSP::takeInstantEffect() {
+  if (AudioEffect* queued = pendingInstantEffect.exchange(nullptr)) {
+    instantEffect.reset(queued);
+    samplesSinceInstantQueued = 0;
+  }
+}
+
+bool BellDSP::canBypass(const Engine& engine, const uint8_t* data,
+                        size_t bytes, size_t frames, uint32_t sampleRate) {
+  // Effects count the samples they were applied to
+  if (instantEffect != nullptr) {
+    silentFrames = 0;
+    bypassingSilence = false;
+    reportPassthrough(false, frames);
+    return false;
+  }
+
+  uint32_t bypassMs = engine.config.silenceBypassMs;
+  if (bypassMs > 0 && dsp::isSilent(data, bytes)) {
+    bool settled = silentFrames >= (uint64_t)sampleRate * bypassMs / 1000;
+    if (settled && (!engine.pipeline || engine.pipeline->keepsFormat())) {
+      bypassingSilence = true;
+      reportPassthrough(false, frames);
+      return true;
     }
+    silentFrames += frames;
+  } else {
+    silentFrames = 0;
+  }
 
-    samplesSinceInstantQueued += length16;
+  bypassingSilence = false;
+  bool passthrough = !engine.pipeline || engine.pipeline->isIdentity();
+  reportPassthrough(passthrough, frames);
+  return passthrough;
+}
 
-    if (this->instantEffect->duration <= samplesSinceInstantQueued) {
-      this->instantEffect = nullptr;
+void BellDSP::reportPassthrough(bool passthrough, size_t frames) {
+  if (passthrough != passingThrough) {
+    passingThrough = passthrough;
+    BELL_METRIC_GAUGE("dsp.passthrough", passthrough ? 1 : 0);
+  }
+  if (passthrough) {
+    BELL_METRIC_COUNT("dsp.passthrough_frames", frames);
+  }
+}
+
+bool BellDSP::useFixedPoint(const Engine& engine, PcmFormat format) const {
+  // Effects work on float samples, so they force the float path, as do
+  // float sources and sinks
+  return engine.config.fixedPoint && instantEffect == nullptr &&
+         format != PcmFormat::FLOAT32 &&
+         (!engine.pipeline || engine.pipeline->supportsFixedPoint());
+}
+
+void BellDSP::loadBlock(Engine& engine, const float* const* planes,
+                        size_t offset, size_t frames, int channels,
+                        PcmFormat format) {
+  fixedBlock = false;
+  for (int ch = 0; ch < channels; ch++) {
+    std::memcpy(engine.channelData[ch], planes[ch] + offset,
+                frames * sizeof(float));
+  }
+}
+
+void BellDSP::loadBlock(Engine& engine, const int32_t* const* planes,
+                        size_t offset, size_t frames, int channels,
+                        PcmFormat format) {
+  fixedBlock = useFixedPoint(engine, format);
+  if (fixedBlock) {
+    for (int ch = 0; ch < channels; ch++) {
+      std::memcpy(engine.fixedChannelData[ch], planes[ch] + offset,
+                  frames * sizeof(int32_t));
     }
+    return;
   }
 
-  for (size_t i = 0; i < length16; i++) {
-    if (dataLeft[i] > 1.0f) {
-      dataLeft[i] = 1.0f;
+  const float scale = 1.0f / 2147483648.0f;
+  for (int ch = 0; ch < channels; ch++) {
+    const int32_t* in = planes[ch] + offset;
+    float* plane = engine.channelData[ch];
+    for (size_t i = 0; i < frames; i++) {
+      plane[i] = in[i] * scale;
     }
+  }
+}
 
-    // Data has been downmixed to mono
-    if (streamInfo->numChannels == 1) {
-      data16Bit[i] = dataLeft[i] * MAX_INT16;  // Denormalize left
-    } else {
-      data16Bit[i * 2] = dataLeft[i] * MAX_INT16;       // Denormalize left
-      data16Bit[i * 2 + 1] = dataRight[i] * MAX_INT16;  // Denormalize right
+void BELL_HOT BellDSP::processBlock(Engine& engine, uint8_t* in,
+                                    size_t frames, int channels,
+                                    uint32_t sampleRate, PcmFormat format) {
+  fixedBlock = useFixedPoint(engine, format);
+  if (fixedBlock) {
+    dsp::deinterleave(in, format, engine.fixedChannelData.data(), channels,
+                      frames);
+  } else {
+    dsp::deinterleave(in, format, engine.channelData.data(), channels, frames);
+  }
+  runBlock(engine, frames, channels, sampleRate, format);
+}
+
+void BELL_HOT BellDSP::runBlock(Engine& engine, size_t frames, int channels,
+                                uint32_t sampleRate, PcmFormat format) {
+  BitWidth bitWidth = format == PcmFormat::INT16 ? BitWidth::BW_16
+                      : format == PcmFormat::INT24_IN_32 ? BitWidth::BW_24
+                                                         : BitWidth::BW_32;
+
+  if (fixedBlock) {
+    fixedStreamInfo.numChannels = channels;
+    fixedStreamInfo.sampleRate = static_cast<bell::SampleRate>(sampleRate);
+    fixedStreamInfo.bitwidth = bitWidth;
+    fixedStreamInfo.numSamples = frames;
+    fixedStreamInfo.data = engine.fixedChannelData.data();
+
+    if (engine.pipeline && !engine.pipeline->isIdentity()) {
+      engine.pipeline->processFixed(fixedStreamInfo);
     }
+
+    // process() sizes the output from streamInfo
+    streamInfo.numChannels = fixedStreamInfo.numChannels;
+    streamInfo.numSamples = fixedStreamInfo.numSamples;
+    streamInfo.sampleRate = fixedStreamInfo.sampleRate;
+    return;
   }
 
-  if (streamInfo->numChannels == 1) {
-    return bytes / 2;
+  // The descriptor is reused for every block, nothing is allocated here
+  streamInfo.numChannels = channels;
+  streamInfo.sampleRate = static_cast<bell::SampleRate>(sampleRate);
+  streamInfo.bitwidth = bitWidth;
+  streamInfo.numSamples = frames;
+  streamInfo.data = engine.channelData.data();
+
+  // Transforms may replace the planes, e.g. a resampler
+  if (engine.pipeline && !engine.pipeline->isIdentity()) {
+    engine.pipeline->process(streamInfo);
+  }
+}
+
+void BellDSP::writeBlock(Engine& engine, uint8_t* out, size_t frames,
+                         int channels, PcmFormat format) {
+  if (fixedBlock) {
+    engine.requantizer.interleave(fixedStreamInfo.data, format, out, channels,
+                                  frames);
+    return;
+  }
+
+  if (this->instantEffect != nullptr) {
+    for (int ch = 0; ch < channels; ch++) {
+      this->instantEffect->apply(streamInfo.data[ch], frames,
+                                 samplesSinceInstantQueued);
+    }
+
+    samplesSinceInstantQueued += frames;
+
+    if (this->instantEffect->duration <= samplesSinceInstantQueued) {
+      this->instantEffect = nullptr;
+    }
   }
 
-  return bytes;
+  engine.requantizer.interleave(streamInfo.data, format, out, channels,
+                                frames);
 }
 
 std::shared_ptr<AudioPipeline> BellDSP::getActivePipeline() {
-  return activePipeline;
+  auto current = engine.current();
+  return current ? current->pipeline : nullptr;
 }
@@ -1,6 +1,12 @@
 #include "Biquad.h"
 
-#include <cmath>  // for pow, cosf, sinf, M_PI, sqrtf, tanf, logf, sinh
+#include <algorithm>  // for copy, min, clamp
+#include <cmath>      // for pow, cosf, sinf, M_PI, sqrtf, tanf, logf, sinh
+#include <iterator>   // for begin, end
+#include <utility>    // for move
+
+#include "BellHotPath.h"  // for BELL_HOT
+#include "Denormals.h"    // for flushDenormals
 
 using namespace bell;
 
@@ -13,17 +19,127 @@ void Biquad::sampleRateChanged(uint32_t sampleRate) {
   //this->configure(this->type, this->currentConfig);
 }
 
+bool Biquad::readConfig(std::map<std::string, float>& biquadConfig,
+                        Type& type, bool skipUnchanged) {
+  this->channel = config->getChannels()[0];
+
+  float invalid = -0x7C;
+
+  auto typeName = config->getString("biquad_type");
+  float bandwidth = config->getFloat("bandwidth", false, invalid);
+  float slope = config->getFloat("slope", false, invalid);
+  float gain = config->getFloat("gain", false, invalid);
+  float frequency = config->getFloat("frequency", false, invalid);
+  float q = config->getFloat("q", false, invalid);
+
+  if (skipUnchanged && currentConfig["bandwidth"] == bandwidth &&
+      currentConfig["slope"] == slope && currentConfig["gain"] == gain &&
+      currentConfig["frequency"] == frequency && currentConfig["q"] == q) {
+    return false;
+  }
+
+  if (bandwidth != invalid)
+    biquadConfig["bandwidth"] = bandwidth;
+  if (slope != invalid)
+    biquadConfig["slope"] = slope;
+  if (gain != invalid)
+    biquadConfig["gain"] = gain;
+  if (frequency != invalid)
+    biquadConfig["freq"] = frequency;
+  if (q != invalid)
+    biquadConfig["q"] = q;
+
+  if (typeName == "free") {
+    biquadConfig["a1"] = config->getFloat("a1");
+    biquadConfig["a2"] = config->getFloat("a2");
+    biquadConfig["b0"] = config->getFloat("b0");
+    biquadConfig["b1"] = config->getFloat("b1");
+    biquadConfig["b2"] = config->getFloat("b2");
+  }
+
+  auto typeElement = strMapType.find(typeName);
+  if (typeElement == strMapType.end()) {
+    throw std::invalid_argument("No biquad of type " + typeName);
+  }
+  type = typeElement->second;
+  return true;
+}
+
+void Biquad::precomputeVolumeSteps() {
+  std::scoped_lock lock(this->accessMutex);
+  int volume = config->currentVolume;
+  // The generators work on the live set, getCoefficients() and the next
+  // reconfigure() must still see it afterwards
+  Type liveType = type;
+  float liveCoeffs[5];
+  std::copy(std::begin(coeffs), std::end(coeffs), liveCoeffs);
+  std::map<std::string, float> liveConfig = currentConfig;
+
+  // Trig and map lookups happen here once, instead of on every volume change
+  volumeSteps.clear();
+  std::map<std::string, float> previousConfig;
+  for (int step = 0; step < VOLUME_STEPS; step++) {
+    config->currentVolume = step;
+
+    std::map<std::string, float> biquadConfig;
+    Type stepType;
+    readConfig(biquadConfig, stepType, false);
+
+    if (!volumeSteps.empty() && biquadConfig == previousConfig) {
+      volumeSteps.push_back(volumeSteps.back());
+      continue;
+    }
+    calculateCoefficients(stepType, biquadConfig);
+    volumeSteps.push_back(makeCoefficients());
+    previousConfig = biquadConfig;
+  }
+
+  config->currentVolume = volume;
+  type = liveType;
+  std::copy(std::begin(liveCoeffs), std::end(liveCoeffs), coeffs);
+  currentConfig = std::move(liveConfig);
+}
+
+bool Biquad::applyVolumeStep(int volume) {
+  std::scoped_lock lock(this->accessMutex);
+  if (volumeSteps.size() != VOLUME_STEPS) {
+    return false;
+  }
+
+  auto& step = volumeSteps[std::clamp(volume, 0, VOLUME_STEPS - 1)];
+  std::copy(step->values, step->values + 5, coeffs);
+  if (activeCoeffs.current() != step) {
+    activeCoeffs.publish(step);
+  }
+  return true;
+}
+
+std::shared_ptr<Biquad::Coefficients> Biquad::makeCoefficients() {
+  auto published = std::make_shared<Coefficients>();
+  std::copy(std::begin(coeffs), std::end(coeffs), published->values);
+  published->rampSamples = rampTimeMs * sampleRate / 1000.0f;
+  return published;
+}
+
 void Biquad::configure(Type type, std::map<std::string, float>& newConf) {
+  calculateCoefficients(type, newConf);
+
+  // Hand the new set over to the audio thread
+  activeCoeffs.publish(makeCoefficients());
+}
+
+void Biquad::calculateCoefficients(Type type,
+                                   std::map<std::string, float>& newConf) {
   this->type = type;
   this->currentConfig = newConf;
 
   switch (type) {
     case Type::Free:
-      coeffs[0] = newConf["a1"];
-      coeffs[1] = newConf["a2"];
-      coeffs[2] = newConf["b0"];
-      coeffs[3] = newConf["b1"];
-      coeffs[4] = newConf["b2"];
+      coeffs[0] = newConf["b0"];
+      coeffs[1] = newConf["b1"];
+      coeffs[2] = newConf["b2"];
+      coeffs[3] = newConf["a1"];
+      coeffs[4] = newConf["a2"];
       break;
     case Type::Highpass:
       highPassCoEffs(newConf["freq"], newConf["q"]);
@@ -416,15 +532,49 @@ void Biquad::normalizeCoEffs(float a0, float a1, float a2, float b0, float b1,
   coeffs[4] = a2 / a0;
 }
 
-std::unique_ptr<StreamInfo> Biquad::process(
-    std::unique_ptr<StreamInfo> stream) {
-  std::scoped_lock lock(accessMutex);
+bool Biquad::isIdentity() {
+  auto active = activeCoeffs.read();
+  if (!active) {
+    return true;
+  }
+  const float* current = ramp.values();
+  return !ramp.isRamping() && std::equal(current, current + 5, active->values) &&
+         current[0] == 1.0f && current[1] == current[3] &&
+         current[2] == current[4];
+}
 
-  auto input = stream->data[this->channel];
-  auto numSamples = stream->numSamples;
+void BELL_HOT Biquad::process(StreamInfo& stream) {
+  auto active = activeCoeffs.read();
+  if (!active) {
+    return;
+  }
+  ramp.setTarget(active->values, active->rampSamples);
+
+  auto input = stream.data[this->channel];
+  size_t numSamples = stream.numSamples;
+  size_t done = 0;
+
+  // Walk towards the new coefficients in small steps to avoid zipper noise
+  while (ramp.isRamping() && done < numSamples) {
+    size_t steps = std::min(
+        {RAMP_BLOCK_SIZE, numSamples - done, ramp.samplesLeft()});
+    processSection(input + done, steps, ramp.values());
+    ramp.advance(steps);
+    done += steps;
+  }
+
+  if (done < numSamples) {
+    processSection(input + done, numSamples - done, ramp.values());
+  }
+  dsp::flushDenormals(w, 2);
+};
 
+void BELL_HOT Biquad::processSection(float* input, size_t numSamples,
+                                     const float* coeffs) {
 #ifdef ESP_PLATFORM
-  dsps_biquad_f32_ae32(input, input, numSamples, coeffs, w);
+  float coeffsCopy[5];
+  std::copy(coeffs, coeffs + 5, coeffsCopy);
+  dsps_biquad_f32_ae32(input, input, numSamples, coeffsCopy, w);
 #else
   // Apply the set coefficients
   for (int i = 0; i < numSamples; i++) {
@@ -434,6 +584,4 @@ std::unique_ptr<StreamInfo> Biquad::process(
     w[0] = d0;
   }
 #endif
-
-  return stream;
-};
+}
@@ -0,0 +1,213 @@
+#include "BiquadCascade.h"
+
+#include <algorithm>  // for max, equal
+
+#include "Denormals.h"  // for flushDenormals
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define BELL_CASCADE_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BELL_CASCADE_SIMD
+#endif
+
+using namespace bell;
+
+void dsp::biquadCascade(float* data, size_t samples, const float* coeffs,
+                        float* state, size_t sections) {
+  for (size_t i = 0; i < samples; i++) {
+    float x = data[i];
+    for (size_t s = 0; s < sections; s++) {
+      const float* c = coeffs + s * 5;
+      float* w = state + s * 2;
+
+      float d0 = x - c[3] * w[0] - c[4] * w[1];
+      x = c[0] * d0 + c[1] * w[0] + c[2] * w[1];
+      w[1] = w[0];
+      w[0] = d0;
+    }
+    data[i] = x;
+  }
+}
+
+BiquadCascade::BiquadCascade() {
+  this->filterType = "biquad_cascade";
+}
+
+void BiquadCascade::configure(
+    const std::map<int, std::vector<Section>>& channelSections) {
+  std::scoped_lock lock(this->accessMutex);
+
+  auto plan = std::make_shared<Plan>();
+  plan->sections = 0;
+  for (auto& [channel, sections] : channelSections) {
+    plan->sections = std::max(plan->sections, sections.size());
+  }
+
+  // Pack channels into groups of LANES
+  std::vector<const std::vector<Section>*> groupSections;
+  for (auto& [channel, sections] : channelSections) {
+    if (plan->groups.empty() || plan->groups.back().laneCount == LANES) {
+      plan->groups.push_back(LaneGroup{{-1, -1, -1, -1}, 0});
+    }
+    auto& group = plan->groups.back();
+    group.channels[group.laneCount++] = channel;
+    groupSections.push_back(&sections);
+  }
+
+  // Interleave the coefficients lane by lane, unused sections and lanes are
+  // pass-through (b0 = 1)
+  size_t groupStride = plan->sections * 5 * LANES;
+  plan->coeffs.assign(plan->groups.size() * groupStride, 0.0f);
+  for (size_t lane = 0; lane < groupSections.size(); lane++) {
+    float* groupCoeffs = plan->coeffs.data() + (lane / LANES) * groupStride;
+    for (size_t s = 0; s < plan->sections; s++) {
+      for (size_t c = 0; c < 5; c++) {
+        float value = c == 0 ? 1.0f : 0.0f;
+        if (s < groupSections[lane]->size()) {
+          value = (*groupSections[lane])[s][c];
+        }
+        groupCoeffs[(s * 5 + c) * LANES + lane % LANES] = value;
+      }
+    }
+  }
+  for (size_t lane = groupSections.size(); lane % LANES != 0; lane++) {
+    float* groupCoeffs = plan->coeffs.data() + (lane / LANES) * groupStride;
+    for (size_t s = 0; s < plan->sections; s++) {
+      groupCoeffs[s * 5 * LANES + lane % LANES] = 1.0f;
+    }
+  }
+
+  // Keep the delay lines if only coefficients changed, to avoid clicks
+  auto previous = activePlan.current();
+  size_t stateSize = plan->groups.size() * plan->sections * 2 * LANES;
+  bool sameShape = previous && previous->sections == plan->sections &&
+                   previous->groups.size() == plan->groups.size() &&
+                   std::equal(previous->groups.begin(), previous->groups.end(),
+                              plan->groups.begin(),
+                              [](const LaneGroup& a, const LaneGroup& b) {
+                                return std::equal(a.channels,
+                                                  a.channels + LANES,
+                                                  b.channels);
+                              });
+  if (sameShape) {
+    plan->state = previous->state;
+  } else {
+    plan->state = std::make_shared<std::vector<float>>(stateSize, 0.0f);
+  }
+
+  activePlan.publish(plan);
+}
+
+std::vector<int> BiquadCascade::getChannels() {
+  std::vector<int> channels;
+  auto plan = activePlan.current();
+  if (plan) {
+    for (auto& group : plan->groups) {
+      channels.insert(channels.end(), group.channels,
+                      group.channels + group.laneCount);
+    }
+  }
+  return channels;
+}
+
+void BiquadCascade::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan || plan->sections == 0) {
+    return;
+  }
+
+  size_t coeffStride = plan->sections * 5 * LANES;
+  size_t stateStride = plan->sections * 2 * LANES;
+  for (size_t g = 0; g < plan->groups.size(); g++) {
+    processGroup(data, plan->groups[g], plan->coeffs.data() + g * coeffStride,
+                 plan->state->data() + g * stateStride, plan->sections);
+  }
+  dsp::flushDenormals(plan->state->data(), plan->state->size());
+}
+
+#ifdef BELL_CASCADE_SIMD
+#if defined(__SSE__)
+typedef __m128 vec4;
+#define vload(p) _mm_loadu_ps(p)
+#define vstore(p, v) _mm_storeu_ps(p, v)
+#define vmul(a, b) _mm_mul_ps(a, b)
+#define vadd(a, b) _mm_add_ps(a, b)
+#define vsub(a, b) _mm_sub_ps(a, b)
+#else
+typedef float32x4_t vec4;
+#define vload(p) vld1q_f32(p)
+#define vstore(p, v) vst1q_f32(p, v)
+#define vmul(a, b) vmulq_f32(a, b)
+#define vadd(a, b) vaddq_f32(a, b)
+#define vsub(a, b) vsubq_f32(a, b)
+#endif
+
+void BiquadCascade::processGroup(StreamInfo& data, const LaneGroup& group,
+                                 const float* coeffs, float* state,
+                                 size_t sections) {
+  float* input[LANES] = {nullptr};
+  for (size_t lane = 0; lane < group.laneCount; lane++) {
+    if (group.channels[lane] < data.numChannels) {
+      input[lane] = data.data[group.channels[lane]];
+    }
+  }
+
+  // One register holds the same sample of every lane
+  alignas(16) float frame[LANES] = {0.0f};
+  for (size_t i = 0; i < data.numSamples; i++) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      frame[lane] = input[lane] ? input[lane][i] : 0.0f;
+    }
+
+    vec4 x = vload(frame);
+    for (size_t s = 0; s < sections; s++) {
+      const float* c = coeffs + s * 5 * LANES;
+      float* w = state + s * 2 * LANES;
+
+      vec4 w0 = vload(w);
+      vec4 w1 = vload(w + LANES);
+      vec4 d0 = vsub(vsub(x, vmul(vload(c + 3 * LANES), w0)),
+                     vmul(vload(c + 4 * LANES), w1));
+      x = vadd(vadd(vmul(vload(c), d0), vmul(vload(c + LANES), w0)),
+               vmul(vload(c + 2 * LANES), w1));
+      vstore(w + LANES, w0);
+      vstore(w, d0);
+    }
+
+    vstore(frame, x);
+    for (size_t lane = 0; lane < LANES; lane++) {
+      if (input[lane]) {
+        input[lane][i] = frame[lane];
+      }
+    }
+  }
+}
+#else
+// No vector unit, run every lane as its own fused cascade
+void BiquadCascade::processGroup(StreamInfo& data, const LaneGroup& group,
+                                 const float* coeffs, float* state,
+                                 size_t sections) {
+  for (size_t lane = 0; lane < group.laneCount; lane++) {
+    if (group.channels[lane] >= data.numChannels) {
+      continue;
+    }
+
+    float* input = data.data[group.channels[lane]];
+    for (size_t i = 0; i < data.numSamples; i++) {
+      float x = input[i];
+      for (size_t s = 0; s < sections; s++) {
+        const float* c = coeffs + s * 5 * LANES + lane;
+        float* w = state + s * 2 * LANES + lane;
+
+        float d0 = x - c[3 * LANES] * w[0] - c[4 * LANES] * w[LANES];
+        x = c[0] * d0 + c[LANES] * w[0] + c[2 * LANES] * w[LANES];
+        w[LANES] = w[0];
+        w[0] = d0;
+      }
+      input[i] = x;
+    }
+  }
+}
+#endif
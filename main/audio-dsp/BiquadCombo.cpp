@@ -4,14 +4,14 @@
 #include <cmath>    // for sinf, M_PI
 #include <utility>  // for move
 
+#include "Denormals.h"  // for flushDenormals
+
 using namespace bell;
 
 BiquadCombo::BiquadCombo() {}
 
 void BiquadCombo::sampleRateChanged(uint32_t sampleRate) {
-  for (auto& biquad : biquads) {
-    biquad->sampleRateChanged(sampleRate);
-  }
+  this->sampleRate = sampleRate;
 }
 
 std::vector<float> BiquadCombo::calculateBWQ(int order) {
@@ -46,15 +46,31 @@ std::vector<float> BiquadCombo::calculateLRQ(int order) {
 }
 
 void BiquadCombo::butterworth(float freq, int order, FilterType type) {
-  std::vector<float> qValues = calculateBWQ(order);
-  for (auto& q : qValues) {}
+  addFilters(freq, calculateBWQ(order), type);
 }
 
 void BiquadCombo::linkwitzRiley(float freq, int order, FilterType type) {
-  std::vector<float> qValues = calculateLRQ(order);
+  addFilters(freq, calculateLRQ(order), type);
+}
+
+void BiquadCombo::configure(int channel, bool linkwitzRiley, FilterType type,
+                            float freq, int order) {
+  this->channel = channel;
+  this->biquads = std::vector<std::unique_ptr<bell::Biquad>>();
+  if (linkwitzRiley) {
+    this->linkwitzRiley(freq, order, type);
+  } else {
+    this->butterworth(freq, order, type);
+  }
+  publishChain();
+}
+
+void BiquadCombo::addFilters(float freq, const std::vector<float>& qValues,
+                             FilterType type) {
   for (auto& q : qValues) {
     auto filter = std::make_unique<Biquad>();
     filter->channel = channel;
+    filter->sampleRateChanged(sampleRate);
 
     auto config = std::map<std::string, float>();
     config["freq"] = freq;
@@ -78,12 +94,28 @@ void BiquadCombo::linkwitzRiley(float freq, int order, FilterType type) {
   }
 }
 
-std::unique_ptr<StreamInfo> BiquadCombo::process(
-    std::unique_ptr<StreamInfo> data) {
-  std::scoped_lock lock(this->accessMutex);
-  for (auto& transform : this->biquads) {
-    data = transform->process(std::move(data));
+void BiquadCombo::publishChain() {
+  auto chain = std::make_shared<Chain>();
+  chain->channel = channel;
+  chain->sections = biquads.size();
+  for (auto& biquad : biquads) {
+    const float* coeffs = biquad->getCoefficients();
+    chain->coeffs.insert(chain->coeffs.end(), coeffs, coeffs + 5);
   }
+  chain->state.assign(chain->sections * 2, 0.0f);
+
+  activeChain.publish(chain);
+}
 
-  return data;
-}
\ No newline at end of file
+void BiquadCombo::process(StreamInfo& data) {
+  auto chain = activeChain.read();
+  if (!chain || chain->channel >= data.numChannels) {
+    return;
+  }
+
+  // All sections in a single pass over the channel
+  dsp::biquadCascade(data.data[chain->channel], data.numSamples,
+                     chain->coeffs.data(), chain->state.data(),
+                     chain->sections);
+  dsp::flushDenormals(chain->state.data(), chain->state.size());
+}
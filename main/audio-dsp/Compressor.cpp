@@ -1,6 +1,7 @@
 #include "Compressor.h"
 
-#include <cstdlib>  // for abs
+#include <algorithm>  // for max, min
+#include <cmath>      // for abs, floorf, ldexpf
 
 using namespace bell;
 
@@ -19,72 +20,122 @@ float log2f_approx(float X) {
   return (Y);
 }
 
-Compressor::Compressor() {}
-
-void Compressor::sumChannels(std::unique_ptr<StreamInfo>& data) {
-  tmp.resize(data->numSamples);
-  for (int i = 0; i < data->numSamples; i++) {
-    float sum = 0.0f;
-    for (auto& channel : channels) {
-      sum += data->data[channel][i];
-    }
-    tmp[i] = sum;
-  }
-}
-
-void Compressor::calLoudness() {
-  for (auto& value : tmp) {
-    value = 20 * log10f_fast(std::abs(value) + 1.0e-9f);
-    if (value >= lastLoudness) {
-      value = attack * lastLoudness + (1.0 - attack) * value;
-    } else {
-      value = release * lastLoudness + (1.0 - release) * value;
-    }
-
-    lastLoudness = value;
-  }
+float exp2f_approx(float X) {
+  float E = floorf(X);
+  float F = X - E;
+  float Y = 0.07944023841053369f;
+  Y *= F;
+  Y += 0.224494337302845f;
+  Y *= F;
+  Y += 0.6960656421638072f;
+  Y *= F;
+  Y += 1.0f;
+  return ldexpf(Y, (int)E);
 }
 
-void Compressor::calGain() {
-  for (auto& value : tmp) {
-    if (value > threshold) {
-      value = -(value - threshold) * (factor - 1.0) / factor;
-    } else {
-      value = 0.0f;
-    }
+// 20 * log10(x) = 20 * log10(2) * log2(x)
+static constexpr float DB_PER_LOG2 = 6.020599913279624f;
 
-    value += makeupGain;
+Compressor::Compressor() {}
 
-    // convert to linear
-    value = pow10f(value / 20.0f);
+void Compressor::delaySamples(StreamInfo& data, const Params& params,
+                              size_t offset, size_t samples) {
+  auto& delay = *params.delay;
+  if (delay.length == 0) {
+    return;
   }
-}
 
-void Compressor::applyGain(std::unique_ptr<StreamInfo>& data) {
-  for (int i = 0; i < data->numSamples; i++) {
-    for (auto& channel : channels) {
-      data->data[channel][i] *= tmp[i];
+  // Swap the block with the delay line, channel by channel
+  for (size_t c = 0; c < params.channels.size(); c++) {
+    float* line = delay.samples.data() + c * delay.length;
+    float* input = data.data[params.channels[c]] + offset;
+    size_t position = delay.position;
+    for (size_t i = 0; i < samples; i++) {
+      float delayed = line[position];
+      line[position] = input[i];
+      input[i] = delayed;
+      if (++position == delay.length) {
+        position = 0;
+      }
     }
   }
+  delay.position = (delay.position + samples) % delay.length;
 }
 
 void Compressor::configure(std::vector<int> channels, float attack,
                            float release, float threshold, float factor,
-                           float makeupGain) {
+                           float makeupGain, float lookahead) {
   this->channels = channels;
-  this->attack = expf(-1000.0 / this->sampleRate / attack);
-  this->release = expf(-1000.0 / this->sampleRate / release);
+
+  // Time constants are per envelope block, not per sample
+  float blockRate = this->sampleRate / ENVELOPE_BLOCK;
+  this->attack = expf(-1000.0 / blockRate / attack);
+  this->release = expf(-1000.0 / blockRate / release);
   this->threshold = threshold;
   this->factor = factor;
   this->makeupGain = makeupGain;
+
+  auto params = std::make_shared<Params>(
+      Params{this->channels, this->attack, this->release, this->threshold,
+             (this->factor - 1.0f) / this->factor, this->makeupGain, nullptr});
+
+  // Keep the delay line contents if its shape stays the same
+  size_t delayLength = lookahead * this->sampleRate / 1000.0f;
+  auto previous = activeParams.current();
+  if (previous && previous->channels == channels &&
+      previous->delay->length == delayLength) {
+    params->delay = previous->delay;
+  } else {
+    params->delay = std::make_shared<DelayLine>();
+    params->delay->length = delayLength;
+    params->delay->samples.assign(delayLength * channels.size(), 0.0f);
+  }
+
+  activeParams.publish(params);
 }
 
-std::unique_ptr<StreamInfo> Compressor::process(
-    std::unique_ptr<StreamInfo> data) {
-  std::scoped_lock lock(this->accessMutex);
-  sumChannels(data);
-  calLoudness();
-  calGain();
-  applyGain(data);
-  return data;
+void Compressor::process(StreamInfo& data) {
+  auto params = activeParams.read();
+  if (!params || params->channels.empty()) {
+    return;
+  }
+
+  for (size_t offset = 0; offset < data.numSamples; offset += ENVELOPE_BLOCK) {
+    size_t samples = std::min(ENVELOPE_BLOCK, data.numSamples - offset);
+
+    // Peak of the summed channels, taken before the delay
+    float peak = 0.0f;
+    for (size_t i = offset; i < offset + samples; i++) {
+      float sum = 0.0f;
+      for (auto& channel : params->channels) {
+        sum += data.data[channel][i];
+      }
+      peak = std::max(peak, std::abs(sum));
+    }
+
+    float loudness = DB_PER_LOG2 * log2f_approx(peak + 1.0e-9f);
+    float coeff = loudness >= lastLoudness ? params->attack : params->release;
+    loudness = coeff * lastLoudness + (1.0f - coeff) * loudness;
+    lastLoudness = loudness;
+
+    float gainDb = params->makeupGain;
+    if (loudness > params->threshold) {
+      gainDb -= (loudness - params->threshold) * params->slope;
+    }
+    float gain = exp2f_approx(gainDb / DB_PER_LOG2);
+
+    delaySamples(data, *params, offset, samples);
+
+    // Interpolate from the previous block's gain
+    float step = (gain - lastGain) / samples;
+    for (auto& channel : params->channels) {
+      float* output = data.data[channel] + offset;
+      float current = lastGain;
+      for (size_t i = 0; i < samples; i++) {
+        current += step;
+        output[i] *= current;
+      }
+    }
+    lastGain = gain;
+  }
 }
@@ -0,0 +1,344 @@
+#include "Crossfader.h"
+
+#include <string.h>   // for memmove, memset
+#include <algorithm>  // for min
+
+#include "SampleConversion.h"  // for deinterleave, interleave
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace bell;
+
+static constexpr float HALF_PI = 1.57079632679f;
+
+// Odd polynomial of sin(x) over [0, pi/2], within 2e-4 of it
+static constexpr float SIN_C3 = -1.0f / 6.0f;
+static constexpr float SIN_C5 = 1.0f / 120.0f;
+static constexpr float SIN_C7 = -1.0f / 5040.0f;
+
+static inline float sinQuarter(float x) {
+  float x2 = x * x;
+  return x * (1.0f + x2 * (SIN_C3 + x2 * (SIN_C5 + x2 * SIN_C7)));
+}
+
+void dsp::equalPowerCurve(float* fadeOut, float* fadeIn, size_t position,
+                          size_t frames, size_t length) {
+  float step = HALF_PI / (float)std::max<size_t>(length, 1);
+  size_t i = 0;
+#if defined(__SSE__)
+  const __m128 c3 = _mm_set1_ps(SIN_C3);
+  const __m128 c5 = _mm_set1_ps(SIN_C5);
+  const __m128 c7 = _mm_set1_ps(SIN_C7);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 halfPi = _mm_set1_ps(HALF_PI);
+  auto sin4 = [&](__m128 x) {
+    __m128 x2 = _mm_mul_ps(x, x);
+    __m128 p = _mm_add_ps(c5, _mm_mul_ps(x2, c7));
+    p = _mm_add_ps(c3, _mm_mul_ps(x2, p));
+    p = _mm_add_ps(one, _mm_mul_ps(x2, p));
+    return _mm_mul_ps(x, p);
+  };
+  for (; i + 4 <= frames && position + i + 4 <= length; i += 4) {
+    float base = (float)(position + i);
+    __m128 x = _mm_mul_ps(
+        _mm_add_ps(_mm_set1_ps(base), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)),
+        _mm_set1_ps(step));
+    _mm_storeu_ps(fadeIn + i, sin4(x));
+    _mm_storeu_ps(fadeOut + i, sin4(_mm_sub_ps(halfPi, x)));
+  }
+#elif defined(__ARM_NEON)
+  const float32x4_t halfPi = vdupq_n_f32(HALF_PI);
+  const float32x4_t offsets = {0.0f, 1.0f, 2.0f, 3.0f};
+  auto sin4 = [](float32x4_t x) {
+    float32x4_t x2 = vmulq_f32(x, x);
+    float32x4_t p = vmlaq_n_f32(vdupq_n_f32(SIN_C5), x2, SIN_C7);
+    p = vmlaq_f32(vdupq_n_f32(SIN_C3), x2, p);
+    p = vmlaq_f32(vdupq_n_f32(1.0f), x2, p);
+    return vmulq_f32(x, p);
+  };
+  for (; i + 4 <= frames && position + i + 4 <= length; i += 4) {
+    float base = (float)(position + i);
+    float32x4_t x = vmulq_n_f32(vaddq_f32(vdupq_n_f32(base), offsets), step);
+    vst1q_f32(fadeIn + i, sin4(x));
+    vst1q_f32(fadeOut + i, sin4(vsubq_f32(halfPi, x)));
+  }
+#endif
+
+  // Past the end of the fade only the incoming track is left
+  for (; i < frames; i++) {
+    if (position + i >= length) {
+      fadeOut[i] = 0.0f;
+      fadeIn[i] = 1.0f;
+      continue;
+    }
+    float x = (position + i) * step;
+    fadeIn[i] = sinQuarter(x);
+    fadeOut[i] = sinQuarter(HALF_PI - x);
+  }
+}
+
+void dsp::crossfadeMix(const float* out, const float* in, const float* fadeOut,
+                       const float* fadeIn, float* dst, size_t frames) {
+  size_t i = 0;
+#if defined(__SSE__)
+  for (; i + 4 <= frames; i += 4) {
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(fadeOut + i));
+    __m128 b = _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(fadeIn + i));
+    _mm_storeu_ps(dst + i, _mm_add_ps(a, b));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 4 <= frames; i += 4) {
+    float32x4_t a = vmulq_f32(vld1q_f32(out + i), vld1q_f32(fadeOut + i));
+    vst1q_f32(dst + i, vmlaq_f32(a, vld1q_f32(in + i), vld1q_f32(fadeIn + i)));
+  }
+#endif
+  for (; i < frames; i++) {
+    dst[i] = out[i] * fadeOut[i] + in[i] * fadeIn[i];
+  }
+}
+
+Crossfader::Crossfader(std::shared_ptr<CentralAudioBuffer> buffer,
+                       size_t maxChannels, size_t stagingFrames)
+    : buffer(buffer), maxChannels(maxChannels), stagingFrames(stagingFrames) {
+  // Everything is allocated here, fades only move data around
+  for (auto& side : staging) {
+    side.planar.assign(maxChannels * stagingFrames, 0.0f);
+    for (size_t ch = 0; ch < maxChannels; ch++) {
+      side.planes.push_back(side.planar.data() + ch * stagingFrames);
+    }
+  }
+  mixPlanar.assign(maxChannels * stagingFrames, 0.0f);
+  for (size_t ch = 0; ch < maxChannels; ch++) {
+    mixPlanes.push_back(mixPlanar.data() + ch * stagingFrames);
+  }
+  gains[OUTGOING].assign(stagingFrames, 0.0f);
+  gains[INCOMING].assign(stagingFrames, 0.0f);
+  stagePlanes.resize(maxChannels);
+
+  // A mix and the incoming track's staged frames at the end of the fade
+  pending.reserve(2 * stagingFrames * maxChannels * sizeof(float));
+}
+
+void Crossfader::setDuration(uint32_t durationMs) {
+  std::scoped_lock lock(fadeMutex);
+  this->durationMs = durationMs;
+}
+
+void Crossfader::startFade(size_t outHash, size_t inHash) {
+  std::scoped_lock lock(fadeMutex);
+  for (auto& side : staging) {
+    side.formatKnown = false;
+    side.ended = false;
+    side.frames = 0;
+  }
+  staging[OUTGOING].hash = outHash;
+  staging[INCOMING].hash = inHash;
+  fading = durationMs > 0 && outHash != inHash;
+  backToBack = false;
+  fadeLength = 0;
+  fadePosition = 0;
+  finishedHash = 0;
+}
+
+void Crossfader::endTrack(size_t hash) {
+  std::scoped_lock lock(fadeMutex);
+  if (fading && hash == staging[OUTGOING].hash) {
+    staging[OUTGOING].ended = true;
+    if (backToBack || !staging[INCOMING].formatKnown) {
+      // Nothing to mix with, the next track just follows
+      finishFade();
+    }
+  } else if (hash == finishedHash) {
+    finishedHash = 0;
+  }
+}
+
+bool Crossfader::isFading() {
+  std::scoped_lock lock(fadeMutex);
+  return fading;
+}
+
+size_t Crossfader::write(const uint8_t* data, size_t dataSize, size_t hash,
+                         uint32_t sampleRate, uint8_t channels,
+                         PcmFormat format) {
+  std::scoped_lock lock(fadeMutex);
+
+  // The buffer refused part of the last mix
+  if (!flushPending()) {
+    return 0;
+  }
+
+  Staging* side = nullptr;
+  if (fading && hash == staging[OUTGOING].hash) {
+    side = &staging[OUTGOING];
+  } else if (fading && hash == staging[INCOMING].hash) {
+    side = &staging[INCOMING];
+  }
+
+  if (side == nullptr) {
+    if (hash == finishedHash) {
+      // Tail of a track that already faded out
+      return dataSize;
+    }
+    return buffer->writePCM(data, dataSize, hash, sampleRate, channels,
+                            format);
+  }
+
+  if (!side->formatKnown) {
+    side->sampleRate = sampleRate;
+    side->channels = channels;
+    side->format = format;
+    side->formatKnown = true;
+
+    if (side == &staging[INCOMING]) {
+      backToBack = !compatible();
+      fadeLength = (uint64_t)durationMs * sampleRate / 1000;
+    }
+  }
+
+  Staging& incoming = staging[INCOMING];
+  if (side == &staging[OUTGOING] && (!incoming.formatKnown || backToBack)) {
+    // The fade starts with the first frames of the next track
+    return buffer->writePCM(data, dataSize, hash, sampleRate, channels,
+                            format);
+  }
+  if (side == &incoming && backToBack) {
+    // Waits for the outgoing track to end
+    return 0;
+  }
+
+  // Mixing first frees staging space for this write
+  while (mix()) {
+  }
+  size_t taken = stage(*side, data, dataSize);
+  while (mix()) {
+  }
+  return taken;
+}
+
+bool Crossfader::compatible() {
+  Staging& outgoing = staging[OUTGOING];
+  Staging& incoming = staging[INCOMING];
+  return outgoing.formatKnown && outgoing.sampleRate == incoming.sampleRate &&
+         outgoing.channels == incoming.channels &&
+         incoming.channels <= maxChannels && incoming.channels > 0;
+}
+
+size_t Crossfader::stage(Staging& side, const uint8_t* data, size_t dataSize) {
+  size_t frameSize = pcmBytesPerSample(side.format) * side.channels;
+  size_t frames = std::min(dataSize / frameSize, stagingFrames - side.frames);
+  if (frames == 0) {
+    // Either full, or not even a whole frame
+    return dataSize < frameSize ? dataSize : 0;
+  }
+
+  for (size_t ch = 0; ch < side.channels; ch++) {
+    stagePlanes[ch] = side.planes[ch] + side.frames;
+  }
+  dsp::deinterleave(data, side.format, stagePlanes.data(), side.channels,
+                    frames);
+  side.frames += frames;
+  return frames * frameSize;
+}
+
+bool Crossfader::mix() {
+  if (!fading || !pending.empty()) {
+    return false;
+  }
+
+  Staging& outgoing = staging[OUTGOING];
+  Staging& incoming = staging[INCOMING];
+  size_t frames = incoming.frames;
+  if (!outgoing.ended) {
+    frames = std::min(frames, outgoing.frames);
+  }
+  frames = std::min(frames, fadeLength - fadePosition);
+  if (frames == 0) {
+    if (fadePosition >= fadeLength) {
+      finishFade();
+    }
+    return false;
+  }
+
+  // A track that ended fades out from silence
+  for (size_t ch = 0; ch < outgoing.channels; ch++) {
+    if (outgoing.frames < frames) {
+      memset(outgoing.planes[ch] + outgoing.frames, 0,
+             (frames - outgoing.frames) * sizeof(float));
+    }
+  }
+
+  dsp::equalPowerCurve(gains[OUTGOING].data(), gains[INCOMING].data(),
+                       fadePosition, frames, fadeLength);
+  for (size_t ch = 0; ch < incoming.channels; ch++) {
+    dsp::crossfadeMix(outgoing.planes[ch], incoming.planes[ch],
+                      gains[OUTGOING].data(), gains[INCOMING].data(),
+                      mixPlanes[ch], frames);
+  }
+  fadePosition += frames;
+  appendPending(mixPlanes.data(), frames);
+
+  consume(outgoing, std::min(frames, outgoing.frames));
+  consume(incoming, frames);
+
+  if (fadePosition >= fadeLength) {
+    finishFade();
+  }
+  flushPending();
+  return true;
+}
+
+void Crossfader::consume(Staging& side, size_t frames) {
+  size_t left = side.frames - frames;
+  for (size_t ch = 0; ch < side.channels; ch++) {
+    memmove(side.planes[ch], side.planes[ch] + frames, left * sizeof(float));
+  }
+  side.frames = left;
+}
+
+void Crossfader::appendPending(float* const* planes, size_t frames) {
+  Staging& incoming = staging[INCOMING];
+  size_t start = pending.size();
+  pending.resize(start + frames * incoming.channels *
+                             pcmBytesPerSample(incoming.format));
+  dsp::interleave(planes, incoming.format, pending.data() + start,
+                  incoming.channels, frames);
+  pendingHash = incoming.hash;
+  pendingRate = incoming.sampleRate;
+  pendingChannels = incoming.channels;
+  pendingFormat = incoming.format;
+}
+
+void Crossfader::finishFade() {
+  Staging& incoming = staging[INCOMING];
+  if (incoming.frames > 0) {
+    // Staged frames behind the fade play at full level
+    appendPending(incoming.planes.data(), incoming.frames);
+    incoming.frames = 0;
+  }
+
+  finishedHash = staging[OUTGOING].hash;
+  staging[OUTGOING].frames = 0;
+  fading = false;
+}
+
+bool Crossfader::flushPending() {
+  while (pendingPos < pending.size()) {
+    size_t written =
+        buffer->writePCM(pending.data() + pendingPos,
+                         pending.size() - pendingPos, pendingHash, pendingRate,
+                         pendingChannels, pendingFormat);
+    if (written == 0) {
+      return false;
+    }
+    pendingPos += written;
+  }
+
+  pending.clear();
+  pendingPos = 0;
+  return true;
+}
@@ -0,0 +1,446 @@
+#include "DSPGraph.h"
+
+#include <string.h>   // for strcmp
+#include <algorithm>  // for clamp, min
+#include <cmath>      // for lround
+#include <map>        // for map
+#include <stdexcept>  // for invalid_argument
+#include <utility>    // for pair
+
+#include "AudioPipeline.h"       // for AudioPipeline
+#include "AudioTransform.h"      // for AudioTransform
+#include "Compressor.h"          // for Compressor
+#include "FirConvolver.h"        // for FirConvolver
+#include "Gain.h"                // for Gain
+#include "LoudnessContour.h"     // for LoudnessContour
+#include "LoudnessNormalizer.h"  // for LoudnessNormalizer
+
+using namespace bell;
+
+DSPGraph::Param DSPGraph::addValues(cJSON* object, const char* field,
+                                    bool isRequired) {
+  Param param = {(uint32_t)values.size(), 0};
+  cJSON* value = cJSON_GetObjectItem(object, field);
+  if (value != NULL && cJSON_IsNumber(value)) {
+    values.push_back(value->valuedouble);
+  } else if (value != NULL && cJSON_IsArray(value)) {
+    cJSON* item;
+    cJSON_ArrayForEach(item, value) {
+      if (cJSON_IsNumber(item)) {
+        values.push_back(item->valuedouble);
+      }
+    }
+  }
+  param.count = values.size() - param.first;
+
+  if (param.count == 0 && isRequired) {
+    throw std::invalid_argument(std::string("Field ") + field +
+                                " is required");
+  }
+  return param;
+}
+
+DSPGraph::Param DSPGraph::addParam(cJSON* object, const char* field,
+                                   bool isRequired) {
+  Param param = addValues(object, field, isRequired);
+  nodeDependsOnVolume |= param.count > 1;
+  return param;
+}
+
+float DSPGraph::resolve(const Param& param, int volume,
+                        float defaultValue) const {
+  if (param.count == 0) {
+    return defaultValue;
+  }
+  // Same spread over the volume range as TransformConfig::getRawValue
+  size_t index = std::clamp(volume, 0, 100) * param.count / 100;
+  return values[param.first + std::min<size_t>(index, param.count - 1)];
+}
+
+std::vector<int> DSPGraph::channelsOf(const Node& node) const {
+  return std::vector<int>(
+      channels.begin() + node.channels.first,
+      channels.begin() + node.channels.first + node.channels.count);
+}
+
+void DSPGraph::compile(const std::string& json) {
+  cJSON* root = cJSON_Parse(json.c_str());
+  if (root == NULL) {
+    throw std::invalid_argument("Invalid DSP description");
+  }
+  try {
+    compile(root);
+  } catch (...) {
+    cJSON_Delete(root);
+    throw;
+  }
+  cJSON_Delete(root);
+}
+
+void DSPGraph::compile(cJSON* json) {
+  if (json == NULL || !cJSON_IsArray(json)) {
+    throw std::invalid_argument("DSP description must be an array");
+  }
+
+  nodes.clear();
+  values.clear();
+  channels.clear();
+  transforms.clear();
+
+  cJSON* object;
+  cJSON_ArrayForEach(object, json) {
+    cJSON* typeItem = cJSON_GetObjectItem(object, "type");
+    if (typeItem == NULL || !cJSON_IsString(typeItem)) {
+      throw std::invalid_argument("Field type is required");
+    }
+    std::string type = typeItem->valuestring;
+    nodeDependsOnVolume = false;
+
+    // "channel" or "channels", like TransformConfig::getChannels()
+    std::vector<int> nodeChannels;
+    cJSON* channelItem = cJSON_GetObjectItem(object, "channel");
+    if (channelItem != NULL && cJSON_IsNumber(channelItem)) {
+      nodeChannels.push_back(channelItem->valueint);
+    } else {
+      cJSON* item;
+      cJSON_ArrayForEach(item, cJSON_GetObjectItem(object, "channels")) {
+        if (cJSON_IsNumber(item)) {
+          nodeChannels.push_back(item->valueint);
+        }
+      }
+    }
+
+    auto addNode = [&](const std::vector<int>& list, NodeParams params) {
+      Node node = {{(uint32_t)channels.size(), (uint32_t)list.size()},
+                   params,
+                   nodeDependsOnVolume};
+      channels.insert(channels.end(), list.begin(), list.end());
+      nodes.push_back(node);
+    };
+    auto requireChannels = [&]() {
+      if (nodeChannels.empty()) {
+        throw std::invalid_argument("Field channels is required");
+      }
+    };
+
+    if (type == "gain") {
+      addNode(nodeChannels, GainNode{addParam(object, "gain", true)});
+    } else if (type == "biquad") {
+      requireChannels();
+      cJSON* name = cJSON_GetObjectItem(object, "biquad_type");
+      auto biquadType = Biquad::strMapType.end();
+      if (name != NULL && cJSON_IsString(name)) {
+        biquadType = Biquad::strMapType.find(name->valuestring);
+      }
+      if (biquadType == Biquad::strMapType.end()) {
+        throw std::invalid_argument(
+            std::string("No biquad of type ") +
+            (name != NULL && cJSON_IsString(name) ? name->valuestring : ""));
+      }
+
+      BiquadNode biquad = {};
+      biquad.type = biquadType->second;
+      biquad.frequency = addParam(object, "frequency", false);
+      biquad.q = addParam(object, "q", false);
+      biquad.gain = addParam(object, "gain", false);
+      biquad.bandwidth = addParam(object, "bandwidth", false);
+      biquad.slope = addParam(object, "slope", false);
+      if (biquad.type == Biquad::Type::Free) {
+        const char* names[5] = {"b0", "b1", "b2", "a1", "a2"};
+        for (int i = 0; i < 5; i++) {
+          biquad.coeffs[i] = addParam(object, names[i], true);
+        }
+      }
+      // A Biquad filters one channel
+      for (int channel : nodeChannels) {
+        addNode({channel}, biquad);
+      }
+    } else if (type == "biquad_combo") {
+      requireChannels();
+      cJSON* name = cJSON_GetObjectItem(object, "combo_type");
+      std::string comboType =
+          name != NULL && cJSON_IsString(name) ? name->valuestring : "";
+      if (comboType != "lr_lowpass" && comboType != "lr_highpass" &&
+          comboType != "bw_lowpass" && comboType != "bw_highpass") {
+        throw std::invalid_argument("Invalid combo filter type");
+      }
+
+      BiquadComboNode combo = {};
+      combo.linkwitzRiley = comboType[0] == 'l';
+      combo.type = comboType.compare(3, 4, "high") == 0
+                       ? BiquadCombo::FilterType::Highpass
+                       : BiquadCombo::FilterType::Lowpass;
+      combo.frequency = addParam(object, "frequency", true);
+      combo.order = addParam(object, "order", true);
+      addNode({nodeChannels[0]}, combo);
+    } else if (type == "compressor") {
+      CompressorNode compressor = {};
+      compressor.attack = addParam(object, "attack", true);
+      compressor.release = addParam(object, "release", true);
+      compressor.threshold = addParam(object, "threshold", true);
+      compressor.factor = addParam(object, "factor", true);
+      compressor.makeupGain = addParam(object, "makeup_gain", true);
+      compressor.lookahead = addParam(object, "lookahead", false);
+      addNode(nodeChannels, compressor);
+    } else if (type == "multiband_compressor") {
+      requireChannels();
+      MultibandNode multiband = {};
+      multiband.crossovers = addValues(object, "crossovers", true);
+      cJSON* bands = cJSON_GetObjectItem(object, "bands");
+      size_t bandCount = bands != NULL && cJSON_IsArray(bands)
+                             ? cJSON_GetArraySize(bands)
+                             : 0;
+      if (bandCount != multiband.crossovers.count + 1 ||
+          bandCount > MultibandCompressor::MAX_BANDS) {
+        throw std::invalid_argument(
+            "Field bands needs one band more than the crossovers, up to " +
+            std::to_string(MultibandCompressor::MAX_BANDS));
+      }
+      multiband.bandCount = bandCount;
+      for (size_t i = 0; i < bandCount; i++) {
+        cJSON* band = cJSON_GetArrayItem(bands, i);
+        auto& compressor = multiband.bands[i];
+        compressor.attack = addParam(band, "attack", true);
+        compressor.release = addParam(band, "release", true);
+        compressor.threshold = addParam(band, "threshold", true);
+        compressor.factor = addParam(band, "factor", true);
+        compressor.makeupGain = addParam(band, "makeup_gain", false);
+      }
+      addNode(nodeChannels, multiband);
+    } else if (type == "loudness") {
+      LoudnessNode loudness = {};
+      loudness.target = addParam(object, "target", false);
+      loudness.maxGain = addParam(object, "max_gain", false);
+      cJSON* clipping = cJSON_GetObjectItem(object, "prevent_clipping");
+      loudness.preventClipping =
+          clipping == NULL || !cJSON_IsNumber(clipping) ||
+          clipping->valueint != 0;
+      addNode(nodeChannels, loudness);
+    } else if (type == "loudness_contour") {
+      requireChannels();
+      LoudnessContourNode contour = {};
+      contour.lowFrequency = addValues(object, "low_frequency", false);
+      contour.highFrequency = addValues(object, "high_frequency", false);
+      contour.lowBoost = addValues(object, "low_boost", false);
+      contour.highBoost = addValues(object, "high_boost", false);
+      contour.referenceVolume = addValues(object, "reference_volume", false);
+      addNode(nodeChannels, contour);
+    } else if (type == "resampler") {
+      cJSON* rate = cJSON_GetObjectItem(object, "sample_rate");
+      if (rate == NULL || !cJSON_IsNumber(rate)) {
+        throw std::invalid_argument("Field sample_rate is required");
+      }
+      cJSON* quality = cJSON_GetObjectItem(object, "quality");
+      cJSON* maxChannels = cJSON_GetObjectItem(object, "max_channels");
+
+      ResamplerNode resampler = {};
+      resampler.sampleRate = rate->valueint;
+      resampler.quality = Resampler::Quality::MEDIUM;
+      if (quality != NULL && cJSON_IsString(quality)) {
+        if (strcmp(quality->valuestring, "low") == 0) {
+          resampler.quality = Resampler::Quality::LOW;
+        } else if (strcmp(quality->valuestring, "high") == 0) {
+          resampler.quality = Resampler::Quality::HIGH;
+        }
+      }
+      resampler.maxChannels = maxChannels != NULL && cJSON_IsNumber(maxChannels)
+                                  ? maxChannels->valueint
+                                  : 2;
+      addNode(nodeChannels, resampler);
+    } else if (type == "oversampler" || type == "decimator") {
+      cJSON* factor = cJSON_GetObjectItem(object, "factor");
+      cJSON* phase = cJSON_GetObjectItem(object, "phase");
+      cJSON* maxChannels = cJSON_GetObjectItem(object, "max_channels");
+
+      OversamplerNode oversampler = {};
+      oversampler.factor =
+          factor != NULL && cJSON_IsNumber(factor) ? factor->valueint : 2;
+      if (oversampler.factor != 2 && oversampler.factor != 4) {
+        throw std::invalid_argument("Field factor must be 2 or 4");
+      }
+      oversampler.phase = Oversampler::Phase::LINEAR;
+      if (phase != NULL && cJSON_IsString(phase) &&
+          strcmp(phase->valuestring, "minimum") == 0) {
+        oversampler.phase = Oversampler::Phase::MINIMUM;
+      }
+      oversampler.maxChannels =
+          maxChannels != NULL && cJSON_IsNumber(maxChannels)
+              ? maxChannels->valueint
+              : 2;
+      if (type == "decimator") {
+        addNode(nodeChannels, DecimatorNode{oversampler});
+      } else {
+        addNode(nodeChannels, oversampler);
+      }
+    } else if (type == "fir") {
+      requireChannels();
+      cJSON* blockSize = cJSON_GetObjectItem(object, "block_size");
+
+      FirNode fir = {};
+      fir.blockSize = blockSize != NULL && cJSON_IsNumber(blockSize)
+                          ? blockSize->valueint
+                          : 256;
+      if (cJSON_IsArray(cJSON_GetObjectItem(object, "coefficients"))) {
+        fir.taps = addValues(object, "coefficients", true);
+      } else {
+        cJSON* filename = cJSON_GetObjectItem(object, "filename");
+        if (filename == NULL || !cJSON_IsString(filename)) {
+          throw std::invalid_argument("Field filename is required");
+        }
+        auto taps = FirConvolver::loadTaps(filename->valuestring);
+        fir.taps = {(uint32_t)values.size(), (uint32_t)taps.size()};
+        values.insert(values.end(), taps.begin(), taps.end());
+      }
+      addNode(nodeChannels, fir);
+    } else {
+      throw std::invalid_argument("Unknown transform type " + type);
+    }
+  }
+}
+
+std::shared_ptr<AudioTransform> DSPGraph::create(const Node& node) {
+  auto& params = node.params;
+  if (std::holds_alternative<GainNode>(params)) {
+    return std::make_shared<Gain>();
+  } else if (std::holds_alternative<BiquadNode>(params)) {
+    return std::make_shared<Biquad>();
+  } else if (std::holds_alternative<BiquadComboNode>(params)) {
+    return std::make_shared<BiquadCombo>();
+  } else if (std::holds_alternative<CompressorNode>(params)) {
+    return std::make_shared<Compressor>();
+  } else if (std::holds_alternative<MultibandNode>(params)) {
+    return std::make_shared<MultibandCompressor>();
+  } else if (std::holds_alternative<LoudnessNode>(params)) {
+    return std::make_shared<LoudnessNormalizer>();
+  } else if (std::holds_alternative<LoudnessContourNode>(params)) {
+    return std::make_shared<LoudnessContour>();
+  } else if (std::holds_alternative<ResamplerNode>(params)) {
+    return std::make_shared<Resampler>();
+  } else if (std::holds_alternative<OversamplerNode>(params)) {
+    return std::make_shared<Oversampler>();
+  } else if (std::holds_alternative<DecimatorNode>(params)) {
+    return std::make_shared<Decimator>();
+  }
+  return std::make_shared<FirConvolver>();
+}
+
+void DSPGraph::apply(const Node& node, AudioTransform& transform,
+                     int volume) {
+  auto nodeChannels = channelsOf(node);
+
+  if (auto* gain = std::get_if<GainNode>(&node.params)) {
+    static_cast<Gain&>(transform).configure(nodeChannels,
+                                            resolve(gain->gain, volume));
+  } else if (auto* biquad = std::get_if<BiquadNode>(&node.params)) {
+    // Biquad's generators take their parameters by name
+    std::map<std::string, float> biquadConfig;
+    const std::pair<const char*, Param> fields[] = {
+        {"freq", biquad->frequency}, {"q", biquad->q},
+        {"gain", biquad->gain},      {"bandwidth", biquad->bandwidth},
+        {"slope", biquad->slope},    {"b0", biquad->coeffs[0]},
+        {"b1", biquad->coeffs[1]},   {"b2", biquad->coeffs[2]},
+        {"a1", biquad->coeffs[3]},   {"a2", biquad->coeffs[4]}};
+    for (auto& field : fields) {
+      if (field.second.count > 0) {
+        biquadConfig[field.first] = resolve(field.second, volume);
+      }
+    }
+    auto& filter = static_cast<Biquad&>(transform);
+    filter.channel = nodeChannels[0];
+    filter.configure(biquad->type, biquadConfig);
+  } else if (auto* combo = std::get_if<BiquadComboNode>(&node.params)) {
+    static_cast<BiquadCombo&>(transform).configure(
+        nodeChannels[0], combo->linkwitzRiley, combo->type,
+        resolve(combo->frequency, volume),
+        std::lround(resolve(combo->order, volume)));
+  } else if (auto* compressor = std::get_if<CompressorNode>(&node.params)) {
+    static_cast<Compressor&>(transform).configure(
+        nodeChannels, resolve(compressor->attack, volume),
+        resolve(compressor->release, volume),
+        resolve(compressor->threshold, volume),
+        resolve(compressor->factor, volume),
+        resolve(compressor->makeupGain, volume),
+        resolve(compressor->lookahead, volume));
+  } else if (auto* multiband = std::get_if<MultibandNode>(&node.params)) {
+    std::vector<float> crossovers(
+        values.begin() + multiband->crossovers.first,
+        values.begin() + multiband->crossovers.first +
+            multiband->crossovers.count);
+    std::vector<MultibandCompressor::Band> bands(multiband->bandCount);
+    for (size_t i = 0; i < bands.size(); i++) {
+      auto& band = multiband->bands[i];
+      bands[i].attack = resolve(band.attack, volume);
+      bands[i].release = resolve(band.release, volume);
+      bands[i].threshold = resolve(band.threshold, volume);
+      bands[i].factor = resolve(band.factor, volume);
+      bands[i].makeupGain = resolve(band.makeupGain, volume);
+    }
+    static_cast<MultibandCompressor&>(transform).configure(nodeChannels,
+                                                           crossovers, bands);
+  } else if (auto* loudness = std::get_if<LoudnessNode>(&node.params)) {
+    static_cast<LoudnessNormalizer&>(transform).configure(
+        resolve(loudness->target, volume,
+                LoudnessNormalizer::REPLAYGAIN_REFERENCE),
+        resolve(loudness->maxGain, volume, 12.0f), loudness->preventClipping);
+  } else if (auto* contour = std::get_if<LoudnessContourNode>(&node.params)) {
+    // Resolved at full volume, they don't vary with it
+    LoudnessContour::Config config;
+    config.channels = nodeChannels;
+    config.lowFrequency = resolve(contour->lowFrequency, 100,
+                                  config.lowFrequency);
+    config.highFrequency = resolve(contour->highFrequency, 100,
+                                   config.highFrequency);
+    config.lowBoostDb = resolve(contour->lowBoost, 100, config.lowBoostDb);
+    config.highBoostDb = resolve(contour->highBoost, 100, config.highBoostDb);
+    config.referenceVolume = std::lround(resolve(
+        contour->referenceVolume, 100, config.referenceVolume));
+    auto& loudness = static_cast<LoudnessContour&>(transform);
+    loudness.configure(config);
+    loudness.applyVolumeStep(volume);
+  } else if (auto* resampler = std::get_if<ResamplerNode>(&node.params)) {
+    static_cast<Resampler&>(transform).configure(
+        resampler->sampleRate, resampler->quality, resampler->maxChannels);
+  } else if (auto* oversampler =
+                 std::get_if<OversamplerNode>(&node.params)) {
+    Oversampler::Config config;
+    config.factor = oversampler->factor;
+    config.phase = oversampler->phase;
+    config.maxChannels = oversampler->maxChannels;
+    static_cast<Oversampler&>(transform).configure(config);
+  } else if (auto* decimator = std::get_if<DecimatorNode>(&node.params)) {
+    Decimator::Config config;
+    config.factor = decimator->factor;
+    config.phase = decimator->phase;
+    config.maxChannels = decimator->maxChannels;
+    static_cast<Decimator&>(transform).configure(config);
+  } else if (auto* fir = std::get_if<FirNode>(&node.params)) {
+    std::vector<float> taps(values.begin() + fir->taps.first,
+                            values.begin() + fir->taps.first + fir->taps.count);
+    static_cast<FirConvolver&>(transform).configure(nodeChannels, taps,
+                                                    fir->blockSize);
+  }
+}
+
+void DSPGraph::build(AudioPipeline& pipeline, uint32_t sampleRate,
+                     int volume) {
+  transforms.clear();
+  for (auto& node : nodes) {
+    auto transform = create(node);
+    // Biquads compute their coefficients for the rate they have when
+    // configured
+    transform->sampleRateChanged(sampleRate);
+    apply(node, *transform, volume);
+    // Nodes after a resampler or oversampler run at its rate
+    sampleRate = transform->getOutputRate(sampleRate);
+    pipeline.addTransform(transform);
+    transforms.push_back(transform);
+  }
+}
+
+void DSPGraph::volumeUpdated(int volume) {
+  for (size_t i = 0; i < transforms.size(); i++) {
+    if (nodes[i].dependsOnVolume) {
+      apply(nodes[i], *transforms[i], volume);
+    }
+  }
+}
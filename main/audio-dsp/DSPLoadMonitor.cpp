@@ -0,0 +1,101 @@
+#include "DSPLoadMonitor.h"
+
+#include <algorithm>  // for min
+
+#include "BellClock.h"    // for nowNs
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"  // for esp_cpu_get_cycle_count
+#if __has_include("esp_private/esp_clk.h")
+#include "esp_private/esp_clk.h"  // for esp_clk_cpu_freq
+#else
+#include "esp_clk.h"  // for esp_clk_cpu_freq
+#endif
+#endif
+
+using namespace bell;
+
+DSPLoadMonitor::DSPLoadMonitor(const Config& config) : config(config) {
+#ifdef ESP_PLATFORM
+  if (config.cycleCounter) {
+    cpuHz = esp_clk_cpu_freq();
+  }
+#endif
+}
+
+uint64_t DSPLoadMonitor::now() {
+#ifdef ESP_PLATFORM
+  if (cpuHz > 0) {
+    return esp_cpu_get_cycle_count();
+  }
+#endif
+  return clock::nowNs();
+}
+
+uint64_t DSPLoadMonitor::begin() {
+  return now();
+}
+
+void DSPLoadMonitor::end(uint64_t started, size_t frames,
+                         uint32_t sampleRate) {
+  if (frames == 0 || sampleRate == 0) {
+    return;
+  }
+  uint64_t elapsedNs;
+  if (cpuHz > 0) {
+    // 32-bit counter, wraps after several seconds, far beyond any block
+    uint32_t cycles = (uint32_t)now() - (uint32_t)started;
+    elapsedNs = (uint64_t)cycles * 1000000000 / cpuHz;
+  } else {
+    elapsedNs = now() - started;
+  }
+  uint64_t budgetNs = (uint64_t)frames * 1000000000 / sampleRate;
+
+  if (resetRequested.exchange(false)) {
+    windowBusyNs = 0;
+    windowBudgetNs = 0;
+  }
+
+  float blockPercent = 100.0f * elapsedNs / budgetNs;
+  if (blockPercent > peakPercent.load(std::memory_order_relaxed)) {
+    peakPercent.store(blockPercent, std::memory_order_relaxed);
+  }
+  if (elapsedNs > budgetNs * config.deadlineFraction) {
+    deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+    BELL_METRIC_COUNT("dsp.deadline_misses", 1);
+  }
+  blocks.fetch_add(1, std::memory_order_relaxed);
+  lastNs.store(std::min<uint64_t>(elapsedNs, UINT32_MAX),
+               std::memory_order_relaxed);
+  lastBudgetNs.store(std::min<uint64_t>(budgetNs, UINT32_MAX),
+                     std::memory_order_relaxed);
+
+  windowBusyNs += elapsedNs;
+  windowBudgetNs += budgetNs;
+  if (windowBudgetNs >= (uint64_t)config.windowMs * 1000000) {
+    loadPercent.store(100.0f * windowBusyNs / windowBudgetNs,
+                      std::memory_order_relaxed);
+    windowBusyNs = 0;
+    windowBudgetNs = 0;
+  }
+}
+
+DSPLoadMonitor::Stats DSPLoadMonitor::getStats() const {
+  Stats stats;
+  stats.loadPercent = loadPercent.load(std::memory_order_relaxed);
+  stats.peakPercent = peakPercent.load(std::memory_order_relaxed);
+  stats.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+  stats.blocks = blocks.load(std::memory_order_relaxed);
+  stats.lastNs = lastNs.load(std::memory_order_relaxed);
+  stats.lastBudgetNs = lastBudgetNs.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void DSPLoadMonitor::reset() {
+  loadPercent.store(0, std::memory_order_relaxed);
+  peakPercent.store(0, std::memory_order_relaxed);
+  deadlineMisses.store(0, std::memory_order_relaxed);
+  blocks.store(0, std::memory_order_relaxed);
+  resetRequested = true;
+}
@@ -0,0 +1,54 @@
+#include "DriftResampler.h"
+
+using namespace bell;
+
+DriftResampler::DriftResampler() {
+  this->filterType = "drift_resampler";
+}
+
+void DriftResampler::configure(size_t maxChannels, size_t maxInputFrames) {
+  this->maxChannels = maxChannels;
+  this->maxInputFrames = maxInputFrames;
+  publishPlan();
+}
+
+void DriftResampler::setRatio(double ratio) {
+  this->ratio.store(ratio, std::memory_order_relaxed);
+}
+
+void DriftResampler::sampleRateChanged(uint32_t sampleRate) {
+  std::scoped_lock lock(this->accessMutex);
+  // History at the old rate would smear into the new one
+  if (activePlan.current()) {
+    publishPlan();
+  }
+}
+
+void DriftResampler::publishPlan() {
+  auto plan = std::make_shared<Plan>();
+  plan->channels = maxChannels;
+  plan->resampler =
+      std::make_unique<dsp::AsyncResampler>(maxChannels, maxInputFrames);
+
+  size_t planeSize = plan->resampler->maxOutputFrames();
+  plan->planarData.assign(planeSize * maxChannels, 0.0f);
+  for (size_t ch = 0; ch < maxChannels; ch++) {
+    plan->channelData.push_back(plan->planarData.data() + ch * planeSize);
+  }
+
+  activePlan.publish(plan);
+}
+
+void DriftResampler::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan || (size_t)data.numChannels > plan->channels) {
+    return;
+  }
+
+  // Whichever plan is active follows the latest ratio
+  plan->resampler->setRatio(ratio.load(std::memory_order_relaxed));
+  data.numSamples =
+      plan->resampler->process(data.data, data.numSamples,
+                               plan->channelData.data(), data.numChannels);
+  data.data = plan->channelData.data();
+}
@@ -0,0 +1,97 @@
+#include "FFT.h"
+
+#include <cmath>      // for cosf, sinf
+#include <stdexcept>  // for invalid_argument
+#include <utility>    // for swap
+
+#if defined(ESP_PLATFORM) && __has_include("esp_dsp.h")
+#include "esp_dsp.h"
+#define BELL_FFT_ESP_DSP
+#endif
+
+using namespace bell;
+
+dsp::FFT::FFT(size_t size) : n(size) {
+  if (size < 2 || (size & (size - 1)) != 0) {
+    throw std::invalid_argument("FFT size must be a power of two");
+  }
+
+#ifdef BELL_FFT_ESP_DSP
+  // esp-dsp keeps a single table, sized for the largest supported transform
+  static bool tableReady = false;
+  if (!tableReady) {
+    if (dsps_fft2r_init_fc32(NULL, CONFIG_DSP_MAX_FFT_SIZE) != ESP_OK) {
+      throw std::runtime_error("Cannot initialize esp-dsp FFT");
+    }
+    tableReady = true;
+  }
+  if (size > CONFIG_DSP_MAX_FFT_SIZE) {
+    throw std::invalid_argument("FFT size above CONFIG_DSP_MAX_FFT_SIZE");
+  }
+#else
+  twiddles.resize(size);
+  for (size_t k = 0; k < size / 2; k++) {
+    float angle = -2.0f * (float)M_PI * k / size;
+    twiddles[k * 2] = cosf(angle);
+    twiddles[k * 2 + 1] = sinf(angle);
+  }
+
+  size_t bits = 0;
+  while ((1u << bits) < size) {
+    bits++;
+  }
+  bitReverse.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    uint32_t reversed = 0;
+    for (size_t b = 0; b < bits; b++) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bitReverse[i] = reversed;
+  }
+#endif
+}
+
+void dsp::FFT::forward(float* data) {
+#ifdef BELL_FFT_ESP_DSP
+  dsps_fft2r_fc32(data, n);
+  dsps_bit_rev_fc32(data, n);
+#else
+  for (size_t i = 0; i < n; i++) {
+    size_t j = bitReverse[i];
+    if (i < j) {
+      std::swap(data[i * 2], data[j * 2]);
+      std::swap(data[i * 2 + 1], data[j * 2 + 1]);
+    }
+  }
+
+  // Iterative decimation in time butterflies
+  for (size_t half = 1, stride = n / 2; half < n; half *= 2, stride /= 2) {
+    for (size_t start = 0; start < n; start += half * 2) {
+      for (size_t k = 0; k < half; k++) {
+        float wr = twiddles[k * stride * 2];
+        float wi = twiddles[k * stride * 2 + 1];
+        float* a = data + (start + k) * 2;
+        float* b = data + (start + k + half) * 2;
+
+        float tr = b[0] * wr - b[1] * wi;
+        float ti = b[0] * wi + b[1] * wr;
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+      }
+    }
+  }
+#endif
+}
+
+void dsp::FFT::inverse(float* data) {
+  // ifft(x) = conj(fft(conj(x))), scaling is left to the caller
+  for (size_t i = 0; i < n; i++) {
+    data[i * 2 + 1] = -data[i * 2 + 1];
+  }
+  forward(data);
+  for (size_t i = 0; i < n; i++) {
+    data[i * 2 + 1] = -data[i * 2 + 1];
+  }
+}
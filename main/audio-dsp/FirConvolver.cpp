@@ -0,0 +1,185 @@
+#include "FirConvolver.h"
+
+#include <algorithm>  // for copy, fill, min
+#include <cstring>    // for memcpy
+#include <fstream>    // for ifstream
+#include <stdexcept>  // for invalid_argument, runtime_error
+
+using namespace bell;
+
+FirConvolver::FirConvolver() {
+  this->filterType = "fir";
+}
+
+std::vector<float> FirConvolver::loadTaps(const std::string& path) {
+  std::vector<float> taps;
+  bool binary =
+      path.size() > 4 && (path.compare(path.size() - 4, 4, ".raw") == 0 ||
+                          path.compare(path.size() - 4, 4, ".bin") == 0);
+
+  std::ifstream file(path, binary ? std::ios::binary : std::ios::in);
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open FIR file " + path);
+  }
+
+  if (binary) {
+    float value;
+    while (file.read(reinterpret_cast<char*>(&value), sizeof(float))) {
+      taps.push_back(value);
+    }
+  } else {
+    std::string token;
+    while (file >> token) {
+      // Skip separators and comment lines
+      if (token[0] == '#' || token[0] == '*') {
+        std::getline(file, token);
+        continue;
+      }
+      if (token.back() == ',') {
+        token.pop_back();
+      }
+      if (!token.empty()) {
+        taps.push_back(std::stof(token));
+      }
+    }
+  }
+
+  if (taps.empty()) {
+    throw std::invalid_argument("FIR file " + path + " has no coefficients");
+  }
+  return taps;
+}
+
+void FirConvolver::configure(std::vector<int> channels,
+                             const std::vector<float>& taps,
+                             size_t blockSize) {
+  if (taps.empty()) {
+    throw std::invalid_argument("FIR filter needs at least one tap");
+  }
+
+  size_t size = 1;
+  while (size < blockSize) {
+    size *= 2;
+  }
+
+  this->channels = channels;
+
+  auto plan = std::make_shared<Plan>();
+  plan->blockSize = size;
+  plan->bins = size + 1;
+  plan->partitions = (taps.size() + size - 1) / size;
+  plan->fft = std::make_unique<dsp::FFT>(size * 2);
+  plan->channels = channels;
+  plan->fftBuffer.resize(size * 4);
+  plan->accumulator.resize(plan->bins * 2);
+
+  // Transform every zero padded partition of the impulse response
+  size_t spectrumSize = plan->bins * 2;
+  plan->spectra.resize(plan->partitions * spectrumSize);
+  for (size_t p = 0; p < plan->partitions; p++) {
+    std::fill(plan->fftBuffer.begin(), plan->fftBuffer.end(), 0.0f);
+    for (size_t i = 0; i < size && p * size + i < taps.size(); i++) {
+      plan->fftBuffer[i * 2] = taps[p * size + i];
+    }
+    plan->fft->forward(plan->fftBuffer.data());
+    std::copy(plan->fftBuffer.begin(), plan->fftBuffer.begin() + spectrumSize,
+              plan->spectra.begin() + p * spectrumSize);
+  }
+
+  plan->states.resize(channels.size());
+  for (auto& state : plan->states) {
+    state.input.assign(size * 2, 0.0f);
+    state.output.assign(size, 0.0f);
+    state.history.assign(plan->partitions * spectrumSize, 0.0f);
+  }
+
+  activePlan.publish(plan);
+}
+
+size_t FirConvolver::getLatency() {
+  auto plan = activePlan.current();
+  return plan ? plan->blockSize : 0;
+}
+
+void FirConvolver::processBlock(Plan& plan, ChannelState& state) {
+  size_t blockSize = plan.blockSize;
+  size_t spectrumSize = plan.bins * 2;
+  float* buffer = plan.fftBuffer.data();
+
+  // Spectrum of the last two blocks goes to the front of the delay line
+  for (size_t i = 0; i < blockSize * 2; i++) {
+    buffer[i * 2] = state.input[i];
+    buffer[i * 2 + 1] = 0.0f;
+  }
+  plan.fft->forward(buffer);
+  std::memcpy(state.history.data() + plan.historyPosition * spectrumSize,
+              buffer, spectrumSize * sizeof(float));
+
+  // Input is real, so only bins 0 to blockSize need to be multiplied
+  float* acc = plan.accumulator.data();
+  std::fill(plan.accumulator.begin(), plan.accumulator.end(), 0.0f);
+  size_t slot = plan.historyPosition;
+  for (size_t p = 0; p < plan.partitions; p++) {
+    const float* x = state.history.data() + slot * spectrumSize;
+    const float* h = plan.spectra.data() + p * spectrumSize;
+    for (size_t k = 0; k < spectrumSize; k += 2) {
+      acc[k] += x[k] * h[k] - x[k + 1] * h[k + 1];
+      acc[k + 1] += x[k] * h[k + 1] + x[k + 1] * h[k];
+    }
+    slot = slot == 0 ? plan.partitions - 1 : slot - 1;
+  }
+
+  // Rebuild the full spectrum from its conjugate symmetric half
+  size_t fftSize = blockSize * 2;
+  std::memcpy(buffer, acc, spectrumSize * sizeof(float));
+  for (size_t k = 1; k < blockSize; k++) {
+    buffer[(fftSize - k) * 2] = acc[k * 2];
+    buffer[(fftSize - k) * 2 + 1] = -acc[k * 2 + 1];
+  }
+  plan.fft->inverse(buffer);
+
+  // Second half holds the valid part of the circular convolution
+  float scale = 1.0f / fftSize;
+  for (size_t i = 0; i < blockSize; i++) {
+    state.output[i] = buffer[(blockSize + i) * 2] * scale;
+  }
+
+  std::copy(state.input.begin() + blockSize, state.input.end(),
+            state.input.begin());
+}
+
+void FirConvolver::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan) {
+    return;
+  }
+
+  size_t blockSize = plan->blockSize;
+  for (size_t offset = 0; offset < data.numSamples;) {
+    size_t samples =
+        std::min(blockSize - plan->position, data.numSamples - offset);
+
+    // Queue the input and hand out the output of the previous block
+    for (size_t c = 0; c < plan->channels.size(); c++) {
+      if (plan->channels[c] >= data.numChannels) {
+        continue;
+      }
+      auto& state = plan->states[c];
+      float* samplesIn = data.data[plan->channels[c]] + offset;
+      std::copy(samplesIn, samplesIn + samples,
+                state.input.begin() + blockSize + plan->position);
+      std::copy(state.output.begin() + plan->position,
+                state.output.begin() + plan->position + samples, samplesIn);
+    }
+
+    offset += samples;
+    plan->position += samples;
+    if (plan->position == blockSize) {
+      for (auto& state : plan->states) {
+        processBlock(*plan, state);
+      }
+      plan->position = 0;
+      plan->historyPosition = (plan->historyPosition + 1) % plan->partitions;
+    }
+  }
+}
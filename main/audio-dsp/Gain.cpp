@@ -1,7 +1,10 @@
 #include "Gain.h"
 
-#include <cmath>   // for pow
-#include <string>  // for string
+#include <algorithm>  // for clamp, min
+#include <cmath>      // for pow, log10
+#include <string>     // for string
+
+#include "FixedPoint.h"  // for SampleFormat, scale, scaleRamp
 
 using namespace bell;
 
@@ -10,20 +13,108 @@ Gain::Gain() : AudioTransform() {
   this->filterType = "gain";
 }
 
-void Gain::configure(std::vector<int> channels, float gainDB) {
+std::shared_ptr<Gain::Params> Gain::makeParams(std::vector<int> channels,
+                                               float gainDB) {
   this->channels = channels;
   this->gainDb = gainDB;
   this->gainFactor = std::pow(10.0f, gainDB / 20.0f);
+
+  auto params = std::make_shared<Params>();
+  params->gainFactor = gainFactor;
+  params->channels = channels;
+  params->rampSamples = rampTimeMs * sampleRate / 1000.0f;
+  return params;
+}
+
+void Gain::configure(std::vector<int> channels, float gainDB) {
+  activeParams.publish(makeParams(channels, gainDB));
+}
+
+void Gain::precomputeVolumeSteps() {
+  std::scoped_lock lock(this->accessMutex);
+  int volume = config->currentVolume;
+
+  volumeSteps.clear();
+  float previousGain = 0;
+  for (int step = 0; step < VOLUME_STEPS; step++) {
+    config->currentVolume = step;
+    float gain = config->getFloat("gain");
+
+    if (!volumeSteps.empty() && gain == previousGain) {
+      volumeSteps.push_back(volumeSteps.back());
+      continue;
+    }
+    volumeSteps.push_back(makeParams(config->getChannels(), gain));
+    previousGain = gain;
+  }
+
+  // Restore the members to the actual volume
+  config->currentVolume = volume;
+  makeParams(config->getChannels(), config->getFloat("gain"));
 }
 
-std::unique_ptr<StreamInfo> Gain::process(std::unique_ptr<StreamInfo> data) {
+bool Gain::applyVolumeStep(int volume) {
   std::scoped_lock lock(this->accessMutex);
-  for (int i = 0; i < data->numSamples; i++) {
-    // Apply gain to all channels
-    for (auto& channel : channels) {
-      data->data[channel][i] *= gainFactor;
+  if (volumeSteps.size() != VOLUME_STEPS) {
+    return false;
+  }
+
+  auto& step = volumeSteps[std::clamp(volume, 0, VOLUME_STEPS - 1)];
+  this->gainFactor = step->gainFactor;
+  this->channels = step->channels;
+  this->gainDb = 20.0f * std::log10(step->gainFactor);
+  if (activeParams.current() != step) {
+    activeParams.publish(step);
+  }
+  return true;
+}
+
+template <typename T>
+void Gain::applyGain(T** data, size_t samples, const Params& params) {
+  typedef dsp::SampleFormat<T> Format;
+  ramp.setTarget(&params.gainFactor, params.rampSamples);
+
+  // Linear ramp until the target is reached, in the sample's own format
+  size_t done = 0;
+  // An empty block would divide by zero
+  if (ramp.isRamping() && samples > 0) {
+    done = std::min(samples, ramp.samplesLeft());
+    auto start = Format::toGain(ramp.values()[0]);
+    ramp.advance(done);
+    auto step = (Format::toGain(ramp.values()[0]) - start) /
+                (typename Format::Gain)done;
+    for (auto& channel : params.channels) {
+      dsp::scaleRamp(data[channel], done, start, step);
     }
   }
 
-  return data;
-}
\ No newline at end of file
+  auto gain = Format::toGain(ramp.values()[0]);
+  for (auto& channel : params.channels) {
+    dsp::scale(data[channel] + done, samples - done, gain);
+  }
+}
+
+bool Gain::isIdentity() {
+  auto params = activeParams.read();
+  return !params || params->channels.empty() ||
+         (params->gainFactor == 1.0f && !ramp.isRamping() &&
+          ramp.values()[0] == 1.0f);
+}
+
+void Gain::process(StreamInfo& data) {
+  auto params = activeParams.read();
+  if (!params) {
+    return;
+  }
+
+  applyGain(data.data, data.numSamples, *params);
+}
+
+void Gain::processFixed(FixedStreamInfo& data) {
+  auto params = activeParams.read();
+  if (!params) {
+    return;
+  }
+
+  applyGain(data.data, data.numSamples, *params);
+}
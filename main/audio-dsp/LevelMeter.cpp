@@ -0,0 +1,191 @@
+#include "LevelMeter.h"
+
+#include <math.h>     // for sqrtf, log10f, cosf, powf, M_PI
+#include <algorithm>  // for min, max, fill
+
+#include "BellUtils.h"         // for BELL_SLEEP_MS
+#include "FFT.h"               // for FFT
+#include "SampleConversion.h"  // for deinterleave
+
+using namespace bell;
+
+namespace {
+float toDb(float value) {
+  return value > 0 ? std::max(20.0f * log10f(value), LevelMeter::FLOOR)
+                   : LevelMeter::FLOOR;
+}
+}  // namespace
+
+LevelMeter::LevelMeter(const Config& config)
+    : bell::Task("level_meter", 4096, 1, 0), config(config) {
+  this->config.maxChannels =
+      std::clamp(this->config.maxChannels, 1, MAX_CHANNELS);
+  // Made once, the tap may write at any time
+  Window window;
+  window.samples.resize(this->config.maxChannels * config.windowFrames);
+  windows = std::make_unique<TripleBuffer<Window>>(window);
+
+  if (config.spectrumBands > 0) {
+    fft = std::make_unique<dsp::FFT>(config.windowFrames);
+    hann.resize(config.windowFrames);
+    for (size_t i = 0; i < config.windowFrames; i++) {
+      hann[i] = 0.5f - 0.5f * cosf(2 * (float)M_PI * i / config.windowFrames);
+    }
+    spectrum.resize(config.windowFrames * 2);
+  }
+}
+
+LevelMeter::~LevelMeter() {
+  stop();
+}
+
+bool LevelMeter::start() {
+  stop();
+  lastWindow = std::chrono::steady_clock::now();
+  return startTask();
+}
+
+void LevelMeter::stop() {
+  stopTask();
+}
+
+BellDSP::Tap LevelMeter::tap() {
+  return [this](const uint8_t* data, size_t bytes, int channels,
+                uint32_t sampleRate, PcmFormat format) {
+    write(data, bytes, channels, sampleRate, format);
+  };
+}
+
+void LevelMeter::write(const uint8_t* data, size_t bytes, int channels,
+                       uint32_t sampleRate, PcmFormat format) {
+  if (channels <= 0 || channels > config.maxChannels) {
+    return;
+  }
+  size_t frameSize = pcmBytesPerSample(format) * channels;
+  size_t frames = bytes / frameSize;
+
+  while (frames > 0) {
+    Window& window = windows->back();
+    if (window.channels != channels || window.sampleRate != sampleRate) {
+      // A window holds a single format
+      window.frames = 0;
+      window.channels = channels;
+      window.sampleRate = sampleRate;
+    }
+
+    size_t count = std::min(frames, config.windowFrames - window.frames);
+    float* planes[MAX_CHANNELS];
+    for (int ch = 0; ch < channels; ch++) {
+      planes[ch] =
+          window.samples.data() + ch * config.windowFrames + window.frames;
+    }
+    dsp::deinterleave(data, format, planes, channels, count);
+    window.frames += count;
+    data += count * frameSize;
+    frames -= count;
+
+    if (window.frames == config.windowFrames) {
+      windows->publish();
+      windows->back().frames = 0;
+    }
+  }
+}
+
+LevelMeter::Levels LevelMeter::getLevels() {
+  std::scoped_lock lock(levelsMutex);
+  return levels;
+}
+
+void LevelMeter::runTask() {
+  while (!isStopRequested()) {
+    BELL_SLEEP_MS(config.pollMs);
+    auto now = std::chrono::steady_clock::now();
+    if (windows->update()) {
+      lastWindow = now;
+      measure(windows->front());
+    } else if (now - lastWindow > std::chrono::milliseconds(config.holdMs)) {
+      std::scoped_lock lock(levelsMutex);
+      std::fill(levels.peakDb.begin(), levels.peakDb.end(), FLOOR);
+      std::fill(levels.rmsDb.begin(), levels.rmsDb.end(), FLOOR);
+      std::fill(levels.spectrumDb.begin(), levels.spectrumDb.end(), FLOOR);
+    }
+  }
+}
+
+void LevelMeter::measure(const Window& window) {
+  std::vector<float> peakDb(window.channels), rmsDb(window.channels);
+  for (int ch = 0; ch < window.channels; ch++) {
+    const float* samples = window.samples.data() + ch * config.windowFrames;
+    float peak = 0, sum = 0;
+    for (size_t i = 0; i < window.frames; i++) {
+      peak = std::max(peak, fabsf(samples[i]));
+      sum += samples[i] * samples[i];
+    }
+    peakDb[ch] = toDb(peak);
+    rmsDb[ch] = toDb(sqrtf(sum / window.frames));
+  }
+
+  std::vector<float> bandsDb;
+  if (fft != nullptr) {
+    measureSpectrum(window, bandsDb);
+  }
+
+  std::scoped_lock lock(levelsMutex);
+  levels.peakDb = std::move(peakDb);
+  levels.rmsDb = std::move(rmsDb);
+  levels.spectrumDb = std::move(bandsDb);
+  levels.sampleRate = window.sampleRate;
+  levels.sequence++;
+}
+
+void LevelMeter::measureSpectrum(const Window& window,
+                                 std::vector<float>& bandsDb) {
+  if (window.sampleRate != bandsRate) {
+    placeBands(window.sampleRate);
+  }
+
+  // Windowed mono downmix, as complex points
+  size_t n = config.windowFrames;
+  for (size_t i = 0; i < n; i++) {
+    float sum = 0;
+    for (int ch = 0; ch < window.channels; ch++) {
+      sum += window.samples[ch * n + i];
+    }
+    spectrum[2 * i] = sum / window.channels * hann[i];
+    spectrum[2 * i + 1] = 0;
+  }
+  fft->forward(spectrum.data());
+
+  // A full scale sine peaks at n / 4 through the Hann window
+  float scale = 4.0f / n;
+  bandsDb.resize(config.spectrumBands);
+  for (size_t band = 0; band < config.spectrumBands; band++) {
+    float peak = 0;
+    for (size_t bin = bandBins[band]; bin < bandBins[band + 1]; bin++) {
+      float re = spectrum[2 * bin], im = spectrum[2 * bin + 1];
+      peak = std::max(peak, re * re + im * im);
+    }
+    bandsDb[band] = toDb(sqrtf(peak) * scale);
+  }
+}
+
+void LevelMeter::placeBands(uint32_t sampleRate) {
+  bandsRate = sampleRate;
+  size_t n = config.windowFrames;
+  float binHz = (float)sampleRate / n;
+  float ratio = powf(sampleRate / 2.0f / config.minHz,
+                     1.0f / config.spectrumBands);
+
+  bandBins.resize(config.spectrumBands + 1);
+  float edge = config.minHz;
+  for (size_t band = 0; band <= config.spectrumBands; band++) {
+    // Past DC
+    bandBins[band] = std::clamp((size_t)(edge / binHz), (size_t)1, n / 2);
+    edge *= ratio;
+  }
+  // Low bands narrower than a bin get the bin they fall in
+  for (size_t band = 0; band < config.spectrumBands; band++) {
+    bandBins[band + 1] =
+        std::max(bandBins[band + 1], std::min(bandBins[band] + 1, n / 2));
+  }
+}
@@ -0,0 +1,128 @@
+#include "LoudnessContour.h"
+
+#include <algorithm>  // for clamp, copy, min
+#include <map>        // for map
+#include <mutex>      // for scoped_lock
+#include <string>     // for string
+
+#include "BellHotPath.h"    // for BELL_HOT
+#include "Biquad.h"         // for Biquad, Biquad::Type
+#include "BiquadCascade.h"  // for biquadCascade
+#include "Denormals.h"      // for flushDenormals
+
+using namespace bell;
+
+LoudnessContour::LoudnessContour(const Config& config) : config(config) {
+  this->filterType = "loudness_contour";
+  publishTable();
+}
+
+void LoudnessContour::configure(const Config& config) {
+  std::scoped_lock lock(this->accessMutex);
+  this->config = config;
+  publishTable();
+}
+
+void LoudnessContour::sampleRateChanged(uint32_t sampleRate) {
+  std::scoped_lock lock(this->accessMutex);
+  this->sampleRate = sampleRate;
+  publishTable();
+}
+
+std::vector<int> LoudnessContour::getChannels() {
+  std::scoped_lock lock(this->accessMutex);
+  return config.channels;
+}
+
+void LoudnessContour::publishTable() {
+  auto table = std::make_shared<Table>();
+  table->channels = config.channels;
+  table->coeffs.resize(VOLUME_STEPS * COEFFS);
+  table->flat.resize(VOLUME_STEPS);
+  table->rampSamples = config.rampMs * sampleRate / 1000.0f;
+
+  // Biquad's shelf generators, their trig only runs here
+  Biquad generator;
+  generator.sampleRateChanged(sampleRate);
+  int reference = std::clamp(config.referenceVolume, 1, VOLUME_STEPS - 1);
+  for (int step = 0; step < VOLUME_STEPS; step++) {
+    // 0 mutes, it gets the boosts of the first step so unmuting doesn't ramp
+    float depth = 0.0f;
+    if (reference > 1) {
+      depth = std::clamp(
+          (float)(reference - std::max(step, 1)) / (reference - 1), 0.0f,
+          1.0f);
+    }
+    float* coeffs = table->coeffs.data() + step * COEFFS;
+
+    // A 0 dB shelf has its numerator equal to its denominator, so ramps out
+    // of flat steps stay smooth
+    std::map<std::string, float> shelf = {{"freq", config.lowFrequency},
+                                          {"gain", config.lowBoostDb * depth},
+                                          {"slope", 1.0f}};
+    generator.configure(Biquad::Type::Lowshelf, shelf);
+    std::copy(generator.getCoefficients(), generator.getCoefficients() + 5,
+              coeffs);
+
+    shelf["freq"] = config.highFrequency;
+    shelf["gain"] = config.highBoostDb * depth;
+    generator.configure(Biquad::Type::Highshelf, shelf);
+    std::copy(generator.getCoefficients(), generator.getCoefficients() + 5,
+              coeffs + 5);
+
+    table->flat[step] = depth == 0.0f || (config.lowBoostDb == 0.0f &&
+                                          config.highBoostDb == 0.0f);
+  }
+
+  // Keep the delay lines while the channels stay the same
+  auto previous = activeTable.current();
+  if (previous && previous->channels == table->channels) {
+    table->state = previous->state;
+  } else {
+    table->state =
+        std::make_shared<std::vector<float>>(table->channels.size() * 4, 0.0f);
+  }
+  activeTable.publish(table);
+}
+
+bool LoudnessContour::applyVolumeStep(int volume) {
+  volumeStep = std::clamp(volume, 0, VOLUME_STEPS - 1);
+  return true;
+}
+
+bool LoudnessContour::isIdentity() {
+  auto table = activeTable.read();
+  return !table || (table->flat[volumeStep] && rampStep == volumeStep &&
+                    !ramp.isRamping());
+}
+
+void BELL_HOT LoudnessContour::process(StreamInfo& data) {
+  auto table = activeTable.read();
+  if (!table || table->channels.empty()) {
+    return;
+  }
+
+  int step = volumeStep;
+  // The first block starts on its step, later ones ramp to theirs
+  ramp.setTarget(table->coeffs.data() + step * COEFFS,
+                 rampStep < 0 ? 0 : table->rampSamples);
+  rampStep = step;
+
+  auto& state = *table->state;
+  size_t done = 0;
+  while (done < data.numSamples) {
+    size_t samples = data.numSamples - done;
+    if (ramp.isRamping()) {
+      samples = std::min({RAMP_BLOCK_SIZE, samples, ramp.samplesLeft()});
+    }
+    for (size_t c = 0; c < table->channels.size(); c++) {
+      if (table->channels[c] < data.numChannels) {
+        dsp::biquadCascade(data.data[table->channels[c]] + done, samples,
+                           ramp.values(), state.data() + c * 4, 2);
+      }
+    }
+    ramp.advance(samples);
+    done += samples;
+  }
+  dsp::flushDenormals(state.data(), state.size());
+}
@@ -0,0 +1,234 @@
+#include "LoudnessMeter.h"
+
+#include <algorithm>  // for min, max, fill
+#include <cmath>      // for tan, pow, log10, abs, M_PI
+#include <iterator>   // for begin, end
+#include <map>        // for map
+#include <string>     // for string
+
+#include "StreamInfo.h"  // for StreamInfo
+
+using namespace bell;
+
+// Gating blocks more than this below the absolute-gated loudness are dropped
+#define RELATIVE_GATE 10.0f
+#define HISTOGRAM_STEP 0.1f
+
+// Loudness of a mean square, BS.1770 offsets it by the K-weighting's gain
+// at 1 kHz
+static float toLoudness(double energy) {
+  if (energy <= 0) {
+    return LoudnessMeter::SILENCE;
+  }
+  return std::max<float>(-0.691 + 10 * std::log10(energy),
+                         LoudnessMeter::SILENCE);
+}
+
+static double toEnergy(float loudness) {
+  return std::pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+// Sum of squares in independent partial sums, which the compiler keeps in
+// vector lanes
+static float sumSquares(const float* data, size_t samples) {
+  float partial[8] = {0};
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    for (size_t lane = 0; lane < 8; lane++) {
+      partial[lane] += data[i + lane] * data[i + lane];
+    }
+  }
+  float sum = 0;
+  for (; i < samples; i++) {
+    sum += data[i] * data[i];
+  }
+  for (size_t lane = 0; lane < 8; lane++) {
+    sum += partial[lane];
+  }
+  return sum;
+}
+
+static float maxAbs(const float* data, size_t samples) {
+  float partial[8] = {0};
+  size_t i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    for (size_t lane = 0; lane < 8; lane++) {
+      partial[lane] = std::max(partial[lane], std::abs(data[i + lane]));
+    }
+  }
+  float result = 0;
+  for (; i < samples; i++) {
+    result = std::max(result, std::abs(data[i]));
+  }
+  for (size_t lane = 0; lane < 8; lane++) {
+    result = std::max(result, partial[lane]);
+  }
+  return result;
+}
+
+void LoudnessMeter::configure(uint32_t sampleRate, int channels) {
+  this->sampleRate = sampleRate;
+  this->channels = channels;
+  subBlockSamples = std::max<size_t>(sampleRate / 10, 1);
+
+  // Pre-filter of BS.1770, designed for any rate as libebur128 does
+  double shelfK = std::tan(M_PI * 1681.974450955533 / sampleRate);
+  double shelfQ = 0.7071752369554196;
+  double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+  double vb = std::pow(vh, 0.4996667741545416);
+  double shelfA0 = 1.0 + shelfK / shelfQ + shelfK * shelfK;
+  std::map<std::string, float> shelf = {
+      {"b0", (vh + vb * shelfK / shelfQ + shelfK * shelfK) / shelfA0},
+      {"b1", 2.0 * (shelfK * shelfK - vh) / shelfA0},
+      {"b2", (vh - vb * shelfK / shelfQ + shelfK * shelfK) / shelfA0},
+      {"a1", 2.0 * (shelfK * shelfK - 1.0) / shelfA0},
+      {"a2", (1.0 - shelfK / shelfQ + shelfK * shelfK) / shelfA0}};
+
+  double highpassK = std::tan(M_PI * 38.13547087602444 / sampleRate);
+  double highpassQ = 0.5003270373238773;
+  double highpassA0 = 1.0 + highpassK / highpassQ + highpassK * highpassK;
+  std::map<std::string, float> highpass = {
+      {"b0", 1.0f},
+      {"b1", -2.0f},
+      {"b2", 1.0f},
+      {"a1", 2.0 * (highpassK * highpassK - 1.0) / highpassA0},
+      {"a2", (1.0 - highpassK / highpassQ + highpassK * highpassK) /
+                 highpassA0}};
+
+  filters.clear();
+  weights.assign(channels, 1.0f);
+  for (int channel = 0; channel < channels; channel++) {
+    for (auto* coeffs : {&shelf, &highpass}) {
+      auto filter = std::make_unique<Biquad>();
+      filter->channel = channel;
+      filter->setRampTime(0);
+      filter->sampleRateChanged(sampleRate);
+      filter->configure(Biquad::Type::Free, *coeffs);
+      filters.push_back(std::move(filter));
+    }
+  }
+  if (channels == 5 || channels == 6) {
+    weights[channels - 2] = weights[channels - 1] = 1.41f;
+  }
+  if (channels == 6) {
+    weights[3] = 0;
+  }
+
+  scratch.resize(channels * SCRATCH_SAMPLES);
+  scratchChannels.resize(channels);
+  for (int channel = 0; channel < channels; channel++) {
+    scratchChannels[channel] = scratch.data() + channel * SCRATCH_SAMPLES;
+  }
+  histogram.assign(HISTOGRAM_BINS, 0);
+  reset();
+}
+
+void LoudnessMeter::reset() {
+  blockEnergy = 0;
+  blockFill = 0;
+  subBlockCount = 0;
+  std::fill(std::begin(subBlocks), std::end(subBlocks), 0.0f);
+  std::fill(histogram.begin(), histogram.end(), 0);
+  samplesMeasured = 0;
+  peak = 0;
+}
+
+void LoudnessMeter::process(float* const* data, size_t samples) {
+  if (channels == 0) {
+    return;
+  }
+
+  StreamInfo stream = {};
+  stream.data = scratchChannels.data();
+  stream.numChannels = channels;
+  for (size_t done = 0; done < samples;) {
+    // Never across a sub-block boundary
+    size_t chunk = std::min({samples - done, SCRATCH_SAMPLES,
+                             subBlockSamples - blockFill});
+    stream.numSamples = chunk;
+
+    double energy = 0;
+    for (int channel = 0; channel < channels; channel++) {
+      float* filtered = scratchChannels[channel];
+      std::copy(data[channel] + done, data[channel] + done + chunk, filtered);
+      peak = std::max(peak, maxAbs(filtered, chunk));
+      filters[channel * 2]->process(stream);
+      filters[channel * 2 + 1]->process(stream);
+      energy += weights[channel] * sumSquares(filtered, chunk);
+    }
+
+    blockEnergy += energy;
+    blockFill += chunk;
+    done += chunk;
+    if (blockFill == subBlockSamples) {
+      finishSubBlock();
+    }
+  }
+  samplesMeasured += samples;
+}
+
+void LoudnessMeter::finishSubBlock() {
+  subBlocks[subBlockCount % SUB_BLOCKS] = blockEnergy / subBlockSamples;
+  subBlockCount++;
+  blockEnergy = 0;
+  blockFill = 0;
+
+  // Gating blocks overlap by 75 %, one ends with every sub-block
+  if (subBlockCount < GATE_SUB_BLOCKS) {
+    return;
+  }
+  float loudness = toLoudness(recentEnergy(GATE_SUB_BLOCKS));
+  if (loudness > SILENCE) {
+    size_t bin = (loudness - SILENCE) / HISTOGRAM_STEP;
+    histogram[std::min(bin, HISTOGRAM_BINS - 1)]++;
+  }
+}
+
+float LoudnessMeter::recentEnergy(size_t count) const {
+  count = std::min(count, subBlockCount);
+  if (count == 0) {
+    return 0;
+  }
+
+  double energy = 0;
+  for (size_t i = 1; i <= count; i++) {
+    energy += subBlocks[(subBlockCount - i) % SUB_BLOCKS];
+  }
+  return energy / count;
+}
+
+float LoudnessMeter::getMomentary() const {
+  return toLoudness(recentEnergy(GATE_SUB_BLOCKS));
+}
+
+float LoudnessMeter::getShortTerm() const {
+  return toLoudness(recentEnergy(SUB_BLOCKS));
+}
+
+float LoudnessMeter::getIntegrated() const {
+  // Bins stand for the energy at their centre
+  auto gatedEnergy = [this](size_t firstBin) {
+    double energy = 0;
+    uint64_t blocks = 0;
+    for (size_t bin = firstBin; bin < histogram.size(); bin++) {
+      if (histogram[bin] > 0) {
+        energy += histogram[bin] *
+                  toEnergy(SILENCE + (bin + 0.5f) * HISTOGRAM_STEP);
+        blocks += histogram[bin];
+      }
+    }
+    return blocks > 0 ? energy / blocks : 0;
+  };
+
+  float absolute = toLoudness(gatedEnergy(0));
+  if (absolute <= SILENCE) {
+    return SILENCE;
+  }
+  float relative = absolute - RELATIVE_GATE;
+  size_t firstBin = std::max<float>(relative - SILENCE, 0) / HISTOGRAM_STEP;
+  return toLoudness(gatedEnergy(std::min(firstBin, HISTOGRAM_BINS - 1)));
+}
+
+uint32_t LoudnessMeter::getMeasuredMs() const {
+  return sampleRate > 0 ? samplesMeasured * 1000 / sampleRate : 0;
+}
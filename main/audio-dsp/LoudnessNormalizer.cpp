@@ -0,0 +1,106 @@
+#include "LoudnessNormalizer.h"
+
+#include <algorithm>  // for min
+#include <cmath>      // for pow, log10
+
+#include "FixedPoint.h"  // for scale, scaleRamp
+
+using namespace bell;
+
+LoudnessNormalizer::LoudnessNormalizer() : AudioTransform() {
+  this->filterType = "loudness";
+  activeParams.publish(std::make_shared<Params>(params));
+}
+
+void LoudnessNormalizer::configure(float targetLufs, float maxGainDb,
+                                   bool preventClipping) {
+  params.target = targetLufs;
+  params.maxGain = maxGainDb;
+  params.preventClipping = preventClipping;
+  activeParams.publish(std::make_shared<Params>(params));
+}
+
+void LoudnessNormalizer::setTagGain(float gainDb, float peak) {
+  std::scoped_lock lock(this->accessMutex);
+  params.hasTag = true;
+  params.tagGain = gainDb;
+  params.tagPeak = peak;
+  activeParams.publish(std::make_shared<Params>(params));
+}
+
+void LoudnessNormalizer::trackChanged() {
+  std::scoped_lock lock(this->accessMutex);
+  params.hasTag = false;
+  activeParams.publish(std::make_shared<Params>(params));
+  resetPending = true;
+}
+
+float LoudnessNormalizer::targetGain(const Params& params) {
+  float gain = gainDb;
+  float peak = meter.getPeak();
+  if (params.hasTag) {
+    gain = params.tagGain + params.target - REPLAYGAIN_REFERENCE;
+    peak = std::max(peak, params.tagPeak);
+  } else if (integratedLoudness > LoudnessMeter::SILENCE &&
+             measuredMs >= MIN_MEASURE_MS) {
+    gain = params.target - integratedLoudness;
+  }
+
+  gain = std::min(gain, params.maxGain);
+  if (params.preventClipping && peak > 0) {
+    gain = std::min(gain, -20.0f * std::log10(peak));
+  }
+  return gain;
+}
+
+void LoudnessNormalizer::process(StreamInfo& data) {
+  auto params = activeParams.read();
+  if (!params || data.numChannels == 0) {
+    return;
+  }
+
+  if (meter.getSampleRate() != sampleRate ||
+      meter.getChannelCount() != data.numChannels) {
+    meter.configure(sampleRate, data.numChannels);
+    resetPending = true;
+  }
+  if (resetPending.exchange(false)) {
+    meter.reset();
+    // Publish the reset right away
+    samplesSinceUpdate = sampleRate;
+  }
+
+  // The unprocessed signal is measured, the gain doesn't feed back
+  meter.process(data.data, data.numSamples);
+
+  // Integrated loudness walks the whole histogram, a few times a second is
+  // plenty
+  samplesSinceUpdate += data.numSamples;
+  if (samplesSinceUpdate >= sampleRate / 10) {
+    samplesSinceUpdate = 0;
+    integratedLoudness = meter.getIntegrated();
+    measuredPeak = meter.getPeak();
+    measuredMs = meter.getMeasuredMs();
+    gainDb = targetGain(*params);
+    appliedGain = gainDb;
+  }
+
+  float factor = std::pow(10.0f, gainDb / 20.0f);
+  ramp.setTarget(&factor, RAMP_TIME_MS * sampleRate / 1000.0f);
+
+  size_t done = 0;
+  if (ramp.isRamping()) {
+    done = std::min(data.numSamples, ramp.samplesLeft());
+    float start = ramp.values()[0];
+    ramp.advance(done);
+    float step = (ramp.values()[0] - start) / done;
+    for (int channel = 0; channel < data.numChannels; channel++) {
+      dsp::scaleRamp(data.data[channel], done, start, step);
+    }
+  }
+
+  for (int channel = 0; channel < data.numChannels; channel++) {
+    dsp::scale(data.data[channel] + done, data.numSamples - done,
+               ramp.values()[0]);
+  }
+}
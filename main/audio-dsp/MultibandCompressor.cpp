@@ -0,0 +1,284 @@
+#include "MultibandCompressor.h"
+
+#include <algorithm>  // for min, max
+#include <array>      // for array
+#include <cmath>      // for abs, expf
+#include <map>        // for map
+#include <mutex>      // for scoped_lock
+#include <stdexcept>  // for invalid_argument
+#include <string>     // for string
+
+#include "Biquad.h"      // for Biquad, Biquad::Type
+#include "Compressor.h"  // for log2f_approx, exp2f_approx
+#include "Denormals.h"   // for flushDenormals
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#define BELL_MULTIBAND_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BELL_MULTIBAND_SIMD
+#endif
+
+using namespace bell;
+
+// 20 * log10(x) = 20 * log10(2) * log2(x)
+static constexpr float DB_PER_LOG2 = 6.020599913279624f;
+// LR4 is two Butterworth sections, their sum an allpass of the same Q
+static constexpr float BUTTERWORTH_Q = 0.7071067811865476f;
+
+typedef std::array<float, 5> Section;
+
+static Section designSection(Biquad& generator, Biquad::Type type,
+                             float freq) {
+  std::map<std::string, float> config = {{"freq", freq},
+                                         {"q", BUTTERWORTH_Q}};
+  generator.configure(type, config);
+  const float* c = generator.getCoefficients();
+  return {c[0], c[1], c[2], c[3], c[4]};
+}
+
+MultibandCompressor::MultibandCompressor() {
+  this->filterType = "multiband_compressor";
+}
+
+void MultibandCompressor::configure(std::vector<int> channels,
+                                    const std::vector<float>& crossovers,
+                                    const std::vector<Band>& bands) {
+  if (bands.size() > MAX_BANDS || bands.size() != crossovers.size() + 1) {
+    throw std::invalid_argument(
+        "A multiband compressor takes up to " + std::to_string(MAX_BANDS) +
+        " bands, one more than its crossovers");
+  }
+
+  std::scoped_lock lock(this->accessMutex);
+  this->channels = channels;
+
+  auto plan = std::make_shared<Plan>();
+  plan->channels = channels;
+  plan->bands = bands.size();
+  plan->sections = crossovers.size() * SECTIONS_PER_STAGE;
+
+  // Pass-through (b0 = 1) unless a stage sets the lane's sections
+  plan->coeffs.assign(plan->sections * 5 * LANES, 0.0f);
+  for (size_t s = 0; s < plan->sections; s++) {
+    for (size_t lane = 0; lane < LANES; lane++) {
+      plan->coeffs[s * 5 * LANES + lane] = 1.0f;
+    }
+  }
+
+  Biquad generator;
+  generator.sampleRateChanged(sampleRate);
+  for (size_t stage = 0; stage < crossovers.size(); stage++) {
+    Section lowpass =
+        designSection(generator, Biquad::Type::Lowpass, crossovers[stage]);
+    Section highpass =
+        designSection(generator, Biquad::Type::Highpass, crossovers[stage]);
+    Section allpass =
+        designSection(generator, Biquad::Type::Allpass, crossovers[stage]);
+
+    for (size_t lane = 0; lane < plan->bands; lane++) {
+      // Bands below the crossover only get its phase shift
+      std::vector<const Section*> sections = {&allpass};
+      if (lane == stage) {
+        sections = {&lowpass, &lowpass};
+      } else if (lane > stage) {
+        sections = {&highpass, &highpass};
+      }
+      for (size_t i = 0; i < sections.size(); i++) {
+        size_t s = stage * SECTIONS_PER_STAGE + i;
+        for (size_t c = 0; c < 5; c++) {
+          plan->coeffs[(s * 5 + c) * LANES + lane] = (*sections[i])[c];
+        }
+      }
+    }
+  }
+
+  // Time constants are per envelope block, not per sample
+  float blockRate = sampleRate / ENVELOPE_BLOCK;
+  for (size_t lane = 0; lane < LANES; lane++) {
+    Band band = lane < bands.size() ? bands[lane] : Band();
+    plan->attack[lane] = expf(-1000.0f / blockRate / band.attack);
+    plan->release[lane] = expf(-1000.0f / blockRate / band.release);
+    plan->threshold[lane] = band.threshold;
+    plan->slope[lane] = (band.factor - 1.0f) / band.factor;
+    plan->makeupGain[lane] = band.makeupGain;
+  }
+
+  // Keep the envelopes and delay lines if only parameters changed
+  auto previous = activePlan.current();
+  if (previous && previous->channels == channels &&
+      previous->bands == plan->bands) {
+    plan->state = previous->state;
+  } else {
+    plan->state = std::make_shared<State>();
+    plan->state->filters.assign(
+        channels.size() * plan->sections * 2 * LANES, 0.0f);
+    plan->state->split.assign(channels.size() * ENVELOPE_BLOCK * LANES,
+                              0.0f);
+    for (size_t lane = 0; lane < LANES; lane++) {
+      plan->state->loudness[lane] = -100.0f;
+      plan->state->gain[lane] = lane < plan->bands ? 1.0f : 0.0f;
+    }
+  }
+
+  activePlan.publish(plan);
+}
+
+void MultibandCompressor::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan || plan->channels.empty()) {
+    return;
+  }
+
+  State& state = *plan->state;
+  size_t channelCount = plan->channels.size();
+  size_t filterStride = plan->sections * 2 * LANES;
+  auto present = [&](size_t c) {
+    return plan->channels[c] < data.numChannels;
+  };
+
+  for (size_t offset = 0; offset < data.numSamples; offset += ENVELOPE_BLOCK) {
+    size_t samples = std::min(ENVELOPE_BLOCK, data.numSamples - offset);
+
+    for (size_t c = 0; c < channelCount; c++) {
+      if (present(c)) {
+        splitBands(*plan, data.data[plan->channels[c]] + offset,
+                   state.filters.data() + c * filterStride,
+                   state.split.data() + c * ENVELOPE_BLOCK * LANES, samples);
+      }
+    }
+
+    // Peak of each band over the summed channels
+    float peak[LANES] = {0.0f};
+    for (size_t i = 0; i < samples; i++) {
+      float sum[LANES] = {0.0f};
+      for (size_t c = 0; c < channelCount; c++) {
+        if (!present(c)) {
+          continue;
+        }
+        const float* bands = state.split.data() + (c * ENVELOPE_BLOCK + i) *
+                                                      LANES;
+        for (size_t lane = 0; lane < LANES; lane++) {
+          sum[lane] += bands[lane];
+        }
+      }
+      for (size_t lane = 0; lane < LANES; lane++) {
+        peak[lane] = std::max(peak[lane], std::abs(sum[lane]));
+      }
+    }
+
+    // Unused lanes carry the unfiltered signal, their gain stays 0
+    float gain[LANES] = {0.0f};
+    float step[LANES];
+    for (size_t lane = 0; lane < plan->bands; lane++) {
+      float loudness = DB_PER_LOG2 * log2f_approx(peak[lane] + 1.0e-9f);
+      float last = state.loudness[lane];
+      float coeff =
+          loudness >= last ? plan->attack[lane] : plan->release[lane];
+      loudness = coeff * last + (1.0f - coeff) * loudness;
+      state.loudness[lane] = loudness;
+
+      float gainDb = plan->makeupGain[lane];
+      if (loudness > plan->threshold[lane]) {
+        gainDb -= (loudness - plan->threshold[lane]) * plan->slope[lane];
+      }
+      gain[lane] = exp2f_approx(gainDb / DB_PER_LOG2);
+    }
+    for (size_t lane = 0; lane < LANES; lane++) {
+      step[lane] = (gain[lane] - state.gain[lane]) / samples;
+    }
+
+    // Sum the bands back, interpolating from the previous block's gains
+    for (size_t c = 0; c < channelCount; c++) {
+      if (!present(c)) {
+        continue;
+      }
+      float* output = data.data[plan->channels[c]] + offset;
+      const float* bands = state.split.data() + c * ENVELOPE_BLOCK * LANES;
+      float current[LANES];
+      std::copy(state.gain, state.gain + LANES, current);
+      for (size_t i = 0; i < samples; i++) {
+        float sum = 0.0f;
+        for (size_t lane = 0; lane < LANES; lane++) {
+          current[lane] += step[lane];
+          sum += bands[i * LANES + lane] * current[lane];
+        }
+        output[i] = sum;
+      }
+    }
+    std::copy(gain, gain + LANES, state.gain);
+  }
+  dsp::flushDenormals(state.filters.data(), state.filters.size());
+}
+
+#ifdef BELL_MULTIBAND_SIMD
+#if defined(__SSE__)
+typedef __m128 vec4;
+#define vdup(x) _mm_set1_ps(x)
+#define vload(p) _mm_loadu_ps(p)
+#define vstore(p, v) _mm_storeu_ps(p, v)
+#define vmul(a, b) _mm_mul_ps(a, b)
+#define vadd(a, b) _mm_add_ps(a, b)
+#define vsub(a, b) _mm_sub_ps(a, b)
+#else
+typedef float32x4_t vec4;
+#define vdup(x) vdupq_n_f32(x)
+#define vload(p) vld1q_f32(p)
+#define vstore(p, v) vst1q_f32(p, v)
+#define vmul(a, b) vmulq_f32(a, b)
+#define vadd(a, b) vaddq_f32(a, b)
+#define vsub(a, b) vsubq_f32(a, b)
+#endif
+
+void MultibandCompressor::splitBands(const Plan& plan, const float* input,
+                                     float* state, float* split,
+                                     size_t samples) {
+  const float* coeffs = plan.coeffs.data();
+  for (size_t i = 0; i < samples; i++) {
+    // Every lane starts from the same sample
+    vec4 x = vdup(input[i]);
+    for (size_t s = 0; s < plan.sections; s++) {
+      const float* c = coeffs + s * 5 * LANES;
+      float* w = state + s * 2 * LANES;
+
+      vec4 w0 = vload(w);
+      vec4 w1 = vload(w + LANES);
+      vec4 d0 = vsub(vsub(x, vmul(vload(c + 3 * LANES), w0)),
+                     vmul(vload(c + 4 * LANES), w1));
+      x = vadd(vadd(vmul(vload(c), d0), vmul(vload(c + LANES), w0)),
+               vmul(vload(c + 2 * LANES), w1));
+      vstore(w + LANES, w0);
+      vstore(w, d0);
+    }
+    vstore(split + i * LANES, x);
+  }
+}
+#else
+// No vector unit, run the lanes one after the other
+void MultibandCompressor::splitBands(const Plan& plan, const float* input,
+                                     float* state, float* split,
+                                     size_t samples) {
+  for (size_t lane = 0; lane < plan.bands; lane++) {
+    for (size_t i = 0; i < samples; i++) {
+      float x = input[i];
+      for (size_t s = 0; s < plan.sections; s++) {
+        const float* c = plan.coeffs.data() + s * 5 * LANES + lane;
+        float* w = state + s * 2 * LANES + lane;
+
+        float d0 = x - c[3 * LANES] * w[0] - c[4 * LANES] * w[LANES];
+        x = c[0] * d0 + c[LANES] * w[0] + c[2 * LANES] * w[LANES];
+        w[LANES] = w[0];
+        w[0] = d0;
+      }
+      split[i * LANES + lane] = x;
+    }
+  }
+  // Lanes past the bands are never read but summed with a gain of 0
+  for (size_t lane = plan.bands; lane < LANES; lane++) {
+    for (size_t i = 0; i < samples; i++) {
+      split[i * LANES + lane] = 0.0f;
+    }
+  }
+}
+#endif
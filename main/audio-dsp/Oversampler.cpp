@@ -0,0 +1,369 @@
+#include "Oversampler.h"
+
+#include <algorithm>  // for copy, fill, max
+#include <cmath>      // for ceil, sqrt, tan, pow, fabs, sin, cos, log
+#include <mutex>      // for scoped_lock
+#include <stdexcept>  // for invalid_argument
+
+#include "BellHotPath.h"         // for BELL_HOT
+#include "Denormals.h"           // for flushDenormals
+#include "PolyphaseResampler.h"  // for dot, besselI0
+
+using namespace bell;
+
+// Rejection both filter kinds are designed for, below float rounding
+static constexpr double STOPBAND_DB = 120.0;
+// Transition of the first 2x stage, around 0.25 of the doubled rate
+static constexpr double FIRST_TRANSITION = 0.05;
+
+dsp::HalfBand::HalfBand(Phase phase, double transition, size_t channels,
+                        size_t maxFrames)
+    : phase(phase), channels(channels), maxFrames(maxFrames) {
+  if (phase == Phase::LINEAR) {
+    designLinear(transition);
+  } else {
+    designMinimum(transition);
+  }
+  reset();
+}
+
+void dsp::HalfBand::designLinear(double transition) {
+  // Kaiser's estimates, for a filter of 4m - 1 taps
+  double beta = 0.1102 * (STOPBAND_DB - 8.7);
+  double length = (STOPBAND_DB - 7.95) / (14.36 * transition) + 1.0;
+  size_t m = (size_t)std::ceil((length + 1.0) / 4.0);
+  // 2m taps on the filtering branch, a multiple of 4 for dot()
+  m += m % 2;
+
+  double center = 2.0 * m - 1.0;
+  double norm = besselI0(beta);
+  taps.resize(2 * m);
+  for (size_t q = 0; q < 2 * m; q++) {
+    // Odd offsets from the center, even ones are 0 but the center's 0.5
+    double x = 2.0 * q - center;
+    double sinc = std::sin(M_PI * x / 2.0) / (M_PI * x);
+    double w = x / center;
+    double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - w * w)));
+    taps[q] = (float)(sinc * window / norm);
+  }
+
+  stride = taps.size() + maxFrames;
+  history.resize(channels * stride);
+  delayed.resize(channels * stride);
+}
+
+void dsp::HalfBand::designMinimum(double transition) {
+  // Elliptic half-band as two allpass chains, after Valenzuela and
+  // Constantinides, the same design HIIR uses
+  double k = std::tan((1.0 - 2.0 * transition) * M_PI / 4.0);
+  k *= k;
+  double kksqrt = std::pow(1.0 - k * k, 0.25);
+  double e = 0.5 * (1.0 - kksqrt) / (1.0 + kksqrt);
+  double e4 = e * e * e * e;
+  double q = e * (1.0 + e4 * (2.0 + e4 * (15.0 + 150.0 * e4)));
+
+  double attenuation = std::pow(10.0, -STOPBAND_DB / 10.0);
+  double a = attenuation / (1.0 - attenuation);
+  int order = (int)std::ceil(std::log(a * a / 16.0) / std::log(q));
+  order = std::max(order | 1, 3);
+
+  coeffs.resize((order - 1) / 2);
+  for (size_t index = 0; index < coeffs.size(); index++) {
+    double c = index + 1.0;
+    double num = 0.0, term = 0.0;
+    int i = 0;
+    do {
+      term = std::pow(q, i * (i + 1)) *
+             std::sin((2 * i + 1) * c * M_PI / order) * (i % 2 ? -1 : 1);
+      num += term;
+      i++;
+    } while (std::fabs(term) > 1e-100);
+    double den = 0.0;
+    i = 1;
+    do {
+      term = std::pow(q, i * i) * std::cos(2 * i * c * M_PI / order) *
+             (i % 2 ? -1 : 1);
+      den += term;
+      i++;
+    } while (std::fabs(term) > 1e-100);
+
+    double ww = num * std::pow(q, 0.25) / (den + 0.5);
+    double wwsq = ww * ww;
+    double x = std::sqrt((1.0 - wwsq * k) * (1.0 - wwsq / k)) / (1.0 + wwsq);
+    coeffs[index] = (float)((1.0 - x) / (1.0 + x));
+  }
+
+  x.resize(channels * coeffs.size());
+  y.resize(channels * coeffs.size());
+}
+
+void dsp::HalfBand::reset() {
+  std::fill(history.begin(), history.end(), 0.0f);
+  std::fill(delayed.begin(), delayed.end(), 0.0f);
+  std::fill(x.begin(), x.end(), 0.0f);
+  std::fill(y.begin(), y.end(), 0.0f);
+}
+
+float dsp::HalfBand::getLatency() const {
+  if (phase == Phase::LINEAR) {
+    return taps.size() - 1.0f;
+  }
+
+  // A first order allpass in z^-2 delays DC by 2 (1 - c) / (1 + c), the
+  // branches are averaged and the second one trails by a sample
+  float delay = 1.0f;
+  for (float c : coeffs) {
+    delay += 2.0f * (1.0f - c) / (1.0f + c);
+  }
+  return delay / 2.0f;
+}
+
+inline void dsp::HalfBand::allpass(size_t channel, float& even, float& odd) {
+  float* xs = x.data() + channel * coeffs.size();
+  float* ys = y.data() + channel * coeffs.size();
+  for (size_t i = 0; i < coeffs.size(); i++) {
+    float& sample = i % 2 ? odd : even;
+    float out = (sample - ys[i]) * coeffs[i] + xs[i];
+    xs[i] = sample;
+    ys[i] = out;
+    sample = out;
+  }
+}
+
+void BELL_HOT dsp::HalfBand::upsample(size_t channel, const float* in,
+                                      size_t frames, float* out) {
+  if (phase == Phase::MINIMUM) {
+    for (size_t i = 0; i < frames; i++) {
+      float even = in[i], odd = in[i];
+      allpass(channel, even, odd);
+      out[2 * i] = even;
+      out[2 * i + 1] = odd;
+    }
+    flushDenormals(y.data() + channel * coeffs.size(), coeffs.size());
+    return;
+  }
+
+  // history holds the last taps - 1 inputs, then this call's
+  size_t length = taps.size();
+  size_t m = length / 2;
+  float* hist = history.data() + channel * stride;
+  std::copy(in, in + frames, hist + length - 1);
+
+  for (size_t i = 0; i < frames; i++) {
+    // Taps are symmetric, oldest first reads the same as newest first; the
+    // interpolation gain of 2 cancels the center's 0.5
+    out[2 * i] = 2.0f * dot(taps.data(), hist + i, length);
+    out[2 * i + 1] = hist[i + m];
+  }
+  std::copy(hist + frames, hist + frames + length - 1, hist);
+}
+
+void BELL_HOT dsp::HalfBand::downsample(size_t channel, const float* in,
+                                        size_t frames, float* out) {
+  size_t pairs = frames / 2;
+  if (phase == Phase::MINIMUM) {
+    for (size_t i = 0; i < pairs; i++) {
+      float even = in[2 * i + 1], odd = in[2 * i];
+      allpass(channel, even, odd);
+      out[i] = 0.5f * (even + odd);
+    }
+    flushDenormals(y.data() + channel * coeffs.size(), coeffs.size());
+    return;
+  }
+
+  size_t length = taps.size();
+  size_t m = length / 2;
+  float* evens = history.data() + channel * stride;
+  float* odds = delayed.data() + channel * stride;
+  for (size_t i = 0; i < pairs; i++) {
+    evens[length - 1 + i] = in[2 * i];
+    odds[length - 1 + i] = in[2 * i + 1];
+  }
+
+  for (size_t i = 0; i < pairs; i++) {
+    out[i] = dot(taps.data(), evens + i, length) +
+             0.5f * odds[i + length - 1 - m];
+  }
+  std::copy(evens + pairs, evens + pairs + length - 1, evens);
+  std::copy(odds + pairs, odds + pairs + length - 1, odds);
+}
+
+// The second of two stages only has to reject what the first let through:
+// images of its passband start past half its rate, less the first's edge
+static double secondTransition() {
+  return 0.25 - FIRST_TRANSITION / 2.0;
+}
+
+static void checkFactor(uint32_t factor) {
+  if (factor != 2 && factor != 4) {
+    throw std::invalid_argument("Oversampling factor must be 2 or 4");
+  }
+}
+
+Oversampler::Oversampler(const Config& config) : config(config) {
+  this->filterType = "oversampler";
+  checkFactor(config.factor);
+  publishPlan();
+}
+
+void Oversampler::configure(const Config& config) {
+  checkFactor(config.factor);
+  std::scoped_lock lock(this->accessMutex);
+  this->config = config;
+  publishPlan();
+}
+
+void Oversampler::sampleRateChanged(uint32_t sampleRate) {
+  // The filters are relative to the rate, a fresh plan only drops the
+  // previous stream's history
+  std::scoped_lock lock(this->accessMutex);
+  publishPlan();
+}
+
+void Oversampler::publishPlan() {
+  auto plan = std::make_shared<Plan>();
+  plan->factor = config.factor;
+  plan->channels = config.maxChannels;
+  plan->maxInputFrames = config.maxInputFrames;
+
+  plan->stages.push_back(std::make_unique<dsp::HalfBand>(
+      config.phase, FIRST_TRANSITION, config.maxChannels,
+      config.maxInputFrames));
+  if (config.factor == 4) {
+    plan->stages.push_back(std::make_unique<dsp::HalfBand>(
+        config.phase, secondTransition(), config.maxChannels,
+        2 * config.maxInputFrames));
+    plan->scratch.resize(2 * config.maxInputFrames);
+  }
+
+  size_t planeSize = config.factor * config.maxInputFrames;
+  plan->planarData.assign(planeSize * config.maxChannels, 0.0f);
+  for (size_t ch = 0; ch < config.maxChannels; ch++) {
+    plan->channelData.push_back(plan->planarData.data() + ch * planeSize);
+  }
+
+  activePlan.publish(plan);
+}
+
+float Oversampler::getLatency() {
+  auto plan = activePlan.read();
+  float latency = 0.0f;
+  for (size_t i = 0; i < plan->stages.size(); i++) {
+    // Stage i runs at 2^(i + 1) times the input rate
+    latency += plan->stages[i]->getLatency() / (2 << i);
+  }
+  return latency;
+}
+
+void Oversampler::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan || (size_t)data.numChannels > plan->channels ||
+      data.numSamples > plan->maxInputFrames) {
+    return;
+  }
+
+  for (size_t ch = 0; ch < (size_t)data.numChannels; ch++) {
+    float* out = plan->channelData[ch];
+    if (plan->factor == 2) {
+      plan->stages[0]->upsample(ch, data.data[ch], data.numSamples, out);
+    } else {
+      float* scratch = plan->scratch.data();
+      plan->stages[0]->upsample(ch, data.data[ch], data.numSamples, scratch);
+      plan->stages[1]->upsample(ch, scratch, 2 * data.numSamples, out);
+    }
+  }
+
+  data.numSamples *= plan->factor;
+  data.data = plan->channelData.data();
+  data.sampleRate = static_cast<SampleRate>(
+      static_cast<uint32_t>(data.sampleRate) * plan->factor);
+}
+
+Decimator::Decimator(const Config& config) : config(config) {
+  this->filterType = "decimator";
+  checkFactor(config.factor);
+  publishPlan();
+}
+
+void Decimator::configure(const Config& config) {
+  checkFactor(config.factor);
+  std::scoped_lock lock(this->accessMutex);
+  this->config = config;
+  publishPlan();
+}
+
+void Decimator::sampleRateChanged(uint32_t sampleRate) {
+  std::scoped_lock lock(this->accessMutex);
+  publishPlan();
+}
+
+void Decimator::publishPlan() {
+  auto plan = std::make_shared<Plan>();
+  plan->factor = config.factor;
+  plan->channels = config.maxChannels;
+  plan->maxInputFrames = config.maxInputFrames;
+
+  // Frames of one call, with the previous call's remainder
+  size_t frames = config.maxInputFrames + config.factor;
+  if (config.factor == 4) {
+    // Mirrors Oversampler, the wide stage at the raised rate first
+    plan->stages.push_back(std::make_unique<dsp::HalfBand>(
+        config.phase, secondTransition(), config.maxChannels, frames / 2));
+    plan->scratch.resize(frames / 2);
+  }
+  plan->stages.push_back(std::make_unique<dsp::HalfBand>(
+      config.phase, FIRST_TRANSITION, config.maxChannels,
+      frames / config.factor));
+
+  plan->carry.assign(config.factor * config.maxChannels, 0.0f);
+  plan->input.resize(frames);
+
+  size_t planeSize = frames / config.factor;
+  plan->planarData.assign(planeSize * config.maxChannels, 0.0f);
+  for (size_t ch = 0; ch < config.maxChannels; ch++) {
+    plan->channelData.push_back(plan->planarData.data() + ch * planeSize);
+  }
+
+  activePlan.publish(plan);
+}
+
+void Decimator::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan || (size_t)data.numChannels > plan->channels ||
+      data.numSamples > plan->maxInputFrames) {
+    return;
+  }
+
+  size_t factor = plan->factor;
+  size_t total = plan->carryFrames + data.numSamples;
+  size_t whole = total - total % factor;
+  size_t left = total - whole;
+
+  for (size_t ch = 0; ch < (size_t)data.numChannels; ch++) {
+    const float* in = data.data[ch];
+    float* carry = plan->carry.data() + ch * factor;
+    // Blocks in whole multiples with nothing carried go straight through
+    if (plan->carryFrames != 0 || left != 0) {
+      float* input = plan->input.data();
+      std::copy(carry, carry + plan->carryFrames, input);
+      std::copy(in, in + data.numSamples, input + plan->carryFrames);
+      std::copy(input + whole, input + total, carry);
+      in = input;
+    }
+
+    float* out = plan->channelData[ch];
+    if (factor == 2) {
+      plan->stages[0]->downsample(ch, in, whole, out);
+    } else {
+      float* scratch = plan->scratch.data();
+      plan->stages[0]->downsample(ch, in, whole, scratch);
+      plan->stages[1]->downsample(ch, scratch, whole / 2, out);
+    }
+  }
+  plan->carryFrames = left;
+
+  data.numSamples = whole / factor;
+  data.data = plan->channelData.data();
+  data.sampleRate = static_cast<SampleRate>(
+      static_cast<uint32_t>(data.sampleRate) / factor);
+}
@@ -0,0 +1,54 @@
+#include "PlaybackClock.h"
+
+#include <algorithm>  // for clamp
+#include <cstdlib>    // for llabs
+
+using namespace bell;
+
+PlaybackClock::PlaybackClock(const Config& config) : config(config) {}
+
+void PlaybackClock::reset() {
+  started = false;
+  smoothedUs = 0;
+  integralPpm = 0;
+  ppm = 0;
+}
+
+PlaybackClock::Adjustment PlaybackClock::update(int64_t timestampUs,
+                                                int64_t nowUs,
+                                                size_t queuedFrames,
+                                                uint32_t sampleRate) {
+  Adjustment adjustment;
+  if (sampleRate == 0) {
+    return adjustment;
+  }
+
+  int64_t heardUs = nowUs + (int64_t)queuedFrames * 1000000 / sampleRate;
+  int64_t errorUs = heardUs - (timestampUs + config.latencyUs);
+
+  if (!started || std::llabs(errorUs) > config.hardSyncUs) {
+    // Jump there, the integral keeps the drift learned so far
+    adjustment.skipFrames = errorUs * sampleRate / 1000000;
+    adjustment.ratio = getRatio();
+    started = true;
+    lastUpdateUs = nowUs;
+    smoothedUs = 0;
+    return adjustment;
+  }
+
+  double dt = (nowUs - lastUpdateUs) / 1e6;
+  lastUpdateUs = nowUs;
+  if (dt > 0) {
+    double tau = config.smoothingMs / 1e3;
+    smoothedUs += (errorUs - smoothedUs) * dt / (dt + tau);
+    integralPpm = std::clamp(
+        integralPpm + config.integralPpm * smoothedUs / 1e3 * dt,
+        -config.maxPpm, config.maxPpm);
+  }
+
+  // Late plays the input faster, above a ratio of 1
+  ppm = std::clamp(config.proportionalPpm * smoothedUs / 1e3 + integralPpm,
+                   -config.maxPpm, config.maxPpm);
+  adjustment.ratio = getRatio();
+  return adjustment;
+}
@@ -0,0 +1,109 @@
+#include "PlaybackPosition.h"
+
+#include <algorithm>  // for max, min
+
+#include "StreamInfo.h"  // for pcmBytesPerSample
+
+using namespace bell;
+
+uint64_t PlaybackPosition::Position::frameAt(int64_t localNs) const {
+  if (!playing || localNs <= this->localNs) {
+    return frame;
+  }
+  uint64_t advanced =
+      frame + (uint64_t)(localNs - this->localNs) * sampleRate / 1000000000;
+  return std::min(advanced, std::max(endFrame, frame));
+}
+
+PlaybackPosition::PlaybackPosition(size_t maxChunks)
+    : segments(std::max<size_t>(maxChunks, 1)) {}
+
+void PlaybackPosition::fed(const CentralAudioBuffer::AudioChunk& chunk,
+                           size_t outputFrames) {
+  size_t frameSize = pcmBytesPerSample(chunk.format) * chunk.channels;
+  if (frameSize == 0) {
+    return;
+  }
+  fed(chunk.trackHash, chunk.framePosition, chunk.pcmSize / frameSize,
+      chunk.sampleRate, outputFrames);
+}
+
+void PlaybackPosition::fed(size_t trackHash, uint64_t framePosition,
+                           size_t frames, uint32_t sampleRate,
+                           size_t outputFrames) {
+  if (outputFrames == 0) {
+    return;
+  }
+  if (count == segments.size()) {
+    // The sink can't hold that much, the oldest is long heard
+    head = (head + 1) % segments.size();
+    count--;
+  }
+  segments[(head + count) % segments.size()] = {
+      trackHash, framePosition, frames, sampleRate, outputFed, outputFrames};
+  count++;
+  outputFed += outputFrames;
+}
+
+void PlaybackPosition::update(size_t queuedFrames, int64_t localNs) {
+  if (count == 0) {
+    return;
+  }
+  uint64_t played = outputFed - std::min<uint64_t>(queuedFrames, outputFed);
+
+  // Drop what was heard, the last chunk stays to hold the position
+  while (count > 1) {
+    const Segment& oldest = segmentAt(0);
+    if (oldest.outputStart + oldest.outputFrames > played) {
+      break;
+    }
+    head = (head + 1) % segments.size();
+    count--;
+  }
+  position.publish(locate(played, localNs));
+}
+
+void PlaybackPosition::pause(int64_t localNs) {
+  Position paused = current();
+  paused.frame = paused.frameAt(localNs);
+  paused.localNs = localNs;
+  paused.playing = false;
+  position.publish(paused);
+}
+
+void PlaybackPosition::reset() {
+  head = 0;
+  count = 0;
+  outputFed = 0;
+  position.publish(Position());
+}
+
+PlaybackPosition::Position PlaybackPosition::locate(uint64_t played,
+                                                    int64_t localNs) const {
+  const Segment& segment = segmentAt(0);
+  uint64_t offset =
+      std::min<uint64_t>(played - std::min(played, segment.outputStart),
+                         segment.outputFrames);
+
+  Position result;
+  result.trackHash = segment.trackHash;
+  result.sampleRate = segment.sampleRate;
+  result.localNs = localNs;
+  // Output and track frames differ when the DSP converts the rate
+  result.frame =
+      segment.framePosition + offset * segment.frames / segment.outputFrames;
+  // Still playing while there's more of the track queued
+  result.playing = offset < segment.outputFrames;
+
+  result.endFrame = segment.framePosition + segment.frames;
+  for (size_t i = 1; i < count; i++) {
+    const Segment& next = segmentAt(i);
+    if (next.trackHash != segment.trackHash ||
+        next.framePosition != result.endFrame) {
+      break;
+    }
+    result.endFrame = next.framePosition + next.frames;
+    result.playing = true;
+  }
+  return result;
+}
@@ -0,0 +1,194 @@
+#include "PolyphaseResampler.h"
+
+#include <algorithm>  // for copy, fill, min
+#include <cmath>      // for sin, cos, sqrt, ceil
+#include <numeric>    // for gcd
+#include <stdexcept>  // for invalid_argument
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace bell;
+
+float dsp::dot(const float* a, const float* b, size_t n) {
+#if defined(__SSE__)
+  __m128 acc = _mm_setzero_ps();
+  for (size_t i = 0; i < n; i += 4) {
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+  alignas(16) float lanes[4];
+  _mm_store_ps(lanes, acc);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (size_t i = 0; i < n; i += 4) {
+    acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  }
+  float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#else
+  float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+  for (size_t i = 0; i < n; i += 4) {
+    acc0 += a[i] * b[i];
+    acc1 += a[i + 1] * b[i + 1];
+    acc2 += a[i + 2] * b[i + 2];
+    acc3 += a[i + 3] * b[i + 3];
+  }
+  return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
+
+double dsp::besselI0(double x) {
+  double sum = 1.0, term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+dsp::PolyphaseResampler::PolyphaseResampler(uint32_t inputRate,
+                                            uint32_t outputRate,
+                                            size_t channels,
+                                            size_t maxInputFrames,
+                                            Quality quality)
+    : channels(channels), maxInputFrames(maxInputFrames) {
+  if (inputRate == 0 || outputRate == 0) {
+    throw std::invalid_argument("Resampler rates must be positive");
+  }
+
+  uint32_t divisor = std::gcd(inputRate, outputRate);
+  up = outputRate / divisor;
+  down = inputRate / divisor;
+
+  if (up > MAX_PHASES) {
+    // Closest fraction with a bounded phase count, via continued fractions
+    double ratio = (double)outputRate / inputRate;
+    uint32_t p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    double x = ratio;
+    while (true) {
+      uint32_t a = (uint32_t)x;
+      uint32_t p2 = a * p1 + p0, q2 = a * q1 + q0;
+      if (p2 > MAX_PHASES) {
+        break;
+      }
+      p0 = p1, q0 = q1, p1 = p2, q1 = q2;
+      if (x - a < 1e-9) {
+        break;
+      }
+      x = 1.0 / (x - a);
+    }
+    up = p1;
+    down = q1;
+  }
+
+  switch (quality) {
+    case Quality::LOW:
+      taps = 8;
+      break;
+    case Quality::MEDIUM:
+      taps = 16;
+      break;
+    case Quality::HIGH:
+      taps = 32;
+      break;
+  }
+  // Keep the same relative transition band when decimating
+  if (down > up) {
+    size_t scaled = (taps * down + up - 1) / up;
+    taps = std::min<size_t>((scaled + 3) & ~(size_t)3, 256);
+  }
+
+  designFilter(quality);
+  history.assign(channels * (taps + maxInputFrames), 0.0f);
+  reset();
+}
+
+void dsp::PolyphaseResampler::designFilter(Quality quality) {
+  double beta = 0, passband = 0;
+  switch (quality) {
+    case Quality::LOW:
+      beta = 5.0, passband = 0.80;
+      break;
+    case Quality::MEDIUM:
+      beta = 7.0, passband = 0.90;
+      break;
+    case Quality::HIGH:
+      beta = 9.0, passband = 0.94;
+      break;
+  }
+
+  // Prototype runs at up * inputRate, cutoff below both Nyquist frequencies
+  size_t length = taps * up;
+  double cutoff = 0.5 * passband / std::max(up, down);
+  double center = (length - 1) / 2.0;
+  double norm = besselI0(beta);
+
+  filter.assign(length, 0.0f);
+  for (size_t p = 0; p < up; p++) {
+    for (size_t t = 0; t < taps; t++) {
+      // Newest input sample pairs with the start of the prototype
+      size_t k = p + (taps - 1 - t) * up;
+      double x = k - center;
+      double sinc = x == 0 ? 2.0 * cutoff
+                           : std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+      double w = 2.0 * x / (length - 1);
+      double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - w * w)));
+      filter[p * taps + t] = (float)(up * sinc * window / norm);
+    }
+  }
+}
+
+size_t dsp::PolyphaseResampler::maxOutputFrames() const {
+  return ((taps + maxInputFrames) * up) / down + 1;
+}
+
+void dsp::PolyphaseResampler::reset() {
+  std::fill(history.begin(), history.end(), 0.0f);
+
+  // Start primed with silence, so output starts right away
+  historyFrames = taps - 1;
+  phase = 0;
+}
+
+size_t dsp::PolyphaseResampler::process(const float* const* in, size_t frames,
+                                        float* const* out,
+                                        size_t activeChannels) {
+  frames = std::min(frames, maxInputFrames);
+  activeChannels = std::min(activeChannels, channels);
+  size_t stride = taps + maxInputFrames;
+  size_t available = historyFrames + frames;
+
+  for (size_t ch = 0; ch < activeChannels; ch++) {
+    std::copy(in[ch], in[ch] + frames,
+              history.begin() + ch * stride + historyFrames);
+  }
+
+  // Output sample n sits at phase / up input samples after position
+  size_t position = 0;
+  size_t produced = 0;
+  while (position + taps <= available) {
+    const float* kernel = filter.data() + phase * taps;
+    for (size_t ch = 0; ch < activeChannels; ch++) {
+      out[ch][produced] =
+          dot(history.data() + ch * stride + position, kernel, taps);
+    }
+    produced++;
+
+    phase += down;
+    position += phase / up;
+    phase %= up;
+  }
+
+  // Carry the samples still needed by upcoming outputs
+  historyFrames = available - position;
+  for (size_t ch = 0; ch < activeChannels; ch++) {
+    float* plane = history.data() + ch * stride;
+    std::copy(plane + position, plane + available, plane);
+  }
+
+  return produced;
+}
@@ -0,0 +1,177 @@
+#include "PowerGovernor.h"
+
+#include "BellLogger.h"   // for BELL_LOG
+#include "BellMetrics.h"  // for BELL_METRIC_GAUGE
+#include "BellUtils.h"    // for BELL_SLEEP_MS
+
+#ifdef ESP_PLATFORM
+#include "esp_pm.h"  // for esp_pm_lock_create, esp_pm_lock_acquire
+#endif
+
+using namespace bell;
+
+namespace {
+const char* levelName(PowerGovernor::Level level) {
+  switch (level) {
+    case PowerGovernor::Level::HIGH:
+      return "high";
+    case PowerGovernor::Level::LOW:
+      return "low";
+    default:
+      return "idle";
+  }
+}
+}  // namespace
+
+PowerGovernor::PowerGovernor(const Config& config)
+    : bell::Task("power_governor", 3072, 1, 0), config(config) {
+#ifdef ESP_PLATFORM
+  // ESP_ERR_NOT_SUPPORTED without CONFIG_PM_ENABLE, nothing to scale then
+  esp_err_t err =
+      esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bell_cpu", &cpuLock);
+  if (err == ESP_OK) {
+    err = esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "bell_apb", &apbLock);
+  }
+  if (err == ESP_OK) {
+    err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "bell_awake",
+                             &awakeLock);
+  }
+  if (err != ESP_OK) {
+    BELL_LOG(info, "PowerGovernor", "Power management unavailable: %d", err);
+  } else if (!config.lightSleep) {
+    esp_pm_lock_acquire(awakeLock);
+  }
+#endif
+}
+
+PowerGovernor::~PowerGovernor() {
+  stop();
+  // Deleting a held lock fails, released first
+  apply(Level::IDLE);
+#ifdef ESP_PLATFORM
+  if (awakeLock && !config.lightSleep) {
+    esp_pm_lock_release(awakeLock);
+  }
+  for (esp_pm_lock* lock : {cpuLock, apbLock, awakeLock}) {
+    if (lock) {
+      esp_pm_lock_delete(lock);
+    }
+  }
+#endif
+}
+
+void PowerGovernor::watch(DSPLoadMonitor* monitor) {
+  monitors.push_back(monitor);
+}
+
+bool PowerGovernor::start() {
+  stop();
+  lastBlocks = 0;
+  lastMisses = 0;
+  for (DSPLoadMonitor* monitor : monitors) {
+    DSPLoadMonitor::Stats stats = monitor->getStats();
+    lastBlocks += stats.blocks;
+    lastMisses += stats.deadlineMisses;
+  }
+  wasPlaying = false;
+  return startTask();
+}
+
+void PowerGovernor::stop() {
+  stopTask();
+}
+
+void PowerGovernor::setPlaying(bool playing) {
+  this->playing = playing;
+  // Without waiting for the next poll, the first blocks must not starve
+  apply(playing ? Level::HIGH : Level::IDLE);
+}
+
+void PowerGovernor::runTask() {
+  while (!isStopRequested()) {
+    BELL_SLEEP_MS(config.pollMs);
+    auto now = std::chrono::steady_clock::now();
+
+    float load = 0;
+    uint32_t blocks = 0, misses = 0;
+    for (DSPLoadMonitor* monitor : monitors) {
+      DSPLoadMonitor::Stats stats = monitor->getStats();
+      load += stats.loadPercent;
+      blocks += stats.blocks;
+      misses += stats.deadlineMisses;
+    }
+    // Compared for change only, a monitor's reset() starts over from 0
+    bool moving = blocks != lastBlocks;
+    bool missed = misses != lastMisses;
+    lastBlocks = blocks;
+    lastMisses = misses;
+
+    bool isPlaying = playing;
+    if (isPlaying && !wasPlaying) {
+      lastBlock = now;
+      calmSince = now;
+    }
+    wasPlaying = isPlaying;
+    if (moving) {
+      lastBlock = now;
+    }
+
+    Level current = level;
+    Level target = current;
+    if (!isPlaying ||
+        now - lastBlock > std::chrono::milliseconds(config.idleMs)) {
+      target = Level::IDLE;
+    } else if (missed || load > config.highPercent ||
+               current == Level::IDLE) {
+      target = Level::HIGH;
+    } else if (current == Level::HIGH) {
+      if (load >= config.lowPercent) {
+        calmSince = now;
+      } else if (now - calmSince > std::chrono::milliseconds(config.holdMs)) {
+        target = Level::LOW;
+      }
+    }
+    if (target != current) {
+      if (target == Level::HIGH) {
+        calmSince = now;
+      }
+      apply(target);
+    }
+  }
+}
+
+void PowerGovernor::apply(Level target) {
+  std::scoped_lock lock(levelMutex);
+  Level current = level;
+  if (target == current) {
+    return;
+  }
+#ifdef ESP_PLATFORM
+  if (cpuLock && apbLock && awakeLock) {
+    // Taken before the others are released, the frequency never dips. Held
+    // for good when lightSleep is off
+    bool awake = target != Level::IDLE;
+    bool wasAwake = current != Level::IDLE;
+    if (awake && !wasAwake) {
+      esp_pm_lock_acquire(awakeLock);
+    }
+    if (target == Level::HIGH) {
+      esp_pm_lock_acquire(cpuLock);
+    } else if (target == Level::LOW) {
+      esp_pm_lock_acquire(apbLock);
+    }
+
+    if (current == Level::HIGH) {
+      esp_pm_lock_release(cpuLock);
+    } else if (current == Level::LOW) {
+      esp_pm_lock_release(apbLock);
+    }
+    if (!awake && wasAwake) {
+      esp_pm_lock_release(awakeLock);
+    }
+  }
+#endif
+  level = target;
+  BELL_LOG(debug, "PowerGovernor", "Level %s", levelName(target));
+  BELL_METRIC_GAUGE("power.level", (int)target);
+}
@@ -0,0 +1,501 @@
+#include "RTPReceiver.h"
+
+#include <string.h>   // for memcpy, memset
+#include <algorithm>  // for clamp, min, max
+#include <chrono>     // for system_clock
+#include <cmath>      // for fabs
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "win32shim.h"
+#else
+#include <arpa/inet.h>   // for inet_pton, htons, htonl
+#include <fcntl.h>       // for fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <netinet/in.h>  // for sockaddr_in, ip_mreq, IPPROTO_UDP
+#include <sys/select.h>  // for select, fd_set
+#include <sys/socket.h>  // for socket, bind, recv, setsockopt
+#include <unistd.h>      // for close
+#endif
+
+#include "AudioCodecs.h"  // for AudioCodecs
+#include "BellClock.h"    // for nowNs
+#include "BellLogger.h"   // for BELL_LOG
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "CodecType.h"    // for AudioCodec
+#include "TimeSync.h"     // for TimeSync
+
+using namespace bell;
+
+namespace {
+#ifdef _WIN32
+void closeFd(int fd) {
+  closesocket(fd);
+}
+
+void setNonBlocking(int fd) {
+  u_long mode = 1;
+  ioctlsocket(fd, FIONBIO, &mode);
+}
+#else
+void closeFd(int fd) {
+  close(fd);
+}
+
+void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+#endif
+
+uint16_t readU16(const uint8_t* data) {
+  return (data[0] << 8) | data[1];
+}
+
+uint32_t readU32(const uint8_t* data) {
+  return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) |
+         data[3];
+}
+}  // namespace
+
+RTPReceiver::RTPReceiver(CentralAudioBuffer& buffer, const Config& config)
+    : bell::Task("rtp_receiver", 4096 * 4, 5, 1, false),
+      buffer(buffer),
+      config(config) {
+  clockRate = config.payload == Payload::OPUS ? 48000 : config.sampleRate;
+}
+
+RTPReceiver::~RTPReceiver() {
+  stop();
+}
+
+bool RTPReceiver::parse(const uint8_t* data, size_t len, Packet& packet) {
+  if (len < 12 || (data[0] >> 6) != 2) {
+    return false;
+  }
+  size_t header = 12 + (data[0] & 0x0F) * 4;
+  // Header extension, its length counts 32 bit words
+  if (data[0] & 0x10) {
+    if (len < header + 4) {
+      return false;
+    }
+    header += 4 + readU16(data + header + 2) * 4;
+  }
+  size_t padding = (data[0] & 0x20) ? data[len - 1] : 0;
+  if (header + padding > len) {
+    return false;
+  }
+
+  packet.marker = data[1] & 0x80;
+  packet.payloadType = data[1] & 0x7F;
+  packet.sequence = readU16(data + 2);
+  packet.timestamp = readU32(data + 4);
+  packet.ssrc = readU32(data + 8);
+  packet.payload = data + header;
+  packet.payloadSize = len - header - padding;
+  return true;
+}
+
+bool RTPReceiver::start() {
+  stop();
+  if (config.payload == Payload::OPUS) {
+    codec = AudioCodecs::createCodec(AudioCodec::OPUS);
+    if (codec == nullptr || !codec->setup(clockRate, config.channels, 16)) {
+      BELL_LOG(error, TAG, "No Opus decoder");
+      return false;
+    }
+  }
+  sock = openSocket(config.port);
+  if (sock < 0) {
+    return false;
+  }
+  // RTCP comes next to RTP, without it chunks keep the local time
+  if (config.syncLatencyMs > 0) {
+    reportSock = openSocket(config.port + 1);
+  }
+
+  synced = false;
+  hasReport = false;
+  stats = Stats();
+  epochNs = clock::nowNs();
+  return startTask();
+}
+
+void RTPReceiver::stop() {
+  stopTask();
+  closeSockets();
+}
+
+RTPReceiver::Stats RTPReceiver::getStats() {
+  std::scoped_lock lock(statsMutex);
+  return stats;
+}
+
+int RTPReceiver::openSocket(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) {
+    return -1;
+  }
+  // Several receivers of a group may share the host
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&yes, sizeof(yes));
+#endif
+  // Room for the packets arriving while the task decodes
+  int size = SLOTS * MAX_PACKET;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&size, sizeof(size));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    BELL_LOG(error, TAG, "Cannot bind port %d", port);
+    closeFd(fd);
+    return -1;
+  }
+
+  if (!config.multicastGroup.empty()) {
+    struct ip_mreq group;
+    memset(&group, 0, sizeof(group));
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (inet_pton(AF_INET, config.multicastGroup.c_str(),
+                  &group.imr_multiaddr) != 1 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&group,
+                   sizeof(group)) < 0) {
+      BELL_LOG(error, TAG, "Cannot join %s", config.multicastGroup.c_str());
+      closeFd(fd);
+      return -1;
+    }
+  }
+
+  setNonBlocking(fd);
+  return fd;
+}
+
+void RTPReceiver::closeSockets() {
+  for (int* fd : {&sock, &reportSock}) {
+    if (*fd >= 0) {
+      closeFd(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+double RTPReceiver::now() {
+  return (clock::nowNs() - epochNs) * (double)clockRate / 1e9;
+}
+
+double RTPReceiver::targetOffset() {
+  double minDelay = config.minDelayMs * (double)clockRate / 1000;
+  double maxDelay = config.maxDelayMs * (double)clockRate / 1000;
+  // Three deviations cover nearly every packet of a steady link
+  return meanTransit + std::clamp(3 * jitter, minDelay, maxDelay);
+}
+
+RTPReceiver::Slot* RTPReceiver::nextSlot() {
+  Slot& slot = slots[nextSequence % SLOTS];
+  return slot.used && slot.sequence == nextSequence ? &slot : nullptr;
+}
+
+double RTPReceiver::nextDue() {
+  Slot* slot = nextSlot();
+  return (slot != nullptr ? slot->timestamp : nextTimestamp) + playoutOffset;
+}
+
+void RTPReceiver::runTask() {
+  while (!isStopRequested()) {
+    uint32_t waitMs = MAX_WAIT_MS;
+    if (synced) {
+      double untilDue = (nextDue() - now()) * 1000 / clockRate;
+      waitMs = (uint32_t)std::clamp(untilDue, 0.0, (double)MAX_WAIT_MS);
+    }
+    struct timeval timeout = {0, (long)waitMs * 1000};
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    if (reportSock >= 0) {
+      FD_SET(reportSock, &readable);
+    }
+    if (select(std::max(sock, reportSock) + 1, &readable, NULL, NULL,
+               &timeout) > 0) {
+      if (FD_ISSET(sock, &readable)) {
+        receive();
+      }
+      if (reportSock >= 0 && FD_ISSET(reportSock, &readable)) {
+        receiveReports();
+      }
+    }
+    if (synced) {
+      playout(now());
+    }
+  }
+}
+
+void RTPReceiver::receive() {
+  while (true) {
+    long len = recv(sock, (char*)packetBuffer.data(), packetBuffer.size(), 0);
+    if (len <= 0) {
+      return;
+    }
+    Packet packet;
+    if (parse(packetBuffer.data(), len, packet)) {
+      onPacket(packet, now());
+    }
+  }
+}
+
+void RTPReceiver::receiveReports() {
+  uint8_t report[MAX_PACKET];
+  while (true) {
+    long len = recv(reportSock, (char*)report, sizeof(report), 0);
+    if (len <= 0) {
+      return;
+    }
+    // Sender report, RFC 3550 6.4.1, the first packet of a compound one
+    if (len < 28 || (report[0] >> 6) != 2 || report[1] != 200 || !synced ||
+        readU32(report + 4) != ssrc) {
+      continue;
+    }
+    int64_t seconds = (int64_t)readU32(report + 8) - NTP_EPOCH_OFFSET;
+    int64_t fraction = readU32(report + 12);
+    reportWallUs = seconds * 1000000 + ((fraction * 1000000) >> 32);
+    reportTimestamp =
+        highestTimestamp +
+        (int32_t)(readU32(report + 16) - (uint32_t)highestTimestamp);
+    hasReport = true;
+  }
+}
+
+void RTPReceiver::sync(const Packet& packet, double arrival) {
+  for (auto& slot : slots) {
+    slot.used = false;
+  }
+  ssrc = packet.ssrc;
+  nextSequence = packet.sequence;
+  nextTimestamp = lastTimestamp = highestTimestamp = packet.timestamp;
+  meanTransit = lastTransit = arrival - packet.timestamp;
+  jitter = 0;
+  playoutOffset = targetOffset();
+  // Known once the first packet is decoded
+  packetFrames = 0;
+  concealedFrames = 0;
+  untilAdapt = ADAPT_INTERVAL;
+  synced = true;
+}
+
+void RTPReceiver::onPacket(const Packet& packet, double arrival) {
+  if (packet.payloadType != config.payloadType || packet.payloadSize == 0 ||
+      packet.payloadSize > MAX_PACKET) {
+    return;
+  }
+  {
+    std::scoped_lock lock(statsMutex);
+    stats.received++;
+  }
+
+  if (!synced || packet.ssrc != ssrc) {
+    sync(packet, arrival);
+  }
+  // Extended past the wraps of the 32 bit timestamp
+  int64_t timestamp = highestTimestamp + (int32_t)(packet.timestamp -
+                                                   (uint32_t)highestTimestamp);
+  int16_t ahead = packet.sequence - nextSequence;
+  if (ahead >= (int16_t)SLOTS || ahead < -(int16_t)SLOTS) {
+    // Too far off to wait for what's missing, e.g. the sender restarted
+    sync(packet, arrival);
+    timestamp = packet.timestamp;
+    ahead = 0;
+  }
+  highestTimestamp = std::max(highestTimestamp, timestamp);
+
+  // Interarrival jitter, RFC 3550 A.8
+  double transit = arrival - timestamp;
+  jitter += (std::fabs(transit - lastTransit) - jitter) / 16;
+  meanTransit += (transit - meanTransit) / 16;
+  lastTransit = transit;
+
+  if (ahead < 0) {
+    // Its place was concealed already, the delay is too short
+    untilAdapt = 1;
+    std::scoped_lock lock(statsMutex);
+    stats.late++;
+    return;
+  }
+
+  Slot& slot = slots[packet.sequence % SLOTS];
+  slot.used = true;
+  slot.sequence = packet.sequence;
+  slot.timestamp = timestamp;
+  slot.size = packet.payloadSize;
+  memcpy(slot.data.data(), packet.payload, packet.payloadSize);
+}
+
+void RTPReceiver::playout(double now) {
+  while (synced && nextDue() <= now) {
+    double due = nextDue();
+    Slot* slot = nextSlot();
+    if (slot != nullptr) {
+      release(*slot, due, false);
+      if (--untilAdapt == 0) {
+        adapt();
+      }
+      continue;
+    }
+    if (packetFrames == 0) {
+      return;
+    }
+
+    // Missing past its due time
+    Slot& following = slots[(uint16_t)(nextSequence + 1) % SLOTS];
+    conceal(following.used &&
+            following.sequence == (uint16_t)(nextSequence + 1));
+    if (concealedFrames * 1000 / clockRate >= config.maxConcealMs) {
+      BELL_LOG(info, TAG, "Stream stopped, waiting for it to resume");
+      synced = false;
+    }
+  }
+}
+
+void RTPReceiver::release(Slot& slot, double due, bool drop) {
+  slot.used = false;
+  // Packet duration from the timestamps, which the decoder's output doesn't
+  // give after a loss
+  if (concealedFrames == 0 && slot.timestamp > lastTimestamp &&
+      slot.timestamp - lastTimestamp < clockRate / 4) {
+    packetFrames = slot.timestamp - lastTimestamp;
+  }
+
+  const uint8_t* data = slot.data.data();
+  size_t size = slot.size;
+  if (codec != nullptr) {
+    uint32_t inLen = slot.size;
+    uint32_t outLen = 0;
+    data = codec->decode(slot.data.data(), inLen, outLen);
+    size = data != nullptr ? outLen : 0;
+  } else {
+    // L16 is in network order
+    size_t samples = slot.size / sizeof(int16_t);
+    pcm.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+      pcm[i] = (int16_t)readU16(slot.data.data() + i * 2);
+    }
+    data = (const uint8_t*)pcm.data();
+    size = samples * sizeof(int16_t);
+  }
+
+  int64_t frames = size / (sizeof(int16_t) * config.channels);
+  if (packetFrames == 0) {
+    packetFrames = frames;
+  }
+  if (!drop && size > 0) {
+    write(data, size, due);
+  }
+
+  lastTimestamp = slot.timestamp;
+  nextTimestamp = slot.timestamp + packetFrames;
+  nextSequence = slot.sequence + 1;
+  concealedFrames = 0;
+}
+
+void RTPReceiver::conceal(bool beforeNext) {
+  {
+    std::scoped_lock lock(statsMutex);
+    stats.lost++;
+  }
+  BELL_METRIC_COUNT("rtp.lost_packets", 1);
+
+  if (codec != nullptr && beforeNext) {
+    // Decoding the next packet rebuilds this one from its FEC data first,
+    // or conceals it where there's none
+    codec->onDataLost();
+  } else {
+    writeConcealment(packetFrames);
+  }
+  nextTimestamp += packetFrames;
+  nextSequence++;
+  concealedFrames += packetFrames;
+}
+
+void RTPReceiver::adapt() {
+  untilAdapt = ADAPT_INTERVAL;
+  double target = targetOffset();
+  if (playoutOffset < target - packetFrames / 2.0) {
+    // Later by a packet, its time filled by the decoder
+    playoutOffset += packetFrames;
+    writeConcealment(packetFrames);
+  } else if (playoutOffset > target + packetFrames * 1.5) {
+    Slot* slot = nextSlot();
+    if (slot == nullptr) {
+      // Only with a packet to drop
+      untilAdapt = 1;
+      return;
+    }
+    // Decoded all the same, the decoder's state goes on smoothly
+    release(*slot, nextDue(), true);
+    playoutOffset -= packetFrames;
+    std::scoped_lock lock(statsMutex);
+    stats.dropped++;
+  }
+
+  std::scoped_lock lock(statsMutex);
+  stats.jitterMs = jitter * 1000 / clockRate;
+  stats.delayMs = (playoutOffset - meanTransit) * 1000 / clockRate;
+}
+
+void RTPReceiver::write(const uint8_t* data, size_t size, double due) {
+  // Wall clock time of the first frame, on the sender's clock when synced
+  int64_t us;
+  if (hasReport) {
+    double timestamp = due - playoutOffset;
+    us = reportWallUs +
+         (int64_t)((timestamp - reportTimestamp) * 1000000 / clockRate) +
+         config.syncLatencyMs * (int64_t)1000;
+  } else if (config.timeSync != nullptr) {
+    us = config.timeSync->toGroupUs(
+        epochNs + (int64_t)(due * 1e9 / clockRate));
+  } else {
+    auto wall = std::chrono::system_clock::now() +
+                std::chrono::microseconds(
+                    (int64_t)((due - now()) * 1000000 / clockRate));
+    us = std::chrono::duration_cast<std::chrono::microseconds>(
+             wall.time_since_epoch())
+             .count();
+  }
+
+  size_t written = 0;
+  while (written < size) {
+    size_t len = buffer.writePCM(data + written, size - written,
+                                 config.trackHash, clockRate, config.channels,
+                                 PcmFormat::INT16, us / 1000000, us % 1000000);
+    if (len == 0) {
+      // The sink is behind, waiting would only add latency
+      std::scoped_lock lock(statsMutex);
+      stats.dropped++;
+      return;
+    }
+    written += len;
+  }
+}
+
+void RTPReceiver::writeConcealment(int64_t frames) {
+  while (frames > 0) {
+    const uint8_t* data;
+    uint32_t size = 0;
+    if (codec != nullptr) {
+      data = codec->conceal(frames, size);
+    } else {
+      pcm.assign(frames * config.channels, 0);
+      data = (const uint8_t*)pcm.data();
+      size = pcm.size() * sizeof(int16_t);
+    }
+    if (data == nullptr || size == 0) {
+      return;
+    }
+    buffer.writeConcealment(data, size, config.trackHash, clockRate,
+                            config.channels, PcmFormat::INT16);
+    frames -= size / (sizeof(int16_t) * config.channels);
+  }
+}
@@ -0,0 +1,363 @@
+#include "RTPSender.h"
+
+#include <string.h>   // for memcpy, memset
+#include <algorithm>  // for min, clamp
+#include <chrono>     // for system_clock
+#include <random>     // for random_device
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "win32shim.h"
+#else
+#include <arpa/inet.h>   // for inet_pton, htons
+#include <netinet/in.h>  // for sockaddr_in, IP_MULTICAST_TTL
+#include <sys/socket.h>  // for socket, sendto, setsockopt
+#include <unistd.h>      // for close
+#endif
+
+#ifdef BELL_CODEC_OPUS
+#include "opus.h"  // for opus_encoder_create, opus_encode, opus_encode_float
+#endif
+
+#include "BellClock.h"           // for nowMs
+#include "BellLogger.h"          // for BELL_LOG
+#include "PolyphaseResampler.h"  // for PolyphaseResampler
+#include "SampleConversion.h"    // for deinterleaveInt16
+#include "TimeSync.h"            // for TimeSync
+
+using namespace bell;
+
+namespace {
+// Input frames resampled at once
+constexpr size_t RESAMPLE_BLOCK = 256;
+
+void writeU16(uint8_t* out, uint16_t value) {
+  out[0] = value >> 8;
+  out[1] = value;
+}
+
+void writeU32(uint8_t* out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+int16_t toInt16(const uint8_t* data, PcmFormat format) {
+  switch (format) {
+    case PcmFormat::INT16:
+      return *(const int16_t*)data;
+    case PcmFormat::FLOAT32:
+      return (int16_t)(std::clamp(*(const float*)data, -1.0f, 1.0f) * 32767);
+    default:
+      // Both left-justified in 32 bits
+      return *(const int32_t*)data >> 16;
+  }
+}
+}  // namespace
+
+RTPSender::RTPSender(const Config& config)
+    : bell::Task("rtp_sender", 4096 * 12, 5, 1, false),
+      config(config),
+      dataSem(16) {
+  // Stereo 48 kHz, the largest format that doesn't need resampling first.
+  // Made once, the tap may write at any time
+  ring = std::make_unique<CircularBuffer>(
+      48 * config.bufferMs * 2 * sizeof(int16_t), CircularBuffer::Mode::SPSC);
+  std::random_device random;
+  ssrc = random();
+  sequence = random();
+  timestamp = random();
+}
+
+RTPSender::~RTPSender() {
+  stop();
+}
+
+BellDSP::Tap RTPSender::tap() {
+  return [this](const uint8_t* data, size_t bytes, int channels,
+                uint32_t sampleRate, PcmFormat format) {
+    write(data, bytes, channels, sampleRate, format);
+  };
+}
+
+bool RTPSender::start() {
+  stop();
+#ifndef BELL_CODEC_OPUS
+  if (config.payload == Payload::OPUS) {
+    BELL_LOG(error, TAG, "Built without Opus");
+    return false;
+  }
+#endif
+  if (!openSocket()) {
+    return false;
+  }
+  restart = true;
+  return startTask();
+}
+
+void RTPSender::stop() {
+  stopTask();
+  release();
+  if (sock >= 0) {
+#ifdef _WIN32
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+    sock = -1;
+  }
+}
+
+void RTPSender::onStopRequested() {
+  dataSem.give();
+}
+
+bool RTPSender::openSocket() {
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return false;
+  }
+#ifdef _WIN32
+  DWORD ttl = config.ttl;
+#else
+  unsigned char ttl = config.ttl;
+#endif
+  setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl,
+             sizeof(ttl));
+  return true;
+}
+
+void RTPSender::write(const uint8_t* data, size_t bytes, int channels,
+                      uint32_t sampleRate, PcmFormat format) {
+  if (channels <= 0 || channels > 2 || sampleRate == 0) {
+    return;
+  }
+  if (sampleRate != this->sampleRate || channels != this->channels) {
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    restart = true;
+  }
+
+  size_t sampleSize = pcmBytesPerSample(format);
+  size_t samples = bytes / sampleSize / channels * channels;
+  const uint8_t* pcm = data;
+  if (format != PcmFormat::INT16) {
+    converted.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+      converted[i] = toInt16(data + i * sampleSize, format);
+    }
+    pcm = (const uint8_t*)converted.data();
+  }
+  // Whatever doesn't fit is dropped, the task is behind
+  ring->write(pcm, samples * sizeof(int16_t));
+  dataSem.give();
+}
+
+uint32_t RTPSender::clockRate() {
+  return config.payload == Payload::OPUS ? 48000 : streamRate;
+}
+
+bool RTPSender::configure() {
+  release();
+  ring->emptyBuffer();
+  streamRate = sampleRate;
+  streamChannels = channels;
+  if (streamRate == 0 || streamChannels == 0) {
+    return false;
+  }
+
+  if (config.payload == Payload::PCM16) {
+    packetFrames = std::min((size_t)(streamRate * config.frameMs / 1000),
+                            (MAX_PACKET - HEADER_SIZE) /
+                                (sizeof(int16_t) * streamChannels));
+    input.resize(packetFrames * streamChannels);
+    return true;
+  }
+
+#ifdef BELL_CODEC_OPUS
+  int error;
+  encoder = opus_encoder_create(48000, streamChannels, OPUS_APPLICATION_AUDIO,
+                                &error);
+  if (encoder == nullptr) {
+    BELL_LOG(error, TAG, "Cannot create the Opus encoder: %d", error);
+    return false;
+  }
+  opus_encoder_ctl(encoder, OPUS_SET_BITRATE(config.bitrate));
+  // Redundancy the receivers rebuild a lost packet from
+  opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(1));
+  opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(5));
+  packetFrames = (size_t)(48000 * config.frameMs / 1000);
+
+  if (streamRate != 48000) {
+    resampler = std::make_unique<dsp::PolyphaseResampler>(
+        streamRate, 48000, streamChannels, RESAMPLE_BLOCK);
+    inPlanes.assign(streamChannels, std::vector<float>(RESAMPLE_BLOCK));
+    outPlanes.assign(streamChannels,
+                     std::vector<float>(resampler->maxOutputFrames()));
+    input.resize(RESAMPLE_BLOCK * streamChannels);
+  } else {
+    input.resize(packetFrames * streamChannels);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void RTPSender::release() {
+#ifdef BELL_CODEC_OPUS
+  if (encoder != nullptr) {
+    opus_encoder_destroy(encoder);
+    encoder = nullptr;
+  }
+#endif
+  resampler = nullptr;
+  pending.clear();
+  streamRate = 0;
+}
+
+void RTPSender::runTask() {
+  lastReportMs = clock::nowMs();
+  while (!isStopRequested()) {
+    dataSem.twait(100);
+    if (restart.exchange(false)) {
+      configure();
+    }
+    if (streamRate != 0) {
+      drain();
+    }
+
+    int64_t nowMs = clock::nowMs();
+    if (streamRate != 0 && nowMs - lastReportMs >= REPORT_INTERVAL_MS) {
+      lastReportMs = nowMs;
+      sendReport();
+    }
+  }
+}
+
+void RTPSender::drain() {
+  size_t frameSize = sizeof(int16_t) * streamChannels;
+  size_t frames = resampler != nullptr ? RESAMPLE_BLOCK : packetFrames;
+  while (!restart && ring->size() >= frames * frameSize) {
+    ring->read((uint8_t*)input.data(), frames * frameSize);
+    if (config.payload == Payload::PCM16) {
+      sendPCM(input.data(), frames);
+    } else {
+      sendOpus(input.data(), frames);
+    }
+  }
+}
+
+void RTPSender::sendPCM(const int16_t* pcm, size_t frames) {
+  uint8_t* payload = packet.data() + HEADER_SIZE;
+  for (size_t i = 0; i < frames * streamChannels; i++) {
+    writeU16(payload + i * 2, pcm[i]);
+  }
+  send(frames * streamChannels * sizeof(int16_t), frames);
+}
+
+void RTPSender::sendOpus(const int16_t* pcm, size_t frames) {
+#ifdef BELL_CODEC_OPUS
+  if (resampler == nullptr) {
+    int len = opus_encode(encoder, pcm, frames, packet.data() + HEADER_SIZE,
+                          MAX_PACKET - HEADER_SIZE);
+    if (len > 0) {
+      send(len, frames);
+    }
+    return;
+  }
+
+  float* in[2];
+  float* out[2];
+  for (size_t ch = 0; ch < streamChannels; ch++) {
+    in[ch] = inPlanes[ch].data();
+    out[ch] = outPlanes[ch].data();
+  }
+  dsp::deinterleaveInt16(pcm, in, streamChannels, frames);
+  size_t produced = resampler->process(in, frames, out, streamChannels);
+  for (size_t i = 0; i < produced; i++) {
+    for (size_t ch = 0; ch < streamChannels; ch++) {
+      pending.push_back(outPlanes[ch][i]);
+    }
+  }
+
+  size_t packetSamples = packetFrames * streamChannels;
+  size_t used = 0;
+  while (pending.size() - used >= packetSamples) {
+    encodeFloat(pending.data() + used);
+    used += packetSamples;
+  }
+  pending.erase(pending.begin(), pending.begin() + used);
+#endif
+}
+
+void RTPSender::encodeFloat(const float* pcm) {
+#ifdef BELL_CODEC_OPUS
+  int len = opus_encode_float(encoder, pcm, packetFrames,
+                              packet.data() + HEADER_SIZE,
+                              MAX_PACKET - HEADER_SIZE);
+  if (len > 0) {
+    send(len, packetFrames);
+  }
+#endif
+}
+
+void RTPSender::send(size_t payloadSize, uint32_t frames) {
+  uint8_t* header = packet.data();
+  header[0] = 0x80;
+  header[1] = config.payloadType & 0x7F;
+  writeU16(header + 2, sequence);
+  writeU32(header + 4, timestamp);
+  writeU32(header + 8, ssrc);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port);
+  inet_pton(AF_INET, config.address.c_str(), &addr.sin_addr);
+  sendto(sock, (const char*)packet.data(), HEADER_SIZE + payloadSize, 0,
+         (struct sockaddr*)&addr, sizeof(addr));
+
+  sequence++;
+  timestamp += frames;
+  packetCount++;
+  octetCount += payloadSize;
+}
+
+void RTPSender::sendReport() {
+  // The next frame to be sent was tapped this long ago
+  size_t queued = ring->size() / (sizeof(int16_t) * streamChannels);
+  uint32_t reportTimestamp =
+      timestamp + (uint32_t)((uint64_t)queued * clockRate() / streamRate) +
+      pending.size() / streamChannels;
+
+  int64_t us = config.timeSync != nullptr
+                   ? config.timeSync->nowUs()
+                   : std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+  uint64_t seconds = us / 1000000 + NTP_EPOCH_OFFSET;
+  uint64_t fraction = ((uint64_t)(us % 1000000) << 32) / 1000000;
+
+  // Sender report without report blocks, RFC 3550 6.4.1
+  uint8_t report[28];
+  report[0] = 0x80;
+  report[1] = 200;
+  writeU16(report + 2, sizeof(report) / 4 - 1);
+  writeU32(report + 4, ssrc);
+  writeU32(report + 8, seconds);
+  writeU32(report + 12, fraction);
+  writeU32(report + 16, reportTimestamp);
+  writeU32(report + 20, packetCount);
+  writeU32(report + 24, octetCount);
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port + 1);
+  inet_pton(AF_INET, config.address.c_str(), &addr.sin_addr);
+  sendto(sock, (const char*)report, sizeof(report), 0,
+         (struct sockaddr*)&addr, sizeof(addr));
+}
@@ -0,0 +1,200 @@
+#include "Requantizer.h"
+
+#include <algorithm>    // for clamp
+#include <cmath>        // for floor, fabs, nearbyint
+#include <type_traits>  // for is_same_v
+
+#include "SampleConversion.h"  // for interleave, isSilent
+
+using namespace bell;
+
+// Dither from nextTpdf() is in 1 / 65536 of an LSB
+static constexpr float TPDF_SCALE = 1.0f / 65536.0f;
+
+void Requantizer::configure(Mode mode, size_t channels) {
+  this->mode = mode;
+  state.assign(channels, ChannelState());
+}
+
+bool Requantizer::targetBits(PcmFormat format, int& bits) const {
+  if (mode == Mode::NONE) {
+    return false;
+  }
+  if (format == PcmFormat::INT16) {
+    bits = 16;
+    return true;
+  }
+  if (format == PcmFormat::INT24_IN_32) {
+    bits = 24;
+    return true;
+  }
+  return false;
+}
+
+template <bool Shaped, typename Out>
+void Requantizer::requantize(const float* in, Out* out, size_t stride,
+                             size_t frames, int bits, ChannelState& channel) {
+  // Same scales as dsp::interleave()
+  const float scale = bits == 16 ? 32767.0f : 8388608.0f;
+  const float maxValue = (float)((1 << (bits - 1)) - 1);
+  const float minValue = -maxValue - 1.0f;
+  const int32_t packing = 1 << (sizeof(Out) * 8 - bits);
+  float* errors = channel.errors;
+
+  for (size_t i = 0; i < frames; i++) {
+    float value = in[i] * scale;
+    if constexpr (Shaped) {
+      value -= SHAPING[0] * errors[0] + SHAPING[1] * errors[1] +
+               SHAPING[2] * errors[2];
+    }
+    float quantized = std::floor(value + nextTpdf() * TPDF_SCALE + 0.5f);
+    if constexpr (Shaped) {
+      // Taken before saturation, so clipping can't build up the feedback
+      errors[2] = errors[1];
+      errors[1] = errors[0];
+      errors[0] = quantized - value;
+    }
+    out[i * stride] =
+        (Out)((int32_t)std::clamp(quantized, minValue, maxValue) * packing);
+  }
+}
+
+template <bool Shaped, typename Out>
+void Requantizer::requantize(const int32_t* in, Out* out, size_t stride,
+                             size_t frames, int bits, ChannelState& channel) {
+  // Q1.31 LSBs per output LSB
+  const int shift = 32 - bits;
+  const int64_t half = (int64_t)1 << (shift - 1);
+  const int64_t maxValue = ((int64_t)1 << (bits - 1)) - 1;
+  const int64_t minValue = -maxValue - 1;
+  const int32_t packing = 1 << (sizeof(Out) * 8 - bits);
+  int64_t* errors = channel.fixedErrors;
+
+  for (size_t i = 0; i < frames; i++) {
+    int64_t value = in[i];
+    if constexpr (Shaped) {
+      value -= (SHAPING_FIXED[0] * errors[0] + SHAPING_FIXED[1] * errors[1] +
+                SHAPING_FIXED[2] * errors[2]) >>
+               SHAPING_FRACTION_BITS;
+    }
+    int64_t dither = ((int64_t)nextTpdf() << shift) >> 16;
+    int64_t quantized = (value + dither + half) >> shift;
+    if constexpr (Shaped) {
+      errors[2] = errors[1];
+      errors[1] = errors[0];
+      errors[0] = quantized * ((int64_t)1 << shift) - value;
+    }
+    out[i * stride] =
+        (Out)((int32_t)std::clamp(quantized, minValue, maxValue) * packing);
+  }
+}
+
+// Whether a Q1.31 plane already fits in bits, e.g. widened int16 input that
+// no transform touched. Dithering it would only lose its exactness
+static bool fitsIn(const int32_t* in, size_t frames, int bits) {
+  const int32_t mask = (1 << (32 - bits)) - 1;
+  int32_t lowBits = 0;
+  for (size_t i = 0; i < frames; i++) {
+    lowBits |= in[i];
+  }
+  return (lowBits & mask) == 0;
+}
+
+// Same for float, within what the int16 to float conversion leaves: input
+// played at unity gain comes out as it went in
+static constexpr float FIT_TOLERANCE = 1.0f / 64.0f;
+static bool fitsIn(const float* in, size_t frames, float scale) {
+  for (size_t i = 0; i < frames; i++) {
+    float value = in[i] * scale;
+    if (std::fabs(value - std::nearbyint(value)) > FIT_TOLERANCE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+void Requantizer::interleaveWith(const T* const* in, PcmFormat format,
+                                 uint8_t* out, size_t channels,
+                                 size_t frames) {
+  int bits = 0;
+  if (!targetBits(format, bits) || channels > state.size()) {
+    dsp::interleave(in, format, out, channels, frames);
+    return;
+  }
+
+  bool shaped = mode == Mode::NOISE_SHAPED;
+  for (size_t ch = 0; ch < channels; ch++) {
+    ChannelState& channel = state[ch];
+    if (dsp::isSilent((const uint8_t*)in[ch], frames * sizeof(T))) {
+      // Dither on digital silence would only add hiss
+      channel = ChannelState();
+      for (size_t i = 0; i < frames; i++) {
+        if (bits == 16) {
+          ((int16_t*)out)[i * channels + ch] = 0;
+        } else {
+          ((int32_t*)out)[i * channels + ch] = 0;
+        }
+      }
+      continue;
+    }
+
+    if constexpr (std::is_same_v<T, int32_t>) {
+      if (fitsIn(in[ch], frames, bits)) {
+        channel = ChannelState();
+        const int shift = 32 - bits;
+        for (size_t i = 0; i < frames; i++) {
+          if (bits == 16) {
+            ((int16_t*)out)[i * channels + ch] = (int16_t)(in[ch][i] >> shift);
+          } else {
+            ((int32_t*)out)[i * channels + ch] = in[ch][i];
+          }
+        }
+        continue;
+      }
+    } else {
+      // Same scales as requantize()
+      const float scale = bits == 16 ? 32767.0f : 8388608.0f;
+      if (fitsIn(in[ch], frames, scale)) {
+        channel = ChannelState();
+        const float maxValue = (float)((1 << (bits - 1)) - 1);
+        for (size_t i = 0; i < frames; i++) {
+          int32_t value = (int32_t)std::clamp(std::nearbyint(in[ch][i] * scale),
+                                              -maxValue - 1.0f, maxValue);
+          if (bits == 16) {
+            ((int16_t*)out)[i * channels + ch] = (int16_t)value;
+          } else {
+            ((int32_t*)out)[i * channels + ch] = value * 256;
+          }
+        }
+        continue;
+      }
+    }
+
+    if (bits == 16) {
+      int16_t* samples = (int16_t*)out + ch;
+      if (shaped) {
+        requantize<true>(in[ch], samples, channels, frames, bits, channel);
+      } else {
+        requantize<false>(in[ch], samples, channels, frames, bits, channel);
+      }
+    } else {
+      int32_t* samples = (int32_t*)out + ch;
+      if (shaped) {
+        requantize<true>(in[ch], samples, channels, frames, bits, channel);
+      } else {
+        requantize<false>(in[ch], samples, channels, frames, bits, channel);
+      }
+    }
+  }
+}
+
+void Requantizer::interleave(const float* const* in, PcmFormat format,
+                             uint8_t* out, size_t channels, size_t frames) {
+  interleaveWith(in, format, out, channels, frames);
+}
+
+void Requantizer::interleave(const int32_t* const* in, PcmFormat format,
+                             uint8_t* out, size_t channels, size_t frames) {
+  interleaveWith(in, format, out, channels, frames);
+}
@@ -0,0 +1,64 @@
+#include "Resampler.h"
+
+using namespace bell;
+
+Resampler::Resampler() {
+  this->filterType = "resampler";
+}
+
+void Resampler::configure(uint32_t outputRate, Quality quality,
+                          size_t maxChannels, size_t maxInputFrames) {
+  std::scoped_lock lock(this->accessMutex);
+  this->outputRate = outputRate;
+  this->quality = quality;
+  this->maxChannels = maxChannels;
+  this->maxInputFrames = maxInputFrames;
+  publishPlan();
+}
+
+void Resampler::sampleRateChanged(uint32_t sampleRate) {
+  std::scoped_lock lock(this->accessMutex);
+  if (sampleRate == inputRate) {
+    return;
+  }
+  inputRate = sampleRate;
+  if (outputRate != 0) {
+    publishPlan();
+  }
+}
+
+void Resampler::publishPlan() {
+  auto plan = std::make_shared<Plan>();
+  plan->inputRate = inputRate;
+  plan->outputRate = outputRate;
+  plan->channels = maxChannels;
+
+  // Same rate on both sides, nothing to allocate
+  if (inputRate != outputRate) {
+    plan->resampler = std::make_unique<dsp::PolyphaseResampler>(
+        inputRate, outputRate, maxChannels, maxInputFrames, quality);
+
+    size_t planeSize = plan->resampler->maxOutputFrames();
+    plan->planarData.assign(planeSize * maxChannels, 0.0f);
+    for (size_t ch = 0; ch < maxChannels; ch++) {
+      plan->channelData.push_back(plan->planarData.data() + ch * planeSize);
+    }
+  }
+
+  activePlan.publish(plan);
+}
+
+void Resampler::process(StreamInfo& data) {
+  auto plan = activePlan.read();
+  if (!plan || !plan->resampler ||
+      static_cast<uint32_t>(data.sampleRate) != plan->inputRate ||
+      (size_t)data.numChannels > plan->channels) {
+    return;
+  }
+
+  data.numSamples =
+      plan->resampler->process(data.data, data.numSamples,
+                               plan->channelData.data(), data.numChannels);
+  data.data = plan->channelData.data();
+  data.sampleRate = static_cast<SampleRate>(plan->outputRate);
+}
@@ -0,0 +1,231 @@
+#include "SampleConversion.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for clamp
+#include <cmath>      // for lrintf
+
+#include "SampleFormat.h"  // for S16, withFormat, deinterleave, interleave
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace bell;
+
+// Same scale as the original MAX_INT16 conversion
+static constexpr float INT16_SCALE = 32767.0f;
+static constexpr float INT16_SCALE_INV = 1.0f / INT16_SCALE;
+// -32768 comes in a little below -1, it has to make it back out
+static constexpr float INT16_FLOOR = -32768.0f / INT16_SCALE;
+
+// Rounded to nearest, so that every int16 survives the way through float
+static inline int16_t toInt16(float sample) {
+  return static_cast<int16_t>(
+      lrintf(std::clamp(sample, INT16_FLOOR, 1.0f) * INT16_SCALE));
+}
+
+// Stereo is by far the most common layout, so it gets the vector paths.
+// Every kernel returns the amount of frames it handled, the scalar loop
+// finishes the rest.
+#if defined(__SSE2__)
+static size_t deinterleaveStereo(const int16_t* in, float* left, float* right,
+                                 size_t frames) {
+  const __m128 scale = _mm_set1_ps(INT16_SCALE_INV);
+  size_t i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    // L0 R0 L1 R1 L2 R2 L3 R3
+    __m128i pcm = _mm_loadu_si128((const __m128i*)(in + i * 2));
+    // Sign-extend to 32 bits
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(pcm, pcm), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(pcm, pcm), 16);
+    __m128 flo = _mm_mul_ps(_mm_cvtepi32_ps(lo), scale);
+    __m128 fhi = _mm_mul_ps(_mm_cvtepi32_ps(hi), scale);
+    _mm_storeu_ps(left + i, _mm_shuffle_ps(flo, fhi, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(right + i, _mm_shuffle_ps(flo, fhi, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+  return i;
+}
+
+static size_t interleaveStereo(const float* left, const float* right,
+                               int16_t* out, size_t frames) {
+  const __m128 scale = _mm_set1_ps(INT16_SCALE);
+  const __m128 minValue = _mm_set1_ps(INT16_FLOOR);
+  const __m128 maxValue = _mm_set1_ps(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    __m128 l =
+        _mm_max_ps(_mm_min_ps(_mm_loadu_ps(left + i), maxValue), minValue);
+    __m128 r =
+        _mm_max_ps(_mm_min_ps(_mm_loadu_ps(right + i), maxValue), minValue);
+    // Rounded to nearest, under the default MXCSR mode
+    __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_unpacklo_ps(l, r), scale));
+    __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_unpackhi_ps(l, r), scale));
+    _mm_storeu_si128((__m128i*)(out + i * 2), _mm_packs_epi32(lo, hi));
+  }
+  return i;
+}
+#elif defined(__ARM_NEON)
+static size_t deinterleaveStereo(const int16_t* in, float* left, float* right,
+                                 size_t frames) {
+  size_t i = 0;
+  for (; i + 8 <= frames; i += 8) {
+    int16x8x2_t pcm = vld2q_s16(in + i * 2);
+    vst1q_f32(left + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(
+                                        vget_low_s16(pcm.val[0]))),
+                                    INT16_SCALE_INV));
+    vst1q_f32(left + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(
+                                            vget_high_s16(pcm.val[0]))),
+                                        INT16_SCALE_INV));
+    vst1q_f32(right + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(
+                                         vget_low_s16(pcm.val[1]))),
+                                     INT16_SCALE_INV));
+    vst1q_f32(right + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(
+                                             vget_high_s16(pcm.val[1]))),
+                                         INT16_SCALE_INV));
+  }
+  return i;
+}
+
+// Rounded to nearest, ARMv7 only has a truncating conversion
+static inline int32x4_t roundToInt32(float32x4_t x) {
+#if defined(__aarch64__)
+  return vcvtnq_s32_f32(x);
+#else
+  // Half away from zero, the same as lrintf but for exact halves
+  const uint32x4_t sign = vdupq_n_u32(0x80000000);
+  uint32x4_t half = vorrq_u32(vandq_u32(vreinterpretq_u32_f32(x), sign),
+                              vreinterpretq_u32_f32(vdupq_n_f32(0.5f)));
+  return vcvtq_s32_f32(vaddq_f32(x, vreinterpretq_f32_u32(half)));
+#endif
+}
+
+static size_t interleaveStereo(const float* left, const float* right,
+                               int16_t* out, size_t frames) {
+  const float32x4_t minValue = vdupq_n_f32(INT16_FLOOR);
+  const float32x4_t maxValue = vdupq_n_f32(1.0f);
+  size_t i = 0;
+  for (; i + 4 <= frames; i += 4) {
+    float32x4_t l =
+        vmaxq_f32(vminq_f32(vld1q_f32(left + i), maxValue), minValue);
+    float32x4_t r =
+        vmaxq_f32(vminq_f32(vld1q_f32(right + i), maxValue), minValue);
+    int16x4x2_t pcm;
+    pcm.val[0] = vqmovn_s32(roundToInt32(vmulq_n_f32(l, INT16_SCALE)));
+    pcm.val[1] = vqmovn_s32(roundToInt32(vmulq_n_f32(r, INT16_SCALE)));
+    vst2_s16(out + i * 2, pcm);
+  }
+  return i;
+}
+#else
+// Plain C fallback (ESP32 and others), unrolled so the compiler can keep the
+// inner loop free of branches
+static size_t deinterleaveStereo(const int16_t* in, float* left, float* right,
+                                 size_t frames) {
+  size_t i = 0;
+  for (; i + 2 <= frames; i += 2) {
+    left[i] = in[i * 2] * INT16_SCALE_INV;
+    right[i] = in[i * 2 + 1] * INT16_SCALE_INV;
+    left[i + 1] = in[i * 2 + 2] * INT16_SCALE_INV;
+    right[i + 1] = in[i * 2 + 3] * INT16_SCALE_INV;
+  }
+  return i;
+}
+
+static size_t interleaveStereo(const float* left, const float* right,
+                               int16_t* out, size_t frames) {
+  size_t i = 0;
+  for (; i + 2 <= frames; i += 2) {
+    out[i * 2] = toInt16(left[i]);
+    out[i * 2 + 1] = toInt16(right[i]);
+    out[i * 2 + 2] = toInt16(left[i + 1]);
+    out[i * 2 + 3] = toInt16(right[i + 1]);
+  }
+  return i;
+}
+#endif
+
+void dsp::deinterleaveInt16(const int16_t* in, float* const* out,
+                            size_t channels, size_t frames) {
+  size_t done = 0;
+  if (channels == 2) {
+    done = deinterleaveStereo(in, out[0], out[1], frames);
+  }
+
+  for (size_t i = done; i < frames; i++) {
+    for (size_t ch = 0; ch < channels; ch++) {
+      out[ch][i] = in[i * channels + ch] * INT16_SCALE_INV;
+    }
+  }
+}
+
+void dsp::interleaveInt16(const float* const* in, int16_t* out,
+                          size_t channels, size_t frames) {
+  size_t done = 0;
+  if (channels == 2) {
+    done = interleaveStereo(in[0], in[1], out, frames);
+  }
+
+  for (size_t i = done; i < frames; i++) {
+    for (size_t ch = 0; ch < channels; ch++) {
+      out[i * channels + ch] = toInt16(in[ch][i]);
+    }
+  }
+}
+
+void dsp::deinterleaveInt16(const int16_t* in, int32_t* const* out,
+                            size_t channels, size_t frames) {
+  deinterleave<S16>((const uint8_t*)in, out, channels, frames);
+}
+
+void dsp::interleaveInt16(const int32_t* const* in, int16_t* out,
+                          size_t channels, size_t frames) {
+  interleave<S16>(in, (uint8_t*)out, channels, frames);
+}
+
+void dsp::deinterleave(const uint8_t* in, PcmFormat format, float* const* out,
+                       size_t channels, size_t frames) {
+  withFormat(format, [&](auto tag) {
+    deinterleave<decltype(tag)>(in, out, channels, frames);
+  });
+}
+
+void dsp::interleave(const float* const* in, PcmFormat format, uint8_t* out,
+                     size_t channels, size_t frames) {
+  withFormat(format, [&](auto tag) {
+    interleave<decltype(tag)>(in, out, channels, frames);
+  });
+}
+
+void dsp::deinterleave(const uint8_t* in, PcmFormat format,
+                       int32_t* const* out, size_t channels, size_t frames) {
+  withFormat(format, [&](auto tag) {
+    deinterleave<decltype(tag)>(in, out, channels, frames);
+  });
+}
+
+void dsp::interleave(const int32_t* const* in, PcmFormat format, uint8_t* out,
+                     size_t channels, size_t frames) {
+  withFormat(format, [&](auto tag) {
+    interleave<decltype(tag)>(in, out, channels, frames);
+  });
+}
+
+bool dsp::isSilent(const uint8_t* data, size_t bytes) {
+  size_t i = 0;
+  // Words of 8 bytes, read through memcpy as data may be unaligned
+  for (; i + 32 <= bytes; i += 32) {
+    uint64_t words[4];
+    memcpy(words, data + i, sizeof(words));
+    if ((words[0] | words[1] | words[2] | words[3]) != 0) {
+      return false;
+    }
+  }
+  for (; i < bytes; i++) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,354 @@
+#include "TimeSync.h"
+
+#include <string.h>   // for memcpy, memset
+#include <algorithm>  // for clamp, min, min_element
+#include <chrono>     // for system_clock
+#include <cmath>      // for llabs
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "win32shim.h"
+#else
+#include <arpa/inet.h>   // for inet_pton, htons, htonl
+#include <fcntl.h>       // for fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <netinet/in.h>  // for sockaddr_in, IPPROTO_UDP
+#include <sys/select.h>  // for select, fd_set
+#include <sys/socket.h>  // for socket, bind, connect, recvfrom, sendto
+#include <unistd.h>      // for close
+#endif
+
+#include "BellClock.h"    // for nowNs
+#include "BellLogger.h"   // for BELL_LOG
+#include "BellMetrics.h"  // for BELL_METRIC_GAUGE
+
+using namespace bell;
+
+namespace {
+const uint8_t MAGIC[3] = {'B', 'T', 'S'};
+// Magic, kind, padding, then the three timestamps
+constexpr size_t PACKET_SIZE = 32;
+
+#ifdef _WIN32
+void closeFd(int fd) {
+  closesocket(fd);
+}
+
+void setNonBlocking(int fd) {
+  u_long mode = 1;
+  ioctlsocket(fd, FIONBIO, &mode);
+}
+#else
+void closeFd(int fd) {
+  close(fd);
+}
+
+void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+#endif
+
+void writeI64(uint8_t* out, int64_t value) {
+  for (int i = 0; i < 8; i++) {
+    out[i] = (uint64_t)value >> (56 - i * 8);
+  }
+}
+
+int64_t readI64(const uint8_t* data) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value = (value << 8) | data[i];
+  }
+  return (int64_t)value;
+}
+
+bool isPacket(const uint8_t* data, long len, uint8_t kind) {
+  return len == (long)PACKET_SIZE &&
+         memcmp(data, MAGIC, sizeof(MAGIC)) == 0 && data[3] == kind;
+}
+}  // namespace
+
+TimeSync::TimeSync(const Config& config)
+    : bell::Task("time_sync", 4096, 5, 0, false), config(config) {}
+
+TimeSync::~TimeSync() {
+  stop();
+}
+
+int64_t TimeSync::wallNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+bool TimeSync::start() {
+  stop();
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0) {
+    return false;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port);
+  if (isHost()) {
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      BELL_LOG(error, TAG, "Cannot bind port %d", config.port);
+      stop();
+      return false;
+    }
+  } else {
+    // Connected, only the host's replies come through
+    if (inet_pton(AF_INET, config.host.c_str(), &addr.sin_addr) != 1 ||
+        connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      BELL_LOG(error, TAG, "Invalid host %s", config.host.c_str());
+      stop();
+      return false;
+    }
+  }
+  setNonBlocking(sock);
+
+  {
+    std::scoped_lock lock(syncMutex);
+    stats = Stats();
+    fitted = false;
+    slope = 0;
+  }
+  latest.clear();
+  picked.clear();
+  lastSentNs = 0;
+  lastEchoNs = 0;
+  lastPickedNs = 0;
+  return startTask();
+}
+
+void TimeSync::stop() {
+  stopTask();
+  if (sock >= 0) {
+    closeFd(sock);
+    sock = -1;
+  }
+}
+
+bool TimeSync::isSyncedLocked() {
+  return isHost() || (fitted && clock::nowNs() - lastReplyNs <
+                                    config.timeoutMs * (int64_t)1000000);
+}
+
+bool TimeSync::isSynced() {
+  std::scoped_lock lock(syncMutex);
+  return isSyncedLocked();
+}
+
+TimeSync::Stats TimeSync::getStats() {
+  std::scoped_lock lock(syncMutex);
+  Stats result = stats;
+  result.synced = isSyncedLocked();
+  return result;
+}
+
+int64_t TimeSync::nowUs() {
+  if (isHost()) {
+    return wallNs() / 1000;
+  }
+  return toGroupUs(clock::nowNs());
+}
+
+double TimeSync::offsetAtLocked(int64_t localNs) {
+  return fitOffsetNs + slope * (localNs - fitNs);
+}
+
+int64_t TimeSync::toGroupUs(int64_t localNs) {
+  std::scoped_lock lock(syncMutex);
+  if (isHost() || !fitted) {
+    return (localNs + (wallNs() - clock::nowNs())) / 1000;
+  }
+  return (localNs + (int64_t)offsetAtLocked(localNs)) / 1000;
+}
+
+int64_t TimeSync::toLocalNs(int64_t groupUs) {
+  std::scoped_lock lock(syncMutex);
+  int64_t groupNs = groupUs * 1000;
+  if (isHost() || !fitted) {
+    return groupNs - (wallNs() - clock::nowNs());
+  }
+  // Solves groupNs = local + offsetAtLocked(local)
+  return fitNs + (int64_t)((groupNs - fitOffsetNs - fitNs) / (1 + slope));
+}
+
+void TimeSync::runTask() {
+  while (!isStopRequested()) {
+    int64_t waitNs = MAX_WAIT_MS * (int64_t)1000000;
+    if (!isHost()) {
+      int64_t untilPoll =
+          lastSentNs + config.pollMs * (int64_t)1000000 - clock::nowNs();
+      if (untilPoll <= 0) {
+        sendRequest();
+        untilPoll = config.pollMs * (int64_t)1000000;
+      }
+      waitNs = std::min(waitNs, untilPoll);
+    }
+    struct timeval timeout = {0, (long)(waitNs / 1000)};
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(sock, &readable);
+    if (select(sock + 1, &readable, NULL, NULL, &timeout) > 0) {
+      if (isHost()) {
+        serve();
+      } else {
+        receiveReplies();
+      }
+    }
+  }
+}
+
+void TimeSync::serve() {
+  uint8_t packet[PACKET_SIZE + 1];
+  while (true) {
+    struct sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    long len = recvfrom(sock, (char*)packet, sizeof(packet), 0,
+                        (struct sockaddr*)&from, &fromLen);
+    // Stamped at once, the time spent here then counts as the host's
+    int64_t receivedNs = wallNs();
+    if (len < 0) {
+      return;
+    }
+    if (!isPacket(packet, len, REQUEST)) {
+      continue;
+    }
+    // The request's send time stays, the follower matches the reply with it
+    packet[3] = REPLY;
+    writeI64(packet + 16, receivedNs);
+    writeI64(packet + 24, wallNs());
+    sendto(sock, (const char*)packet, PACKET_SIZE, 0, (struct sockaddr*)&from,
+           fromLen);
+
+    std::scoped_lock lock(syncMutex);
+    stats.served++;
+  }
+}
+
+void TimeSync::sendRequest() {
+  uint8_t packet[PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  memcpy(packet, MAGIC, sizeof(MAGIC));
+  packet[3] = REQUEST;
+  lastSentNs = clock::nowNs();
+  writeI64(packet + 8, lastSentNs);
+  send(sock, (const char*)packet, sizeof(packet), 0);
+
+  std::scoped_lock lock(syncMutex);
+  stats.sent++;
+}
+
+void TimeSync::receiveReplies() {
+  uint8_t packet[PACKET_SIZE + 1];
+  while (true) {
+    long len = recv(sock, (char*)packet, sizeof(packet), 0);
+    int64_t receivedNs = clock::nowNs();
+    if (len < 0) {
+      return;
+    }
+    if (!isPacket(packet, len, REPLY)) {
+      continue;
+    }
+    int64_t sentNs = readI64(packet + 8);
+    int64_t hostReceivedNs = readI64(packet + 16);
+    int64_t hostSentNs = readI64(packet + 24);
+    // Stale, repeated, or not one of ours
+    if (sentNs <= lastEchoNs || sentNs > receivedNs ||
+        receivedNs - sentNs > config.timeoutMs * (int64_t)1000000) {
+      continue;
+    }
+    lastEchoNs = sentNs;
+
+    Sample sample;
+    sample.localNs = sentNs + (receivedNs - sentNs) / 2;
+    sample.offsetNs =
+        ((hostReceivedNs - sentNs) + (hostSentNs - receivedNs)) / 2;
+    sample.delayNs = std::max<int64_t>(
+        0, (receivedNs - sentNs) - (hostSentNs - hostReceivedNs));
+    {
+      std::scoped_lock lock(syncMutex);
+      stats.received++;
+      lastReplyNs = receivedNs;
+    }
+    onSample(sample);
+  }
+}
+
+void TimeSync::onSample(const Sample& sample) {
+  latest.push_back(sample);
+  while (latest.size() > std::max<size_t>(config.filterSamples, 1)) {
+    latest.pop_front();
+  }
+  // Queuing only ever adds delay, and skews the offset by half of it
+  Sample pick = *std::min_element(
+      latest.begin(), latest.end(),
+      [](const Sample& a, const Sample& b) { return a.delayNs < b.delayNs; });
+  if (pick.localNs <= lastPickedNs) {
+    return;
+  }
+  lastPickedNs = pick.localNs;
+
+  std::scoped_lock lock(syncMutex);
+  int64_t errorNs = fitted ? pick.offsetNs - (int64_t)offsetAtLocked(
+                                                 pick.localNs)
+                           : 0;
+  if (llabs(errorNs) > config.resyncMs * (int64_t)1000000) {
+    BELL_LOG(info, TAG, "Host clock moved by %lld us, resyncing",
+             (long long)(errorNs / 1000));
+    picked.clear();
+    latest.clear();
+    latest.push_back(pick);
+    errorNs = 0;
+  }
+  picked.push_back(pick);
+  while (picked.size() > std::max<size_t>(config.driftSamples, 2)) {
+    picked.pop_front();
+  }
+  fit();
+
+  stats.delayUs = pick.delayNs / 1000;
+  stats.errorUs = errorNs / 1000;
+  stats.driftPpm = slope * 1e6;
+  BELL_METRIC_GAUGE("timesync.error_us", stats.errorUs);
+  BELL_METRIC_GAUGE("timesync.delay_us", stats.delayUs);
+}
+
+void TimeSync::fit() {
+  const Sample& last = picked.back();
+  if (!fitted || picked.size() < 2 ||
+      last.localNs - picked.front().localNs < DRIFT_BASELINE_NS) {
+    // Too short a span to tell the drift from the jitter, kept as it was
+    fitNs = last.localNs;
+    fitOffsetNs = last.offsetNs;
+    fitted = true;
+    return;
+  }
+
+  // Least squares, around the last sample so the sums keep their precision
+  double n = picked.size(), sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+  for (const Sample& sample : picked) {
+    double x = (sample.localNs - last.localNs) / 1e9;
+    double y = sample.offsetNs - last.offsetNs;
+    sumX += x;
+    sumY += y;
+    sumXX += x * x;
+    sumXY += x * y;
+  }
+  double meanX = sumX / n;
+  double meanY = sumY / n;
+  double spread = sumXX - sumX * meanX;
+  if (spread > 0) {
+    double maxSlope = config.maxDriftPpm / 1e6;
+    slope = std::clamp((sumXY - sumX * meanY) / spread / 1e9, -maxSlope,
+                       maxSlope);
+  }
+  fitNs = last.localNs + (int64_t)(meanX * 1e9);
+  fitOffsetNs = last.offsetNs + (int64_t)meanY;
+}
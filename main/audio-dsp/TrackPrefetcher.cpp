@@ -0,0 +1,201 @@
+#include "TrackPrefetcher.h"
+
+#include <chrono>     // for milliseconds, steady_clock
+#include <exception>  // for exception
+#include <utility>    // for move
+
+#include "AudioCodecs.h"      // for AudioCodecs
+#include "AudioContainers.h"  // for guessAudioContainer
+#include "BellLogger.h"       // for BELL_LOG
+#include "HTTPClient.h"       // for HTTPClient
+
+using namespace bell;
+
+TrackPrefetcher::TrackPrefetcher(uint32_t stageMs, uint32_t bufferSize)
+    : bell::Task("prefetch", 4096 * 4, 3, 0),
+      stageMs(stageMs),
+      bufferSize(bufferSize),
+      stagedSem(5) {}
+
+TrackPrefetcher::~TrackPrefetcher() {
+  stop();
+}
+
+void TrackPrefetcher::stop() {
+  stopTask();
+}
+
+void TrackPrefetcher::onStopRequested() {
+  // The stream may be blocking the task in a read
+  std::scoped_lock lock(pendingMutex);
+  if (pending != nullptr && pending->stream != nullptr) {
+    pending->stream->close();
+  }
+}
+
+void TrackPrefetcher::cancel() {
+  stop();
+  active = false;
+  staged = false;
+  track = nullptr;
+  pcm.clear();
+}
+
+void TrackPrefetcher::prefetch(const BufferedStream::StreamReader& reader,
+                               size_t trackHash) {
+  cancel();
+
+  this->reader = reader;
+  this->hash = trackHash;
+  active = startTask();
+}
+
+void TrackPrefetcher::prefetch(const std::string& url, size_t trackHash) {
+  prefetch(httpReader(url), trackHash);
+}
+
+bool TrackPrefetcher::isStaged() {
+  return staged && track != nullptr;
+}
+
+bool TrackPrefetcher::waitStaged(uint32_t timeoutMs) {
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeoutMs);
+  while (!staged) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (left.count() <= 0) {
+      return false;
+    }
+    stagedSem.twait(left.count());
+  }
+  return true;
+}
+
+std::unique_ptr<TrackPrefetcher::Track> TrackPrefetcher::splice(
+    CentralAudioBuffer& buffer, size_t trackHash) {
+  if (!active || trackHash != hash) {
+    return nullptr;
+  }
+
+  // Not staged in time, this is no slower than opening the track now
+  waitStaged(UINT32_MAX);
+  active = false;
+  if (track == nullptr) {
+    return nullptr;
+  }
+
+  GaplessInfo gapless;
+  if (track->container->getGaplessInfo(gapless)) {
+    buffer.setTrackTrim(hash, gapless.delay, gapless.totalFrames);
+  }
+
+  size_t written = 0;
+  while (written < pcm.size()) {
+    size_t toWrite = buffer.writePCM(pcm.data() + written,
+                                     pcm.size() - written, hash, sampleRate,
+                                     channels, format);
+    if (toWrite == 0) {
+      buffer.waitForSpace(1, 100);
+      continue;
+    }
+    written += toWrite;
+  }
+
+  staged = false;
+  pcm.clear();
+  pcm.shrink_to_fit();
+  return std::move(track);
+}
+
+BufferedStream::StreamReader TrackPrefetcher::httpReader(
+    const std::string& url) {
+  // Total length from the first response, later requests stop there
+  auto length = std::make_shared<size_t>(0);
+  return [url, length](uint32_t rangeStart) -> BufferedStream::StreamPtr {
+    if (rangeStart > 0 && rangeStart >= *length) {
+      return nullptr;
+    }
+
+    try {
+      HTTPClient::Headers headers = {
+          {"Range", "bytes=" + std::to_string(rangeStart) + "-"}};
+      auto response = HTTPClient::get(url, headers, Socket::Profile::BULK);
+      if (rangeStart == 0) {
+        *length = response->totalLength();
+      }
+      return std::make_shared<HTTPClient::ResponseStream>(std::move(response));
+    } catch (const std::exception& e) {
+      BELL_LOG(error, "TrackPrefetcher", "Request failed: %s", e.what());
+      return nullptr;
+    }
+  };
+}
+
+void TrackPrefetcher::runTask() {
+  auto next = std::make_unique<Track>();
+  next->hash = hash;
+  next->stream = std::make_shared<BufferedStream>(
+      "prefetch_stream", bufferSize, bufferSize / 2, READ_SIZE, bufferSize / 4,
+      READ_SIZE, true);
+  {
+    std::scoped_lock pendingLock(pendingMutex);
+    pending = next.get();
+  }
+
+  next->stream->open(reader);
+  if (!isStopRequested()) {
+    next->container = AudioContainers::guessAudioContainer(*next->stream);
+  }
+  if (!isStopRequested() && next->container != nullptr) {
+    next->codec = AudioCodecs::createCodec(next->container.get());
+  }
+
+  // Decode the head of the track, a few bad frames are skipped
+  size_t limit = 0;
+  int failures = 0;
+  while (!isStopRequested() && next->codec != nullptr &&
+         failures < MAX_FAILURES) {
+    uint32_t len = 0;
+    uint8_t* data = next->codec->decode(next->container.get(), len);
+    if (data == nullptr) {
+      failures++;
+      continue;
+    }
+    failures = 0;
+    if (len == 0) {
+      continue;
+    }
+
+    if (limit == 0) {
+      // Codecs know their output format after the first frame
+      sampleRate = next->codec->sampleRate;
+      channels = next->codec->channelCount;
+      format = next->codec->getPcmFormat();
+      limit = (size_t)stageMs * sampleRate / 1000 * channels *
+              pcmBytesPerSample(format);
+      pcm.reserve(limit);
+    }
+
+    pcm.insert(pcm.end(), data, data + len);
+    if (pcm.size() >= limit) {
+      break;
+    }
+  }
+
+  {
+    std::scoped_lock pendingLock(pendingMutex);
+    pending = nullptr;
+  }
+
+  if (isStopRequested() || next->codec == nullptr) {
+    BELL_LOG(error, "TrackPrefetcher", "Could not prefetch the next track");
+    next->stream->close();
+    pcm.clear();
+  } else {
+    track = std::move(next);
+  }
+
+  staged = true;
+  stagedSem.give();
+}
@@ -0,0 +1,47 @@
+#include "VolumeControl.h"
+
+#include <algorithm>  // for clamp
+#include <cmath>      // for INFINITY
+
+#include "AudioPipeline.h"   // for AudioPipeline
+#include "AudioSink.h"       // for AudioSink
+#include "AudioTransform.h"  // for AudioTransform
+#include "Gain.h"            // for Gain
+
+using namespace bell;
+
+VolumeControl::VolumeControl(std::shared_ptr<AudioPipeline> pipeline,
+                             AudioSink* sink, const Config& config)
+    : config(config), pipeline(pipeline), sink(sink) {
+  if (!sink->softwareVolumeControl) {
+    return;
+  }
+
+  // Last in the chain, so transforms before it keep their headroom
+  softwareGain = std::make_shared<Gain>();
+  softwareGain->setRampTime(config.rampMs);
+  softwareGain->configure(config.channels, 0.0f);
+  pipeline->addTransform(softwareGain);
+}
+
+void VolumeControl::setVolume(int volume) {
+  const int maxVolume = AudioTransform::VOLUME_STEPS - 1;
+  std::scoped_lock lock(accessMutex);
+  volume = std::clamp(volume, 0, maxVolume);
+  if (volume == this->volume) {
+    return;
+  }
+  this->volume = volume;
+
+  if (softwareGain) {
+    // Linear in dB from minDb at the first step to 0 dB at the last
+    float gainDb = volume == 0 ? -INFINITY
+                               : config.minDb * (maxVolume - volume) /
+                                     (maxVolume - 1);
+    softwareGain->configure(config.channels, gainDb);
+  } else {
+    sink->volumeChanged(volume * AudioSink::MAX_VOLUME / maxVolume);
+  }
+
+  pipeline->volumeUpdated(volume);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, int32_t
+#include <atomic>    // for atomic
+#include <vector>    // for vector
+
+namespace bell {
+namespace dsp {
+/**
+ * Resampler for ratios a fraction of a percent away from 1, adjustable
+ * while it runs, to follow the drift between two clocks nominally at the
+ * same rate. Outputs are interpolated between the two closest of PHASES
+ * windowed sinc kernels, at a 32-bit fractional position.
+ *
+ * All memory is allocated in the constructor, process() doesn't allocate.
+ */
+class AsyncResampler {
+ public:
+  static const size_t TAPS = 32;
+  static const size_t PHASES = 128;
+  // Furthest setRatio() goes from 1
+  static constexpr double MAX_DEVIATION = 0.01;
+
+  /**
+   * @param channels amount of planes processed
+   * @param maxInputFrames largest amount of frames passed to process()
+   */
+  AsyncResampler(size_t channels, size_t maxInputFrames);
+
+  /**
+   * Safe to call from any thread, applies from the next process() call
+   * @param ratio input frames consumed per output frame, above 1 to play
+   * the input faster
+   */
+  void setRatio(double ratio);
+  double getRatio() const;
+
+  // Upper bound of frames returned by a single process() call
+  size_t maxOutputFrames() const;
+
+  // Frames between an input and its output, half the filter
+  size_t latencyFrames() const { return TAPS / 2; }
+
+  /**
+   * @param in channels planes of frames samples, at most maxInputFrames
+   * @param frames amount of input frames
+   * @param out channels planes of at least maxOutputFrames() samples
+   * @param activeChannels planes actually present, at most channels
+   * @return amount of frames written to out
+   */
+  size_t process(const float* const* in, size_t frames, float* const* out,
+                 size_t activeChannels);
+
+  // Clears the filter history, e.g. on a track change
+  void reset();
+
+ private:
+  size_t channels;
+  size_t maxInputFrames;
+
+  // [phase][tap] for PHASES + 1 fractional delays from 0 to 1, so the last
+  // phase can be interpolated with the next one
+  std::vector<float> filter;
+
+  // [channel][TAPS + maxInputFrames], as in PolyphaseResampler
+  std::vector<float> history;
+  size_t historyFrames = 0;
+  // Position of the next output between two input frames, 32-bit fraction
+  uint32_t fraction = 0;
+
+  // Input advance per output, minus one input frame, in the same fraction
+  std::atomic<int32_t> stepOffset = 0;
+
+  void designFilter();
+};
+}  // namespace dsp
+}  // namespace bell
@@ -9,9 +9,15 @@
 #include <vector>     // for vector
 
 #include "AudioTransform.h"  // for AudioTransform
+#include "RcuPtr.h"          // for RcuPtr
 #include "StreamInfo.h"      // for StreamInfo
 
 namespace bell {
+/**
+ * Channel mixer built on a gain matrix. Every output channel is a weighted
+ * sum of the input channels, computed into scratch planes before being
+ * written back, so a destination can also be the source of another output.
+ */
 class AudioMixer : public bell::AudioTransform {
  public:
   enum DownmixMode { DEFAULT };
@@ -32,11 +38,26 @@ class AudioMixer : public bell::AudioTransform {
   // Configuration of each channels in the mixer
   std::vector<MixerConfig> mixerConfig;
 
-  std::unique_ptr<StreamInfo> process(
-      std::unique_ptr<StreamInfo> data) override;
+  void process(StreamInfo& data) override;
+  bool keepsFormat() override { return false; }
+  // The configured output count, to planes are written whatever the input
+  int getOutputChannels(int inputChannels) override;
 
   void reconfigure() override {}
 
+  /**
+   * Sets the gain matrix directly, e.g. for crossover or upmix setups.
+   * @param from amount of input channels
+   * @param to amount of output channels
+   * @param gains to * from gains, row by row (gains[out * from + in])
+   */
+  void configure(int from, int to, const std::vector<float>& gains);
+
+  // Makes the current from / to / mixerConfig active for process(). Each
+  // destination averages its sources, channels that aren't a destination
+  // pass through
+  void publishConfig();
+
   void fromJSON(cJSON* json) {
     cJSON* mappedChannels = cJSON_GetObjectItem(json, "mapped_channels");
 
@@ -75,6 +96,26 @@ class AudioMixer : public bell::AudioTransform {
 
     this->from = sources.size();
     this->to = mixerConfig.size();
+    publishConfig();
   }
+
+ private:
+  // Frames mixed per pass into the scratch planes
+  static constexpr size_t MIX_BLOCK = 128;
+
+  struct ActiveMix {
+    int from;
+    int to;
+
+    // [to][from]
+    std::vector<float> gains;
+
+    // [to][MIX_BLOCK] and plane pointers, only touched by the audio thread
+    std::vector<float> scratch;
+    std::vector<float*> outputPlanes;
+    std::vector<const float*> inputPlanes;
+  };
+
+  RcuPtr<ActiveMix> activeMix;
 };
 }  // namespace bell
\ No newline at end of file
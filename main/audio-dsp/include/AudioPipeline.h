@@ -1,9 +1,13 @@
 #pragma once
 
-#include <memory>  // for shared_ptr, unique_ptr
-#include <mutex>   // for mutex
-#include <vector>  // for vector
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <map>       // for map
+#include <memory>    // for shared_ptr, unique_ptr
+#include <mutex>     // for mutex
+#include <vector>    // for vector
 
+#include "RcuPtr.h"      // for RcuPtr
 #include "StreamInfo.h"  // for StreamInfo
 
 namespace bell {
@@ -12,18 +16,101 @@ class Gain;
 
 class AudioPipeline {
  private:
+  class Worker;
+  class Quantizer;
+  typedef std::vector<std::shared_ptr<AudioTransform>> Lane;
+
+  /**
+   * Transforms between two that touch every channel. Lanes hold groups of
+   * transforms sharing no channel with the other lane, lane 1 runs on the
+   * worker while process() runs lane 0.
+   *
+   * Transforms with a quantum get a stage of their own, run through its
+   * quantizer.
+   */
+  struct Stage {
+    Lane lanes[2];
+    std::shared_ptr<Quantizer> quantizer;
+  };
+
+  struct Plan {
+    std::vector<Stage> stages;
+    // No transform changes the channel or sample count
+    bool keepsFormat = true;
+    // Kept alive for process() while the plan is in use
+    std::shared_ptr<Worker> worker;
+  };
+
   std::shared_ptr<Gain> headroomGainTransform;
+  std::shared_ptr<Worker> worker;
+  // Kept across plans, so that buffered samples survive a new transform
+  std::map<AudioTransform*, std::shared_ptr<Quantizer>> quantizers;
+
+  // Snapshot of transforms used by process(), republished after every call
+  // that adds, reconfigures or retunes transforms
+  RcuPtr<Plan> activePlan;
+
+  // Splits transforms into stages, lanes only with a worker
+  std::shared_ptr<Plan> makePlan();
+  void publishPlan() { activePlan.publish(makePlan()); }
+
+  template <typename Info>
+  void runPlan(Info& data);
 
  public:
   AudioPipeline();
   ~AudioPipeline(){};
 
+  // Guards the control side, process() never takes it
   std::mutex accessMutex;
   std::vector<std::shared_ptr<AudioTransform>> transforms;
 
   void recalculateHeadroom();
   void addTransform(std::shared_ptr<AudioTransform> transform);
+
+  /**
+   * Runs transforms on independent channels on a second task, e.g. the
+   * left and right halves of an EQ on both cores of an ESP32. The two meet
+   * again before every transform that reads all channels, like mixers,
+   * resamplers and transforms without channel information.
+   * @param core core of the worker, ignored off ESP32
+   */
+  void enableParallelProcessing(int core = 1);
+  void disableParallelProcessing();
+
+  // Samples of delay added by transforms running on a quantum
+  size_t getLatency();
+
+  // Most channels any transform writes for the given input, planes handed
+  // to process() must hold that many. Audio thread, like process()
+  int getMaxChannels(int inputChannels);
+
+  // Reconfigures the transforms whose config depends on volume, the
+  // actual gain is VolumeControl's
   void volumeUpdated(int volume);
-  std::unique_ptr<StreamInfo> process(std::unique_ptr<StreamInfo> data);
+
+  // Forwards a new input sample rate to every transform, each getting the
+  // output rate of the previous one
+  void sampleRateChanged(uint32_t sampleRate);
+
+  // Rebuilds the per-volume caches of all transforms, call after their
+  // configuration changed
+  void precomputeVolumeSteps();
+  // Lock-free, to be called from a single audio thread
+  void process(StreamInfo& data);
+
+  /**
+   * Audio thread, between blocks. True when every transform would leave
+   * the samples untouched right now, process() can then be skipped
+   */
+  bool isIdentity();
+  // Whether silence stays silence of the same shape, once filter tails
+  // rang out
+  bool keepsFormat();
+
+  // True if every active transform has a fixed point implementation. Called
+  // from the audio thread, like processFixed()
+  bool supportsFixedPoint();
+  void processFixed(FixedStreamInfo& data);
 };
 };  // namespace bell
\ No newline at end of file
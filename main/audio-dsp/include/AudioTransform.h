@@ -3,25 +3,110 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
+#include "RTMutex.h"
 #include "StreamInfo.h"
 #include "TransformConfig.h"
 
 namespace bell {
+class MetricHistogram;
+
 class AudioTransform {
  protected:
-  std::mutex accessMutex;
+  // Serializes reconfiguration. Parameters are handed over to process()
+  // through an RcuPtr, so process() never takes this lock. Calls meant for
+  // the audio thread outside of it that need it only try_lock(), they keep
+  // the previous configuration while it's held
+  RTMutex accessMutex;
 
  public:
-  virtual std::unique_ptr<StreamInfo> process(
-      std::unique_ptr<StreamInfo> data) = 0;
+  // Processes one block in place, data describes the planar buffers and may
+  // be updated (e.g. channel count after a downmix)
+  virtual void process(StreamInfo& data) = 0;
+
+  // Transforms that can run on Q1.31 samples return true here and implement
+  // processFixed(), a pipeline made only of those skips float conversion
+  virtual bool supportsFixedPoint() { return false; }
+  virtual void processFixed(FixedStreamInfo& data){};
+
   virtual void sampleRateChanged(uint32_t sampleRate){};
+
+  /**
+   * Rate of the stream process() hands on for the given input rate, for
+   * resamplers and oversamplers. AudioPipeline tells each transform the rate
+   * of the one before it
+   */
+  virtual uint32_t getOutputRate(uint32_t inputRate) { return inputRate; }
+
+  /**
+   * Channels process() hands on for the given input channels, for mixers.
+   * Called from the audio thread, AudioPipeline::getMaxChannels() follows it
+   * through the chain
+   */
+  virtual int getOutputChannels(int inputChannels) { return inputChannels; }
+
+  /**
+   * Channels process() reads and writes, empty for all of them. AudioPipeline
+   * runs transforms without a channel in common in parallel, one listing
+   * several channels, like a linked compressor, joins them.
+   */
+  virtual std::vector<int> getChannels() { return {}; }
+
+  /**
+   * Block size process() works best at, 0 for any. AudioPipeline buffers
+   * the stream to hand such transforms blocks of exactly this many samples,
+   * at a latency of one quantum. Transforms with a quantum must keep the
+   * sample and channel counts of data; the fixed point path,
+   * processFixed(), calls them with the caller's blocks.
+   */
+  virtual size_t getQuantum() { return 0; }
+
+  /**
+   * Whether process() currently leaves the samples as they are, e.g. a gain
+   * of 0 dB that finished ramping. Called from the audio thread between
+   * blocks, AudioPipeline::isIdentity() skips pipelines made only of these
+   */
+  virtual bool isIdentity() { return false; }
+
+  /**
+   * False for transforms that change the channel or sample count, like
+   * mixers and resamplers, which keep a pipeline from being skipped on
+   * silence
+   */
+  virtual bool keepsFormat() { return true; }
   virtual float calculateHeadroom() { return 0; };
 
   virtual void reconfigure(){};
 
+  // Number of volume steps a TransformConfig can resolve, 0 to 100
+  static const int VOLUME_STEPS = 101;
+
+  /**
+   * Builds per-volume processing state from config, so that later volume
+   * changes don't have to recompute it. Called on the control thread.
+   */
+  virtual void precomputeVolumeSteps(){};
+
+  /**
+   * Switches to the precomputed state of the given volume
+   * @return false if nothing was precomputed, reconfigure() is used then
+   */
+  virtual bool applyVolumeStep(int volume) { return false; };
+
+  /**
+   * Transforms reacting to volume by themselves rather than through their
+   * config, e.g. loudness compensation. AudioPipeline::volumeUpdated()
+   * hands them every volume through applyVolumeStep()
+   */
+  virtual bool followsVolume() { return false; }
+
   std::string filterType;
   std::unique_ptr<TransformConfig> config;
 
+  // "dsp.<filterType>" process() timings, set by AudioPipeline in
+  // BELL_METRICS builds
+  MetricHistogram* processTime = nullptr;
+
   AudioTransform() = default;
   virtual ~AudioTransform() = default;
 };
@@ -1,13 +1,20 @@
 #pragma once
 
 #include <stddef.h>    // for size_t
-#include <stdint.h>    // for uint32_t, uint8_t
+#include <stdint.h>    // for uint32_t, uint8_t, int32_t
+#include <atomic>      // for atomic
 #include <functional>  // for function
 #include <memory>      // for shared_ptr, unique_ptr
-#include <mutex>       // for mutex
+#include <mutex>       // for scoped_lock
 #include <vector>      // for vector
 
-#include "StreamInfo.h"  // for BitWidth
+#include "BellAllocator.h"   // for CapsAllocator
+#include "BellMetrics.h"     // for MemoryAccount
+#include "DSPLoadMonitor.h"  // for DSPLoadMonitor
+#include "RTMutex.h"         // for RTMutex
+#include "RcuPtr.h"          // for RcuPtr
+#include "Requantizer.h"     // for Requantizer
+#include "StreamInfo.h"      // for BitWidth, PcmFormat
 
 namespace bell {
 class AudioPipeline;
@@ -17,13 +24,42 @@ class CentralAudioBuffer;
 
 class BellDSP {
  public:
+  // Sizes the planar work buffers, allocated once outside of the audio path
+  struct EngineConfig {
+    // Largest block, in frames, processed in a single pipeline pass. Larger
+    // inputs are processed in several passes
+    size_t maxBlockFrames = 1024;
+
+    // Maximum number of channels any stage of the pipeline works on, blocks
+    // a mixer would upmix beyond it are dropped
+    size_t maxChannels = 2;
+
+    // Run pipelines made only of fixed point capable transforms (or no
+    // transforms at all) in Q1.31, skipping the float conversion. Opt-in,
+    // results differ from the float path by the Q1.31 rounding
+    bool fixedPoint = false;
+
+    // Interleaved input that stayed digital silence this long skips the
+    // pipeline, once filter tails had time to ring out. 0 always runs it
+    uint32_t silenceBypassMs = 1000;
+
+    // How float and Q1.31 results are brought down to 16 and 24-bit output.
+    // Blocks nothing moved off the output's steps are passed bit exact
+    Requantizer::Mode dither = Requantizer::Mode::TPDF;
+
+    // Only read by the constructor, see loadMonitor
+    DSPLoadMonitor::Config loadMonitor;
+  };
+
   BellDSP(std::shared_ptr<CentralAudioBuffer> centralAudioBuffer);
-  ~BellDSP(){};
+  BellDSP(std::shared_ptr<CentralAudioBuffer> centralAudioBuffer,
+          EngineConfig engineConfig);
+  ~BellDSP();
 
   class AudioEffect {
    public:
     AudioEffect() = default;
-    ~AudioEffect() = default;
+    virtual ~AudioEffect() = default;
     size_t duration;
     virtual void apply(float* sampleData, size_t samples,
                        size_t relativePosition) = 0;
@@ -42,25 +78,195 @@ class BellDSP {
     void apply(float* sampleData, size_t samples, size_t relativePosition);
   };
 
+  /**
+   * Interleaved PCM passing through process(), e.g. for an RTPSender. Runs
+   * on the audio thread, so it must only copy the data away.
+   */
+  typedef std::function<void(const uint8_t* data, size_t bytes, int channels,
+                             uint32_t sampleRate, PcmFormat format)>
+      Tap;
+
+  enum class TapPoint {
+    // Input as decoded, interleaved input only
+    PRE_DSP,
+    // Output, after the pipeline and its volume
+    POST_DSP,
+  };
+
+  // Replaces the tap at point, nullptr removes it
+  void setTap(TapPoint point, const Tap& tap);
+
   void applyPipeline(std::shared_ptr<AudioPipeline> pipeline);
+  void applyPipeline(std::shared_ptr<AudioPipeline> pipeline,
+                     EngineConfig engineConfig);
   void queryInstantEffect(std::unique_ptr<AudioEffect> instantEffect);
 
   std::shared_ptr<AudioPipeline> getActivePipeline();
 
+  // Every process() call against the time its input takes to play
+  DSPLoadMonitor& getLoadMonitor() { return loadMonitor; }
+
+  // Whether the last block was silence passed through untouched, a sink
+  // can idle its output stage meanwhile
+  bool isBypassingSilence() { return bypassingSilence; }
+
+  /**
+   * Whether the last interleaved block left process() bit for bit as it
+   * came in, of any format, because there's no pipeline or it's identity
+   * (e.g. volume is left to the DAC). Mirrored on the "dsp.passthrough"
+   * gauge, with the frames passed on "dsp.passthrough_frames"
+   */
+  bool isPassingThrough() { return passingThrough; }
+
+  /**
+   * Runs interleaved PCM through the active pipeline, in place. The pipeline
+   * may reduce the channel count (downmix), the output is then packed at the
+   * start of data.
+   * @return amount of bytes of processed data, 0 on unsupported input
+   */
   size_t process(uint8_t* data, size_t bytes, int channels, uint32_t sampleRate,
                  BitWidth bitWidth);
 
+  /**
+   * Same as above, for pipelines that can grow the data (e.g. a Resampler
+   * converting up). Input whose output doesn't fit in capacity is kept, and
+   * run ahead of the next call's of the same format.
+   * @param capacity size of data in bytes, at least bytes
+   */
+  size_t process(uint8_t* data, size_t bytes, size_t capacity, int channels,
+                 uint32_t sampleRate, BitWidth bitWidth);
+
+  /**
+   * Same as above, for any PcmFormat. Output keeps the input format
+   */
+  size_t process(uint8_t* data, size_t bytes, size_t capacity, int channels,
+                 uint32_t sampleRate, PcmFormat format);
+
+  /**
+   * Runs planar PCM through the active pipeline, e.g. the output of
+   * BaseCodec::decodePlanar(). Planes are copied into the work buffers as
+   * they are, Q1.31 planes stay on the fixed point path when the pipeline
+   * allows it. The result is interleaved into out.
+   * @param frames samples in each of the channels planes
+   * @param capacity size of out in bytes, output beyond it is dropped
+   * @param format layout of out
+   * @return amount of bytes written to out
+   */
+  size_t process(const float* const* planes, size_t frames, int channels,
+                 uint32_t sampleRate, uint8_t* out, size_t capacity,
+                 PcmFormat format);
+  size_t process(const int32_t* const* planes, size_t frames, int channels,
+                 uint32_t sampleRate, uint8_t* out, size_t capacity,
+                 PcmFormat format);
+
  private:
-  std::shared_ptr<AudioPipeline> activePipeline;
+  // Interleaved input process() had no room for
+  struct Carry {
+    std::vector<uint8_t> data;
+    size_t bytes = 0;
+    int channels = 0;
+    uint32_t sampleRate = 0;
+    PcmFormat format = PcmFormat::INT16;
+
+    // Appends to the carried bytes, data only grows when callers keep
+    // passing too little capacity
+    void stash(const uint8_t* input, size_t length);
+  };
+
+  // Everything the audio thread needs for a block, swapped as a whole
+  struct Engine {
+    EngineConfig config;
+    std::shared_ptr<AudioPipeline> pipeline;
+
+    // Planar work buffers, maxChannels planes of maxBlockFrames samples.
+    // Every transform runs over them, so they stay in internal RAM
+    std::vector<float, CapsAllocator<float, Allocator::INTERNAL>> planarData;
+    std::vector<float*> channelData;
+
+    // Same for the fixed point path, empty if it's disabled
+    std::vector<int32_t, CapsAllocator<int32_t, Allocator::INTERNAL>>
+        fixedPlanarData;
+    std::vector<int32_t*> fixedChannelData;
+
+    // Output stage, keeps dither and error feedback state per channel
+    Requantizer requantizer;
+
+    // Presized to a block, only touched by the audio thread
+    Carry carry;
+
+    // Work buffers of this engine, the previous one's until it's released
+    MemoryAccount memory = MemoryAccount("dsp");
+  };
+
+  RcuPtr<Engine> engine;
   std::shared_ptr<CentralAudioBuffer> buffer;
-  std::mutex accessMutex;
-  std::vector<float> dataLeft = std::vector<float>(1024);
-  std::vector<float> dataRight = std::vector<float>(1024);
+
+  struct Taps {
+    Tap pre;
+    Tap post;
+  };
+  RcuPtr<Taps> taps;
+
+  // Serializes control side changes, never taken by process()
+  RTMutex accessMutex;
+  EngineConfig engineConfig;
+
+  DSPLoadMonitor loadMonitor;
+
+  // Only touched by the audio thread
+  StreamInfo streamInfo = {};
+  // Rate of the last interleaved block's output, 0 before the first
+  uint32_t outputRate = 0;
+  FixedStreamInfo fixedStreamInfo = {};
+  bool fixedBlock = false;
+  // Silence run through the pipeline since the last sound
+  uint64_t silentFrames = 0;
+  std::atomic<bool> bypassingSilence = false;
+  std::atomic<bool> passingThrough = false;
+
+  // Expects accessMutex to be held
+  void publishEngine(std::shared_ptr<AudioPipeline> pipeline);
+  // Whether the work buffers hold channels and everything the pipeline
+  // makes of them
+  bool fitsPlanes(Engine& engine, int channels);
+  // Picks up an effect handed over by queryInstantEffect
+  void takeInstantEffect();
+  /**
+   * Whether interleaved input can be left as it is, because it's settled
+   * silence or the pipeline is identity
+   */
+  bool canBypass(const Engine& engine, const uint8_t* data, size_t bytes,
+                 size_t frames, uint32_t sampleRate);
+  // Updates isPassingThrough() and its metrics for a block of frames
+  void reportPassthrough(bool passthrough, size_t frames);
+  // Whether a block of format can run in Q1.31
+  bool useFixedPoint(const Engine& engine, PcmFormat format) const;
+  // Runs one block through the pipeline, the result is left in streamInfo
+  void processBlock(Engine& engine, uint8_t* in, size_t frames, int channels,
+                    uint32_t sampleRate, PcmFormat format);
+  // Same, for a block already in the work buffers
+  void runBlock(Engine& engine, size_t frames, int channels,
+                uint32_t sampleRate, PcmFormat format);
+  // Copies frames of planes, from offset, into the work buffers
+  void loadBlock(Engine& engine, const float* const* planes, size_t offset,
+                 size_t frames, int channels, PcmFormat format);
+  void loadBlock(Engine& engine, const int32_t* const* planes, size_t offset,
+                 size_t frames, int channels, PcmFormat format);
+  template <typename T>
+  size_t processPlanar(const T* const* planes, size_t frames, int channels,
+                       uint32_t sampleRate, uint8_t* out, size_t capacity,
+                       PcmFormat format);
+  // Applies effects to the result of processBlock and interleaves it
+  void writeBlock(Engine& engine, uint8_t* out, size_t frames, int channels,
+                  PcmFormat format);
 
   std::unique_ptr<AudioEffect> underflowEffect = nullptr;
   std::unique_ptr<AudioEffect> startEffect = nullptr;
   std::unique_ptr<AudioEffect> instantEffect = nullptr;
 
-  size_t samplesSinceInstantQueued;
+  // Handed over from queryInstantEffect to the audio thread
+  std::atomic<AudioEffect*> pendingInstantEffect = nullptr;
+
+  size_t samplesSinceInstantQueued = 0;
 };
 };  // namespace bell
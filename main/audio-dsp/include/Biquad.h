@@ -11,6 +11,8 @@
 #include <vector>         // for vector
 
 #include "AudioTransform.h"   // for AudioTransform
+#include "ParameterRamp.h"    // for ParameterRamp
+#include "RcuPtr.h"           // for RcuPtr
 #include "StreamInfo.h"       // for StreamInfo
 #include "TransformConfig.h"  // for TransformConfig
 
@@ -43,7 +45,7 @@ class Biquad : public bell::AudioTransform {
 
   std::map<std::string, float> currentConfig;
 
-  std::unordered_map<std::string, Type> const strMapType = {
+  static inline const std::unordered_map<std::string, Type> strMapType = {
       {"free", Type::Free},
       {"highpass", Type::Highpass},
       {"lowpass", Type::Lowpass},
@@ -64,63 +66,66 @@ class Biquad : public bell::AudioTransform {
   int channel;
   Biquad::Type type;
 
-  std::unique_ptr<StreamInfo> process(
-      std::unique_ptr<StreamInfo> data) override;
+  void process(StreamInfo& data) override;
 
   void configure(Type type, std::map<std::string, float>& config);
 
   void sampleRateChanged(uint32_t sampleRate) override;
+  std::vector<int> getChannels() override { return {channel}; }
+  // Sections whose numerator equals the denominator, a peaking filter at
+  // 0 dB for instance
+  bool isIdentity() override;
+
+  // Last configured set, b0, b1, b2, a1, a2
+  const float* getCoefficients() const { return coeffs; }
+
+  // Time over which coefficient changes are interpolated, 0 to jump
+  void setRampTime(float milliseconds) { rampTimeMs = milliseconds; }
 
   void reconfigure() override {
     std::scoped_lock lock(this->accessMutex);
     std::map<std::string, float> biquadConfig;
-    this->channel = config->getChannels()[0];
-
-    float invalid = -0x7C;
-
-    auto type = config->getString("biquad_type");
-    float bandwidth = config->getFloat("bandwidth", false, invalid);
-    float slope = config->getFloat("slope", false, invalid);
-    float gain = config->getFloat("gain", false, invalid);
-    float frequency = config->getFloat("frequency", false, invalid);
-    float q = config->getFloat("q", false, invalid);
+    Type newType;
 
-    if (currentConfig["bandwidth"] == bandwidth &&
-        currentConfig["slope"] == slope && currentConfig["gain"] == gain &&
-        currentConfig["frequency"] == frequency && currentConfig["q"] == q) {
+    if (!readConfig(biquadConfig, newType, true)) {
       return;
     }
-
-    if (bandwidth != invalid)
-      biquadConfig["bandwidth"] = bandwidth;
-    if (slope != invalid)
-      biquadConfig["slope"] = slope;
-    if (gain != invalid)
-      biquadConfig["gain"] = gain;
-    if (frequency != invalid)
-      biquadConfig["freq"] = frequency;
-    if (q != invalid)
-      biquadConfig["q"] = q;
-
-    if (type == "free") {
-      biquadConfig["a1"] = config->getFloat("a1");
-      biquadConfig["a2"] = config->getFloat("a2");
-      biquadConfig["b0"] = config->getFloat("b0");
-      biquadConfig["b1"] = config->getFloat("b1");
-      biquadConfig["b2"] = config->getFloat("b2");
-    }
-
-    auto typeElement = strMapType.find(type);
-    if (typeElement != strMapType.end()) {
-      this->configure(typeElement->second, biquadConfig);
-    } else {
-      throw std::invalid_argument("No biquad of type " + type);
-    }
+    this->configure(newType, biquadConfig);
   }
 
+  void precomputeVolumeSteps() override;
+  bool applyVolumeStep(int volume) override;
+
  private:
+  struct Coefficients {
+    float values[5];
+    size_t rampSamples;
+  };
+
+  // Coefficients are interpolated in steps of this many samples
+  static const size_t RAMP_BLOCK_SIZE = 32;
+  float rampTimeMs = 20.0f;
+
+  // Scratch set written by the generators, published on configure()
   float coeffs[5];
-  float w[2] = {1.0, 1.0};
+  RcuPtr<Coefficients> activeCoeffs;
+
+  // Published coefficient sets for every volume step, entries are shared
+  // between steps with identical parameters
+  std::vector<std::shared_ptr<Coefficients>> volumeSteps;
+
+  // Resolves config at its current volume, false if it didn't change and
+  // skipUnchanged is set
+  bool readConfig(std::map<std::string, float>& biquadConfig, Type& type,
+                  bool skipUnchanged);
+  void calculateCoefficients(Type type, std::map<std::string, float>& config);
+  std::shared_ptr<Coefficients> makeCoefficients();
+
+  // Filter state, only touched by the audio thread
+  float w[2] = {0.0, 0.0};
+  ParameterRamp<5> ramp;
+
+  void processSection(float* data, size_t samples, const float* coeffs);
 
   float sampleRate = 44100;
 
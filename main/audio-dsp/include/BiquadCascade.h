@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <array>     // for array
+#include <map>       // for map
+#include <memory>    // for shared_ptr
+#include <vector>    // for vector
+
+#include "AudioTransform.h"  // for AudioTransform
+#include "RcuPtr.h"          // for RcuPtr
+#include "StreamInfo.h"      // for StreamInfo
+
+namespace bell {
+namespace dsp {
+/**
+ * Runs a cascade of second order sections over one channel in a single pass.
+ * @param data samples, processed in place
+ * @param samples number of samples
+ * @param coeffs sections * 5 coefficients, each b0, b1, b2, a1, a2
+ * @param state sections * 2 delay elements, w0, w1
+ * @param sections number of sections
+ */
+void biquadCascade(float* data, size_t samples, const float* coeffs,
+                   float* state, size_t sections);
+}  // namespace dsp
+
+/**
+ * Fused multi-channel biquad cascade. All sections of all configured channels
+ * are applied in a single pass over each sample, with up to four channels in
+ * the lanes of one SIMD register on SSE / NEON hosts. Meant for parametric EQs
+ * where chaining separate Biquad transforms costs a memory pass per band.
+ */
+class BiquadCascade : public bell::AudioTransform {
+ public:
+  // b0, b1, b2, a1, a2, same layout as Biquad
+  typedef std::array<float, 5> Section;
+
+  BiquadCascade();
+  ~BiquadCascade(){};
+
+  /**
+   * Replaces the cascade. Channels with fewer sections than the longest one
+   * are padded with pass-through sections. Filter state survives as long as
+   * the set of channels and the section count stay the same.
+   * @param channelSections sections to apply, per channel index
+   */
+  void configure(const std::map<int, std::vector<Section>>& channelSections);
+
+  void process(StreamInfo& data) override;
+  std::vector<int> getChannels() override;
+
+ private:
+  static const size_t LANES = 4;
+
+  struct LaneGroup {
+    int channels[LANES];
+    size_t laneCount;
+  };
+
+  struct Plan {
+    std::vector<LaneGroup> groups;
+    size_t sections;
+
+    // [group][section][coefficient][lane]
+    std::vector<float> coeffs;
+
+    // [group][section][w0 / w1][lane], written by the audio thread only.
+    // Shared between plans of the same shape
+    std::shared_ptr<std::vector<float>> state;
+  };
+
+  RcuPtr<Plan> activePlan;
+
+  void processGroup(StreamInfo& data, const LaneGroup& group,
+                    const float* coeffs, float* state, size_t sections);
+};
+}  // namespace bell
@@ -10,13 +10,36 @@
 
 #include "AudioTransform.h"   // for AudioTransform
 #include "Biquad.h"           // for Biquad
+#include "BiquadCascade.h"    // for biquadCascade
+#include "RcuPtr.h"           // for RcuPtr
 #include "StreamInfo.h"       // for StreamInfo
 #include "TransformConfig.h"  // for TransformConfig
 
 namespace bell {
 class BiquadCombo : public bell::AudioTransform {
+ public:
+  enum class FilterType { Highpass, Lowpass };
+
  private:
+  // Sections of all filters, run as one fused cascade
+  struct Chain {
+    int channel;
+    size_t sections;
+    std::vector<float> coeffs;
+
+    // Delay lines, only touched by the audio thread
+    std::vector<float> state;
+  };
+
+  // Filters being built by reconfigure(), published once complete
   std::vector<std::unique_ptr<bell::Biquad>> biquads;
+  RcuPtr<Chain> activeChain;
+
+  float sampleRate = 44100;
+
+  void addFilters(float freq, const std::vector<float>& qValues,
+                  FilterType type);
+  void publishChain();
 
   // Calculates Q values for Nth order Butterworth / Linkwitz-Riley filters
   std::vector<float> calculateBWQ(int order);
@@ -30,14 +53,16 @@ class BiquadCombo : public bell::AudioTransform {
   std::map<std::string, float> paramCache = {{"order", 0.0f},
                                              {"frequency", 0.0f}};
 
-  enum class FilterType { Highpass, Lowpass };
-
   void linkwitzRiley(float freq, int order, FilterType type);
   void butterworth(float freq, int order, FilterType type);
 
-  std::unique_ptr<StreamInfo> process(
-      std::unique_ptr<StreamInfo> data) override;
+  // Replaces the filters with a Linkwitz-Riley or Butterworth set
+  void configure(int channel, bool linkwitzRiley, FilterType type,
+                 float freq, int order);
+
+  void process(StreamInfo& data) override;
   void sampleRateChanged(uint32_t sampleRate) override;
+  std::vector<int> getChannels() override { return {channel}; }
 
   void reconfigure() override {
     std::scoped_lock lock(this->accessMutex);
@@ -52,17 +77,19 @@ class BiquadCombo : public bell::AudioTransform {
       paramCache["order"] = order;
     }
 
-    this->channel = config->getChannels()[0];
-    this->biquads = std::vector<std::unique_ptr<bell::Biquad>>();
     auto type = config->getString("combo_type");
     if (type == "lr_lowpass") {
-      this->linkwitzRiley(freq, order, FilterType::Lowpass);
+      configure(config->getChannels()[0], true, FilterType::Lowpass, freq,
+                order);
     } else if (type == "lr_highpass") {
-      this->linkwitzRiley(freq, order, FilterType::Highpass);
+      configure(config->getChannels()[0], true, FilterType::Highpass, freq,
+                order);
     } else if (type == "bw_highpass") {
-      this->butterworth(freq, order, FilterType::Highpass);
+      configure(config->getChannels()[0], false, FilterType::Highpass, freq,
+                order);
     } else if (type == "bw_lowpass") {
-      this->butterworth(freq, order, FilterType::Highpass);
+      configure(config->getChannels()[0], false, FilterType::Lowpass, freq,
+                order);
     } else {
       throw std::invalid_argument("Invalid combo filter type");
     }
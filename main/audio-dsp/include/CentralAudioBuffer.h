@@ -1,19 +1,29 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <vector>
 
+#include "BellAllocator.h"
+#include "BellMetrics.h"
+#include "BellTrace.h"
 #include "BellUtils.h"
-#include "CircularBuffer.h"
+#include "SampleConversion.h"
+#include "SlotRing.h"
 #include "StreamInfo.h"
 #include "WrappedSemaphore.h"
 
-#ifdef _WIN32
-#define __attribute__(X)
+// Maximum payload of a single chunk, chunks can be cut shorter at runtime
+#ifndef BELL_PCM_CHUNK_SIZE
+#define BELL_PCM_CHUNK_SIZE 4096
 #endif
 
 typedef std::function<void(std::string)> shutdownEventHandler;
@@ -24,14 +34,43 @@ class CentralAudioBuffer {
   std::mutex accessMutex;
 
   std::atomic<bool> isLocked = false;
+
+  // Guards producer-side state (currentChunk) against clearBuffer(), the
+  // reader never takes it
   std::mutex dataAccessMutex;
 
+  // Size at which a chunk is handed over to the reader
+  size_t chunkSize;
+
+  // Maximum time a partially filled chunk is held back, 0 disables
+  std::chrono::milliseconds flushInterval{0};
+  std::chrono::steady_clock::time_point chunkStarted;
+
+  // Gapless trimming of the track with trimHash, in frames
+  bool trimActive = false;
+  size_t trimHash = 0;
+  uint64_t trimSkip = 0;
+  uint64_t trimLength = 0;
+  uint64_t trimWritten = 0;
+
+  // Frames committed so far for the track with positionHash
+  size_t positionHash = 0;
+  uint64_t positionFrames = 0;
+
+  // Bumped by every clear, chunks reserved before belong to the previous one
+  std::atomic<uint32_t> generation = 0;
+  // Reader side, the generation takeFlush() last reported
+  uint32_t readGeneration = 0;
+
  public:
-  static const size_t PCM_CHUNK_SIZE = 4096;
+  static constexpr size_t PCM_CHUNK_SIZE = BELL_PCM_CHUNK_SIZE;
+  // Given whenever a chunk is committed / a slot is freed
   std::unique_ptr<bell::WrappedSemaphore> chunkReady;
+  std::unique_ptr<bell::WrappedSemaphore> spaceReady;
 
-  // Audio marker for track change detection, and DSP autoconfig
-  struct AudioChunk {
+  // Audio marker for track change detection, and DSP autoconfig. Aligned to a
+  // cache line, so the pcmData of every slot is suitably aligned for SIMD
+  struct alignas(64) AudioChunk {
     // Timeval
     int32_t sec;
     int32_t usec;
@@ -39,24 +78,54 @@ class CentralAudioBuffer {
     // Unique track hash, used for track change detection
     size_t trackHash;
 
+    // Position of the first frame in the track, counting every frame
+    // committed for it since its start or setTrackPosition()
+    uint64_t framePosition;
+
     // Audio format
     uint32_t sampleRate;
     uint8_t channels;
     uint8_t bitWidth;
+    PcmFormat format;
 
     // PCM data size
     size_t pcmSize;
 
+    // getGeneration() when the chunk was reserved, the reader drops chunks
+    // of an older one
+    uint32_t generation;
+
+    // Whole payload is digital silence. Set by writePCM(), chunks written
+    // in place through reserveChunk() have it cleared unless the writer
+    // sets it. Lets the reader skip DSP or idle the sink
+    bool silent;
+
     // PCM data
-    uint8_t pcmData[PCM_CHUNK_SIZE];
-  } __attribute__((packed));
+    alignas(16) uint8_t pcmData[PCM_CHUNK_SIZE];
+  };
 
-  CentralAudioBuffer(size_t chunks) {
-    audioBuffer = std::make_shared<CircularBuffer>(chunks * sizeof(AudioChunk));
+  /**
+	 * @param chunks number of chunk slots in the ring
+	 * @param chunkSize bytes after which a chunk is passed on, at most
+	 * PCM_CHUNK_SIZE. Smaller values lower latency at the cost of more chunks
+	 */
+  CentralAudioBuffer(size_t chunks, size_t chunkSize = PCM_CHUNK_SIZE) {
+    setChunkSize(chunkSize);
+
+    // Chunks travel from the decoder thread to the sink thread only, so the
+    // ring can run lock-free
+    audioBuffer = std::make_shared<ChunkRing>(chunks);
+    memory.resize(chunks * sizeof(AudioChunk));
     chunkReady = std::make_unique<bell::WrappedSemaphore>(50);
+    spaceReady = std::make_unique<bell::WrappedSemaphore>(50);
   }
 
-  std::shared_ptr<bell::CircularBuffer> audioBuffer;
+  // Chunks are only copied in and out, the ring can live in PSRAM
+  typedef SlotRing<AudioChunk, CapsAllocator<AudioChunk, Allocator::PSRAM>>
+      ChunkRing;
+  std::shared_ptr<ChunkRing> audioBuffer;
+  MemoryAccount memory = MemoryAccount("audio_buffer");
+  MemoryAccount historyMemory = MemoryAccount("pcm_history");
   uint32_t currentSampleRate = 44100;
 
   /**
@@ -65,23 +134,248 @@ class CentralAudioBuffer {
 	 */
   uint32_t getSampleRate() { return currentSampleRate; }
 
+  /**
+	 * Sets the size after which a chunk is handed over to the reader
+	 * @param bytes chunk size, clamped to [1, PCM_CHUNK_SIZE]
+	 */
+  void setChunkSize(size_t bytes) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    chunkSize = std::clamp(bytes, (size_t)1, PCM_CHUNK_SIZE);
+  }
+
+  size_t getChunkSize() { return chunkSize; }
+
+  /**
+	 * Sets the maximum time a partially filled chunk is held back before it is
+	 * handed over to the reader
+	 * @param interval hold time, 0 to only pass on full chunks
+	 */
+  void setFlushInterval(std::chrono::milliseconds interval) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    flushInterval = interval;
+  }
+
+  /**
+	 * Hands the partially filled chunk, if any, over to the reader. Call after
+	 * a seek or when a short sound has to be played out immediately
+	 */
+  void flush() {
+    std::scoped_lock lock(this->dataAccessMutex);
+    commitPending();
+  }
+
+  /**
+	 * Trims encoder delay and padding off a track, see
+	 * AudioContainer::getGaplessInfo(). Dropped frames count as written, so
+	 * the next track's first frame directly follows the last kept one. After a
+	 * seek, call again with no skip and the length left.
+	 * @param hash track hash passed to writePCM
+	 * @param skipFrames frames to drop at the start
+	 * @param totalFrames frames to keep after those, 0 keeps everything
+	 */
+  void setTrackTrim(size_t hash, uint64_t skipFrames, uint64_t totalFrames) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    trimActive = true;
+    trimHash = hash;
+    trimSkip = skipFrames;
+    trimLength = totalFrames;
+    trimWritten = 0;
+  }
+
+  /**
+	 * Sets the length of the track being trimmed, for containers that only
+	 * know it near the end. Frames written so far are kept.
+	 * @param hash track hash passed to setTrackTrim
+	 * @param totalFrames frames to keep after the skipped ones
+	 */
+  void setTrackLength(size_t hash, uint64_t totalFrames) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    if (!trimActive || trimHash != hash) {
+      trimActive = true;
+      trimHash = hash;
+      trimSkip = 0;
+      trimWritten = 0;
+    }
+    trimLength = totalFrames;
+  }
+
+  /**
+	 * Sets the frame position of the track's next committed chunk. Call after
+	 * the decoder seeked, so the history knows where its chunks belong
+	 * @param hash track hash passed to writePCM
+	 * @param frame position the decoder continues from
+	 */
+  void setTrackPosition(size_t hash, uint64_t frame) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    positionHash = hash;
+    positionFrames = frame;
+  }
+
+  /**
+	 * Keeps the last committed chunks, decoded, in a history ring in PSRAM so
+	 * that a seek back into them is served by seekInHistory() without fetching
+	 * or decoding anything again. A 4 KiB chunk holds 23 ms of 16 bit stereo
+	 * at 44.1 kHz, 430 chunks (1.8 MB) about 10 s. Call before playback
+	 * @param chunks chunks kept, 0 disables the history
+	 */
+  void setHistorySize(size_t chunks) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    history = HistoryRing(chunks);
+    historyMemory.resize(chunks * sizeof(AudioChunk));
+    historyHead = 0;
+    historyCount = 0;
+    replayLeft = 0;
+  }
+
+  /**
+	 * Producer side. Restarts playback of the current track from a frame still
+	 * in the history: the buffer is cleared and refilled with the history from
+	 * that frame on, the decoder then carries on from where it was, as
+	 * writePCM() only accepts new data once the history is queued.
+	 *
+	 * Only the chunks committed since the last setTrackPosition() and leading
+	 * up to the latest one are used, so the decoder's output still follows.
+	 * @param hash track hash passed to writePCM
+	 * @param frame position to play from
+	 * @return false when the frame isn't in the history, the caller then
+	 * seeks the usual way
+	 */
+  bool seekInHistory(size_t hash, uint64_t frame) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    if (hasChunk && currentChunk->pcmSize > 0) {
+      // The chunk being filled is the newest part of the history
+      trackChunk(currentChunk);
+    }
+
+    // Walk back over the run of contiguous chunks ending at the newest
+    size_t historySize = history.size();
+    uint64_t runStart = positionFrames;
+    for (size_t back = 1; back <= historyCount; back++) {
+      size_t slot = (historyHead + historySize - back) % historySize;
+      const AudioChunk& chunk = history[slot];
+      uint64_t frames = chunkFrames(chunk);
+      if (chunk.trackHash != hash || positionHash != hash ||
+          chunk.framePosition + frames != runStart) {
+        break;
+      }
+      runStart = chunk.framePosition;
+      if (frame >= runStart && frame < runStart + frames) {
+        generation++;
+        audioBuffer->clear();
+        hasChunk = false;
+        reservedChunk = nullptr;
+        replayIndex = slot;
+        replayLeft = back;
+        replaySkip = (frame - runStart) * (chunk.pcmSize / frames);
+        pumpHistory();
+        spaceReady->give();
+        return true;
+      }
+    }
+
+    if (hasChunk && currentChunk->pcmSize > 0) {
+      // Not seeking after all, the chunk is still being filled
+      untrackChunk(currentChunk);
+    }
+    return false;
+  }
+
   /**
 	 * Clears input buffer, to be called for track change and such
 	 */
   void clearBuffer() {
     std::scoped_lock lock(this->dataAccessMutex);
 
-    audioBuffer->emptyBuffer();
+    generation++;
+    audioBuffer->clear();
     hasChunk = false;
+    replayLeft = 0;
+    spaceReady->give();
   }
 
   void emptyCompletely() {
     std::scoped_lock lock(this->dataAccessMutex);
-    audioBuffer->emptyBuffer();
+    generation++;
+    audioBuffer->clear();
+    replayLeft = 0;
+    spaceReady->give();
+  }
+
+  /**
+	 * Counts clearBuffer(), emptyCompletely() and seekInHistory() calls.
+	 * Every chunk carries the one it was written in
+	 */
+  uint32_t getGeneration() { return generation; }
+
+  /**
+	 * Reader side. True once after every clear: what the reader passed on
+	 * before is stale, and playing out what the sink holds delays a seek by
+	 * its whole buffer. The reader then drops it downstream, through
+	 * AudioSink::flush() and PlaybackPosition::reset(), before feeding the
+	 * next chunk. Call before every read, also while the buffer is empty
+	 */
+  bool takeFlush() {
+    uint32_t current = generation;
+    if (current == readGeneration) {
+      return false;
+    }
+    readGeneration = current;
+    BELL_METRIC_COUNT("buffer.flushes", 1);
+    return true;
   }
 
   bool hasAtLeast(size_t chunks) {
-    return this->audioBuffer->size() >= chunks * sizeof(AudioChunk);
+    return this->audioBuffer->size() >= chunks;
+  }
+
+  /**
+	 * Producer side: whether the reader is about to run dry. A decoder whose
+	 * source has no data yet (e.g. BufferedStream::readAvailable is low)
+	 * should then write concealment instead of blocking on the source
+	 * @param lowWaterChunks chunks below which the reader is starving
+	 */
+  bool isStarving(size_t lowWaterChunks) {
+    return !hasAtLeast(lowWaterChunks);
+  }
+
+  /**
+	 * Writes synthesized audio, e.g. BaseCodec::conceal(), bridging a stall
+	 * of the track with the given hash. Unlike writePCM() it isn't counted
+	 * as part of the track for gapless trimming, and goes out right away.
+	 * @return amount of bytes written, 0 when the buffer is full
+	 */
+  size_t writeConcealment(const uint8_t* data, size_t dataSize, size_t hash,
+                          uint32_t sampleRate, uint8_t channels,
+                          PcmFormat format) {
+    std::scoped_lock lock(this->dataAccessMutex);
+    size_t written =
+        appendPCM(data, dataSize, hash, sampleRate, channels, format, 0, 0);
+    commitPending();
+    BELL_METRIC_COUNT("buffer.concealed_bytes", written);
+    return written;
+  }
+
+  /**
+	 * Blocks until at least the given amount of chunks is buffered
+	 * @param chunks number of chunks to wait for
+	 * @param timeoutMs maximum time to wait
+	 * @return true if the chunks are available, false on timeout
+	 */
+  bool waitForChunks(size_t chunks, uint32_t timeoutMs) {
+    return waitFor(*chunkReady, timeoutMs,
+                   [this, chunks]() { return hasAtLeast(chunks); });
+  }
+
+  /**
+	 * Blocks until at least the given amount of chunk slots is free
+	 * @param chunks number of free slots to wait for
+	 * @param timeoutMs maximum time to wait
+	 * @return true if the space is available, false on timeout
+	 */
+  bool waitForSpace(size_t chunks, uint32_t timeoutMs) {
+    return waitFor(*spaceReady, timeoutMs, [this, chunks]() {
+      return audioBuffer->capacity() - audioBuffer->size() >= chunks;
+    });
   }
 
   /**
@@ -106,20 +400,89 @@ class CentralAudioBuffer {
     }
   }
 
-  AudioChunk currentChunk = {};
+  // Chunk currently being filled by writePCM, lives inside the ring
+  AudioChunk* currentChunk = nullptr;
   bool hasChunk = false;
 
   AudioChunk lastReadChunk = {};
 
+  /**
+	 * Reserves the next free chunk slot inside the ring, so that a decoder can
+	 * write its output in place. Must be followed by commitChunk().
+	 * @return pointer to the slot, nullptr when the buffer is full or still
+	 * taking the history queued by seekInHistory()
+	 */
+  AudioChunk* reserveChunk() {
+    if (replayLeft > 0 && !pumpHistory()) {
+      return nullptr;
+    }
+    AudioChunk* chunk = audioBuffer->reserve();
+    if (chunk != nullptr) {
+      chunk->generation = generation;
+      chunk->silent = false;
+    }
+    reservedChunk = chunk;
+    return chunk;
+  }
+
+  /**
+	 * Publishes the chunk previously returned by reserveChunk() to readers
+	 */
+  void commitChunk() {
+    if (reservedChunk != nullptr) {
+      trackChunk(reservedChunk);
+      reservedChunk = nullptr;
+    }
+    audioBuffer->commit();
+    BELL_METRIC_GAUGE("buffer.chunks", audioBuffer->size());
+    this->chunkReady->give();
+  }
+
+  /**
+	 * Returns the oldest chunk without copying it out of the ring. The chunk
+	 * stays valid until releaseChunk() is called. Chunks committed before a
+	 * clear that raced with it are skipped.
+	 * @return pointer to the chunk, nullptr when the buffer is empty
+	 */
+  const AudioChunk* peekChunk() {
+    const AudioChunk* chunk = audioBuffer->peek();
+    while (chunk != nullptr && chunk->generation != generation) {
+      releaseChunk();
+      chunk = audioBuffer->peek();
+    }
+    if (chunk != nullptr) {
+      currentSampleRate = static_cast<uint32_t>(chunk->sampleRate);
+    }
+    return chunk;
+  }
+
+  /**
+	 * Frees the chunk previously returned by peekChunk()
+	 * @return false when clearBuffer() dropped it while it was being read
+	 */
+  bool releaseChunk() {
+    bool released = audioBuffer->release();
+    BELL_METRIC_GAUGE("buffer.chunks", audioBuffer->size());
+    this->spaceReady->give();
+    return released;
+  }
+
   AudioChunk* readChunk() {
-    std::scoped_lock lock(this->dataAccessMutex);
-    if (audioBuffer->size() < sizeof(AudioChunk)) {
+    BELL_TRACE_SCOPE("buffer.read");
+    const AudioChunk* chunk = peekChunk();
+    if (chunk == nullptr) {
       lastReadChunk.pcmSize = 0;
       return nullptr;
     }
 
-    audioBuffer->read((uint8_t*)&lastReadChunk, sizeof(AudioChunk));
-    currentSampleRate = static_cast<uint32_t>(lastReadChunk.sampleRate);
+    // Only copy the used part of the PCM payload
+    memcpy(&lastReadChunk, chunk, offsetof(AudioChunk, pcmData));
+    memcpy(lastReadChunk.pcmData, chunk->pcmData, chunk->pcmSize);
+    if (!releaseChunk()) {
+      // Cleared under the copy, a seek doesn't play what came before it
+      lastReadChunk.pcmSize = 0;
+      return nullptr;
+    }
     return &lastReadChunk;
   }
 
@@ -127,46 +490,214 @@ class CentralAudioBuffer {
                   uint32_t sampleRate = 44100, uint8_t channels = 2,
                   BitWidth bitWidth = BitWidth::BW_16, int32_t sec = 0,
                   int32_t usec = 0) {
+    return writePCM(data, dataSize, hash, sampleRate, channels,
+                    pcmFormatFor(bitWidth), sec, usec);
+  }
+
+  /**
+	 * Writes interleaved PCM of the given format, chunks keep the format so
+	 * hi-res sources reach BellDSP and the sink without truncation
+	 * @return amount of bytes written, 0 when the buffer is full
+	 */
+  size_t writePCM(const uint8_t* data, size_t dataSize, size_t hash,
+                  uint32_t sampleRate, uint8_t channels, PcmFormat format,
+                  int32_t sec = 0, int32_t usec = 0) {
+    // Waiting for the lock included, the reader may hold it
+    BELL_TRACE_SCOPE("buffer.write");
     std::scoped_lock lock(this->dataAccessMutex);
-    if (hasChunk && (currentChunk.trackHash != hash ||
-                     currentChunk.pcmSize >= PCM_CHUNK_SIZE)) {
 
-      if ((audioBuffer->size() - audioBuffer->capacity()) <
-          sizeof(AudioChunk)) {
-        return 0;
+    // Encoder delay and padding are reported as written
+    size_t trimmed = 0;
+    size_t frameSize = pcmBytesPerSample(format) * channels;
+    if (trimActive && trimHash == hash && frameSize > 0) {
+      uint64_t frames = dataSize / frameSize;
+      uint64_t skip = std::min(trimSkip, frames);
+      if (trimLength > 0) {
+        frames = std::min(frames - skip, trimLength - trimWritten);
+        if (frames == 0) {
+          trimSkip -= skip;
+          return dataSize;
+        }
+      } else {
+        frames -= skip;
+      }
+
+      trimSkip -= skip;
+      trimmed = skip * frameSize;
+      data += trimmed;
+      // Padding behind the kept frames is dropped by the caller's next write
+      dataSize = frames * frameSize;
+      if (dataSize == 0) {
+        return trimmed;
+      }
+    }
+
+    size_t written = appendPCM(data, dataSize, hash, sampleRate, channels,
+                               format, sec, usec);
+    if (trimActive && trimHash == hash && frameSize > 0) {
+      trimWritten += written / frameSize;
+    }
+    return trimmed + written;
+  }
+
+ private:
+  // Slot returned by the last reserveChunk()
+  AudioChunk* reservedChunk = nullptr;
+
+  // Committed chunks, historyHead is the slot the next one goes to
+  typedef std::vector<AudioChunk, CapsAllocator<AudioChunk, Allocator::PSRAM>>
+      HistoryRing;
+  HistoryRing history;
+  size_t historyHead = 0;
+  size_t historyCount = 0;
+
+  // History chunks still to queue after seekInHistory(), from replayIndex,
+  // the first one without its first replaySkip bytes
+  size_t replayIndex = 0;
+  size_t replayLeft = 0;
+  size_t replaySkip = 0;
+
+  static uint64_t chunkFrames(const AudioChunk& chunk) {
+    return chunk.pcmSize / (pcmBytesPerSample(chunk.format) * chunk.channels);
+  }
+
+  // Stamps a chunk with its track position and keeps it in the history.
+  // Producer side only, like everything touching the history
+  void trackChunk(AudioChunk* chunk) {
+    if (chunk->trackHash != positionHash) {
+      positionHash = chunk->trackHash;
+      positionFrames = 0;
+    }
+    chunk->framePosition = positionFrames;
+    positionFrames += chunkFrames(*chunk);
+
+    if (!history.empty()) {
+      AudioChunk& kept = history[historyHead];
+      memcpy(&kept, chunk, offsetof(AudioChunk, pcmData));
+      memcpy(kept.pcmData, chunk->pcmData, chunk->pcmSize);
+      historyHead = (historyHead + 1) % history.size();
+      historyCount = std::min(historyCount + 1, history.size());
+    }
+  }
+
+  // Takes back trackChunk() of the newest chunk
+  void untrackChunk(AudioChunk* chunk) {
+    positionFrames -= chunkFrames(*chunk);
+    if (!history.empty()) {
+      historyHead = (historyHead + history.size() - 1) % history.size();
+      historyCount--;
+    }
+  }
+
+  // Queues history chunks while there is room, returns whether all are
+  bool pumpHistory() {
+    while (replayLeft > 0) {
+      AudioChunk* slot = audioBuffer->reserve();
+      if (slot == nullptr) {
+        return false;
       }
+      const AudioChunk& kept = history[replayIndex];
+      memcpy(slot, &kept, offsetof(AudioChunk, pcmData));
+      slot->generation = generation;
+      slot->pcmSize = kept.pcmSize - replaySkip;
+      slot->framePosition += chunkFrames(kept) - chunkFrames(*slot);
+      memcpy(slot->pcmData, kept.pcmData + replaySkip, slot->pcmSize);
+      audioBuffer->commit();
+      this->chunkReady->give();
+
+      replayIndex = (replayIndex + 1) % history.size();
+      replayLeft--;
+      replaySkip = 0;
+    }
+    BELL_METRIC_GAUGE("buffer.chunks", audioBuffer->size());
+    return true;
+  }
 
-      // Track changed or buf full, return current chunk
-      hasChunk = false;
-      this->audioBuffer->write((uint8_t*)&currentChunk, sizeof(AudioChunk));
-      // this->chunkReady->give();
+  // Copies data into the current chunk, expects dataAccessMutex to be held
+  size_t appendPCM(const uint8_t* data, size_t dataSize, size_t hash,
+                   uint32_t sampleRate, uint8_t channels, PcmFormat format,
+                   int32_t sec, int32_t usec) {
+    if (hasChunk && (currentChunk->trackHash != hash ||
+                     currentChunk->format != format)) {
+      // Track or format changed, return current chunk
+      commitPending();
     }
 
     // New chunk requested, initialize
     if (!hasChunk) {
-      currentChunk.trackHash = hash;
-      currentChunk.sampleRate = sampleRate;
-      currentChunk.channels = channels;
-      currentChunk.bitWidth = 16;
-      currentChunk.sec = sec;
-      currentChunk.usec = usec;
-      currentChunk.pcmSize = 0;
+      currentChunk = reserveChunk();
+      if (currentChunk == nullptr) {
+        return 0;
+      }
+
+      currentChunk->trackHash = hash;
+      currentChunk->sampleRate = sampleRate;
+      currentChunk->channels = channels;
+      currentChunk->format = format;
+      currentChunk->bitWidth = format == PcmFormat::INT16         ? 16
+                               : format == PcmFormat::INT24_IN_32 ? 24
+                                                                  : 32;
+      currentChunk->sec = sec;
+      currentChunk->usec = usec;
+      currentChunk->pcmSize = 0;
+      currentChunk->silent = true;
       hasChunk = true;
+      chunkStarted = std::chrono::steady_clock::now();
     }
 
-    // Calculate how much data we can write
+    // Calculate how much data we can write, in whole frames so that no
+    // chunk starts in the middle of one
+    size_t frameSize =
+        pcmBytesPerSample(format) * std::max<size_t>(channels, 1);
+    size_t usableSize = std::max(chunkSize - chunkSize % frameSize, frameSize);
     size_t toWriteSize = dataSize;
 
-    if (currentChunk.pcmSize + toWriteSize > PCM_CHUNK_SIZE) {
-      toWriteSize = PCM_CHUNK_SIZE - currentChunk.pcmSize;
+    if (currentChunk->pcmSize + toWriteSize > usableSize) {
+      toWriteSize = usableSize - currentChunk->pcmSize;
     }
 
-    // Copy it over :)
-    memcpy(currentChunk.pcmData + currentChunk.pcmSize, data, toWriteSize);
-    currentChunk.pcmSize += toWriteSize;
+    // Copy it straight into the ring slot
+    memcpy(currentChunk->pcmData + currentChunk->pcmSize, data, toWriteSize);
+    currentChunk->pcmSize += toWriteSize;
+    if (currentChunk->silent) {
+      currentChunk->silent = dsp::isSilent(data, toWriteSize);
+    }
+
+    // Buf full or held back for too long, return current chunk
+    if (currentChunk->pcmSize >= usableSize ||
+        (flushInterval.count() > 0 &&
+         std::chrono::steady_clock::now() - chunkStarted >= flushInterval)) {
+      commitPending();
+    }
 
     return toWriteSize;
   }
+
+  // The semaphores only signal that the state changed, the condition itself
+  // is always re-checked
+  template <typename Predicate>
+  bool waitFor(WrappedSemaphore& semaphore, uint32_t timeoutMs,
+               Predicate ready) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeoutMs);
+    while (!ready()) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0) {
+        return false;
+      }
+      semaphore.twait(left.count());
+    }
+    return true;
+  }
+
+  // Expects dataAccessMutex to be held
+  void commitPending() {
+    if (hasChunk && currentChunk->pcmSize > 0) {
+      commitChunk();
+    }
+    hasChunk = false;
+  }
 };
 
 }  // namespace bell
@@ -9,6 +9,7 @@
 #include <vector>    // for vector
 
 #include "AudioTransform.h"   // for AudioTransform
+#include "RcuPtr.h"           // for RcuPtr
 #include "StreamInfo.h"       // for StreamInfo
 #include "TransformConfig.h"  // for TransformConfig
 
@@ -18,13 +19,49 @@
 // Y = C[0]*F*F*F + C[1]*F*F + C[2]*F + C[3] + E;
 float log2f_approx(float X);
 
+// Fast approximation to exp2(), cubic on the fractional part
+// Y = (1 + C[0]*F + C[1]*F*F + C[2]*F*F*F) * 2^E;
+float exp2f_approx(float X);
+
 #define log10f_fast(x) (log2f_approx(x) * 0.3010299956639812f)
 
 namespace bell {
+/**
+ * Feed-forward compressor / limiter. The envelope and gain are computed once
+ * per ENVELOPE_BLOCK samples on the peak of the summed channels, the gain is
+ * then interpolated linearly across the block. An optional look-ahead delays
+ * the signal so that the gain can settle before a transient arrives.
+ */
 class Compressor : public bell::AudioTransform {
+ public:
+  // Samples per envelope update
+  static constexpr size_t ENVELOPE_BLOCK = 16;
+
+  struct DelayLine {
+    // [channel][sample]
+    std::vector<float> samples;
+    size_t length = 0;
+    size_t position = 0;
+  };
+
+  struct Params {
+    std::vector<int> channels;
+    float attack;
+    float release;
+    float threshold;
+    float slope;
+    float makeupGain;
+
+    // Written by the audio thread only, shared between params of the same
+    // channels and look-ahead
+    std::shared_ptr<DelayLine> delay;
+  };
+
  private:
   std::vector<int> channels;
-  std::vector<float> tmp;
+
+  // Parameters used by process(), swapped on configure()
+  RcuPtr<Params> activeParams;
 
   std::map<std::string, float> paramCache;
 
@@ -35,22 +72,36 @@ class Compressor : public bell::AudioTransform {
   float clipLimit;
   float makeupGain;
 
+  // Envelope state, only touched by the audio thread
   float lastLoudness = -100.0f;
+  float lastGain = 1.0f;
 
   float sampleRate = 44100;
 
+  void delaySamples(StreamInfo& data, const Params& params, size_t offset,
+                    size_t samples);
+
  public:
   Compressor();
   ~Compressor(){};
 
+  /**
+   * @param attack attack time in ms
+   * @param release release time in ms
+   * @param threshold threshold in dB
+   * @param factor compression ratio
+   * @param makeupGain gain applied after compression, in dB
+   * @param lookahead delay of the signal against the detector in ms
+   */
   void configure(std::vector<int> channels, float attack, float release,
-                 float threshold, float factor, float makeupGain);
-
-  void sumChannels(std::unique_ptr<StreamInfo>& data);
-  void calLoudness();
-  void calGain();
+                 float threshold, float factor, float makeupGain,
+                 float lookahead = 0.0f);
 
-  void applyGain(std::unique_ptr<StreamInfo>& data);
+  // Channels are linked through the shared detector
+  std::vector<int> getChannels() override { return channels; }
+  // Envelope blocks line up with the calls, so the time constants don't
+  // depend on the caller's block size
+  size_t getQuantum() override { return ENVELOPE_BLOCK; }
 
   void reconfigure() override {
     std::scoped_lock lock(this->accessMutex);
@@ -61,12 +112,14 @@ class Compressor : public bell::AudioTransform {
     float newThreshold = config->getFloat("threshold");
     float newFactor = config->getFloat("factor");
     float newMakeupGain = config->getFloat("makeup_gain");
+    float newLookahead = config->getFloat("lookahead", false, 0.0f);
 
     if (paramCache["attack"] == newAttack &&
         paramCache["release"] == newRelease &&
         paramCache["threshold"] == newThreshold &&
         paramCache["factor"] == newFactor &&
-        paramCache["makeup_gain"] == newMakeupGain) {
+        paramCache["makeup_gain"] == newMakeupGain &&
+        paramCache["lookahead"] == newLookahead) {
       return;
     } else {
 
@@ -75,10 +128,11 @@ class Compressor : public bell::AudioTransform {
       paramCache["threshold"] = newThreshold;
       paramCache["factor"] = newFactor;
       paramCache["makeup_gain"] = newMakeupGain;
+      paramCache["lookahead"] = newLookahead;
     }
 
     this->configure(newChannels, newAttack, newRelease, newThreshold, newFactor,
-                    newMakeupGain);
+                    newMakeupGain, newLookahead);
   }
 
   // void fromJSON(cJSON* json) override {
@@ -93,8 +147,7 @@ class Compressor : public bell::AudioTransform {
   //     this->configure(attack, release, clipLimit, threshold, factor, makeupGain);
   // }
 
-  std::unique_ptr<StreamInfo> process(
-      std::unique_ptr<StreamInfo> data) override;
+  void process(StreamInfo& data) override;
   void sampleRateChanged(uint32_t sampleRate) override {
     this->sampleRate = sampleRate;
   };
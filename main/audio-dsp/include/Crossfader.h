@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t
+#include <memory>    // for shared_ptr
+#include <mutex>     // for mutex
+#include <vector>    // for vector
+
+#include "CentralAudioBuffer.h"  // for CentralAudioBuffer
+#include "StreamInfo.h"          // for PcmFormat
+
+namespace bell {
+namespace dsp {
+/**
+ * Equal power gains of a crossfade, fadeOut[i]^2 + fadeIn[i]^2 = 1
+ * @param fadeOut gains of the outgoing track
+ * @param fadeIn gains of the incoming track
+ * @param position frames of the fade already done
+ * @param frames number of gains to compute
+ * @param length length of the whole fade, in frames
+ */
+void equalPowerCurve(float* fadeOut, float* fadeIn, size_t position,
+                     size_t frames, size_t length);
+
+/**
+ * dst[i] = out[i] * fadeOut[i] + in[i] * fadeIn[i]
+ */
+void crossfadeMix(const float* out, const float* in, const float* fadeOut,
+                  const float* fadeIn, float* dst, size_t frames);
+}  // namespace dsp
+
+/**
+ * Mixes the tail of one track with the head of the next before they enter
+ * CentralAudioBuffer, so BellDSP runs its pipeline once over the mix.
+ *
+ * Both decoders write through write(), each with its own track hash and on
+ * its own thread, with a codec instance of its own (see
+ * AudioCodecs::createCodec and TrackPrefetcher). Outside of a fade, writes
+ * go straight to the buffer. During a fade, both tracks are staged and mixed
+ * as soon as both have frames; the mix carries the incoming track's hash.
+ * Tracks of different sample rates or channel counts are played back to
+ * back instead.
+ */
+class Crossfader {
+ public:
+  /**
+   * @param buffer buffer receiving the mix
+   * @param maxChannels largest channel count to mix
+   * @param stagingFrames frames staged per track, a full staging area makes
+   * write() take less than it was given
+   */
+  Crossfader(std::shared_ptr<CentralAudioBuffer> buffer,
+             size_t maxChannels = 2, size_t stagingFrames = 2048);
+
+  // Length of the fades started from now on
+  void setDuration(uint32_t durationMs);
+  uint32_t getDuration() { return durationMs; }
+
+  /**
+   * Starts fading from one track to the next. Call when the outgoing track
+   * has about getDuration() left.
+   * @param outHash hash of the outgoing track
+   * @param inHash hash of the next track
+   */
+  void startFade(size_t outHash, size_t inHash);
+
+  /**
+   * Marks the outgoing track as finished, the rest of the fade mixes the
+   * incoming one with silence.
+   */
+  void endTrack(size_t hash);
+
+  // Whether a fade is in progress
+  bool isFading();
+
+  /**
+   * Same as CentralAudioBuffer::writePCM(). Data of the outgoing track left
+   * after the fade is dropped, but reported as written.
+   * @return amount of bytes taken, 0 when nothing fits right now
+   */
+  size_t write(const uint8_t* data, size_t dataSize, size_t hash,
+               uint32_t sampleRate, uint8_t channels, PcmFormat format);
+
+ private:
+  enum Side { OUTGOING = 0, INCOMING = 1 };
+
+  struct Staging {
+    size_t hash = 0;
+    uint32_t sampleRate = 0;
+    uint8_t channels = 0;
+    PcmFormat format = PcmFormat::INT16;
+    bool formatKnown = false;
+    bool ended = false;
+
+    // stagingFrames per channel plane
+    std::vector<float> planar;
+    std::vector<float*> planes;
+    size_t frames = 0;
+  };
+
+  std::shared_ptr<CentralAudioBuffer> buffer;
+  size_t maxChannels;
+  size_t stagingFrames;
+  uint32_t durationMs = 5000;
+
+  std::mutex fadeMutex;
+  bool fading = false;
+  // Formats don't allow a mix, the tracks play one after the other
+  bool backToBack = false;
+  // Fade length and progress, frames
+  size_t fadeLength = 0;
+  size_t fadePosition = 0;
+  Staging staging[2];
+  std::vector<float*> stagePlanes;
+  // Outgoing track of the last fade, whatever it still writes is dropped
+  size_t finishedHash = 0;
+
+  // Mixed frames, one plane per channel, and their interleaved form that
+  // didn't fit into the buffer yet
+  std::vector<float> mixPlanar;
+  std::vector<float*> mixPlanes;
+  std::vector<float> gains[2];
+  std::vector<uint8_t> pending;
+  size_t pendingPos = 0;
+  size_t pendingHash = 0;
+  uint32_t pendingRate = 0;
+  uint8_t pendingChannels = 0;
+  PcmFormat pendingFormat = PcmFormat::INT16;
+
+  // Expect fadeMutex to be held
+  size_t stage(Staging& side, const uint8_t* data, size_t dataSize);
+  void consume(Staging& side, size_t frames);
+  bool mix();
+  void appendPending(float* const* planes, size_t frames);
+  bool flushPending();
+  void finishFade();
+  bool compatible();
+};
+}  // namespace bell
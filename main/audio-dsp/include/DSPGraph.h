@@ -0,0 +1,264 @@
+#pragma once
+
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint32_t, uint8_t
+#include <memory>     // for shared_ptr
+#include <stdexcept>  // for invalid_argument
+#include <string>     // for string
+#include <variant>    // for variant
+#include <vector>     // for vector
+
+#include "Biquad.h"               // for Biquad, Biquad::Type
+#include "BiquadCombo.h"          // for BiquadCombo, BiquadCombo::FilterType
+#include "MultibandCompressor.h"  // for MultibandCompressor
+#include "Oversampler.h"          // for Oversampler, Decimator
+#include "Resampler.h"            // for Resampler, Resampler::Quality
+#include "StaticPipeline.h"       // for StaticPipeline
+#include "cJSON.h"                // for cJSON
+
+namespace bell {
+class AudioPipeline;
+class AudioTransform;
+class Compressor;
+class FirConvolver;
+class Gain;
+class LoudnessContour;
+class LoudnessNormalizer;
+
+/**
+ * DSP chain compiled from its JSON description. The JSON is walked once by
+ * compile(), into one typed node per transform; building the pipeline and
+ * following volume changes afterwards only index flat tables, without the
+ * cJSON lookups and string keyed caches of JSONTransformConfig.
+ *
+ * The description is an array of objects, one per transform, with a "type"
+ * of gain, biquad, biquad_combo, compressor, multiband_compressor, loudness,
+ * loudness_contour, resampler, oversampler, decimator or fir and the fields
+ * TransformConfig would
+ * read for it. Numeric fields may hold an array instead, one value per volume
+ * range. Biquads get a transform per channel they list. A
+ * multiband_compressor lists its "crossovers" in Hz and its "bands" as
+ * objects with a compressor's fields. A loudness_contour follows the volume
+ * by itself, its fields are single numbers. An oversampler or decimator
+ * takes a "factor" of 2 or 4 and a "phase" of linear or minimum; nodes after
+ * it are built for the rate it outputs.
+ */
+class DSPGraph {
+ public:
+  // Value of a field, count entries of the value table spread over 0 - 100
+  // volume like TransformConfig's arrays
+  struct Param {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  // Channels of a node, entries of the channel table
+  struct ChannelRange {
+    uint32_t first;
+    uint32_t count;
+  };
+
+  struct GainNode {
+    Param gain;
+  };
+
+  struct BiquadNode {
+    Biquad::Type type;
+    // Unset fields have a count of 0
+    Param frequency, q, gain, bandwidth, slope;
+    // b0, b1, b2, a1, a2 of free biquads
+    Param coeffs[5];
+  };
+
+  struct BiquadComboNode {
+    bool linkwitzRiley;
+    BiquadCombo::FilterType type;
+    Param frequency, order;
+  };
+
+  struct CompressorNode {
+    Param attack, release, threshold, factor, makeupGain, lookahead;
+  };
+
+  struct MultibandNode {
+    // Frequencies in the value table, whole rather than per volume
+    Param crossovers;
+    uint32_t bandCount;
+    // Lookahead is left unset
+    CompressorNode bands[MultibandCompressor::MAX_BANDS];
+  };
+
+  struct LoudnessNode {
+    Param target, maxGain;
+    bool preventClipping;
+  };
+
+  // Single values, the transform has a table per volume step
+  struct LoudnessContourNode {
+    Param lowFrequency, highFrequency, lowBoost, highBoost, referenceVolume;
+  };
+
+  struct ResamplerNode {
+    uint32_t sampleRate;
+    Resampler::Quality quality;
+    uint32_t maxChannels;
+  };
+
+  // As Oversampler::Config
+  struct OversamplerNode {
+    uint32_t factor;
+    Oversampler::Phase phase;
+    uint32_t maxChannels;
+  };
+
+  // Same fields, as Decimator::Config
+  struct DecimatorNode : OversamplerNode {};
+
+  struct FirNode {
+    uint32_t blockSize;
+    // Taps in the value table, whole rather than per volume
+    Param taps;
+  };
+
+  typedef std::variant<GainNode, BiquadNode, BiquadComboNode, CompressorNode,
+                       MultibandNode, LoudnessNode, LoudnessContourNode,
+                       ResamplerNode, OversamplerNode, DecimatorNode, FirNode>
+      NodeParams;
+
+  struct Node {
+    ChannelRange channels;
+    NodeParams params;
+    // Whether any Param has more than one value
+    bool dependsOnVolume;
+  };
+
+  DSPGraph() = default;
+  ~DSPGraph() = default;
+
+  /**
+   * Replaces the graph with the one described by json, FIR impulse
+   * responses given by filename are loaded here as well
+   * @throws std::invalid_argument on unknown types or missing fields
+   */
+  void compile(cJSON* json);
+  void compile(const std::string& json);
+
+  /**
+   * Creates the transforms of every node for the given input rate and
+   * volume, and adds them to pipeline in order. The graph keeps them for
+   * volumeUpdated().
+   */
+  void build(AudioPipeline& pipeline, uint32_t sampleRate, int volume);
+
+  /**
+   * Same as above for a chain fixed at compile time, whose stages must
+   * match the nodes one for one, e.g. StaticPipeline<Gain, Biquad, Biquad>
+   * for a gain and a biquad on two channels. The graph keeps the pipeline
+   * alive for volumeUpdated().
+   * @throws std::invalid_argument when a stage doesn't match its node
+   */
+  template <typename... Stages>
+  void build(std::shared_ptr<StaticPipeline<Stages...>> pipeline,
+             uint32_t sampleRate, int volume) {
+    if (nodes.size() != sizeof...(Stages)) {
+      throw std::invalid_argument("Pipeline has " +
+                                  std::to_string(sizeof...(Stages)) +
+                                  " stages for " +
+                                  std::to_string(nodes.size()) + " nodes");
+    }
+    size_t index = 0;
+    bool matches = (std::holds_alternative<typename NodeOf<Stages>::type>(
+                        nodes[index++].params) &&
+                    ...);
+    if (!matches) {
+      throw std::invalid_argument("Pipeline stages don't match the nodes");
+    }
+
+    transforms.clear();
+    auto stages = pipeline->getStages();
+    for (size_t i = 0; i < nodes.size(); i++) {
+      stages[i]->sampleRateChanged(sampleRate);
+      apply(nodes[i], *stages[i], volume);
+      sampleRate = stages[i]->getOutputRate(sampleRate);
+      // Shares the pipeline's ownership
+      transforms.emplace_back(pipeline, stages[i]);
+    }
+  }
+
+  // Reconfigures the built transforms whose nodes depend on volume, along
+  // with AudioPipeline::volumeUpdated()
+  void volumeUpdated(int volume);
+
+  const std::vector<Node>& getNodes() const { return nodes; }
+
+ private:
+  // Node type of each transform type, for the static build()
+  template <typename Transform>
+  struct NodeOf;
+
+  std::vector<Node> nodes;
+  std::vector<float> values;
+  std::vector<int> channels;
+
+  // Transforms of build(), one per node
+  std::vector<std::shared_ptr<AudioTransform>> transforms;
+
+  // Set by addParam() while a node is compiled
+  bool nodeDependsOnVolume = false;
+
+  // Appends the number or numbers of field to the value table
+  Param addValues(cJSON* object, const char* field, bool isRequired);
+  // Same, for a field resolved by volume
+  Param addParam(cJSON* object, const char* field, bool isRequired);
+  float resolve(const Param& param, int volume, float defaultValue = 0) const;
+  std::vector<int> channelsOf(const Node& node) const;
+
+  std::shared_ptr<AudioTransform> create(const Node& node);
+  void apply(const Node& node, AudioTransform& transform, int volume);
+};
+
+template <>
+struct DSPGraph::NodeOf<Gain> {
+  typedef GainNode type;
+};
+template <>
+struct DSPGraph::NodeOf<Biquad> {
+  typedef BiquadNode type;
+};
+template <>
+struct DSPGraph::NodeOf<BiquadCombo> {
+  typedef BiquadComboNode type;
+};
+template <>
+struct DSPGraph::NodeOf<Compressor> {
+  typedef CompressorNode type;
+};
+template <>
+struct DSPGraph::NodeOf<MultibandCompressor> {
+  typedef MultibandNode type;
+};
+template <>
+struct DSPGraph::NodeOf<LoudnessNormalizer> {
+  typedef LoudnessNode type;
+};
+template <>
+struct DSPGraph::NodeOf<LoudnessContour> {
+  typedef LoudnessContourNode type;
+};
+template <>
+struct DSPGraph::NodeOf<Resampler> {
+  typedef ResamplerNode type;
+};
+template <>
+struct DSPGraph::NodeOf<Oversampler> {
+  typedef OversamplerNode type;
+};
+template <>
+struct DSPGraph::NodeOf<Decimator> {
+  typedef DecimatorNode type;
+};
+template <>
+struct DSPGraph::NodeOf<FirConvolver> {
+  typedef FirNode type;
+};
+}  // namespace bell
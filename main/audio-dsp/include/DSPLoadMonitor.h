@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint64_t, uint32_t
+#include <atomic>    // for atomic
+
+namespace bell {
+/**
+ * Measures each processed block against its real-time budget, the time the
+ * block takes to play (frames / sampleRate). A block taking longer than
+ * its budget is a deadline miss: a sink fed only by this thread underruns
+ * sooner or later. The load is the busy time over the budget of every block
+ * in a window, and tells whether a pipeline fits a device, e.g. how many
+ * EQ bands or FIR taps it can afford.
+ *
+ * begin() / end() are called from the audio thread only, the getters from
+ * any thread.
+ */
+class DSPLoadMonitor {
+ public:
+  struct Config {
+    // Length of audio the rolling load is computed over
+    uint32_t windowMs = 1000;
+    // Share of the budget a block may use before it counts as a miss, below
+    // 1 to leave time to the decoder and sink on the same core
+    float deadlineFraction = 1.0f;
+    // ESP32 only: times blocks with the CPU cycle counter instead of
+    // esp_timer, for sub-µs blocks. The feeding task has to be pinned to a
+    // core, each core counts on its own
+    bool cycleCounter = false;
+  };
+
+  struct Stats {
+    // Busy time over budget in the last complete window, in %
+    float loadPercent = 0;
+    // Highest single block load since reset(), in %
+    float peakPercent = 0;
+    uint32_t deadlineMisses = 0;
+    uint32_t blocks = 0;
+    // Last block's processing time and budget
+    uint32_t lastNs = 0;
+    uint32_t lastBudgetNs = 0;
+  };
+
+  DSPLoadMonitor() : DSPLoadMonitor(Config()) {}
+  DSPLoadMonitor(const Config& config);
+
+  // Timestamp to pass to end()
+  uint64_t begin();
+  // @param frames frames of the block, at sampleRate
+  void end(uint64_t started, size_t frames, uint32_t sampleRate);
+
+  Stats getStats() const;
+  // Starts over, the current window included
+  void reset();
+
+ private:
+  Config config;
+  uint32_t cpuHz = 0;
+
+  // Published for the getters
+  std::atomic<float> loadPercent = 0;
+  std::atomic<float> peakPercent = 0;
+  std::atomic<uint32_t> deadlineMisses = 0;
+  std::atomic<uint32_t> blocks = 0;
+  std::atomic<uint32_t> lastNs = 0;
+  std::atomic<uint32_t> lastBudgetNs = 0;
+  // Set by reset(), the audio thread clears its window on the next block
+  std::atomic<bool> resetRequested = false;
+
+  // Current window, audio thread only
+  uint64_t windowBusyNs = 0;
+  uint64_t windowBudgetNs = 0;
+
+  uint64_t now();
+};
+}  // namespace bell
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t
+#include <cmath>     // for abs
+
+#if defined(__SSE__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>  // for _mm_getcsr, _mm_setcsr
+#define BELL_DSP_FTZ_SSE
+#elif defined(__aarch64__)
+#define BELL_DSP_FTZ_AARCH64
+#elif defined(__arm__) && defined(__ARM_FP)
+#define BELL_DSP_FTZ_ARM
+#endif
+
+namespace bell {
+namespace dsp {
+#if defined(BELL_DSP_FTZ_SSE) || defined(BELL_DSP_FTZ_AARCH64) || \
+    defined(BELL_DSP_FTZ_ARM)
+static constexpr bool HAS_FLUSH_TO_ZERO = true;
+#else
+static constexpr bool HAS_FLUSH_TO_ZERO = false;
+#endif
+
+/**
+ * Makes the calling thread's FPU treat denormals as zero while in scope,
+ * FTZ / DAZ in MXCSR on x86, FZ in FPCR / FPSCR on ARM. Recursive filters
+ * decaying through silence otherwise end up on the slow denormal path.
+ * Does nothing where HAS_FLUSH_TO_ZERO is false, filters call
+ * flushDenormals() on their state there.
+ */
+class DenormalGuard {
+ public:
+  DenormalGuard() {
+#if defined(BELL_DSP_FTZ_SSE)
+    saved = _mm_getcsr();
+    // FTZ, DAZ
+    _mm_setcsr(saved | 0x8040);
+#elif defined(BELL_DSP_FTZ_AARCH64)
+    asm volatile("mrs %0, fpcr" : "=r"(saved));
+    asm volatile("msr fpcr, %0" : : "r"(saved | (1ULL << 24)));
+#elif defined(BELL_DSP_FTZ_ARM)
+    asm volatile("vmrs %0, fpscr" : "=r"(saved));
+    asm volatile("vmsr fpscr, %0" : : "r"(saved | (1U << 24)));
+#endif
+  }
+
+  ~DenormalGuard() {
+#if defined(BELL_DSP_FTZ_SSE)
+    _mm_setcsr(saved);
+#elif defined(BELL_DSP_FTZ_AARCH64)
+    asm volatile("msr fpcr, %0" : : "r"(saved));
+#elif defined(BELL_DSP_FTZ_ARM)
+    asm volatile("vmsr fpscr, %0" : : "r"(saved));
+#endif
+  }
+
+  DenormalGuard(const DenormalGuard&) = delete;
+  DenormalGuard& operator=(const DenormalGuard&) = delete;
+
+ private:
+#if defined(BELL_DSP_FTZ_AARCH64)
+  uint64_t saved;
+#else
+  uint32_t saved = 0;
+#endif
+};
+
+/**
+ * Zeroes filter state that decayed below audibility, about -300 dB, once
+ * per block. Compiled out where the FPU flushes denormals itself.
+ */
+inline void flushDenormals(float* state, size_t count) {
+  if constexpr (!HAS_FLUSH_TO_ZERO) {
+    for (size_t i = 0; i < count; i++) {
+      if (std::abs(state[i]) < 1.0e-15f) {
+        state[i] = 0.0f;
+      }
+    }
+  }
+}
+}  // namespace dsp
+}  // namespace bell
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <atomic>    // for atomic
+#include <memory>    // for shared_ptr, unique_ptr
+#include <vector>    // for vector
+
+#include "AsyncResampler.h"  // for AsyncResampler
+#include "AudioTransform.h"  // for AudioTransform
+#include "RcuPtr.h"          // for RcuPtr
+#include "StreamInfo.h"      // for StreamInfo
+
+namespace bell {
+/**
+ * Plays the stream marginally faster or slower, so a sink follows another
+ * clock than its own (see PlaybackClock). The sample rate stays the same,
+ * only the amount of frames changes.
+ *
+ * The output is written to planes owned by this transform, data.data and
+ * numSamples are updated to point at them.
+ */
+class DriftResampler : public bell::AudioTransform {
+ public:
+  DriftResampler();
+  ~DriftResampler(){};
+
+  /**
+   * @param maxChannels largest channel count of the stream
+   * @param maxInputFrames largest block passed to process()
+   */
+  void configure(size_t maxChannels = 2, size_t maxInputFrames = 1024);
+
+  /**
+   * Input frames per output frame, see AsyncResampler. From any thread, a
+   * servo on the audio thread included, applies from the next process()
+   */
+  void setRatio(double ratio);
+
+  // Drops the filter history, with the next block
+  void sampleRateChanged(uint32_t sampleRate) override;
+
+  void process(StreamInfo& data) override;
+  bool keepsFormat() override { return false; }
+
+  void reconfigure() override {
+    std::scoped_lock lock(this->accessMutex);
+    size_t newChannels = config->getInt("max_channels", false, 2);
+    if (newChannels == maxChannels) {
+      return;
+    }
+    this->configure(newChannels, maxInputFrames);
+  }
+
+ private:
+  struct Plan {
+    size_t channels;
+    std::unique_ptr<dsp::AsyncResampler> resampler;
+
+    // Output planes, only touched by the audio thread
+    std::vector<float> planarData;
+    std::vector<float*> channelData;
+  };
+
+  size_t maxChannels = 2;
+  size_t maxInputFrames = 1024;
+  std::atomic<double> ratio = 1.0;
+
+  RcuPtr<Plan> activePlan;
+
+  // Expects accessMutex to be held
+  void publishPlan();
+};
+}  // namespace bell
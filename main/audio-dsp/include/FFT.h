@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <vector>    // for vector
+
+namespace bell {
+namespace dsp {
+/**
+ * Radix-2 complex FFT of a fixed power of two size. Data is interleaved,
+ * re0 im0 re1 im1 ..., and transformed in place. Uses esp-dsp when it's
+ * available on ESP32.
+ */
+class FFT {
+ public:
+  /**
+   * @param size amount of complex points, must be a power of two
+   */
+  FFT(size_t size);
+
+  size_t size() const { return n; }
+
+  /**
+   * Forward transform
+   * @param data 2 * size() floats
+   */
+  void forward(float* data);
+
+  /**
+   * Inverse transform, not scaled by 1 / size()
+   * @param data 2 * size() floats
+   */
+  void inverse(float* data);
+
+ private:
+  size_t n;
+
+  // cos / sin pairs of the n / 2 twiddle factors
+  std::vector<float> twiddles;
+  std::vector<uint32_t> bitReverse;
+};
+}  // namespace dsp
+}  // namespace bell
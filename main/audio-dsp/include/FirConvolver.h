@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <memory>    // for shared_ptr, unique_ptr
+#include <mutex>     // for scoped_lock
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioTransform.h"   // for AudioTransform
+#include "FFT.h"              // for FFT
+#include "RcuPtr.h"           // for RcuPtr
+#include "StreamInfo.h"       // for StreamInfo
+#include "TransformConfig.h"  // for TransformConfig
+
+namespace bell {
+/**
+ * FIR filter using uniformly partitioned overlap-save FFT convolution, meant
+ * for long room correction filters. The impulse response is split into
+ * partitions of blockSize taps whose spectra are computed once on configure.
+ * Each block of input is transformed once and multiplied with every
+ * partition through a frequency domain delay line.
+ *
+ * Latency is blockSize samples. Smaller blocks lower the latency at the cost
+ * of more partitions to multiply per block.
+ */
+class FirConvolver : public bell::AudioTransform {
+ public:
+  FirConvolver();
+  ~FirConvolver(){};
+
+  /**
+   * @param channels channels to filter, each gets its own state
+   * @param taps impulse response
+   * @param blockSize partition size in samples, rounded up to a power of two
+   */
+  void configure(std::vector<int> channels, const std::vector<float>& taps,
+                 size_t blockSize = 256);
+
+  /**
+   * Loads an impulse response from a file. Files ending in .raw or .bin are
+   * read as native 32-bit floats, anything else as text with one coefficient
+   * per line (comma or whitespace separated values work as well).
+   */
+  static std::vector<float> loadTaps(const std::string& path);
+
+  // Delay added by the convolution, in samples
+  size_t getLatency();
+
+  std::vector<int> getChannels() override { return channels; }
+
+  void process(StreamInfo& data) override;
+
+  void reconfigure() override {
+    std::scoped_lock lock(this->accessMutex);
+    auto channels = config->getChannels();
+    size_t blockSize = config->getInt("block_size", false, 256);
+
+    // The impulse response doesn't depend on volume, only reload on changes
+    std::string source = "coefficients";
+    if (!config->isArray("coefficients")) {
+      source = config->getString("filename", true);
+    }
+    if (source == currentSource && blockSize == currentBlockSize &&
+        channels == this->channels) {
+      return;
+    }
+
+    auto taps = source == "coefficients"
+                    ? config->rawGetFloatArray("coefficients")
+                    : loadTaps(source);
+    currentSource = source;
+    currentBlockSize = blockSize;
+    this->configure(channels, taps, blockSize);
+  }
+
+ private:
+  struct ChannelState {
+    // Last two blocks of input, [previous][current]
+    std::vector<float> input;
+    std::vector<float> output;
+
+    // Frequency domain delay line, [partition][bin][re / im]
+    std::vector<float> history;
+  };
+
+  struct Plan {
+    size_t blockSize;
+    size_t bins;
+    size_t partitions;
+    std::unique_ptr<dsp::FFT> fft;
+
+    // [partition][bin][re / im], bins 0 to blockSize of each partition
+    std::vector<float> spectra;
+
+    std::vector<int> channels;
+
+    // Only touched by the audio thread
+    std::vector<ChannelState> states;
+    std::vector<float> fftBuffer;
+    std::vector<float> accumulator;
+    size_t position = 0;
+    size_t historyPosition = 0;
+  };
+
+  std::vector<int> channels;
+  std::string currentSource;
+  size_t currentBlockSize = 0;
+
+  RcuPtr<Plan> activePlan;
+
+  void processBlock(Plan& plan, ChannelState& state);
+};
+}  // namespace bell
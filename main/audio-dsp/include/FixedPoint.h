@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int32_t, int64_t, int16_t
+
+namespace bell::dsp {
+// Q1.15 and Q1.31 samples, [-1, 1)
+typedef int16_t q15_t;
+typedef int32_t q31_t;
+
+// Gains in fixed point use Q8.24, enough headroom for +42 dB
+static constexpr int GAIN_FRACTION_BITS = 24;
+
+inline q31_t saturateQ31(int64_t value) {
+  if (value > INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (value < INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (q31_t)value;
+}
+
+inline q15_t q31ToQ15(q31_t value) {
+  // Round to nearest, then drop the low half
+  int64_t rounded = ((int64_t)value + (1 << 15)) >> 16;
+  return rounded > INT16_MAX ? INT16_MAX : (q15_t)rounded;
+}
+
+inline q31_t q15ToQ31(q15_t value) {
+  return (q31_t)value * (1 << 16);
+}
+
+/**
+ * Sample type traits shared by the float and fixed point variants of a
+ * transform, so the processing loop can be written once as a template.
+ */
+template <typename T>
+struct SampleFormat;
+
+template <>
+struct SampleFormat<float> {
+  typedef float Gain;
+
+  static Gain toGain(float gain) { return gain; }
+  static float scale(float sample, Gain gain) { return sample * gain; }
+};
+
+template <>
+struct SampleFormat<q31_t> {
+  // Q8.24
+  typedef int32_t Gain;
+
+  static Gain toGain(float gain) {
+    float scaled = gain * (1 << GAIN_FRACTION_BITS);
+    return scaled >= (float)INT32_MAX ? INT32_MAX : (Gain)scaled;
+  }
+  static q31_t scale(q31_t sample, Gain gain) {
+    return saturateQ31(((int64_t)sample * gain) >> GAIN_FRACTION_BITS);
+  }
+};
+
+/**
+ * Multiplies samples by a gain that moves linearly from start, by step per
+ * sample.
+ * @return gain after the last sample
+ */
+template <typename T>
+typename SampleFormat<T>::Gain scaleRamp(T* data, size_t samples,
+                                         typename SampleFormat<T>::Gain start,
+                                         typename SampleFormat<T>::Gain step) {
+  for (size_t i = 0; i < samples; i++) {
+    data[i] = SampleFormat<T>::scale(data[i], start);
+    start += step;
+  }
+  return start;
+}
+
+template <typename T>
+void scale(T* data, size_t samples, typename SampleFormat<T>::Gain gain) {
+  for (size_t i = 0; i < samples; i++) {
+    data[i] = SampleFormat<T>::scale(data[i], gain);
+  }
+}
+}  // namespace bell::dsp
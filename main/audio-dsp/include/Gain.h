@@ -1,20 +1,45 @@
 #pragma once
 
-#include <memory>  // for unique_ptr
+#include <memory>  // for shared_ptr
 #include <mutex>   // for scoped_lock
 #include <vector>  // for vector
 
 #include "AudioTransform.h"   // for AudioTransform
+#include "ParameterRamp.h"    // for ParameterRamp
+#include "RcuPtr.h"           // for RcuPtr
 #include "StreamInfo.h"       // for StreamInfo
 #include "TransformConfig.h"  // for TransformConfig
 
 namespace bell {
 class Gain : public bell::AudioTransform {
  private:
-  float gainFactor = 1.0f;
+  struct Params {
+    float gainFactor = 1.0f;
+    std::vector<int> channels;
+    size_t rampSamples = 0;
+  };
+
+  float rampTimeMs = 20.0f;
+  float sampleRate = 44100;
 
+  // Gain actually applied, follows the target with a linear ramp
+  ParameterRamp<1> ramp;
+
+  float gainFactor = 1.0f;
   std::vector<int> channels;
 
+  // Copy of the above used by process(), swapped on configure()
+  RcuPtr<Params> activeParams;
+
+  // Published parameters for every volume step
+  std::vector<std::shared_ptr<Params>> volumeSteps;
+
+  std::shared_ptr<Params> makeParams(std::vector<int> channels, float gainDB);
+
+  // Shared by the float and Q1.31 paths
+  template <typename T>
+  void applyGain(T** data, size_t samples, const Params& params);
+
  public:
   Gain();
   ~Gain(){};
@@ -23,8 +48,20 @@ class Gain : public bell::AudioTransform {
 
   void configure(std::vector<int> channels, float gainDB);
 
-  std::unique_ptr<StreamInfo> process(
-      std::unique_ptr<StreamInfo> data) override;
+  std::vector<int> getChannels() override { return channels; }
+  bool isIdentity() override;
+
+  void process(StreamInfo& data) override;
+
+  bool supportsFixedPoint() override { return true; }
+  void processFixed(FixedStreamInfo& data) override;
+
+  void sampleRateChanged(uint32_t sampleRate) override {
+    this->sampleRate = sampleRate;
+  }
+
+  // Time over which gain changes are ramped, 0 to jump
+  void setRampTime(float milliseconds) { rampTimeMs = milliseconds; }
 
   void reconfigure() override {
     std::scoped_lock lock(this->accessMutex);
@@ -37,5 +74,8 @@ class Gain : public bell::AudioTransform {
 
     this->configure(channels, gain);
   }
+
+  void precomputeVolumeSteps() override;
+  bool applyVolumeStep(int volume) override;
 };
 }  // namespace bell
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint32_t
+#include <chrono>    // for steady_clock
+#include <memory>    // for unique_ptr
+#include <mutex>     // for mutex
+#include <vector>    // for vector
+
+#include "BellDSP.h"       // for BellDSP
+#include "BellTask.h"      // for Task
+#include "StreamInfo.h"    // for PcmFormat
+#include "TripleBuffer.h"  // for TripleBuffer
+
+namespace bell {
+namespace dsp {
+class FFT;
+}
+
+/**
+ * Peak and RMS levels of each channel, and optionally a spectrum, of the
+ * PCM passing a BellDSP tap, for a UI to poll.
+ *
+ * The tap only converts the PCM to float into a window of windowFrames
+ * frames and, once full, swaps it into a TripleBuffer; it never blocks nor
+ * allocates. The meter's task picks the latest window up and analyses it,
+ * so every window is measured unless the task falls behind.
+ */
+class LevelMeter : public bell::Task {
+ public:
+  // Level of silence, and of anything quieter
+  static constexpr float FLOOR = -120.0f;
+
+  struct Config {
+    // Frames of a window, a power of two. Also the FFT size
+    size_t windowFrames = 1024;
+    // Channels measured, wider streams are ignored. No more than 8
+    int maxChannels = 2;
+    // Log spaced bands of the spectrum, 0 leaves it out
+    size_t spectrumBands = 0;
+    // Lower edge of the first band, the last one ends at Nyquist
+    float minHz = 20.0f;
+    // How often the task looks for a new window
+    uint32_t pollMs = 10;
+    // Levels fall to FLOOR when no window arrives for this long
+    uint32_t holdMs = 500;
+  };
+
+  struct Levels {
+    // dBFS, per channel
+    std::vector<float> peakDb;
+    std::vector<float> rmsDb;
+    // dB, a full scale sine reads 0 in its band. Low to high
+    std::vector<float> spectrumDb;
+    uint32_t sampleRate = 0;
+    // Counts the windows measured, a UI can tell it saw one already
+    uint32_t sequence = 0;
+  };
+
+  LevelMeter() : LevelMeter(Config()) {}
+  LevelMeter(const Config& config);
+  ~LevelMeter();
+
+  bool start();
+  void stop();
+
+  // Hook for BellDSP::setTap(), the meter must outlive it
+  BellDSP::Tap tap();
+
+  // Feeds PCM of any format. Never blocks, for the audio thread
+  void write(const uint8_t* data, size_t bytes, int channels,
+             uint32_t sampleRate, PcmFormat format);
+
+  Levels getLevels();
+
+ private:
+  static constexpr int MAX_CHANNELS = 8;
+
+  struct Window {
+    // Planar, windowFrames floats per channel
+    std::vector<float> samples;
+    size_t frames = 0;
+    int channels = 0;
+    uint32_t sampleRate = 0;
+  };
+
+  Config config;
+  std::unique_ptr<TripleBuffer<Window>> windows;
+
+  std::mutex levelsMutex;
+  Levels levels;
+
+  // Task only
+  std::unique_ptr<dsp::FFT> fft;
+  std::vector<float> hann;
+  std::vector<float> spectrum;
+  // First bin of each band, and the end of the last
+  std::vector<size_t> bandBins;
+  uint32_t bandsRate = 0;
+  std::chrono::steady_clock::time_point lastWindow;
+
+  void runTask() override;
+
+  void measure(const Window& window);
+  void measureSpectrum(const Window& window, std::vector<float>& bandsDb);
+  void placeBands(uint32_t sampleRate);
+};
+}  // namespace bell
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t
+#include <atomic>    // for atomic
+#include <memory>    // for shared_ptr
+#include <vector>    // for vector
+
+#include "AudioTransform.h"  // for AudioTransform
+#include "ParameterRamp.h"   // for ParameterRamp
+#include "RcuPtr.h"          // for RcuPtr
+#include "StreamInfo.h"      // for StreamInfo
+
+namespace bell {
+/**
+ * Loudness compensation following the volume: a low and a high shelf
+ * boosted as the volume goes down, the ear losing more of both ends than of
+ * the mids at low levels. The shelves of every volume step are computed on
+ * configure(), a volume change only picks another set, and process() walks
+ * from the previous set to it over rampMs, so volume sweeps cost no trig and
+ * don't click.
+ *
+ * The boosts grow linearly with the steps below referenceVolume, which is
+ * linear in dB with VolumeControl's software gain.
+ */
+class LoudnessContour : public bell::AudioTransform {
+ public:
+  struct Config {
+    std::vector<int> channels = {0, 1};
+    // Shelf corners, in Hz
+    float lowFrequency = 100.0f;
+    float highFrequency = 10000.0f;
+    // Boosts at the lowest volume step above 0, in dB
+    float lowBoostDb = 12.0f;
+    float highBoostDb = 4.0f;
+    // Flat at and above this step
+    int referenceVolume = VOLUME_STEPS - 1;
+    // Walk from one step's shelves to the next's
+    float rampMs = 50.0f;
+  };
+
+  LoudnessContour() : LoudnessContour(Config()) {}
+  LoudnessContour(const Config& config);
+  ~LoudnessContour(){};
+
+  // Recomputes the shelves of every step, on the control thread
+  void configure(const Config& config);
+
+  void process(StreamInfo& data) override;
+  // The shelves depend on it, they're computed again
+  void sampleRateChanged(uint32_t sampleRate) override;
+  std::vector<int> getChannels() override;
+  bool isIdentity() override;
+
+  bool followsVolume() override { return true; }
+  bool applyVolumeStep(int volume) override;
+
+ private:
+  // Low shelf then high shelf, b0, b1, b2, a1, a2 each
+  static constexpr size_t COEFFS = 10;
+  // Coefficients are interpolated in steps of this many samples
+  static constexpr size_t RAMP_BLOCK_SIZE = 32;
+
+  struct Table {
+    std::vector<int> channels;
+    // [step][coefficient]
+    std::vector<float> coeffs;
+    // Whether the step's shelves are flat
+    std::vector<uint8_t> flat;
+    size_t rampSamples;
+
+    // [channel][section][w0 / w1], written by the audio thread only,
+    // shared between tables of the same channels
+    std::shared_ptr<std::vector<float>> state;
+  };
+
+  Config config;
+  float sampleRate = 44100;
+  RcuPtr<Table> activeTable;
+  std::atomic<int> volumeStep = VOLUME_STEPS - 1;
+
+  // Audio thread only
+  ParameterRamp<COEFFS> ramp;
+  // Step the ramp heads to, -1 before the first block
+  int rampStep = -1;
+
+  void publishTable();
+};
+}  // namespace bell
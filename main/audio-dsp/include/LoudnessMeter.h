@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <memory>    // for unique_ptr
+#include <vector>    // for vector
+
+#include "Biquad.h"  // for Biquad
+
+namespace bell {
+/**
+ * Streaming loudness meter after ITU-R BS.1770 / EBU R128. Channels are
+ * K-weighted by a high shelf and a high-pass Biquad, their mean square is
+ * summed over 100 ms sub-blocks, four of which make a 400 ms gating block.
+ * Integrated loudness keeps a histogram of the gating blocks in 0.1 LU bins,
+ * so a whole track is measured in constant memory and in a single pass.
+ *
+ * Channels 4 and 5 of 5 and 6 channel streams are the surrounds and weigh
+ * 1.41, channel 3 of 6 is the LFE and is left out. Not thread safe.
+ */
+class LoudnessMeter {
+ public:
+  // Loudness of silence, and of anything below the absolute gate
+  static constexpr float SILENCE = -70.0f;
+
+  LoudnessMeter() {}
+
+  // Designs the filters and resets the measurement
+  void configure(uint32_t sampleRate, int channels);
+  void reset();
+
+  // Measures samples of data, left untouched
+  void process(float* const* data, size_t samples);
+
+  // Loudness of the last 400 ms, in LUFS
+  float getMomentary() const;
+  // Loudness of the last 3 s, in LUFS
+  float getShortTerm() const;
+  // Gated loudness of everything measured since reset(), in LUFS
+  float getIntegrated() const;
+  // Largest sample since reset(), linear
+  float getPeak() const { return peak; }
+  // Milliseconds measured since reset()
+  uint32_t getMeasuredMs() const;
+
+  uint32_t getSampleRate() const { return sampleRate; }
+  int getChannelCount() const { return channels; }
+
+ private:
+  // 3 s of sub-blocks for the short-term loudness
+  static constexpr size_t SUB_BLOCKS = 30;
+  static constexpr size_t GATE_SUB_BLOCKS = 4;
+  // Histogram from SILENCE to +10 LUFS
+  static constexpr size_t HISTOGRAM_BINS = 800;
+  // Samples filtered per pass, bounds the scratch buffers
+  static constexpr size_t SCRATCH_SAMPLES = 256;
+
+  uint32_t sampleRate = 0;
+  int channels = 0;
+  size_t subBlockSamples = 0;
+
+  // Shelf and high-pass of each channel, run on scratch
+  std::vector<std::unique_ptr<Biquad>> filters;
+  std::vector<float> scratch;
+  std::vector<float*> scratchChannels;
+  std::vector<float> weights;
+
+  // Weighted sum of squares of the sub-block being filled
+  double blockEnergy = 0;
+  size_t blockFill = 0;
+
+  // Mean square of the last sub-blocks, a ring
+  float subBlocks[SUB_BLOCKS] = {0};
+  size_t subBlockCount = 0;
+
+  std::vector<uint32_t> histogram;
+  uint64_t samplesMeasured = 0;
+  float peak = 0;
+
+  void finishSubBlock();
+  // Mean square of the last count sub-blocks
+  float recentEnergy(size_t count) const;
+};
+}  // namespace bell
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <atomic>    // for atomic
+#include <memory>    // for shared_ptr
+#include <mutex>     // for scoped_lock
+
+#include "AudioTransform.h"   // for AudioTransform
+#include "LoudnessMeter.h"    // for LoudnessMeter
+#include "ParameterRamp.h"    // for ParameterRamp
+#include "RcuPtr.h"           // for RcuPtr
+#include "StreamInfo.h"       // for StreamInfo
+#include "TransformConfig.h"  // for TransformConfig
+
+namespace bell {
+/**
+ * Loudness normalization. The gain comes from the track's ReplayGain / R128
+ * tags when the host passes them with setTagGain(), e.g. from
+ * AudioContainer::getReplayGain(). Untagged tracks are measured while they
+ * play, and the gain follows their integrated loudness once a few seconds
+ * were heard. The measurement runs on tagged tracks as well, so the host
+ * can store what it found and skip an offline analysis.
+ *
+ * Config fields: "target" in LUFS, "max_gain" in dB and "prevent_clipping",
+ * which keeps the gain below the track peak.
+ */
+class LoudnessNormalizer : public bell::AudioTransform {
+ public:
+  // ReplayGain 2.0 reference, which tag gains are relative to
+  static constexpr float REPLAYGAIN_REFERENCE = -18.0f;
+
+  LoudnessNormalizer();
+  ~LoudnessNormalizer(){};
+
+  void configure(float targetLufs, float maxGainDb, bool preventClipping);
+
+  /**
+   * Uses a tag gain for the current track, until trackChanged()
+   * @param gainDb gain to reach REPLAYGAIN_REFERENCE
+   * @param peak linear track peak, 0 when unknown
+   */
+  void setTagGain(float gainDb, float peak);
+
+  // Starts measuring a new track, without a tag gain
+  void trackChanged();
+
+  void process(StreamInfo& data) override;
+
+  void sampleRateChanged(uint32_t sampleRate) override {
+    this->sampleRate = sampleRate;
+  }
+
+  void reconfigure() override {
+    std::scoped_lock lock(this->accessMutex);
+    this->configure(
+        config->getFloat("target", false, REPLAYGAIN_REFERENCE),
+        config->getFloat("max_gain", false, 12.0f),
+        config->getInt("prevent_clipping", false, 1) != 0);
+  }
+
+  // Measurement of the current track, updated every 100 ms
+  float getIntegratedLoudness() const { return integratedLoudness; }
+  float getPeak() const { return measuredPeak; }
+  uint32_t getMeasuredMs() const { return measuredMs; }
+  // ReplayGain 2.0 track gain of the measurement, to store as a tag
+  float getMeasuredGain() const {
+    return REPLAYGAIN_REFERENCE - integratedLoudness;
+  }
+  // Gain being applied, in dB
+  float getAppliedGain() const { return appliedGain; }
+
+ private:
+  struct Params {
+    float target = REPLAYGAIN_REFERENCE;
+    float maxGain = 12.0f;
+    bool preventClipping = true;
+    bool hasTag = false;
+    float tagGain = 0;
+    float tagPeak = 0;
+  };
+
+  // Untagged tracks keep their gain until this much was measured
+  static constexpr uint32_t MIN_MEASURE_MS = 3000;
+  // Gain changes are slow, the measurement settles over the track
+  static constexpr float RAMP_TIME_MS = 1000.0f;
+
+  float sampleRate = 44100;
+
+  // Control thread copy, published to process() on every change
+  Params params;
+  RcuPtr<Params> activeParams;
+  std::atomic<bool> resetPending = false;
+
+  // Audio thread only
+  LoudnessMeter meter;
+  ParameterRamp<1> ramp;
+  float gainDb = 0;
+  size_t samplesSinceUpdate = 0;
+
+  std::atomic<float> integratedLoudness = LoudnessMeter::SILENCE;
+  std::atomic<float> measuredPeak = 0;
+  std::atomic<uint32_t> measuredMs = 0;
+  std::atomic<float> appliedGain = 0;
+
+  // Gain in dB for the measurement so far
+  float targetGain(const Params& params);
+};
+}  // namespace bell
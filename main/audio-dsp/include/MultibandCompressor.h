@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <memory>    // for shared_ptr
+#include <vector>    // for vector
+
+#include "AudioTransform.h"  // for AudioTransform
+#include "RcuPtr.h"          // for RcuPtr
+#include "StreamInfo.h"      // for StreamInfo
+
+namespace bell {
+/**
+ * Multiband compressor on a single Linkwitz-Riley crossover bank. Each
+ * channel is split once into up to MAX_BANDS bands, one per SIMD lane: a
+ * stage per crossover frequency gives the bands below it an allpass, the
+ * band at it the LR4 lowpass and those above the LR4 highpass, so the bands
+ * stay in phase and sum back flat. Band envelopes are taken together on the
+ * peak of the summed channels, like Compressor's, and the bands are
+ * recombined with their gains in the same pass.
+ *
+ * Replaces chains of BiquadCombo crossovers and Compressors, which filter
+ * and buffer every band separately.
+ */
+class MultibandCompressor : public bell::AudioTransform {
+ public:
+  // Samples per envelope update
+  static constexpr size_t ENVELOPE_BLOCK = 16;
+  static constexpr size_t MAX_BANDS = 4;
+
+  // Same parameters as Compressor::configure()
+  struct Band {
+    // ms
+    float attack = 10.0f;
+    float release = 100.0f;
+    // dB
+    float threshold = 0.0f;
+    float factor = 1.0f;
+    // dB
+    float makeupGain = 0.0f;
+  };
+
+  MultibandCompressor();
+  ~MultibandCompressor(){};
+
+  /**
+   * Envelopes and filter state survive as long as the channels and the
+   * band count stay the same.
+   * @param crossovers frequencies between the bands in Hz, ascending
+   * @param bands one more than the crossovers, lowest first
+   * @throws std::invalid_argument on more than MAX_BANDS bands or a band
+   * count not matching the crossovers
+   */
+  void configure(std::vector<int> channels,
+                 const std::vector<float>& crossovers,
+                 const std::vector<Band>& bands);
+
+  // Channels are linked through the shared detectors
+  std::vector<int> getChannels() override { return channels; }
+  size_t getQuantum() override { return ENVELOPE_BLOCK; }
+
+  void process(StreamInfo& data) override;
+  void sampleRateChanged(uint32_t sampleRate) override {
+    this->sampleRate = sampleRate;
+  };
+
+ private:
+  static constexpr size_t LANES = MAX_BANDS;
+  // LR4 filters are two sections, allpass stages pad the second
+  static constexpr size_t SECTIONS_PER_STAGE = 2;
+
+  // Written by the audio thread only, shared between plans of the same shape
+  struct State {
+    // [channel][section][w0 / w1][lane]
+    std::vector<float> filters;
+    // Bands of the current envelope block, [channel][sample][lane]
+    std::vector<float> split;
+    float loudness[LANES];
+    float gain[LANES];
+  };
+
+  struct Plan {
+    std::vector<int> channels;
+    size_t bands;
+    size_t sections;
+
+    // [section][coefficient][lane], b0, b1, b2, a1, a2 as Biquad
+    std::vector<float> coeffs;
+
+    // Per lane, unused lanes get a gain of 0
+    float attack[LANES];
+    float release[LANES];
+    float threshold[LANES];
+    float slope[LANES];
+    float makeupGain[LANES];
+
+    std::shared_ptr<State> state;
+  };
+
+  std::vector<int> channels;
+  RcuPtr<Plan> activePlan;
+  float sampleRate = 44100;
+
+  // Runs one channel's crossover bank, band b ends up in lane b of split
+  static void splitBands(const Plan& plan, const float* input, float* state,
+                         float* split, size_t samples);
+};
+}  // namespace bell
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <memory>    // for shared_ptr
+#include <vector>    // for vector
+
+#include "AudioTransform.h"  // for AudioTransform
+#include "RcuPtr.h"          // for RcuPtr
+#include "StreamInfo.h"      // for StreamInfo
+
+namespace bell {
+namespace dsp {
+/**
+ * One 2x stage of half-band filtering for planar float audio, interpolating
+ * or decimating. Half-band filters have every other tap zero, so each of the
+ * two polyphase branches is either a plain delay or a short filter.
+ *
+ * LINEAR is a Kaiser windowed FIR, its even branch run through the vector
+ * dot() kernel. MINIMUM is a pair of polyphase allpass chains, in the manner
+ * of HIIR: no pre-ringing, a few samples of latency and less work than the
+ * FIR at a similar rejection, but the phase isn't linear.
+ *
+ * All memory is allocated in the constructor, the calls don't allocate.
+ */
+class HalfBand {
+ public:
+  enum class Phase { LINEAR, MINIMUM };
+
+  /**
+   * @param phase filter kind
+   * @param transition width of the transition band around the half-band
+   * point, relative to the higher rate: 0.05 spans 19.85 - 24.25 kHz at
+   * 88.2 kHz
+   * @param channels amount of planes processed
+   * @param maxFrames largest amount of low rate frames of a call
+   */
+  HalfBand(Phase phase, double transition, size_t channels, size_t maxFrames);
+
+  /**
+   * @param in frames samples at the low rate
+   * @param out 2 * frames samples at the high rate
+   */
+  void upsample(size_t channel, const float* in, size_t frames, float* out);
+
+  /**
+   * Takes the high rate samples in pairs, frames must be even
+   * @param in frames samples at the high rate
+   * @param out frames / 2 samples at the low rate
+   */
+  void downsample(size_t channel, const float* in, size_t frames, float* out);
+
+  // Clears the filter history, e.g. on a track change
+  void reset();
+
+  // Delay of the filter, in samples at the high rate, at DC for MINIMUM
+  float getLatency() const;
+
+ private:
+  Phase phase;
+  size_t channels;
+  size_t maxFrames;
+  // Per channel stride of history and delayed
+  size_t stride = 0;
+
+  // LINEAR: taps of the filtering branch, oldest sample first, a multiple
+  // of 4; the other branch is delayed by half of them
+  std::vector<float> taps;
+  // [channel][taps + maxFrames], of the filtering branch
+  std::vector<float> history;
+  // [channel][taps + maxFrames], of the delayed branch when decimating
+  std::vector<float> delayed;
+
+  // MINIMUM: allpass coefficients, even ones on the first branch
+  std::vector<float> coeffs;
+  // [channel][coefficient], inputs and outputs of last sample
+  std::vector<float> x;
+  std::vector<float> y;
+
+  void designLinear(double transition);
+  void designMinimum(double transition);
+  // One low rate sample pair through both allpass branches
+  void allpass(size_t channel, float& even, float& odd);
+};
+}  // namespace dsp
+
+/**
+ * Raises the rate of the stream 2x or 4x through cascaded half-band stages,
+ * e.g. for DACs that clock best at 4x rates, or to run an EQ away from the
+ * input's Nyquist frequency. Transforms after it in an AudioPipeline are
+ * told the raised rate, through getOutputRate().
+ *
+ * The output is written to planes owned by this transform, data.data,
+ * numSamples and sampleRate are updated to point at them.
+ */
+class Oversampler : public bell::AudioTransform {
+ public:
+  typedef dsp::HalfBand::Phase Phase;
+
+  struct Config {
+    // 2 or 4
+    uint32_t factor = 2;
+    Phase phase = Phase::LINEAR;
+    size_t maxChannels = 2;
+    // Largest block passed to process()
+    size_t maxInputFrames = 1024;
+  };
+
+  Oversampler() : Oversampler(Config()) {}
+  Oversampler(const Config& config);
+  ~Oversampler(){};
+
+  // @throws std::invalid_argument on a factor other than 2 or 4
+  void configure(const Config& config);
+
+  void process(StreamInfo& data) override;
+  void sampleRateChanged(uint32_t sampleRate) override;
+  uint32_t getOutputRate(uint32_t inputRate) override {
+    return inputRate * config.factor;
+  }
+  bool keepsFormat() override { return false; }
+
+  // Delay, in samples at the input rate
+  float getLatency();
+
+ private:
+  struct Plan {
+    uint32_t factor;
+    size_t channels;
+    size_t maxInputFrames;
+    std::vector<std::unique_ptr<dsp::HalfBand>> stages;
+
+    // Output planes, and the first stage's for 4x, only touched by the
+    // audio thread
+    std::vector<float> planarData;
+    std::vector<float*> channelData;
+    std::vector<float> scratch;
+  };
+
+  Config config;
+  RcuPtr<Plan> activePlan;
+
+  // Expects accessMutex to be held
+  void publishPlan();
+};
+
+/**
+ * Brings a stream raised by an Oversampler back down 2x or 4x, through the
+ * same half-band stages. Blocks whose length isn't a multiple of the factor
+ * are fine, the remainder waits for the next one.
+ *
+ * The output is written to planes owned by this transform, like
+ * Oversampler's.
+ */
+class Decimator : public bell::AudioTransform {
+ public:
+  typedef dsp::HalfBand::Phase Phase;
+
+  struct Config {
+    uint32_t factor = 2;
+    Phase phase = Phase::LINEAR;
+    size_t maxChannels = 2;
+    // Largest block passed to process(), at the raised rate
+    size_t maxInputFrames = 4096;
+  };
+
+  Decimator() : Decimator(Config()) {}
+  Decimator(const Config& config);
+  ~Decimator(){};
+
+  // @throws std::invalid_argument on a factor other than 2 or 4
+  void configure(const Config& config);
+
+  void process(StreamInfo& data) override;
+  void sampleRateChanged(uint32_t sampleRate) override;
+  uint32_t getOutputRate(uint32_t inputRate) override {
+    return inputRate / config.factor;
+  }
+  bool keepsFormat() override { return false; }
+
+ private:
+  struct Plan {
+    uint32_t factor;
+    size_t channels;
+    size_t maxInputFrames;
+    std::vector<std::unique_ptr<dsp::HalfBand>> stages;
+
+    // Input kept from the last block, up to factor - 1 frames per channel
+    std::vector<float> carry;
+    size_t carryFrames = 0;
+    // Whole multiples of the factor, then the output planes, only touched
+    // by the audio thread
+    std::vector<float> input;
+    std::vector<float> planarData;
+    std::vector<float*> channelData;
+    std::vector<float> scratch;
+  };
+
+  Config config;
+  RcuPtr<Plan> activePlan;
+
+  void publishPlan();
+};
+}  // namespace bell
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>   // for size_t
+#include <algorithm>  // for copy, equal, min
+
+namespace bell {
+/**
+ * Linear ramp of N parameters towards a target, owned by the audio thread.
+ * Used to change filter coefficients and gains without zipper noise.
+ */
+template <size_t N>
+class ParameterRamp {
+ public:
+  /**
+   * Starts ramping towards target, unless it's already the target. The first
+   * target is applied immediately.
+   * @param target N values to reach
+   * @param samples length of the ramp, 0 to jump
+   */
+  void setTarget(const float* target, size_t samples) {
+    if (std::equal(target, target + N, this->target)) {
+      return;
+    }
+
+    std::copy(target, target + N, this->target);
+    if (!initialized || samples == 0) {
+      std::copy(target, target + N, current);
+      remaining = 0;
+      initialized = true;
+      return;
+    }
+
+    for (size_t i = 0; i < N; i++) {
+      step[i] = (target[i] - current[i]) / samples;
+    }
+    remaining = samples;
+  }
+
+  bool isRamping() const { return remaining > 0; }
+
+  // Samples left until the target is reached
+  size_t samplesLeft() const { return remaining; }
+
+  const float* values() const { return current; }
+
+  /**
+   * Moves the ramp forward, landing exactly on the target at its end
+   * @param samples amount of samples to advance by
+   */
+  void advance(size_t samples) {
+    if (remaining == 0) {
+      return;
+    }
+
+    samples = std::min(samples, remaining);
+    remaining -= samples;
+    for (size_t i = 0; i < N; i++) {
+      current[i] = remaining == 0 ? target[i] : current[i] + step[i] * samples;
+    }
+  }
+
+ private:
+  float current[N] = {0};
+  float target[N] = {0};
+  float step[N] = {0};
+  size_t remaining = 0;
+  bool initialized = false;
+};
+}  // namespace bell
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int64_t, uint32_t
+
+namespace bell {
+/**
+ * Keeps a sink in step with the timestamps of the chunks it plays, so that
+ * several devices sharing a clock (NTP, PTP, the sender's) play together.
+ * Before each chunk is fed, update() compares when its first frame will be
+ * heard, from the frames still queued in the sink, with when it's due. A
+ * PI controller turns the smoothed error into a ratio for a DriftResampler,
+ * in ppm, which cancels the drift of the sink's crystal. Errors too large
+ * to slew, like at startup or after an underrun, are corrected at once.
+ *
+ * Only called from the thread feeding the sink.
+ */
+class PlaybackClock {
+ public:
+  struct Config {
+    // Added to every timestamp, leaves room to buffer, the same on every
+    // device of a group
+    int64_t latencyUs = 0;
+    // Furthest the ratio goes from 1
+    double maxPpm = 500;
+    // Errors beyond this are corrected by dropping or padding frames
+    int64_t hardSyncUs = 20000;
+    // Time constant of the error smoothing, hides the sink's jitter
+    double smoothingMs = 100;
+    // Ratio offset per ms of error
+    double proportionalPpm = 100;
+    // Ratio offset added per ms of error and second
+    double integralPpm = 5;
+  };
+
+  struct Adjustment {
+    // Input frames per output frame, see DriftResampler::setRatio()
+    double ratio = 1.0;
+    // Frames of the chunk to drop, or of silence to play first if negative
+    int64_t skipFrames = 0;
+  };
+
+  PlaybackClock() : PlaybackClock(Config()) {}
+  PlaybackClock(const Config& config);
+
+  /**
+   * @param timestampUs when the chunk's first frame is due, e.g. from its
+   * sec / usec
+   * @param nowUs current time on the same clock, TimeSync::nowUs() in a group
+   * @param queuedFrames frames fed to the sink but not heard yet, as
+   * AudioSink::queuedFrames(), plus the resampler's latency
+   * @param sampleRate rate the sink plays at
+   */
+  Adjustment update(int64_t timestampUs, int64_t nowUs, size_t queuedFrames,
+                    uint32_t sampleRate);
+
+  // Forgets the error history, e.g. when playback restarts
+  void reset();
+
+  // Smoothed error, positive when playing late
+  int64_t getErrorUs() const { return (int64_t)smoothedUs; }
+  double getRatio() const { return 1.0 + ppm * 1e-6; }
+
+ private:
+  Config config;
+
+  bool started = false;
+  int64_t lastUpdateUs = 0;
+  double smoothedUs = 0;
+  double integralPpm = 0;
+  double ppm = 0;
+};
+}  // namespace bell
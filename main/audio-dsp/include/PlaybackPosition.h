@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint64_t, int64_t, uint32_t
+#include <vector>    // for vector
+
+#include "BellClock.h"           // for nowNs
+#include "CentralAudioBuffer.h"  // for CentralAudioBuffer::AudioChunk
+#include "Snapshot.h"            // for Snapshot
+
+namespace bell {
+/**
+ * Which frame of which track is heard right now. Counting the bytes written
+ * to CentralAudioBuffer runs ahead by everything still in the ring, the DSP
+ * and the sink; this follows chunks to the sink instead. The feeding thread
+ * reports every chunk it feeds, with the frames it became after BellDSP
+ * (a Resampler or an Oversampler changes the count), then the frames the
+ * sink still has queued. Frames fed minus frames queued is what was heard,
+ * mapped back through the chunks fed to a track and a frame position of it.
+ *
+ * Any thread reads the position without a lock at any time, it advances at
+ * the track's rate from the last update.
+ */
+class PlaybackPosition {
+ public:
+  struct Position {
+    size_t trackHash = 0;
+    // Frame of the track heard at localNs, at the track's rate
+    uint64_t frame = 0;
+    uint32_t sampleRate = 0;
+    int64_t localNs = 0;
+    // Last frame of the track fed so far, the position stops there on
+    // underruns
+    uint64_t endFrame = 0;
+    // False before the first chunk and while paused
+    bool playing = false;
+
+    // The position extrapolated to localNs
+    uint64_t frameAt(int64_t localNs) const;
+  };
+
+  /**
+   * @param maxChunks chunks tracked between the feeder and the speaker, at
+   * least what the sink buffers. Older ones are dropped as heard
+   */
+  PlaybackPosition(size_t maxChunks = 64);
+
+  /**
+   * Feeding thread. Reports a chunk of the buffer handed to the sink
+   * @param outputFrames frames it was fed as, after DSP
+   */
+  void fed(const CentralAudioBuffer::AudioChunk& chunk, size_t outputFrames);
+  void fed(size_t trackHash, uint64_t framePosition, size_t frames,
+           uint32_t sampleRate, size_t outputFrames);
+
+  /**
+   * Feeding thread, after feeding. A sink that was flushed, e.g. on a seek,
+   * reports fewer frames queued and the chunks it dropped are skipped
+   * @param queuedFrames frames fed but not heard, AudioSink::queuedFrames()
+   * plus any DSP latency, in output frames
+   */
+  void update(size_t queuedFrames, int64_t localNs = clock::nowNs());
+
+  // Feeding thread. Stops the position advancing, until the next update()
+  void pause(int64_t localNs = clock::nowNs());
+
+  // Feeding thread. Forgets every chunk, e.g. when playback stops
+  void reset();
+
+  // Any thread, wait-free
+  Position current() const { return position.read(); }
+  uint64_t frameNow() const { return current().frameAt(clock::nowNs()); }
+
+ private:
+  struct Segment {
+    size_t trackHash;
+    uint64_t framePosition;
+    size_t frames;
+    uint32_t sampleRate;
+    // Output frames fed before it, and the ones it was fed as
+    uint64_t outputStart;
+    size_t outputFrames;
+  };
+
+  // Chunks not fully heard yet, oldest at head
+  std::vector<Segment> segments;
+  size_t head = 0;
+  size_t count = 0;
+  uint64_t outputFed = 0;
+
+  Snapshot<Position> position;
+
+  const Segment& segmentAt(size_t index) const {
+    return segments[(head + index) % segments.size()];
+  }
+  // Finds the heard frame at localNs, expects count > 0
+  Position locate(uint64_t played, int64_t localNs) const;
+};
+}  // namespace bell
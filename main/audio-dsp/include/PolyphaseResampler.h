@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <vector>    // for vector
+
+namespace bell {
+namespace dsp {
+// Dot product of n floats, n a multiple of 4 so the vector loop has no tail
+float dot(const float* a, const float* b, size_t n);
+
+// Zeroth order modified Bessel function, for Kaiser windows
+double besselI0(double x);
+
+/**
+ * Streaming polyphase sample rate converter for planar float audio. The rate
+ * ratio is reduced to up / down, with up limited to MAX_PHASES; ratios that
+ * don't fit use the closest fraction that does (a few ppm off at worst).
+ *
+ * All memory is allocated in the constructor, process() doesn't allocate.
+ */
+class PolyphaseResampler {
+ public:
+  // Taps per phase, Kaiser window and passband width grow with quality
+  enum class Quality { LOW, MEDIUM, HIGH };
+
+  static const uint32_t MAX_PHASES = 1024;
+
+  /**
+   * @param inputRate rate of the input, in Hz
+   * @param outputRate rate of the output, in Hz
+   * @param channels amount of planes processed
+   * @param maxInputFrames largest amount of frames passed to process()
+   * @param quality filter length and steepness
+   */
+  PolyphaseResampler(uint32_t inputRate, uint32_t outputRate, size_t channels,
+                     size_t maxInputFrames, Quality quality = Quality::MEDIUM);
+
+  // Upper bound of frames returned by a single process() call
+  size_t maxOutputFrames() const;
+
+  /**
+   * @param in channels planes of frames samples, at most maxInputFrames
+   * @param frames amount of input frames
+   * @param out channels planes of at least maxOutputFrames() samples
+   * @param activeChannels planes actually present, at most channels
+   * @return amount of frames written to out
+   */
+  size_t process(const float* const* in, size_t frames, float* const* out,
+                 size_t activeChannels);
+
+  // Clears the filter history, e.g. on a track change
+  void reset();
+
+  uint32_t getUpFactor() const { return up; }
+  uint32_t getDownFactor() const { return down; }
+
+ private:
+  uint32_t up;
+  uint32_t down;
+  size_t taps;
+  size_t channels;
+  size_t maxInputFrames;
+
+  // [phase][tap], taps ordered oldest input sample first
+  std::vector<float> filter;
+
+  // [channel][taps + maxInputFrames], unconsumed input carried between calls
+  std::vector<float> history;
+  size_t historyFrames = 0;
+  uint32_t phase = 0;
+
+  void designFilter(Quality quality);
+};
+}  // namespace dsp
+}  // namespace bell
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>  // for uint32_t
+#include <atomic>    // for atomic
+#include <chrono>    // for steady_clock
+#include <mutex>     // for mutex
+#include <vector>    // for vector
+
+#include "BellTask.h"        // for Task
+#include "DSPLoadMonitor.h"  // for DSPLoadMonitor
+
+struct esp_pm_lock;
+
+namespace bell {
+/**
+ * Scales the CPU frequency with the load DSPLoadMonitors measure, through
+ * esp_pm locks on ESP32. The application configures dynamic frequency
+ * scaling (esp_pm_configure()) and its bounds, the governor only holds
+ * locks:
+ * - HIGH: CPU at max_freq_mhz, taken at once when the load crosses
+ *   highPercent or a block misses its deadline
+ * - LOW: CPU at 80 MHz at least, once the load stayed under lowPercent for
+ *   holdMs
+ * - IDLE: no lock, down to min_freq_mhz and light sleep, when paused or no
+ *   block went through for idleMs
+ *
+ * Elsewhere, or without CONFIG_PM_ENABLE, only the level is tracked.
+ */
+class PowerGovernor : public bell::Task {
+ public:
+  enum class Level { IDLE, LOW, HIGH };
+
+  struct Config {
+    uint32_t pollMs = 100;
+    // Steps up from LOW above this load, measured at LOW's frequency
+    float highPercent = 60.0f;
+    // Steps down from HIGH below this load, measured at the maximum. Kept
+    // under highPercent * 80 / max_freq_mhz, or LOW steps straight back up
+    float lowPercent = 15.0f;
+    // Time under lowPercent before stepping down
+    uint32_t holdMs = 3000;
+    // Time without any block before IDLE
+    uint32_t idleMs = 500;
+    // Lets IDLE light sleep, off when a peripheral must keep running
+    bool lightSleep = true;
+  };
+
+  PowerGovernor() : PowerGovernor(Config()) {}
+  PowerGovernor(const Config& config);
+  ~PowerGovernor();
+
+  /**
+   * Adds a monitor to the load, e.g. BellDSP's and one timing the decoder.
+   * Loads add up, as if all ran on the same core. Before start(), the
+   * monitor must outlive the governor
+   */
+  void watch(DSPLoadMonitor* monitor);
+
+  bool start();
+  void stop();
+
+  // Called on pause and resume, resuming goes HIGH right away
+  void setPlaying(bool playing);
+
+  Level getLevel() const { return level; }
+
+ private:
+  Config config;
+  std::vector<DSPLoadMonitor*> monitors;
+  std::atomic<bool> playing = true;
+
+  std::mutex levelMutex;
+  std::atomic<Level> level = Level::IDLE;
+  esp_pm_lock* cpuLock = nullptr;
+  esp_pm_lock* apbLock = nullptr;
+  esp_pm_lock* awakeLock = nullptr;
+
+  // Task only
+  uint32_t lastBlocks = 0;
+  uint32_t lastMisses = 0;
+  bool wasPlaying = false;
+  std::chrono::steady_clock::time_point lastBlock;
+  std::chrono::steady_clock::time_point calmSince;
+
+  void runTask() override;
+
+  void apply(Level target);
+};
+}  // namespace bell
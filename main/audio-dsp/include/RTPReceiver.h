@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t, int64_t
+#include <array>     // for array
+#include <memory>    // for shared_ptr
+#include <mutex>     // for mutex
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "BaseCodec.h"           // for BaseCodec
+#include "BellTask.h"            // for Task
+#include "CentralAudioBuffer.h"  // for CentralAudioBuffer
+
+namespace bell {
+class TimeSync;
+
+/**
+ * Receives an RTP stream (RFC 3550) over UDP, PCM (L16, RFC 3551) or Opus
+ * (RFC 7587), and writes it to a CentralAudioBuffer, each chunk stamped
+ * with the wall clock time its first frame is due, for PlaybackClock. With
+ * syncLatencyMs, that time comes from the RTCP sender reports of e.g. an
+ * RTPSender instead, for devices sharing one clock.
+ *
+ * Packets wait in a jitter buffer, ordered by sequence number, until their
+ * RTP timestamp plus the playout delay. The delay follows the interarrival
+ * jitter of RFC 3550 A.8, within minDelayMs and maxDelayMs, by a packet
+ * at a time: a packet is concealed to grow it, one is dropped to shrink it.
+ * A packet missing by its due time is rebuilt from the next one's in-band
+ * FEC with Opus, or concealed by the decoder's PLC (silence for PCM).
+ *
+ * The receiving task paces the writes itself, so the buffer only needs a
+ * chunk or two ahead of the sink; with a chunk of a packet's size, latency
+ * is the playout delay plus one chunk.
+ */
+class RTPReceiver : public bell::Task {
+ public:
+  enum class Payload {
+    // Big-endian signed 16 bit, L16
+    PCM16,
+    OPUS,
+  };
+
+  struct Config {
+    uint16_t port = 5004;
+    // Joined when set, e.g. "239.255.10.1" for a multi-room group
+    std::string multicastGroup;
+    Payload payload = Payload::OPUS;
+    // Packets of other payload types are ignored, 96 and up are dynamic
+    uint8_t payloadType = 96;
+    // RTP clock rate of PCM, Opus always runs a 48 kHz clock
+    uint32_t sampleRate = 48000;
+    uint8_t channels = 2;
+    uint32_t minDelayMs = 5;
+    uint32_t maxDelayMs = 60;
+    // Missing audio after which the sender counts as gone, the next packet
+    // starts over
+    uint32_t maxConcealMs = 200;
+    // Hash the chunks are written with
+    size_t trackHash = 0;
+    /**
+     * Stamps the chunks this long after the time the sender's RTCP reports
+     * give them, the same on every receiver of a group so they play
+     * together. 0 stamps them with the local playout time instead
+     */
+    uint32_t syncLatencyMs = 0;
+    // Group clock the local playout time is stamped on, instead of the wall
+    // clock, for a sender without RTCP. Must outlive the receiver
+    TimeSync* timeSync = nullptr;
+  };
+
+  struct Stats {
+    uint32_t received = 0;
+    // Missing by their due time, rebuilt or concealed
+    uint32_t lost = 0;
+    // Arrived after their due time, dropped
+    uint32_t late = 0;
+    // Dropped to shrink the delay, or because the buffer was full
+    uint32_t dropped = 0;
+    float jitterMs = 0;
+    float delayMs = 0;
+  };
+
+  // Fixed part of an RTP packet
+  struct Packet {
+    uint8_t payloadType;
+    bool marker;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    const uint8_t* payload;
+    size_t payloadSize;
+  };
+
+  RTPReceiver(CentralAudioBuffer& buffer)
+      : RTPReceiver(buffer, Config()) {}
+  RTPReceiver(CentralAudioBuffer& buffer, const Config& config);
+  ~RTPReceiver();
+
+  /**
+   * Binds the port and starts receiving
+   * @returns false if the socket can't be set up or the codec is missing
+   */
+  bool start();
+  void stop();
+
+  Stats getStats();
+
+  /**
+   * Parses the header of an RTP packet, skipping CSRCs, the extension and
+   * padding
+   * @returns false if data isn't a version 2 RTP packet
+   */
+  static bool parse(const uint8_t* data, size_t len, Packet& packet);
+
+ private:
+  // Reordering window, a packet further ahead restarts the stream
+  static constexpr size_t SLOTS = 32;
+  static constexpr size_t MAX_PACKET = 1500;
+  // Packets released between two changes of the delay
+  static constexpr uint32_t ADAPT_INTERVAL = 25;
+  // Longest wait for a packet, so stop() is noticed
+  static constexpr uint32_t MAX_WAIT_MS = 10;
+  // Offset between the NTP (1900) and Unix (1970) epochs, in seconds
+  static constexpr int64_t NTP_EPOCH_OFFSET = 2208988800LL;
+  const char* TAG = "RTPReceiver";
+
+  struct Slot {
+    bool used = false;
+    uint16_t sequence;
+    // Timestamp extended past its wraps
+    int64_t timestamp;
+    size_t size;
+    std::array<uint8_t, MAX_PACKET> data;
+  };
+
+  CentralAudioBuffer& buffer;
+  Config config;
+  uint32_t clockRate;
+  int sock = -1;
+  int reportSock = -1;
+  std::shared_ptr<BaseCodec> codec;
+  std::vector<Slot> slots = std::vector<Slot>(SLOTS);
+  std::array<uint8_t, MAX_PACKET> packetBuffer;
+  // PCM in host order, or silence
+  std::vector<int16_t> pcm;
+
+  std::mutex statsMutex;
+  Stats stats;
+
+  // Task only
+  bool synced = false;
+  uint32_t ssrc = 0;
+  uint16_t nextSequence = 0;
+  int64_t nextTimestamp = 0;
+  // Of the last packet released, and the latest one received
+  int64_t lastTimestamp = 0;
+  int64_t highestTimestamp = 0;
+  // Duration of a packet, in RTP clock units
+  int64_t packetFrames = 0;
+  // Stream time to local time, RTP clock units: a packet is due when the
+  // local clock reaches its timestamp plus playoutOffset
+  double playoutOffset = 0;
+  // Smoothed transit time and its deviation (the RFC 3550 jitter)
+  double meanTransit = 0;
+  double lastTransit = 0;
+  double jitter = 0;
+  uint32_t untilAdapt = ADAPT_INTERVAL;
+  int64_t concealedFrames = 0;
+  // Start of the local clock, see now()
+  int64_t epochNs = 0;
+  // Last sender report, a timestamp and its time on the sender's clock
+  bool hasReport = false;
+  int64_t reportTimestamp = 0;
+  int64_t reportWallUs = 0;
+
+  void runTask() override;
+
+  // UDP socket bound to port, in the group if there is one
+  int openSocket(uint16_t port);
+  void closeSockets();
+  // Reads every packet waiting on the socket
+  void receive();
+  void receiveReports();
+  void onPacket(const Packet& packet, double arrival);
+  void sync(const Packet& packet, double arrival);
+  // Releases, or conceals, the packets due by now
+  void playout(double now);
+  // Decodes the next packet and writes it, or only decodes it when drop
+  void release(Slot& slot, double due, bool drop);
+  // Fills the place of a missing packet, or leaves it to the next one's FEC
+  void conceal(bool beforeNext);
+  // Moves playoutOffset a packet toward targetOffset()
+  void adapt();
+  // Writes PCM due at due, stamped with its wall clock time
+  void write(const uint8_t* data, size_t size, double due);
+  void writeConcealment(int64_t frames);
+  // Local clock, in RTP clock units since start()
+  double now();
+  // Playout offset the jitter asks for
+  double targetOffset();
+  // When the next packet is due, in RTP clock units
+  double nextDue();
+  Slot* nextSlot();
+};
+}  // namespace bell
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t, int64_t
+#include <atomic>    // for atomic
+#include <memory>    // for unique_ptr
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "BellDSP.h"           // for BellDSP
+#include "BellTask.h"          // for Task
+#include "CircularBuffer.h"    // for CircularBuffer
+#include "RTPReceiver.h"       // for RTPReceiver
+#include "StreamInfo.h"        // for PcmFormat
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+struct OpusEncoder;
+
+namespace bell {
+class TimeSync;
+namespace dsp {
+class PolyphaseResampler;
+}
+
+/**
+ * Multicasts the PCM passing a BellDSP tap as RTP, L16 or Opus, so one
+ * device decodes a stream and the others of a zone play it through an
+ * RTPReceiver. RTCP sender reports, on port + 1 every second, map the RTP
+ * timestamps to the sender's wall clock; receivers with a syncLatencyMs
+ * stamp their chunks from it, and PlaybackClock keeps every device on the
+ * same time.
+ *
+ * The tap only copies the PCM, as 16 bit, into a ring; the sender's task
+ * encodes and sends it. Opus runs at 48 kHz, other rates are resampled.
+ */
+class RTPSender : public bell::Task {
+ public:
+  typedef RTPReceiver::Payload Payload;
+
+  struct Config {
+    // Multicast group, or the address of a single receiver
+    std::string address = "239.255.10.1";
+    uint16_t port = 5004;
+    // Hops the packets may travel, 1 keeps them on the local network
+    uint8_t ttl = 1;
+    Payload payload = Payload::OPUS;
+    uint8_t payloadType = 96;
+    uint32_t bitrate = 128000;
+    // Audio per packet, an Opus frame size: 2.5, 5, 10, 20, 40 or 60. L16
+    // packets are cut to fit a 1500 byte MTU
+    float frameMs = 10;
+    // Audio the ring holds, what the task hasn't sent when it's full is
+    // dropped
+    uint32_t bufferMs = 200;
+    // Clock the sender reports are stamped on, the group's when the sender
+    // isn't the TimeSync host. Must outlive the sender
+    TimeSync* timeSync = nullptr;
+  };
+
+  RTPSender() : RTPSender(Config()) {}
+  RTPSender(const Config& config);
+  ~RTPSender();
+
+  /**
+   * Opens the socket and starts sending what the tap receives
+   * @returns false if the socket can't be set up or Opus is missing
+   */
+  bool start();
+  void stop();
+
+  // Hook for BellDSP::setTap(), the sender must outlive it
+  BellDSP::Tap tap();
+
+  /**
+   * Queues PCM to send, any format, with 2 channels at most. A change of
+   * rate or channels restarts the stream. Never blocks, for the audio thread.
+   */
+  void write(const uint8_t* data, size_t bytes, int channels,
+             uint32_t sampleRate, PcmFormat format);
+
+  // Packets sent so far
+  uint32_t getPacketCount() { return packetCount; }
+
+ private:
+  static constexpr size_t MAX_PACKET = 1500;
+  static constexpr size_t HEADER_SIZE = 12;
+  static constexpr uint32_t REPORT_INTERVAL_MS = 1000;
+  // Offset between the NTP (1900) and Unix (1970) epochs, in seconds
+  static constexpr uint64_t NTP_EPOCH_OFFSET = 2208988800ULL;
+  const char* TAG = "RTPSender";
+
+  Config config;
+  int sock = -1;
+  uint32_t ssrc;
+
+  // 16 bit interleaved PCM from write(), in the format below
+  std::unique_ptr<CircularBuffer> ring;
+  bell::WrappedSemaphore dataSem;
+  std::atomic<uint32_t> sampleRate = 0;
+  std::atomic<uint8_t> channels = 0;
+  // Set by write() on a format change, the task starts over
+  std::atomic<bool> restart = false;
+  // Written by the audio thread only
+  std::vector<int16_t> converted;
+
+  // Task only
+  uint32_t streamRate = 0;
+  uint8_t streamChannels = 0;
+  uint16_t sequence;
+  uint32_t timestamp;
+  std::atomic<uint32_t> packetCount = 0;
+  uint32_t octetCount = 0;
+  int64_t lastReportMs = 0;
+  // Frames of a packet, at the RTP clock rate
+  size_t packetFrames = 0;
+  std::vector<int16_t> input;
+  std::vector<uint8_t> packet = std::vector<uint8_t>(MAX_PACKET);
+
+  ::OpusEncoder* encoder = nullptr;
+  std::unique_ptr<dsp::PolyphaseResampler> resampler;
+  // Resampler planes, and its output waiting for a whole packet
+  std::vector<std::vector<float>> inPlanes, outPlanes;
+  std::vector<float> pending;
+
+  void runTask() override;
+  void onStopRequested() override;
+
+  bool openSocket();
+  // Sets up the encoder for the format write() announced
+  bool configure();
+  void release();
+  // Sends what's queued, a packet at a time
+  void drain();
+  void sendOpus(const int16_t* pcm, size_t frames);
+  void sendPCM(const int16_t* pcm, size_t frames);
+  void encodeFloat(const float* pcm);
+  void send(size_t payloadSize, uint32_t frames);
+  void sendReport();
+  uint32_t clockRate();
+};
+}  // namespace bell
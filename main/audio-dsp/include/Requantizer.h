@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int32_t, uint32_t, uint8_t
+#include <vector>    // for vector
+
+#include "StreamInfo.h"  // for PcmFormat
+
+namespace bell {
+/**
+ * Final stage of the engine, brings planar samples down to the width of the
+ * output format. Plain rounding leaves an error that follows the signal,
+ * audible as distortion on quiet passages and fade outs. TPDF dither of
+ * +-1 LSB turns it into a constant noise floor, noise shaping additionally
+ * feeds the error back through an E-weighted filter, moving that floor to
+ * frequencies the ear is less sensitive to (tuned for 44.1 and 48 kHz).
+ *
+ * Only INT16 and INT24_IN_32 are requantized, INT32 and FLOAT32 go through
+ * dsp::interleave() untouched, as any other format with Mode::NONE. A channel
+ * that's digital silence for a whole block stays silence, one whose samples
+ * all already sit on the output's steps, e.g. 16-bit input at unity gain,
+ * comes out bit exact: only what gain, DSP or a narrower output moved off
+ * the grid gets dithered.
+ */
+class Requantizer {
+ public:
+  enum class Mode { NONE, TPDF, NOISE_SHAPED };
+
+  Requantizer() = default;
+  ~Requantizer() = default;
+
+  // Resets the error state, for up to channels channels
+  void configure(Mode mode, size_t channels);
+  Mode getMode() const { return mode; }
+
+  /**
+   * Interleaves normalized planar float into out, rounding, dithering and
+   * saturating to format
+   * @param channels at most the amount passed to configure()
+   */
+  void interleave(const float* const* in, PcmFormat format, uint8_t* out,
+                  size_t channels, size_t frames);
+
+  // Same, for planar Q1.31
+  void interleave(const int32_t* const* in, PcmFormat format, uint8_t* out,
+                  size_t channels, size_t frames);
+
+ private:
+  // Error feedback filter, the error spectrum gets 1 - H(z)
+  static constexpr int SHAPING_TAPS = 3;
+  static constexpr float SHAPING[SHAPING_TAPS] = {1.623f, -0.982f, 0.109f};
+  // Same in Q12, for the fixed point path
+  static constexpr int SHAPING_FRACTION_BITS = 12;
+  static constexpr int32_t SHAPING_FIXED[SHAPING_TAPS] = {6648, -4022, 446};
+
+  struct ChannelState {
+    // Last errors, newest first, in output LSB (float) or Q1.31 (fixed)
+    float errors[SHAPING_TAPS] = {};
+    int64_t fixedErrors[SHAPING_TAPS] = {};
+  };
+
+  Mode mode = Mode::TPDF;
+  std::vector<ChannelState> state;
+  uint32_t seed = 0x12345678;
+
+  // Triangular noise in (-65536, 65536), two uniform halves of one xorshift
+  inline int32_t nextTpdf() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (int32_t)(seed & 0xFFFF) - (int32_t)(seed >> 16);
+  }
+
+  // Whether format gets requantized, with its width in bits
+  bool targetBits(PcmFormat format, int& bits) const;
+
+  // One plane into every stride-th sample of out, at bits significant bits
+  template <bool Shaped, typename Out>
+  void requantize(const float* in, Out* out, size_t stride, size_t frames,
+                  int bits, ChannelState& channel);
+  template <bool Shaped, typename Out>
+  void requantize(const int32_t* in, Out* out, size_t stride, size_t frames,
+                  int bits, ChannelState& channel);
+  template <typename T>
+  void interleaveWith(const T* const* in, PcmFormat format, uint8_t* out,
+                      size_t channels, size_t frames);
+};
+}  // namespace bell
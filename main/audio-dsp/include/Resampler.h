@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <memory>    // for shared_ptr, unique_ptr
+#include <mutex>     // for scoped_lock
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioTransform.h"     // for AudioTransform
+#include "PolyphaseResampler.h"  // for PolyphaseResampler
+#include "RcuPtr.h"             // for RcuPtr
+#include "StreamInfo.h"         // for StreamInfo
+#include "TransformConfig.h"    // for TransformConfig
+
+namespace bell {
+/**
+ * Converts the stream to a fixed output rate, so that sinks can stay opened
+ * at one rate whatever the source is. The converter for a given input rate is
+ * built in sampleRateChanged(), on the control thread; blocks at any other
+ * rate pass through untouched.
+ *
+ * The output is written to planes owned by this transform, data.data,
+ * numSamples and sampleRate are updated to point at them.
+ */
+class Resampler : public bell::AudioTransform {
+ public:
+  typedef dsp::PolyphaseResampler::Quality Quality;
+
+  Resampler();
+  ~Resampler(){};
+
+  /**
+   * @param outputRate rate the stream is converted to
+   * @param quality converter quality tier
+   * @param maxChannels largest channel count of the stream
+   * @param maxInputFrames largest block passed to process()
+   */
+  void configure(uint32_t outputRate, Quality quality = Quality::MEDIUM,
+                 size_t maxChannels = 2, size_t maxInputFrames = 1024);
+
+  // Builds the converter for a new input rate
+  void sampleRateChanged(uint32_t sampleRate) override;
+
+  void process(StreamInfo& data) override;
+  bool keepsFormat() override { return false; }
+  uint32_t getOutputRate(uint32_t inputRate) override {
+    return outputRate != 0 ? outputRate : inputRate;
+  }
+
+  void reconfigure() override {
+    uint32_t newRate = config->getInt("sample_rate", true);
+    std::string qualityName = config->getString("quality", false, "medium");
+    size_t newChannels = config->getInt("max_channels", false, 2);
+
+    Quality newQuality = Quality::MEDIUM;
+    if (qualityName == "low") {
+      newQuality = Quality::LOW;
+    } else if (qualityName == "high") {
+      newQuality = Quality::HIGH;
+    }
+
+    {
+      std::scoped_lock lock(this->accessMutex);
+      if (newRate == outputRate && newQuality == quality &&
+          newChannels == maxChannels) {
+        return;
+      }
+    }
+    // configure() takes the lock itself
+    this->configure(newRate, newQuality, newChannels, maxInputFrames);
+  }
+
+ private:
+  struct Plan {
+    uint32_t inputRate;
+    uint32_t outputRate;
+    size_t channels;
+    std::unique_ptr<dsp::PolyphaseResampler> resampler;
+
+    // Output planes, only touched by the audio thread
+    std::vector<float> planarData;
+    std::vector<float*> channelData;
+  };
+
+  uint32_t inputRate = 44100;
+  uint32_t outputRate = 0;
+  Quality quality = Quality::MEDIUM;
+  size_t maxChannels = 2;
+  size_t maxInputFrames = 1024;
+
+  RcuPtr<Plan> activePlan;
+
+  // Expects accessMutex to be held
+  void publishPlan();
+};
+}  // namespace bell
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int16_t, int32_t, uint8_t
+
+#include "StreamInfo.h"  // for PcmFormat
+
+namespace bell::dsp {
+/**
+ * Converts interleaved int16 PCM into normalized planar float
+ * @param in interleaved samples, frames * channels of them
+ * @param out one destination plane per channel
+ * @param channels number of interleaved channels
+ * @param frames number of samples per channel
+ */
+void deinterleaveInt16(const int16_t* in, float* const* out, size_t channels,
+                       size_t frames);
+
+/**
+ * Converts normalized planar float into interleaved int16 PCM, rounding to
+ * nearest and clipping anything outside of [-32768 / 32767, 1]. Every int16
+ * comes back unchanged from deinterleaveInt16()
+ * @param in one source plane per channel
+ * @param out interleaved destination, frames * channels samples
+ * @param channels number of channels to interleave
+ * @param frames number of samples per channel
+ */
+void interleaveInt16(const float* const* in, int16_t* out, size_t channels,
+                     size_t frames);
+
+/**
+ * Converts interleaved int16 PCM into planar Q1.31, without touching the FPU
+ * @param in interleaved samples, frames * channels of them
+ * @param out one destination plane per channel
+ * @param channels number of interleaved channels
+ * @param frames number of samples per channel
+ */
+void deinterleaveInt16(const int16_t* in, int32_t* const* out, size_t channels,
+                       size_t frames);
+
+/**
+ * Converts planar Q1.31 into interleaved int16 PCM, rounding to nearest
+ * @param in one source plane per channel
+ * @param out interleaved destination, frames * channels samples
+ * @param channels number of channels to interleave
+ * @param frames number of samples per channel
+ */
+void interleaveInt16(const int32_t* const* in, int16_t* out, size_t channels,
+                     size_t frames);
+
+/**
+ * Converts interleaved PCM of any PcmFormat into normalized planar float
+ * @param in interleaved samples, frames * channels of them
+ * @param format layout of in
+ * @param out one destination plane per channel
+ * @param channels number of interleaved channels
+ * @param frames number of samples per channel
+ */
+void deinterleave(const uint8_t* in, PcmFormat format, float* const* out,
+                  size_t channels, size_t frames);
+
+/**
+ * Converts normalized planar float into interleaved PCM. Integer formats are
+ * clipped to [-1, 1], FLOAT32 is passed as is
+ */
+void interleave(const float* const* in, PcmFormat format, uint8_t* out,
+                size_t channels, size_t frames);
+
+/**
+ * Planar Q1.31 counterparts of the above, FLOAT32 clipped to [-1, 1]. These
+ * dispatch to SampleFormat.h's templates, which also cover packed 24-bit and
+ * big-endian layouts for code that knows its format at compile time
+ */
+void deinterleave(const uint8_t* in, PcmFormat format, int32_t* const* out,
+                  size_t channels, size_t frames);
+void interleave(const int32_t* const* in, PcmFormat format, uint8_t* out,
+                size_t channels, size_t frames);
+
+/**
+ * Whether PCM of any format is digital silence, all bytes zero. Returns at
+ * the first sample that isn't, so music costs a few bytes of scanning
+ */
+bool isSilent(const uint8_t* data, size_t bytes);
+}  // namespace bell::dsp
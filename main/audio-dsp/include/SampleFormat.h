@@ -0,0 +1,287 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for int32_t, uint8_t, int16_t
+#include <string.h>     // for memcpy
+#include <algorithm>    // for clamp
+#include <cmath>        // for lrintf
+#include <type_traits>  // for is_same_v
+
+#include "FixedPoint.h"        // for q15ToQ31, q31ToQ15
+#include "SampleConversion.h"  // for deinterleaveInt16, interleaveInt16
+#include "StreamInfo.h"        // for PcmFormat
+
+namespace bell::dsp {
+/**
+ * Sample formats as types, for conversion loops written once and expanded
+ * per format at compile time. Each format reads and writes one sample at a
+ * byte address, through float (normalized to [-1, 1]) and through Q1.31;
+ * writes saturate. Integer formats convert between each other through Q1.31
+ * so widening is exact, float goes through float.
+ *
+ * Formats are little-endian like every bell target, Swapped<> gives their
+ * big-endian counterparts, e.g. for AIFF or network streams. Scales and
+ * rounding match SampleConversion's, which dispatches its PcmFormat entry
+ * points here.
+ */
+struct S16 {
+  static constexpr size_t BYTES = 2;
+  static constexpr bool FLOAT = false;
+
+  static float toFloat(const uint8_t* p) {
+    return load(p) * (1.0f / 32767.0f);
+  }
+  static void fromFloat(float x, uint8_t* p) {
+    store((int16_t)lrintf(std::clamp(x, -32768.0f / 32767.0f, 1.0f) * 32767.0f),
+          p);
+  }
+  static int32_t toQ31(const uint8_t* p) { return q15ToQ31(load(p)); }
+  static void fromQ31(int32_t x, uint8_t* p) { store(q31ToQ15(x), p); }
+
+ private:
+  static int16_t load(const uint8_t* p) {
+    int16_t x;
+    memcpy(&x, p, BYTES);
+    return x;
+  }
+  static void store(int16_t x, uint8_t* p) { memcpy(p, &x, BYTES); }
+};
+
+// Full range 32-bit integers, as PcmFormat::INT32
+struct S32 {
+  static constexpr size_t BYTES = 4;
+  static constexpr bool FLOAT = false;
+
+  static float toFloat(const uint8_t* p) {
+    return toQ31(p) * (1.0f / 2147483648.0f);
+  }
+  static void fromFloat(float x, uint8_t* p) { fromQ31(floatToQ31(x), p); }
+  static int32_t toQ31(const uint8_t* p) {
+    int32_t x;
+    memcpy(&x, p, BYTES);
+    return x;
+  }
+  static void fromQ31(int32_t x, uint8_t* p) { memcpy(p, &x, BYTES); }
+
+  // Clipped to [-1, 1], 1 saturating to INT32_MAX
+  static int32_t floatToQ31(float x) {
+    float scaled = std::clamp(x, -1.0f, 1.0f) * 2147483648.0f;
+    return scaled >= 2147483648.0f ? INT32_MAX : (int32_t)scaled;
+  }
+};
+
+// 24 bits left-justified in 32-bit words, as PcmFormat::INT24_IN_32
+struct S24_4 {
+  static constexpr size_t BYTES = 4;
+  static constexpr bool FLOAT = false;
+
+  static float toFloat(const uint8_t* p) { return S32::toFloat(p); }
+  static void fromFloat(float x, uint8_t* p) {
+    S32::fromQ31(round(S32::floatToQ31(x)), p);
+  }
+  static int32_t toQ31(const uint8_t* p) { return S32::toQ31(p); }
+  static void fromQ31(int32_t x, uint8_t* p) { S32::fromQ31(round(x), p); }
+
+  // To the nearest of the 24 significant bits, saturating
+  static int32_t round(int32_t x) {
+    int64_t rounded = ((int64_t)x + 0x80) & ~(int64_t)0xFF;
+    return rounded > INT32_MAX ? 0x7FFFFF00 : (int32_t)rounded;
+  }
+};
+
+// Packed 24-bit, three bytes per sample as in WAV files and S/PDIF frames
+struct S24_3 {
+  static constexpr size_t BYTES = 3;
+  static constexpr bool FLOAT = false;
+
+  static float toFloat(const uint8_t* p) {
+    return toQ31(p) * (1.0f / 2147483648.0f);
+  }
+  static void fromFloat(float x, uint8_t* p) {
+    fromQ31(S24_4::round(S32::floatToQ31(x)), p);
+  }
+  static int32_t toQ31(const uint8_t* p) {
+    return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) |
+                     ((uint32_t)p[2] << 24));
+  }
+  static void fromQ31(int32_t x, uint8_t* p) {
+    uint32_t bits = (uint32_t)S24_4::round(x);
+    p[0] = bits >> 8;
+    p[1] = bits >> 16;
+    p[2] = bits >> 24;
+  }
+};
+
+// IEEE float, passed as is; Q1.31 conversions clip to [-1, 1]
+struct F32 {
+  static constexpr size_t BYTES = 4;
+  static constexpr bool FLOAT = true;
+
+  static float toFloat(const uint8_t* p) {
+    float x;
+    memcpy(&x, p, BYTES);
+    return x;
+  }
+  static void fromFloat(float x, uint8_t* p) { memcpy(p, &x, BYTES); }
+  static int32_t toQ31(const uint8_t* p) {
+    return S32::floatToQ31(toFloat(p));
+  }
+  static void fromQ31(int32_t x, uint8_t* p) {
+    fromFloat(x * (1.0f / 2147483648.0f), p);
+  }
+};
+
+// Byte swapped Format, for big-endian streams
+template <typename Format>
+struct Swapped {
+  static constexpr size_t BYTES = Format::BYTES;
+  static constexpr bool FLOAT = Format::FLOAT;
+
+  static float toFloat(const uint8_t* p) {
+    uint8_t native[BYTES];
+    swap(p, native);
+    return Format::toFloat(native);
+  }
+  static void fromFloat(float x, uint8_t* p) {
+    uint8_t native[BYTES];
+    Format::fromFloat(x, native);
+    swap(native, p);
+  }
+  static int32_t toQ31(const uint8_t* p) {
+    uint8_t native[BYTES];
+    swap(p, native);
+    return Format::toQ31(native);
+  }
+  static void fromQ31(int32_t x, uint8_t* p) {
+    uint8_t native[BYTES];
+    Format::fromQ31(x, native);
+    swap(native, p);
+  }
+
+ private:
+  static void swap(const uint8_t* in, uint8_t* out) {
+    for (size_t i = 0; i < BYTES; i++) {
+      out[i] = in[BYTES - 1 - i];
+    }
+  }
+};
+
+typedef Swapped<S16> S16BE;
+typedef Swapped<S24_3> S24_3BE;
+typedef Swapped<S24_4> S24_4BE;
+typedef Swapped<S32> S32BE;
+typedef Swapped<F32> F32BE;
+
+/**
+ * Calls function with a default constructed tag of format's type, e.g.
+ * withFormat(format, [&](auto tag) { deinterleave<decltype(tag)>(...); })
+ * expands the loop once per PcmFormat
+ */
+template <typename Function>
+inline void withFormat(PcmFormat format, Function&& function) {
+  switch (format) {
+    case PcmFormat::INT16:
+      function(S16());
+      break;
+    case PcmFormat::INT24_IN_32:
+      function(S24_4());
+      break;
+    case PcmFormat::INT32:
+      function(S32());
+      break;
+    case PcmFormat::FLOAT32:
+      function(F32());
+      break;
+  }
+}
+
+// Interleaved loop with the stride known at compile time for stereo, which
+// lets the compiler vectorize it
+template <typename Step>
+inline void forEachSample(size_t channels, size_t frames, Step&& step) {
+  if (channels == 2) {
+    for (size_t i = 0; i < frames; i++) {
+      step(i, 0, i * 2);
+      step(i, 1, i * 2 + 1);
+    }
+    return;
+  }
+  for (size_t i = 0; i < frames; i++) {
+    for (size_t ch = 0; ch < channels; ch++) {
+      step(i, ch, i * channels + ch);
+    }
+  }
+}
+
+/**
+ * Interleaved Format into planar float or Q1.31
+ * @param in interleaved samples, frames * channels of them
+ * @param out one destination plane per channel
+ */
+template <typename Format>
+inline void deinterleave(const uint8_t* in, float* const* out,
+                         size_t channels, size_t frames) {
+  if constexpr (std::is_same_v<Format, S16>) {
+    // Vector kernels
+    deinterleaveInt16((const int16_t*)in, out, channels, frames);
+  } else {
+    forEachSample(channels, frames, [&](size_t i, size_t ch, size_t index) {
+      out[ch][i] = Format::toFloat(in + index * Format::BYTES);
+    });
+  }
+}
+
+template <typename Format>
+inline void deinterleave(const uint8_t* in, int32_t* const* out,
+                         size_t channels, size_t frames) {
+  forEachSample(channels, frames, [&](size_t i, size_t ch, size_t index) {
+    out[ch][i] = Format::toQ31(in + index * Format::BYTES);
+  });
+}
+
+/**
+ * Planar float or Q1.31 into interleaved Format, saturating
+ * @param in one source plane per channel
+ * @param out interleaved destination, frames * channels samples
+ */
+template <typename Format>
+inline void interleave(const float* const* in, uint8_t* out, size_t channels,
+                       size_t frames) {
+  if constexpr (std::is_same_v<Format, S16>) {
+    interleaveInt16(in, (int16_t*)out, channels, frames);
+  } else {
+    forEachSample(channels, frames, [&](size_t i, size_t ch, size_t index) {
+      Format::fromFloat(in[ch][i], out + index * Format::BYTES);
+    });
+  }
+}
+
+template <typename Format>
+inline void interleave(const int32_t* const* in, uint8_t* out,
+                       size_t channels, size_t frames) {
+  forEachSample(channels, frames, [&](size_t i, size_t ch, size_t index) {
+    Format::fromQ31(in[ch][i], out + index * Format::BYTES);
+  });
+}
+
+/**
+ * Converts samples between two formats, keeping their layout; integers
+ * through Q1.31, anything involving float through float
+ * @param samples amount of samples, frames * channels when interleaved
+ */
+template <typename From, typename To>
+inline void convert(const uint8_t* in, uint8_t* out, size_t samples) {
+  if constexpr (std::is_same_v<From, To>) {
+    memcpy(out, in, samples * From::BYTES);
+  } else {
+    for (size_t i = 0; i < samples; i++) {
+      if constexpr (From::FLOAT || To::FLOAT) {
+        To::fromFloat(From::toFloat(in + i * From::BYTES),
+                      out + i * To::BYTES);
+      } else {
+        To::fromQ31(From::toQ31(in + i * From::BYTES), out + i * To::BYTES);
+      }
+    }
+  }
+}
+}  // namespace bell::dsp
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint32_t
+#include <algorithm>    // for max, find
+#include <tuple>        // for tuple, apply, get, tuple_element_t
+#include <type_traits>  // for is_base_of_v
+#include <vector>       // for vector
+
+#include "AudioTransform.h"  // for AudioTransform
+#include "StreamInfo.h"      // for StreamInfo, FixedStreamInfo
+
+namespace bell {
+/**
+ * Chain of transforms fixed at compile time, e.g.
+ * StaticPipeline<Gain, BiquadCascade, Compressor> for a product whose DSP
+ * never changes shape. The stages are held by value and called directly,
+ * without the per-transform virtual dispatch, plan and timing of
+ * AudioPipeline, so the compiler sees the whole chain at once.
+ *
+ * The chain is itself a transform: added to an AudioPipeline it makes a
+ * single stage of it. Stages are configured in code through get<I>(), or
+ * from the same JSON description as a dynamic pipeline with
+ * DSPGraph::build(). Stages with a quantum must all share it, the whole
+ * chain then runs on blocks of that size.
+ */
+template <typename... Stages>
+class StaticPipeline : public bell::AudioTransform {
+  static_assert((std::is_base_of_v<AudioTransform, Stages> && ...),
+                "Stages must be transforms");
+
+ public:
+  static constexpr size_t STAGE_COUNT = sizeof...(Stages);
+
+  StaticPipeline() { this->filterType = "static_pipeline"; }
+  ~StaticPipeline(){};
+
+  template <size_t I>
+  std::tuple_element_t<I, std::tuple<Stages...>>& get() {
+    return std::get<I>(stages);
+  }
+
+  // Every stage, in order, for code that configures them generically
+  std::vector<AudioTransform*> getStages() {
+    return std::apply(
+        [](auto&... stage) {
+          return std::vector<AudioTransform*>{&stage...};
+        },
+        stages);
+  }
+
+  void process(StreamInfo& data) override {
+    // Qualified calls, resolved at compile time
+    std::apply([&](auto&... stage) { (processStage(stage, data), ...); },
+               stages);
+  }
+
+  bool supportsFixedPoint() override {
+    return std::apply(
+        [](auto&... stage) { return (stage.supportsFixedPoint() && ...); },
+        stages);
+  }
+
+  void processFixed(FixedStreamInfo& data) override {
+    std::apply([&](auto&... stage) { (processFixedStage(stage, data), ...); },
+               stages);
+  }
+
+  // Stages get the rate of the one before them, like AudioPipeline's
+  void sampleRateChanged(uint32_t sampleRate) override {
+    std::apply(
+        [&](auto&... stage) {
+          ((stage.sampleRateChanged(sampleRate),
+            sampleRate = stage.getOutputRate(sampleRate)),
+           ...);
+        },
+        stages);
+  }
+
+  uint32_t getOutputRate(uint32_t inputRate) override {
+    std::apply(
+        [&](auto&... stage) {
+          ((inputRate = stage.getOutputRate(inputRate)), ...);
+        },
+        stages);
+    return inputRate;
+  }
+
+  int getOutputChannels(int inputChannels) override {
+    std::apply(
+        [&](auto&... stage) {
+          ((inputChannels = stage.getOutputChannels(inputChannels)), ...);
+        },
+        stages);
+    return inputChannels;
+  }
+
+  // Every channel a stage uses, or all of them if one has no channels
+  std::vector<int> getChannels() override {
+    std::vector<int> channels;
+    bool all = false;
+    std::apply(
+        [&](auto&... stage) {
+          (addChannels(stage.getChannels(), channels, all), ...);
+        },
+        stages);
+    return all ? std::vector<int>() : channels;
+  }
+
+  size_t getQuantum() override {
+    return std::apply(
+        [](auto&... stage) {
+          return std::max({(size_t)0, stage.getQuantum()...});
+        },
+        stages);
+  }
+
+  bool isIdentity() override {
+    return std::apply(
+        [](auto&... stage) { return (stage.isIdentity() && ...); }, stages);
+  }
+
+  bool keepsFormat() override {
+    return std::apply(
+        [](auto&... stage) { return (stage.keepsFormat() && ...); }, stages);
+  }
+
+  float calculateHeadroom() override {
+    return std::apply(
+        [](auto&... stage) {
+          return std::max({0.0f, stage.calculateHeadroom()...});
+        },
+        stages);
+  }
+
+ private:
+  std::tuple<Stages...> stages;
+
+  template <typename Stage>
+  static void processStage(Stage& stage, StreamInfo& data) {
+    stage.Stage::process(data);
+  }
+
+  template <typename Stage>
+  static void processFixedStage(Stage& stage, FixedStreamInfo& data) {
+    stage.Stage::processFixed(data);
+  }
+
+  static void addChannels(const std::vector<int>& stageChannels,
+                          std::vector<int>& channels, bool& all) {
+    all = all || stageChannels.empty();
+    for (int channel : stageChannels) {
+      if (std::find(channels.begin(), channels.end(), channel) ==
+          channels.end()) {
+        channels.push_back(channel);
+      }
+    }
+  }
+};
+}  // namespace bell
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <memory>
 #include <string>
 #include <vector>
@@ -8,8 +10,18 @@ namespace bell {
 enum class Channels { LEFT, RIGHT, LEFT_RIGHT };
 
 enum class SampleRate : uint32_t {
+  SR_8000 = 8000,
+  SR_11025 = 11025,
+  SR_16000 = 16000,
+  SR_22050 = 22050,
+  SR_24000 = 24000,
+  SR_32000 = 32000,
   SR_44100 = 44100,
   SR_48000 = 48000,
+  SR_88200 = 88200,
+  SR_96000 = 96000,
+  SR_176400 = 176400,
+  SR_192000 = 192000,
 };
 
 enum class BitWidth : uint32_t {
@@ -18,6 +30,31 @@ enum class BitWidth : uint32_t {
   BW_32 = 32,
 };
 
+// Layout of interleaved PCM as it travels between decoders, BellDSP and sinks
+enum class PcmFormat : uint8_t {
+  INT16,
+  // 24 significant bits, left-justified in 32-bit words (low byte unused)
+  INT24_IN_32,
+  INT32,
+  FLOAT32,
+};
+
+inline size_t pcmBytesPerSample(PcmFormat format) {
+  return format == PcmFormat::INT16 ? 2 : 4;
+}
+
+// Integer format carrying the given bit width
+inline PcmFormat pcmFormatFor(BitWidth bitWidth) {
+  switch (bitWidth) {
+    case BitWidth::BW_24:
+      return PcmFormat::INT24_IN_32;
+    case BitWidth::BW_32:
+      return PcmFormat::INT32;
+    default:
+      return PcmFormat::INT16;
+  }
+}
+
 typedef struct {
   float** data;
   BitWidth bitwidth;
@@ -25,4 +62,13 @@ typedef struct {
   SampleRate sampleRate;
   size_t numSamples;
 } StreamInfo;
+
+// Same as StreamInfo, for the fixed point pipeline. Samples are Q1.31
+typedef struct {
+  int32_t** data;
+  BitWidth bitwidth;
+  int numChannels;
+  SampleRate sampleRate;
+  size_t numSamples;
+} FixedStreamInfo;
 };  // namespace bell
\ No newline at end of file
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int64_t, uint16_t, uint32_t
+#include <deque>     // for deque
+#include <mutex>     // for mutex
+#include <string>    // for string
+
+#include "BellTask.h"  // for Task
+
+namespace bell {
+/**
+ * Shares one clock between the devices of a group, over UDP. One device
+ * hosts it, its wall clock becomes the group's; the others follow it and
+ * read the group time from their own monotonic clock, corrected for the
+ * offset and the drift they measure against the host.
+ *
+ * Following is NTP-like: every pollMs a request goes out with the local
+ * send time, the host stamps when it got it and when it replied, and the
+ * round trip gives an offset and a delay. Of the filterSamples latest, the
+ * one with the shortest round trip is the least skewed by queuing; a line
+ * fitted through the last driftSamples of those gives the offset at any
+ * time and the drift. On a LAN the error stays well under a millisecond.
+ *
+ * Chunks stamped, and PlaybackClock updated, with nowUs() play together on
+ * every device, see RTPReceiver::Config::timeSync.
+ */
+class TimeSync : public bell::Task {
+ public:
+  struct Config {
+    // IPv4 address of the host to follow, empty to host the group's clock
+    std::string host;
+    uint16_t port = 5010;
+    uint32_t pollMs = 250;
+    // Latest samples the shortest round trip is picked from
+    size_t filterSamples = 8;
+    // Picked samples the offset and drift are fitted over
+    size_t driftSamples = 64;
+    // Bound of the measured drift, in ppm
+    double maxDriftPpm = 500;
+    // Jump of the offset beyond which the fit starts over, e.g. when the
+    // host's clock is set
+    uint32_t resyncMs = 10;
+    // Time without replies after which the group time isn't trusted
+    uint32_t timeoutMs = 5000;
+  };
+
+  struct Stats {
+    bool synced = false;
+    // Round trip of the last picked sample
+    int64_t delayUs = 0;
+    // Last picked sample against the fit before it
+    int64_t errorUs = 0;
+    // Local clock against the host's, positive when the host runs fast
+    double driftPpm = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    // Requests answered, hosting
+    uint32_t served = 0;
+  };
+
+  TimeSync() : TimeSync(Config()) {}
+  TimeSync(const Config& config);
+  ~TimeSync();
+
+  /**
+   * Binds the port, or opens the socket to the host, and starts
+   * @returns false if the socket can't be set up or the host is invalid
+   */
+  bool start();
+  void stop();
+
+  bool isHost() const { return config.host.empty(); }
+  // A host is always synced, a follower from its first reply until timeout
+  bool isSynced();
+
+  // Group time in µs since the Unix epoch, the local wall clock until synced
+  int64_t nowUs();
+  // Group time at localNs, on bell::clock::nowNs()'s clock, in µs
+  int64_t toGroupUs(int64_t localNs);
+  // Local time a group time falls at, in ns of bell::clock::nowNs()
+  int64_t toLocalNs(int64_t groupUs);
+
+  Stats getStats();
+
+  // Host's wall clock, in ns since the Unix epoch
+  static int64_t wallNs();
+
+ private:
+  static constexpr uint8_t REQUEST = 1;
+  static constexpr uint8_t REPLY = 2;
+  // Longest wait on the socket, so stop() is noticed
+  static constexpr uint32_t MAX_WAIT_MS = 100;
+  // Shortest span the drift is fitted over
+  static constexpr int64_t DRIFT_BASELINE_NS = 2000000000;
+  const char* TAG = "TimeSync";
+
+  struct Sample {
+    // Local time halfway through the round trip
+    int64_t localNs;
+    // Group time minus local time
+    int64_t offsetNs;
+    int64_t delayNs;
+  };
+
+  Config config;
+  int sock = -1;
+
+  std::mutex syncMutex;
+  Stats stats;
+  // Fitted offset at fitNs and its slope, group ns per local ns minus 1
+  bool fitted = false;
+  int64_t fitNs = 0;
+  int64_t fitOffsetNs = 0;
+  double slope = 0;
+  int64_t lastReplyNs = 0;
+
+  // Task only
+  std::deque<Sample> latest;
+  std::deque<Sample> picked;
+  int64_t lastSentNs = 0;
+  // Send time of the last reply taken, older and repeated ones are dropped
+  int64_t lastEchoNs = 0;
+  int64_t lastPickedNs = 0;
+
+  void runTask() override;
+
+  void serve();
+  void sendRequest();
+  void receiveReplies();
+  void onSample(const Sample& sample);
+  // Fits the offset line through picked
+  void fit();
+  double offsetAtLocked(int64_t localNs);
+  bool isSyncedLocked();
+};
+}  // namespace bell
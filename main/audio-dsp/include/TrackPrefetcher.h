@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t
+#include <atomic>    // for atomic
+#include <memory>    // for shared_ptr, unique_ptr
+#include <mutex>     // for mutex
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioContainer.h"      // for AudioContainer
+#include "BaseCodec.h"           // for BaseCodec
+#include "BellTask.h"            // for Task
+#include "BufferedStream.h"      // for BufferedStream
+#include "CentralAudioBuffer.h"  // for CentralAudioBuffer
+#include "StreamInfo.h"          // for PcmFormat
+#include "WrappedSemaphore.h"    // for WrappedSemaphore
+
+namespace bell {
+/**
+ * Opens the next track while the current one is still playing, so the
+ * connection, container probing and the first frames are done by the time
+ * it ends. The first stageMs of audio are decoded into a staging area, which
+ * splice() writes into CentralAudioBuffer right behind the current track.
+ * The new track hash makes the buffer start a fresh chunk at the boundary.
+ */
+class TrackPrefetcher : public bell::Task {
+ public:
+  // The prefetched track, decoding continues from here after splice()
+  struct Track {
+    size_t hash;
+    std::shared_ptr<BufferedStream> stream;
+    std::unique_ptr<AudioContainer> container;
+    std::shared_ptr<BaseCodec> codec;
+  };
+
+  /**
+   * @param stageMs amount of audio decoded ahead
+   * @param bufferSize size of the next track's BufferedStream
+   */
+  TrackPrefetcher(uint32_t stageMs = 1000, uint32_t bufferSize = 32 * 1024);
+  ~TrackPrefetcher();
+
+  /**
+   * Starts fetching a track in the background, cancelling any previous one
+   * @param reader source of the track, see BufferedStream::open()
+   * @param trackHash hash the track is written to CentralAudioBuffer with
+   */
+  void prefetch(const BufferedStream::StreamReader& reader, size_t trackHash);
+  void prefetch(const std::string& url, size_t trackHash);
+
+  /**
+   * Blocks until staging finished, successfully or not
+   * @return false on timeout
+   */
+  bool waitStaged(uint32_t timeoutMs);
+
+  // Whether a track is staged and ready to be spliced
+  bool isStaged();
+
+  /**
+   * Writes the staged audio into buffer, applying the container's gapless
+   * trimming, and hands the track over. Blocks while the buffer is full.
+   * @param buffer buffer the current track is written to
+   * @param trackHash hash passed to prefetch()
+   * @returns the track, nullptr if it isn't the staged one or staging failed
+   */
+  std::unique_ptr<Track> splice(CentralAudioBuffer& buffer, size_t trackHash);
+
+  // Drops the prefetched track
+  void cancel();
+
+  /**
+   * Reader fetching url with HTTP range requests, so the stream can seek
+   */
+  static BufferedStream::StreamReader httpReader(const std::string& url);
+
+ private:
+  static constexpr uint32_t READ_SIZE = 4096;
+  // Consecutive frames failing to decode before staging gives up
+  static constexpr int MAX_FAILURES = 8;
+
+  uint32_t stageMs;
+  uint32_t bufferSize;
+
+  // Track being staged, so cancel() can unblock its stream
+  std::mutex pendingMutex;
+  Track* pending = nullptr;
+
+  bool active = false;
+  size_t hash = 0;
+  BufferedStream::StreamReader reader;
+
+  // Written by the task, read once staged is set
+  std::atomic<bool> staged = false;
+  bell::WrappedSemaphore stagedSem;
+  std::unique_ptr<Track> track;
+  std::vector<uint8_t> pcm;
+  uint32_t sampleRate = 44100;
+  uint8_t channels = 2;
+  PcmFormat format = PcmFormat::INT16;
+
+  void runTask() override;
+  void onStopRequested() override;
+  void stop();
+};
+}  // namespace bell
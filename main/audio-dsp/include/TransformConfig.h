@@ -99,6 +99,15 @@ class TransformConfig {
       return val;
   }
 
+  // True if a field read so far has several values, one per volume range
+  bool dependsOnVolume() {
+    for (auto& field : rawValues) {
+      if (field.second.size() > 1)
+        return true;
+    }
+    return false;
+  }
+
   std::vector<int> getChannels() {
     auto channel = getInt("channel", false, invalidInt);
 
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <memory>  // for shared_ptr
+#include <mutex>   // for mutex
+#include <vector>  // for vector
+
+class AudioSink;
+
+namespace bell {
+class AudioPipeline;
+class Gain;
+
+/**
+ * Single entry point for volume changes. Sinks with a codec volume
+ * (softwareVolumeControl false) get it through volumeChanged(), otherwise
+ * a Gain appended to the pipeline scales the samples. Either way the
+ * pipeline is only told, so transforms whose config varies with volume
+ * follow it and the others are left alone.
+ */
+class VolumeControl {
+ public:
+  struct Config {
+    // Software gain at the lowest step above 0, 0 mutes
+    float minDb = -60.0f;
+    // Ramp of the software gain, see Gain::setRampTime()
+    float rampMs = 20.0f;
+    // Channels the software gain applies to
+    std::vector<int> channels = {0, 1};
+  };
+
+  // The sink must outlive this
+  VolumeControl(std::shared_ptr<AudioPipeline> pipeline, AudioSink* sink)
+      : VolumeControl(pipeline, sink, Config()) {}
+  VolumeControl(std::shared_ptr<AudioPipeline> pipeline, AudioSink* sink,
+                const Config& config);
+
+  /**
+   * @param volume 0 to AudioTransform::VOLUME_STEPS - 1, as
+   * AudioPipeline::volumeUpdated()
+   */
+  void setVolume(int volume);
+  int getVolume() { return volume; }
+
+  bool usesHardwareVolume() { return softwareGain == nullptr; }
+
+ private:
+  Config config;
+  std::shared_ptr<AudioPipeline> pipeline;
+  AudioSink* sink;
+
+  // Only when the sink can't change volume itself
+  std::shared_ptr<Gain> softwareGain;
+
+  std::mutex accessMutex;
+  int volume = -1;
+};
+}  // namespace bell
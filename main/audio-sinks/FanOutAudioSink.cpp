@@ -0,0 +1,194 @@
+#include "FanOutAudioSink.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min, max
+
+#include "AudioPipeline.h"  // for AudioPipeline
+#include "BellDSP.h"        // for BellDSP
+#include "BellLogger.h"     // for BELL_LOG
+
+FanOutAudioSink::Output::Output(FanOutAudioSink* parent, AudioSink* sink,
+                                std::shared_ptr<bell::AudioPipeline> pipeline)
+    : bell::Task("fanout", 4096 * 2, 5, 0),
+      sink(sink),
+      pipeline(pipeline),
+      queue(parent->config.blocks),
+      parent(parent) {
+  // Feeds a sink, like the sinks' own tasks
+  this->scheduling.policy = Policy::AUDIO;
+  if (pipeline) {
+    dsp = std::make_unique<bell::BellDSP>(nullptr);
+    dsp->applyPipeline(pipeline);
+    work.resize(parent->config.blockSize *
+                std::max<size_t>(parent->config.dspCapacity, 1));
+  }
+}
+
+FanOutAudioSink::Output::~Output() {
+  stopTask();
+}
+
+void FanOutAudioSink::Output::runTask() {
+  Block* block;
+  while (queue.pop(block)) {
+    if (!block) {
+      // Called from the thread feeding the sink, as expected
+      sink->flush();
+      continue;
+    }
+    const uint8_t* data = block->data.data();
+    size_t size = block->size;
+    if (dsp) {
+      memcpy(work.data(), data, size);
+      size = dsp->process(work.data(), size, work.size(), parent->channels,
+                          parent->sampleRate, parent->format);
+      data = work.data();
+    }
+    sink->feedPCMFrames(data, size);
+
+    pendingBytes -= block->size;
+    parent->release(block);
+  }
+}
+
+FanOutAudioSink::FanOutAudioSink(const Config& config)
+    : config(config), freeBlocks(config.blocks), releasedSem(config.blocks) {
+  outputRate = sampleRate;
+  for (size_t i = 0; i < config.blocks; i++) {
+    blocks.push_back(std::make_unique<Block>());
+    blocks.back()->data.resize(config.blockSize);
+    freeBlocks.tryPush(blocks.back().get());
+  }
+}
+
+FanOutAudioSink::~FanOutAudioSink() {
+  std::scoped_lock lock(outputsMutex);
+  outputs.clear();
+}
+
+void FanOutAudioSink::addOutput(AudioSink* sink,
+                                std::shared_ptr<bell::AudioPipeline> pipeline) {
+  std::scoped_lock lock(outputsMutex);
+  outputs.push_back(std::make_unique<Output>(this, sink, pipeline));
+  outputs.back()->startTask();
+
+  // Software volume unless every child does it in hardware
+  softwareVolumeControl = false;
+  for (auto& output : outputs) {
+    softwareVolumeControl |= output->sink->softwareVolumeControl;
+  }
+}
+
+void FanOutAudioSink::release(Block* block) {
+  if (block->refs.fetch_sub(1) == 1) {
+    freeBlocks.tryPush(block);
+    releasedSem.give();
+  }
+}
+
+void FanOutAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  // Whole frames per block, pipelines drop partial ones
+  size_t blockBytes = config.blockSize / frameSize * frameSize;
+  while (bytes > 0) {
+    Block* block;
+    if (!freeBlocks.pop(block)) {
+      return;
+    }
+    block->size = std::min(bytes, blockBytes);
+    memcpy(block->data.data(), buffer, block->size);
+    buffer += block->size;
+    bytes -= block->size;
+
+    std::scoped_lock lock(outputsMutex);
+    if (outputs.empty()) {
+      freeBlocks.tryPush(block);
+      continue;
+    }
+    block->refs = outputs.size();
+    for (auto& output : outputs) {
+      output->pendingBytes += block->size;
+      // Never full, there are as many slots as blocks
+      output->queue.tryPush(block);
+    }
+  }
+}
+
+bool FanOutAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                                uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 16:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT16);
+    case 24:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT24_IN_32);
+    case 32:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT32);
+    default:
+      return false;
+  }
+}
+
+bool FanOutAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                                bell::PcmFormat format) {
+  if (channelCount == 0) {
+    return false;
+  }
+  // Blocks still queued are in the old format
+  while (freeBlocks.size() < blocks.size()) {
+    releasedSem.twait(100);
+  }
+
+  std::scoped_lock lock(outputsMutex);
+  bool accepted = true;
+  for (auto& output : outputs) {
+    if (output->pipeline && sampleRate != this->sampleRate) {
+      output->pipeline->sampleRateChanged(sampleRate);
+    }
+    if (!output->sink->setFormat(sampleRate, channelCount, format)) {
+      BELL_LOG(error, "FanOutAudioSink", "Output rejected %u Hz, %d channels",
+               sampleRate, channelCount);
+      accepted = false;
+    }
+  }
+
+  this->sampleRate = sampleRate;
+  this->channels = channelCount;
+  this->format = format;
+  frameSize = channelCount * bell::pcmBytesPerSample(format);
+  outputRate = sampleRate;
+  return accepted;
+}
+
+void FanOutAudioSink::volumeChanged(uint16_t volume) {
+  std::scoped_lock lock(outputsMutex);
+  for (auto& output : outputs) {
+    if (!output->sink->softwareVolumeControl) {
+      output->sink->volumeChanged(volume);
+    }
+  }
+}
+
+size_t FanOutAudioSink::queuedFrames() {
+  std::scoped_lock lock(outputsMutex);
+  size_t queued = 0;
+  for (auto& output : outputs) {
+    queued = std::max(queued, output->pendingBytes / frameSize +
+                                  output->sink->queuedFrames());
+  }
+  return queued;
+}
+
+void FanOutAudioSink::flush() {
+  std::scoped_lock lock(outputsMutex);
+  for (auto& output : outputs) {
+    Block* block;
+    while (output->queue.tryPop(block)) {
+      if (block) {
+        output->pendingBytes -= block->size;
+        release(block);
+      }
+    }
+    // Room for it, the queue was just emptied. Blocks fed after it are
+    // played once the sink dropped the older ones
+    output->queue.tryPush(nullptr);
+  }
+}
@@ -0,0 +1,129 @@
+#include "FileAudioSink.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+
+#include "BellLogger.h"    // for BELL_LOG
+#include "SampleFormat.h"  // for convert, S24_3, S24_4
+
+namespace {
+void writeLE(uint8_t* out, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = value >> (i * 8);
+  }
+}
+}  // namespace
+
+FileAudioSink::FileAudioSink(const std::string& path, Container container)
+    : container(container) {
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    BELL_LOG(error, "FileAudioSink", "Cannot create %s", path.c_str());
+    return;
+  }
+  if (container == Container::WAV) {
+    // Room for the header, written once the sizes are known
+    uint8_t header[WAV_HEADER_SIZE] = {};
+    fwrite(header, 1, sizeof(header), file);
+  }
+}
+
+FileAudioSink::~FileAudioSink() {
+  close();
+}
+
+void FileAudioSink::close() {
+  if (file == nullptr) {
+    return;
+  }
+  if (container == Container::WAV) {
+    // Chunks end on an even byte
+    if (dataBytes % 2) {
+      fputc(0, file);
+    }
+    writeHeader();
+  }
+  fclose(file);
+  file = nullptr;
+}
+
+bool FileAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                              uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 16:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT16);
+    case 24:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT24_IN_32);
+    case 32:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT32);
+    default:
+      return false;
+  }
+}
+
+bool FileAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                              bell::PcmFormat format) {
+  if (channelCount == 0) {
+    return false;
+  }
+  if (formatSet && dataBytes > 0 && container == Container::WAV &&
+      (sampleRate != this->sampleRate || channelCount != channels ||
+       format != this->format)) {
+    BELL_LOG(error, "FileAudioSink", "A WAV file takes a single format");
+    return false;
+  }
+  this->sampleRate = sampleRate;
+  this->channels = channelCount;
+  this->format = format;
+  this->outputRate = sampleRate;
+  size_t sampleSize = format == bell::PcmFormat::INT24_IN_32
+                          ? 3
+                          : bell::pcmBytesPerSample(format);
+  frameSize = sampleSize * channels;
+  formatSet = true;
+  return true;
+}
+
+void FileAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  if (file == nullptr || !formatSet) {
+    return;
+  }
+  if (format != bell::PcmFormat::INT24_IN_32) {
+    bytes -= bytes % frameSize;
+    dataBytes += fwrite(buffer, 1, bytes, file);
+    return;
+  }
+
+  // Left-justified, the top three bytes of each little-endian word
+  size_t samples = bytes / 4 / channels * channels;
+  packed.resize(samples * 3);
+  bell::dsp::convert<bell::dsp::S24_4, bell::dsp::S24_3>(buffer, packed.data(),
+                                                         samples);
+  dataBytes += fwrite(packed.data(), 1, packed.size(), file);
+}
+
+void FileAudioSink::writeHeader() {
+  if (!formatSet || fseek(file, 0, SEEK_SET) != 0) {
+    return;
+  }
+  // Sizes past 4 GiB are left at their maximum
+  uint32_t dataSize = (uint32_t)std::min<uint64_t>(
+      dataBytes, 0xFFFFFFFF - WAV_HEADER_SIZE + 8);
+  uint16_t sampleSize = frameSize / channels;
+
+  uint8_t header[WAV_HEADER_SIZE];
+  memcpy(header, "RIFF", 4);
+  writeLE(header + 4, dataSize + dataSize % 2 + WAV_HEADER_SIZE - 8, 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  writeLE(header + 16, 16, 4);
+  // PCM, or IEEE float
+  writeLE(header + 20, format == bell::PcmFormat::FLOAT32 ? 3 : 1, 2);
+  writeLE(header + 22, channels, 2);
+  writeLE(header + 24, sampleRate, 4);
+  writeLE(header + 28, sampleRate * frameSize, 4);
+  writeLE(header + 32, frameSize, 2);
+  writeLE(header + 34, sampleSize * 8, 2);
+  memcpy(header + 36, "data", 4);
+  writeLE(header + 40, dataSize, 4);
+  fwrite(header, 1, sizeof(header), file);
+}
@@ -0,0 +1,85 @@
+#include "IEC61937Packer.h"
+
+#include "AC3Container.h"  // for AC3Container
+
+using namespace bell;
+
+size_t IEC61937Packer::pack(const uint8_t* frame, size_t size,
+                            std::vector<uint8_t>& burst) {
+  AC3Container::FrameHeader header;
+  if (!AC3Container::parseFrameHeader(frame, size, header) ||
+      header.size > size) {
+    return 0;
+  }
+
+  if (!header.enhanced) {
+    pending.clear();
+    pendingBlocks = 0;
+    carrierRate = header.sampleRate;
+    return writeBurst(DataType::AC3, header.bsmod, frame, header.size,
+                      AC3_PERIOD, burst);
+  }
+
+  // Dependent substreams and other programs belong with the independent
+  // frame of substream 0 before them, a new one may close the burst
+  size_t written = 0;
+  bool main = header.independent && header.substream == 0;
+  if (main && pendingBlocks >= EAC3_BLOCKS) {
+    written = flush(burst);
+  }
+  if (pending.size() + header.size + PREAMBLE_SIZE > EAC3_PERIOD * 4) {
+    // Can't be carried, the burst is dropped
+    reset();
+  }
+  carrierRate = header.sampleRate * 4;
+  pending.insert(pending.end(), frame, frame + header.size);
+  pendingBlocks += main ? header.samples / 256 : 0;
+  return written;
+}
+
+size_t IEC61937Packer::flush(std::vector<uint8_t>& burst) {
+  size_t written = 0;
+  if (!pending.empty()) {
+    written = writeBurst(DataType::EAC3, 0, pending.data(), pending.size(),
+                         EAC3_PERIOD, burst);
+  }
+  reset();
+  return written;
+}
+
+void IEC61937Packer::reset() {
+  pending.clear();
+  pendingBlocks = 0;
+}
+
+size_t IEC61937Packer::writeBurst(DataType type, uint8_t bsmod,
+                                  const uint8_t* payload, size_t size,
+                                  size_t period, std::vector<uint8_t>& burst) {
+  // Two 16-bit words per carrier frame, zero stuffed past the payload
+  size_t burstSize = period * 4;
+  if (size + PREAMBLE_SIZE > burstSize) {
+    burst.clear();
+    return 0;
+  }
+  burst.assign(burstSize, 0);
+
+  // Pd counts bits for AC-3, bytes for E-AC-3
+  uint16_t words[4] = {
+      SYNC_A, SYNC_B, (uint16_t)((uint8_t)type | (bsmod & 0x07) << 8),
+      (uint16_t)(type == DataType::AC3 ? size * 8 : size)};
+  for (int i = 0; i < 4; i++) {
+    burst[i * 2] = words[i] & 0xFF;
+    burst[i * 2 + 1] = words[i] >> 8;
+  }
+
+  // The stream's big endian words become little endian samples
+  uint8_t* out = burst.data() + PREAMBLE_SIZE;
+  for (size_t i = 0; i + 1 < size; i += 2) {
+    out[i] = payload[i + 1];
+    out[i + 1] = payload[i];
+  }
+  if (size % 2) {
+    out[size] = payload[size - 1];
+  }
+  return burstSize;
+}
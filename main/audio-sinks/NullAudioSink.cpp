@@ -0,0 +1,102 @@
+#include "NullAudioSink.h"
+
+#include <algorithm>  // for min
+
+#include "BellClock.h"    // for nowNs
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "BellUtils.h"    // for BELL_SLEEP_MS
+
+NullAudioSink::NullAudioSink(const Config& config) : config(config) {}
+
+bool NullAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                              uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 16:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT16);
+    case 24:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT24_IN_32);
+    case 32:
+      return setFormat(sampleRate, channelCount, bell::PcmFormat::INT32);
+    default:
+      return false;
+  }
+}
+
+bool NullAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                              bell::PcmFormat format) {
+  if (sampleRate == 0 || channelCount == 0) {
+    return false;
+  }
+  if (sampleRate != outputRate) {
+    // What's queued plays at the old rate, gone by the time it matters
+    reset();
+  }
+  outputRate = sampleRate;
+  frameSize = bell::pcmBytesPerSample(format) * channelCount;
+  return true;
+}
+
+void NullAudioSink::reset() {
+  anchorFrames = 0;
+  lastFeedNs = 0;
+}
+
+uint64_t NullAudioSink::playedFrames(int64_t nowNs) {
+  uint64_t elapsed = (nowNs - anchorNs) * (double)outputRate / 1e9;
+  return std::min(elapsed, anchorFrames);
+}
+
+size_t NullAudioSink::queuedFrames() {
+  if (!config.realTime || anchorFrames == 0) {
+    return 0;
+  }
+  return anchorFrames - playedFrames(bell::clock::nowNs());
+}
+
+NullAudioSink::Stats NullAudioSink::getStats() {
+  std::scoped_lock lock(statsMutex);
+  return stats;
+}
+
+void NullAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  if (frameSize == 0) {
+    return;
+  }
+  int64_t nowNs = bell::clock::nowNs();
+  if (lastFeedNs != 0) {
+    intervals.record(nowNs - lastFeedNs);
+  }
+  lastFeedNs = nowNs;
+  uint64_t frames = bytes / frameSize;
+
+  uint64_t missing = 0;
+  if (config.realTime) {
+    if (anchorFrames > 0) {
+      uint64_t elapsed = (nowNs - anchorNs) * (double)outputRate / 1e9;
+      missing = elapsed > anchorFrames ? elapsed - anchorFrames : 0;
+    }
+    // Idle, or ran dry: the device starts over with these frames
+    if (anchorFrames == 0 || missing > 0) {
+      anchorNs = nowNs;
+      anchorFrames = 0;
+    }
+    anchorFrames += frames;
+
+    // Waits for room, as a full device would
+    uint64_t limit = (uint64_t)config.bufferMs * outputRate / 1000;
+    uint64_t queued = anchorFrames - playedFrames(nowNs);
+    if (queued > limit) {
+      int64_t waitMs = ((queued - limit) * 1000 + outputRate - 1) / outputRate;
+      BELL_SLEEP_MS(waitMs);
+    }
+  }
+
+  std::scoped_lock lock(statsMutex);
+  stats.frames += frames;
+  stats.feeds++;
+  if (missing > 0) {
+    stats.underruns++;
+    stats.underrunFrames += missing;
+    BELL_METRIC_COUNT("null.underruns", 1);
+  }
+}
@@ -0,0 +1,162 @@
+#include "OfflineRenderer.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for max, min
+#include <atomic>     // for atomic
+#include <chrono>     // for steady_clock, duration
+#include <exception>  // for exception
+#include <thread>     // for hardware_concurrency
+
+#include "AudioPipeline.h"       // for AudioPipeline
+#include "BellTask.h"            // for Task
+#include "EncodedAudioStream.h"  // for EncodedAudioStream
+#include "FileStream.h"          // for FileStream
+
+using namespace bell;
+
+namespace {
+// 8 channels of 32-bit samples
+constexpr size_t MAX_FRAME_SIZE = 32;
+
+// Runs a share of renderAll()'s jobs
+class RenderWorker : public bell::Task {
+ public:
+  RenderWorker(const std::function<void()>& work)
+      : bell::Task("render", 4096 * 16, 0, 0), work(work) {}
+  ~RenderWorker() { joinTask(); }
+
+ private:
+  std::function<void()> work;
+
+  void runTask() override { work(); }
+};
+}  // namespace
+
+OfflineRenderer::Result OfflineRenderer::render(const Job& job,
+                                                const Config& config) {
+  Result result;
+  auto started = std::chrono::steady_clock::now();
+  try {
+    EncodedAudioStream decoded;
+    FileStream::Config fileConfig;
+    fileConfig.mmap = true;
+    if (!decoded.openWithStream(
+            std::make_unique<FileStream>(job.input, fileConfig))) {
+      result.error = "Unsupported format";
+      return result;
+    }
+    result.codec = decoded.getCodec();
+    FileAudioSink sink(job.output, job.container);
+    if (!sink.isOpen()) {
+      result.error = "Cannot create " + job.output;
+      return result;
+    }
+
+    // Whatever comes out of the pipeline, in the format it comes out
+    bool formatSet = false;
+    uint8_t outChannels = 0;
+    PcmFormat outFormat = PcmFormat::INT16;
+    auto write = [&](const uint8_t* data, size_t bytes, int channels,
+                     uint32_t sampleRate, PcmFormat format) {
+      if (!formatSet || sampleRate != result.sampleRate ||
+          channels != outChannels || format != outFormat) {
+        result.sampleRate = sampleRate;
+        outChannels = channels;
+        outFormat = format;
+        formatSet = sink.setFormat(sampleRate, channels, format);
+        if (!formatSet) {
+          result.error = "Unsupported output format";
+        }
+      }
+      if (formatSet) {
+        sink.feedPCMFrames(data, bytes);
+      }
+    };
+
+    std::shared_ptr<AudioPipeline> pipeline =
+        job.makePipeline ? job.makePipeline() : nullptr;
+    std::unique_ptr<BellDSP> dsp;
+    if (pipeline != nullptr) {
+      BellDSP::EngineConfig engine = config.engine;
+      engine.silenceBypassMs = 0;
+      dsp = std::make_unique<BellDSP>(nullptr, engine);
+      dsp->applyPipeline(pipeline);
+      dsp->setTap(BellDSP::TapPoint::POST_DSP, write);
+    }
+
+    std::vector<uint8_t> block(config.blockBytes *
+                               std::max<size_t>(config.dspCapacity, 1));
+    // Bytes of a partial frame, carried over to the next block
+    size_t carry = 0;
+    uint32_t inputRate = 0;
+    while (result.error.empty()) {
+      size_t bytes =
+          carry + decoded.read(block.data() + carry, config.blockBytes - carry);
+      uint32_t sampleRate = decoded.getSampleRate();
+      int channels = decoded.getChannelCount();
+      PcmFormat format = decoded.getPcmFormat();
+      size_t frameSize = pcmBytesPerSample(format) * channels;
+      if (bytes == carry || sampleRate == 0 || frameSize == 0 ||
+          frameSize > MAX_FRAME_SIZE) {
+        break;
+      }
+      size_t frames = bytes / frameSize;
+      carry = bytes - frames * frameSize;
+      result.audioSeconds += (double)frames / sampleRate;
+
+      // Set aside, the output may be longer than the input
+      uint8_t rest[MAX_FRAME_SIZE];
+      memcpy(rest, block.data() + frames * frameSize, carry);
+      if (dsp == nullptr) {
+        write(block.data(), frames * frameSize, channels, sampleRate, format);
+      } else {
+        if (sampleRate != inputRate) {
+          pipeline->sampleRateChanged(sampleRate);
+          inputRate = sampleRate;
+        }
+        dsp->process(block.data(), frames * frameSize, block.size(), channels,
+                     sampleRate, format);
+      }
+      memcpy(block.data(), rest, carry);
+    }
+
+    sink.close();
+    result.frames = sink.getFrames();
+    result.ok = result.error.empty();
+  } catch (std::exception& e) {
+    result.error = e.what();
+  }
+  result.renderSeconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - started)
+          .count();
+  return result;
+}
+
+std::vector<OfflineRenderer::Result> OfflineRenderer::renderAll(
+    const std::vector<Job>& jobs, const Config& config) {
+  std::vector<Result> results(jobs.size());
+  std::atomic<size_t> next = 0;
+  auto work = [&]() {
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+      results[i] = render(jobs[i], config);
+    }
+  };
+
+  size_t threads = config.threads;
+  if (threads == 0) {
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  threads = std::min(threads, jobs.size());
+
+  std::vector<std::unique_ptr<RenderWorker>> workers;
+  for (size_t i = 1; i < threads; i++) {
+    auto worker = std::make_unique<RenderWorker>(work);
+    if (worker->startTask()) {
+      workers.push_back(std::move(worker));
+    }
+  }
+  work();
+  // Joined by their destructors
+  workers.clear();
+  return results;
+}
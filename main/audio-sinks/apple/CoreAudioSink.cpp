@@ -0,0 +1,245 @@
+#include "CoreAudioSink.h"
+
+#include <stdio.h>    // for printf
+#include <string.h>   // for memset
+#include <unistd.h>   // for getpid
+#include <algorithm>  // for max, min
+
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "BellTrace.h"    // for BELL_TRACE_SCOPE
+
+// kAudioObjectPropertyElementMain, named Master before macOS 12
+static constexpr AudioObjectPropertyElement MAIN_ELEMENT = 0;
+
+// Reads an output scope property of device, 0 if it has none
+template <typename T>
+static T getDeviceProperty(AudioDeviceID device,
+                           AudioObjectPropertySelector selector) {
+  AudioObjectPropertyAddress address = {
+      selector, kAudioObjectPropertyScopeOutput, MAIN_ELEMENT};
+  T value = 0;
+  UInt32 size = sizeof(value);
+  if (AudioObjectGetPropertyData(device, &address, 0, NULL, &size, &value) !=
+      noErr) {
+    return 0;
+  }
+  return value;
+}
+
+template <typename T>
+static bool setDeviceProperty(AudioDeviceID device,
+                              AudioObjectPropertySelector selector, T value) {
+  AudioObjectPropertyAddress address = {
+      selector, kAudioObjectPropertyScopeOutput, MAIN_ELEMENT};
+  return AudioObjectSetPropertyData(device, &address, 0, NULL, sizeof(value),
+                                    &value) == noErr;
+}
+
+CoreAudioSink::CoreAudioSink(const Config& config)
+    : config(config), freeSem(1) {
+  this->setParams(44100, 2, 16);
+}
+
+CoreAudioSink::~CoreAudioSink() {
+  closeUnit();
+}
+
+bool CoreAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                              uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 32:
+      return openUnit(sampleRate, channelCount, false, 4);
+    case 24:
+      // Packed, as PortAudioSink's paInt24
+      return openUnit(sampleRate, channelCount, false, 3);
+    case 16:
+      return openUnit(sampleRate, channelCount, false, 2);
+    default:
+      return false;
+  }
+}
+
+bool CoreAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                              bell::PcmFormat format) {
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return openUnit(sampleRate, channelCount, false, 2);
+    case bell::PcmFormat::INT24_IN_32:
+    case bell::PcmFormat::INT32:
+      // Left-justified 24-bit plays as is through a 32-bit stream
+      return openUnit(sampleRate, channelCount, false, 4);
+    case bell::PcmFormat::FLOAT32:
+      return openUnit(sampleRate, channelCount, true, 4);
+  }
+  return false;
+}
+
+void CoreAudioSink::closeUnit() {
+  if (unit) {
+    // Returns once the render callback is done with the ring
+    AudioOutputUnitStop(unit);
+    AudioUnitUninitialize(unit);
+    AudioComponentInstanceDispose(unit);
+    unit = nullptr;
+  }
+  if (hogging) {
+    setDeviceProperty<pid_t>(device, kAudioDevicePropertyHogMode, -1);
+    hogging = false;
+  }
+  device = kAudioObjectUnknown;
+}
+
+bool CoreAudioSink::openUnit(uint32_t sampleRate, uint8_t channelCount,
+                             bool isFloat, size_t sampleSize) {
+  closeUnit();
+
+  AudioComponentDescription description = {};
+  description.componentType = kAudioUnitType_Output;
+  description.componentSubType = kAudioUnitSubType_DefaultOutput;
+  description.componentManufacturer = kAudioUnitManufacturer_Apple;
+  AudioComponent component = AudioComponentFindNext(NULL, &description);
+  if (component == NULL ||
+      AudioComponentInstanceNew(component, &unit) != noErr) {
+    printf("CoreAudio: Default output unit not found!\n");
+    unit = nullptr;
+    return false;
+  }
+
+  frameSize = channelCount * sampleSize;
+  AudioStreamBasicDescription format = {};
+  format.mSampleRate = sampleRate;
+  format.mFormatID = kAudioFormatLinearPCM;
+  format.mFormatFlags =
+      (isFloat ? kAudioFormatFlagIsFloat : kAudioFormatFlagIsSignedInteger) |
+      kAudioFormatFlagIsPacked;
+  format.mFramesPerPacket = 1;
+  format.mChannelsPerFrame = channelCount;
+  format.mBitsPerChannel = sampleSize * 8;
+  format.mBytesPerFrame = frameSize;
+  format.mBytesPerPacket = frameSize;
+
+  AURenderCallbackStruct callback = {renderCallback, this};
+  UInt32 size = sizeof(device);
+  OSStatus err = AudioUnitSetProperty(unit, kAudioUnitProperty_StreamFormat,
+                                      kAudioUnitScope_Input, 0, &format,
+                                      sizeof(format));
+  if (err == noErr) {
+    err = AudioUnitSetProperty(unit, kAudioUnitProperty_SetRenderCallback,
+                               kAudioUnitScope_Input, 0, &callback,
+                               sizeof(callback));
+  }
+  if (err == noErr) {
+    err = AudioUnitGetProperty(unit, kAudioOutputUnitProperty_CurrentDevice,
+                               kAudioUnitScope_Global, 0, &device, &size);
+  }
+  if (err != noErr) {
+    printf("CoreAudio: Unsupported format, error %d\n", (int)err);
+    closeUnit();
+    return false;
+  }
+
+  configureDevice(sampleRate);
+
+  size_t ringFrames = std::max<size_t>(
+      (size_t)sampleRate * config.ringMs / 1000, config.bufferFrames);
+  ring = std::make_unique<bell::CircularBuffer>(
+      ringFrames * frameSize, bell::CircularBuffer::Mode::SPSC);
+  playing = false;
+
+  err = AudioUnitInitialize(unit);
+  if (err == noErr) {
+    err = AudioOutputUnitStart(unit);
+  }
+  if (err != noErr) {
+    printf("CoreAudio: Cannot start the output unit, error %d\n", (int)err);
+    closeUnit();
+    return false;
+  }
+  outputRate = sampleRate;
+  return true;
+}
+
+void CoreAudioSink::configureDevice(uint32_t sampleRate) {
+  if (config.exclusive) {
+    hogging =
+        setDeviceProperty<pid_t>(device, kAudioDevicePropertyHogMode, getpid());
+  }
+  if (config.matchDeviceRate) {
+    // Devices that can't keep the unit resampling
+    setDeviceProperty<Float64>(device, kAudioDevicePropertyNominalSampleRate,
+                               sampleRate);
+  }
+  if (config.bufferFrames > 0) {
+    setDeviceProperty<UInt32>(device, kAudioDevicePropertyBufferFrameSize,
+                              config.bufferFrames);
+  }
+
+  // What a frame rendered now waits for, in frames of the device
+  UInt32 frames =
+      getDeviceProperty<UInt32>(device, kAudioDevicePropertyBufferFrameSize) +
+      getDeviceProperty<UInt32>(device, kAudioDevicePropertySafetyOffset) +
+      getDeviceProperty<UInt32>(device, kAudioDevicePropertyLatency);
+  Float64 deviceRate =
+      getDeviceProperty<Float64>(device, kAudioDevicePropertyNominalSampleRate);
+  deviceFrames = deviceRate > 0 ? (size_t)(frames * sampleRate / deviceRate)
+                                : frames;
+}
+
+OSStatus CoreAudioSink::renderCallback(void* userData,
+                                       AudioUnitRenderActionFlags* flags,
+                                       const AudioTimeStamp* timeStamp,
+                                       UInt32 bus, UInt32 frameCount,
+                                       AudioBufferList* data) {
+  CoreAudioSink* self = static_cast<CoreAudioSink*>(userData);
+  uint8_t* output = static_cast<uint8_t*>(data->mBuffers[0].mData);
+  size_t wanted = std::min<size_t>(frameCount * self->frameSize,
+                                   data->mBuffers[0].mDataByteSize);
+  // Whole frames only, the rest of one may still be on its way
+  size_t available = self->ring->size() / self->frameSize * self->frameSize;
+  size_t read = self->ring->read(output, std::min(wanted, available));
+  // Underrun, play silence rather than stopping
+  memset(output + read, 0, wanted - read);
+  if (read < wanted && self->playing) {
+    // Once per dropout, not for every callback of a stopped stream
+    BELL_METRIC_COUNT("sink.underruns", 1);
+  }
+  self->playing = read == wanted;
+  if (read > 0) {
+    self->freeSem.give();
+  } else {
+    *flags |= kAudioUnitRenderAction_OutputIsSilence;
+  }
+  return noErr;
+}
+
+size_t CoreAudioSink::queuedFrames() {
+  if (!unit)
+    return 0;
+  return ring->size() / frameSize + deviceFrames;
+}
+
+void CoreAudioSink::flush() {
+  if (!unit)
+    return;
+  // Returns once the render callback is done with the ring
+  AudioOutputUnitStop(unit);
+  ring->emptyBuffer();
+  playing = false;
+  AudioOutputUnitStart(unit);
+}
+
+void CoreAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  BELL_TRACE_SCOPE("sink.feed");
+  if (!unit)
+    return;
+
+  while (bytes > 0) {
+    size_t written = ring->write(buffer, bytes);
+    buffer += written;
+    bytes -= written;
+    if (bytes > 0 && written == 0) {
+      // The timeout covers a device that went away
+      freeSem.twait(100);
+    }
+  }
+}
@@ -4,26 +4,65 @@
 #include "freertos/ringbuf.h"
 #include "freertos/task.h"
 
-RingbufHandle_t dataBuffer;
+#include "BellHotPath.h"  // for BELL_HOT
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "BellTrace.h"    // for BELL_TRACE_SCOPE
 
-static void i2sFeed(void* pvParameters) {
+// How long the idle feed task takes to notice a flush
+static const TickType_t FLUSH_POLL_TICKS = pdMS_TO_TICKS(20) + 1;
+
+void BELL_HOT BufferedAudioSink::i2sFeed(void* pvParameters) {
+  BufferedAudioSink* self = (BufferedAudioSink*)pvParameters;
   while (true) {
+    if (self->flushDone != self->flushRequested) {
+      self->drop();
+    }
     size_t itemSize;
-    char* item = (char*)xRingbufferReceiveUpTo(dataBuffer, &itemSize,
-                                               portMAX_DELAY, 512);
+    char* item =
+        (char*)xRingbufferReceiveUpTo(self->dataBuffer, &itemSize, 0, 512);
+    if (item == NULL) {
+      // The DMA buffers play out what they hold, then silence
+      BELL_METRIC_COUNT("i2s.ring_empty", 1);
+    }
+    while (item == NULL && self->flushDone == self->flushRequested) {
+      item = (char*)xRingbufferReceiveUpTo(self->dataBuffer, &itemSize,
+                                           FLUSH_POLL_TICKS, 512);
+    }
+    if (item != NULL && self->flushDone != self->flushRequested) {
+      // Received before the flush, it's stale
+      vRingbufferReturnItem(self->dataBuffer, (void*)item);
+      continue;
+    }
     if (item != NULL) {
+      self->inFlight = itemSize;
       size_t written = 0;
       while (written < itemSize) {
-        i2s_write((i2s_port_t)0, item, itemSize, &written, portMAX_DELAY);
+        i2s_write((i2s_port_t)self->i2sPort, item, itemSize, &written,
+                  portMAX_DELAY);
       }
-      vRingbufferReturnItem(dataBuffer, (void*)item);
+      self->inFlight = 0;
+      vRingbufferReturnItem(self->dataBuffer, (void*)item);
     }
   }
 }
 
+void BufferedAudioSink::drop() {
+  uint32_t requested = flushRequested;
+  size_t itemSize;
+  void* item;
+  while ((item = xRingbufferReceiveUpTo(dataBuffer, &itemSize, 0,
+                                        dataBufferSize)) != NULL) {
+    vRingbufferReturnItem(dataBuffer, item);
+  }
+  // Plays silence until the next write instead of what the DMA holds
+  i2s_zero_dma_buffer((i2s_port_t)i2sPort);
+  flushDone = requested;
+}
+
 void BufferedAudioSink::startI2sFeed(size_t buf_size) {
   dataBuffer = xRingbufferCreate(buf_size, RINGBUF_TYPE_BYTEBUF);
-  xTaskCreatePinnedToCore(&i2sFeed, "i2sFeed", 4096, NULL, 10, NULL,
+  dataBufferSize = buf_size;
+  xTaskCreatePinnedToCore(&i2sFeed, "i2sFeed", 4096, this, 10, NULL,
                           tskNO_AFFINITY);
 }
 
@@ -33,13 +72,53 @@ void BufferedAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
 
 void BufferedAudioSink::feedPCMFramesInternal(const void* pvItem,
                                               size_t xItemSize) {
+  BELL_TRACE_SCOPE("sink.feed");
   xRingbufferSend(dataBuffer, pvItem, xItemSize, portMAX_DELAY);
 }
 
+void BufferedAudioSink::flush() {
+  if (!dataBuffer) {
+    return;
+  }
+  uint32_t requested = ++flushRequested;
+  // Nothing refills the ringbuffer meanwhile, feedPCMFrames() runs on this
+  // task. Bounded in case the feed task is stuck in i2s_write()
+  for (TickType_t waited = 0;
+       flushDone != requested && waited < 10 * FLUSH_POLL_TICKS; waited++) {
+    vTaskDelay(1);
+  }
+}
+
 bool BufferedAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
                                   uint8_t bitDepth) {
   // TODO override this for sinks with custom mclk
-  i2s_set_clk((i2s_port_t)0, sampleRate, (i2s_bits_per_sample_t)bitDepth,
+  i2s_set_clk((i2s_port_t)i2sPort, sampleRate, (i2s_bits_per_sample_t)bitDepth,
               (i2s_channel_t)channelCount);
+  outputRate = sampleRate;
+  // 24-bit samples sit in 32-bit slots, in the buffer as on the bus
+  size_t slotBytes = bitDepth == 24 ? 4 : bitDepth / 8;
+  frameSize = channelCount * slotBytes;
   return true;
+}
+
+size_t BufferedAudioSink::queuedFrames() {
+  if (!dataBuffer) {
+    return 0;
+  }
+  size_t buffered = dataBufferSize - xRingbufferGetCurFreeSize(dataBuffer);
+  return (buffered + inFlight) / frameSize + dmaFrames;
+}
+
+bool BufferedAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                                  bell::PcmFormat format) {
+  // I2S slots are MSB first, so left-justified 24-bit goes out as 32-bit
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return setParams(sampleRate, channelCount, 16);
+    case bell::PcmFormat::INT24_IN_32:
+    case bell::PcmFormat::INT32:
+      return setParams(sampleRate, channelCount, 32);
+    default:
+      return false;
+  }
 }
\ No newline at end of file
@@ -6,6 +6,9 @@ struct es8388_cmd_s {
 };
 
 ES8388AudioSink::ES8388AudioSink() {
+  // Handled by the DAC volume registers, see volumeChanged()
+  softwareVolumeControl = false;
+
   // configure i2c
   i2c_config = {
       .mode = I2C_MODE_MASTER,
@@ -66,6 +69,11 @@ ES8388AudioSink::ES8388AudioSink() {
     ESP_LOGE("OI", "i2c master start error: %d", err);
   }
 
+  // 7-bit address, the chip increments the register on sequential writes
+  codec_regs_init(&regs, I2C_NUM_0, ES8388_ADDR >> 1, 1, true);
+  // The whole sequence below goes out as one transaction
+  codec_regs_begin(&regs);
+
   /* mute DAC during setup, power up all systems, slave mode */
   writeReg(ES8388_DACCONTROL3, 0x04);
   writeReg(ES8388_CONTROL2, 0x50);
@@ -116,30 +124,67 @@ ES8388AudioSink::ES8388AudioSink() {
   writeReg(ES8388_DACCONTROL27, 0x1e);
 
   /* power up and enable DAC; power up ADC (no MIC bias) */
-  writeReg(ES8388_DACPOWER, 0x3c);
+  writeReg(ES8388_DACPOWER, dacPower);
   writeReg(ES8388_DACCONTROL3, 0x00);
   writeReg(ES8388_ADCPOWER, 0x00);
+  codec_regs_commit(&regs);
 
   startI2sFeed();
 }
 
 void ES8388AudioSink::writeReg(uint8_t reg_add, uint8_t data) {
-
-  int res = 0;
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-  res |= i2c_master_start(cmd);
-  res |= i2c_master_write_byte(cmd, ES8388_ADDR, ACK_CHECK_EN);
-  res |= i2c_master_write_byte(cmd, reg_add, ACK_CHECK_EN);
-  res |= i2c_master_write_byte(cmd, data, ACK_CHECK_EN);
-  res |= i2c_master_stop(cmd);
-  res |= i2c_master_cmd_begin(I2C_NUM_0, cmd, 1000 / portTICK_PERIOD_MS);
-  i2c_cmd_link_delete(cmd);
-
+  // Dropped when unchanged, queued within codec_regs_begin() / commit()
+  esp_err_t res = codec_regs_write(&regs, reg_add, data);
   if (res != ESP_OK) {
     ESP_LOGE("RR", "Unable to write to ES8388: %d", res);
-  } else {
-    ESP_LOGE("RR", "register successfull written.");
   }
 }
 
+void ES8388AudioSink::mute(const ES8388_OUT out, const bool muted) {
+  switch (out) {
+    case ES_MAIN:
+      writeReg(ES8388_DACCONTROL3, muted ? 0x04 : 0x00);
+      return;
+    case ES_OUT1:
+      // LOUT1 / ROUT1 power
+      dacPower = muted ? dacPower & ~0x30 : dacPower | 0x30;
+      break;
+    case ES_OUT2:
+      dacPower = muted ? dacPower & ~0x0c : dacPower | 0x0c;
+      break;
+  }
+  writeReg(ES8388_DACPOWER, dacPower);
+}
+
+void ES8388AudioSink::volume(const ES8388_OUT out, const uint8_t vol) {
+  uint8_t value;
+  switch (out) {
+    case ES_MAIN:
+      // 0dB down to -96dB, in 0.5dB steps
+      value = (100 - std::min(vol, (uint8_t)100)) * 0xc0 / 100;
+      writeReg(ES8388_DACCONTROL4, value);
+      writeReg(ES8388_DACCONTROL5, value);
+      break;
+    case ES_OUT1:
+      // -45dB up to +4.5dB, in 1.5dB steps
+      value = std::min(vol, (uint8_t)100) * 0x21 / 100;
+      writeReg(ES8388_DACCONTROL24, value);
+      writeReg(ES8388_DACCONTROL25, value);
+      break;
+    case ES_OUT2:
+      value = std::min(vol, (uint8_t)100) * 0x21 / 100;
+      writeReg(ES8388_DACCONTROL26, value);
+      writeReg(ES8388_DACCONTROL27, value);
+      break;
+  }
+}
+
+void ES8388AudioSink::volumeChanged(uint16_t volume) {
+  // Both channels and the mute in one transaction
+  codec_regs_begin(&regs);
+  this->volume(ES_MAIN, volume * 100 / MAX_VOLUME);
+  mute(ES_MAIN, volume == 0);
+  codec_regs_commit(&regs);
+}
+
 ES8388AudioSink::~ES8388AudioSink() {}
@@ -0,0 +1,199 @@
+#include "I2SChannelAudioSink.h"
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+
+#include <string.h>   // for memset
+#include <algorithm>  // for min
+
+#include "BellHotPath.h"  // for BELL_HOT
+#include "BellTrace.h"    // for BELL_TRACE_SCOPE
+#include "esp_log.h"
+
+static const char* TAG = "I2SChannelAudioSink";
+
+I2SChannelAudioSink::I2SChannelAudioSink(const Config& config)
+    : config(config) {
+  outputRate = 44100;
+#ifdef BELL_METRICS
+  underruns = &bell::Metrics::counter("sink.underruns");
+#endif
+  ring = std::make_unique<bell::CircularBuffer>(
+      config.ringSize, bell::CircularBuffer::Mode::SPSC);
+
+  i2s_chan_config_t chanConfig =
+      I2S_CHANNEL_DEFAULT_CONFIG(config.port, I2S_ROLE_MASTER);
+  chanConfig.dma_desc_num = config.dmaDescNum;
+  chanConfig.dma_frame_num = config.dmaFrameNum;
+  // Would wipe what onSent() just wrote, silence is written there instead
+  chanConfig.auto_clear = false;
+  esp_err_t err = i2s_new_channel(&chanConfig, &channel, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot create the I2S channel: %s", esp_err_to_name(err));
+    channel = nullptr;
+    return;
+  }
+
+  i2s_std_config_t stdConfig = {
+      .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(44100),
+      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT,
+                                                      I2S_SLOT_MODE_STEREO),
+      .gpio_cfg =
+          {
+              .mclk = config.mclk,
+              .bclk = config.bclk,
+              .ws = config.ws,
+              .dout = config.dout,
+              .din = I2S_GPIO_UNUSED,
+              .invert_flags = {},
+          },
+  };
+  i2s_channel_init_std_mode(channel, &stdConfig);
+
+  i2s_event_callbacks_t callbacks = {};
+  callbacks.on_sent = onSent;
+  i2s_channel_register_event_callback(channel, &callbacks, this);
+
+  enabled = i2s_channel_enable(channel) == ESP_OK;
+}
+
+I2SChannelAudioSink::~I2SChannelAudioSink() {
+  if (channel) {
+    if (enabled) {
+      i2s_channel_disable(channel);
+    }
+    i2s_del_channel(channel);
+  }
+}
+
+bool BELL_HOT I2SChannelAudioSink::onSent(i2s_chan_handle_t handle,
+                                          i2s_event_data_t* event,
+                                          void* userContext) {
+  I2SChannelAudioSink* self = (I2SChannelAudioSink*)userContext;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 4, 0)
+  uint8_t* dma = (uint8_t*)event->dma_buf;
+#else
+  // Points to the descriptor's buffer pointer before IDF 5.4
+  uint8_t* dma = *(uint8_t**)event->data;
+#endif
+
+  // The buffer just went out, it's sent again after the others
+  size_t available = self->ring->size() / self->frameSize * self->frameSize;
+  size_t read = self->ring->read(dma, std::min(event->size, available));
+  memset(dma + read, 0, event->size - read);
+#ifdef BELL_METRICS
+  if (read < event->size && self->playing) {
+    self->underruns->add();
+  }
+  self->playing = read == event->size;
+#endif
+
+  BaseType_t woken = pdFALSE;
+  TaskHandle_t waiting = self->waiter;
+  if (read > 0 && waiting) {
+    vTaskNotifyGiveFromISR(waiting, &woken);
+  }
+  return woken == pdTRUE;
+}
+
+void I2SChannelAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  BELL_TRACE_SCOPE("sink.feed");
+  if (!enabled) {
+    return;
+  }
+  while (bytes > 0) {
+    waiter = xTaskGetCurrentTaskHandle();
+    size_t written = ring->write(buffer, bytes);
+    buffer += written;
+    bytes -= written;
+    if (bytes > 0 && written == 0) {
+      // Notified as soon as a DMA buffer took data, a period at most
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+  }
+  waiter = nullptr;
+}
+
+bool I2SChannelAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                                    uint8_t bitDepth) {
+  if (!channel || (channelCount != 1 && channelCount != 2) ||
+      (bitDepth != 16 && bitDepth != 24 && bitDepth != 32)) {
+    return false;
+  }
+
+  if (enabled) {
+    i2s_channel_disable(channel);
+    enabled = false;
+  }
+  // Queued frames are in the old format, feedPCMFrames() runs on this task
+  ring->emptyBuffer();
+  frameSize = channelCount * (bitDepth == 16 ? 2 : 4);
+  outputRate = sampleRate;
+
+  i2s_std_clk_config_t clkConfig = I2S_STD_CLK_DEFAULT_CONFIG(sampleRate);
+  i2s_std_slot_config_t slotConfig = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(
+      (i2s_data_bit_width_t)bitDepth,
+      channelCount == 1 ? I2S_SLOT_MODE_MONO : I2S_SLOT_MODE_STEREO);
+  if (bitDepth == 24) {
+    // 24-bit samples in 32-bit words
+    slotConfig.slot_bit_width = I2S_SLOT_BIT_WIDTH_32BIT;
+    clkConfig.mclk_multiple = I2S_MCLK_MULTIPLE_384;
+  }
+  if (i2s_channel_reconfig_std_clock(channel, &clkConfig) != ESP_OK ||
+      i2s_channel_reconfig_std_slot(channel, &slotConfig) != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot set %lu Hz, %d bits", (unsigned long)sampleRate,
+             bitDepth);
+    return false;
+  }
+  // Starts on silence instead of the old format's leftovers
+  return enable();
+}
+
+bool I2SChannelAudioSink::enable() {
+  size_t zeros = config.dmaDescNum * config.dmaFrameNum * frameSize;
+  uint8_t silence[256] = {};
+  size_t loaded = sizeof(silence);
+  while (zeros > 0 && loaded == sizeof(silence)) {
+    i2s_channel_preload_data(channel, silence,
+                             std::min(zeros, sizeof(silence)), &loaded);
+    zeros -= std::min(zeros, loaded);
+  }
+  enabled = i2s_channel_enable(channel) == ESP_OK;
+  return enabled;
+}
+
+size_t I2SChannelAudioSink::queuedFrames() {
+  if (!enabled) {
+    return 0;
+  }
+  return ring->size() / frameSize + config.dmaDescNum * config.dmaFrameNum;
+}
+
+void I2SChannelAudioSink::flush() {
+  if (!enabled) {
+    return;
+  }
+  // The interrupt is done with the ring once disabled
+  i2s_channel_disable(channel);
+  enabled = false;
+  ring->emptyBuffer();
+#ifdef BELL_METRICS
+  playing = false;
+#endif
+  enable();
+}
+
+bool I2SChannelAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                                    bell::PcmFormat format) {
+  // I2S slots are MSB first, so left-justified 24-bit goes out as 32-bit
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return setParams(sampleRate, channelCount, 16);
+    case bell::PcmFormat::INT24_IN_32:
+    case bell::PcmFormat::INT32:
+      return setParams(sampleRate, channelCount, 32);
+    default:
+      return false;
+  }
+}
+
+#endif
@@ -4,6 +4,7 @@
 InternalAudioSink::InternalAudioSink() {
   softwareVolumeControl = true;
   usign = true;
+  dmaFrames = 6 * 512;
 #ifdef I2S_MODE_DAC_BUILT_IN
 
   i2s_config_t i2s_config = {
@@ -2,9 +2,11 @@
 
 #include "driver/i2s.h"
 
+#include "BellHotPath.h"  // for BELL_HOT, BELL_HOT_DATA
+
 // See http://www.hardwarebook.info/S/PDIF for more info on this protocol
 // Conversion table to biphase code mark (LSB first, ending in 1)
-static const uint16_t bmc_convert[256] = {
+static const BELL_HOT_DATA uint16_t bmc_convert[256] = {
     0x3333, 0xb333, 0xd333, 0x5333, 0xcb33, 0x4b33, 0x2b33, 0xab33, 0xcd33,
     0x4d33, 0x2d33, 0xad33, 0x3533, 0xb533, 0xd533, 0x5533, 0xccb3, 0x4cb3,
     0x2cb3, 0xacb3, 0x34b3, 0xb4b3, 0xd4b3, 0x54b3, 0x32b3, 0xb2b3, 0xd2b3,
@@ -42,41 +44,145 @@ static const uint16_t bmc_convert[256] = {
 #define SPDIF_BUF_SIZE (BITS_PER_SUBFRAME / 8 * 2 * FRAMES_PER_BLOCK)
 #define SPDIF_BUF_ARRAY_SIZE (SPDIF_BUF_SIZE / sizeof(uint32_t))
 
-#define BMC_B 0x33173333  // block start
-#define BMC_M 0x331d3333  // left ch
-#define BMC_W 0x331b3333  // right ch
-#define BMC_MW_DIF (BMC_M ^ BMC_W)
+#define BMC_B 0x00170000  // block start
+#define BMC_M 0x001d0000  // left ch
+#define BMC_W 0x001b0000  // right ch
+#define BMC_ZEROS 0x3333  // four 0 bits
+#define BMC_VUCP 0x33000000      // valid, no subcode nor channel status
+#define BMC_VUCP_C 0x35000000    // channel status and parity bits set
+#define BMC_DATA_START 0x7fffffff  // clears the first cell of a word
 
 static uint32_t spdif_buf[SPDIF_BUF_ARRAY_SIZE];
 static uint32_t* spdif_ptr;
 
-static void spdif_buf_init(void) {
-  // first bllock has W preamble
-  spdif_buf[0] = BMC_B;
+static void spdif_buf_init(uint32_t sampleRate, uint8_t bitDepth,
+                           bool nonAudio) {
+  // Consumer channel status, one bit per frame and the same in both
+  // subframes, bits are numbered LSB first
+  uint8_t status[FRAMES_PER_BLOCK / 8] = {};
+  status[0] = 0x04;  // copying permitted
+  if (nonAudio) {
+    status[0] |= 0x02;  // IEC 61937 data, receivers mute their DAC
+  }
+  switch (sampleRate) {
+    case 32000:
+      status[3] = 0x03;
+      break;
+    case 48000:
+      status[3] = 0x02;
+      break;
+    case 88200:
+      status[3] = 0x08;
+      break;
+    case 96000:
+      status[3] = 0x0a;
+      break;
+    default:  // 44.1 kHz
+      break;
+  }
+  // 16 bits out of 20, or 24 out of 24. Not given for data bursts
+  if (!nonAudio) {
+    status[4] = bitDepth == 16 ? 0x02 : 0x0b;
+  }
 
-  // all other blocks are alternating M, then W preamble
-  uint32_t bmc_mw = BMC_M;
-  for (int i = 2; i < SPDIF_BUF_ARRAY_SIZE; i += 2) {
-    spdif_buf[i] = bmc_mw ^= BMC_MW_DIF;
+  for (int i = 0; i < SPDIF_BUF_ARRAY_SIZE; i += 2) {
+    // Each subframe starts with the VUCP bits of the previous one, then the
+    // preamble, then four aux and four audio bits which are zeros in 16-bit
+    int subframe = i / 2;
+    int previous = (subframe + FRAMES_PER_BLOCK * 2 - 1) / 2 % FRAMES_PER_BLOCK;
+    bool statusBit = status[previous / 8] & (1 << (previous % 8));
+    uint32_t preamble = subframe == 0 ? BMC_B : subframe % 2 ? BMC_W : BMC_M;
+    spdif_buf[i] = (statusBit ? BMC_VUCP_C : BMC_VUCP) | preamble | BMC_ZEROS;
+    spdif_buf[i + 1] = (BMC_ZEROS << 16) | BMC_ZEROS;
   }
 }
 
+/**
+ * What is this, and why does it work?
+ *
+ * Rather than assemble all S/PDIF frames from scratch we want to do the
+ * minimum amount of work possible. To that extent, we fix the final four
+ * bits (VUCP) to be all-zero prior to BMC encoding (= valid, no subcode or
+ * channel-status bits set, even parity), and zero the lowest 8 sample bits
+ * (prior to BMC encoding) in 16-bit. This is all done in spdif_buf_init(),
+ * aligning at word boundaries and setting alternating preambles as well as
+ * encoding 8 bits of zeros as 0x33, leaving the final bit high. A set
+ * channel-status bit comes with a set parity bit, so parity stays even.
+ *
+ * We must therefore BMC encode our PCM data in such a way that:
+ *  - the first (least significant) bit is 0 (to fit with 0x33 zeros, or
+ *    the preamble, which ends high as well)
+ *  - the final bit is 1 (so as to fit with the following 0x33 VUCP bits)
+ *  - the result has even parity
+ *
+ * As biphase mark code retains parity (0 encodes as two 1s or two 0s),
+ * this is evidently not possible without loss of data, as the input PCM
+ * data isn't already even parity. We can use the first (least significant)
+ * bit as parity bit to achieve our desired encoding.
+ *
+ * The bmc_convert table converts 8 bits of PCM into 16 bit biphase mark
+ * code patterns with the first two bits encoding the LSB and the final bit
+ * always high. Two of them make a 32 bit encoding of 16 bits of input data,
+ * by shifting the first (lower) 16 bit into position, then sign-extending
+ * the second (higher) 16bit pattern. If that pattern started with a 1, the
+ * resulting 32 bit pattern will now contain 1s in the first 16 bits.
+ *
+ * Keep in mind that the shifted value in the first (lower) 16 bits always
+ * ends in a 1 bit, so the entire pattern must be flipped in case the
+ * second (higher) 16 bit pattern starts with a 1 bit. XORing the sign-
+ * extended component to the first one achieves exactly that. In 24-bit
+ * the lowest 8 bits are encoded the same way in front of that word.
+ *
+ * Finally, we zero out the very first bit of the resulting value. This
+ * may change the lowest bit of our encoded value, but ensures that our
+ * newly encoded bits form a valid BMC pattern with the already zeroed out
+ * lower 8 bits in the pattern set up in spdif_buf_init().
+ *
+ * Further, this also happens to ensure even parity, without counting bits:
+ * All entries in the BMC table end in a 1, so an all-zero pattern would
+ * end (after encoding an even number of bits) in two 0 bits. Setting any
+ * bit will cause the BMC-encoded pattern to flip its first (lowest) bit,
+ * meaning we can use that bit to infer parity. Setting it to zero flips
+ * the first (lowest) bit such that we always have even parity.
+ *
+ * I did not come up with this, all credit goes to
+ * github.com/amedes/esp_a2dp_sink_spdif
+ */
+static inline uint32_t bmc_encode16(uint8_t lo, uint8_t hi) {
+  return ((uint32_t)bmc_convert[lo] << 16) ^
+         (uint32_t)(int32_t)(int16_t)bmc_convert[hi];
+}
+
 SPDIFAudioSink::SPDIFAudioSink(uint8_t spdifPin) {
-  // initialize S/PDIF buffer
-  spdif_buf_init();
-  spdif_ptr = spdif_buf;
   this->spdifPin = spdifPin;
-  this->setParams(44100, 16, 2);
+  // Encoded, a frame takes two subframes of two words, at twice the rate
+  frameSize = BITS_PER_SUBFRAME / 8 * 2;
+  dmaFrames = 8 * 512 / 2;
+  this->setParams(44100, 2, 16);
   startI2sFeed(SPDIF_BUF_SIZE * 16);
 }
 
 bool SPDIFAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
                                uint8_t bitDepth) {
-  if (bitDepth != 16 ||
-      channelCount != 2)  // TODO support mono playback and different bit widths
+  // TODO support mono playback
+  if (channelCount != 2 || (bitDepth != 16 && bitDepth != 24 && bitDepth != 32))
     return false;
+  return configure(sampleRate, bitDepth == 16 ? 16 : 24, false);
+}
+
+bool SPDIFAudioSink::setBitstream(uint32_t sampleRate) {
+  // Words go out in the upper 16 bits of 24-bit subframes, see
+  // feedPCMFrames(), so the bit sacrificed to parity is padding
+  return configure(sampleRate, 24, true);
+}
+
+bool SPDIFAudioSink::configure(uint32_t sampleRate, uint8_t bitDepth,
+                               bool bitstream) {
   int sample_rate = (int)sampleRate * 2;
   int bclk = sample_rate * 64 * 2;
+  // Up to 96 kHz, mclk can't go past the magic number
+  if (bclk > I2S_BUG_MAGIC)
+    return false;
   int mclk = (I2S_BUG_MAGIC / bclk) * bclk;
 
   i2s_config_t i2s_config = {
@@ -86,7 +192,7 @@ bool SPDIFAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
 #else
     .sample_rate = (int)sample_rate,
 #endif
-    .bits_per_sample = (i2s_bits_per_sample_t)(bitDepth * 2),
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
     .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
     .communication_format = I2S_COMM_FORMAT_STAND_I2S,
     .intr_alloc_flags = 0,
@@ -105,6 +211,13 @@ bool SPDIFAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
   i2s_driver_uninstall((i2s_port_t)0);
   int err = i2s_driver_install((i2s_port_t)0, &i2s_config, 0, nullptr);
   i2s_set_pin((i2s_port_t)0, &pin_config);
+
+  // A partly encoded block is dropped, it's in the old format
+  this->bitDepth = bitDepth;
+  this->bitstream = bitstream;
+  outputRate = sampleRate;
+  spdif_buf_init(sampleRate, bitDepth, bitstream);
+  spdif_ptr = spdif_buf;
   return !err;
 }
 
@@ -112,69 +225,64 @@ SPDIFAudioSink::~SPDIFAudioSink() {
   i2s_driver_uninstall((i2s_port_t)0);
 }
 
-int num_frames = 0;
-
-void SPDIFAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
-  for (int i = 0; i < bytes; i += 2) {
-    /**
-         * What is this, and why does it work?
-         *
-         * Rather than assemble all S/PDIF frames from scratch we want to do the
-         * minimum amount of work possible. To that extent, we fix the final four
-         * bits (VUCP) to be all-zero prior to BMC encoding (= valid, no subcode
-         * or channel-status bits set, even parity), and zero the lowest 8 sample
-         * bits (prior to BMC encoding). This is all done in spdif_buf_init(),
-         * aligning at word boundaries and setting alternating preambles as well
-         * as encoding 8 bits of zeros as 0x33, leaving the final bit high.
-         *
-         * We must therefore BMC encode our 16 bit PCM data in such a way that:
-         *  - the first (least significant) bit is 0 (to fit with 0x33 zeros)
-         *  - the final bit is 1 (so as to fit with the following 0x33 VUCP bits)
-         *  - the result has even parity
-         *
-         * As biphase mark code retains parity (0 encodes as two 1s or two 0s),
-         * this is evidently not possible without loss of data, as the input PCM
-         * data isn't already even parity. We can use the first (least significant)
-         * bit as parity bit to achieve our desired encoding.
-         * 
-         * The bmc_convert table converts the lower and upper 8 bit of our PCM
-         * frames into 16 bit biphase mark code patterns with the first two bits
-         * encoding the LSB and the final bit always high. We combine both 16bit
-         * patterns into a 32 bit encoding of our original input data by shifting
-         * the first (lower) 16 bit into position, then sign-extending the second
-         * (higher) 16bit pattern. If that pattern started with a 1, the resulting
-         * 32 bit pattern will now contain 1s in the first 16 bits.
-         *
-         * Keep in mind that the shifted value in the first (lower) 16 bits always
-         * ends in a 1 bit, so the entire pattern must be flipped in case the
-         * second (higher) 16 bit pattern starts with a 1 bit. XORing the sign-
-         * extended component to the first one achieves exactly that.
-         *
-         * Finally, we zero out the very first bit of the resulting value. This
-         * may change the lowest bit of our encoded value, but ensures that our
-         * newly encoded bits form a valid BMC pattern with the already zeroed out
-         * lower 8 bits in the pattern set up in spdif_buf_init().
-         *
-         * Further, this also happens to ensure even parity:
-         * All entries in the BMC table end in a 1, so an all-zero pattern would
-         * end (after encoding an even number of bits) in two 0 bits. Setting any
-         * bit will cause the BMC-encoded pattern to flip its first (lowest) bit,
-         * meaning we can use that bit to infer parity. Setting it to zero flips
-         * the first (lowest) bit such that we always have even parity.
-         *
-         * I did not come up with this, all credit goes to
-         * github.com/amedes/esp_a2dp_sink_spdif
-         */
-    uint32_t lo = ((uint32_t)(bmc_convert[buffer[i]]) << 16);
-    uint32_t hi = (uint32_t)((int16_t)bmc_convert[buffer[i + 1]]);
-
-    *(spdif_ptr + 1) = ((lo ^ hi) << 1) >> 1;
-
-    spdif_ptr += 2;  // advance to next audio data
-
-    if (spdif_ptr >= &spdif_buf[SPDIF_BUF_ARRAY_SIZE]) {
-      feedPCMFramesInternal(spdif_buf, sizeof(spdif_buf));
-      spdif_ptr = spdif_buf;
+size_t SPDIFAudioSink::queuedFrames() {
+  // Plus what's encoded of the block being filled
+  return BufferedAudioSink::queuedFrames() +
+         (spdif_ptr - spdif_buf) * sizeof(uint32_t) / frameSize;
+}
+
+void SPDIFAudioSink::flush() {
+  BufferedAudioSink::flush();
+  spdif_ptr = spdif_buf;
+}
+
+void BELL_HOT SPDIFAudioSink::feedPCMFrames(const uint8_t* buffer,
+                                            size_t bytes) {
+  const uint32_t* end = &spdif_buf[SPDIF_BUF_ARRAY_SIZE];
+  uint32_t* ptr = spdif_ptr;
+
+  if (bitstream) {
+    // 16-bit words as the upper part of 24-bit samples, the low byte zero
+    for (const uint8_t* last = buffer + bytes - bytes % 2; buffer < last;
+         buffer += 2) {
+      uint32_t hi = bmc_encode16(buffer[0], buffer[1]);
+      uint32_t lo = (bmc_convert[0] ^ -(hi >> 31)) & 0xffff;
+      *ptr = (*ptr & 0xffff0000) | (lo & (BMC_DATA_START >> 16));
+      *(ptr + 1) = hi;
+      ptr += 2;
+
+      if (ptr == end) {
+        feedPCMFramesInternal(spdif_buf, sizeof(spdif_buf));
+        ptr = spdif_buf;
+      }
+    }
+  } else if (bitDepth == 16) {
+    for (const uint8_t* last = buffer + bytes - bytes % 2; buffer < last;
+         buffer += 2) {
+      *(ptr + 1) = bmc_encode16(buffer[0], buffer[1]) & BMC_DATA_START;
+      ptr += 2;  // advance to next audio data
+
+      if (ptr == end) {
+        feedPCMFramesInternal(spdif_buf, sizeof(spdif_buf));
+        ptr = spdif_buf;
+      }
+    }
+  } else {
+    // Left-justified in 32 bits, the lowest byte is dropped
+    for (const uint8_t* last = buffer + bytes - bytes % 4; buffer < last;
+         buffer += 4) {
+      uint32_t hi = bmc_encode16(buffer[2], buffer[3]);
+      // Flipped when the upper 16 bits start with a 1, as above
+      uint32_t lo = (bmc_convert[buffer[1]] ^ -(hi >> 31)) & 0xffff;
+      *ptr = (*ptr & 0xffff0000) | (lo & (BMC_DATA_START >> 16));
+      *(ptr + 1) = hi;
+      ptr += 2;
+
+      if (ptr == end) {
+        feedPCMFramesInternal(spdif_buf, sizeof(spdif_buf));
+        ptr = spdif_buf;
+      }
     }
   }
-}
\ No newline at end of file
+  spdif_ptr = ptr;
+}
@@ -17,6 +17,9 @@ static const struct tas5711_cmd_s tas5711_init_sequence[] = {
 i2c_ack_type_t ACK_CHECK_EN = (i2c_ack_type_t)0x1;
 
 TAS5711AudioSink::TAS5711AudioSink() {
+  // Handled by the master volume register, see volumeChanged()
+  softwareVolumeControl = false;
+
   i2s_config_t i2s_config = {
 
       .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),  // Only TX
@@ -75,6 +78,7 @@ TAS5711AudioSink::TAS5711AudioSink() {
     ESP_LOGI("RR", "Unable to detect dac");
   }
 
+  codec_regs_init(&regs, i2c_port, 0x1b, 1, false);
   writeReg(0x1b, 0x00);
   vTaskDelay(100 / portTICK_PERIOD_MS);
 
@@ -86,22 +90,22 @@ TAS5711AudioSink::TAS5711AudioSink() {
   startI2sFeed();
 }
 
-void TAS5711AudioSink::writeReg(uint8_t reg, uint8_t value) {
-  i2c_cmd_handle_t i2c_cmd = i2c_cmd_link_create();
-
-  i2c_master_start(i2c_cmd);
-  i2c_master_write_byte(i2c_cmd, (0x1b << 1) | I2C_MASTER_WRITE, ACK_CHECK_EN);
-  i2c_master_write_byte(i2c_cmd, reg, ACK_CHECK_EN);
-  i2c_master_write_byte(i2c_cmd, value, ACK_CHECK_EN);
-
-  i2c_master_stop(i2c_cmd);
-  esp_err_t res =
-      i2c_master_cmd_begin(i2c_port, i2c_cmd, 500 / portTICK_PERIOD_MS);
+void TAS5711AudioSink::volumeChanged(uint16_t volume) {
+  // 0x30 is 0dB, every step down is -0.5dB to 0xfe, 0xff mutes
+  uint8_t value = 0xff;
+  if (volume > 0) {
+    value = 0x30 + (MAX_VOLUME - std::min(volume, MAX_VOLUME)) *
+                       (0xfe - 0x30) / MAX_VOLUME;
+  }
+  writeReg(0x07, value);
+}
 
+void TAS5711AudioSink::writeReg(uint8_t reg, uint8_t value) {
+  // Dropped when unchanged, e.g. the same volume set again
+  esp_err_t res = codec_regs_write(&regs, reg, value);
   if (res != ESP_OK) {
     ESP_LOGE("RR", "Unable to write to TAS5711");
   }
-  i2c_cmd_link_delete(i2c_cmd);
 }
 
 TAS5711AudioSink::~TAS5711AudioSink() {}
@@ -32,6 +32,7 @@
 #include <freertos/task.h>
 #include <string.h>
 #include "adac.h"
+#include "codec_regs.h"
 
 const static char TAG[] = "AC101";
 
@@ -66,6 +67,8 @@ static void ac101_set_spk_volume(uint8_t volume);
 static int ac101_get_spk_volume(void);
 
 static int i2c_port;
+// unchanged writes are dropped, reads of written registers stay off the bus
+static codec_regs_t ac101_regs;
 
 /****************************************************************************************
  * init
@@ -87,10 +90,13 @@ static bool init(int i2c_port_num, int i2s_num, i2s_config_t* i2s_config) {
 
   i2c_param_config(i2c_port, &i2c_config);
   i2c_driver_install(i2c_port, I2C_MODE_MASTER, false, false, false);
+  codec_regs_init(&ac101_regs, i2c_port, AC101_ADDR, 2, false);
 
-  res = i2c_read_reg(CHIP_AUDIO_RS);
+  // chip ID, from the bus whatever was cached
+  uint16_t id = 0;
+  codec_regs_read_volatile(&ac101_regs, CHIP_AUDIO_RS, &id);
 
-  if (!res) {
+  if (!id) {
     ESP_LOGW(TAG, "No AC101 detected");
     i2c_driver_delete(i2c_port);
     return 0;
@@ -100,9 +106,14 @@ static bool init(int i2c_port_num, int i2s_num, i2s_config_t* i2s_config) {
            i2c_config.scl_io_num);
 
   res = i2c_write_reg(CHIP_AUDIO_RS, 0x123);
+  // soft reset, every register is back to its default
+  codec_regs_invalidate(&ac101_regs);
   // huh?
   vTaskDelay(100 / portTICK_PERIOD_MS);
 
+  // the whole configuration in one transaction
+  codec_regs_begin(&ac101_regs);
+
   // enable the PLL from BCLK source
   i2c_write_reg(PLL_CTRL1,
                 BIN(0000, 0001, 0100, 1111));  // F=1,M=1,PLL,INT=31 (medium)
@@ -159,6 +170,7 @@ static bool init(int i2c_port_num, int i2s_num, i2s_config_t* i2s_config) {
   i2c_write_reg(OMIXER_SR, BIN(0000, 0101, 0000,
                                1010));  // source=DAC(R/L) and LINEIN(R/L)
 #endif
+  codec_regs_commit(&ac101_regs);
 
   // configure I2S pins & install driver
   i2s_pin_config_t i2s_pin_config = (i2s_pin_config_t){
@@ -240,41 +252,16 @@ static void headset(bool active) {
  * 
  */
 static esp_err_t i2c_write_reg(uint8_t reg, uint16_t val) {
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-  esp_err_t ret = 0;
-  uint8_t send_buff[4];
-  send_buff[0] = (AC101_ADDR << 1);
-  send_buff[1] = reg;
-  send_buff[2] = (val >> 8) & 0xff;
-  send_buff[3] = val & 0xff;
-  ret |= i2c_master_start(cmd);
-  ret |= i2c_master_write(cmd, send_buff, 4, ACK_CHECK_EN);
-  ret |= i2c_master_stop(cmd);
-  ret |= i2c_master_cmd_begin(i2c_port, cmd, 1000 / portTICK_PERIOD_MS);
-  i2c_cmd_link_delete(cmd);
-  return ret;
+  return codec_regs_write(&ac101_regs, reg, val);
 }
 
 /****************************************************************************************
  * 
  */
 static uint16_t i2c_read_reg(uint8_t reg) {
-  uint8_t data[2] = {0};
-
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-  i2c_master_start(cmd);
-  i2c_master_write_byte(cmd, (AC101_ADDR << 1) | WRITE_BIT, ACK_CHECK_EN);
-  i2c_master_write_byte(cmd, reg, ACK_CHECK_EN);
-  i2c_master_start(cmd);
-  i2c_master_write_byte(cmd, (AC101_ADDR << 1) | READ_BIT,
-                        ACK_CHECK_EN);  //check or not
-  i2c_master_read(cmd, data, 2, ACK_VAL);
-  i2c_master_stop(cmd);
-  i2c_master_cmd_begin(i2c_port, cmd, 1000 / portTICK_PERIOD_MS);
-  i2c_cmd_link_delete(cmd);
-
-  return (data[0] << 8) + data[1];
-  ;
+  uint16_t value = 0;
+  codec_regs_read(&ac101_regs, reg, &value);
+  return value;
 }
 
 /****************************************************************************************
@@ -0,0 +1,151 @@
+#include "codec_regs.h"
+
+#include <string.h>
+#include "esp_log.h"
+
+static const char TAG[] = "codec_regs";
+
+#define I2C_TIMEOUT (1000 / portTICK_PERIOD_MS)
+
+static bool is_known(const codec_regs_t* regs, uint8_t reg) {
+  return regs->known[reg / 32] & (1u << (reg % 32));
+}
+
+static void set_known(codec_regs_t* regs, uint8_t reg, bool known) {
+  if (known)
+    regs->known[reg / 32] |= 1u << (reg % 32);
+  else
+    regs->known[reg / 32] &= ~(1u << (reg % 32));
+}
+
+void codec_regs_init(codec_regs_t* regs, i2c_port_t port, uint8_t address,
+                     uint8_t width, bool burst) {
+  memset(regs, 0, sizeof(*regs));
+  regs->port = port;
+  regs->address = address;
+  regs->width = width == 2 ? 2 : 1;
+  regs->burst = burst;
+}
+
+void codec_regs_invalidate(codec_regs_t* regs) {
+  memset(regs->known, 0, sizeof(regs->known));
+}
+
+void codec_regs_begin(codec_regs_t* regs) {
+  regs->depth++;
+}
+
+esp_err_t codec_regs_commit(codec_regs_t* regs) {
+  if (regs->depth > 0)
+    regs->depth--;
+  if (regs->depth > 0 || regs->queued == 0)
+    return ESP_OK;
+
+  // One command link, a repeated start before every run of registers
+  esp_err_t res = ESP_OK;
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  for (int i = 0; i < regs->queued; i++) {
+    uint8_t reg = regs->queue[i].reg;
+    bool next = i > 0 && reg == (uint8_t)(regs->queue[i - 1].reg + 1);
+    if (!regs->burst || !next) {
+      res |= i2c_master_start(cmd);
+      res |= i2c_master_write_byte(
+          cmd, (regs->address << 1) | I2C_MASTER_WRITE, true);
+      res |= i2c_master_write_byte(cmd, reg, true);
+    }
+    uint16_t value = regs->queue[i].value;
+    if (regs->width == 2)
+      res |= i2c_master_write_byte(cmd, value >> 8, true);
+    res |= i2c_master_write_byte(cmd, value & 0xff, true);
+  }
+  res |= i2c_master_stop(cmd);
+  res |= i2c_master_cmd_begin(regs->port, cmd, I2C_TIMEOUT);
+  i2c_cmd_link_delete(cmd);
+
+  if (res != ESP_OK) {
+    // Some may have gone through, the next writes must not be dropped
+    ESP_LOGE(TAG, "Unable to write %d registers at 0x%02x: %d", regs->queued,
+             regs->address, res);
+    for (int i = 0; i < regs->queued; i++)
+      set_known(regs, regs->queue[i].reg, false);
+  }
+  regs->queued = 0;
+  return res;
+}
+
+esp_err_t codec_regs_write(codec_regs_t* regs, uint8_t reg, uint16_t value) {
+  if (is_known(regs, reg) && regs->values[reg] == value)
+    return ESP_OK;
+  regs->values[reg] = value;
+  set_known(regs, reg, true);
+
+  esp_err_t res = ESP_OK;
+  if (regs->queued == CODEC_REGS_QUEUE) {
+    // Keeps the order, in a transaction of its own
+    int depth = regs->depth;
+    regs->depth = 1;
+    res = codec_regs_commit(regs);
+    regs->depth = depth;
+  }
+  regs->queue[regs->queued].reg = reg;
+  regs->queue[regs->queued].value = value;
+  regs->queued++;
+
+  if (regs->depth > 0)
+    return res;
+  regs->depth = 1;
+  return res | codec_regs_commit(regs);
+}
+
+esp_err_t codec_regs_update(codec_regs_t* regs, uint8_t reg, uint16_t mask,
+                            uint16_t value) {
+  uint16_t current;
+  esp_err_t res = codec_regs_read(regs, reg, &current);
+  if (res != ESP_OK)
+    return res;
+  return codec_regs_write(regs, reg, (current & ~mask) | (value & mask));
+}
+
+esp_err_t codec_regs_read(codec_regs_t* regs, uint8_t reg, uint16_t* value) {
+  if (is_known(regs, reg)) {
+    *value = regs->values[reg];
+    return ESP_OK;
+  }
+  return codec_regs_read_volatile(regs, reg, value);
+}
+
+esp_err_t codec_regs_read_volatile(codec_regs_t* regs, uint8_t reg,
+                                   uint16_t* value) {
+  // Queued writes go first, they may change what's read
+  if (regs->queued > 0) {
+    int depth = regs->depth;
+    regs->depth = 1;
+    codec_regs_commit(regs);
+    regs->depth = depth;
+  }
+
+  uint8_t data[2] = {0};
+  esp_err_t res = ESP_OK;
+  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+  res |= i2c_master_start(cmd);
+  res |= i2c_master_write_byte(cmd, (regs->address << 1) | I2C_MASTER_WRITE,
+                               true);
+  res |= i2c_master_write_byte(cmd, reg, true);
+  res |= i2c_master_start(cmd);
+  res |= i2c_master_write_byte(cmd, (regs->address << 1) | I2C_MASTER_READ,
+                               true);
+  res |= i2c_master_read(cmd, data, regs->width, I2C_MASTER_LAST_NACK);
+  res |= i2c_master_stop(cmd);
+  res |= i2c_master_cmd_begin(regs->port, cmd, I2C_TIMEOUT);
+  i2c_cmd_link_delete(cmd);
+
+  if (res != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to read register 0x%02x at 0x%02x: %d", reg,
+             regs->address, res);
+    return res;
+  }
+  *value = regs->width == 2 ? (data[0] << 8) | data[1] : data[0];
+  regs->values[reg] = *value;
+  set_known(regs, reg, true);
+  return ESP_OK;
+}
@@ -24,6 +24,7 @@
 
 #include "es8311.h"
 #include <string.h>
+#include "codec_regs.h"
 #include "esp_log.h"
 // #include "board.h"
 
@@ -268,40 +269,26 @@ static char* TAG = "DRV8311";
     return b;                             \
   }
 
+/*
+ * Shadow of the registers, unchanged writes are dropped and the ones of
+ * es8311_init() go out as one transaction
+ */
+static codec_regs_t es8311_regs;
+
 static int Es8311WriteReg(uint8_t regAdd, uint8_t data) {
-  int res = 0;
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-  res |= i2c_master_start(cmd);
-  res |= i2c_master_write_byte(cmd, ES8311_ADDR, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_write_byte(cmd, regAdd, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_write_byte(cmd, data, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_stop(cmd);
-  res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_PERIOD_MS);
-  i2c_cmd_link_delete(cmd);
+  int res = codec_regs_write(&es8311_regs, regAdd, data);
   ES_ASSERT(res, "Es8311 Write Reg error", -1);
   return res;
 }
 
 int Es8311ReadReg(uint8_t regAdd) {
-  uint8_t data;
-  int res = 0;
-  i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-
-  res |= i2c_master_start(cmd);
-  res |= i2c_master_write_byte(cmd, ES8311_ADDR, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_write_byte(cmd, regAdd, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_stop(cmd);
-  res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_PERIOD_MS);
-  i2c_cmd_link_delete(cmd);
-
-  cmd = i2c_cmd_link_create();
-  res |= i2c_master_start(cmd);
-  res |= i2c_master_write_byte(cmd, ES8311_ADDR | 0x01, 1 /*ACK_CHECK_EN*/);
-  res |= i2c_master_read_byte(cmd, &data, 0x01 /*NACK_VAL*/);
-  res |= i2c_master_stop(cmd);
-  res |= i2c_master_cmd_begin(0, cmd, 1000 / portTICK_PERIOD_MS);
-  i2c_cmd_link_delete(cmd);
-
+  uint16_t data;
+  int res;
+  /* the reset register has self-clearing bits, always read from the chip */
+  if (regAdd == ES8311_RESET_REG00)
+    res = codec_regs_read_volatile(&es8311_regs, regAdd, &data);
+  else
+    res = codec_regs_read(&es8311_regs, regAdd, &data);
   ES_ASSERT(res, "Es8311 Read Reg error", -1);
   return (int)data;
 }
@@ -511,6 +498,7 @@ static void es8311_mute(int mute) {
 */
 static void es8311_init(uint32_t mclk_freq, uint32_t lrck_freq) {
   int regv;
+  codec_regs_begin(&es8311_regs);
   Es8311WriteReg(ES8311_GP_REG45, 0x00);
   Es8311WriteReg(ES8311_CLK_MANAGER_REG01, 0x30);
   Es8311WriteReg(ES8311_CLK_MANAGER_REG02, 0x00);
@@ -611,6 +599,7 @@ static void es8311_init(uint32_t mclk_freq, uint32_t lrck_freq) {
   Es8311WriteReg(ES8311_DAC_REG37, 0x48);
   Es8311WriteReg(ES8311_GPIO_REG44, 0x08);
   Es8311WriteReg(ES8311_DAC_REG32, 0xBF);
+  codec_regs_commit(&es8311_regs);
 
 #ifdef CONFIG_USE_ES7243
   Es7243Init();
@@ -669,12 +658,15 @@ esp_err_t Es8311GetRef(bool flag) {
 int Es8311Init(Es8311Config* cfg) {
   es8311_priv = calloc(1, sizeof(struct es8311_private));
   I2cInit(&cfg->i2c_cfg, cfg->i2c_port_num);  // ESP32 in master mode
+  codec_regs_init(&es8311_regs, cfg->i2c_port_num, ES8311_ADDR >> 1, 1, false);
   es8311_Codec_Startup(11289600, 44100);
   return 0;
 }
 
 void Es8311Uninit() {
   Es8311WriteReg(ES8311_RESET_REG00, 0x3f);
+  /* registers are back to their defaults */
+  codec_regs_invalidate(&es8311_regs);
   free(es8311_priv);
   es8311_priv = NULL;
 }
@@ -832,7 +824,8 @@ int ES8311WriteReg(uint8_t regAdd, uint8_t data) {
 
 void Es8311ReadAll() {
   for (int i = 0; i < 0x4A; i++) {
-    uint8_t reg = Es8311ReadReg(i);
+    uint16_t reg;
+    codec_regs_read_volatile(&es8311_regs, i, &reg);
     // ets_printf("REG:%02x, %02x\n", reg, i);
   }
 }
\ No newline at end of file
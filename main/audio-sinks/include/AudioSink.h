@@ -1,27 +1,75 @@
 #ifndef AUDIOSINK_H
 #define AUDIOSINK_H
 
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <vector>
 
+#include "StreamInfo.h"  // for PcmFormat
+
 class AudioSink {
  public:
   AudioSink() {}
   virtual ~AudioSink() {}
   virtual void feedPCMFrames(const uint8_t* buffer, size_t bytes) = 0;
+  // Codec volume, 0 to MAX_VOLUME. Only used by sinks that clear
+  // softwareVolumeControl, samples are scaled in the pipeline otherwise.
   virtual void volumeChanged(uint16_t volume) {}
+  static constexpr uint16_t MAX_VOLUME = 255;
   // Return false if the sink doesn't support reconfiguration.
   virtual bool setParams(uint32_t sampleRate, uint8_t channelCount,
                          uint8_t bitDepth) {
     return false;
   }
+  // Same as setParams(), for sinks that take 32-bit or float samples as they
+  // come out of BellDSP. INT24_IN_32 maps to a bitDepth of 24, sinks
+  // accepting it expect left-justified 32-bit words. Return false if the
+  // format isn't supported, the caller has to convert then.
+  virtual bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                         bell::PcmFormat format) {
+    switch (format) {
+      case bell::PcmFormat::INT16:
+        return setParams(sampleRate, channelCount, 16);
+      case bell::PcmFormat::INT24_IN_32:
+        return setParams(sampleRate, channelCount, 24);
+      case bell::PcmFormat::INT32:
+        return setParams(sampleRate, channelCount, 32);
+      default:
+        return false;
+    }
+  }
   // Deprecated. Implement/use setParams() instead.
   virtual inline bool setRate(uint16_t sampleRate) {
     return setParams(sampleRate, 2, 16);
   }
+  /**
+   * Frames fed but not heard yet, from the sink's own buffers down to the
+   * device's. Called from the thread feeding the sink.
+   * @return 0 if the sink can't tell
+   */
+  virtual size_t queuedFrames() { return 0; }
+  /**
+   * Drops every frame queued, down to the device's buffers where the sink
+   * can, so the next frame fed is the next one heard, e.g. on a seek.
+   * Called from the thread feeding the sink. Sinks that can't drop anything
+   * keep playing out what they hold.
+   */
+  virtual void flush() {}
+  // Time until a frame fed now is heard
+  virtual std::chrono::microseconds outputLatency() {
+    if (outputRate == 0) {
+      return std::chrono::microseconds(0);
+    }
+    return std::chrono::microseconds((uint64_t)queuedFrames() * 1000000 /
+                                     outputRate);
+  }
   bool softwareVolumeControl = true;
   bool usign = false;
+
+ protected:
+  // Rate the device plays at, set by setParams()
+  uint32_t outputRate = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t
+#include <atomic>    // for atomic
+#include <memory>    // for shared_ptr, unique_ptr
+#include <mutex>     // for scoped_lock
+#include <vector>    // for vector
+
+#include "AudioSink.h"         // for AudioSink
+#include "BellTask.h"          // for Task
+#include "BoundedQueue.h"      // for BoundedQueue
+#include "RTMutex.h"           // for RTMutex
+#include "StreamInfo.h"        // for PcmFormat
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+namespace bell {
+class AudioPipeline;
+class BellDSP;
+}  // namespace bell
+
+/**
+ * Plays one stream on several sinks, e.g. an I2S DAC and S/PDIF. Every
+ * feedPCMFrames() block is copied once into a refcounted block shared by
+ * all outputs. Each output has its own task, so one blocking on a full
+ * buffer doesn't hold back the others. An output can have its own
+ * AudioPipeline, a crossover for instance, run on a private copy.
+ *
+ * Format changes wait until every output played what it was given, then
+ * reach all children at once. A pipeline that changes the channel count
+ * needs a child opened accordingly. The shared path's software volume
+ * applies to every output, sinks with hardware volume that share a stream
+ * with others are better served by a VolumeControl on their own pipeline.
+ */
+class FanOutAudioSink : public AudioSink {
+ public:
+  struct Config {
+    // Blocks shared by the outputs, feedPCMFrames() waits while all are
+    // in use
+    size_t blocks = 8;
+    size_t blockSize = 4096;
+    // Room for pipelines that grow the data (Resampler), in blocks
+    size_t dspCapacity = 2;
+  };
+
+  FanOutAudioSink() : FanOutAudioSink(Config()) {}
+  FanOutAudioSink(const Config& config);
+  ~FanOutAudioSink() override;
+
+  /**
+   * @param sink child, has to outlive this
+   * @param pipeline processing for this output only, nullptr plays the
+   * shared blocks as they are
+   */
+  void addOutput(AudioSink* sink,
+                 std::shared_ptr<bell::AudioPipeline> pipeline = nullptr);
+
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  // Reaches the children with hardware volume only
+  void volumeChanged(uint16_t volume) override;
+  // The output furthest behind
+  size_t queuedFrames() override;
+  // Drops the blocks not played yet, then every child flushes on its task
+  void flush() override;
+
+ private:
+  struct Block {
+    std::vector<uint8_t> data;
+    size_t size = 0;
+    // Outputs that still have to play it
+    std::atomic<int> refs = 0;
+  };
+
+  class Output : public bell::Task {
+   public:
+    Output(FanOutAudioSink* parent, AudioSink* sink,
+           std::shared_ptr<bell::AudioPipeline> pipeline);
+    ~Output();
+
+    AudioSink* sink;
+    std::shared_ptr<bell::AudioPipeline> pipeline;
+    // nullptr has the task flush the sink
+    bell::BoundedQueue<Block*> queue;
+    // Queued for this output and not fed to the sink yet
+    std::atomic<size_t> pendingBytes = 0;
+
+    void runTask() override;
+
+   private:
+    FanOutAudioSink* parent;
+    std::unique_ptr<bell::BellDSP> dsp;
+    // Private copy the pipeline runs on
+    std::vector<uint8_t> work;
+
+    void onStopRequested() override { queue.shutdown(); }
+  };
+
+  Config config;
+  std::vector<std::unique_ptr<Block>> blocks;
+  bell::BoundedQueue<Block*> freeBlocks;
+  // Given whenever a block returns to freeBlocks
+  bell::WrappedSemaphore releasedSem;
+
+  // Guards outputs against addOutput() while feeding, which waits on it
+  bell::RTMutex outputsMutex;
+  std::vector<std::unique_ptr<Output>> outputs;
+
+  // Only changed while every block is free
+  uint32_t sampleRate = 44100;
+  uint8_t channels = 2;
+  bell::PcmFormat format = bell::PcmFormat::INT16;
+  size_t frameSize = 4;
+
+  void release(Block* block);
+};
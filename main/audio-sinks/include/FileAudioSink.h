@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t, uint64_t
+#include <stdio.h>   // for FILE
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioSink.h"   // for AudioSink
+#include "StreamInfo.h"  // for PcmFormat
+
+/**
+ * Writes PCM to a file as fast as it comes, without any pacing, e.g. for
+ * offline renders. WAV files get their sizes patched in by close(), raw
+ * files are the samples as fed.
+ *
+ * 24-bit samples in 32 are stored packed in 3 bytes, FLOAT32 makes an IEEE
+ * float WAV. A WAV takes a single format, later setFormat() calls with
+ * another one fail once samples were written.
+ */
+class FileAudioSink : public AudioSink {
+ public:
+  enum class Container { WAV, RAW };
+
+  FileAudioSink(const std::string& path, Container container = Container::WAV);
+  ~FileAudioSink() override;
+
+  // Whether the file could be created
+  bool isOpen() { return file != nullptr; }
+  // Finishes the file, called by the destructor
+  void close();
+
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+
+  // Frames written so far
+  uint64_t getFrames() { return frameSize ? dataBytes / frameSize : 0; }
+
+ private:
+  static constexpr size_t WAV_HEADER_SIZE = 44;
+
+  FILE* file = nullptr;
+  Container container;
+  bool formatSet = false;
+  uint32_t sampleRate = 0;
+  uint8_t channels = 0;
+  bell::PcmFormat format = bell::PcmFormat::INT16;
+  // Of a frame as stored
+  size_t frameSize = 0;
+  uint64_t dataBytes = 0;
+  // Packed 24-bit samples on their way to the file
+  std::vector<uint8_t> packed;
+
+  void writeHeader();
+};
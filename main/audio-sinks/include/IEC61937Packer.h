@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t
+#include <vector>    // for vector
+
+namespace bell {
+/**
+ * Wraps AC-3 and E-AC-3 sync frames, e.g. from an AC3Container, into
+ * IEC 61937 data bursts: a receiver takes them from an S/PDIF link that
+ * looks like 16-bit stereo PCM, flagged as non-audio in its channel status
+ * (see SPDIFAudioSink::setBitstream()), and decodes them itself.
+ *
+ * Every burst fills the time of the audio it carries, 1536 frames of the
+ * carrier for AC-3. E-AC-3 gathers the frames of 6 audio blocks into one
+ * burst, sent at four times the sample rate.
+ *
+ *   IEC61937Packer packer;
+ *   while (auto* frame = container->readSample(len)) {
+ *     if (packer.pack((uint8_t*)frame, len, burst) > 0) {
+ *       sink->feedPCMFrames(burst.data(), burst.size());
+ *     }
+ *     container->consumeBytes(len);
+ *   }
+ */
+class IEC61937Packer {
+ public:
+  // Pc data types
+  enum class DataType : uint8_t {
+    AC3 = 0x01,
+    EAC3 = 0x15,
+  };
+
+  IEC61937Packer() = default;
+  ~IEC61937Packer() = default;
+
+  /**
+   * Adds a sync frame
+   * @param [out] burst completed burst, as little endian 16-bit stereo
+   * frames at getCarrierRate()
+   * @returns size of burst, 0 while E-AC-3 frames are gathered or when the
+   * frame isn't AC-3 nor E-AC-3
+   */
+  size_t pack(const uint8_t* frame, size_t size, std::vector<uint8_t>& burst);
+
+  // Burst of the E-AC-3 frames gathered so far, at the end of a stream
+  size_t flush(std::vector<uint8_t>& burst);
+
+  // Drops gathered frames, e.g. on a seek
+  void reset();
+
+  // S/PDIF frame rate the bursts play at, 0 before the first frame
+  uint32_t getCarrierRate() const { return carrierRate; }
+
+ private:
+  // Pa and Pb, the sync words starting every burst
+  static constexpr uint16_t SYNC_A = 0xF872;
+  static constexpr uint16_t SYNC_B = 0x4E1F;
+  static constexpr size_t PREAMBLE_SIZE = 8;
+  // Carrier frames of a burst
+  static constexpr size_t AC3_PERIOD = 1536;
+  static constexpr size_t EAC3_PERIOD = 6144;
+  static constexpr uint32_t EAC3_BLOCKS = 6;
+
+  uint32_t carrierRate = 0;
+
+  // E-AC-3 frames of the burst being gathered
+  std::vector<uint8_t> pending;
+  uint32_t pendingBlocks = 0;
+
+  size_t writeBurst(DataType type, uint8_t bsmod, const uint8_t* payload,
+                    size_t size, size_t period, std::vector<uint8_t>& burst);
+};
+}  // namespace bell
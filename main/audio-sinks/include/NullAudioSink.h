@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t, uint64_t, int64_t
+#include <mutex>     // for mutex
+
+#include "AudioSink.h"    // for AudioSink
+#include "BellMetrics.h"  // for MetricHistogram
+#include "StreamInfo.h"   // for PcmFormat
+
+/**
+ * Plays nothing, for benchmarks and soak tests without audio hardware.
+ * Takes any format. In real time it behaves as a device does: a buffer of
+ * bufferMs drains at the sample rate, feedPCMFrames() blocks while it's
+ * full, and the buffer running dry between two feeds is an underrun. Off
+ * real time, it takes PCM as fast as it comes.
+ *
+ * The time between feeds goes to a histogram, its spread is the feeding
+ * thread's jitter. Called from the thread feeding the sink, the stats may
+ * be read from any.
+ */
+class NullAudioSink : public AudioSink {
+ public:
+  struct Config {
+    bool realTime = true;
+    // Buffer of the modelled device, in real time
+    uint32_t bufferMs = 100;
+  };
+
+  struct Stats {
+    uint64_t frames = 0;
+    uint64_t feeds = 0;
+    uint32_t underruns = 0;
+    // Silence the device played through underruns
+    uint64_t underrunFrames = 0;
+  };
+
+  NullAudioSink() : NullAudioSink(Config()) {}
+  NullAudioSink(const Config& config);
+
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  size_t queuedFrames() override;
+  // Same as reset()
+  void flush() override { reset(); }
+
+  // Empties the buffer without an underrun, and the pause until the next
+  // feed isn't an interval
+  void reset();
+
+  Stats getStats();
+  // Time between feeds, in ns
+  const bell::MetricHistogram& getIntervals() const { return intervals; }
+
+ private:
+  Config config;
+  size_t frameSize = 0;
+  std::mutex statsMutex;
+  Stats stats;
+  bell::MetricHistogram intervals;
+
+  int64_t lastFeedNs = 0;
+  // Device playing since anchorNs, with the frames fed since
+  int64_t anchorNs = 0;
+  uint64_t anchorFrames = 0;
+
+  // Frames the device played since anchorNs by nowNs, at most those fed
+  uint64_t playedFrames(int64_t nowNs);
+};
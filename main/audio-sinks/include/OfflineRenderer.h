@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint32_t, uint64_t
+#include <functional>  // for function
+#include <memory>      // for shared_ptr
+#include <string>      // for string
+#include <vector>      // for vector
+
+#include "BellDSP.h"        // for BellDSP
+#include "CodecType.h"      // for AudioCodec
+#include "FileAudioSink.h"  // for FileAudioSink
+
+namespace bell {
+class AudioPipeline;
+
+/**
+ * Decodes files, runs them through a pipeline and writes the result to
+ * FileAudioSinks as fast as the CPU allows, e.g. to regression test DSP
+ * presets and codecs without playing them. Containers are probed by
+ * EncodedAudioStream, so call bell::createDecoders() first.
+ *
+ * The output is taken from BellDSP's post tap, so pipelines that resample
+ * or downmix are written in the format they produce.
+ */
+class OfflineRenderer {
+ public:
+  struct Job {
+    std::string input;
+    std::string output;
+    FileAudioSink::Container container = FileAudioSink::Container::WAV;
+    // Makes the job's own pipeline, transforms keep state so jobs can't
+    // share one. Empty writes the decoded PCM as it is
+    std::function<std::shared_ptr<AudioPipeline>()> makePipeline;
+  };
+
+  struct Result {
+    bool ok = false;
+    std::string error;
+    // Of the input, UNKNOWN when it couldn't be opened
+    AudioCodec codec = AudioCodec::UNKNOWN;
+    // Written to the output
+    uint64_t frames = 0;
+    uint32_t sampleRate = 0;
+    // Duration of the input, and the time its render took
+    double audioSeconds = 0;
+    double renderSeconds = 0;
+
+    // Times faster than real time
+    double speed() const {
+      return renderSeconds > 0 ? audioSeconds / renderSeconds : 0;
+    }
+  };
+
+  struct Config {
+    // Jobs rendered at once by renderAll(), 0 for one per core
+    size_t threads = 0;
+    // Decoded PCM run through the pipeline at once
+    size_t blockBytes = 16384;
+    // Room for pipelines that grow the data (Resampler), in blocks
+    size_t dspCapacity = 4;
+    // silenceBypassMs is ignored, every sample goes through the pipeline
+    BellDSP::EngineConfig engine;
+  };
+
+  static Result render(const Job& job) { return render(job, Config()); }
+  static Result render(const Job& job, const Config& config);
+
+  /**
+   * Renders every job, config.threads of them at once, the calling thread
+   * being one of the workers
+   * @returns a result per job, in the jobs' order
+   */
+  static std::vector<Result> renderAll(const std::vector<Job>& jobs,
+                                       const Config& config);
+  static std::vector<Result> renderAll(const std::vector<Job>& jobs) {
+    return renderAll(jobs, Config());
+  }
+};
+}  // namespace bell
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <AudioToolbox/AudioToolbox.h>
+#include <CoreAudio/CoreAudio.h>
+#include <cstdint>
+#include <memory>
+#include "AudioSink.h"
+#include "CircularBuffer.h"
+#include "WrappedSemaphore.h"
+
+/**
+ * Plays through the default output device's AudioUnit. Its render callback
+ * drains a lock-free ring filled by feedPCMFrames(), which only blocks while
+ * the ring is full, so the added latency is the ring plus the device's own:
+ * its I/O buffer, safety offset and latency, all of them reported by
+ * queuedFrames().
+ */
+class CoreAudioSink : public AudioSink {
+ public:
+  struct Config {
+    // Length of the ring
+    uint32_t ringMs = 10;
+    // I/O buffer of the device, within the range it allows. 0 keeps its
+    // own, typically 512
+    uint32_t bufferFrames = 128;
+    // Switches the device to the stream's rate instead of having the
+    // AudioUnit resample
+    bool matchDeviceRate = true;
+    // Takes the device in hog mode, no other process can play meanwhile
+    bool exclusive = false;
+  };
+
+  CoreAudioSink() : CoreAudioSink(Config()) {}
+  CoreAudioSink(const Config& config);
+  ~CoreAudioSink() override;
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  // The ring plus the device's latency
+  size_t queuedFrames() override;
+  // Stops the unit without playing out, the ring emptied
+  void flush() override;
+
+ private:
+  Config config;
+  AudioComponentInstance unit = nullptr;
+  AudioDeviceID device = kAudioObjectUnknown;
+  bool hogging = false;
+
+  // Bytes per interleaved frame of the open stream
+  size_t frameSize = 4;
+  // Latency of the device, in frames of the stream
+  size_t deviceFrames = 0;
+
+  std::unique_ptr<bell::CircularBuffer> ring;
+  // Given by the callback after taking data from the ring
+  bell::WrappedSemaphore freeSem;
+  // Render thread only, whether the last callback had data for all frames
+  bool playing = false;
+
+  static OSStatus renderCallback(void* userData,
+                                 AudioUnitRenderActionFlags* flags,
+                                 const AudioTimeStamp* timeStamp, UInt32 bus,
+                                 UInt32 frameCount, AudioBufferList* data);
+
+  bool openUnit(uint32_t sampleRate, uint8_t channelCount, bool isFloat,
+                size_t sampleSize);
+  void closeUnit();
+  // Sets up the device for sampleRate, and measures its latency
+  void configureDevice(uint32_t sampleRate);
+};
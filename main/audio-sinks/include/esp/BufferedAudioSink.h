@@ -5,23 +5,55 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include "AudioSink.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
 
 class BufferedAudioSink : public AudioSink {
  public:
+  // Every sink installs its driver at 44.1 kHz, 16-bit stereo
+  BufferedAudioSink() { outputRate = 44100; }
+
   void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
   bool setParams(uint32_t sampleRate, uint8_t channelCount,
                  uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  // The ringbuffer plus the DMA buffers, assumed full while playing
+  size_t queuedFrames() override;
+  // Has the feed task drop the ringbuffer and zero the DMA buffers, waits
+  // for it
+  void flush() override;
 
  protected:
+  // Legacy driver port the feed task writes to, set before startI2sFeed()
+  int i2sPort = 0;
+  // Bytes per frame in the ringbuffer, and frames the DMA buffers hold
+  // (dma_buf_count * dma_buf_len)
+  size_t frameSize = 4;
+  size_t dmaFrames = 8 * 512;
+
   void startI2sFeed(size_t buf_size = 4096 * 8);
   void feedPCMFramesInternal(const void* pvItem, size_t xItemSize);
 
  private:
+  RingbufHandle_t dataBuffer = nullptr;
+  size_t dataBufferSize = 0;
+  // Received from the ringbuffer but not written to the driver yet
+  std::atomic<size_t> inFlight = 0;
+  // flush() requests, and the last one the feed task carried out
+  std::atomic<uint32_t> flushRequested = 0;
+  std::atomic<uint32_t> flushDone = 0;
+
+  // Feed task, empties the ringbuffer and the DMA buffers
+  void drop();
+
+  static void i2sFeed(void* pvParameters);
 };
 
 #endif
\ No newline at end of file
@@ -7,9 +7,11 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "BufferedAudioSink.h"
+#include "codec_regs.h"
 #include "driver/i2s.h"
 #include "esp_err.h"
 #include "esp_log.h"
@@ -91,13 +93,18 @@ class ES8388AudioSink : public BufferedAudioSink {
   };
 
   void mute(const ES8388_OUT out, const bool muted);
+  // 0 to 100
   void volume(const ES8388_OUT out, const uint8_t vol);
+  void volumeChanged(uint16_t volume) override;
 
   void writeReg(uint8_t reg_add, uint8_t data);
 
  private:
   i2c_config_t i2c_config;
   i2c_port_t i2c_port = I2C_NUM_0;
+  codec_regs_t regs;
+  // Outputs powered by ES8388_DACPOWER
+  uint8_t dacPower = 0x3c;
 };
 
 #endif
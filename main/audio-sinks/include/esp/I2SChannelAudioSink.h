@@ -0,0 +1,82 @@
+#ifndef I2SCHANNELAUDIOSINK_H
+#define I2SCHANNELAUDIOSINK_H
+
+#include "esp_idf_version.h"
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include "AudioSink.h"
+#include "BellMetrics.h"
+#include "CircularBuffer.h"
+#include "driver/i2s_std.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/**
+ * I2S sink on the IDF 5 i2s_channel driver, without a feed task. The DMA
+ * descriptors loop on their own, and the on_sent interrupt refills each
+ * buffer straight from a lock-free ring that feedPCMFrames() writes to, so
+ * samples are copied once instead of going through a FreeRTOS ringbuffer
+ * and i2s_write(). An empty ring plays silence.
+ *
+ * Every instance owns its channel, so several ports can play at once. The
+ * IDF refuses to run the legacy driver/i2s.h alongside, a firmware uses
+ * either this sink or the BufferedAudioSink based ones. With
+ * CONFIG_I2S_ISR_IRAM_SAFE the ring isn't reachable from the interrupt
+ * while the cache is disabled, leave it off.
+ */
+class I2SChannelAudioSink : public AudioSink {
+ public:
+  struct Config {
+    i2s_port_t port = I2S_NUM_0;
+    gpio_num_t mclk = I2S_GPIO_UNUSED;
+    gpio_num_t bclk = GPIO_NUM_27;
+    gpio_num_t ws = GPIO_NUM_32;
+    gpio_num_t dout = GPIO_NUM_25;
+    // Latency is dmaDescNum * dmaFrameNum frames on top of the ring
+    uint32_t dmaDescNum = 6;
+    uint32_t dmaFrameNum = 240;
+    size_t ringSize = 4096 * 8;
+  };
+
+  I2SChannelAudioSink() : I2SChannelAudioSink(Config()) {}
+  I2SChannelAudioSink(const Config& config);
+  ~I2SChannelAudioSink() override;
+
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  // The ring plus the DMA descriptors, which always loop full
+  size_t queuedFrames() override;
+  // Stops the channel, then restarts it on silence with the ring emptied
+  void flush() override;
+
+ private:
+  Config config;
+  i2s_chan_handle_t channel = nullptr;
+  bool enabled = false;
+  std::unique_ptr<bell::CircularBuffer> ring;
+  // Bytes per frame, the interrupt only takes whole frames
+  size_t frameSize = 4;
+  // Task blocked in feedPCMFrames() on a full ring
+  std::atomic<TaskHandle_t> waiter = nullptr;
+#ifdef BELL_METRICS
+  // Resolved up front, the interrupt can't take the registry's lock
+  bell::MetricCounter* underruns = nullptr;
+  // Interrupt only, whether the last buffer was filled completely
+  bool playing = false;
+#endif
+
+  // Preloads the DMA buffers with silence and enables the disabled channel
+  bool enable();
+  static bool onSent(i2s_chan_handle_t handle, i2s_event_data_t* event,
+                     void* userContext);
+};
+
+#endif
+#endif
@@ -14,6 +14,12 @@
 class SPDIFAudioSink : public BufferedAudioSink {
  private:
   uint8_t spdifPin;
+  // 16, or 24 for left-justified 24 and 32-bit samples
+  uint8_t bitDepth = 16;
+  // IEC 61937 bursts instead of PCM
+  bool bitstream = false;
+
+  bool configure(uint32_t sampleRate, uint8_t bitDepth, bool bitstream);
 
  public:
   explicit SPDIFAudioSink(uint8_t spdifPin);
@@ -21,8 +27,19 @@ class SPDIFAudioSink : public BufferedAudioSink {
   void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
   bool setParams(uint32_t sampleRate, uint8_t channelCount,
                  uint8_t bitDepth) override;
+  size_t queuedFrames() override;
+  // Also drops the partly encoded block
+  void flush() override;
 
- private:
+  /**
+   * Switches to compressed data, the IEC 61937 bursts of an IEC61937Packer
+   * fed as 16-bit stereo frames through feedPCMFrames(). Channel status
+   * flags the stream as non-audio, and the bursts go out bit exact.
+   * setParams() switches back to PCM.
+   * @param sampleRate IEC61937Packer::getCarrierRate(), 96 kHz at most,
+   * which leaves E-AC-3 out
+   */
+  bool setBitstream(uint32_t sampleRate);
 };
 
 #endif
\ No newline at end of file
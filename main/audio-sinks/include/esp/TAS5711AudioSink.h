@@ -6,9 +6,11 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "BufferedAudioSink.h"
+#include "codec_regs.h"
 #include "driver/i2s.h"
 #include "esp_err.h"
 #include "esp_log.h"
@@ -18,11 +20,13 @@ class TAS5711AudioSink : public BufferedAudioSink {
   TAS5711AudioSink();
   ~TAS5711AudioSink();
 
+  void volumeChanged(uint16_t volume) override;
   void writeReg(uint8_t reg, uint8_t value);
 
  private:
   i2c_config_t i2c_config;
   i2c_port_t i2c_port = I2C_NUM_0;
+  codec_regs_t regs;
 };
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef _CODEC_REGS_H
+#define _CODEC_REGS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "driver/i2c.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shadow of a codec's registers, shared by the I2C codec drivers.
+ *
+ * Writes of the value a register already holds are dropped. The others are
+ * queued in order, each sequence between codec_regs_begin() and
+ * codec_regs_commit() goes out as a single I2C transaction, with runs of
+ * consecutive registers as one auto-increment burst on chips that support
+ * it. Reads of registers written through the map come from the shadow
+ * without touching the bus.
+ */
+
+/* Writes queued before an implicit commit */
+#define CODEC_REGS_QUEUE 48
+
+typedef struct {
+  i2c_port_t port;
+  uint8_t address; /* 7-bit */
+  uint8_t width;   /* bytes per register value, 1 or 2, MSB first */
+  bool burst;      /* the chip increments the address on sequential writes */
+  int depth;       /* nested codec_regs_begin() calls */
+  uint16_t values[256];
+  uint32_t known[256 / 32];
+  uint8_t queued;
+  struct {
+    uint8_t reg;
+    uint16_t value;
+  } queue[CODEC_REGS_QUEUE];
+} codec_regs_t;
+
+void codec_regs_init(codec_regs_t* regs, i2c_port_t port, uint8_t address,
+                     uint8_t width, bool burst);
+
+/* Forgets every value, e.g. after a soft reset of the chip */
+void codec_regs_invalidate(codec_regs_t* regs);
+
+/* Queues writes until the matching codec_regs_commit() */
+void codec_regs_begin(codec_regs_t* regs);
+esp_err_t codec_regs_commit(codec_regs_t* regs);
+
+/* Written at once outside of begin() / commit(), dropped if unchanged */
+esp_err_t codec_regs_write(codec_regs_t* regs, uint8_t reg, uint16_t value);
+/* Changes the bits of mask to those of value */
+esp_err_t codec_regs_update(codec_regs_t* regs, uint8_t reg, uint16_t mask,
+                            uint16_t value);
+
+/* From the shadow once known, from the chip the first time */
+esp_err_t codec_regs_read(codec_regs_t* regs, uint8_t reg, uint16_t* value);
+/* Always from the chip, for status and ID registers */
+esp_err_t codec_regs_read_volatile(codec_regs_t* regs, uint8_t reg,
+                                   uint16_t* value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
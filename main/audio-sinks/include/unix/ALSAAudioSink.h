@@ -6,101 +6,80 @@
 #include <unistd.h>
 #include <fstream>
 #include <memory>
-#include <mutex>
+#include <string>
 #include <vector>
 #include "AudioSink.h"
+#include "SlotRing.h"
+#include "WrappedSemaphore.h"
 
 #define PCM_DEVICE "default"
 
-template <typename T, int SIZE>
-class RingbufferPointer {
-  typedef std::unique_ptr<T> TPointer;
-
- public:
-  explicit RingbufferPointer() {
-    // create objects
-    for (int i = 0; i < SIZE; i++) {
-      buf_[i] = std::make_unique<T>();
-    }
-  }
-
-  bool push(TPointer& item) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (full())
-      return false;
-
-    std::swap(buf_[head_], item);
-
-    if (full_)
-      tail_ = (tail_ + 1) % max_size_;
-
-    head_ = (head_ + 1) % max_size_;
-    full_ = head_ == tail_;
-
-    return true;
-  }
-
-  bool pop(TPointer& item) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (empty())
-      return false;
-
-    std::swap(buf_[tail_], item);
-
-    full_ = false;
-    tail_ = (tail_ + 1) % max_size_;
-
-    return true;
-  }
-
-  void reset() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    head_ = tail_;
-    full_ = false;
-  }
-
-  bool empty() const { return (!full_ && (head_ == tail_)); }
-
-  bool full() const { return full_; }
-
-  int capacity() const { return max_size_; }
-
-  int size() const {
-    int size = max_size_;
-
-    if (!full_) {
-      if (head_ >= tail_)
-        size = head_ - tail_;
-      else
-        size = max_size_ + head_ - tail_;
-    }
-
-    return size;
-  }
-
- private:
-  TPointer buf_[SIZE];
-
-  std::mutex mutex_;
-  int head_ = 0;
-  int tail_ = 0;
-  const int max_size_ = SIZE;
-  bool full_ = 0;
-};
-
+/**
+ * In the default read/write mode periods are filled in place in a
+ * preallocated ring, the task writes them to the device as they complete.
+ * Neither side allocates or polls, the task sleeps until a period is ready
+ * and feedPCMFrames() until one is free.
+ *
+ * In mmap mode there's no task nor ring, feedPCMFrames() copies straight
+ * into the device's buffer and sleeps in snd_pcm_wait() while it's full.
+ */
 class ALSAAudioSink : public AudioSink, public bell::Task {
  public:
-  ALSAAudioSink();
+  struct Config {
+    std::string device = PCM_DEVICE;
+    // Fewer, longer periods mean fewer wakeups but more latency
+    unsigned int periodUs = 800;
+    // 0 lets the device pick
+    unsigned int bufferUs = 0;
+    // Falls back to read/write if the device can't
+    bool mmap = false;
+  };
+
+  ALSAAudioSink() : ALSAAudioSink(Config()) {}
+  ALSAAudioSink(const Config& config);
   ~ALSAAudioSink();
   void feedPCMFrames(const uint8_t* buffer, size_t bytes);
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
   void runTask();
+  // Periods in the ring plus the device's delay
+  size_t queuedFrames() override;
+  // snd_pcm_drop() and the ring emptied, the device restarts on the next
+  // frames fed
+  void flush() override;
 
  private:
-  RingbufferPointer<std::vector<uint8_t>, 3> ringbuffer;
-  unsigned int pcm;
-  snd_pcm_t* pcm_handle;
-  snd_pcm_hw_params_t* params;
+  static constexpr size_t PERIODS = 3;
+  // 8 channels of 32-bit samples
+  static constexpr size_t MAX_FRAME_SIZE = 32;
+
+  Config config;
+  bool mmapAccess = false;
+
+  bell::SlotRing<std::vector<uint8_t>> ringbuffer;
+  // Given once a period is committed / released
+  bell::WrappedSemaphore filledSem, freeSem;
+  // Period being filled by feedPCMFrames() and how much of it is
+  std::vector<uint8_t>* filling = nullptr;
+  size_t filled = 0;
+
+  // Start of a frame split between two feedPCMFrames() calls, mmap only
+  uint8_t partialFrame[MAX_FRAME_SIZE];
+  size_t partialSize = 0;
+
+  int pcm;
+  snd_pcm_t* pcm_handle = nullptr;
   snd_pcm_uframes_t frames;
+  size_t frameSize = 4;
   int buff_size;
-  std::vector<uint8_t> buff;
+
+  void onStopRequested() override;
+  bool openStream(uint32_t sampleRate, uint8_t channelCount,
+                  snd_pcm_format_t format);
+  // snd_pcm_recover(), false if the stream can't be recovered
+  bool recover(int err);
+  // Writes whole frames into the mmap area
+  void writeMmap(const uint8_t* buffer, snd_pcm_uframes_t count);
 };
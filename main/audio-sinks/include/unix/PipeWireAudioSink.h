@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/raw.h>
+#include <cstdint>
+#include <string>
+#include "AudioSink.h"
+
+/**
+ * Plays through a PipeWire stream instead of its ALSA plugin. The stream
+ * maps its buffers, feedPCMFrames() copies straight into the graph's shared
+ * memory and queues each buffer once full, sleeping while all of them are
+ * queued. There's no ring of our own, the buffers bound the latency.
+ *
+ * The stream asks for the graph to run at its own rate so that nothing
+ * resamples, and at config.quantum. queuedFrames() includes the graph's
+ * latency down to the device.
+ */
+class PipeWireAudioSink : public AudioSink {
+ public:
+  struct Config {
+    // Node name or serial to connect to, empty for the default sink
+    std::string target;
+    // Frames per graph cycle asked for, PipeWire may pick another
+    uint32_t quantum = 256;
+    // Buffers shared with the graph, each of a quantum
+    uint32_t buffers = 3;
+  };
+
+  PipeWireAudioSink() : PipeWireAudioSink(Config()) {}
+  PipeWireAudioSink(const Config& config);
+  ~PipeWireAudioSink() override;
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  // The filling buffer, queued ones and the graph's latency
+  size_t queuedFrames() override;
+  // Drops the buffers queued to the graph and what's in the filling one
+  void flush() override;
+
+ private:
+  Config config;
+  pw_thread_loop* loop = nullptr;
+  pw_stream* stream = nullptr;
+  // Set by the loop when the stream fails, feedPCMFrames() gives up then
+  bool failed = false;
+
+  size_t frameSize = 4;
+  // Buffer being filled by feedPCMFrames(), its capacity and how much of it
+  // is filled, in bytes
+  pw_buffer* filling = nullptr;
+  size_t capacity = 0;
+  size_t filled = 0;
+
+  static const pw_stream_events streamEvents;
+  static void onStateChanged(void* userData, pw_stream_state old,
+                             pw_stream_state state, const char* error);
+  static void onParamChanged(void* userData, uint32_t id,
+                             const spa_pod* param);
+  static void onProcess(void* userData);
+
+  bool openStream(uint32_t sampleRate, uint8_t channelCount,
+                  spa_audio_format format, size_t sampleSize);
+  // Loop locked
+  void closeStream();
+  void queueFilling();
+};
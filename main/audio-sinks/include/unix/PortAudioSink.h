@@ -2,18 +2,63 @@
 
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "AudioSink.h"
+#include "CircularBuffer.h"
+#include "WrappedSemaphore.h"
 #include "portaudio.h"
 
+/**
+ * Writes to the default output device, either through PortAudio's blocking
+ * API or, in callback mode, from a lock-free ring that PortAudio's callback
+ * drains. feedPCMFrames() then only blocks while the ring is full, and the
+ * ring's length bounds the added latency.
+ */
 class PortAudioSink : public AudioSink {
  public:
-  PortAudioSink();
+  struct Config {
+    bool callback = false;
+    // Seconds, passed to PortAudio as suggestedLatency
+    double latency = 0.050;
+    // 0 lets PortAudio pick in callback mode, 4096 bytes worth otherwise
+    unsigned long framesPerBuffer = 0;
+    // Length of the callback ring
+    uint32_t ringMs = 20;
+  };
+
+  PortAudioSink() : PortAudioSink(Config()) {}
+  PortAudioSink(const Config& config);
   ~PortAudioSink() override;
   void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
   bool setParams(uint32_t sampleRate, uint8_t channelCount,
                  uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  // The callback ring plus PortAudio's output latency
+  size_t queuedFrames() override;
+  // Aborts the stream, dropping PortAudio's buffers and the ring
+  void flush() override;
 
  private:
+  Config config;
   PaStream* stream = nullptr;
+
+  // Bytes per interleaved frame of the open stream
+  size_t frameSize = 4;
+
+  // Callback mode, filled by feedPCMFrames()
+  std::unique_ptr<bell::CircularBuffer> ring;
+  // Given by the callback after taking data from the ring
+  bell::WrappedSemaphore freeSem;
+  // Callback thread only, whether the last callback had data for all frames
+  bool playing = false;
+
+  static int streamCallback(const void* input, void* output,
+                            unsigned long frameCount,
+                            const PaStreamCallbackTimeInfo* timeInfo,
+                            PaStreamCallbackFlags statusFlags, void* userData);
+
+  bool openStream(uint32_t sampleRate, uint8_t channelCount,
+                  PaSampleFormat sampleFormat, size_t sampleSize);
 };
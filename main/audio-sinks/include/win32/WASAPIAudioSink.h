@@ -0,0 +1,76 @@
+#pragma once
+
+// Before the Windows headers, it brings winsock2.h
+#include <BellTask.h>
+
+#include <audioclient.h>
+#include <mmdeviceapi.h>
+#include <cstdint>
+#include <memory>
+#include "AudioSink.h"
+#include "CircularBuffer.h"
+#include "WrappedSemaphore.h"
+
+/**
+ * Plays through the default render endpoint with WASAPI, event driven: the
+ * task sleeps until the device wants a buffer and fills it from a lock-free
+ * ring, feedPCMFrames() only blocks while the ring is full.
+ *
+ * In exclusive mode the stream bypasses the audio engine, the device plays
+ * the format as is with a period down to its minimum. Falls back to shared
+ * mode, which the engine mixes and resamples, if the device refuses it.
+ */
+class WASAPIAudioSink : public AudioSink, public bell::Task {
+ public:
+  struct Config {
+    bool exclusive = true;
+    // Device period, 0 for the shortest the mode allows
+    uint32_t periodUs = 0;
+    // Length of the ring, rounded up to a device buffer
+    uint32_t ringMs = 10;
+  };
+
+  WASAPIAudioSink() : WASAPIAudioSink(Config()) {}
+  WASAPIAudioSink(const Config& config);
+  ~WASAPIAudioSink() override;
+  void feedPCMFrames(const uint8_t* buffer, size_t bytes) override;
+  bool setParams(uint32_t sampleRate, uint8_t channelCount,
+                 uint8_t bitDepth) override;
+  bool setFormat(uint32_t sampleRate, uint8_t channelCount,
+                 bell::PcmFormat format) override;
+  void runTask() override;
+  // The ring, the device buffer and the stream's latency
+  size_t queuedFrames() override;
+  // Resets the client, dropping the device buffer, and empties the ring
+  void flush() override;
+
+ private:
+  Config config;
+  bool comInitialized = false;
+
+  IMMDevice* device = nullptr;
+  IAudioClient* client = nullptr;
+  IAudioRenderClient* render = nullptr;
+  // Signaled by the device whenever a buffer is wanted
+  HANDLE event = NULL;
+  bool exclusive = false;
+  UINT32 bufferFrames = 0;
+  // Stream latency, in frames
+  size_t latencyFrames = 0;
+
+  size_t frameSize = 4;
+  std::unique_ptr<bell::CircularBuffer> ring;
+  // Given by the task after taking data from the ring
+  bell::WrappedSemaphore freeSem;
+  // Task only, whether the last buffer had data for all frames
+  bool playing = false;
+
+  void onStopRequested() override;
+  bool openStream(uint32_t sampleRate, uint8_t channelCount, bool isFloat,
+                  size_t sampleSize, uint16_t validBits);
+  // Initializes client in the given mode, false if the device refuses it
+  bool initializeClient(const WAVEFORMATEX* format, bool exclusiveMode);
+  void closeStream();
+  // Fills frames of the device buffer from the ring
+  void fillBuffer(UINT32 frames);
+};
@@ -1,75 +1,217 @@
 #include "ALSAAudioSink.h"
 
-ALSAAudioSink::ALSAAudioSink() : Task("", 0, 0, 0) {
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "BellTrace.h"    // for BELL_TRACE_SCOPE
+
+ALSAAudioSink::ALSAAudioSink(const Config& config)
+    : Task("", 0, 0, 0),
+      config(config),
+      ringbuffer(PERIODS),
+      filledSem(PERIODS),
+      freeSem(PERIODS) {
   /* Open the PCM device in playback mode */
-  if (pcm = snd_pcm_open(&pcm_handle, PCM_DEVICE, SND_PCM_STREAM_PLAYBACK, 0) <
-            0) {
-    printf("ERROR: Can't open \"%s\" PCM device. %s\n", PCM_DEVICE,
+  if ((pcm = snd_pcm_open(&pcm_handle, config.device.c_str(),
+                          SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+    printf("ERROR: Can't open \"%s\" PCM device. %s\n", config.device.c_str(),
            snd_strerror(pcm));
+    pcm_handle = nullptr;
+    return;
   }
 
-  /* Allocate parameters object and fill it with default values*/
-  snd_pcm_hw_params_alloca(&params);
+  /* Resume information */
+  printf("PCM name: '%s'\n", snd_pcm_name(pcm_handle));
+  printf("PCM state: %s\n", snd_pcm_state_name(snd_pcm_state(pcm_handle)));
+  // Feeds the device, underruns if preempted too long
+  this->scheduling.policy = Policy::AUDIO;
+  this->setParams(44100, 2, 16);
+}
+
+ALSAAudioSink::~ALSAAudioSink() {
+  stopTask();
+  if (pcm_handle) {
+    snd_pcm_drain(pcm_handle);
+    snd_pcm_close(pcm_handle);
+  }
+}
+
+bool ALSAAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                              uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 32:
+      return openStream(sampleRate, channelCount, SND_PCM_FORMAT_S32_LE);
+    case 24:
+      // Packed, as PortAudioSink's paInt24
+      return openStream(sampleRate, channelCount, SND_PCM_FORMAT_S24_3LE);
+    case 16:
+      return openStream(sampleRate, channelCount, SND_PCM_FORMAT_S16_LE);
+    default:
+      return false;
+  }
+}
+
+bool ALSAAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                              bell::PcmFormat format) {
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return openStream(sampleRate, channelCount, SND_PCM_FORMAT_S16_LE);
+    case bell::PcmFormat::INT24_IN_32:
+    case bell::PcmFormat::INT32:
+      // Left-justified 24-bit plays as is through a 32-bit stream
+      return openStream(sampleRate, channelCount, SND_PCM_FORMAT_S32_LE);
+    case bell::PcmFormat::FLOAT32:
+      return openStream(sampleRate, channelCount, SND_PCM_FORMAT_FLOAT_LE);
+  }
+  return false;
+}
+
+bool ALSAAudioSink::openStream(uint32_t sampleRate, uint8_t channelCount,
+                               snd_pcm_format_t format) {
+  if (!pcm_handle)
+    return false;
+  size_t newFrameSize =
+      channelCount * snd_pcm_format_physical_width(format) / 8;
+  if (newFrameSize == 0 || newFrameSize > MAX_FRAME_SIZE)
+    return false;
+
+  // The device plays out its buffer, periods left in the ring are dropped
+  stopTask();
+  snd_pcm_drain(pcm_handle);
+  ringbuffer.clear();
+  filling = nullptr;
+  partialSize = 0;
 
+  snd_pcm_hw_params_t* params;
+  snd_pcm_hw_params_alloca(&params);
   snd_pcm_hw_params_any(pcm_handle, params);
 
-  /* Set parameters */
-  if (pcm = snd_pcm_hw_params_set_access(pcm_handle, params,
-                                         SND_PCM_ACCESS_RW_INTERLEAVED) < 0)
+  mmapAccess = config.mmap && snd_pcm_hw_params_set_access(
+                                  pcm_handle, params,
+                                  SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+  if (config.mmap && !mmapAccess)
+    printf("mmap access not supported, using read/write\n");
+  if (!mmapAccess &&
+      (pcm = snd_pcm_hw_params_set_access(pcm_handle, params,
+                                          SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
     printf("ERROR: Can't set interleaved mode. %s\n", snd_strerror(pcm));
+    return false;
+  }
 
-  if (pcm = snd_pcm_hw_params_set_format(pcm_handle, params,
-                                         SND_PCM_FORMAT_S16_LE) < 0)
+  // The caller converts when the device can't take the format
+  if ((pcm = snd_pcm_hw_params_set_format(pcm_handle, params, format)) < 0) {
     printf("ERROR: Can't set format. %s\n", snd_strerror(pcm));
-
-  if (pcm = snd_pcm_hw_params_set_channels(pcm_handle, params, 2) < 0)
+    return false;
+  }
+  if ((pcm = snd_pcm_hw_params_set_channels(pcm_handle, params,
+                                            channelCount)) < 0) {
     printf("ERROR: Can't set channels number. %s\n", snd_strerror(pcm));
-  unsigned int rate = 44100;
-  if (pcm = snd_pcm_hw_params_set_rate_near(pcm_handle, params, &rate, 0) < 0)
+    return false;
+  }
+  unsigned int rate = sampleRate;
+  if ((pcm = snd_pcm_hw_params_set_rate_near(pcm_handle, params, &rate, 0)) <
+      0)
     printf("ERROR: Can't set rate. %s\n", snd_strerror(pcm));
-  unsigned int periodTime = 800;
+  unsigned int periodTime = config.periodUs;
   int dir = -1;
   snd_pcm_hw_params_set_period_time_near(pcm_handle, params, &periodTime, &dir);
+  if (config.bufferUs > 0) {
+    unsigned int bufferTime = config.bufferUs;
+    dir = 0;
+    snd_pcm_hw_params_set_buffer_time_near(pcm_handle, params, &bufferTime,
+                                           &dir);
+  }
   /* Write parameters */
-  if (pcm = snd_pcm_hw_params(pcm_handle, params) < 0)
+  if ((pcm = snd_pcm_hw_params(pcm_handle, params)) < 0) {
     printf("ERROR: Can't set harware parameters. %s\n", snd_strerror(pcm));
+    return false;
+  }
 
-  /* Resume information */
-  printf("PCM name: '%s'\n", snd_pcm_name(pcm_handle));
-
-  printf("PCM state: %s\n", snd_pcm_state_name(snd_pcm_state(pcm_handle)));
   unsigned int tmp;
-  snd_pcm_hw_params_get_channels(params, &tmp);
-  printf("channels: %i ", tmp);
-  if (tmp == 1)
-    printf("(mono)\n");
-  else if (tmp == 2)
-    printf("(stereo)\n");
-
   snd_pcm_hw_params_get_period_time(params, &tmp, NULL);
-  printf("period_time = %d\n", tmp);
+  printf("rate = %d, channels = %d, %s, period_time = %d\n", rate,
+         channelCount, snd_pcm_format_name(format), tmp);
   snd_pcm_hw_params_get_period_size(params, &frames, 0);
+  snd_pcm_uframes_t bufferFrames;
+  snd_pcm_hw_params_get_buffer_size(params, &bufferFrames);
 
-  this->buff_size = frames * 2 * 2 /* 2 -> sample size */;
+  this->frameSize = newFrameSize;
+  this->outputRate = rate;
+  this->buff_size = frames * frameSize;
   printf("required buff_size: %d\n", buff_size);
-  this->startTask();
+
+  if (mmapAccess) {
+    // Nothing else starts it, begin once the device buffer is full
+    snd_pcm_sw_params_t* swParams;
+    snd_pcm_sw_params_alloca(&swParams);
+    snd_pcm_sw_params_current(pcm_handle, swParams);
+    snd_pcm_sw_params_set_start_threshold(pcm_handle, swParams, bufferFrames);
+    snd_pcm_sw_params(pcm_handle, swParams);
+    return true;
+  }
+
+  // Size every period once, the ring then starts out empty
+  for (size_t i = 0; i < PERIODS; i++) {
+    filling = ringbuffer.reserve();
+    filling->resize(buff_size);
+    ringbuffer.commit();
+  }
+  ringbuffer.clear();
+  filling = nullptr;
+  return this->startTask();
 }
 
-ALSAAudioSink::~ALSAAudioSink() {
-  snd_pcm_drain(pcm_handle);
-  snd_pcm_close(pcm_handle);
+size_t ALSAAudioSink::queuedFrames() {
+  if (!pcm_handle)
+    return 0;
+  size_t queued = 0;
+  if (!mmapAccess) {
+    queued = ringbuffer.size() * frames;
+    if (filling)
+      queued += filled / frameSize;
+  }
+  // Frames written to the device until the next one is heard
+  snd_pcm_sframes_t delay = 0;
+  if (snd_pcm_delay(pcm_handle, &delay) == 0 && delay > 0)
+    queued += delay;
+  return queued;
+}
+
+void ALSAAudioSink::flush() {
+  if (!pcm_handle)
+    return;
+  bool restart = isTaskRunning();
+  stopTask();
+  // Drops the device's buffer, prepare leaves it ready to start again
+  snd_pcm_drop(pcm_handle);
+  snd_pcm_prepare(pcm_handle);
+  ringbuffer.clear();
+  filling = nullptr;
+  filled = 0;
+  partialSize = 0;
+  if (restart)
+    startTask();
+}
+
+void ALSAAudioSink::onStopRequested() {
+  filledSem.give();
+  freeSem.give();
 }
 
 void ALSAAudioSink::runTask() {
-  std::unique_ptr<std::vector<uint8_t>> dataPtr;
-  while (true) {
-    if (!this->ringbuffer.pop(dataPtr)) {
-      usleep(100);
+  while (!isStopRequested()) {
+    std::vector<uint8_t>* period = this->ringbuffer.peek();
+    if (!period) {
+      filledSem.wait();
       continue;
     }
-    if (pcm = snd_pcm_writei(pcm_handle, dataPtr->data(), this->frames) ==
-              -EPIPE) {
-
+    pcm = snd_pcm_writei(pcm_handle, period->data(), this->frames);
+    this->ringbuffer.release();
+    freeSem.give();
+    if (pcm == -EPIPE) {
+      BELL_METRIC_COUNT("sink.underruns", 1);
+      BELL_METRIC_COUNT("alsa.epipe_recoveries", 1);
       snd_pcm_prepare(pcm_handle);
     } else if (pcm < 0) {
       printf("ERROR. Can't write to PCM device. %s\n", snd_strerror(pcm));
@@ -77,16 +219,102 @@ void ALSAAudioSink::runTask() {
   }
 }
 
+bool ALSAAudioSink::recover(int err) {
+  if (err == -EPIPE) {
+    BELL_METRIC_COUNT("sink.underruns", 1);
+    BELL_METRIC_COUNT("alsa.epipe_recoveries", 1);
+  }
+  if ((pcm = snd_pcm_recover(pcm_handle, err, 1)) < 0) {
+    printf("ERROR. Can't write to PCM device. %s\n", snd_strerror(pcm));
+    return false;
+  }
+  return true;
+}
+
+void ALSAAudioSink::writeMmap(const uint8_t* buffer, snd_pcm_uframes_t count) {
+  while (count > 0) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm_handle);
+    if (avail < 0) {
+      if (!recover(avail))
+        return;
+      continue;
+    }
+    if ((snd_pcm_uframes_t)avail < std::min(count, frames)) {
+      // Below the start threshold without room for a period, start now
+      if (snd_pcm_state(pcm_handle) == SND_PCM_STATE_PREPARED)
+        snd_pcm_start(pcm_handle);
+      // Wakes once a period is free
+      if ((pcm = snd_pcm_wait(pcm_handle, 1000)) < 0 && !recover(pcm))
+        return;
+      continue;
+    }
+
+    const snd_pcm_channel_area_t* areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t toWrite = count;
+    if ((pcm = snd_pcm_mmap_begin(pcm_handle, &areas, &offset, &toWrite)) <
+        0) {
+      if (!recover(pcm))
+        return;
+      continue;
+    }
+    // Interleaved, every channel shares the first area
+    uint8_t* dst = static_cast<uint8_t*>(areas[0].addr) +
+                   (areas[0].first + offset * areas[0].step) / 8;
+    memcpy(dst, buffer, toWrite * frameSize);
+    snd_pcm_sframes_t committed =
+        snd_pcm_mmap_commit(pcm_handle, offset, toWrite);
+    if (committed < 0) {
+      if (!recover(committed))
+        return;
+      continue;
+    }
+    buffer += committed * frameSize;
+    count -= committed;
+  }
+}
+
 void ALSAAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  BELL_TRACE_SCOPE("sink.feed");
+  if (mmapAccess) {
+    if (partialSize > 0) {
+      size_t toCopy = std::min(bytes, frameSize - partialSize);
+      memcpy(partialFrame + partialSize, buffer, toCopy);
+      partialSize += toCopy;
+      buffer += toCopy;
+      bytes -= toCopy;
+      if (partialSize < frameSize)
+        return;
+      writeMmap(partialFrame, 1);
+      partialSize = 0;
+    }
+    writeMmap(buffer, bytes / frameSize);
+    partialSize = bytes % frameSize;
+    memcpy(partialFrame, buffer + bytes - partialSize, partialSize);
+    return;
+  }
 
-  buff.insert(buff.end(), buffer, buffer + bytes);
-  while (buff.size() > this->buff_size) {
-    auto ptr = std::make_unique<std::vector<uint8_t>>(
-        this->buff.begin(), this->buff.begin() + this->buff_size);
-    this->buff = std::vector<uint8_t>(this->buff.begin() + this->buff_size,
-                                      this->buff.end());
-    while (!this->ringbuffer.push(ptr)) {
-      usleep(100);
-    };
+  while (bytes > 0) {
+    if (!filling) {
+      filling = this->ringbuffer.reserve();
+      if (!filling) {
+        // Every period is queued, wait for the device to take one
+        if (isStopRequested() || !isTaskRunning())
+          return;
+        freeSem.wait();
+        continue;
+      }
+      filled = 0;
+    }
+    size_t toCopy = std::min(bytes, (size_t)buff_size - filled);
+    memcpy(filling->data() + filled, buffer, toCopy);
+    filled += toCopy;
+    buffer += toCopy;
+    bytes -= toCopy;
+    if (filled == (size_t)buff_size) {
+      this->ringbuffer.commit();
+      filling = nullptr;
+      filledSem.give();
+    }
   }
 }
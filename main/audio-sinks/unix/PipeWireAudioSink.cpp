@@ -0,0 +1,264 @@
+#include "PipeWireAudioSink.h"
+
+#include <spa/param/audio/format-utils.h>  // for spa_format_audio_raw_build
+#include <spa/param/buffers.h>             // for SPA_PARAM_BUFFERS_buffers
+#include <spa/pod/builder.h>               // for spa_pod_builder
+#include <errno.h>                         // for errno
+#include <stdio.h>                         // for printf
+#include <string.h>                        // for memcpy, strerror
+#include <algorithm>                       // for min
+#include <string>                          // for to_string
+
+#include "BellTrace.h"  // for BELL_TRACE_SCOPE
+
+const pw_stream_events PipeWireAudioSink::streamEvents = [] {
+  pw_stream_events events = {};
+  events.version = PW_VERSION_STREAM_EVENTS;
+  events.state_changed = onStateChanged;
+  events.param_changed = onParamChanged;
+  events.process = onProcess;
+  return events;
+}();
+
+PipeWireAudioSink::PipeWireAudioSink(const Config& config) : config(config) {
+  pw_init(NULL, NULL);
+  loop = pw_thread_loop_new("bell-pipewire", NULL);
+  if (!loop || pw_thread_loop_start(loop) < 0) {
+    printf("ERROR: Can't start the PipeWire loop\n");
+    return;
+  }
+  this->setParams(44100, 2, 16);
+}
+
+PipeWireAudioSink::~PipeWireAudioSink() {
+  if (loop) {
+    pw_thread_loop_lock(loop);
+    closeStream();
+    pw_thread_loop_unlock(loop);
+    pw_thread_loop_stop(loop);
+    pw_thread_loop_destroy(loop);
+  }
+  pw_deinit();
+}
+
+bool PipeWireAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                                  uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 32:
+      return openStream(sampleRate, channelCount, SPA_AUDIO_FORMAT_S32_LE, 4);
+    case 24:
+      // Packed, as PortAudioSink's paInt24
+      return openStream(sampleRate, channelCount, SPA_AUDIO_FORMAT_S24_LE, 3);
+    case 16:
+      return openStream(sampleRate, channelCount, SPA_AUDIO_FORMAT_S16_LE, 2);
+    default:
+      return false;
+  }
+}
+
+bool PipeWireAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                                  bell::PcmFormat format) {
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return openStream(sampleRate, channelCount, SPA_AUDIO_FORMAT_S16_LE, 2);
+    case bell::PcmFormat::INT24_IN_32:
+    case bell::PcmFormat::INT32:
+      // Left-justified 24-bit plays as is through a 32-bit stream
+      return openStream(sampleRate, channelCount, SPA_AUDIO_FORMAT_S32_LE, 4);
+    case bell::PcmFormat::FLOAT32:
+      return openStream(sampleRate, channelCount, SPA_AUDIO_FORMAT_F32_LE, 4);
+  }
+  return false;
+}
+
+void PipeWireAudioSink::closeStream() {
+  if (stream) {
+    // Frames in the filling buffer and queued ones are dropped
+    pw_stream_destroy(stream);
+    stream = nullptr;
+  }
+  filling = nullptr;
+  filled = 0;
+  failed = false;
+}
+
+bool PipeWireAudioSink::openStream(uint32_t sampleRate, uint8_t channelCount,
+                                   spa_audio_format format,
+                                   size_t sampleSize) {
+  if (!loop || channelCount == 0 || channelCount > SPA_AUDIO_MAX_CHANNELS)
+    return false;
+
+  // node.rate has the graph switch to the stream's rate when the server
+  // allows it, rather than resampling
+  std::string rate = "1/" + std::to_string(sampleRate);
+  std::string latency =
+      std::to_string(config.quantum) + "/" + std::to_string(sampleRate);
+  pw_properties* props = pw_properties_new(
+      PW_KEY_MEDIA_TYPE, "Audio", PW_KEY_MEDIA_CATEGORY, "Playback",
+      PW_KEY_MEDIA_ROLE, "Music", PW_KEY_NODE_RATE, rate.c_str(),
+      PW_KEY_NODE_LATENCY, latency.c_str(), NULL);
+  if (!config.target.empty())
+    pw_properties_set(props, PW_KEY_TARGET_OBJECT, config.target.c_str());
+
+  spa_audio_info_raw info = {};
+  info.format = format;
+  info.rate = sampleRate;
+  info.channels = channelCount;
+  if (channelCount == 2) {
+    info.position[0] = SPA_AUDIO_CHANNEL_FL;
+    info.position[1] = SPA_AUDIO_CHANNEL_FR;
+  } else if (channelCount == 1) {
+    info.position[0] = SPA_AUDIO_CHANNEL_MONO;
+  } else {
+    // Left to the session manager's channel map
+    info.flags = SPA_AUDIO_FLAG_UNPOSITIONED;
+  }
+  uint8_t podBuffer[1024];
+  spa_pod_builder builder;
+  spa_pod_builder_init(&builder, podBuffer, sizeof(podBuffer));
+  const spa_pod* params[1] = {
+      spa_format_audio_raw_build(&builder, SPA_PARAM_EnumFormat, &info)};
+
+  pw_thread_loop_lock(loop);
+  closeStream();
+  frameSize = channelCount * sampleSize;
+  stream = pw_stream_new_simple(pw_thread_loop_get_loop(loop), "bell", props,
+                                &streamEvents, this);
+  int err = stream ? 0 : -errno;
+  if (stream) {
+    // MAP_BUFFERS, the buffers' memory is ours to write into
+    err = pw_stream_connect(
+        stream, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+        (pw_stream_flags)(PW_STREAM_FLAG_AUTOCONNECT |
+                          PW_STREAM_FLAG_MAP_BUFFERS),
+        params, 1);
+    if (err < 0)
+      closeStream();
+  }
+  pw_thread_loop_unlock(loop);
+  if (err < 0) {
+    printf("ERROR: Can't create the PipeWire stream. %s\n", strerror(-err));
+    return false;
+  }
+
+  printf("PipeWire: rate = %u, channels = %d, quantum = %u\n", sampleRate,
+         channelCount, config.quantum);
+  this->outputRate = sampleRate;
+  return true;
+}
+
+void PipeWireAudioSink::onStateChanged(void* userData, pw_stream_state old,
+                                       pw_stream_state state,
+                                       const char* error) {
+  PipeWireAudioSink* self = static_cast<PipeWireAudioSink*>(userData);
+  if (state == PW_STREAM_STATE_ERROR) {
+    printf("ERROR: PipeWire stream failed. %s\n", error ? error : "");
+    self->failed = true;
+  }
+  // Wakes feedPCMFrames() to notice
+  pw_thread_loop_signal(self->loop, false);
+}
+
+void PipeWireAudioSink::onParamChanged(void* userData, uint32_t id,
+                                       const spa_pod* param) {
+  PipeWireAudioSink* self = static_cast<PipeWireAudioSink*>(userData);
+  if (id != SPA_PARAM_Format || param == NULL)
+    return;
+
+  // Once the format is set, as many buffers as asked of a quantum each
+  uint8_t podBuffer[256];
+  spa_pod_builder builder;
+  spa_pod_builder_init(&builder, podBuffer, sizeof(podBuffer));
+  int32_t stride = self->frameSize;
+  int32_t size = self->config.quantum * stride;
+  const spa_pod* params[1] = {(const spa_pod*)spa_pod_builder_add_object(
+      &builder, SPA_TYPE_OBJECT_ParamBuffers, SPA_PARAM_Buffers,
+      SPA_PARAM_BUFFERS_buffers,
+      SPA_POD_CHOICE_RANGE_Int(self->config.buffers, 2, 16),
+      SPA_PARAM_BUFFERS_blocks, SPA_POD_Int(1), SPA_PARAM_BUFFERS_size,
+      SPA_POD_CHOICE_RANGE_Int(size, stride, INT32_MAX),
+      SPA_PARAM_BUFFERS_stride, SPA_POD_Int(stride))};
+  pw_stream_update_params(self->stream, params, 1);
+}
+
+void PipeWireAudioSink::onProcess(void* userData) {
+  // A buffer went back to the stream, feedPCMFrames() may dequeue it
+  PipeWireAudioSink* self = static_cast<PipeWireAudioSink*>(userData);
+  pw_thread_loop_signal(self->loop, false);
+}
+
+void PipeWireAudioSink::queueFilling() {
+  spa_data& data = filling->buffer->datas[0];
+  data.chunk->offset = 0;
+  data.chunk->stride = frameSize;
+  data.chunk->size = filled;
+  pw_stream_queue_buffer(stream, filling);
+  filling = nullptr;
+  filled = 0;
+}
+
+size_t PipeWireAudioSink::queuedFrames() {
+  if (!loop)
+    return 0;
+  pw_thread_loop_lock(loop);
+  size_t queued = 0;
+  pw_time time = {};
+  if (stream && pw_stream_get_time_n(stream, &time, sizeof(time)) == 0) {
+    // Bytes queued in buffers, and frames in the graph until the device,
+    // in ticks of the graph's clock
+    queued = time.queued / frameSize + time.buffered + filled / frameSize;
+    if (time.delay > 0 && time.rate.denom > 0) {
+      queued += (uint64_t)time.delay * time.rate.num * outputRate /
+                time.rate.denom;
+    }
+  }
+  pw_thread_loop_unlock(loop);
+  return queued;
+}
+
+void PipeWireAudioSink::flush() {
+  if (!loop)
+    return;
+  pw_thread_loop_lock(loop);
+  // The filling buffer is kept and refilled from its start
+  filled = 0;
+  if (stream)
+    pw_stream_flush(stream, false);
+  pw_thread_loop_unlock(loop);
+}
+
+void PipeWireAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  BELL_TRACE_SCOPE("sink.feed");
+  if (!loop)
+    return;
+
+  pw_thread_loop_lock(loop);
+  while (bytes > 0 && stream && !failed) {
+    if (!filling) {
+      filling = pw_stream_dequeue_buffer(stream);
+      if (!filling) {
+        // All buffers are with the graph, released by onProcess()
+        pw_thread_loop_timed_wait(loop, 1);
+        continue;
+      }
+      spa_data& data = filling->buffer->datas[0];
+      capacity = data.maxsize;
+      if (filling->requested > 0)
+        capacity = std::min<size_t>(capacity, filling->requested * frameSize);
+      capacity = capacity / frameSize * frameSize;
+      if (data.data == NULL || capacity == 0) {
+        queueFilling();
+        continue;
+      }
+    }
+
+    size_t toCopy = std::min(bytes, capacity - filled);
+    memcpy((uint8_t*)filling->buffer->datas[0].data + filled, buffer, toCopy);
+    filled += toCopy;
+    buffer += toCopy;
+    bytes -= toCopy;
+    if (filled == capacity)
+      queueFilling();
+  }
+  pw_thread_loop_unlock(loop);
+}
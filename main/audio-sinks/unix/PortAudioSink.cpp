@@ -1,57 +1,177 @@
 #include "PortAudioSink.h"
 
-PortAudioSink::PortAudioSink() {
+#include <string.h>   // for memset
+#include <algorithm>  // for max, min
+
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "BellTrace.h"    // for BELL_TRACE_SCOPE
+
+PortAudioSink::PortAudioSink(const Config& config)
+    : config(config), freeSem(1) {
   Pa_Initialize();
   this->setParams(44100, 2, 16);
 }
 
 bool PortAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
                               uint8_t bitDepth) {
-  if (stream) {
-    Pa_StopStream(stream);
-  }
-  PaStreamParameters outputParameters;
-  outputParameters.device = Pa_GetDefaultOutputDevice();
-  if (outputParameters.device == paNoDevice) {
-    printf("PortAudio: Default audio device not found!\n");
-    // exit(0);
-  }
-  printf("PortAudio: Default audio device not found!\n");
-
-  outputParameters.channelCount = channelCount;
+  PaSampleFormat sampleFormat;
   switch (bitDepth) {
     case 32:
-      outputParameters.sampleFormat = paInt32;
+      sampleFormat = paInt32;
       break;
     case 24:
-      outputParameters.sampleFormat = paInt24;
+      sampleFormat = paInt24;
       break;
     case 16:
-      outputParameters.sampleFormat = paInt16;
+      sampleFormat = paInt16;
       break;
     case 8:
-      outputParameters.sampleFormat = paInt8;
+      sampleFormat = paInt8;
       break;
     default:
-      outputParameters.sampleFormat = paInt16;
+      sampleFormat = paInt16;
+      bitDepth = 16;
       break;
   }
-  outputParameters.suggestedLatency = 0.050;
+  return openStream(sampleRate, channelCount, sampleFormat, bitDepth / 8);
+}
+
+bool PortAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                              bell::PcmFormat format) {
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return openStream(sampleRate, channelCount, paInt16, 2);
+    case bell::PcmFormat::INT24_IN_32:
+    case bell::PcmFormat::INT32:
+      // Left-justified 24-bit plays as is through a 32-bit stream
+      return openStream(sampleRate, channelCount, paInt32, 4);
+    case bell::PcmFormat::FLOAT32:
+      return openStream(sampleRate, channelCount, paFloat32, 4);
+  }
+  return false;
+}
+
+bool PortAudioSink::openStream(uint32_t sampleRate, uint8_t channelCount,
+                               PaSampleFormat sampleFormat, size_t sampleSize) {
+  if (stream) {
+    // Plays out what's queued, the callback is done with the ring after
+    Pa_StopStream(stream);
+    Pa_CloseStream(stream);
+    stream = nullptr;
+  }
+  PaStreamParameters outputParameters;
+  outputParameters.device = Pa_GetDefaultOutputDevice();
+  if (outputParameters.device == paNoDevice) {
+    printf("PortAudio: Default audio device not found!\n");
+    return false;
+  }
+
+  outputParameters.channelCount = channelCount;
+  outputParameters.sampleFormat = sampleFormat;
+  outputParameters.suggestedLatency = config.latency;
   outputParameters.hostApiSpecificStreamInfo = NULL;
 
-  PaError err = Pa_OpenStream(&stream, NULL, &outputParameters, sampleRate,
-                              4096 / (channelCount * bitDepth / 8), paClipOff,
-                              NULL,  // blocking api
-                              NULL);
+  frameSize = channelCount * sampleSize;
+  unsigned long framesPerBuffer = config.framesPerBuffer;
+  if (config.callback) {
+    size_t ringFrames = std::max<size_t>(
+        (size_t)sampleRate * config.ringMs / 1000, framesPerBuffer);
+    ring = std::make_unique<bell::CircularBuffer>(
+        ringFrames * frameSize, bell::CircularBuffer::Mode::SPSC);
+    if (framesPerBuffer == 0)
+      framesPerBuffer = paFramesPerBufferUnspecified;
+  } else if (framesPerBuffer == 0) {
+    framesPerBuffer = 4096 / frameSize;
+  }
+
+  PaError err = Pa_OpenStream(
+      &stream, NULL, &outputParameters, sampleRate, framesPerBuffer, paClipOff,
+      config.callback ? streamCallback : NULL,  // NULL for the blocking api
+      this);
+  if (err != paNoError) {
+    printf("PortAudio: %s\n", Pa_GetErrorText(err));
+    stream = nullptr;
+    return false;
+  }
   Pa_StartStream(stream);
-  return !err;
+  outputRate = sampleRate;
+  return true;
 }
 
 PortAudioSink::~PortAudioSink() {
-  Pa_StopStream(stream);
+  if (stream) {
+    Pa_StopStream(stream);
+    Pa_CloseStream(stream);
+  }
   Pa_Terminate();
 }
 
+int PortAudioSink::streamCallback(const void* input, void* output,
+                                  unsigned long frameCount,
+                                  const PaStreamCallbackTimeInfo* timeInfo,
+                                  PaStreamCallbackFlags statusFlags,
+                                  void* userData) {
+  PortAudioSink* self = static_cast<PortAudioSink*>(userData);
+  size_t wanted = frameCount * self->frameSize;
+  // Whole frames only, the rest of one may still be on its way
+  size_t available = self->ring->size() / self->frameSize * self->frameSize;
+  size_t read = self->ring->read(static_cast<uint8_t*>(output),
+                                 std::min(wanted, available));
+  // Underrun, play silence rather than stopping
+  memset(static_cast<uint8_t*>(output) + read, 0, wanted - read);
+  if (read < wanted && self->playing) {
+    // Once per dropout, not for every callback of a stopped stream
+    BELL_METRIC_COUNT("sink.underruns", 1);
+  }
+  self->playing = read == wanted;
+  if (read > 0)
+    self->freeSem.give();
+  return paContinue;
+}
+
+size_t PortAudioSink::queuedFrames() {
+  if (!stream)
+    return 0;
+  const PaStreamInfo* info = Pa_GetStreamInfo(stream);
+  size_t deviceFrames = info ? (size_t)(info->outputLatency * outputRate) : 0;
+  if (config.callback)
+    return ring->size() / frameSize + deviceFrames;
+
+  // The latency covers a full buffer, less what can be written right away
+  signed long writable = Pa_GetStreamWriteAvailable(stream);
+  if (writable < 0)
+    return deviceFrames;
+  return deviceFrames - std::min(deviceFrames, (size_t)writable);
+}
+
+void PortAudioSink::flush() {
+  if (!stream)
+    return;
+  // Unlike Pa_StopStream() doesn't play out, the callback is done with the
+  // ring after
+  Pa_AbortStream(stream);
+  if (config.callback)
+    ring->emptyBuffer();
+  playing = false;
+  Pa_StartStream(stream);
+}
+
 void PortAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
-  Pa_WriteStream(stream, buffer, bytes / 4);
+  BELL_TRACE_SCOPE("sink.feed");
+  if (!stream)
+    return;
+  if (!config.callback) {
+    Pa_WriteStream(stream, buffer, bytes / frameSize);
+    return;
+  }
+
+  while (bytes > 0) {
+    size_t written = ring->write(buffer, bytes);
+    buffer += written;
+    bytes -= written;
+    if (bytes > 0 && written == 0) {
+      // The timeout covers a stream PortAudio stopped on its own
+      freeSem.twait(100);
+    }
+  }
 }
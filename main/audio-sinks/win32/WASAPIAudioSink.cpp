@@ -0,0 +1,337 @@
+#include "WASAPIAudioSink.h"
+
+#include <avrt.h>     // for AvSetMmThreadCharacteristicsW
+#include <stdio.h>    // for printf
+#include <string.h>   // for memset
+#include <algorithm>  // for max, min
+
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+#include "BellTrace.h"    // for BELL_TRACE_SCOPE
+
+namespace {
+// KSDATAFORMAT_SUBTYPE_PCM and _IEEE_FLOAT, without linking ksuser
+const GUID SUBTYPE_PCM = {0x00000001,
+                          0x0000,
+                          0x0010,
+                          {0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71}};
+const GUID SUBTYPE_FLOAT = {0x00000003,
+                            0x0000,
+                            0x0010,
+                            {0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71}};
+
+// 100 ns units of REFERENCE_TIME
+constexpr REFERENCE_TIME UNITS_PER_SECOND = 10000000;
+
+// The usual layouts, exclusive mode may reject a mask of 0
+DWORD channelMask(uint8_t channelCount) {
+  switch (channelCount) {
+    case 1:
+      return SPEAKER_FRONT_CENTER;
+    case 2:
+      return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+    case 4:
+      return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_BACK_LEFT |
+             SPEAKER_BACK_RIGHT;
+    case 6:
+      return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER |
+             SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT;
+    case 8:
+      return SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT | SPEAKER_FRONT_CENTER |
+             SPEAKER_LOW_FREQUENCY | SPEAKER_BACK_LEFT | SPEAKER_BACK_RIGHT |
+             SPEAKER_SIDE_LEFT | SPEAKER_SIDE_RIGHT;
+    default:
+      return 0;
+  }
+}
+
+template <typename T>
+void release(T*& object) {
+  if (object) {
+    object->Release();
+    object = nullptr;
+  }
+}
+}  // namespace
+
+WASAPIAudioSink::WASAPIAudioSink(const Config& config)
+    : Task("", 0, 0, 0), config(config), freeSem(1) {
+  // Free-threaded, the task uses the client set up here
+  comInitialized = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+  // Fills the device, underruns if preempted too long
+  this->scheduling.policy = Policy::AUDIO;
+  this->setParams(44100, 2, 16);
+}
+
+WASAPIAudioSink::~WASAPIAudioSink() {
+  stopTask();
+  closeStream();
+  if (comInitialized) {
+    CoUninitialize();
+  }
+}
+
+bool WASAPIAudioSink::setParams(uint32_t sampleRate, uint8_t channelCount,
+                                uint8_t bitDepth) {
+  switch (bitDepth) {
+    case 32:
+      return openStream(sampleRate, channelCount, false, 4, 32);
+    case 24:
+      // Packed, as PortAudioSink's paInt24
+      return openStream(sampleRate, channelCount, false, 3, 24);
+    case 16:
+      return openStream(sampleRate, channelCount, false, 2, 16);
+    default:
+      return false;
+  }
+}
+
+bool WASAPIAudioSink::setFormat(uint32_t sampleRate, uint8_t channelCount,
+                                bell::PcmFormat format) {
+  switch (format) {
+    case bell::PcmFormat::INT16:
+      return openStream(sampleRate, channelCount, false, 2, 16);
+    case bell::PcmFormat::INT24_IN_32:
+      // Left-justified, exclusive mode takes it as 24 valid bits
+      return openStream(sampleRate, channelCount, false, 4, 24);
+    case bell::PcmFormat::INT32:
+      return openStream(sampleRate, channelCount, false, 4, 32);
+    case bell::PcmFormat::FLOAT32:
+      return openStream(sampleRate, channelCount, true, 4, 32);
+  }
+  return false;
+}
+
+void WASAPIAudioSink::closeStream() {
+  release(render);
+  release(client);
+  release(device);
+  if (event) {
+    CloseHandle(event);
+    event = NULL;
+  }
+}
+
+bool WASAPIAudioSink::initializeClient(const WAVEFORMATEX* format,
+                                       bool exclusiveMode) {
+  release(client);
+  if (FAILED(device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL,
+                              (void**)&client))) {
+    client = nullptr;
+    return false;
+  }
+
+  REFERENCE_TIME period = (REFERENCE_TIME)config.periodUs * 10;
+  HRESULT hr;
+  if (exclusiveMode) {
+    if (period == 0) {
+      REFERENCE_TIME defaultPeriod;
+      client->GetDevicePeriod(&defaultPeriod, &period);
+    }
+    // Event driven, the buffer is one period
+    hr = client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                            AUDCLNT_STREAMFLAGS_EVENTCALLBACK, period, period,
+                            format, NULL);
+    if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED) {
+      // Retries with the period of the aligned buffer it reports
+      UINT32 alignedFrames;
+      client->GetBufferSize(&alignedFrames);
+      period = (REFERENCE_TIME)((double)UNITS_PER_SECOND * alignedFrames /
+                                    format->nSamplesPerSec +
+                                0.5);
+      release(client);
+      if (FAILED(device->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL,
+                                  (void**)&client))) {
+        client = nullptr;
+        return false;
+      }
+      hr = client->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                              AUDCLNT_STREAMFLAGS_EVENTCALLBACK, period,
+                              period, format, NULL);
+    }
+  } else {
+    // The engine converts the format, and sets the period itself
+    hr = client->Initialize(AUDCLNT_SHAREMODE_SHARED,
+                            AUDCLNT_STREAMFLAGS_EVENTCALLBACK |
+                                AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+                                AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+                            period, 0, format, NULL);
+  }
+  if (FAILED(hr)) {
+    printf("WASAPI: Can't open %s stream, error 0x%08lx\n",
+           exclusiveMode ? "an exclusive" : "a shared", (unsigned long)hr);
+    release(client);
+    return false;
+  }
+  return true;
+}
+
+bool WASAPIAudioSink::openStream(uint32_t sampleRate, uint8_t channelCount,
+                                 bool isFloat, size_t sampleSize,
+                                 uint16_t validBits) {
+  // The device plays out its buffer, frames left in the ring are dropped
+  stopTask();
+  closeStream();
+
+  IMMDeviceEnumerator* enumerator = nullptr;
+  HRESULT hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), NULL,
+                                CLSCTX_ALL, __uuidof(IMMDeviceEnumerator),
+                                (void**)&enumerator);
+  if (SUCCEEDED(hr)) {
+    hr = enumerator->GetDefaultAudioEndpoint(eRender, eConsole, &device);
+    enumerator->Release();
+  }
+  if (FAILED(hr)) {
+    printf("WASAPI: No default output device, error 0x%08lx\n",
+           (unsigned long)hr);
+    device = nullptr;
+    return false;
+  }
+
+  frameSize = channelCount * sampleSize;
+  WAVEFORMATEXTENSIBLE format = {};
+  format.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format.Format.nChannels = channelCount;
+  format.Format.nSamplesPerSec = sampleRate;
+  format.Format.wBitsPerSample = sampleSize * 8;
+  format.Format.nBlockAlign = frameSize;
+  format.Format.nAvgBytesPerSec = sampleRate * frameSize;
+  format.Format.cbSize = sizeof(format) - sizeof(WAVEFORMATEX);
+  format.Samples.wValidBitsPerSample = validBits;
+  format.dwChannelMask = channelMask(channelCount);
+  format.SubFormat = isFloat ? SUBTYPE_FLOAT : SUBTYPE_PCM;
+
+  const WAVEFORMATEX* wave = &format.Format;
+  exclusive = config.exclusive && initializeClient(wave, true);
+  if (!exclusive) {
+    if (config.exclusive)
+      printf("WASAPI: Exclusive mode not available, using shared mode\n");
+    if (!initializeClient(wave, false)) {
+      closeStream();
+      return false;
+    }
+  }
+
+  event = CreateEvent(NULL, FALSE, FALSE, NULL);
+  REFERENCE_TIME latency = 0;
+  if (!event || FAILED(client->SetEventHandle(event)) ||
+      FAILED(client->GetBufferSize(&bufferFrames)) ||
+      FAILED(client->GetService(__uuidof(IAudioRenderClient),
+                                (void**)&render))) {
+    printf("WASAPI: Can't set up the stream\n");
+    render = nullptr;
+    closeStream();
+    return false;
+  }
+  client->GetStreamLatency(&latency);
+  latencyFrames = (size_t)(latency * sampleRate / UNITS_PER_SECOND);
+  printf("WASAPI: %s mode, rate = %u, channels = %d, buffer = %u frames\n",
+         exclusive ? "Exclusive" : "Shared", sampleRate, channelCount,
+         bufferFrames);
+
+  size_t ringFrames = std::max<size_t>(
+      (size_t)sampleRate * config.ringMs / 1000, bufferFrames);
+  ring = std::make_unique<bell::CircularBuffer>(
+      ringFrames * frameSize, bell::CircularBuffer::Mode::SPSC);
+  playing = false;
+  outputRate = sampleRate;
+  return this->startTask();
+}
+
+size_t WASAPIAudioSink::queuedFrames() {
+  if (!client)
+    return 0;
+  // Frames of the device buffer yet to be played
+  UINT32 padding = 0;
+  client->GetCurrentPadding(&padding);
+  return ring->size() / frameSize + padding + latencyFrames;
+}
+
+void WASAPIAudioSink::flush() {
+  if (!client)
+    return;
+  // The task stops the client on its way out and starts it again after
+  // the first buffer, Reset() needs it stopped
+  stopTask();
+  client->Reset();
+  ring->emptyBuffer();
+  playing = false;
+  startTask();
+}
+
+void WASAPIAudioSink::onStopRequested() {
+  if (event)
+    SetEvent(event);
+  freeSem.give();
+}
+
+void WASAPIAudioSink::fillBuffer(UINT32 frames) {
+  BYTE* data;
+  if (FAILED(render->GetBuffer(frames, &data)))
+    return;
+  size_t wanted = frames * frameSize;
+  // Whole frames only, the rest of one may still be on its way
+  size_t available = ring->size() / frameSize * frameSize;
+  size_t read = ring->read(data, std::min(wanted, available));
+  // Underrun, play silence rather than stopping
+  memset(data + read, 0, wanted - read);
+  if (read < wanted && playing) {
+    // Once per dropout, not for every buffer of a stopped stream
+    BELL_METRIC_COUNT("sink.underruns", 1);
+  }
+  playing = read == wanted;
+  render->ReleaseBuffer(frames, read > 0 ? 0 : AUDCLNT_BUFFERFLAGS_SILENT);
+  if (read > 0)
+    freeSem.give();
+}
+
+void WASAPIAudioSink::runTask() {
+  bool taskCom = SUCCEEDED(CoInitializeEx(NULL, COINIT_MULTITHREADED));
+  // On top of Policy::AUDIO, the multimedia scheduler boosts the thread
+  DWORD taskIndex = 0;
+  HANDLE mmcss = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
+
+  // The first buffer goes in before the stream starts
+  bool started = false;
+  while (!isStopRequested()) {
+    UINT32 frames = bufferFrames;
+    if (!exclusive) {
+      // The engine takes whatever part of its buffer is free
+      UINT32 padding = 0;
+      client->GetCurrentPadding(&padding);
+      frames -= std::min(padding, bufferFrames);
+    }
+    if (frames > 0)
+      fillBuffer(frames);
+    if (!started) {
+      started = SUCCEEDED(client->Start());
+      if (!started) {
+        printf("WASAPI: Can't start the stream\n");
+        break;
+      }
+    }
+    WaitForSingleObject(event, 200);
+  }
+
+  if (started)
+    client->Stop();
+  if (mmcss)
+    AvRevertMmThreadCharacteristics(mmcss);
+  if (taskCom)
+    CoUninitialize();
+}
+
+void WASAPIAudioSink::feedPCMFrames(const uint8_t* buffer, size_t bytes) {
+  BELL_TRACE_SCOPE("sink.feed");
+  if (!client)
+    return;
+
+  while (bytes > 0 && isTaskRunning()) {
+    size_t written = ring->write(buffer, bytes);
+    buffer += written;
+    bytes -= written;
+    if (bytes > 0 && written == 0) {
+      // The timeout covers a device that went away
+      freeSem.twait(100);
+    }
+  }
+}
@@ -0,0 +1,32 @@
+#include "AESCTRStream.h"
+
+#include <utility>  // for move
+
+using namespace bell;
+
+AESCTRStream::AESCTRStream(std::shared_ptr<bell::ByteStream> source,
+                           const std::vector<uint8_t>& key,
+                           const std::vector<uint8_t>& iv)
+    : source(std::move(source)), cipher(key, iv) {
+  cipher.seek(this->source->position());
+}
+
+size_t AESCTRStream::read(uint8_t* buf, size_t nbytes) {
+  size_t bytesRead = source->read(buf, nbytes);
+  cipher.xcrypt(buf, bytesRead);
+  return bytesRead;
+}
+
+size_t AESCTRStream::skip(size_t nbytes) {
+  size_t skipped = source->skip(nbytes);
+  cipher.seek(cipher.position() + skipped);
+  return skipped;
+}
+
+bool AESCTRStream::seek(size_t offset) {
+  if (!source->seek(offset)) {
+    return false;
+  }
+  cipher.seek(offset);
+  return true;
+}
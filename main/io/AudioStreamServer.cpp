@@ -0,0 +1,539 @@
+#include "AudioStreamServer.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for clamp
+#include <array>      // for array
+#include <random>     // for random_device
+
+#ifdef BELL_CODEC_OPUS
+#include "opus.h"  // for opus_encoder_create, opus_encode_float
+#endif
+
+#include "BellLogger.h"          // for BELL_LOG
+#include "PolyphaseResampler.h"  // for PolyphaseResampler
+
+using namespace bell;
+
+namespace {
+void writeLE(uint8_t* out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = value >> (i * 8);
+  }
+}
+
+void appendLE(std::vector<uint8_t>& out, uint64_t value, size_t bytes) {
+  out.resize(out.size() + bytes);
+  writeLE(out.data() + out.size() - bytes, value, bytes);
+}
+
+void appendTag(std::vector<uint8_t>& out, const char* tag) {
+  out.insert(out.end(), tag, tag + strlen(tag));
+}
+
+// CRC-32 with polynomial 0x04c11db7, unreflected, as used by Ogg
+uint32_t pageCrc(const uint8_t* data, size_t len) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> crcTable;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i << 24;
+      for (int bit = 0; bit < 8; bit++) {
+        r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+      }
+      crcTable[i] = r;
+    }
+    return crcTable;
+  }();
+
+  uint32_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc = (crc << 8) ^ table[((crc >> 24) ^ data[i]) & 0xFF];
+  }
+  return crc;
+}
+
+int16_t toInt16(const uint8_t* data, PcmFormat format) {
+  switch (format) {
+    case PcmFormat::INT16:
+      return *(const int16_t*)data;
+    case PcmFormat::FLOAT32:
+      return (int16_t)(std::clamp(*(const float*)data, -1.0f, 1.0f) * 32767);
+    default:
+      // Both left-justified in 32 bits
+      return *(const int32_t*)data >> 16;
+  }
+}
+}  // namespace
+
+struct AudioStreamServer::Feed::Client {
+  std::shared_ptr<Feed> feed;
+  // Stream the client plays, and the sequence of its next chunk
+  uint64_t stream = 0;
+  uint64_t cursor = 0;
+  bool started = false;
+
+  ~Client() { feed->clients--; }
+};
+
+void AudioStreamServer::Feed::reset(Chunk header) {
+  std::scoped_lock lock(mutex);
+  this->header = std::move(header);
+  stream++;
+  changed.notify_all();
+}
+
+void AudioStreamServer::Feed::push(Chunk chunk) {
+  std::scoped_lock lock(mutex);
+  ring[next % ring.size()] = std::move(chunk);
+  next++;
+  changed.notify_all();
+}
+
+void AudioStreamServer::Feed::close() {
+  std::scoped_lock lock(mutex);
+  closed = true;
+  changed.notify_all();
+}
+
+void AudioStreamServer::Feed::open() {
+  std::scoped_lock lock(mutex);
+  closed = false;
+  header = nullptr;
+  std::fill(ring.begin(), ring.end(), nullptr);
+}
+
+bool AudioStreamServer::Feed::isOpen() {
+  std::scoped_lock lock(mutex);
+  return !closed;
+}
+
+std::function<AudioStreamServer::Chunk()>
+AudioStreamServer::Feed::subscribe() {
+  auto client = std::make_shared<Client>();
+  client->feed = shared_from_this();
+  clients++;
+  return [client]() {
+    return client->feed->nextChunk(*client);
+  };
+}
+
+AudioStreamServer::Chunk AudioStreamServer::Feed::nextChunk(Client& client) {
+  std::unique_lock lock(mutex);
+  while (!closed) {
+    if (client.stream != stream && header != nullptr) {
+      if (client.started) {
+        // New format, the client reconnects for its header
+        break;
+      }
+      client.started = true;
+      client.stream = stream;
+      client.cursor = next;
+      return header;
+    }
+    if (client.started) {
+      if (next - client.cursor > ring.size()) {
+        BELL_LOG(error, "AudioStreamServer", "Client too slow, dropping it");
+        break;
+      }
+      if (client.cursor < next) {
+        return ring[client.cursor++ % ring.size()];
+      }
+    }
+    changed.wait(lock);
+  }
+  return nullptr;
+}
+
+AudioStreamServer::AudioStreamServer(BellHTTPServer& server,
+                                     const Config& config)
+    : bell::Task("audio_stream", 4096 * 12, 4, 1, false),
+      config(config),
+      server(server),
+      dataSem(16) {
+  wavFeed = std::make_shared<Feed>(config.ringChunks);
+  opusFeed = std::make_shared<Feed>(config.ringChunks);
+  monitors = std::make_shared<Monitors>();
+  // Stereo 48 kHz, made once as the tap may write at any time
+  ring = std::make_unique<CircularBuffer>(
+      48 * config.bufferMs * 2 * sizeof(int16_t), CircularBuffer::Mode::SPSC);
+
+  if (!config.wavUrl.empty()) {
+    route(config.wavUrl, wavFeed, "audio/wav");
+  }
+#ifdef BELL_CODEC_OPUS
+  if (!config.opusUrl.empty()) {
+    route(config.opusUrl, opusFeed, "audio/ogg; codecs=opus");
+  }
+  if (!config.monitorUrl.empty()) {
+    routeMonitor();
+  }
+#endif
+}
+
+AudioStreamServer::~AudioStreamServer() {
+  stop();
+}
+
+void AudioStreamServer::route(const std::string& url,
+                              std::shared_ptr<Feed> feed,
+                              const std::string& contentType) {
+  auto& server = this->server;
+  server.registerGet(url, [&server, feed, contentType](
+                              struct mg_connection* conn) {
+    if (!feed->isOpen()) {
+      return server.makeJsonResponse("{\"error\":\"Not streaming\"}", 503);
+    }
+    auto response = server.makeChunkResponse(feed->subscribe(), contentType);
+    response->headers["Cache-Control"] = "no-cache";
+    return response;
+  });
+}
+
+void AudioStreamServer::routeMonitor() {
+  // Constant, the monitor's format doesn't follow the stream's
+  std::string hello = "{\"codec\":\"opus\",\"sampleRate\":" +
+                      std::to_string(config.monitorRate) +
+                      ",\"channels\":1}";
+  auto monitors = this->monitors;
+  server.registerWS(
+      config.monitorUrl, [](struct mg_connection* conn, char*, size_t) {},
+      [monitors, hello](struct mg_connection* conn,
+                        BellHTTPServer::WSState state) {
+        if (state == BellHTTPServer::WSState::READY) {
+          // Ahead of the packets, the broadcast writer locks conn too
+          mg_lock_connection(conn);
+          mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_TEXT, hello.data(),
+                             hello.size());
+          mg_unlock_connection(conn);
+        }
+        std::scoped_lock lock(monitors->mutex);
+        if (state == BellHTTPServer::WSState::READY) {
+          monitors->connections.insert(conn);
+        } else if (state == BellHTTPServer::WSState::CLOSED) {
+          // Reported twice when the client closes first
+          monitors->connections.erase(conn);
+        }
+        monitors->count = monitors->connections.size();
+      });
+}
+
+bool AudioStreamServer::start() {
+  stop();
+  wavFeed->open();
+  opusFeed->open();
+  restart = true;
+  return startTask();
+}
+
+void AudioStreamServer::stop() {
+  stopTask();
+  wavFeed->close();
+  opusFeed->close();
+  release();
+}
+
+void AudioStreamServer::onStopRequested() {
+  dataSem.give();
+}
+
+BellDSP::Tap AudioStreamServer::tap() {
+  return [this](const uint8_t* data, size_t bytes, int channels,
+                uint32_t sampleRate, PcmFormat format) {
+    write(data, bytes, channels, sampleRate, format);
+  };
+}
+
+size_t AudioStreamServer::getClientCount() {
+  return wavFeed->clients + opusFeed->clients + monitors->count;
+}
+
+void AudioStreamServer::write(const uint8_t* data, size_t bytes,
+                              int channels, uint32_t sampleRate,
+                              PcmFormat format) {
+  if (channels <= 0 || channels > 2 || sampleRate == 0) {
+    return;
+  }
+  if (sampleRate != this->sampleRate || channels != this->channels) {
+    this->sampleRate = sampleRate;
+    this->channels = channels;
+    restart = true;
+    dataSem.give();
+  }
+  if (getClientCount() == 0) {
+    return;
+  }
+
+  size_t sampleSize = pcmBytesPerSample(format);
+  size_t samples = bytes / sampleSize / channels * channels;
+  const uint8_t* pcm = data;
+  if (format != PcmFormat::INT16) {
+    converted.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+      converted[i] = toInt16(data + i * sampleSize, format);
+    }
+    pcm = (const uint8_t*)converted.data();
+  }
+  // Whatever doesn't fit is dropped, the task is behind
+  ring->write(pcm, samples * sizeof(int16_t));
+  dataSem.give();
+}
+
+void AudioStreamServer::runTask() {
+  while (!isStopRequested()) {
+    dataSem.twait(100);
+    if (restart.exchange(false)) {
+      configure();
+    }
+    if (streamRate != 0) {
+      drain();
+    }
+  }
+}
+
+void AudioStreamServer::configure() {
+  release();
+  ring->emptyBuffer();
+  streamRate = sampleRate;
+  streamChannels = channels;
+  if (streamRate == 0 || streamChannels == 0) {
+    return;
+  }
+  chunkFrames = (size_t)(streamRate * config.chunkMs / 1000);
+  input.resize(chunkFrames * streamChannels);
+
+  // Endless WAV, the sizes left at their maximum
+  auto wav = std::make_shared<std::vector<uint8_t>>();
+  appendTag(*wav, "RIFF");
+  appendLE(*wav, 0xFFFFFFFF, 4);
+  appendTag(*wav, "WAVEfmt ");
+  appendLE(*wav, 16, 4);
+  appendLE(*wav, 1, 2);
+  appendLE(*wav, streamChannels, 2);
+  appendLE(*wav, streamRate, 4);
+  appendLE(*wav, streamRate * streamChannels * sizeof(int16_t), 4);
+  appendLE(*wav, streamChannels * sizeof(int16_t), 2);
+  appendLE(*wav, 16, 2);
+  appendTag(*wav, "data");
+  appendLE(*wav, 0xFFFFFFFF, 4);
+  wavFeed->reset(wav);
+  configureMonitor();
+
+#ifdef BELL_CODEC_OPUS
+  if (config.opusUrl.empty()) {
+    return;
+  }
+  int error;
+  encoder = opus_encoder_create(48000, streamChannels, OPUS_APPLICATION_AUDIO,
+                                &error);
+  if (encoder == nullptr) {
+    BELL_LOG(error, TAG, "Cannot create the Opus encoder: %d", error);
+    return;
+  }
+  opus_encoder_ctl(encoder, OPUS_SET_BITRATE(config.bitrate));
+  opus_int32 lookahead = 0;
+  opus_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+  opusFrames = (size_t)(48000 * config.chunkMs / 1000);
+  if (streamRate != 48000) {
+    resampler = std::make_unique<dsp::PolyphaseResampler>(
+        streamRate, 48000, streamChannels, chunkFrames);
+    inPlanes.assign(streamChannels, std::vector<float>(chunkFrames));
+    outPlanes.assign(streamChannels,
+                     std::vector<float>(resampler->maxOutputFrames()));
+  }
+
+  // Identification and comment headers, RFC 7845 5
+  std::vector<uint8_t> head, tags;
+  appendTag(head, "OpusHead");
+  appendLE(head, 1, 1);
+  appendLE(head, streamChannels, 1);
+  appendLE(head, lookahead, 2);
+  appendLE(head, streamRate, 4);
+  // Output gain, then mapping family 0
+  appendLE(head, 0, 3);
+  appendTag(tags, "OpusTags");
+  appendLE(tags, 4, 4);
+  appendTag(tags, "bell");
+  appendLE(tags, 0, 4);
+
+  std::random_device random;
+  serial = random();
+  pageSequence = 0;
+  granule = 0;
+  auto ogg = std::make_shared<std::vector<uint8_t>>();
+  appendPage(*ogg, head.data(), head.size(), 0x02, 0);
+  appendPage(*ogg, tags.data(), tags.size(), 0, 0);
+  opusFeed->reset(ogg);
+#endif
+}
+
+void AudioStreamServer::configureMonitor() {
+#ifdef BELL_CODEC_OPUS
+  if (config.monitorUrl.empty()) {
+    return;
+  }
+  int error;
+  monitorEncoder = opus_encoder_create(config.monitorRate, 1,
+                                       OPUS_APPLICATION_AUDIO, &error);
+  if (monitorEncoder == nullptr) {
+    BELL_LOG(error, TAG, "Cannot create the monitor encoder: %d", error);
+    return;
+  }
+  opus_encoder_ctl(monitorEncoder, OPUS_SET_BITRATE(config.monitorBitrate));
+  // Cheaper, a preview doesn't need the best quality
+  opus_encoder_ctl(monitorEncoder, OPUS_SET_COMPLEXITY(5));
+  monitorFrames = (size_t)(config.monitorRate * config.chunkMs / 1000);
+  monitorIn.resize(chunkFrames);
+  if (streamRate != config.monitorRate) {
+    monitorResampler = std::make_unique<dsp::PolyphaseResampler>(
+        streamRate, config.monitorRate, 1, chunkFrames);
+    monitorOut.resize(monitorResampler->maxOutputFrames());
+  }
+#endif
+}
+
+void AudioStreamServer::release() {
+#ifdef BELL_CODEC_OPUS
+  if (encoder != nullptr) {
+    opus_encoder_destroy(encoder);
+    encoder = nullptr;
+  }
+  if (monitorEncoder != nullptr) {
+    opus_encoder_destroy(monitorEncoder);
+    monitorEncoder = nullptr;
+  }
+#endif
+  resampler = nullptr;
+  monitorResampler = nullptr;
+  pending.clear();
+  monitorPending.clear();
+  streamRate = 0;
+}
+
+void AudioStreamServer::drain() {
+  size_t chunkSize = chunkFrames * streamChannels * sizeof(int16_t);
+  while (!restart && ring->size() >= chunkSize) {
+    ring->read((uint8_t*)input.data(), chunkSize);
+    if (wavFeed->clients > 0) {
+      encodeWav(input.data(), chunkFrames);
+    }
+    if (encoder != nullptr && opusFeed->clients > 0) {
+      encodeOpus(input.data(), chunkFrames);
+    }
+    if (monitorEncoder != nullptr && monitors->count > 0) {
+      encodeMonitor(input.data(), chunkFrames);
+    }
+  }
+}
+
+void AudioStreamServer::encodeWav(const int16_t* pcm, size_t frames) {
+  auto chunk = std::make_shared<std::vector<uint8_t>>(frames * streamChannels *
+                                                      sizeof(int16_t));
+  for (size_t i = 0; i < frames * streamChannels; i++) {
+    writeLE(chunk->data() + i * 2, (uint16_t)pcm[i], 2);
+  }
+  wavFeed->push(chunk);
+}
+
+void AudioStreamServer::encodeOpus(const int16_t* pcm, size_t frames) {
+  if (resampler == nullptr) {
+    for (size_t i = 0; i < frames * streamChannels; i++) {
+      pending.push_back(pcm[i] / 32768.0f);
+    }
+  } else {
+    float* in[2];
+    float* out[2];
+    for (size_t ch = 0; ch < streamChannels; ch++) {
+      in[ch] = inPlanes[ch].data();
+      out[ch] = outPlanes[ch].data();
+    }
+    for (size_t i = 0; i < frames; i++) {
+      for (size_t ch = 0; ch < streamChannels; ch++) {
+        in[ch][i] = pcm[i * streamChannels + ch] / 32768.0f;
+      }
+    }
+    size_t produced = resampler->process(in, frames, out, streamChannels);
+    for (size_t i = 0; i < produced; i++) {
+      for (size_t ch = 0; ch < streamChannels; ch++) {
+        pending.push_back(outPlanes[ch][i]);
+      }
+    }
+  }
+
+  size_t frameSamples = opusFrames * streamChannels;
+  size_t used = 0;
+  while (pending.size() - used >= frameSamples) {
+    encodeOpusFrame(pending.data() + used);
+    used += frameSamples;
+  }
+  pending.erase(pending.begin(), pending.begin() + used);
+}
+
+void AudioStreamServer::encodeOpusFrame(const float* pcm) {
+#ifdef BELL_CODEC_OPUS
+  uint8_t packet[1500];
+  int len = opus_encode_float(encoder, pcm, opusFrames, packet, sizeof(packet));
+  if (len <= 0) {
+    return;
+  }
+  granule += opusFrames;
+  auto chunk = std::make_shared<std::vector<uint8_t>>();
+  appendPage(*chunk, packet, len, 0, granule);
+  opusFeed->push(chunk);
+#endif
+}
+
+void AudioStreamServer::encodeMonitor(const int16_t* pcm, size_t frames) {
+#ifdef BELL_CODEC_OPUS
+  for (size_t i = 0; i < frames; i++) {
+    float sum = 0;
+    for (size_t ch = 0; ch < streamChannels; ch++) {
+      sum += pcm[i * streamChannels + ch];
+    }
+    monitorIn[i] = sum / (32768.0f * streamChannels);
+  }
+  if (monitorResampler == nullptr) {
+    monitorPending.insert(monitorPending.end(), monitorIn.begin(),
+                          monitorIn.begin() + frames);
+  } else {
+    float* in = monitorIn.data();
+    float* out = monitorOut.data();
+    size_t produced = monitorResampler->process(&in, frames, &out, 1);
+    monitorPending.insert(monitorPending.end(), monitorOut.begin(),
+                          monitorOut.begin() + produced);
+  }
+
+  uint8_t packet[1500];
+  size_t used = 0;
+  while (monitorPending.size() - used >= monitorFrames) {
+    int len = opus_encode_float(monitorEncoder, monitorPending.data() + used,
+                                monitorFrames, packet, sizeof(packet));
+    used += monitorFrames;
+    if (len > 0) {
+      server.broadcastWS(config.monitorUrl, packet, len,
+                         MG_WEBSOCKET_OPCODE_BINARY);
+    }
+  }
+  monitorPending.erase(monitorPending.begin(),
+                       monitorPending.begin() + used);
+#endif
+}
+
+void AudioStreamServer::appendPage(std::vector<uint8_t>& out,
+                                   const uint8_t* packet, size_t size,
+                                   uint8_t flags, uint64_t granule) {
+  size_t start = out.size();
+  appendTag(out, "OggS");
+  appendLE(out, 0, 1);
+  appendLE(out, flags, 1);
+  appendLE(out, granule, 8);
+  appendLE(out, serial, 4);
+  appendLE(out, pageSequence++, 4);
+  // Checksum, filled in once the page is complete
+  appendLE(out, 0, 4);
+  // Lacing, 255 byte segments and the rest
+  appendLE(out, size / 255 + 1, 1);
+  out.insert(out.end(), size / 255, 255);
+  appendLE(out, size % 255, 1);
+  out.insert(out.end(), packet, packet + size);
+  writeLE(out.data() + start + 22,
+          pageCrc(out.data() + start, out.size() - start), 4);
+}
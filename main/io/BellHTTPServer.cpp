@@ -1,12 +1,26 @@
 #include "BellHTTPServer.h"
 
-#include <string.h>   // for memcpy
-#include <cassert>    // for assert
-#include <exception>  // for exception
-#include <mutex>      // for scoped_lock
-#include <regex>      // for sregex_token_iterator, regex
+#include <ctype.h>             // for tolower
+#include <stdio.h>             // for snprintf
+#include <stdlib.h>            // for strtoull, strtol
+#include <string.h>            // for memcpy, strcmp, memchr
+#include <algorithm>           // for min, sort, transform
+#include <atomic>              // for atomic
+#include <cassert>             // for assert
+#include <chrono>              // for milliseconds
+#include <condition_variable>  // for condition_variable
+#include <deque>               // for deque
+#include <exception>           // for exception
+#include <mutex>               // for scoped_lock
 
-#include "BellLogger.h"   // for AbstractLogger, BELL_LOG, bell
+#include "BellLogger.h"        // for AbstractLogger, BELL_LOG, bell
+#include "BellMetrics.h"       // for Metrics
+#include "BellTask.h"          // for Task
+#include "BellTrace.h"         // for Trace
+#include "FileStream.h"        // for FileStream
+#include "JsonWriter.h"        // for JsonWriter
+#include "MGStreamAdapter.h"   // for MGStreamAdapter
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
 #include "CivetServer.h"  // for CivetServer, CivetWebSocketHandler
 #include "civetweb.h"     // for mg_get_request_info, mg_printf, mg_set_user...
 
@@ -14,11 +28,87 @@ using namespace bell;
 
 std::mutex BellHTTPServer::initMutex;
 
+typedef std::shared_ptr<const std::vector<uint8_t>> WSFrame;
+
+// Sends broadcast frames to one client, so a slow one only stalls itself
+class WebSocketWriter : public bell::Task {
+ public:
+  WebSocketWriter(struct mg_connection* conn)
+      : bell::Task("ws_writer", 4096, 0, 0), conn(conn) {}
+
+  // Waits for a write in progress, conn is gone after handleClose()
+  void stop() { stopTask(); }
+
+  // @returns false when the client fell too far behind and is dropped
+  bool push(const WSFrame& frame) {
+    std::scoped_lock lock(framesMutex);
+    if (dropped) {
+      return false;
+    }
+    if (frames.size() >= BellHTTPServer::WS_MAX_QUEUED_FRAMES) {
+      BELL_LOG(error, "HttpServer", "WebSocket client too slow, dropping it");
+      frames.clear();
+      dropped = true;
+    } else {
+      frames.push_back(frame);
+    }
+    framesSem.give();
+    return !dropped;
+  }
+
+ private:
+  struct mg_connection* conn;
+  std::mutex framesMutex;
+  std::deque<WSFrame> frames;
+  bool dropped = false;
+
+  bell::WrappedSemaphore framesSem;
+
+  void onStopRequested() override { framesSem.give(); }
+
+  void runTask() override {
+    while (!isStopRequested()) {
+      WSFrame frame;
+      {
+        std::scoped_lock lock(framesMutex);
+        if (dropped) {
+          break;
+        }
+        if (!frames.empty()) {
+          frame = frames.front();
+          frames.pop_front();
+        }
+      }
+      if (frame == nullptr) {
+        framesSem.twait(100);
+        continue;
+      }
+
+      // Keeps other writers to conn, e.g. a data handler, from interleaving
+      mg_lock_connection(conn);
+      int written = mg_write(conn, frame->data(), frame->size());
+      mg_unlock_connection(conn);
+      if (written != (int)frame->size()) {
+        std::scoped_lock lock(framesMutex);
+        dropped = true;
+      }
+    }
+
+    if (!isStopRequested()) {
+      // Dropped, ask the client to go away
+      mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE, "", 0);
+    }
+  }
+};
+
 class WebSocketHandler : public CivetWebSocketHandler {
  public:
   BellHTTPServer::WSDataHandler dataHandler;
   BellHTTPServer::WSStateHandler stateHandler;
 
+  std::mutex writersMutex;
+  std::map<struct mg_connection*, std::shared_ptr<WebSocketWriter>> writers;
+
   WebSocketHandler(BellHTTPServer::WSDataHandler dataHandler,
                    BellHTTPServer::WSStateHandler stateHandler) {
     this->dataHandler = dataHandler;
@@ -33,6 +123,13 @@ class WebSocketHandler : public CivetWebSocketHandler {
 
   virtual void handleReadyState(CivetServer* server,
                                 struct mg_connection* conn) {
+    auto writer = std::make_shared<WebSocketWriter>(conn);
+    if (writer->startTask()) {
+      std::scoped_lock lock(writersMutex);
+      writers[conn] = writer;
+    } else {
+      BELL_LOG(error, "HttpServer", "Cannot start a WebSocket writer");
+    }
     this->stateHandler(conn, BellHTTPServer::WSState::READY);
   }
 
@@ -50,83 +147,440 @@ class WebSocketHandler : public CivetWebSocketHandler {
   }
 
   virtual void handleClose(CivetServer* server, struct mg_connection* conn) {
+    std::shared_ptr<WebSocketWriter> writer;
+    {
+      std::scoped_lock lock(writersMutex);
+      auto it = writers.find(conn);
+      if (it != writers.end()) {
+        writer = it->second;
+        writers.erase(it);
+      }
+    }
+    if (writer != nullptr) {
+      writer->stop();
+    }
     stateHandler(conn, BellHTTPServer::WSState::CLOSED);
   }
+
+  size_t broadcast(const WSFrame& frame) {
+    std::scoped_lock lock(writersMutex);
+    size_t queued = 0;
+    for (auto& writer : writers) {
+      if (writer.second->push(frame)) {
+        queued++;
+      }
+    }
+    return queued;
+  }
+};
+
+// Server to client frames aren't masked, so one encoding fits every client
+static WSFrame encodeWSFrame(int opcode, const uint8_t* data, size_t len) {
+  auto frame = std::make_shared<std::vector<uint8_t>>();
+  frame->reserve(len + 10);
+  frame->push_back(0x80 | (opcode & 0x0F));  // FIN
+  if (len < 126) {
+    frame->push_back(len);
+  } else if (len <= 0xFFFF) {
+    frame->push_back(126);
+    frame->push_back(len >> 8);
+    frame->push_back(len & 0xFF);
+  } else {
+    frame->push_back(127);
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      frame->push_back(((uint64_t)len >> shift) & 0xFF);
+    }
+  }
+  frame->insert(frame->end(), data, data + len);
+  return frame;
+}
+
+// Latest state of each key of an SSE stream, numbered in publish order
+class SSEChannel {
+ public:
+  void publish(const std::string& key, const std::string& data) {
+    std::scoped_lock lock(mutex);
+    // Encoded once for every client, numbered so clients can pick up
+    std::string event = "id: " + std::to_string(++seq) + "\nevent: " + key;
+    size_t start = 0;
+    do {
+      size_t end = std::min(data.find('\n', start), data.size());
+      event += "\ndata: " + data.substr(start, end - start);
+      start = end + 1;
+    } while (start <= data.size());
+    states[key] = {std::move(event) + "\n\n", seq};
+    changed.notify_all();
+  }
+
+  /**
+   * The latest events of the keys changed after lastSeq, in publish order.
+   * Waits up to timeoutMs for one, out is left empty otherwise
+   * @returns false once the channel is closed
+   */
+  bool next(uint64_t& lastSeq, std::string& out, uint32_t timeoutMs) {
+    std::unique_lock lock(mutex);
+    // From an earlier run of the server, everything is new
+    if (lastSeq > seq) {
+      lastSeq = 0;
+    }
+    changed.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                     [&]() { return closed || seq > lastSeq; });
+
+    std::vector<const State*> pending;
+    for (auto& [key, state] : states) {
+      if (state.seq > lastSeq) {
+        pending.push_back(&state);
+      }
+    }
+    std::sort(pending.begin(), pending.end(),
+              [](const State* a, const State* b) { return a->seq < b->seq; });
+    out.clear();
+    for (auto state : pending) {
+      out += state->event;
+    }
+    lastSeq = seq;
+    return !closed;
+  }
+
+  void close() {
+    std::scoped_lock lock(mutex);
+    closed = true;
+    changed.notify_all();
+  }
+
+ private:
+  struct State {
+    std::string event;
+    uint64_t seq;
+  };
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::map<std::string, State> states;
+  uint64_t seq = 0;
+  bool closed = false;
 };
 
-std::vector<std::string> BellHTTPServer::Router::split(
-    const std::string str, const std::string regex_str) {
-  std::regex regexz(regex_str);
-  return {std::sregex_token_iterator(str.begin(), str.end(), regexz, -1),
-          std::sregex_token_iterator()};
+// Splits on '/': "/a//b/" gives "", "a", "", "b" and "" gives ""
+class PathSegments {
+ public:
+  PathSegments(std::string_view path) : rest(path) {}
+
+  bool next(std::string_view& segment) {
+    if (rest.empty()) {
+      if (!first) {
+        return false;
+      }
+      first = false;
+      segment = rest;
+      return true;
+    }
+    first = false;
+
+    size_t pos = rest.find('/');
+    if (pos == std::string_view::npos) {
+      segment = rest;
+      rest = std::string_view();
+    } else {
+      segment = rest.substr(0, pos);
+      rest = rest.substr(pos + 1);
+    }
+    return true;
+  }
+
+ private:
+  std::string_view rest;
+  bool first = true;
+};
+
+// civetweb hands over a path and every path below it, so a route goes to
+// it up to its first parameter or catch-all, the router does the rest
+static std::string civetPath(const std::string& route) {
+  size_t end = std::min(route.find("/:"), route.find("/*"));
+  return end == 0 ? "/" : route.substr(0, end);
 }
 
+// Value of a "; name=value" parameter of a header, e.g. a boundary, without
+// its quotes. Empty when missing
+static std::string headerParam(std::string_view header,
+                               std::string_view name) {
+  while (!header.empty()) {
+    size_t end = header.find(';');
+    std::string_view param = header.substr(0, end);
+    header = end == std::string_view::npos ? std::string_view()
+                                           : header.substr(end + 1);
+    while (!param.empty() && param[0] == ' ') {
+      param.remove_prefix(1);
+    }
+    if (param.size() > name.size() && param[name.size()] == '=' &&
+        mg_strncasecmp(param.data(), name.data(), name.size()) == 0) {
+      std::string_view value = param.substr(name.size() + 1);
+      if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+      }
+      return std::string(value);
+    }
+  }
+  return {};
+}
+
+/**
+ * Splits a multipart body on its boundary as it's fed, in pieces of any
+ * size. Only part headers are buffered, a part's data goes to the handler
+ * as it comes, less the few bytes that could begin a boundary.
+ */
+class MultipartParser {
+ public:
+  MultipartParser(std::string_view boundary,
+                  BellHTTPServer::UploadHandler& handler)
+      : delimiter("\r\n--" + std::string(boundary)), handler(handler) {}
+
+  // @returns false once the body is malformed or the handler aborted
+  bool feed(const uint8_t* data, size_t size) {
+    while (size > 0 && !failed) {
+      size_t used = 1;
+      switch (state) {
+        case State::PREAMBLE:
+        case State::BODY: {
+          bool found = false;
+          used = search(data, size, state == State::BODY, found);
+          if (found) {
+            if (state == State::BODY && !handler.endPart()) {
+              failed = true;
+            }
+            state = State::DELIMITER_END;
+            delimiterEnd.clear();
+          }
+          break;
+        }
+        case State::DELIMITER_END:
+          // "--" after the last boundary, a CRLF before a part's headers
+          delimiterEnd.push_back(data[0]);
+          if (delimiterEnd.size() == 2) {
+            if (delimiterEnd == "--") {
+              state = State::DONE;
+            } else if (delimiterEnd == "\r\n") {
+              state = State::HEADERS;
+              headers.clear();
+            } else {
+              failed = true;
+            }
+          }
+          break;
+        case State::HEADERS:
+          headers.push_back(data[0]);
+          if (headers == "\r\n" || headers.ends_with("\r\n\r\n")) {
+            if (!handler.beginPart(parsePart())) {
+              failed = true;
+            }
+            state = State::BODY;
+          } else if (headers.size() > MAX_HEADERS) {
+            failed = true;
+          }
+          break;
+        case State::DONE:
+          // The epilogue, if any, means nothing
+          return true;
+      }
+      data += used;
+      size -= used;
+    }
+    return !failed;
+  }
+
+  // The closing boundary was seen
+  bool done() const { return state == State::DONE; }
+
+ private:
+  static constexpr size_t MAX_HEADERS = 1024;
+
+  enum class State { PREAMBLE, DELIMITER_END, HEADERS, BODY, DONE };
+
+  std::string delimiter;
+  BellHTTPServer::UploadHandler& handler;
+  State state = State::PREAMBLE;
+  bool failed = false;
+  // Bytes of the delimiter matched so far. The body opens with a boundary
+  // without the CRLF before it, as if it had been seen
+  size_t matched = 2;
+  // How many of those came from an earlier piece, they're delimiter[0, held)
+  size_t held = 2;
+  std::string delimiterEnd;
+  std::string headers;
+
+  /**
+   * Looks for the delimiter in data, what comes before it goes to the
+   * handler if emit is set
+   * @returns the bytes used, up to the delimiter's end when found
+   */
+  size_t search(const uint8_t* data, size_t size, bool emit, bool& found) {
+    size_t i = 0;
+    while (i < size) {
+      if (matched == 0) {
+        auto cr = (const uint8_t*)memchr(data + i, '\r', size - i);
+        if (cr == nullptr) {
+          i = size;
+          break;
+        }
+        i = cr - data;
+      }
+      if (data[i] == (uint8_t)delimiter[matched]) {
+        matched++;
+        i++;
+        if (matched == delimiter.size()) {
+          pass(data, i - (matched - held), emit);
+          matched = held = 0;
+          found = true;
+          return i;
+        }
+        continue;
+      }
+      // Data after all. A boundary has no CR, so no match starts within
+      // what was matched, data[i] may begin one though
+      if (held > 0) {
+        pass((const uint8_t*)delimiter.data(), held, emit);
+        held = 0;
+      }
+      matched = 0;
+    }
+    // The tail that may begin a delimiter waits for the next piece
+    pass(data, size - (matched - held), emit);
+    held = matched;
+    return size;
+  }
+
+  void pass(const uint8_t* data, size_t size, bool emit) {
+    if (emit && size > 0 && !handler.write(data, size)) {
+      failed = true;
+    }
+  }
+
+  BellHTTPServer::UploadHandler::Part parsePart() {
+    BellHTTPServer::UploadHandler::Part part;
+    std::string_view rest = headers;
+    while (!rest.empty()) {
+      size_t end = rest.find("\r\n");
+      std::string_view line = rest.substr(0, end);
+      rest = end == std::string_view::npos ? std::string_view()
+                                           : rest.substr(end + 2);
+      size_t colon = line.find(':');
+      if (colon == std::string_view::npos) {
+        continue;
+      }
+      std::string_view name = line.substr(0, colon);
+      std::string_view value = line.substr(colon + 1);
+      while (!value.empty() && value[0] == ' ') {
+        value.remove_prefix(1);
+      }
+      if (name.size() == 19 &&
+          mg_strncasecmp(name.data(), "Content-Disposition", 19) == 0) {
+        part.name = headerParam(value, "name");
+        part.filename = headerParam(value, "filename");
+      } else if (name.size() == 12 &&
+                 mg_strncasecmp(name.data(), "Content-Type", 12) == 0) {
+        part.contentType = value;
+      }
+    }
+    return part;
+  }
+};
+
 void BellHTTPServer::Router::insert(const std::string& route,
-                                    HTTPHandler& value) {
-  auto parts = split(route, "/");
+                                    HTTPHandler& value,
+                                    Concurrency concurrency) {
+  PathSegments segments(route);
+  std::string_view part;
   auto currentNode = &root;
 
-  for (int index = 0; index < parts.size(); index++) {
-    auto part = parts[index];
-    if (part[0] == ':') {
+  while (segments.next(part)) {
+    if (!part.empty() && part[0] == ':') {
       currentNode->isParam = true;
       currentNode->paramName = part.substr(1);
       part = "";
-    } else if (part[0] == '*') {
+    } else if (!part.empty() && part[0] == '*') {
       currentNode->isCatchAll = true;
       currentNode->value = value;
+      currentNode->concurrency = concurrency;
       return;
     }
 
-    if (!currentNode->children.count(part)) {
-      currentNode->children[part] = std::make_unique<RouterNode>();
+    auto it = currentNode->children.find(part);
+    if (it == currentNode->children.end()) {
+      it = currentNode->children
+               .emplace(std::string(part), std::make_unique<RouterNode>())
+               .first;
     }
-    currentNode = currentNode->children[part].get();
+    currentNode = it->second.get();
   }
   currentNode->value = value;
+  currentNode->concurrency = concurrency;
 }
 
-BellHTTPServer::Router::HandlerAndParams BellHTTPServer::Router::find(
-    const std::string& route) {
-  auto parts = split(route, "/");
+bool BellHTTPServer::Router::match(std::string_view route,
+                                   Match& match) const {
+  PathSegments segments(route);
+  std::string_view part;
   auto currentNode = &root;
-  std::unordered_map<std::string, std::string> params;
-
-  for (int index = 0; index < parts.size(); index++) {
-    auto part = parts[index];
+  match = Match();
 
-    if (currentNode->children.count(part)) {
-      currentNode = currentNode->children[part].get();
+  while (segments.next(part)) {
+    auto it = currentNode->children.find(part);
+    if (it != currentNode->children.end()) {
+      currentNode = it->second.get();
     } else if (currentNode->isParam) {
-      params[currentNode->paramName] = part;
-      if (currentNode->children.count("")) {
-        currentNode = currentNode->children[""].get();
-      } else {
-        return {nullptr, Params()};
+      it = currentNode->children.find(std::string_view());
+      if (it == currentNode->children.end() ||
+          match.paramCount == Match::MAX_PARAMS) {
+        return false;
       }
+      match.params[match.paramCount++] = {currentNode->paramName, part};
+      currentNode = it->second.get();
     } else if (currentNode->isCatchAll) {
-      params["**"] = '*';
-      return {currentNode->value, params};
+      match.catchAll = true;
+      break;
     } else {
-      return {nullptr, Params()};
+      return false;
     }
   }
 
-  if (currentNode->value != nullptr) {
-    return {currentNode->value, params};
+  if (currentNode->value == nullptr) {
+    return false;
+  }
+  match.handler = &currentNode->value;
+  match.concurrency = currentNode->concurrency;
+  return true;
+}
+
+BellHTTPServer::Router::Params BellHTTPServer::Router::Match::toParams()
+    const {
+  Params result;
+  for (size_t i = 0; i < paramCount; i++) {
+    result[std::string(params[i].first)] = params[i].second;
   }
+  if (catchAll) {
+    result["**"] = '*';
+  }
+  return result;
+}
 
-  return {nullptr, Params()};
+BellHTTPServer::Router::HandlerAndParams BellHTTPServer::Router::find(
+    const std::string& route) {
+  Match found;
+  if (!match(route, found)) {
+    return {nullptr, Params()};
+  }
+  return {*found.handler, found.toParams()};
 }
 
 bool BellHTTPServer::handleGet(CivetServer* server,
                                struct mg_connection* conn) {
-  std::scoped_lock lock(this->responseMutex);
+  std::unique_lock lock(this->responseMutex, std::defer_lock);
   auto requestInfo = mg_get_request_info(conn);
-  auto handler = getRequestsRouter.find(requestInfo->local_uri);
+  Router::Match match;
 
-  if (handler.first == nullptr) {
+  if (!getRequestsRouter.match(requestInfo->local_uri, match)) {
     if (this->notFoundHandler != nullptr) {
+      lock.lock();
       this->notFoundHandler(conn);
       return true;
     }
@@ -134,20 +588,18 @@ bool BellHTTPServer::handleGet(CivetServer* server,
     return false;
   }
 
-  mg_set_user_connection_data(conn, &handler.second);
+  // Params are only built if the handler asks for them
+  mg_set_user_connection_data(conn, &match);
 
   try {
-    auto reply = handler.first(conn);
-    if (reply->body == nullptr) {
-      return true;
+    if (match.concurrency == Concurrency::SERIALIZED) {
+      lock.lock();
     }
-
-    mg_printf(
-        conn,
-        "HTTP/1.1 %d OK\r\nContent-Type: "
-        "%s\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
-        reply->status, reply->headers["Content-Type"].c_str());
-    mg_write(conn, reply->body, reply->bodySize);
+    auto reply = (*match.handler)(conn);
+    if (lock.owns_lock()) {
+      lock.unlock();
+    }
+    sendResponse(conn, *reply);
 
     return true;
   } catch (std::exception& e) {
@@ -158,28 +610,26 @@ bool BellHTTPServer::handleGet(CivetServer* server,
 
 bool BellHTTPServer::handlePost(CivetServer* server,
                                 struct mg_connection* conn) {
-  std::scoped_lock lock(this->responseMutex);
+  std::unique_lock lock(this->responseMutex, std::defer_lock);
   auto requestInfo = mg_get_request_info(conn);
-  auto handler = postRequestsRouter.find(requestInfo->local_uri);
+  Router::Match match;
 
-  if (handler.first == nullptr) {
+  if (!postRequestsRouter.match(requestInfo->local_uri, match)) {
     return false;
   }
 
-  mg_set_user_connection_data(conn, &handler.second);
+  // Params are only built if the handler asks for them
+  mg_set_user_connection_data(conn, &match);
 
   try {
-    auto reply = handler.first(conn);
-    if (reply->body == nullptr) {
-      return true;
+    if (match.concurrency == Concurrency::SERIALIZED) {
+      lock.lock();
     }
-
-    mg_printf(
-        conn,
-        "HTTP/1.1 %d OK\r\nContent-Type: "
-        "%s\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
-        reply->status, reply->headers["Content-Type"].c_str());
-    mg_write(conn, reply->body, reply->bodySize);
+    auto reply = (*match.handler)(conn);
+    if (lock.owns_lock()) {
+      lock.unlock();
+    }
+    sendResponse(conn, *reply);
 
     return true;
   } catch (std::exception& e) {
@@ -188,7 +638,145 @@ bool BellHTTPServer::handlePost(CivetServer* server,
   }
 }
 
-BellHTTPServer::BellHTTPServer(int serverPort) {
+void BellHTTPServer::writeHead(struct mg_connection* conn,
+                               HTTPResponse& reply,
+                               const std::string& extraHeaders) {
+  std::string headers = extraHeaders;
+  for (auto& [name, value] : reply.headers) {
+    if (name != "Content-Type") {
+      headers += name + ": " + value + "\r\n";
+    }
+  }
+  mg_printf(conn,
+            "HTTP/1.1 %d %s\r\nContent-Type: "
+            "%s\r\nAccess-Control-Allow-Origin: *\r\nConnection: "
+            "%s\r\n%s\r\n",
+            reply.status, mg_get_response_code_text(conn, reply.status),
+            reply.headers["Content-Type"].c_str(),
+            keepsAlive(conn) ? "keep-alive" : "close", headers.c_str());
+}
+
+bool BellHTTPServer::keepsAlive(struct mg_connection* conn) {
+  if (!keepAlive) {
+    return false;
+  }
+  // The client's wish, else the default of its HTTP version
+  const char* header = mg_get_header(conn, "Connection");
+  if (header != nullptr) {
+    std::string value = header;
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value.find("keep-alive") != std::string::npos;
+  }
+  const char* version = mg_get_request_info(conn)->http_version;
+  return version != nullptr && strcmp(version, "1.1") == 0;
+}
+
+bool BellHTTPServer::sendResponse(struct mg_connection* conn,
+                                  HTTPResponse& reply) {
+  if (reply.status == 304) {
+    // Never has a body
+    writeHead(conn, reply, "");
+    return true;
+  }
+
+  if (reply.bodyView.data() != nullptr) {
+    writeHead(conn, reply,
+              "Content-Length: " + std::to_string(reply.bodyView.size()) +
+                  "\r\n");
+    mg_write(conn, reply.bodyView.data(), reply.bodyView.size());
+    return true;
+  }
+
+  // Every body is delimited, the connection may stay open after it
+  if (reply.body != nullptr) {
+    writeHead(conn, reply,
+              "Content-Length: " + std::to_string(reply.bodySize) + "\r\n");
+    mg_write(conn, reply.body, reply.bodySize);
+    return true;
+  }
+
+  // civetweb is built without its file system, files go out as streams
+  if (!reply.bodyFile.empty()) {
+    try {
+      reply.bodyStream = std::make_shared<FileStream>(reply.bodyFile, "rb");
+    } catch (const std::exception&) {
+      BELL_LOG(error, "HttpServer", "Cannot send %s", reply.bodyFile.c_str());
+      reply.status = 404;
+      writeHead(conn, reply, "Content-Length: 0\r\n");
+      return true;
+    }
+  }
+
+  if (reply.bodyChunks != nullptr) {
+    writeHead(conn, reply, "Transfer-Encoding: chunked\r\n");
+    while (auto chunk = reply.bodyChunks()) {
+      // An empty one would end the body
+      if (!chunk->empty() &&
+          mg_send_chunk(conn, (const char*)chunk->data(), chunk->size()) <=
+              0) {
+        // The client went away
+        return true;
+      }
+    }
+    mg_send_chunk(conn, "", 0);
+    return true;
+  }
+
+  if (reply.bodyWriter != nullptr) {
+    writeHead(conn, reply, "Transfer-Encoding: chunked\r\n");
+    {
+      // STREAM_CHUNK_SIZE pieces, the writer flushes about as often
+      MGStreamAdapter out(conn, STREAM_CHUNK_SIZE + 64, true);
+      reply.bodyWriter(out);
+      out.flush();
+    }
+    mg_send_chunk(conn, "", 0);
+    return true;
+  }
+
+  if (reply.bodyStream == nullptr && reply.bodyGenerator == nullptr) {
+    return false;
+  }
+
+  std::function<size_t(uint8_t*, size_t)> next = reply.bodyGenerator;
+  bool chunked = true;
+  if (reply.bodyStream != nullptr) {
+    auto stream = reply.bodyStream;
+    next = [stream](uint8_t* buf, size_t len) {
+      return stream->read(buf, len);
+    };
+
+    size_t size = stream->size(), position = stream->position();
+    if (size > position) {
+      chunked = false;
+      writeHead(conn, reply,
+                "Content-Length: " + std::to_string(size - position) + "\r\n");
+    }
+  }
+  if (chunked) {
+    writeHead(conn, reply, "Transfer-Encoding: chunked\r\n");
+  }
+
+  std::vector<uint8_t> chunk(STREAM_CHUNK_SIZE);
+  while (true) {
+    size_t len = next(chunk.data(), chunk.size());
+    if (len == 0) {
+      break;
+    }
+    int written = chunked ? mg_send_chunk(conn, (const char*)chunk.data(), len)
+                          : mg_write(conn, chunk.data(), len);
+    if (written <= 0) {
+      // The client went away
+      return true;
+    }
+  }
+  if (chunked) {
+    mg_send_chunk(conn, "", 0);
+  }
+  return true;
+}
+
+BellHTTPServer::BellHTTPServer(int serverPort, const Config& config) {
   std::lock_guard lock(initMutex);
   mg_init_library(0);
   BELL_LOG(info, "HttpServer", "Server listening on port %d", serverPort);
@@ -197,10 +785,21 @@ BellHTTPServer::BellHTTPServer(int serverPort) {
 
   civetWebOptions.push_back("listening_ports");
   civetWebOptions.push_back(port);
+  civetWebOptions.insert(
+      civetWebOptions.end(),
+      {"num_threads", std::to_string(config.numThreads), "connection_queue",
+       std::to_string(config.connectionQueue), "enable_keep_alive",
+       config.keepAlive ? "yes" : "no", "keep_alive_timeout_ms",
+       std::to_string(config.keepAliveTimeoutMs), "request_timeout_ms",
+       std::to_string(config.requestTimeoutMs)});
+  civetWebOptions.insert(civetWebOptions.end(), config.options.begin(),
+                         config.options.end());
+  keepAlive = config.keepAlive;
   server = std::make_unique<CivetServer>(civetWebOptions);
 }
 
 BellHTTPServer::~BellHTTPServer() {
+  closeSSE();
   std::lock_guard lock(initMutex);
   mg_exit_library();
 }
@@ -209,7 +808,7 @@ std::unique_ptr<BellHTTPServer::HTTPResponse> BellHTTPServer::makeJsonResponse(
     const std::string& json, int status) {
   auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
 
-  response->body = (uint8_t*)malloc(json.size());
+  response->body = (uint8_t*)bell::Allocator::allocate(json.size());
   response->bodySize = json.size();
   response->headers["Content-Type"] = "application/json";
   response->status = status;
@@ -218,29 +817,343 @@ std::unique_ptr<BellHTTPServer::HTTPResponse> BellHTTPServer::makeJsonResponse(
   return response;
 }
 
+std::unique_ptr<BellHTTPServer::HTTPResponse>
+BellHTTPServer::makeJsonStreamResponse(
+    std::function<void(JsonWriter& json)> write, int status) {
+  auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+  response->bodyWriter = [write](std::ostream& out) {
+    JsonWriter json(out, STREAM_CHUNK_SIZE);
+    write(json);
+  };
+  response->headers["Content-Type"] = "application/json";
+  response->status = status;
+  return response;
+}
+
 std::unique_ptr<BellHTTPServer::HTTPResponse>
 BellHTTPServer::makeEmptyResponse() {
   auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
   return response;
 }
 
+std::unique_ptr<BellHTTPServer::HTTPResponse>
+BellHTTPServer::makeSliceResponse(const bell::BufferSlice& slice,
+                                  const std::string& contentType, int status) {
+  auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+  response->bodySlice = slice;
+  response->bodyView = response->bodySlice.view();
+  if (response->bodyView.data() == nullptr) {
+    // An empty slice is still a body, of zero length
+    response->bodyView = {(const uint8_t*)"", 0};
+  }
+  response->headers["Content-Type"] = contentType;
+  response->status = status;
+  return response;
+}
+
+std::unique_ptr<BellHTTPServer::HTTPResponse>
+BellHTTPServer::makeStreamResponse(std::shared_ptr<bell::ByteStream> stream,
+                                   const std::string& contentType, int status) {
+  auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+  response->bodyStream = std::move(stream);
+  response->headers["Content-Type"] = contentType;
+  response->status = status;
+  return response;
+}
+
+std::unique_ptr<BellHTTPServer::HTTPResponse> BellHTTPServer::makeFileResponse(
+    const std::string& path, const std::string& contentType, int status) {
+  auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+  response->bodyFile = path;
+  response->headers["Content-Type"] = contentType;
+  response->status = status;
+  return response;
+}
+
+std::unique_ptr<BellHTTPServer::HTTPResponse>
+BellHTTPServer::makeGeneratorResponse(
+    std::function<size_t(uint8_t* buf, size_t len)> generator,
+    const std::string& contentType, int status) {
+  auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+  response->bodyGenerator = std::move(generator);
+  response->headers["Content-Type"] = contentType;
+  response->status = status;
+  return response;
+}
+
+std::unique_ptr<BellHTTPServer::HTTPResponse>
+BellHTTPServer::makeChunkResponse(std::function<HTTPResponse::Chunk()> chunks,
+                                  const std::string& contentType, int status) {
+  auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+  response->bodyChunks = std::move(chunks);
+  response->headers["Content-Type"] = contentType;
+  response->status = status;
+  return response;
+}
+
 void BellHTTPServer::registerGet(const std::string& url,
-                                 BellHTTPServer::HTTPHandler handler) {
-  server->addHandler(url, this);
-  getRequestsRouter.insert(url, handler);
+                                 BellHTTPServer::HTTPHandler handler,
+                                 Concurrency concurrency) {
+  server->addHandler(civetPath(url), this);
+  getRequestsRouter.insert(url, handler, concurrency);
+}
+
+void BellHTTPServer::registerMetrics(const std::string& url) {
+  registerGet(
+      url,
+      [this](struct mg_connection* conn) {
+        bell::Metrics::sampleHeap();
+        return makeJsonResponse(bell::Metrics::toJson());
+      },
+      Concurrency::PARALLEL);
+}
+
+void BellHTTPServer::registerPrometheusMetrics(const std::string& url) {
+  registerGet(
+      url,
+      [](struct mg_connection* conn) {
+        bell::Metrics::sampleHeap();
+        std::string text = bell::Metrics::toPrometheus();
+        auto response = std::make_unique<BellHTTPServer::HTTPResponse>();
+        response->body = (uint8_t*)bell::Allocator::allocate(text.size());
+        response->bodySize = text.size();
+        response->headers["Content-Type"] = "text/plain; version=0.0.4";
+        memcpy(response->body, text.data(), text.size());
+        return response;
+      },
+      Concurrency::PARALLEL);
+}
+
+void BellHTTPServer::registerTrace(const std::string& url) {
+  registerGet(
+      url,
+      [this](struct mg_connection* conn) {
+        return makeJsonResponse(bell::Trace::toJson());
+      },
+      Concurrency::PARALLEL);
+}
+
+// FNV-1a, only has to change with the content
+static std::string makeETag(std::span<const uint8_t> data) {
+  uint32_t hash = 2166136261u;
+  for (uint8_t byte : data) {
+    hash = (hash ^ byte) * 16777619u;
+  }
+  char etag[32];
+  snprintf(etag, sizeof(etag), "\"%08lx-%zx\"", (unsigned long)hash,
+           data.size());
+  return etag;
+}
+
+void BellHTTPServer::registerStaticFiles(
+    const std::string& url,
+    std::shared_ptr<bell::BellTar::mapped_archive> archive,
+    const std::string& indexFile) {
+  // Hashed once here rather than on every request
+  auto etags = std::make_shared<std::unordered_map<std::string, std::string>>();
+  for (auto& entry : archive->get_index().entries()) {
+    (*etags)[entry.name] = makeETag(archive->get(entry.name));
+  }
+
+  std::string prefix = url;
+  while (!prefix.empty() && prefix.back() == '/') {
+    prefix.pop_back();
+  }
+
+  // Reads the archive only, requests are served concurrently
+  auto handler = [this, archive, etags, prefix,
+                  indexFile](struct mg_connection* conn) {
+    std::string_view uri = mg_get_request_info(conn)->local_uri;
+    std::string path(uri.substr(std::min(prefix.size(), uri.size())));
+    while (!path.empty() && path[0] == '/') {
+      path.erase(0, 1);
+    }
+    if (path.empty() || path.back() == '/') {
+      path += indexFile;
+    }
+
+    const char* acceptEncoding = mg_get_header(conn, "Accept-Encoding");
+    std::string_view accepted = acceptEncoding ? acceptEncoding : "";
+    std::string member = path;
+    std::string encoding;
+    if (accepted.find("br") != std::string_view::npos &&
+        archive->get_index().find(path + ".br")) {
+      member = path + ".br";
+      encoding = "br";
+    } else if (accepted.find("gzip") != std::string_view::npos &&
+               archive->get_index().find(path + ".gz")) {
+      member = path + ".gz";
+      encoding = "gzip";
+    }
+
+    auto etag = etags->find(member);
+    if (etag == etags->end()) {
+      auto response = makeEmptyResponse();
+      response->status = 404;
+      response->bodyView = {(const uint8_t*)"Not found", 9};
+      response->headers["Content-Type"] = "text/plain";
+      return response;
+    }
+
+    auto response = makeEmptyResponse();
+    response->headers["Content-Type"] =
+        mg_get_builtin_mime_type(path.c_str());
+    response->headers["ETag"] = etag->second;
+    // Revalidated on every load, a reflashed bundle shows up at once
+    response->headers["Cache-Control"] = "no-cache";
+    response->headers["Vary"] = "Accept-Encoding";
+    if (!encoding.empty()) {
+      response->headers["Content-Encoding"] = encoding;
+    }
+
+    const char* ifNoneMatch = mg_get_header(conn, "If-None-Match");
+    if (ifNoneMatch && std::string_view(ifNoneMatch).find(etag->second) !=
+                           std::string_view::npos) {
+      response->status = 304;
+      return response;
+    }
+    response->bodyView = archive->get(member);
+    return response;
+  };
+  registerGet(prefix + "/*", handler, Concurrency::PARALLEL);
 }
 
 void BellHTTPServer::registerPost(const std::string& url,
-                                  BellHTTPServer::HTTPHandler handler) {
-  server->addHandler(url, this);
-  postRequestsRouter.insert(url, handler);
+                                  BellHTTPServer::HTTPHandler handler,
+                                  Concurrency concurrency) {
+  server->addHandler(civetPath(url), this);
+  postRequestsRouter.insert(url, handler, concurrency);
+}
+
+void BellHTTPServer::registerUpload(const std::string& url,
+                                    UploadFactory factory,
+                                    Concurrency concurrency) {
+  auto handler = [this, factory](struct mg_connection* conn) {
+    auto upload = factory(conn);
+    if (upload == nullptr) {
+      return makeJsonResponse("{\"error\":\"refused\"}", 403);
+    }
+
+    const char* header = mg_get_header(conn, "Content-Type");
+    std::string_view contentType = header ? header : "";
+    std::unique_ptr<MultipartParser> multipart;
+    bool ok = true;
+    if (contentType.starts_with("multipart/")) {
+      std::string boundary = headerParam(contentType, "boundary");
+      ok = !boundary.empty();
+      multipart = std::make_unique<MultipartParser>(boundary, *upload);
+    } else {
+      ok = upload->beginPart({"", "", std::string(contentType)});
+    }
+
+    // Unknown for a chunked body, mg_read() ends it either way
+    long long length = mg_get_request_info(conn)->content_length;
+    long long read = 0;
+    std::vector<uint8_t> buf(BELL_HTTP_UPLOAD_CHUNK);
+    int got = 0;
+    while (ok && (got = mg_read(conn, buf.data(), buf.size())) > 0) {
+      read += got;
+      ok = multipart ? multipart->feed(buf.data(), got)
+                     : upload->write(buf.data(), got);
+    }
+
+    bool complete = ok && got == 0 && (length < 0 || read == length);
+    if (multipart) {
+      complete = complete && multipart->done();
+    } else if (ok) {
+      complete = upload->endPart() && complete;
+    }
+    return upload->finish(*this, complete);
+  };
+  registerPost(url, handler, concurrency);
 }
 
 void BellHTTPServer::registerWS(const std::string& url,
                                 BellHTTPServer::WSDataHandler dataHandler,
                                 BellHTTPServer::WSStateHandler stateHandler) {
-  server->addWebSocketHandler(url,
-                              new WebSocketHandler(dataHandler, stateHandler));
+  auto handler = new WebSocketHandler(dataHandler, stateHandler);
+  {
+    std::scoped_lock lock(wsHandlersMutex);
+    wsHandlers[url] = handler;
+  }
+  server->addWebSocketHandler(url, handler);
+}
+
+size_t BellHTTPServer::broadcastWS(const std::string& url, const uint8_t* data,
+                                   size_t len, int opcode) {
+  WebSocketHandler* handler;
+  {
+    std::scoped_lock lock(wsHandlersMutex);
+    auto it = wsHandlers.find(url);
+    if (it == wsHandlers.end()) {
+      return 0;
+    }
+    handler = it->second;
+  }
+  return handler->broadcast(encodeWSFrame(opcode, data, len));
+}
+
+size_t BellHTTPServer::broadcastWS(const std::string& url,
+                                   const std::string& message) {
+  return broadcastWS(url, (const uint8_t*)message.data(), message.size());
+}
+
+void BellHTTPServer::registerSSE(const std::string& url,
+                                 uint32_t heartbeatMs) {
+  auto channel = std::make_shared<SSEChannel>();
+  {
+    std::scoped_lock lock(sseMutex);
+    sseChannels[url] = channel;
+  }
+
+  // Blocks its worker for as long as the client stays
+  auto handler = [this, channel, heartbeatMs](struct mg_connection* conn) {
+    mg_printf(conn,
+              "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+              "Cache-Control: no-cache\r\nAccess-Control-Allow-Origin: "
+              "*\r\nConnection: close\r\n\r\n");
+    const char* lastEventId = mg_get_header(conn, "Last-Event-ID");
+    uint64_t lastSeq = lastEventId ? strtoull(lastEventId, nullptr, 10) : 0;
+
+    std::string events;
+    while (channel->next(lastSeq, events, heartbeatMs)) {
+      if (events.empty()) {
+        events = ":\n\n";
+      }
+      if (mg_write(conn, events.data(), events.size()) <= 0) {
+        // The client went away
+        break;
+      }
+    }
+    return makeEmptyResponse();
+  };
+  registerGet(url, handler, Concurrency::PARALLEL);
+}
+
+void BellHTTPServer::publishSSE(const std::string& url, const std::string& key,
+                                const std::string& data) {
+  std::shared_ptr<SSEChannel> channel;
+  {
+    std::scoped_lock lock(sseMutex);
+    auto it = sseChannels.find(url);
+    if (it == sseChannels.end()) {
+      return;
+    }
+    channel = it->second;
+  }
+  channel->publish(key, data);
+}
+
+void BellHTTPServer::closeSSE() {
+  std::scoped_lock lock(sseMutex);
+  for (auto& [url, channel] : sseChannels) {
+    channel->close();
+  }
+}
+
+void BellHTTPServer::close() {
+  closeSSE();
+  server->close();
 }
 
 void BellHTTPServer::registerNotFound(HTTPHandler handler) {
@@ -251,8 +1164,111 @@ std::unordered_map<std::string, std::string> BellHTTPServer::extractParams(
     struct mg_connection* conn) {
   void* data = mg_get_user_connection_data(conn);
   assert(data != nullptr);
-  std::unordered_map<std::string, std::string>& params =
-      *(std::unordered_map<std::string, std::string>*)data;
+  return static_cast<const Router::Match*>(data)->toParams();
+}
+
+std::string_view BellHTTPServer::extractParam(struct mg_connection* conn,
+                                              std::string_view name) {
+  void* data = mg_get_user_connection_data(conn);
+  assert(data != nullptr);
+  const Router::Match& match = *static_cast<const Router::Match*>(data);
+  for (size_t i = 0; i < match.paramCount; i++) {
+    if (match.params[i].first == name) {
+      return match.params[i].second;
+    }
+  }
+  return {};
+}
+
+BellHTTPServer::QueryParams::QueryParams(std::string_view text) {
+  while (!text.empty() && count < MAX_PARAMS) {
+    size_t end = text.find('&');
+    std::string_view pair = text.substr(0, end);
+    text = end == std::string_view::npos ? std::string_view()
+                                         : text.substr(end + 1);
+    if (pair.empty()) {
+      continue;
+    }
+    size_t equals = pair.find('=');
+    if (equals == std::string_view::npos) {
+      params[count++] = {pair, {}};
+    } else {
+      params[count++] = {pair.substr(0, equals), pair.substr(equals + 1)};
+    }
+  }
+}
+
+bool BellHTTPServer::QueryParams::has(std::string_view name) const {
+  for (size_t i = 0; i < count; i++) {
+    if (params[i].first == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string_view BellHTTPServer::QueryParams::get(
+    std::string_view name) const {
+  for (size_t i = 0; i < count; i++) {
+    if (params[i].first == name) {
+      return params[i].second;
+    }
+  }
+  return {};
+}
+
+std::string_view BellHTTPServer::QueryParams::decode(std::string_view name,
+                                                     char* buf,
+                                                     size_t size) const {
+  std::string_view value = get(name);
+  if (value.empty() || size == 0) {
+    return {};
+  }
+  // Writes a terminator too, -1 when that doesn't fit
+  int length =
+      mg_url_decode(value.data(), (int)value.size(), buf, (int)size, 1);
+  if (length < 0) {
+    return {};
+  }
+  return std::string_view(buf, length);
+}
+
+long BellHTTPServer::QueryParams::getInt(std::string_view name,
+                                         long fallback) const {
+  char buf[24];
+  std::string_view value = decode(name, buf, sizeof(buf));
+  if (value.empty()) {
+    return fallback;
+  }
+  char* end = nullptr;
+  long number = strtol(buf, &end, 10);
+  return end == buf + value.size() ? number : fallback;
+}
+
+BellHTTPServer::QueryParams BellHTTPServer::extractQuery(
+    struct mg_connection* conn) {
+  const char* query = mg_get_request_info(conn)->query_string;
+  return query == nullptr ? QueryParams() : QueryParams(query);
+}
+
+BellHTTPServer::QueryParams BellHTTPServer::extractForm(
+    struct mg_connection* conn, char* buf, size_t size) {
+  long long length = mg_get_request_info(conn)->content_length;
+  if (length < 0 || (size_t)length > size) {
+    return {};
+  }
+  size_t read = 0;
+  while (read < (size_t)length) {
+    int got = mg_read(conn, buf + read, length - read);
+    if (got <= 0) {
+      return {};
+    }
+    read += got;
+  }
+  return QueryParams(std::string_view(buf, read));
+}
 
-  return params;
+BellHTTPServer::HTTPResponse::Pool& BellHTTPServer::HTTPResponse::pool() {
+  static Pool pool("http_response");
+  return pool;
 }
@@ -1,110 +1,719 @@
 #include "BellMQTTClient.h"
 
 #ifndef _WIN32
-#include <sys/fcntl.h>  // for fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <netinet/in.h>   // for IPPROTO_TCP
+#include <netinet/tcp.h>  // for TCP_CORK
+#include <sys/fcntl.h>    // for fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <sys/socket.h>   // for setsockopt
 #endif
 #include <stddef.h>   // for NULL
+#include <stdint.h>   // for SIZE_MAX
+#include <string.h>   // for strlen
+#include <algorithm>  // for min
+#include <exception>  // for exception
 #include <stdexcept>  // for runtime_error
 
-#include "BellLogger.h"  // for AbstractLogger, BELL_LOG
-#include "BellSocket.h"  // for bell
-#include "TCPSocket.h"   // for TCPSocket
+#include "BellClock.h"         // for nowMs
+#include "BellLogger.h"        // for AbstractLogger, BELL_LOG
+#include "BellMetrics.h"       // for Metrics, BELL_METRIC_COUNT
+#include "BellSocket.h"        // for bell
+#include "TCPSocket.h"         // for TCPSocket
+#include "TLSSocket.h"         // for TLSSocket
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
 
 using namespace bell;
 
+// Fixed header, packet id and topic length of a publish
+static constexpr size_t PUBLISH_OVERHEAD = 9;
+
 void cPublishCallback(void** unused, struct mqtt_response_publish* published) {
   // Map to class instance
   MQTTClient* client = (MQTTClient*)*unused;
   client->publishCallback(published);
 }
 
+static size_t publishSize(size_t topicSize, size_t messageSize) {
+  return PUBLISH_OVERHEAD + topicSize + messageSize +
+         sizeof(struct mqtt_queued_message);
+}
+
+// Topics of a batched SUBSCRIBE, the library packs fewer than its maximum
+static constexpr size_t SUBSCRIBE_BATCH =
+    MQTT_SUBSCRIBE_REQUEST_MAX_NUM_TOPICS - 1;
+
+// Same as mqtt_pal_sendall(), through a bell::Socket
+static ssize_t socketSend(void* state, const void* buf, size_t len) {
+  auto* socket = static_cast<bell::Socket*>(state);
+  size_t sent = 0;
+  while (sent < len) {
+    long result = (long)socket->write((uint8_t*)buf + sent, len - sent);
+    if (result <= 0) {
+      if (result < 0 && socket->getError() != Socket::Error::TIMEOUT) {
+        return sent > 0 ? (ssize_t)sent : (ssize_t)MQTT_ERROR_SOCKET_ERROR;
+      }
+      // Would block, or TLS flushed a pending record only
+      break;
+    }
+    sent += result;
+  }
+  return sent;
+}
+
+// Same as mqtt_pal_recvall(), through a bell::Socket
+static ssize_t socketRecv(void* state, void* buf, size_t bufsz) {
+  auto* socket = static_cast<bell::Socket*>(state);
+  size_t received = 0;
+  while (received < bufsz) {
+    long result =
+        (long)socket->read((uint8_t*)buf + received, bufsz - received);
+    if (result <= 0) {
+      if (result < 0 && socket->getError() == Socket::Error::TIMEOUT) {
+        break;
+      }
+      // Closed or failed, a reconnect is up to the caller
+      return received > 0 ? (ssize_t)received
+                          : (ssize_t)MQTT_ERROR_SOCKET_ERROR;
+    }
+    received += result;
+  }
+  return received;
+}
+
+MQTTClient::MQTTClient(const Config& config)
+    : config(config),
+      sendbuf(config.sendBufferSize),
+      recvbuf(config.recvBufferSize) {
+  if (config.tls) {
+    socket = std::make_unique<bell::TLSSocket>();
+  } else {
+    socket = std::make_unique<bell::TCPSocket>();
+  }
+  transport.send = socketSend;
+  transport.recv = socketRecv;
+  transport.state = socket.get();
+}
+
+MQTTClient::~MQTTClient() {
+  detach();
+}
+
 void bell::MQTTClient::connect(const std::string& host, uint16_t port,
                                const std::string& username,
                                const std::string& password) {
-  socket.open(host, port);
+  if (config.persistentSession && config.clientId.empty()) {
+    throw std::runtime_error("A persistent MQTT session needs a client id");
+  }
+  this->host = host;
+  this->port = port;
+  this->username = username;
+  this->password = password;
+
+  std::scoped_lock lock(syncMutex);
+  open();
+  backoffMs = config.reconnectMinMs;
+  reconnecting = config.autoReconnect;
+}
+
+void MQTTClient::open() {
+  socket->open(host, port);
 
   // Verify that the socket is open
-  if (!socket.isOpen()) {
+  if (!socket->isOpen()) {
     throw std::runtime_error("Could not connect to MQTT broker");
   }
 
   // Set the socket to non-blocking
 #ifdef _WIN32
   u_long iMode = 1;
-  ioctlsocket(socket.getFd(), FIONBIO, &iMode);
+  ioctlsocket(socket->getFd(), FIONBIO, &iMode);
 #else
-  int status = fcntl(socket.getFd(), F_SETFL,
-                     fcntl(socket.getFd(), F_GETFL, 0) | O_NONBLOCK);
+  int status = fcntl(socket->getFd(), F_SETFL,
+                     fcntl(socket->getFd(), F_GETFL, 0) | O_NONBLOCK);
 #endif
 
   // Pass pointer to this object to the publish callback
   client.publish_response_callback_state = this;
 
-  if (mqtt_init(&client, socket.getFd(), sendbuf, sizeof(sendbuf), recvbuf,
-                sizeof(recvbuf), cPublishCallback) != MQTT_OK) {
+  // publish() and subscribe() hand messages to the library under it
+  std::scoped_lock lock(queueMutex);
+  if (mqtt_init(&client, socket->getFd(), sendbuf.data(), sendbuf.size(),
+                recvbuf.data(), recvbuf.size(),
+                cPublishCallback) != MQTT_OK) {
     throw std::runtime_error("Cannot initialize MQTT structure");
   }
+  // TLS records are the socket's to decrypt, a plain one is read directly
+  if (config.tls) {
+    client.transport = &transport;
+  }
 
-  const char* clientId = NULL;
-  uint8_t connect_flags = MQTT_CONNECT_CLEAN_SESSION;
+  const char* clientId =
+      config.clientId.empty() ? NULL : config.clientId.c_str();
+  uint8_t connect_flags =
+      config.persistentSession ? 0 : MQTT_CONNECT_CLEAN_SESSION;
   if (mqtt_connect(&client, clientId, NULL, NULL, 0, username.c_str(),
-                   password.c_str(), connect_flags, 400) != MQTT_OK) {
+                   password.c_str(), connect_flags,
+                   config.keepAliveSec) != MQTT_OK) {
     throw std::runtime_error("MQTT connect failed");
   }
 
   // Mark as connected
   connected = true;
+  awaitingConnack = true;
+}
+
+void MQTTClient::lost() {
+  BELL_LOG(error, "mqtt", "MQTT connection lost, reconnecting in %u ms",
+           backoffMs);
+  BELL_METRIC_COUNT("mqtt.disconnects", 1);
+  if (attached) {
+    loop->unwatch(socket->getFd());
+  }
+  socket->close();
+
+  {
+    std::scoped_lock lock(queueMutex);
+    // What was acknowledged before the drop
+    sweepOutbox();
+    for (auto& publish : outbox) {
+      if (publish.packetId != 0) {
+        publish.packetId = 0;
+        publish.dup = true;
+      }
+    }
+    connected = false;
+  }
+  awaitingConnack = false;
+  nextAttemptMs = bell::clock::nowMs() + backoffMs;
+  backoffMs = std::min(backoffMs * 2, config.reconnectMaxMs);
+}
+
+void MQTTClient::tryReconnect() {
+  if (connected || !reconnecting || bell::clock::nowMs() < nextAttemptMs) {
+    return;
+  }
+
+  try {
+    open();
+  } catch (const std::exception& e) {
+    BELL_LOG(error, "mqtt", "MQTT reconnect failed: %s", e.what());
+    socket->close();
+    nextAttemptMs = bell::clock::nowMs() + backoffMs;
+    backoffMs = std::min(backoffMs * 2, config.reconnectMaxMs);
+    return;
+  }
+
+  BELL_LOG(info, "mqtt", "MQTT reconnected to %s", host.c_str());
+  BELL_METRIC_COUNT("mqtt.reconnects", 1);
+  catchingUp = true;
+  if (attached) {
+    watchSocket();
+  }
+}
+
+bool MQTTClient::takeBurst(size_t size) {
+  if (burstLeft == 0) {
+    return false;
+  }
+  // One over is let through, so a publish larger than the burst still goes
+  if (burstLeft != SIZE_MAX) {
+    burstLeft -= std::min(size, burstLeft);
+  }
+  return true;
+}
+
+void MQTTClient::resubscribe() {
+  std::scoped_lock lock(subscriptionsMutex, queueMutex);
+  while (!resubscribes.empty() && connected) {
+    size_t count = std::min(resubscribes.size(), SUBSCRIBE_BATCH);
+    const char* topics[SUBSCRIBE_BATCH];
+    int levels[SUBSCRIBE_BATCH];
+    // Fixed header, packet id, and each topic's length and QoS
+    size_t size = 7 + sizeof(struct mqtt_queued_message);
+    for (size_t i = 0; i < count; i++) {
+      const std::string& topic = resubscribes[resubscribes.size() - 1 - i];
+      topics[i] = topic.c_str();
+      levels[i] = (int)subscriptions[topic];
+      size += topic.size() + 3;
+    }
+    if (!hasRoom(size) || !takeBurst(size)) {
+      break;
+    }
+
+    int err = mqtt_subscribe_many(&client, topics, levels, count);
+    if (err != MQTT_OK) {
+      BELL_LOG(error, "mqtt", "MQTT subscribe failed: %d", err);
+      break;
+    }
+    resubscribes.resize(resubscribes.size() - count);
+  }
+}
+
+void MQTTClient::drainOutbox() {
+  std::scoped_lock lock(queueMutex);
+  for (auto& publish : outbox) {
+    if (!connected) {
+      break;
+    }
+    if (publish.packetId != 0) {
+      continue;
+    }
+    size_t size = publishSize(publish.topic.size(), publish.message.size());
+    if (!hasRoom(size) || !takeBurst(size)) {
+      break;
+    }
+
+    uint8_t flags = (uint8_t)publish.qos | (publish.dup ? MQTT_PUBLISH_DUP : 0);
+    int err = mqtt_publish(&client, publish.topic.c_str(),
+                           publish.message.data(), publish.message.size(),
+                           flags);
+    if (err != MQTT_OK) {
+      BELL_LOG(error, "mqtt", "MQTT publish failed: %d", err);
+      break;
+    }
+    // The library numbered it, its newest message is at the queue's tail
+    MQTT_PAL_MUTEX_LOCK(&client.mutex);
+    publish.packetId = client.mq.queue_tail->packet_id;
+    MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+  }
+}
+
+void MQTTClient::sweepOutbox() {
+  MQTT_PAL_MUTEX_LOCK(&client.mutex);
+  for (auto it = outbox.begin(); it != outbox.end();) {
+    if (it->packetId != 0) {
+      // Cleaned out of the library's queue once acknowledged
+      uint16_t packetId = it->packetId;
+      auto message =
+          mqtt_mq_find(&client.mq, MQTT_CONTROL_PUBLISH, &packetId);
+      if (message == nullptr || message->state == MQTT_QUEUED_COMPLETE) {
+        outboxSize -= it->topic.size() + it->message.size();
+        it = outbox.erase(it);
+        continue;
+      }
+    }
+    ++it;
+  }
+  MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+}
+
+void MQTTClient::attach(bell::EventLoop& loop) {
+  if (!connected && !reconnecting) {
+    throw std::runtime_error("MQTT client is not connected");
+  }
+  detach();
+
+  this->loop = &loop;
+  {
+    std::scoped_lock lock(syncMutex, queueMutex);
+    attached = true;
+    if (connected) {
+      watchSocket();
+    }
+  }
+  scheduleTick();
+  // Whatever was published before attaching
+  loop.post([this]() {
+    if (attached) {
+      pump();
+    }
+  });
+}
+
+void MQTTClient::detach() {
+  if (loop == nullptr) {
+    return;
+  }
+
+  {
+    // No more posts from publish() once this is cleared, nor (re)watches
+    // from pump()
+    std::scoped_lock lock(syncMutex, queueMutex);
+    attached = false;
+    if (connected) {
+      loop->unwatch(socket->getFd());
+    }
+  }
+
+  // Wait for a handler or tick that is running on the loop right now
+  bell::WrappedSemaphore done(1);
+  loop->post([&done]() { done.give(); });
+  done.wait();
+
+  loop->cancel(tickTimer);
+  tickTimer = 0;
+  loop->cancel(metricsTimer);
+  metricsTimer = 0;
+  pumpPosted = false;
+  loop = nullptr;
+}
+
+void MQTTClient::watchSocket() {
+  loop->watch(socket->getFd(), EventLoop::READABLE, [this](int events) {
+    if (attached) {
+      pump();
+    }
+  });
+}
+
+void MQTTClient::scheduleTick() {
+  tickTimer = loop->schedule(TICK_MS, [this]() {
+    if (attached) {
+      pump();
+      scheduleTick();
+    }
+  });
+}
+
+void MQTTClient::scheduleMetrics(const std::string& topic,
+                                 uint32_t intervalMs, QOS qos) {
+  metricsTimer = loop->schedule(intervalMs, [this, topic, intervalMs, qos]() {
+    if (attached) {
+      if (connected || reconnecting) {
+        publishMetrics(topic, qos);
+      }
+      scheduleMetrics(topic, intervalMs, qos);
+    }
+  });
+}
+
+void MQTTClient::publishMetricsEvery(const std::string& topic,
+                                     uint32_t intervalMs, QOS qos) {
+  if (loop == nullptr) {
+    throw std::runtime_error("MQTT client is not attached");
+  }
+  loop->post([this, topic, intervalMs, qos]() {
+    if (!attached) {
+      return;
+    }
+    loop->cancel(metricsTimer);
+    metricsTimer = 0;
+    if (intervalMs > 0) {
+      scheduleMetrics(topic, intervalMs, qos);
+    }
+  });
 }
 
 void MQTTClient::sync() {
-  if (!connected) {
+  if (!connected && !reconnecting) {
     throw std::runtime_error("MQTT client is not connected");
   }
 
   // Poll the socket
   // Process the data
-  mqtt_sync(&client);
+  pump();
 }
 
-void MQTTClient::publish(const std::string& topic, const std::string& message,
-                         QOS qos) {
-  if (!connected) {
-    throw std::runtime_error("MQTT client is not connected");
+void MQTTClient::setCorked(bool corked) {
+#ifdef TCP_CORK
+  // Lets the publishes the library sends one by one leave as full segments
+  int value = corked ? 1 : 0;
+  setsockopt(socket->getFd(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#endif
+}
+
+bool MQTTClient::hasRoom(size_t needed) {
+  struct mqtt_message_queue* mq = &client.mq;
+  MQTT_PAL_MUTEX_LOCK(&client.mutex);
+  size_t room = mqtt_mq_currsz(mq);
+  if (room < needed) {
+    // Reclaims what was already sent and acknowledged
+    mqtt_mq_clean(mq);
+    room = mqtt_mq_currsz(mq);
+  }
+  MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+  return room >= needed;
+}
+
+void MQTTClient::drainQueue() {
+  std::scoped_lock lock(queueMutex);
+  while (!queue.empty() && connected) {
+    QueuedPublish& next = queue.front();
+    size_t size = publishSize(next.topic.size(), next.message.size());
+    if (!hasRoom(size) || !takeBurst(size)) {
+      break;
+    }
+
+    int err = mqtt_publish(&client, next.topic.c_str(), next.message.c_str(),
+                           next.message.size(), (uint8_t)next.qos);
+    if (err != MQTT_OK) {
+      BELL_LOG(error, "mqtt", "MQTT publish failed: %d", err);
+      break;
+    }
+    queueBytes -= next.topic.size() + next.message.size();
+    queue.pop_front();
   }
+}
 
-  int err = mqtt_publish(&client, topic.c_str(), message.c_str(),
-                         message.size(), (uint8_t)qos);
+const char* MQTTClient::findTopic(std::string_view topic) {
+  std::scoped_lock lock(topicsMutex);
+  auto it = topics.find(topic);
+  if (it == topics.end()) {
+    if (topics.size() >= MAX_TOPICS) {
+      return nullptr;
+    }
+    it = topics.emplace(topic).first;
+  }
+  return it->c_str();
+}
+
+void MQTTClient::cacheTopic(std::string_view topic) {
+  findTopic(topic);
+}
 
+bool MQTTClient::publishDirect(const char* topic,
+                               std::span<const uint8_t> message, QOS qos) {
+  std::scoped_lock lock(queueMutex);
+  // Queued publishes go first
+  if (!connected || !queue.empty() ||
+      !hasRoom(publishSize(strlen(topic), message.size()))) {
+    return false;
+  }
+
+  int err = mqtt_publish(&client, topic, message.data(), message.size(),
+                         (uint8_t)qos);
   if (err != MQTT_OK) {
     BELL_LOG(error, "mqtt", "MQTT publish failed: %d", err);
     throw std::runtime_error("MQTT publish failed");
   }
+  return true;
 }
 
-void MQTTClient::subscribe(const std::string& topic, QOS qos) {
+void MQTTClient::postPump() {
+  // One pump flushes every publish made until it runs
+  if (!pumpPosted.exchange(true)) {
+    loop->post([this]() {
+      if (attached) {
+        pump();
+      }
+    });
+  }
+}
+
+bool MQTTClient::hasUnsent() {
+  {
+    std::scoped_lock lock(subscriptionsMutex, queueMutex);
+    if (!queue.empty() || !resubscribes.empty()) {
+      return true;
+    }
+    for (auto& publish : outbox) {
+      if (publish.packetId == 0) {
+        return true;
+      }
+    }
+  }
+
+  bool unsent = false;
+  MQTT_PAL_MUTEX_LOCK(&client.mutex);
+  for (ssize_t i = 0; i < mqtt_mq_length(&client.mq); i++) {
+    if (mqtt_mq_get(&client.mq, i)->state == MQTT_QUEUED_UNSENT) {
+      unsent = true;
+      break;
+    }
+  }
+  MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+  return unsent;
+}
+
+void MQTTClient::pump() {
+  std::scoped_lock lock(syncMutex);
+  pumpPosted = false;
+  tryReconnect();
   if (!connected) {
+    return;
+  }
+
+  burstLeft = catchingUp ? config.reconnectBurstBytes : SIZE_MAX;
+  if (awaitingConnack && client.session_present >= 0) {
+    awaitingConnack = false;
+    backoffMs = config.reconnectMinMs;
+    if (catchingUp &&
+        (!config.persistentSession || client.session_present == 0)) {
+      // The broker starts from nothing, subscriptions included
+      std::scoped_lock subscriptionsLock(subscriptionsMutex);
+      resubscribes.clear();
+      for (auto& [topic, qos] : subscriptions) {
+        resubscribes.push_back(topic);
+      }
+    }
+  }
+
+  resubscribe();
+  drainOutbox();
+  drainQueue();
+  setCorked(true);
+  enum MQTTErrors err = mqtt_sync(&client);
+  setCorked(false);
+
+  if (client.error == MQTT_ERROR_SEND_BUFFER_IS_FULL) {
+    // Sticky in the library, but drainQueue() only fills what fits
+    client.error = MQTT_OK;
+  } else if (err != MQTT_OK) {
+    BELL_LOG(error, "mqtt", "MQTT sync failed: %s", mqtt_error_str(err));
+    if (reconnecting) {
+      lost();
+      return;
+    }
+  }
+
+  // Room may have been freed by the sync
+  resubscribe();
+  drainOutbox();
+  drainQueue();
+  {
+    std::scoped_lock queueLock(queueMutex);
+    sweepOutbox();
+  }
+  if (catchingUp && !awaitingConnack && !hasUnsent()) {
+    catchingUp = false;
+  }
+
+  if (attached) {
+    // Wake up again once the socket takes more
+    loop->modify(socket->getFd(),
+                 EventLoop::READABLE | (hasUnsent() ? EventLoop::WRITABLE : 0));
+  }
+}
+
+bool MQTTClient::publish(const std::string& topic, const std::string& message,
+                         QOS qos) {
+  return publish(std::string_view(topic),
+                 std::span((const uint8_t*)message.data(), message.size()),
+                 qos);
+}
+
+bool MQTTClient::publishMetrics(const std::string& topic, QOS qos) {
+  bell::Metrics::sampleHeap();
+  return publish(topic, bell::Metrics::toJson(), qos);
+}
+
+bool MQTTClient::publish(std::string_view topic,
+                         std::span<const uint8_t> message, QOS qos) {
+  if (!connected && !reconnecting) {
     throw std::runtime_error("MQTT client is not connected");
   }
+  if (publishSize(topic.size(), message.size()) > sendbuf.size()) {
+    throw std::runtime_error("MQTT message exceeds the send buffer");
+  }
+
+  if (config.outboxBytes > 0 && qos != QOS::AT_MOST_ONCE) {
+    {
+      std::scoped_lock lock(queueMutex);
+      size_t size = topic.size() + message.size();
+      while (!outbox.empty() && outboxSize + size > config.outboxBytes) {
+        // Telemetry ages, the newest matters most
+        outboxSize -= outbox.front().topic.size() +
+                      outbox.front().message.size();
+        outbox.pop_front();
+        BELL_METRIC_COUNT("mqtt.outbox_dropped", 1);
+      }
+      outbox.push_back(
+          {std::string(topic),
+           std::string((const char*)message.data(), message.size()), qos});
+      outboxSize += size;
+
+      if (attached) {
+        postPump();
+        return true;
+      }
+    }
+    drainOutbox();
+    return true;
+  }
+  if (!connected) {
+    // At most once, while reconnecting that's not at all
+    BELL_METRIC_COUNT("mqtt.dropped", 1);
+    return true;
+  }
+
+  const char* cachedTopic = findTopic(topic);
+  if (cachedTopic != nullptr && publishDirect(cachedTopic, message, qos)) {
+    std::scoped_lock lock(queueMutex);
+    if (attached) {
+      postPump();
+    }
+    return true;
+  }
+
+  {
+    std::scoped_lock lock(queueMutex);
+    size_t size = topic.size() + message.size();
+    if (!queue.empty() && queueBytes + size > config.maxQueuedBytes) {
+      return false;
+    }
+    queue.push_back({std::string(topic),
+                     std::string((const char*)message.data(), message.size()),
+                     qos});
+    queueBytes += size;
+
+    if (attached) {
+      postPump();
+      return true;
+    }
+  }
 
-  mqtt_subscribe(&client, topic.c_str(), (uint8_t)qos);
+  drainQueue();
+  return true;
+}
+
+size_t MQTTClient::queuedBytes() {
+  std::scoped_lock lock(queueMutex);
+  return queueBytes;
+}
+
+size_t MQTTClient::outboxBytes() {
+  std::scoped_lock lock(queueMutex);
+  return outboxSize;
+}
+
+void MQTTClient::subscribe(const std::string& topic, QOS qos) {
+  if (!connected && !reconnecting) {
+    throw std::runtime_error("MQTT client is not connected");
+  }
+
+  std::scoped_lock lock(subscriptionsMutex, queueMutex);
+  subscriptions[topic] = qos;
+  // Otherwise sent on reconnect
+  if (connected) {
+    mqtt_subscribe(&client, topic.c_str(), (uint8_t)qos);
+  }
 }
 
 void MQTTClient::unsubscribe(const std::string& topic) {
-  if (!connected) {
+  if (!connected && !reconnecting) {
     throw std::runtime_error("MQTT client is not connected");
   }
 
-  mqtt_unsubscribe(&client, topic.c_str());
+  std::scoped_lock lock(subscriptionsMutex, queueMutex);
+  subscriptions.erase(topic);
+  std::erase(resubscribes, topic);
+  if (connected) {
+    mqtt_unsubscribe(&client, topic.c_str());
+  }
 }
 
 void MQTTClient::disconnect() {
-  if (!connected) {
+  if (!connected && !reconnecting) {
     throw std::runtime_error("MQTT client is not connected");
   }
 
-  mqtt_disconnect(&client);
-  socket.close();
-  connected = false;
+  reconnecting = false;
+  detach();
+  if (connected) {
+    // Flush queued publishes and the disconnect itself before closing
+    pump();
+    mqtt_disconnect(&client);
+    pump();
+    socket->close();
+    connected = false;
+  }
+
+  std::scoped_lock lock(subscriptionsMutex, queueMutex);
+  queue.clear();
+  queueBytes = 0;
+  outbox.clear();
+  outboxSize = 0;
+  subscriptions.clear();
+  resubscribes.clear();
 }
 
 bool MQTTClient::isConnected() {
@@ -112,7 +721,14 @@ bool MQTTClient::isConnected() {
 }
 
 void MQTTClient::publishCallback(struct mqtt_response_publish* published) {
-  if (_publishCallback) {
+  if (_publishViewCallback) {
+    // Straight out of the receive buffer
+    _publishViewCallback(
+        std::string_view((const char*)published->topic_name,
+                         published->topic_name_size),
+        std::span((const uint8_t*)published->application_message,
+                  published->application_message_size));
+  } else if (_publishCallback) {
     // Prepare the topic and message
     std::string topic((const char*)published->topic_name,
                       published->topic_name_size);
@@ -120,4 +736,4 @@ void MQTTClient::publishCallback(struct mqtt_response_publish* published) {
                         published->application_message_size);
     _publishCallback(topic, message);
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,144 @@
+#include "BellSocket.h"
+
+#include <errno.h>  // for errno, EAGAIN, EWOULDBLOCK
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>   // for IPPROTO_TCP
+#include <netinet/tcp.h>  // for TCP_NODELAY, TCP_QUICKACK, TCP_KEEPIDLE
+#include <sys/socket.h>   // for setsockopt, SOL_SOCKET, SO_RCVTIMEO
+#include <sys/time.h>     // for timeval
+#endif
+
+using namespace bell;
+
+Socket::Timeouts& Socket::defaultTimeouts() {
+  static Timeouts timeouts;
+  return timeouts;
+}
+
+Socket::Options& Socket::profileOptions(Profile profile) {
+  static Options interactive = {
+      .quickAck = true,
+      // Keeps a request from queueing behind a backlog of unsent data
+      .notSentLowat = 16 * 1024,
+      // Pooled connections are found dead before they're reused
+      .keepAliveIdleS = 30,
+  };
+  static Options bulk = {
+      .receiveBuffer = BELL_SOCKET_BULK_RCVBUF,
+      .keepAliveIdleS = 60,
+  };
+  return profile == Profile::BULK ? bulk : interactive;
+}
+
+void Socket::setProfileOptions(Profile profile, const Options& options) {
+  profileOptions(profile) = options;
+}
+
+Socket::Options Socket::getProfileOptions(Profile profile) {
+  return profileOptions(profile);
+}
+
+void Socket::setDefaultTimeouts(const Timeouts& timeouts) {
+  defaultTimeouts() = timeouts;
+}
+
+void Socket::setTimeouts(const Timeouts& timeouts) {
+  this->timeouts = timeouts;
+  if (isOpen()) {
+    applyTimeouts(getFd());
+  }
+}
+
+void Socket::setProfile(Profile profile) {
+  this->profile = profile;
+  if (isOpen()) {
+    applyProfile(getFd());
+  }
+}
+
+void Socket::applyProfile(int fd) {
+  if (fd < 0) {
+    return;
+  }
+  const Options options = profileOptions(profile);
+  auto set = [fd](int level, int name, int value) {
+    setsockopt(fd, level, name, (const char*)&value, sizeof(value));
+  };
+
+  if (options.receiveBuffer > 0) {
+    set(SOL_SOCKET, SO_RCVBUF, options.receiveBuffer);
+  }
+  if (options.sendBuffer > 0) {
+    set(SOL_SOCKET, SO_SNDBUF, options.sendBuffer);
+  }
+  set(IPPROTO_TCP, TCP_NODELAY, options.noDelay);
+#ifdef TCP_NOTSENT_LOWAT
+  if (options.notSentLowat > 0) {
+    set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.notSentLowat);
+  }
+#endif
+  set(SOL_SOCKET, SO_KEEPALIVE, options.keepAliveIdleS > 0);
+  if (options.keepAliveIdleS > 0) {
+#if defined(TCP_KEEPIDLE)
+    set(IPPROTO_TCP, TCP_KEEPIDLE, options.keepAliveIdleS);
+#elif defined(TCP_KEEPALIVE)
+    // Same option on Apple platforms
+    set(IPPROTO_TCP, TCP_KEEPALIVE, options.keepAliveIdleS);
+#endif
+  }
+
+  quickAck = options.quickAck;
+  rearmQuickAck(fd);
+}
+
+void Socket::rearmQuickAck(int fd) {
+#ifdef TCP_QUICKACK
+  if (quickAck) {
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, (const char*)&flag,
+               sizeof(flag));
+  }
+#endif
+}
+
+void Socket::applyTimeouts(int fd) {
+  if (fd < 0) {
+    return;
+  }
+#ifdef _WIN32
+  // Milliseconds as a DWORD on Windows
+  DWORD readTimeout = timeouts.readMs, writeTimeout = timeouts.writeMs;
+#else
+  struct timeval readTimeout = {(time_t)(timeouts.readMs / 1000),
+                                (suseconds_t)(timeouts.readMs % 1000) * 1000};
+  struct timeval writeTimeout = {
+      (time_t)(timeouts.writeMs / 1000),
+      (suseconds_t)(timeouts.writeMs % 1000) * 1000};
+#endif
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&readTimeout,
+             sizeof(readTimeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (const char*)&writeTimeout,
+             sizeof(writeTimeout));
+}
+
+void Socket::setError(long result) {
+  if (result > 0) {
+    error = Error::NONE;
+    return;
+  }
+  if (result == 0) {
+    error = Error::CLOSED;
+    return;
+  }
+#ifdef _WIN32
+  int code = WSAGetLastError();
+  error = code == WSAETIMEDOUT || code == WSAEWOULDBLOCK ? Error::TIMEOUT
+                                                          : Error::FAILED;
+#else
+  error = errno == EAGAIN || errno == EWOULDBLOCK ? Error::TIMEOUT
+                                                  : Error::FAILED;
+#endif
+}
@@ -1,6 +1,6 @@
 #include "BellTar.h"
 
-#include <sys/stat.h>  // for mkdir
+#include <sys/stat.h>  // for mkdir, fstat
 
 using namespace bell::BellTar;
 
@@ -15,6 +15,11 @@ using namespace bell::BellTar;
 #include <vector>     // for vector
 #ifdef _WIN32
 #include <direct.h>
+#elif !defined(ESP_PLATFORM)
+#include <fcntl.h>     // for open, O_RDONLY
+#include <sys/mman.h>  // for mmap, munmap
+#include <unistd.h>    // for close
+#define BELL_TAR_MMAP
 #endif
 
 #ifdef ENABLE_LOGGING
@@ -176,6 +181,21 @@ bool _check_if_header_is_next(std::istream& inp) {
   return true;
 }
 
+// Creates every directory leading to |path|
+void _make_parent_directories(const std::string& path) {
+  size_t pos = 0;
+  while ((pos = path.find('/', pos)) != std::string::npos) {
+    std::string dir = path.substr(0, pos);
+    // Create the directory if it doesn't exist
+#ifdef _WIN32
+    mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(), 0777);
+#endif
+    pos++;
+  }
+}
+
 void _seek_to_next_header(std::istream& inp) {
   // Advance to start of next header or to end of file
   // Works because
@@ -294,18 +314,7 @@ void reader::extract_all_files(std::string dest_directory) {
     if (fileType == '0' && fileName.find("._") != 0) {
 #endif
       std::string path = dest_directory + "/" + fileName;
-
-      size_t pos = 0;
-      while ((pos = path.find('/', pos)) != std::string::npos) {
-        std::string dir = path.substr(0, pos);
-        // Create the directory if it doesn't exist
-#ifdef _WIN32
-        mkdir(dir.c_str());
-#else
-        mkdir(dir.c_str(), 0777);
-#endif
-        pos++;
-      }
+      _make_parent_directories(path);
 
       std::ofstream out(path, std::ios::binary);
 
@@ -330,4 +339,294 @@ void reader::extract_all_files(std::string dest_directory) {
       skip_next_file();
     }
   }
-}
\ No newline at end of file
+}
+////////////////////////////////////////
+// archive_index Implementation
+////////////////////////////////////////
+
+static const char INDEX_MAGIC[4] = {'B', 'T', 'I', 'X'};
+static const uint8_t INDEX_VERSION = 1;
+
+// Round a member's size up to whole records
+static file_size_t _records_size(file_size_t size) {
+  return (size + sizeof(tar_header) - 1) / sizeof(tar_header) *
+         sizeof(tar_header);
+}
+
+// Fields aren't always NUL terminated when full, sscanf() could run past them
+static file_size_t _parse_octal(const char* field, size_t length) {
+  file_size_t value = 0;
+  for (size_t i = 0; i < length && field[i] == ' '; i++) {
+    field++;
+    length--;
+  }
+  for (size_t i = 0; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+    value = value * 8 + (field[i] - '0');
+  }
+  return value;
+}
+
+// Full member name, ustar splits long paths into prefix and name
+static std::string _entry_name(const tar_header* header) {
+  std::string name(header->name, strnlen(header->name, FILE_NAME_LENGTH));
+  if (std::strncmp(header->magic, "ustar", 5) == 0 && header->prefix[0]) {
+    name = std::string(header->prefix,
+                       strnlen(header->prefix, sizeof(header->prefix))) +
+           "/" + name;
+  }
+  return name;
+}
+
+void archive_index::_map_names() {
+  // Keys point into _entries, only filled once the vector is complete
+  _by_name.clear();
+  _by_name.reserve(_entries.size());
+  for (size_t i = 0; i < _entries.size(); i++) {
+    _by_name[_entries[i].name] = i;
+  }
+}
+
+bool archive_index::build(std::istream& inp) {
+  _entries.clear();
+  inp.seekg(0, std::ios::beg);
+
+  file_size_t offset = 0;
+  tar_header header;
+  while (inp.read((char*)&header, sizeof(tar_header))) {
+    // Archives end on zero records
+    if (header.name[0] == FILL_CHAR) {
+      break;
+    }
+    entry e;
+    e.name = _entry_name(&header);
+    e.offset = offset + sizeof(tar_header);
+    e.size = _parse_octal(header.size, sizeof(header.size));
+    e.file_type = header.typeflag[0];
+    offset = e.offset + _records_size(e.size);
+    _entries.push_back(std::move(e));
+    inp.seekg(offset, std::ios::beg);
+  }
+  inp.clear();
+  _archive_size = offset;
+  _map_names();
+  return !_entries.empty();
+}
+
+bool archive_index::build(const uint8_t* data, size_t size) {
+  _entries.clear();
+
+  file_size_t offset = 0;
+  while (offset + sizeof(tar_header) <= size) {
+    const tar_header* header = (const tar_header*)(data + offset);
+    if (header->name[0] == FILL_CHAR) {
+      break;
+    }
+    entry e;
+    e.name = _entry_name(header);
+    e.offset = offset + sizeof(tar_header);
+    e.size = _parse_octal(header->size, sizeof(header->size));
+    e.file_type = header->typeflag[0];
+    if (e.offset + e.size > size) {
+      LOG("Truncated tar member %s\n", e.name.c_str());
+      break;
+    }
+    offset = e.offset + _records_size(e.size);
+    _entries.push_back(std::move(e));
+  }
+  _archive_size = std::min<file_size_t>(offset, size);
+  _map_names();
+  return !_entries.empty();
+}
+
+template <typename T>
+static void _put(std::ostream& out, T value) {
+  out.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+static bool _get(std::istream& inp, T& value) {
+  return (bool)inp.read((char*)&value, sizeof(T));
+}
+
+void archive_index::save(std::ostream& out) const {
+  // Native byte order, an index is only read back on the device that wrote it
+  out.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  _put<uint8_t>(out, INDEX_VERSION);
+  _put<uint64_t>(out, _archive_size);
+  _put<uint32_t>(out, _entries.size());
+  for (auto& e : _entries) {
+    _put<uint16_t>(out, e.name.size());
+    out.write(e.name.data(), e.name.size());
+    _put<uint64_t>(out, e.offset);
+    _put<uint64_t>(out, e.size);
+    _put<char>(out, e.file_type);
+  }
+}
+
+bool archive_index::load(std::istream& inp, file_size_t archive_size) {
+  char magic[sizeof(INDEX_MAGIC)];
+  uint8_t version;
+  uint64_t saved_size;
+  uint32_t count;
+  if (!inp.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0 ||
+      !_get(inp, version) || version != INDEX_VERSION ||
+      !_get(inp, saved_size) || !_get(inp, count)) {
+    return false;
+  }
+  // Trailing zero records aren't part of the saved size
+  if (saved_size > archive_size) {
+    return false;
+  }
+
+  std::vector<entry> entries(count);
+  for (auto& e : entries) {
+    uint16_t name_size;
+    uint64_t offset, size;
+    if (!_get(inp, name_size)) {
+      return false;
+    }
+    e.name.resize(name_size);
+    if (!inp.read(e.name.data(), name_size) || !_get(inp, offset) ||
+        !_get(inp, size) || !_get(inp, e.file_type) ||
+        offset + size > saved_size) {
+      return false;
+    }
+    e.offset = offset;
+    e.size = size;
+  }
+
+  _entries = std::move(entries);
+  _archive_size = saved_size;
+  _map_names();
+  return true;
+}
+
+const entry* archive_index::find(std::string_view name) const {
+  auto it = _by_name.find(name);
+  if (it == _by_name.end()) {
+    return nullptr;
+  }
+  return &_entries[it->second];
+}
+
+////////////////////////////////////////
+// mapped_archive Implementation
+////////////////////////////////////////
+
+mapped_archive::mapped_archive(const std::string& path,
+                               const std::string& index_path) {
+#ifdef BELL_TAR_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG("Can not open %s\n", path.c_str());
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      _data = (const uint8_t*)mapping;
+      _size = st.st_size;
+      _mapped = true;
+    }
+  }
+  // The mapping holds its own reference to the file
+  close(fd);
+#else
+  // Files on SPIFFS / LittleFS can't be mapped, a partition can
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (file) {
+    _loaded.resize(file.tellg());
+    file.seekg(0, std::ios::beg);
+    if (file.read((char*)_loaded.data(), _loaded.size())) {
+      _data = _loaded.data();
+      _size = _loaded.size();
+    }
+  }
+#endif
+  if (!_data) {
+    LOG("Can not map %s\n", path.c_str());
+    return;
+  }
+  _open_index(index_path);
+}
+
+#ifdef ESP_PLATFORM
+mapped_archive::mapped_archive(const esp_partition_t* partition,
+                               const std::string& index_path) {
+  const void* mapping = nullptr;
+  if (esp_partition_mmap(partition, 0, partition->size,
+                         ESP_PARTITION_MMAP_DATA, &mapping,
+                         &_mmap_handle) != ESP_OK) {
+    LOG("Can not map partition %s\n", partition->label);
+    return;
+  }
+  _data = (const uint8_t*)mapping;
+  _size = partition->size;
+  _mapped = true;
+  _open_index(index_path);
+}
+#endif
+
+mapped_archive::~mapped_archive() {
+  if (!_mapped) {
+    return;
+  }
+#ifdef BELL_TAR_MMAP
+  munmap((void*)_data, _size);
+#elif defined(ESP_PLATFORM)
+  esp_partition_munmap(_mmap_handle);
+#endif
+}
+
+void mapped_archive::_open_index(const std::string& index_path) {
+  if (!index_path.empty()) {
+    std::ifstream saved(index_path, std::ios::binary);
+    // A different archive of the same size, e.g. a reflashed partition,
+    // shows in the last member's header
+    if (saved && _index.load(saved, _size)) {
+      auto& entries = _index.entries();
+      if (entries.empty()) {
+        return;
+      }
+      const tar_header* last =
+          (const tar_header*)(_data + entries.back().offset -
+                              sizeof(tar_header));
+      if (_entry_name(last) == entries.back().name &&
+          _parse_octal(last->size, sizeof(last->size)) ==
+              entries.back().size) {
+        return;
+      }
+    }
+  }
+
+  _index.build(_data, _size);
+  if (!index_path.empty()) {
+    std::ofstream out(index_path, std::ios::binary);
+    _index.save(out);
+  }
+}
+
+std::span<const uint8_t> mapped_archive::get(std::string_view name) const {
+  const entry* e = _index.find(name);
+  if (!e) {
+    return {};
+  }
+  return {_data + e->offset, (size_t)e->size};
+}
+
+void mapped_archive::extract_all_files(std::string output_dir) const {
+  for (auto& e : _index.entries()) {
+    // 0 is the normal file type, skip apple's ._ files
+    if ((e.file_type != '0' && e.file_type != FILL_CHAR) ||
+        e.name.starts_with("._")) {
+      continue;
+    }
+    std::string path = output_dir + "/" + e.name;
+    _make_parent_directories(path);
+
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char*)_data + e.offset, e.size);
+  }
+}
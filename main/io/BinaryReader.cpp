@@ -1,17 +1,42 @@
 #include "BinaryReader.h"
 
-#include <stdlib.h>     // for size_t
-#include <cstdint>      // for uint8_t
-#include <type_traits>  // for remove_extent_t
+#include <stdlib.h>   // for size_t
+#include <algorithm>  // for min
+#include <cstdint>    // for uint8_t
 
 #include "ByteStream.h"  // for ByteStream
 
-bell::BinaryReader::BinaryReader(std::shared_ptr<ByteStream> stream) {
+bell::BinaryReader::BinaryReader(std::shared_ptr<ByteStream> stream,
+                                 size_t bufferSize)
+    : buffer(std::max<size_t>(bufferSize, sizeof(uint64_t))) {
   this->stream = stream;
 }
 
+bool bell::BinaryReader::fill(size_t count) {
+  if (tail - head >= count) {
+    return true;
+  }
+
+  // Keeps the unread bytes, at the front
+  std::copy(buffer.begin() + head, buffer.begin() + tail, buffer.begin());
+  tail -= head;
+  head = 0;
+  if (buffer.size() < count) {
+    buffer.resize(count);
+  }
+
+  while (tail < count) {
+    size_t read = stream->read(buffer.data() + tail, buffer.size() - tail);
+    if (read == 0) {
+      return false;
+    }
+    tail += read;
+  }
+  return true;
+}
+
 size_t bell::BinaryReader::position() {
-  return stream->position();
+  return stream->position() - (tail - head);
 }
 
 size_t bell::BinaryReader::size() {
@@ -19,51 +44,46 @@ size_t bell::BinaryReader::size() {
 }
 
 void bell::BinaryReader::close() {
+  head = tail = 0;
   stream->close();
 }
 
-void bell::BinaryReader::skip(size_t pos) {
-  std::vector<uint8_t> b(pos);
-  stream->read(&b[0], pos);
-}
-
-int32_t bell::BinaryReader::readInt() {
-  uint8_t b[4];
-  if (stream->read((uint8_t*)b, 4) != 4)
-    return 0;
-
-  return static_cast<int32_t>((b[3]) | (b[2] << 8) | (b[1] << 16) |
-                              (b[0] << 24));
-}
-
-int16_t bell::BinaryReader::readShort() {
-  uint8_t b[2];
-  if (stream->read((uint8_t*)b, 2) != 2)
-    return 0;
-
-  return static_cast<int16_t>((b[1]) | (b[0] << 8));
+size_t bell::BinaryReader::skip(size_t count) {
+  size_t buffered = std::min(count, tail - head);
+  head += buffered;
+  if (buffered == count) {
+    return count;
+  }
+  return buffered + stream->skip(count - buffered);
 }
 
-uint32_t bell::BinaryReader::readUInt() {
-  return readInt() & 0xffffffffL;
+std::span<const uint8_t> bell::BinaryReader::readSpan(size_t count) {
+  fill(count);
+  count = std::min(count, tail - head);
+  std::span<const uint8_t> data(buffer.data() + head, count);
+  head += count;
+  return data;
 }
 
-uint8_t bell::BinaryReader::readByte() {
-  uint8_t b[1];
-  if (stream->read((uint8_t*)b, 1) != 1)
-    return 0;
-  return b[0];
+size_t bell::BinaryReader::readBytes(uint8_t* dst, size_t count) {
+  size_t buffered = std::min(count, tail - head);
+  memcpy(dst, buffer.data() + head, buffered);
+  head += buffered;
+
+  // Large reads go straight to dst
+  size_t done = buffered;
+  while (done < count) {
+    size_t read = stream->read(dst + done, count - done);
+    if (read == 0) {
+      break;
+    }
+    done += read;
+  }
+  return done;
 }
 
 std::vector<uint8_t> bell::BinaryReader::readBytes(size_t size) {
   std::vector<uint8_t> data(size);
-  stream->read(&data[0], size);
+  data.resize(readBytes(data.data(), size));
   return data;
 }
-
-long long bell::BinaryReader::readLong() {
-  long high = readInt();
-  long low = readInt();
-
-  return static_cast<long long>(((long long)high << 32) | low);
-}
@@ -28,6 +28,20 @@ void BinaryStream::ensureWritable() {
     throw std::runtime_error("No output provided for binary stream");
 }
 
+BinaryStream& BinaryStream::operator>>(char& value) {
+  ensureReadable();
+  istr->read(&value, sizeof(value));
+
+  return *this;
+}
+
+BinaryStream& BinaryStream::operator>>(std::byte& value) {
+  ensureReadable();
+  istr->read((char*)&value, sizeof(value));
+
+  return *this;
+}
+
 BinaryStream& BinaryStream::operator>>(int16_t& value) {
   ensureReadable();
   istr->read((char*)&value, sizeof(value));
@@ -42,7 +56,7 @@ BinaryStream& BinaryStream::operator>>(uint16_t& value) {
   ensureReadable();
   istr->read((char*)&value, sizeof(value));
   if (flipBytes)
-    swap16(value);
+    value = swap16(value);
 
   return *this;
 }
@@ -1,39 +1,60 @@
 #include "BufferedStream.h"
 
-#include <stdlib.h>     // for free, malloc
-#include <algorithm>    // for min
+#include <algorithm>    // for min, clamp, max
 #include <cstdint>      // for uint32_t
 #include <cstring>      // for memcpy
 #include <type_traits>  // for remove_extent_t
 
+#include "BellAllocator.h"  // for Allocator
+#include "BellLogger.h"     // for BELL_LOG
+#include "BellMetrics.h"    // for BELL_METRIC_COUNT, BELL_METRIC_GAUGE
+#include "BellTrace.h"      // for BELL_TRACE_SCOPE
+
 BufferedStream::BufferedStream(const std::string& taskName, uint32_t bufferSize,
                                uint32_t readThreshold, uint32_t readSize,
                                uint32_t readyThreshold,
                                uint32_t notReadyThreshold, bool waitForReady)
     : bell::Task(taskName, 4096, 5, 0) {
   this->bufferSize = bufferSize;
-  this->readAt = bufferSize - readThreshold;
-  this->readSize = readSize;
-  this->readyThreshold = readyThreshold;
-  this->notReadyThreshold = notReadyThreshold;
+  this->limits = {readSize, readThreshold, bufferSize, readyThreshold,
+                  notReadyThreshold};
+  applyLimits();
   this->waitForReady = waitForReady;
-  this->buf = static_cast<uint8_t*>(malloc(bufferSize));
+  // Network buffers are large and DMA never touches them, PSRAM is fine
+  this->buf = static_cast<uint8_t*>(
+      bell::Allocator::allocate(bufferSize, bell::Allocator::PSRAM));
+  memory.resize(bufferSize);
   this->bufEnd = buf + bufferSize;
   reset();
 }
 
 BufferedStream::~BufferedStream() {
-  this->close();
-  free(buf);
+  // buf can't go while the task may still write to it
+  stopTask();
+  bell::Allocator::release(buf);
 }
 
 void BufferedStream::close() {
-  this->terminate = true;
+  if (!stopTask(STOP_TIMEOUT_MS)) {
+    BELL_LOG(error, "BufferedStream", "Source still blocking the task");
+  }
+}
+
+void BufferedStream::onStopRequested() {
   this->readSem.give();  // force a read operation
-  const std::lock_guard lock(runningMutex);
-  if (this->source)
-    this->source->close();
-  this->source = nullptr;
+  this->dataSem.give();  // release a waiting reader
+  StreamPtr blocking;
+  {
+    const std::lock_guard lock(sourceMutex);
+    blocking = this->source;
+  }
+  if (blocking)
+    blocking->close();  // end a read in progress
+}
+
+void BufferedStream::setSource(const StreamPtr& newSource) {
+  const std::lock_guard lock(sourceMutex);
+  this->source = newSource;
 }
 
 void BufferedStream::reset() {
@@ -42,27 +63,65 @@ void BufferedStream::reset() {
   this->readTotal = 0;
   this->bufferTotal = 0;
   this->readAvailable = 0;
-  this->terminate = false;
 }
 
 bool BufferedStream::open(const std::shared_ptr<bell::ByteStream>& stream) {
-  if (this->running)
-    this->close();
+  this->close();
+  if (isTaskRunning())
+    return false;
   reset();
-  this->source = stream;
+  this->seekReader = nullptr;
+  setSource(stream);
   startTask();
   return source.get();
 }
 
 bool BufferedStream::open(const StreamReader& newReader,
                           uint32_t initialOffset) {
-  if (this->running)
-    this->close();
+  this->close();
+  if (isTaskRunning())
+    return false;
   reset();
   this->reader = newReader;
+  this->seekReader = newReader;
   this->bufferTotal = initialOffset;
-  startTask();
-  return source.get();
+  return startTask();
+}
+
+void BufferedStream::setWatermarks(uint32_t lowWatermark,
+                                   const WatermarkCallback& onLow,
+                                   uint32_t highWatermark,
+                                   const WatermarkCallback& onHigh) {
+  // The task and read() use the callbacks without a lock
+  if (isTaskRunning()) {
+    BELL_LOG(error, "BufferedStream", "Watermarks set while streaming");
+    return;
+  }
+  this->lowWatermark = lowWatermark;
+  this->onLow = onLow;
+  this->highWatermark = highWatermark;
+  this->onHigh = onHigh;
+}
+
+void BufferedStream::setPolicy(
+    const std::shared_ptr<bell::ReadAheadPolicy>& policy) {
+  this->policy = policy;
+}
+
+void BufferedStream::applyLimits() {
+  // a threshold of 0 would make the task spin
+  this->readSize = std::clamp<uint32_t>(limits.readSize, 1, bufferSize);
+  this->fillLimit =
+      std::clamp<uint32_t>(limits.fillLimit, readSize, bufferSize);
+  this->readAt = fillLimit - std::clamp<uint32_t>(limits.readThreshold, 1,
+                                                  fillLimit);
+  // Refills stop at fillLimit - readSize or more, and start again below
+  // readAt: a threshold above the lower of both may never be reached, the
+  // task would spin and a reader wait forever
+  this->readyThreshold =
+      std::min(limits.readyThreshold, std::min(readAt, fillLimit - readSize));
+  this->notReadyThreshold = std::min(limits.notReadyThreshold,
+                                     readyThreshold.load());
 }
 
 bool BufferedStream::isReady() const {
@@ -81,102 +140,133 @@ size_t BufferedStream::position() {
   return readTotal;
 }
 
+bool BufferedStream::seek(size_t offset) {
+  if (!seekReader)
+    return false;
+  // the copy outlives open() replacing the reader
+  StreamReader newReader = seekReader;
+  if (!open(newReader, offset))
+    return false;
+  this->readTotal = offset;
+  return true;
+}
+
 size_t BufferedStream::size() {
   return source->size();
 }
 
-uint32_t BufferedStream::lengthBetween(uint8_t* me, uint8_t* other) {
-  const std::lock_guard lock(readMutex);
-  if (other <= me) {
-    // buf .... other ...... me ........ bufEnd
-    // buf .... me/other ........ bufEnd
-    return bufEnd - me;
-  } else {
-    // buf ........ me ........ other .... bufEnd
-    return other - me;
+void BufferedStream::waitReady() {
+  readerWaiting = true;
+  // end waiting after termination
+  while (isTaskRunning() && !isReady()) {
+    // the timeout only guards against a signal given just before waiting
+    dataSem.twait(100);
   }
+  readerWaiting = false;
 }
 
 size_t BufferedStream::read(uint8_t* dst, size_t len) {
   if (waitForReady && isNotReady()) {
-    while ((source || reader) && !isReady()) {
-    }  // end waiting after termination
+    waitReady();
   }
-  if (!running && !readAvailable) {
+  if (!readAvailable && !isTaskRunning()) {
     reset();
     return 0;
   }
+  if (!readAvailable) {
+    // The decoder caught up with the network
+    BELL_METRIC_COUNT("stream.empty_reads", 1);
+  }
   uint32_t read = 0;
   uint32_t toReadTotal =
       std::min(readAvailable.load(), static_cast<uint32_t>(len));
   while (toReadTotal > 0) {
+    // only the task moves bufWritePtr, everything up to readAvailable is ours
     uint32_t toRead =
-        std::min(toReadTotal, lengthBetween(bufReadPtr, bufWritePtr));
+        std::min(toReadTotal, static_cast<uint32_t>(bufEnd - bufReadPtr));
     if (dst) {
       memcpy(dst, bufReadPtr, toRead);
       dst += toRead;
     }
-    readAvailable -= toRead;
     bufReadPtr += toRead;
     if (bufReadPtr >= bufEnd)
       bufReadPtr = buf;
+    uint32_t before = readAvailable.fetch_sub(toRead);
+    if (onLow && before >= lowWatermark && before - toRead < lowWatermark)
+      onLow(before - toRead);
     toReadTotal -= toRead;
     read += toRead;
     readTotal += toRead;
   }
+  BELL_METRIC_GAUGE("stream.buffered", readAvailable.load());
   this->readSem.give();
   return read;
 }
 
 void BufferedStream::runTask() {
-  const std::lock_guard lock(runningMutex);
-  running = true;
   if (!source && reader) {
     // get the initial request on the task's thread
-    source = reader(this->bufferTotal);
+    setSource(reader(this->bufferTotal));
   }
-  while (!terminate) {
+  bool ended = false;
+  while (!ended && !isStopRequested()) {
     if (!source)
       break;
     if (isReady()) {
       // buffer ready, wait for any read operations
       this->readSem.wait();
     }
-    if (terminate)
+    if (isStopRequested())
       break;
     if (readAvailable > readAt)
       continue;
     // here, the buffer needs re-filling
-    uint32_t len;
+    size_t len;
     bool wasReady = isReady();
     do {
+      // only read() moves bufReadPtr, everything beyond readAvailable is ours
       uint32_t toRead =
-          std::min(readSize, lengthBetween(bufWritePtr, bufReadPtr));
+          std::min(readSize, static_cast<uint32_t>(bufEnd - bufWritePtr));
+      toRead = std::min(toRead, bufferSize - readAvailable.load());
       if (!source) {
         len = 0;
         break;
       }
-      len = source->read(bufWritePtr, toRead);
-      readAvailable += len;
+      auto started = std::chrono::steady_clock::now();
+      {
+        BELL_TRACE_SCOPE("stream.read");
+        len = source->read(bufWritePtr, toRead);
+      }
+      if (policy)
+        policy->onRead(len,
+                       std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - started));
       bufferTotal += len;
       bufWritePtr += len;
-      if (bufWritePtr >= bufEnd)  // TODO is == enough here?
+      if (bufWritePtr >= bufEnd)
         bufWritePtr = buf;
+      // publish the data only once it's in place
+      uint32_t before = readAvailable.fetch_add(len);
+      if (onHigh && before < highWatermark && before + len >= highWatermark)
+        onHigh(before + len);
+      if (readerWaiting)
+        this->dataSem.give();
     } while (
         len &&
-        readSize <
-            bufferSize -
-                readAvailable);  // loop until there's no more free space in the buffer
-    if (!len && reader)
-      source = reader(bufferTotal);
+        readAvailable + readSize <
+            fillLimit);  // loop until there's no more free space in the buffer
+    if (policy && policy->update(bufferSize, limits))
+      applyLimits();
+    if (!len && reader && !isStopRequested())
+      setSource(reader(bufferTotal));
     else if (!len)
-      terminate = true;
+      ended = true;
     // signal that buffer is ready for reading
     if (!wasReady && isReady()) {
       this->readySem.give();
     }
   }
-  source = nullptr;
+  setSource(nullptr);
   reader = nullptr;
-  running = false;
+  this->dataSem.give();
 }
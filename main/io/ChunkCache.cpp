@@ -0,0 +1,429 @@
+#include "ChunkCache.h"
+
+#include <dirent.h>    // for opendir, readdir, closedir
+#include <stdio.h>     // for fopen, fread, fwrite, snprintf
+#include <stdlib.h>    // for strtoull, strtoul
+#include <string.h>    // for memcpy, strcmp
+#include <sys/stat.h>  // for stat, mkdir
+#include <algorithm>   // for min, sort
+#include <array>       // for array
+#include <atomic>      // for atomic
+#include <memory>      // for shared_ptr, make_shared
+
+#include "BellLogger.h"   // for BELL_LOG
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+
+using namespace bell;
+
+namespace {
+constexpr uint32_t CHUNK_MAGIC = 0x4b484342;  // "BCHK"
+
+// Written in the device's byte order, a cache isn't moved between devices
+struct ChunkHeader {
+  uint32_t magic;
+  uint32_t index;
+  uint64_t key;
+  uint64_t totalSize;
+  uint32_t length;
+  uint32_t crc;
+};
+
+// CRC-32 with polynomial 0xedb88320, reflected, as used by zlib
+uint32_t chunkCrc(const uint8_t* data, size_t len) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> crcTable;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i;
+      for (int bit = 0; bit < 8; bit++) {
+        r = (r & 1) ? (r >> 1) ^ 0xedb88320 : r >> 1;
+      }
+      crcTable[i] = r;
+    }
+    return crcTable;
+  }();
+
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < len; i++) {
+    crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xFF];
+  }
+  return crc ^ 0xffffffff;
+}
+
+/**
+ * One read of a resource through the cache. Every chunk entered is looked
+ * up first; when it's missing, upstream is opened at the current position
+ * and its bytes are passed on, and kept when they make up a whole chunk.
+ */
+class CachedStream : public ByteStream {
+ public:
+  CachedStream(ChunkCache* cache, uint64_t key,
+               const BufferedStream::StreamReader& upstream, size_t offset)
+      : cache(cache), key(key), upstream(upstream), offset(offset) {}
+
+  ~CachedStream() { close(); }
+
+  // Whether the first byte can be served, from the cache or upstream
+  bool prepare() { return enter(offset / cache->getChunkSize()); }
+
+  size_t read(uint8_t* buf, size_t nbytes) override {
+    size_t chunkSize = cache->getChunkSize();
+    size_t pos = position();
+    if (terminate || nbytes == 0 || (totalSize > 0 && pos >= totalSize)) {
+      return 0;
+    }
+
+    uint32_t chunk = pos / chunkSize;
+    if (chunk != currentChunk && !enter(chunk)) {
+      return 0;
+    }
+
+    size_t chunkEnd = (size_t)(chunk + 1) * chunkSize;
+    size_t toRead = std::min(nbytes, chunkEnd - pos);
+    if (isCached) {
+      size_t start = pos - (size_t)chunk * chunkSize;
+      toRead = std::min(toRead, data.size() - start);
+      memcpy(buf, data.data() + start, toRead);
+      readTotal += toRead;
+      return toRead;
+    }
+
+    size_t bytesRead = source->read(buf, toRead);
+    if (bytesRead == 0) {
+      // Ended early, the reader is called again from here
+      closeSource();
+      return 0;
+    }
+    readTotal += bytesRead;
+
+    if (recording) {
+      data.insert(data.end(), buf, buf + bytesRead);
+      if (data.size() == chunkLength(chunk)) {
+        cache->store(key, chunk, data.data(), data.size(), totalSize);
+        recording = false;
+      }
+    }
+    return bytesRead;
+  }
+
+  size_t skip(size_t nbytes) override {
+    // Through read(), so the chunks skipped over still get stored
+    uint8_t scratch[512];
+    size_t skipped = 0;
+    while (skipped < nbytes) {
+      size_t bytesRead =
+          read(scratch, std::min(sizeof(scratch), nbytes - skipped));
+      if (bytesRead == 0) {
+        break;
+      }
+      skipped += bytesRead;
+    }
+    return skipped;
+  }
+
+  size_t position() override { return offset + readTotal; }
+
+  size_t size() override { return totalSize; }
+
+  void close() override {
+    terminate = true;
+    closeSource();
+  }
+
+ private:
+  static constexpr uint32_t NO_CHUNK = UINT32_MAX;
+
+  ChunkCache* cache;
+  uint64_t key;
+  BufferedStream::StreamReader upstream;
+  size_t offset;
+  size_t readTotal = 0;
+  size_t totalSize = 0;
+  std::atomic<bool> terminate = false;
+
+  // Chunk being served, from data when isCached
+  uint32_t currentChunk = NO_CHUNK;
+  bool isCached = false;
+  // Whether data holds the upstream bytes of the chunk from its start
+  bool recording = false;
+  std::vector<uint8_t> data;
+
+  // Guards source against close() from another thread
+  std::mutex sourceMutex;
+  BufferedStream::StreamPtr source;
+
+  size_t chunkLength(uint32_t chunk) {
+    size_t start = (size_t)chunk * cache->getChunkSize();
+    return std::min(cache->getChunkSize(), totalSize - start);
+  }
+
+  bool enter(uint32_t chunk) {
+    currentChunk = chunk;
+    size_t cachedSize = 0;
+    if (cache->load(key, chunk, data, cachedSize)) {
+      isCached = true;
+      recording = false;
+      totalSize = cachedSize;
+      closeSource();
+      return true;
+    }
+
+    isCached = false;
+    data.clear();
+    if (source == nullptr) {
+      auto stream = upstream(position());
+      std::scoped_lock lock(sourceMutex);
+      if (stream == nullptr || terminate) {
+        return false;
+      }
+      source = stream;
+      totalSize = source->size();
+    }
+    // The chunk can only be stored when upstream delivers all of it, and the
+    // size tells where the last one ends
+    recording = totalSize > 0 && position() % cache->getChunkSize() == 0;
+    return true;
+  }
+
+  void closeSource() {
+    BufferedStream::StreamPtr stream;
+    {
+      std::scoped_lock lock(sourceMutex);
+      stream = std::move(source);
+    }
+    if (stream != nullptr) {
+      stream->close();
+    }
+  }
+};
+}  // namespace
+
+ChunkCache::ChunkCache(const Config& config) : config(config) {
+#ifdef _WIN32
+  mkdir(config.path.c_str());
+#else
+  mkdir(config.path.c_str(), 0777);
+#endif
+  scan();
+}
+
+uint64_t ChunkCache::hashKey(const std::string& key) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : key) {
+    hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+  }
+  return hash;
+}
+
+std::string ChunkCache::chunkPath(const ChunkId& id) const {
+  char name[40];
+  snprintf(name, sizeof(name), "/%016llx-%u.chk",
+           (unsigned long long)id.first, (unsigned)id.second);
+  return config.path + name;
+}
+
+void ChunkCache::scan() {
+  DIR* dir = opendir(config.path.c_str());
+  if (dir == nullptr) {
+    BELL_LOG(error, "ChunkCache", "Can't open %s, caching disabled",
+             config.path.c_str());
+    config.maxBytes = 0;
+    return;
+  }
+
+  struct Found {
+    Entry entry;
+    time_t modified;
+  };
+  std::vector<Found> found;
+  while (struct dirent* file = readdir(dir)) {
+    std::string path = config.path + "/" + file->d_name;
+    char* end = nullptr;
+    uint64_t key = strtoull(file->d_name, &end, 16);
+    if (end - file->d_name != 16 || *end != '-') {
+      continue;
+    }
+    uint32_t chunk = strtoul(end + 1, &end, 10);
+    struct stat st;
+    if (strcmp(end, ".chk.tmp") == 0) {
+      // Interrupted store
+      ::remove(path.c_str());
+    } else if (strcmp(end, ".chk") == 0 && stat(path.c_str(), &st) == 0) {
+      found.push_back({{{key, chunk}, (size_t)st.st_size}, st.st_mtime});
+    }
+  }
+  closedir(dir);
+
+  std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) {
+    return a.modified > b.modified;
+  });
+
+  std::scoped_lock lock(mutex);
+  for (auto& chunk : found) {
+    if (usedBytes + chunk.entry.bytes > config.maxBytes) {
+      ::remove(chunkPath(chunk.entry.id).c_str());
+      evictions++;
+      continue;
+    }
+    lru.push_back(chunk.entry);
+    index[chunk.entry.id] = std::prev(lru.end());
+    usedBytes += chunk.entry.bytes;
+  }
+  BELL_LOG(info, "ChunkCache", "%u chunks, %u bytes in %s",
+           (unsigned)lru.size(), (unsigned)usedBytes, config.path.c_str());
+}
+
+void ChunkCache::forget(
+    std::map<ChunkId, std::list<Entry>::iterator>::iterator it) {
+  usedBytes -= it->second->bytes;
+  lru.erase(it->second);
+  index.erase(it);
+}
+
+void ChunkCache::drop(const ChunkId& id, bool isCorrupt) {
+  std::scoped_lock lock(mutex);
+  auto it = index.find(id);
+  if (it != index.end()) {
+    forget(it);
+  }
+  ::remove(chunkPath(id).c_str());
+  if (isCorrupt) {
+    corrupt++;
+    misses++;
+    BELL_METRIC_COUNT("cache.corrupt", 1);
+  }
+}
+
+bool ChunkCache::contains(uint64_t key, uint32_t chunk) {
+  std::scoped_lock lock(mutex);
+  return index.count({key, chunk}) > 0;
+}
+
+bool ChunkCache::load(uint64_t key, uint32_t chunk, std::vector<uint8_t>& data,
+                      size_t& totalSize) {
+  ChunkId id = {key, chunk};
+  {
+    std::scoped_lock lock(mutex);
+    auto it = index.find(id);
+    if (it == index.end()) {
+      misses++;
+      BELL_METRIC_COUNT("cache.miss", 1);
+      return false;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+  }
+
+  FILE* file = fopen(chunkPath(id).c_str(), "rb");
+  if (file == nullptr) {
+    // Deleted behind our back, not corrupt
+    drop(id, false);
+    std::scoped_lock lock(mutex);
+    misses++;
+    return false;
+  }
+
+  ChunkHeader header;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+               header.magic == CHUNK_MAGIC && header.key == key &&
+               header.index == chunk && header.length <= config.chunkSize;
+  if (valid) {
+    data.resize(header.length);
+    valid = fread(data.data(), 1, header.length, file) == header.length &&
+            chunkCrc(data.data(), data.size()) == header.crc;
+  }
+  fclose(file);
+
+  if (!valid) {
+    BELL_LOG(error, "ChunkCache", "Chunk %u of %016llx is corrupt",
+             (unsigned)chunk, (unsigned long long)key);
+    data.clear();
+    drop(id, true);
+    return false;
+  }
+
+  totalSize = header.totalSize;
+  std::scoped_lock lock(mutex);
+  hits++;
+  BELL_METRIC_COUNT("cache.hit", 1);
+  return true;
+}
+
+void ChunkCache::store(uint64_t key, uint32_t chunk, const uint8_t* data,
+                       size_t length, size_t totalSize) {
+  ChunkId id = {key, chunk};
+  size_t bytes = sizeof(ChunkHeader) + length;
+  {
+    // Room is made before writing, a full card would fail the write
+    std::scoped_lock lock(mutex);
+    if (length == 0 || length > config.chunkSize ||
+        bytes > config.maxBytes) {
+      return;
+    }
+    auto it = index.find(id);
+    if (it != index.end()) {
+      forget(it);
+    }
+    while (!lru.empty() && usedBytes + bytes > config.maxBytes) {
+      ::remove(chunkPath(lru.back().id).c_str());
+      forget(index.find(lru.back().id));
+      evictions++;
+    }
+  }
+
+  ChunkHeader header = {CHUNK_MAGIC,        chunk,
+                        key,                totalSize,
+                        (uint32_t)length,   chunkCrc(data, length)};
+  // Written aside and renamed, a power loss mid-write leaves no chunk
+  std::string path = chunkPath(id);
+  std::string tmpPath = path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  bool written = file != nullptr &&
+                 fwrite(&header, sizeof(header), 1, file) == 1 &&
+                 fwrite(data, 1, length, file) == length;
+  if (file != nullptr) {
+    written = fclose(file) == 0 && written;
+  }
+  // FAT can't rename over an existing file
+  ::remove(path.c_str());
+  if (!written || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    BELL_LOG(error, "ChunkCache", "Can't write %s", path.c_str());
+    ::remove(tmpPath.c_str());
+    return;
+  }
+
+  std::scoped_lock lock(mutex);
+  auto it = index.find(id);
+  if (it != index.end()) {
+    forget(it);
+  }
+  lru.push_front({id, bytes});
+  index[id] = lru.begin();
+  usedBytes += bytes;
+}
+
+void ChunkCache::remove(uint64_t key) {
+  std::scoped_lock lock(mutex);
+  auto it = index.lower_bound({key, 0});
+  while (it != index.end() && it->first.first == key) {
+    ::remove(chunkPath(it->first).c_str());
+    forget(it++);
+  }
+}
+
+ChunkCache::Stats ChunkCache::getStats() {
+  std::scoped_lock lock(mutex);
+  return {lru.size(), usedBytes, hits, misses, evictions, corrupt};
+}
+
+BufferedStream::StreamReader ChunkCache::reader(
+    const std::string& key, const BufferedStream::StreamReader& upstream) {
+  uint64_t hash = hashKey(key);
+  return [this, hash,
+          upstream](uint32_t rangeStart) -> BufferedStream::StreamPtr {
+    auto stream = std::make_shared<CachedStream>(this, hash, upstream,
+                                                 rangeStart);
+    if (!stream->prepare()) {
+      return nullptr;
+    }
+    return stream;
+  };
+}
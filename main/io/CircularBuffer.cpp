@@ -1,20 +1,36 @@
 #include "CircularBuffer.h"
 
 #include <algorithm>  // for min
+#include <mutex>      // for lock_guard
+
+#include "BellHotPath.h"  // for BELL_HOT
 
 using namespace bell;
 
-CircularBuffer::CircularBuffer(size_t dataCapacity) {
+CircularBuffer::CircularBuffer(size_t dataCapacity, Mode mode) {
+  this->mode = mode;
   this->dataCapacity = dataCapacity;
   buffer = std::vector<uint8_t>(dataCapacity);
+  memory.resize(dataCapacity);
   this->dataSemaphore = std::make_unique<bell::WrappedSemaphore>(5);
 };
 
-size_t CircularBuffer::write(const uint8_t* data, size_t bytes) {
+size_t BELL_HOT CircularBuffer::size() const {
+  if (mode == Mode::SPSC) {
+    return distance(readPos.load(std::memory_order_acquire),
+                     writePos.load(std::memory_order_acquire));
+  }
+  return dataSize;
+}
+
+size_t BELL_HOT CircularBuffer::write(const uint8_t* data, size_t bytes) {
   if (bytes == 0)
     return 0;
 
-  std::lock_guard<std::mutex> guard(bufferMutex);
+  if (mode == Mode::SPSC)
+    return writeSPSC(data, bytes);
+
+  std::lock_guard<RTMutex> guard(bufferMutex);
   size_t bytesToWrite = std::min(bytes, dataCapacity - dataSize);
   // Write in a single step
   if (bytesToWrite <= dataCapacity - endIndex) {
@@ -35,19 +51,37 @@ size_t CircularBuffer::write(const uint8_t* data, size_t bytes) {
 
   dataSize += bytesToWrite;
 
-  // this->dataSemaphore->give();
+  this->dataSemaphore->give();
   return bytesToWrite;
 }
 
 void CircularBuffer::emptyBuffer() {
-  std::lock_guard<std::mutex> guard(bufferMutex);
+  if (mode == Mode::SPSC) {
+    // Dropping everything only moves the read position, a concurrent read
+    // notices it through its compare-exchange and discards its result
+    readPos.store(writePos.load(std::memory_order_acquire),
+                  std::memory_order_release);
+    return;
+  }
+
+  std::lock_guard<RTMutex> guard(bufferMutex);
   begIndex = 0;
   dataSize = 0;
   endIndex = 0;
 }
 
 void CircularBuffer::emptyExcept(size_t sizeToSet) {
-  std::lock_guard<std::mutex> guard(bufferMutex);
+  if (mode == Mode::SPSC) {
+    // Moves the write position back, so it has to run on the producer thread
+    size_t readFrom = readPos.load(std::memory_order_acquire);
+    size_t writeTo = writePos.load(std::memory_order_relaxed);
+    if (sizeToSet < distance(readFrom, writeTo)) {
+      writePos.store(advance(readFrom, sizeToSet), std::memory_order_release);
+    }
+    return;
+  }
+
+  std::lock_guard<RTMutex> guard(bufferMutex);
   if (sizeToSet > dataSize)
     sizeToSet = dataSize;
   dataSize = sizeToSet;
@@ -57,11 +91,14 @@ void CircularBuffer::emptyExcept(size_t sizeToSet) {
   }
 }
 
-size_t CircularBuffer::read(uint8_t* data, size_t bytes) {
+size_t BELL_HOT CircularBuffer::read(uint8_t* data, size_t bytes) {
   if (bytes == 0)
     return 0;
 
-  std::lock_guard<std::mutex> guard(bufferMutex);
+  if (mode == Mode::SPSC)
+    return readSPSC(data, bytes);
+
+  std::lock_guard<RTMutex> guard(bufferMutex);
   size_t bytesToRead = std::min(bytes, dataSize);
 
   // Read in a single step
@@ -83,3 +120,92 @@ size_t CircularBuffer::read(uint8_t* data, size_t bytes) {
   dataSize -= bytesToRead;
   return bytesToRead;
 }
+
+size_t BELL_HOT CircularBuffer::writeSPSC(const uint8_t* data,
+                                         size_t bytes) {
+  // Only the producer moves writePos, so a relaxed load is enough here
+  size_t writeTo = writePos.load(std::memory_order_relaxed);
+  size_t readFrom = readPos.load(std::memory_order_acquire);
+
+  size_t bytesToWrite =
+      std::min(bytes, dataCapacity - distance(readFrom, writeTo));
+  if (bytesToWrite == 0)
+    return 0;
+
+  size_t index = toIndex(writeTo);
+  size_t firstChunkSize = std::min(bytesToWrite, dataCapacity - index);
+  memcpy(buffer.data() + index, data, firstChunkSize);
+  memcpy(buffer.data(), data + firstChunkSize, bytesToWrite - firstChunkSize);
+
+  // Publish the data to the consumer
+  writePos.store(advance(writeTo, bytesToWrite), std::memory_order_release);
+  this->dataSemaphore->give();
+  return bytesToWrite;
+}
+
+size_t BELL_HOT CircularBuffer::readSPSC(uint8_t* data, size_t bytes) {
+  size_t readFrom = readPos.load(std::memory_order_acquire);
+  size_t writeTo = writePos.load(std::memory_order_acquire);
+
+  size_t bytesToRead = std::min(bytes, distance(readFrom, writeTo));
+  if (bytesToRead == 0)
+    return 0;
+
+  size_t index = toIndex(readFrom);
+  size_t firstChunkSize = std::min(bytesToRead, dataCapacity - index);
+  memcpy(data, buffer.data() + index, firstChunkSize);
+  memcpy(data + firstChunkSize, buffer.data(), bytesToRead - firstChunkSize);
+
+  // Hand the space back to the producer, unless emptyBuffer() ran meanwhile
+  if (!readPos.compare_exchange_strong(readFrom,
+                                       advance(readFrom, bytesToRead),
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+    return 0;
+  }
+  return bytesToRead;
+}
+
+uint8_t* BELL_HOT CircularBuffer::writeReserve(size_t bytes) {
+  if (mode != Mode::SPSC || bytes == 0)
+    return nullptr;
+
+  size_t writeTo = writePos.load(std::memory_order_relaxed);
+  size_t readFrom = readPos.load(std::memory_order_acquire);
+  size_t index = toIndex(writeTo);
+
+  if (dataCapacity - distance(readFrom, writeTo) < bytes ||
+      dataCapacity - index < bytes) {
+    return nullptr;
+  }
+  return buffer.data() + index;
+}
+
+void BELL_HOT CircularBuffer::writeCommit(size_t bytes) {
+  size_t writeTo = writePos.load(std::memory_order_relaxed);
+  writePos.store(advance(writeTo, bytes), std::memory_order_release);
+  this->dataSemaphore->give();
+}
+
+const uint8_t* BELL_HOT CircularBuffer::readPeek(size_t bytes) {
+  if (mode != Mode::SPSC || bytes == 0)
+    return nullptr;
+
+  size_t readFrom = readPos.load(std::memory_order_acquire);
+  size_t writeTo = writePos.load(std::memory_order_acquire);
+  size_t index = toIndex(readFrom);
+
+  if (distance(readFrom, writeTo) < bytes || dataCapacity - index < bytes) {
+    return nullptr;
+  }
+  peekPos = readFrom;
+  return buffer.data() + index;
+}
+
+void BELL_HOT CircularBuffer::readRelease(size_t bytes) {
+  size_t readFrom = peekPos;
+  // A concurrent emptyBuffer() already released this data
+  readPos.compare_exchange_strong(readFrom, advance(peekPos, bytes),
+                                  std::memory_order_release,
+                                  std::memory_order_relaxed);
+}
@@ -0,0 +1,276 @@
+#include "DNSCache.h"
+
+#include <stdio.h>    // for snprintf
+#include <string.h>   // for memcpy, memcmp
+#include <algorithm>  // for min, min_element, find_if, rotate
+#ifdef _WIN32
+#include "win32shim.h"
+#else
+#include <errno.h>       // for errno, EINPROGRESS
+#include <fcntl.h>       // for fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <netdb.h>       // for addrinfo, getaddrinfo, freeaddrinfo
+#include <netinet/in.h>  // for IPPROTO_TCP
+#include <sys/select.h>  // for select, fd_set
+#include <unistd.h>      // for close
+#endif
+
+using namespace bell;
+
+#ifdef _WIN32
+static void closeSocket(int fd) {
+  closesocket(fd);
+}
+
+static void setNonBlocking(int fd, bool nonBlocking) {
+  u_long mode = nonBlocking ? 1 : 0;
+  ioctlsocket(fd, FIONBIO, &mode);
+}
+
+static bool inProgress() {
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+static void closeSocket(int fd) {
+  ::close(fd);
+}
+
+static void setNonBlocking(int fd, bool nonBlocking) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, nonBlocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK);
+}
+
+static bool inProgress() {
+  return errno == EINPROGRESS;
+}
+#endif
+
+static std::string cacheKey(const std::string& host, uint16_t port) {
+  return host + ":" + std::to_string(port);
+}
+
+DNSCache& DNSCache::instance() {
+  static DNSCache cache;
+  return cache;
+}
+
+void DNSCache::setConfig(const Config& config) {
+  std::scoped_lock lock(mutex);
+  this->config = config;
+  entries.clear();
+}
+
+std::vector<DNSCache::Address> DNSCache::resolve(const std::string& host,
+                                                 uint16_t port) {
+  std::string key = cacheKey(host, port);
+  int family;
+  {
+    std::scoped_lock lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end() &&
+        it->second.expires > std::chrono::steady_clock::now()) {
+      return it->second.addresses;
+    }
+    family = config.family;
+  }
+
+  // Resolve without holding the lock, it may take a while
+  struct addrinfo hints {
+  }, *result;
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  hints.ai_flags = AI_ADDRCONFIG;
+
+  char portStr[6];
+  snprintf(portStr, sizeof(portStr), "%u", port);
+
+  std::vector<Address> addresses;
+  if (getaddrinfo(host.c_str(), portStr, &hints, &result) == 0) {
+    for (auto* info = result; info != nullptr; info = info->ai_next) {
+      if (info->ai_addrlen > sizeof(sockaddr_storage)) {
+        continue;
+      }
+      Address address = {};
+      memcpy(&address.addr, info->ai_addr, info->ai_addrlen);
+      address.len = info->ai_addrlen;
+      address.family = info->ai_family;
+      addresses.push_back(address);
+    }
+    freeaddrinfo(result);
+  }
+
+  std::scoped_lock lock(mutex);
+  evict();
+  uint32_t ttl = addresses.empty() ? config.negativeTtlMs : config.ttlMs;
+  entries[key] = {addresses, std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(ttl)};
+  return addresses;
+}
+
+void DNSCache::invalidate(const std::string& host, uint16_t port) {
+  std::scoped_lock lock(mutex);
+  entries.erase(cacheKey(host, port));
+}
+
+void DNSCache::prefer(const std::string& host, uint16_t port,
+                      const Address& address) {
+  std::scoped_lock lock(mutex);
+  auto it = entries.find(cacheKey(host, port));
+  if (it == entries.end()) {
+    return;
+  }
+  auto& addresses = it->second.addresses;
+  auto found = std::find_if(addresses.begin(), addresses.end(),
+                            [&](const Address& cached) {
+                              return cached.len == address.len &&
+                                     memcmp(&cached.addr, &address.addr,
+                                            address.len) == 0;
+                            });
+  if (found != addresses.end()) {
+    std::rotate(addresses.begin(), found, found + 1);
+  }
+}
+
+void DNSCache::clear() {
+  std::scoped_lock lock(mutex);
+  entries.clear();
+}
+
+void DNSCache::evict() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->second.expires <= now) {
+      it = entries.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  // Room for one more, dropping whatever expires first
+  while (!entries.empty() && entries.size() >= config.maxEntries) {
+    entries.erase(std::min_element(entries.begin(), entries.end(),
+                                   [](const auto& a, const auto& b) {
+                                     return a.second.expires <
+                                            b.second.expires;
+                                   }));
+  }
+}
+
+int DNSCache::connect(const std::string& host, uint16_t port) {
+  std::vector<Address> resolved = resolve(host, port);
+  uint32_t raceDelayMs, connectTimeoutMs;
+  {
+    std::scoped_lock lock(mutex);
+    raceDelayMs = config.raceDelayMs;
+    connectTimeoutMs = config.connectTimeoutMs;
+  }
+
+  // Alternate families, starting with the resolver's preferred one
+  std::vector<Address> addresses;
+  std::vector<Address> first, other;
+  for (auto& address : resolved) {
+    (address.family == resolved[0].family ? first : other).push_back(address);
+  }
+  for (size_t i = 0; i < std::max(first.size(), other.size()); i++) {
+    if (i < first.size()) {
+      addresses.push_back(first[i]);
+    }
+    if (i < other.size()) {
+      addresses.push_back(other[i]);
+    }
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto deadline = now + std::chrono::milliseconds(connectTimeoutMs);
+  auto nextStart = now;
+  size_t next = 0;
+  // Sockets in progress, with the address they connect to
+  std::vector<std::pair<int, size_t>> attempts;
+  int connected = -1;
+  size_t winner = 0;
+
+  while (connected < 0 && now < deadline) {
+    if (next < addresses.size() && now >= nextStart) {
+      size_t index = next++;
+      const Address& address = addresses[index];
+      nextStart = now + std::chrono::milliseconds(raceDelayMs);
+      int fd = socket(address.family, SOCK_STREAM, IPPROTO_TCP);
+      if (fd >= 0) {
+        setNonBlocking(fd, true);
+        if (::connect(fd, (const struct sockaddr*)&address.addr,
+                      address.len) == 0) {
+          connected = fd;
+          winner = index;
+          break;
+        } else if (inProgress()) {
+          attempts.push_back({fd, index});
+        } else {
+          closeSocket(fd);
+        }
+      }
+    }
+
+    if (attempts.empty()) {
+      if (next >= addresses.size()) {
+        break;
+      }
+      // Failed right away, go on with the next address
+      nextStart = now;
+      continue;
+    }
+
+    auto until = next < addresses.size() ? std::min(nextStart, deadline)
+                                         : deadline;
+    auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      until - now)
+                      .count();
+    waitMs = std::max<int64_t>(waitMs, 0);
+    struct timeval timeout = {(long)(waitMs / 1000),
+                              (long)(waitMs % 1000) * 1000};
+
+    fd_set writable;
+    FD_ZERO(&writable);
+    int maxFd = -1;
+    for (auto& [fd, index] : attempts) {
+      FD_SET(fd, &writable);
+      maxFd = std::max(maxFd, fd);
+    }
+    if (select(maxFd + 1, NULL, &writable, NULL, &timeout) > 0) {
+      for (auto it = attempts.begin(); it != attempts.end();) {
+        if (!FD_ISSET(it->first, &writable)) {
+          it++;
+          continue;
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(it->first, SOL_SOCKET, SO_ERROR, (char*)&error, &len);
+        if (error == 0 && connected < 0) {
+          connected = it->first;
+          winner = it->second;
+        } else {
+          closeSocket(it->first);
+        }
+        it = attempts.erase(it);
+      }
+    }
+    now = std::chrono::steady_clock::now();
+  }
+
+  // The losers of the race
+  for (auto& [fd, index] : attempts) {
+    closeSocket(fd);
+  }
+
+  if (connected < 0) {
+    // Maybe the host moved, resolve again next time
+    if (!resolved.empty()) {
+      invalidate(host, port);
+    }
+    return -1;
+  }
+  if (winner > 0) {
+    prefer(host, port, addresses[winner]);
+  }
+  setNonBlocking(connected, false);
+  return connected;
+}
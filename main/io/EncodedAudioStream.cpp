@@ -1,183 +1,127 @@
 #include "EncodedAudioStream.h"
 
-#include <string.h>     // for memcpy, memmove
-#include <stdexcept>    // for runtime_error
-#include <type_traits>  // for remove_extent_t
-#include <utility>      // for move
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+#include <utility>    // for move
 
-#include "BellLogger.h"      // for AbstractLogger, BELL_LOG, bell
-#include "ByteStream.h"      // for ByteStream
-#include "DecoderGlobals.h"  // for DecodersInstance, decodersInstance, AAC_...
+#include "AudioCodecs.h"      // for AudioCodecs
+#include "AudioContainers.h"  // for guessAudioContainer
+#include "BellLogger.h"       // for AbstractLogger, BELL_LOG, bell
 
 using namespace bell;
 
-EncodedAudioStream::EncodedAudioStream() {
-  bell::decodersInstance->ensureAAC();
-  bell::decodersInstance->ensureMP3();
-  inputBuffer = std::vector<uint8_t>(1024 * 4);
-  outputBuffer = std::vector<short>(2 * 2 * 4 * 4);
-  decodePtr = inputBuffer.data();
-}
+EncodedAudioStream::EncodedAudioStream() {}
 
 EncodedAudioStream::~EncodedAudioStream() {
-  this->innerStream->close();
+  close();
 }
 
-void EncodedAudioStream::openWithStream(
+bool EncodedAudioStream::openWithStream(
     std::unique_ptr<bell::ByteStream> byteStream) {
-  if (this->innerStream) {
-    this->innerStream->close();
+  close();
+  innerStream = std::move(byteStream);
+  ended = false;
+  pcmPosition = 0;
+
+  container = AudioContainers::guessAudioContainer(*innerStream);
+  if (container != nullptr) {
+    codec = AudioCodecs::createCodec(container.get());
   }
-  this->innerStream = std::move(byteStream);
-  this->guessDataFormat();
-}
-
-bool EncodedAudioStream::vectorStartsWith(std::vector<uint8_t>& vec,
-                                          std::vector<uint8_t>& start) {
-  if (vec.size() < start.size()) {
+  if (codec == nullptr) {
+    BELL_LOG(error, TAG, "Codec not supported");
+    container = nullptr;
     return false;
   }
-
-  for (int i = 0; i < start.size(); i++) {
-    if (vec[i] != start[i]) {
-      return false;
-    }
-  }
-
   return true;
 }
 
-size_t EncodedAudioStream::decodeFrame(uint8_t* dst) {
-  if (innerStream->size() != 0 &&
-      innerStream->position() >= innerStream->size()) {
-    return 0;
-  }
-
-  switch (this->codec) {
-    case AudioCodec::AAC:
-      return decodeFrameAAC(dst);
-      break;
-    case AudioCodec::MP3:
-      return decodeFrameMp3(dst);
-      break;
-    default:
-      break;
-  }
+bool EncodedAudioStream::isReadable() {
+  return codec != nullptr && !ended;
+}
 
-  return 0;
+AudioCodec EncodedAudioStream::getCodec() {
+  return container ? container->getCodec() : AudioCodec::UNKNOWN;
 }
 
-size_t EncodedAudioStream::decodeFrameMp3(uint8_t* dst) {
-  size_t writtenBytes = 0;
-  int bufSize = MP3_READBUF_SIZE;
-
-  int readBytes = innerStream->read(inputBuffer.data() + bytesInBuffer,
-                                    bufSize - bytesInBuffer);
-  if (readBytes > 0) {
-    bytesInBuffer += readBytes;
-    decodePtr = inputBuffer.data();
-    offset = MP3FindSyncWord(inputBuffer.data(), bytesInBuffer);
-
-    if (offset != -1) {
-      bytesInBuffer -= offset;
-      decodePtr += offset;
-
-      int decodeStatus =
-          MP3Decode(bell::decodersInstance->mp3Decoder, &decodePtr,
-                    &bytesInBuffer, outputBuffer.data(), 0);
-      MP3GetLastFrameInfo(bell::decodersInstance->mp3Decoder, &mp3FrameInfo);
-      if (decodeStatus == ERR_MP3_NONE) {
-        decodedSampleRate = mp3FrameInfo.samprate;
-        writtenBytes =
-            (mp3FrameInfo.bitsPerSample / 8) * mp3FrameInfo.outputSamps;
-
-        memcpy(dst, outputBuffer.data(), writtenBytes);
-
-      } else {
-        BELL_LOG(info, TAG, "Error in frame, moving two bytes %d",
-                 decodeStatus);
-        decodePtr += 1;
-        bytesInBuffer -= 1;
+bool EncodedAudioStream::nextFrame() {
+  int failures = 0;
+  while (codec != nullptr && !ended) {
+    uint32_t len = 0;
+    uint8_t* data = codec->decode(container.get(), len);
+    if (data == nullptr) {
+      // Bad frames are skipped by the container, a run of them is the end
+      if (++failures >= MAX_FAILURES) {
+        ended = true;
       }
-    } else {
-      BELL_LOG(info, TAG, "Unexpected error in data, skipping a word");
-      decodePtr += 3800;
-      bytesInBuffer -= 3800;
+      continue;
+    }
+    failures = 0;
+    if (len > 0) {
+      frameData = data;
+      frameLeft = len;
+      return true;
     }
+  }
+  return false;
+}
 
-    memmove(inputBuffer.data(), decodePtr, bytesInBuffer);
+size_t EncodedAudioStream::read(uint8_t* buf, size_t nbytes) {
+  size_t done = 0;
+  while (done < nbytes && (frameLeft > 0 || nextFrame())) {
+    size_t toCopy = std::min<size_t>(frameLeft, nbytes - done);
+    memcpy(buf + done, frameData, toCopy);
+    frameData += toCopy;
+    frameLeft -= toCopy;
+    done += toCopy;
   }
-  return writtenBytes;
+  pcmPosition += done;
+  return done;
 }
 
-bool EncodedAudioStream::isReadable() {
-  return this->codec != AudioCodec::NONE;
+size_t EncodedAudioStream::skip(size_t nbytes) {
+  size_t done = 0;
+  while (done < nbytes && (frameLeft > 0 || nextFrame())) {
+    size_t toSkip = std::min<size_t>(frameLeft, nbytes - done);
+    frameData += toSkip;
+    frameLeft -= toSkip;
+    done += toSkip;
+  }
+  pcmPosition += done;
+  return done;
 }
 
-size_t EncodedAudioStream::decodeFrameAAC(uint8_t* dst) {
-  return 0;
-  // size_t writtenBytes = 0;
-  // auto bufSize = AAC_READBUF_SIZE;
-
-  // int readBytes = innerStream->read(inputBuffer.data() + bytesInBuffer,
-  //                                   bufSize - bytesInBuffer);
-  // if (readBytes > 0) {
-  //   bytesInBuffer += readBytes;
-  //   decodePtr = inputBuffer.data();
-  //   offset = AACFindSyncWord(inputBuffer.data(), bytesInBuffer);
-
-  //   if (offset != -1) {
-  //     bytesInBuffer -= offset;
-  //     decodePtr += offset;
-
-  //     int decodeStatus =
-  //         AACDecode(bell::decodersInstance->aacDecoder, &decodePtr,
-  //                   &bytesInBuffer, outputBuffer.data());
-  //     AACGetLastFrameInfo(bell::decodersInstance->aacDecoder, &aacFrameInfo);
-  //     if (decodeStatus == ERR_AAC_NONE) {
-  //       decodedSampleRate = aacFrameInfo.sampRateOut;
-  //       writtenBytes =
-  //           (aacFrameInfo.bitsPerSample / 8) * aacFrameInfo.outputSamps;
-
-  //       memcpy(dst, outputBuffer.data(), writtenBytes);
-
-  //     } else {
-  //       BELL_LOG(info, TAG, "Error in frame, moving two bytes %d",
-  //                decodeStatus);
-  //       decodePtr += 1;
-  //       bytesInBuffer -= 1;
-  //     }
-  //   } else {
-  //     BELL_LOG(info, TAG, "Unexpected error in data, skipping a word");
-  //     decodePtr += 3800;
-  //     bytesInBuffer -= 3800;
-  //   }
-
-  //   memmove(inputBuffer.data(), decodePtr, bytesInBuffer);
-  // }
-  // return writtenBytes;
+size_t EncodedAudioStream::size() {
+  GaplessInfo info;
+  if (container == nullptr || !container->getGaplessInfo(info)) {
+    return 0;
+  }
+  return info.totalFrames * getChannelCount() *
+         pcmBytesPerSample(getPcmFormat());
 }
 
-void EncodedAudioStream::guessDataFormat() {
-  // Read 14 bytes from the stream
-  this->innerStream->read(inputBuffer.data(), 14);
-  bytesInBuffer = 14;
-
-  BELL_LOG(info, TAG, "No codec set, reading secret bytes");
-
-  if (vectorStartsWith(inputBuffer, this->mp3MagicBytesIdc) ||
-      vectorStartsWith(inputBuffer, this->mp3MagicBytesUntagged)) {
-    BELL_LOG(info, TAG, "Detected MP3");
-    codec = AudioCodec::MP3;
-  } else if (vectorStartsWith(inputBuffer, this->aacMagicBytes) ||
-             vectorStartsWith(inputBuffer, this->aacMagicBytes4)) {
-    BELL_LOG(info, TAG, "Detected AAC");
-    codec = AudioCodec::AAC;
+bool EncodedAudioStream::seekToTime(uint32_t timeMs) {
+  if (container == nullptr || !container->seekToTime(timeMs)) {
+    return false;
   }
 
-  if (codec == AudioCodec::NONE) {
-    throw std::runtime_error("Codec not supported");
+  // Whatever was left of the frame belongs to the old position
+  frameLeft = 0;
+  if (codec) {
+    codec->flush(timeMs == 0);
   }
+  ended = false;
+  pcmPosition = (uint64_t)container->getPositionMs() * getSampleRate() /
+                1000 * getChannelCount() * pcmBytesPerSample(getPcmFormat());
+  return true;
 }
 
-void EncodedAudioStream::readFully(uint8_t* dst, size_t nbytes) {}
+void EncodedAudioStream::close() {
+  // The codec may point into the container, which reads from the stream
+  frameLeft = 0;
+  codec = nullptr;
+  container = nullptr;
+  if (innerStream) {
+    innerStream->close();
+    innerStream = nullptr;
+  }
+}
@@ -0,0 +1,660 @@
+#include "EventLoop.h"
+
+#include <string.h>   // for memset
+#include <algorithm>  // for remove_if, min
+#include <utility>    // for move, swap
+#ifdef _WIN32
+#include <io.h>  // for _lseeki64, _read
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "win32shim.h"
+#else
+#include <errno.h>        // for errno, EAGAIN, EINPROGRESS, EINTR
+#include <fcntl.h>        // for fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <netinet/in.h>   // for sockaddr_in, IPPROTO_TCP
+#include <netinet/tcp.h>  // for TCP_NODELAY
+#include <sys/select.h>   // for select, fd_set
+#include <sys/socket.h>   // for socket, connect, send, recv
+#include <unistd.h>       // for close, lseek, read
+#endif
+#ifdef BELL_IO_URING
+#include <poll.h>  // for POLLIN, POLLOUT
+
+#include "IoUring.h"  // for IoUring
+#else
+// Never created, only complete for the destructor of ring
+class bell::IoUring {};
+#endif
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "BellUtils.h"   // for BELL_SLEEP_MS
+#include "DNSCache.h"    // for DNSCache
+
+using namespace bell;
+
+#ifdef _WIN32
+static void closeSocket(int fd) {
+  closesocket(fd);
+}
+
+static void setNonBlocking(int fd) {
+  u_long mode = 1;
+  ioctlsocket(fd, FIONBIO, &mode);
+}
+
+static bool wouldBlock() {
+  int err = WSAGetLastError();
+  return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+static int readAt(int fd, int64_t offset, uint8_t* dst, size_t len) {
+  if (offset >= 0 && _lseeki64(fd, offset, SEEK_SET) < 0) {
+    return -errno;
+  }
+  int result = _read(fd, dst, len);
+  return result < 0 ? -errno : result;
+}
+#else
+static void closeSocket(int fd) {
+  ::close(fd);
+}
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static bool wouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+// Without io_uring, blocks the loop for as long as the read takes
+static int readAt(int fd, int64_t offset, uint8_t* dst, size_t len) {
+  if (offset >= 0 && lseek(fd, offset, SEEK_SET) < 0) {
+    return -errno;
+  }
+  int result = ::read(fd, dst, len);
+  return result < 0 ? -errno : result;
+}
+#endif
+
+// A peer that went away must not raise SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+EventLoop::EventLoop(const std::string& taskName, int stackSize)
+    : bell::Task(taskName, stackSize, 5, 0) {
+  wakeFd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (wakeFd < 0) {
+    BELL_LOG(error, "EventLoop", "Cannot create the wake socket");
+    return;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t len = sizeof(addr);
+  // Bound to an ephemeral port, then connected to itself
+  if (bind(wakeFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      getsockname(wakeFd, (struct sockaddr*)&addr, &len) < 0 ||
+      ::connect(wakeFd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    BELL_LOG(error, "EventLoop", "Cannot set up the wake socket");
+    closeSocket(wakeFd);
+    wakeFd = -1;
+    return;
+  }
+  setNonBlocking(wakeFd);
+
+#ifdef BELL_IO_URING
+  ring = std::make_unique<IoUring>();
+  if (!ring->isValid()) {
+    // Older kernel, or io_uring disabled by the sandbox
+    ring.reset();
+  }
+#endif
+}
+
+EventLoop::~EventLoop() {
+  stop();
+  if (wakeFd >= 0) {
+    closeSocket(wakeFd);
+  }
+}
+
+bool EventLoop::start() {
+  if (running) {
+    return true;
+  }
+  running = true;
+  if (!startTask()) {
+    running = false;
+    return false;
+  }
+  return true;
+}
+
+void EventLoop::stop() {
+  running = false;
+  wake();
+  joinTask();
+}
+
+void EventLoop::wake() {
+  if (wakeFd >= 0) {
+    char signal = 0;
+    send(wakeFd, &signal, 1, 0);
+  }
+}
+
+void EventLoop::watch(int fd, int events, const Handler& handler) {
+  {
+    std::scoped_lock lock(mutex);
+    watches[fd] = {events, handler, nextGeneration++};
+  }
+  wake();
+}
+
+void EventLoop::modify(int fd, int events) {
+  {
+    std::scoped_lock lock(mutex);
+    auto it = watches.find(fd);
+    if (it == watches.end() || it->second.events == events) {
+      return;
+    }
+    it->second.events = events;
+  }
+  wake();
+}
+
+void EventLoop::unwatch(int fd) {
+  std::scoped_lock lock(mutex);
+  watches.erase(fd);
+}
+
+void EventLoop::post(const Callback& callback) {
+  {
+    std::scoped_lock lock(mutex);
+    posted.push_back(callback);
+  }
+  wake();
+}
+
+uint32_t EventLoop::schedule(uint32_t delayMs, const Callback& callback) {
+  uint32_t id;
+  {
+    std::scoped_lock lock(mutex);
+    id = nextTimer++;
+    if (nextTimer == 0) {
+      nextTimer = 1;
+    }
+    timers.push_back({id,
+                      std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(delayMs),
+                      callback});
+  }
+  wake();
+  return id;
+}
+
+void EventLoop::cancel(uint32_t timer) {
+  std::scoped_lock lock(mutex);
+  timers.erase(std::remove_if(timers.begin(), timers.end(),
+                              [&](const Timer& it) { return it.id == timer; }),
+               timers.end());
+}
+
+void EventLoop::read(int fd, int64_t offset, uint8_t* dst, size_t len,
+                     const ReadCallback& callback) {
+  {
+    std::scoped_lock lock(mutex);
+    reads.push_back({fd, offset, dst, len, callback});
+  }
+  wake();
+}
+
+bool EventLoop::registerBuffers(
+    const std::vector<std::span<uint8_t>>& buffers) {
+#ifdef BELL_IO_URING
+  if (ring && !running) {
+    return ring->registerBuffers(buffers);
+  }
+#endif
+  return false;
+}
+
+void EventLoop::runTimers() {
+  auto now = std::chrono::steady_clock::now();
+  std::vector<Callback> due;
+  {
+    std::scoped_lock lock(mutex);
+    for (auto it = timers.begin(); it != timers.end();) {
+      if (it->due <= now) {
+        due.push_back(std::move(it->callback));
+        it = timers.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+  for (auto& callback : due) {
+    callback();
+  }
+}
+
+uint32_t EventLoop::waitMs() {
+  if (!posted.empty() || !reads.empty()) {
+    return 0;
+  }
+  uint32_t wait = MAX_WAIT_MS;
+  auto now = std::chrono::steady_clock::now();
+  for (auto& timer : timers) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        timer.due - now);
+    wait = std::min<uint32_t>(wait, std::max<int64_t>(left.count(), 0));
+  }
+  return wait;
+}
+
+void EventLoop::runHandlers(const std::vector<std::pair<int, int>>& ready) {
+  for (auto& [fd, events] : ready) {
+    Handler handler;
+    int wanted;
+    {
+      // A previous handler may have dropped or changed it
+      std::scoped_lock lock(mutex);
+      auto it = watches.find(fd);
+      if (it == watches.end() || !(wanted = events & it->second.events)) {
+        continue;
+      }
+      handler = it->second.handler;
+    }
+    handler(wanted);
+  }
+}
+
+void EventLoop::runCallbacks(std::vector<Callback>& callbacks) {
+  runTimers();
+
+  {
+    std::scoped_lock lock(mutex);
+    std::swap(callbacks, posted);
+  }
+  for (auto& callback : callbacks) {
+    callback();
+  }
+  callbacks.clear();
+}
+
+void EventLoop::runTask() {
+#ifdef BELL_IO_URING
+  if (ring) {
+    runIoUring();
+    return;
+  }
+#endif
+  runSelect();
+}
+
+void EventLoop::runSelect() {
+  std::vector<std::pair<int, int>> ready;
+  std::vector<Callback> callbacks;
+  std::vector<Read> toRead;
+  while (running) {
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    int maxFd = wakeFd;
+    if (wakeFd >= 0) {
+      FD_SET(wakeFd, &readable);
+    }
+
+    uint32_t wait;
+    {
+      std::scoped_lock lock(mutex);
+      for (auto& [fd, watch] : watches) {
+        if (watch.events & READABLE) {
+          FD_SET(fd, &readable);
+        }
+        if (watch.events & WRITABLE) {
+          FD_SET(fd, &writable);
+        }
+        maxFd = std::max(maxFd, fd);
+      }
+      wait = waitMs();
+    }
+
+    struct timeval timeout = {(long)(wait / 1000), (long)(wait % 1000) * 1000};
+    int count = select(maxFd + 1, &readable, &writable, NULL, &timeout);
+    if (count < 0) {
+      // Most likely a fd closed before unwatch(), it's gone next round
+      BELL_LOG(error, "EventLoop", "select failed");
+      BELL_SLEEP_MS(10);
+      continue;
+    }
+
+    if (wakeFd >= 0 && FD_ISSET(wakeFd, &readable)) {
+      char drain[16];
+      while (recv(wakeFd, drain, sizeof(drain), 0) > 0) {
+      }
+    }
+
+    ready.clear();
+    {
+      std::scoped_lock lock(mutex);
+      for (auto& [fd, watch] : watches) {
+        int events = (FD_ISSET(fd, &readable) ? READABLE : 0) |
+                     (FD_ISSET(fd, &writable) ? WRITABLE : 0);
+        if (events & watch.events) {
+          ready.push_back({fd, events & watch.events});
+        }
+      }
+      std::swap(toRead, reads);
+    }
+    runHandlers(ready);
+
+    // Files are always ready, select() can't tell more
+    for (auto& read : toRead) {
+      read.callback(readAt(read.fd, read.offset, read.dst, read.len));
+    }
+    toRead.clear();
+
+    runCallbacks(callbacks);
+  }
+}
+
+#ifdef BELL_IO_URING
+// Completions of poll removals, nothing to do with them
+static constexpr uint64_t IGNORED_TAG = 0;
+static constexpr uint64_t WAKE_TAG = UINT64_MAX;
+
+void EventLoop::runIoUring() {
+  std::vector<std::pair<int, int>> ready;
+  std::vector<Callback> callbacks;
+  std::vector<Read> toRead;
+  std::vector<std::pair<ReadCallback, int>> done;
+  while (running) {
+    if (!wakeArmed && wakeFd >= 0) {
+      wakeArmed = ring->pollAdd(wakeFd, POLLIN, WAKE_TAG);
+    }
+
+    uint32_t wait;
+    {
+      std::scoped_lock lock(mutex);
+      // Polls of unwatched or changed fds go, those missing are added
+      for (auto it = armed.begin(); it != armed.end();) {
+        auto watch = watches.find(it->first);
+        if (watch != watches.end() &&
+            watch->second.generation == it->second.generation &&
+            watch->second.events == it->second.events) {
+          it++;
+          continue;
+        }
+        ring->pollRemove(it->second.tag, IGNORED_TAG);
+        polls.erase(it->second.tag);
+        it = armed.erase(it);
+      }
+      for (auto& [fd, watch] : watches) {
+        if (watch.events == 0 || armed.count(fd)) {
+          continue;
+        }
+        uint32_t mask = (watch.events & READABLE ? POLLIN : 0) |
+                        (watch.events & WRITABLE ? POLLOUT : 0);
+        uint64_t tag = nextTag++;
+        if (ring->pollAdd(fd, mask, tag)) {
+          armed[fd] = {watch.generation, watch.events, tag};
+          polls[tag] = fd;
+        }
+      }
+      std::swap(toRead, reads);
+      wait = waitMs();
+    }
+
+    for (auto& read : toRead) {
+      uint64_t tag = nextTag++;
+      if (ring->read(read.fd, read.offset, read.dst, read.len, tag)) {
+        inFlight[tag] = std::move(read.callback);
+      } else {
+        done.push_back({std::move(read.callback), -EBUSY});
+      }
+    }
+    toRead.clear();
+
+    // Submits every change above with the wait
+    int count = ring->submitAndWait(wait);
+    if (count < 0) {
+      BELL_LOG(error, "EventLoop", "io_uring wait failed, error %d", -count);
+      BELL_SLEEP_MS(10);
+    }
+
+    ready.clear();
+    ring->reap([&](uint64_t tag, int result) {
+      if (tag == WAKE_TAG) {
+        char drain[16];
+        while (recv(wakeFd, drain, sizeof(drain), 0) > 0) {
+        }
+        wakeArmed = false;
+        return;
+      }
+      auto poll = polls.find(tag);
+      if (poll != polls.end()) {
+        // One shot, armed again next round if still watched
+        armed.erase(poll->second);
+        if (result > 0) {
+          // Hangups and errors wake both, as they do select()
+          int events =
+              (result & (POLLIN | POLLHUP | POLLERR) ? READABLE : 0) |
+              (result & (POLLOUT | POLLHUP | POLLERR) ? WRITABLE : 0);
+          ready.push_back({poll->second, events});
+        }
+        polls.erase(poll);
+        return;
+      }
+      auto read = inFlight.find(tag);
+      if (read != inFlight.end()) {
+        done.push_back({std::move(read->second), result});
+        inFlight.erase(read);
+      }
+    });
+    runHandlers(ready);
+
+    for (auto& [callback, result] : done) {
+      callback(result);
+    }
+    done.clear();
+
+    runCallbacks(callbacks);
+  }
+}
+#endif
+
+AsyncSocket::AsyncSocket(EventLoop& loop) : loop(loop) {}
+
+std::shared_ptr<AsyncSocket> AsyncSocket::create(EventLoop& loop) {
+  return std::shared_ptr<AsyncSocket>(new AsyncSocket(loop));
+}
+
+AsyncSocket::~AsyncSocket() {
+  if (fd >= 0) {
+    loop.unwatch(fd);
+    closeSocket(fd);
+  }
+}
+
+void AsyncSocket::setDataCallback(const DataCallback& onData) {
+  this->onData = onData;
+}
+
+void AsyncSocket::connect(const std::string& host, uint16_t port,
+                          const ConnectCallback& onConnect) {
+  this->onConnect = onConnect;
+
+  auto addresses = DNSCache::instance().resolve(host, port);
+  if (addresses.empty()) {
+    BELL_LOG(error, "AsyncSocket", "Could not resolve %s", host.c_str());
+    loop.post([onConnect]() { onConnect(false); });
+    return;
+  }
+
+  const DNSCache::Address& address = addresses[0];
+  int err = -1;
+  int sock = socket(address.family, SOCK_STREAM, IPPROTO_TCP);
+  if (sock >= 0) {
+    setNonBlocking(sock);
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
+    err = ::connect(sock, (const struct sockaddr*)&address.addr, address.len);
+  }
+
+  if (sock < 0 || (err < 0 && !wouldBlock())) {
+    BELL_LOG(error, "AsyncSocket", "Could not connect to %s", host.c_str());
+    if (sock >= 0) {
+      closeSocket(sock);
+    }
+    loop.post([onConnect]() { onConnect(false); });
+    return;
+  }
+
+  // Writable once connected, or once the connection failed
+  std::weak_ptr<AsyncSocket> weak = shared_from_this();
+  loop.post([weak, sock]() {
+    auto self = weak.lock();
+    if (self == nullptr) {
+      closeSocket(sock);
+      return;
+    }
+    self->fd = sock;
+    self->connecting = true;
+    self->loop.watch(sock, EventLoop::WRITABLE, [weak](int events) {
+      if (auto self = weak.lock()) {
+        self->handle(events);
+      }
+    });
+  });
+}
+
+void AsyncSocket::write(const uint8_t* data, size_t len) {
+  {
+    std::scoped_lock lock(outboxMutex);
+    outbox.insert(outbox.end(), data, data + len);
+  }
+  std::weak_ptr<AsyncSocket> weak = shared_from_this();
+  loop.post([weak]() {
+    if (auto self = weak.lock()) {
+      self->flush();
+    }
+  });
+}
+
+void AsyncSocket::write(const std::string& data) {
+  write((const uint8_t*)data.data(), data.size());
+}
+
+size_t AsyncSocket::pending() {
+  std::scoped_lock lock(outboxMutex);
+  return outbox.size() - outboxPos;
+}
+
+void AsyncSocket::close() {
+  auto self = shared_from_this();
+  loop.post([self]() {
+    if (self->fd >= 0) {
+      self->loop.unwatch(self->fd);
+      closeSocket(self->fd);
+      self->fd = -1;
+    }
+    self->connected = false;
+    self->connecting = false;
+  });
+}
+
+void AsyncSocket::handle(int events) {
+  if (connecting && (events & EventLoop::WRITABLE)) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*)&err, &len);
+    connecting = false;
+    if (err != 0) {
+      BELL_LOG(error, "AsyncSocket", "Connection failed, error %d", err);
+      loop.unwatch(fd);
+      closeSocket(fd);
+      fd = -1;
+      if (onConnect) {
+        onConnect(false);
+      }
+      return;
+    }
+    connected = true;
+    loop.modify(fd, EventLoop::READABLE);
+    if (onConnect) {
+      onConnect(true);
+    }
+    flush();
+    return;
+  }
+
+  if (events & EventLoop::WRITABLE) {
+    flush();
+  }
+
+  if (fd >= 0 && (events & EventLoop::READABLE)) {
+    // Drain what's there, the next select() reports the rest
+    while (fd >= 0) {
+      int len = recv(fd, (char*)readBuffer.data(), readBuffer.size(), 0);
+      if (len > 0) {
+        if (onData) {
+          onData(readBuffer.data(), len);
+        }
+        continue;
+      }
+      if (len < 0 && wouldBlock()) {
+        break;
+      }
+      finish();
+      break;
+    }
+  }
+}
+
+void AsyncSocket::flush() {
+  if (!connected || fd < 0) {
+    return;
+  }
+
+  std::scoped_lock lock(outboxMutex);
+  while (outboxPos < outbox.size()) {
+    int len = send(fd, (const char*)outbox.data() + outboxPos,
+                   outbox.size() - outboxPos, SEND_FLAGS);
+    if (len <= 0) {
+      if (len < 0 && !wouldBlock()) {
+        outbox.clear();
+        outboxPos = 0;
+        return;
+      }
+      break;
+    }
+    outboxPos += len;
+  }
+
+  if (outboxPos == outbox.size()) {
+    outbox.clear();
+    outboxPos = 0;
+    loop.modify(fd, EventLoop::READABLE);
+  } else {
+    // Wait for the connection to take more
+    loop.modify(fd, EventLoop::READABLE | EventLoop::WRITABLE);
+  }
+}
+
+void AsyncSocket::finish() {
+  loop.unwatch(fd);
+  closeSocket(fd);
+  fd = -1;
+  connected = false;
+  if (onData) {
+    onData(nullptr, 0);
+  }
+}
@@ -1,61 +1,197 @@
 #include "FileStream.h"
 
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
 #include <stdexcept>  // for runtime_error
 
 #include "BellLogger.h"  // for bell
 
+#ifdef _WIN32
+#include <windows.h>  // for CreateFileMapping, MapViewOfFile
+#elif !defined(ESP_PLATFORM)
+#include <fcntl.h>     // for open, posix_fadvise
+#include <sys/mman.h>  // for mmap, munmap
+#include <sys/stat.h>  // for fstat
+#include <unistd.h>    // for close
+#define BELL_FILESTREAM_MMAP
+#endif
+
 using namespace bell;
 
 FileStream::FileStream(const std::string& path, std::string read) {
+  open(path, Config());
+}
+
+FileStream::FileStream(const std::string& path, const Config& config) {
+  open(path, config);
+}
+
+FileStream::~FileStream() {
+  close();
+}
+
+void FileStream::open(const std::string& path, const Config& config) {
+  if (config.mmap && map(path)) {
+    isOpen = true;
+    return;
+  }
+
   file = fopen(path.c_str(), "rb");
   if (file == NULL) {
     throw std::runtime_error("Could not open file: " + path);
   }
+  isOpen = true;
+
+  if (config.readAhead > 0) {
+    readAheadBuffer.resize((config.readAhead + 4095) / 4096 * 4096);
+    setvbuf(file, readAheadBuffer.data(), _IOFBF, readAheadBuffer.size());
+  }
+
+  fseek(file, 0, SEEK_END);
+  fileSize = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+#if defined(BELL_FILESTREAM_MMAP) && defined(POSIX_FADV_SEQUENTIAL)
+  if (config.sequential) {
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+#endif
 }
 
-FileStream::~FileStream() {
-  close();
+bool FileStream::map(const std::string& path) {
+#if defined(BELL_FILESTREAM_MMAP)
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void* view = MAP_FAILED;
+  // mmap() refuses empty files
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    return false;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(view, st.st_size, MADV_SEQUENTIAL);
+#endif
+  mapping = (const uint8_t*)view;
+  fileSize = st.st_size;
+  return true;
+#elif defined(_WIN32)
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER length;
+  HANDLE fileMapping = NULL;
+  if (GetFileSizeEx(handle, &length) && length.QuadPart > 0) {
+    fileMapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  }
+  // The mapping keeps the file open
+  CloseHandle(handle);
+  if (fileMapping == NULL) {
+    return false;
+  }
+  const void* view = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(fileMapping);
+    return false;
+  }
+  mapping = (const uint8_t*)view;
+  mappingHandle = fileMapping;
+  fileSize = length.QuadPart;
+  return true;
+#else
+  return false;
+#endif
 }
 
 size_t FileStream::read(uint8_t* buf, size_t nbytes) {
-  if (file == NULL) {
+  if (!isOpen) {
     throw std::runtime_error("Stream is closed");
   }
 
-  return fread(buf, 1, nbytes, file);
+  if (mapping != nullptr) {
+    nbytes = std::min(nbytes, fileSize - filePosition);
+    memcpy(buf, mapping + filePosition, nbytes);
+    filePosition += nbytes;
+    return nbytes;
+  }
+
+  size_t read = fread(buf, 1, nbytes, file);
+  filePosition += read;
+  return read;
 }
 
 size_t FileStream::skip(size_t nbytes) {
-  if (file == NULL) {
+  if (!isOpen) {
     throw std::runtime_error("Stream is closed");
   }
 
-  return fseek(file, nbytes, SEEK_CUR);
+  nbytes = std::min(nbytes, fileSize - filePosition);
+  if (mapping == nullptr && fseek(file, nbytes, SEEK_CUR) != 0) {
+    return 0;
+  }
+  filePosition += nbytes;
+  return nbytes;
 }
 
 size_t FileStream::position() {
-  if (file == NULL) {
+  if (!isOpen) {
     throw std::runtime_error("Stream is closed");
   }
 
-  return ftell(file);
+  return filePosition;
+}
+
+bool FileStream::seek(size_t offset) {
+  if (!isOpen) {
+    throw std::runtime_error("Stream is closed");
+  }
+
+  if (offset > fileSize) {
+    return false;
+  }
+  if (mapping == nullptr && fseek(file, offset, SEEK_SET) != 0) {
+    return false;
+  }
+  filePosition = offset;
+  return true;
 }
 
 size_t FileStream::size() {
-  if (file == NULL) {
+  if (!isOpen) {
     throw std::runtime_error("Stream is closed");
   }
 
-  size_t pos = ftell(file);
-  fseek(file, 0, SEEK_END);
-  size_t size = ftell(file);
-  fseek(file, pos, SEEK_SET);
-  return size;
+  return fileSize;
+}
+
+std::span<const uint8_t> FileStream::mapped() const {
+  if (mapping == nullptr) {
+    return {};
+  }
+  return {mapping, fileSize};
 }
 
 void FileStream::close() {
+  if (mapping != nullptr) {
+#if defined(BELL_FILESTREAM_MMAP)
+    munmap((void*)mapping, fileSize);
+#elif defined(_WIN32)
+    UnmapViewOfFile(mapping);
+    CloseHandle(mappingHandle);
+#endif
+    mapping = nullptr;
+  }
   if (file != NULL) {
     fclose(file);
     file = NULL;
   }
-}
\ No newline at end of file
+  isOpen = false;
+}
@@ -0,0 +1,574 @@
+#include "HLSStream.h"
+
+#include <stdlib.h>   // for strtoul, strtoull
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min, max, stable_sort
+#include <exception>  // for exception
+#include <stdexcept>  // for runtime_error
+#include <utility>    // for move
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "BellUtils.h"   // for BELL_SLEEP_MS
+#include "URLParser.h"   // for URLParser
+
+using namespace bell;
+
+namespace {
+std::string_view trim(std::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t' ||
+                            value.back() == '\r')) {
+    value.remove_suffix(1);
+  }
+  return value;
+}
+
+bool startsWith(std::string_view value, std::string_view prefix) {
+  return value.substr(0, prefix.size()) == prefix;
+}
+
+// Value of name in an attribute list, NAME=value,NAME="quoted, value"
+std::string attribute(std::string_view list, std::string_view name) {
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t equals = list.find('=', pos);
+    if (equals == std::string_view::npos) {
+      break;
+    }
+    std::string_view key = trim(list.substr(pos, equals - pos));
+    size_t start = equals + 1, end;
+    if (start < list.size() && list[start] == '"') {
+      start++;
+      end = list.find('"', start);
+      if (end == std::string_view::npos) {
+        end = list.size();
+      }
+      pos = list.find(',', end);
+    } else {
+      end = list.find(',', start);
+      if (end == std::string_view::npos) {
+        end = list.size();
+      }
+      pos = end;
+    }
+    if (key == name) {
+      return std::string(list.substr(start, end - start));
+    }
+    if (pos == std::string_view::npos) {
+      break;
+    }
+    pos++;
+  }
+  return "";
+}
+
+// n[@o], the offset following previousEnd when it's missing
+void parseByteRange(std::string_view value, size_t previousEnd,
+                    HLSStream::Segment& segment) {
+  std::string range(value);
+  segment.length = strtoul(range.c_str(), nullptr, 10);
+  size_t at = range.find('@');
+  segment.offset = at != std::string::npos
+                       ? strtoul(range.c_str() + at + 1, nullptr, 10)
+                       : previousEnd;
+}
+}  // namespace
+
+std::string HLSStream::resolve(const std::string& base, std::string_view ref) {
+  if (ref.find("://") != std::string_view::npos) {
+    return std::string(ref);
+  }
+  URLParser::View view;
+  if (!URLParser::parse(base, view)) {
+    return std::string(ref);
+  }
+  std::string schema = view.schema.empty() ? "http" : std::string(view.schema);
+  if (startsWith(ref, "//")) {
+    return schema + ":" + std::string(ref);
+  }
+
+  // Authority as written in base, it ends where the path starts
+  size_t authorityStart = base.find("//") + 2;
+  size_t authorityEnd = base.find_first_of("/?#", authorityStart);
+  std::string origin = base.substr(0, authorityEnd);
+  if (startsWith(ref, "/")) {
+    return origin + std::string(ref);
+  }
+
+  // Next to the last path segment of base, its query left out
+  std::string path = std::string(view.path.substr(0, view.path.find('?')));
+  if (!startsWith(ref, "?")) {
+    path.erase(path.rfind('/') + 1);
+  }
+  return origin + path + std::string(ref);
+}
+
+bool HLSStream::isPlaylist(std::string_view url, std::string_view contentType) {
+  std::string_view path = url.substr(0, url.find_first_of("?#"));
+  if (path.size() >= 5 && path.substr(path.size() - 5) == ".m3u8") {
+    return true;
+  }
+  return contentType.find("mpegurl") != std::string_view::npos;
+}
+
+HLSStream::Playlist HLSStream::parsePlaylist(std::string_view text,
+                                             const std::string& url) {
+  Playlist playlist;
+  uint64_t sequence = 0;
+  bool first = true;
+  bool pendingVariant = false;
+  Variant variant;
+  Segment segment;
+  bool hasRange = false;
+  // End of the previous byte range, where the next one starts by default
+  size_t rangeEnd = 0;
+
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+    std::string_view line = trim(text.substr(0, end));
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    if (line.empty()) {
+      continue;
+    }
+    if (first) {
+      if (line != "#EXTM3U") {
+        return Playlist();
+      }
+      first = false;
+      continue;
+    }
+
+    if (line[0] != '#') {
+      // URI, of the variant or of the segment the tags above describe
+      if (pendingVariant) {
+        variant.url = resolve(url, line);
+        playlist.variants.push_back(std::move(variant));
+        variant = Variant();
+        pendingVariant = false;
+        continue;
+      }
+      segment.url = resolve(url, line);
+      segment.sequence = sequence++;
+      if (!hasRange) {
+        segment.offset = segment.length = 0;
+      }
+      rangeEnd = segment.offset + segment.length;
+      playlist.segments.push_back(std::move(segment));
+      segment = Segment();
+      hasRange = false;
+      continue;
+    }
+
+    size_t colon = line.find(':');
+    std::string_view tag = line.substr(0, colon);
+    std::string_view value =
+        colon == std::string_view::npos ? "" : line.substr(colon + 1);
+    std::string number(value);
+    if (tag == "#EXT-X-STREAM-INF") {
+      variant.bandwidth =
+          strtoul(attribute(value, "BANDWIDTH").c_str(), nullptr, 10);
+      variant.codecs = attribute(value, "CODECS");
+      pendingVariant = true;
+    } else if (tag == "#EXT-X-TARGETDURATION") {
+      playlist.targetDurationMs = strtoul(number.c_str(), nullptr, 10) * 1000;
+    } else if (tag == "#EXT-X-MEDIA-SEQUENCE") {
+      sequence = strtoull(number.c_str(), nullptr, 10);
+    } else if (tag == "#EXT-X-BYTERANGE") {
+      parseByteRange(value, rangeEnd, segment);
+      hasRange = true;
+    } else if (tag == "#EXT-X-MAP") {
+      playlist.init.url = resolve(url, attribute(value, "URI"));
+      playlist.init.sequence = NO_SEQUENCE;
+      std::string range = attribute(value, "BYTERANGE");
+      if (!range.empty()) {
+        parseByteRange(range, 0, playlist.init);
+      }
+    } else if (tag == "#EXT-X-KEY") {
+      std::string method = attribute(value, "METHOD");
+      playlist.encrypted = playlist.encrypted || method != "NONE";
+    } else if (tag == "#EXT-X-ENDLIST") {
+      playlist.ended = true;
+    }
+  }
+  return playlist;
+}
+
+HLSStream::Worker::Worker(HLSStream* owner)
+    : bell::Task("hls_fetch", 4096 * 4, 5, 0), owner(owner) {}
+
+HLSStream::HLSStream(const std::string& url, const Config& config)
+    : config(config), dataSem(1) {
+  std::scoped_lock lock(playlistMutex);
+  if (!loadMedia(url)) {
+    throw std::runtime_error("Cannot load playlist");
+  }
+
+  if (!playlist.variants.empty()) {
+    // Switching is only seamless between variants of the same codecs
+    std::string codecs = playlist.variants[0].codecs;
+    std::string start = playlist.variants[0].url;
+    for (auto& candidate : playlist.variants) {
+      if (candidate.codecs == codecs) {
+        variants.push_back(candidate);
+      }
+    }
+    std::stable_sort(variants.begin(), variants.end(),
+                     [](const Variant& a, const Variant& b) {
+                       return a.bandwidth < b.bandwidth;
+                     });
+    for (size_t i = 0; i < variants.size(); i++) {
+      if (variants[i].url == start) {
+        variant = i;
+      }
+    }
+    if (!loadMedia(variants[variant].url) || !playlist.variants.empty()) {
+      throw std::runtime_error("Cannot load variant playlist");
+    }
+  }
+
+  if (playlist.encrypted) {
+    throw std::runtime_error("Encrypted HLS is not supported");
+  }
+  if (playlist.segments.empty() && playlist.ended) {
+    throw std::runtime_error("Empty playlist");
+  }
+  if (!playlist.segments.empty()) {
+    // Live streams start three segments before the end, RFC 8216 6.3.3
+    size_t start = playlist.ended
+                       ? 0
+                       : playlist.segments.size() -
+                             std::min<size_t>(3, playlist.segments.size());
+    nextSequence = playlist.segments[start].sequence;
+  }
+
+  for (size_t i = 0; i < std::max<size_t>(config.prefetch, 1); i++) {
+    workers.push_back(std::make_unique<Worker>(this));
+  }
+  for (auto& worker : workers) {
+    if (!worker->startTask()) {
+      BELL_LOG(error, TAG, "Cannot start a worker");
+    }
+  }
+}
+
+HLSStream::~HLSStream() {
+  close();
+}
+
+void HLSStream::close() {
+  terminate = true;
+  for (auto& worker : workers) {
+    worker->requestStop();
+  }
+  // Workers read owner until they're out of their Task
+  for (auto& worker : workers) {
+    worker->joinTask();
+  }
+}
+
+uint32_t HLSStream::getBandwidth() {
+  std::scoped_lock lock(playlistMutex);
+  return variants.empty() ? 0 : variants[variant].bandwidth;
+}
+
+uint32_t HLSStream::getThroughput() {
+  std::scoped_lock lock(playlistMutex);
+  return throughput;
+}
+
+bool HLSStream::loadMedia(const std::string& url) {
+  lastReload = std::chrono::steady_clock::now();
+  try {
+    auto response = HTTPClient::get(url);
+    if (response->status() != 200) {
+      BELL_LOG(error, TAG, "Playlist request failed: %d", response->status());
+      return false;
+    }
+    Playlist loaded = parsePlaylist(response->body(), url);
+    if (loaded.segments.empty() && loaded.variants.empty() && !loaded.ended) {
+      BELL_LOG(error, TAG, "Invalid playlist");
+      return false;
+    }
+    if (initSent && loaded.init.url != playlist.init.url) {
+      // The container was set up by the previous init segment
+      BELL_LOG(error, TAG, "Init segment changed, not adapting");
+      config.adaptive = false;
+      return false;
+    }
+    playlist = std::move(loaded);
+    mediaUrl = url;
+    return true;
+  } catch (const std::exception& e) {
+    BELL_LOG(error, TAG, "Playlist request failed: %s", e.what());
+    return false;
+  }
+}
+
+void HLSStream::adapt() {
+  if (!config.adaptive || variants.size() < 2 || samples < 2) {
+    return;
+  }
+
+  // Highest variant the throughput allows, the lowest one at least
+  double usable = throughput * config.bandwidthMargin;
+  size_t chosen = 0;
+  for (size_t i = 0; i < variants.size(); i++) {
+    if (variants[i].bandwidth <= usable) {
+      chosen = i;
+    }
+  }
+  if (chosen == variant) {
+    return;
+  }
+
+  BELL_LOG(info, TAG, "Switching to %u bps, measured %u bps",
+           (unsigned)variants[chosen].bandwidth, (unsigned)throughput);
+  // Sequence numbers line up across variants, the next one is kept
+  if (loadMedia(variants[chosen].url)) {
+    variant = chosen;
+  }
+  samples = 0;
+}
+
+bool HLSStream::nextSegment(Segment& segment, size_t& ticket) {
+  std::unique_lock lock(playlistMutex);
+  int failures = 0;
+  while (!terminate && !exhausted) {
+    if (!initSent && !playlist.init.url.empty()) {
+      segment = playlist.init;
+      initSent = true;
+      ticket = assigned++;
+      return true;
+    }
+
+    adapt();
+    if (!playlist.segments.empty()) {
+      uint64_t firstSequence = playlist.segments.front().sequence;
+      if (nextSequence < firstSequence) {
+        // Fell behind a live playlist, those segments are gone
+        BELL_LOG(error, TAG, "Skipped %u segments",
+                 (unsigned)(firstSequence - nextSequence));
+        nextSequence = firstSequence;
+      }
+      uint64_t index = nextSequence - firstSequence;
+      if (index < playlist.segments.size()) {
+        segment = playlist.segments[index];
+        nextSequence++;
+        ticket = assigned++;
+        return true;
+      }
+    }
+    if (playlist.ended) {
+      break;
+    }
+
+    // Live, wait for the playlist to grow
+    auto due = lastReload + std::chrono::milliseconds(
+                                std::max<uint32_t>(playlist.targetDurationMs,
+                                                   1000) /
+                                2);
+    if (std::chrono::steady_clock::now() < due) {
+      lock.unlock();
+      BELL_SLEEP_MS(100);
+      lock.lock();
+      continue;
+    }
+    if (loadMedia(mediaUrl)) {
+      failures = 0;
+    } else if (++failures >= MAX_ATTEMPTS) {
+      break;
+    }
+  }
+
+  exhausted = true;
+  dataSem.give();
+  return false;
+}
+
+void HLSStream::addSample(size_t bytes,
+                          std::chrono::steady_clock::duration elapsed) {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  if (bytes < MIN_MEASURED || seconds <= 0) {
+    return;
+  }
+  // The fetches running alongside took their share of the link
+  double sample = bytes * 8 / seconds * std::max<size_t>(fetching, 1);
+  std::scoped_lock lock(playlistMutex);
+  throughput = throughput == 0 ? sample : throughput * 0.7 + sample * 0.3;
+  samples++;
+}
+
+HLSStream::Worker* HLSStream::slot(size_t ticket) {
+  for (auto& worker : workers) {
+    if (worker->ticket == ticket) {
+      return worker.get();
+    }
+  }
+  return nullptr;
+}
+
+size_t HLSStream::read(uint8_t* buf, size_t nbytes) {
+  size_t read = 0;
+  while (read < nbytes && !terminate) {
+    Worker* worker = slot(current);
+    if (worker == nullptr) {
+      if (exhausted && current >= assigned) {
+        break;
+      }
+      if (read > 0) {
+        break;
+      }
+      dataSem.twait(100);
+      continue;
+    }
+
+    // Before filled, so no data is missed once the segment is done
+    bool done = worker->done;
+    size_t available = worker->filled - segmentPos;
+    if (available == 0) {
+      if (!done) {
+        // Hand out what's there rather than waiting for more
+        if (read > 0) {
+          break;
+        }
+        dataSem.twait(100);
+        continue;
+      }
+      if (worker->failed) {
+        BELL_LOG(error, TAG, "Segment failed, skipped");
+      }
+      // Let the worker fetch its next segment
+      segmentPos = 0;
+      current++;
+      worker->ticket = NO_TICKET;
+      worker->freeSem.give();
+      continue;
+    }
+
+    size_t toRead = std::min(available, nbytes - read);
+    if (buf != nullptr) {
+      std::scoped_lock lock(worker->dataMutex);
+      memcpy(buf + read, worker->data.data() + segmentPos, toRead);
+    }
+    segmentPos += toRead;
+    read += toRead;
+    readTotal += toRead;
+  }
+  return read;
+}
+
+size_t HLSStream::skip(size_t nbytes) {
+  return read(nullptr, nbytes);
+}
+
+void HLSStream::Worker::onStopRequested() {
+  {
+    // The worker may be blocked in a read
+    std::scoped_lock lock(responseMutex);
+    if (response != nullptr) {
+      response->byteStream().close();
+    }
+  }
+  freeSem.give();
+}
+
+void HLSStream::Worker::runTask() {
+  while (!owner->terminate) {
+    // Wait for read() to consume the previous segment
+    while (ticket != NO_TICKET && !owner->terminate) {
+      freeSem.twait(100);
+    }
+
+    Segment segment;
+    size_t next;
+    if (owner->terminate || !owner->nextSegment(segment, next)) {
+      break;
+    }
+    filled = 0;
+    done = false;
+    failed = false;
+    ticket = next;
+
+    failed = !fetch(segment);
+    done = true;
+    owner->dataSem.give();
+  }
+
+  std::scoped_lock responseLock(responseMutex);
+  response = nullptr;
+}
+
+bool HLSStream::Worker::fetch(const Segment& segment) {
+  auto started = std::chrono::steady_clock::now();
+  owner->fetching++;
+  bool complete = false;
+  for (int attempt = 0;
+       attempt < MAX_ATTEMPTS && !complete && !owner->terminate; attempt++) {
+    try {
+      // A retry resumes where the previous attempt stopped
+      size_t resumed = filled;
+      HTTPClient::Headers headers;
+      if (segment.length > 0) {
+        headers.push_back(HTTPClient::RangeHeader::range(
+            segment.offset + resumed, segment.offset + segment.length - 1));
+      } else if (resumed > 0) {
+        headers.push_back({"Range", "bytes=" + std::to_string(resumed) + "-"});
+      }
+      auto next =
+          HTTPClient::get(segment.url, headers, Socket::Profile::BULK);
+      {
+        std::scoped_lock lock(responseMutex);
+        response = std::move(next);
+      }
+      if (response->status() >= 300) {
+        throw std::runtime_error("Status " +
+                                 std::to_string(response->status()));
+      }
+      if (!headers.empty() && response->header("content-range").empty()) {
+        throw std::runtime_error("Range not satisfied");
+      }
+
+      // One allocation when the length is known
+      size_t expected = response->contentLength();
+      if (expected > 0) {
+        expected += resumed;
+        if (expected > owner->config.maxSegmentSize) {
+          throw std::runtime_error("Segment too large");
+        }
+        std::scoped_lock lock(dataMutex);
+        data.resize(std::max(data.size(), expected));
+      }
+
+      while (!owner->terminate) {
+        if (filled == data.size()) {
+          size_t grown = std::max<size_t>(data.size() * 2, 16 * 1024);
+          if (data.size() >= owner->config.maxSegmentSize) {
+            throw std::runtime_error("Segment too large");
+          }
+          std::scoped_lock lock(dataMutex);
+          data.resize(std::min(grown, owner->config.maxSegmentSize));
+        }
+        // Past filled, read() doesn't look there
+        size_t len = response->byteStream().read(data.data() + filled,
+                                                 data.size() - filled);
+        if (len == 0) {
+          break;
+        }
+        filled += len;
+        owner->dataSem.give();
+      }
+      complete = expected == 0 || filled == expected;
+    } catch (const std::exception& e) {
+      BELL_LOG(error, owner->TAG, "Segment request failed: %s", e.what());
+    }
+
+    std::scoped_lock lock(responseMutex);
+    response = nullptr;
+  }
+
+  owner->addSample(filled, std::chrono::steady_clock::now() - started);
+  owner->fetching--;
+  return complete;
+}
@@ -0,0 +1,375 @@
+#include "HPACK.h"
+
+#include <algorithm>  // for min
+
+using namespace bell;
+
+namespace {
+// RFC 7541 Appendix A
+const HPACK::Header STATIC_TABLE[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+constexpr size_t STATIC_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+// Code length of every symbol, RFC 7541 Appendix B. The code is canonical,
+// so the lengths are all it takes to decode it
+const uint8_t HUFFMAN_LENGTHS[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6,  10, 10, 12, 13, 6,  8,  11, 10, 10, 8,  11, 8,  6,  6,  6,
+    5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8,  15, 6,  12, 10,
+    13, 6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+    7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8,  13, 19, 13, 14, 6,
+    15, 5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+    6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7,  15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+constexpr int HUFFMAN_EOS = 256;
+constexpr int HUFFMAN_MAX_LENGTH = 30;
+
+size_t entrySize(const HPACK::Header& header) {
+  return header.first.size() + header.second.size() + 32;
+}
+
+// Integer with an N bit prefix, RFC 7541 5.1
+bool decodeInteger(const uint8_t*& data, const uint8_t* end, int prefixBits,
+                   size_t& value) {
+  if (data == end) {
+    return false;
+  }
+  size_t max = (1 << prefixBits) - 1;
+  value = *data++ & max;
+  if (value < max) {
+    return true;
+  }
+  for (int shift = 0; shift < 28; shift += 7) {
+    if (data == end) {
+      return false;
+    }
+    uint8_t byte = *data++;
+    value += (size_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void encodeInteger(std::vector<uint8_t>& out, uint8_t flags, int prefixBits,
+                   size_t value) {
+  size_t max = (1 << prefixBits) - 1;
+  if (value < max) {
+    out.push_back(flags | value);
+    return;
+  }
+  out.push_back(flags | max);
+  value -= max;
+  while (value >= 0x80) {
+    out.push_back(0x80 | (value & 0x7f));
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+bool decodeString(const uint8_t*& data, const uint8_t* end,
+                  std::string& out) {
+  if (data == end) {
+    return false;
+  }
+  bool huffman = *data & 0x80;
+  size_t length;
+  if (!decodeInteger(data, end, 7, length) || length > (size_t)(end - data)) {
+    return false;
+  }
+  out.clear();
+  bool valid = true;
+  if (huffman) {
+    valid = HPACK::huffmanDecode(data, length, out);
+  } else {
+    out.assign((const char*)data, length);
+  }
+  data += length;
+  return valid;
+}
+
+// Sent as raw octets, Huffman coding is only worth it on the way in
+void encodeString(std::vector<uint8_t>& out, const std::string& value) {
+  encodeInteger(out, 0, 7, value.size());
+  out.insert(out.end(), value.begin(), value.end());
+}
+}  // namespace
+
+void HPACK::Table::setMaxSize(size_t newSize) {
+  maxSize = newSize;
+  evict(0);
+}
+
+void HPACK::Table::evict(size_t room) {
+  while (!entries.empty() && size + room > maxSize) {
+    size -= entrySize(entries.back());
+    entries.pop_back();
+  }
+}
+
+void HPACK::Table::add(const std::string& name, const std::string& value) {
+  Header header = {name, value};
+  size_t needed = entrySize(header);
+  evict(needed);
+  // Larger than the table, it just empties it
+  if (needed <= maxSize) {
+    entries.push_front(std::move(header));
+    size += needed;
+  }
+}
+
+const HPACK::Header* HPACK::Table::get(size_t index) const {
+  if (index == 0) {
+    return nullptr;
+  }
+  if (index <= STATIC_SIZE) {
+    return &STATIC_TABLE[index - 1];
+  }
+  index -= STATIC_SIZE + 1;
+  return index < entries.size() ? &entries[index] : nullptr;
+}
+
+size_t HPACK::Table::find(const std::string& name, const std::string& value,
+                          size_t& nameIndex) const {
+  nameIndex = 0;
+  for (size_t i = 0; i < STATIC_SIZE + entries.size(); i++) {
+    const Header& header =
+        i < STATIC_SIZE ? STATIC_TABLE[i] : entries[i - STATIC_SIZE];
+    if (header.first != name) {
+      continue;
+    }
+    if (header.second == value) {
+      return i + 1;
+    }
+    if (nameIndex == 0) {
+      nameIndex = i + 1;
+    }
+  }
+  return 0;
+}
+
+bool HPACK::huffmanDecode(const uint8_t* data, size_t length,
+                          std::string& out) {
+  // Symbols ordered by code, and how many codes there are of each length
+  struct Code {
+    uint16_t count[HUFFMAN_MAX_LENGTH + 1] = {};
+    uint16_t symbol[257];
+  };
+  static const Code code = [] {
+    Code built;
+    for (uint8_t length : HUFFMAN_LENGTHS) {
+      built.count[length]++;
+    }
+    size_t index = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_LENGTH; length++) {
+      for (int symbol = 0; symbol < 257; symbol++) {
+        if (HUFFMAN_LENGTHS[symbol] == length) {
+          built.symbol[index++] = symbol;
+        }
+      }
+    }
+    return built;
+  }();
+
+  // Same walk as a canonical inflate decoder, most significant bit first
+  int value = 0, first = 0, index = 0, bits = 0;
+  bool ones = true;
+  for (size_t i = 0; i < length; i++) {
+    for (int bit = 7; bit >= 0; bit--) {
+      int next = (data[i] >> bit) & 1;
+      value |= next;
+      ones = ones && next;
+      bits++;
+
+      int count = code.count[bits];
+      if (value - count < first) {
+        int symbol = code.symbol[index + (value - first)];
+        if (symbol == HUFFMAN_EOS) {
+          return false;
+        }
+        out.push_back((char)symbol);
+        value = first = index = bits = 0;
+        ones = true;
+        continue;
+      }
+      if (bits == HUFFMAN_MAX_LENGTH) {
+        return false;
+      }
+      index += count;
+      first = (first + count) << 1;
+      value <<= 1;
+    }
+  }
+  // Padding is the start of EOS, all ones and shorter than a byte
+  return bits < 8 && ones;
+}
+
+bool HPACK::Decoder::decode(const uint8_t* data, size_t length,
+                            Headers& headers) {
+  const uint8_t* end = data + length;
+  size_t total = 0;
+  while (data < end) {
+    uint8_t first = *data;
+    size_t index;
+
+    if (first & 0x80) {
+      // Indexed header field
+      const Header* header;
+      if (!decodeInteger(data, end, 7, index) ||
+          (header = table.get(index)) == nullptr) {
+        return false;
+      }
+      headers.push_back(*header);
+    } else if ((first & 0xe0) == 0x20) {
+      // Dynamic table size update, at most the size of our settings
+      if (!decodeInteger(data, end, 5, index) ||
+          index > DEFAULT_TABLE_SIZE) {
+        return false;
+      }
+      table.setMaxSize(index);
+      continue;
+    } else {
+      // Literal, with incremental indexing or not
+      bool indexed = (first & 0xc0) == 0x40;
+      Header header;
+      if (!decodeInteger(data, end, indexed ? 6 : 4, index)) {
+        return false;
+      }
+      if (index > 0) {
+        const Header* named = table.get(index);
+        if (named == nullptr) {
+          return false;
+        }
+        header.first = named->first;
+      } else if (!decodeString(data, end, header.first)) {
+        return false;
+      }
+      if (!decodeString(data, end, header.second)) {
+        return false;
+      }
+      if (indexed) {
+        table.add(header.first, header.second);
+      }
+      headers.push_back(std::move(header));
+    }
+
+    total += entrySize(headers.back());
+    if (total > MAX_HEADER_LIST) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void HPACK::Encoder::setMaxTableSize(size_t size) {
+  size = std::min(size, DEFAULT_TABLE_SIZE);
+  if (size != table.getMaxSize()) {
+    table.setMaxSize(size);
+    sizeUpdate = true;
+  }
+}
+
+void HPACK::Encoder::encode(const Headers& headers,
+                            std::vector<uint8_t>& out) {
+  if (sizeUpdate) {
+    encodeInteger(out, 0x20, 5, table.getMaxSize());
+    sizeUpdate = false;
+  }
+
+  for (auto& header : headers) {
+    size_t nameIndex;
+    size_t index = table.find(header.first, header.second, nameIndex);
+    if (index > 0) {
+      encodeInteger(out, 0x80, 7, index);
+      continue;
+    }
+
+    bool changing = header.first == ":path" || header.first == "range" ||
+                    header.first == "content-length" ||
+                    header.first == "if-none-match" ||
+                    header.first == "if-modified-since";
+    if (changing) {
+      // Literal without indexing
+      encodeInteger(out, 0x00, 4, nameIndex);
+    } else {
+      encodeInteger(out, 0x40, 6, nameIndex);
+      table.add(header.first, header.second);
+    }
+    if (nameIndex == 0) {
+      encodeString(out, header.first);
+    }
+    encodeString(out, header.second);
+  }
+}
@@ -0,0 +1,698 @@
+#include "HTTP2Connection.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min, transform
+#include <cctype>     // for tolower
+#include <set>        // for set
+#include <stdexcept>  // for runtime_error
+#include <utility>    // for move
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "HTTPClient.h"  // for HTTPClient
+#include "TCPSocket.h"   // for TCPSocket
+#include "TLSSocket.h"   // for TLSSocket
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>  // for select, fd_set
+#endif
+
+using namespace bell;
+
+namespace {
+const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// Error codes, RFC 9113 7
+constexpr uint32_t PROTOCOL_ERROR = 0x1;
+constexpr uint32_t CANCEL = 0x8;
+
+// Settings, RFC 9113 6.5.2
+constexpr uint16_t HEADER_TABLE_SIZE = 0x1;
+constexpr uint16_t ENABLE_PUSH = 0x2;
+constexpr uint16_t MAX_CONCURRENT_STREAMS = 0x3;
+constexpr uint16_t INITIAL_WINDOW_SIZE = 0x4;
+constexpr uint16_t MAX_FRAME_SIZE_SETTING = 0x5;
+constexpr uint16_t MAX_HEADER_LIST_SIZE = 0x6;
+
+uint32_t readBE(const uint8_t* data, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+void writeBE(uint8_t* data, uint32_t value, size_t bytes) {
+  for (size_t i = bytes; i > 0; i--) {
+    data[i - 1] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+// Serializes a frame at the end of out
+void appendFrame(std::vector<uint8_t>& out, uint8_t type, uint8_t flags,
+                 uint32_t streamId, const uint8_t* payload, size_t length) {
+  uint8_t header[9];
+  writeBE(header, length, 3);
+  header[3] = type;
+  header[4] = flags;
+  writeBE(header + 5, streamId & 0x7fffffff, 4);
+  out.insert(out.end(), header, header + sizeof(header));
+  out.insert(out.end(), payload, payload + length);
+}
+
+void appendWindowUpdate(std::vector<uint8_t>& out, uint32_t streamId,
+                        size_t increment) {
+  uint8_t payload[4];
+  writeBE(payload, increment, 4);
+  appendFrame(out, 0x8, 0, streamId, payload, sizeof(payload));
+}
+
+void appendReset(std::vector<uint8_t>& out, uint32_t streamId,
+                 uint32_t error) {
+  uint8_t payload[4];
+  writeBE(payload, error, 4);
+  appendFrame(out, 0x3, 0, streamId, payload, sizeof(payload));
+}
+
+bool socketReadable(int fd, int timeoutMs) {
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(fd, &readable);
+  struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+  return select(fd + 1, &readable, NULL, NULL, &timeout) > 0;
+}
+
+// Request headers that only mean something to HTTP/1.1, RFC 9113 8.2.2
+bool connectionSpecific(const std::string& name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade" || name == "host";
+}
+
+std::string authority(const URLParser& url) {
+  std::string host = url.host;
+  if (host.find(':') != std::string::npos) {
+    host = "[" + host + "]";
+  }
+  bool defaultPort = (url.schema == "https" && url.port == 443) ||
+                     (url.schema == "http" && url.port == 80);
+  return defaultPort ? host : host + ":" + std::to_string(url.port);
+}
+
+struct Pool {
+  std::mutex mutex;
+  HTTP2Connection::Config config;
+  std::map<std::string, std::shared_ptr<HTTP2Connection>> connections;
+  // Hosts that picked HTTP/1.1, not asked again
+  std::set<std::string> http1Hosts;
+
+  static Pool& instance() {
+    static Pool pool;
+    return pool;
+  }
+};
+}  // namespace
+
+void HTTP2Connection::setConfig(const Config& config) {
+  Pool& pool = Pool::instance();
+  std::scoped_lock lock(pool.mutex);
+  pool.config = config;
+}
+
+HTTP2Connection::Config HTTP2Connection::getConfig() {
+  Pool& pool = Pool::instance();
+  std::scoped_lock lock(pool.mutex);
+  return pool.config;
+}
+
+std::shared_ptr<HTTP2Connection> HTTP2Connection::acquire(
+    const URLParser& url, std::unique_ptr<bell::Socket>& fallback) {
+  Pool& pool = Pool::instance();
+  bool https = url.schema == "https";
+  std::string key =
+      url.schema + "://" + url.host + ":" + std::to_string(url.port);
+  {
+    std::scoped_lock lock(pool.mutex);
+    if (!pool.config.enabled || (!https && !pool.config.cleartext) ||
+        pool.http1Hosts.count(key) > 0) {
+      return nullptr;
+    }
+    auto it = pool.connections.find(key);
+    if (it != pool.connections.end()) {
+      if (it->second->isUsable()) {
+        return it->second;
+      }
+      pool.connections.erase(it);
+    }
+  }
+
+  std::unique_ptr<bell::Socket> socket;
+  if (https) {
+    auto tlsSocket = std::make_unique<bell::TLSSocket>();
+    tlsSocket->setTimeouts(HTTPClient::getTimeouts());
+    tlsSocket->setOfferHTTP2(true);
+    tlsSocket->open(url.host, url.port);
+    if (tlsSocket->getProtocol() != "h2") {
+      std::scoped_lock lock(pool.mutex);
+      pool.http1Hosts.insert(key);
+      fallback = std::move(tlsSocket);
+      return nullptr;
+    }
+    socket = std::move(tlsSocket);
+  } else {
+    socket = std::make_unique<bell::TCPSocket>();
+    socket->setTimeouts(HTTPClient::getTimeouts());
+    socket->open(url.host, url.port);
+  }
+
+  auto connection = std::make_shared<HTTP2Connection>(std::move(socket));
+  std::scoped_lock lock(pool.mutex);
+  pool.connections[key] = connection;
+  return connection;
+}
+
+HTTP2Connection::HTTP2Connection(std::unique_ptr<bell::Socket> socket)
+    : socket(std::move(socket)),
+      frame(Allocator::allocateBuffer(MAX_FRAME_SIZE)) {
+  std::vector<uint8_t> out(PREFACE, PREFACE + sizeof(PREFACE) - 1);
+
+  uint8_t settings[18];
+  const std::pair<uint16_t, uint32_t> values[] = {
+      {ENABLE_PUSH, 0},
+      {INITIAL_WINDOW_SIZE, BELL_HTTP2_STREAM_WINDOW},
+      {MAX_HEADER_LIST_SIZE, 16 * 1024},
+  };
+  for (size_t i = 0; i < 3; i++) {
+    writeBE(settings + i * 6, values[i].first, 2);
+    writeBE(settings + i * 6 + 2, values[i].second, 4);
+  }
+  appendFrame(out, SETTINGS, 0, 0, settings, sizeof(settings));
+  appendWindowUpdate(out, 0, BELL_HTTP2_CONNECTION_WINDOW - DEFAULT_WINDOW);
+
+  std::scoped_lock lock(ioMutex);
+  if (!writeAll(out.data(), out.size())) {
+    throw std::runtime_error("HTTP/2 preface failed");
+  }
+}
+
+HTTP2Connection::~HTTP2Connection() {
+  socket->close();
+}
+
+bool HTTP2Connection::writeAll(const uint8_t* data, size_t length) {
+  while (length > 0) {
+    size_t written = socket->write(const_cast<uint8_t*>(data), length);
+    if (written == 0 || written > length) {
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+bool HTTP2Connection::readAll(uint8_t* data, size_t length) {
+  while (length > 0) {
+    size_t len = socket->read(data, length);
+    if (len == 0 || len > length) {
+      return false;
+    }
+    data += len;
+    length -= len;
+  }
+  return true;
+}
+
+void HTTP2Connection::writeFrames(const std::vector<uint8_t>& frames) {
+  if (frames.empty()) {
+    return;
+  }
+  std::scoped_lock lock(ioMutex);
+  if (!writeAll(frames.data(), frames.size())) {
+    std::scoped_lock stateLock(mutex);
+    fail();
+  }
+}
+
+bool HTTP2Connection::isUsable() {
+  std::unique_lock lock(mutex);
+  if (!reading && !dead) {
+    // Takes in what arrived while idle, e.g. a GOAWAY or the close
+    reading = true;
+    lock.unlock();
+    bool alive = true;
+    while (alive && (socket->poll() > 0 ||
+                     socketReadable(socket->getFd(), 0))) {
+      alive = readFrame();
+    }
+    lock.lock();
+    reading = false;
+    if (!alive) {
+      fail();
+    }
+    changed.notify_all();
+  }
+  return !dead && goAwayId == UINT32_MAX && nextStreamId < 0x7fffffff;
+}
+
+bool HTTP2Connection::waitFor(std::unique_lock<std::mutex>& lock,
+                              const std::function<bool()>& ready) {
+  while (!ready()) {
+    if (dead) {
+      return false;
+    }
+    if (reading) {
+      changed.wait(lock);
+      continue;
+    }
+
+    reading = true;
+    lock.unlock();
+    bool alive = readFrame();
+    lock.lock();
+    reading = false;
+    if (!alive) {
+      fail();
+    }
+    changed.notify_all();
+  }
+  return true;
+}
+
+bool HTTP2Connection::readFrame() {
+  uint8_t header[FRAME_HEADER_SIZE];
+  size_t length;
+  while (true) {
+    {
+      // Only once there is data, writes would wait for a blocked read
+      std::scoped_lock lock(ioMutex);
+      if (socket->poll() > 0 || socketReadable(socket->getFd(), 0)) {
+        if (!readAll(header, sizeof(header))) {
+          return false;
+        }
+        length = readBE(header, 3);
+        if (length > MAX_FRAME_SIZE || !readAll(frame.get(), length)) {
+          return false;
+        }
+        break;
+      }
+    }
+    socketReadable(socket->getFd(), 100);
+  }
+
+  std::vector<uint8_t> replies;
+  {
+    std::scoped_lock lock(mutex);
+    if (!handleFrame(header[3], header[4], readBE(header + 5, 4) & 0x7fffffff,
+                     frame.get(), length, replies)) {
+      return false;
+    }
+  }
+  writeFrames(replies);
+  return true;
+}
+
+bool HTTP2Connection::handleFrame(uint8_t type, uint8_t flags,
+                                  uint32_t streamId, const uint8_t* payload,
+                                  size_t length,
+                                  std::vector<uint8_t>& replies) {
+  if (headerStream != 0 && (type != CONTINUATION || streamId != headerStream)) {
+    // A header block can't be interrupted
+    return false;
+  }
+
+  auto it = streams.find(streamId);
+  Stream* stream = it != streams.end() ? it->second : nullptr;
+
+  // Padding and priority, ahead of the header block
+  size_t padding = 0;
+  if ((type == DATA || type == HEADERS) && (flags & PADDED)) {
+    if (length == 0 || payload[0] >= length) {
+      return false;
+    }
+    padding = payload[0];
+    payload++;
+    length -= padding + 1;
+  }
+
+  switch (type) {
+    case DATA: {
+      size_t frameBytes = length + padding + ((flags & PADDED) ? 1 : 0);
+      if (stream != nullptr && !stream->ended) {
+        stream->body.insert(stream->body.end(), payload, payload + length);
+        stream->ended = flags & END_STREAM;
+        // Padding doesn't reach the reader, it's acknowledged right away
+        consumed(nullptr, frameBytes - length, replies);
+      } else {
+        // Cancelled or finished stream
+        consumed(nullptr, frameBytes, replies);
+      }
+      break;
+    }
+    case HEADERS:
+      if (flags & PRIORITY) {
+        if (length < 5) {
+          return false;
+        }
+        payload += 5;
+        length -= 5;
+      }
+      headerStream = streamId;
+      headerEndStream = flags & END_STREAM;
+      headerBlock.assign(payload, payload + length);
+      if (flags & END_HEADERS) {
+        return handleHeaders();
+      }
+      break;
+    case CONTINUATION:
+      if (headerStream == 0) {
+        return false;
+      }
+      headerBlock.insert(headerBlock.end(), payload, payload + length);
+      if (flags & END_HEADERS) {
+        return handleHeaders();
+      }
+      break;
+    case RST_STREAM:
+      if (stream != nullptr) {
+        BELL_LOG(error, "http2", "Stream %u reset, error %u",
+                 (unsigned)streamId,
+                 (unsigned)(length >= 4 ? readBE(payload, 4) : 0));
+        stream->failed = true;
+      }
+      break;
+    case SETTINGS:
+      if (flags & ACK) {
+        break;
+      }
+      for (size_t i = 0; i + 6 <= length; i += 6) {
+        uint16_t id = readBE(payload + i, 2);
+        uint32_t value = readBE(payload + i + 2, 4);
+        if (id == HEADER_TABLE_SIZE) {
+          peerTableSize = value;
+        } else if (id == MAX_CONCURRENT_STREAMS) {
+          peerMaxStreams = value;
+        } else if (id == INITIAL_WINDOW_SIZE) {
+          // Applies to the open streams as well, by the difference
+          for (auto& open : streams) {
+            open.second->sendWindow += (int32_t)value - initialSendWindow;
+          }
+          initialSendWindow = value;
+        } else if (id == MAX_FRAME_SIZE_SETTING) {
+          peerMaxFrameSize = std::min<size_t>(value, MAX_FRAME_SIZE);
+        }
+      }
+      appendFrame(replies, SETTINGS, ACK, 0, nullptr, 0);
+      break;
+    case PUSH_PROMISE:
+      // Disabled by our settings
+      return false;
+    case PING:
+      if (!(flags & ACK)) {
+        appendFrame(replies, PING, ACK, 0, payload, length);
+      }
+      break;
+    case GOAWAY:
+      goAwayId = length >= 4 ? readBE(payload, 4) & 0x7fffffff : 0;
+      for (auto& open : streams) {
+        if (open.first > goAwayId) {
+          open.second->failed = true;
+        }
+      }
+      break;
+    case WINDOW_UPDATE: {
+      int32_t increment = length >= 4 ? readBE(payload, 4) & 0x7fffffff : 0;
+      if (streamId == 0) {
+        sendWindow += increment;
+      } else if (stream != nullptr) {
+        stream->sendWindow += increment;
+      }
+      break;
+    }
+    default:
+      // Unknown frame types are ignored
+      break;
+  }
+  return true;
+}
+
+bool HTTP2Connection::handleHeaders() {
+  uint32_t streamId = headerStream;
+  headerStream = 0;
+
+  // Decoded even for a stream that's gone, the table must stay in sync
+  HPACK::Headers headers;
+  if (!decoder.decode(headerBlock.data(), headerBlock.size(), headers)) {
+    return false;
+  }
+  headerBlock.clear();
+
+  auto it = streams.find(streamId);
+  if (it == streams.end()) {
+    return true;
+  }
+  Stream* stream = it->second;
+  if (!stream->headersDone) {
+    int status = 0;
+    for (auto& header : headers) {
+      if (header.first == ":status") {
+        status = atoi(header.second.c_str());
+      } else if (header.first == "content-length") {
+        stream->contentLength = strtoul(header.second.c_str(), nullptr, 10);
+      }
+    }
+    if (status >= 100 && status < 200) {
+      // Informational, the real response follows
+      return true;
+    }
+    stream->status = status;
+    stream->headers = std::move(headers);
+    stream->headersDone = true;
+  }
+  // Later blocks are trailers, not passed on
+  if (headerEndStream) {
+    stream->ended = true;
+  }
+  return true;
+}
+
+void HTTP2Connection::fail() {
+  if (!dead) {
+    dead = true;
+    socket->close();
+  }
+  for (auto& open : streams) {
+    open.second->failed = true;
+  }
+  changed.notify_all();
+}
+
+void HTTP2Connection::consumed(Stream* stream, size_t bytes,
+                               std::vector<uint8_t>& replies) {
+  // Acknowledged in batches of half a window
+  if (stream != nullptr) {
+    stream->unacknowledged += bytes;
+    if (!stream->ended &&
+        stream->unacknowledged >= BELL_HTTP2_STREAM_WINDOW / 2) {
+      appendWindowUpdate(replies, stream->id, stream->unacknowledged);
+      stream->unacknowledged = 0;
+    }
+  }
+  unacknowledged += bytes;
+  if (unacknowledged >= BELL_HTTP2_CONNECTION_WINDOW / 2) {
+    appendWindowUpdate(replies, 0, unacknowledged);
+    unacknowledged = 0;
+  }
+}
+
+std::unique_ptr<HTTP2Connection::Stream> HTTP2Connection::request(
+    const std::string& method, const URLParser& url,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    const std::vector<uint8_t>& content) {
+  auto stream = std::make_unique<Stream>(shared_from_this());
+
+  HPACK::Headers block = {
+      {":method", method},
+      {":scheme", url.schema},
+      {":authority", authority(url)},
+      {":path", url.path},
+      {"accept", "*/*"},
+  };
+  for (auto& header : headers) {
+    std::string name = header.first;
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (!connectionSpecific(name)) {
+      block.push_back({name, header.second});
+    }
+  }
+  if (!content.empty()) {
+    block.push_back({"content-length", std::to_string(content.size())});
+  }
+
+  {
+    std::unique_lock lock(mutex);
+    if (!waitFor(lock, [this]() { return streams.size() < peerMaxStreams; })) {
+      throw std::runtime_error("HTTP/2 connection closed");
+    }
+  }
+
+  {
+    // Stream ids have to reach the server in order, so they're taken while
+    // holding the socket
+    std::scoped_lock io(ioMutex);
+    size_t maxFrame;
+    {
+      std::scoped_lock lock(mutex);
+      if (dead || goAwayId != UINT32_MAX) {
+        throw std::runtime_error("HTTP/2 connection closed");
+      }
+      stream->id = nextStreamId;
+      nextStreamId += 2;
+      stream->sendWindow = initialSendWindow;
+      streams[stream->id] = stream.get();
+      if (peerTableSize != SIZE_MAX) {
+        encoder.setMaxTableSize(peerTableSize);
+        peerTableSize = SIZE_MAX;
+      }
+      maxFrame = peerMaxFrameSize;
+    }
+
+    std::vector<uint8_t> encoded;
+    encoder.encode(block, encoded);
+    // HEADERS, then CONTINUATION frames for what doesn't fit
+    std::vector<uint8_t> out;
+    size_t sent = 0;
+    do {
+      size_t length = std::min(maxFrame, encoded.size() - sent);
+      uint8_t flags = sent + length == encoded.size() ? END_HEADERS : 0;
+      if (sent == 0 && content.empty()) {
+        flags |= END_STREAM;
+      }
+      appendFrame(out, sent == 0 ? HEADERS : CONTINUATION, flags, stream->id,
+                  encoded.data() + sent, length);
+      sent += length;
+    } while (sent < encoded.size());
+    if (!writeAll(out.data(), out.size())) {
+      std::scoped_lock lock(mutex);
+      fail();
+      throw std::runtime_error("HTTP/2 write failed");
+    }
+  }
+
+  // The body goes out as the flow control windows allow
+  for (size_t sent = 0; sent < content.size();) {
+    size_t length;
+    {
+      std::unique_lock lock(mutex);
+      Stream* pending = stream.get();
+      if (!waitFor(lock, [this, pending]() {
+            return pending->failed ||
+                   (sendWindow > 0 && pending->sendWindow > 0);
+          }) ||
+          pending->failed) {
+        throw std::runtime_error("HTTP/2 request failed");
+      }
+      length = std::min({content.size() - sent, peerMaxFrameSize,
+                         (size_t)sendWindow, (size_t)pending->sendWindow});
+      sendWindow -= length;
+      pending->sendWindow -= length;
+    }
+    std::vector<uint8_t> out;
+    bool last = sent + length == content.size();
+    appendFrame(out, DATA, last ? END_STREAM : 0, stream->id,
+                content.data() + sent, length);
+    writeFrames(out);
+    sent += length;
+  }
+
+  std::unique_lock lock(mutex);
+  Stream* pending = stream.get();
+  if (!waitFor(lock, [pending]() {
+        return pending->headersDone || pending->failed;
+      }) ||
+      !pending->headersDone) {
+    throw std::runtime_error("HTTP/2 request failed");
+  }
+  return stream;
+}
+
+void HTTP2Connection::cancel(Stream& stream, std::vector<uint8_t>& replies) {
+  if (!stream.ended && !stream.failed && !dead) {
+    appendReset(replies, stream.id, CANCEL);
+  }
+  stream.failed = true;
+  // What's still buffered won't be read, it's given back to the connection
+  consumed(nullptr, stream.body.size() - stream.bodyPos, replies);
+  stream.body.clear();
+  stream.bodyPos = 0;
+}
+
+HTTP2Connection::Stream::Stream(std::shared_ptr<HTTP2Connection> connection)
+    : connection(std::move(connection)) {}
+
+HTTP2Connection::Stream::~Stream() {
+  std::vector<uint8_t> replies;
+  {
+    std::scoped_lock lock(connection->mutex);
+    if (id != 0) {
+      connection->cancel(*this, replies);
+      connection->streams.erase(id);
+    }
+  }
+  connection->writeFrames(replies);
+}
+
+size_t HTTP2Connection::Stream::read(uint8_t* buf, size_t nbytes) {
+  std::vector<uint8_t> replies;
+  size_t len;
+  {
+    std::unique_lock lock(connection->mutex);
+    connection->waitFor(
+        lock, [this]() { return bodyPos < body.size() || ended || failed; });
+    len = std::min(nbytes, body.size() - bodyPos);
+    if (len == 0) {
+      return 0;
+    }
+    memcpy(buf, body.data() + bodyPos, len);
+    bodyPos += len;
+    if (bodyPos == body.size()) {
+      body.clear();
+      bodyPos = 0;
+    }
+    readTotal += len;
+    connection->consumed(this, len, replies);
+  }
+  connection->writeFrames(replies);
+  return len;
+}
+
+size_t HTTP2Connection::Stream::skip(size_t nbytes) {
+  uint8_t scratch[256];
+  size_t skipped = 0;
+  while (skipped < nbytes) {
+    size_t len = read(scratch, std::min(sizeof(scratch), nbytes - skipped));
+    if (len == 0) {
+      break;
+    }
+    skipped += len;
+  }
+  return skipped;
+}
+
+void HTTP2Connection::Stream::close() {
+  std::vector<uint8_t> replies;
+  {
+    std::scoped_lock lock(connection->mutex);
+    connection->cancel(*this, replies);
+    connection->changed.notify_all();
+  }
+  connection->writeFrames(replies);
+}
+
+bool HTTP2Connection::Stream::finished() {
+  std::scoped_lock lock(connection->mutex);
+  return ended && !failed && bodyPos == body.size();
+}
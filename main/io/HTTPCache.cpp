@@ -0,0 +1,254 @@
+#include "HTTPCache.h"
+
+#include <stdint.h>    // for uint32_t, uint64_t
+#include <stdio.h>     // for fopen, fread, fwrite, snprintf
+#include <sys/stat.h>  // for mkdir
+#include <algorithm>   // for transform
+#include <cctype>      // for tolower
+#include <utility>     // for move
+
+#include "BellLogger.h"   // for BELL_LOG
+#include "BellMetrics.h"  // for BELL_METRIC_COUNT
+
+using namespace bell;
+
+namespace {
+constexpr uint32_t ENTRY_MAGIC = 0x31434842;  // "BHC1"
+
+std::string lowercase(std::string_view value) {
+  std::string lower(value);
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return lower;
+}
+
+std::string trim(std::string_view value) {
+  size_t start = value.find_first_not_of(" \t");
+  if (start == std::string_view::npos) {
+    return "";
+  }
+  size_t end = value.find_last_not_of(" \t");
+  return std::string(value.substr(start, end - start + 1));
+}
+
+// Request headers named by vary, in the order the server listed them
+std::string variantOf(const std::string& vary,
+                      const HTTPClient::Headers& headers) {
+  std::string variant;
+  size_t start = 0;
+  while (start < vary.size()) {
+    size_t end = vary.find(',', start);
+    if (end == std::string::npos) {
+      end = vary.size();
+    }
+    std::string name = lowercase(trim(vary.substr(start, end - start)));
+    start = end + 1;
+    if (name.empty()) {
+      continue;
+    }
+    variant += name + ":";
+    for (auto& header : headers) {
+      if (lowercase(header.first) == name) {
+        variant += " " + header.second;
+      }
+    }
+    variant += "\n";
+  }
+  return variant;
+}
+
+void writeField(FILE* file, const void* data, uint32_t length, bool& ok) {
+  ok = ok && fwrite(&length, sizeof(length), 1, file) == 1 &&
+       (length == 0 || fwrite(data, 1, length, file) == length);
+}
+
+template <typename Container>
+bool readField(FILE* file, Container& field) {
+  uint32_t length;
+  if (fread(&length, sizeof(length), 1, file) != 1 || length > 1024 * 1024) {
+    return false;
+  }
+  field.resize(length);
+  return length == 0 || fread(field.data(), 1, length, file) == length;
+}
+}  // namespace
+
+bool HTTPCache::MemoryStore::load(const std::string& url, Entry& entry) {
+  std::scoped_lock lock(mutex);
+  auto it = index.find(url);
+  if (it == index.end()) {
+    return false;
+  }
+  entries.splice(entries.begin(), entries, it->second);
+  entry = *it->second;
+  return true;
+}
+
+void HTTPCache::MemoryStore::store(const Entry& entry) {
+  std::scoped_lock lock(mutex);
+  auto it = index.find(entry.url);
+  if (it != index.end()) {
+    erase(it->second);
+  }
+  if (entry.body.size() > maxBytes) {
+    return;
+  }
+  while (usedBytes + entry.body.size() > maxBytes) {
+    erase(std::prev(entries.end()));
+  }
+  entries.push_front(entry);
+  index[entry.url] = entries.begin();
+  usedBytes += entry.body.size();
+}
+
+void HTTPCache::MemoryStore::remove(const std::string& url) {
+  std::scoped_lock lock(mutex);
+  auto it = index.find(url);
+  if (it != index.end()) {
+    erase(it->second);
+  }
+}
+
+void HTTPCache::MemoryStore::erase(std::list<Entry>::iterator it) {
+  usedBytes -= it->body.size();
+  index.erase(it->url);
+  entries.erase(it);
+}
+
+HTTPCache::FileStore::FileStore(const std::string& dir) : dir(dir) {
+#ifdef _WIN32
+  mkdir(dir.c_str());
+#else
+  mkdir(dir.c_str(), 0777);
+#endif
+}
+
+std::string HTTPCache::FileStore::entryPath(const std::string& url) {
+  // FNV-1a, the URL itself is stored in the entry to rule out collisions
+  uint64_t hash = 0xcbf29ce484222325;
+  for (char c : url) {
+    hash = (hash ^ (uint8_t)c) * 0x100000001b3;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.http", (unsigned long long)hash);
+  return dir + name;
+}
+
+bool HTTPCache::FileStore::load(const std::string& url, Entry& entry) {
+  std::scoped_lock lock(mutex);
+  FILE* file = fopen(entryPath(url).c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  uint32_t magic = 0;
+  bool ok = fread(&magic, sizeof(magic), 1, file) == 1 &&
+            magic == ENTRY_MAGIC && readField(file, entry.url) &&
+            readField(file, entry.etag) &&
+            readField(file, entry.lastModified) &&
+            readField(file, entry.vary) && readField(file, entry.variant) &&
+            readField(file, entry.contentType) && readField(file, entry.body);
+  fclose(file);
+  return ok && entry.url == url;
+}
+
+void HTTPCache::FileStore::store(const Entry& entry) {
+  std::scoped_lock lock(mutex);
+  // Written aside and renamed, a power loss mid-write leaves the old entry
+  std::string path = entryPath(entry.url);
+  std::string tmpPath = path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == nullptr) {
+    BELL_LOG(error, "HTTPCache", "Can't write %s", tmpPath.c_str());
+    return;
+  }
+
+  bool ok = fwrite(&ENTRY_MAGIC, sizeof(ENTRY_MAGIC), 1, file) == 1;
+  for (const std::string* field :
+       {&entry.url, &entry.etag, &entry.lastModified, &entry.vary,
+        &entry.variant, &entry.contentType}) {
+    writeField(file, field->data(), field->size(), ok);
+  }
+  writeField(file, entry.body.data(), entry.body.size(), ok);
+  ok = fclose(file) == 0 && ok;
+
+  // FAT can't rename over an existing file
+  ::remove(path.c_str());
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    BELL_LOG(error, "HTTPCache", "Can't write %s", path.c_str());
+    ::remove(tmpPath.c_str());
+  }
+}
+
+void HTTPCache::FileStore::remove(const std::string& url) {
+  std::scoped_lock lock(mutex);
+  ::remove(entryPath(url).c_str());
+}
+
+HTTPCache::HTTPCache(std::unique_ptr<Store> store) : store(std::move(store)) {}
+
+HTTPCache::Result HTTPCache::get(const std::string& url,
+                                 const HTTPClient::Headers& headers) {
+  requests++;
+  BELL_METRIC_COUNT("httpcache.requests", 1);
+
+  Entry entry;
+  bool cached = store->load(url, entry) &&
+                variantOf(entry.vary, headers) == entry.variant;
+  HTTPClient::Headers requestHeaders = headers;
+  if (cached) {
+    if (!entry.etag.empty()) {
+      requestHeaders.push_back({"If-None-Match", entry.etag});
+    }
+    if (!entry.lastModified.empty()) {
+      requestHeaders.push_back({"If-Modified-Since", entry.lastModified});
+    }
+  }
+
+  auto response = HTTPClient::get(url, requestHeaders);
+  int status = response->status();
+  if (status == 304 && cached) {
+    // Reads the empty body, so the connection can be reused
+    response->body();
+    hits++;
+    BELL_METRIC_COUNT("httpcache.hits", 1);
+
+    // The server may hand out new validators along with the 304
+    std::string etag = std::string(response->header("etag"));
+    if (!etag.empty() && etag != entry.etag) {
+      entry.etag = etag;
+      store->store(entry);
+    }
+    return {200, std::move(entry.body), entry.contentType, true};
+  }
+
+  Result result = {status, response->bytes(),
+                   std::string(response->header("content-type")), false};
+  if (status != 200) {
+    return result;
+  }
+
+  entry.url = url;
+  entry.etag = std::string(response->header("etag"));
+  entry.lastModified = std::string(response->header("last-modified"));
+  entry.vary = std::string(response->header("vary"));
+  std::string cacheControl = lowercase(response->header("cache-control"));
+  if ((entry.etag.empty() && entry.lastModified.empty()) ||
+      cacheControl.find("no-store") != std::string::npos ||
+      entry.vary.find('*') != std::string::npos) {
+    if (cached) {
+      store->remove(url);
+    }
+    return result;
+  }
+
+  entry.variant = variantOf(entry.vary, headers);
+  entry.contentType = result.contentType;
+  entry.body = result.body;
+  store->store(entry);
+  return result;
+}
+
+void HTTPCache::invalidate(const std::string& url) {
+  store->remove(url);
+}
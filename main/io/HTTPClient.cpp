@@ -1,18 +1,251 @@
 #include "HTTPClient.h"
 
-#include <string.h>   // for memcpy
-#include <algorithm>  // for transform
+#include <stdlib.h>   // for strtoul
+#include <string.h>   // for memcpy, memcmp, memmove
+#include <algorithm>  // for transform, count_if, find_if
 #include <cassert>    // for assert
-#include <cctype>     // for tolower
+#include <cctype>     // for tolower, isxdigit
+#include <iterator>   // for next
 #include <ostream>    // for operator<<, basic_ostream
 #include <stdexcept>  // for runtime_error
-
-#include "BellSocket.h"  // for bell
+#include <utility>    // for move
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>  // for select, fd_set
+#endif
 
 using namespace bell;
 
+// An idle connection has nothing to read, unless the server closed it
+static bool isStale(bell::Socket& socket) {
+  if (!socket.isOpen()) {
+    return true;
+  }
+  int fd = socket.getFd();
+  fd_set readable;
+  FD_ZERO(&readable);
+  FD_SET(fd, &readable);
+  struct timeval timeout = {0, 0};
+  return select(fd + 1, &readable, NULL, NULL, &timeout) != 0;
+}
+
+HTTPClient::ConnectionPool::ConnectionPool() : ConnectionPool(Config()) {}
+
+HTTPClient::ConnectionPool::ConnectionPool(Config config) : config(config) {}
+
+void HTTPClient::ConnectionPool::setConfig(const Config& config) {
+  std::scoped_lock lock(mutex);
+  this->config = config;
+  evictExpired();
+}
+
+std::unique_ptr<bell::Socket> HTTPClient::ConnectionPool::acquire(
+    const std::string& key) {
+  std::scoped_lock lock(mutex);
+  evictExpired();
+
+  // Most recent first, it's the least likely to be dropped by the server
+  for (auto it = idle.rbegin(); it != idle.rend(); it++) {
+    if (it->key != key) {
+      continue;
+    }
+    auto socket = std::move(it->socket);
+    idle.erase(std::next(it).base());
+    if (!isStale(*socket)) {
+      return socket;
+    }
+    // Others to this host are older, and likely stale as well
+    break;
+  }
+
+  // A new connection is about to be opened, make room for it
+  if (!idle.empty() && idle.size() >= config.maxIdle) {
+    idle.erase(idle.begin());
+  }
+  return nullptr;
+}
+
+void HTTPClient::ConnectionPool::release(const std::string& key,
+                                         std::unique_ptr<bell::Socket> socket) {
+  std::scoped_lock lock(mutex);
+  evictExpired();
+
+  size_t sameHost = std::count_if(
+      idle.begin(), idle.end(), [&](const Idle& it) { return it.key == key; });
+  if (sameHost >= config.maxIdlePerHost) {
+    // Drop the oldest one to that host
+    idle.erase(std::find_if(idle.begin(), idle.end(),
+                            [&](const Idle& it) { return it.key == key; }));
+  }
+  if (idle.size() >= config.maxIdle && !idle.empty()) {
+    idle.erase(idle.begin());
+  }
+  if (config.maxIdle > 0 && config.maxIdlePerHost > 0) {
+    idle.push_back({key, std::move(socket), std::chrono::steady_clock::now()});
+  }
+}
+
+void HTTPClient::ConnectionPool::clear() {
+  std::scoped_lock lock(mutex);
+  idle.clear();
+}
+
+size_t HTTPClient::ConnectionPool::idleCount() {
+  std::scoped_lock lock(mutex);
+  return idle.size();
+}
+
+void HTTPClient::ConnectionPool::evictExpired() {
+  auto expired = std::chrono::steady_clock::now() -
+                 std::chrono::milliseconds(config.idleTimeoutMs);
+  while (!idle.empty() && idle.front().since < expired) {
+    idle.erase(idle.begin());
+  }
+  while (idle.size() > config.maxIdle) {
+    idle.erase(idle.begin());
+  }
+}
+
+HTTPClient::ConnectionPool& HTTPClient::connectionPool() {
+  static ConnectionPool pool;
+  return pool;
+}
+
+namespace {
+Socket::Timeouts& httpTimeouts() {
+  static Socket::Timeouts timeouts = {15000, 15000};
+  return timeouts;
+}
+}  // namespace
+
+void HTTPClient::setTimeouts(const Socket::Timeouts& timeouts) {
+  httpTimeouts() = timeouts;
+}
+
+Socket::Timeouts HTTPClient::getTimeouts() {
+  return httpTimeouts();
+}
+
+HTTPClient::Response::Pool& HTTPClient::Response::pool() {
+  static Pool pool("http_client");
+  return pool;
+}
+
+void HTTPClient::BodyStream::reset(bool chunked, size_t length) {
+  this->chunked = chunked;
+  this->length = length;
+  this->readPosition = 0;
+  this->chunkLeft = 0;
+  this->firstChunk = true;
+  this->lastChunk = false;
+  raw.setLimit(chunked ? SIZE_MAX : length);
+}
+
+bool HTTPClient::BodyStream::readLine(std::string& line) {
+  line.clear();
+  uint8_t c;
+  // Chunk lines are short, and come from the socket's buffer
+  while (raw.read(&c, 1) == 1) {
+    if (c == '\n') {
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      return true;
+    }
+    if (line.size() >= 256) {
+      return false;
+    }
+    line.push_back(c);
+  }
+  return false;
+}
+
+bool HTTPClient::BodyStream::nextChunk() {
+  std::string line;
+  // Every chunk but the first follows the CRLF ending the previous one
+  if (!firstChunk && (!readLine(line) || !line.empty())) {
+    return false;
+  }
+  firstChunk = false;
+
+  // Size in hex, optionally followed by extensions
+  if (!readLine(line) || line.empty() || !isxdigit((unsigned char)line[0])) {
+    return false;
+  }
+  chunkLeft = strtoul(line.c_str(), nullptr, 16);
+
+  if (chunkLeft == 0) {
+    // Skip the trailer, up to the empty line
+    while (readLine(line) && !line.empty()) {
+    }
+    lastChunk = line.empty();
+    return false;
+  }
+  return true;
+}
+
+size_t HTTPClient::BodyStream::read(uint8_t* buf, size_t nbytes) {
+  if (!chunked) {
+    size_t len = raw.read(buf, nbytes);
+    readPosition += len;
+    return len;
+  }
+
+  if (chunkLeft == 0 && (lastChunk || !nextChunk())) {
+    return 0;
+  }
+  size_t len = raw.read(buf, std::min(nbytes, chunkLeft));
+  chunkLeft -= len;
+  readPosition += len;
+  return len;
+}
+
+size_t HTTPClient::BodyStream::skip(size_t nbytes) {
+  uint8_t scratch[256];
+  size_t skipped = 0;
+  while (skipped < nbytes) {
+    size_t len = read(scratch, std::min(sizeof(scratch), nbytes - skipped));
+    if (len == 0) {
+      break;
+    }
+    skipped += len;
+  }
+  return skipped;
+}
+
+bool HTTPClient::BodyStream::finished() {
+  if (chunked) {
+    return lastChunk;
+  }
+  return length != SIZE_MAX && readPosition == length;
+}
+
 void HTTPClient::Response::connect(const std::string& url) {
   urlParser = bell::URLParser::parse(url);
+  poolKey = urlParser.schema + "://" + urlParser.host + ":" +
+            std::to_string(urlParser.port);
+  this->http2Stream.reset();
+  this->http2.reset();
+  this->socketStream.rdbuf()->setTimeouts(getTimeouts());
+  this->socketStream.rdbuf()->setProfile(profile);
+
+  auto socket = connectionPool().acquire(poolKey);
+  if (socket != nullptr) {
+    this->socketStream.attach(std::move(socket));
+    this->reused = true;
+    return;
+  }
+
+  // Hosts that picked HTTP/1.1 hand back the connection negotiating it
+  this->http2 = HTTP2Connection::acquire(urlParser, socket);
+  if (this->http2 != nullptr) {
+    return;
+  }
+  if (socket != nullptr) {
+    this->socketStream.attach(std::move(socket));
+    return;
+  }
 
   // Open socket of type
   this->socketStream.open(urlParser.host, urlParser.port,
@@ -20,17 +253,76 @@ void HTTPClient::Response::connect(const std::string& url) {
 }
 
 HTTPClient::Response::~Response() {
-  if (this->socketStream.isOpen()) {
+  if (this->socketStream.isOpen() && keepAlive && bodyConsumed()) {
+    connectionPool().release(poolKey, this->socketStream.release());
+  } else if (this->socketStream.isOpen()) {
     this->socketStream.close();
   }
 }
 
+bool HTTPClient::Response::bodyConsumed() {
+  // Whatever is left would be taken for the next response
+  return socketStream.good() && socketStream.rdbuf()->buffered() == 0 &&
+         bodyStream.finished();
+}
+
 void HTTPClient::Response::rawRequest(const std::string& url,
                                       const std::string& method,
                                       const std::vector<uint8_t>& content,
                                       Headers& headers) {
   urlParser = bell::URLParser::parse(url);
 
+  if (http2 != nullptr) {
+    try {
+      requestHTTP2(method, content, headers);
+    } catch (const std::exception&) {
+      // The connection may have gone away in between, retry on a new one
+      std::unique_ptr<bell::Socket> fallback;
+      http2 = HTTP2Connection::acquire(urlParser, fallback);
+      if (http2 == nullptr) {
+        throw;
+      }
+      requestHTTP2(method, content, headers);
+    }
+    return;
+  }
+
+  try {
+    writeRequest(method, content, headers);
+    readResponseHeaders();
+  } catch (const std::exception&) {
+    if (!reused) {
+      throw;
+    }
+
+    // The server closed the pooled connection, retry on a new one
+    reused = false;
+    socketStream.close();
+    socketStream.clear();
+    socketStream.open(urlParser.host, urlParser.port,
+                      urlParser.schema == "https");
+    writeRequest(method, content, headers);
+    readResponseHeaders();
+  }
+}
+
+void HTTPClient::Response::requestHTTP2(const std::string& method,
+                                        const std::vector<uint8_t>& content,
+                                        Headers& headers) {
+  this->http2Stream.reset();
+  this->headerCount = 0;
+  this->keepAlive = false;
+  this->statusCode = 0;
+
+  this->http2Stream = http2->request(method, urlParser, headers, content);
+  this->statusCode = http2Stream->status;
+  // Framed by the protocol, never chunked
+  setupBody(false);
+}
+
+void HTTPClient::Response::writeRequest(const std::string& method,
+                                        const std::vector<uint8_t>& content,
+                                        Headers& headers) {
   // Prepare a request
   const char* reqEnd = "\r\n";
 
@@ -57,13 +349,19 @@ void HTTPClient::Response::rawRequest(const std::string& url,
   }
 
   socketStream.flush();
+}
 
-  // Parse response
-  readResponseHeaders();
+// FNV-1a of the lowercase name, header names are case insensitive
+static uint32_t headerHash(std::string_view name) {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : name) {
+    hash ^= (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    hash *= 16777619u;
+  }
+  return hash;
 }
 
 void HTTPClient::Response::readResponseHeaders() {
-  char *method, *path;
   const char* msgPointer;
 
   size_t msgLen;
@@ -71,16 +369,36 @@ void HTTPClient::Response::readResponseHeaders() {
 
   size_t prevbuflen = 0, numHeaders;
   this->httpBufferAvailable = 0;
+  this->headerCount = 0;
+  this->keepAlive = false;
+  this->statusCode = 0;
 
   while (1) {
-    socketStream.getline((char*)httpBuffer.data() + httpBufferAvailable,
-                         httpBuffer.size() - httpBufferAvailable);
+    // Usually gets the whole header block at once
+    size_t len = socketStream.rdbuf()->readSome(
+        httpBuffer.data() + httpBufferAvailable,
+        httpBuffer.size() - httpBufferAvailable);
+    if (len == 0) {
+      throw std::runtime_error("Connection closed");
+    }
 
     prevbuflen = httpBufferAvailable;
-    httpBufferAvailable += socketStream.gcount();
+    httpBufferAvailable += len;
 
-    // Restore delimiters
-    memcpy(httpBuffer.data() + httpBufferAvailable - 2, "\r\n", 2);
+    // SHOUTcast answers "ICY 200 OK", parsed as the HTTP/1.0 it stands for
+    if (httpBufferAvailable < 4 &&
+        memcmp(httpBuffer.data(), "ICY ", httpBufferAvailable) == 0) {
+      continue;
+    }
+    if (prevbuflen < 4 && httpBufferAvailable >= 4 &&
+        memcmp(httpBuffer.data(), "ICY ", 4) == 0 &&
+        httpBufferAvailable + 5 <= httpBuffer.size()) {
+      memmove(httpBuffer.data() + 8, httpBuffer.data() + 3,
+              httpBufferAvailable - 3);
+      memcpy(httpBuffer.data(), "HTTP/1.0", 8);
+      httpBufferAvailable += 5;
+      prevbuflen = 0;
+    }
 
     // Parse the request
     numHeaders = sizeof(phResponseHeaders) / sizeof(phResponseHeaders[0]);
@@ -101,22 +419,79 @@ void HTTPClient::Response::readResponseHeaders() {
       throw std::runtime_error("Response too large");
   }
 
-  this->responseHeaders = {};
+  // The start of the body came along, hand it back to the stream
+  socketStream.rdbuf()->unread(httpBuffer.data() + pret,
+                               httpBufferAvailable - pret);
 
-  // Headers have benen read
+  // Headers have benen read, they stay in httpBuffer
+  this->statusCode = status;
+  this->headerCount = numHeaders;
   for (int headerIndex = 0; headerIndex < numHeaders; headerIndex++) {
-    this->responseHeaders.push_back(
-        ValueHeader{std::string(phResponseHeaders[headerIndex].name,
-                                phResponseHeaders[headerIndex].name_len),
-                    std::string(phResponseHeaders[headerIndex].value,
-                                phResponseHeaders[headerIndex].value_len)});
+    this->headerHashes[headerIndex] =
+        headerHash(std::string_view(phResponseHeaders[headerIndex].name,
+                                    phResponseHeaders[headerIndex].name_len));
   }
 
+  std::string encoding = std::string(header("transfer-encoding"));
+  std::transform(encoding.begin(), encoding.end(), encoding.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  // Content-Length must be ignored for a chunked body
+  bool chunked = encoding.find("chunked") != std::string::npos;
+  setupBody(chunked);
+
+  // Without a length, the body ends with the connection
+  std::string connection = std::string(header("connection"));
+  std::transform(connection.begin(), connection.end(), connection.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  this->keepAlive = (hasContentSize || chunked) && minorVersion >= 1 &&
+                    connection != "close";
+}
+
+void HTTPClient::Response::setupBody(bool chunked) {
+  this->hasContentSize = false;
+  this->contentSize = 0;
+
   std::string contentLengthValue = std::string(header("content-length"));
-  if (contentLengthValue.size() > 0) {
+  if (contentLengthValue.size() > 0 && !chunked) {
     this->hasContentSize = true;
     this->contentSize = std::stoi(contentLengthValue);
   }
+  if (statusCode < 200 || statusCode == 204 || statusCode == 304) {
+    // Never has a body, whatever the headers say
+    this->hasContentSize = true;
+    this->contentSize = 0;
+    chunked = false;
+  }
+  this->rawBodyRead = false;
+  this->rawBody.clear();
+  if (http2Stream == nullptr) {
+    bodyStream.reset(chunked, hasContentSize ? contentSize : SIZE_MAX);
+  }
+
+  std::string contentEncoding = std::string(header("content-encoding"));
+  std::transform(contentEncoding.begin(), contentEncoding.end(),
+                 contentEncoding.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  this->inflating = (contentEncoding == "gzip" ||
+                     contentEncoding == "x-gzip" ||
+                     contentEncoding == "deflate") &&
+                    !(hasContentSize && contentSize == 0);
+  if (inflating && inflateStream == nullptr) {
+    inflateStream = std::make_unique<bell::InflateStream>(rawStream());
+  } else if (inflating) {
+    inflateStream->reset(rawStream());
+  }
+
+  std::string metaInt = std::string(header("icy-metaint"));
+  size_t interval = strtoul(metaInt.c_str(), nullptr, 10);
+  this->icy = interval > 0;
+  bell::ByteStream& audio =
+      inflating ? (bell::ByteStream&)*inflateStream : rawStream();
+  if (icy && icyStream == nullptr) {
+    icyStream = std::make_unique<bell::IcyStream>(audio, interval);
+  } else if (icy) {
+    icyStream->reset(audio, interval);
+  }
 }
 
 void HTTPClient::Response::get(const std::string& url, Headers headers) {
@@ -131,16 +506,42 @@ void HTTPClient::Response::post(const std::string& url, Headers headers,
 }
 
 size_t HTTPClient::Response::contentLength() {
+  if (inflating || icy) {
+    return 0;
+  }
   return contentSize;
 }
 
-std::string_view HTTPClient::Response::header(const std::string& headerName) {
-  for (auto& header : this->responseHeaders) {
-    std::string headerValue = header.first;
-    std::transform(headerValue.begin(), headerValue.end(), headerValue.begin(),
-                   [](unsigned char c) { return std::tolower(c); });
-    if (headerName == headerValue) {
-      return header.second;
+std::string_view HTTPClient::Response::header(std::string_view headerName) {
+  if (http2Stream != nullptr) {
+    // Names come lowercase over HTTP/2
+    for (auto& header : http2Stream->headers) {
+      if (header.first.size() == headerName.size() &&
+          std::equal(header.first.begin(), header.first.end(),
+                     headerName.begin(), [](char a, char b) {
+                       return a == std::tolower((unsigned char)b);
+                     })) {
+        return header.second;
+      }
+    }
+    return "";
+  }
+
+  uint32_t hash = headerHash(headerName);
+  for (size_t headerIndex = 0; headerIndex < headerCount; headerIndex++) {
+    const phr_header& header = phResponseHeaders[headerIndex];
+    if (headerHashes[headerIndex] != hash ||
+        header.name_len != headerName.size()) {
+      continue;
+    }
+    // Rule out a collision
+    bool same = true;
+    for (size_t i = 0; i < headerName.size() && same; i++) {
+      same = std::tolower((unsigned char)header.name[i]) ==
+             std::tolower((unsigned char)headerName[i]);
+    }
+    if (same) {
+      return std::string_view(header.value, header.value_len);
     }
   }
 
@@ -159,9 +560,34 @@ size_t HTTPClient::Response::totalLength() {
 }
 
 void HTTPClient::Response::readRawBody() {
-  if (contentSize > 0 && rawBody.size() == 0) {
-    rawBody = std::vector<uint8_t>(contentSize);
-    socketStream.read((char*)rawBody.data(), contentSize);
+  if (rawBodyRead) {
+    return;
+  }
+  rawBodyRead = true;
+
+  // Without a length, the body grows as it's read
+  bool sized = hasContentSize && !inflating && !icy;
+  size_t filled = 0;
+  rawBody.resize(sized ? contentSize : HTTP_BUF_SIZE);
+  while (true) {
+    if (filled == rawBody.size()) {
+      if (sized) {
+        break;
+      }
+      rawBody.resize(rawBody.size() * 2);
+    }
+    size_t len =
+        byteStream().read(rawBody.data() + filled, rawBody.size() - filled);
+    if (len == 0) {
+      break;
+    }
+    filled += len;
+  }
+  rawBody.resize(filled);
+
+  // The compressed data may end before the last chunk of a chunked body,
+  // which has to be read for the connection to be reused
+  while (inflating && rawStream().skip(HTTP_BUF_SIZE) > 0) {
   }
 }
 
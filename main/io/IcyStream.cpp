@@ -0,0 +1,110 @@
+#include "IcyStream.h"
+
+#include <algorithm>  // for min
+
+using namespace bell;
+
+IcyStream::IcyStream(bell::ByteStream& source, size_t metaInt) {
+  reset(source, metaInt);
+}
+
+void IcyStream::reset(bell::ByteStream& source, size_t metaInt) {
+  this->source = &source;
+  this->metaInt = metaInt;
+  this->untilMetadata = metaInt;
+  this->readTotal = 0;
+  this->lastBlock.clear();
+  this->title.clear();
+}
+
+std::string_view IcyStream::field(std::string_view block,
+                                  std::string_view name) {
+  size_t start = block.find(name);
+  while (start != std::string_view::npos) {
+    size_t value = start + name.size();
+    if (block.substr(value, 2) == "='") {
+      value += 2;
+      // Titles may hold quotes themselves, the field ends with a quote and
+      // a semicolon, or with the last quote of the block
+      size_t end = block.find("';", value);
+      if (end == std::string_view::npos) {
+        end = block.rfind('\'');
+        if (end == std::string_view::npos || end < value) {
+          end = block.size();
+        }
+      }
+      return block.substr(value, end - value);
+    }
+    start = block.find(name, start + 1);
+  }
+  return "";
+}
+
+bool IcyStream::readMetadata() {
+  uint8_t length;
+  if (source->read(&length, 1) != 1) {
+    return false;
+  }
+  size_t size = length * 16;
+  size_t filled = 0;
+  while (filled < size) {
+    size_t len =
+        source->read((uint8_t*)metadata.data() + filled, size - filled);
+    if (len == 0) {
+      return false;
+    }
+    filled += len;
+  }
+  untilMetadata = metaInt;
+
+  // Padded with zeros up to the 16 byte unit
+  std::string_view block(metadata.data(), size);
+  block = block.substr(0, block.find('\0'));
+  if (block.empty() || block == lastBlock) {
+    return true;
+  }
+  lastBlock = block;
+  title = field(block, "StreamTitle");
+  if (callback) {
+    callback({field(lastBlock, "StreamTitle"), field(lastBlock, "StreamUrl"),
+              lastBlock});
+  }
+  return true;
+}
+
+size_t IcyStream::transfer(uint8_t* buf, size_t nbytes) {
+  size_t done = 0;
+  while (done < nbytes) {
+    if (metaInt > 0 && untilMetadata == 0 && !readMetadata()) {
+      break;
+    }
+
+    size_t toRead = nbytes - done;
+    if (metaInt > 0) {
+      toRead = std::min(toRead, untilMetadata);
+    }
+    size_t len = buf != nullptr ? source->read(buf + done, toRead)
+                                : source->skip(toRead);
+    if (len == 0) {
+      break;
+    }
+    done += len;
+    readTotal += len;
+    if (metaInt > 0) {
+      untilMetadata -= len;
+    }
+    // The source had no more for now
+    if (len < toRead) {
+      break;
+    }
+  }
+  return done;
+}
+
+size_t IcyStream::read(uint8_t* buf, size_t nbytes) {
+  return transfer(buf, nbytes);
+}
+
+size_t IcyStream::skip(size_t nbytes) {
+  return transfer(nullptr, nbytes);
+}
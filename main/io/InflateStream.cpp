@@ -0,0 +1,414 @@
+#include "InflateStream.h"
+
+#include <string.h>   // for memmove
+#include <algorithm>  // for min
+#include <array>      // for array
+#include <stdexcept>  // for runtime_error
+#include <string>     // for string
+
+using namespace bell;
+
+namespace {
+// Base and extra bits of the length symbols 257..285, RFC 1951 3.2.5
+const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                  15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                  67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                  1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                  4, 4, 4, 4, 5, 5, 5, 5, 0};
+// Same for the distance symbols 0..29
+const uint16_t DISTANCE_BASE[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                    4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                    9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// Order the code length code lengths are sent in
+const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                       11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+[[noreturn]] void corrupt(const char* what) {
+  throw std::runtime_error(std::string("Invalid compressed data: ") + what);
+}
+
+// CRC-32 with polynomial 0xedb88320, reflected, as used by gzip
+uint32_t crcUpdate(uint32_t crc, uint8_t byte) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> crcTable;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t r = i;
+      for (int bit = 0; bit < 8; bit++) {
+        r = (r & 1) ? (r >> 1) ^ 0xedb88320 : r >> 1;
+      }
+      crcTable[i] = r;
+    }
+    return crcTable;
+  }();
+  return (crc >> 8) ^ table[(crc ^ byte) & 0xFF];
+}
+}  // namespace
+
+InflateStream::InflateStream(bell::ByteStream& source)
+    : window(Allocator::allocateBuffer(WINDOW_SIZE)) {
+  reset(source);
+}
+
+void InflateStream::reset(bell::ByteStream& newSource) {
+  source = &newSource;
+  windowPos = 0;
+  outputTotal = 0;
+  inputPos = 0;
+  inputLength = 0;
+  bitBuffer = 0;
+  bitCount = 0;
+  state = State::HEADER;
+  lastBlock = false;
+  storedLeft = 0;
+  copyLength = 0;
+  crc = 0xffffffff;
+  adler = 1;
+}
+
+bool InflateStream::fill(size_t count) {
+  if (inputLength - inputPos >= count) {
+    return true;
+  }
+  memmove(input, input + inputPos, inputLength - inputPos);
+  inputLength -= inputPos;
+  inputPos = 0;
+  while (inputLength < count) {
+    size_t len = source->read(input + inputLength, INPUT_SIZE - inputLength);
+    if (len == 0) {
+      return false;
+    }
+    inputLength += len;
+  }
+  return true;
+}
+
+uint8_t InflateStream::nextByte() {
+  if (!fill(1)) {
+    corrupt("truncated");
+  }
+  return input[inputPos++];
+}
+
+uint32_t InflateStream::bits(int count) {
+  while (bitCount < count) {
+    bitBuffer |= (uint32_t)nextByte() << bitCount;
+    bitCount += 8;
+  }
+  uint32_t value = bitBuffer & ((1u << count) - 1);
+  bitBuffer >>= count;
+  bitCount -= count;
+  return value;
+}
+
+int InflateStream::decode(const Huffman& code) {
+  // Codes of each length are consecutive, starting at first
+  int value = 0, first = 0, index = 0;
+  for (int length = 1; length < 16; length++) {
+    value |= bits(1);
+    int count = code.count[length];
+    if (value - count < first) {
+      return code.symbol[index + (value - first)];
+    }
+    index += count;
+    first = (first + count) << 1;
+    value <<= 1;
+  }
+  corrupt("bad code");
+}
+
+void InflateStream::build(Huffman& code, const uint8_t* lengths, int symbols) {
+  for (auto& count : code.count) {
+    count = 0;
+  }
+  for (int symbol = 0; symbol < symbols; symbol++) {
+    code.count[lengths[symbol]]++;
+  }
+
+  // Incomplete codes are allowed, e.g. a single distance code
+  int left = 1;
+  for (int length = 1; length < 16; length++) {
+    left = (left << 1) - code.count[length];
+    if (left < 0) {
+      corrupt("oversubscribed code");
+    }
+  }
+
+  uint16_t offsets[16];
+  offsets[1] = 0;
+  for (int length = 1; length < 15; length++) {
+    offsets[length + 1] = offsets[length] + code.count[length];
+  }
+  for (int symbol = 0; symbol < symbols; symbol++) {
+    if (lengths[symbol] != 0) {
+      code.symbol[offsets[lengths[symbol]]++] = symbol;
+    }
+  }
+}
+
+void InflateStream::readHeader() {
+  if (!fill(2)) {
+    corrupt("truncated");
+  }
+  uint8_t first = input[inputPos], second = input[inputPos + 1];
+  if (first == 0x1f && second == 0x8b) {
+    container = Container::GZIP;
+    inputPos += 2;
+    if (nextByte() != 8) {
+      corrupt("not deflate");
+    }
+    uint8_t flags = nextByte();
+    // Modification time, extra flags, OS
+    for (int i = 0; i < 6; i++) {
+      nextByte();
+    }
+    if (flags & 0x04) {
+      size_t extra = nextByte();
+      extra |= nextByte() << 8;
+      while (extra-- > 0) {
+        nextByte();
+      }
+    }
+    // Name, then comment, zero terminated
+    for (uint8_t flag : {0x08, 0x10}) {
+      if (flags & flag) {
+        while (nextByte() != 0) {
+        }
+      }
+    }
+    if (flags & 0x02) {
+      nextByte();
+      nextByte();
+    }
+  } else if ((first & 0x0f) == 8 && (first >> 4) <= 7 &&
+             (first * 256 + second) % 31 == 0) {
+    container = Container::ZLIB;
+    inputPos += 2;
+    if (second & 0x20) {
+      corrupt("preset dictionary");
+    }
+  } else {
+    // What some servers send for Content-Encoding: deflate
+    container = Container::RAW;
+  }
+}
+
+void InflateStream::startBlock() {
+  lastBlock = bits(1);
+  switch (bits(2)) {
+    case 0: {
+      // Stored, starts on a byte boundary
+      bitBuffer = 0;
+      bitCount = 0;
+      size_t length = nextByte();
+      length |= nextByte() << 8;
+      size_t complement = nextByte();
+      complement |= nextByte() << 8;
+      if (length != (~complement & 0xffff)) {
+        corrupt("stored length");
+      }
+      storedLeft = length;
+      state = State::STORED;
+      break;
+    }
+    case 1: {
+      uint8_t lengths[288 + 30];
+      // Fixed codes, RFC 1951 3.2.6
+      for (int symbol = 0; symbol < 288; symbol++) {
+        lengths[symbol] = (symbol < 144 || symbol >= 280) ? 8
+                          : symbol < 256                  ? 9
+                                                          : 7;
+      }
+      for (int symbol = 0; symbol < 30; symbol++) {
+        lengths[288 + symbol] = 5;
+      }
+      build(lengthCode, lengths, 288);
+      build(distanceCode, lengths + 288, 30);
+      state = State::HUFFMAN;
+      break;
+    }
+    case 2:
+      readDynamicCodes();
+      state = State::HUFFMAN;
+      break;
+    default:
+      corrupt("block type");
+  }
+}
+
+void InflateStream::readDynamicCodes() {
+  int lengthSymbols = bits(5) + 257;
+  int distanceSymbols = bits(5) + 1;
+  int codeLengthSymbols = bits(4) + 4;
+  if (lengthSymbols > 286 || distanceSymbols > 30) {
+    corrupt("code counts");
+  }
+
+  uint8_t lengths[286 + 30] = {};
+  for (int i = 0; i < codeLengthSymbols; i++) {
+    lengths[CODE_LENGTH_ORDER[i]] = bits(3);
+  }
+  // The code length code goes in distanceCode until the real one is read
+  build(distanceCode, lengths, 19);
+
+  int total = lengthSymbols + distanceSymbols;
+  for (int i = 0; i < 19; i++) {
+    lengths[i] = 0;
+  }
+  for (int index = 0; index < total;) {
+    int symbol = decode(distanceCode);
+    if (symbol < 16) {
+      lengths[index++] = symbol;
+      continue;
+    }
+
+    uint8_t value = 0;
+    int repeat;
+    if (symbol == 16) {
+      if (index == 0) {
+        corrupt("repeat without length");
+      }
+      value = lengths[index - 1];
+      repeat = 3 + bits(2);
+    } else if (symbol == 17) {
+      repeat = 3 + bits(3);
+    } else {
+      repeat = 11 + bits(7);
+    }
+    if (index + repeat > total) {
+      corrupt("too many lengths");
+    }
+    while (repeat-- > 0) {
+      lengths[index++] = value;
+    }
+  }
+
+  if (lengths[256] == 0) {
+    corrupt("no end of block code");
+  }
+  build(lengthCode, lengths, lengthSymbols);
+  build(distanceCode, lengths + lengthSymbols, distanceSymbols);
+}
+
+void InflateStream::readTrailer() {
+  bitBuffer = 0;
+  bitCount = 0;
+  if (container == Container::GZIP) {
+    uint32_t expectedCrc = 0, expectedSize = 0;
+    for (int i = 0; i < 4; i++) {
+      expectedCrc |= (uint32_t)nextByte() << (8 * i);
+    }
+    for (int i = 0; i < 4; i++) {
+      expectedSize |= (uint32_t)nextByte() << (8 * i);
+    }
+    if (expectedCrc != (crc ^ 0xffffffff) ||
+        expectedSize != (uint32_t)outputTotal) {
+      corrupt("checksum");
+    }
+  } else if (container == Container::ZLIB) {
+    uint32_t expectedAdler = 0;
+    for (int i = 0; i < 4; i++) {
+      expectedAdler = (expectedAdler << 8) | nextByte();
+    }
+    if (expectedAdler != adler) {
+      corrupt("checksum");
+    }
+  }
+}
+
+void InflateStream::put(uint8_t* buf, size_t& produced, uint8_t byte) {
+  buf[produced++] = byte;
+  window[windowPos] = byte;
+  windowPos = (windowPos + 1) % WINDOW_SIZE;
+  outputTotal++;
+
+  if (container == Container::GZIP) {
+    crc = crcUpdate(crc, byte);
+  } else if (container == Container::ZLIB) {
+    uint32_t low = ((adler & 0xffff) + byte) % 65521;
+    uint32_t high = ((adler >> 16) + low) % 65521;
+    adler = (high << 16) | low;
+  }
+}
+
+size_t InflateStream::read(uint8_t* buf, size_t nbytes) {
+  size_t produced = 0;
+  while (produced < nbytes) {
+    switch (state) {
+      case State::HEADER:
+        readHeader();
+        state = State::BLOCK;
+        break;
+      case State::BLOCK:
+        if (lastBlock) {
+          state = State::TRAILER;
+        } else {
+          startBlock();
+        }
+        break;
+      case State::STORED:
+        if (storedLeft == 0) {
+          state = State::BLOCK;
+        } else {
+          put(buf, produced, nextByte());
+          storedLeft--;
+        }
+        break;
+      case State::HUFFMAN: {
+        if (copyLength > 0) {
+          size_t from = (windowPos + WINDOW_SIZE - copyDistance) % WINDOW_SIZE;
+          put(buf, produced, window[from]);
+          copyLength--;
+          break;
+        }
+
+        int symbol = decode(lengthCode);
+        if (symbol < 256) {
+          put(buf, produced, symbol);
+        } else if (symbol == 256) {
+          state = State::BLOCK;
+        } else {
+          symbol -= 257;
+          if (symbol >= 29) {
+            corrupt("length symbol");
+          }
+          copyLength = LENGTH_BASE[symbol] + bits(LENGTH_EXTRA[symbol]);
+          int distance = decode(distanceCode);
+          if (distance >= 30) {
+            corrupt("distance symbol");
+          }
+          copyDistance =
+              DISTANCE_BASE[distance] + bits(DISTANCE_EXTRA[distance]);
+          if (copyDistance > outputTotal) {
+            corrupt("distance too far back");
+          }
+        }
+        break;
+      }
+      case State::TRAILER:
+        readTrailer();
+        state = State::DONE;
+        break;
+      case State::DONE:
+        return produced;
+    }
+  }
+  return produced;
+}
+
+size_t InflateStream::skip(size_t nbytes) {
+  uint8_t scratch[256];
+  size_t skipped = 0;
+  while (skipped < nbytes) {
+    size_t len = read(scratch, std::min(sizeof(scratch), nbytes - skipped));
+    if (len == 0) {
+      break;
+    }
+    skipped += len;
+  }
+  return skipped;
+}
@@ -0,0 +1,203 @@
+#include "IoUring.h"
+
+#include <errno.h>        // for errno, ETIME, EINTR
+#include <string.h>       // for memset
+#include <sys/mman.h>     // for mmap, munmap
+#include <sys/syscall.h>  // for __NR_io_uring_setup, __NR_io_uring_enter
+#include <sys/uio.h>      // for iovec
+#include <unistd.h>       // for syscall, close
+#include <algorithm>      // for max, min
+
+#include "BellLogger.h"  // for BELL_LOG
+
+using namespace bell;
+
+IoUring::IoUring(uint32_t entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ringFd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ringFd < 0) {
+    BELL_LOG(info, "IoUring", "io_uring not available, errno %d", errno);
+    ringFd = -1;
+    return;
+  }
+  features = params.features;
+  // Timed waits without a timeout request each round
+  if (!(features & IORING_FEAT_EXT_ARG)) {
+    BELL_LOG(info, "IoUring", "Kernel too old for io_uring timed waits");
+    ::close(ringFd);
+    ringFd = -1;
+    return;
+  }
+
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  // Both rings share a mapping since 5.4
+  if (features & IORING_FEAT_SINGLE_MMAP) {
+    sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+  }
+  sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    sqRing = nullptr;
+  } else if (features & IORING_FEAT_SINGLE_MMAP) {
+    cqRing = sqRing;
+  } else {
+    cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    cqRing = cqRing == MAP_FAILED ? nullptr : cqRing;
+  }
+  sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqeMap = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  sqes = sqeMap == MAP_FAILED ? nullptr : (io_uring_sqe*)sqeMap;
+  if (!sqRing || !cqRing || !sqes) {
+    BELL_LOG(error, "IoUring", "Cannot map the rings");
+    ::close(ringFd);
+    ringFd = -1;
+    return;
+  }
+
+  uint8_t* sq = (uint8_t*)sqRing;
+  sqHead = (uint32_t*)(sq + params.sq_off.head);
+  sqTail = (uint32_t*)(sq + params.sq_off.tail);
+  sqMask = (uint32_t*)(sq + params.sq_off.ring_mask);
+  sqArray = (uint32_t*)(sq + params.sq_off.array);
+  uint8_t* cq = (uint8_t*)cqRing;
+  cqHead = (uint32_t*)(cq + params.cq_off.head);
+  cqTail = (uint32_t*)(cq + params.cq_off.tail);
+  cqMask = (uint32_t*)(cq + params.cq_off.ring_mask);
+  cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+  if (sqes) {
+    munmap(sqes, sqesSize);
+  }
+  if (cqRing && cqRing != sqRing) {
+    munmap(cqRing, cqRingSize);
+  }
+  if (sqRing) {
+    munmap(sqRing, sqRingSize);
+  }
+  if (ringFd >= 0) {
+    ::close(ringFd);
+  }
+}
+
+int IoUring::enter(uint32_t toSubmit, uint32_t minComplete, uint32_t flags,
+                   const void* arg, size_t argSize) {
+  int ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags,
+                    arg, argSize);
+  if (ret < 0) {
+    return -errno;
+  }
+  queued -= std::min<uint32_t>(ret, queued);
+  return ret;
+}
+
+io_uring_sqe* IoUring::nextSqe() {
+  if (!isValid()) {
+    return nullptr;
+  }
+  uint32_t tail = *sqTail;
+  if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > *sqMask) {
+    // Full, the kernel takes the queued entries right away
+    enter(queued, 0, 0, NULL, 0);
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) > *sqMask) {
+      return nullptr;
+    }
+  }
+  uint32_t index = tail & *sqMask;
+  io_uring_sqe* sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray[index] = index;
+  // Only read by the kernel in enter(), once the entry is filled
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+  queued++;
+  return sqe;
+}
+
+bool IoUring::pollAdd(int fd, uint32_t mask, uint64_t userData) {
+  io_uring_sqe* sqe = nextSqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = mask;
+  sqe->user_data = userData;
+  return true;
+}
+
+bool IoUring::pollRemove(uint64_t target, uint64_t userData) {
+  io_uring_sqe* sqe = nextSqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = target;
+  sqe->user_data = userData;
+  return true;
+}
+
+bool IoUring::read(int fd, uint64_t offset, uint8_t* dst, size_t len,
+                   uint64_t userData) {
+  io_uring_sqe* sqe = nextSqe();
+  if (!sqe) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_READ;
+  for (size_t i = 0; i < registered.size(); i++) {
+    if (dst >= registered[i].data() &&
+        dst + len <= registered[i].data() + registered[i].size()) {
+      sqe->opcode = IORING_OP_READ_FIXED;
+      sqe->buf_index = i;
+      break;
+    }
+  }
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = (uint64_t)dst;
+  sqe->len = len;
+  sqe->user_data = userData;
+  return true;
+}
+
+bool IoUring::registerBuffers(const std::vector<std::span<uint8_t>>& buffers) {
+  if (!isValid()) {
+    return false;
+  }
+  if (!registered.empty()) {
+    syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_BUFFERS, NULL,
+            0);
+    registered.clear();
+  }
+  std::vector<iovec> iovecs;
+  for (auto& buffer : buffers) {
+    iovecs.push_back({buffer.data(), buffer.size()});
+  }
+  // Pinned, counts against RLIMIT_MEMLOCK
+  if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+              iovecs.data(), iovecs.size()) < 0) {
+    BELL_LOG(error, "IoUring", "Cannot register buffers, errno %d", errno);
+    return false;
+  }
+  registered = buffers;
+  return true;
+}
+
+int IoUring::submitAndWait(uint32_t timeoutMs) {
+  __kernel_timespec timeout = {(int64_t)(timeoutMs / 1000),
+                               (long long)(timeoutMs % 1000) * 1000000};
+  io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = (uint64_t)&timeout;
+  int ret = enter(queued, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                  &arg, sizeof(arg));
+  if (ret < 0 && ret != -ETIME && ret != -EINTR) {
+    return ret;
+  }
+  return __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) - *cqHead;
+}
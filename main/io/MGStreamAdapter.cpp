@@ -1,8 +1,20 @@
 // MGStreamAdapter.cpp
 #include "MGStreamAdapter.h"
 
-mg_buf::mg_buf(struct mg_connection* _conn) : conn(_conn) {
-  setp(buffer, buffer + BUF_SIZE - 1);  // -1 to leave space for overflow '\0'
+#include <algorithm>  // for max, min
+
+mg_buf::mg_buf(struct mg_connection* _conn, size_t bufferSize, bool chunked)
+    : conn(_conn), buffer(std::max<size_t>(bufferSize, 2)), chunked(chunked) {
+  // -1 to leave space for overflow '\0'
+  setp(buffer.data(), buffer.data() + buffer.size() - 1);
+}
+
+int mg_buf::send(const char* data, int len) {
+  if (!chunked) {
+    return mg_write(conn, data, len);
+  }
+  // Counts the chunk's framing too
+  return mg_send_chunk(conn, data, len) > 0 ? len : -1;
 }
 
 mg_buf::int_type mg_buf::overflow(int_type c) {
@@ -18,9 +30,31 @@ mg_buf::int_type mg_buf::overflow(int_type c) {
   return c;
 }
 
+std::streamsize mg_buf::xsputn(const char_type* s, std::streamsize n) {
+  if (n <= epptr() - pptr()) {
+    traits_type::copy(pptr(), s, n);
+    pbump(n);
+    return n;
+  }
+
+  if (flush_buffer() == EOF) {
+    return 0;
+  }
+  if (n < epptr() - pptr()) {
+    traits_type::copy(pptr(), s, n);
+    pbump(n);
+    return n;
+  }
+  // Larger than the buffer, no point in copying it
+  if (send(s, n) != n) {
+    return 0;
+  }
+  return n;
+}
+
 int mg_buf::flush_buffer() {
   int len = int(pptr() - pbase());
-  if (mg_write(conn, buffer, len) != len) {
+  if (len > 0 && send(pbase(), len) != len) {
     return EOF;
   }
   pbump(-len);  // reset put pointer accordingly
@@ -34,15 +68,18 @@ int mg_buf::sync() {
   return 0;
 }
 
-MGStreamAdapter::MGStreamAdapter(struct mg_connection* _conn)
-    : std::ostream(&buf), buf(_conn) {
+MGStreamAdapter::MGStreamAdapter(struct mg_connection* _conn,
+                                 size_t bufferSize, bool chunked)
+    : std::ostream(&buf), buf(_conn, bufferSize, chunked) {
   rdbuf(&buf);  // set the custom streambuf
 }
 
-mg_read_buf::mg_read_buf(struct mg_connection* _conn) : conn(_conn) {
-  setg(buffer + BUF_SIZE,   // beginning of putback area
-       buffer + BUF_SIZE,   // read position
-       buffer + BUF_SIZE);  // end position
+mg_read_buf::mg_read_buf(struct mg_connection* _conn, size_t bufferSize)
+    : conn(_conn), buffer(std::max<size_t>(bufferSize, 4)) {
+  char* end = buffer.data() + buffer.size();
+  setg(end,   // beginning of putback area
+       end,   // read position
+       end);  // end position
 }
 
 mg_read_buf::int_type mg_read_buf::underflow() {
@@ -50,7 +87,7 @@ mg_read_buf::int_type mg_read_buf::underflow() {
     return traits_type::to_int_type(*gptr());
   }
 
-  char* base = buffer;
+  char* base = buffer.data();
   char* start = base;
 
   if (eback() == base) {  // true when this isn't the first fill
@@ -60,8 +97,8 @@ mg_read_buf::int_type mg_read_buf::underflow() {
   }
 
   // Read new characters
-  int n = mg_read(conn, start, buffer + BUF_SIZE - start);
-  if (n == 0) {
+  int n = mg_read(conn, start, base + buffer.size() - start);
+  if (n <= 0) {
     return traits_type::eof();
   }
 
@@ -72,7 +109,27 @@ mg_read_buf::int_type mg_read_buf::underflow() {
   return traits_type::to_int_type(*gptr());
 }
 
-MGInputStreamAdapter::MGInputStreamAdapter(struct mg_connection* _conn)
-    : std::istream(&buf), buf(_conn) {
+std::streamsize mg_read_buf::xsgetn(char_type* s, std::streamsize n) {
+  std::streamsize done = std::min<std::streamsize>(egptr() - gptr(), n);
+  traits_type::copy(s, gptr(), done);
+  gbump(done);
+
+  while (n - done >= (std::streamsize)buffer.size()) {
+    int len = mg_read(conn, s + done, n - done);
+    if (len <= 0) {
+      return done;
+    }
+    done += len;
+  }
+  if (done < n) {
+    // Through the buffer, refilling it
+    done += std::streambuf::xsgetn(s + done, n - done);
+  }
+  return done;
+}
+
+MGInputStreamAdapter::MGInputStreamAdapter(struct mg_connection* _conn,
+                                           size_t bufferSize)
+    : std::istream(&buf), buf(_conn, bufferSize) {
   rdbuf(&buf);  // set the custom streambuf
 }
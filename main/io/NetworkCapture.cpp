@@ -0,0 +1,173 @@
+#include "NetworkCapture.h"
+
+#include <string.h>   // for memcmp, memcpy
+#include <algorithm>  // for min
+#include <stdexcept>  // for runtime_error
+
+#include "BellClock.h"   // for nowUs
+#include "BellLogger.h"  // for BELL_LOG
+#include "BellUtils.h"   // for BELL_SLEEP_MS
+
+using namespace bell;
+
+/**
+ * Capture file, little-endian:
+ *   "BNC1", uint64 size of the source
+ *   per read: uint64 µs from the first read, uint32 length, the bytes
+ */
+namespace {
+const uint8_t MAGIC[4] = {'B', 'N', 'C', '1'};
+constexpr size_t FILE_HEADER = 12;
+constexpr size_t RECORD_HEADER = 12;
+
+void writeLE(uint8_t* out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = value >> (i * 8);
+  }
+}
+
+uint64_t readLE(const uint8_t* data, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = bytes; i-- > 0;) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+}  // namespace
+
+RecordingStream::RecordingStream(std::shared_ptr<ByteStream> source,
+                                 const std::string& path)
+    : source(source) {
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    throw std::runtime_error("Could not create capture: " + path);
+  }
+  uint8_t header[FILE_HEADER];
+  memcpy(header, MAGIC, sizeof(MAGIC));
+  writeLE(header + 4, source->size(), 8);
+  fwrite(header, 1, sizeof(header), file);
+}
+
+RecordingStream::~RecordingStream() {
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
+
+size_t RecordingStream::read(uint8_t* buf, size_t nbytes) {
+  if (startUs < 0) {
+    startUs = clock::nowUs();
+  }
+  size_t len = source->read(buf, nbytes);
+  if (file == nullptr) {
+    return len;
+  }
+
+  uint8_t header[RECORD_HEADER];
+  writeLE(header, clock::nowUs() - startUs, 8);
+  writeLE(header + 8, len, 4);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+      fwrite(buf, 1, len, file) != len) {
+    BELL_LOG(error, "RecordingStream", "Capture cut short, write failed");
+    fclose(file);
+    file = nullptr;
+  }
+  return len;
+}
+
+size_t RecordingStream::skip(size_t nbytes) {
+  uint8_t scratch[1024];
+  size_t skipped = 0;
+  while (skipped < nbytes) {
+    size_t len = read(scratch, std::min(nbytes - skipped, sizeof(scratch)));
+    if (len == 0) {
+      break;
+    }
+    skipped += len;
+  }
+  return skipped;
+}
+
+void RecordingStream::close() {
+  source->close();
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+ReplayStream::ReplayStream(const std::string& path, const Config& config)
+    : config(config) {
+  file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    throw std::runtime_error("Could not open capture: " + path);
+  }
+  uint8_t header[FILE_HEADER];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      memcmp(header, MAGIC, sizeof(MAGIC)) != 0) {
+    close();
+    throw std::runtime_error("Not a capture: " + path);
+  }
+  sourceSize = readLE(header + 4, 8);
+}
+
+ReplayStream::~ReplayStream() {
+  close();
+}
+
+bool ReplayStream::nextRecord() {
+  uint8_t header[RECORD_HEADER];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+    return false;
+  }
+  uint64_t atUs = readLE(header, 8);
+  remaining = readLE(header + 8, 4);
+
+  if (config.speed > 0) {
+    int64_t dueUs = startUs + (int64_t)(atUs / (double)config.speed);
+    int64_t waitMs;
+    while ((waitMs = (dueUs - clock::nowUs() + 999) / 1000) > 0) {
+      BELL_SLEEP_MS(waitMs);
+    }
+  }
+  return true;
+}
+
+size_t ReplayStream::read(uint8_t* buf, size_t nbytes) {
+  if (file == nullptr || nbytes == 0) {
+    return 0;
+  }
+  if (startUs < 0) {
+    startUs = clock::nowUs();
+  }
+  // A recorded end comes back as one, the reads after go on
+  if (remaining == 0 && (!nextRecord() || remaining == 0)) {
+    return 0;
+  }
+
+  size_t len = fread(buf, 1, std::min(nbytes, remaining), file);
+  // Truncated, the record ends here
+  remaining = len > 0 ? remaining - len : 0;
+  delivered += len;
+  return len;
+}
+
+size_t ReplayStream::skip(size_t nbytes) {
+  uint8_t scratch[1024];
+  size_t skipped = 0;
+  while (skipped < nbytes) {
+    size_t len = read(scratch, std::min(nbytes - skipped, sizeof(scratch)));
+    if (len == 0) {
+      break;
+    }
+    skipped += len;
+  }
+  return skipped;
+}
+
+void ReplayStream::close() {
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+  }
+}
@@ -0,0 +1,177 @@
+#include "OTADownloader.h"
+
+#include <exception>  // for exception
+#include <memory>     // for make_shared
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "BellUtils.h"   // for BELL_SLEEP_MS
+#include "HTTPClient.h"  // for HTTPClient
+
+using namespace bell;
+
+OTADownloader::OTADownloader(const Config& config)
+    : bell::Task("ota_hash", 4096, 0, config.hashCore),
+      config(config),
+      image(config.path) {
+  mbedtls_md_init(&sha256);
+  mbedtls_md_setup(&sha256, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&sha256);
+  blocks[0].resize(config.blockSize);
+  blocks[1].resize(config.blockSize);
+}
+
+OTADownloader::~OTADownloader() {
+  mbedtls_md_free(&sha256);
+}
+
+bool OTADownloader::download(const BufferedStream::StreamReader& reader) {
+  if (!image.open()) {
+    return fail(image.getError());
+  }
+  threaded = startTask();
+
+  BufferedStream::StreamPtr stream = reader(0);
+  size_t total = 0;
+  size_t fill = 0;
+  int current = 0;
+  int failures = 0;
+  bool ended = false;
+  while (error == nullptr && !ended) {
+    if (stream == nullptr) {
+      if (failures++ >= config.retries) {
+        fail("download failed");
+        break;
+      }
+      uint32_t delay = config.retryDelayMs;
+      BELL_SLEEP_MS(delay);
+      // What the partial block held comes again with the rest
+      fill = 0;
+      stream = reader(written);
+      continue;
+    }
+    if (total == 0) {
+      total = stream->size();
+    }
+
+    auto& block = blocks[current];
+    size_t got = stream->read(block.data() + fill, block.size() - fill);
+    if (got > 0) {
+      failures = 0;
+    }
+    fill += got;
+    ended = got == 0 && (total == 0 || written + fill >= total);
+    if (got == 0 && !ended) {
+      BELL_LOG(error, "OTA", "Download cut at %zu of %zu bytes, resuming",
+               written + fill, total);
+      stream = nullptr;
+      continue;
+    }
+
+    if (fill == block.size() || (ended && fill > 0)) {
+      if (written + fill > image.capacity()) {
+        fail("image too large");
+        break;
+      }
+      // Hashed on the other task while it's written here
+      hash(block.data(), fill);
+      if (!image.write(block.data(), fill)) {
+        fail(image.getError());
+        break;
+      }
+      written += fill;
+      fill = 0;
+      current ^= 1;
+      if (config.onProgress) {
+        config.onProgress(written, total);
+      }
+    }
+  }
+  stream = nullptr;
+
+  // Ends the hashing task once it's through the last block
+  hash(nullptr, 0);
+  waitHash();
+  if (threaded) {
+    joinTask();
+  }
+
+  if (error == nullptr && !OTAImage::verify(sha256, config.sha256, digest)) {
+    fail("sha256 mismatch");
+  }
+  if (error == nullptr && !image.commit()) {
+    fail(image.getError());
+  }
+  if (error != nullptr) {
+    image.abort();
+    return false;
+  }
+  BELL_LOG(info, "OTA", "Image of %zu bytes stored, sha256 %s", written,
+           digest.c_str());
+  return true;
+}
+
+BufferedStream::StreamReader OTADownloader::httpReader(const std::string& url) {
+  return [url](uint32_t rangeStart) -> BufferedStream::StreamPtr {
+    try {
+      HTTPClient::Headers headers = {
+          {"Range", "bytes=" + std::to_string(rangeStart) + "-"}};
+      auto response = HTTPClient::get(url, headers, Socket::Profile::BULK);
+      int status = response->status();
+      if (status != 200 && status != 206) {
+        BELL_LOG(error, "OTA", "Download failed with status %d", status);
+        return nullptr;
+      }
+      auto stream =
+          std::make_shared<HTTPClient::ResponseStream>(std::move(response));
+      // The whole body, from its start
+      if (status == 200 && stream->skip(rangeStart) != rangeStart) {
+        return nullptr;
+      }
+      return stream;
+    } catch (const std::exception& e) {
+      BELL_LOG(error, "OTA", "Download failed: %s", e.what());
+      return nullptr;
+    }
+  };
+}
+
+void OTADownloader::runTask() {
+  while (true) {
+    hashReady.wait();
+    if (hashBlock == nullptr) {
+      hashDone.give();
+      return;
+    }
+    mbedtls_md_update(&sha256, hashBlock, hashSize);
+    hashDone.give();
+  }
+}
+
+void OTADownloader::hash(const uint8_t* data, size_t size) {
+  if (!threaded) {
+    if (data != nullptr) {
+      mbedtls_md_update(&sha256, data, size);
+    }
+    return;
+  }
+  waitHash();
+  hashBlock = data;
+  hashSize = size;
+  hashing = true;
+  hashReady.give();
+}
+
+void OTADownloader::waitHash() {
+  if (hashing) {
+    hashDone.wait();
+    hashing = false;
+  }
+}
+
+bool OTADownloader::fail(const char* why) {
+  if (error == nullptr) {
+    error = why;
+    BELL_LOG(error, "OTA", "Download failed: %s", why);
+  }
+  return false;
+}
@@ -0,0 +1,123 @@
+#include "OTAImage.h"
+
+#include <ctype.h>   // for tolower
+#include <stdint.h>  // for SIZE_MAX
+#include <stdio.h>   // for fopen, fwrite, fclose, remove, rename, snprintf
+
+#include "BellLogger.h"  // for BELL_LOG
+
+using namespace bell;
+
+OTAImage::OTAImage(const std::string& path) : path(path) {}
+
+OTAImage::~OTAImage() {
+  abort();
+}
+
+bool OTAImage::open() {
+#ifdef ESP_PLATFORM
+  partition = esp_ota_get_next_update_partition(nullptr);
+  if (partition == nullptr) {
+    return fail("no OTA partition");
+  }
+  // Erased as it's written rather than all at once up front
+  if (esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle) !=
+      ESP_OK) {
+    handle = 0;
+    return fail("OTA begin failed");
+  }
+  BELL_LOG(info, "OTA", "Writing image to partition %s", partition->label);
+#else
+  std::string partPath = path + ".part";
+  file = fopen(partPath.c_str(), "wb");
+  if (file == nullptr) {
+    return fail("can't open image file");
+  }
+  BELL_LOG(info, "OTA", "Writing image to %s", partPath.c_str());
+#endif
+  return true;
+}
+
+bool OTAImage::write(const uint8_t* data, size_t size) {
+#ifdef ESP_PLATFORM
+  if (esp_ota_write(handle, data, size) != ESP_OK) {
+    return fail("flash write failed");
+  }
+#else
+  if (fwrite(data, 1, size, file) != size) {
+    return fail("file write failed");
+  }
+#endif
+  return true;
+}
+
+bool OTAImage::commit() {
+#ifdef ESP_PLATFORM
+  // Validates the image, and frees the handle either way
+  esp_err_t err = esp_ota_end(handle);
+  handle = 0;
+  if (err != ESP_OK) {
+    return fail("invalid image");
+  }
+  if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+    return fail("can't set boot partition");
+  }
+#else
+  std::string partPath = path + ".part";
+  int closed = fclose(file);
+  file = nullptr;
+  if (closed != 0 || rename(partPath.c_str(), path.c_str()) != 0) {
+    remove(partPath.c_str());
+    return fail("can't store image");
+  }
+#endif
+  return true;
+}
+
+void OTAImage::abort() {
+#ifdef ESP_PLATFORM
+  if (handle != 0) {
+    esp_ota_abort(handle);
+    handle = 0;
+  }
+#else
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+    remove((path + ".part").c_str());
+  }
+#endif
+}
+
+size_t OTAImage::capacity() const {
+#ifdef ESP_PLATFORM
+  return partition != nullptr ? partition->size : 0;
+#else
+  return SIZE_MAX;
+#endif
+}
+
+bool OTAImage::verify(mbedtls_md_context_t& sha256,
+                      const std::string& expected, std::string& digest) {
+  uint8_t hash[32];
+  mbedtls_md_finish(&sha256, hash);
+  char hex[sizeof(hash) * 2 + 1];
+  for (size_t i = 0; i < sizeof(hash); i++) {
+    snprintf(hex + i * 2, 3, "%02x", hash[i]);
+  }
+  digest = hex;
+
+  if (expected.empty()) {
+    return true;
+  }
+  bool match = expected.size() == digest.size();
+  for (size_t i = 0; match && i < digest.size(); i++) {
+    match = tolower((unsigned char)expected[i]) == digest[i];
+  }
+  return match;
+}
+
+bool OTAImage::fail(const char* why) {
+  error = why;
+  return false;
+}
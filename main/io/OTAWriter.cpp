@@ -0,0 +1,103 @@
+#include "OTAWriter.h"
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "JsonWriter.h"  // for JsonWriter
+
+using namespace bell;
+
+OTAWriter::OTAWriter(const Config& config)
+    : config(config), image(config.path) {
+  mbedtls_md_init(&sha256);
+  mbedtls_md_setup(&sha256, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&sha256);
+}
+
+OTAWriter::~OTAWriter() {
+  mbedtls_md_free(&sha256);
+}
+
+bool OTAWriter::beginPart(const Part& part) {
+  // A form's other fields come as parts without a file name
+  if (state != State::WAITING ||
+      (part.filename.empty() && !part.name.empty())) {
+    return true;
+  }
+  if (!image.open()) {
+    return fail(image.getError(), 500);
+  }
+  state = State::WRITING;
+  return true;
+}
+
+bool OTAWriter::write(const uint8_t* data, size_t size) {
+  if (state != State::WRITING) {
+    return true;
+  }
+  if ((config.maxSize > 0 && this->size + size > config.maxSize) ||
+      this->size + size > image.capacity()) {
+    return fail("image too large", 413);
+  }
+  if (!image.write(data, size)) {
+    return fail(image.getError(), 500);
+  }
+
+  mbedtls_md_update(&sha256, data, size);
+  this->size += size;
+  return true;
+}
+
+bool OTAWriter::endPart() {
+  if (state == State::WRITING) {
+    state = State::WRITTEN;
+  }
+  return true;
+}
+
+std::unique_ptr<BellHTTPServer::HTTPResponse> OTAWriter::finish(
+    BellHTTPServer& server, bool complete) {
+  if (error == nullptr) {
+    if (!complete) {
+      fail("upload incomplete", 400);
+    } else if (state != State::WRITTEN) {
+      fail("no image in upload", 400);
+    } else {
+      commit();
+    }
+  }
+
+  std::string json;
+  JsonWriter writer(json);
+  writer.beginObject();
+  if (error != nullptr) {
+    image.abort();
+    writer.key("error").value(error);
+  }
+  writer.key("size").value(size);
+  if (!digest.empty()) {
+    writer.key("sha256").value(digest);
+  }
+  writer.endObject();
+  return server.makeJsonResponse(json, error ? errorStatus : 200);
+}
+
+bool OTAWriter::commit() {
+  if (!OTAImage::verify(sha256, config.sha256, digest)) {
+    return fail("sha256 mismatch", 400);
+  }
+  if (!image.commit()) {
+    return fail(image.getError(), 500);
+  }
+
+  BELL_LOG(info, "OTA", "Image of %zu bytes stored, sha256 %s", size,
+           digest.c_str());
+  return true;
+}
+
+bool OTAWriter::fail(const char* why, int status) {
+  if (error == nullptr) {
+    error = why;
+    errorStatus = status;
+    BELL_LOG(error, "OTA", "Upload failed: %s", why);
+  }
+  return false;
+}
@@ -0,0 +1,234 @@
+#include "ParallelRangeStream.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+#include <exception>  // for exception
+#include <stdexcept>  // for runtime_error
+#include <utility>    // for move
+
+#include "BellLogger.h"  // for BELL_LOG
+
+using namespace bell;
+
+ParallelRangeStream::Worker::Worker(ParallelRangeStream* owner, size_t index)
+    : bell::Task("range_fetch", 4096 * 4, 5, 0),
+      owner(owner),
+      index(index),
+      data(owner->segmentSize) {}
+
+ParallelRangeStream::ParallelRangeStream(
+    const std::string& url, size_t offset,
+    std::unique_ptr<HTTPClient::Response> first, size_t segmentSize,
+    size_t segments)
+    : url(url), offset(offset), segmentSize(segmentSize) {
+  totalLength = first->totalLength();
+
+  for (size_t i = 0; i < std::max<size_t>(segments, 1); i++) {
+    workers.push_back(std::make_unique<Worker>(this, i));
+  }
+  workers[0]->response = std::move(first);
+
+  for (auto& worker : workers) {
+    if (!worker->startTask()) {
+      // The stream ends before this worker's first segment
+      BELL_LOG(error, "ParallelRangeStream", "Cannot start a worker");
+      worker->segment = worker->index;
+      worker->failed = true;
+      worker->done = true;
+    }
+  }
+}
+
+ParallelRangeStream::~ParallelRangeStream() {
+  close();
+}
+
+void ParallelRangeStream::close() {
+  terminate = true;
+  for (auto& worker : workers) {
+    worker->requestStop();
+  }
+  // Workers read owner and workers until they're out of their Task
+  for (auto& worker : workers) {
+    worker->joinTask();
+  }
+}
+
+size_t ParallelRangeStream::segmentLength(size_t segment) {
+  size_t start = offset + segment * segmentSize;
+  if (start >= totalLength) {
+    return 0;
+  }
+  return std::min(segmentSize, totalLength - start);
+}
+
+size_t ParallelRangeStream::read(uint8_t* buf, size_t nbytes) {
+  size_t read = 0;
+  while (read < nbytes && !terminate) {
+    size_t length = segmentLength(current);
+    if (length == 0) {
+      break;
+    }
+
+    Worker& worker = *workers[current % workers.size()];
+    if (worker.segment != current ||
+        (worker.filled == segmentPos && !worker.done)) {
+      // Hand out what's there rather than waiting for more
+      if (read > 0) {
+        break;
+      }
+      worker.dataSem.twait(100);
+      continue;
+    }
+
+    size_t toRead = std::min(worker.filled - segmentPos, nbytes - read);
+    if (toRead == 0) {
+      // The segment failed, end the stream here
+      break;
+    }
+    if (buf != nullptr) {
+      memcpy(buf + read, worker.data.data() + segmentPos, toRead);
+    }
+    segmentPos += toRead;
+    read += toRead;
+    readTotal += toRead;
+
+    if (segmentPos == length) {
+      // Let the worker fetch its next segment
+      segmentPos = 0;
+      current++;
+      worker.segment = NO_SEGMENT;
+      worker.freeSem.give();
+    }
+  }
+  return read;
+}
+
+size_t ParallelRangeStream::skip(size_t nbytes) {
+  return read(nullptr, nbytes);
+}
+
+size_t ParallelRangeStream::position() {
+  return offset + readTotal;
+}
+
+size_t ParallelRangeStream::size() {
+  return totalLength;
+}
+
+void ParallelRangeStream::Worker::onStopRequested() {
+  {
+    // The worker may be blocked in a read
+    std::scoped_lock lock(responseMutex);
+    if (response != nullptr) {
+      response->byteStream().close();
+    }
+  }
+  freeSem.give();
+}
+
+void ParallelRangeStream::Worker::runTask() {
+  for (size_t next = index; !owner->terminate; next += owner->workers.size()) {
+    size_t length = owner->segmentLength(next);
+    if (length == 0) {
+      break;
+    }
+
+    // Wait for read() to consume the previous segment
+    while (segment != NO_SEGMENT && !owner->terminate) {
+      freeSem.twait(100);
+    }
+    if (owner->terminate) {
+      break;
+    }
+
+    filled = 0;
+    done = false;
+    failed = false;
+    segment = next;
+
+    bool fetched = fetch(owner->offset + next * owner->segmentSize, length);
+    failed = !fetched;
+    done = true;
+    dataSem.give();
+    if (!fetched) {
+      break;
+    }
+  }
+
+  std::scoped_lock responseLock(responseMutex);
+  response = nullptr;
+}
+
+bool ParallelRangeStream::Worker::fetch(size_t start, size_t length) {
+  for (int attempt = 0; attempt < MAX_ATTEMPTS && !owner->terminate;
+       attempt++) {
+    try {
+      if (response == nullptr) {
+        // Resume where the previous attempt stopped
+        HTTPClient::Headers headers = {HTTPClient::RangeHeader::range(
+            start + filled, start + length - 1)};
+        auto next =
+            HTTPClient::get(owner->url, headers, Socket::Profile::BULK);
+        std::scoped_lock lock(responseMutex);
+        response = std::move(next);
+      }
+      if (response->header("content-range").empty()) {
+        throw std::runtime_error("Range not satisfied");
+      }
+
+      while (filled < length && !owner->terminate) {
+        size_t len = response->byteStream().read(data.data() + filled,
+                                                 length - filled);
+        if (len == 0) {
+          break;
+        }
+        filled += len;
+        dataSem.give();
+      }
+    } catch (const std::exception& e) {
+      BELL_LOG(error, "ParallelRangeStream", "Segment at %d failed: %s",
+               (int)start, e.what());
+    }
+
+    {
+      std::scoped_lock lock(responseMutex);
+      response = nullptr;
+    }
+    if (filled == length) {
+      return true;
+    }
+  }
+  return false;
+}
+
+BufferedStream::StreamReader ParallelRangeStream::reader(
+    const std::string& url, size_t segmentSize, size_t segments) {
+  return [url, segmentSize,
+          segments](uint32_t rangeStart) -> BufferedStream::StreamPtr {
+    try {
+      HTTPClient::Headers headers = {HTTPClient::RangeHeader::range(
+          rangeStart, rangeStart + segmentSize - 1)};
+      auto response = HTTPClient::get(url, headers, Socket::Profile::BULK);
+
+      if (response->header("content-range").empty()) {
+        // The server ignored the range, it's all in one response
+        auto stream =
+            std::make_shared<HTTPClient::ResponseStream>(std::move(response));
+        if (stream->skip(rangeStart) < rangeStart) {
+          return nullptr;
+        }
+        return stream;
+      }
+
+      if (rangeStart >= response->totalLength()) {
+        return nullptr;
+      }
+      return std::make_shared<ParallelRangeStream>(
+          url, rangeStart, std::move(response), segmentSize, segments);
+    } catch (const std::exception& e) {
+      BELL_LOG(error, "ParallelRangeStream", "Request failed: %s", e.what());
+      return nullptr;
+    }
+  };
+}
@@ -0,0 +1,75 @@
+#include "ReadAheadPolicy.h"
+
+#include <algorithm>  // for clamp, max, min
+
+using namespace bell;
+
+AdaptiveReadAhead::AdaptiveReadAhead() : AdaptiveReadAhead(Config()) {}
+
+AdaptiveReadAhead::AdaptiveReadAhead(Config config) : config(config) {
+  consumeRate = config.consumeRate;
+}
+
+void AdaptiveReadAhead::setConsumeRate(uint32_t bytesPerSecond) {
+  consumeRate = bytesPerSecond;
+}
+
+void AdaptiveReadAhead::onRead(size_t bytes, std::chrono::microseconds took) {
+  // A socket read returns whatever arrived, so throughput is only
+  // meaningful over a whole refill
+  cycleBytes += bytes;
+  cycleTime += took;
+
+  float tookMs = took.count() / 1000.0f;
+  if (tookMs >= config.stallMs) {
+    stallPeakMs = std::max(stallPeakMs, tookMs);
+  }
+}
+
+bool AdaptiveReadAhead::update(uint32_t bufferSize, Limits& limits) {
+  if (cycleTime.count() > 0 && cycleBytes > 0) {
+    float rate = cycleBytes * 1000000.0f / cycleTime.count();
+    throughput = throughput == 0
+                     ? rate
+                     : throughput + config.smoothing * (rate - throughput);
+  }
+  cycleBytes = 0;
+  cycleTime = std::chrono::microseconds(0);
+  stallPeakMs *= config.stallDecay;
+
+  if (throughput == 0) {
+    return false;
+  }
+
+  Limits next;
+  uint32_t rate = std::max<uint32_t>(consumeRate, 1);
+  next.readSize = std::clamp<uint32_t>(
+      throughput * config.readIntervalMs / 1000, config.minReadSize,
+      std::max(config.minReadSize, std::min(config.maxReadSize,
+                                            bufferSize / 4)));
+
+  // Hold the target, but never less than two reads
+  uint64_t target = (uint64_t)rate * config.targetMs / 1000;
+  next.fillLimit = std::clamp<uint64_t>(
+      target, std::min(next.readSize * 2, bufferSize), bufferSize);
+  next.readThreshold = std::max(next.readSize, next.fillLimit / 4);
+
+  // Enough to ride out the stalls seen recently
+  float readyMs = std::max<float>(config.minReadyMs, stallPeakMs * 1.5f);
+  uint32_t ready = rate * readyMs / 1000;
+  // At most where refills start, BufferedStream can't wait for more
+  uint32_t maxReady =
+      std::min(next.fillLimit * 3 / 4,
+               next.fillLimit - std::min(next.readThreshold, next.fillLimit));
+  next.readyThreshold =
+      std::clamp(ready, std::min(next.readSize, maxReady), maxReady);
+  next.notReadyThreshold = next.readyThreshold / 2;
+
+  bool changed = next.readSize != limits.readSize ||
+                 next.readThreshold != limits.readThreshold ||
+                 next.fillLimit != limits.fillLimit ||
+                 next.readyThreshold != limits.readyThreshold ||
+                 next.notReadyThreshold != limits.notReadyThreshold;
+  limits = next;
+  return changed;
+}
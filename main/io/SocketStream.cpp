@@ -1,13 +1,26 @@
 #include "SocketStream.h"
 
-#include <stdint.h>  // for uint8_t
-#include <cstdio>    // for NULL, ssize_t
+#include <stdint.h>   // for uint8_t
+#include <algorithm>  // for min
+#include <cstdio>     // for NULL, ssize_t
+#include <cstring>    // for memcpy, memmove
+#include <utility>    // for move
 
 #include "TCPSocket.h"  // for TCPSocket
 #include "TLSSocket.h"  // for TLSSocket
 
 using namespace bell;
 
+void SocketBuffer::setBufferSizes(size_t inputSize, size_t outputSize) {
+  if (internalSocket != nullptr && isOpen()) {
+    pubsync();
+  }
+  ibuf.assign(std::max<size_t>(inputSize, 1), 0);
+  obuf.assign(std::max<size_t>(outputSize, 1), 0);
+  setg(NULL, NULL, NULL);
+  setp(obuf.data(), obuf.data() + obuf.size());
+}
+
 int SocketBuffer::open(const std::string& hostname, int port, bool isSSL) {
   if (internalSocket != nullptr) {
     close();
@@ -17,6 +30,12 @@ int SocketBuffer::open(const std::string& hostname, int port, bool isSSL) {
   } else {
     internalSocket = std::make_unique<bell::TCPSocket>();
   }
+  if (timeouts) {
+    internalSocket->setTimeouts(*timeouts);
+  }
+  if (profile) {
+    internalSocket->setProfile(*profile);
+  }
 
   internalSocket->open(hostname, port);
   return 0;
@@ -31,29 +50,64 @@ int SocketBuffer::close() {
   return 0;
 }
 
+std::unique_ptr<bell::Socket> SocketBuffer::release() {
+  if (internalSocket != nullptr && isOpen()) {
+    pubsync();
+  }
+  setg(NULL, NULL, NULL);
+  return std::move(internalSocket);
+}
+
+void SocketBuffer::attach(std::unique_ptr<bell::Socket> socket) {
+  close();
+  setg(NULL, NULL, NULL);
+  internalSocket = std::move(socket);
+  if (internalSocket != nullptr && timeouts) {
+    internalSocket->setTimeouts(*timeouts);
+  }
+  if (internalSocket != nullptr && profile) {
+    internalSocket->setProfile(*profile);
+  }
+}
+
+void SocketBuffer::unread(const uint8_t* data, size_t len) {
+  const size_t remaining = buffered();
+  if (remaining + len > ibuf.size()) {
+    std::vector<char> grown(remaining + len);
+    memcpy(grown.data() + len, gptr(), remaining);
+    ibuf.swap(grown);
+  } else if (remaining > 0) {
+    memmove(ibuf.data() + len, gptr(), remaining);
+  }
+  memcpy(ibuf.data(), data, len);
+  setg(ibuf.data(), ibuf.data(), ibuf.data() + len + remaining);
+}
+
 int SocketBuffer::sync() {
   ssize_t bw, n = pptr() - pbase();
   while (n > 0) {
     bw = internalSocket->write(reinterpret_cast<uint8_t*>(pptr() - n), n);
     if (bw < 0) {
-      setp(pptr() - n, obuf + bufLen);
+      setp(pptr() - n, obuf.data() + obuf.size());
       pbump(n);
       return -1;
     }
     n -= bw;
   }
-  setp(obuf, obuf + bufLen);
+  setp(obuf.data(), obuf.data() + obuf.size());
   return 0;
 }
 
 SocketBuffer::int_type SocketBuffer::underflow() {
-  ssize_t br = internalSocket->read(reinterpret_cast<uint8_t*>(ibuf), bufLen);
+  char* buf = ibuf.data();
+  ssize_t br = internalSocket->read(reinterpret_cast<uint8_t*>(buf),
+                                    ibuf.size());
   if (br <= 0) {
     setg(NULL, NULL, NULL);
     return traits_type::eof();
   }
-  setg(ibuf, ibuf, ibuf + br);
-  return traits_type::to_int_type(*ibuf);
+  setg(buf, buf, buf + br);
+  return traits_type::to_int_type(*buf);
 }
 
 SocketBuffer::int_type SocketBuffer::overflow(int_type c) {
@@ -94,12 +148,17 @@ std::streamsize SocketBuffer::xsputn(const char_type* __s,
     pbump(__n);
     return __n;
   }
+  // Top up the buffer first, so small writes leave together with the next
+  // large one instead of in a TLS record of their own
+  const std::streamsize room = epptr() - pptr();
+  traits_type::copy(pptr(), __s, room);
+  pbump(room);
   if (sync() < 0)
-    return 0;
+    return room;
   ssize_t bw;
-  std::streamsize remain = __n;
+  std::streamsize remain = __n - room;
   const char_type* end = __s + __n;
-  while (remain > bufLen) {
+  while (remain > (std::streamsize)obuf.size()) {
     bw = internalSocket->write((uint8_t*)(end - remain), remain);
     if (bw < 0)
       return (__n - remain);
@@ -111,3 +170,56 @@ std::streamsize SocketBuffer::xsputn(const char_type* __s,
   }
   return __n;
 }
+
+size_t SocketBuffer::readSome(uint8_t* dst, size_t len) {
+  const size_t buffered = egptr() - gptr();
+  if (buffered > 0) {
+    size_t toCopy = std::min(buffered, len);
+    traits_type::copy(reinterpret_cast<char*>(dst), gptr(), toCopy);
+    gbump(toCopy);
+    return toCopy;
+  }
+
+  if (internalSocket == nullptr || len == 0) {
+    return 0;
+  }
+
+  if (len < ibuf.size()) {
+    // Small reads, e.g. from a BinaryReader, share one socket read
+    if (traits_type::eq_int_type(underflow(), traits_type::eof())) {
+      return 0;
+    }
+    size_t toCopy = std::min<size_t>(egptr() - gptr(), len);
+    traits_type::copy(reinterpret_cast<char*>(dst), gptr(), toCopy);
+    gbump(toCopy);
+    return toCopy;
+  }
+
+  // Up to a whole TLS record, decrypted straight into dst
+  ssize_t br = internalSocket->read(dst, len);
+  return br > 0 ? br : 0;
+}
+
+size_t SocketByteStream::read(uint8_t* buf, size_t nbytes) {
+  nbytes = std::min(nbytes, limit - readPosition);
+  if (nbytes == 0) {
+    return 0;
+  }
+  size_t bytesRead = stream.rdbuf()->readSome(buf, nbytes);
+  readPosition += bytesRead;
+  return bytesRead;
+}
+
+size_t SocketByteStream::skip(size_t nbytes) {
+  uint8_t scratch[256];
+  size_t skipped = 0;
+  while (skipped < nbytes) {
+    size_t bytesRead =
+        read(scratch, std::min(sizeof(scratch), nbytes - skipped));
+    if (bytesRead == 0) {
+      break;
+    }
+    skipped += bytesRead;
+  }
+  return skipped;
+}
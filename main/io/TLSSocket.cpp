@@ -5,63 +5,204 @@
 #include <mbedtls/net_sockets.h>  // for mbedtls_net_connect, mbedtls_net_free
 #include <mbedtls/ssl.h>          // for mbedtls_ssl_conf_authmode, mbedtls_...
 #include <cstring>                // for strlen, NULL
+#include <list>                   // for list
+#include <mutex>                  // for mutex, scoped_lock
 #include <stdexcept>              // for runtime_error
+#include <string>                 // for string, to_string
 
-#include "BellLogger.h"  // for AbstractLogger, BELL_LOG
-#include "X509Bundle.h"  // for shouldVerify, attach
+#include "BellLogger.h"      // for AbstractLogger, BELL_LOG
+#include "DNSCache.h"        // for DNSCache
+#include "StartupProfile.h"  // for BELL_STARTUP_STEP
+#include "X509Bundle.h"      // for shouldVerify, attach
+
+// Number of hosts whose last session is kept for resumption
+static constexpr size_t MAX_SESSIONS = 4;
 
 /**
- * Platform TLSSocket implementation for the mbedtls
+ * SSL config and random generator shared by every connection. It's set up
+ * on the first connection and read-only after that, so handshakes only
+ * contend for the generator.
  */
-bell::TLSSocket::TLSSocket() {
-  this->isClosed = false;
-  mbedtls_net_init(&server_fd);
-  mbedtls_ssl_init(&ssl);
-  mbedtls_ssl_config_init(&conf);
+struct SharedTLSConfig {
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_ssl_config conf;
+  // Same, offering HTTP/2 through ALPN
+  mbedtls_ssl_config h2Conf;
+  std::mutex rngMutex;
+  bool ready = false;
 
-  if (bell::X509Bundle::shouldVerify()) {
-    bell::X509Bundle::attach(&conf);
+  SharedTLSConfig() {
+    // Seeding the generator is the slow part, see TLSSocket::warmUp()
+    BELL_STARTUP_STEP("tls.config");
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_config_init(&h2Conf);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    mbedtls_entropy_init(&entropy);
+
+    const char* pers = "euphonium";
+    int ret;
+    if ((ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func,
+                                     &entropy, (const unsigned char*)pers,
+                                     strlen(pers))) != 0) {
+      BELL_LOG(error, "http_tls",
+               "failed\n  ! mbedtls_ctr_drbg_seed returned %d\n", ret);
+      return;
+    }
+
+    if (!setup(conf) || !setup(h2Conf)) {
+      return;
+    }
+#if defined(MBEDTLS_SSL_ALPN)
+    static const char* h2Protocols[] = {"h2", "http/1.1", NULL};
+    mbedtls_ssl_conf_alpn_protocols(&h2Conf, h2Protocols);
+#endif
+    ready = true;
   }
 
-  mbedtls_ctr_drbg_init(&ctr_drbg);
-  mbedtls_entropy_init(&entropy);
+  bool setup(mbedtls_ssl_config& conf) {
+    int ret;
+    if ((ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
+                                           MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+      BELL_LOG(error, "http_tls", "failed! config returned %d\n", ret);
+      return false;
+    }
 
-  const char* pers = "euphonium";
-  int ret;
-  if ((ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
-                                   (const unsigned char*)pers, strlen(pers))) !=
-      0) {
-    BELL_LOG(error, "http_tls",
-             "failed\n  ! mbedtls_ctr_drbg_seed returned %d\n", ret);
-    throw std::runtime_error("mbedtls_ctr_drbg_seed failed");
+    // Only verify if the X509 bundle is present
+    if (bell::X509Bundle::shouldVerify()) {
+      bell::X509Bundle::attach(&conf);
+      mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    } else {
+      mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+    }
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf,
+                                     MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    mbedtls_ssl_conf_rng(&conf, lockedRandom, this);
+    return true;
   }
+
+  // The generator isn't thread safe, handshakes may run on several tasks
+  static int lockedRandom(void* shared, unsigned char* output, size_t len) {
+    auto* config = static_cast<SharedTLSConfig*>(shared);
+    std::scoped_lock lock(config->rngMutex);
+    return mbedtls_ctr_drbg_random(&config->ctr_drbg, output, len);
+  }
+
+  static SharedTLSConfig& instance() {
+    static SharedTLSConfig config;
+    return config;
+  }
+};
+
+/**
+ * Last session negotiated with each host, oldest first. Holds session IDs
+ * or tickets, whichever the server handed out.
+ */
+class TLSSessionCache {
+ public:
+  ~TLSSessionCache() {
+    for (auto& entry : sessions) {
+      mbedtls_ssl_session_free(&entry.session);
+    }
+  }
+
+  void restore(const std::string& key, mbedtls_ssl_context* ssl) {
+    std::scoped_lock lock(mutex);
+    for (auto& entry : sessions) {
+      if (entry.key == key) {
+        mbedtls_ssl_set_session(ssl, &entry.session);
+        return;
+      }
+    }
+  }
+
+  void save(const std::string& key, const mbedtls_ssl_context* ssl) {
+    std::scoped_lock lock(mutex);
+    for (auto it = sessions.begin(); it != sessions.end(); it++) {
+      if (it->key == key) {
+        mbedtls_ssl_session_free(&it->session);
+        sessions.erase(it);
+        break;
+      }
+    }
+    if (sessions.size() >= MAX_SESSIONS) {
+      mbedtls_ssl_session_free(&sessions.front().session);
+      sessions.pop_front();
+    }
+
+    sessions.push_back({key, {}});
+    mbedtls_ssl_session_init(&sessions.back().session);
+    if (mbedtls_ssl_get_session(ssl, &sessions.back().session) != 0) {
+      mbedtls_ssl_session_free(&sessions.back().session);
+      sessions.pop_back();
+    }
+  }
+
+  static TLSSessionCache& instance() {
+    static TLSSessionCache cache;
+    return cache;
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    mbedtls_ssl_session session;
+  };
+
+  std::mutex mutex;
+  // std::list keeps sessions in place, mbedtls doesn't expect them to move
+  std::list<Entry> sessions;
+};
+
+/**
+ * Platform TLSSocket implementation for the mbedtls
+ */
+void bell::TLSSocket::warmUp() {
+  SharedTLSConfig::instance();
+}
+
+bell::TLSSocket::TLSSocket() {
+  this->isClosed = false;
+  mbedtls_net_init(&server_fd);
+  mbedtls_ssl_init(&ssl);
 }
 
 void bell::TLSSocket::open(const std::string& hostUrl, uint16_t port) {
   int ret;
-  if ((ret = mbedtls_net_connect(&server_fd, hostUrl.c_str(),
-                                 std::to_string(port).c_str(),
-                                 MBEDTLS_NET_PROTO_TCP)) != 0) {
-    BELL_LOG(error, "http_tls", "failed! connect returned %d\n", ret);
+  SharedTLSConfig& shared = SharedTLSConfig::instance();
+  if (!shared.ready) {
+    throw std::runtime_error("TLS config setup failed");
   }
-
-  if ((ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
-                                         MBEDTLS_SSL_TRANSPORT_STREAM,
-                                         MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
-
-    BELL_LOG(error, "http_tls", "failed! config returned %d\n", ret);
-    throw std::runtime_error("mbedtls_ssl_config_defaults failed");
+  // Opened again after close(), e.g. reconnecting
+  if (isClosed) {
+    mbedtls_net_init(&server_fd);
+    mbedtls_ssl_init(&ssl);
+    isClosed = false;
   }
 
-  // Only verify if the X509 bundle is present
-  if (bell::X509Bundle::shouldVerify()) {
-    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
-  } else {
-    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+  // Same as mbedtls_net_connect(), through the DNS cache
+  server_fd.fd = bell::DNSCache::instance().connect(hostUrl, port);
+  if (server_fd.fd < 0) {
+    BELL_LOG(error, "http_tls", "failed! cannot connect to %s\n",
+             hostUrl.c_str());
+    throw std::runtime_error("connect failed");
   }
+  // mbedtls_net_recv() fails on the timeout, there's no retry to wait out
+  applyTimeouts(server_fd.fd);
+  applyProfile(server_fd.fd);
 
-  mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
-  mbedtls_ssl_setup(&ssl, &conf);
+  if ((ret = mbedtls_ssl_setup(&ssl, offerHTTP2 ? &shared.h2Conf
+                                                : &shared.conf)) != 0) {
+    BELL_LOG(error, "http_tls", "failed! setup returned %d\n", ret);
+    throw std::runtime_error("mbedtls_ssl_setup failed");
+  }
+  // The record buffers are allocated by the setup, and dominate
+  memory.resize(sizeof(ssl) + MBEDTLS_SSL_IN_CONTENT_LEN +
+                MBEDTLS_SSL_OUT_CONTENT_LEN);
 
   if ((ret = mbedtls_ssl_set_hostname(&ssl, hostUrl.c_str())) != 0) {
     throw std::runtime_error("mbedtls_ssl_set_hostname failed");
@@ -69,20 +210,58 @@ void bell::TLSSocket::open(const std::string& hostUrl, uint16_t port) {
   mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, mbedtls_net_recv,
                       NULL);
 
+  // Resumes the last session with this host, if the server still has it
+  std::string sessionKey = hostUrl + ":" + std::to_string(port);
+  TLSSessionCache::instance().restore(sessionKey, &ssl);
+
   while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
     if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
       BELL_LOG(error, "http_tls", "failed! config returned %d\n", ret);
       throw std::runtime_error("mbedtls_ssl_handshake error");
     }
   }
+
+  TLSSessionCache::instance().save(sessionKey, &ssl);
+}
+
+void bell::TLSSocket::setTLSError(int result) {
+  if (result > 0) {
+    error = Error::NONE;
+  } else if (result == 0 || result == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+    error = Error::CLOSED;
+  } else if (result == MBEDTLS_ERR_SSL_WANT_READ ||
+             result == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    // A non-blocking socket with nothing to take, as EAGAIN
+    error = Error::TIMEOUT;
+  } else if (result == MBEDTLS_ERR_NET_RECV_FAILED ||
+             result == MBEDTLS_ERR_NET_SEND_FAILED) {
+    // errno is still that of the failed socket call
+    setError(-1);
+  } else {
+    error = Error::FAILED;
+  }
 }
 
 size_t bell::TLSSocket::read(uint8_t* buf, size_t len) {
-  return mbedtls_ssl_read(&ssl, buf, len);
+  int result = mbedtls_ssl_read(&ssl, buf, len);
+  setTLSError(result);
+  rearmQuickAck(server_fd.fd);
+  return result;
 }
 
 size_t bell::TLSSocket::write(uint8_t* buf, size_t len) {
-  return mbedtls_ssl_write(&ssl, buf, len);
+  int result = mbedtls_ssl_write(&ssl, buf, len);
+  setTLSError(result);
+  return result;
+}
+
+std::string bell::TLSSocket::getProtocol() {
+#if defined(MBEDTLS_SSL_ALPN)
+  const char* protocol = mbedtls_ssl_get_alpn_protocol(&ssl);
+  return protocol != NULL ? protocol : "";
+#else
+  return "";
+#endif
 }
 
 size_t bell::TLSSocket::poll() {
@@ -96,9 +275,7 @@ void bell::TLSSocket::close() {
   if (!isClosed) {
     mbedtls_net_free(&server_fd);
     mbedtls_ssl_free(&ssl);
-    mbedtls_ssl_config_free(&conf);
-    mbedtls_ctr_drbg_free(&ctr_drbg);
-    mbedtls_entropy_free(&entropy);
+    memory.resize(0);
     this->isClosed = true;
   }
 }
@@ -2,52 +2,162 @@
 
 namespace bell {
 
-#ifdef BELL_DISABLE_REGEX
-void URLParser::parse(const char* url, std::vector<std::string>& match) {
-  match[0] = url;
-  char scratch[512];
-
-  /* Parsing the following (http|https://[host][/path][?query]#hash] as in regex 
-     * below. This needs to be changed if you update that regex */
-
-  // get the schema
-  if (sscanf(url, "%[^:]:/", scratch) > 0)
-    match[1] = scratch;
-
-  // get the host
-  if (sscanf(url, "htt%*[^:]://%512[^/#?]", scratch) > 0)
-    match[2] = scratch;
-
-  // get the path
-  url = strstr(url, match[2].c_str()) + match[2].size();
-  if (sscanf(url, "/%512[^?]", scratch) > 0)
-    match[3] = scratch;
-  else if (*url && *url != '?' && *url != '#')
-    url++;
-
-  // get the query
-  if (match[3].size())
-    url += match[3].size() + 1;
-  if (sscanf(url, "?%512[^#]", scratch) > 0)
-    match[4] = scratch;
-
-  // get the hash
-  if (match[4].size())
-    url += match[4].size() + 1;
-  if (sscanf(url, "#%512s", scratch) > 0)
-    match[5] = scratch;
-
-  // fix the acquired items
-  match[3] = "/" + match[3];
-  if (match[4].size())
-    match[4] = "?" + match[4];
-
-  // need at least schema and host
-  if (match[1].size() == 0 || match[2].size() == 0)
-    match.clear();
+static const char* HEX_DIGITS = "0123456789ABCDEF";
+
+// Unreserved, !'()*-._~ included
+static bool isUnescaped(char ch) {
+  return (ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') ||
+         (ch >= 'a' && ch <= 'z') || ch == '-' || ch == '_' || ch == '!' ||
+         ch == '\'' || ch == '(' || ch == ')' || ch == '*' || ch == '~' ||
+         ch == '.';
+}
+
+static int hexValue(char ch) {
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+  return -1;
+}
+
+size_t URLParser::urlEncode(std::string_view value, char* out,
+                            size_t outSize) {
+  size_t length = 0;
+  auto put = [&](char ch) {
+    if (length + 1 < outSize) {
+      out[length] = ch;
+    }
+    length++;
+  };
+
+  for (auto ch : value) {
+    if (isUnescaped(ch)) {
+      put(ch);
+    } else {
+      put('%');
+      put(HEX_DIGITS[static_cast<unsigned char>(ch) >> 4]);
+      put(HEX_DIGITS[static_cast<unsigned char>(ch) & 15]);
+    }
+  }
+
+  if (outSize > 0) {
+    out[length < outSize ? length : outSize - 1] = '\0';
+  }
+  return length;
+}
+
+void URLParser::urlEncode(std::string_view value, std::string& out) {
+  size_t escaped = 0;
+  for (auto ch : value) {
+    escaped += !isUnescaped(ch);
+  }
+  out.reserve(out.size() + value.size() + escaped * 2);
+
+  for (auto ch : value) {
+    if (isUnescaped(ch)) {
+      out.push_back(ch);
+    } else {
+      out.push_back('%');
+      out.push_back(HEX_DIGITS[static_cast<unsigned char>(ch) >> 4]);
+      out.push_back(HEX_DIGITS[static_cast<unsigned char>(ch) & 15]);
+    }
+  }
+}
+
+void URLParser::urlDecode(std::string_view value, std::string& out) {
+  out.reserve(out.size() + value.size());
+
+  for (std::size_t i = 0; i < value.size(); ++i) {
+    auto ch = value[i];
+
+    if (ch == '%' && (i + 2) < value.size() && hexValue(value[i + 1]) >= 0 &&
+        hexValue(value[i + 2]) >= 0) {
+      out.push_back(static_cast<char>(hexValue(value[i + 1]) * 16 +
+                                      hexValue(value[i + 2])));
+      i += 2;
+    } else if (ch == '+') {
+      out.push_back(' ');
+    } else {
+      out.push_back(ch);
+    }
+  }
+}
+
+bool URLParser::parse(std::string_view url, View& view) {
+  view = View();
+  size_t pos = 0;
+
+  // Schema, up to a ':' before any of "/?#"
+  size_t end = url.find_first_of(":/?#");
+  if (end != std::string_view::npos && end > 0 && url[end] == ':') {
+    view.schema = url.substr(0, end);
+    pos = end + 1;
+  }
+
+  // Authority, after "//"
+  if (url.substr(pos, 2) != "//") {
+    return false;
+  }
+  pos += 2;
+  end = url.find_first_of("/?#", pos);
+  std::string_view authority = url.substr(pos, end - pos);
+  pos = end == std::string_view::npos ? url.size() : end;
+
+  std::string_view port;
+  if (!authority.empty() && authority[0] == '[') {
+    size_t close = authority.find(']');
+    if (close == std::string_view::npos) {
+      return false;
+    }
+    view.host = authority.substr(1, close - 1);
+    if (close + 1 < authority.size()) {
+      if (authority[close + 1] != ':') {
+        return false;
+      }
+      port = authority.substr(close + 2);
+    }
+  } else {
+    size_t colon = authority.find(':');
+    view.host = authority.substr(0, colon);
+    if (colon != std::string_view::npos) {
+      port = authority.substr(colon + 1);
+    }
+  }
+  if (view.host.empty()) {
+    return false;
+  }
+
+  if (!port.empty()) {
+    int value = 0;
+    for (char digit : port) {
+      if (digit < '0' || digit > '9' || value > 65535) {
+        return false;
+      }
+      value = value * 10 + (digit - '0');
+    }
+    if (value > 65535) {
+      return false;
+    }
+    view.port = value;
+  } else {
+    view.port = view.schema == "https" || view.schema == "wss" ? 443 : 80;
+  }
+
+  // Path and query stay together, as sent in a request line
+  end = url.find('#', pos);
+  view.path = url.substr(pos, end - pos);
+  if (end != std::string_view::npos) {
+    view.fragment = url.substr(end + 1);
+  }
+  size_t query = view.path.find('?');
+  if (query != std::string_view::npos) {
+    view.query = view.path.substr(query + 1);
+  }
+  if (view.path.empty()) {
+    view.path = "/";
+  }
+  return true;
 }
-#else
-const std::regex URLParser::urlParseRegex = std::regex(
-    "^(?:([^:/?#]+):)?(?://([^/?#]*))?([^?#]*)(\\?(?:[^#]*))?(#(?:.*))?");
-#endif
 }  // namespace bell
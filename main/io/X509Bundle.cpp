@@ -6,9 +6,13 @@
 #include <mbedtls/x509.h>  // for mbedtls_x509_buf, MBEDTLS_ERR_X5...
 #include <stdlib.h>        // for free, calloc
 #include <string.h>        // for memcmp, memcpy
+#include <list>            // for list
+#include <memory>          // for shared_ptr
+#include <mutex>           // for mutex, scoped_lock
 #include <stdexcept>       // for runtime_error
 
-#include "BellLogger.h"  // for AbstractLogger, BELL_LOG
+#include "BellLogger.h"      // for AbstractLogger, BELL_LOG
+#include "StartupProfile.h"  // for BELL_STARTUP_STEP
 
 using namespace bell::X509Bundle;
 
@@ -28,55 +32,109 @@ static mbedtls_x509_crt s_dummy_crt;
 static bool s_should_verify_certs = false;
 static crt_bundle_t s_crt_bundle;
 
+/* Root keys parsed by earlier handshakes, most recently used first, so
+ * reconnecting to the same hosts skips the ASN.1 and key parsing */
+typedef struct parsed_key_t {
+  const uint8_t* crt;  // bundle entry the key was parsed from
+  std::shared_ptr<mbedtls_pk_context> pk;
+} parsed_key_t;
+
+static constexpr size_t MAX_PARSED_KEYS = 4;
+static std::mutex s_parsed_keys_mutex;
+static std::list<parsed_key_t> s_parsed_keys;
+
 #ifndef MBEDTLS_PRIVATE
 #define MBEDTLS_PRIVATE(member) member
 #endif
 
-int bell::X509Bundle::crtCheckCertificate(mbedtls_x509_crt* child,
-                                          const uint8_t* pub_key_buf,
-                                          size_t pub_key_len) {
-  int ret = 0;
-  mbedtls_x509_crt parent;
-  const mbedtls_md_info_t* md_info;
-  unsigned char hash[MBEDTLS_MD_MAX_SIZE];
-
-  mbedtls_x509_crt_init(&parent);
-
-  if ((ret = mbedtls_pk_parse_public_key(&parent.pk, pub_key_buf,
-                                         pub_key_len)) != 0) {
+static std::shared_ptr<mbedtls_pk_context> parsePublicKey(
+    const uint8_t* pub_key_buf, size_t pub_key_len) {
+  auto pk = std::shared_ptr<mbedtls_pk_context>(new mbedtls_pk_context,
+                                                [](mbedtls_pk_context* pk) {
+                                                  mbedtls_pk_free(pk);
+                                                  delete pk;
+                                                });
+  mbedtls_pk_init(pk.get());
+
+  int ret = mbedtls_pk_parse_public_key(pk.get(), pub_key_buf, pub_key_len);
+  if (ret != 0) {
     BELL_LOG(error, TAG, "PK parse failed with error 0x%04x, key len = %d", ret,
              pub_key_len);
-    goto cleanup;
+    return nullptr;
   }
+  return pk;
+}
+
+static int checkSignature(mbedtls_x509_crt* child, mbedtls_pk_context* pk) {
+  int ret = 0;
+  const mbedtls_md_info_t* md_info;
+  unsigned char hash[MBEDTLS_MD_MAX_SIZE];
 
   // Fast check to avoid expensive computations when not necessary
-  if (!mbedtls_pk_can_do(&parent.pk, child->MBEDTLS_PRIVATE(sig_pk))) {
+  if (!mbedtls_pk_can_do(pk, child->MBEDTLS_PRIVATE(sig_pk))) {
     BELL_LOG(error, TAG, "Simple compare failed");
-    ret = -1;
-    goto cleanup;
+    return -1;
   }
 
   md_info = mbedtls_md_info_from_type(child->MBEDTLS_PRIVATE(sig_md));
   if ((ret = mbedtls_md(md_info, child->tbs.p, child->tbs.len, hash)) != 0) {
     BELL_LOG(error, TAG, "Internal mbedTLS error %X", ret);
-    goto cleanup;
+    return ret;
   }
 
   if ((ret = mbedtls_pk_verify_ext(
-           child->MBEDTLS_PRIVATE(sig_pk), child->MBEDTLS_PRIVATE(sig_opts),
-           &parent.pk, child->MBEDTLS_PRIVATE(sig_md), hash,
-           mbedtls_md_get_size(md_info), child->MBEDTLS_PRIVATE(sig).p,
-           child->MBEDTLS_PRIVATE(sig).len)) != 0) {
-
+           child->MBEDTLS_PRIVATE(sig_pk), child->MBEDTLS_PRIVATE(sig_opts), pk,
+           child->MBEDTLS_PRIVATE(sig_md), hash, mbedtls_md_get_size(md_info),
+           child->MBEDTLS_PRIVATE(sig).p, child->MBEDTLS_PRIVATE(sig).len)) !=
+      0) {
     BELL_LOG(error, TAG, "PK verify failed with error %X", ret);
-    goto cleanup;
   }
-cleanup:
-  mbedtls_x509_crt_free(&parent);
-
   return ret;
 }
 
+/* Key of a bundle entry, parsed on first use */
+static std::shared_ptr<mbedtls_pk_context> rootKey(const uint8_t* crt) {
+  {
+    std::scoped_lock lock(s_parsed_keys_mutex);
+    for (auto it = s_parsed_keys.begin(); it != s_parsed_keys.end(); it++) {
+      if (it->crt == crt) {
+        s_parsed_keys.splice(s_parsed_keys.begin(), s_parsed_keys, it);
+        return it->pk;
+      }
+    }
+  }
+
+  size_t name_len = crt[0] << 8 | crt[1];
+  size_t key_len = crt[2] << 8 | crt[3];
+  auto pk = parsePublicKey(crt + CRT_HEADER_OFFSET + name_len, key_len);
+  if (pk == nullptr) {
+    return nullptr;
+  }
+
+  std::scoped_lock lock(s_parsed_keys_mutex);
+  for (auto& parsed : s_parsed_keys) {
+    // Another handshake got there first
+    if (parsed.crt == crt) {
+      return parsed.pk;
+    }
+  }
+  if (s_parsed_keys.size() >= MAX_PARSED_KEYS) {
+    s_parsed_keys.pop_back();
+  }
+  s_parsed_keys.push_front({crt, pk});
+  return pk;
+}
+
+int bell::X509Bundle::crtCheckCertificate(mbedtls_x509_crt* child,
+                                          const uint8_t* pub_key_buf,
+                                          size_t pub_key_len) {
+  auto pk = parsePublicKey(pub_key_buf, pub_key_len);
+  if (pk == nullptr) {
+    return MBEDTLS_ERR_X509_FATAL_ERROR;
+  }
+  return checkSignature(child, pk.get());
+}
+
 /* This callback is called for every certificate in the chain. If the chain
  * is proper each intermediate certificate is validated through its parent
  * in the x509_crt_verify_chain() function. So this callback should
@@ -129,11 +187,11 @@ int bell::X509Bundle::crtVerifyCallback(void* buf, mbedtls_x509_crt* crt,
 
   int ret = MBEDTLS_ERR_X509_FATAL_ERROR;
   if (crt_found) {
-    size_t key_len =
-        s_crt_bundle.crts[middle][2] << 8 | s_crt_bundle.crts[middle][3];
-    ret = crtCheckCertificate(
-        child, s_crt_bundle.crts[middle] + CRT_HEADER_OFFSET + name_len,
-        key_len);
+    // Keeps the key alive should another task evict it meanwhile
+    auto pk = rootKey(s_crt_bundle.crts[middle]);
+    if (pk != nullptr) {
+      ret = checkSignature(child, pk.get());
+    }
   } else {
     BELL_LOG(error, TAG, "Certificate not found in bundle");
   }
@@ -151,7 +209,9 @@ int bell::X509Bundle::crtVerifyCallback(void* buf, mbedtls_x509_crt* crt,
 /* Initialize the bundle into an array so we can do binary search for certs,
    the bundle generated by the python utility is already presorted by subject name
  */
-void bell::X509Bundle::init(const uint8_t* x509_bundle, size_t bundle_size) {
+void bell::X509Bundle::init(const uint8_t* x509_bundle, size_t bundle_size,
+                            bool copy) {
+  BELL_STARTUP_STEP("x509.init");
   if (bundle_size < BUNDLE_HEADER_OFFSET + CRT_HEADER_OFFSET) {
     throw std::runtime_error("Invalid certificate bundle");
   }
@@ -164,13 +224,18 @@ void bell::X509Bundle::init(const uint8_t* x509_bundle, size_t bundle_size) {
     throw std::runtime_error("Unable to allocate memory for bundle");
   }
 
-  bundleBytes.resize(bundle_size);
-  memcpy(bundleBytes.data(), x509_bundle, bundle_size);
+  /* Entries point into the caller's bundle, or into our own copy */
+  std::vector<uint8_t> bytes;
+  const uint8_t* bundle = x509_bundle;
+  if (copy) {
+    bytes.assign(x509_bundle, x509_bundle + bundle_size);
+    bundle = bytes.data();
+  }
 
   const uint8_t* cur_crt;
   /* This is the maximum region that is allowed to access */
-  const uint8_t* bundle_end = bundleBytes.data() + bundle_size;
-  cur_crt = bundleBytes.data() + BUNDLE_HEADER_OFFSET;
+  const uint8_t* bundle_end = bundle + bundle_size;
+  cur_crt = bundle + BUNDLE_HEADER_OFFSET;
 
   for (int i = 0; i < num_certs; i++) {
     crts[i] = cur_crt;
@@ -194,6 +259,13 @@ void bell::X509Bundle::init(const uint8_t* x509_bundle, size_t bundle_size) {
   free(s_crt_bundle.crts);
   s_crt_bundle.num_certs = num_certs;
   s_crt_bundle.crts = crts;
+  bundleBytes.swap(bytes);
+
+  /* Cached keys belong to the previous bundle */
+  {
+    std::scoped_lock lock(s_parsed_keys_mutex);
+    s_parsed_keys.clear();
+  }
 
   // Enable certificate verification
   s_should_verify_certs = true;
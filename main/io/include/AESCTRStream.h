@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t
+#include <memory>    // for shared_ptr
+#include <vector>    // for vector
+
+#include "ByteStream.h"  // for ByteStream
+#include "Crypto.h"      // for AESCTRCipher
+
+namespace bell {
+/**
+ * Decrypts an AES-CTR encrypted source as it's read, in place in the
+ * reader's buffer. Wrapped in a BufferedStream, data is decrypted once, in
+ * the large blocks the buffer is filled with.
+ *
+ * The keystream follows the source's position, so streams that start at an
+ * offset into the encrypted file (e.g. a range request) decrypt correctly.
+ */
+class AESCTRStream : public bell::ByteStream {
+ public:
+  AESCTRStream(std::shared_ptr<bell::ByteStream> source,
+               const std::vector<uint8_t>& key, const std::vector<uint8_t>& iv);
+
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+
+  size_t position() override { return source->position(); }
+  size_t size() override { return source->size(); }
+  void close() override { source->close(); }
+
+  bool seek(size_t offset) override;
+
+ private:
+  std::shared_ptr<bell::ByteStream> source;
+  AESCTRCipher cipher;
+};
+}  // namespace bell
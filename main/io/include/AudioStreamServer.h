@@ -0,0 +1,194 @@
+#pragma once
+
+#include <stddef.h>            // for size_t
+#include <stdint.h>            // for uint8_t, uint32_t, uint64_t
+#include <atomic>              // for atomic
+#include <condition_variable>  // for condition_variable
+#include <functional>          // for function
+#include <memory>              // for shared_ptr, unique_ptr
+#include <mutex>               // for mutex
+#include <set>                 // for set
+#include <string>              // for string
+#include <vector>              // for vector
+
+#include "BellDSP.h"           // for BellDSP
+#include "BellHTTPServer.h"    // for BellHTTPServer
+#include "BellTask.h"          // for Task
+#include "CircularBuffer.h"    // for CircularBuffer
+#include "StreamInfo.h"        // for PcmFormat
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+struct OpusEncoder;
+
+namespace bell {
+namespace dsp {
+class PolyphaseResampler;
+}
+
+/**
+ * Serves the PCM passing a BellDSP tap to LAN clients over HTTP, as an
+ * endless WAV (16 bit) and as Ogg Opus, e.g. /stream.wav and /stream.opus.
+ *
+ * Each format is encoded once, by the server's task, into shared chunks
+ * kept in a ring; every client only holds a cursor into it and sends the
+ * chunks as they are. A client that falls a whole ring behind is dropped
+ * instead of holding up the others. A change of rate or channels ends the
+ * responses, the clients reconnect for the new format's header.
+ *
+ * Every client holds a civetweb worker thread while it listens.
+ *
+ * The WebSocket monitor, e.g. for a web UI to audition the DSP output, is
+ * downmixed to mono and decimated to monitorRate: every binary message is
+ * a raw Opus packet, for WebCodecs' AudioDecoder. A client gets a text
+ * message, {"codec":"opus","sampleRate":..,"channels":1}, on connecting.
+ * Messages go through BellHTTPServer::broadcastWS(), encoded once for all
+ * the clients.
+ */
+class AudioStreamServer : public bell::Task {
+ public:
+  typedef BellHTTPServer::HTTPResponse::Chunk Chunk;
+
+  struct Config {
+    // Routes, left out when empty. Opus needs BELL_CODEC_OPUS
+    std::string wavUrl = "/stream.wav";
+    std::string opusUrl = "/stream.opus";
+    uint32_t bitrate = 128000;
+    // Audio per chunk, an Opus frame size: 2.5, 5, 10, 20, 40 or 60
+    float chunkMs = 20;
+    // Chunks each format keeps, how far a client may fall behind
+    size_t ringChunks = 64;
+    // Audio the tap may queue for the task
+    uint32_t bufferMs = 200;
+    // WebSocket monitor, left out when empty. Needs BELL_CODEC_OPUS
+    std::string monitorUrl = "/monitor";
+    // Opus rate, 8000, 12000, 16000, 24000 or 48000
+    uint32_t monitorRate = 24000;
+    uint32_t monitorBitrate = 32000;
+  };
+
+  AudioStreamServer(BellHTTPServer& server)
+      : AudioStreamServer(server, Config()) {}
+  AudioStreamServer(BellHTTPServer& server, const Config& config);
+  ~AudioStreamServer();
+
+  // Starts the task, the routes are registered by the constructor
+  bool start();
+  // Ends every response, the routes answer 503 until start()
+  void stop();
+
+  // Hook for BellDSP::setTap(), the server must outlive it
+  BellDSP::Tap tap();
+
+  /**
+   * Queues PCM to serve, any format, with 2 channels at most. Dropped while
+   * nobody listens. Never blocks, for the audio thread.
+   */
+  void write(const uint8_t* data, size_t bytes, int channels,
+             uint32_t sampleRate, PcmFormat format);
+
+  // Clients listening, of every format and the monitor
+  size_t getClientCount();
+
+ private:
+  const char* TAG = "AudioStreamServer";
+
+  /**
+   * Chunks of one format, shared by the task and every client's response.
+   * Outlives the server while a response still runs.
+   */
+  class Feed : public std::enable_shared_from_this<Feed> {
+   public:
+    Feed(size_t capacity) : ring(capacity) {}
+
+    // Starts a stream with a header, the clients of the last one are ended
+    void reset(Chunk header);
+    void push(Chunk chunk);
+    // Ends every response, and refuses new ones
+    void close();
+    void open();
+    bool isOpen();
+
+    // Body of a new client's response
+    std::function<Chunk()> subscribe();
+
+    std::atomic<size_t> clients = 0;
+
+   private:
+    struct Client;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<Chunk> ring;
+    // Sequence of the next chunk pushed
+    uint64_t next = 0;
+    // Counts the resets, a client plays a single stream
+    uint64_t stream = 0;
+    Chunk header;
+    bool closed = true;
+
+    Chunk nextChunk(Client& client);
+  };
+
+  // Connected monitor clients, shared with the WebSocket handlers
+  struct Monitors {
+    std::mutex mutex;
+    std::set<struct mg_connection*> connections;
+    std::atomic<size_t> count = 0;
+  };
+
+  Config config;
+  BellHTTPServer& server;
+  std::shared_ptr<Feed> wavFeed, opusFeed;
+  std::shared_ptr<Monitors> monitors;
+
+  // 16 bit interleaved PCM from write()
+  std::unique_ptr<CircularBuffer> ring;
+  bell::WrappedSemaphore dataSem;
+  std::atomic<uint32_t> sampleRate = 0;
+  std::atomic<uint8_t> channels = 0;
+  // Set by write() on a format change, the task starts over
+  std::atomic<bool> restart = false;
+  // Written by the audio thread only
+  std::vector<int16_t> converted;
+
+  // Task only
+  uint32_t streamRate = 0;
+  uint8_t streamChannels = 0;
+  size_t chunkFrames = 0;
+  std::vector<int16_t> input;
+
+  ::OpusEncoder* encoder = nullptr;
+  std::unique_ptr<dsp::PolyphaseResampler> resampler;
+  std::vector<std::vector<float>> inPlanes, outPlanes;
+  std::vector<float> pending;
+  // Opus frames of a page, at 48 kHz
+  size_t opusFrames = 0;
+  uint32_t serial = 0;
+  uint32_t pageSequence = 0;
+  uint64_t granule = 0;
+
+  ::OpusEncoder* monitorEncoder = nullptr;
+  std::unique_ptr<dsp::PolyphaseResampler> monitorResampler;
+  std::vector<float> monitorIn, monitorOut, monitorPending;
+  size_t monitorFrames = 0;
+
+  void runTask() override;
+  void onStopRequested() override;
+
+  void route(const std::string& url, std::shared_ptr<Feed> feed,
+             const std::string& contentType);
+  void routeMonitor();
+  // Sets up the encoder and headers for the format write() announced
+  void configure();
+  void configureMonitor();
+  void release();
+  void drain();
+  void encodeWav(const int16_t* pcm, size_t frames);
+  void encodeOpus(const int16_t* pcm, size_t frames);
+  void encodeOpusFrame(const float* pcm);
+  void encodeMonitor(const int16_t* pcm, size_t frames);
+  // An Ogg page holding a single packet
+  void appendPage(std::vector<uint8_t>& out, const uint8_t* packet,
+                  size_t size, uint8_t flags, uint64_t granule);
+};
+}  // namespace bell
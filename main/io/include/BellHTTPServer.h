@@ -1,35 +1,110 @@
 #pragma once
 
-#include <BellLogger.h>   // for bell
-#include <stdint.h>       // for uint8_t
-#include <stdlib.h>       // for free, size_t
-#include <functional>     // for function
-#include <map>            // for map
-#include <memory>         // for unique_ptr
-#include <mutex>          // for mutex
-#include <string>         // for string, hash, operator==, operator<
-#include <unordered_map>  // for unordered_map
-#include <utility>        // for pair
-#include <vector>         // for vector
+#include <BellAllocator.h>  // for Allocator
+#include <BellLogger.h>     // for bell
+#include <ObjectPool.h>     // for ObjectPool
+#include <stdint.h>         // for uint8_t
+#include <stdlib.h>         // for size_t
+#include <functional>       // for function
+#include <map>              // for map
+#include <memory>           // for unique_ptr
+#include <mutex>            // for mutex
+#include <ostream>          // for ostream
+#include <span>             // for span
+#include <string>           // for string, hash, operator==, operator<
+#include <string_view>      // for string_view
+#include <unordered_map>    // for unordered_map
+#include <utility>          // for pair
+#include <vector>           // for vector
 
+#include "BellBuffer.h"   // for BufferSlice
+#include "BellTar.h"      // for mapped_archive
+#include "ByteStream.h"   // for ByteStream
 #include "CivetServer.h"  // for CivetServer, CivetHandler
+#include "JsonWriter.h"   // for JsonWriter
+
+class WebSocketHandler;
+class SSEChannel;
+
+// Responses alive at once before they come from the heap, about one per
+// civetweb worker thread
+#ifndef BELL_HTTP_RESPONSE_POOL_SIZE
+#define BELL_HTTP_RESPONSE_POOL_SIZE 4
+#endif
+
+// Bytes of an upload read from the connection at a time
+#ifndef BELL_HTTP_UPLOAD_CHUNK
+#define BELL_HTTP_UPLOAD_CHUNK 4096
+#endif
 
 using namespace bell;
 namespace bell {
 class BellHTTPServer : public CivetHandler {
  public:
-  BellHTTPServer(int serverPort);
+  struct Config {
+    // civetweb workers, each serves one connection at a time, a kept alive
+    // one included
+    int numThreads = 4;
+    // Accepted connections waiting for a worker
+    int connectionQueue = 20;
+    // Handlers writing their response themselves have to delimit its body
+    bool keepAlive = false;
+    uint32_t keepAliveTimeoutMs = 500;
+    uint32_t requestTimeoutMs = 30000;
+    // More civetweb options, as name and value pairs
+    std::vector<std::string> options;
+  };
+
+  BellHTTPServer(int serverPort) : BellHTTPServer(serverPort, Config()) {}
+  BellHTTPServer(int serverPort, const Config& config);
   ~BellHTTPServer();
 
   enum class WSState { CONNECTED, READY, CLOSED };
 
+  /**
+   * How a route's handler runs against the others. SERIALIZED ones run one
+   * at a time, behind a lock shared by all of them; PARALLEL ones run on
+   * any worker at once, for handlers safe to call concurrently, e.g.
+   * read-only ones. Responses are sent without the lock either way. The
+   * metrics, trace and static file routes are PARALLEL.
+   */
+  enum class Concurrency { SERIALIZED, PARALLEL };
+
+  /**
+   * Response sent once the handler returns. With none of the bodies set,
+   * the handler is expected to have written the response itself.
+   *
+   * The streamed bodies are sent without holding the server's handler lock,
+   * so a slow client doesn't hold up other requests.
+   */
   struct HTTPResponse {
+    typedef std::shared_ptr<const std::vector<uint8_t>> Chunk;
+
+    // From bell::Allocator::allocate(), released with the response
     uint8_t* body;
     size_t bodySize;
     std::map<std::string, std::string> headers;
 
     int status;
 
+    // Sent with a Content-Length when its size() is known, chunked otherwise
+    std::shared_ptr<bell::ByteStream> bodyStream;
+    // Path of a file, streamed as bodyStream is, a 404 if it can't be read
+    std::string bodyFile;
+    // Fills buf with the next piece of the body, until it returns 0
+    std::function<size_t(uint8_t* buf, size_t len)> bodyGenerator;
+    // Bytes owned elsewhere, e.g. a mapped archive member, written as they
+    // are. They have to outlive the response
+    std::span<const uint8_t> bodyView;
+    // Keeps the block of a bodyView taken from a bell::Buffer until the
+    // response is sent, see makeSliceResponse()
+    bell::BufferSlice bodySlice;
+    // Next chunk of the body, until it returns nullptr. Written as it is,
+    // so a chunk shared by many responses is never copied for one
+    std::function<Chunk()> bodyChunks;
+    // Writes the whole body to the stream, sent chunked as it's written
+    std::function<void(std::ostream& out)> bodyWriter;
+
     HTTPResponse() {
       body = nullptr;
       bodySize = 0;
@@ -38,10 +113,16 @@ class BellHTTPServer : public CivetHandler {
 
     ~HTTPResponse() {
       if (body != nullptr) {
-        free(body);
+        bell::Allocator::release(body);
         body = nullptr;
       }
     }
+
+    // Served from a fixed pool, exported as "pool.http_response"
+    typedef ObjectPool<HTTPResponse, BELL_HTTP_RESPONSE_POOL_SIZE> Pool;
+    static Pool& pool();
+    static void* operator new(size_t size) { return pool().allocate(size); }
+    static void operator delete(void* ptr) { pool().release(ptr); }
   };
   typedef std::function<std::unique_ptr<HTTPResponse>(
       struct mg_connection* conn)>
@@ -51,11 +132,49 @@ class BellHTTPServer : public CivetHandler {
   typedef std::function<void(struct mg_connection* conn, char*, size_t)>
       WSDataHandler;
 
+  /**
+   * Takes a POST body as it's read, for bodies too large to hold, e.g.
+   * firmware images. A multipart/form-data body comes part by part, each
+   * begun, written and ended in turn; any other is a single part of the
+   * request's Content-Type. A call returning false aborts the upload,
+   * finish() is called either way.
+   */
+  class UploadHandler {
+   public:
+    struct Part {
+      // Form field and file name, empty outside of multipart
+      std::string name;
+      std::string filename;
+      std::string contentType;
+    };
+
+    virtual ~UploadHandler() = default;
+
+    virtual bool beginPart(const Part& part) = 0;
+    virtual bool write(const uint8_t* data, size_t size) = 0;
+    virtual bool endPart() = 0;
+    // complete is false for an aborted, cut short or malformed upload
+    virtual std::unique_ptr<HTTPResponse> finish(BellHTTPServer& server,
+                                                 bool complete) = 0;
+  };
+  // A handler for each upload, nullptr refuses it with a 403
+  typedef std::function<std::unique_ptr<UploadHandler>(
+      struct mg_connection* conn)>
+      UploadFactory;
+
+  /**
+   * Trie of path segments, "/users/:id/<wildcard>" style. Literal segments
+   * win over parameters, parameters over catch-alls. Lookups compare
+   * string_views and don't allocate.
+   */
   class Router {
    public:
     struct RouterNode {
-      std::unordered_map<std::string, std::unique_ptr<RouterNode>> children;
+      // Transparent, to look segments up without building strings
+      std::map<std::string, std::unique_ptr<RouterNode>, std::less<>>
+          children;
       HTTPHandler value = nullptr;
+      Concurrency concurrency = Concurrency::SERIALIZED;
       std::string paramName = "";
 
       bool isParam = false;
@@ -67,44 +186,223 @@ class BellHTTPServer : public CivetHandler {
     typedef std::unordered_map<std::string, std::string> Params;
     typedef std::pair<HTTPHandler, Params> HandlerAndParams;
 
-    std::vector<std::string> split(const std::string str,
-                                   const std::string regex_str);
+    // Views into the route and the tree, valid while neither changes
+    struct Match {
+      static constexpr size_t MAX_PARAMS = 8;
+
+      const HTTPHandler* handler = nullptr;
+      Concurrency concurrency = Concurrency::SERIALIZED;
+      std::pair<std::string_view, std::string_view> params[MAX_PARAMS];
+      size_t paramCount = 0;
+      bool catchAll = false;
+
+      // Params for extractParams(), allocates
+      Params toParams() const;
+    };
+
+    void insert(const std::string& route, HTTPHandler& value,
+                Concurrency concurrency = Concurrency::SERIALIZED);
 
-    void insert(const std::string& route, HTTPHandler& value);
+    // @returns false without a handler for route
+    bool match(std::string_view route, Match& match) const;
 
     HandlerAndParams find(const std::string& route);
   };
 
   std::vector<int> getListeningPorts() { return server->getListeningPorts(); };
-  void close() { server->close(); }
+  // Ends the SSE streams too, their handlers hold civetweb's workers
+  void close();
 
   std::unique_ptr<HTTPResponse> makeJsonResponse(const std::string& json,
                                                  int status = 200);
+  /**
+   * JSON written straight to the connection by write, through a JsonWriter,
+   * instead of a whole document built first. write runs as the response is
+   * sent, after the handler returned and without its lock: it has to own
+   * or safely share what it reads
+   */
+  std::unique_ptr<HTTPResponse> makeJsonStreamResponse(
+      std::function<void(bell::JsonWriter& json)> write, int status = 200);
   std::unique_ptr<HTTPResponse> makeEmptyResponse();
+  // Sends slice as it is, the response holds a reference to its buffer
+  std::unique_ptr<HTTPResponse> makeSliceResponse(
+      const bell::BufferSlice& slice, const std::string& contentType,
+      int status = 200);
+  std::unique_ptr<HTTPResponse> makeStreamResponse(
+      std::shared_ptr<bell::ByteStream> stream, const std::string& contentType,
+      int status = 200);
+  std::unique_ptr<HTTPResponse> makeFileResponse(const std::string& path,
+                                                 const std::string& contentType,
+                                                 int status = 200);
+  std::unique_ptr<HTTPResponse> makeGeneratorResponse(
+      std::function<size_t(uint8_t* buf, size_t len)> generator,
+      const std::string& contentType, int status = 200);
+  std::unique_ptr<HTTPResponse> makeChunkResponse(
+      std::function<HTTPResponse::Chunk()> chunks,
+      const std::string& contentType, int status = 200);
 
   void registerNotFound(HTTPHandler handler);
-  void registerGet(const std::string&, HTTPHandler handler);
-  void registerPost(const std::string&, HTTPHandler handler);
+  void registerGet(const std::string&, HTTPHandler handler,
+                   Concurrency concurrency = Concurrency::SERIALIZED);
+  void registerPost(const std::string&, HTTPHandler handler,
+                    Concurrency concurrency = Concurrency::SERIALIZED);
   void registerWS(const std::string&, WSDataHandler dataHandler,
                   WSStateHandler stateHandler);
+  /**
+   * POST bodies streamed to a handler from factory, BELL_HTTP_UPLOAD_CHUNK
+   * bytes at a time, whatever their size. PARALLEL by default, an upload
+   * would hold the SERIALIZED routes for as long as it lasts
+   */
+  void registerUpload(const std::string& url, UploadFactory factory,
+                      Concurrency concurrency = Concurrency::PARALLEL);
+  // Serves bell::Metrics::toJson(), empty without BELL_METRICS. The heap
+  // gauges are sampled for every request, see Metrics::sampleHeap()
+  void registerMetrics(const std::string& url = "/metrics");
+  // Same in Prometheus' text format, Metrics::toPrometheus(), for a scrape
+  // config pointing at url
+  void registerPrometheusMetrics(const std::string& url = "/metrics/prom");
+  // Serves bell::Trace::toJson(), for chrome://tracing or ui.perfetto.dev.
+  // Empty without BELL_TRACE
+  void registerTrace(const std::string& url = "/trace");
+
+  /**
+   * Serves the members of a tar bundle under url, "/ui" maps "/ui/app.js"
+   * to the member "app.js". Bytes go out from the mapping, without a copy.
+   *
+   * A member stored as "app.js.br" or "app.js.gz" is sent instead of
+   * "app.js" to clients accepting that encoding, the bundle may hold only
+   * the compressed variants. Every response carries an ETag, a matching
+   * If-None-Match gets a 304.
+   * @param indexFile member served for url itself and paths ending in '/'
+   */
+  void registerStaticFiles(
+      const std::string& url,
+      std::shared_ptr<bell::BellTar::mapped_archive> archive,
+      const std::string& indexFile = "index.html");
+
+  /**
+   * Sends one message to every client connected to the registered url. The
+   * frame is encoded once and shared by all the clients' queues. A client
+   * more than WS_MAX_QUEUED_FRAMES behind is disconnected instead of
+   * holding up the others.
+   * @param opcode MG_WEBSOCKET_OPCODE_TEXT or MG_WEBSOCKET_OPCODE_BINARY
+   * @returns number of clients the message was queued for
+   */
+  size_t broadcastWS(const std::string& url, const uint8_t* data, size_t len,
+                     int opcode = MG_WEBSOCKET_OPCODE_TEXT);
+  size_t broadcastWS(const std::string& url, const std::string& message);
 
+  static constexpr size_t WS_MAX_QUEUED_FRAMES = 16;
+
+  /**
+   * Serves url as a Server-Sent Events stream of the state publishSSE()
+   * sets, instead of clients polling for it. A client gets every key's
+   * latest data on connect, then each change; changes made while it's
+   * behind coalesce into the latest. Events carry ids, a reconnecting
+   * client's Last-Event-ID skips what it has seen already.
+   *
+   * Every client holds a civetweb worker, see Config::numThreads.
+   * @param heartbeatMs idle time before a comment line is sent, which also
+   * finds the clients gone
+   */
+  void registerSSE(const std::string& url, uint32_t heartbeatMs = 15000);
+  // Sets the state of key on url's stream, sent as an event named key. A
+  // multi-line data goes out as several data lines
+  void publishSSE(const std::string& url, const std::string& key,
+                  const std::string& data);
+
+  // Route parameters of the request being handled, built on every call.
+  // extractParam() and extractQuery() are the ones for hot routes
   static std::unordered_map<std::string, std::string> extractParams(
       struct mg_connection* conn);
+  /**
+   * Same for a single parameter, without allocating
+   * @returns a view into the request's URI, empty when there is no such
+   * parameter. Valid while the handler runs
+   */
+  static std::string_view extractParam(struct mg_connection* conn,
+                                       std::string_view name);
+
+  /**
+   * The name=value pairs of a query string or of a urlencoded form, as
+   * views into the text they were parsed from, which has to outlive them.
+   * Nothing is copied: values stay encoded until decode() is asked for one,
+   * into the caller's buffer. Names are matched as sent, pairs past
+   * MAX_PARAMS are dropped.
+   */
+  class QueryParams {
+   public:
+    static constexpr size_t MAX_PARAMS = 16;
+
+    QueryParams() = default;
+    QueryParams(std::string_view text);
+
+    bool has(std::string_view name) const;
+    // Still encoded, empty when missing
+    std::string_view get(std::string_view name) const;
+    /**
+     * Decodes name's value into buf, '+' as a space
+     * @returns the decoded text in buf, empty when missing or when it
+     * doesn't fit
+     */
+    std::string_view decode(std::string_view name, char* buf,
+                            size_t size) const;
+    // fallback when missing or not an integer
+    long getInt(std::string_view name, long fallback = 0) const;
+
+    size_t size() const { return count; }
+    const std::pair<std::string_view, std::string_view>& operator[](
+        size_t index) const {
+      return params[index];
+    }
+
+   private:
+    std::pair<std::string_view, std::string_view> params[MAX_PARAMS];
+    size_t count = 0;
+  };
+
+  // Query string of the request being handled, valid while the handler runs
+  static QueryParams extractQuery(struct mg_connection* conn);
+  /**
+   * Reads an application/x-www-form-urlencoded body into buf
+   * @returns its pairs, viewing buf. None when the body doesn't fit
+   */
+  static QueryParams extractForm(struct mg_connection* conn, char* buf,
+                                 size_t size);
 
  private:
   std::unique_ptr<CivetServer> server;
   std::vector<std::string> civetWebOptions;
   int serverPort = 8080;
+  bool keepAlive = false;
 
   Router getRequestsRouter;
   Router postRequestsRouter;
+  std::mutex wsHandlersMutex;
+  // Owned by civetweb once registered
+  std::map<std::string, WebSocketHandler*> wsHandlers;
+  std::mutex sseMutex;
+  std::map<std::string, std::shared_ptr<SSEChannel>> sseChannels;
+  // Held while a SERIALIZED handler runs
   std::mutex responseMutex;
   HTTPHandler notFoundHandler;
 
   static std::mutex initMutex;
 
+  // Block size of streamed bodies
+  static constexpr size_t STREAM_CHUNK_SIZE = 4096;
+
   bool handleGet(CivetServer* server, struct mg_connection* conn);
   bool handlePost(CivetServer* server, struct mg_connection* conn);
+
+  // Whether civetweb keeps conn open once the response is sent
+  bool keepsAlive(struct mg_connection* conn);
+  void writeHead(struct mg_connection* conn, HTTPResponse& reply,
+                 const std::string& extraHeaders);
+  // @returns false when reply carries no body, i.e. was sent by the handler
+  bool sendResponse(struct mg_connection* conn, HTTPResponse& reply);
+  // Makes the SSE handlers return
+  void closeSSE();
 };
 
 }  // namespace bell
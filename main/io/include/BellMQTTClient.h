@@ -1,17 +1,67 @@
 #pragma once
-#include <stdint.h>    // for uint8_t, uint16_t
-#include <functional>  // for function
-#include <string>      // for string
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint8_t, uint16_t, uint32_t
+#include <atomic>       // for atomic
+#include <deque>        // for deque
+#include <functional>   // for function
+#include <map>          // for map
+#include <memory>       // for unique_ptr
+#include <mutex>        // for mutex
+#include <set>          // for set
+#include <span>         // for span
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
 
-#include "TCPSocket.h"  // for TCPSocket
-#include "mqtt.h"       // for MQTT_PUBLISH_QOS_0, MQTT_PUBLISH_QOS_1, MQTT_...
+#include "BellSocket.h"  // for Socket
+#include "EventLoop.h"   // for EventLoop
+#include "mqtt.h"        // for MQTT_PUBLISH_QOS_0, MQTT_PUBLISH_QOS_1, MQTT_...
 
 namespace bell {
 /// MQTTClient is a thin wrapper around the MQTT client library.
 class MQTTClient {
  public:
-  MQTTClient(){};
-  ~MQTTClient() = default;
+  struct Config {
+    // The library's packet buffers
+    size_t sendBufferSize = 2048;
+    size_t recvBufferSize = 1024;
+    // Publishes waiting for room in the send buffer, beyond it publish()
+    // reports backpressure
+    size_t maxQueuedBytes = 8192;
+
+    // Connects through a TLSSocket, which shares its SSL config with the
+    // other TLS connections. Reconnects resume the last session with the
+    // broker, an abbreviated handshake, when the broker still has it
+    bool tls = false;
+
+    // Identifies the client to the broker, a persistent session needs one
+    std::string clientId;
+    // The broker keeps the subscriptions, and what they got while the
+    // client was away, across reconnects
+    bool persistentSession = false;
+    uint16_t keepAliveSec = 400;
+
+    // Reconnects when the connection drops, after reconnectMinMs at first,
+    // doubling up to reconnectMaxMs while attempts fail. Driven by sync()
+    // or the attached loop, an attempt blocks it for the TCP connect
+    bool autoReconnect = false;
+    uint32_t reconnectMinMs = 1000;
+    uint32_t reconnectMaxMs = 60000;
+
+    // QoS 1 and 2 publishes are kept until the broker acknowledges them, and
+    // sent again after a reconnect. A full outbox drops its oldest. 0 sends
+    // them as QoS 0 ones are, lost with the connection
+    size_t outboxBytes = 0;
+    // Bytes of resubscriptions and replayed publishes handed to the
+    // library per sync after a reconnect, so the backlog goes out in
+    // slices between the loop's other work
+    size_t reconnectBurstBytes = 2048;
+  };
+
+  MQTTClient() : MQTTClient(Config()) {}
+  MQTTClient(const Config& config);
+  // Not from the attached loop's task
+  ~MQTTClient();
 
   enum class QOS {
     AT_MOST_ONCE = MQTT_PUBLISH_QOS_0,
@@ -26,12 +76,25 @@ class MQTTClient {
                              const std::string& message)>
       PublishCallback;
 
+  // @brief Callback for when a message is published, without copies.
+  // @param topic The topic, valid during the call only.
+  // @param message The message, valid during the call only.
+  typedef std::function<void(std::string_view topic,
+                             std::span<const uint8_t> message)>
+      PublishViewCallback;
+
   // @brief Set the publish callback
   void setPublishCallback(PublishCallback callback) {
     _publishCallback = callback;
   }
 
+  // @brief Set the copy-free publish callback, replaces setPublishCallback's
+  void setPublishViewCallback(PublishViewCallback callback) {
+    _publishViewCallback = callback;
+  }
+
   // @brief Connect to an MQTT broker.
+  // Throws when the first attempt fails, autoReconnect or not.
   // @param host The host to connect to.
   // @param port The port to connect to.
   // @param username The username to authenticate with.
@@ -43,17 +106,58 @@ class MQTTClient {
   // @brief Disconnect from the MQTT broker.
   void disconnect();
 
+  // @brief Let an EventLoop drive the connection instead of sync().
+  // Publishes are flushed as soon as the socket takes them, coalesced.
+  // @param loop The loop, must outlive the attachment.
+  void attach(bell::EventLoop& loop);
+
+  // @brief Stop the attached loop from driving the connection.
+  // Not from the loop's task.
+  void detach();
+
   // @brief Synchronize with the MQTT broker.
   void sync();
 
   // @brief Publish a message to a topic.
+  // While reconnecting, QoS 0 messages are dropped and the others wait in
+  // the outbox.
   // @param topic The topic to publish to.
   // @param message The message to publish.
   // @param qos The quality of service to publish with.
-  void publish(const std::string& topic, const std::string& message,
+  // @return False when maxQueuedBytes are already waiting, try again later.
+  bool publish(const std::string& topic, const std::string& message,
                QOS qos = QOS::AT_MOST_ONCE);
 
+  // @brief Publish a preserialized payload to a topic.
+  // Doesn't allocate when the topic is cached and the send buffer has room,
+  // see cacheTopic().
+  // @return False when maxQueuedBytes are already waiting, try again later.
+  bool publish(std::string_view topic, std::span<const uint8_t> message,
+               QOS qos = QOS::AT_MOST_ONCE);
+
+  // @brief Publish bell::Metrics::toJson(), e.g. from a periodic task.
+  // @return False when maxQueuedBytes are already waiting, try again later.
+  bool publishMetrics(const std::string& topic, QOS qos = QOS::AT_MOST_ONCE);
+
+  // @brief Publish the metrics every intervalMs from the attached loop.
+  // A round the queue has no room for is skipped. Stopped by 0, or by
+  // detach().
+  void publishMetricsEvery(const std::string& topic, uint32_t intervalMs,
+                           QOS qos = QOS::AT_MOST_ONCE);
+
+  // @brief Keep a copy of a topic published to often, up to MAX_TOPICS.
+  // Topics are also cached on first publish while there is room.
+  void cacheTopic(std::string_view topic);
+
+  // @brief Bytes of publishes not handed to the library yet.
+  size_t queuedBytes();
+
+  // @brief Bytes of the outbox, acknowledged publishes leave it.
+  size_t outboxBytes();
+
   // @brief Subscribe to a topic.
+  // Kept for reconnects, resubscribed in batches unless the broker kept
+  // the session.
   // @param topic The topic to subscribe to.
   void subscribe(const std::string& topic, QOS qos = QOS::AT_MOST_ONCE);
 
@@ -65,17 +169,114 @@ class MQTTClient {
   // @retreturn True if the MQTT client is connected, false otherwise.
   bool isConnected();
 
+  // @brief Whether it reconnects, it only stops after disconnect().
+  bool isReconnecting() { return reconnecting; }
+
   // Directly mapped from mqtt client's publish_callback field
   void publishCallback(struct mqtt_response_publish* published);
 
  private:
-  bell::TCPSocket socket;
-  bool connected = false;
+  // Keeps the library's ping timer going while attached
+  static constexpr uint32_t TICK_MS = 1000;
+  static constexpr size_t MAX_TOPICS = 32;
+
+  struct QueuedPublish {
+    std::string topic;
+    std::string message;
+    QOS qos;
+  };
+
+  struct OutboxPublish {
+    std::string topic;
+    std::string message;
+    QOS qos;
+    // Given once handed to the library, 0 while waiting
+    uint16_t packetId = 0;
+    // Sent before, a broker may have it already
+    bool dup = false;
+  };
+
+  Config config;
+  // A TCPSocket, or a TLSSocket the library goes through with transport
+  std::unique_ptr<bell::Socket> socket;
+  struct mqtt_transport transport;
+  std::atomic<bool> connected = false;
+  // Set by connect(), cleared by disconnect(), with autoReconnect
+  std::atomic<bool> reconnecting = false;
+  std::string host;
+  uint16_t port = 0;
+  std::string username;
+  std::string password;
+  uint32_t backoffMs = 0;
+  int64_t nextAttemptMs = 0;
+  // Of the reconnect burst, what this sync may still hand over
+  size_t burstLeft = SIZE_MAX;
+  // Until the CONNACK tells whether the broker kept the session
+  bool awaitingConnack = false;
+  // From a reconnect until its backlog is handed over, see burstLeft
+  bool catchingUp = false;
   PublishCallback _publishCallback = nullptr;
+  PublishViewCallback _publishViewCallback = nullptr;
+
+  // NUL terminated topics for the library, found by string_view
+  std::mutex topicsMutex;
+  std::set<std::string, std::less<>> topics;
+
+  std::mutex queueMutex;
+  std::deque<QueuedPublish> queue;
+  size_t queueBytes = 0;
+  // Under queueMutex too
+  std::deque<OutboxPublish> outbox;
+  size_t outboxSize = 0;
+
+  std::mutex subscriptionsMutex;
+  std::map<std::string, QOS> subscriptions;
+  // Left to send again after a reconnect
+  std::vector<std::string> resubscribes;
+
+  // Serializes syncs between the loop and callers of sync()
+  std::mutex syncMutex;
+  bell::EventLoop* loop = nullptr;
+  std::atomic<bool> attached = false;
+  std::atomic<bool> pumpPosted = false;
+  uint32_t tickTimer = 0;
+  // Of publishMetricsEvery(), only touched on the loop's task
+  uint32_t metricsTimer = 0;
 
   // mqtt lib internals
   struct mqtt_client client;
-  uint8_t sendbuf[2048];
-  uint8_t recvbuf[1024];
+  std::vector<uint8_t> sendbuf;
+  std::vector<uint8_t> recvbuf;
+
+  // Socket and the library's CONNECT, expects syncMutex to be held
+  void open();
+  // The connection dropped, publishes in flight go back to the outbox
+  void lost();
+  // When one is due, expects syncMutex to be held
+  void tryReconnect();
+  // Hands queued publishes to the library while its send buffer has room
+  void drainQueue();
+  // Same for the outbox, within burstLeft
+  void drainOutbox();
+  // Drops what the broker acknowledged, expects queueMutex to be held
+  void sweepOutbox();
+  void resubscribe();
+  // Whether the burst allows size more bytes, counting them if it does
+  bool takeBurst(size_t size);
+  // Expects queueMutex to be held
+  bool hasRoom(size_t needed);
+  // @returns cached NUL terminated topic, nullptr when not cached
+  const char* findTopic(std::string_view topic);
+  // Hands the publish to the library when nothing is queued and it fits
+  bool publishDirect(const char* topic, std::span<const uint8_t> message,
+                     QOS qos);
+  void postPump();
+  void watchSocket();
+  void pump();
+  void scheduleTick();
+  void scheduleMetrics(const std::string& topic, uint32_t intervalMs,
+                       QOS qos);
+  void setCorked(bool corked);
+  bool hasUnsent();
 };
 }  // namespace bell
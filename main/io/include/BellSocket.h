@@ -1,10 +1,66 @@
 #pragma once
 
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t
 #include <string>
 
+/**
+ * Receive buffer of BULK sockets, 0 keeping the system's. Linux, Windows and
+ * macOS grow theirs with the transfer, a fixed size turning that off; on
+ * lwIP it should match TCP_WND.
+ */
+#ifndef BELL_SOCKET_BULK_RCVBUF
+#define BELL_SOCKET_BULK_RCVBUF 0
+#endif
+
 namespace bell {
 class Socket {
  public:
+  // Why the last read() or write() failed
+  enum class Error {
+    NONE,
+    // The deadline passed, the connection may only be stalled
+    TIMEOUT,
+    // Closed by the peer
+    CLOSED,
+    FAILED,
+  };
+
+  /**
+   * Longest a single read() or write() may wait, 0 waits forever. Connecting
+   * is bounded by DNSCache::Config::connectTimeoutMs, the TLS handshake by
+   * the read timeout.
+   */
+  struct Timeouts {
+    uint32_t readMs = 0;
+    uint32_t writeMs = 0;
+  };
+
+  // What the connection carries, picks its Options
+  enum class Profile {
+    // Requests and small replies, latency first
+    INTERACTIVE,
+    // Large downloads, e.g. audio, throughput first
+    BULK,
+  };
+
+  /**
+   * TCP options of a profile, each left as it is when 0 or when the platform
+   * lacks it, also when a connection switches profiles
+   */
+  struct Options {
+    // SO_RCVBUF and SO_SNDBUF, in bytes
+    int receiveBuffer = 0;
+    int sendBuffer = 0;
+    // Disables Nagle, so small writes leave at once
+    bool noDelay = true;
+    // Acks right away instead of delaying them, TCP_QUICKACK on Linux
+    bool quickAck = false;
+    // Unsent data the kernel holds at most, TCP_NOTSENT_LOWAT
+    int notSentLowat = 0;
+    // Idle time before keepalive probes find out a dead peer, SO_KEEPALIVE
+    int keepAliveIdleS = 0;
+  };
+
   Socket(){};
   virtual ~Socket() = default;
 
@@ -15,5 +71,41 @@ class Socket {
   virtual bool isOpen() = 0;
   virtual void close() = 0;
   virtual int getFd() = 0;
+
+  // Applies from the next open(), or right away when already open
+  void setTimeouts(const Timeouts& timeouts);
+  Timeouts getTimeouts() { return timeouts; }
+  Error getError() { return error; }
+
+  // Applies from the next open(), or right away when already open
+  void setProfile(Profile profile);
+  Profile getProfile() { return profile; }
+
+  // Timeouts of sockets created from then on
+  static void setDefaultTimeouts(const Timeouts& timeouts);
+
+  // Options of sockets using profile, from their next open() or setProfile()
+  static void setProfileOptions(Profile profile, const Options& options);
+  static Options getProfileOptions(Profile profile);
+
+ protected:
+  Timeouts timeouts = defaultTimeouts();
+  Error error = Error::NONE;
+  Profile profile = Profile::INTERACTIVE;
+  // Whether reads rearm TCP_QUICKACK, which Linux clears as it goes
+  bool quickAck = false;
+
+  // Sets the deadlines on fd, SO_RCVTIMEO and SO_SNDTIMEO
+  void applyTimeouts(int fd);
+  // Sets the options of the profile on fd
+  void applyProfile(int fd);
+  // Rearms TCP_QUICKACK after a read, when the profile wants it
+  void rearmQuickAck(int fd);
+  // Classifies a failed socket call from errno, a result of 0 as CLOSED
+  void setError(long result);
+
+ private:
+  static Timeouts& defaultTimeouts();
+  static Options& profileOptions(Profile profile);
 };
 }  // namespace bell
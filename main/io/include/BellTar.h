@@ -1,7 +1,17 @@
 #pragma once
 
-#include <iostream>  // for istream, ostream
-#include <string>    // for string
+#include <stddef.h>       // for size_t
+#include <stdint.h>       // for uint8_t
+#include <iostream>       // for istream, ostream
+#include <span>           // for span
+#include <string>         // for string
+#include <string_view>    // for string_view
+#include <unordered_map>  // for unordered_map
+#include <vector>         // for vector
+
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"  // for esp_partition_t, esp_partition_mmap
+#endif
 
 namespace bell::BellTar {
 typedef long long unsigned file_size_t;
@@ -72,4 +82,78 @@ class reader {
   // Returns number of files in tar at |inp|.
   int number_of_files();
 };
+
+////////////////////////////////////////
+// Random access
+////////////////////////////////////////
+
+// Where a member's data is, relative to the start of the archive
+struct entry {
+  std::string name;
+  file_size_t offset;
+  file_size_t size;
+  char file_type;
+};
+
+// Name to entry map of an archive, built in a single pass over the headers
+// or loaded from a copy saved alongside the archive.
+class archive_index {
+  std::vector<entry> _entries;
+  std::unordered_map<std::string_view, size_t> _by_name;
+  file_size_t _archive_size = 0;
+  void _map_names();
+
+ public:
+  // Reads only the headers, data is skipped with seekg().
+  bool build(std::istream& inp);
+  // Same over an archive in memory, e.g. a mapped one.
+  bool build(const uint8_t* data, size_t size);
+
+  // Binary copy of the index, load() fails unless it was saved for an
+  // archive of |archive_size| bytes, the caller rebuilds then.
+  void save(std::ostream& out) const;
+  bool load(std::istream& inp, file_size_t archive_size);
+
+  // nullptr when |name| isn't in the archive.
+  const entry* find(std::string_view name) const;
+  const std::vector<entry>& entries() const { return _entries; }
+  // Bytes up to the end of the last member
+  file_size_t archive_size() const { return _archive_size; }
+};
+
+// An archive mapped into memory, members are read where they lie. Linux
+// and macOS mmap() files, an ESP32 maps a data partition holding the tar
+// image, other platforms fall back to loading the file.
+class mapped_archive {
+  const uint8_t* _data = nullptr;
+  size_t _size = 0;
+  archive_index _index;
+  std::vector<uint8_t> _loaded;
+#ifdef ESP_PLATFORM
+  esp_partition_mmap_handle_t _mmap_handle = 0;
+#endif
+  bool _mapped = false;
+  void _open_index(const std::string& index_path);
+
+ public:
+  // |index_path| is read if it matches the archive, written otherwise. Empty
+  // to always index the archive in memory.
+  mapped_archive(const std::string& path, const std::string& index_path = "");
+#ifdef ESP_PLATFORM
+  mapped_archive(const esp_partition_t* partition,
+                 const std::string& index_path = "");
+#endif
+  ~mapped_archive();
+  mapped_archive(const mapped_archive&) = delete;
+  mapped_archive& operator=(const mapped_archive&) = delete;
+
+  bool is_open() const { return _data != nullptr; }
+  const archive_index& get_index() const { return _index; }
+
+  // Data of |name|, empty if it isn't there. Valid while this is.
+  std::span<const uint8_t> get(std::string_view name) const;
+
+  // Writes every regular file under |output_dir|, straight from the mapping.
+  void extract_all_files(std::string output_dir) const;
+};
 }  // namespace bell::BellTar
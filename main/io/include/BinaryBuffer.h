@@ -0,0 +1,141 @@
+#pragma once
+
+#include <bit>          // for endian
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint8_t, uint16_t, uint32_t, uint64_t
+#include <string.h>     // for memcpy
+#include <concepts>     // for integral
+#include <cstddef>      // for byte
+#include <span>         // for span
+#include <type_traits>  // for make_unsigned_t
+#include <vector>       // for vector
+
+namespace bell {
+/**
+ * BinaryStream's operators over memory: a span to read from, a fixed
+ * buffer or a growing vector to write to. The byte order is a template
+ * parameter, a field is a memcpy plus a byte swap known at compile time.
+ *
+ * Like an iostream, running past the end doesn't throw: reads give 0,
+ * writes are dropped, and good() turns false.
+ *
+ * BinaryBuffer<std::endian::big> frame(header);
+ * uint32_t length;
+ * frame >> length;
+ */
+template <std::endian ByteOrder>
+class BinaryBuffer {
+ public:
+  // Reads from data
+  BinaryBuffer(std::span<const uint8_t> data)
+      : readData(data.data()), capacity(data.size()) {}
+  // Writes into out, up to its size
+  BinaryBuffer(std::span<uint8_t> out)
+      : readData(out.data()), writeData(out.data()), capacity(out.size()) {}
+  // Appends to out
+  BinaryBuffer(std::vector<uint8_t>& out)
+      : arena(&out), offset(out.size()) {}
+
+  template <std::integral T>
+  static constexpr T convert(T value) {
+    if constexpr (sizeof(T) == 1 || ByteOrder == std::endian::native) {
+      return value;
+    } else if constexpr (sizeof(T) == 2) {
+      return (T)__builtin_bswap16((uint16_t)value);
+    } else if constexpr (sizeof(T) == 4) {
+      return (T)__builtin_bswap32((uint32_t)value);
+    } else {
+      static_assert(sizeof(T) == 8);
+      return (T)__builtin_bswap64((uint64_t)value);
+    }
+  }
+
+  template <std::integral T>
+  BinaryBuffer& operator>>(T& value) {
+    value = 0;
+    if (read(&value, sizeof(T))) {
+      value = convert(value);
+    }
+    return *this;
+  }
+  BinaryBuffer& operator>>(std::byte& value) {
+    value = std::byte(0);
+    read(&value, 1);
+    return *this;
+  }
+
+  template <std::integral T>
+  BinaryBuffer& operator<<(T value) {
+    value = convert(value);
+    write(&value, sizeof(T));
+    return *this;
+  }
+  BinaryBuffer& operator<<(std::byte value) {
+    write(&value, 1);
+    return *this;
+  }
+
+  // @returns false, reading nothing, if fewer than bytes are left
+  bool read(void* dst, size_t bytes) {
+    if (offset + bytes > capacity) {
+      failed = true;
+      return false;
+    }
+    memcpy(dst, readData + offset, bytes);
+    offset += bytes;
+    return true;
+  }
+
+  // Next bytes without a copy, empty if fewer are left
+  std::span<const uint8_t> readSpan(size_t bytes) {
+    if (offset + bytes > capacity) {
+      failed = true;
+      return {};
+    }
+    offset += bytes;
+    return {readData + offset - bytes, bytes};
+  }
+
+  // @returns false, writing nothing, if the fixed buffer is full
+  bool write(const void* src, size_t bytes) {
+    if (arena != nullptr) {
+      arena->resize(offset + bytes);
+      memcpy(arena->data() + offset, src, bytes);
+    } else if (offset + bytes > capacity) {
+      failed = true;
+      return false;
+    } else {
+      memcpy(writeData + offset, src, bytes);
+    }
+    offset += bytes;
+    return true;
+  }
+
+  bool skip(size_t bytes) {
+    if (arena == nullptr && offset + bytes > capacity) {
+      failed = true;
+      return false;
+    }
+    if (arena != nullptr) {
+      arena->resize(offset + bytes);
+    }
+    offset += bytes;
+    return true;
+  }
+
+  // Bytes read or written so far, from the start of the span
+  size_t position() const { return offset; }
+  size_t remaining() const {
+    return arena != nullptr ? 0 : capacity - offset;
+  }
+  bool good() const { return !failed; }
+
+ private:
+  const uint8_t* readData = nullptr;
+  uint8_t* writeData = nullptr;
+  std::vector<uint8_t>* arena = nullptr;
+  size_t capacity = 0;
+  size_t offset = 0;
+  bool failed = false;
+};
+}  // namespace bell
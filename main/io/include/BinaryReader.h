@@ -1,28 +1,83 @@
 #pragma once
 
-#include <stdint.h>  // for uint8_t, int16_t, int32_t, uint32_t
-#include <stdlib.h>  // for size_t
-#include <memory>    // for shared_ptr
-#include <vector>    // for vector
+#include <stdint.h>     // for uint8_t, int16_t, int32_t, uint32_t
+#include <stdlib.h>     // for size_t
+#include <string.h>     // for memcpy
+#include <memory>       // for shared_ptr
+#include <span>         // for span
+#include <type_traits>  // for is_integral_v
+#include <vector>       // for vector
 
 namespace bell {
 class ByteStream;
 
+/**
+ * Big-endian reader over a ByteStream. The stream is read in blocks into
+ * an internal buffer, fields are decoded from there, so a field costs a
+ * memcpy instead of a virtual read() each.
+ *
+ * The reader reads ahead: once it is in use, reads from the stream itself
+ * miss what's buffered. position() accounts for it.
+ */
 class BinaryReader {
   std::shared_ptr<ByteStream> stream;
-  size_t currentPos = 0;
+  std::vector<uint8_t> buffer;
+  // Unread bytes are buffer[head, tail)
+  size_t head = 0;
+  size_t tail = 0;
+
+  // Whether count bytes are buffered, reading more if needed
+  bool fill(size_t count);
+
+  template <typename T>
+  static T fromBigEndian(T value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if constexpr (sizeof(T) == 2) {
+      return (T)__builtin_bswap16((uint16_t)value);
+    } else if constexpr (sizeof(T) == 4) {
+      return (T)__builtin_bswap32((uint32_t)value);
+    } else if constexpr (sizeof(T) == 8) {
+      return (T)__builtin_bswap64((uint64_t)value);
+    }
+#endif
+    return value;
+  }
 
  public:
-  BinaryReader(std::shared_ptr<ByteStream> stream);
-  int32_t readInt();
-  int16_t readShort();
-  uint32_t readUInt();
-  long long readLong();
+  // @param bufferSize bytes asked from the stream at once
+  BinaryReader(std::shared_ptr<ByteStream> stream, size_t bufferSize = 1024);
+
+  // Big-endian integer, 0 when the stream ends first
+  template <typename T>
+  T read() {
+    static_assert(std::is_integral_v<T>, "integers only");
+    if (!fill(sizeof(T))) {
+      return 0;
+    }
+    T value;
+    memcpy(&value, buffer.data() + head, sizeof(T));
+    head += sizeof(T);
+    return fromBigEndian(value);
+  }
+
+  int32_t readInt() { return read<int32_t>(); }
+  int16_t readShort() { return read<int16_t>(); }
+  uint32_t readUInt() { return read<uint32_t>(); }
+  long long readLong() { return read<int64_t>(); }
+  uint8_t readByte() { return read<uint8_t>(); }
   void close();
-  uint8_t readByte();
   size_t size();
   size_t position();
+
+  /**
+   * Next count bytes, in the reader's buffer. Shorter at the end of the
+   * stream. Valid until the next call on the reader.
+   */
+  std::span<const uint8_t> readSpan(size_t count);
   std::vector<uint8_t> readBytes(size_t);
-  void skip(size_t);
+  // @returns bytes read into dst
+  size_t readBytes(uint8_t* dst, size_t count);
+  // Drops what's buffered, the rest is skipped by the stream
+  size_t skip(size_t);
 };
-}  // namespace bell
\ No newline at end of file
+}  // namespace bell
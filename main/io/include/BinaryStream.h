@@ -9,6 +9,7 @@
 #include <iostream>  // for istream, ostream
 
 namespace bell {
+// Reads and writes through iostreams, BinaryBuffer works on memory directly
 class BinaryStream {
  private:
   std::endian byteOrder;
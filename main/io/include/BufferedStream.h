@@ -3,13 +3,16 @@
 #include <stddef.h>    // for size_t
 #include <stdint.h>    // for uint32_t, uint8_t
 #include <atomic>      // for atomic
+#include <chrono>      // for steady_clock
 #include <functional>  // for function
 #include <memory>      // for shared_ptr
 #include <mutex>       // for mutex
 #include <string>      // for string
 
+#include "BellMetrics.h"       // for MemoryAccount
 #include "BellTask.h"          // for Task
 #include "ByteStream.h"        // for ByteStream
+#include "ReadAheadPolicy.h"   // for ReadAheadPolicy
 #include "WrappedSemaphore.h"  // for WrappedSemaphore
 
 /**
@@ -24,7 +27,11 @@
  * the caller code should be modified to check isReady() and isNotReady() flags.
  *
  * If the actual reading code can't be modified, waitForReady allows to wait for buffer readiness
- * during reading. Keep in mind that using the semaphore is probably more resource effective.
+ * during reading. The reader then sleeps on a semaphore until the buffer is ready again.
+ *
+ * The buffer is a single producer, single consumer ring: the task only moves the write pointer,
+ * read() only moves the read pointer, and the two only share the atomic readAvailable count.
+ * read() must not be called from more than one thread at a time.
  *
  * The source stream (passed to open() or returned by the reader) should implement the read()
  * method correctly, such as that 0 is returned if, and only if the stream ends.
@@ -33,6 +40,7 @@ class BufferedStream : public bell::ByteStream, bell::Task {
  public:
   typedef std::shared_ptr<bell::ByteStream> StreamPtr;
   typedef std::function<StreamPtr(uint32_t rangeStart)> StreamReader;
+  typedef std::function<void(uint32_t available)> WatermarkCallback;
 
  public:
   /**
@@ -50,10 +58,28 @@ class BufferedStream : public bell::ByteStream, bell::Task {
                  uint32_t readyThreshold, uint32_t notReadyThreshold,
                  bool waitForReady = false);
   ~BufferedStream() override;
+  /**
+	 * Stops the previous source, see close(), and buffers from the new one.
+	 *
+	 * @returns false if the previous task is still stuck in its source
+	 */
   bool open(const StreamPtr& stream);
+  /**
+	 * Same, the reader is called from the task for the first and every following
+	 * source, with the offset to continue from.
+	 *
+	 * @returns whether the task started
+	 */
   bool open(const StreamReader& newReader, uint32_t initialOffset = 0);
+  /**
+	 * Closes the source to unblock the task and waits at most STOP_TIMEOUT_MS for
+	 * it, so skipping tracks doesn't hang on a slow source. The destructor waits
+	 * for as long as it takes.
+	 */
   void close() override;
 
+  static constexpr uint32_t STOP_TIMEOUT_MS = 500;
+
   // inherited methods
  public:
   /**
@@ -69,6 +95,11 @@ class BufferedStream : public bell::ByteStream, bell::Task {
   size_t skip(size_t len) override;
   size_t position() override;
   size_t size() override;
+  /**
+	 * Restarts the source at offset through the StreamReader passed to open(),
+	 * dropping everything buffered. Plain streams can't seek.
+	 */
+  bool seek(size_t offset) override;
 
   // stream status
  public:
@@ -101,27 +132,60 @@ class BufferedStream : public bell::ByteStream, bell::Task {
 	 */
   bell::WrappedSemaphore readySem;
 
+  /**
+	 * Sets callbacks for the amount of buffered bytes crossing a watermark, e.g. to
+	 * pause playback or to report buffering. Both fire once per crossing. Call
+	 * before open() or after close(), from the thread calling read(); ignored
+	 * while the buffering task runs.
+	 *
+	 * @param lowWatermark onLow is called from read() when readAvailable drops below it
+	 * @param highWatermark onHigh is called from the buffering task when readAvailable
+	 * reaches it
+	 */
+  void setWatermarks(uint32_t lowWatermark, const WatermarkCallback& onLow,
+                     uint32_t highWatermark, const WatermarkCallback& onHigh);
+
+  /**
+	 * Lets policy resize reads and thresholds after every refill, instead of using
+	 * the constructor's values. Call before open().
+	 *
+	 * @param policy e.g. a bell::AdaptiveReadAhead, nullptr for the fixed values
+	 */
+  void setPolicy(const std::shared_ptr<bell::ReadAheadPolicy>& policy);
+
  private:
-  std::mutex runningMutex;
-  bool running = false;
-  bool terminate = false;
+  // Guards replacing source, so close() can close it under the task
+  std::mutex sourceMutex;
   bell::WrappedSemaphore
       readSem;  // signal to start writing to buffer after reading from it
-  std::mutex
-      readMutex;  // mutex for locking read operations during writing, and vice versa
+  bell::WrappedSemaphore
+      dataSem;  // signal to a waiting reader that data arrived, or the source ended
+  std::atomic<bool> readerWaiting = false;
+  uint32_t lowWatermark = 0;
+  uint32_t highWatermark = 0;
+  WatermarkCallback onLow;
+  WatermarkCallback onHigh;
+  std::shared_ptr<bell::ReadAheadPolicy> policy;
+  bell::ReadAheadPolicy::Limits limits;
   uint32_t bufferSize;
   uint32_t readAt;
   uint32_t readSize;
-  uint32_t readyThreshold;
-  uint32_t notReadyThreshold;
+  uint32_t fillLimit;
+  std::atomic<uint32_t> readyThreshold;
+  std::atomic<uint32_t> notReadyThreshold;
   bool waitForReady;
   uint8_t* buf;
+  bell::MemoryAccount memory = bell::MemoryAccount("buffered_stream");
   uint8_t* bufEnd;
   uint8_t* bufReadPtr;
   uint8_t* bufWritePtr;
   StreamPtr source;
   StreamReader reader;
+  StreamReader seekReader;  // reader of the last open(), kept for seek()
   void runTask() override;
+  void onStopRequested() override;
+  void setSource(const StreamPtr& newSource);
   void reset();
-  uint32_t lengthBetween(uint8_t* me, uint8_t* other);
+  void waitReady();
+  void applyLimits();
 };
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "BellBuffer.h"
+
 /**
  * A class for reading bytes from a stream. Further implemented in HTTPStream.h
  */
@@ -19,6 +21,23 @@ class ByteStream {
   virtual size_t position() = 0;
   virtual size_t size() = 0;
   virtual void close() = 0;
+
+  /**
+   * Moves the read position to an absolute offset, if the stream supports it
+   * @returns whether the stream was repositioned
+   */
+  virtual bool seek(size_t offset) { return false; }
+
+  /**
+   * Reads up to nbytes as a slice, to hand them on without further copies.
+   * Reads into a new Buffer, a stream whose bytes already are in one may
+   * return a slice of it instead
+   * @throws std::bad_alloc when the buffer can't be allocated
+   */
+  virtual BufferSlice readSlice(size_t nbytes) {
+    Buffer buffer = Buffer::allocate(nbytes);
+    return buffer.slice(0, read(buffer.data(), nbytes));
+  }
 };
 }  // namespace bell
 
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t, uint8_t
+#include <list>      // for list
+#include <map>       // for map
+#include <mutex>     // for mutex
+#include <string>    // for string
+#include <utility>   // for pair
+#include <vector>    // for vector
+
+#include "BufferedStream.h"  // for BufferedStream
+
+namespace bell {
+/**
+ * Content-addressed cache of fixed size chunks on a filesystem, so that a
+ * track played again doesn't go through the network. Any directory works:
+ * a local disk on Linux, an SD card or a FAT / LittleFS partition mounted
+ * in the VFS on the ESP32.
+ *
+ * A resource is named by a key, e.g. its file id, and cut in chunkSize
+ * chunks; each chunk is a file "<key hash>-<index>.chk" starting with a
+ * header and a CRC-32 of its bytes. A chunk failing the check is deleted
+ * and counts as a miss. The least recently used chunks are evicted once the
+ * cache goes over maxBytes. Recency is kept in memory; after a restart it
+ * starts from the time each chunk was written.
+ */
+class ChunkCache {
+ public:
+  struct Config {
+    // Created if missing
+    std::string path;
+    size_t maxBytes = 64 * 1024 * 1024;
+    // Unit of caching and eviction, the last chunk of a resource is shorter
+    size_t chunkSize = 64 * 1024;
+  };
+
+  struct Stats {
+    size_t chunks;
+    size_t bytes;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    // Chunks deleted for a bad header or checksum
+    size_t corrupt;
+  };
+
+  ChunkCache(const Config& config);
+
+  ChunkCache(const ChunkCache&) = delete;
+  ChunkCache& operator=(const ChunkCache&) = delete;
+
+  // FNV-1a, the name of a key's chunks
+  static uint64_t hashKey(const std::string& key);
+
+  size_t getChunkSize() const { return config.chunkSize; }
+
+  bool contains(uint64_t key, uint32_t index);
+
+  /**
+   * Reads a chunk, and marks it as recently used
+   * @param data filled with the chunk's bytes
+   * @param totalSize set to the size of the whole resource
+   * @returns false when it's missing or corrupt
+   */
+  bool load(uint64_t key, uint32_t index, std::vector<uint8_t>& data,
+            size_t& totalSize);
+
+  /**
+   * Writes a chunk, evicting others to make room. Failures are logged and
+   * leave the cache without the chunk
+   */
+  void store(uint64_t key, uint32_t index, const uint8_t* data, size_t length,
+             size_t totalSize);
+
+  // Deletes every chunk of key
+  void remove(uint64_t key);
+
+  Stats getStats();
+
+  /**
+   * StreamReader serving the resource key from the cache, and from upstream
+   * for the chunks it doesn't have, which are stored as they pass through.
+   * Upstream is only opened, at the first missing byte, when needed and
+   * closed again once the stream reaches a cached chunk. The cache must
+   * outlive the reader.
+   */
+  BufferedStream::StreamReader reader(
+      const std::string& key, const BufferedStream::StreamReader& upstream);
+
+ private:
+  typedef std::pair<uint64_t, uint32_t> ChunkId;
+
+  struct Entry {
+    ChunkId id;
+    size_t bytes;
+  };
+
+  Config config;
+  std::mutex mutex;
+  // Most recently used first
+  std::list<Entry> lru;
+  std::map<ChunkId, std::list<Entry>::iterator> index;
+  size_t usedBytes = 0;
+  size_t hits = 0, misses = 0, evictions = 0, corrupt = 0;
+
+  std::string chunkPath(const ChunkId& id) const;
+  void scan();
+  // Expects mutex to be held
+  void forget(std::map<ChunkId, std::list<Entry>::iterator>::iterator it);
+  void drop(const ChunkId& id, bool isCorrupt);
+};
+}  // namespace bell
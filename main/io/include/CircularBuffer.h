@@ -1,35 +1,86 @@
 #pragma once
 
+#include <atomic>   // for atomic
 #include <cstdint>  // for uint8_t
 #include <cstring>  // for size_t
 #include <memory>   // for unique_ptr
-#include <mutex>    // for mutex
 #include <vector>   // for vector
 
+#include "BellMetrics.h"       // for MemoryAccount
+#include "RTMutex.h"           // for RTMutex
 #include "WrappedSemaphore.h"  // for WrappedSemaphore
 
 namespace bell {
 class CircularBuffer {
  public:
-  CircularBuffer(size_t dataCapacity);
+  enum class Mode {
+    // Every operation is guarded by a mutex, any number of readers / writers
+    LOCKED,
+    // Lock-free, exactly one writer thread and one reader thread
+    SPSC,
+  };
+
+  CircularBuffer(size_t dataCapacity, Mode mode = Mode::LOCKED);
 
   std::unique_ptr<bell::WrappedSemaphore> dataSemaphore;
 
-  size_t size() const { return dataSize; }
+  size_t size() const;
 
   size_t capacity() const { return dataCapacity; }
 
+  Mode getMode() const { return mode; }
+
   size_t write(const uint8_t* data, size_t bytes);
   size_t read(uint8_t* data, size_t bytes);
   void emptyBuffer();
   void emptyExcept(size_t size);
 
+  /**
+   * Zero-copy access, SPSC mode only. Returns a pointer to `bytes` contiguous
+   * free bytes, or nullptr when there is not enough room before the wrap.
+   * Data becomes visible to the reader after writeCommit().
+   */
+  uint8_t* writeReserve(size_t bytes);
+  void writeCommit(size_t bytes);
+
+  /**
+   * Zero-copy access, SPSC mode only. Returns a pointer to `bytes` contiguous
+   * readable bytes, or nullptr when not available. The data stays valid until
+   * readRelease() hands the space back to the writer.
+   */
+  const uint8_t* readPeek(size_t bytes);
+  void readRelease(size_t bytes);
+
  private:
-  std::mutex bufferMutex;
+  Mode mode;
+  // Priority inheriting, an audio thread on one end may wait on the other
+  RTMutex bufferMutex;
   size_t begIndex = 0;
   size_t endIndex = 0;
   size_t dataSize = 0;
   size_t dataCapacity = 0;
   std::vector<uint8_t> buffer;
+  MemoryAccount memory = MemoryAccount("circular_buffer");
+
+  // SPSC mode positions, kept in [0, 2 * dataCapacity) so that a full and an
+  // empty buffer can be told apart without wasting a byte
+  std::atomic<size_t> readPos = 0;
+  std::atomic<size_t> writePos = 0;
+  // Consumer-only, position returned by the last readPeek()
+  size_t peekPos = 0;
+
+  size_t distance(size_t from, size_t to) const {
+    return to >= from ? to - from : to + 2 * dataCapacity - from;
+  }
+  size_t advance(size_t pos, size_t bytes) const {
+    pos += bytes;
+    return pos >= 2 * dataCapacity ? pos - 2 * dataCapacity : pos;
+  }
+  size_t toIndex(size_t pos) const {
+    return pos >= dataCapacity ? pos - dataCapacity : pos;
+  }
+
+  size_t writeSPSC(const uint8_t* data, size_t bytes);
+  size_t readSPSC(uint8_t* data, size_t bytes);
 };
-}  // namespace bell
\ No newline at end of file
+}  // namespace bell
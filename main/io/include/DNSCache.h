@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint16_t, uint32_t
+#include <chrono>    // for steady_clock
+#include <map>       // for map
+#include <mutex>     // for mutex
+#include <string>    // for string
+#include <vector>    // for vector
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>  // for sockaddr_storage, socklen_t, AF_INET
+#endif
+
+namespace bell {
+/**
+ * Process-wide cache of resolved host names, shared by TCPSocket, TLSSocket
+ * and AsyncSocket, so repeated connections to one host skip the blocking
+ * DNS round trip.
+ *
+ * getaddrinfo() doesn't report record TTLs, entries live for ttlMs instead.
+ * Failed lookups are cached for negativeTtlMs, so retries against a host
+ * that doesn't resolve fail fast.
+ */
+class DNSCache {
+ public:
+  struct Config {
+    uint32_t ttlMs = 60000;
+    uint32_t negativeTtlMs = 5000;
+    size_t maxEntries = 16;
+    // AF_UNSPEC for IPv6 and IPv4 addresses, or AF_INET for IPv4 only
+#ifdef ESP_PLATFORM
+    int family = AF_INET;
+#else
+    int family = AF_UNSPEC;
+#endif
+    // Next address is raced after this long without a connection
+    uint32_t raceDelayMs = 250;
+    uint32_t connectTimeoutMs = 10000;
+  };
+
+  struct Address {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int family;
+  };
+
+  static DNSCache& instance();
+
+  void setConfig(const Config& config);
+
+  /**
+   * Addresses of host, resolving it when not cached
+   * @returns addresses in resolver order, empty when host didn't resolve
+   */
+  std::vector<Address> resolve(const std::string& host, uint16_t port);
+
+  // Drops host, e.g. when none of its addresses accepts connections
+  void invalidate(const std::string& host, uint16_t port);
+  void clear();
+
+  /**
+   * Blocking TCP connect to host. Its addresses are tried one raceDelayMs
+   * after the other, alternating families, and the first connection to be
+   * established wins (RFC 8305 happy eyeballs). The winner is tried first
+   * the next time, so a host whose IPv6 route is broken costs one delay.
+   * @returns blocking connected socket, -1 on failure
+   */
+  int connect(const std::string& host, uint16_t port);
+
+ private:
+  struct Entry {
+    std::vector<Address> addresses;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  DNSCache() = default;
+
+  std::mutex mutex;
+  Config config;
+  std::map<std::string, Entry> entries;
+
+  // Expect mutex to be held
+  void evict();
+  // Moves address to the front of the cached entry
+  void prefer(const std::string& host, uint16_t port, const Address& address);
+};
+}  // namespace bell
@@ -1,56 +1,82 @@
 #pragma once
 
 #include <stddef.h>  // for size_t
-#include <cstdint>   // for uint8_t
+#include <cstdint>   // for uint8_t, uint32_t
 #include <memory>    // for shared_ptr, unique_ptr
-#include <string>    // for basic_string, string
-#include <vector>    // for vector
 
-#include "mp3dec.h"  // for MP3FrameInfo
+#include "AudioContainer.h"  // for AudioContainer
+#include "BaseCodec.h"       // for BaseCodec
+#include "ByteStream.h"      // for ByteStream
+#include "CodecType.h"       // for AudioCodec
+#include "StreamInfo.h"      // for PcmFormat
 
 namespace bell {
-class ByteStream;
-
-class EncodedAudioStream {
+/**
+ * Decoded view of an encoded stream: read() returns interleaved PCM, in
+ * getPcmFormat(), so the stream can stand in for a raw PCM source. The
+ * format is probed by AudioContainers, and the stream gets a codec of its
+ * own from AudioCodecs::createCodec(), so several of them play side by side.
+ *
+ * PCM is handed out straight from the codec's frame buffer, a frame is only
+ * decoded once the previous one was read completely.
+ */
+class EncodedAudioStream : public bell::ByteStream {
  public:
   EncodedAudioStream();
   ~EncodedAudioStream();
 
-  // Codecs supported by this stream class
-  enum class AudioCodec { AAC, MP3, OGG, NONE };
-
-  void openWithStream(std::unique_ptr<bell::ByteStream> byteStream);
-  size_t decodeFrame(uint8_t* dst);
+  /**
+   * Takes over byteStream, closing the previous one, and sets up a container
+   * and codec for it
+   * @returns false if the format isn't supported
+   */
+  bool openWithStream(std::unique_ptr<bell::ByteStream> byteStream);
   bool isReadable();
 
- private:
-  std::shared_ptr<ByteStream> innerStream;
-  std::vector<uint8_t> inputBuffer;
-  std::vector<short> outputBuffer;
-  std::string TAG = "EncryptedAudioStream";
+  // Reads up to nbytes of PCM, less only at the end of the stream
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
 
-  uint8_t* decodePtr = 0;
-  int bytesInBuffer = 0;
-  size_t offset = 0;
+  // PCM bytes read so far
+  size_t position() override { return pcmPosition; }
+  // PCM bytes of the whole track, 0 when unknown
+  size_t size() override;
+  void close() override;
 
-  size_t decodedSampleRate = 44100;
+  /**
+   * Moves to the frame at, or shortly before, timeMs, if the source and the
+   * container support it
+   */
+  bool seekToTime(uint32_t timeMs);
 
-  AudioCodec codec = AudioCodec::NONE;
+  // Output format, known once the first frame was decoded
+  uint32_t getSampleRate() { return codec ? codec->sampleRate : 0; }
+  uint8_t getChannelCount() { return codec ? codec->channelCount : 0; }
+  PcmFormat getPcmFormat() {
+    return codec ? codec->getPcmFormat() : PcmFormat::INT16;
+  }
+  AudioCodec getCodec();
 
-  void guessDataFormat();
+  // Container of the stream, e.g. for its gapless or ReplayGain info
+  AudioContainer* getContainer() { return container.get(); }
 
-  void readFully(uint8_t* dst, size_t nbytes);
-  bool vectorStartsWith(std::vector<uint8_t>&, std::vector<uint8_t>&);
+ private:
+  // Consecutive frames failing to decode before the stream counts as ended
+  static constexpr int MAX_FAILURES = 8;
+  const char* TAG = "EncodedAudioStream";
 
-  std::vector<uint8_t> aacMagicBytes = {0xFF, 0xF1};
-  std::vector<uint8_t> aacMagicBytes4 = {0xFF, 0xF9};
-  std::vector<uint8_t> mp3MagicBytesUntagged = {0xFF, 0xFB};
-  std::vector<uint8_t> mp3MagicBytesIdc = {0x49, 0x44, 0x33};
+  // Declared before the container, which reads from it
+  std::unique_ptr<ByteStream> innerStream;
+  std::unique_ptr<AudioContainer> container;
+  std::shared_ptr<BaseCodec> codec;
 
-  // AACFrameInfo aacFrameInfo;
-  MP3FrameInfo mp3FrameInfo;
+  // Rest of the last decoded frame, in the codec's buffer
+  uint8_t* frameData = nullptr;
+  uint32_t frameLeft = 0;
+  bool ended = false;
+  size_t pcmPosition = 0;
 
-  size_t decodeFrameMp3(uint8_t* dst);
-  size_t decodeFrameAAC(uint8_t* dst);
+  // Decodes the next frame with samples, false at the end
+  bool nextFrame();
 };
 }  // namespace bell
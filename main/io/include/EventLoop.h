@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint8_t, uint16_t, uint32_t
+#include <atomic>      // for atomic
+#include <chrono>      // for steady_clock
+#include <functional>  // for function
+#include <map>         // for map
+#include <memory>      // for shared_ptr, enable_shared_from_this
+#include <mutex>       // for mutex
+#include <span>        // for span
+#include <string>      // for string
+#include <vector>      // for vector
+
+#include "BellTask.h"          // for Task
+
+namespace bell {
+class IoUring;
+
+/**
+ * Single task reactor over select(), so many non-blocking sockets share one
+ * stack instead of a task each. select() is available on lwIP, POSIX and
+ * Winsock alike.
+ *
+ * Built with BELL_IO_URING, Linux waits on an io_uring instead when the
+ * kernel has it: every watch is a poll request, and all the changes of an
+ * iteration go in with the wait in a single system call, without select()'s
+ * FD_SETSIZE limit. File reads then complete in the ring too.
+ *
+ * Handlers, timers and posted callbacks all run on the loop's task, and
+ * must not block it. Every method is safe to call from any task.
+ */
+class EventLoop : public bell::Task {
+ public:
+  enum Events : int { READABLE = 1, WRITABLE = 2 };
+  typedef std::function<void(int events)> Handler;
+  typedef std::function<void()> Callback;
+  // Bytes read, 0 at the end of the file, or -errno
+  typedef std::function<void(int result)> ReadCallback;
+
+  EventLoop(const std::string& taskName = "event_loop",
+            int stackSize = 4096 * 2);
+  ~EventLoop();
+
+  bool start();
+  // Stops the loop, waiting for the current iteration to end
+  void stop();
+
+  /**
+   * Calls handler whenever fd becomes ready, replacing any previous watch
+   * @param events READABLE and/or WRITABLE, 0 keeps the handler but waits
+   * for nothing
+   */
+  void watch(int fd, int events, const Handler& handler);
+  // Changes the events of a watched fd
+  void modify(int fd, int events);
+  // Call before closing fd
+  void unwatch(int fd);
+
+  // Runs callback on the loop's task, once
+  void post(const Callback& callback);
+
+  /**
+   * Runs callback on the loop's task after delayMs
+   * @returns timer id for cancel(), never 0
+   */
+  uint32_t schedule(uint32_t delayMs, const Callback& callback);
+  void cancel(uint32_t timer);
+
+  /**
+   * Reads len bytes of fd at offset into dst, then calls callback on the
+   * loop's task. dst must stay valid until then. Without io_uring the read
+   * happens on the loop's task, blocking it, which only suits local files.
+   * @param offset -1 to read from the current position
+   */
+  void read(int fd, int64_t offset, uint8_t* dst, size_t len,
+            const ReadCallback& callback);
+
+  /**
+   * io_uring only, pins memory that read() destinations lie in, e.g. the
+   * rings of the streams it feeds, so that the kernel can skip mapping it
+   * on every read. Call before start().
+   */
+  bool registerBuffers(const std::vector<std::span<uint8_t>>& buffers);
+
+  // Whether the loop waits on an io_uring rather than select()
+  bool usesIoUring() const { return ring != nullptr; }
+
+ private:
+  // Upper bound of a select() wait, so stop() is noticed without a wake
+  static constexpr uint32_t MAX_WAIT_MS = 1000;
+
+  struct Watch {
+    int events;
+    Handler handler;
+    // Tells a new watch of a reused fd apart
+    uint64_t generation;
+  };
+
+  struct Read {
+    int fd;
+    int64_t offset;
+    uint8_t* dst;
+    size_t len;
+    ReadCallback callback;
+  };
+
+  struct Timer {
+    uint32_t id;
+    std::chrono::steady_clock::time_point due;
+    Callback callback;
+  };
+
+  std::mutex mutex;
+  std::map<int, Watch> watches;
+  std::vector<Callback> posted;
+  std::vector<Timer> timers;
+  uint32_t nextTimer = 1;
+  uint64_t nextGeneration = 1;
+  std::vector<Read> reads;
+
+  // UDP socket on loopback sending to itself, interrupts select()
+  int wakeFd = -1;
+
+  std::atomic<bool> running = false;
+
+  // Poll requests in the ring, the loop's task only
+  struct Armed {
+    uint64_t generation;
+    int events;
+    uint64_t tag;
+  };
+
+  std::unique_ptr<IoUring> ring;
+  std::map<int, Armed> armed;
+  // Tags of requests in flight, to their fd or read
+  std::map<uint64_t, int> polls;
+  std::map<uint64_t, ReadCallback> inFlight;
+  uint64_t nextTag = 1;
+  bool wakeArmed = false;
+
+  void wake();
+  void runTimers();
+  // Longest wait before a timer is due, 0 with callbacks posted. Locked
+  uint32_t waitMs();
+  // Calls the handlers of fds still watched for the events
+  void runHandlers(const std::vector<std::pair<int, int>>& ready);
+  // Timers and posted callbacks, once the fds are handled
+  void runCallbacks(std::vector<Callback>& callbacks);
+  void runSelect();
+  void runIoUring();
+  void runTask() override;
+};
+
+/**
+ * Non-blocking TCP connection driven by an EventLoop. Callbacks run on the
+ * loop's task; connect(), write() and close() may be called from any task.
+ * Plain TCP only, TLS connections still go through TLSSocket.
+ */
+class AsyncSocket : public std::enable_shared_from_this<AsyncSocket> {
+ public:
+  typedef std::function<void(bool connected)> ConnectCallback;
+  // Called for every block received, with len == 0 once the connection ends
+  typedef std::function<void(const uint8_t* data, size_t len)> DataCallback;
+
+  static std::shared_ptr<AsyncSocket> create(EventLoop& loop);
+  ~AsyncSocket();
+
+  /**
+   * Starts connecting. Name resolution blocks the calling task unless the
+   * host is in the DNSCache, the connection itself doesn't.
+   * @param onConnect called from the loop once connected, or on failure
+   */
+  void connect(const std::string& host, uint16_t port,
+               const ConnectCallback& onConnect);
+
+  // Set before connect()
+  void setDataCallback(const DataCallback& onData);
+
+  // Queues data, sent as fast as the connection takes it
+  void write(const uint8_t* data, size_t len);
+  void write(const std::string& data);
+
+  void close();
+
+  bool isConnected() { return connected; }
+
+  // Bytes queued but not sent yet
+  size_t pending();
+
+ private:
+  AsyncSocket(EventLoop& loop);
+
+  EventLoop& loop;
+  int fd = -1;
+  std::atomic<bool> connected = false;
+  bool connecting = false;
+  ConnectCallback onConnect;
+  DataCallback onData;
+
+  std::mutex outboxMutex;
+  std::vector<uint8_t> outbox;
+  size_t outboxPos = 0;
+  std::vector<uint8_t> readBuffer = std::vector<uint8_t>(1460);
+
+  // Loop's task only
+  void handle(int events);
+  void flush();
+  void finish();
+};
+}  // namespace bell
@@ -3,21 +3,40 @@
 #include <ByteStream.h>  // for ByteStream
 #include <stdint.h>      // for uint8_t
 #include <stdio.h>       // for size_t, FILE
+#include <span>          // for span
 #include <string>        // for string
+#include <vector>        // for vector
 
 /*
 * FileStream
 *
 * A class for reading and writing to files implementing the ByteStream interface.
 *
+* The size is read once when opening, and the position is tracked here, so
+* that neither costs a seek, e.g. for BufferedStream asking on every read.
 */
 namespace bell {
 class FileStream : public ByteStream {
  public:
+  struct Config {
+    // Maps the whole file on Linux, macOS and Windows, reads are then a
+    // memcpy() and mapped() hands out the bytes themselves. Falls back to
+    // buffered reads where it isn't available, e.g. on the ESP32
+    bool mmap = false;
+    // stdio buffer, rounded up to whole 4 KiB blocks so that refills line
+    // up with the filesystem's. 0 keeps the libc default
+    size_t readAhead = 0;
+    // Tells the kernel the file is read front to back, where posix_fadvise()
+    // exists, for a more aggressive read-ahead
+    bool sequential = true;
+  };
+
   FileStream(const std::string& path, std::string mode);
+  FileStream(const std::string& path, const Config& config);
   ~FileStream();
 
-  FILE* file;
+  // NULL when mapped
+  FILE* file = NULL;
 
   /*
         * Reads data from the stream.
@@ -31,14 +50,36 @@ class FileStream : public ByteStream {
 
   /*
         * Skips nbytes bytes in the stream.
+        * @return The number of bytes skipped, less than nbytes at the end.
         */
   size_t skip(size_t nbytes);
 
   size_t position();
 
+  bool seek(size_t offset) override;
+
   size_t size();
 
+  /*
+        * Whole file when mapped, empty otherwise. Valid until close().
+        */
+  std::span<const uint8_t> mapped() const;
+
   // Closes the connection
   void close();
+
+ private:
+  size_t fileSize = 0;
+  size_t filePosition = 0;
+  bool isOpen = false;
+
+  const uint8_t* mapping = nullptr;
+#ifdef _WIN32
+  void* mappingHandle = nullptr;
+#endif
+  std::vector<char> readAheadBuffer;
+
+  bool map(const std::string& path);
+  void open(const std::string& path, const Config& config);
 };
 }  // namespace bell
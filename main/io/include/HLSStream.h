@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint8_t, uint32_t, uint64_t
+#include <atomic>       // for atomic
+#include <chrono>       // for steady_clock
+#include <memory>       // for unique_ptr
+#include <mutex>        // for mutex, unique_lock
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
+
+#include "BellTask.h"          // for Task
+#include "ByteStream.h"        // for ByteStream
+#include "HTTPClient.h"        // for HTTPClient
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+namespace bell {
+/**
+ * HLS stream (RFC 8216) read as one continuous ByteStream, e.g. for
+ * EncodedAudioStream::openWithStream(). The segments are fetched by
+ * prefetch workers, each holding one segment, over pooled connections;
+ * read() returns them in order as their bytes arrive.
+ *
+ * Live playlists are reloaded as the workers run out of segments, every
+ * half target duration at most. A variant playlist is followed by measured
+ * throughput, switching between the variants of the same codecs at segment
+ * boundaries.
+ *
+ * The segments are passed through as they are: packed audio (ADTS, MP3) and
+ * fragmented MP4, the init segment going first. MPEG-TS segments would need
+ * a demuxer, and encrypted ones aren't supported.
+ */
+class HLSStream : public bell::ByteStream {
+ public:
+  struct Config {
+    // Segments fetched ahead of the reader
+    size_t prefetch = 3;
+    // Follow the throughput across variants, stay on the first one otherwise
+    bool adaptive = true;
+    // Share of the measured throughput a variant's bandwidth may take
+    float bandwidthMargin = 0.8f;
+    // Larger segments are dropped, they're held in memory whole
+    size_t maxSegmentSize = 4 * 1024 * 1024;
+  };
+
+  struct Variant {
+    std::string url;
+    // Peak bits per second, as announced
+    uint32_t bandwidth = 0;
+    std::string codecs;
+  };
+
+  struct Segment {
+    std::string url;
+    // Media sequence number, NO_SEQUENCE for the init segment
+    uint64_t sequence = 0;
+    // Byte range of the resource, the whole of it when length is 0
+    size_t offset = 0;
+    size_t length = 0;
+  };
+
+  struct Playlist {
+    // Set on a master playlist, which has no segments
+    std::vector<Variant> variants;
+    std::vector<Segment> segments;
+    // Init segment of fragmented MP4, EXT-X-MAP, the url is empty without
+    Segment init;
+    uint32_t targetDurationMs = 0;
+    // No more segments will be added, EXT-X-ENDLIST
+    bool ended = false;
+    bool encrypted = false;
+  };
+
+  static constexpr uint64_t NO_SEQUENCE = UINT64_MAX;
+
+  /**
+   * Loads the playlist at url, and the first variant of a master one, then
+   * starts prefetching
+   * @throws std::runtime_error when the playlist can't be loaded or isn't
+   * supported
+   */
+  HLSStream(const std::string& url) : HLSStream(url, Config()) {}
+  HLSStream(const std::string& url, const Config& config);
+  ~HLSStream();
+
+  // Ends early only when the playlist can no longer be loaded
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+  size_t position() override { return readTotal; }
+  // Unknown, the length isn't announced and a live stream has none
+  size_t size() override { return 0; }
+  void close() override;
+
+  // Bandwidth of the variant being fetched, 0 without a master playlist
+  uint32_t getBandwidth();
+  // Bits per second, 0 until a segment was fetched
+  uint32_t getThroughput();
+
+  /**
+   * Parses a master or media playlist
+   * @param url where the playlist came from, relative URIs are resolved
+   * against it
+   * @returns an empty playlist when text isn't one
+   */
+  static Playlist parsePlaylist(std::string_view text, const std::string& url);
+  // Reference resolved against base, as RFC 3986 5.2 without dot segments
+  static std::string resolve(const std::string& base, std::string_view ref);
+  // Whether url or contentType look like an HLS playlist
+  static bool isPlaylist(std::string_view url, std::string_view contentType);
+
+ private:
+  // Attempts per segment, and playlist reloads failing before the end
+  static constexpr int MAX_ATTEMPTS = 3;
+  static constexpr size_t NO_TICKET = SIZE_MAX;
+  // Smaller fetches are dominated by the round trip, not measured
+  static constexpr size_t MIN_MEASURED = 16 * 1024;
+  const char* TAG = "HLSStream";
+
+  class Worker : public bell::Task {
+   public:
+    Worker(HLSStream* owner);
+
+    HLSStream* owner;
+    // Grown by the worker only, under dataMutex, read() copies under it
+    std::vector<uint8_t> data;
+    std::mutex dataMutex;
+
+    // Position of the segment in the stream, NO_TICKET once read() is done
+    // with it
+    std::atomic<size_t> ticket = NO_TICKET;
+    std::atomic<size_t> filled = 0;
+    std::atomic<bool> done = false;
+    std::atomic<bool> failed = false;
+    // Given by read() on a free slot
+    bell::WrappedSemaphore freeSem;
+
+    // Request in progress, so close() can unblock it
+    std::mutex responseMutex;
+    std::unique_ptr<HTTPClient::Response> response;
+
+    void runTask() override;
+    // Unblocks the read in progress and the wait for a free slot
+    void onStopRequested() override;
+    bool fetch(const Segment& segment);
+  };
+
+  Config config;
+  std::atomic<bool> terminate = false;
+  std::vector<std::unique_ptr<Worker>> workers;
+  // Given by the workers on new data, read() waits on it
+  bell::WrappedSemaphore dataSem;
+
+  // Guards the playlist state, taken by the workers between segments
+  std::mutex playlistMutex;
+  // Variants of the same codecs as the first listed, by bandwidth
+  std::vector<Variant> variants;
+  size_t variant = 0;
+  std::string mediaUrl;
+  Playlist playlist;
+  std::chrono::steady_clock::time_point lastReload;
+  uint64_t nextSequence = 0;
+  bool initSent = false;
+  double throughput = 0;
+  // Throughput samples since the last switch
+  size_t samples = 0;
+  // Fetches running, they share the link
+  std::atomic<size_t> fetching = 0;
+  // Tickets handed out, and whether that's all of them
+  std::atomic<size_t> assigned = 0;
+  std::atomic<bool> exhausted = false;
+
+  // Only touched by read()
+  size_t readTotal = 0;
+  size_t current = 0;
+  size_t segmentPos = 0;
+
+  // Expect playlistMutex to be held
+  bool loadMedia(const std::string& url);
+  void adapt();
+
+  /**
+   * Next segment to fetch, held by ticket, waiting for a live playlist to
+   * grow if needed
+   * @returns false at the end of the stream
+   */
+  bool nextSegment(Segment& segment, size_t& ticket);
+  void addSample(size_t bytes, std::chrono::steady_clock::duration elapsed);
+  Worker* slot(size_t ticket);
+};
+}  // namespace bell
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint32_t
+#include <deque>     // for deque
+#include <string>    // for string
+#include <utility>   // for pair
+#include <vector>    // for vector
+
+namespace bell {
+/**
+ * HPACK, the header compression of HTTP/2 (RFC 7541). The encoder and the
+ * decoder each mirror a dynamic table of the peer, so they are per
+ * connection and must see every header block, in order.
+ */
+class HPACK {
+ public:
+  // Lowercase name and value
+  typedef std::pair<std::string, std::string> Header;
+  typedef std::vector<Header> Headers;
+
+  // Table size both sides start with
+  static constexpr size_t DEFAULT_TABLE_SIZE = 4096;
+
+  // Static table followed by the dynamic one, as one index space from 1
+  class Table {
+   public:
+    Table(size_t maxSize = DEFAULT_TABLE_SIZE) : maxSize(maxSize) {}
+
+    void setMaxSize(size_t size);
+    size_t getMaxSize() const { return maxSize; }
+
+    void add(const std::string& name, const std::string& value);
+    // nullptr when out of range
+    const Header* get(size_t index) const;
+
+    /**
+     * @param nameIndex set to an entry with the same name, 0 if none
+     * @returns an entry with the same name and value, 0 if none
+     */
+    size_t find(const std::string& name, const std::string& value,
+                size_t& nameIndex) const;
+
+   private:
+    // Newest first
+    std::deque<Header> entries;
+    // Names and values plus 32 per entry, as RFC 7541 4.1 counts it
+    size_t size = 0;
+    size_t maxSize;
+
+    void evict(size_t room);
+  };
+
+  class Decoder {
+   public:
+    /**
+     * Decodes a complete header block, appending to headers
+     * @returns false when the block is malformed, the connection's table
+     * is then out of sync and it can't continue
+     */
+    bool decode(const uint8_t* data, size_t length, Headers& headers);
+
+   private:
+    // Most bytes a decoded block may take, against unbounded growth
+    static constexpr size_t MAX_HEADER_LIST = 16 * 1024;
+
+    Table table;
+  };
+
+  class Encoder {
+   public:
+    // Table size the peer allows, from its SETTINGS_HEADER_TABLE_SIZE
+    void setMaxTableSize(size_t size);
+
+    /**
+     * Appends the header block of headers to out. Repeated headers become
+     * single byte references to the table; values that change from request
+     * to request, e.g. :path or range, are sent without being indexed so they
+     * don't push the others out.
+     */
+    void encode(const Headers& headers, std::vector<uint8_t>& out);
+
+   private:
+    Table table;
+    bool sizeUpdate = false;
+  };
+
+  // Decodes a Huffman coded string, false when it's invalid
+  static bool huffmanDecode(const uint8_t* data, size_t length,
+                            std::string& out);
+};
+}  // namespace bell
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stddef.h>            // for size_t
+#include <stdint.h>            // for uint8_t, uint32_t
+#include <condition_variable>  // for condition_variable
+#include <functional>          // for function
+#include <map>                 // for map
+#include <memory>              // for shared_ptr, unique_ptr
+#include <mutex>               // for mutex
+#include <string>              // for string
+#include <vector>              // for vector
+
+#include "BellAllocator.h"  // for Allocator
+#include "BellSocket.h"     // for Socket
+#include "ByteStream.h"     // for ByteStream
+#include "HPACK.h"          // for HPACK
+#include "URLParser.h"      // for URLParser
+
+// Receive window of every stream, about what a stream buffers at most
+#ifndef BELL_HTTP2_STREAM_WINDOW
+#define BELL_HTTP2_STREAM_WINDOW (64 * 1024)
+#endif
+
+// Receive window of the connection, across its streams
+#ifndef BELL_HTTP2_CONNECTION_WINDOW
+#define BELL_HTTP2_CONNECTION_WINDOW (256 * 1024)
+#endif
+
+namespace bell {
+/**
+ * HTTP/2 client connection (RFC 9113), carrying any number of requests at
+ * once, each on its own stream, over one TCP + TLS connection. Used by
+ * HTTPClient::Response when HTTP/2 is enabled and the server agrees to it
+ * through ALPN.
+ *
+ * There is no task of its own: whichever stream waits for data reads the
+ * next frames off the socket and hands them to the streams they belong to,
+ * the others wait for it. The socket is only read once it has data, so that
+ * requests can be written in between.
+ *
+ * Server push isn't supported, and request bodies are meant to be small,
+ * e.g. API calls; they're sent within the flow control windows.
+ */
+class HTTP2Connection : public std::enable_shared_from_this<HTTP2Connection> {
+ public:
+  struct Config {
+    // Negotiate HTTP/2 with https:// servers
+    bool enabled = false;
+    // Also speak it to http:// servers, without negotiation (h2c with prior
+    // knowledge), e.g. for a local server known to support it
+    bool cleartext = false;
+  };
+
+  static void setConfig(const Config& config);
+  static Config getConfig();
+
+  /**
+   * Response to one request, its body is read like any ByteStream. The
+   * headers are complete when HTTP2Connection::request() returns it.
+   * Closing it before the end of the body cancels the request.
+   */
+  class Stream : public bell::ByteStream {
+   public:
+    Stream(std::shared_ptr<HTTP2Connection> connection);
+    ~Stream();
+
+    int status = 0;
+    // Lowercase names, as HTTP/2 sends them
+    HPACK::Headers headers;
+
+    size_t read(uint8_t* buf, size_t nbytes) override;
+    size_t skip(size_t nbytes) override;
+    size_t position() override { return readTotal; }
+    // content-length, 0 when unknown
+    size_t size() override { return contentLength; }
+    void close() override;
+
+    // Whether the body was read to its end
+    bool finished();
+
+   private:
+    friend class HTTP2Connection;
+
+    std::shared_ptr<HTTP2Connection> connection;
+    uint32_t id = 0;
+    size_t readTotal = 0;
+    size_t contentLength = 0;
+
+    // Guarded by the connection's mutex, body is read from bodyPos
+    std::vector<uint8_t> body;
+    size_t bodyPos = 0;
+    bool headersDone = false;
+    bool ended = false;
+    bool failed = false;
+    int32_t sendWindow = 0;
+    // Bytes read since the last WINDOW_UPDATE
+    size_t unacknowledged = 0;
+  };
+
+  /**
+   * Connection to the host of url, an open one if there is, otherwise a new
+   * one when the server agrees to HTTP/2
+   * @param fallback set to the new connection when the server picked
+   * HTTP/1.1 instead, so it can be used for the request
+   * @returns nullptr when the request has to go over HTTP/1.1
+   */
+  static std::shared_ptr<HTTP2Connection> acquire(
+      const URLParser& url, std::unique_ptr<bell::Socket>& fallback);
+
+  /**
+   * Sends a request and waits for the headers of its response
+   * @throws std::runtime_error when the connection fails or the server
+   * refuses the stream
+   */
+  std::unique_ptr<Stream> request(
+      const std::string& method, const URLParser& url,
+      const std::vector<std::pair<std::string, std::string>>& headers,
+      const std::vector<uint8_t>& content);
+
+  // Whether new requests can go on this connection
+  bool isUsable();
+
+  HTTP2Connection(std::unique_ptr<bell::Socket> socket);
+  ~HTTP2Connection();
+
+ private:
+  static constexpr size_t FRAME_HEADER_SIZE = 9;
+  static constexpr size_t MAX_FRAME_SIZE = 16384;
+  static constexpr int32_t DEFAULT_WINDOW = 65535;
+
+  enum FrameType : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+  };
+
+  enum Flags : uint8_t {
+    ACK = 0x1,
+    END_STREAM = 0x1,
+    END_HEADERS = 0x4,
+    PADDED = 0x8,
+    PRIORITY = 0x20,
+  };
+
+  std::unique_ptr<bell::Socket> socket;
+
+  // Guards the state below and of every stream
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::map<uint32_t, Stream*> streams;
+  uint32_t nextStreamId = 1;
+  bool reading = false;
+  bool dead = false;
+  // Streams above it weren't processed by the server, see GOAWAY
+  uint32_t goAwayId = UINT32_MAX;
+  int32_t sendWindow = DEFAULT_WINDOW;
+  int32_t initialSendWindow = DEFAULT_WINDOW;
+  size_t peerMaxFrameSize = MAX_FRAME_SIZE;
+  size_t peerMaxStreams = 100;
+  // SETTINGS_HEADER_TABLE_SIZE not yet passed to the encoder, SIZE_MAX if none
+  size_t peerTableSize = SIZE_MAX;
+  // Connection level bytes read since the last WINDOW_UPDATE
+  size_t unacknowledged = 0;
+
+  // Header block being received, over HEADERS and CONTINUATION frames
+  std::vector<uint8_t> headerBlock;
+  uint32_t headerStream = 0;
+  bool headerEndStream = false;
+  HPACK::Decoder decoder;
+
+  // Held for any socket access, as a TLS session can't be read and written
+  // at once. Taken before mutex, never while holding it. The encoder and the
+  // frame buffer only ever run under it too
+  std::mutex ioMutex;
+  HPACK::Encoder encoder;
+
+  // Holds one frame, from the Allocator
+  Allocator::Buffer frame;
+
+  // Expect ioMutex to be held
+  bool writeAll(const uint8_t* data, size_t length);
+  bool readAll(uint8_t* data, size_t length);
+  // Takes ioMutex, expects mutex not to be held
+  void writeFrames(const std::vector<uint8_t>& frames);
+
+  /**
+   * Waits until ready() holds, reading frames meanwhile when no other
+   * thread is. Expects lock to hold mutex
+   * @returns false when the connection died first
+   */
+  bool waitFor(std::unique_lock<std::mutex>& lock,
+               const std::function<bool()>& ready);
+  // Reads and dispatches one frame, false when the connection failed
+  bool readFrame();
+
+  /**
+   * The following expect mutex to be held. Frames to send in return are
+   * appended to replies, to be written once it's released
+   * @returns false on a protocol error, which ends the connection
+   */
+  bool handleFrame(uint8_t type, uint8_t flags, uint32_t streamId,
+                   const uint8_t* payload, size_t length,
+                   std::vector<uint8_t>& replies);
+  bool handleHeaders();
+  void fail();
+  // Credits bytes handed to the reader of stream, or of the connection only
+  // when stream is nullptr
+  void consumed(Stream* stream, size_t bytes, std::vector<uint8_t>& replies);
+  void cancel(Stream& stream, std::vector<uint8_t>& replies);
+};
+}  // namespace bell
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stddef.h>       // for size_t
+#include <stdint.h>       // for uint8_t
+#include <atomic>         // for atomic
+#include <list>           // for list
+#include <memory>         // for unique_ptr
+#include <mutex>          // for mutex
+#include <string>         // for string
+#include <string_view>    // for string_view
+#include <unordered_map>  // for unordered_map
+#include <vector>         // for vector
+
+#include "HTTPClient.h"  // for HTTPClient
+
+namespace bell {
+/**
+ * Client side cache of GET responses, for endpoints polled over and over
+ * such as metadata and configuration. A 200 response carrying an ETag or a
+ * Last-Modified is kept together with its validators; the next request for
+ * the URL sends them as If-None-Match / If-Modified-Since, and a 304 answer
+ * is served from the cache without its body going over the network.
+ *
+ * Entries are keyed by URL, one variant each: when the server names request
+ * headers in Vary, the entry only answers requests with the same values for
+ * them, others refetch and replace it. Responses with Vary: * or
+ * Cache-Control: no-store aren't kept.
+ */
+class HTTPCache {
+ public:
+  struct Entry {
+    std::string url;
+    std::string etag;
+    std::string lastModified;
+    // Vary of the response, and "name: value\n" of the request headers it
+    // lists
+    std::string vary;
+    std::string variant;
+    std::string contentType;
+    std::vector<uint8_t> body;
+  };
+
+  // Where the entries live, implementations must be thread safe
+  class Store {
+   public:
+    virtual ~Store() = default;
+    virtual bool load(const std::string& url, Entry& entry) = 0;
+    virtual void store(const Entry& entry) = 0;
+    virtual void remove(const std::string& url) = 0;
+  };
+
+  // Entries in RAM, least recently used dropped past maxBytes of bodies
+  class MemoryStore : public Store {
+   public:
+    MemoryStore(size_t maxBytes = 64 * 1024) : maxBytes(maxBytes) {}
+
+    bool load(const std::string& url, Entry& entry) override;
+    void store(const Entry& entry) override;
+    void remove(const std::string& url) override;
+
+   private:
+    size_t maxBytes;
+    size_t usedBytes = 0;
+    std::mutex mutex;
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    // Expects mutex to be held
+    void erase(std::list<Entry>::iterator it);
+  };
+
+  /**
+   * One file per entry in a directory, e.g. on an SD card or a LittleFS
+   * partition, so that the validators survive a reboot. Not bounded, it
+   * holds one entry per URL requested
+   */
+  class FileStore : public Store {
+   public:
+    // dir is created if missing
+    FileStore(const std::string& dir);
+
+    bool load(const std::string& url, Entry& entry) override;
+    void store(const Entry& entry) override;
+    void remove(const std::string& url) override;
+
+   private:
+    std::string dir;
+    std::mutex mutex;
+
+    std::string entryPath(const std::string& url);
+  };
+
+  struct Result {
+    int status;
+    std::vector<uint8_t> body;
+    std::string contentType;
+    // Whether the body came from the cache, after a 304
+    bool cached;
+
+    std::string_view text() const {
+      return std::string_view((const char*)body.data(), body.size());
+    }
+  };
+
+  HTTPCache(std::unique_ptr<Store> store);
+
+  /**
+   * GET through the cache, a 304 comes back as status 200 with the cached
+   * body. Other responses are passed on as they are
+   * @throws std::runtime_error when the request fails, like HTTPClient::get()
+   */
+  Result get(const std::string& url, const HTTPClient::Headers& headers = {});
+
+  void invalidate(const std::string& url);
+
+  // Requests answered from the cache, and all requests made
+  size_t getHits() { return hits; }
+  size_t getRequests() { return requests; }
+
+ private:
+  std::unique_ptr<Store> store;
+  std::atomic<size_t> hits = 0;
+  std::atomic<size_t> requests = 0;
+};
+}  // namespace bell
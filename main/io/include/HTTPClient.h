@@ -2,20 +2,33 @@
 #pragma once
 
 #include <stddef.h>     // for size_t
+#include <array>        // for array
+#include <chrono>       // for steady_clock
 #include <cstdint>      // for uint8_t, int32_t
 #include <memory>       // for make_unique, unique_ptr
+#include <mutex>        // for mutex
 #include <string>       // for string
 #include <string_view>  // for string_view
-#include <utility>      // for pair
+#include <utility>      // for pair, move
 #include <vector>       // for vector
 
-#include "SocketStream.h"  // for SocketStream
-#include "URLParser.h"     // for URLParser
+#include "BellSocket.h"       // for Socket
+#include "HTTP2Connection.h"  // for HTTP2Connection
+#include "IcyStream.h"        // for IcyStream
+#include "InflateStream.h"    // for InflateStream
+#include "ObjectPool.h"       // for ObjectPool
+#include "SocketStream.h"     // for SocketStream
+#include "URLParser.h"        // for URLParser
 #ifndef BELL_DISABLE_FMT
 #include "fmt/core.h"  // for format
 #endif
 #include "picohttpparser.h"  // for phr_header
 
+// Responses alive at once before they come from the heap, see Response::pool()
+#ifndef BELL_HTTP_CLIENT_POOL_SIZE
+#define BELL_HTTP_CLIENT_POOL_SIZE 4
+#endif
+
 namespace bell {
 class HTTPClient {
  public:
@@ -44,16 +57,163 @@ class HTTPClient {
     }
   };
 
+  /**
+   * Asks for a compressed body. Responses sent with gzip or deflate are
+   * decompressed as they're read, transparently to body(), bytes() and
+   * byteStream(). Not meant for ranges, they'd be ranges of the compressed
+   * body.
+   */
+  struct EncodingHeader {
+    static ValueHeader compressed() {
+      return ValueHeader{"Accept-Encoding", "gzip, deflate"};
+    }
+  };
+
+  /**
+   * Asks an Icecast / SHOUTcast server for in-stream metadata. The blocks
+   * are taken out of byteStream() by an IcyStream, see getIcyStream(); they
+   * are also when a server sends them unasked.
+   */
+  struct IcyHeader {
+    static ValueHeader metadata() { return ValueHeader{"Icy-MetaData", "1"}; }
+  };
+
+  /**
+   * Keeps the connections of finished keep-alive responses open, so the next
+   * request to the same host skips DNS, TCP and TLS setup. A connection is
+   * only pooled once its response body was read completely.
+   */
+  class ConnectionPool {
+   public:
+    struct Config {
+      // Idle connections kept open across all hosts, 0 disables pooling
+      size_t maxIdle = 4;
+      size_t maxIdlePerHost = 2;
+      // Servers drop idle connections too, usually after 5 to 60 seconds
+      uint32_t idleTimeoutMs = 10000;
+    };
+
+    ConnectionPool();
+    ConnectionPool(Config config);
+
+    void setConfig(const Config& config);
+
+    /**
+     * Takes an idle connection out of the pool
+     * @param key host the connection goes to, see Response::connect()
+     * @returns the connection, nullptr when there is no usable one
+     */
+    std::unique_ptr<bell::Socket> acquire(const std::string& key);
+
+    // Puts a connection back, closing it when the pool is full
+    void release(const std::string& key, std::unique_ptr<bell::Socket> socket);
+
+    // Closes every idle connection
+    void clear();
+
+    size_t idleCount();
+
+   private:
+    struct Idle {
+      std::string key;
+      std::unique_ptr<bell::Socket> socket;
+      std::chrono::steady_clock::time_point since;
+    };
+
+    Config config;
+    std::mutex mutex;
+    // Oldest first
+    std::vector<Idle> idle;
+
+    // Expect mutex to be held
+    void evictExpired();
+  };
+
+  // Pool shared by all requests
+  static ConnectionPool& connectionPool();
+
+  /**
+   * Read and write deadlines of the requests' connections, 15 seconds each
+   * by default, so a stalled server fails the read rather than blocking it
+   * until the OS gives up. A BufferedStream then calls its StreamReader
+   * again from where it stopped.
+   */
+  static void setTimeouts(const Socket::Timeouts& timeouts);
+  static Socket::Timeouts getTimeouts();
+
+  /**
+   * Body of a response as a ByteStream, read in blocks of any size without
+   * the iostream layers. Chunked transfer encoding is decoded on the fly, and
+   * the stream ends with the body rather than with the connection.
+   */
+  class BodyStream : public bell::ByteStream {
+   public:
+    BodyStream(bell::SocketStream& stream) : raw(stream) {}
+
+    /**
+     * Starts the body of a new response
+     * @param chunked whether the body uses chunked transfer encoding
+     * @param length body length when known and not chunked, SIZE_MAX until
+     * the connection closes
+     */
+    void reset(bool chunked, size_t length);
+
+    size_t read(uint8_t* buf, size_t nbytes) override;
+    size_t skip(size_t nbytes) override;
+    size_t position() override { return readPosition; }
+    // Unknown when chunked
+    size_t size() override { return chunked ? 0 : length; }
+    void close() override { raw.close(); }
+
+    // Whether the whole body was read, up to the last chunk
+    bool finished();
+
+   private:
+    bell::SocketByteStream raw;
+    bool chunked = false;
+    size_t length = 0;
+    size_t readPosition = 0;
+    // Data left in the current chunk
+    size_t chunkLeft = 0;
+    bool firstChunk = true;
+    bool lastChunk = false;
+
+    bool readLine(std::string& line);
+    bool nextChunk();
+  };
+
   class Response {
    public:
     Response(){};
     ~Response();
 
     /**
-    * Initializes a connection with a given url.
+     * Responses, with their header buffer, live in a fixed pool reused from
+     * request to request. Stats of it are also exported as "pool.http_client"
+     */
+    typedef ObjectPool<Response, BELL_HTTP_CLIENT_POOL_SIZE> Pool;
+    static Pool& pool();
+    static void* operator new(size_t size) { return pool().allocate(size); }
+    static void operator delete(void* ptr) { pool().release(ptr); }
+
+    /**
+    * Initializes a connection with a given url, reusing an idle one to the
+    * same host if there is any. With HTTP2Connection::setConfig() enabling
+    * it, the request goes over a shared HTTP/2 connection instead when the
+    * server supports it.
     */
     void connect(const std::string& url);
 
+    /**
+     * TCP options of the connection, INTERACTIVE by default. Also applies to
+     * a connection already open, e.g. once the body turns out to be large.
+     * The shared HTTP/2 connections keep theirs.
+     */
+    void setProfile(bell::Socket::Profile profile) {
+      this->profile = profile;
+      this->socketStream.rdbuf()->setProfile(profile);
+    }
+
     void rawRequest(const std::string& method, const std::string& url,
                     const std::vector<uint8_t>& content, Headers& headers);
     void get(const std::string& url, Headers headers = {});
@@ -63,30 +223,92 @@ class HTTPClient {
     std::string_view body();
     std::vector<uint8_t> bytes();
 
-    std::string_view header(const std::string& headerName);
+    /**
+     * Value of a response header, valid until the next request
+     * @param headerName name, in any case
+     * @returns the value, empty when the header is missing
+     */
+    std::string_view header(std::string_view headerName);
+    // Connection of an HTTP/1.1 response, not open over HTTP/2
     bell::SocketStream& stream() { return this->socketStream; }
+    bool isHTTP2() { return this->http2Stream != nullptr; }
+    // Status code of the last response, e.g. 200
+    int status() { return this->statusCode; }
+    // Why the body ended early over HTTP/1.1, e.g. Socket::Error::TIMEOUT
+    bell::Socket::Error socketError() {
+      return this->socketStream.rdbuf()->getError();
+    }
+    // Body as a ByteStream, reading it this way keeps memory bounded
+    bell::ByteStream& byteStream() {
+      if (icy) {
+        return *this->icyStream;
+      }
+      if (inflating) {
+        return *this->inflateStream;
+      }
+      return rawStream();
+    }
 
+    // Metadata of an ICY stream, nullptr for other responses
+    bell::IcyStream* getIcyStream() { return icy ? icyStream.get() : nullptr; }
+
+    // 0 for a chunked, compressed or ICY body, see byteStream()
     size_t contentLength();
     size_t totalLength();
 
    private:
     bell::URLParser urlParser;
     bell::SocketStream socketStream;
+    BodyStream bodyStream = BodyStream(socketStream);
+    // Decompresses rawStream(), kept from one response to the next
+    std::unique_ptr<bell::InflateStream> inflateStream;
+    bool inflating = false;
+    // Strips ICY metadata after decompression, when icy-metaint is set
+    std::unique_ptr<bell::IcyStream> icyStream;
+    bool icy = false;
+
+    // Set instead of socketStream when the host speaks HTTP/2
+    std::shared_ptr<bell::HTTP2Connection> http2;
+    std::unique_ptr<bell::HTTP2Connection::Stream> http2Stream;
 
+    // Point into httpBuffer, along with their lowercase name hashes
     struct phr_header phResponseHeaders[32];
-    const size_t HTTP_BUF_SIZE = 1024;
+    uint32_t headerHashes[32];
+    size_t headerCount = 0;
+    static constexpr size_t HTTP_BUF_SIZE = 1024;
 
-    std::vector<uint8_t> httpBuffer = std::vector<uint8_t>(HTTP_BUF_SIZE);
+    // Part of the object, so it comes from the pool along with it
+    std::array<uint8_t, HTTP_BUF_SIZE> httpBuffer;
     std::vector<uint8_t> rawBody = std::vector<uint8_t>();
     size_t httpBufferAvailable;
 
+    int statusCode = 0;
     size_t contentSize = 0;
     bool hasContentSize = false;
+    bool rawBodyRead = false;
 
-    Headers responseHeaders;
+    // Host of the connection in the pool, and how it may be reused
+    std::string poolKey;
+    bool reused = false;
+    bool keepAlive = false;
+    bell::Socket::Profile profile = bell::Socket::Profile::INTERACTIVE;
 
+    void writeRequest(const std::string& method,
+                      const std::vector<uint8_t>& content, Headers& headers);
     void readResponseHeaders();
+    void requestHTTP2(const std::string& method,
+                      const std::vector<uint8_t>& content, Headers& headers);
+    // Length and encoding of the body, from the headers of either protocol
+    void setupBody(bool chunked);
+    // Body as sent, before decompression
+    bell::ByteStream& rawStream() {
+      if (http2Stream != nullptr) {
+        return *this->http2Stream;
+      }
+      return this->bodyStream;
+    }
     void readRawBody();
+    bool bodyConsumed();
   };
 
   enum class Method : uint8_t { GET = 0, POST = 1 };
@@ -97,9 +319,40 @@ class HTTPClient {
     Headers headers;
   };
 
-  static std::unique_ptr<Response> get(const std::string& url,
-                                       Headers headers = {}) {
+  /**
+   * Owns a response and reads its body, e.g. as a BufferedStream source.
+   * size() is the total length of a ranged resource.
+   */
+  class ResponseStream : public bell::ByteStream {
+   public:
+    // The connection switches to the BULK profile, the body is a download
+    ResponseStream(std::unique_ptr<Response> response)
+        : response(std::move(response)) {
+      this->response->setProfile(bell::Socket::Profile::BULK);
+    }
+
+    size_t read(uint8_t* buf, size_t nbytes) override {
+      return response->byteStream().read(buf, nbytes);
+    }
+    size_t skip(size_t nbytes) override {
+      return response->byteStream().skip(nbytes);
+    }
+    size_t position() override { return response->byteStream().position(); }
+    size_t size() override { return response->totalLength(); }
+    void close() override { response->byteStream().close(); }
+
+    Response& getResponse() { return *response; }
+
+   private:
+    std::unique_ptr<Response> response;
+  };
+
+  // BULK suits large bodies, read as a stream, see Response::setProfile()
+  static std::unique_ptr<Response> get(
+      const std::string& url, Headers headers = {},
+      bell::Socket::Profile profile = bell::Socket::Profile::INTERACTIVE) {
     auto response = std::make_unique<Response>();
+    response->setProfile(profile);
     response->connect(url);
     response->get(url, headers);
     return response;
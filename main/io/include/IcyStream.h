@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint8_t
+#include <array>        // for array
+#include <functional>   // for function
+#include <string>       // for string
+#include <string_view>  // for string_view
+
+#include "ByteStream.h"  // for ByteStream
+
+namespace bell {
+/**
+ * Audio of an Icecast / SHOUTcast stream, the ICY metadata blocks the server
+ * inserts every icy-metaint bytes taken out. Audio is read straight into the
+ * caller's buffer, up to the next block; blocks go to a fixed buffer of the
+ * largest size they can have, so nothing is allocated per block.
+ *
+ * Title changes are reported through the metadata callback, blocks
+ * repeating the current metadata are only skipped.
+ */
+class IcyStream : public bell::ByteStream {
+ public:
+  struct Metadata {
+    // StreamTitle, usually "artist - title"
+    std::string_view title;
+    // StreamUrl, when the server sends one
+    std::string_view url;
+    // Whole block, e.g. for fields of other servers
+    std::string_view raw;
+  };
+
+  // Runs on the reading thread, the views last until it returns
+  typedef std::function<void(const Metadata&)> MetadataCallback;
+
+  // source must outlive the stream
+  IcyStream(bell::ByteStream& source, size_t metaInt);
+
+  // Starts over on a new response, keeping the callback
+  void reset(bell::ByteStream& source, size_t metaInt);
+  void setMetadataCallback(const MetadataCallback& callback) {
+    this->callback = callback;
+  }
+
+  // Title of the last metadata block, empty before the first one
+  const std::string& getTitle() { return title; }
+
+  // Ends where the source ends, also inside a metadata block
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+  // Audio bytes read
+  size_t position() override { return readTotal; }
+  size_t size() override { return 0; }
+  void close() override { source->close(); }
+
+  /**
+   * Value of a field of a metadata block, StreamTitle='value';
+   * @returns the value, empty when the field is missing
+   */
+  static std::string_view field(std::string_view block, std::string_view name);
+
+ private:
+  // The length byte counts in 16 byte units
+  static constexpr size_t MAX_METADATA = 255 * 16;
+
+  bell::ByteStream* source;
+  size_t metaInt;
+  // Audio bytes before the next block
+  size_t untilMetadata;
+  size_t readTotal = 0;
+
+  std::array<char, MAX_METADATA> metadata;
+  // Last block, to tell a change from a repeat
+  std::string lastBlock;
+  std::string title;
+  MetadataCallback callback;
+
+  // Audio into buf, or skipped when buf is nullptr
+  size_t transfer(uint8_t* buf, size_t nbytes);
+  bool readMetadata();
+};
+}  // namespace bell
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint16_t, uint32_t
+
+#include "BellAllocator.h"  // for Allocator
+#include "ByteStream.h"     // for ByteStream
+
+namespace bell {
+/**
+ * Decompresses a gzip, zlib or raw deflate stream as it's read, e.g. a HTTP
+ * body sent with Content-Encoding: gzip. The format is told apart by the
+ * first bytes. Memory is a 32 KiB history window, the largest distance
+ * deflate can refer back to, taken from the Allocator so it goes to PSRAM
+ * where there is some, and a small input buffer.
+ *
+ * Codes are decoded one bit at a time rather than through lookup tables,
+ * which keeps the decoder small at the cost of speed; it is meant for API
+ * payloads rather than media. The gzip CRC-32 and zlib Adler-32 are checked
+ * at the end of the stream.
+ */
+class InflateStream : public bell::ByteStream {
+ public:
+  // source must outlive the stream
+  InflateStream(bell::ByteStream& source);
+
+  // Starts over on a new compressed stream, keeping the window
+  void reset(bell::ByteStream& source);
+
+  /**
+   * @returns decompressed bytes, 0 once the stream ended
+   * @throws std::runtime_error on corrupt or truncated data
+   */
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+  size_t position() override { return outputTotal; }
+  // Unknown until the end
+  size_t size() override { return 0; }
+  void close() override { source->close(); }
+
+ private:
+  static constexpr size_t WINDOW_SIZE = 32 * 1024;
+  static constexpr size_t INPUT_SIZE = 512;
+
+  enum class Container { GZIP, ZLIB, RAW };
+  enum class State { HEADER, BLOCK, STORED, HUFFMAN, TRAILER, DONE };
+
+  // Canonical Huffman code, symbols ordered by code
+  struct Huffman {
+    uint16_t count[16];
+    uint16_t symbol[288];
+  };
+
+  bell::ByteStream* source;
+  Allocator::Buffer window;
+  size_t windowPos = 0;
+  size_t outputTotal = 0;
+
+  uint8_t input[INPUT_SIZE];
+  size_t inputPos = 0;
+  size_t inputLength = 0;
+  uint32_t bitBuffer = 0;
+  int bitCount = 0;
+
+  Container container = Container::RAW;
+  State state = State::HEADER;
+  bool lastBlock = false;
+  size_t storedLeft = 0;
+  // Match still to copy from the window
+  size_t copyLength = 0;
+  size_t copyDistance = 0;
+  Huffman lengthCode;
+  Huffman distanceCode;
+  uint32_t crc = 0;
+  uint32_t adler = 1;
+
+  // Makes at least count bytes available in input, false at the end
+  bool fill(size_t count);
+  uint8_t nextByte();
+  uint32_t bits(int count);
+  int decode(const Huffman& code);
+  static void build(Huffman& code, const uint8_t* lengths, int symbols);
+
+  void readHeader();
+  void startBlock();
+  void readDynamicCodes();
+  void readTrailer();
+  void put(uint8_t* buf, size_t& produced, uint8_t byte);
+};
+}  // namespace bell
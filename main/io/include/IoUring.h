@@ -0,0 +1,101 @@
+#pragma once
+
+#include <linux/io_uring.h>  // for io_uring_sqe, io_uring_cqe
+#include <stddef.h>          // for size_t
+#include <stdint.h>          // for uint8_t, uint32_t, uint64_t
+#include <span>              // for span
+#include <vector>            // for vector
+
+namespace bell {
+/**
+ * Minimal io_uring over the raw system calls, without liburing. Requests are
+ * prepared into the submission ring, then submitted together by one
+ * submitAndWait(), which also waits for completions.
+ *
+ * Not thread safe, the whole ring belongs to one task. Needs Linux 5.11 for
+ * timed waits, isValid() is false on older kernels or where io_uring is
+ * disabled.
+ */
+class IoUring {
+ public:
+  IoUring(uint32_t entries = 256);
+  ~IoUring();
+
+  bool isValid() const { return ringFd >= 0; }
+
+  // Queues a poll for mask (POLLIN, POLLOUT) on fd, completed once, with
+  // the mask that's ready, or -errno
+  bool pollAdd(int fd, uint32_t mask, uint64_t userData);
+  // Cancels the poll queued with userData
+  bool pollRemove(uint64_t target, uint64_t userData);
+
+  /**
+   * Queues a read of len bytes at offset, (uint64_t)-1 for the current
+   * position of a pipe or socket. Goes through the registered buffer dst
+   * lies in, if any, saving the page pinning of every read.
+   */
+  bool read(int fd, uint64_t offset, uint8_t* dst, size_t len,
+            uint64_t userData);
+
+  /**
+   * Registers memory that later reads land in, e.g. a stream's ring. Call
+   * before any read, replaces the previous set.
+   */
+  bool registerBuffers(const std::vector<std::span<uint8_t>>& buffers);
+
+  /**
+   * Submits what's queued and waits up to timeoutMs for one completion
+   * @returns completions available, or -errno
+   */
+  int submitAndWait(uint32_t timeoutMs);
+
+  /**
+   * Calls onCompletion(userData, result) for every completion, result being
+   * what the system call would have returned, or -errno
+   * @returns number of completions
+   */
+  template <typename F>
+  size_t reap(F&& onCompletion) {
+    uint32_t head = *cqHead;
+    uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    while (head != tail) {
+      const io_uring_cqe& cqe = cqes[head & *cqMask];
+      onCompletion(cqe.user_data, cqe.res);
+      head++;
+      count++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+ private:
+  int ringFd = -1;
+  uint32_t features = 0;
+
+  void* sqRing = nullptr;
+  size_t sqRingSize = 0;
+  void* cqRing = nullptr;
+  size_t cqRingSize = 0;
+  io_uring_sqe* sqes = nullptr;
+  size_t sqesSize = 0;
+
+  uint32_t* sqHead;
+  uint32_t* sqTail;
+  uint32_t* sqMask;
+  uint32_t* sqArray;
+  uint32_t* cqHead;
+  uint32_t* cqTail;
+  uint32_t* cqMask;
+  io_uring_cqe* cqes;
+
+  // Prepared but not submitted
+  uint32_t queued = 0;
+  std::vector<std::span<uint8_t>> registered;
+
+  // Next free entry, zeroed, submitting the queued ones if the ring is full
+  io_uring_sqe* nextSqe();
+  int enter(uint32_t toSubmit, uint32_t minComplete, uint32_t flags,
+            const void* arg, size_t argSize);
+};
+}  // namespace bell
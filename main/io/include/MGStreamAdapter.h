@@ -3,21 +3,31 @@
 #include <cstring>
 #include <iostream>
 #include <ostream>
+#include <vector>
 #include "civetweb.h"
 
-const size_t BUF_SIZE = 1024;
+// Default buffer size, a typical API response goes out in one mg_write
+const size_t BUF_SIZE = 4096;
 
 // Custom streambuf
 class mg_buf : public std::streambuf {
  private:
   struct mg_connection* conn;
-  char buffer[BUF_SIZE];
+  std::vector<char> buffer;
+  bool chunked;
+
+  // @returns len, or <= 0 when the client went away
+  int send(const char* data, int len);
 
  public:
-  mg_buf(struct mg_connection* _conn);
+  // chunked writes each flush as a chunk of a chunked body
+  mg_buf(struct mg_connection* _conn, size_t bufferSize = BUF_SIZE,
+         bool chunked = false);
 
  protected:
   virtual int_type overflow(int_type c);
+  // Batches small writes, passes ones larger than the buffer straight through
+  virtual std::streamsize xsputn(const char_type* s, std::streamsize n);
   int flush_buffer();
   virtual int sync();
 };
@@ -31,20 +41,23 @@ class MGStreamAdapter : public std::ostream {
   mg_buf buf;
 
  public:
-  MGStreamAdapter(struct mg_connection* _conn);
+  MGStreamAdapter(struct mg_connection* _conn, size_t bufferSize = BUF_SIZE,
+                  bool chunked = false);
 };
 
 // Custom streambuf
 class mg_read_buf : public std::streambuf {
  private:
   struct mg_connection* conn;
-  char buffer[BUF_SIZE];
+  std::vector<char> buffer;
 
  public:
-  mg_read_buf(struct mg_connection* _conn);
+  mg_read_buf(struct mg_connection* _conn, size_t bufferSize = BUF_SIZE);
 
  protected:
   virtual int_type underflow();
+  // Reads larger than the buffer go straight into s
+  virtual std::streamsize xsgetn(char_type* s, std::streamsize n);
 };
 
 /**
@@ -55,5 +68,6 @@ class MGInputStreamAdapter : public std::istream {
   mg_read_buf buf;
 
  public:
-  MGInputStreamAdapter(struct mg_connection* _conn);
+  MGInputStreamAdapter(struct mg_connection* _conn,
+                       size_t bufferSize = BUF_SIZE);
 };
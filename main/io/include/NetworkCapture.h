@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint64_t, int64_t
+#include <stdio.h>   // for FILE
+#include <memory>    // for shared_ptr
+#include <string>    // for string
+
+#include "ByteStream.h"  // for ByteStream
+
+namespace bell {
+/**
+ * Records what a source delivers and when, to replay it later with
+ * ReplayStream: an underrun seen in the field then happens again on the
+ * desk, and a buffer policy or a prefetch change can be compared against
+ * the very same network. Wraps e.g. an HTTPClient response stream, or the
+ * stream a BufferedStream's reader returns.
+ *
+ * Every read() is one record of the capture file: the time it returned,
+ * from the first read, and the bytes it returned. skip() reads through, so
+ * the capture holds every byte. Reads go on when the file can't be written,
+ * the capture is then cut short.
+ */
+class RecordingStream : public ByteStream {
+ public:
+  // @throws std::runtime_error if path can't be created
+  RecordingStream(std::shared_ptr<ByteStream> source, const std::string& path);
+  ~RecordingStream();
+
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+
+  size_t position() override { return source->position(); }
+  size_t size() override { return source->size(); }
+  void close() override;
+
+ private:
+  std::shared_ptr<ByteStream> source;
+  FILE* file = nullptr;
+  int64_t startUs = -1;
+};
+
+/**
+ * Delivers a RecordingStream capture with its recorded timing: a read
+ * waits until the next record arrived, then returns what arrived, at most
+ * nbytes; the rest of a record is there for the next reads at once. A
+ * record of no bytes, the source's end, is returned as such.
+ *
+ * Timing counts from the first read, scaled by speed. With speed 0 reads
+ * never wait, which replays the same sequence of reads as fast as it goes.
+ */
+class ReplayStream : public ByteStream {
+ public:
+  struct Config {
+    // 2 delivers twice as fast as recorded, 0 without waiting
+    float speed = 1;
+  };
+
+  // @throws std::runtime_error if path isn't a capture
+  ReplayStream(const std::string& path) : ReplayStream(path, Config()) {}
+  ReplayStream(const std::string& path, const Config& config);
+  ~ReplayStream();
+
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+
+  size_t position() override { return delivered; }
+  // Of the recorded source
+  size_t size() override { return sourceSize; }
+  void close() override;
+
+ private:
+  Config config;
+  FILE* file = nullptr;
+  size_t sourceSize = 0;
+  size_t delivered = 0;
+  int64_t startUs = -1;
+  // Bytes of the current record not yet read
+  size_t remaining = 0;
+
+  // Waits for the next record, @returns false at the end of the capture
+  bool nextRecord();
+};
+}  // namespace bell
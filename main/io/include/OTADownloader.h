@@ -0,0 +1,91 @@
+#pragma once
+
+#include <mbedtls/md.h>  // for mbedtls_md_context_t
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t, uint32_t
+#include <functional>    // for function
+#include <string>        // for string
+#include <vector>        // for vector
+
+#include "BellTask.h"          // for Task
+#include "BufferedStream.h"    // for BufferedStream
+#include "OTAImage.h"          // for OTAImage
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+namespace bell {
+/**
+ * Pulls a firmware image into an OTAImage as it downloads, in blocks of
+ * blockSize so the flash is written a sector at a time. Blocks are double
+ * buffered: one is hashed by a task of its own, on hashCore, while it's
+ * written and the next one downloads, so the SHA-256 costs no time on the
+ * downloading task.
+ *
+ * The body comes from a StreamReader, e.g. httpReader(). When its stream
+ * ends early, the reader is asked again from the last offset written, up
+ * to `retries` times in a row. A stream of an unknown size ends the image
+ * where it ends, only sha256 catches it being cut short then.
+ */
+class OTADownloader : bell::Task {
+ public:
+  struct Config {
+    // Where the image goes off the ESP32, see OTAImage
+    std::string path = "firmware.bin";
+    // Expected SHA-256 in hex, not checked when empty
+    std::string sha256;
+    size_t blockSize = 4096;
+    int hashCore = 1;
+    int retries = 5;
+    uint32_t retryDelayMs = 1000;
+    // Bytes written and the total, 0 when it isn't known, after each block
+    std::function<void(size_t written, size_t total)> onProgress;
+  };
+
+  OTADownloader() : OTADownloader(Config()) {}
+  OTADownloader(const Config& config);
+  ~OTADownloader();
+
+  /**
+   * Downloads the image on the calling task and stores it
+   * @returns true once it's complete, verified and set to boot
+   */
+  bool download(const BufferedStream::StreamReader& reader);
+  bool download(const std::string& url) { return download(httpReader(url)); }
+
+  size_t getSize() const { return written; }
+  // Of the whole image, in hex, once downloaded
+  const std::string& getSha256() const { return digest; }
+  // Why download() returned false
+  const char* getError() const { return error; }
+
+  /**
+   * Reader fetching url with HTTP range requests. A server ignoring them
+   * has the start of its body skipped instead
+   */
+  static BufferedStream::StreamReader httpReader(const std::string& url);
+
+ private:
+  Config config;
+  OTAImage image;
+  mbedtls_md_context_t sha256;
+  std::string digest;
+  size_t written = 0;
+  const char* error = nullptr;
+
+  std::vector<uint8_t> blocks[2];
+  // Block handed to the hashing task, and its size
+  const uint8_t* hashBlock = nullptr;
+  size_t hashSize = 0;
+  // Given with hashBlock set, nullptr to end the task
+  WrappedSemaphore hashReady = WrappedSemaphore(1);
+  WrappedSemaphore hashDone = WrappedSemaphore(1);
+  bool hashing = false;
+  // Without a task, e.g. when it couldn't start, blocks are hashed inline
+  bool threaded = false;
+
+  void runTask() override;
+  // Hands a block to the hashing task, once it's done with the last one
+  void hash(const uint8_t* data, size_t size);
+  void waitHash();
+  bool fail(const char* why);
+};
+}  // namespace bell
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <mbedtls/md.h>  // for mbedtls_md_context_t
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t
+#include <stdio.h>       // for FILE
+#include <string>        // for string
+
+#ifdef ESP_PLATFORM
+#include "esp_ota_ops.h"  // for esp_ota_handle_t, esp_partition_t
+#endif
+
+namespace bell {
+/**
+ * Storage of a firmware image being received: the next OTA partition on
+ * the ESP32, erased as it's written, and a file elsewhere, written to
+ * path + ".part" first. Until commit() nothing changes for the running
+ * firmware, the image is dropped if it's never called.
+ */
+class OTAImage {
+ public:
+  // Where the image goes off the ESP32
+  OTAImage(const std::string& path);
+  ~OTAImage();
+
+  bool open();
+  bool write(const uint8_t* data, size_t size);
+  // Sets the boot partition, or renames the file over path
+  bool commit();
+  void abort();
+
+  // Largest image that fits, SIZE_MAX for a file
+  size_t capacity() const;
+  // Why the last call returned false
+  const char* getError() const { return error; }
+
+  /**
+   * Ends a SHA-256 of an image, into digest in hex
+   * @returns whether it's expected, in any case. Any is when it's empty
+   */
+  static bool verify(mbedtls_md_context_t& sha256,
+                     const std::string& expected, std::string& digest);
+
+ private:
+  std::string path;
+  const char* error = nullptr;
+
+#ifdef ESP_PLATFORM
+  const esp_partition_t* partition = nullptr;
+  esp_ota_handle_t handle = 0;
+#else
+  FILE* file = nullptr;
+#endif
+
+  bool fail(const char* why);
+};
+}  // namespace bell
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <mbedtls/md.h>  // for mbedtls_md_context_t
+#include <stddef.h>      // for size_t
+#include <stdint.h>      // for uint8_t
+#include <memory>        // for unique_ptr
+#include <string>        // for string
+
+#include "BellHTTPServer.h"  // for BellHTTPServer
+#include "OTAImage.h"        // for OTAImage
+
+namespace bell {
+/**
+ * Firmware upload for registerUpload(): takes the first file part of a
+ * form, or the whole body, and writes it as it arrives to an OTAImage,
+ * hashing it on the way. A multi-MB image needs no more memory than the
+ * chunk in flight.
+ *
+ * The new image is only switched to, the boot partition set or the file
+ * renamed over path, once it's complete and its SHA-256 is the expected one.
+ * The device isn't restarted, that's the app's call after a 200.
+ */
+class OTAWriter : public BellHTTPServer::UploadHandler {
+ public:
+  struct Config {
+    // Where the image goes off the ESP32, written to path + ".part" first
+    std::string path = "firmware.bin";
+    // Expected SHA-256 in hex, any case. Not checked when empty
+    std::string sha256;
+    // Larger images are refused, 0 leaves only the partition's size
+    size_t maxSize = 0;
+  };
+
+  OTAWriter() : OTAWriter(Config()) {}
+  OTAWriter(const Config& config);
+  ~OTAWriter();
+
+  bool beginPart(const Part& part) override;
+  bool write(const uint8_t* data, size_t size) override;
+  bool endPart() override;
+  // {"size":..., "sha256":"..."}, or an "error" with a 4xx or 500
+  std::unique_ptr<BellHTTPServer::HTTPResponse> finish(
+      BellHTTPServer& server, bool complete) override;
+
+  // Bytes written so far
+  size_t getSize() const { return size; }
+  // Of the whole image, in hex, once finished
+  const std::string& getSha256() const { return digest; }
+
+ private:
+  // The image is the first file part, the parts around it are ignored
+  enum class State { WAITING, WRITING, WRITTEN };
+
+  Config config;
+  State state = State::WAITING;
+  size_t size = 0;
+  OTAImage image;
+  mbedtls_md_context_t sha256;
+  std::string digest;
+  // Why the upload failed, once it has
+  const char* error = nullptr;
+  int errorStatus = 400;
+
+  bool commit();
+  bool fail(const char* why, int status);
+};
+}  // namespace bell
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint32_t
+#include <atomic>    // for atomic
+#include <memory>    // for unique_ptr
+#include <mutex>     // for mutex
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "BellTask.h"          // for Task
+#include "BufferedStream.h"    // for BufferedStream
+#include "ByteStream.h"        // for ByteStream
+#include "HTTPClient.h"        // for HTTPClient
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+namespace bell {
+/**
+ * Reads a HTTP resource through several range requests in flight at once,
+ * so the round trip of each request overlaps with the transfer of the
+ * others. The resource is split in segments of segmentSize; every worker
+ * fetches one segment at a time into its own slot, and read() returns the
+ * segments in order, as soon as their bytes arrive.
+ *
+ * A segment that can't be completed ends the stream early, read() then
+ * returns 0 at the position it reached. BufferedStream handles that by
+ * calling its StreamReader again from there.
+ */
+class ParallelRangeStream : public bell::ByteStream {
+ public:
+  /**
+   * @param url resource to fetch
+   * @param offset position of the first byte read
+   * @param first response to the first segment's range request
+   * @param segmentSize bytes fetched per request
+   * @param segments requests kept in flight
+   */
+  ParallelRangeStream(const std::string& url, size_t offset,
+                      std::unique_ptr<HTTPClient::Response> first,
+                      size_t segmentSize, size_t segments);
+  ~ParallelRangeStream();
+
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+  size_t position() override;
+  size_t size() override;
+  void close() override;
+
+  /**
+   * StreamReader for BufferedStream::open(). It falls back to a single
+   * request when the server ignores ranges.
+   * @param segmentSize bytes fetched per request, about the buffer size
+   * divided by segments keeps the fetch from running far ahead
+   * @param segments requests kept in flight
+   */
+  static BufferedStream::StreamReader reader(const std::string& url,
+                                             size_t segmentSize = 16 * 1024,
+                                             size_t segments = 3);
+
+ private:
+  // Attempts per segment, each resuming where the previous one stopped
+  static constexpr int MAX_ATTEMPTS = 3;
+  static constexpr size_t NO_SEGMENT = SIZE_MAX;
+
+  class Worker : public bell::Task {
+   public:
+    Worker(ParallelRangeStream* owner, size_t index);
+
+    ParallelRangeStream* owner;
+    size_t index;
+    std::vector<uint8_t> data;
+
+    // Segment held by the slot, NO_SEGMENT once read() consumed it
+    std::atomic<size_t> segment = NO_SEGMENT;
+    std::atomic<size_t> filled = 0;
+    std::atomic<bool> done = false;
+    std::atomic<bool> failed = false;
+    // Given by the worker on new data, and by read() on a free slot
+    bell::WrappedSemaphore dataSem;
+    bell::WrappedSemaphore freeSem;
+
+    // Request in progress, so close() can unblock it
+    std::mutex responseMutex;
+    std::unique_ptr<HTTPClient::Response> response;
+
+    void runTask() override;
+    // Unblocks the read in progress and the wait for a free slot
+    void onStopRequested() override;
+    bool fetch(size_t start, size_t length);
+  };
+
+  std::string url;
+  size_t offset;
+  size_t totalLength;
+  size_t segmentSize;
+  std::atomic<bool> terminate = false;
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  // Only touched by read()
+  size_t readTotal = 0;
+  size_t current = 0;
+  size_t segmentPos = 0;
+
+  size_t segmentLength(size_t segment);
+};
+}  // namespace bell
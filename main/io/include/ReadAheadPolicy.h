@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <atomic>    // for atomic
+#include <chrono>    // for microseconds
+
+namespace bell {
+/**
+ * Decides how BufferedStream reads ahead. The buffering task reports every
+ * read from the source, and asks for new limits once per refill.
+ */
+class ReadAheadPolicy {
+ public:
+  struct Limits {
+    // Bytes asked from the source per read
+    uint32_t readSize;
+    // A refill starts once this much was read since the buffer was last full
+    uint32_t readThreshold;
+    // Refills stop once this much is buffered, at most the buffer size
+    uint32_t fillLimit;
+    uint32_t readyThreshold;
+    uint32_t notReadyThreshold;
+  };
+
+  virtual ~ReadAheadPolicy() = default;
+
+  /**
+   * Called from the buffering task after each read from the source
+   * @param bytes amount of bytes returned, 0 at the end of the source
+   * @param took time spent in the read
+   */
+  virtual void onRead(size_t bytes, std::chrono::microseconds took) = 0;
+
+  /**
+   * Called from the buffering task after each refill
+   * @param bufferSize total size of the buffer
+   * @param [in,out] limits current limits, to be adjusted
+   * @returns whether limits changed
+   */
+  virtual bool update(uint32_t bufferSize, Limits& limits) = 0;
+};
+
+/**
+ * Sizes reads and thresholds from the measured source throughput and read
+ * stalls, so the buffer holds about targetMs of audio: reads grow on fast
+ * links, and the ready threshold covers the stalls seen recently.
+ */
+class AdaptiveReadAhead : public ReadAheadPolicy {
+ public:
+  struct Config {
+    // Rate the buffer is read at, e.g. the stream bitrate / 8
+    uint32_t consumeRate = 320000 / 8;
+    // Audio to keep buffered
+    uint32_t targetMs = 4000;
+    // The ready threshold never goes below this much audio
+    uint32_t minReadyMs = 500;
+    // Reads try to return about this much of the source's throughput
+    uint32_t readIntervalMs = 50;
+    uint32_t minReadSize = 512;
+    uint32_t maxReadSize = 16 * 1024;
+    // Reads taking longer than this count as stalls
+    uint32_t stallMs = 100;
+    // Weight of a new measurement in the averages
+    float smoothing = 0.2f;
+    // Per refill decay of the longest recent stall
+    float stallDecay = 0.95f;
+  };
+
+  AdaptiveReadAhead();
+  AdaptiveReadAhead(Config config);
+
+  void onRead(size_t bytes, std::chrono::microseconds took) override;
+  bool update(uint32_t bufferSize, Limits& limits) override;
+
+  // Stream bitrate changed, e.g. the next track is of another quality
+  void setConsumeRate(uint32_t bytesPerSecond);
+
+  // Average source throughput in bytes per second, 0 before the first read
+  uint32_t getThroughput() { return (uint32_t)throughput; }
+  // Longest recent stall, decaying over time
+  uint32_t getStallMs() { return (uint32_t)stallPeakMs; }
+
+ private:
+  Config config;
+  std::atomic<uint32_t> consumeRate;
+
+  // Only touched by the buffering task
+  size_t cycleBytes = 0;
+  std::chrono::microseconds cycleTime{0};
+  float throughput = 0;
+  float stallPeakMs = 0;
+};
+}  // namespace bell
@@ -1,24 +1,41 @@
 #pragma once
 
+#include <stdint.h>  // for SIZE_MAX
 #include <iostream>  // for streamsize, basic_streambuf<>::int_type, ios...
 #include <memory>    // for unique_ptr, operator!=
+#include <optional>  // for optional
 #include <string>    // for char_traits, string
+#include <utility>   // for move
+#include <vector>    // for vector
 
 #include "BellSocket.h"  // for Socket
+#include "ByteStream.h"  // for ByteStream
 
 namespace bell {
 class SocketBuffer : public std::streambuf {
  private:
   std::unique_ptr<bell::Socket> internalSocket;
 
-  static const int bufLen = 1024;
-  char ibuf[bufLen], obuf[bufLen];
+  std::vector<char> ibuf, obuf;
+  // The sockets' own defaults until set
+  std::optional<Socket::Timeouts> timeouts;
+  std::optional<Socket::Profile> profile;
 
  public:
-  SocketBuffer() { internalSocket = nullptr; }
+  // Room for a few small TLS records, or the start of a larger one
+  static constexpr size_t DEFAULT_INPUT_SIZE = 4096;
+  // Request headers and a small body leave in one write, i.e. one TLS record
+  static constexpr size_t DEFAULT_OUTPUT_SIZE = 2048;
+
+  SocketBuffer(size_t inputSize = DEFAULT_INPUT_SIZE,
+               size_t outputSize = DEFAULT_OUTPUT_SIZE) {
+    internalSocket = nullptr;
+    setBufferSizes(inputSize, outputSize);
+  }
 
-  SocketBuffer(const std::string& hostname, int port, bool isSSL = false) {
-    open(hostname, port);
+  SocketBuffer(const std::string& hostname, int port, bool isSSL = false)
+      : SocketBuffer() {
+    open(hostname, port, isSSL);
   }
 
   int open(const std::string& hostname, int port, bool isSSL = false);
@@ -31,6 +48,63 @@ class SocketBuffer : public std::streambuf {
 
   ~SocketBuffer() { close(); }
 
+  /**
+   * Resizes the buffers, flushing pending output and dropping buffered input
+   * first. Reads larger than the input buffer bypass it, so it only needs to
+   * fit what's read in small pieces, e.g. header lines.
+   */
+  void setBufferSizes(size_t inputSize, size_t outputSize);
+
+  /**
+   * Hands the connection over, e.g. to keep it open for another request.
+   * Anything left in the input buffer is dropped.
+   */
+  std::unique_ptr<bell::Socket> release();
+
+  // Continues on an already open connection, closing the current one
+  void attach(std::unique_ptr<bell::Socket> socket);
+
+  // Bytes received but not read yet
+  size_t buffered() { return egptr() - gptr(); }
+
+  /**
+   * Deadlines of the connection's reads and writes, see Socket::Timeouts.
+   * Kept for the connections opened or attached later, a TLS handshake is
+   * bounded by them too.
+   */
+  void setTimeouts(const Socket::Timeouts& timeouts) {
+    this->timeouts = timeouts;
+    if (internalSocket != nullptr) {
+      internalSocket->setTimeouts(timeouts);
+    }
+  }
+  // TCP options of the connection, kept like the timeouts
+  void setProfile(Socket::Profile profile) {
+    this->profile = profile;
+    if (internalSocket != nullptr) {
+      internalSocket->setProfile(profile);
+    }
+  }
+  // Why the last socket read or write failed
+  Socket::Error getError() {
+    return internalSocket != nullptr ? internalSocket->getError()
+                                     : Socket::Error::CLOSED;
+  }
+
+  /**
+   * Puts bytes back in front of the input, e.g. the start of a body read
+   * along with the headers. The input buffer grows when they don't fit.
+   */
+  void unread(const uint8_t* data, size_t len);
+
+  /**
+   * Reads whatever is available, draining buffered input first. Reads
+   * smaller than the input buffer refill it, larger ones go straight into
+   * dst with a single socket read.
+   * @return amount of bytes read, 0 on end of stream or error
+   */
+  size_t readSome(uint8_t* dst, size_t len);
+
  protected:
   virtual int sync();
 
@@ -67,5 +141,50 @@ class SocketStream : public std::iostream {
   int close() { return socketBuf.close(); }
 
   bool isOpen() { return socketBuf.isOpen(); }
+
+  std::unique_ptr<bell::Socket> release() {
+    clear();
+    return socketBuf.release();
+  }
+
+  void attach(std::unique_ptr<bell::Socket> socket) {
+    clear();
+    socketBuf.attach(std::move(socket));
+  }
+
+  void setBufferSizes(size_t inputSize, size_t outputSize) {
+    socketBuf.setBufferSizes(inputSize, outputSize);
+  }
+};
+
+/**
+ * ByteStream view of a SocketStream, for consumers that pull large blocks and
+ * don't need the iostream layers. Reads pick up where the stream left off.
+ */
+class SocketByteStream : public bell::ByteStream {
+ public:
+  SocketByteStream(SocketStream& stream) : stream(stream) {}
+
+  size_t read(uint8_t* buf, size_t nbytes) override;
+  size_t skip(size_t nbytes) override;
+
+  size_t position() override { return readPosition; }
+  // Unknown for a socket
+  size_t size() override { return 0; }
+  void close() override { stream.close(); }
+
+  /**
+   * Starts a new body, reads return 0 after limit bytes. A keep-alive
+   * connection doesn't end with the body, so reading on would block.
+   */
+  void setLimit(size_t limit) {
+    this->limit = limit;
+    this->readPosition = 0;
+  }
+
+ private:
+  SocketStream& stream;
+  size_t readPosition = 0;
+  size_t limit = SIZE_MAX;
 };
 }  // namespace bell
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 #include "BellSocket.h"
+#include "DNSCache.h"
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -42,55 +43,32 @@ class TCPSocket : public bell::Socket {
   int getFd() { return sockFd; }
 
   void open(const std::string& host, uint16_t port) {
-    int err;
-    int domain = AF_INET;
-    int socketType = SOCK_STREAM;
-
-    struct addrinfo hints {
-    }, *addr;
-    //fine-tune hints according to which socket you want to open
-    hints.ai_family = domain;
-    hints.ai_socktype = socketType;
-    hints.ai_protocol =
-        IPPROTO_IP;  // no enum : possible value can be read in /etc/protocols
-    hints.ai_flags = AI_CANONNAME | AI_ALL | AI_ADDRCONFIG;
-
-    // BELL_LOG(info, "http", "%s %d", host.c_str(), port);
-
-    char portStr[6];
-    sprintf(portStr, "%u", port);
-    err = getaddrinfo(host.c_str(), portStr, &hints, &addr);
-    if (err != 0) {
-      throw std::runtime_error("Resolve failed");
-    }
-
-    sockFd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
-
-    err = connect(sockFd, addr->ai_addr, addr->ai_addrlen);
-    if (err < 0) {
-      close();
-      BELL_LOG(error, "http", "Could not connect to %s. Error %d", host.c_str(),
-               errno);
-      throw std::runtime_error("Resolve failed");
+    // Resolved through the cache, racing the host's addresses
+    sockFd = DNSCache::instance().connect(host, port);
+    if (sockFd < 0) {
+      BELL_LOG(error, "http", "Could not connect to %s", host.c_str());
+      throw std::runtime_error("Connect failed");
     }
 
-    int flag = 1;
-    setsockopt(sockFd,       /* socket affected */
-               IPPROTO_TCP,  /* set option at TCP level */
-               TCP_NODELAY,  /* name of option */
-               (char*)&flag, /* the cast is historical cruft */
-               sizeof(int)); /* length of option value */
+    // TCP_NODELAY and the rest of the profile's options
+    applyProfile(sockFd);
+    applyTimeouts(sockFd);
 
-    freeaddrinfo(addr);
     isClosed = false;
   }
 
+  // Negative on failure, getError() tells a timeout from a broken connection
   size_t read(uint8_t* buf, size_t len) {
-    return recv(sockFd, (char*)buf, len, 0);
+    long result = recv(sockFd, (char*)buf, len, 0);
+    setError(result);
+    rearmQuickAck(sockFd);
+    return result;
   }
 
   size_t write(uint8_t* buf, size_t len) {
-    return send(sockFd, (char*)buf, len, 0);
+    long result = send(sockFd, (char*)buf, len, 0);
+    setError(result);
+    return result;
   }
 
   size_t poll() {
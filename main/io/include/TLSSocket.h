@@ -3,7 +3,8 @@
 
 #include <stdint.h>  // for uint8_t, uint16_t
 
-#include "BellSocket.h"  // for Socket
+#include "BellMetrics.h"  // for MemoryAccount
+#include "BellSocket.h"   // for Socket
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -18,20 +19,43 @@
 #include "mbedtls/ssl.h"          // for mbedtls_ssl_config, mbedtls_ssl_con...
 
 namespace bell {
+/**
+ * TLS client connection. All connections share one SSL config and random
+ * generator, and the last session to every host is kept so reconnecting
+ * can resume it with an abbreviated handshake.
+ */
 class TLSSocket : public bell::Socket {
  private:
   mbedtls_net_context server_fd;
-  mbedtls_entropy_context entropy;
-  mbedtls_ctr_drbg_context ctr_drbg;
   mbedtls_ssl_context ssl;
-  mbedtls_ssl_config conf;
 
   bool isClosed = true;
+  bool offerHTTP2 = false;
+  // Context and record buffers of the open connection
+  MemoryAccount memory = MemoryAccount("tls");
+
+  // Sets error from the result of mbedtls_ssl_read() or write()
+  void setTLSError(int result);
 
  public:
   TLSSocket();
   ~TLSSocket() { close(); };
 
+  /**
+   * Seeds the shared random generator and sets up the SSL config, which
+   * otherwise happens on the first connection. Meant for a background
+   * job, e.g. StartupProfile::warmUp("tls", TLSSocket::warmUp)
+   */
+  static void warmUp();
+
+  /**
+   * Offers HTTP/2 next to HTTP/1.1 through ALPN on the following open(),
+   * getProtocol() then tells which one the server picked
+   */
+  void setOfferHTTP2(bool offer) { offerHTTP2 = offer; }
+  // Protocol agreed through ALPN, empty when the server didn't take part
+  std::string getProtocol();
+
   void open(const std::string& host, uint16_t port);
 
   size_t read(uint8_t* buf, size_t len);
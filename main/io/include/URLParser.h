@@ -1,107 +1,84 @@
 #pragma once
 
-#include <cstdlib>    // for strtol, size_t
-#include <regex>      // for match_results, match_results<>::value_type, sub...
-#include <stdexcept>  // for invalid_argument
-#include <string>     // for string, allocator, operator+, char_traits, oper...
+#include <cstdlib>      // for size_t
+#include <stdexcept>    // for invalid_argument
+#include <string>       // for string
+#include <string_view>  // for string_view
 
 namespace bell {
 class URLParser {
  public:
+  /**
+   * Percent-encodes everything but [0-9A-Za-z] and !'()*-._~, appending to
+   * out. Reserves once, out can be reused across calls.
+   */
+  static void urlEncode(std::string_view value, std::string& out);
+  /**
+   * Same into a caller's buffer, NUL terminated when it fits.
+   * @returns length of the encoded value, larger than outSize - 1 when
+   * truncated, like snprintf()
+   */
+  static size_t urlEncode(std::string_view value, char* out, size_t outSize);
   static std::string urlEncode(const std::string& value) {
-    std::string new_str = "";
-    static auto hex_digt = "0123456789ABCDEF";
-
     std::string result;
-    result.reserve(value.size() << 1);
-
-    for (auto ch : value) {
-      if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') ||
-          (ch >= 'a' && ch <= 'z') || ch == '-' || ch == '_' || ch == '!' ||
-          ch == '\'' || ch == '(' || ch == ')' || ch == '*' || ch == '~' ||
-          ch == '.')  // !'()*-._~
-      {
-        result.push_back(ch);
-      } else {
-        result += std::string("%") +
-                  hex_digt[static_cast<unsigned char>(ch) >> 4] +
-                  hex_digt[static_cast<unsigned char>(ch) & 15];
-      }
-    }
-
+    urlEncode(value, result);
     return result;
   }
+
+  // '+' decodes to a space, invalid escapes are kept as they are
+  static void urlDecode(std::string_view value, std::string& out);
   static std::string urlDecode(const std::string& value) {
     std::string result;
-    result.reserve(value.size());
-
-    for (std::size_t i = 0; i < value.size(); ++i) {
-      auto ch = value[i];
-
-      if (ch == '%' && (i + 2) < value.size()) {
-        auto hex = value.substr(i + 1, 2);
-        auto dec = static_cast<char>(std::strtol(hex.c_str(), nullptr, 16));
-        result.push_back(dec);
-        i += 2;
-      } else if (ch == '+') {
-        result.push_back(' ');
-      } else {
-        result.push_back(ch);
-      }
-    }
-
+    urlDecode(value, result);
     return result;
   }
 
+  // Components of a URL, views into it
+  struct View {
+    std::string_view schema;
+    // Without the brackets of an IPv6 address
+    std::string_view host;
+    // Path and query as in the URL, "/" when both are missing
+    std::string_view path;
+    std::string_view query;
+    std::string_view fragment;
+    // The schema's default when the URL has none
+    int port = -1;
+  };
+
+  /**
+   * Splits url in one pass, without allocating
+   * ([schema:]//host[:port][/path][?query][#fragment]).
+   * @returns false without a host or with an invalid port
+   */
+  static bool parse(std::string_view url, View& view);
+
   std::string host;
   int port = -1;
 
   std::string schema = "http";
   std::string path;
-#ifdef BELL_DISABLE_REGEX
-  void parse(const char* url, std::vector<std::string>& match);
-#else
-  static const std::regex urlParseRegex;
-#endif
 
+  // Owning copy of the above
+  // @throws std::invalid_argument on an invalid URL
   static URLParser parse(const std::string& url) {
-    URLParser parser;
-
-    // apply parser.urlParseRegex to url
-#ifdef BELL_DISABLE_REGEX
-    std::vector<std::string> match(6);
-    parser.parse(url.c_str(), match);
-#else
-    std::cmatch match;
-    std::regex_match(url.c_str(), match, parser.urlParseRegex);
-#endif
-
-    if (match.size() < 3) {
+    View view;
+    if (!parse(url, view)) {
       throw std::invalid_argument("Invalid URL");
     }
 
-    parser.schema = match[1];
-    parser.host = match[2];
-    parser.path = match[3];
-
-    if (match[4] != "") {
-      parser.path += match[4];
-    }
-
-    // check if parser.host contains ':'
-    if (parser.host.find(':') != std::string::npos) {
-      auto port = std::stoi(
-          parser.host.substr(parser.host.find(':') + 1, parser.host.size()));
-      auto host = parser.host.substr(0, parser.host.find(':'));
-      parser.port = port;
-      parser.host = host;
+    URLParser parser;
+    if (!view.schema.empty()) {
+      parser.schema = view.schema;
     }
-
-    if (parser.port == -1) {
-      parser.port = parser.schema == "http" ? 80 : 443;
+    parser.host = view.host;
+    if (view.path[0] == '?') {
+      // A request line needs the path, "http://host?query"
+      parser.path = "/";
     }
-
+    parser.path += view.path;
+    parser.port = view.port;
     return parser;
   }
 };
-}  // namespace bell
\ No newline at end of file
+}  // namespace bell
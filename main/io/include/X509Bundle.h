@@ -22,8 +22,10 @@ int crtVerifyCallback(void* buf, mbedtls_x509_crt* crt, int depth,
 
 /* Initialize the bundle into an array so we can do binary search for certs,
    the bundle generated by the python utility is already presorted by subject name
+   Pass copy = false when x509_bundle stays valid, e.g. embedded in flash or
+   memory mapped, to index it in place
  */
-void init(const uint8_t* x509_bundle, size_t bundle_size);
+void init(const uint8_t* x509_bundle, size_t bundle_size, bool copy = true);
 
 void attach(mbedtls_ssl_config* conf);
 
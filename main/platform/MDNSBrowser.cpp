@@ -0,0 +1,481 @@
+#include "MDNSBrowser.h"
+
+#include <string.h>   // for memcpy, memset
+#include <algorithm>  // for min, sort, unique
+#include <cctype>     // for tolower
+
+#include "BellLogger.h"  // for BELL_LOG
+#include "BellTask.h"    // for Task
+
+#ifndef ESP_PLATFORM
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>   // for inet_ntop, htons
+#include <netinet/in.h>  // for sockaddr_in, ip_mreq
+#include <sys/select.h>  // for select
+#include <sys/socket.h>  // for socket, setsockopt
+#include <unistd.h>      // for close
+#endif
+#endif
+
+using namespace bell;
+
+std::vector<MDNSBrowser::Service> MDNSBrowser::getServices() {
+  std::scoped_lock lock(cacheMutex);
+  auto now = Clock::now();
+  std::vector<Service> services;
+  for (auto& [name, entry] : cache) {
+    if (entry.expires > now) {
+      services.push_back(entry.service);
+    }
+  }
+  return services;
+}
+
+bool MDNSBrowser::findService(const std::string& name, Service& service) {
+  std::scoped_lock lock(cacheMutex);
+  auto it = cache.find(name);
+  if (it == cache.end() || it->second.expires <= Clock::now()) {
+    return false;
+  }
+  service = it->second.service;
+  return true;
+}
+
+void MDNSBrowser::updateService(const Service& service, uint32_t ttl) {
+  Change change;
+  {
+    std::scoped_lock lock(cacheMutex);
+    auto expires = ttl ? Clock::now() + std::chrono::seconds(ttl)
+                       : Clock::time_point::max();
+    auto it = cache.find(service.name);
+    if (it == cache.end()) {
+      change = Change::ADDED;
+    } else if (it->second.service.host != service.host ||
+               it->second.service.address != service.address ||
+               it->second.service.port != service.port ||
+               it->second.service.txtData != service.txtData) {
+      change = Change::UPDATED;
+    } else {
+      // Same records, only the TTL moves
+      it->second.expires = expires;
+      return;
+    }
+    cache[service.name] = {service, expires};
+  }
+  if (onChange) {
+    onChange(change, service);
+  }
+}
+
+void MDNSBrowser::removeService(const std::string& name) {
+  Service removed;
+  {
+    std::scoped_lock lock(cacheMutex);
+    auto it = cache.find(name);
+    if (it == cache.end()) {
+      return;
+    }
+    removed = std::move(it->second.service);
+    cache.erase(it);
+  }
+  if (onChange) {
+    onChange(Change::REMOVED, removed);
+  }
+}
+
+void MDNSBrowser::expireServices() {
+  std::vector<Service> expired;
+  {
+    std::scoped_lock lock(cacheMutex);
+    auto now = Clock::now();
+    for (auto it = cache.begin(); it != cache.end();) {
+      if (it->second.expires <= now) {
+        expired.push_back(std::move(it->second.service));
+        it = cache.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+  if (onChange) {
+    for (auto& service : expired) {
+      onChange(Change::REMOVED, service);
+    }
+  }
+}
+
+#ifndef ESP_PLATFORM
+namespace {
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#define closeSocket closesocket
+#else
+typedef int socket_t;
+#define INVALID_SOCKET -1
+#define closeSocket close
+#endif
+
+enum RecordType : uint16_t {
+  TYPE_A = 1,
+  TYPE_PTR = 12,
+  TYPE_TXT = 16,
+  TYPE_SRV = 33,
+  TYPE_ANY = 255,
+};
+
+std::string lowercase(std::string name) {
+  for (auto& ch : name) {
+    ch = std::tolower((unsigned char)ch);
+  }
+  return name;
+}
+
+// Reads a possibly compressed name at pos, moving pos past it
+bool readName(const uint8_t* packet, size_t size, size_t& pos,
+              std::vector<std::string>& labels) {
+  labels.clear();
+  size_t at = pos;
+  bool jumped = false;
+  for (int jumps = 0; jumps < 16;) {
+    if (at >= size) {
+      return false;
+    }
+    uint8_t length = packet[at];
+    if ((length & 0xC0) == 0xC0) {
+      if (at + 1 >= size) {
+        return false;
+      }
+      if (!jumped) {
+        pos = at + 2;
+      }
+      jumped = true;
+      at = ((length & 0x3F) << 8) | packet[at + 1];
+      jumps++;
+      continue;
+    }
+    at++;
+    if (length == 0) {
+      if (!jumped) {
+        pos = at;
+      }
+      return true;
+    }
+    if (at + length > size) {
+      return false;
+    }
+    labels.emplace_back((const char*)packet + at, length);
+    at += length;
+  }
+  // Pointer loop
+  return false;
+}
+
+std::string joinLabels(const std::vector<std::string>& labels) {
+  std::string name;
+  for (auto& label : labels) {
+    if (!name.empty()) {
+      name += '.';
+    }
+    name += label;
+  }
+  return name;
+}
+
+uint16_t read16(const uint8_t* data) {
+  return (data[0] << 8) | data[1];
+}
+
+uint32_t read32(const uint8_t* data) {
+  return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) |
+         data[3];
+}
+
+/**
+ * Browses with multicast DNS queries (RFC 6762) on 224.0.0.251:5353,
+ * listening to the answers and to unsolicited announcements and goodbyes.
+ */
+class QueryMDNSBrowser : public MDNSBrowser, public bell::Task {
+ public:
+  QueryMDNSBrowser(const std::string& serviceType,
+                   const std::string& serviceProto, ChangeCallback onChange)
+      : MDNSBrowser(onChange),
+        bell::Task("mdns_browse", 4096 * 2, 0, 0),
+        serviceName(serviceType + "." + serviceProto + ".local") {
+    for (size_t start = 0, end; start < serviceName.size(); start = end + 1) {
+      end = serviceName.find('.', start);
+      if (end == std::string::npos) {
+        end = serviceName.size();
+      }
+      serviceLabels.push_back(serviceName.substr(start, end - start));
+    }
+    serviceName = lowercase(serviceName);
+  }
+
+  ~QueryMDNSBrowser() {
+    stopTask();
+    if (sock != INVALID_SOCKET) {
+      closeSocket(sock);
+    }
+  }
+
+  bool start() {
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+      return false;
+    }
+    // Shares the port with a responder, ours included
+    int yes = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&yes, sizeof(yes));
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(5353);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct ip_mreq group;
+    group.imr_multiaddr.s_addr = inet_addr("224.0.0.251");
+    group.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&group,
+                   sizeof(group)) < 0) {
+      BELL_LOG(error, "MDNS", "cannot listen for mDNS answers");
+      return false;
+    }
+    return startTask();
+  }
+
+ private:
+  // Re-asked well before the usual 120 s SRV and TXT TTLs run out
+  static constexpr int QUERY_INTERVAL_S = 60;
+
+  // Records of one instance, gathered across packets
+  struct Instance {
+    std::string name;
+    std::string host;
+    int port = 0;
+    std::map<std::string, std::string> txtData;
+    bool hasSRV = false;
+    bool hasTXT = false;
+    uint32_t ttl = 0;
+    // Last follow-up question, one a second at most
+    std::chrono::steady_clock::time_point asked;
+  };
+
+  socket_t sock = INVALID_SOCKET;
+  std::string serviceName;
+  std::vector<std::string> serviceLabels;
+  // By lowercase full name, "kitchen._spotify-connect._tcp.local"
+  std::map<std::string, Instance> instances;
+  // Lowercase host to IPv4
+  std::map<std::string, std::string> addresses;
+
+  void sendQuery(const std::vector<std::string>& labels, uint16_t type) {
+    std::vector<uint8_t> packet(12, 0);
+    packet[5] = 1;  // one question
+    for (auto& label : labels) {
+      packet.push_back(std::min<size_t>(label.size(), 63));
+      packet.insert(packet.end(), label.begin(),
+                    label.begin() + std::min<size_t>(label.size(), 63));
+    }
+    packet.push_back(0);
+    packet.push_back(type >> 8);
+    packet.push_back(type & 0xFF);
+    packet.push_back(0);
+    packet.push_back(1);  // IN
+
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(5353);
+    to.sin_addr.s_addr = inet_addr("224.0.0.251");
+    sendto(sock, (const char*)packet.data(), packet.size(), 0,
+           (struct sockaddr*)&to, sizeof(to));
+  }
+
+  void handlePacket(const uint8_t* packet, size_t size) {
+    // Answers only
+    if (size < 12 || !(packet[2] & 0x80)) {
+      return;
+    }
+    size_t records = read16(packet + 6) + read16(packet + 8) +
+                     read16(packet + 10);
+    size_t pos = 12;
+    std::vector<std::string> labels, target;
+
+    for (size_t i = read16(packet + 4); i > 0; i--) {
+      if (!readName(packet, size, pos, labels) || pos + 4 > size) {
+        return;
+      }
+      pos += 4;
+    }
+
+    std::vector<std::string> touched;
+    for (; records > 0; records--) {
+      if (!readName(packet, size, pos, labels) || pos + 10 > size) {
+        return;
+      }
+      uint16_t type = read16(packet + pos);
+      uint32_t ttl = read32(packet + pos + 4);
+      size_t length = read16(packet + pos + 8);
+      pos += 10;
+      if (pos + length > size) {
+        return;
+      }
+      size_t rdata = pos;
+      pos += length;
+      std::string owner = lowercase(joinLabels(labels));
+
+      if (type == TYPE_PTR && owner == serviceName) {
+        size_t at = rdata;
+        if (!readName(packet, size, at, target) || target.empty()) {
+          continue;
+        }
+        std::string key = lowercase(joinLabels(target));
+        if (ttl == 0) {
+          // Goodbye
+          auto it = instances.find(key);
+          if (it != instances.end()) {
+            removeService(it->second.name);
+            instances.erase(it);
+          }
+          continue;
+        }
+        auto& instance = instances[key];
+        instance.name = target[0];
+        instance.ttl = instance.ttl ? std::min(instance.ttl, ttl) : ttl;
+        touched.push_back(key);
+      } else if (type == TYPE_SRV && instances.count(owner) && length > 6) {
+        size_t at = rdata + 6;
+        if (!readName(packet, size, at, target)) {
+          continue;
+        }
+        auto& instance = instances[owner];
+        instance.port = read16(packet + rdata + 4);
+        instance.host = joinLabels(target);
+        instance.hasSRV = true;
+        instance.ttl = std::min(instance.ttl, ttl);
+        touched.push_back(owner);
+      } else if (type == TYPE_TXT && instances.count(owner)) {
+        auto& instance = instances[owner];
+        instance.txtData.clear();
+        for (size_t at = rdata; at < rdata + length;) {
+          size_t entryLength = packet[at++];
+          std::string entry((const char*)packet + at,
+                            std::min(entryLength, rdata + length - at));
+          at += entryLength;
+          size_t equals = entry.find('=');
+          if (!entry.empty()) {
+            instance.txtData[entry.substr(0, equals)] =
+                equals == std::string::npos ? "" : entry.substr(equals + 1);
+          }
+        }
+        instance.hasTXT = true;
+        touched.push_back(owner);
+      } else if (type == TYPE_A && length == 4) {
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, packet + rdata, address, sizeof(address));
+        addresses[owner] = address;
+        for (auto& [key, instance] : instances) {
+          if (lowercase(instance.host) == owner) {
+            touched.push_back(key);
+          }
+        }
+      }
+    }
+
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (auto& key : touched) {
+      resolve(key);
+    }
+  }
+
+  // Reports the instance once complete, asks for what's missing otherwise
+  void resolve(const std::string& key) {
+    auto& instance = instances[key];
+    auto now = std::chrono::steady_clock::now();
+    bool canAsk = now - instance.asked >= std::chrono::seconds(1);
+    if (!instance.hasSRV || !instance.hasTXT) {
+      if (!canAsk) {
+        return;
+      }
+      instance.asked = now;
+      std::vector<std::string> labels = serviceLabels;
+      labels.insert(labels.begin(), instance.name);
+      sendQuery(labels, TYPE_ANY);
+      return;
+    }
+    auto address = addresses.find(lowercase(instance.host));
+    if (address == addresses.end()) {
+      if (!canAsk) {
+        return;
+      }
+      instance.asked = now;
+      std::vector<std::string> labels;
+      for (size_t start = 0, end; start < instance.host.size();
+           start = end + 1) {
+        end = instance.host.find('.', start);
+        if (end == std::string::npos) {
+          end = instance.host.size();
+        }
+        labels.push_back(instance.host.substr(start, end - start));
+      }
+      sendQuery(labels, TYPE_A);
+      return;
+    }
+
+    Service service;
+    service.name = instance.name;
+    service.host = instance.host;
+    service.address = address->second;
+    service.port = instance.port;
+    service.txtData = instance.txtData;
+    updateService(service, instance.ttl);
+  }
+
+  void runTask() override {
+    std::vector<uint8_t> packet(9000);
+    auto nextQuery = std::chrono::steady_clock::now();
+
+    while (!isStopRequested()) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= nextQuery) {
+        sendQuery(serviceLabels, TYPE_PTR);
+        nextQuery = now + std::chrono::seconds(QUERY_INTERVAL_S);
+        expireServices();
+      }
+
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(sock, &fds);
+      // Wakes up now and then to notice requestStop()
+      struct timeval timeout = {1, 0};
+      if (select(sock + 1, &fds, NULL, NULL, &timeout) <= 0) {
+        continue;
+      }
+      int received = recv(sock, (char*)packet.data(), packet.size(), 0);
+      if (received > 0) {
+        handlePacket(packet.data(), received);
+      }
+    }
+  }
+};
+}  // namespace
+
+std::unique_ptr<MDNSBrowser> MDNSBrowser::browseWithQueries(
+    const std::string& serviceType, const std::string& serviceProto,
+    ChangeCallback onChange) {
+  auto browser =
+      std::make_unique<QueryMDNSBrowser>(serviceType, serviceProto, onChange);
+  if (!browser->start()) {
+    return nullptr;
+  }
+  return browser;
+}
+#endif
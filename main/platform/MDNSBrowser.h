@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>    // for uint32_t
+#include <chrono>      // for steady_clock
+#include <functional>  // for function
+#include <map>         // for map
+#include <memory>      // for unique_ptr
+#include <mutex>       // for mutex
+#include <string>      // for string
+#include <vector>      // for vector
+
+namespace bell {
+
+/**
+ * Discovers the instances of a service type, e.g. "_spotify-connect",
+ * "_tcp", with Avahi or dns_sd where they run, the ESP-IDF mdns component
+ * on the ESP32, and its own multicast queries otherwise.
+ *
+ * Resolved instances are cached until their records' TTL runs out or they
+ * say goodbye, lookups never wait for the network. Changes are reported as
+ * they are seen, from the browser's own thread.
+ */
+class MDNSBrowser {
+ public:
+  struct Service {
+    // Instance name, "Kitchen"
+    std::string name;
+    // Target host, "kitchen.local"
+    std::string host;
+    // IPv4 address of the host, dotted
+    std::string address;
+    int port = 0;
+    std::map<std::string, std::string> txtData;
+  };
+
+  enum class Change { ADDED, UPDATED, REMOVED };
+  typedef std::function<void(Change change, const Service& service)>
+      ChangeCallback;
+
+  virtual ~MDNSBrowser() {}
+
+  // nullptr when no backend could start
+  static std::unique_ptr<MDNSBrowser> browse(const std::string& serviceType,
+                                             const std::string& serviceProto,
+                                             ChangeCallback onChange = nullptr);
+
+  // Instances currently known, from the cache
+  std::vector<Service> getServices();
+  // @returns false if name isn't in the cache
+  bool findService(const std::string& name, Service& service);
+
+ protected:
+  MDNSBrowser(ChangeCallback onChange) : onChange(onChange) {}
+
+  /**
+   * Adds or refreshes service, reports it if it's new or changed.
+   * @param ttl seconds the records stay valid, 0 when the backend reports
+   * removals itself
+   */
+  void updateService(const Service& service, uint32_t ttl);
+  void removeService(const std::string& name);
+  // Reports and drops services with an expired TTL
+  void expireServices();
+
+  // Browses with our own multicast queries, for platforms without a
+  // browsing responder
+  static std::unique_ptr<MDNSBrowser> browseWithQueries(
+      const std::string& serviceType, const std::string& serviceProto,
+      ChangeCallback onChange);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    Service service;
+    // Clock::time_point::max() without a TTL
+    Clock::time_point expires;
+  };
+
+  std::mutex cacheMutex;
+  std::map<std::string, Entry> cache;
+  ChangeCallback onChange;
+};
+
+}  // namespace bell
@@ -0,0 +1,145 @@
+#include "MDNSService.h"
+
+#include <chrono>              // for steady_clock, milliseconds
+#include <condition_variable>  // for condition_variable
+#include <deque>               // for deque
+#include <mutex>               // for mutex, unique_lock
+
+#include "BellTask.h"  // for Task
+
+using namespace bell;
+
+namespace {
+// Registers services and sends their TXT updates, one task per process
+class MDNSResponder : public bell::Task {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  MDNSResponder() : bell::Task("mdns", 4096 * 2, 0, 0) { startTask(); }
+
+  // Started on first use and never destroyed, services may outlive statics
+  static MDNSResponder& instance() {
+    std::scoped_lock lock(instanceMutex);
+    if (responder == nullptr) {
+      responder = new MDNSResponder();
+    }
+    return *responder;
+  }
+
+  // nullptr until instance() was called
+  static MDNSResponder* existing() {
+    std::scoped_lock lock(instanceMutex);
+    return responder;
+  }
+
+  void post(std::function<void()> job) {
+    {
+      std::scoped_lock lock(mutex);
+      jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+  }
+
+  void setTXT(MDNSService* service,
+              const std::map<std::string, std::string>& txtData) {
+    {
+      std::scoped_lock lock(mutex);
+      auto it = pending.find(service);
+      if (it != pending.end()) {
+        // Keeps its turn, with the newer data
+        it->second.txtData = txtData;
+        return;
+      }
+      auto due = Clock::now();
+      auto last = lastUpdate.find(service);
+      if (last != lastUpdate.end()) {
+        due = std::max(due, last->second + INTERVAL);
+      }
+      pending[service] = {txtData, due};
+    }
+    wake.notify_one();
+  }
+
+  void cancel(MDNSService* service) {
+    // Held while an update runs, so the service is left alone once this
+    // returns
+    std::scoped_lock lock(mutex);
+    pending.erase(service);
+    lastUpdate.erase(service);
+  }
+
+ private:
+  struct PendingTXT {
+    std::map<std::string, std::string> txtData;
+    Clock::time_point due;
+  };
+
+  static constexpr std::chrono::milliseconds INTERVAL{
+      MDNSService::TXT_UPDATE_INTERVAL_MS};
+  static std::mutex instanceMutex;
+  static MDNSResponder* responder;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::function<void()>> jobs;
+  std::map<MDNSService*, PendingTXT> pending;
+  std::map<MDNSService*, Clock::time_point> lastUpdate;
+
+  void runTask() override {
+    std::unique_lock lock(mutex);
+    while (true) {
+      if (!jobs.empty()) {
+        auto job = std::move(jobs.front());
+        jobs.pop_front();
+        // Registrations may resolve hosts, the others can still queue
+        lock.unlock();
+        job();
+        lock.lock();
+        continue;
+      }
+
+      auto first = pending.end();
+      for (auto it = pending.begin(); it != pending.end(); it++) {
+        if (first == pending.end() || it->second.due < first->second.due) {
+          first = it;
+        }
+      }
+      if (first == pending.end()) {
+        wake.wait(lock);
+      } else if (first->second.due > Clock::now()) {
+        wake.wait_until(lock, first->second.due);
+      } else {
+        MDNSService* service = first->first;
+        auto txtData = std::move(first->second.txtData);
+        pending.erase(first);
+        service->updateTXT(txtData);
+        lastUpdate[service] = Clock::now();
+      }
+    }
+  }
+};
+std::mutex MDNSResponder::instanceMutex;
+MDNSResponder* MDNSResponder::responder = nullptr;
+}  // namespace
+
+void MDNSService::registerServiceAsync(
+    const std::string& serviceName, const std::string& serviceType,
+    const std::string& serviceProto, const std::string& serviceHost,
+    int servicePort, const std::map<std::string, std::string> txtData,
+    RegisterCallback onRegistered) {
+  MDNSResponder::instance().post([=]() {
+    onRegistered(registerService(serviceName, serviceType, serviceProto,
+                                 serviceHost, servicePort, txtData));
+  });
+}
+
+void MDNSService::setTXT(const std::map<std::string, std::string>& txtData) {
+  MDNSResponder::instance().setTXT(this, txtData);
+}
+
+void MDNSService::cancelTXTUpdates() {
+  // Without a responder there is nothing to cancel
+  if (auto responder = MDNSResponder::existing()) {
+    responder->cancel(this);
+  }
+}
@@ -1,19 +1,57 @@
 #pragma once
 
-#include <map>     // for map
-#include <memory>  // for unique_ptr
-#include <string>  // for string
+#include <functional>  // for function
+#include <map>         // for map
+#include <memory>      // for unique_ptr
+#include <string>      // for string
 
 namespace bell {
 
 class MDNSService {
  public:
+  typedef std::function<void(std::unique_ptr<MDNSService>)> RegisterCallback;
+
   virtual ~MDNSService() {}
   static std::unique_ptr<MDNSService> registerService(
       const std::string& serviceName, const std::string& serviceType,
       const std::string& serviceProto, const std::string& serviceHost,
       int servicePort, const std::map<std::string, std::string> txtData);
+
+  /**
+   * registerService() on the shared mDNS task, without blocking the caller
+   * on the responder. Every service of the process goes through that task
+   * and the one responder connection each platform keeps.
+   * @param onRegistered called from the mDNS task, nullptr on failure
+   */
+  static void registerServiceAsync(
+      const std::string& serviceName, const std::string& serviceType,
+      const std::string& serviceProto, const std::string& serviceHost,
+      int servicePort, const std::map<std::string, std::string> txtData,
+      RegisterCallback onRegistered);
+
   virtual void unregisterService() = 0;
+
+  /**
+   * Replaces the TXT record of the running service, without withdrawing
+   * it, so that browsers see a change instead of a new service. The
+   * built-in responder has no update and registers the service again.
+   * @returns false if the responder refused the record
+   */
+  virtual bool updateTXT(const std::map<std::string, std::string>& txtData) = 0;
+
+  /**
+   * updateTXT() from the mDNS task, at most once per TXT_UPDATE_INTERVAL_MS.
+   * Updates in between are merged, only the latest data goes out, e.g. for
+   * now-playing state changing on every track skip.
+   */
+  void setTXT(const std::map<std::string, std::string>& txtData);
+
+  static constexpr int TXT_UPDATE_INTERVAL_MS = 1000;
+
+ protected:
+  // Drops a pending setTXT(), waiting for one in progress. For the
+  // implementations' destructors, while they can still take an update
+  void cancelTXTUpdates();
 };
 
-}  // namespace bell
\ No newline at end of file
+}  // namespace bell
@@ -0,0 +1,97 @@
+#pragma once
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#elif _WIN32
+#include <winsock2.h>
+#else
+#include <pthread.h>  // for pthread_mutex_t, PTHREAD_PRIO_INHERIT
+#endif
+
+namespace bell {
+
+/**
+ * Mutex with priority inheritance, for locks an audio thread may wait on.
+ * A low priority thread holding it, e.g. one reconfiguring a transform, runs
+ * at the waiter's priority until it unlocks, instead of being preempted by
+ * the threads in between while the audio thread starves. A plain std::mutex
+ * gives no such guarantee under SCHED_FIFO or FreeRTOS.
+ *
+ * On FreeRTOS it's a mutex semaphore, which inherits on its own. POSIX
+ * builds ask for PTHREAD_PRIO_INHERIT and fall back to a plain mutex where
+ * the system doesn't support it. Windows has no inheritance, its scheduler
+ * boosts starved threads instead.
+ *
+ * Meets Lockable, so std::scoped_lock and std::unique_lock work with it.
+ * Not for interrupts.
+ */
+class RTMutex {
+ public:
+  RTMutex() {
+#ifdef ESP_PLATFORM
+    handle = xSemaphoreCreateMutexStatic(&storage);
+#elif !defined(_WIN32)
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT) != 0 ||
+        pthread_mutex_init(&mutex, &attr) != 0) {
+      pthread_mutex_init(&mutex, NULL);
+    }
+    pthread_mutexattr_destroy(&attr);
+#endif
+  }
+  ~RTMutex() {
+#ifdef ESP_PLATFORM
+    vSemaphoreDelete(handle);
+#elif !defined(_WIN32)
+    pthread_mutex_destroy(&mutex);
+#endif
+  }
+  RTMutex(const RTMutex&) = delete;
+  RTMutex& operator=(const RTMutex&) = delete;
+
+  void lock() {
+#ifdef ESP_PLATFORM
+    xSemaphoreTake(handle, portMAX_DELAY);
+#elif _WIN32
+    AcquireSRWLockExclusive(&srwLock);
+#else
+    pthread_mutex_lock(&mutex);
+#endif
+  }
+
+  // Audio threads take this where they have something else to do, like
+  // keeping the previous configuration, rather than waiting
+  bool try_lock() {
+#ifdef ESP_PLATFORM
+    return xSemaphoreTake(handle, 0) == pdTRUE;
+#elif _WIN32
+    return TryAcquireSRWLockExclusive(&srwLock);
+#else
+    return pthread_mutex_trylock(&mutex) == 0;
+#endif
+  }
+
+  void unlock() {
+#ifdef ESP_PLATFORM
+    xSemaphoreGive(handle);
+#elif _WIN32
+    ReleaseSRWLockExclusive(&srwLock);
+#else
+    pthread_mutex_unlock(&mutex);
+#endif
+  }
+
+ private:
+#ifdef ESP_PLATFORM
+  StaticSemaphore_t storage;
+  SemaphoreHandle_t handle;
+#elif _WIN32
+  SRWLOCK srwLock = SRWLOCK_INIT;
+#else
+  pthread_mutex_t mutex;
+#endif
+};
+
+}  // namespace bell
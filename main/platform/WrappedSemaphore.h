@@ -8,12 +8,19 @@
 #elif _WIN32
 #include <winsock2.h>
 #else
-#include <semaphore.h>
-#include <time.h>
+#include <atomic>  // for atomic
 #endif
 
 namespace bell {
 
+/**
+ * Counting semaphore starting at 0. give() beyond maxVal is dropped, so a
+ * semaphore of 1 is a binary one.
+ *
+ * On Linux it's a futex, wait() and give() only enter the kernel when a
+ * task actually has to sleep or be woken. Timeouts are measured on the
+ * monotonic clock. On ESP32 it's a FreeRTOS semaphore.
+ */
 class WrappedSemaphore {
  private:
 #ifdef ESP_PLATFORM
@@ -23,7 +30,14 @@ class WrappedSemaphore {
 #elif _WIN32
   HANDLE semaphoreHandle;
 #else
-  sem_t semaphoreHandle;
+  int maxCount;
+  std::atomic<int> count = 0;
+  std::atomic<int> waiters = 0;
+
+  // Takes one without sleeping
+  bool tryTake();
+  // timeoutMs < 0 waits forever
+  int take(long timeoutMs);
 #endif
 
  public:
@@ -31,6 +45,7 @@ class WrappedSemaphore {
   ~WrappedSemaphore();
 
   int wait();
+  // @returns 0 once taken, non zero on timeout
   int twait(long milliseconds = 10);
   void give();
 };
@@ -0,0 +1,178 @@
+#include "MDNSBrowser.h"
+
+#include <arpa/inet.h>   // for inet_ntop, ntohs
+#include <sys/select.h>  // for select
+#include <list>          // for list
+
+#include "BellTask.h"  // for Task
+#include "dns_sd.h"    // for DNSServiceRef, DNSServiceBrowse, DNSServiceRe...
+
+using namespace bell;
+
+/**
+ * MacOS implementation of MDNSBrowser, on mDNSResponder. The browse and
+ * every resolution share one connection, served by the browser's task.
+ * @see https://developer.apple.com/documentation/dnssd
+ **/
+class implMDNSBrowser : public MDNSBrowser, public bell::Task {
+ public:
+  implMDNSBrowser(ChangeCallback onChange)
+      : MDNSBrowser(onChange), bell::Task("mdns_browse", 4096 * 2, 0, 0) {}
+
+  ~implMDNSBrowser() {
+    stopTask();
+    if (connection) {
+      // Deallocates the browse and resolutions along
+      DNSServiceRefDeallocate(connection);
+    }
+  }
+
+  bool start(const std::string& type) {
+    if (DNSServiceCreateConnection(&connection) != kDNSServiceErr_NoError) {
+      connection = nullptr;
+      return false;
+    }
+    browseRef = connection;
+    if (DNSServiceBrowse(&browseRef, kDNSServiceFlagsShareConnection, 0,
+                         type.c_str(), NULL, browseReply,
+                         this) != kDNSServiceErr_NoError) {
+      return false;
+    }
+    return startTask();
+  }
+
+ private:
+  // One instance being resolved, SRV and TXT first, then the address
+  struct Resolution {
+    implMDNSBrowser* browser;
+    Service service;
+    uint32_t interface;
+    DNSServiceRef resolveRef = nullptr;
+    DNSServiceRef addressRef = nullptr;
+  };
+
+  DNSServiceRef connection = nullptr;
+  DNSServiceRef browseRef = nullptr;
+  // Reply callbacks run on the task only
+  std::list<Resolution> resolutions;
+
+  void finish(Resolution* resolution) {
+    for (auto it = resolutions.begin(); it != resolutions.end(); it++) {
+      if (&*it == resolution) {
+        if (it->resolveRef) {
+          DNSServiceRefDeallocate(it->resolveRef);
+        }
+        if (it->addressRef) {
+          DNSServiceRefDeallocate(it->addressRef);
+        }
+        resolutions.erase(it);
+        return;
+      }
+    }
+  }
+
+  static void browseReply(DNSServiceRef ref, DNSServiceFlags flags,
+                          uint32_t interface, DNSServiceErrorType error,
+                          const char* name, const char* type,
+                          const char* domain, void* context) {
+    auto self = (implMDNSBrowser*)context;
+    if (error != kDNSServiceErr_NoError) {
+      return;
+    }
+    if (!(flags & kDNSServiceFlagsAdd)) {
+      self->removeService(name);
+      return;
+    }
+
+    self->resolutions.push_back({self, Service(), interface});
+    auto& resolution = self->resolutions.back();
+    resolution.service.name = name;
+    resolution.resolveRef = self->connection;
+    if (DNSServiceResolve(&resolution.resolveRef,
+                          kDNSServiceFlagsShareConnection, interface, name,
+                          type, domain, resolveReply,
+                          &resolution) != kDNSServiceErr_NoError) {
+      resolution.resolveRef = nullptr;
+      self->finish(&resolution);
+    }
+  }
+
+  static void resolveReply(DNSServiceRef ref, DNSServiceFlags flags,
+                           uint32_t interface, DNSServiceErrorType error,
+                           const char* fullName, const char* hostTarget,
+                           uint16_t port, uint16_t txtLength,
+                           const unsigned char* txtRecord, void* context) {
+    auto resolution = (Resolution*)context;
+    auto self = resolution->browser;
+    if (error != kDNSServiceErr_NoError || resolution->addressRef) {
+      return;
+    }
+
+    resolution->service.host = hostTarget;
+    resolution->service.port = ntohs(port);
+    char key[256];
+    uint8_t valueLength;
+    const void* value;
+    for (uint16_t i = 0; i < TXTRecordGetCount(txtLength, txtRecord); i++) {
+      if (TXTRecordGetItemAtIndex(txtLength, txtRecord, i, sizeof(key), key,
+                                  &valueLength,
+                                  &value) == kDNSServiceErr_NoError) {
+        resolution->service.txtData[key] =
+            value ? std::string((const char*)value, valueLength) : "";
+      }
+    }
+
+    resolution->addressRef = self->connection;
+    if (DNSServiceGetAddrInfo(&resolution->addressRef,
+                              kDNSServiceFlagsShareConnection, interface,
+                              kDNSServiceProtocol_IPv4, hostTarget,
+                              addressReply,
+                              resolution) != kDNSServiceErr_NoError) {
+      resolution->addressRef = nullptr;
+      self->finish(resolution);
+    }
+  }
+
+  static void addressReply(DNSServiceRef ref, DNSServiceFlags flags,
+                           uint32_t interface, DNSServiceErrorType error,
+                           const char* hostName, const struct sockaddr* address,
+                           uint32_t ttl, void* context) {
+    auto resolution = (Resolution*)context;
+    auto self = resolution->browser;
+    if (error == kDNSServiceErr_NoError && address &&
+        address->sa_family == AF_INET) {
+      char text[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &((const struct sockaddr_in*)address)->sin_addr,
+                text, sizeof(text));
+      resolution->service.address = text;
+      // Removals come from the browse, the TTL only guards the address
+      self->updateService(resolution->service, 0);
+    }
+    self->finish(resolution);
+  }
+
+  void runTask() override {
+    int fd = DNSServiceRefSockFD(connection);
+    while (!isStopRequested()) {
+      fd_set fds;
+      FD_ZERO(&fds);
+      FD_SET(fd, &fds);
+      // Wakes up now and then to notice requestStop()
+      struct timeval timeout = {1, 0};
+      if (select(fd + 1, &fds, NULL, NULL, &timeout) > 0 &&
+          DNSServiceProcessResult(connection) != kDNSServiceErr_NoError) {
+        break;
+      }
+    }
+  }
+};
+
+std::unique_ptr<MDNSBrowser> MDNSBrowser::browse(
+    const std::string& serviceType, const std::string& serviceProto,
+    ChangeCallback onChange) {
+  auto browser = std::make_unique<implMDNSBrowser>(onChange);
+  if (!browser->start(serviceType + "." + serviceProto)) {
+    return nullptr;
+  }
+  return browser;
+}
@@ -14,7 +14,26 @@ class implMDNSService : public MDNSService {
 
  public:
   implMDNSService(DNSServiceRef* service) : service(service) {}
-  void unregisterService() { DNSServiceRefDeallocate(*service); }
+  ~implMDNSService() { cancelTXTUpdates(); }
+  void unregisterService() {
+    cancelTXTUpdates();
+    DNSServiceRefDeallocate(*service);
+  }
+
+  bool updateTXT(const std::map<std::string, std::string>& txtData) {
+    TXTRecordRef txtRecord;
+    TXTRecordCreate(&txtRecord, 0, NULL);
+    for (auto& data : txtData) {
+      TXTRecordSetValue(&txtRecord, data.first.c_str(), data.second.size(),
+                        data.second.c_str());
+    }
+    // A NULL record is the service's primary TXT record
+    DNSServiceErrorType err = DNSServiceUpdateRecord(
+        *service, NULL, 0, TXTRecordGetLength(&txtRecord),
+        TXTRecordGetBytesPtr(&txtRecord), 0);
+    TXTRecordDeallocate(&txtRecord);
+    return err == kDNSServiceErr_NoError;
+  }
 };
 
 /**
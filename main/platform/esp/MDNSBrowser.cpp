@@ -0,0 +1,89 @@
+#include "MDNSBrowser.h"
+
+#include <stdio.h>  // for snprintf
+
+#include "BellTask.h"  // for Task
+#include "mdns.h"      // for mdns_query_ptr, mdns_result_t, mdns_query_re...
+
+using namespace bell;
+
+/**
+ * ESP32 implementation of MDNSBrowser. The mdns component answers one-shot
+ * queries only, the browser's task asks again now and then and lets the
+ * cache drop what stopped answering.
+ * @see https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/protocols/mdns.html
+ **/
+class implMDNSBrowser : public MDNSBrowser, public bell::Task {
+ public:
+  implMDNSBrowser(const std::string& type, const std::string& proto,
+                  ChangeCallback onChange)
+      : MDNSBrowser(onChange),
+        bell::Task("mdns_browse", 4096, 0, 0),
+        type(type),
+        proto(proto) {}
+
+  ~implMDNSBrowser() { stopTask(); }
+
+ private:
+  // Between two queries, well below the usual 75 min PTR TTL
+  static constexpr int QUERY_INTERVAL_S = 60;
+
+  const std::string type;
+  const std::string proto;
+
+  void runTask() override {
+    while (!isStopRequested()) {
+      mdns_result_t* results = NULL;
+      if (mdns_query_ptr(type.c_str(), proto.c_str(), 3000, 20, &results) ==
+          ESP_OK) {
+        for (mdns_result_t* r = results; r; r = r->next) {
+          if (!r->instance_name) {
+            continue;
+          }
+          if (r->ttl == 0) {
+            removeService(r->instance_name);
+            continue;
+          }
+
+          Service service;
+          service.name = r->instance_name;
+          service.host = r->hostname ? std::string(r->hostname) + ".local" : "";
+          service.port = r->port;
+          for (size_t i = 0; i < r->txt_count; i++) {
+            service.txtData[r->txt[i].key] =
+                r->txt[i].value ? std::string(r->txt[i].value,
+                                              r->txt_value_len[i])
+                                : "";
+          }
+          for (mdns_ip_addr_t* a = r->addr; a; a = a->next) {
+            if (a->addr.type == ESP_IPADDR_TYPE_V4) {
+              char address[16];
+              snprintf(address, sizeof(address), IPSTR,
+                       IP2STR(&a->addr.u_addr.ip4));
+              service.address = address;
+              break;
+            }
+          }
+          updateService(service, r->ttl);
+        }
+        mdns_query_results_free(results);
+      }
+      expireServices();
+
+      for (int i = 0; i < QUERY_INTERVAL_S && !isStopRequested(); i++) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+      }
+    }
+  }
+};
+
+std::unique_ptr<MDNSBrowser> MDNSBrowser::browse(
+    const std::string& serviceType, const std::string& serviceProto,
+    ChangeCallback onChange) {
+  auto browser =
+      std::make_unique<implMDNSBrowser>(serviceType, serviceProto, onChange);
+  if (!browser->startTask()) {
+    return nullptr;
+  }
+  return browser;
+}
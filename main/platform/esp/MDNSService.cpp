@@ -9,11 +9,26 @@ class implMDNSService : public MDNSService {
  private:
   const std::string type;
   const std::string proto;
-  void unregisterService() { mdns_service_remove(type.c_str(), proto.c_str()); }
+  void unregisterService() {
+    cancelTXTUpdates();
+    mdns_service_remove(type.c_str(), proto.c_str());
+  }
 
  public:
   implMDNSService(std::string type, std::string proto)
       : type(type), proto(proto){};
+  ~implMDNSService() { cancelTXTUpdates(); }
+
+  bool updateTXT(const std::map<std::string, std::string>& txtData) {
+    std::vector<mdns_txt_item_t> txtItems;
+    txtItems.reserve(txtData.size());
+    for (auto& data : txtData) {
+      txtItems.push_back({data.first.c_str(), data.second.c_str()});
+    }
+    // Sent as an update of the record, no probing
+    return mdns_service_txt_set(type.c_str(), proto.c_str(), txtItems.data(),
+                                txtItems.size()) == ESP_OK;
+  }
 };
 
 /**
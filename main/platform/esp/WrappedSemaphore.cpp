@@ -7,7 +7,9 @@
 using namespace bell;
 
 WrappedSemaphore::WrappedSemaphore(int count) {
-  semaphoreHandle = xSemaphoreCreateCounting(count, 0);
+  // A kernel object either way, any number of tasks may wait on it
+  semaphoreHandle = count > 1 ? xSemaphoreCreateCounting(count, 0)
+                              : xSemaphoreCreateBinary();
 }
 
 WrappedSemaphore::~WrappedSemaphore() {
@@ -32,6 +34,5 @@ int WrappedSemaphore::twait(long milliseconds) {
 }
 
 void WrappedSemaphore::give() {
-
   xSemaphoreGive(semaphoreHandle);
 }
@@ -0,0 +1,125 @@
+#include "MDNSBrowser.h"
+
+#if __has_include("avahi-client/client.h") && !defined(BELL_DISABLE_AVAHI)
+#include <avahi-client/client.h>
+#include <avahi-client/lookup.h>
+#include <avahi-common/error.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/thread-watch.h>
+#define BELL_AVAHI_BROWSE
+#endif
+
+#include "BellLogger.h"
+
+using namespace bell;
+
+#ifdef BELL_AVAHI_BROWSE
+/**
+ * Linux browser on the avahi daemon, which keeps its own cache and reports
+ * removals, so entries carry no TTL here.
+ * @see https://www.avahi.org/doxygen/html/
+ **/
+class AvahiMDNSBrowser : public MDNSBrowser {
+ public:
+  AvahiMDNSBrowser(ChangeCallback onChange) : MDNSBrowser(onChange) {}
+
+  ~AvahiMDNSBrowser() {
+    if (poll) {
+      // Callbacks run on the poll's thread, none after this
+      avahi_threaded_poll_stop(poll);
+    }
+    if (browser) {
+      avahi_service_browser_free(browser);
+    }
+    if (client) {
+      avahi_client_free(client);
+    }
+    if (poll) {
+      avahi_threaded_poll_free(poll);
+    }
+  }
+
+  bool start(const std::string& type) {
+    int error;
+    poll = avahi_threaded_poll_new();
+    if (!poll) {
+      return false;
+    }
+    client = avahi_client_new(avahi_threaded_poll_get(poll),
+                              AvahiClientFlags(0), NULL, NULL, &error);
+    if (!client) {
+      return false;
+    }
+    browser = avahi_service_browser_new(
+        client, AVAHI_IF_UNSPEC, AVAHI_PROTO_INET, type.c_str(), NULL,
+        AvahiLookupFlags(0), browseCallback, this);
+    return browser && avahi_threaded_poll_start(poll) >= 0;
+  }
+
+ private:
+  AvahiThreadedPoll* poll = nullptr;
+  AvahiClient* client = nullptr;
+  AvahiServiceBrowser* browser = nullptr;
+
+  static void browseCallback(AvahiServiceBrowser* b, AvahiIfIndex interface,
+                             AvahiProtocol protocol, AvahiBrowserEvent event,
+                             const char* name, const char* type,
+                             const char* domain, AvahiLookupResultFlags flags,
+                             void* userdata) {
+    auto self = (AvahiMDNSBrowser*)userdata;
+    if (event == AVAHI_BROWSER_NEW) {
+      // Frees itself once resolved
+      avahi_service_resolver_new(self->client, interface, protocol, name,
+                                 type, domain, AVAHI_PROTO_INET,
+                                 AvahiLookupFlags(0), resolveCallback, self);
+    } else if (event == AVAHI_BROWSER_REMOVE) {
+      self->removeService(name);
+    }
+  }
+
+  static void resolveCallback(AvahiServiceResolver* r, AvahiIfIndex interface,
+                              AvahiProtocol protocol,
+                              AvahiResolverEvent event, const char* name,
+                              const char* type, const char* domain,
+                              const char* hostName, const AvahiAddress* a,
+                              uint16_t port, AvahiStringList* txt,
+                              AvahiLookupResultFlags flags, void* userdata) {
+    auto self = (AvahiMDNSBrowser*)userdata;
+    if (event == AVAHI_RESOLVER_FOUND) {
+      Service service;
+      char address[AVAHI_ADDRESS_STR_MAX];
+      avahi_address_snprint(address, sizeof(address), a);
+      service.name = name;
+      service.host = hostName;
+      service.address = address;
+      service.port = port;
+      for (AvahiStringList* item = txt; item; item = item->next) {
+        char *key, *value;
+        if (avahi_string_list_get_pair(item, &key, &value, NULL) == 0) {
+          service.txtData[key] = value ? value : "";
+          avahi_free(key);
+          avahi_free(value);
+        }
+      }
+      self->updateService(service, 0);
+    }
+    avahi_service_resolver_free(r);
+  }
+};
+#endif
+
+std::unique_ptr<MDNSBrowser> MDNSBrowser::browse(
+    const std::string& serviceType, const std::string& serviceProto,
+    ChangeCallback onChange) {
+#ifdef BELL_AVAHI_BROWSE
+  // try avahi first if available
+  auto browser = std::make_unique<AvahiMDNSBrowser>(onChange);
+  if (browser->start(serviceType + "." + serviceProto)) {
+    BELL_LOG(info, "MDNS", "browsing %s with avahi", serviceType.c_str());
+    return browser;
+  }
+#endif
+
+  BELL_LOG(info, "MDNS", "browsing %s with mDNS queries", serviceType.c_str());
+  return browseWithQueries(serviceType, serviceProto, onChange);
+}
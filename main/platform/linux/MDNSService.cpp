@@ -31,9 +31,12 @@ static void groupHandler(AvahiEntryGroup* g, AvahiEntryGroupState state,
 class implMDNSService : public MDNSService {
  private:
 #ifndef BELL_DISABLE_AVAHI
-  AvahiEntryGroup* avahiGroup;
+  AvahiEntryGroup* avahiGroup = nullptr;
 #endif
-  struct mdns_service* service;
+  struct mdns_service* service = nullptr;
+  // To find the service again for TXT updates
+  std::string name, type;
+  int port;
 
  public:
 #ifndef BELL_DISABLE_AVAHI
@@ -44,11 +47,21 @@ class implMDNSService : public MDNSService {
   static in_addr_t host;
   static std::atomic<size_t> instances;
 
-  implMDNSService(struct mdns_service* service) : service(service){ instances++; };
+  implMDNSService(struct mdns_service* service, const std::string& name,
+                  const std::string& type, int port)
+      : service(service), name(name), type(type), port(port) {
+    instances++;
+  };
 #ifndef BELL_DISABLE_AVAHI
-  implMDNSService(AvahiEntryGroup* avahiGroup) : avahiGroup(avahiGroup){};
+  implMDNSService(AvahiEntryGroup* avahiGroup, const std::string& name,
+                  const std::string& type, int port)
+      : avahiGroup(avahiGroup), name(name), type(type), port(port) {
+    instances++;
+  };
 #endif
+  ~implMDNSService() { cancelTXTUpdates(); }
   void unregisterService();
+  bool updateTXT(const std::map<std::string, std::string>& txtData);
 };
 
 struct mdnsd* implMDNSService::mdnsServer = NULL;
@@ -66,24 +79,68 @@ AvahiSimplePoll* implMDNSService::avahiPoll = NULL;
  **/
 
 void implMDNSService::unregisterService() {
+  cancelTXTUpdates();
+  std::lock_guard lock(registerMutex);
 #ifndef BELL_DISABLE_AVAHI
   if (avahiGroup) {
     avahi_entry_group_free(avahiGroup);
+    avahiGroup = nullptr;
     if (!--instances && implMDNSService::avahiClient) {
       avahi_client_free(implMDNSService::avahiClient);
       avahi_simple_poll_free(implMDNSService::avahiPoll);
       implMDNSService::avahiClient = nullptr;
       implMDNSService::avahiPoll = nullptr;
     }
-  } else
+    return;
+  }
 #endif
-  {
+  if (service) {
     mdns_service_remove(implMDNSService::mdnsServer, service);
+    service = nullptr;
     if (!--instances && implMDNSService::mdnsServer) {
-     mdnsd_stop(implMDNSService::mdnsServer);
-     implMDNSService::mdnsServer = nullptr;
+      mdnsd_stop(implMDNSService::mdnsServer);
+      implMDNSService::mdnsServer = nullptr;
     }
-  }  
+  }
+}
+
+bool implMDNSService::updateTXT(
+    const std::map<std::string, std::string>& txtData) {
+  std::lock_guard lock(registerMutex);
+#ifndef BELL_DISABLE_AVAHI
+  if (avahiGroup) {
+    AvahiStringList* avahiTxt = NULL;
+    for (auto& [key, value] : txtData) {
+      avahiTxt =
+          avahi_string_list_add_pair(avahiTxt, key.c_str(), value.c_str());
+    }
+    int ret = avahi_entry_group_update_service_txt_strlst(
+        avahiGroup, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, (AvahiPublishFlags)0,
+        name.c_str(), type.c_str(), NULL, avahiTxt);
+    avahi_string_list_free(avahiTxt);
+    return ret >= 0;
+  }
+#endif
+
+  if (!service) {
+    return false;
+  }
+
+  // mdnssvc can't change a record, the service is announced anew instead
+  std::vector<std::string> txtStr;
+  std::vector<const char*> txt;
+  for (auto& [key, value] : txtData) {
+    txtStr.push_back(key + "=" + value);
+  }
+  for (auto& str : txtStr) {
+    txt.push_back(str.c_str());
+  }
+  txt.push_back(NULL);
+
+  mdns_service_remove(implMDNSService::mdnsServer, service);
+  service = mdnsd_register_svc(implMDNSService::mdnsServer, name.c_str(),
+                               type.c_str(), port, NULL, txt.data());
+  return service != NULL;
 }
 
 std::unique_ptr<MDNSService> MDNSService::registerService(
@@ -133,7 +190,8 @@ std::unique_ptr<MDNSService> MDNSService::registerService(
       avahi_entry_group_free(avahiGroup);
     } else {
       BELL_LOG(info, "MDNS", "using avahi for %s", serviceName.c_str());
-      return std::make_unique<implMDNSService>(avahiGroup);
+      return std::make_unique<implMDNSService>(avahiGroup, serviceName, type,
+                                               servicePort);
     }
   }
 #endif
@@ -197,7 +255,9 @@ std::unique_ptr<MDNSService> MDNSService::registerService(
         mdnsd_register_svc(implMDNSService::mdnsServer, serviceName.c_str(),
                              type.c_str(), servicePort, NULL, txt.data());
 
-    if (service) return std::make_unique<implMDNSService>(service);
+    if (service)
+      return std::make_unique<implMDNSService>(service, serviceName, type,
+                                               servicePort);
   }
 
   BELL_LOG(error, "MDNS", "cannot start any mDNS listener for %s",
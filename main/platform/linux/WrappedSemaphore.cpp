@@ -1,33 +1,86 @@
 #include "WrappedSemaphore.h"
-#include <sys/time.h>
+
+#include <linux/futex.h>  // for FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h>  // for SYS_futex
+#include <time.h>         // for timespec
+#include <unistd.h>       // for syscall
+#include <chrono>         // for steady_clock
 
 using namespace bell;
 
-WrappedSemaphore::WrappedSemaphore(int count) {
-  sem_init(&this->semaphoreHandle, 0, 0);  // eek pointer
+namespace {
+// std::atomic<int> is laid out as a plain int
+int* futexWord(std::atomic<int>& value) {
+  static_assert(sizeof(std::atomic<int>) == sizeof(int));
+  return reinterpret_cast<int*>(&value);
 }
+}  // namespace
+
+WrappedSemaphore::WrappedSemaphore(int maxVal) : maxCount(maxVal) {}
+
+WrappedSemaphore::~WrappedSemaphore() {}
 
-WrappedSemaphore::~WrappedSemaphore() {
-  sem_destroy(&this->semaphoreHandle);
+bool WrappedSemaphore::tryTake() {
+  int available = count.load();
+  while (available > 0) {
+    if (count.compare_exchange_weak(available, available - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int WrappedSemaphore::take(long timeoutMs) {
+  if (tryTake()) {
+    return 0;
+  }
+
+  // Relative futex timeouts run on CLOCK_MONOTONIC, like steady_clock
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(timeoutMs);
+  waiters++;
+  int result = 0;
+  while (!tryTake()) {
+    struct timespec timeout;
+    struct timespec* timeoutPtr = nullptr;
+    if (timeoutMs >= 0) {
+      auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      deadline - std::chrono::steady_clock::now())
+                      .count();
+      if (left <= 0) {
+        result = 1;
+        break;
+      }
+      timeout.tv_sec = left / 1000000000;
+      timeout.tv_nsec = left % 1000000000;
+      timeoutPtr = &timeout;
+    }
+    // Sleeps only while count is still 0, a give() in between isn't lost
+    syscall(SYS_futex, futexWord(count), FUTEX_WAIT_PRIVATE, 0, timeoutPtr,
+            nullptr, 0);
+  }
+  waiters--;
+  return result;
 }
 
 int WrappedSemaphore::wait() {
-  sem_wait(&this->semaphoreHandle);
-  return 0;
+  return take(-1);
 }
 
 int WrappedSemaphore::twait(long milliseconds) {
-  // wait on semaphore with timeout
-  struct timespec ts;
-  struct timeval tv;
-
-  gettimeofday(&tv, 0);
-
-  ts.tv_sec = tv.tv_sec + milliseconds / 1000;
-  ts.tv_nsec = tv.tv_usec * 1000 + (milliseconds % 1000) * 1000000;
-  return sem_timedwait(&this->semaphoreHandle, &ts);
+  return take(milliseconds < 0 ? 0 : milliseconds);
 }
 
 void WrappedSemaphore::give() {
-  sem_post(&this->semaphoreHandle);
+  int available = count.load();
+  do {
+    if (available >= maxCount) {
+      return;
+    }
+  } while (!count.compare_exchange_weak(available, available + 1));
+
+  if (waiters > 0) {
+    syscall(SYS_futex, futexWord(count), FUTEX_WAKE_PRIVATE, 1, nullptr,
+            nullptr, 0);
+  }
 }
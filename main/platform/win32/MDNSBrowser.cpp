@@ -0,0 +1,13 @@
+#include "MDNSBrowser.h"
+
+using namespace bell;
+
+/**
+ * Win32 implementation of MDNSBrowser, mdnssvc only answers so the
+ * browser sends its own queries
+ **/
+std::unique_ptr<MDNSBrowser> MDNSBrowser::browse(
+    const std::string& serviceType, const std::string& serviceProto,
+    ChangeCallback onChange) {
+  return browseWithQueries(serviceType, serviceProto, onChange);
+}
@@ -20,12 +20,21 @@ using namespace bell;
 class implMDNSService : public MDNSService {
  private:
   struct mdns_service* service;
+  // To register the service again for TXT updates
+  std::string name, type;
+  int port;
   void unregisterService(void);
 
  public:
   static struct mdnsd* mdnsServer;
   static std::atomic<size_t> instances;
-  implMDNSService(struct mdns_service* service) : service(service) { instances++; };
+  implMDNSService(struct mdns_service* service, const std::string& name,
+                  const std::string& type, int port)
+      : service(service), name(name), type(type), port(port) {
+    instances++;
+  };
+  ~implMDNSService() { cancelTXTUpdates(); }
+  bool updateTXT(const std::map<std::string, std::string>& txtData);
 };
 
 /**
@@ -38,11 +47,41 @@ std::atomic<size_t> implMDNSService::instances = 0;
 static std::mutex registerMutex;
 
 void implMDNSService::unregisterService() {
+  cancelTXTUpdates();
+  std::lock_guard lock(registerMutex);
+  if (!service) {
+    return;
+  }
   mdns_service_remove(implMDNSService::mdnsServer, service);
+  service = nullptr;
   if (!--instances && implMDNSService::mdnsServer) {
     mdnsd_stop(implMDNSService::mdnsServer);
     implMDNSService::mdnsServer = nullptr;
-  }   
+  }
+}
+
+bool implMDNSService::updateTXT(
+    const std::map<std::string, std::string>& txtData) {
+  std::lock_guard lock(registerMutex);
+  if (!service) {
+    return false;
+  }
+
+  // mdnssvc can't change a record, the service is announced anew instead
+  std::vector<std::string> txtStr;
+  std::vector<const char*> txt;
+  for (auto& [key, value] : txtData) {
+    txtStr.push_back(key + "=" + value);
+  }
+  for (auto& str : txtStr) {
+    txt.push_back(str.c_str());
+  }
+  txt.push_back(NULL);
+
+  mdns_service_remove(implMDNSService::mdnsServer, service);
+  service = mdnsd_register_svc(implMDNSService::mdnsServer, name.c_str(),
+                               type.c_str(), port, NULL, txt.data());
+  return service != NULL;
 }
 
 std::unique_ptr<MDNSService> MDNSService::registerService(
@@ -104,5 +143,7 @@ std::unique_ptr<MDNSService> MDNSService::registerService(
       mdnsd_register_svc(implMDNSService::mdnsServer, serviceName.c_str(),
                          type.c_str(), servicePort, NULL, txt.data());
 
-  return service ? std::make_unique<implMDNSService>(service) : nullptr;
+  return service ? std::make_unique<implMDNSService>(service, serviceName,
+                                                     type, servicePort)
+                 : nullptr;
 }
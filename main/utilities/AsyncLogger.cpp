@@ -0,0 +1,251 @@
+#include "AsyncLogger.h"
+
+#include <stdio.h>    // for printf, fflush
+#include <string.h>   // for memcpy, strlen
+#include <algorithm>  // for min, remove_if
+
+#include "BellUtils.h"  // for BELL_SLEEP_MS
+#include "LogFormat.h"  // for LogArgType, LogArgValue, LogSpec, format...
+
+using namespace bell;
+
+namespace {
+// Thread exit orphans the ring, so the log task can free it once drained
+struct ThreadRing {
+  void* owner = nullptr;
+  std::shared_ptr<void> ring;
+  std::atomic<bool>* orphaned = nullptr;
+
+  ~ThreadRing() {
+    if (orphaned != nullptr) {
+      *orphaned = true;
+    }
+  }
+};
+
+thread_local ThreadRing threadRingHolder;
+}  // namespace
+
+AsyncLogger::AsyncLogger(const Config& config)
+    : bell::Task("logger", 4096, -1, 0), config(config), wakeSem(1) {}
+
+AsyncLogger::Ring* AsyncLogger::threadRing() {
+  ThreadRing& holder = threadRingHolder;
+  if (holder.owner != this) {
+    auto ring = std::make_shared<Ring>(config.slotsPerThread);
+    {
+      std::scoped_lock lock(ringsMutex);
+      rings.push_back(ring);
+    }
+    if (holder.orphaned != nullptr) {
+      *holder.orphaned = true;
+    }
+    holder.owner = this;
+    holder.ring = ring;
+    holder.orphaned = &ring->orphaned;
+  }
+  return (Ring*)holder.ring.get();
+}
+
+void AsyncLogger::capture(char level, const LogSite& site,
+                          const char* submodule, const char* format,
+                          va_list args) {
+  Ring* ring = threadRing();
+  Record* record = ring->records.reserve();
+  if (record == nullptr) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  record->level = level;
+  record->time = std::chrono::system_clock::now();
+  record->site = &site;
+  record->submodule = submodule;
+  record->format = format;
+  record->argCount = 0;
+  record->truncated = false;
+  record->stringsUsed = 0;
+
+  // Walked by pointer, va_list may be an array type
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+  readLogArgs(format, &argsCopy,
+              [record](LogArgType type, const LogArgValue& value) {
+                if (record->argCount >= MAX_ARGS) {
+                  record->truncated = true;
+                  return false;
+                }
+                Arg& arg = record->args[record->argCount++];
+                arg.type = type;
+                arg.value = value;
+                if (type == LogArgType::STRING) {
+                  const char* string = value.s ? value.s : "(null)";
+                  size_t left = STRING_BYTES - record->stringsUsed - 1;
+                  size_t len = std::min(strlen(string), left);
+                  arg.value.u = record->stringsUsed;
+                  memcpy(record->strings + record->stringsUsed, string, len);
+                  record->strings[record->stringsUsed + len] = '\0';
+                  record->stringsUsed += len + (left > len ? 1 : 0);
+                }
+                return true;
+              });
+  va_end(argsCopy);
+
+  ring->records.commit();
+}
+
+void AsyncLogger::format(const Record& record, char* message, size_t size) {
+  size_t used = 0;
+  size_t argIndex = 0;
+  const char* c = record.format;
+  while (*c && used < size - 1) {
+    if (*c != '%') {
+      message[used++] = *c++;
+      continue;
+    }
+    c++;
+    if (*c == '%') {
+      message[used++] = *c++;
+      continue;
+    }
+
+    const char* specStart = c - 1;
+    LogSpec spec;
+    c = parseLogSpec(c, spec);
+    if (spec.widthStar) {
+      spec.width =
+          argIndex < record.argCount ? record.args[argIndex++].value.i : 0;
+    }
+    if (spec.precisionStar) {
+      spec.precision =
+          argIndex < record.argCount ? record.args[argIndex++].value.i : 0;
+    }
+
+    if (spec.type == LogArgType::WRITEBACK) {
+      continue;
+    }
+    if (spec.type == LogArgType::NONE) {
+      // Not a conversion we know, copy it verbatim
+      size_t len = std::min<size_t>(c - specStart, size - 1 - used);
+      memcpy(message + used, specStart, len);
+      used += len;
+      continue;
+    }
+    if (argIndex >= record.argCount) {
+      // Didn't fit in the record
+      break;
+    }
+
+    LogArgValue value = record.args[argIndex++].value;
+    if (spec.type == LogArgType::STRING) {
+      value.s = record.strings + value.u;
+    }
+    int written = formatLogArg(message + used, size - used, spec, value);
+    if (written > 0) {
+      used = std::min(used + written, size - 1);
+    }
+  }
+  message[used] = '\0';
+}
+
+void AsyncLogger::drain() {
+  std::vector<std::shared_ptr<Ring>> active;
+  {
+    std::scoped_lock lock(ringsMutex);
+    active = rings;
+  }
+
+  char message[MESSAGE_SIZE];
+  while (true) {
+    // Oldest record of all threads first
+    Ring* oldest = nullptr;
+    Record* oldestRecord = nullptr;
+    for (auto& ring : active) {
+      Record* record = ring->records.peek();
+      if (record != nullptr &&
+          (oldestRecord == nullptr || record->time < oldestRecord->time)) {
+        oldest = ring.get();
+        oldestRecord = record;
+      }
+    }
+    if (oldest == nullptr) {
+      break;
+    }
+
+    format(*oldestRecord, message, sizeof(message));
+    printPrefix(oldestRecord->level, oldestRecord->time, *oldestRecord->site,
+                oldestRecord->submodule);
+    printf("%s%s\n", message, oldestRecord->truncated ? "..." : "");
+    oldest->records.release();
+  }
+
+  uint32_t dropped = 0;
+  for (auto& ring : active) {
+    dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+  }
+  if (dropped > 0) {
+    static LogSite site(__FILE__, __LINE__);
+    BellLogger::error(site, "logger", "%u log messages dropped", dropped);
+  }
+
+  std::scoped_lock lock(ringsMutex);
+  rings.erase(std::remove_if(rings.begin(), rings.end(),
+                             [](const std::shared_ptr<Ring>& ring) {
+                               return ring->orphaned && ring->records.empty();
+                             }),
+              rings.end());
+}
+
+void AsyncLogger::runTask() {
+  while (true) {
+    wakeSem.twait(config.flushIntervalMs);
+    uint32_t requested = flushRequests;
+    drain();
+    fflush(stdout);
+    flushesDone = requested;
+  }
+}
+
+void AsyncLogger::flush() {
+  uint32_t request = ++flushRequests;
+  wakeSem.give();
+  while ((int32_t)(flushesDone - request) < 0) {
+    BELL_SLEEP_MS(1);
+  }
+}
+
+void AsyncLogger::debug(const LogSite& site, const char* submodule,
+                          const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  capture('D', site, submodule, format, args);
+  va_end(args);
+}
+
+void AsyncLogger::error(const LogSite& site, const char* submodule,
+                          const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  capture('E', site, submodule, format, args);
+  va_end(args);
+}
+
+void AsyncLogger::info(const LogSite& site, const char* submodule,
+                         const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  capture('I', site, submodule, format, args);
+  va_end(args);
+}
+
+void bell::setAsyncLogger() {
+  // Never destroyed, like the default logger
+  auto* logger = new bell::AsyncLogger();
+  if (bell::bellGlobalLogger != nullptr) {
+    logger->enableSubmodule = bell::bellGlobalLogger->enableSubmodule;
+    logger->enableTimestamp = bell::bellGlobalLogger->enableTimestamp;
+    logger->shortTime = bell::bellGlobalLogger->shortTime;
+  }
+  logger->startTask();
+  bell::bellGlobalLogger = logger;
+}
@@ -0,0 +1,88 @@
+#include "BellAllocator.h"
+
+#include <stdlib.h>  // for malloc, free, posix_memalign
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"  // for heap_caps_malloc, heap_caps_free
+#elif defined(_WIN32)
+#include <malloc.h>  // for _aligned_malloc, _aligned_free
+#endif
+
+using namespace bell;
+
+#ifdef ESP_PLATFORM
+// A PCM chunk or a codec frame and up go to PSRAM. Below that, buffers are
+// too small to matter and keep the speed of SRAM
+Allocator::Policy Allocator::policy = {4096, Allocator::PSRAM,
+                                       Allocator::INTERNAL};
+
+static void* allocateWith(size_t size, uint32_t heapCaps, size_t alignment) {
+  if (alignment > 4) {
+    return heap_caps_aligned_alloc(alignment, size, heapCaps);
+  }
+  return heap_caps_malloc(size, heapCaps);
+}
+
+static void* allocatePlatform(size_t size, uint32_t caps, size_t alignment) {
+  if (caps & Allocator::DMA) {
+    return allocateWith(size, MALLOC_CAP_DMA | MALLOC_CAP_8BIT, alignment);
+  }
+  if (caps & Allocator::PSRAM) {
+    void* buffer =
+        allocateWith(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT, alignment);
+    if (buffer != nullptr) {
+      return buffer;
+    }
+  }
+  return allocateWith(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, alignment);
+}
+
+void Allocator::release(void* buffer) {
+  heap_caps_free(buffer);
+}
+#else
+// Single heap, placement doesn't matter
+Allocator::Policy Allocator::policy = {SIZE_MAX, Allocator::DEFAULT,
+                                       Allocator::DEFAULT};
+
+static void* allocatePlatform(size_t size, uint32_t caps, size_t alignment) {
+#ifdef _WIN32
+  // Always aligned, so release() can tell how to free it
+  return _aligned_malloc(size, alignment > 16 ? alignment : 16);
+#else
+  if (alignment <= alignof(max_align_t)) {
+    return malloc(size);
+  }
+  void* buffer = nullptr;
+  return posix_memalign(&buffer, alignment, size) == 0 ? buffer : nullptr;
+#endif
+}
+
+void Allocator::release(void* buffer) {
+#ifdef _WIN32
+  _aligned_free(buffer);
+#else
+  free(buffer);
+#endif
+}
+#endif
+
+void* Allocator::allocate(size_t size, uint32_t caps, size_t alignment) {
+  if (caps == DEFAULT) {
+    caps = size >= policy.largeThreshold ? policy.largeCaps : policy.smallCaps;
+  }
+  return allocatePlatform(size, caps, alignment);
+}
+
+void Allocator::setPolicy(const Policy& newPolicy) {
+  policy = newPolicy;
+}
+
+Allocator::Buffer Allocator::allocateBuffer(size_t size, uint32_t caps,
+                                            size_t alignment) {
+  void* buffer = allocate(size, caps, alignment);
+  if (buffer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return Buffer(static_cast<uint8_t*>(buffer));
+}
@@ -0,0 +1,81 @@
+#include "BellBuffer.h"
+
+#include <new>  // for bad_alloc, placement new
+
+using namespace bell;
+
+Buffer Buffer::allocate(size_t size, uint32_t caps) {
+  void* memory = Allocator::allocate(HEADER + size, caps, ALIGNMENT);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return Buffer(new (memory) Block{{1}, size, nullptr});
+}
+
+void Buffer::release() {
+  Block* last = std::exchange(block, nullptr);
+  if (last == nullptr ||
+      last->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (last->pool != nullptr) {
+    last->pool->recycle(last);
+  } else {
+    last->~Block();
+    Allocator::release(last);
+  }
+}
+
+BufferPool::BufferPool(const char* name, size_t bufferSize, size_t maxIdle,
+                       uint32_t caps)
+    : bufferSize(bufferSize), maxIdle(maxIdle), caps(caps), memory(name) {
+  // Giving a block back never allocates
+  idleBlocks.reserve(maxIdle);
+}
+
+BufferPool::~BufferPool() { trim(); }
+
+Buffer BufferPool::acquire() {
+  {
+    std::scoped_lock lock(poolMutex);
+    if (!idleBlocks.empty()) {
+      Buffer::Block* block = idleBlocks.back();
+      idleBlocks.pop_back();
+      block->refs.store(1, std::memory_order_relaxed);
+      return Buffer(block);
+    }
+  }
+
+  void* storage = Allocator::allocate(Buffer::HEADER + bufferSize, caps,
+                                      Buffer::ALIGNMENT);
+  if (storage == nullptr) {
+    throw std::bad_alloc();
+  }
+  std::scoped_lock lock(poolMutex);
+  blocks++;
+  memory.resize(blocks * (Buffer::HEADER + bufferSize));
+  return Buffer(new (storage) Buffer::Block{{1}, bufferSize, this});
+}
+
+void BufferPool::trim() {
+  std::scoped_lock lock(poolMutex);
+  for (auto* block : idleBlocks) {
+    block->~Block();
+    Allocator::release(block);
+  }
+  blocks -= idleBlocks.size();
+  idleBlocks.clear();
+  memory.resize(blocks * (Buffer::HEADER + bufferSize));
+}
+
+void BufferPool::recycle(Buffer::Block* block) {
+  std::scoped_lock lock(poolMutex);
+  if (idleBlocks.size() < maxIdle) {
+    idleBlocks.push_back(block);
+    return;
+  }
+  block->~Block();
+  Allocator::release(block);
+  blocks--;
+  memory.resize(blocks * (Buffer::HEADER + bufferSize));
+}
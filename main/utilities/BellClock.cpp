@@ -0,0 +1,140 @@
+#include "BellClock.h"
+
+#include <algorithm>  // for clamp
+#include <cmath>      // for fabs, llround
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"  // for esp_timer_get_time
+#elif defined(_WIN32)
+#include <windows.h>  // for QueryPerformanceCounter
+#else
+#include <time.h>  // for clock_gettime, CLOCK_MONOTONIC
+#endif
+
+using namespace bell;
+using namespace bell::clock;
+
+int64_t bell::clock::nowNs() {
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time() * 1000;
+#elif defined(_WIN32)
+  static const int64_t frequency = [] {
+    LARGE_INTEGER value;
+    QueryPerformanceFrequency(&value);
+    return (int64_t)value.QuadPart;
+  }();
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  // Split, counter * 1e9 overflows after a few days at 10 MHz
+  int64_t ticks = counter.QuadPart;
+  return ticks / frequency * 1000000000 +
+         ticks % frequency * 1000000000 / frequency;
+#else
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+MediaClock::MediaClock(const Config& config) : config(config) {}
+
+void MediaClock::reset(uint32_t rate, int64_t position, int64_t localNs) {
+  std::scoped_lock lock(clockMutex);
+  this->rate = rate;
+  anchorPosition = position;
+  anchorNs = localNs;
+  // The drift is the output's, and stays with it across streams
+  hasBase = false;
+}
+
+double MediaClock::positionAtLocked(int64_t localNs) const {
+  if (paused || rate == 0) {
+    return anchorPosition;
+  }
+  return anchorPosition + (localNs - anchorNs) * ratio * rate / 1e9;
+}
+
+void MediaClock::update(int64_t position, int64_t localNs) {
+  std::scoped_lock lock(clockMutex);
+  if (rate == 0) {
+    return;
+  }
+  if (paused) {
+    anchorPosition = position;
+    anchorNs = localNs;
+    hasBase = false;
+    return;
+  }
+
+  double error = position - positionAtLocked(localNs);
+  if (!hasBase || fabs(error) > config.resyncMs * (double)rate / 1000) {
+    // Seek, underrun or first report, nothing to slew from
+    anchorPosition = position;
+    anchorNs = localNs;
+    basePosition = position;
+    baseNs = localNs;
+    hasBase = true;
+    fit = {};
+    return;
+  }
+
+  // Least squares line through every report since the last re-anchor, a
+  // single report is off by the output's granularity (a DMA buffer)
+  double t = (localNs - baseNs) / 1e9;
+  double p = (double)(position - basePosition);
+  fit.n++;
+  fit.t += t;
+  fit.p += p;
+  fit.tt += t * t;
+  fit.tp += t * p;
+  double spread = fit.n * fit.tt - fit.t * fit.t;
+  if (localNs - baseNs >= DRIFT_BASELINE_NS && spread > 0) {
+    double slope = (fit.n * fit.tp - fit.t * fit.p) / spread;
+    double maxRatio = config.maxDriftPpm / 1e6;
+    ratio = std::clamp(slope / rate, 1.0 - maxRatio, 1.0 + maxRatio);
+  }
+  anchorPosition = positionAtLocked(localNs) + config.slewGain * error;
+  anchorNs = localNs;
+}
+
+void MediaClock::pause(int64_t localNs) {
+  std::scoped_lock lock(clockMutex);
+  if (!paused) {
+    anchorPosition = positionAtLocked(localNs);
+    anchorNs = localNs;
+    paused = true;
+  }
+}
+
+void MediaClock::resume(int64_t localNs) {
+  std::scoped_lock lock(clockMutex);
+  if (paused) {
+    anchorNs = localNs;
+    paused = false;
+    hasBase = false;
+  }
+}
+
+int64_t MediaClock::positionAt(int64_t localNs) const {
+  std::scoped_lock lock(clockMutex);
+  return llround(positionAtLocked(localNs));
+}
+
+int64_t MediaClock::localNsAt(int64_t position) const {
+  std::scoped_lock lock(clockMutex);
+  if (rate == 0) {
+    return anchorNs;
+  }
+  return anchorNs +
+         llround((position - anchorPosition) * 1e9 / (ratio * rate));
+}
+
+uint32_t MediaClock::getRate() const {
+  std::scoped_lock lock(clockMutex);
+  return rate;
+}
+
+double MediaClock::getDriftPpm() const {
+  std::scoped_lock lock(clockMutex);
+  return (ratio - 1.0) * 1e6;
+}
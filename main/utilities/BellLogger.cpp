@@ -1,5 +1,7 @@
 #include "BellLogger.h"
 
+#include <string_view>  // for string_view
+
 bell::AbstractLogger* bell::bellGlobalLogger;
 
 void bell::setDefaultLogger() {
@@ -14,3 +16,21 @@ void bell::enableTimestampLogging(bool local) {
   bell::bellGlobalLogger->enableTimestamp = true;
   bell::bellGlobalLogger->shortTime = local;
 }
+
+void bell::AbstractLogger::setLevel(int level) {
+  std::scoped_lock lock(levelsMutex);
+  defaultLevel = level;
+  levelsGeneration++;
+}
+
+void bell::AbstractLogger::setLevel(const char* submodule, int level) {
+  std::scoped_lock lock(levelsMutex);
+  levels[submodule] = level;
+  levelsGeneration++;
+}
+
+int bell::AbstractLogger::levelOf(const char* submodule) {
+  std::scoped_lock lock(levelsMutex);
+  auto it = levels.find(std::string_view(submodule));
+  return it != levels.end() ? it->second : defaultLevel;
+}
@@ -0,0 +1,340 @@
+#include "BellMetrics.h"
+
+#include <ctype.h>    // for isalnum
+#include <algorithm>  // for min, max
+#include <bit>        // for bit_width
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"  // for heap_caps_get_free_size
+#endif
+
+#include "JsonWriter.h"  // for JsonWriter
+
+using namespace bell;
+
+uint32_t MetricCounter::get() const {
+  uint32_t total = 0;
+  for (auto& shard : shards) {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void MetricCounter::reset() {
+  for (auto& shard : shards) {
+    shard.value.store(0, std::memory_order_relaxed);
+  }
+}
+
+void MetricGauge::set(int32_t level) {
+  value.store(level, std::memory_order_relaxed);
+  // Only the writer of a gauge updates its extremes, no CAS loop needed
+  if (level < min.load(std::memory_order_relaxed)) {
+    min.store(level, std::memory_order_relaxed);
+  }
+  if (level > max.load(std::memory_order_relaxed)) {
+    max.store(level, std::memory_order_relaxed);
+  }
+}
+
+void MetricGauge::add(int32_t delta) {
+  int32_t level = value.fetch_add(delta, std::memory_order_relaxed) + delta;
+  int32_t previous = min.load(std::memory_order_relaxed);
+  while (level < previous &&
+         !min.compare_exchange_weak(previous, level,
+                                    std::memory_order_relaxed)) {
+  }
+  previous = max.load(std::memory_order_relaxed);
+  while (level > previous &&
+         !max.compare_exchange_weak(previous, level,
+                                    std::memory_order_relaxed)) {
+  }
+}
+
+void MetricGauge::reset() {
+  int32_t current = get();
+  min.store(current, std::memory_order_relaxed);
+  max.store(current, std::memory_order_relaxed);
+}
+
+void MetricHistogram::record(uint64_t ns) {
+  size_t bucket = ns == 0 ? 0 : std::bit_width(ns) - 1;
+  if (bucket >= BUCKETS) {
+    bucket = BUCKETS - 1;
+  }
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(ns, std::memory_order_relaxed);
+
+  uint64_t previous = max.load(std::memory_order_relaxed);
+  while (ns > previous &&
+         !max.compare_exchange_weak(previous, ns, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t MetricHistogram::getQuantile(float quantile) const {
+  uint64_t total = getCount();
+  if (total == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t)(quantile * total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < BUCKETS; i++) {
+    seen += getBucket(i);
+    if (seen > target) {
+      return std::min(((uint64_t)2 << i) - 1, getMax());
+    }
+  }
+  return getMax();
+}
+
+void MetricHistogram::reset() {
+  for (auto& bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  max.store(0, std::memory_order_relaxed);
+}
+
+#ifdef BELL_METRICS
+MemoryAccount::MemoryAccount(const char* subsystem)
+    : gauge(Metrics::gauge(std::string("mem.") + subsystem)) {}
+
+void MemoryAccount::resize(size_t newBytes) {
+  if (newBytes != bytes) {
+    gauge.add((int32_t)newBytes - (int32_t)bytes);
+    bytes = newBytes;
+  }
+}
+#endif
+
+Metrics& Metrics::instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+// Returns the named metric, created on first use
+template <typename T>
+static T& lookup(std::mutex& mutex,
+                 std::map<std::string, std::unique_ptr<T>, std::less<>>& map,
+                 const std::string& name) {
+  std::scoped_lock lock(mutex);
+  auto& metric = map[name];
+  if (!metric) {
+    metric = std::make_unique<T>();
+  }
+  return *metric;
+}
+
+MetricCounter& Metrics::counter(const std::string& name) {
+  auto& self = instance();
+  return lookup(self.registryMutex, self.counters, name);
+}
+
+MetricGauge& Metrics::gauge(const std::string& name) {
+  auto& self = instance();
+  return lookup(self.registryMutex, self.gauges, name);
+}
+
+MetricHistogram& Metrics::histogram(const std::string& name) {
+  auto& self = instance();
+  return lookup(self.registryMutex, self.histograms, name);
+}
+
+void Metrics::visit(MetricsVisitor& visitor) {
+  auto& self = instance();
+  std::scoped_lock lock(self.registryMutex);
+  for (auto& [name, counter] : self.counters) {
+    visitor.onCounter(name, *counter);
+  }
+  for (auto& [name, gauge] : self.gauges) {
+    visitor.onGauge(name, *gauge);
+  }
+  for (auto& [name, histogram] : self.histograms) {
+    visitor.onHistogram(name, *histogram);
+  }
+}
+
+namespace {
+class JsonVisitor : public MetricsVisitor {
+ public:
+  JsonVisitor(std::string& out) : json(out) {}
+
+  void onCounter(const std::string& name,
+                 const MetricCounter& counter) override {
+    section("counters");
+    json.key(name).value(counter.get());
+  }
+
+  void onGauge(const std::string& name, const MetricGauge& gauge) override {
+    section("gauges");
+    // Extremes aren't set before the first value
+    json.key(name).beginObject();
+    json.key("value").value(gauge.get());
+    json.key("min").value(std::min(gauge.getMin(), gauge.get()));
+    json.key("max").value(std::max(gauge.getMax(), gauge.get()));
+    json.endObject();
+  }
+
+  void onHistogram(const std::string& name,
+                   const MetricHistogram& histogram) override {
+    section("histograms");
+    uint64_t count = histogram.getCount();
+    json.key(name).beginObject();
+    json.key("count").value(count);
+    json.key("mean_ns").value(count ? histogram.getSum() / count : 0);
+    json.key("p50_ns").value(histogram.getQuantile(0.5f));
+    json.key("p99_ns").value(histogram.getQuantile(0.99f));
+    json.key("max_ns").value(histogram.getMax());
+    json.endObject();
+  }
+
+  void finish() {
+    if (current == nullptr) {
+      json.beginObject();
+    } else {
+      json.endObject();
+    }
+    json.endObject();
+  }
+
+ private:
+  JsonWriter json;
+  const char* current = nullptr;
+
+  void section(const char* name) {
+    if (current == name) {
+      return;
+    }
+    if (current == nullptr) {
+      json.beginObject();
+    } else {
+      json.endObject();
+    }
+    json.key(name).beginObject();
+    current = name;
+  }
+};
+}  // namespace
+
+std::string Metrics::toJson() {
+  std::string json;
+  JsonVisitor visitor(json);
+  visit(visitor);
+  visitor.finish();
+  return json;
+}
+
+namespace {
+class PrometheusVisitor : public MetricsVisitor {
+ public:
+  PrometheusVisitor(std::string& out) : out(out) {}
+
+  void onCounter(const std::string& name,
+                 const MetricCounter& counter) override {
+    std::string metric = metricName(name);
+    type(metric + "_total", "counter");
+    sample(metric + "_total", "", counter.get());
+  }
+
+  void onGauge(const std::string& name, const MetricGauge& gauge) override {
+    std::string metric = metricName(name);
+    type(metric, "gauge");
+    sample(metric, "", gauge.get());
+    // Extremes aren't set before the first value
+    type(metric + "_min", "gauge");
+    sample(metric + "_min", "", std::min(gauge.getMin(), gauge.get()));
+    type(metric + "_max", "gauge");
+    sample(metric + "_max", "", std::max(gauge.getMax(), gauge.get()));
+  }
+
+  void onHistogram(const std::string& name,
+                   const MetricHistogram& histogram) override {
+    std::string metric = metricName(name) + "_ns";
+    type(metric, "histogram");
+
+    size_t used = 0;
+    for (size_t i = 0; i < MetricHistogram::BUCKETS; i++) {
+      if (histogram.getBucket(i) != 0) {
+        used = i + 1;
+      }
+    }
+    // Buckets are read one by one while recording goes on, the count is
+    // their sum so that +Inf stays the highest
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < used; i++) {
+      cumulative += histogram.getBucket(i);
+      sample(metric + "_bucket",
+             "{le=\"" + std::to_string(((uint64_t)2 << i) - 1) + "\"}",
+             cumulative);
+    }
+    sample(metric + "_bucket", "{le=\"+Inf\"}", cumulative);
+    sample(metric + "_sum", "", histogram.getSum());
+    sample(metric + "_count", "", cumulative);
+  }
+
+ private:
+  std::string& out;
+
+  // Prometheus names are [a-zA-Z0-9_:]
+  static std::string metricName(const std::string& name) {
+    std::string metric = "bell_" + name;
+    for (auto& c : metric) {
+      if (!isalnum((unsigned char)c) && c != '_') {
+        c = '_';
+      }
+    }
+    return metric;
+  }
+
+  void type(const std::string& metric, const char* kind) {
+    out += "# TYPE " + metric + " " + kind + "\n";
+  }
+
+  template <typename T>
+  void sample(const std::string& metric, const std::string& labels, T value) {
+    out += metric + labels + " " + std::to_string(value) + "\n";
+  }
+};
+}  // namespace
+
+std::string Metrics::toPrometheus() {
+  std::string text;
+  PrometheusVisitor visitor(text);
+  visit(visitor);
+  return text;
+}
+
+void Metrics::reset() {
+  auto& self = instance();
+  std::scoped_lock lock(self.registryMutex);
+  for (auto& [name, counter] : self.counters) {
+    counter->reset();
+  }
+  for (auto& [name, gauge] : self.gauges) {
+    gauge->reset();
+  }
+  for (auto& [name, histogram] : self.histograms) {
+    histogram->reset();
+  }
+}
+
+#ifdef ESP_PLATFORM
+static void sampleRegion(const std::string& name, uint32_t caps) {
+  Metrics::gauge("heap." + name + ".free")
+      .set((int32_t)heap_caps_get_free_size(caps));
+  Metrics::gauge("heap." + name + ".min_free")
+      .set((int32_t)heap_caps_get_minimum_free_size(caps));
+  Metrics::gauge("heap." + name + ".largest_block")
+      .set((int32_t)heap_caps_get_largest_free_block(caps));
+}
+#endif
+
+void Metrics::sampleHeap() {
+#ifdef ESP_PLATFORM
+  sampleRegion("internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  sampleRegion("psram", MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  sampleRegion("dma", MALLOC_CAP_DMA);
+#endif
+}
@@ -0,0 +1,198 @@
+#include "BellTrace.h"
+
+#include <stdio.h>    // for snprintf, fopen, fwrite, fclose
+#include <string.h>   // for strncpy
+#include <algorithm>  // for min, max
+#include <atomic>     // for atomic, memory_order_relaxed
+#include <memory>     // for unique_ptr
+#include <mutex>      // for mutex, scoped_lock
+
+using namespace bell;
+
+#ifdef BELL_TRACE
+namespace {
+struct Event {
+  std::atomic<const char*> name;
+  // Low 32 bits of the start, in µs since the epoch below
+  std::atomic<uint32_t> startUs;
+  std::atomic<uint32_t> durationNs;
+};
+
+struct ThreadBuffer {
+  // Spans written so far, only the owner moves it
+  std::atomic<uint32_t> head = 0;
+  // Owned by a live thread
+  std::atomic<bool> claimed = false;
+  // Below, under the registry's mutex
+  uint32_t tid = 0;
+  uint32_t clearedAt = 0;
+  char name[24] = {};
+  Event events[Trace::EVENTS];
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::unique_ptr<ThreadBuffer> buffers[Trace::MAX_THREADS];
+  // Spans are stamped from here, the first use of the trace
+  int64_t epochNs = clock::nowNs();
+};
+
+Registry& registry() {
+  static Registry instance;
+  return instance;
+}
+
+// Gives the buffer up as its thread exits, for the next thread to claim
+struct Claim {
+  ThreadBuffer* buffer = nullptr;
+  ~Claim() {
+    if (buffer) {
+      buffer->claimed.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local Claim claim;
+// Set once no buffer was left, the thread stops trying
+thread_local bool unclaimed = false;
+
+ThreadBuffer* claimBuffer() {
+  Registry& self = registry();
+  std::scoped_lock lock(self.mutex);
+  for (size_t i = 0; i < Trace::MAX_THREADS; i++) {
+    auto& buffer = self.buffers[i];
+    if (!buffer) {
+      buffer = std::make_unique<ThreadBuffer>();
+    } else if (buffer->claimed.load(std::memory_order_acquire)) {
+      continue;
+    }
+    // A dead thread's spans go with it
+    buffer->claimed = true;
+    buffer->tid = i + 1;
+    buffer->clearedAt = buffer->head.load(std::memory_order_relaxed);
+    snprintf(buffer->name, sizeof(buffer->name), "thread %u",
+             (unsigned)(i + 1));
+    return buffer.get();
+  }
+  return nullptr;
+}
+
+ThreadBuffer* threadBuffer() {
+  if (claim.buffer == nullptr && !unclaimed) {
+    claim.buffer = claimBuffer();
+    unclaimed = claim.buffer == nullptr;
+  }
+  return claim.buffer;
+}
+
+// Names and spans are plain identifiers, only quotes are escaped
+void appendEscaped(std::string& json, const char* text) {
+  for (const char* c = text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      json += '\\';
+    }
+    json += *c;
+  }
+}
+}  // namespace
+
+void Trace::record(const char* name, int64_t startNs, int64_t endNs) {
+  ThreadBuffer* buffer = threadBuffer();
+  if (buffer == nullptr) {
+    return;
+  }
+  uint32_t head = buffer->head.load(std::memory_order_relaxed);
+  Event& event = buffer->events[head % EVENTS];
+  int64_t duration = std::max<int64_t>(endNs - startNs, 0);
+  event.name.store(name, std::memory_order_relaxed);
+  event.startUs.store((startNs - registry().epochNs) / 1000,
+                      std::memory_order_relaxed);
+  event.durationNs.store(std::min<int64_t>(duration, UINT32_MAX),
+                         std::memory_order_relaxed);
+  // Published after its fields, for a dump reading along
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::setThreadName(const char* name) {
+  ThreadBuffer* buffer = threadBuffer();
+  if (buffer == nullptr) {
+    return;
+  }
+  std::scoped_lock lock(registry().mutex);
+  strncpy(buffer->name, name, sizeof(buffer->name) - 1);
+}
+
+std::string Trace::toJson() {
+  Registry& self = registry();
+  std::scoped_lock lock(self.mutex);
+  int64_t nowUs = (clock::nowNs() - self.epochNs) / 1000;
+
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  char line[160];
+  for (auto& buffer : self.buffers) {
+    if (!buffer) {
+      continue;
+    }
+    snprintf(line, sizeof(line),
+             "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+             "\"args\":{\"name\":\"",
+             buffer->tid == 1 ? "" : ",", (unsigned)buffer->tid);
+    json += line;
+    appendEscaped(json, buffer->name);
+    json += "\"}}";
+
+    uint32_t head = buffer->head.load(std::memory_order_acquire);
+    uint32_t kept = std::min<uint32_t>(head - buffer->clearedAt, EVENTS);
+    for (uint32_t i = head - kept; i != head; i++) {
+      Event& event = buffer->events[i % EVENTS];
+      const char* name = event.name.load(std::memory_order_relaxed);
+      uint32_t startUs = event.startUs.load(std::memory_order_relaxed);
+      uint32_t durationNs = event.durationNs.load(std::memory_order_relaxed);
+      // Overwritten while copied, and the slot being written now
+      uint32_t written = buffer->head.load(std::memory_order_acquire);
+      if (written - i >= EVENTS) {
+        continue;
+      }
+      int64_t ts = nowUs - (uint32_t)((uint32_t)nowUs - startUs);
+      snprintf(line, sizeof(line),
+               ",{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,"
+               "\"dur\":%.3f,\"name\":\"",
+               (unsigned)buffer->tid, (long long)ts, durationNs / 1000.0);
+      json += line;
+      appendEscaped(json, name);
+      json += "\"}";
+    }
+  }
+  return json + "]}";
+}
+
+void Trace::clear() {
+  Registry& self = registry();
+  std::scoped_lock lock(self.mutex);
+  for (auto& buffer : self.buffers) {
+    if (buffer) {
+      buffer->clearedAt = buffer->head.load(std::memory_order_acquire);
+    }
+  }
+}
+#else
+void Trace::record(const char* name, int64_t startNs, int64_t endNs) {}
+
+void Trace::setThreadName(const char* name) {}
+
+std::string Trace::toJson() {
+  return "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[]}";
+}
+
+void Trace::clear() {}
+#endif
+
+bool Trace::writeFile(const std::string& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    return false;
+  }
+  std::string json = toJson();
+  bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+  return fclose(file) == 0 && written;
+}
@@ -0,0 +1,206 @@
+#include "BinaryLogger.h"
+
+#include <string.h>   // for memcpy, strlen
+#include <algorithm>  // for min
+
+#include "LogFormat.h"  // for LogArgType, LogArgValue, readLogArgs
+
+using namespace bell;
+
+namespace {
+// Set while a batch is being sent, logs made by the sink only get queued
+thread_local bool inSink = false;
+
+size_t putVarint(uint8_t* out, uint64_t value) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    out[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[len++] = (uint8_t)value;
+  return len;
+}
+
+uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+}  // namespace
+
+BinaryLogger::BinaryLogger(const Config& config, const Sink& sink)
+    : config(config), sink(sink) {
+  batch.reserve(config.batchSize);
+}
+
+BinaryLogger::Sink BinaryLogger::fileSink(FILE* file) {
+  return [file](const uint8_t* data, size_t len) {
+    fwrite(data, 1, len, file);
+    fflush(file);
+  };
+}
+
+void BinaryLogger::write(const LogSite& site, const char* format,
+                         va_list args) {
+  // Encoded outside the lock, worst case a varint is 10 bytes
+  uint8_t encoded[MAX_ARGS_SIZE];
+  size_t argsSize = 0;
+
+  va_list argsCopy;
+  va_copy(argsCopy, args);
+  readLogArgs(format, &argsCopy,
+              [&](LogArgType type, const LogArgValue& value) {
+                if (argsSize + 10 > MAX_ARGS_SIZE) {
+                  return false;
+                }
+                uint8_t* out = encoded + argsSize;
+                switch (type) {
+                  case LogArgType::INT:
+                    argsSize += putVarint(out, zigzag(value.i));
+                    break;
+                  case LogArgType::UINT:
+                    argsSize += putVarint(out, value.u);
+                    break;
+                  case LogArgType::CHAR:
+                    encoded[argsSize++] = (uint8_t)value.i;
+                    break;
+                  case LogArgType::DOUBLE:
+                    memcpy(out, &value.d, sizeof(double));
+                    argsSize += sizeof(double);
+                    break;
+                  case LogArgType::POINTER:
+                    argsSize += putVarint(out, (uintptr_t)value.p);
+                    break;
+                  case LogArgType::STRING: {
+                    const char* string = value.s ? value.s : "(null)";
+                    size_t len = strlen(string);
+                    len = std::min(len, MAX_STRING);
+                    len = std::min(len, MAX_ARGS_SIZE - argsSize - 1);
+                    encoded[argsSize++] = (uint8_t)len;
+                    memcpy(encoded + argsSize, string, len);
+                    argsSize += len;
+                    break;
+                  }
+                  default:
+                    break;
+                }
+                return true;
+              });
+  va_end(argsCopy);
+
+  std::vector<uint8_t> finished;
+  uint32_t turn = 0;
+  {
+    std::scoped_lock lock(batchMutex);
+    auto now = std::chrono::system_clock::now();
+    size_t recordSize = 4 + 10 + 1 + argsSize;
+    bool expired = !batch.empty() &&
+                   now - batchStart > std::chrono::milliseconds(
+                                          config.maxDelayMs);
+    if (!batch.empty() &&
+        (expired || batch.size() + recordSize > config.batchSize)) {
+      if (inSink) {
+        // Can't send from within the sink, but don't grow without bound
+        if (batch.size() + recordSize > 2 * config.batchSize) {
+          return;
+        }
+      } else {
+        finished = takeBatch(turn);
+      }
+    }
+
+    if (batch.empty()) {
+      batch.resize(HEADER_SIZE);
+      batchStart = lastRecord = now;
+    }
+
+    uint8_t record[4 + 10 + 1];
+    uint32_t id = site.id;
+    for (size_t i = 0; i < 4; i++) {
+      record[i] = (uint8_t)(id >> (8 * i));
+    }
+    auto delta = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     now - lastRecord)
+                     .count();
+    size_t len = 4 + putVarint(record + 4, delta > 0 ? delta : 0);
+    record[len++] = (uint8_t)argsSize;
+    lastRecord = now;
+
+    batch.insert(batch.end(), record, record + len);
+    batch.insert(batch.end(), encoded, encoded + argsSize);
+  }
+
+  if (!finished.empty()) {
+    send(finished, turn);
+  }
+}
+
+std::vector<uint8_t> BinaryLogger::takeBatch(uint32_t& turn) {
+  turn = batchesTaken++;
+  std::vector<uint8_t> finished;
+  finished.reserve(config.batchSize);
+  finished.swap(batch);
+
+  size_t recordsSize = finished.size() - HEADER_SIZE;
+  uint64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         batchStart.time_since_epoch())
+                         .count();
+  finished[0] = 'B';
+  finished[1] = 'L';
+  finished[2] = VERSION;
+  finished[3] = (uint8_t)recordsSize;
+  finished[4] = (uint8_t)(recordsSize >> 8);
+  for (size_t i = 0; i < 8; i++) {
+    finished[5 + i] = (uint8_t)(startMs >> (8 * i));
+  }
+  return finished;
+}
+
+void BinaryLogger::send(std::vector<uint8_t>& finished, uint32_t turn) {
+  std::unique_lock lock(sinkMutex);
+  // A batch taken before this one may not have reached the lock yet
+  sinkTurn.wait(lock, [&]() { return batchesSent == turn; });
+  inSink = true;
+  sink(finished.data(), finished.size());
+  inSink = false;
+  batchesSent++;
+  sinkTurn.notify_all();
+}
+
+void BinaryLogger::flush() {
+  if (inSink) {
+    return;
+  }
+  std::vector<uint8_t> finished;
+  uint32_t turn;
+  {
+    std::scoped_lock lock(batchMutex);
+    if (batch.empty()) {
+      return;
+    }
+    finished = takeBatch(turn);
+  }
+  send(finished, turn);
+}
+
+void BinaryLogger::debug(const LogSite& site, const char* submodule,
+                         const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  write(site, format, args);
+  va_end(args);
+}
+
+void BinaryLogger::error(const LogSite& site, const char* submodule,
+                         const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  write(site, format, args);
+  va_end(args);
+}
+
+void BinaryLogger::info(const LogSite& site, const char* submodule,
+                        const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  write(site, format, args);
+  va_end(args);
+}
@@ -5,8 +5,14 @@
 #include <mbedtls/ctr_drbg.h>  // for mbedtls_ctr_drbg_free, mbedtls_ctr_drb...
 #include <mbedtls/entropy.h>   // for mbedtls_entropy_free, mbedtls_entropy_...
 #include <mbedtls/pkcs5.h>     // for mbedtls_pkcs5_pbkdf2_hmac
+#include <string.h>            // for memcpy
 #include <cstdint>             // for uint8_t
+#include <functional>          // for function
+#include <mutex>               // for mutex, scoped_lock, call_once
 #include <stdexcept>           // for runtime_error
+#include <utility>             // for move
+
+#include "Executor.h"  // for Executor
 
 extern "C" {
 #include "aes.h"  // for AES_ECB_decrypt, AES_init_ctx, AES_ctx
@@ -14,6 +20,75 @@ extern "C" {
 
 static unsigned char DHGenerator[1] = {2};
 
+namespace {
+template <typename T>
+std::future<T> runInBackground(std::function<T()> job) {
+  return bell::Executor::instance().submit(bell::Executor::Lane::BACKGROUND,
+                                           std::move(job));
+}
+
+struct DHKeys {
+  std::vector<uint8_t> privateKey, publicKey;
+};
+
+std::mutex dhKeysMutex;
+// Valid once prepareDHKeys() was called
+std::future<DHKeys> nextDHKeys;
+
+// R^2 mod DHPrime, which mbedtls_mpi_exp_mod() otherwise derives every call
+mbedtls_mpi primeRR;
+std::once_flag primeRRFlag;
+
+mbedtls_mpi* dhPrimeRR() {
+  std::call_once(primeRRFlag, []() {
+    mbedtls_mpi prime, one, res;
+    mbedtls_mpi_init(&primeRR);
+    mbedtls_mpi_init(&prime);
+    mbedtls_mpi_init(&one);
+    mbedtls_mpi_init(&res);
+    mbedtls_mpi_read_binary(&prime, DHPrime, sizeof(DHPrime));
+    mbedtls_mpi_lset(&one, 1);
+    mbedtls_mpi_exp_mod(&res, &one, &one, &prime, &primeRR);
+    mbedtls_mpi_free(&prime);
+    mbedtls_mpi_free(&one);
+    mbedtls_mpi_free(&res);
+  });
+  return &primeRR;
+}
+
+DHKeys generateDHKeys() {
+  DHKeys keys;
+  keys.privateKey = CryptoMbedTLS::generateVectorWithRandomData(DH_KEY_SIZE);
+
+  // initialize big num
+  mbedtls_mpi prime, generator, res, privKey;
+  mbedtls_mpi_init(&prime);
+  mbedtls_mpi_init(&generator);
+  mbedtls_mpi_init(&privKey);
+  mbedtls_mpi_init(&res);
+
+  // Read bin into big num mpi
+  mbedtls_mpi_read_binary(&prime, DHPrime, sizeof(DHPrime));
+  mbedtls_mpi_read_binary(&generator, DHGenerator, sizeof(DHGenerator));
+  mbedtls_mpi_read_binary(&privKey, keys.privateKey.data(), DH_KEY_SIZE);
+
+  // perform diffie hellman G^X mod P
+  mbedtls_mpi_exp_mod(&res, &generator, &privKey, &prime, dhPrimeRR());
+
+  // Write generated public key to vector
+  keys.publicKey = std::vector<uint8_t>(DH_KEY_SIZE);
+  mbedtls_mpi_write_binary(&res, keys.publicKey.data(), DH_KEY_SIZE);
+
+  // Release memory
+  mbedtls_mpi_free(&prime);
+  mbedtls_mpi_free(&generator);
+  mbedtls_mpi_free(&privKey);
+  mbedtls_mpi_free(&res);
+
+  return keys;
+}
+}  // namespace
+
 CryptoMbedTLS::CryptoMbedTLS() {}
 
 CryptoMbedTLS::~CryptoMbedTLS() {
@@ -22,33 +97,48 @@ CryptoMbedTLS::~CryptoMbedTLS() {
   }
 }
 
-std::vector<uint8_t> CryptoMbedTLS::base64Decode(const std::string& data) {
-  // Calculate max decode length
-  size_t requiredSize;
+static void requireSize(std::span<const uint8_t> buffer, size_t size) {
+  if (buffer.size() < size) {
+    throw std::runtime_error("Output buffer too small");
+  }
+}
 
-  mbedtls_base64_encode(nullptr, 0, &requiredSize, (unsigned char*)data.c_str(),
-                        data.size());
+std::vector<uint8_t> CryptoMbedTLS::base64Decode(const std::string& data) {
+  // At most 3 bytes for every 4 characters
+  std::vector<uint8_t> output(data.size() / 4 * 3 + 3);
+  output.resize(base64Decode(data, output));
+  return output;
+}
 
-  std::vector<uint8_t> output(requiredSize);
+size_t CryptoMbedTLS::base64Decode(std::string_view data,
+                                   std::span<uint8_t> out) {
   size_t outputLen = 0;
-  mbedtls_base64_decode(output.data(), requiredSize, &outputLen,
-                        (unsigned char*)data.c_str(), data.size());
-
-  return std::vector<uint8_t>(output.begin(), output.begin() + outputLen);
+  int ret = mbedtls_base64_decode(out.data(), out.size(), &outputLen,
+                                  (const unsigned char*)data.data(),
+                                  data.size());
+  if (ret == MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL) {
+    throw std::runtime_error("Output buffer too small");
+  }
+  // Invalid input decodes to nothing, as before
+  return ret == 0 ? outputLen : 0;
 }
 
 std::string CryptoMbedTLS::base64Encode(const std::vector<uint8_t>& data) {
-  // Calculate max output length
-  size_t requiredSize;
-  mbedtls_base64_encode(nullptr, 0, &requiredSize, data.data(), data.size());
+  // 4 characters for every 3 bytes, and a null terminator
+  std::string output((data.size() + 2) / 3 * 4 + 1, '\0');
+  output.resize(base64Encode(data, output));
+  return output;
+}
 
-  std::vector<uint8_t> output(requiredSize);
+size_t CryptoMbedTLS::base64Encode(std::span<const uint8_t> data,
+                                   std::span<char> out) {
+  // mbedtls null terminates, the terminator may take the last byte
   size_t outputLen = 0;
-
-  mbedtls_base64_encode(output.data(), requiredSize, &outputLen, data.data(),
-                        data.size());
-
-  return std::string(output.begin(), output.begin() + outputLen);
+  if (mbedtls_base64_encode((unsigned char*)out.data(), out.size(), &outputLen,
+                            data.data(), data.size()) != 0) {
+    throw std::runtime_error("Output buffer too small");
+  }
+  return outputLen;
 }
 
 // Sha1
@@ -60,19 +150,25 @@ void CryptoMbedTLS::sha1Init() {
 }
 
 void CryptoMbedTLS::sha1Update(const std::string& s) {
-  sha1Update(std::vector<uint8_t>(s.begin(), s.end()));
+  sha1Update(std::span<const uint8_t>((const uint8_t*)s.data(), s.size()));
 }
 void CryptoMbedTLS::sha1Update(const std::vector<uint8_t>& vec) {
-  mbedtls_md_update(&sha1Context, vec.data(), vec.size());
+  sha1Update(std::span<const uint8_t>(vec));
+}
+void CryptoMbedTLS::sha1Update(std::span<const uint8_t> data) {
+  mbedtls_md_update(&sha1Context, data.data(), data.size());
 }
 
 std::vector<uint8_t> CryptoMbedTLS::sha1FinalBytes() {
-  std::vector<uint8_t> digest(20);  // SHA1 digest size
+  std::vector<uint8_t> digest(SHA1_SIZE);
+  sha1Final(digest);
+  return digest;
+}
 
+void CryptoMbedTLS::sha1Final(std::span<uint8_t> digest) {
+  requireSize(digest, SHA1_SIZE);
   mbedtls_md_finish(&sha1Context, digest.data());
   mbedtls_md_free(&sha1Context);
-
-  return digest;
 }
 
 std::string CryptoMbedTLS::sha1Final() {
@@ -83,15 +179,22 @@ std::string CryptoMbedTLS::sha1Final() {
 // HMAC SHA1
 std::vector<uint8_t> CryptoMbedTLS::sha1HMAC(
     const std::vector<uint8_t>& inputKey, const std::vector<uint8_t>& message) {
-  std::vector<uint8_t> digest(20);  // SHA1 digest size
+  std::vector<uint8_t> digest(SHA1_SIZE);
+  sha1HMAC(std::span<const uint8_t>(inputKey),
+           std::span<const uint8_t>(message), digest);
+  return digest;
+}
+
+void CryptoMbedTLS::sha1HMAC(std::span<const uint8_t> inputKey,
+                             std::span<const uint8_t> message,
+                             std::span<uint8_t> digest) {
+  requireSize(digest, SHA1_SIZE);
 
   sha1Init();
   mbedtls_md_hmac_starts(&sha1Context, inputKey.data(), inputKey.size());
   mbedtls_md_hmac_update(&sha1Context, message.data(), message.size());
   mbedtls_md_hmac_finish(&sha1Context, digest.data());
   mbedtls_md_free(&sha1Context);
-
-  return digest;
 }
 
 // AES CTR
@@ -106,9 +209,13 @@ void CryptoMbedTLS::aesCTRXcrypt(const std::vector<uint8_t>& key,
   size_t off = 0;
   unsigned char streamBlock[16] = {0};
 
-  // set IV
-  if (mbedtls_aes_setkey_enc(&aesCtx, key.data(), key.size() * 8) != 0) {
-    throw std::runtime_error("Failed to set AES key");
+  // set key, unless it's the one of the previous call
+  if (key != aesKey) {
+    if (mbedtls_aes_setkey_enc(&aesCtx, key.data(), key.size() * 8) != 0) {
+      aesKey.clear();
+      throw std::runtime_error("Failed to set AES key");
+    }
+    aesKey = key;
   }
   // Perform decrypt
   if (mbedtls_aes_crypt_ctr(&aesCtx, nbytes, &off, iv.data(), streamBlock,
@@ -117,8 +224,63 @@ void CryptoMbedTLS::aesCTRXcrypt(const std::vector<uint8_t>& key,
   }
 }
 
+AESCTRCipher::AESCTRCipher(const std::vector<uint8_t>& key,
+                           const std::vector<uint8_t>& iv) {
+  if (iv.size() != BLOCK_SIZE) {
+    throw std::runtime_error("Invalid AES IV size");
+  }
+  mbedtls_aes_init(&ctx);
+  if (mbedtls_aes_setkey_enc(&ctx, key.data(), key.size() * 8) != 0) {
+    mbedtls_aes_free(&ctx);
+    throw std::runtime_error("Failed to set AES key");
+  }
+  memcpy(this->iv, iv.data(), BLOCK_SIZE);
+  seek(0);
+}
+
+AESCTRCipher::~AESCTRCipher() {
+  mbedtls_aes_free(&ctx);
+}
+
+void AESCTRCipher::seek(size_t offset) {
+  this->offset = offset;
+
+  // counter = iv + offset / BLOCK_SIZE, as a 128 bit big endian number
+  uint64_t carry = offset / BLOCK_SIZE;
+  for (int i = BLOCK_SIZE - 1; i >= 0; i--) {
+    carry += iv[i];
+    counter[i] = carry & 0xFF;
+    carry >>= 8;
+  }
+
+  blockOffset = offset % BLOCK_SIZE;
+  if (blockOffset != 0) {
+    // Mid block, mbedtls expects that block's keystream and the next counter
+    uint8_t zeros[BLOCK_SIZE] = {0};
+    size_t start = 0;
+    mbedtls_aes_crypt_ctr(&ctx, BLOCK_SIZE, &start, counter, streamBlock,
+                          zeros, zeros);
+  }
+}
+
+void AESCTRCipher::xcrypt(uint8_t* data, size_t nbytes) {
+  if (mbedtls_aes_crypt_ctr(&ctx, nbytes, &blockOffset, counter, streamBlock,
+                            data, data) != 0) {
+    throw std::runtime_error("Failed to decrypt");
+  }
+  offset += nbytes;
+}
+
 void CryptoMbedTLS::aesECBdecrypt(const std::vector<uint8_t>& key,
                                   std::vector<uint8_t>& data) {
+  aesECBdecrypt(std::span<const uint8_t>(key), std::span<uint8_t>(data));
+}
+
+void CryptoMbedTLS::aesECBdecrypt(std::span<const uint8_t> key,
+                                  std::span<uint8_t> data) {
+  if (key.size() < AES_KEYLEN) {
+    throw std::runtime_error("Invalid AES key size");
+  }
 
   struct AES_ctx aesCtr;
   AES_init_ctx(&aesCtr, key.data());
@@ -134,12 +296,19 @@ std::vector<uint8_t> CryptoMbedTLS::pbkdf2HmacSha1(
     const std::vector<uint8_t>& password, const std::vector<uint8_t>& salt,
     int iterations, int digestSize) {
   auto digest = std::vector<uint8_t>(digestSize);
+  pbkdf2HmacSha1(std::span<const uint8_t>(password),
+                 std::span<const uint8_t>(salt), iterations, digest);
+  return digest;
+}
 
+void CryptoMbedTLS::pbkdf2HmacSha1(std::span<const uint8_t> password,
+                                   std::span<const uint8_t> salt,
+                                   int iterations, std::span<uint8_t> digest) {
 #if MBEDTLS_VERSION_NUMBER < 0x03030000
   // Init sha context
   sha1Init();
   mbedtls_pkcs5_pbkdf2_hmac(&sha1Context, password.data(), password.size(),
-                            salt.data(), salt.size(), iterations, digestSize,
+                            salt.data(), salt.size(), iterations, digest.size(),
                             digest.data());
 
   // Free sha context
@@ -147,43 +316,54 @@ std::vector<uint8_t> CryptoMbedTLS::pbkdf2HmacSha1(
 #else
   mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA1, password.data(),
                                 password.size(), salt.data(), salt.size(),
-                                iterations, digestSize, digest.data());
+                                iterations, digest.size(), digest.data());
 #endif
-
-  return digest;
 }
 
-void CryptoMbedTLS::dhInit() {
-  privateKey = generateVectorWithRandomData(DH_KEY_SIZE);
-
-  // initialize big num
-  mbedtls_mpi prime, generator, res, privKey;
-  mbedtls_mpi_init(&prime);
-  mbedtls_mpi_init(&generator);
-  mbedtls_mpi_init(&privKey);
-  mbedtls_mpi_init(&res);
-
-  // Read bin into big num mpi
-  mbedtls_mpi_read_binary(&prime, DHPrime, sizeof(DHPrime));
-  mbedtls_mpi_read_binary(&generator, DHGenerator, sizeof(DHGenerator));
-  mbedtls_mpi_read_binary(&privKey, privateKey.data(), DH_KEY_SIZE);
+std::future<std::vector<uint8_t>> CryptoMbedTLS::pbkdf2HmacSha1Async(
+    const std::vector<uint8_t>& password, const std::vector<uint8_t>& salt,
+    int iterations, int digestSize) {
+  return runInBackground<std::vector<uint8_t>>(
+      [password, salt, iterations, digestSize]() {
+        // Own object, pbkdf2HmacSha1() may use its SHA1 context
+        CryptoMbedTLS crypto;
+        return crypto.pbkdf2HmacSha1(password, salt, iterations, digestSize);
+      });
+}
 
-  // perform diffie hellman G^X mod P
-  mbedtls_mpi_exp_mod(&res, &generator, &privKey, &prime, NULL);
+void CryptoMbedTLS::prepareDHKeys() {
+  std::scoped_lock lock(dhKeysMutex);
+  if (!nextDHKeys.valid()) {
+    nextDHKeys = runInBackground<DHKeys>(generateDHKeys);
+  }
+}
 
-  // Write generated public key to vector
-  this->publicKey = std::vector<uint8_t>(DH_KEY_SIZE);
-  mbedtls_mpi_write_binary(&res, publicKey.data(), DH_KEY_SIZE);
+void CryptoMbedTLS::dhInit() {
+  std::future<DHKeys> prepared;
+  {
+    std::scoped_lock lock(dhKeysMutex);
+    if (nextDHKeys.valid()) {
+      prepared = std::move(nextDHKeys);
+      nextDHKeys = runInBackground<DHKeys>(generateDHKeys);
+    }
+  }
 
-  // Release memory
-  mbedtls_mpi_free(&prime);
-  mbedtls_mpi_free(&generator);
-  mbedtls_mpi_free(&privKey);
-  mbedtls_mpi_free(&res);
+  DHKeys keys = prepared.valid() ? prepared.get() : generateDHKeys();
+  this->privateKey = std::move(keys.privateKey);
+  this->publicKey = std::move(keys.publicKey);
 }
 
 std::vector<uint8_t> CryptoMbedTLS::dhCalculateShared(
     const std::vector<uint8_t>& remoteKey) {
+  auto sharedKey = std::vector<uint8_t>(DH_KEY_SIZE);
+  dhCalculateShared(std::span<const uint8_t>(remoteKey), sharedKey);
+  return sharedKey;
+}
+
+void CryptoMbedTLS::dhCalculateShared(std::span<const uint8_t> remoteKey,
+                                      std::span<uint8_t> sharedKey) {
+  requireSize(sharedKey, DH_KEY_SIZE);
+
   // initialize big num
   mbedtls_mpi prime, remKey, res, privKey;
   mbedtls_mpi_init(&prime);
@@ -197,9 +377,8 @@ std::vector<uint8_t> CryptoMbedTLS::dhCalculateShared(
   mbedtls_mpi_read_binary(&privKey, privateKey.data(), DH_KEY_SIZE);
 
   // perform diffie hellman (G^Y)^X mod P (for shared secret)
-  mbedtls_mpi_exp_mod(&res, &remKey, &privKey, &prime, NULL);
+  mbedtls_mpi_exp_mod(&res, &remKey, &privKey, &prime, dhPrimeRR());
 
-  auto sharedKey = std::vector<uint8_t>(DH_KEY_SIZE);
   mbedtls_mpi_write_binary(&res, sharedKey.data(), DH_KEY_SIZE);
 
   // Release memory
@@ -207,14 +386,27 @@ std::vector<uint8_t> CryptoMbedTLS::dhCalculateShared(
   mbedtls_mpi_free(&remKey);
   mbedtls_mpi_free(&privKey);
   mbedtls_mpi_free(&res);
+}
 
-  return sharedKey;
+std::future<std::vector<uint8_t>> CryptoMbedTLS::dhCalculateSharedAsync(
+    const std::vector<uint8_t>& remoteKey) {
+  std::vector<uint8_t> privateKey = this->privateKey;
+  return runInBackground<std::vector<uint8_t>>([remoteKey, privateKey]() {
+    CryptoMbedTLS crypto;
+    crypto.privateKey = privateKey;
+    return crypto.dhCalculateShared(remoteKey);
+  });
 }
 
 // Random stuff
 std::vector<uint8_t> CryptoMbedTLS::generateVectorWithRandomData(
     size_t length) {
   std::vector<uint8_t> randomVector(length);
+  generateRandomData(randomVector);
+  return randomVector;
+}
+
+void CryptoMbedTLS::generateRandomData(std::span<uint8_t> out) {
   mbedtls_entropy_context entropy;
   mbedtls_ctr_drbg_context ctrDrbg;
   // Personification string
@@ -229,11 +421,9 @@ std::vector<uint8_t> CryptoMbedTLS::generateVectorWithRandomData(
                         (const unsigned char*)pers, 7);
 
   // Generate random bytes
-  mbedtls_ctr_drbg_random(&ctrDrbg, randomVector.data(), length);
+  mbedtls_ctr_drbg_random(&ctrDrbg, out.data(), out.size());
 
   // Release memory
   mbedtls_entropy_free(&entropy);
   mbedtls_ctr_drbg_free(&ctrDrbg);
-
-  return randomVector;
 }
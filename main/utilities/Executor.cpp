@@ -0,0 +1,148 @@
+#include "Executor.h"
+
+#include <chrono>  // for milliseconds
+
+using namespace bell;
+
+namespace {
+// Worker the calling task belongs to, if any
+thread_local void* currentWorker = nullptr;
+}  // namespace
+
+Executor::Worker::Worker(Executor& executor, size_t index, int core)
+    : bell::Task("executor_" + std::to_string(index),
+                 executor.config.stackSize, executor.config.priority, core),
+      executor(executor),
+      index(index) {}
+
+bool Executor::Worker::start() {
+  running = true;
+  if (!startTask()) {
+    running = false;
+    return false;
+  }
+  return true;
+}
+
+void Executor::Worker::runTask() {
+  currentWorker = this;
+  {
+    // Workers that failed to start are still being dropped from workers
+    std::unique_lock lock(executor.idleMutex);
+    executor.idleCondition.wait(
+        lock, [this]() { return executor.started || !running; });
+  }
+
+  Job job;
+  while (running) {
+    if (executor.take(*this, job)) {
+      job();
+      job = nullptr;
+      continue;
+    }
+
+    std::unique_lock lock(executor.idleMutex);
+    executor.idleCondition.wait(
+        lock, [this]() { return executor.pending > 0 || !running; });
+  }
+}
+
+Executor::Executor(const Config& config) : config(config) {
+  for (size_t i = 0; i < config.workers; i++) {
+    int core = config.pinToCores ? i % config.cores : 0;
+    auto worker = std::make_unique<Worker>(*this, i, core);
+    workers.push_back(std::move(worker));
+  }
+
+  // Started once all exist, they steal from each other
+  for (auto it = workers.begin(); it != workers.end();) {
+    if ((*it)->start()) {
+      it++;
+    } else {
+      it = workers.erase(it);
+    }
+  }
+  {
+    std::scoped_lock lock(idleMutex);
+    started = true;
+  }
+  idleCondition.notify_all();
+}
+
+Executor::~Executor() {
+  {
+    std::scoped_lock lock(idleMutex);
+    for (auto& worker : workers) {
+      worker->running = false;
+    }
+  }
+  idleCondition.notify_all();
+  for (auto& worker : workers) {
+    // Workers are only destroyed once out of their Task
+    worker->joinTask();
+  }
+}
+
+Executor& Executor::instance() {
+  // Never destroyed, jobs may still be posted at exit
+  static Executor* executor = new Executor();
+  return *executor;
+}
+
+void Executor::post(Lane lane, const Job& job) {
+  if (workers.empty()) {
+    job();
+    return;
+  }
+
+  Worker* worker = nullptr;
+  for (auto& candidate : workers) {
+    if (candidate.get() == currentWorker) {
+      worker = candidate.get();
+      break;
+    }
+  }
+  if (worker == nullptr) {
+    worker = workers[nextWorker++ % workers.size()].get();
+  }
+
+  {
+    // Under idleMutex so the idle wait can't miss it, counted before it's
+    // queued so a worker taking it right away never sees pending wrap
+    std::scoped_lock lock(idleMutex);
+    pending++;
+  }
+  {
+    std::scoped_lock lock(worker->mutex);
+    worker->lanes[(size_t)lane].push_back(job);
+  }
+  idleCondition.notify_one();
+}
+
+bool Executor::take(Worker& worker, Job& job) {
+  for (size_t lane = 0; lane < LANES; lane++) {
+    {
+      std::scoped_lock lock(worker.mutex);
+      auto& queue = worker.lanes[lane];
+      if (!queue.empty()) {
+        job = std::move(queue.front());
+        queue.pop_front();
+        pending--;
+        return true;
+      }
+    }
+
+    for (size_t i = 1; i < workers.size(); i++) {
+      Worker& victim = *workers[(worker.index + i) % workers.size()];
+      std::scoped_lock lock(victim.mutex);
+      auto& queue = victim.lanes[lane];
+      if (!queue.empty()) {
+        job = std::move(queue.back());
+        queue.pop_back();
+        pending--;
+        return true;
+      }
+    }
+  }
+  return false;
+}
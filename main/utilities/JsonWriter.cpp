@@ -0,0 +1,176 @@
+#include "JsonWriter.h"
+
+#include <stdio.h>   // for snprintf
+#include <stdlib.h>  // for strtod
+#include <cmath>     // for isfinite
+
+using namespace bell;
+
+JsonWriter::JsonWriter(std::string& out) : out(out) {}
+
+JsonWriter::JsonWriter(std::ostream& out, size_t flushSize)
+    : out(pending), stream(&out), flushSize(flushSize) {
+  pending.reserve(flushSize + 64);
+}
+
+JsonWriter::~JsonWriter() {
+  flush();
+}
+
+void JsonWriter::flush() {
+  if (stream != nullptr && !pending.empty()) {
+    stream->write(pending.data(), pending.size());
+    pending.clear();
+  }
+}
+
+void JsonWriter::written() {
+  if (stream != nullptr && pending.size() >= flushSize) {
+    flush();
+  }
+}
+
+void JsonWriter::element() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (depth == 0 || depth > MAX_DEPTH) {
+    return;
+  }
+  uint64_t bit = 1ull << (depth - 1);
+  if (filled & bit) {
+    out += ',';
+  }
+  filled |= bit;
+}
+
+void JsonWriter::open(char bracket) {
+  element();
+  out += bracket;
+  depth++;
+  if (depth <= MAX_DEPTH) {
+    filled &= ~(1ull << (depth - 1));
+  }
+}
+
+void JsonWriter::close(char bracket) {
+  out += bracket;
+  if (depth > 0) {
+    depth--;
+  }
+  written();
+}
+
+JsonWriter& JsonWriter::beginObject() {
+  open('{');
+  return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+  close('}');
+  return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+  open('[');
+  return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+  close(']');
+  return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view name) {
+  element();
+  string(name);
+  out += ':';
+  afterKey = true;
+  return *this;
+}
+
+void JsonWriter::string(std::string_view text) {
+  static const char HEX[] = "0123456789abcdef";
+  out += '"';
+  // Runs without anything to escape are appended at once
+  size_t start = 0;
+  for (size_t i = 0; i < text.size(); i++) {
+    unsigned char c = text[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out.append(text.data() + start, i - start);
+    start = i + 1;
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        out += "\\u00";
+        out += HEX[c >> 4];
+        out += HEX[c & 0xf];
+    }
+  }
+  out.append(text.data() + start, text.size() - start);
+  out += '"';
+}
+
+JsonWriter& JsonWriter::value(std::string_view text) {
+  element();
+  string(text);
+  written();
+  return *this;
+}
+
+JsonWriter& JsonWriter::value(bool flag) {
+  return raw(flag ? "true" : "false");
+}
+
+JsonWriter& JsonWriter::value(double number) {
+  if (!std::isfinite(number)) {
+    return null();
+  }
+  // Round trips a double, without its usual noise for short values
+  char text[32];
+  int len = snprintf(text, sizeof(text), "%.15g", number);
+  if (strtod(text, nullptr) != number) {
+    len = snprintf(text, sizeof(text), "%.17g", number);
+  }
+  return raw(std::string_view(text, len));
+}
+
+JsonWriter& JsonWriter::integer(long long number) {
+  char text[24];
+  int len = snprintf(text, sizeof(text), "%lld", number);
+  return raw(std::string_view(text, len));
+}
+
+JsonWriter& JsonWriter::integer(unsigned long long number) {
+  char text[24];
+  int len = snprintf(text, sizeof(text), "%llu", number);
+  return raw(std::string_view(text, len));
+}
+
+JsonWriter& JsonWriter::null() {
+  return raw("null");
+}
+
+JsonWriter& JsonWriter::raw(std::string_view json) {
+  element();
+  out += json;
+  written();
+  return *this;
+}
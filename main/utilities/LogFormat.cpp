@@ -0,0 +1,223 @@
+#include "LogFormat.h"
+
+#include <stdio.h>      // for snprintf
+#include <cstddef>      // for ptrdiff_t
+#include <cstdint>      // for intmax_t, uintmax_t
+#include <type_traits>  // for make_signed_t
+
+using namespace bell;
+
+static LogArgType typeOf(char conversion) {
+  switch (conversion) {
+    case 'd':
+    case 'i':
+      return LogArgType::INT;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      return LogArgType::UINT;
+    case 'c':
+      return LogArgType::CHAR;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      return LogArgType::DOUBLE;
+    case 'p':
+      return LogArgType::POINTER;
+    case 's':
+      return LogArgType::STRING;
+    case 'n':
+      return LogArgType::WRITEBACK;
+    default:
+      return LogArgType::NONE;
+  }
+}
+
+static bool isFlag(char c) {
+  return c == '-' || c == '+' || c == ' ' || c == '#' || c == '0';
+}
+
+static bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+const char* bell::parseLogSpec(const char* c, LogSpec& spec) {
+  size_t flags = 0;
+  while (isFlag(*c)) {
+    if (flags < sizeof(spec.flags) - 1) {
+      spec.flags[flags++] = *c;
+    }
+    c++;
+  }
+  spec.flags[flags] = '\0';
+
+  spec.width = -1;
+  spec.widthStar = *c == '*';
+  if (spec.widthStar) {
+    c++;
+  } else if (isDigit(*c)) {
+    spec.width = 0;
+    while (isDigit(*c)) {
+      spec.width = spec.width * 10 + (*c++ - '0');
+    }
+  }
+
+  spec.precision = -1;
+  spec.precisionStar = false;
+  if (*c == '.') {
+    c++;
+    spec.precision = 0;
+    spec.precisionStar = *c == '*';
+    if (spec.precisionStar) {
+      c++;
+    }
+    while (isDigit(*c)) {
+      spec.precision = spec.precision * 10 + (*c++ - '0');
+    }
+  }
+
+  spec.length = LogLength::NONE;
+  switch (*c) {
+    case 'h':
+      spec.length = c[1] == 'h' ? LogLength::HH : LogLength::H;
+      c += spec.length == LogLength::HH ? 2 : 1;
+      break;
+    case 'l':
+      spec.length = c[1] == 'l' ? LogLength::LL : LogLength::L;
+      c += spec.length == LogLength::LL ? 2 : 1;
+      break;
+    case 'j':
+      spec.length = LogLength::J;
+      c++;
+      break;
+    case 'z':
+      spec.length = LogLength::Z;
+      c++;
+      break;
+    case 't':
+      spec.length = LogLength::T;
+      c++;
+      break;
+    case 'L':
+      spec.length = LogLength::LD;
+      c++;
+      break;
+  }
+
+  spec.conversion = *c;
+  spec.type = typeOf(*c);
+  return *c ? c + 1 : c;
+}
+
+static int64_t signedArg(LogLength length, va_list* args) {
+  switch (length) {
+    case LogLength::HH:
+      return (signed char)va_arg(*args, int);
+    case LogLength::H:
+      return (short)va_arg(*args, int);
+    case LogLength::L:
+      return va_arg(*args, long);
+    case LogLength::LL:
+      return va_arg(*args, long long);
+    case LogLength::J:
+      return va_arg(*args, intmax_t);
+    case LogLength::Z:
+      return va_arg(*args, std::make_signed_t<size_t>);
+    case LogLength::T:
+      return va_arg(*args, ptrdiff_t);
+    default:
+      return va_arg(*args, int);
+  }
+}
+
+static uint64_t unsignedArg(LogLength length, va_list* args) {
+  switch (length) {
+    case LogLength::HH:
+      return (unsigned char)va_arg(*args, unsigned int);
+    case LogLength::H:
+      return (unsigned short)va_arg(*args, unsigned int);
+    case LogLength::L:
+      return va_arg(*args, unsigned long);
+    case LogLength::LL:
+      return va_arg(*args, unsigned long long);
+    case LogLength::J:
+      return va_arg(*args, uintmax_t);
+    case LogLength::Z:
+      return va_arg(*args, size_t);
+    case LogLength::T:
+      return va_arg(*args, ptrdiff_t);
+    default:
+      return va_arg(*args, unsigned int);
+  }
+}
+
+LogArgValue bell::readLogArg(const LogSpec& spec, va_list* args) {
+  LogArgValue value;
+  value.u = 0;
+  switch (spec.type) {
+    case LogArgType::INT:
+      value.i = signedArg(spec.length, args);
+      break;
+    case LogArgType::UINT:
+      value.u = unsignedArg(spec.length, args);
+      break;
+    case LogArgType::CHAR:
+      value.i = va_arg(*args, int);
+      break;
+    case LogArgType::DOUBLE:
+      value.d = spec.length == LogLength::LD
+                    ? (double)va_arg(*args, long double)
+                    : va_arg(*args, double);
+      break;
+    case LogArgType::POINTER:
+    case LogArgType::WRITEBACK:
+      value.p = va_arg(*args, const void*);
+      break;
+    case LogArgType::STRING:
+      value.s = va_arg(*args, const char*);
+      break;
+    case LogArgType::NONE:
+      break;
+  }
+  return value;
+}
+
+int bell::formatLogArg(char* out, size_t size, const LogSpec& spec,
+                       const LogArgValue& value) {
+  bool integer = spec.type == LogArgType::INT || spec.type == LogArgType::UINT;
+  char specText[32];
+  int specLen = snprintf(specText, sizeof(specText), "%%%s", spec.flags);
+  if (spec.width >= 0) {
+    specLen += snprintf(specText + specLen, sizeof(specText) - specLen, "%d",
+                        spec.width);
+  }
+  if (spec.precision >= 0) {
+    specLen += snprintf(specText + specLen, sizeof(specText) - specLen,
+                        ".%d", spec.precision);
+  }
+  snprintf(specText + specLen, sizeof(specText) - specLen, "%s%c",
+           integer ? "ll" : "", spec.conversion);
+
+  switch (spec.type) {
+    case LogArgType::INT:
+      return snprintf(out, size, specText, (long long)value.i);
+    case LogArgType::UINT:
+      return snprintf(out, size, specText, (unsigned long long)value.u);
+    case LogArgType::CHAR:
+      return snprintf(out, size, specText, (int)value.i);
+    case LogArgType::DOUBLE:
+      return snprintf(out, size, specText, value.d);
+    case LogArgType::POINTER:
+      return snprintf(out, size, specText, value.p);
+    case LogArgType::STRING:
+      return snprintf(out, size, specText, value.s ? value.s : "(null)");
+    default:
+      return 0;
+  }
+}
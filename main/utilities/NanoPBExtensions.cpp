@@ -5,6 +5,7 @@
 #include <vector>    // for vector
 
 #include <pb_common.h>
+#include <pb_decode.h>
 #include <pb_encode.h>
 
 bool bell::nanopb::encodeString(pb_ostream_t* stream, const pb_field_t* field,
@@ -56,4 +57,11 @@ bool bell::nanopb::encodeVector(pb_ostream_t* stream, const pb_field_t* field,
   }
 
   return true;
-}
\ No newline at end of file
+}
+bool bell::nanopb::decodeString(pb_istream_t* stream, const pb_field_t* field,
+                                void** arg) {
+  auto& str = *static_cast<std::string*>(*arg);
+
+  str.resize(stream->bytes_left);
+  return pb_read(stream, (pb_byte_t*)str.data(), str.size());
+}
@@ -2,7 +2,8 @@
 
 #include <stdlib.h>   // for malloc
 #include <string.h>   // for strcpy, memcpy, strlen
-#include <algorithm>  // for copy
+#include <algorithm>  // for copy, max, min
+#include <cstddef>    // for max_align_t
 #include <cstdint>    // for uint8_t
 
 #include "pb_encode.h"  // for pb_ostream_s, pb_encode, pb_get_encoded_size
@@ -28,15 +29,60 @@ pb_ostream_t pb_ostream_from_vector(std::vector<uint8_t>& vec) {
   return stream;
 }
 
+static bool byteStreamRead(pb_istream_t* stream, pb_byte_t* buf,
+                           size_t count) {
+  auto* source = reinterpret_cast<bell::ByteStream*>(stream->state);
+
+  while (count > 0) {
+    size_t read = source->read(buf, count);
+    if (read == 0) {
+      // nanopb tells a clean end from a truncated message by bytes_left
+      stream->bytes_left = 0;
+      return false;
+    }
+    buf += read;
+    count -= read;
+  }
+
+  return true;
+}
+
+pb_istream_t pb_istream_from_stream(bell::ByteStream& stream, size_t size) {
+  pb_istream_t istream = PB_ISTREAM_EMPTY;
+
+  istream.callback = &byteStreamRead;
+  istream.state = &stream;
+  istream.bytes_left = size;
+
+  return istream;
+}
+
 std::vector<uint8_t> pbEncode(const pb_msgdesc_t* fields,
                               const void* src_struct) {
   std::vector<uint8_t> vecData(0);
-  pb_ostream_t stream = pb_ostream_from_vector(vecData);
-  pb_encode(&stream, fields, src_struct);
+  pbEncode(fields, src_struct, vecData);
 
   return vecData;
 }
 
+bool pbEncode(const pb_msgdesc_t* fields, const void* src_struct,
+              std::vector<uint8_t>& out) {
+  size_t size;
+  if (!pb_get_encoded_size(&size, fields, src_struct)) {
+    out.clear();
+    return false;
+  }
+  out.resize(size);
+  pb_ostream_t stream = pb_ostream_from_buffer(out.data(), out.size());
+  if (!pb_encode(&stream, fields, src_struct)) {
+    out.clear();
+    return false;
+  }
+  // Callback fields may not give the same size twice
+  out.resize(stream.bytes_written);
+  return true;
+}
+
 void packString(char*& dst, std::string stringToPack) {
   dst = (char*)malloc((strlen(stringToPack.c_str()) + 1) * sizeof(char));
   strcpy(dst, stringToPack.c_str());
@@ -51,6 +97,22 @@ pb_bytes_array_t* vectorToPbArray(const std::vector<uint8_t>& vectorToPack) {
   return result;
 }
 
+void packString(char*& dst, const std::string& stringToPack,
+                bell::nanopb::Arena& arena) {
+  dst = (char*)arena.allocate(stringToPack.size() + 1);
+  pbPutString(stringToPack, dst);
+}
+
+pb_bytes_array_t* vectorToPbArray(const std::vector<uint8_t>& vectorToPack,
+                                  bell::nanopb::Arena& arena) {
+  auto size = static_cast<pb_size_t>(vectorToPack.size());
+  auto result = static_cast<pb_bytes_array_t*>(
+      arena.allocate(PB_BYTES_ARRAY_T_ALLOCSIZE(size)));
+  result->size = size;
+  memcpy(result->bytes, vectorToPack.data(), size);
+  return result;
+}
+
 void pbPutString(const std::string& stringToPack, char* dst) {
   stringToPack.copy(dst, stringToPack.size());
   dst[stringToPack.size()] = '\0';
@@ -79,4 +141,93 @@ const char* pb_encode_to_string(const pb_msgdesc_t* fields, const void* data) {
   pb_encode(&ostream, fields, data);
   buf[len] = '\0';
   return reinterpret_cast<const char*>(buf);
-}
\ No newline at end of file
+}
+using namespace bell::nanopb;
+
+// Arena pb_realloc() allocates from, per thread so decodes don't mix
+static thread_local Arena* currentArena = nullptr;
+
+// Every allocation starts with its size, reallocate() copies that much
+static constexpr size_t ALLOCATION_HEADER = alignof(std::max_align_t);
+
+Arena::Arena(size_t blockSize) : blockSize(blockSize) {}
+
+void* Arena::allocate(size_t size) {
+  size_t needed = (ALLOCATION_HEADER + size + ALLOCATION_HEADER - 1) /
+                  ALLOCATION_HEADER * ALLOCATION_HEADER;
+  if (blocks.empty() || blocks.back().size - blocks.back().used < needed) {
+    // Big fields get a block of their own
+    size_t size = std::max(blockSize, needed);
+    blocks.push_back({std::unique_ptr<uint8_t[]>(new uint8_t[size]), size, 0});
+  }
+  Block& block = blocks.back();
+  last = block.data.get() + block.used;
+  block.used += needed;
+  memcpy(last, &size, sizeof(size));
+  return last + ALLOCATION_HEADER;
+}
+
+void* Arena::reallocate(void* ptr, size_t size) {
+  if (ptr == nullptr) {
+    return allocate(size);
+  }
+  uint8_t* start = (uint8_t*)ptr - ALLOCATION_HEADER;
+  size_t previous;
+  memcpy(&previous, start, sizeof(previous));
+
+  Block& block = blocks.back();
+  size_t needed = (ALLOCATION_HEADER + size + ALLOCATION_HEADER - 1) /
+                  ALLOCATION_HEADER * ALLOCATION_HEADER;
+  if (start == last && start - block.data.get() + needed <= block.size) {
+    block.used = start - block.data.get() + needed;
+    memcpy(start, &size, sizeof(size));
+    return ptr;
+  }
+
+  void* moved = allocate(size);
+  memcpy(moved, ptr, std::min(previous, size));
+  return moved;
+}
+
+bool Arena::owns(const void* ptr) const {
+  for (auto& block : blocks) {
+    if (ptr >= block.data.get() && ptr < block.data.get() + block.size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Arena::reset() {
+  if (blocks.size() > 1) {
+    blocks.resize(1);
+  }
+  if (!blocks.empty()) {
+    blocks[0].used = 0;
+  }
+  last = nullptr;
+}
+
+Arena::Scope::Scope(Arena& arena) : previous(currentArena) {
+  currentArena = &arena;
+}
+
+Arena::Scope::~Scope() {
+  currentArena = previous;
+}
+
+extern "C" void* bell_pb_realloc(void* ptr, size_t size) {
+  if (currentArena != nullptr &&
+      (ptr == nullptr || currentArena->owns(ptr))) {
+    return currentArena->reallocate(ptr, size);
+  }
+  return realloc(ptr, size);
+}
+
+extern "C" void bell_pb_free(void* ptr) {
+  // Arena memory goes with the arena, e.g. when a failed decode releases
+  if (currentArena != nullptr && currentArena->owns(ptr)) {
+    return;
+  }
+  free(ptr);
+}
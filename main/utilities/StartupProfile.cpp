@@ -0,0 +1,93 @@
+#include "StartupProfile.h"
+
+#include <stdio.h>  // for snprintf
+#include <mutex>    // for mutex, scoped_lock
+
+#include "BellClock.h"   // for nowUs
+#include "BellLogger.h"  // for BELL_LOG
+#include "Executor.h"    // for Executor
+
+using namespace bell;
+
+namespace {
+std::mutex stepsMutex;
+StartupProfile::Step steps[StartupProfile::MAX_STEPS];
+size_t stepCount = 0;
+uint32_t readyMs = 0;
+
+#ifndef ESP_PLATFORM
+// Taken during static initialization, as close to the start as it gets
+const int64_t processStartUs = clock::nowUs();
+#endif
+}  // namespace
+
+uint64_t StartupProfile::nowUs() {
+#ifdef ESP_PLATFORM
+  // The clock starts at boot
+  return clock::nowUs();
+#else
+  return clock::nowUs() - processStartUs;
+#endif
+}
+
+void StartupProfile::record(const char* name, uint64_t startUs,
+                            uint64_t durationUs) {
+  std::scoped_lock lock(stepsMutex);
+  if (stepCount < MAX_STEPS) {
+    steps[stepCount++] = {name, (uint32_t)(startUs / 1000),
+                          (uint32_t)durationUs};
+  }
+}
+
+void StartupProfile::markReady() {
+  std::vector<Step> recorded;
+  {
+    std::scoped_lock lock(stepsMutex);
+    if (readyMs != 0) {
+      return;
+    }
+    readyMs = (uint32_t)(nowUs() / 1000);
+    recorded.assign(steps, steps + stepCount);
+  }
+
+  for (auto& step : recorded) {
+    BELL_LOG(info, "startup", "%s at %u ms, took %u us", step.name,
+             (unsigned)step.startMs, (unsigned)step.durationUs);
+  }
+  BELL_LOG(info, "startup", "Ready %u ms after boot", (unsigned)readyMs);
+}
+
+uint32_t StartupProfile::getReadyMs() {
+  std::scoped_lock lock(stepsMutex);
+  return readyMs;
+}
+
+std::vector<StartupProfile::Step> StartupProfile::getSteps() {
+  std::scoped_lock lock(stepsMutex);
+  return std::vector<Step>(steps, steps + stepCount);
+}
+
+std::string StartupProfile::toJson() {
+  std::string json = "{\"ready_ms\":" + std::to_string(getReadyMs()) +
+                     ",\"steps\":[";
+  bool first = true;
+  // Step names are literals chosen by bell, they go in unescaped
+  for (auto& step : getSteps()) {
+    char entry[128];
+    snprintf(entry, sizeof(entry),
+             "{\"name\":\"%s\",\"start_ms\":%u,\"duration_us\":%u}",
+             step.name, (unsigned)step.startMs, (unsigned)step.durationUs);
+    json += first ? "" : ",";
+    json += entry;
+    first = false;
+  }
+  return json + "]}";
+}
+
+void StartupProfile::warmUp(const char* name,
+                            const std::function<void()>& job) {
+  Executor::instance().post(Executor::Lane::BACKGROUND, [name, job]() {
+    BELL_STARTUP_STEP(name);
+    job();
+  });
+}
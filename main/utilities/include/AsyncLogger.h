@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdarg.h>  // for va_list
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint8_t, uint32_t
+#include <atomic>    // for atomic
+#include <chrono>    // for system_clock
+#include <memory>    // for shared_ptr
+#include <mutex>     // for mutex
+#include <vector>    // for vector
+
+#include "BellLogger.h"        // for BellLogger
+#include "BellTask.h"          // for Task
+#include "LogFormat.h"         // for LogArgType, LogArgValue
+#include "SlotRing.h"          // for SlotRing
+#include "WrappedSemaphore.h"  // for WrappedSemaphore
+
+namespace bell {
+/**
+ * Deferred BellLogger. BELL_LOG only copies the format pointer and its
+ * arguments into a ring owned by the calling thread, formatting and console
+ * output happen later on a low priority task. Records of all threads are
+ * written in the order they were logged.
+ *
+ * Formats and submodules must outlive the logger, which string literals do.
+ * %s arguments are copied, up to STRING_BYTES per record, and at most
+ * MAX_ARGS arguments are kept. While a thread's ring is full its records are
+ * dropped and counted.
+ */
+class AsyncLogger : public bell::BellLogger, public bell::Task {
+ public:
+  struct Config {
+    size_t slotsPerThread = 32;
+    uint32_t flushIntervalMs = 20;
+  };
+
+  AsyncLogger() : AsyncLogger(Config()) {}
+  AsyncLogger(const Config& config);
+
+  void debug(const LogSite& site, const char* submodule, const char* format,
+             ...);
+  void error(const LogSite& site, const char* submodule, const char* format,
+             ...);
+  void info(const LogSite& site, const char* submodule, const char* format,
+            ...);
+
+  // Waits until everything logged so far is written, not from the log task
+  void flush();
+
+ private:
+  static constexpr size_t MAX_ARGS = 8;
+  static constexpr size_t STRING_BYTES = 64;
+  static constexpr size_t MESSAGE_SIZE = 256;
+
+  struct Arg {
+    LogArgType type;
+    // Strings hold their offset into Record::strings
+    LogArgValue value;
+  };
+
+  struct Record {
+    char level;
+    std::chrono::system_clock::time_point time;
+    const LogSite* site;
+    const char* submodule;
+    const char* format;
+    uint8_t argCount;
+    // Arguments didn't fit, the message is cut at the first one missing
+    bool truncated;
+    Arg args[MAX_ARGS];
+    uint8_t stringsUsed;
+    char strings[STRING_BYTES];
+  };
+
+  struct Ring {
+    Ring(size_t slots) : records(slots) {}
+
+    SlotRing<Record> records;
+    std::atomic<uint32_t> dropped = 0;
+    // The thread is gone, freed once drained
+    std::atomic<bool> orphaned = false;
+  };
+
+  Config config;
+
+  std::mutex ringsMutex;
+  std::vector<std::shared_ptr<Ring>> rings;
+
+  bell::WrappedSemaphore wakeSem;
+  std::atomic<uint32_t> flushRequests = 0;
+  std::atomic<uint32_t> flushesDone = 0;
+
+  // Registers the calling thread's ring on first use
+  Ring* threadRing();
+  void capture(char level, const LogSite& site, const char* submodule,
+               const char* format, va_list args);
+  void format(const Record& record, char* message, size_t size);
+  void drain();
+  void runTask() override;
+};
+
+// Replaces the default logger with a started AsyncLogger, levels set on the
+// previous logger are not carried over
+void setAsyncLogger();
+}  // namespace bell
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint8_t
+#include <memory>    // for unique_ptr
+#include <new>       // for bad_alloc
+
+namespace bell {
+/**
+ * Placement aware allocation of large buffers. Callers say what the memory
+ * is for with capability tags, the platform decides where it goes: on the
+ * ESP32 INTERNAL maps to on-chip SRAM, PSRAM to external RAM and DMA to
+ * memory the I2S / SPI engines can reach. Elsewhere the tags only matter
+ * for the alignment, the memory comes from the C heap.
+ *
+ * Buffers without a placement need (DEFAULT) follow the Policy by size, so
+ * that the large ones of the streams, codecs and the audio buffer move to
+ * PSRAM on boards that have it, leaving SRAM to the network stack and DSP.
+ */
+class Allocator {
+ public:
+  // Capability tags, may be combined
+  enum Caps : uint32_t {
+    // Placed by the Policy
+    DEFAULT = 0,
+    // Fast on-chip RAM, for buffers touched on every sample
+    INTERNAL = 1 << 0,
+    // External RAM, falls back to internal RAM on boards without it
+    PSRAM = 1 << 1,
+    // Reachable by DMA, in internal RAM. No fallback
+    DMA = 1 << 2,
+  };
+
+  struct Policy {
+    // DEFAULT allocations of at least this many bytes get largeCaps, the
+    // others smallCaps
+    size_t largeThreshold;
+    uint32_t largeCaps;
+    uint32_t smallCaps;
+  };
+
+  /**
+   * @param caps Caps tags the memory needs
+   * @param alignment power of two, 0 for the heap's default alignment
+   * @returns nullptr when the allocation fails, like malloc()
+   */
+  static void* allocate(size_t size, uint32_t caps = DEFAULT,
+                        size_t alignment = 0);
+  // Frees memory of allocate(), nullptr is ignored
+  static void release(void* buffer);
+
+  /**
+   * Replaces the placement of DEFAULT allocations. Meant for startup, the
+   * policy is read without synchronization
+   */
+  static void setPolicy(const Policy& policy);
+  static Policy getPolicy() { return policy; }
+
+  struct Deleter {
+    void operator()(void* buffer) const { release(buffer); }
+  };
+  typedef std::unique_ptr<uint8_t[], Deleter> Buffer;
+
+  /**
+   * Same as allocate(), owned by the returned Buffer
+   * @throws std::bad_alloc when the allocation fails
+   */
+  static Buffer allocateBuffer(size_t size, uint32_t caps = DEFAULT,
+                               size_t alignment = 0);
+
+ private:
+  static Policy policy;
+};
+
+/**
+ * Standard allocator on top of Allocator, e.g. for the std::vector of a
+ * large table: std::vector<float, CapsAllocator<float, Allocator::PSRAM>>.
+ * Honours the alignment of T.
+ */
+template <typename T, uint32_t Caps = Allocator::DEFAULT>
+class CapsAllocator {
+ public:
+  typedef T value_type;
+
+  // Required, allocator_traits can't rebind over the Caps parameter
+  template <typename U>
+  struct rebind {
+    typedef CapsAllocator<U, Caps> other;
+  };
+
+  CapsAllocator() = default;
+  template <typename U>
+  CapsAllocator(const CapsAllocator<U, Caps>&) {}
+
+  T* allocate(size_t count) {
+    void* buffer = Allocator::allocate(count * sizeof(T), Caps, alignof(T));
+    if (buffer == nullptr) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(buffer);
+  }
+
+  void deallocate(T* buffer, size_t) { Allocator::release(buffer); }
+
+  template <typename U>
+  bool operator==(const CapsAllocator<U, Caps>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const CapsAllocator<U, Caps>&) const {
+    return false;
+  }
+};
+}  // namespace bell
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint8_t, uint32_t, SIZE_MAX
+#include <algorithm>  // for min
+#include <atomic>     // for atomic
+#include <mutex>      // for mutex
+#include <span>       // for span
+#include <utility>    // for exchange
+#include <vector>     // for vector
+
+#include "BellAllocator.h"  // for Allocator
+#include "BellMetrics.h"    // for MemoryAccount
+
+namespace bell {
+class BufferPool;
+class BufferSlice;
+
+/**
+ * Refcounted block of bytes, to hand data from one subsystem to the next
+ * without copying it: a socket reads into one, a container hands slices of
+ * it to the codec, an HTTP response or an MQTT publish holds it until it's
+ * sent. Copies of a Buffer share the block, the last one to go frees it, or
+ * gives it back to the BufferPool it came from.
+ *
+ * The refcount and the size live in front of the bytes, one allocation per
+ * block. Whoever fills a buffer does it while it's the only holder, before
+ * handing out slices; from then on it's read only, and any thread may read
+ * and drop its references.
+ */
+class Buffer {
+ public:
+  Buffer() = default;
+  Buffer(const Buffer& other) : block(other.block) { retain(); }
+  Buffer(Buffer&& other) : block(std::exchange(other.block, nullptr)) {}
+  Buffer& operator=(const Buffer& other) {
+    if (block != other.block) {
+      release();
+      block = other.block;
+      retain();
+    }
+    return *this;
+  }
+  Buffer& operator=(Buffer&& other) {
+    if (this != &other) {
+      release();
+      block = std::exchange(other.block, nullptr);
+    }
+    return *this;
+  }
+  ~Buffer() { release(); }
+
+  /**
+   * A block of its own, freed with its last reference
+   * @param caps Allocator::Caps the bytes need, e.g. DMA for a sink's
+   * @throws std::bad_alloc when the allocation fails
+   */
+  static Buffer allocate(size_t size, uint32_t caps = Allocator::DEFAULT);
+
+  uint8_t* data() const { return block ? (uint8_t*)block + HEADER : nullptr; }
+  size_t size() const { return block ? block->size : 0; }
+  explicit operator bool() const { return block != nullptr; }
+
+  // Safe to write to, no slice or copy shares the bytes
+  bool unique() const {
+    return block && block->refs.load(std::memory_order_acquire) == 1;
+  }
+
+  // Shares length bytes from offset, clipped to the buffer
+  BufferSlice slice(size_t offset = 0, size_t length = SIZE_MAX) const;
+
+ private:
+  friend class BufferPool;
+
+  struct Block {
+    std::atomic<uint32_t> refs;
+    size_t size;
+    // Takes the block back, nullptr when it's freed instead
+    BufferPool* pool;
+  };
+  // Bytes start past the header, at an alignment fit for any sample type
+  static constexpr size_t ALIGNMENT = 16;
+  static constexpr size_t HEADER =
+      (sizeof(Block) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+
+  Block* block = nullptr;
+
+  explicit Buffer(Block* block) : block(block) {}
+  void retain() {
+    if (block) {
+      block->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  void release();
+};
+
+/**
+ * Read only window on a Buffer, holding a reference to it. Cheap to copy
+ * and to narrow, what a stage parses out of a block is handed on as a
+ * slice of it.
+ */
+class BufferSlice {
+ public:
+  BufferSlice() = default;
+
+  const uint8_t* data() const { return buffer.data() + offset; }
+  size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+  std::span<const uint8_t> view() const { return {data(), length}; }
+
+  // Shares length bytes from offset within this slice, clipped to it
+  BufferSlice slice(size_t offset, size_t length = SIZE_MAX) const {
+    offset = std::min(offset, this->length);
+    return BufferSlice(buffer, this->offset + offset,
+                       std::min(length, this->length - offset));
+  }
+
+  // The whole block the slice is part of
+  const Buffer& getBuffer() const { return buffer; }
+
+ private:
+  friend class Buffer;
+
+  Buffer buffer;
+  size_t offset = 0;
+  size_t length = 0;
+
+  BufferSlice(const Buffer& buffer, size_t offset, size_t length)
+      : buffer(buffer), offset(offset), length(length) {}
+};
+
+inline BufferSlice Buffer::slice(size_t offset, size_t length) const {
+  offset = std::min(offset, size());
+  return BufferSlice(*this, offset, std::min(length, size() - offset));
+}
+
+/**
+ * Blocks of one size handed out over and over, e.g. one per socket read or
+ * per decoded frame. Up to maxIdle blocks given back are kept for the next
+ * acquire(), the long running streams don't go through the heap for each
+ * block. With BELL_METRICS the bytes it holds are the gauge "mem.<name>".
+ *
+ * Must outlive the buffers it hands out, like an ObjectPool.
+ */
+class BufferPool {
+ public:
+  /**
+   * @param bufferSize bytes of every block
+   * @param caps Allocator::Caps of the blocks
+   */
+  BufferPool(const char* name, size_t bufferSize, size_t maxIdle,
+             uint32_t caps = Allocator::DEFAULT);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /**
+   * An idle block when there's one, a new one otherwise
+   * @throws std::bad_alloc when the allocation fails
+   */
+  Buffer acquire();
+
+  size_t getBufferSize() const { return bufferSize; }
+
+  // Frees the idle blocks, e.g. when playback stops
+  void trim();
+
+ private:
+  friend class Buffer;
+
+  const size_t bufferSize;
+  const size_t maxIdle;
+  const uint32_t caps;
+
+  std::mutex poolMutex;
+  std::vector<Buffer::Block*> idleBlocks;
+  // Blocks out and idle
+  size_t blocks = 0;
+  MemoryAccount memory;
+
+  // From the last reference to a block of the pool
+  void recycle(Buffer::Block* block);
+};
+}  // namespace bell
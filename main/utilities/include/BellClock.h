@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>  // for int64_t, uint32_t
+#include <chrono>    // for nanoseconds, time_point
+#include <mutex>     // for mutex
+
+namespace bell {
+namespace clock {
+/**
+ * Monotonic time in nanoseconds, since an unspecified epoch (boot on most
+ * platforms). Never jumps with NTP or the user setting the time, for
+ * intervals, timeouts and timestamps compared on the same device.
+ *
+ * clock_gettime(CLOCK_MONOTONIC) on POSIX, esp_timer on ESP32 (µs steps),
+ * QueryPerformanceCounter on Windows.
+ */
+int64_t nowNs();
+
+inline int64_t nowUs() {
+  return nowNs() / 1000;
+}
+
+inline int64_t nowMs() {
+  return nowNs() / 1000000;
+}
+
+// nowNs() as a std::chrono clock, in place of steady_clock
+struct Monotonic {
+  using duration = std::chrono::nanoseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<Monotonic>;
+  static constexpr bool is_steady = true;
+
+  static time_point now() { return time_point(duration(nowNs())); }
+};
+
+/**
+ * Media position, in frames of the stream's rate, locked to where the output
+ * actually is. The output reports the frame it plays now, e.g. the frames
+ * fed to a sink minus its queuedFrames(), and anything to keep in sync with
+ * the audio (video, lyrics, the other devices of a group) reads the
+ * position back at any time in between.
+ *
+ * Between updates the position advances at the nominal rate, corrected by
+ * the drift measured between the output's clock and nowNs(). Small errors
+ * are slewed out, a seek or an underrun re-anchors. Thread safe. The
+ * reverse, steering the output to given timestamps, is PlaybackClock's.
+ */
+class MediaClock {
+ public:
+  struct Config {
+    // Error beyond which update() re-anchors instead of slewing, in ms
+    uint32_t resyncMs = 50;
+    // Share of the error removed by each update
+    double slewGain = 0.1;
+    // Bound of the measured drift, in ppm
+    double maxDriftPpm = 1000;
+  };
+
+  MediaClock() : MediaClock(Config()) {}
+  MediaClock(const Config& config);
+
+  // Starts over at position, running unless paused
+  void reset(uint32_t rate, int64_t position = 0, int64_t localNs = nowNs());
+  // The output played position at localNs
+  void update(int64_t position, int64_t localNs = nowNs());
+
+  // Freezes the position, for a paused output
+  void pause(int64_t localNs = nowNs());
+  void resume(int64_t localNs = nowNs());
+
+  int64_t positionAt(int64_t localNs) const;
+  int64_t position() const { return positionAt(nowNs()); }
+  // Local time position plays at, or played at
+  int64_t localNsAt(int64_t position) const;
+
+  uint32_t getRate() const;
+  // Output clock against nowNs(), positive when the output runs fast
+  double getDriftPpm() const;
+
+ private:
+  Config config;
+  mutable std::mutex clockMutex;
+  uint32_t rate = 0;
+  bool paused = false;
+  // Position at anchorNs, the line the position follows from there
+  double anchorPosition = 0;
+  int64_t anchorNs = 0;
+  // Shortest span the drift is measured over
+  static constexpr int64_t DRIFT_BASELINE_NS = 2000000000;
+
+  // Media rate over nominal
+  double ratio = 1.0;
+  // Report the drift is measured from, the first since re-anchoring
+  int64_t basePosition = 0;
+  int64_t baseNs = 0;
+  bool hasBase = false;
+  // Sums of the reports since, in s and frames from the base
+  struct {
+    double n, t, p, tt, tp;
+  } fit = {};
+
+  double positionAtLocked(int64_t localNs) const;
+};
+}  // namespace clock
+}  // namespace bell
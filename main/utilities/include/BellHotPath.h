@@ -0,0 +1,24 @@
+#pragma once
+
+/**
+ * Placement of the audio hot path on ESP32, with BELL_IRAM_HOT_PATH.
+ *
+ * Code running from flash goes through the cache, and a miss waits on the
+ * SPI bus that Wi-Fi, PSRAM and flash writes (NVS, OTA) also use. BELL_HOT
+ * puts a function in IRAM and BELL_HOT_DATA a constant table in DRAM, so
+ * the ring, DSP and sink code that keeps the DMA buffers filled never
+ * waits on it. Callees still come from flash unless marked too, and IRAM is
+ * scarce: only mark per-sample loops and the tables they index.
+ *
+ * Empty elsewhere and in the default build. The bell_iram_report target
+ * prints what the profile costs.
+ */
+#if defined(ESP_PLATFORM) && defined(BELL_IRAM_HOT_PATH)
+#include "esp_attr.h"  // for IRAM_ATTR, DRAM_ATTR
+
+#define BELL_HOT IRAM_ATTR
+#define BELL_HOT_DATA DRAM_ATTR
+#else
+#define BELL_HOT
+#define BELL_HOT_DATA
+#endif
@@ -2,13 +2,87 @@
 #define BELL_LOGGER_H
 
 #include <stdarg.h>  // for va_end, va_list, va_start
+#include <stdint.h>  // for uint32_t
 #include <stdio.h>   // for printf, vprintf
-#include <chrono>
-#include <iomanip>
-#include <iostream>
-#include <string>  // for string, basic_string
+#include <time.h>    // for strftime, gmtime, localtime
+#include <atomic>    // for atomic
+#include <chrono>    // for system_clock
+#include <map>       // for map
+#include <mutex>     // for mutex
+#include <string>    // for string, basic_string
+
+// Levels for BELL_LOG_MAX_LEVEL and AbstractLogger::setLevel
+#define BELL_LOG_LEVEL_NONE 0
+#define BELL_LOG_LEVEL_ERROR 1
+#define BELL_LOG_LEVEL_INFO 2
+#define BELL_LOG_LEVEL_DEBUG 3
+
+// BELL_LOG calls above this level are compiled out
+#ifndef BELL_LOG_MAX_LEVEL
+#define BELL_LOG_MAX_LEVEL BELL_LOG_LEVEL_DEBUG
+#endif
 
 namespace bell {
+// Maps the BELL_LOG type token to its level
+constexpr int logLevel_error = BELL_LOG_LEVEL_ERROR;
+constexpr int logLevel_info = BELL_LOG_LEVEL_INFO;
+constexpr int logLevel_debug = BELL_LOG_LEVEL_DEBUG;
+
+/**
+ * What BELL_LOG knows about its call site at compile time, one static
+ * instance per call. Also caches the site's runtime level.
+ */
+struct LogSite {
+  static constexpr int NColors = 15;
+  static constexpr int allColors[NColors] = {31, 32, 33, 34, 35, 36, 37, 90,
+                                             91, 92, 93, 94, 95, 96, 97};
+
+  const char* filename;
+  const char* basename;
+  int line;
+  // Filename colour, from a hash of the basename
+  int color;
+  // Same in every build of the sources, see scripts/bell_log_decode.py
+  uint32_t id;
+
+  // AbstractLogger::levelsGeneration the level was resolved for
+  std::atomic<uint32_t> generation = 0;
+  std::atomic<int> level = BELL_LOG_LEVEL_NONE;
+
+  constexpr LogSite(const char* filename, int line)
+      : filename(filename),
+        basename(findBasename(filename)),
+        line(line),
+        color(hashColor(findBasename(filename))),
+        id(hashId(findBasename(filename), line)) {}
+
+  static constexpr const char* findBasename(const char* path) {
+    const char* basename = path;
+    for (const char* c = path; *c; c++) {
+      if (*c == '/' || *c == '\\') {
+        basename = c + 1;
+      }
+    }
+    return basename;
+  }
+
+  static constexpr int hashColor(const char* basename) {
+    unsigned long hash = 5381;
+    for (const char* c = basename; *c; c++) {
+      hash = ((hash << 5) + hash) + *c; /* hash * 33 + c */
+    }
+    return allColors[hash % NColors];
+  }
+
+  // FNV-1a of the basename, then of the line
+  static constexpr uint32_t hashId(const char* basename, int line) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = basename; *c; c++) {
+      hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return (hash ^ (uint32_t)line) * 16777619u;
+  }
+};
 
 class AbstractLogger {
  public:
@@ -16,30 +90,44 @@ class AbstractLogger {
   bool enableTimestamp = false;
   bool shortTime = false;
 
-  virtual void debug(std::string filename, int line, std::string submodule,
+  virtual void debug(const LogSite& site, const char* submodule,
                      const char* format, ...) = 0;
-  virtual void error(std::string filename, int line, std::string submodule,
+  virtual void error(const LogSite& site, const char* submodule,
                      const char* format, ...) = 0;
-  virtual void info(std::string filename, int line, std::string submodule,
+  virtual void info(const LogSite& site, const char* submodule,
                     const char* format, ...) = 0;
+
+  // Runtime level of submodules without their own, BELL_LOG_LEVEL_*
+  void setLevel(int level);
+  void setLevel(const char* submodule, int level);
+
+  // A site's submodule is expected not to change between calls
+  bool isEnabled(int level, LogSite& site, const char* submodule) {
+    uint32_t current = levelsGeneration.load(std::memory_order_acquire);
+    if (site.generation.load(std::memory_order_acquire) != current) {
+      site.level.store(levelOf(submodule), std::memory_order_relaxed);
+      site.generation.store(current, std::memory_order_release);
+    }
+    return level <= site.level.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::mutex levelsMutex;
+  int defaultLevel = BELL_LOG_LEVEL_DEBUG;
+  std::map<std::string, int, std::less<>> levels;
+  // Bumped on every level change, sites start at 0
+  std::atomic<uint32_t> levelsGeneration = 1;
+
+  int levelOf(const char* submodule);
 };
 
 extern bell::AbstractLogger* bellGlobalLogger;
 class BellLogger : public bell::AbstractLogger {
  public:
   // static bool enableColors = true;
-  void debug(std::string filename, int line, std::string submodule,
-             const char* format, ...) {
-    printTimestamp();
-
-    printf(colorRed);
-    printf("D ");
-    if (enableSubmodule) {
-      printf(colorReset);
-      printf("[%s] ", submodule.c_str());
-    }
-    printFilename(filename);
-    printf(":%d: ", line);
+  void debug(const LogSite& site, const char* submodule, const char* format,
+             ...) {
+    printPrefix('D', std::chrono::system_clock::now(), site, submodule);
     va_list args;
     va_start(args, format);
     vprintf(format, args);
@@ -47,19 +135,9 @@ class BellLogger : public bell::AbstractLogger {
     printf("\n");
   };
 
-  void error(std::string filename, int line, std::string submodule,
-             const char* format, ...) {
-    printTimestamp();
-
-    printf(colorRed);
-    printf("E ");
-    if (enableSubmodule) {
-      printf(colorReset);
-      printf("[%s] ", submodule.c_str());
-    }
-    printFilename(filename);
-    printf(":%d: ", line);
-    printf(colorRed);
+  void error(const LogSite& site, const char* submodule, const char* format,
+             ...) {
+    printPrefix('E', std::chrono::system_clock::now(), site, submodule);
     va_list args;
     va_start(args, format);
     vprintf(format, args);
@@ -67,19 +145,9 @@ class BellLogger : public bell::AbstractLogger {
     printf("\n");
   };
 
-  void info(std::string filename, int line, std::string submodule,
-            const char* format, ...) {
-    printTimestamp();
-
-    printf(colorBlue);
-    printf("I ");
-    if (enableSubmodule) {
-      printf(colorReset);
-      printf("[%s] ", submodule.c_str());
-    }
-    printFilename(filename);
-    printf(":%d: ", line);
-    printf(colorReset);
+  void info(const LogSite& site, const char* submodule, const char* format,
+            ...) {
+    printPrefix('I', std::chrono::system_clock::now(), site, submodule);
     va_list args;
     va_start(args, format);
     vprintf(format, args);
@@ -87,52 +155,53 @@ class BellLogger : public bell::AbstractLogger {
     printf("\n");
   };
 
-  void printTimestamp() {
+  // Everything before the message, leaves the message's colour set
+  void printPrefix(char level, std::chrono::system_clock::time_point time,
+                   const LogSite& site, const char* submodule) {
+    printTimestamp(time);
+
+    printf(level == 'I' ? colorBlue : colorRed);
+    printf("%c ", level);
+    if (enableSubmodule) {
+      printf(colorReset);
+      printf("[%s] ", submodule);
+    }
+    printf("\033[0;%dm", site.color);
+    printf("%s", site.basename);
+    printf(colorReset);
+    printf(":%d: ", site.line);
+    if (level == 'E') {
+      printf(colorRed);
+    } else if (level == 'I') {
+      printf(colorReset);
+    }
+  }
+
+  void printTimestamp(std::chrono::system_clock::time_point time) {
     if (enableTimestamp) {
-      auto now = std::chrono::system_clock::now();
-      time_t now_time = std::chrono::system_clock::to_time_t(now);
+      time_t now_time = std::chrono::system_clock::to_time_t(time);
       const auto nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
-                             now.time_since_epoch()) %
+                             time.time_since_epoch()) %
                          1000;
 
       printf(colorReset);
       struct tm* gmt_time;
+      char formatted[24];
       if (shortTime) {
         gmt_time = localtime(&now_time);
-        std::cout << std::put_time(gmt_time, "[%H:%M:%S") << '.'
-                  << std::setfill('0') << std::setw(3) << nowMs.count() << "] ";
+        strftime(formatted, sizeof(formatted), "%H:%M:%S", gmt_time);
       } else {
         gmt_time = gmtime(&now_time);
-        std::cout << std::put_time(gmt_time, "[%Y-%m-%d %H:%M:%S") << '.'
-                  << std::setfill('0') << std::setw(3) << nowMs.count() << "] ";
+        strftime(formatted, sizeof(formatted), "%Y-%m-%d %H:%M:%S", gmt_time);
       }
+      printf("[%s.%03d] ", formatted, (int)nowMs.count());
     }
   }
 
-  void printFilename(std::string filename) {
-#ifdef _WIN32
-    std::string basenameStr(filename.substr(filename.rfind("\\") + 1));
-#else
-    std::string basenameStr(filename.substr(filename.rfind("/") + 1));
-#endif
-    unsigned long hash = 5381;
-    for (char const& c : basenameStr) {
-      hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-    }
-
-    printf("\033[0;%dm", allColors[hash % NColors]);
-
-    printf("%s", basenameStr.c_str());
-    printf(colorReset);
-  }
-
  private:
   static constexpr const char* colorReset = "\033[0m";
   static constexpr const char* colorRed = "\033[0;31m";
   static constexpr const char* colorBlue = "\033[0;34m";
-  static constexpr const int NColors = 15;
-  static constexpr int allColors[NColors] = {31, 32, 33, 34, 35, 36, 37, 90,
-                                             91, 92, 93, 94, 95, 96, 97};
 };
 
 void setDefaultLogger();
@@ -140,9 +209,15 @@ void enableSubmoduleLogging();
 void enableTimestampLogging(bool local = false);
 }  // namespace bell
 
-#define BELL_LOG(type, ...)                                        \
-  do {                                                             \
-    bell::bellGlobalLogger->type(__FILE__, __LINE__, __VA_ARGS__); \
+#define BELL_LOG(type, submodule, ...)                                    \
+  do {                                                                    \
+    if constexpr (bell::logLevel_##type <= BELL_LOG_MAX_LEVEL) {          \
+      static bell::LogSite bellLogSite(__FILE__, __LINE__);               \
+      if (bell::bellGlobalLogger->isEnabled(bell::logLevel_##type,        \
+                                            bellLogSite, submodule)) {    \
+        bell::bellGlobalLogger->type(bellLogSite, submodule, __VA_ARGS__); \
+      }                                                                   \
+    }                                                                     \
   } while (0)
 
 #endif
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, uint64_t, int32_t
+#include <atomic>    // for atomic, memory_order_relaxed
+#include <map>       // for map
+#include <memory>    // for unique_ptr
+#include <mutex>     // for mutex
+#include <string>    // for string
+
+#include "BellClock.h"  // for nowNs
+
+namespace bell {
+/**
+ * Events that happened, e.g. underruns. 32-bit, so that even the ESP32 can
+ * count from an interrupt.
+ *
+ * On hosts every thread adds to a shard of its own, on its own cache line,
+ * so threads counting the same event don't bounce the line between cores;
+ * get() sums the shards. The ESP32 has one shard, two cores barely contend
+ * and an interrupt has no thread to pick a shard by.
+ */
+class MetricCounter {
+ public:
+  void add(uint32_t n = 1) {
+    shards[shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+  }
+  uint32_t get() const;
+  void reset();
+
+ private:
+#ifdef ESP_PLATFORM
+  static constexpr size_t SHARDS = 1;
+#else
+  static constexpr size_t SHARDS = 8;
+#endif
+
+  struct alignas(64) Shard {
+    std::atomic<uint32_t> value = 0;
+  };
+  Shard shards[SHARDS];
+
+  // Threads take shards in turn, the ninth shares the first's
+  static size_t shardIndex() {
+    if constexpr (SHARDS == 1) {
+      return 0;
+    } else {
+      static std::atomic<size_t> nextShard = 0;
+      thread_local size_t shard =
+          nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+      return shard;
+    }
+  }
+};
+
+// Last value of a level, e.g. a buffer fill, with its extremes
+class MetricGauge {
+ public:
+  void set(int32_t level);
+  // Moves the level by delta, safe with several writers
+  void add(int32_t delta);
+  int32_t get() const { return value.load(std::memory_order_relaxed); }
+  int32_t getMin() const { return min.load(std::memory_order_relaxed); }
+  int32_t getMax() const { return max.load(std::memory_order_relaxed); }
+  // Extremes start over from the current value
+  void reset();
+
+ private:
+  std::atomic<int32_t> value = 0;
+  std::atomic<int32_t> min = INT32_MAX;
+  std::atomic<int32_t> max = INT32_MIN;
+};
+
+/**
+ * Durations in ns, in power of two buckets: bucket i holds [2^i, 2^(i+1)).
+ * Recording is a few relaxed atomics, not for interrupts.
+ */
+class MetricHistogram {
+ public:
+  static constexpr size_t BUCKETS = 32;
+
+  void record(uint64_t ns);
+  uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+  uint64_t getSum() const { return sum.load(std::memory_order_relaxed); }
+  uint64_t getMax() const { return max.load(std::memory_order_relaxed); }
+  uint64_t getBucket(size_t i) const {
+    return buckets[i].load(std::memory_order_relaxed);
+  }
+  // Upper bound of the bucket holding the given quantile, 0 to 1
+  uint64_t getQuantile(float quantile) const;
+  void reset();
+
+ private:
+  std::atomic<uint32_t> buckets[BUCKETS] = {};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> max = 0;
+};
+
+// Receives every metric from Metrics::visit(), to export them elsewhere
+class MetricsVisitor {
+ public:
+  virtual ~MetricsVisitor() = default;
+  virtual void onCounter(const std::string& name,
+                         const MetricCounter& counter) = 0;
+  virtual void onGauge(const std::string& name, const MetricGauge& gauge) = 0;
+  virtual void onHistogram(const std::string& name,
+                           const MetricHistogram& histogram) = 0;
+};
+
+/**
+ * Process-wide registry of named metrics. Lookups take a lock, call sites
+ * resolve a metric once (the BELL_METRIC_ macros cache it in a static) and
+ * then only touch its atomics. Metrics are never removed, references stay
+ * valid for the life of the process.
+ *
+ * Names are dot separated, "<stage>.<what>", e.g. "alsa.xruns". Without
+ * BELL_METRICS the macros compile to nothing, a build only pays for the
+ * stages it instruments on purpose.
+ */
+class Metrics {
+ public:
+  static MetricCounter& counter(const std::string& name);
+  static MetricGauge& gauge(const std::string& name);
+  static MetricHistogram& histogram(const std::string& name);
+
+  // In name order, counters first, then gauges and histograms
+  static void visit(MetricsVisitor& visitor);
+
+  /**
+   * Every metric as one JSON object, for BellHTTPServer::registerMetrics()
+   * and BellMQTTClient::publishMetrics(). Histograms give count, mean, p50,
+   * p99 and max, in ns.
+   */
+  static std::string toJson();
+
+  /**
+   * Every metric in Prometheus' text format, for a scraper of
+   * BellHTTPServer::registerPrometheusMetrics(). Names get a "bell_" prefix
+   * and underscores for dots, "alsa.xruns" is bell_alsa_xruns_total.
+   * Gauges come with _min and _max gauges, histograms with their buckets
+   * as cumulative counts up to the highest one used, bounds in ns.
+   */
+  static std::string toPrometheus();
+
+  // Counters to 0, gauge extremes and histograms start over
+  static void reset();
+
+  /**
+   * Updates the "heap.<region>.*" gauges, free bytes, lowest free ever and
+   * largest free block of the internal, PSRAM and DMA capable heaps. ESP32
+   * only, called before the metrics are served or published
+   */
+  static void sampleHeap();
+
+ private:
+  Metrics() = default;
+
+  std::mutex registryMutex;
+  std::map<std::string, std::unique_ptr<MetricCounter>, std::less<>> counters;
+  std::map<std::string, std::unique_ptr<MetricGauge>, std::less<>> gauges;
+  std::map<std::string, std::unique_ptr<MetricHistogram>, std::less<>>
+      histograms;
+
+  static Metrics& instance();
+};
+
+/**
+ * Bytes a subsystem holds, on the gauge "mem.<subsystem>": its value is
+ * what the subsystem holds now, its max the peak. An owner keeps one next
+ * to the buffer it counts, its bytes are given back when it goes. Does
+ * nothing without BELL_METRICS.
+ */
+class MemoryAccount {
+ public:
+  MemoryAccount(const char* subsystem);
+  ~MemoryAccount() { resize(0); }
+
+  MemoryAccount(const MemoryAccount&) = delete;
+  MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+  // Sets the bytes counted, e.g. after the buffer was reallocated
+  void resize(size_t bytes);
+
+ private:
+#ifdef BELL_METRICS
+  MetricGauge& gauge;
+  size_t bytes = 0;
+#endif
+};
+
+#ifndef BELL_METRICS
+inline MemoryAccount::MemoryAccount(const char* subsystem) {}
+inline void MemoryAccount::resize(size_t bytes) {}
+#endif
+
+// Records the time until it goes out of scope
+class MetricTimer {
+ public:
+  MetricTimer(MetricHistogram& histogram)
+      : histogram(histogram), start(clock::nowNs()) {}
+  ~MetricTimer() { histogram.record(clock::nowNs() - start); }
+
+ private:
+  MetricHistogram& histogram;
+  int64_t start;
+};
+}  // namespace bell
+
+#define BELL_METRIC_CONCAT_(a, b) a##b
+#define BELL_METRIC_CONCAT(a, b) BELL_METRIC_CONCAT_(a, b)
+
+#ifdef BELL_METRICS
+#define BELL_METRIC_COUNT(name, n)                                         \
+  do {                                                                     \
+    static bell::MetricCounter& bellMetric = bell::Metrics::counter(name); \
+    bellMetric.add(n);                                                     \
+  } while (0)
+
+#define BELL_METRIC_GAUGE(name, level)                                 \
+  do {                                                                 \
+    static bell::MetricGauge& bellMetric = bell::Metrics::gauge(name); \
+    bellMetric.set(level);                                             \
+  } while (0)
+
+// Times the rest of the enclosing scope
+#define BELL_METRIC_SCOPE(name)                                            \
+  static bell::MetricHistogram& BELL_METRIC_CONCAT(bellMetric, __LINE__) = \
+      bell::Metrics::histogram(name);                                      \
+  bell::MetricTimer BELL_METRIC_CONCAT(bellMetricTimer, __LINE__)(         \
+      BELL_METRIC_CONCAT(bellMetric, __LINE__))
+#else
+#define BELL_METRIC_COUNT(name, n) \
+  do {                             \
+  } while (0)
+#define BELL_METRIC_GAUGE(name, level) \
+  do {                                 \
+  } while (0)
+#define BELL_METRIC_SCOPE(name) \
+  do {                          \
+  } while (0)
+#endif
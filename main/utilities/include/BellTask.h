@@ -13,17 +13,62 @@
 #include <winsock2.h>
 #else
 #include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
 #endif
 
+#include <stddef.h>            // for size_t
+#include <stdint.h>            // for uint32_t, UINT32_MAX
+#include <stdio.h>             // for printf
+#include <algorithm>           // for min, max
+#include <atomic>              // for atomic
+#include <chrono>              // for milliseconds
+#include <condition_variable>  // for condition_variable
 #include <iostream>
+#include <mutex>               // for mutex, scoped_lock, unique_lock
 #include <string>
 
+#include "BellLogger.h"  // for BELL_LOG
+#include "BellTrace.h"   // for BELL_TRACE_THREAD
+
 namespace bell {
 class Task {
  public:
+  /**
+   * Scheduling on desktop platforms, where priority, core and stackSize
+   * are ignored otherwise. ESP32 keeps using those.
+   */
+  enum class Policy {
+    DEFAULT,
+    // SCHED_FIFO / SCHED_RR, needs CAP_SYS_NICE or an rtprio limit
+    FIFO,
+    ROUND_ROBIN,
+    // Time constraint policy on macOS, FIFO elsewhere
+    AUDIO
+  };
+
+  struct SchedulingOptions {
+    Policy policy = Policy::DEFAULT;
+    // For FIFO and ROUND_ROBIN, clamped to what the system allows
+    int realtimePriority = 50;
+    // Pins to core, Linux and Windows only
+    bool pinToCore = false;
+    // Bytes, 0 keeps the system default. stackSize is sized for ESP32 and
+    // far too small for desktop code
+    size_t stackSize = 0;
+    // AUDIO on macOS, how often the task runs and how long it needs
+    uint32_t audioPeriodUs = 10000;
+    uint32_t audioComputationUs = 2500;
+  };
+
   std::string TASK;
   int stackSize, core;
   bool runOnPSRAM;
+  SchedulingOptions scheduling;
   Task(std::string taskName, int stackSize, int priority, int core,
        bool runOnPSRAM = true) {
     this->TASK = taskName;
@@ -31,31 +76,129 @@ class Task {
     this->core = core;
     this->runOnPSRAM = runOnPSRAM;
 #ifdef ESP_PLATFORM
-    this->xStack = NULL;
     this->priority = CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + priority;
     if (this->priority <= ESP_TASK_PRIO_MIN)
       this->priority = ESP_TASK_PRIO_MIN + 1;
-    if (runOnPSRAM) {
-      this->xStack = (StackType_t*)heap_caps_malloc(
-          this->stackSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    }
-#endif
-  }
-  virtual ~Task() {
-#ifdef ESP_PLATFORM
-    if (xStack)
-      heap_caps_free(xStack);
 #endif
   }
+  // Doesn't stop the task, derived classes stop it in their destructor
+  virtual ~Task() {}
 
+  /**
+   * Starts runTask() on its own thread
+   * @returns false if it couldn't, or if the previous run hasn't returned
+   */
   bool startTask() {
+    {
+      std::scoped_lock lock(taskMutex);
+      if (taskRunning) {
+        return false;
+      }
+      taskRunning = true;
+      stopRequested = false;
+    }
+    if (!createTask()) {
+      finishTask();
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * Asks runTask() to return, it learns so from isStopRequested(). Calls
+   * onStopRequested() to wake the task if it's running.
+   */
+  void requestStop() {
+    {
+      std::scoped_lock lock(taskMutex);
+      if (!taskRunning) {
+        return;
+      }
+      stopRequested = true;
+    }
+    onStopRequested();
+  }
+
+  /**
+   * Waits up to timeoutMs for runTask() to return, UINT32_MAX for as long as
+   * it takes. Must not be called from the task itself.
+   * @returns false on timeout, the object must then outlive the task
+   */
+  bool joinTask(uint32_t timeoutMs = UINT32_MAX) {
+    std::unique_lock lock(taskMutex);
+    auto done = [this]() { return !taskRunning; };
+    if (timeoutMs == UINT32_MAX) {
+      taskDone.wait(lock, done);
+      return true;
+    }
+    return taskDone.wait_for(lock, std::chrono::milliseconds(timeoutMs), done);
+  }
+
+  // requestStop(), then joinTask()
+  bool stopTask(uint32_t timeoutMs = UINT32_MAX) {
+    requestStop();
+    return joinTask(timeoutMs);
+  }
+
+  // From startTask() until runTask() returns
+  bool isTaskRunning() {
+    std::scoped_lock lock(taskMutex);
+    return taskRunning;
+  }
+
+ protected:
+  virtual void runTask() = 0;
+
+  /**
+   * Checked by runTask() to return early. Set by requestStop(), cleared by
+   * startTask().
+   */
+  bool isStopRequested() const { return stopRequested; }
+
+  /**
+   * Called by requestStop() from the stopping thread, to give semaphores or
+   * close streams runTask() may be blocked on
+   */
+  virtual void onStopRequested() {}
+
+ private:
+  std::mutex taskMutex;
+  std::condition_variable taskDone;
+  bool taskRunning = false;
+  std::atomic<bool> stopRequested = false;
+
+  // Last access of the task to this, a joined Task may be destroyed after
+  void finishTask() {
+    std::scoped_lock lock(taskMutex);
+    taskRunning = false;
+    taskDone.notify_all();
+  }
+
+  bool createTask() {
 #ifdef ESP_PLATFORM
     if (runOnPSRAM) {
-      xTaskBuffer = (StaticTask_t*)heap_caps_malloc(
-          sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
-      return (xTaskCreateStaticPinnedToCore(
-                  taskEntryFuncPSRAM, this->TASK.c_str(), this->stackSize, this,
-                  this->priority, xStack, xTaskBuffer, this->core) != NULL);
+      // Every run gets its own, the task frees them once it's deleted
+      TaskMemory* memory = (TaskMemory*)heap_caps_malloc(
+          sizeof(TaskMemory), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      if (memory == NULL) {
+        return false;
+      }
+      memory->stack = (StackType_t*)heap_caps_malloc(
+          this->stackSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+      if (memory->stack == NULL) {
+        heap_caps_free(memory);
+        return false;
+      }
+      taskMemory = memory;
+      if (xTaskCreateStaticPinnedToCore(
+              taskEntryFuncPSRAM, this->TASK.c_str(), this->stackSize, this,
+              this->priority, memory->stack, &memory->tcb,
+              this->core) == NULL) {
+        heap_caps_free(memory->stack);
+        heap_caps_free(memory);
+        return false;
+      }
+      return true;
     } else {
       printf("task on internal %s", this->TASK.c_str());
       esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
@@ -70,20 +213,52 @@ class Task {
 #if _WIN32
     thread = CreateThread(NULL, stackSize,
                           (LPTHREAD_START_ROUTINE)taskEntryFunc, this, 0, NULL);
+    if (thread != NULL) {
+      if (scheduling.policy != Policy::DEFAULT) {
+        SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL);
+      }
+      if (scheduling.pinToCore) {
+        SetThreadAffinityMask(thread, (DWORD_PTR)1 << core);
+      }
+    }
     return thread != NULL;
 #else
-    if (!pthread_create(&thread, NULL, taskEntryFunc, this)) {
-        pthread_detach(thread);
-        return true;
+#ifdef ESP_PLATFORM
+    // Attributes would override the esp_pthread_cfg above
+    int err = pthread_create(&thread, NULL, taskEntryFunc, this);
+#else
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (scheduling.stackSize > 0) {
+      pthread_attr_setstacksize(&attr, scheduling.stackSize);
+    }
+    setRealtimeAttributes(&attr);
+    int err = pthread_create(&thread, &attr, taskEntryFunc, this);
+    if (err != 0 && scheduling.policy != Policy::DEFAULT) {
+      // Most likely not allowed to, run with the default policy instead
+      BELL_LOG(info, "task", "%s: real-time scheduling refused, using default",
+               this->TASK.c_str());
+      pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+      err = pthread_create(&thread, &attr, taskEntryFunc, this);
+    }
+    pthread_attr_destroy(&attr);
+#endif
+    if (!err) {
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+      if (scheduling.pinToCore) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+      }
+#endif
+      pthread_detach(thread);
+      return true;
     }
     return false;
 #endif
   }
 
- protected:
-  virtual void runTask() = 0;
-
- private:
 #if _WIN32
   HANDLE thread;
 #else
@@ -91,18 +266,31 @@ class Task {
 #endif
 #ifdef ESP_PLATFORM
   int priority;
-  StaticTask_t* xTaskBuffer;
-  StackType_t* xStack;
+
+  // TCB in internal RAM and stack in PSRAM of a static task. Owned by the
+  // task, it runs on them until it's deleted, after the Task may be gone
+  struct TaskMemory {
+    StaticTask_t tcb;
+    StackType_t* stack;
+  };
+  TaskMemory* taskMemory = NULL;
 
   static void taskEntryFuncPSRAM(void* This) {
     Task* self = (Task*)This;
+    TaskMemory* memory = self->taskMemory;
+    BELL_TRACE_THREAD(self->TASK.c_str());
     self->runTask();
+    // Last access to self, only the locals below from here
+    self->finishTask();
 
     // TCB are cleanup in IDLE task, so give it some time
     TimerHandle_t timer =
-        xTimerCreate("cleanup", pdMS_TO_TICKS(5000), pdFALSE, self->xTaskBuffer,
+        xTimerCreate("cleanup", pdMS_TO_TICKS(5000), pdFALSE, memory,
                      [](TimerHandle_t xTimer) {
-                       heap_caps_free(pvTimerGetTimerID(xTimer));
+                       TaskMemory* owned =
+                           (TaskMemory*)pvTimerGetTimerID(xTimer);
+                       heap_caps_free(owned->stack);
+                       heap_caps_free(owned);
                        xTimerDelete(xTimer, portMAX_DELAY);
                      });
     xTimerStart(timer, portMAX_DELAY);
@@ -111,8 +299,66 @@ class Task {
   }
 #endif
 
+#if !defined(_WIN32) && !defined(ESP_PLATFORM)
+  void setRealtimeAttributes(pthread_attr_t* attr) {
+    int policy;
+    switch (scheduling.policy) {
+      case Policy::FIFO:
+        policy = SCHED_FIFO;
+        break;
+      case Policy::ROUND_ROBIN:
+        policy = SCHED_RR;
+        break;
+      case Policy::AUDIO:
+#ifdef __APPLE__
+        // Set from the thread itself, see taskEntryFunc
+        return;
+#else
+        policy = SCHED_FIFO;
+        break;
+#endif
+      default:
+        return;
+    }
+
+    struct sched_param param = {};
+    param.sched_priority = std::min(
+        std::max(scheduling.realtimePriority, sched_get_priority_min(policy)),
+        sched_get_priority_max(policy));
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, policy);
+    pthread_attr_setschedparam(attr, &param);
+  }
+#endif
+
+#ifdef __APPLE__
+  void setTimeConstraintPolicy() {
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    auto toAbsolute = [&timebase](uint32_t us) {
+      return (uint32_t)((uint64_t)us * 1000 * timebase.denom / timebase.numer);
+    };
+
+    thread_time_constraint_policy_data_t policy;
+    policy.period = toAbsolute(scheduling.audioPeriodUs);
+    policy.computation = toAbsolute(scheduling.audioComputationUs);
+    policy.constraint = policy.period;
+    policy.preemptible = true;
+    thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY,
+                      (thread_policy_t)&policy,
+                      THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+  }
+#endif
+
   static void* taskEntryFunc(void* This) {
+#ifdef __APPLE__
+    if (((Task*)This)->scheduling.policy == Policy::AUDIO) {
+      ((Task*)This)->setTimeConstraintPolicy();
+    }
+#endif
+    BELL_TRACE_THREAD(((Task*)This)->TASK.c_str());
     ((Task*)This)->runTask();
+    ((Task*)This)->finishTask();
     return NULL;
   }
 };
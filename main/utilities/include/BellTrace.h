@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int64_t, uint32_t
+#include <string>    // for string
+
+#include "BellClock.h"  // for nowNs
+
+// Spans each thread keeps, the oldest are overwritten
+#ifndef BELL_TRACE_EVENTS
+#define BELL_TRACE_EVENTS 1024
+#endif
+
+namespace bell {
+/**
+ * Timeline of what the pipeline's threads do: network reads, decodes, DSP
+ * blocks, buffer and sink writes, as spans in the Chrome trace format that
+ * chrome://tracing and ui.perfetto.dev open. Where metrics give how long a
+ * stage takes, the trace shows what ran meanwhile on the other threads,
+ * e.g. the decode a sink starved behind.
+ *
+ * Each thread records into a ring of its own, claimed on its first span,
+ * with relaxed atomics and no lock; a dump copies the rings while they are
+ * written. Span names are string literals, stored by pointer. Without
+ * BELL_TRACE the macros compile to nothing and dumps are empty.
+ */
+class Trace {
+ public:
+  static constexpr size_t EVENTS = BELL_TRACE_EVENTS;
+  // Threads recording at once, spans of any more are dropped
+  static constexpr size_t MAX_THREADS = 32;
+
+  // A span of the calling thread, on bell::clock::nowNs()'s clock
+  static void record(const char* name, int64_t startNs, int64_t endNs);
+  // Names the calling thread in the dumps, bell::Task names its own
+  static void setThreadName(const char* name);
+
+  /**
+   * Every thread's spans as a Chrome trace JSON object, for
+   * BellHTTPServer::registerTrace(). Spans older than about an hour are
+   * misplaced, their start is kept in 32 bit µs
+   */
+  static std::string toJson();
+  // toJson() to a file, @returns false if it can't be written
+  static bool writeFile(const std::string& path);
+  // Forgets the spans recorded so far, e.g. before reproducing an issue
+  static void clear();
+};
+
+// Records the time until it goes out of scope
+class TraceSpan {
+ public:
+  TraceSpan(const char* name) : name(name), start(clock::nowNs()) {}
+  ~TraceSpan() { Trace::record(name, start, clock::nowNs()); }
+
+ private:
+  const char* name;
+  int64_t start;
+};
+}  // namespace bell
+
+#define BELL_TRACE_CONCAT_(a, b) a##b
+#define BELL_TRACE_CONCAT(a, b) BELL_TRACE_CONCAT_(a, b)
+
+#ifdef BELL_TRACE
+// Traces the rest of the enclosing scope, name is "<stage>.<what>"
+#define BELL_TRACE_SCOPE(name) \
+  bell::TraceSpan BELL_TRACE_CONCAT(bellTraceSpan, __LINE__)(name)
+#define BELL_TRACE_THREAD(name) bell::Trace::setThreadName(name)
+#else
+#define BELL_TRACE_SCOPE(name) \
+  do {                         \
+  } while (0)
+#define BELL_TRACE_THREAD(name) \
+  do {                          \
+  } while (0)
+#endif
@@ -21,6 +21,8 @@ namespace bell {
 std::string generateRandomUUID();
 void freeAndNull(void*& ptr);
 std::string getMacAddress();
+// Wall clock time, follows NTP and time changes. Intervals and timestamps
+// compared on the device use bell::clock, see BellClock.h
 struct tv {
   tv() {}
   tv(timeval tv) : sec(tv.tv_sec), usec(tv.tv_usec){};
@@ -30,17 +32,17 @@ struct tv {
 #if _WIN32
     static const uint64_t EPOCH = ((uint64_t)116444736000000000ULL);
 
-    SYSTEMTIME system_time;
     FILETIME file_time;
     uint64_t time;
 
-    GetSystemTime(&system_time);
-    SystemTimeToFileTime(&system_time, &file_time);
+    // Down to the µs, GetSystemTime() only has milliseconds
+    GetSystemTimePreciseAsFileTime(&file_time);
     time = ((uint64_t)file_time.dwLowDateTime);
     time += ((uint64_t)file_time.dwHighDateTime) << 32;
 
+    // In 100 ns units
     timestampNow.sec = (long)((time - EPOCH) / 10000000L);
-    timestampNow.usec = (long)(system_time.wMilliseconds * 1000);
+    timestampNow.usec = (long)((time - EPOCH) % 10000000L / 10);
 #else
     timeval t;
     gettimeofday(&t, NULL);
@@ -60,7 +62,7 @@ struct tv {
     tv result(*this);
     result.sec += other.sec;
     result.usec += other.usec;
-    if (result.usec > 1000000) {
+    if (result.usec >= 1000000) {
       result.sec += result.usec / 1000000;
       result.usec %= 1000000;
     }
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdarg.h>    // for va_list
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint8_t, uint32_t
+#include <stdio.h>     // for FILE
+#include <chrono>              // for system_clock
+#include <condition_variable>  // for condition_variable
+#include <functional>          // for function
+#include <mutex>               // for mutex
+#include <vector>      // for vector
+
+#include "BellLogger.h"  // for AbstractLogger, LogSite
+
+namespace bell {
+/**
+ * Logger writing compact binary records instead of text, for shipping logs
+ * off a device. A record holds the LogSite::id of the call, the time since
+ * the previous record and the raw arguments. Format strings stay behind,
+ * scripts/bell_log_decode.py rebuilds the text from the sources.
+ *
+ * Records are batched. A batch goes to the sink once full, once older than
+ * maxDelayMs when the next record comes in, or on flush(). Each batch
+ * starts with a header carrying its length and absolute time, so batches
+ * decode on their own, e.g. one per MQTT message:
+ *
+ *   new bell::BinaryLogger([&mqtt](const uint8_t* data, size_t len) {
+ *     mqtt.publish("device/log", std::span(data, len));
+ *   });
+ *
+ * Integers are sent as varints, strings up to MAX_STRING bytes, doubles in
+ * host byte order (little endian on every target bell runs on).
+ */
+class BinaryLogger : public bell::AbstractLogger {
+ public:
+  typedef std::function<void(const uint8_t* data, size_t len)> Sink;
+
+  struct Config {
+    // At most 32767, the header has 16 bits for twice that
+    size_t batchSize = 512;
+    uint32_t maxDelayMs = 1000;
+  };
+
+  BinaryLogger(const Sink& sink) : BinaryLogger(Config(), sink) {}
+  BinaryLogger(const Config& config, const Sink& sink);
+
+  // Appends every batch to file
+  static Sink fileSink(FILE* file);
+
+  void debug(const LogSite& site, const char* submodule, const char* format,
+             ...);
+  void error(const LogSite& site, const char* submodule, const char* format,
+             ...);
+  void info(const LogSite& site, const char* submodule, const char* format,
+            ...);
+
+  // Sends the current batch, if any
+  void flush();
+
+  // "BL", version, records length (16 bit), epoch ms (64 bit)
+  static constexpr size_t HEADER_SIZE = 13;
+  static constexpr uint8_t VERSION = 1;
+  static constexpr size_t MAX_STRING = 64;
+  // Argument bytes of a record, the rest is cut
+  static constexpr size_t MAX_ARGS_SIZE = 255;
+
+ private:
+  Config config;
+  Sink sink;
+
+  std::mutex batchMutex;
+  std::vector<uint8_t> batch;
+  std::chrono::system_clock::time_point batchStart, lastRecord;
+  // Batches finished so far, the next one's turn to be sent
+  uint32_t batchesTaken = 0;
+
+  // batchMutex isn't held while sending, batches wait for their turn
+  std::mutex sinkMutex;
+  std::condition_variable sinkTurn;
+  uint32_t batchesSent = 0;
+
+  void write(const LogSite& site, const char* format, va_list args);
+  // Expects batchMutex to be held, hands back the finished batch and its turn
+  std::vector<uint8_t> takeBatch(uint32_t& turn);
+  void send(std::vector<uint8_t>& finished, uint32_t turn);
+};
+}  // namespace bell
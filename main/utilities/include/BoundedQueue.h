@@ -0,0 +1,226 @@
+#pragma once
+
+#include <stdint.h>            // for intptr_t, uint32_t
+#include <atomic>              // for atomic, memory_order
+#include <chrono>              // for steady_clock, milliseconds
+#include <condition_variable>  // for condition_variable
+#include <cstddef>             // for size_t
+#include <memory>              // for unique_ptr
+#include <mutex>               // for mutex, unique_lock
+#include <new>                 // for placement new
+#include <utility>             // for forward, move
+
+namespace bell {
+/**
+ * Bounded multi-producer / multi-consumer queue, the preallocated
+ * alternative to bell::Queue for fan-in from several tasks. Pushing and
+ * popping is lock-free (Vyukov's ring, a sequence number per cell), the
+ * mutex and condition variables are only used by tasks that have to wait.
+ *
+ * Elements only need to be movable. Capacity is rounded up to a power of
+ * two. After shutdown() the blocking calls return false right away, waking
+ * every waiting task, while tryPop() still drains what's left.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  BoundedQueue(size_t capacity) {
+    size_t cellCount = 2;
+    while (cellCount < capacity) {
+      cellCount <<= 1;
+    }
+    mask = cellCount - 1;
+    cells = std::make_unique<Cell[]>(cellCount);
+    for (size_t i = 0; i < cellCount; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~BoundedQueue() {
+    size_t last = enqueuePos.load(std::memory_order_relaxed);
+    for (size_t pos = dequeuePos.load(std::memory_order_relaxed); pos != last;
+         pos++) {
+      reinterpret_cast<T*>(cells[pos & mask].storage)->~T();
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  size_t capacity() const { return mask + 1; }
+
+  // Only a snapshot while other tasks push or pop
+  size_t size() const {
+    size_t first = dequeuePos.load(std::memory_order_acquire);
+    size_t last = enqueuePos.load(std::memory_order_acquire);
+    return last > first ? last - first : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @returns false when the queue is full
+   */
+  template <typename U>
+  bool tryPush(U&& value) {
+    if (!enqueue(std::forward<U>(value))) {
+      return false;
+    }
+    wake(popWaiters, notEmpty);
+    return true;
+  }
+
+  /**
+   * @returns false when the queue is empty
+   */
+  bool tryPop(T& value) {
+    if (!dequeue(value)) {
+      return false;
+    }
+    wake(pushWaiters, notFull);
+    return true;
+  }
+
+  /**
+   * Waits while the queue is full
+   * @returns false after shutdown(), value isn't queued then
+   */
+  template <typename U>
+  bool push(U&& value) {
+    if (tryPush(std::forward<U>(value))) {
+      return true;
+    }
+    // enqueue() only moves from value once it has a cell
+    if (!waitFor(pushWaiters, notFull, UINT32_MAX,
+                 [&]() { return enqueue(std::forward<U>(value)); })) {
+      return false;
+    }
+    wake(popWaiters, notEmpty);
+    return true;
+  }
+
+  /**
+   * Waits up to timeoutMs for an element, UINT32_MAX for as long as it takes
+   * @returns false on timeout and after shutdown()
+   */
+  bool pop(T& value, uint32_t timeoutMs = UINT32_MAX) {
+    if (tryPop(value)) {
+      return true;
+    }
+    if (!waitFor(popWaiters, notEmpty, timeoutMs,
+                 [&]() { return dequeue(value); })) {
+      return false;
+    }
+    wake(pushWaiters, notFull);
+    return true;
+  }
+
+  // Wakes every waiting task, the queue can't be restarted
+  void shutdown() {
+    stopped = true;
+    std::scoped_lock lock(waitMutex);
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+
+  bool isShutdown() const { return stopped; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  // Producers and consumers don't share a cache line
+  alignas(64) std::atomic<size_t> enqueuePos = 0;
+  alignas(64) std::atomic<size_t> dequeuePos = 0;
+
+  alignas(64) std::atomic<bool> stopped = false;
+  std::mutex waitMutex;
+  std::condition_variable notEmpty, notFull;
+  std::atomic<int> popWaiters = 0, pushWaiters = 0;
+
+  // The lock-free part of tryPush(), without waking anyone
+  template <typename U>
+  bool enqueue(U&& value) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Still holds the element of the previous lap
+        return false;
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->storage) T(std::forward<U>(value));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool dequeue(T& value) {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    T* element = reinterpret_cast<T*>(cell->storage);
+    value = std::move(*element);
+    element->~T();
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  void wake(std::atomic<int>& waiters, std::condition_variable& waiting) {
+    // A read-modify-write, not a load: either it sees the increment in
+    // waitFor() or that waiter's attempt sees the cell just written
+    if (waiters.fetch_add(0) > 0) {
+      std::scoped_lock lock(waitMutex);
+      waiting.notify_one();
+    }
+  }
+
+  template <typename Attempt>
+  bool waitFor(std::atomic<int>& waiters, std::condition_variable& waiting,
+               uint32_t timeoutMs, Attempt&& attempt) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeoutMs);
+    std::unique_lock lock(waitMutex);
+    waiters++;
+    bool done = false;
+    auto ready = [&]() {
+      done = !stopped && attempt();
+      return done || stopped;
+    };
+    if (timeoutMs == UINT32_MAX) {
+      waiting.wait(lock, ready);
+    } else {
+      waiting.wait_until(lock, deadline, ready);
+    }
+    waiters--;
+    return done;
+  }
+};
+}  // namespace bell
@@ -1,8 +1,11 @@
 #ifndef BELL_CRYPTO_H
 #define BELL_CRYPTO_H
 
-#include <string>  // for string
-#include <vector>  // for vector
+#include <future>       // for future
+#include <span>         // for span
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <vector>       // for vector
 
 #include <mbedtls/aes.h>  // for mbedtls_aes_context
 #include <mbedtls/md.h>   // for mbedtls_md_context_t
@@ -26,24 +29,49 @@ class CryptoMbedTLS {
   mbedtls_md_context_t sha1Context;
   mbedtls_aes_context aesCtx;
   bool aesCtxInitialized = false;
+  // Key aesCtx was set up with, so repeated calls don't expand it again
+  std::vector<uint8_t> aesKey;
 
  public:
+  static constexpr size_t SHA1_SIZE = 20;
+
   CryptoMbedTLS();
   ~CryptoMbedTLS();
+
+  /*
+   * The span overloads write into caller supplied storage, e.g. a wire
+   * buffer, and throw std::runtime_error when it's too small. The vector
+   * ones wrap them.
+   *
+   * The Async variants run on a shared background task, in order, so the
+   * 768 bit modexps and PBKDF2 iterations stay off the connecting task.
+   */
+
   // Base64
   static std::vector<uint8_t> base64Decode(const std::string& data);
   static std::string base64Encode(const std::vector<uint8_t>& data);
+  // @returns decoded length
+  static size_t base64Decode(std::string_view data, std::span<uint8_t> out);
+  // @returns encoded length, out isn't null terminated
+  static size_t base64Encode(std::span<const uint8_t> data,
+                             std::span<char> out);
 
   // Sha1
   void sha1Init();
   void sha1Update(const std::string& s);
   void sha1Update(const std::vector<uint8_t>& vec);
+  void sha1Update(std::span<const uint8_t> data);
   std::string sha1Final();
   std::vector<uint8_t> sha1FinalBytes();
+  // Writes SHA1_SIZE bytes
+  void sha1Final(std::span<uint8_t> digest);
 
   // HMAC SHA1
   std::vector<uint8_t> sha1HMAC(const std::vector<uint8_t>& inputKey,
                                 const std::vector<uint8_t>& message);
+  // Writes SHA1_SIZE bytes
+  void sha1HMAC(std::span<const uint8_t> inputKey,
+                std::span<const uint8_t> message, std::span<uint8_t> digest);
 
   // AES CTR
   void aesCTRXcrypt(const std::vector<uint8_t>& key, std::vector<uint8_t>& iv,
@@ -52,20 +80,75 @@ class CryptoMbedTLS {
   // AES ECB
   void aesECBdecrypt(const std::vector<uint8_t>& key,
                      std::vector<uint8_t>& data);
+  void aesECBdecrypt(std::span<const uint8_t> key, std::span<uint8_t> data);
 
   // Diffie Hellman
   std::vector<uint8_t> publicKey;
   std::vector<uint8_t> privateKey;
+  // Takes a keypair from prepareDHKeys() when there's one
   void dhInit();
+  /**
+   * Generates DH keypairs ahead of time on the background task, e.g. at
+   * boot, so dhInit() doesn't wait for the modexp. Every dhInit() then
+   * starts preparing the next keypair, keys are never reused.
+   */
+  static void prepareDHKeys();
   std::vector<uint8_t> dhCalculateShared(const std::vector<uint8_t>& remoteKey);
+  // Writes DH_KEY_SIZE bytes
+  void dhCalculateShared(std::span<const uint8_t> remoteKey,
+                         std::span<uint8_t> sharedKey);
+  // Call after dhInit()
+  std::future<std::vector<uint8_t>> dhCalculateSharedAsync(
+      const std::vector<uint8_t>& remoteKey);
 
   // PBKDF2
   std::vector<uint8_t> pbkdf2HmacSha1(const std::vector<uint8_t>& password,
                                       const std::vector<uint8_t>& salt,
                                       int iterations, int digestSize);
+  // Fills all of digest
+  void pbkdf2HmacSha1(std::span<const uint8_t> password,
+                      std::span<const uint8_t> salt, int iterations,
+                      std::span<uint8_t> digest);
+  static std::future<std::vector<uint8_t>> pbkdf2HmacSha1Async(
+      const std::vector<uint8_t>& password, const std::vector<uint8_t>& salt,
+      int iterations, int digestSize);
 
   // Random stuff
-  std::vector<uint8_t> generateVectorWithRandomData(size_t length);
+  static std::vector<uint8_t> generateVectorWithRandomData(size_t length);
+  static void generateRandomData(std::span<uint8_t> out);
+};
+
+/**
+ * AES-CTR keystream keyed once, e.g. per track, decrypting data in place as
+ * it arrives in chunks of any size. mbedtls runs the fastest AES it was built
+ * with: AES-NI or ARMv8 crypto extensions on hosts, the AES peripheral with
+ * DMA on ESP32 (CONFIG_MBEDTLS_HARDWARE_AES). Larger chunks amortize the
+ * per call overhead, the peripheral's in particular.
+ */
+class AESCTRCipher {
+ public:
+  AESCTRCipher(const std::vector<uint8_t>& key, const std::vector<uint8_t>& iv);
+  ~AESCTRCipher();
+
+  AESCTRCipher(const AESCTRCipher&) = delete;
+  AESCTRCipher& operator=(const AESCTRCipher&) = delete;
+
+  // Moves the keystream to offset bytes past the IV
+  void seek(size_t offset);
+  size_t position() { return offset; }
+
+  void xcrypt(uint8_t* data, size_t nbytes);
+
+ private:
+  static constexpr size_t BLOCK_SIZE = 16;
+
+  mbedtls_aes_context ctx;
+  uint8_t iv[BLOCK_SIZE];
+  uint8_t counter[BLOCK_SIZE];
+  uint8_t streamBlock[BLOCK_SIZE];
+  // Used bytes of streamBlock
+  size_t blockOffset = 0;
+  size_t offset = 0;
 };
 
 #define Crypto CryptoMbedTLS
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>            // for size_t
+#include <atomic>              // for atomic
+#include <condition_variable>  // for condition_variable
+#include <deque>               // for deque
+#include <functional>          // for function
+#include <future>              // for future, packaged_task
+#include <memory>              // for make_shared, unique_ptr
+#include <mutex>               // for mutex
+#include <string>              // for string
+#include <type_traits>         // for invoke_result_t
+#include <utility>             // for move
+#include <vector>              // for vector
+
+#include "BellTask.h"  // for Task
+
+namespace bell {
+/**
+ * Fixed pool of worker tasks running short jobs, decoding, prefetching or
+ * crypto, without a bell::Task each.
+ *
+ * Jobs go to one of three lanes, every worker takes REALTIME jobs before
+ * IO ones and IO before BACKGROUND. Each worker has its own queues: jobs
+ * posted from a worker stay on it, others are spread round robin, and a
+ * worker out of jobs steals the newest of another's. Jobs of one lane on
+ * one worker start in the order they were posted.
+ *
+ * Jobs must not block for long, a blocked worker holds its queue back until
+ * someone steals from it. Long running loops still belong in a bell::Task.
+ */
+class Executor {
+ public:
+  enum class Lane { REALTIME = 0, IO = 1, BACKGROUND = 2 };
+  typedef std::function<void()> Job;
+
+  struct Config {
+    size_t workers = 2;
+    int stackSize = 4096 * 4;
+    int priority = 0;
+    // Passed as the workers' bell::Task core, round robin over cores
+    bool pinToCores = false;
+    int cores = 2;
+  };
+
+  Executor() : Executor(Config()) {}
+  Executor(const Config& config);
+  // Waits for running jobs to end, queued ones are dropped
+  ~Executor();
+
+  // Shared pool, started on first use and never destroyed
+  static Executor& instance();
+
+  /**
+   * Queues job, runs it right away when no worker could be started
+   */
+  void post(Lane lane, const Job& job);
+
+  template <typename F>
+  auto submit(Lane lane, F&& job) -> std::future<std::invoke_result_t<F>> {
+    typedef std::invoke_result_t<F> T;
+    // std::function needs a copyable callable
+    auto task = std::make_shared<std::packaged_task<T()>>(std::forward<F>(job));
+    auto future = task->get_future();
+    post(lane, [task]() { (*task)(); });
+    return future;
+  }
+
+  size_t workerCount() { return workers.size(); }
+
+ private:
+  static constexpr size_t LANES = 3;
+
+  class Worker : public bell::Task {
+   public:
+    Worker(Executor& executor, size_t index, int core);
+
+    Executor& executor;
+    size_t index;
+    std::mutex mutex;
+    std::deque<Job> lanes[LANES];
+
+    std::atomic<bool> running = false;
+
+    bool start();
+
+   private:
+    void runTask() override;
+  };
+
+  Config config;
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> nextWorker = 0;
+
+  // Idle workers sleep on it
+  std::mutex idleMutex;
+  std::condition_variable idleCondition;
+  std::atomic<size_t> pending = 0;
+  // Under idleMutex, set once workers is final, the workers wait for it
+  bool started = false;
+
+  // Own queues first, then steals, higher lanes first
+  bool take(Worker& worker, Job& job);
+};
+}  // namespace bell
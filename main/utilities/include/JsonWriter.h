@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint64_t
+#include <ostream>      // for ostream
+#include <string>       // for string
+#include <string_view>  // for string_view
+#include <type_traits>  // for enable_if_t, is_integral_v, is_same_v...
+
+namespace bell {
+/**
+ * Writes JSON as it goes, without building a document first: into a string
+ * kept from one document to the next, or in pieces to an ostream such as a
+ * chunked MGStreamAdapter. Commas and escapes are the writer's, the calls
+ * nest as the document does:
+ *
+ *   JsonWriter json(out);
+ *   json.beginObject().key("volume").value(42).endObject();
+ *
+ * Nesting isn't checked, only its depth is bounded, by MAX_DEPTH.
+ */
+class JsonWriter {
+ public:
+  static constexpr size_t MAX_DEPTH = 64;
+
+  // Appends to out, clear() it between documents to keep its capacity
+  JsonWriter(std::string& out);
+  // Writes to out whenever flushSize bytes are pending, the rest on flush()
+  JsonWriter(std::ostream& out, size_t flushSize = 1024);
+  ~JsonWriter();
+
+  JsonWriter& beginObject();
+  JsonWriter& endObject();
+  JsonWriter& beginArray();
+  JsonWriter& endArray();
+  JsonWriter& key(std::string_view name);
+
+  JsonWriter& value(std::string_view text);
+  JsonWriter& value(const char* text) { return value(std::string_view(text)); }
+  JsonWriter& value(const std::string& text) {
+    return value(std::string_view(text));
+  }
+  JsonWriter& value(bool flag);
+  // NaN and infinities aren't JSON, they come out as null
+  JsonWriter& value(double number);
+  template <typename T, std::enable_if_t<std::is_integral_v<T> &&
+                                              !std::is_same_v<T, bool>,
+                                          int> = 0>
+  JsonWriter& value(T number) {
+    if constexpr (std::is_signed_v<T>) {
+      return integer((long long)number);
+    } else {
+      return integer((unsigned long long)number);
+    }
+  }
+  JsonWriter& null();
+  // Serialized JSON, e.g. a cached fragment, written as it is
+  JsonWriter& raw(std::string_view json);
+
+  // Passes what's pending to the ostream, nothing with a string
+  void flush();
+
+ private:
+  // With an ostream, the pending bytes
+  std::string pending;
+  std::string& out;
+  std::ostream* stream = nullptr;
+  size_t flushSize = 0;
+
+  size_t depth = 0;
+  // A bit per open level, set once it holds an element
+  uint64_t filled = 0;
+  bool afterKey = false;
+
+  // The comma before an element, if it isn't the first of its level
+  void element();
+  void open(char bracket);
+  void close(char bracket);
+  void string(std::string_view text);
+  JsonWriter& integer(long long number);
+  JsonWriter& integer(unsigned long long number);
+  void written();
+};
+}  // namespace bell
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdarg.h>  // for va_list, va_arg
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int64_t, uint8_t, uint64_t
+
+namespace bell {
+/**
+ * printf format walking shared by the deferred loggers, which capture the
+ * arguments of a BELL_LOG call and format them later, or elsewhere.
+ */
+enum class LogLength : uint8_t { NONE, HH, H, L, LL, J, Z, T, LD };
+
+// What a conversion consumes, integers are widened to 64 bits
+enum class LogArgType : uint8_t {
+  INT,
+  UINT,
+  CHAR,
+  DOUBLE,
+  POINTER,
+  STRING,
+  // %n, consumed but never written back
+  WRITEBACK,
+  // Not a conversion, printed as is and consumes nothing
+  NONE
+};
+
+union LogArgValue {
+  int64_t i;
+  uint64_t u;
+  double d;
+  const void* p;
+  const char* s;
+};
+
+// One conversion of a printf format
+struct LogSpec {
+  char flags[6];
+  int width;
+  bool widthStar;
+  int precision;
+  bool precisionStar;
+  LogLength length;
+  char conversion;
+  LogArgType type;
+};
+
+/**
+ * Parses the conversion following a '%'
+ * @returns the character after it
+ */
+const char* parseLogSpec(const char* c, LogSpec& spec);
+
+// Reads the value of spec, not its * width or precision
+LogArgValue readLogArg(const LogSpec& spec, va_list* args);
+
+/**
+ * Formats one value, with width and precision already resolved
+ * @returns what snprintf returns
+ */
+int formatLogArg(char* out, size_t size, const LogSpec& spec,
+                 const LogArgValue& value);
+
+/**
+ * Calls visit(LogArgType, const LogArgValue&) for every argument format
+ * consumes, * widths and precisions included, until it returns false.
+ * %s strings are passed as read, possibly nullptr.
+ */
+template <typename Visitor>
+void readLogArgs(const char* format, va_list* args, Visitor&& visit) {
+  const char* c = format;
+  while (*c) {
+    if (*c++ != '%') {
+      continue;
+    }
+    if (*c == '%') {
+      c++;
+      continue;
+    }
+
+    LogSpec spec;
+    c = parseLogSpec(c, spec);
+    LogArgValue value;
+    if (spec.widthStar) {
+      value.i = va_arg(*args, int);
+      if (!visit(LogArgType::INT, value)) {
+        return;
+      }
+    }
+    if (spec.precisionStar) {
+      value.i = va_arg(*args, int);
+      if (!visit(LogArgType::INT, value)) {
+        return;
+      }
+    }
+    if (spec.type == LogArgType::NONE) {
+      continue;
+    }
+    value = readLogArg(spec, args);
+    if (spec.type != LogArgType::WRITEBACK && !visit(spec.type, value)) {
+      return;
+    }
+  }
+}
+}  // namespace bell
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>  // for min
+#include <cstddef>    // for byte, size_t
+#include <cstring>    // for memcpy
+#include <vector>     // for vector
+
+namespace bell {
+/**
+ * Byte ring that always hands out contiguous read spans. The first maxSpan
+ * bytes of the ring are mirrored past its end, so a span starting anywhere
+ * can run across the wrap point without being compacted. The only copy is the
+ * mirror update, at most maxSpan bytes per lap.
+ *
+ * Not thread-safe, meant to back a single parser.
+ */
+class MirroredRing {
+ public:
+  /**
+   * @param capacity bytes the ring can hold
+   * @param maxSpan longest contiguous span readSpan() guarantees, <= capacity
+   */
+  MirroredRing(size_t capacity, size_t maxSpan)
+      : ringCapacity(capacity),
+        mirrorSize(std::min(maxSpan, capacity)),
+        storage(capacity + mirrorSize) {}
+
+  size_t size() const { return count; }
+
+  size_t capacity() const { return ringCapacity; }
+
+  size_t freeSpace() const { return ringCapacity - count; }
+
+  /**
+   * Returns the contiguous free area at the write position
+   * @param len set to the amount of bytes that can be written
+   */
+  std::byte* writeSpan(size_t& len) {
+    size_t writePos = toIndex(readPos + count);
+    len = std::min(ringCapacity - count, ringCapacity - writePos);
+    return storage.data() + writePos;
+  }
+
+  /**
+   * Publishes len bytes written to the span returned by writeSpan()
+   */
+  void commit(size_t len) {
+    size_t writePos = toIndex(readPos + count);
+    if (writePos < mirrorSize) {
+      memcpy(storage.data() + ringCapacity + writePos,
+             storage.data() + writePos, std::min(len, mirrorSize - writePos));
+    }
+    count += len;
+  }
+
+  /**
+   * Copies data in, as much as fits
+   * @return amount of bytes written
+   */
+  size_t write(const std::byte* data, size_t len) {
+    size_t written = 0;
+    while (written < len && freeSpace() > 0) {
+      size_t spanLen;
+      std::byte* span = writeSpan(spanLen);
+      spanLen = std::min(spanLen, len - written);
+      memcpy(span, data + written, spanLen);
+      commit(spanLen);
+      written += spanLen;
+    }
+    return written;
+  }
+
+  /**
+   * Returns the oldest data as one contiguous span
+   * @param len set to the span length, size() capped to what the mirror covers
+   */
+  std::byte* readSpan(size_t& len) {
+    len = std::min(count, ringCapacity - readPos + mirrorSize);
+    return storage.data() + readPos;
+  }
+
+  void consume(size_t len) {
+    len = std::min(len, count);
+    readPos = toIndex(readPos + len);
+    count -= len;
+  }
+
+  void clear() {
+    readPos = 0;
+    count = 0;
+  }
+
+ private:
+  size_t ringCapacity;
+  size_t mirrorSize;
+  std::vector<std::byte> storage;
+
+  size_t readPos = 0;
+  size_t count = 0;
+
+  size_t toIndex(size_t pos) const {
+    return pos >= ringCapacity ? pos - ringCapacity : pos;
+  }
+};
+}  // namespace bell
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <pb.h>
+#include <pb_decode.h>
+
+#include <functional>  // for function
+#include <string>      // for string
 
 /// Set of helper methods that simplify nanopb usage in C++.
 namespace bell::nanopb {
@@ -12,4 +16,42 @@ bool encodeVector(pb_ostream_t* stream, const pb_field_t* field,
 
 bool encodeBoolean(pb_ostream_t* stream, const pb_field_t* field,
                    void* const* arg);
+
+// Into the std::string arg points to
+bool decodeString(pb_istream_t* stream, const pb_field_t* field, void** arg);
+
+/**
+ * Hands the elements of a repeated submessage field to onElement one at a
+ * time, as they are decoded. The field has to be a callback one, e.g.
+ * "Message.tracks type:FT_CALLBACK" in the .options file.
+ *
+ * ElementDecoder<Track> tracks{Track_fields, [](Track& track) {
+ *   ...
+ *   return true;
+ * }};
+ * tracks.bind(page.tracks);
+ */
+template <typename T>
+struct ElementDecoder {
+  const pb_msgdesc_t* fields;
+  // Element is released after it returns, false stops the decode
+  std::function<bool(T& element)> onElement;
+
+  void bind(pb_callback_t& callback) {
+    callback.funcs.decode = &decode;
+    callback.arg = this;
+  }
+
+  static bool decode(pb_istream_t* stream, const pb_field_t* field,
+                     void** arg) {
+    auto& decoder = *static_cast<ElementDecoder<T>*>(*arg);
+    T element = {};
+    if (!pb_decode(stream, decoder.fields, &element)) {
+      return false;
+    }
+    bool keepGoing = decoder.onElement(element);
+    pb_release(decoder.fields, &element);
+    return keepGoing;
+  }
+};
 }  // namespace bell::nanopb
\ No newline at end of file
@@ -1,20 +1,79 @@
 #pragma once
 
 #include <stdint.h>  // for uint8_t
+#include <stdint.h>  // for SIZE_MAX
 #include <stdio.h>   // for printf
+#include <memory>    // for unique_ptr
+#include <span>      // for span
 #include <string>    // for string
 #include <vector>    // for vector
 
-#include "pb.h"         // for pb_msgdesc_t, pb_bytes_array_t, PB_GET_ERROR
+#include "ByteStream.h"  // for ByteStream
+#include "pb.h"          // for pb_msgdesc_t, pb_bytes_array_t, PB_GET_ERROR
 #include "pb_decode.h"  // for pb_istream_from_buffer, pb_decode, pb_istream_s
 
+namespace bell::nanopb {
+/**
+ * Bump allocator for the strings, bytes and arrays of decoded messages,
+ * freed all at once when the arena is reset or destroyed. A message decoded
+ * into an arena must not go through pb_release() or free() after the
+ * decode, and doesn't outlive the arena.
+ */
+class Arena {
+ public:
+  Arena(size_t blockSize = 1024);
+  ~Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Aligned for any field type
+  void* allocate(size_t size);
+  // Grows the last allocation in place when it can
+  void* reallocate(void* ptr, size_t size);
+  bool owns(const void* ptr) const;
+  // Keeps the first block for the next message
+  void reset();
+
+  // Allocations are routed here by pb_realloc() while a scope exists
+  class Scope {
+   public:
+    Scope(Arena& arena);
+    ~Scope();
+
+   private:
+    Arena* previous;
+  };
+
+ private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+    size_t used;
+  };
+  size_t blockSize;
+  std::vector<Block> blocks;
+  // Start of the last allocation, for in-place growth
+  uint8_t* last = nullptr;
+};
+}  // namespace bell::nanopb
+
+// Sized with pb_get_encoded_size() first, then encoded in place
 std::vector<uint8_t> pbEncode(const pb_msgdesc_t* fields,
                               const void* src_struct);
+// Same, reusing out's capacity
+bool pbEncode(const pb_msgdesc_t* fields, const void* src_struct,
+              std::vector<uint8_t>& out);
 
 pb_bytes_array_t* vectorToPbArray(const std::vector<uint8_t>& vectorToPack);
 
 void packString(char*& dst, std::string stringToPack);
 
+// Same as the above, allocated from the arena instead of malloc()
+pb_bytes_array_t* vectorToPbArray(const std::vector<uint8_t>& vectorToPack,
+                                  bell::nanopb::Arena& arena);
+void packString(char*& dst, const std::string& stringToPack,
+                bell::nanopb::Arena& arena);
+
 std::vector<uint8_t> pbArrayToVector(pb_bytes_array_t* pbArray);
 
 template <typename T>
@@ -44,6 +103,49 @@ void pbDecode(T& result, const pb_msgdesc_t* fields,
   }
 }
 
+/**
+ * Reads a message from stream as nanopb decodes it, instead of buffering it
+ * whole first. Works on sockets, bytes are read until each request is met.
+ * @param size length of the message, when the stream holds more
+ */
+pb_istream_t pb_istream_from_stream(bell::ByteStream& stream,
+                                    size_t size = SIZE_MAX);
+
+/**
+ * Decodes size bytes of stream into result. Combined with the element
+ * callbacks of NanoPBExtensions.h, peak memory is one element, however
+ * long the repeated fields are.
+ */
+template <typename T>
+bool pbDecode(T& result, const pb_msgdesc_t* fields, bell::ByteStream& stream,
+              size_t size) {
+  pb_istream_t istream = pb_istream_from_stream(stream, size);
+
+  if (pb_decode(&istream, fields, &result) == false) {
+    printf("Decode failed: %s\n", PB_GET_ERROR(&istream));
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Decodes into result, with its strings, bytes and arrays allocated from
+ * arena. Nothing to free, the arena releases them in one go.
+ * @returns false on a malformed message, result is then cleared
+ */
+template <typename T>
+bool pbDecode(T& result, const pb_msgdesc_t* fields,
+              std::span<const uint8_t> data, bell::nanopb::Arena& arena) {
+  bell::nanopb::Arena::Scope scope(arena);
+  pb_istream_t stream = pb_istream_from_buffer(data.data(), data.size());
+
+  if (pb_decode(&stream, fields, &result) == false) {
+    printf("Decode failed: %s\n", PB_GET_ERROR(&stream));
+    return false;
+  }
+  return true;
+}
+
 void pbPutString(const std::string& stringToPack, char* dst);
 void pbPutCharArray(const char* stringToPack, char* dst);
 void pbPutBytes(const std::vector<uint8_t>& data, pb_bytes_array_t& dst);
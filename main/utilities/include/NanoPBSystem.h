@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * Replaces nanopb's system header (PB_SYSTEM_HEADER), to route its
+ * allocations through bell: outside of an arena decode they still go to
+ * realloc() and free(), see bell::nanopb::Arena.
+ */
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void* bell_pb_realloc(void* ptr, size_t size);
+void bell_pb_free(void* ptr);
+#ifdef __cplusplus
+}
+#endif
+
+#define pb_realloc(ptr, size) bell_pb_realloc(ptr, size)
+#define pb_free(ptr) bell_pb_free(ptr)
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stddef.h>  // for size_t
+#include <mutex>     // for mutex, scoped_lock
+#include <new>       // for operator new, operator delete, bad_alloc
+
+#include "BellAllocator.h"  // for Allocator
+#include "BellMetrics.h"    // for Metrics, MetricGauge, MemoryAccount
+
+namespace bell {
+/**
+ * Fixed set of slots for objects created and destroyed over and over, e.g.
+ * one per HTTP request. The slots are allocated once, as a single block, on
+ * first use and reused from then on, so a device running for days doesn't
+ * fragment its heap with them. When every slot is taken, or for a larger
+ * derived type, allocations fall back to the heap and are counted.
+ *
+ * Meant to back a class's operator new / delete:
+ *   static void* operator new(size_t size) { return pool().allocate(size); }
+ *   static void operator delete(void* ptr) { pool().release(ptr); }
+ * With BELL_METRICS the slots in use are exported as the gauge "pool.<name>",
+ * its maximum is the high-water mark, and the block as "mem.<name>".
+ */
+template <typename T, size_t Slots>
+class ObjectPool {
+ public:
+  struct Stats {
+    size_t slots;
+    size_t inUse;
+    // Most slots in use at once
+    size_t highWater;
+    // Allocations that went to the heap
+    size_t fallbacks;
+  };
+
+  ObjectPool(const char* name) : memory(name) {
+#ifdef BELL_METRICS
+    gauge = &Metrics::gauge(std::string("pool.") + name);
+#endif
+  }
+
+  ~ObjectPool() { Allocator::release(storage); }
+
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  /**
+   * @returns a free slot when size fits one, heap memory otherwise
+   * @throws std::bad_alloc when the heap allocation fails
+   */
+  void* allocate(size_t size) {
+    {
+      std::scoped_lock lock(mutex);
+      if (Slot* slot = size <= sizeof(Slot) ? takeSlot() : nullptr) {
+        return slot;
+      }
+      fallbacks++;
+    }
+    return ::operator new(size);
+  }
+
+  // Takes memory of allocate() back, nullptr is ignored
+  void release(void* ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    Slot* slot = static_cast<Slot*>(ptr);
+    {
+      std::scoped_lock lock(mutex);
+      if (storage != nullptr && slot >= storage && slot < storage + Slots) {
+        freeSlots[freeCount++] = slot - storage;
+        updateUsage();
+        return;
+      }
+    }
+    ::operator delete(ptr);
+  }
+
+  Stats getStats() {
+    std::scoped_lock lock(mutex);
+    return {Slots, inUse(), highWater, fallbacks};
+  }
+
+ private:
+  struct Slot {
+    alignas(T) unsigned char bytes[sizeof(T)];
+  };
+
+  std::mutex mutex;
+  Slot* storage = nullptr;
+  // Indices of the free slots, a stack so the last freed is reused first
+  size_t freeSlots[Slots];
+  size_t freeCount = 0;
+  size_t highWater = 0;
+  size_t fallbacks = 0;
+  MemoryAccount memory;
+#ifdef BELL_METRICS
+  MetricGauge* gauge;
+#endif
+
+  size_t inUse() const { return storage != nullptr ? Slots - freeCount : 0; }
+
+  // Expects mutex to be held, nullptr when every slot is taken
+  Slot* takeSlot() {
+    if (storage == nullptr) {
+      // Gets its placement from the Allocator's Policy, like any buffer
+      storage = static_cast<Slot*>(Allocator::allocate(
+          sizeof(Slot) * Slots, Allocator::DEFAULT, alignof(Slot)));
+      if (storage == nullptr) {
+        return nullptr;
+      }
+      for (size_t i = 0; i < Slots; i++) {
+        freeSlots[i] = Slots - 1 - i;
+      }
+      freeCount = Slots;
+      memory.resize(sizeof(Slot) * Slots);
+    }
+    if (freeCount == 0) {
+      return nullptr;
+    }
+    Slot* slot = &storage[freeSlots[--freeCount]];
+    updateUsage();
+    return slot;
+  }
+
+  // Expects mutex to be held
+  void updateUsage() {
+    if (inUse() > highWater) {
+      highWater = inUse();
+    }
+#ifdef BELL_METRICS
+    gauge->set((int32_t)inUse());
+#endif
+  }
+};
+}  // namespace bell
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>  // for uint32_t
+#include <atomic>    // for atomic
+#include <memory>    // for shared_ptr
+#include <mutex>     // for mutex, scoped_lock
+#include <thread>    // for yield
+#include <utility>   // for move
+
+namespace bell {
+/**
+ * Read-copy-update pointer for a single real-time reader thread.
+ *
+ * The reader enters a read section through read(), which costs two atomic
+ * increments and never blocks. Writers build a new object off the reader's
+ * thread and publish() it; the previous object is only released once the
+ * reader has left any section that could still be using it.
+ *
+ * Read sections on the same RcuPtr must not nest.
+ */
+template <typename T>
+class RcuPtr {
+ public:
+  RcuPtr(std::shared_ptr<T> initial = nullptr) { publish(std::move(initial)); }
+
+  class ReadGuard {
+   public:
+    ReadGuard(RcuPtr& owner) : owner(owner) {
+      // Odd epoch marks the reader as inside a section
+      owner.readerEpoch.fetch_add(1);
+      ptr = owner.live.load();
+    }
+    ~ReadGuard() { owner.readerEpoch.fetch_add(1); }
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    T* get() const { return ptr; }
+    T* operator->() const { return ptr; }
+    T& operator*() const { return *ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+
+   private:
+    RcuPtr& owner;
+    T* ptr;
+  };
+
+  /**
+   * Reader side. The returned object stays alive until the guard goes out of
+   * scope.
+   */
+  ReadGuard read() { return ReadGuard(*this); }
+
+  /**
+   * Writer side. Swaps in a new object and waits for the reader to finish
+   * with the previous one, never call it from the reader thread.
+   */
+  void publish(std::shared_ptr<T> value) {
+    std::shared_ptr<T> previous;
+    {
+      std::scoped_lock lock(writerMutex);
+      previous = std::move(owned);
+      owned = std::move(value);
+      live.store(owned.get());
+      waitForReader();
+    }
+    // previous is released here, outside of the writer lock
+  }
+
+  /**
+   * Writer side. Returns the currently published object.
+   */
+  std::shared_ptr<T> current() {
+    std::scoped_lock lock(writerMutex);
+    return owned;
+  }
+
+ private:
+  std::mutex writerMutex;
+  std::shared_ptr<T> owned;
+  std::atomic<T*> live = nullptr;
+  std::atomic<uint32_t> readerEpoch = 0;
+
+  void waitForReader() {
+    uint32_t epoch = readerEpoch.load();
+    if ((epoch & 1) == 0) {
+      return;
+    }
+
+    // Reader is inside a section that may have picked up the old pointer
+    while (readerEpoch.load() == epoch) {
+      std::this_thread::yield();
+    }
+  }
+};
+}  // namespace bell
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>   // for atomic, memory_order
+#include <cstddef>  // for size_t
+#include <cstdint>  // for SIZE_MAX
+#include <memory>   // for allocator
+#include <vector>   // for vector
+
+namespace bell {
+/**
+ * Lock-free single-producer / single-consumer ring of fixed-size slots.
+ * Elements are constructed once and reused, the producer fills them in place
+ * through reserve() / commit() and the consumer reads them in place through
+ * peek() / release(). Alignment of T is honoured for every slot, the slots
+ * come from Alloc, e.g. a bell::CapsAllocator placing them in PSRAM.
+ *
+ * clear() may run on any thread. The slot the consumer holds between peek()
+ * and release() is never handed to the producer, even once cleared, so what
+ * the consumer reads in place can't change under it.
+ */
+template <typename T, typename Alloc = std::allocator<T>>
+class SlotRing {
+ public:
+  SlotRing(size_t slots) : slotCount(slots), slots(slots) {}
+
+  /**
+   * @return number of committed slots waiting to be read
+   */
+  size_t size() const {
+    return distance(readPos.load(std::memory_order_acquire),
+                    writePos.load(std::memory_order_acquire));
+  }
+
+  size_t capacity() const { return slotCount; }
+
+  bool empty() const { return size() == 0; }
+
+  bool full() const { return size() == slotCount; }
+
+  /**
+   * Producer side. Returns the next free slot, nullptr when the ring is full.
+   */
+  T* reserve() {
+    size_t writeTo = writePos.load(std::memory_order_relaxed);
+    // Sequentially consistent with peek(), which publishes heldPos before
+    // checking readPos again
+    if (distance(readPos.load(std::memory_order_seq_cst), writeTo) ==
+            slotCount ||
+        heldPos.load(std::memory_order_seq_cst) == toIndex(writeTo)) {
+      return nullptr;
+    }
+    return &slots[toIndex(writeTo)];
+  }
+
+  /**
+   * Producer side. Publishes the slot returned by reserve().
+   */
+  void commit() {
+    size_t writeTo = writePos.load(std::memory_order_relaxed);
+    writePos.store(advance(writeTo), std::memory_order_release);
+  }
+
+  /**
+   * Consumer side. Returns the oldest committed slot, nullptr when empty.
+   */
+  T* peek() {
+    peekPos = readPos.load(std::memory_order_acquire);
+    while (true) {
+      if (peekPos == writePos.load(std::memory_order_acquire)) {
+        heldPos.store(NONE, std::memory_order_relaxed);
+        return nullptr;
+      }
+      heldPos.store(toIndex(peekPos), std::memory_order_seq_cst);
+      // A clear() the producer saw before heldPos was set shows up here
+      size_t current = readPos.load(std::memory_order_seq_cst);
+      if (current == peekPos) {
+        return &slots[toIndex(peekPos)];
+      }
+      peekPos = current;
+    }
+  }
+
+  /**
+   * Consumer side. Hands the slot returned by peek() back to the producer.
+   * @return false if clear() ran in the meantime, what was read from the
+   * slot has been dropped since and should be thrown away
+   */
+  bool release() {
+    size_t readFrom = peekPos;
+    bool released = readPos.compare_exchange_strong(
+        readFrom, advance(peekPos), std::memory_order_release,
+        std::memory_order_relaxed);
+    heldPos.store(NONE, std::memory_order_release);
+    return released;
+  }
+
+  /**
+   * Drops every committed slot. Safe to call from any thread.
+   */
+  void clear() {
+    readPos.store(writePos.load(std::memory_order_acquire),
+                  std::memory_order_release);
+  }
+
+ private:
+  size_t slotCount;
+  std::vector<T, Alloc> slots;
+
+  // Positions are kept in [0, 2 * slotCount) to tell full from empty
+  std::atomic<size_t> readPos = 0;
+  std::atomic<size_t> writePos = 0;
+
+  // Consumer-only, position returned by the last peek()
+  size_t peekPos = 0;
+  // Index of the slot between peek() and release(), kept from the producer
+  static constexpr size_t NONE = SIZE_MAX;
+  std::atomic<size_t> heldPos = NONE;
+
+  size_t distance(size_t from, size_t to) const {
+    return to >= from ? to - from : to + 2 * slotCount - from;
+  }
+  size_t advance(size_t pos) const {
+    return pos + 1 >= 2 * slotCount ? 0 : pos + 1;
+  }
+  size_t toIndex(size_t pos) const {
+    return pos >= slotCount ? pos - slotCount : pos;
+  }
+};
+}  // namespace bell
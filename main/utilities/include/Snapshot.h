@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>     // for size_t
+#include <stdint.h>     // for uint32_t
+#include <string.h>     // for memcpy
+#include <atomic>       // for atomic, atomic_thread_fence, memory_order
+#include <type_traits>  // for is_trivially_copyable_v
+
+namespace bell {
+/**
+ * Single-writer / multi-reader snapshot of a T, e.g. player state the audio
+ * thread updates and HTTP handlers, MQTT publishers or mDNS read. The writer
+ * copies the new state into the oldest of SLOTS buffers and publishes it with
+ * one atomic store, so it never waits on a reader. Readers copy the latest
+ * buffer without taking a lock, and copy again in the rare case the writer
+ * published SLOTS - 1 times during their copy and reused the buffer under
+ * them.
+ *
+ * Unlike TripleBuffer, any number of threads may read. T is copied as bytes,
+ * so it has to be trivially copyable: fixed-size fields, no std::string.
+ */
+template <typename T, size_t SLOTS = 4>
+class Snapshot {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Snapshot copies T as bytes, it must be trivially copyable");
+  static_assert(SLOTS >= 2, "Snapshot needs a slot besides the latest");
+
+ public:
+  Snapshot() : Snapshot(T()) {}
+  Snapshot(const T& initial) {
+    memcpy(&slots[0].value, &initial, sizeof(T));
+  }
+
+  /**
+   * Writer side, one thread only. Wait-free, a copy of value and three
+   * atomic stores
+   */
+  void publish(const T& value) {
+    uint32_t next = version.load(std::memory_order_relaxed) + 1;
+    Slot& slot = slots[next % SLOTS];
+    // Odd while the buffer is rewritten, readers of the previous round
+    // still in it will see the stamp moved and copy again
+    slot.stamp.store((next << 1) | 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&slot.value, &value, sizeof(T));
+    slot.stamp.store(next << 1, std::memory_order_release);
+    version.store(next, std::memory_order_release);
+  }
+
+  /**
+   * Reader side, any thread. Copies the latest published T into out
+   * @returns its version, which grows by one with every publish()
+   */
+  uint32_t read(T& out) const {
+    for (;;) {
+      uint32_t latest = version.load(std::memory_order_acquire);
+      const Slot& slot = slots[latest % SLOTS];
+      uint32_t before = slot.stamp.load(std::memory_order_acquire);
+      memcpy(&out, &slot.value, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (before == latest << 1 &&
+          slot.stamp.load(std::memory_order_relaxed) == before) {
+        return latest;
+      }
+    }
+  }
+
+  T read() const {
+    T out;
+    read(out);
+    return out;
+  }
+
+  /**
+   * Reader side. Copies the latest T only when it's newer than seen, e.g. to
+   * publish changes alone
+   * @returns false when nothing was published since version seen
+   */
+  bool readIfNewer(T& out, uint32_t& seen) const {
+    if (version.load(std::memory_order_acquire) == seen) {
+      return false;
+    }
+    seen = read(out);
+    return true;
+  }
+
+  // Version of the latest publish(), 0 for the initial T
+  uint32_t getVersion() const {
+    return version.load(std::memory_order_acquire);
+  }
+
+ private:
+  struct Slot {
+    // Version written into the buffer shifted by one, the low bit set while
+    // it's being written
+    std::atomic<uint32_t> stamp = 0;
+    T value;
+  };
+
+  Slot slots[SLOTS];
+  std::atomic<uint32_t> version = 0;
+};
+}  // namespace bell
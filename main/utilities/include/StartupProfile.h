@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>    // for size_t
+#include <stdint.h>    // for uint32_t, uint64_t
+#include <functional>  // for function
+#include <string>      // for string
+#include <vector>      // for vector
+
+namespace bell {
+/**
+ * Timeline of the init steps between power-on and the device being ready,
+ * so boot-to-first-sound can be broken down. Steps are timed with a Scope,
+ * or BELL_STARTUP_STEP, and kept in a fixed table; recording one is cheap
+ * enough to leave in release builds.
+ *
+ * The expensive subsystems (TLS random generator and config, certificate
+ * index, codecs) are set up on first use, warmUp() moves that first use to
+ * a background job so the first request doesn't pay for it.
+ */
+class StartupProfile {
+ public:
+  static constexpr size_t MAX_STEPS = 32;
+
+  struct Step {
+    // String literal
+    const char* name;
+    // Since boot on the ESP32, since the process started elsewhere
+    uint32_t startMs;
+    uint32_t durationUs;
+  };
+
+  // Times the rest of the enclosing scope as step name
+  class Scope {
+   public:
+    Scope(const char* name) : name(name), start(nowUs()) {}
+    ~Scope() { record(name, start, nowUs() - start); }
+
+   private:
+    const char* name;
+    uint64_t start;
+  };
+
+  static uint64_t nowUs();
+
+  // Steps past MAX_STEPS are dropped
+  static void record(const char* name, uint64_t startUs, uint64_t durationUs);
+
+  /**
+   * Marks the device as ready, e.g. once it can take a play command, and
+   * logs every step recorded so far. Only the first call counts
+   */
+  static void markReady();
+  // 0 until markReady()
+  static uint32_t getReadyMs();
+
+  static std::vector<Step> getSteps();
+  // {"ready_ms":..,"steps":[{"name":..,"start_ms":..,"duration_us":..}]}
+  static std::string toJson();
+
+  /**
+   * Runs job as step name on the Executor's BACKGROUND lane, e.g.
+   * warmUp("tls", TLSSocket::warmUp). Jobs must be safe to run next to the
+   * first real use, which then simply waits for them or finds them done
+   */
+  static void warmUp(const char* name, const std::function<void()>& job);
+};
+}  // namespace bell
+
+#define BELL_STARTUP_CONCAT_(a, b) a##b
+#define BELL_STARTUP_CONCAT(a, b) BELL_STARTUP_CONCAT_(a, b)
+
+// Times the rest of the enclosing scope
+#define BELL_STARTUP_STEP(name)                                        \
+  bell::StartupProfile::Scope BELL_STARTUP_CONCAT(bellStartupStep, \
+                                                  __LINE__)(name)
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>   // for atomic, memory_order
+#include <cstdint>  // for uint8_t
+
+namespace bell {
+/**
+ * Wait-free single-producer / single-consumer snapshot of a T. The producer
+ * fills the back buffer in place and publishes it by swapping it with the
+ * middle one, the consumer picks the middle one up the same way, so each
+ * side only ever swaps an index. The consumer sees the latest published T,
+ * snapshots it's too slow for are overwritten.
+ */
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() {}
+  // Starts the three buffers as copies of initial, e.g. sized vectors
+  TripleBuffer(const T& initial) : buffers{initial, initial, initial} {}
+
+  /**
+   * Producer side. The buffer to fill, kept across publish() calls until
+   * it's swapped out
+   */
+  T& back() { return buffers[backIndex]; }
+
+  /**
+   * Producer side. Publishes back(), which becomes an older buffer to be
+   * filled again from scratch
+   */
+  void publish() {
+    uint8_t previous =
+        middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+    backIndex = previous & INDEX;
+  }
+
+  /**
+   * Consumer side. Takes the latest published buffer, if there is one
+   * @returns false when nothing was published since the last call
+   */
+  bool update() {
+    if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+      return false;
+    }
+    uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+    frontIndex = previous & INDEX;
+    return true;
+  }
+
+  // Consumer side. The buffer taken by the last update()
+  T& front() { return buffers[frontIndex]; }
+
+ private:
+  static constexpr uint8_t INDEX = 0x03;
+  // Set on the middle index when the producer published it
+  static constexpr uint8_t FRESH = 0x04;
+
+  T buffers[3];
+  uint8_t backIndex = 0;
+  std::atomic<uint8_t> middle = 1;
+  uint8_t frontIndex = 2;
+};
+}  // namespace bell
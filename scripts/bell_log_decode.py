@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""Decodes logs written by bell::BinaryLogger.
+
+The logger only sends the id of each BELL_LOG call site, so the formats are
+recovered from the sources the firmware was built from:
+
+    bell_log_decode.py table --out sites.json main/ ../my-app/src
+    bell_log_decode.py decode --table sites.json log.bin
+
+or in one go, without keeping the table:
+
+    bell_log_decode.py decode --sources main/ ../my-app/src -- log.bin
+
+Several batches may be concatenated in one input, e.g. MQTT payloads
+appended to a file. Site ids hash the file's basename and line, so the line
+numbers must match the ones the firmware was built with.
+"""
+
+import argparse
+import datetime
+import json
+import os
+import re
+import struct
+import sys
+
+SOURCE_EXTENSIONS = (".c", ".cc", ".cpp", ".h", ".hpp")
+HEADER = struct.Struct("<2sBHQ")
+VERSION = 1
+
+LOG_CALL = re.compile(
+    r"BELL_LOG\(\s*(?P<level>error|info|debug)\s*,\s*(?P<submodule>[^,]+?)\s*,"
+    r"\s*(?P<format>(?:\"(?:[^\"\\]|\\.)*\"\s*)+)")
+STRING_PART = re.compile(r"\"((?:[^\"\\]|\\.)*)\"")
+CONVERSION = re.compile(
+    r"%(?P<flags>[-+ #0]*)(?P<width>\*|\d+)?(?:\.(?P<precision>\*|\d*))?"
+    r"(?P<length>hh|h|ll|l|j|z|t|L)?(?P<conversion>.?)", re.S)
+
+
+def site_id(basename, line):
+    """Same as LogSite::hashId()"""
+    value = 2166136261
+    for byte in basename.encode():
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return ((value ^ line) * 16777619) & 0xFFFFFFFF
+
+
+def unescape(literal):
+    return literal.encode("latin-1", "backslashreplace").decode(
+        "unicode_escape")
+
+
+def scan(paths):
+    sites = {}
+    for root in paths:
+        files = [root] if os.path.isfile(root) else [
+            os.path.join(dirpath, name)
+            for dirpath, _, names in os.walk(root) for name in names
+            if name.endswith(SOURCE_EXTENSIONS)
+        ]
+        for path in files:
+            with open(path, encoding="utf-8", errors="replace") as source:
+                text = source.read()
+            basename = os.path.basename(path)
+            for call in LOG_CALL.finditer(text):
+                # GCC's __LINE__ is where the macro name is
+                line = text.count("\n", 0, call.start()) + 1
+                submodule = call.group("submodule")
+                if submodule.startswith('"'):
+                    submodule = unescape(submodule.strip('"'))
+                site = {
+                    "file": path,
+                    "line": line,
+                    "level": call.group("level"),
+                    "submodule": submodule,
+                    "format": "".join(
+                        unescape(part)
+                        for part in STRING_PART.findall(call.group("format"))),
+                }
+                key = site_id(basename, line)
+                if key in sites:
+                    print("warning: %s:%d and %s:%d share an id" %
+                          (path, line, sites[key]["file"], sites[key]["line"]),
+                          file=sys.stderr)
+                sites[key] = site
+    return sites
+
+
+class Reader:
+
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def left(self):
+        return len(self.data) - self.pos
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def varint(self):
+        value, shift = 0, 0
+        while True:
+            byte = self.byte()
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if byte < 0x80:
+                return value
+
+    def zigzag(self):
+        value = self.varint()
+        return (value >> 1) ^ -(value & 1)
+
+    def take(self, size):
+        value = self.data[self.pos:self.pos + size]
+        if len(value) < size:
+            raise IndexError
+        self.pos += size
+        return value
+
+
+def render(fmt, args):
+    """printf of the arguments a record carries, cut where they run out"""
+    out = []
+    pos = 0
+    for conversion in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:conversion.start()])
+        pos = conversion.end()
+        kind = conversion.group("conversion")
+        if kind == "%":
+            out.append("%")
+            continue
+        try:
+            width = conversion.group("width") or ""
+            if width == "*":
+                width = str(args.zigzag())
+            precision = conversion.group("precision")
+            if precision == "*":
+                precision = str(args.zigzag())
+            spec = "%" + conversion.group("flags") + width
+            if precision is not None:
+                spec += "." + precision
+
+            if kind in "di":
+                out.append((spec + "d") % args.zigzag())
+            elif kind in "uoxX":
+                out.append((spec + kind.replace("u", "d")) % args.varint())
+            elif kind == "c":
+                out.append((spec + "c") % args.byte())
+            elif kind in "fFeEgG":
+                value = struct.unpack("<d", args.take(8))[0]
+                out.append((spec + kind) % value)
+            elif kind in "aA":
+                value = struct.unpack("<d", args.take(8))[0]
+                out.append((spec + "s") % value.hex())
+            elif kind == "s":
+                text = args.take(args.byte()).decode("utf-8", "replace")
+                out.append((spec + "s") % text)
+            elif kind == "p":
+                out.append((spec + "s") % hex(args.varint()))
+            elif kind == "n":
+                pass
+            else:
+                out.append(conversion.group(0))
+        except IndexError:
+            # Arguments didn't fit in the record
+            out.append("...")
+            return "".join(out)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def decode(data, sites, out):
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, version, size, start_ms = HEADER.unpack_from(data, pos)
+        if magic != b"BL" or version != VERSION:
+            print("error: no batch at offset %d" % pos, file=sys.stderr)
+            return False
+        pos += HEADER.size
+        records = Reader(data[pos:pos + size])
+        pos += size
+
+        time_ms = start_ms
+        while records.left() > 0:
+            key = struct.unpack("<I", records.take(4))[0]
+            time_ms += records.varint()
+            args = Reader(records.take(records.byte()))
+
+            stamp = datetime.datetime.fromtimestamp(
+                time_ms / 1000, datetime.timezone.utc).strftime(
+                    "%Y-%m-%d %H:%M:%S.%f")[:-3]
+            site = sites.get(key)
+            if site is None:
+                out.write("[%s] ? unknown site %08x\n" % (stamp, key))
+                continue
+            out.write("[%s] %s [%s] %s:%d: %s\n" %
+                      (stamp, site["level"][0].upper(), site["submodule"],
+                       os.path.basename(site["file"]), site["line"],
+                       render(site["format"], args)))
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    table = commands.add_parser("table", help="build a site table")
+    table.add_argument("--out", required=True)
+    table.add_argument("sources", nargs="+")
+
+    decoder = commands.add_parser("decode", help="decode binary logs")
+    decoder.add_argument("--table")
+    decoder.add_argument("--sources", nargs="+")
+    decoder.add_argument("inputs", nargs="*", help="files, stdin if none")
+
+    args = parser.parse_args()
+    if args.command == "table":
+        with open(args.out, "w") as out:
+            json.dump({"%08x" % key: site
+                       for key, site in scan(args.sources).items()},
+                      out, indent=1)
+        return 0
+
+    if args.table:
+        with open(args.table) as table_file:
+            sites = {int(key, 16): site
+                     for key, site in json.load(table_file).items()}
+    elif args.sources:
+        sites = scan(args.sources)
+    else:
+        parser.error("decode needs --table or --sources")
+
+    ok = True
+    for path in args.inputs or ["-"]:
+        if path == "-":
+            data = sys.stdin.buffer.read()
+        else:
+            with open(path, "rb") as source:
+                data = source.read()
+        ok = decode(data, sites, sys.stdout) and ok
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
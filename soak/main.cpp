@@ -0,0 +1,379 @@
+#include <stdio.h>    // for printf, fprintf, fflush, stderr
+#include <stdlib.h>   // for atof, atoi
+#include <string.h>   // for strcmp
+#include <algorithm>  // for max
+#include <atomic>     // for atomic
+#include <map>        // for map
+#include <memory>     // for make_shared, shared_ptr, make_unique
+#include <random>     // for mt19937, uniform_int_distribution
+#include <stdexcept>  // for runtime_error
+#include <string>     // for string
+#include <vector>     // for vector
+
+#ifndef _WIN32
+#include <sys/resource.h>  // for getrusage
+#endif
+
+#include "AudioPipeline.h"       // for AudioPipeline
+#include "BellClock.h"           // for nowNs, nowUs
+#include "BellDSP.h"             // for BellDSP
+#include "BellLogger.h"          // for setDefaultLogger, bellGlobalLogger
+#include "BellTask.h"            // for Task
+#include "BellUtils.h"           // for BELL_SLEEP_MS
+#include "Biquad.h"              // for Biquad
+#include "CentralAudioBuffer.h"  // for CentralAudioBuffer
+#include "DecoderGlobals.h"      // for createDecoders
+#include "EncodedAudioStream.h"  // for EncodedAudioStream
+#include "FileStream.h"          // for FileStream
+#include "Gain.h"                // for Gain
+#include "NullAudioSink.h"       // for NullAudioSink
+
+/**
+ * Runs decode -> buffer -> DSP -> NullAudioSink for hours, with track
+ * switches, seeks and pipeline swaps at random, to catch what only shows
+ * after a long time: leaks, drift, a rare race. Every report gives the
+ * stages' latencies, the sink's underruns and the process' memory peak.
+ *
+ *   bell-soak [-t hours] [-s seed] [-r report seconds] [-f] file...
+ *
+ * -f feeds the sink as fast as it goes instead of in real time. Exits with
+ * 1 if the sink ran dry while a track played.
+ */
+using namespace bell;
+
+namespace {
+struct Options {
+  double hours = 1;
+  uint32_t seed = 1;
+  uint32_t reportSeconds = 60;
+  bool realTime = true;
+  std::vector<std::string> files;
+};
+
+// Requests of the main thread to the decoder
+enum class Request { None, Switch, Seek };
+
+struct Soak {
+  Options options;
+  std::shared_ptr<CentralAudioBuffer> buffer;
+  std::shared_ptr<BellDSP> dsp;
+  NullAudioSink sink;
+
+  std::atomic<Request> request = Request::None;
+  // Set by the player, the next pipeline is built for it
+  std::atomic<uint32_t> sampleRate = 44100;
+  std::atomic<bool> rateChanged = false;
+
+  MetricHistogram decodeNs;
+  MetricHistogram dspNs;
+  // From the PCM entering the buffer to the sink
+  MetricHistogram latencyNs;
+  std::atomic<uint32_t> switches = 0;
+  std::atomic<uint32_t> seeks = 0;
+  std::atomic<uint32_t> swaps = 0;
+  std::atomic<uint32_t> failures = 0;
+
+  Soak(const Options& options)
+      : options(options),
+        sink(NullAudioSink::Config{.realTime = options.realTime}) {
+    buffer = std::make_shared<CentralAudioBuffer>(16);
+    dsp = std::make_shared<BellDSP>(buffer);
+  }
+};
+
+class Decoder : public Task {
+ public:
+  Decoder(Soak& soak)
+      : Task("soak_decoder", 16 * 1024, 5, 0),
+        soak(soak),
+        random(soak.options.seed + 1) {}
+
+ protected:
+  void runTask() override {
+    while (!isStopRequested()) {
+      Request request = soak.request.exchange(Request::None);
+      if (request == Request::Switch || !stream.isReadable()) {
+        if (!open()) {
+          BELL_SLEEP_MS(waitMs);
+          continue;
+        }
+      } else if (request == Request::Seek) {
+        seek();
+      }
+
+      if (left == 0) {
+        int64_t startNs = clock::nowNs();
+        left = stream.read(pcm, sizeof(pcm));
+        soak.decodeNs.record(clock::nowNs() - startNs);
+        offset = 0;
+        if (left == 0) {
+          // End of the track, on to the next one
+          stream.close();
+        }
+        continue;
+      }
+
+      int64_t nowUs = clock::nowUs();
+      size_t written = soak.buffer->writePCM(
+          pcm + offset, left, hash, stream.getSampleRate(),
+          stream.getChannelCount(), stream.getPcmFormat(), nowUs / 1000000,
+          nowUs % 1000000);
+      if (written == 0) {
+        soak.buffer->spaceReady->twait(100);
+      }
+      offset += written;
+      left -= written;
+    }
+  }
+
+ private:
+  static constexpr int64_t waitMs = 100;
+  Soak& soak;
+  std::mt19937 random;
+  EncodedAudioStream stream;
+  size_t hash = 0;
+  uint8_t pcm[4096];
+  size_t offset = 0;
+  size_t left = 0;
+
+  bool open() {
+    auto& files = soak.options.files;
+    const std::string& path =
+        files[std::uniform_int_distribution<size_t>(0, files.size() - 1)(
+            random)];
+    try {
+      if (!stream.openWithStream(std::make_unique<FileStream>(path, "rb"))) {
+        throw std::runtime_error("unsupported format");
+      }
+    } catch (const std::exception& e) {
+      fprintf(stderr, "Cannot play %s: %s\n", path.c_str(), e.what());
+      soak.failures++;
+      return false;
+    }
+    restart();
+    soak.switches++;
+    return true;
+  }
+
+  void seek() {
+    size_t frameSize =
+        pcmBytesPerSample(stream.getPcmFormat()) * stream.getChannelCount();
+    uint32_t rate = stream.getSampleRate();
+    // Unknown lengths seek within the first minute
+    uint32_t lengthMs = 60000;
+    if (frameSize > 0 && rate > 0 && stream.size() > 0) {
+      lengthMs = stream.size() / frameSize * 1000 / rate;
+    }
+    stream.seekToTime(
+        std::uniform_int_distribution<uint32_t>(0, lengthMs)(random));
+    restart();
+    soak.seeks++;
+  }
+
+  // The sink starts over with the next hash, the gap isn't an underrun
+  void restart() {
+    soak.buffer->clearBuffer();
+    hash++;
+    offset = 0;
+    left = 0;
+  }
+};
+
+class Player : public Task {
+ public:
+  Player(Soak& soak) : Task("soak_player", 16 * 1024, 6, 1), soak(soak) {}
+
+ protected:
+  void runTask() override {
+    size_t hash = 0;
+    while (!isStopRequested()) {
+      if (soak.buffer->takeFlush()) {
+        // A seek or a switch, what the sink holds is from before
+        soak.sink.flush();
+      }
+      auto chunk = soak.buffer->readChunk();
+      if (chunk == nullptr || chunk->pcmSize == 0) {
+        soak.buffer->chunkReady->twait(100);
+        continue;
+      }
+      int64_t writtenUs = (int64_t)chunk->sec * 1000000 + chunk->usec;
+      soak.latencyNs.record((clock::nowUs() - writtenUs) * 1000);
+
+      if (chunk->trackHash != hash) {
+        hash = chunk->trackHash;
+        soak.sink.reset();
+      }
+      if (chunk->sampleRate != soak.sampleRate) {
+        // The main thread swaps in a pipeline for the new rate
+        soak.sampleRate = chunk->sampleRate;
+        soak.rateChanged = true;
+      }
+      soak.sink.setFormat(chunk->sampleRate, chunk->channels, chunk->format);
+
+      int64_t startNs = clock::nowNs();
+      size_t bytes = soak.dsp->process(chunk->pcmData, chunk->pcmSize,
+                                       sizeof(chunk->pcmData), chunk->channels,
+                                       chunk->sampleRate, chunk->format);
+      soak.dspNs.record(clock::nowNs() - startNs);
+      soak.sink.feedPCMFrames(chunk->pcmData, bytes);
+    }
+  }
+
+ private:
+  Soak& soak;
+};
+}  // namespace
+
+// A gain, or up to four random EQ bands per channel
+static std::shared_ptr<AudioPipeline> makePipeline(std::mt19937& random,
+                                                   uint32_t sampleRate) {
+  auto pipeline = std::make_shared<AudioPipeline>();
+  auto uniform = [&](float min, float max) {
+    return std::uniform_real_distribution<float>(min, max)(random);
+  };
+  if (random() % 2 == 0) {
+    auto gain = std::make_shared<Gain>();
+    gain->configure({0, 1}, uniform(-12, 0));
+    pipeline->addTransform(gain);
+  } else {
+    int bands = random() % 5;
+    for (int channel = 0; channel < 2; channel++) {
+      for (int i = 0; i < bands; i++) {
+        auto biquad = std::make_shared<Biquad>();
+        biquad->channel = channel;
+        biquad->sampleRateChanged(sampleRate);
+        std::map<std::string, float> config = {{"freq", uniform(40, 16000)},
+                                               {"q", 0.707f},
+                                               {"gain", uniform(-6, 6)}};
+        biquad->configure(Biquad::Type::Peaking, config);
+        pipeline->addTransform(biquad);
+      }
+    }
+  }
+  pipeline->sampleRateChanged(sampleRate);
+  return pipeline;
+}
+
+// Peak resident memory in KiB, 0 where unknown
+static long peakMemoryKiB() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static void reportHistogram(const char* name, const MetricHistogram& ns) {
+  printf("  %-9s p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms  (%llu)\n", name,
+         ns.getQuantile(0.5f) / 1e6, ns.getQuantile(0.99f) / 1e6,
+         ns.getMax() / 1e6, (unsigned long long)ns.getCount());
+}
+
+static void report(Soak& soak, int64_t elapsedS) {
+  NullAudioSink::Stats stats = soak.sink.getStats();
+  printf("[%lld:%02lld:%02lld] %llu frames, %u underruns (%llu frames), "
+         "%u switches, %u seeks, %u swaps, %u failures\n",
+         (long long)(elapsedS / 3600), (long long)(elapsedS / 60 % 60),
+         (long long)(elapsedS % 60), (unsigned long long)stats.frames,
+         (unsigned)stats.underruns, (unsigned long long)stats.underrunFrames,
+         (unsigned)soak.switches, (unsigned)soak.seeks, (unsigned)soak.swaps,
+         (unsigned)soak.failures);
+  reportHistogram("decode", soak.decodeNs);
+  reportHistogram("dsp", soak.dspNs);
+  reportHistogram("latency", soak.latencyNs);
+  reportHistogram("interval", soak.sink.getIntervals());
+  printf("  peak memory %ld KiB\n", peakMemoryKiB());
+  fflush(stdout);
+}
+
+static bool parse(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "-t") == 0 && hasValue) {
+      options.hours = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0 && hasValue) {
+      options.seed = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && hasValue) {
+      options.reportSeconds = std::max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "-f") == 0) {
+      options.realTime = false;
+    } else if (argv[i][0] == '-') {
+      return false;
+    } else {
+      options.files.push_back(argv[i]);
+    }
+  }
+  return !options.files.empty();
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parse(argc, argv, options)) {
+    fprintf(stderr,
+            "Usage: %s [-t hours] [-s seed] [-r report seconds] [-f] "
+            "file...\n",
+            argv[0]);
+    return 2;
+  }
+  bell::setDefaultLogger();
+  // Containers log every open
+  bell::bellGlobalLogger->setLevel(BELL_LOG_LEVEL_ERROR);
+  bell::createDecoders();
+
+  Soak soak(options);
+  std::mt19937 random(options.seed);
+  Decoder decoder(soak);
+  Player player(soak);
+  decoder.startTask();
+  player.startTask();
+
+  // Events every 2 to 30 s, half of them switches
+  auto nextEventMs = [&]() {
+    return std::uniform_int_distribution<int64_t>(2000, 30000)(random);
+  };
+  int64_t startMs = clock::nowNs() / 1000000;
+  int64_t endMs = startMs + (int64_t)(options.hours * 3600000);
+  int64_t eventMs = startMs + nextEventMs();
+  int64_t reportMs = startMs + options.reportSeconds * 1000;
+  int64_t tickMs = 100;
+
+  for (int64_t nowMs = startMs; nowMs < endMs;
+       nowMs = clock::nowNs() / 1000000) {
+    if (soak.rateChanged.exchange(false)) {
+      soak.dsp->applyPipeline(makePipeline(random, soak.sampleRate));
+    }
+    if (nowMs >= eventMs) {
+      switch (random() % 4) {
+        case 0:
+        case 1:
+          soak.request = Request::Switch;
+          break;
+        case 2:
+          soak.request = Request::Seek;
+          break;
+        default:
+          soak.dsp->applyPipeline(makePipeline(random, soak.sampleRate));
+          soak.swaps++;
+      }
+      eventMs = nowMs + nextEventMs();
+    }
+    if (nowMs >= reportMs) {
+      report(soak, (nowMs - startMs) / 1000);
+      reportMs += options.reportSeconds * 1000;
+    }
+    BELL_SLEEP_MS(tickMs);
+  }
+
+  decoder.stopTask();
+  player.stopTask();
+  report(soak, (clock::nowNs() / 1000000 - startMs) / 1000);
+  return soak.sink.getStats().underruns > 0 ? 1 : 0;
+}
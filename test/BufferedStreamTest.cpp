@@ -0,0 +1,69 @@
+#include <stdint.h>  // for SIZE_MAX
+#include <stdlib.h>  // for _Exit
+#include <string.h>  // for memset
+#include <chrono>    // for seconds
+#include <future>    // for async, future_status
+#include <memory>    // for make_shared
+
+#include "BufferedStream.h"  // for BufferedStream
+#include "ByteStream.h"      // for ByteStream
+#include "Test.h"            // for BELL_CHECK, failures
+
+// Endless source answering every read in full, right away
+class EndlessStream : public bell::ByteStream {
+ public:
+  size_t read(uint8_t* buf, size_t nbytes) override {
+    memset(buf, 0x55, nbytes);
+    total += nbytes;
+    return nbytes;
+  }
+  size_t skip(size_t nbytes) override { return nbytes; }
+  size_t position() override { return total; }
+  size_t size() override { return SIZE_MAX; }
+  void close() override {}
+
+ private:
+  size_t total = 0;
+};
+
+// Runs read on another thread, a hung read ends the test as failed
+static size_t readWithin(BufferedStream& stream, uint8_t* buf, size_t len) {
+  auto result =
+      std::async(std::launch::async, [&]() { return stream.read(buf, len); });
+  if (result.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+    printf("read() never returned\n");
+    _Exit(1);
+  }
+  return result.get();
+}
+
+// A ready threshold the fill task can't reach used to keep the reader
+// waiting forever
+static void oversizedReadyThreshold() {
+  const uint32_t bufferSize = 64 * 1024;
+  BufferedStream stream("test_stream", bufferSize, 16 * 1024, 8 * 1024,
+                        bufferSize, bufferSize, true);
+  stream.open(std::make_shared<EndlessStream>());
+
+  uint8_t buf[1024];
+  BELL_CHECK(readWithin(stream, buf, sizeof(buf)) == sizeof(buf));
+  BELL_CHECK(buf[0] == 0x55);
+  stream.close();
+}
+
+static void readyThresholdWithinReach() {
+  BufferedStream stream("test_stream", 64 * 1024, 16 * 1024, 8 * 1024,
+                        16 * 1024, 8 * 1024, true);
+  stream.open(std::make_shared<EndlessStream>());
+
+  uint8_t buf[1024];
+  BELL_CHECK(readWithin(stream, buf, sizeof(buf)) == sizeof(buf));
+  BELL_CHECK(stream.isReady());
+  stream.close();
+}
+
+int main() {
+  oversizedReadyThreshold();
+  readyThresholdWithinReach();
+  return bell::test::failures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>  // for malloc, free
+#include <string.h>  // for memcpy
+#include <atomic>    // for atomic, memory_order_relaxed
+#include <cmath>     // for sin, M_PI
+#include <map>       // for map
+#include <memory>    // for make_shared, shared_ptr
+#include <new>       // for bad_alloc, nothrow_t
+#include <string>    // for string
+#include <vector>    // for vector
+
+#include "AudioPipeline.h"  // for AudioPipeline
+#include "BellDSP.h"        // for BellDSP
+#include "BellLogger.h"     // for setDefaultLogger
+#include "Biquad.h"         // for Biquad
+#include "Compressor.h"     // for Compressor
+#include "Gain.h"           // for Gain
+#include "Resampler.h"      // for Resampler
+#include "StreamInfo.h"     // for PcmFormat
+#include "Test.h"           // for BELL_CHECK, failures
+
+// Every operator new of the process, as bench/Allocations.cpp counts them
+static std::atomic<uint64_t> allocationCount = 0;
+
+void* operator new(size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size > 0 ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+static const uint32_t SAMPLE_RATE = 44100;
+static const size_t FRAMES = 1024;
+// Calls before counting, a plan or a carry may be set up by the first ones
+static const int WARMUP_CALLS = 4;
+static const int COUNTED_CALLS = 64;
+
+static std::shared_ptr<bell::Biquad> makeBiquad(int channel, float freq) {
+  auto biquad = std::make_shared<bell::Biquad>();
+  biquad->channel = channel;
+  biquad->sampleRateChanged(SAMPLE_RATE);
+  std::map<std::string, float> config = {
+      {"freq", freq}, {"q", 0.707f}, {"gain", 3.0f}};
+  biquad->configure(bell::Biquad::Type::Peaking, config);
+  return biquad;
+}
+
+// Once running, process() must not go through the heap
+static void steadyState(const char* name,
+                        std::shared_ptr<bell::AudioPipeline> pipeline,
+                        bell::PcmFormat format = bell::PcmFormat::INT16) {
+  std::vector<int16_t> tone(FRAMES * 2);
+  for (size_t i = 0; i < FRAMES; i++) {
+    tone[i * 2] = tone[i * 2 + 1] =
+        (int16_t)(16383 * sin(2 * M_PI * 1000 * i / SAMPLE_RATE));
+  }
+  std::vector<uint8_t> work(tone.size() * sizeof(int16_t) * 4);
+  size_t bytes = tone.size() * sizeof(int16_t);
+
+  bell::BellDSP dsp(nullptr);
+  dsp.applyPipeline(pipeline);
+  pipeline->sampleRateChanged(SAMPLE_RATE);
+
+  auto run = [&]() {
+    memcpy(work.data(), tone.data(), bytes);
+    dsp.process(work.data(), bytes, work.size(), 2, SAMPLE_RATE, format);
+  };
+  for (int i = 0; i < WARMUP_CALLS; i++) {
+    run();
+  }
+  uint64_t before = allocationCount.load(std::memory_order_relaxed);
+  for (int i = 0; i < COUNTED_CALLS; i++) {
+    run();
+  }
+  uint64_t allocations =
+      allocationCount.load(std::memory_order_relaxed) - before;
+  if (allocations != 0) {
+    printf("%s: %llu allocations\n", name, (unsigned long long)allocations);
+  }
+  BELL_CHECK(allocations == 0);
+}
+
+int main() {
+  bell::setDefaultLogger();
+
+  steadyState("passthrough", std::make_shared<bell::AudioPipeline>());
+
+  auto gain = std::make_shared<bell::AudioPipeline>();
+  auto gainTransform = std::make_shared<bell::Gain>();
+  gainTransform->configure({0, 1}, -6.0f);
+  gain->addTransform(gainTransform);
+  steadyState("gain", gain);
+
+  auto eq = std::make_shared<bell::AudioPipeline>();
+  for (int channel = 0; channel < 2; channel++) {
+    for (float freq : {60.0f, 1000.0f, 12000.0f}) {
+      eq->addTransform(makeBiquad(channel, freq));
+    }
+  }
+  steadyState("eq", eq);
+  steadyState("eq_int24", eq, bell::PcmFormat::INT24_IN_32);
+
+  auto compressor = std::make_shared<bell::AudioPipeline>();
+  auto compressorTransform = std::make_shared<bell::Compressor>();
+  compressorTransform->configure({0, 1}, 5, 100, -20, 4, 0);
+  compressor->addTransform(compressorTransform);
+  steadyState("compressor", compressor);
+
+  auto resampler = std::make_shared<bell::AudioPipeline>();
+  auto resamplerTransform = std::make_shared<bell::Resampler>();
+  resamplerTransform->configure(48000);
+  resampler->addTransform(resamplerTransform);
+  steadyState("resampler", resampler);
+
+  return bell::test::failures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#include <inttypes.h>  // for PRIx64
+#include <stdio.h>     // for printf, fopen, fread, fclose
+#include <filesystem>  // for path, temp_directory_path, remove
+#include <fstream>     // for ifstream
+#include <map>         // for map
+#include <sstream>     // for istringstream
+#include <string>      // for string, getline
+#include <vector>      // for vector
+
+#include "BellLogger.h"       // for setDefaultLogger, bellGlobalLogger
+#include "CodecBufferPool.h"  // for CodecBufferPool
+#include "CodecType.h"        // for AudioCodec
+#include "DecoderGlobals.h"   // for createDecoders
+#include "FileAudioSink.h"    // for FileAudioSink
+#include "OfflineRenderer.h"  // for OfflineRenderer
+#include "Test.h"             // for BELL_CHECK, failures
+
+// What ctest takes for a skipped test, when no corpus is configured
+static const int SKIPPED = 77;
+
+static const char* codecName(bell::AudioCodec codec) {
+  switch (codec) {
+    case bell::AudioCodec::AAC:
+      return "aac";
+    case bell::AudioCodec::MP3:
+      return "mp3";
+    case bell::AudioCodec::VORBIS:
+      return "vorbis";
+    case bell::AudioCodec::OPUS:
+      return "opus";
+    case bell::AudioCodec::FLAC:
+      return "flac";
+    case bell::AudioCodec::ALAC:
+      return "alac";
+    default:
+      return "unknown";
+  }
+}
+
+// FNV-1a of a whole file, the same on every platform
+static uint64_t hashFile(const std::string& path) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return 0;
+  }
+  uint8_t buf[16384];
+  while (size_t len = fread(buf, 1, sizeof(buf), file)) {
+    for (size_t i = 0; i < len; i++) {
+      hash = (hash ^ buf[i]) * 0x100000001b3ull;
+    }
+  }
+  fclose(file);
+  return hash;
+}
+
+// Lines of "<file name> <hash>", # starts a comment
+static std::map<std::string, uint64_t> readManifest(const std::string& path) {
+  std::map<std::string, uint64_t> golden;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string name, hash;
+    if (line.empty() || line[0] == '#' || !(fields >> name >> hash)) {
+      continue;
+    }
+    golden[name] = std::stoull(hash, nullptr, 16);
+  }
+  return golden;
+}
+
+/**
+ * Renders every file given after the manifest through OfflineRenderer, as
+ * raw PCM, and checks it against the manifest's hash. Files without one
+ * print theirs, to write the manifest from a known good build. Decode
+ * speeds are printed per codec, so one run also tells how the platform
+ * fares.
+ */
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    printf("No corpus, set BELL_GOLDEN_CORPUS and BELL_GOLDEN_MANIFEST\n");
+    return SKIPPED;
+  }
+  bell::setDefaultLogger();
+  // Containers log every open
+  bell::bellGlobalLogger->setLevel(BELL_LOG_LEVEL_ERROR);
+  bell::createDecoders();
+
+  auto golden = readManifest(argv[1]);
+  auto outputDir = std::filesystem::temp_directory_path();
+  std::vector<bell::OfflineRenderer::Job> jobs;
+  std::vector<std::string> names;
+  for (int i = 2; i < argc; i++) {
+    std::string name = std::filesystem::path(argv[i]).filename().string();
+    bell::OfflineRenderer::Job job;
+    job.input = argv[i];
+    job.output = (outputDir / ("bell_golden_" + name + ".raw")).string();
+    job.container = FileAudioSink::Container::RAW;
+    jobs.push_back(job);
+    names.push_back(name);
+  }
+
+  auto results = bell::OfflineRenderer::renderAll(jobs);
+  for (size_t i = 0; i < jobs.size(); i++) {
+    auto& result = results[i];
+    std::string label = std::string(codecName(result.codec)) + "/" + names[i];
+    if (!result.ok) {
+      printf("%-36s cannot be rendered: %s\n", label.c_str(),
+             result.error.c_str());
+      BELL_CHECK(result.ok);
+      continue;
+    }
+
+    uint64_t hash = hashFile(jobs[i].output);
+    std::filesystem::remove(jobs[i].output);
+    printf("%-36s %8.1fx real time, pcm %016" PRIx64, label.c_str(),
+           result.speed(), hash);
+    auto expected = golden.find(names[i]);
+    if (expected == golden.end()) {
+      printf(", no golden hash\n");
+      continue;
+    }
+    printf(expected->second == hash ? " ok\n" : " MISMATCH\n");
+    BELL_CHECK(expected->second == hash);
+  }
+  // The codecs' buffers stay pooled otherwise
+  bell::CodecBufferPool::trim();
+  return bell::test::failures() > 0 ? 1 : 0;
+}
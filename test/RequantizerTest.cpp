@@ -0,0 +1,72 @@
+#include <stdint.h>  // for int16_t, int32_t
+#include <cmath>     // for sin, M_PI
+#include <vector>    // for vector
+
+#include "Requantizer.h"       // for Requantizer
+#include "SampleConversion.h"  // for deinterleaveInt16
+#include "StreamInfo.h"        // for PcmFormat
+#include "Test.h"              // for BELL_CHECK, failures
+
+static const size_t FRAMES = 1024;
+
+static std::vector<int16_t> makeTone() {
+  std::vector<int16_t> tone(FRAMES * 2);
+  for (size_t i = 0; i < FRAMES; i++) {
+    tone[i * 2] = (int16_t)(8000 * sin(2 * M_PI * 440 * i / 44100));
+    tone[i * 2 + 1] = (int16_t)(-3000 * sin(2 * M_PI * 1000 * i / 44100));
+  }
+  return tone;
+}
+
+// 16-bit input nothing touched comes out as it went in, dither or not
+static void unityIsBitExact(bell::Requantizer::Mode mode) {
+  std::vector<int16_t> tone = makeTone();
+  std::vector<float> left(FRAMES), right(FRAMES);
+  float* planes[] = {left.data(), right.data()};
+  bell::dsp::deinterleaveInt16(tone.data(), planes, 2, FRAMES);
+
+  bell::Requantizer requantizer;
+  requantizer.configure(mode, 2);
+  std::vector<int16_t> out(tone.size());
+  requantizer.interleave(planes, bell::PcmFormat::INT16, (uint8_t*)out.data(),
+                         2, FRAMES);
+  BELL_CHECK(out == tone);
+
+  // Q1.31 too
+  std::vector<int32_t> fixedLeft(FRAMES), fixedRight(FRAMES);
+  int32_t* fixedPlanes[] = {fixedLeft.data(), fixedRight.data()};
+  bell::dsp::deinterleaveInt16(tone.data(), fixedPlanes, 2, FRAMES);
+  requantizer.interleave(fixedPlanes, bell::PcmFormat::INT16,
+                         (uint8_t*)out.data(), 2, FRAMES);
+  BELL_CHECK(out == tone);
+}
+
+// Gain moves samples off the 16-bit steps, those get dithered
+static void gainIsDithered() {
+  std::vector<int16_t> tone = makeTone();
+  std::vector<float> left(FRAMES), right(FRAMES);
+  float* planes[] = {left.data(), right.data()};
+  bell::dsp::deinterleaveInt16(tone.data(), planes, 2, FRAMES);
+  for (size_t i = 0; i < FRAMES; i++) {
+    left[i] *= 0.5f;
+    right[i] *= 0.5f;
+  }
+
+  std::vector<int16_t> rounded(tone.size()), dithered(tone.size());
+  bell::dsp::interleaveInt16(planes, rounded.data(), 2, FRAMES);
+  bell::Requantizer requantizer;
+  requantizer.configure(bell::Requantizer::Mode::TPDF, 2);
+  requantizer.interleave(planes, bell::PcmFormat::INT16,
+                         (uint8_t*)dithered.data(), 2, FRAMES);
+  BELL_CHECK(dithered != rounded);
+  for (size_t i = 0; i < tone.size(); i++) {
+    BELL_CHECK(dithered[i] - rounded[i] >= -1 && dithered[i] - rounded[i] <= 1);
+  }
+}
+
+int main() {
+  unityIsBitExact(bell::Requantizer::Mode::TPDF);
+  unityIsBitExact(bell::Requantizer::Mode::NOISE_SHAPED);
+  gainIsDithered();
+  return bell::test::failures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+#include <stdint.h>  // for int16_t, uint8_t
+#include <vector>    // for vector
+
+#include "SampleConversion.h"  // for deinterleaveInt16, interleaveInt16
+#include "SampleFormat.h"      // for S16BE, deinterleave, interleave
+#include "Test.h"              // for BELL_CHECK, failures
+
+// Every int16 value, spread over channels planes
+static std::vector<int16_t> everyValue(size_t channels) {
+  std::vector<int16_t> pcm;
+  for (int32_t value = -32768; value <= 32767; value++) {
+    pcm.push_back((int16_t)value);
+  }
+  // Whole frames, the last one padded with zeros
+  pcm.resize((pcm.size() + channels - 1) / channels * channels, 0);
+  return pcm;
+}
+
+static size_t mismatches(const std::vector<int16_t>& a,
+                         const std::vector<int16_t>& b) {
+  size_t count = 0;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i] != b[i]) {
+      if (count == 0) {
+        printf("sample %zu: %d came back as %d\n", i, a[i], b[i]);
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+// Unity gain playback has to be bit exact: int16 to float and back
+static void roundTrip(size_t channels) {
+  std::vector<int16_t> pcm = everyValue(channels);
+  size_t frames = pcm.size() / channels;
+
+  std::vector<std::vector<float>> planes(channels, std::vector<float>(frames));
+  std::vector<float*> planePtrs;
+  for (auto& plane : planes) {
+    planePtrs.push_back(plane.data());
+  }
+
+  std::vector<int16_t> out(pcm.size());
+  bell::dsp::deinterleaveInt16(pcm.data(), planePtrs.data(), channels,
+                               frames);
+  bell::dsp::interleaveInt16(planePtrs.data(), out.data(), channels, frames);
+  BELL_CHECK(mismatches(pcm, out) == 0);
+
+  // Formats without a kernel of their own round the same way
+  std::vector<int16_t> swapped(pcm.size());
+  bell::dsp::interleave<bell::dsp::S16BE>(
+      planePtrs.data(), (uint8_t*)swapped.data(), channels, frames);
+  bell::dsp::deinterleave<bell::dsp::S16BE>(
+      (const uint8_t*)swapped.data(), planePtrs.data(), channels, frames);
+  bell::dsp::interleaveInt16(planePtrs.data(), out.data(), channels, frames);
+  BELL_CHECK(mismatches(pcm, out) == 0);
+}
+
+static void clipping() {
+  float left[] = {2.0f, -2.0f, 1.0f, -1.0f};
+  float right[] = {0.5f / 32767, -0.5f / 32767, 1.5f / 32767, 0.0f};
+  const float* planes[] = {left, right};
+  int16_t out[8];
+  bell::dsp::interleaveInt16(planes, out, 2, 4);
+  BELL_CHECK(out[0] == 32767);
+  BELL_CHECK(out[2] == -32768);
+  BELL_CHECK(out[4] == 32767);
+  BELL_CHECK(out[6] == -32767);
+  // Halves round to even
+  BELL_CHECK(out[1] == 0);
+  BELL_CHECK(out[3] == 0);
+  BELL_CHECK(out[5] == 2);
+}
+
+int main() {
+  // Stereo goes through the vector kernels, the others through the scalar
+  // loop
+  roundTrip(2);
+  roundTrip(1);
+  roundTrip(3);
+  clipping();
+  return bell::test::failures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>  // for printf
+
+namespace bell::test {
+// Failed checks of the test so far, main() returns it
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+}  // namespace bell::test
+
+// Reports a failed condition and carries on with the test
+#define BELL_CHECK(condition)                                              \
+  do {                                                                     \
+    if (!(condition)) {                                                    \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      bell::test::failures()++;                                            \
+    }                                                                      \
+  } while (0)